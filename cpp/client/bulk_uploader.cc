@@ -0,0 +1,143 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "client/bulk_uploader.h"
+
+#include <glog/logging.h>
+
+using std::string;
+
+BulkUploader::BulkUploader(const HTTPLogClient &client, int parallel,
+                           int max_retries)
+    : server_(client.Server()),
+      max_retries_(max_retries),
+      multi_(CHECK_NOTNULL(curl_multi_init())),
+      requests_(parallel) {
+  CHECK_GT(parallel, 0);
+  CHECK_GE(max_retries, 0);
+  // Don't open more connections than requests.
+  curl_multi_setopt(multi_, CURLMOPT_MAXCONNECTS, static_cast<long>(parallel));
+  for (size_t i = 0; i < requests_.size(); ++i)
+    requests_[i].handle = CHECK_NOTNULL(curl_easy_init());
+}
+
+BulkUploader::~BulkUploader() {
+  for (size_t i = 0; i < requests_.size(); ++i) {
+    if (requests_[i].busy)
+      curl_multi_remove_handle(multi_, requests_[i].handle);
+    curl_easy_cleanup(requests_[i].handle);
+  }
+  curl_multi_cleanup(multi_);
+}
+
+void BulkUploader::Upload(Source *source, Callback *callback) {
+  bool more = true;
+  size_t running = 0;
+  for (size_t i = 0; i < requests_.size() && more; ++i) {
+    requests_[i].submission = Submission();
+    more = source->Next(&requests_[i].submission);
+    if (more) {
+      requests_[i].attempts = 0;
+      Start(&requests_[i]);
+      ++running;
+    }
+  }
+
+  while (running > 0) {
+    int still_running;
+    curl_multi_perform(multi_, &still_running);
+    CURLMsg *message;
+    int queued;
+    while ((message = curl_multi_info_read(multi_, &queued)) != NULL) {
+      if (message->msg != CURLMSG_DONE)
+        continue;
+      const CURLcode code = message->data.result;
+      Request *request = NULL;
+      for (size_t i = 0; i < requests_.size(); ++i)
+        if (requests_[i].handle == message->easy_handle)
+          request = &requests_[i];
+      CHECK_NOTNULL(request);
+      curl_multi_remove_handle(multi_, request->handle);
+      request->busy = false;
+
+      HTTPLogClient::Status status;
+      ct::SignedCertificateTimestamp sct;
+      if (!Finish(request, code, &status, &sct)) {
+        Start(request);
+        continue;
+      }
+      callback->Uploaded(request->submission, status, sct);
+
+      // The connection stays with the handle for the next submission.
+      request->submission = Submission();
+      more = more && source->Next(&request->submission);
+      if (more) {
+        request->attempts = 0;
+        Start(request);
+      } else {
+        --running;
+      }
+    }
+
+    if (running > 0)
+      curl_multi_wait(multi_, NULL, 0, 1000, NULL);
+  }
+}
+
+void BulkUploader::Start(Request *request) {
+  string url = "http://" + server_ + "/ct/v1/add-";
+  if (request->submission.pre)
+    url += "pre-";
+  url += "chain";
+  const string post = HTTPLogClient::ChainRequest(request->submission.chain);
+
+  request->busy = true;
+  ++request->attempts;
+  request->body.clear();
+  CURL *handle = request->handle;
+  // Forgets the last request's options, but not its connection.
+  curl_easy_reset(handle);
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(handle, CURLOPT_URL, url.c_str()));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE,
+                                      static_cast<long>(post.size())));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(handle, CURLOPT_COPYPOSTFIELDS,
+                                      post.data()));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION,
+                                      &BulkUploader::WriteCallback));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(handle, CURLOPT_WRITEDATA,
+                                      &request->body));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L));
+  CHECK_EQ(CURLM_OK, curl_multi_add_handle(multi_, handle));
+}
+
+bool BulkUploader::Finish(Request *request, CURLcode code,
+                          HTTPLogClient::Status *status,
+                          ct::SignedCertificateTimestamp *sct) {
+  const string &name = request->submission.name;
+  bool retry = false;
+  if (code != CURLE_OK) {
+    LOG(WARNING) << name << ": " << curl_easy_strerror(code);
+    *status = code == CURLE_COULDNT_CONNECT ? HTTPLogClient::CONNECT_FAILED
+        : HTTPLogClient::UNKNOWN_ERROR;
+    retry = true;
+  } else {
+    long http_code = 0;
+    curl_easy_getinfo(request->handle, CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code == 200) {
+      *status = HTTPLogClient::ParseSCT(request->body, sct);
+    } else {
+      LOG(WARNING) << name << ": HTTP status " << http_code << ": "
+                   << request->body;
+      *status = HTTPLogClient::UPLOAD_FAILED;
+      // The log is busy or broken, rather than the chain bad.
+      retry = http_code == 429 || http_code >= 500;
+    }
+  }
+  string().swap(request->body);
+  return !retry || request->attempts > max_retries_;
+}
+
+// static
+size_t BulkUploader::WriteCallback(char *buffer, size_t size, size_t nmemb,
+                                   string *body) {
+  body->append(buffer, size * nmemb);
+  return size * nmemb;
+}
@@ -0,0 +1,87 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef BULK_UPLOADER_H
+#define BULK_UPLOADER_H
+
+#include <curl/curl.h>
+#include <string>
+#include <vector>
+
+#include "client/http_log_client.h"
+#include "proto/ct.pb.h"
+
+// Submits many chains to an HTTP log, over |parallel| connections kept
+// alive between requests, with one request in flight on each. Requests
+// that fail on the way, or that the log can't take right now, are
+// retried; those that the log rejects are not.
+//
+// Not thread-safe.
+class BulkUploader {
+ public:
+  struct Submission {
+    Submission() : pre(false) {}
+
+    // Names the submission in the output.
+    std::string name;
+    // The DER-encoded certificates, leaf first.
+    std::vector<std::string> chain;
+    // Whether to submit to add-pre-chain.
+    bool pre;
+  };
+
+  class Source {
+   public:
+    virtual ~Source() {}
+
+    // Fill in the next submission, or return false if there are no more.
+    virtual bool Next(Submission *submission) = 0;
+  };
+
+  class Callback {
+   public:
+    virtual ~Callback() {}
+
+    // |submission| got |sct|, if |status| is OK.
+    virtual void Uploaded(const Submission &submission,
+                          HTTPLogClient::Status status,
+                          const ct::SignedCertificateTimestamp &sct) = 0;
+  };
+
+  // Uploads to the server of |client|, trying each submission up to
+  // |max_retries| more times.
+  BulkUploader(const HTTPLogClient &client, int parallel, int max_retries);
+  ~BulkUploader();
+
+  // Upload everything from |source|, and pass the outcome of each to
+  // |callback|, in the order they finish.
+  void Upload(Source *source, Callback *callback);
+
+ private:
+  // An easy handle, and the submission it is uploading, if any.
+  struct Request {
+    Request() : handle(NULL), busy(false), attempts(0) {}
+
+    CURL *handle;
+    bool busy;
+    Submission submission;
+    int attempts;
+    std::string body;
+  };
+
+  // Start uploading the submission of |request|.
+  void Start(Request *request);
+
+  // Deal with the reply of |request|. Returns false if it should be tried
+  // again, or else the outcome in |status| and |sct|.
+  bool Finish(Request *request, CURLcode code, HTTPLogClient::Status *status,
+              ct::SignedCertificateTimestamp *sct);
+
+  static size_t WriteCallback(char *buffer, size_t size, size_t nmemb,
+                              std::string *body);
+
+  const std::string server_;
+  const int max_retries_;
+  CURLM *const multi_;
+  std::vector<Request> requests_;
+};
+
+#endif
@@ -0,0 +1,534 @@
+/* -*- indent-tabs-mode: nil -*- */
+// Load generator for HTTP logs.
+//
+// Replays a weighted mix of requests against the log at --ct_server from
+// --threads threads, each with a connection of its own, for
+// --duration_secs, either as fast as the log answers or, with --rate, at
+// that many requests per second in all. Chains for add-chain and
+// add-pre-chain are made up front by the test CA in --ca_cert and
+// --ca_key, which the log must accept as a root. At the end, prints one
+// JSON object per line for each endpoint, and one for all of them, with
+// the request and error counts, the rate and the latency percentiles.
+//
+// With --rate, latencies count from when a request was due rather than
+// from when it was sent, so that a log that falls behind shows the wait
+// its clients would see, rather than sending less.
+//
+// get-proof-by-hash goes with the get-sth that HTTPLogClient needs first
+// for the tree size, and counts as one request. The client logs every
+// response, so run with --minloglevel=1 or higher.
+#include <algorithm>
+#include <curl/curl.h>
+#include <errno.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <openssl/bio.h>
+#include <openssl/bn.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "client/http_log_client.h"
+#include "log/ct_extensions.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+
+DEFINE_string(ct_server, "", "Log server to load, as host:port");
+DEFINE_string(mix, "add-chain=1,get-sth=1", "Comma-separated endpoint=weight "
+              "pairs: requests go to each endpoint in proportion to its "
+              "weight. The endpoints are add-chain, add-pre-chain, "
+              "get-entries, get-proof-by-hash, get-sth and "
+              "get-sth-consistency.");
+DEFINE_int32(threads, 8, "Number of threads, and connections, sending "
+             "requests");
+DEFINE_double(rate, 0, "Requests per second, in all, or 0 for as many as the "
+              "log can take");
+DEFINE_int32(duration_secs, 60, "How long to send requests for");
+DEFINE_string(ca_cert, "", "PEM-encoded CA certificate that issues the "
+              "submitted chains");
+DEFINE_string(ca_key, "", "PEM-encoded private key of --ca_cert");
+DEFINE_string(ca_key_password, "", "Password of --ca_key, if any");
+DEFINE_int32(chains, 1000, "Number of chains of each kind to make before "
+             "starting. Once they have all been submitted, they are "
+             "submitted again, which the log answers for what it has.");
+DEFINE_int32(get_entries_count, 100, "Number of entries get-entries asks "
+             "for");
+DEFINE_int32(sample_entries, 1000, "Number of entries read before "
+             "starting, for get-proof-by-hash to ask for");
+
+namespace {
+
+using std::string;
+
+enum Endpoint {
+  ADD_CHAIN,
+  ADD_PRE_CHAIN,
+  GET_ENTRIES,
+  GET_PROOF_BY_HASH,
+  GET_STH,
+  GET_STH_CONSISTENCY,
+  NUM_ENDPOINTS,
+};
+
+const char *const kEndpointNames[NUM_ENDPOINTS] = {
+  "add-chain",
+  "add-pre-chain",
+  "get-entries",
+  "get-proof-by-hash",
+  "get-sth",
+  "get-sth-consistency",
+};
+
+uint64_t NowInMicroseconds() {
+  struct timespec ts;
+  PCHECK(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void SleepUntil(uint64_t usec) {
+  const uint64_t now = NowInMicroseconds();
+  if (usec <= now)
+    return;
+  struct timespec ts;
+  ts.tv_sec = (usec - now) / 1000000;
+  ts.tv_nsec = (usec - now) % 1000000 * 1000;
+  while (nanosleep(&ts, &ts) != 0)
+    PCHECK(errno == EINTR);
+}
+
+// The weights of --mix.
+bool ParseMix(const string &mix, std::vector<int> *weights) {
+  weights->assign(NUM_ENDPOINTS, 0);
+  size_t start = 0;
+  while (start < mix.size()) {
+    size_t end = mix.find(',', start);
+    if (end == string::npos)
+      end = mix.size();
+    const string pair(mix, start, end - start);
+    start = end + 1;
+
+    const size_t equals = pair.find('=');
+    if (equals == string::npos)
+      return false;
+    const string name(pair, 0, equals);
+    int endpoint = 0;
+    while (endpoint < NUM_ENDPOINTS && name != kEndpointNames[endpoint])
+      ++endpoint;
+    if (endpoint == NUM_ENDPOINTS) {
+      LOG(ERROR) << "Unknown endpoint " << name;
+      return false;
+    }
+    char *weight_end;
+    const long weight = strtol(pair.c_str() + equals + 1, &weight_end, 10);
+    if (*weight_end != '\0' || weight_end == pair.c_str() + equals + 1 ||
+        weight < 0)
+      return false;
+    (*weights)[endpoint] = weight;
+  }
+  return true;
+}
+
+// Issues chains of a fresh leaf, or precertificate, and the CA.
+class ChainMaker {
+ public:
+  ChainMaker(X509 *ca, EVP_PKEY *ca_key)
+      : ca_(ca),
+        ca_key_(ca_key),
+        leaf_key_(CHECK_NOTNULL(EVP_PKEY_new())),
+        made_(0) {
+    CHECK(DerEncode(ca_, &ca_der_));
+
+    // One key will do for every leaf.
+    RSA *rsa = CHECK_NOTNULL(RSA_new());
+    BIGNUM *exponent = CHECK_NOTNULL(BN_new());
+    CHECK_EQ(1, BN_set_word(exponent, RSA_F4));
+    CHECK_EQ(1, RSA_generate_key_ex(rsa, 2048, exponent, NULL));
+    BN_free(exponent);
+    CHECK_EQ(1, EVP_PKEY_assign_RSA(leaf_key_, rsa));
+  }
+
+  ~ChainMaker() { EVP_PKEY_free(leaf_key_); }
+
+  void Make(bool pre, std::vector<string> *chain) {
+    X509 *x = CHECK_NOTNULL(X509_new());
+    CHECK_EQ(1, X509_set_version(x, 2));
+
+    // Random 128 bit serial number
+    BIGNUM *serial = CHECK_NOTNULL(BN_new());
+    CHECK_EQ(1, BN_rand(serial, 128, 0, 0));
+    CHECK_NOTNULL(BN_to_ASN1_INTEGER(serial, X509_get_serialNumber(x)));
+    BN_free(serial);
+
+    CHECK_NOTNULL(X509_gmtime_adj(X509_get_notBefore(x), 0));
+    CHECK_NOTNULL(X509_gmtime_adj(X509_get_notAfter(x), 86400));
+    CHECK_EQ(1, X509_set_issuer_name(x, X509_get_subject_name(ca_)));
+
+    char subject[64];
+    snprintf(subject, sizeof(subject), "ct-loadgen %lu",
+             static_cast<unsigned long>(made_++));
+    X509_NAME *name = X509_get_subject_name(x);
+    CHECK_EQ(1, X509_NAME_add_entry_by_NID(
+        name, NID_commonName, MBSTRING_ASC,
+        reinterpret_cast<unsigned char*>(subject), -1, -1, 0));
+    CHECK_EQ(1, X509_set_pubkey(x, leaf_key_));
+
+    if (pre) {
+      // The critical poison extension, whose value is an ASN.1 NULL.
+      ASN1_OCTET_STRING *null = CHECK_NOTNULL(ASN1_OCTET_STRING_new());
+      CHECK_EQ(1, ASN1_OCTET_STRING_set(
+          null, reinterpret_cast<const unsigned char*>("\x05\x00"), 2));
+      X509_EXTENSION *poison = CHECK_NOTNULL(X509_EXTENSION_create_by_NID(
+          NULL, ct::NID_ctPoison, 1, null));
+      CHECK_EQ(1, X509_add_ext(x, poison, -1));
+      X509_EXTENSION_free(poison);
+      ASN1_OCTET_STRING_free(null);
+    }
+
+    CHECK_GT(X509_sign(x, ca_key_, EVP_sha256()), 0);
+
+    chain->resize(2);
+    CHECK(DerEncode(x, &(*chain)[0]));
+    (*chain)[1] = ca_der_;
+    X509_free(x);
+  }
+
+ private:
+  static bool DerEncode(X509 *x, string *der) {
+    const int length = i2d_X509(x, NULL);
+    if (length <= 0)
+      return false;
+    der->resize(length);
+    unsigned char *out = reinterpret_cast<unsigned char*>(&(*der)[0]);
+    return i2d_X509(x, &out) == length;
+  }
+
+  X509 *const ca_;
+  EVP_PKEY *const ca_key_;
+  EVP_PKEY *const leaf_key_;
+  string ca_der_;
+  // Numbers the subjects.
+  uint64_t made_;
+};
+
+// The leaf hash of |leaf|, for get-proof-by-hash.
+string LeafHash(const ct::MerkleTreeLeaf &leaf) {
+  const ct::TimestampedEntry &entry = leaf.timestamped_entry();
+  string serialized;
+  Serializer::SerializeResult result;
+  if (entry.entry_type() == ct::PRECERT_ENTRY)
+    result = Serializer::SerializeV1PrecertSCTMerkleTreeLeaf(
+        entry.timestamp(), entry.signed_entry().precert().issuer_key_hash(),
+        entry.signed_entry().precert().tbs_certificate(), entry.extensions(),
+        &serialized);
+  else
+    result = Serializer::SerializeV1CertSCTMerkleTreeLeaf(
+        entry.timestamp(), entry.signed_entry().x509(), entry.extensions(),
+        &serialized);
+  CHECK_EQ(Serializer::OK, result);
+  return TreeHasher(new Sha256Hasher).HashLeaf(serialized);
+}
+
+// What the threads share, which they only read.
+struct Load {
+  // Cumulative weights of the endpoints, and their sum.
+  std::vector<int> cumulative;
+  uint64_t tree_size;
+  std::vector<string> leaf_hashes;
+  std::vector<std::vector<string> > chains;
+  std::vector<std::vector<string> > pre_chains;
+  uint64_t start;
+  uint64_t end;
+  // Between requests of one thread, if the rate is set.
+  uint64_t interval;
+};
+
+// What a thread saw of each endpoint.
+struct Results {
+  Results() : latencies(NUM_ENDPOINTS), errors(NUM_ENDPOINTS, 0) {}
+
+  // In microseconds.
+  std::vector<std::vector<uint32_t> > latencies;
+  std::vector<uint64_t> errors;
+};
+
+class Worker {
+ public:
+  Worker(const Load &load, const HTTPLogClient &client, unsigned seed,
+         uint64_t first_due)
+      : load_(load), client_(client), seed_(seed), next_due_(first_due),
+        next_chain_(seed), next_pre_chain_(seed) {}
+
+  static void *Thread(void *arg) {
+    static_cast<Worker*>(arg)->Run();
+    return NULL;
+  }
+
+  const Results &results() const { return results_; }
+
+ private:
+  void Run() {
+    for (;;) {
+      uint64_t start;
+      if (load_.interval > 0) {
+        start = next_due_;
+        next_due_ += load_.interval;
+        if (start >= load_.end)
+          break;
+        SleepUntil(start);
+      } else {
+        start = NowInMicroseconds();
+        if (start >= load_.end)
+          break;
+      }
+
+      const Endpoint endpoint = Pick();
+      const bool ok = Send(endpoint);
+      const uint64_t latency = NowInMicroseconds() - start;
+      results_.latencies[endpoint].push_back(
+          std::min<uint64_t>(latency, 0xffffffff));
+      if (!ok)
+        ++results_.errors[endpoint];
+    }
+  }
+
+  Endpoint Pick() {
+    const int value = rand_r(&seed_) % load_.cumulative.back();
+    int endpoint = 0;
+    while (value >= load_.cumulative[endpoint])
+      ++endpoint;
+    return static_cast<Endpoint>(endpoint);
+  }
+
+  uint64_t Random(uint64_t limit) {
+    const uint64_t value = (static_cast<uint64_t>(rand_r(&seed_)) << 31) ^
+        rand_r(&seed_);
+    return value % limit;
+  }
+
+  bool Send(Endpoint endpoint) {
+    ct::SignedCertificateTimestamp sct;
+    switch (endpoint) {
+      case ADD_CHAIN:
+        return client_.UploadChain(
+            load_.chains[next_chain_++ % load_.chains.size()], false, &sct)
+            == HTTPLogClient::OK;
+      case ADD_PRE_CHAIN:
+        return client_.UploadChain(
+            load_.pre_chains[next_pre_chain_++ % load_.pre_chains.size()],
+            true, &sct) == HTTPLogClient::OK;
+      case GET_ENTRIES: {
+        const uint64_t first = Random(load_.tree_size);
+        const uint64_t last =
+            std::min<uint64_t>(first + FLAGS_get_entries_count,
+                               load_.tree_size) - 1;
+        std::vector<HTTPLogClient::LogEntry> entries;
+        return client_.GetEntries(first, last, &entries)
+            == HTTPLogClient::OK;
+      }
+      case GET_PROOF_BY_HASH: {
+        ct::MerkleAuditProof proof;
+        return client_.QueryAuditProof(
+            load_.leaf_hashes[Random(load_.leaf_hashes.size())], &proof)
+            == HTTPLogClient::OK;
+      }
+      case GET_STH: {
+        ct::SignedTreeHead sth;
+        return client_.GetSTH(&sth) == HTTPLogClient::OK;
+      }
+      case GET_STH_CONSISTENCY: {
+        const uint64_t first = 1 + Random(load_.tree_size - 1);
+        std::vector<string> proof;
+        return client_.GetSTHConsistency(first, load_.tree_size, &proof)
+            == HTTPLogClient::OK;
+      }
+      case NUM_ENDPOINTS:
+        break;
+    }
+    LOG(FATAL) << "Bad endpoint " << endpoint;
+    return false;
+  }
+
+  const Load &load_;
+  const HTTPLogClient client_;
+  unsigned seed_;
+  uint64_t next_due_;
+  // Where in the chains this thread goes on, so that threads don't send
+  // the same ones at once.
+  size_t next_chain_;
+  size_t next_pre_chain_;
+  Results results_;
+};
+
+void AppendNumber(const char *name, double value, string *out) {
+  char buf[256];
+  snprintf(buf, sizeof(buf), ", \"%s\": %.3f", name, value);
+  out->append(buf);
+}
+
+void Report(const char *name, std::vector<uint32_t> *latencies,
+            uint64_t errors, double secs) {
+  string line = string("{ \"endpoint\": \"") + name + "\"";
+  const size_t count = latencies->size();
+  AppendNumber("requests", count, &line);
+  AppendNumber("errors", errors, &line);
+  AppendNumber("error_rate", count == 0 ? 0 : double(errors) / count, &line);
+  AppendNumber("requests_per_sec", count / secs, &line);
+  if (count > 0) {
+    std::sort(latencies->begin(), latencies->end());
+    static const double kPercentiles[] = { 50, 90, 99, 99.9 };
+    static const char *const kNames[] = { "p50_ms", "p90_ms", "p99_ms",
+                                          "p999_ms" };
+    for (size_t i = 0; i < 4; ++i) {
+      const size_t rank = std::min<size_t>(count - 1,
+                                           count * kPercentiles[i] / 100);
+      AppendNumber(kNames[i], (*latencies)[rank] / 1000.0, &line);
+    }
+    AppendNumber("max_ms", latencies->back() / 1000.0, &line);
+  }
+  line += " }";
+  printf("%s\n", line.c_str());
+}
+
+// Leaf hashes of the last |count| entries of the tree.
+void SampleLeafHashes(const HTTPLogClient &client, uint64_t tree_size,
+                      uint64_t count, std::vector<string> *leaf_hashes) {
+  uint64_t next = tree_size - std::min(count, tree_size);
+  while (next < tree_size) {
+    std::vector<HTTPLogClient::LogEntry> entries;
+    CHECK_EQ(HTTPLogClient::OK, client.GetEntries(next, tree_size - 1,
+                                                  &entries));
+    CHECK(!entries.empty());
+    for (size_t i = 0; i < entries.size(); ++i)
+      leaf_hashes->push_back(LeafHash(entries[i].leaf));
+    next += entries.size();
+  }
+}
+
+// Drop |endpoint| from the mix, if it is in it, as it can't be loaded.
+void Drop(Endpoint endpoint, const char *reason, std::vector<int> *weights) {
+  if ((*weights)[endpoint] == 0)
+    return;
+  LOG(WARNING) << "Not loading " << kEndpointNames[endpoint] << ": " << reason;
+  (*weights)[endpoint] = 0;
+}
+
+void MakeChains(const std::vector<int> &weights, Load *load) {
+  if (weights[ADD_CHAIN] == 0 && weights[ADD_PRE_CHAIN] == 0)
+    return;
+
+  BIO *bio = CHECK_NOTNULL(BIO_new_file(FLAGS_ca_cert.c_str(), "r"));
+  X509 *ca = CHECK_NOTNULL(PEM_read_bio_X509(bio, NULL, NULL, NULL));
+  BIO_free(bio);
+  bio = CHECK_NOTNULL(BIO_new_file(FLAGS_ca_key.c_str(), "r"));
+  EVP_PKEY *ca_key = CHECK_NOTNULL(PEM_read_bio_PrivateKey(
+      bio, NULL, NULL, const_cast<char*>(FLAGS_ca_key_password.c_str())));
+  BIO_free(bio);
+
+  ChainMaker maker(ca, ca_key);
+  if (weights[ADD_CHAIN] > 0) {
+    load->chains.resize(FLAGS_chains);
+    for (size_t i = 0; i < load->chains.size(); ++i)
+      maker.Make(false, &load->chains[i]);
+  }
+  if (weights[ADD_PRE_CHAIN] > 0) {
+    load->pre_chains.resize(FLAGS_chains);
+    for (size_t i = 0; i < load->pre_chains.size(); ++i)
+      maker.Make(true, &load->pre_chains[i]);
+  }
+  EVP_PKEY_free(ca_key);
+  X509_free(ca);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  SSL_library_init();
+  ct::LoadCtExtensions();
+  // Before any threads, which curl_easy_init() would otherwise do.
+  CHECK_EQ(CURLE_OK, curl_global_init(CURL_GLOBAL_ALL));
+
+  CHECK(!FLAGS_ct_server.empty()) << "Please give --ct_server";
+  CHECK_GT(FLAGS_threads, 0);
+  CHECK_GT(FLAGS_duration_secs, 0);
+  CHECK_GE(FLAGS_rate, 0);
+  CHECK_GT(FLAGS_chains, 0);
+  CHECK_GT(FLAGS_get_entries_count, 0);
+
+  std::vector<int> weights;
+  CHECK(ParseMix(FLAGS_mix, &weights)) << "Bad --mix " << FLAGS_mix;
+
+  const HTTPLogClient client(FLAGS_ct_server);
+  Load load;
+  ct::SignedTreeHead sth;
+  CHECK_EQ(HTTPLogClient::OK, client.GetSTH(&sth));
+  load.tree_size = sth.tree_size();
+  if (load.tree_size == 0)
+    Drop(GET_ENTRIES, "the tree is empty", &weights);
+  if (load.tree_size < 2)
+    Drop(GET_STH_CONSISTENCY, "the tree is too small", &weights);
+  if (weights[GET_PROOF_BY_HASH] > 0 && FLAGS_sample_entries > 0)
+    SampleLeafHashes(client, load.tree_size, FLAGS_sample_entries,
+                     &load.leaf_hashes);
+  if (load.leaf_hashes.empty())
+    Drop(GET_PROOF_BY_HASH, "there are no entries to ask for", &weights);
+  MakeChains(weights, &load);
+
+  int sum = 0;
+  for (size_t i = 0; i < weights.size(); ++i)
+    load.cumulative.push_back(sum += weights[i]);
+  CHECK_GT(sum, 0) << "Nothing to load";
+
+  load.interval = FLAGS_rate > 0 ? FLAGS_threads * 1e6 / FLAGS_rate : 0;
+  load.start = NowInMicroseconds();
+  load.end = load.start + FLAGS_duration_secs * 1000000ULL;
+
+  std::vector<Worker*> workers;
+  std::vector<pthread_t> threads(FLAGS_threads);
+  for (int i = 0; i < FLAGS_threads; ++i) {
+    // Spread the threads' requests over the interval.
+    workers.push_back(new Worker(load, client, i + 1,
+                                 load.start + load.interval * i /
+                                 FLAGS_threads));
+    CHECK_EQ(0, pthread_create(&threads[i], NULL, &Worker::Thread,
+                               workers[i]));
+  }
+  for (int i = 0; i < FLAGS_threads; ++i)
+    CHECK_EQ(0, pthread_join(threads[i], NULL));
+  const double secs = (NowInMicroseconds() - load.start) / 1e6;
+
+  std::vector<uint32_t> all;
+  uint64_t all_errors = 0;
+  for (int endpoint = 0; endpoint < NUM_ENDPOINTS; ++endpoint) {
+    if (weights[endpoint] == 0)
+      continue;
+    std::vector<uint32_t> latencies;
+    uint64_t errors = 0;
+    for (size_t i = 0; i < workers.size(); ++i) {
+      const Results &results = workers[i]->results();
+      latencies.insert(latencies.end(), results.latencies[endpoint].begin(),
+                       results.latencies[endpoint].end());
+      errors += results.errors[endpoint];
+    }
+    all.insert(all.end(), latencies.begin(), latencies.end());
+    all_errors += errors;
+    Report(kEndpointNames[endpoint], &latencies, errors, secs);
+  }
+  Report("all", &all, all_errors, secs);
+
+  for (size_t i = 0; i < workers.size(); ++i)
+    delete workers[i];
+  return 0;
+}
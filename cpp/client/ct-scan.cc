@@ -0,0 +1,122 @@
+/* -*- indent-tabs-mode: nil -*- */
+// Scans the entries of the log at --ct_server for certificates that match
+// all of the given criteria, and prints one line for each match: its index,
+// whether it is an X.509 or a precert entry, and its subject name.
+//
+// Entries are fetched with --get_entries_parallel requests in flight, and
+// matched in --scan_threads threads. With --checkpoint_file, progress is
+// saved as the scan goes, and an interrupted scan picks up from there when
+// run again; a few matches before the interruption may be printed twice.
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+
+#include "client/entry_fetcher.h"
+#include "client/http_log_client.h"
+#include "client/scanner.h"
+#include "log/cert.h"
+#include "proto/ct.pb.h"
+#include "util/util.h"
+
+using ct::Cert;
+using ct::SignedTreeHead;
+using std::string;
+
+DEFINE_string(ct_server, "", "Log server to scan, as host:port");
+DEFINE_string(subject_regex, "", "POSIX extended regular expression to "
+              "match against the subject name and the subjectAltName DNS "
+              "names");
+DEFINE_string(issuer_regex, "", "POSIX extended regular expression to match "
+              "against the issuer name");
+DEFINE_string(serial, "", "Serial number to match, in hex");
+DEFINE_bool(precerts_only, false, "Only match precert entries");
+DEFINE_int32(first, 0, "Index of the first entry to scan");
+DEFINE_int32(last, -1, "Index of the last entry to scan, or -1 for the last "
+             "entry of the log's latest tree head");
+DEFINE_int32(scan_threads, 4, "Number of threads matching entries");
+DEFINE_int32(scan_chunks, 64, "Number of chunks of fetched entries to keep "
+             "waiting at most");
+DEFINE_int32(get_entries_parallel, 4,
+             "Number of get-entries requests to keep in flight");
+DEFINE_int32(get_entries_batch_size, 1000,
+             "Number of entries to ask for in each get-entries request");
+DEFINE_int32(get_entries_retries, 3,
+             "Number of times to retry a failed get-entries request");
+DEFINE_string(checkpoint_file, "", "File to save the progress of the scan "
+              "to, and resume it from");
+
+namespace {
+
+class MatchPrinter : public Scanner::Callback {
+ public:
+  virtual void Matched(int index, const HTTPLogClient::LogEntry &entry) {
+    const ct::TimestampedEntry &timestamped =
+        entry.leaf.timestamped_entry();
+    const bool precert = timestamped.entry_type() == ct::PRECERT_ENTRY;
+    Cert cert;
+    // The scanner only reports entries that parsed.
+    CHECK_EQ(Cert::TRUE, cert.LoadFromDerString(precert ?
+        entry.entry.precert_entry().pre_certificate() :
+        timestamped.signed_entry().x509()));
+    std::cout << index << "\t" << (precert ? "precert" : "x509") << "\t"
+              << cert.PrintSubjectName() << std::endl;
+  }
+};
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  if (FLAGS_ct_server.empty()) {
+    std::cerr << "--ct_server must be set" << std::endl;
+    exit(1);
+  }
+  if (FLAGS_scan_threads <= 0 || FLAGS_scan_chunks <= 0) {
+    std::cerr << "--scan_threads and --scan_chunks must be greater than 0"
+              << std::endl;
+    exit(1);
+  }
+
+  AllOfMatcher matcher;
+  if (!FLAGS_subject_regex.empty())
+    matcher.Add(new SubjectRegexMatcher(FLAGS_subject_regex));
+  if (!FLAGS_issuer_regex.empty())
+    matcher.Add(new IssuerRegexMatcher(FLAGS_issuer_regex));
+  if (!FLAGS_serial.empty()) {
+    // Serial numbers are matched without leading zero bytes.
+    string serial = util::BinaryString(FLAGS_serial);
+    const size_t zeros = serial.find_first_not_of('\0');
+    serial.erase(0, zeros == string::npos ? serial.size() : zeros);
+    matcher.Add(new SerialNumberMatcher(serial));
+  }
+  if (FLAGS_precerts_only)
+    matcher.Add(new PrecertMatcher);
+
+  HTTPLogClient client(FLAGS_ct_server);
+  int last = FLAGS_last;
+  if (last < 0) {
+    SignedTreeHead sth;
+    CHECK_EQ(HTTPLogClient::OK, client.GetSTH(&sth))
+        << "Failed to get the tree head of " << FLAGS_ct_server;
+    last = static_cast<int>(sth.tree_size()) - 1;
+  }
+
+  EntryFetcher fetcher(client, FLAGS_get_entries_parallel,
+                       FLAGS_get_entries_batch_size,
+                       FLAGS_get_entries_retries);
+  Scanner scanner(&fetcher, &matcher, FLAGS_scan_threads, FLAGS_scan_chunks);
+  MatchPrinter printer;
+  const HTTPLogClient::Status status =
+      scanner.Scan(FLAGS_first, last, FLAGS_checkpoint_file, &printer);
+  LOG(INFO) << "Scanned " << scanner.Scanned() << " entries, of which "
+            << scanner.Unparsed() << " didn't parse";
+  if (status != HTTPLogClient::OK) {
+    LOG(ERROR) << "Failed to get entries from " << FLAGS_ct_server;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,385 @@
+/* -*- indent-tabs-mode: nil -*- */
+// Keeps SCTs stapled to the certificates that the TLS servers on a host
+// serve.
+//
+// Each file in --chains_dir is the PEM-encoded chain of a certificate that
+// is served, leaf first. The stapler submits each chain to every log in
+// --ct_servers, and publishes the SCTs it gets back to --staple_file, ready
+// to go out in the TLS extension (see log/sct_staple.h); the servers map
+// the file and look the extension up on each handshake.
+//
+// The directory is looked at every --poll_secs. New and changed chains are
+// submitted right away, and removed ones are no longer stapled. Every chain
+// is submitted again every --refresh_secs, and SCTs from logs that are no
+// longer in --ct_servers are dropped then. When a log fails, the SCT that
+// it gave before, if any, stays, and the chain is tried again after
+// --retry_secs. With --ct_server_public_keys, SCTs that do not verify
+// against their log's key are not stapled.
+//
+// Each log is submitted to from a thread of its own, one chain at a time.
+#include <curl/curl.h>
+#include <dirent.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iostream>
+#include <map>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "client/http_log_client.h"
+#include "log/cert.h"
+#include "log/cert_submission_handler.h"
+#include "log/ct_extensions.h"
+#include "log/log_signer.h"
+#include "log/log_verifier.h"
+#include "log/sct_staple.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+DEFINE_string(chains_dir, "", "Directory of the PEM-encoded certificate "
+              "chains to staple SCTs to, one chain per file, leaf first");
+DEFINE_string(ct_servers, "", "Comma-separated logs to get SCTs from, as "
+              "host:port");
+DEFINE_string(ct_server_public_keys, "", "Comma-separated PEM-encoded "
+              "public keys of --ct_servers, in the same order, to verify "
+              "SCTs with; if empty, SCTs are not verified");
+DEFINE_string(staple_file, "/dev/shm/ct-staples", "File to publish the "
+              "stapled SCTs to, for TLS servers to map");
+DEFINE_int32(poll_secs, 60, "How often to look for new, changed and removed "
+             "chains");
+DEFINE_int32(refresh_secs, 86400, "How often to get new SCTs for chains "
+             "that have not changed");
+DEFINE_int32(retry_secs, 300, "How soon to try again for a chain that a log "
+             "gave no SCT for");
+
+namespace {
+
+using ct::CertChain;
+using ct::LogEntry;
+using ct::SignedCertificateTimestamp;
+using ct::SignedCertificateTimestampList;
+using std::string;
+
+struct Log {
+  string server;
+  // NULL if SCTs are not verified.
+  LogVerifier *verifier;
+};
+
+struct Chain {
+  // Of the file when it was read.
+  time_t mtime;
+  off_t size;
+  string cert_hash;
+  // DER-encoded, leaf first.
+  std::vector<string> certs;
+  LogEntry entry;
+  // Serialized SCTs, by log server.
+  std::map<string, string> scts;
+  // When to submit the chain again.
+  time_t due;
+};
+
+// One round of submissions: the chains that are due, and the SCTs that
+// each log gives for them, with an empty one for each that failed.
+struct Round {
+  const std::vector<Log> *logs;
+  std::vector<const Chain*> chains;
+  // By log, then by chain.
+  std::vector<std::vector<string> > scts;
+};
+
+std::vector<string> Split(const string &list) {
+  std::vector<string> parts;
+  size_t begin = 0;
+  while (begin < list.size()) {
+    size_t end = list.find(',', begin);
+    if (end == string::npos)
+      end = list.size();
+    if (end > begin)
+      parts.push_back(list.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  return parts;
+}
+
+LogVerifier *GetLogVerifier(const string &log_server_key) {
+  EVP_PKEY *pkey = NULL;
+  FILE *fp = fopen(log_server_key.c_str(), "r");
+
+  PCHECK(fp != static_cast<FILE*>(NULL))
+      << "Could not read CT server public key file " << log_server_key;
+  // No password.
+  PEM_read_PUBKEY(fp, &pkey, NULL, NULL);
+  CHECK_NE(pkey, static_cast<EVP_PKEY*>(NULL)) <<
+      log_server_key << " is not a valid PEM-encoded public key.";
+  fclose(fp);
+
+  return new LogVerifier(new LogSigVerifier(pkey),
+                         new MerkleVerifier(new Sha256Hasher()));
+}
+
+// Read the chain in |path| into |chain|. Returns false if it is no good.
+bool ReadChain(const string &path, Chain *chain) {
+  string pem;
+  if (!util::ReadBinaryFile(path, &pem)) {
+    LOG(WARNING) << "Could not read " << path;
+    return false;
+  }
+  CertChain certs(pem);
+  if (!certs.IsLoaded()) {
+    LOG(WARNING) << path << " is not a valid PEM-encoded certificate chain";
+    return false;
+  }
+  chain->certs.clear();
+  for (size_t i = 0; i < certs.Length(); ++i) {
+    string der;
+    if (certs.CertAt(i)->DerEncoding(&der) != ct::Cert::TRUE) {
+      LOG(WARNING) << "Could not DER-encode certificate " << i << " of "
+                   << path;
+      return false;
+    }
+    chain->certs.push_back(der);
+  }
+  if (!CertSubmissionHandler::X509ChainToEntry(certs, &chain->entry)) {
+    LOG(WARNING) << "Could not make a log entry of " << path;
+    return false;
+  }
+  chain->cert_hash = SctStapleWriter::CertificateHash(chain->certs[0]);
+  return true;
+}
+
+// Submit the chains of a Round to logs [|begin|, |end|).
+void SubmitToLogs(void *arg, size_t /* chunk */, size_t begin, size_t end) {
+  Round *round = static_cast<Round*>(arg);
+  for (size_t l = begin; l < end; ++l) {
+    const Log &log = (*round->logs)[l];
+    HTTPLogClient client(log.server);
+    for (size_t c = 0; c < round->chains.size(); ++c) {
+      const Chain &chain = *round->chains[c];
+      SignedCertificateTimestamp sct;
+      HTTPLogClient::Status status = client.UploadChain(chain.certs, false,
+                                                        &sct);
+      if (status != HTTPLogClient::OK) {
+        LOG(WARNING) << log.server << " gave no SCT for "
+                     << util::HexString(chain.cert_hash) << ": " << status;
+        continue;
+      }
+      if (log.verifier != NULL) {
+        LogVerifier::VerifyResult result =
+            log.verifier->VerifySignedCertificateTimestamp(chain.entry, sct);
+        if (result != LogVerifier::VERIFY_OK) {
+          LOG(WARNING) << "SCT from " << log.server << " for "
+                       << util::HexString(chain.cert_hash)
+                       << " does not verify: " << result;
+          continue;
+        }
+      }
+      string serialized;
+      CHECK_EQ(Serializer::OK, Serializer::SerializeSCT(sct, &serialized));
+      round->scts[l][c] = serialized;
+    }
+  }
+}
+
+class Stapler {
+ public:
+  Stapler(const std::vector<Log> &logs, const string &chains_dir,
+          const string &staple_file)
+      : logs_(logs),
+        chains_dir_(chains_dir),
+        staple_file_(staple_file),
+        // The caller submits to a log too.
+        pool_(logs.size() - 1, false),
+        published_(false) {}
+
+  ~Stapler() {
+    for (std::map<string, Chain*>::iterator it = chains_.begin();
+         it != chains_.end(); ++it)
+      delete it->second;
+  }
+
+  // Look at the chains, submit those that are due, and publish if anything
+  // changed, or if nothing was published yet.
+  void Poll() {
+    bool changed = Scan();
+    changed = Submit() || changed;
+    if (changed || !published_)
+      Publish();
+  }
+
+ private:
+  // Read new and changed chains, and forget removed ones. Returns whether
+  // any were removed or changed, and so are stapled no more.
+  bool Scan() {
+    DIR *dir = opendir(chains_dir_.c_str());
+    PCHECK(dir != NULL) << "Could not open " << chains_dir_;
+    std::map<string, Chain*> chains;
+    bool changed = false;
+    const time_t now = time(NULL);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      if (entry->d_name[0] == '.')
+        continue;
+      const string path = chains_dir_ + "/" + entry->d_name;
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        continue;
+      std::map<string, Chain*>::iterator old = chains_.find(path);
+      if (old != chains_.end()) {
+        Chain *chain = old->second;
+        chains_.erase(old);
+        if (chain->mtime == st.st_mtime && chain->size == st.st_size) {
+          chains[path] = chain;
+          continue;
+        }
+        delete chain;
+        changed = true;
+      }
+      Chain *chain = new Chain;
+      chain->mtime = st.st_mtime;
+      chain->size = st.st_size;
+      chain->due = now;
+      // A chain that is no good is tried again once it changes.
+      if (!ReadChain(path, chain))
+        chain->due = static_cast<time_t>(-1);
+      chains[path] = chain;
+    }
+    closedir(dir);
+
+    // What is left was removed.
+    for (std::map<string, Chain*>::iterator it = chains_.begin();
+         it != chains_.end(); ++it) {
+      LOG(INFO) << "No longer stapling " << it->first;
+      delete it->second;
+      changed = true;
+    }
+    chains_.swap(chains);
+    return changed;
+  }
+
+  // Submit the chains that are due to every log. Returns whether any got
+  // SCTs.
+  bool Submit() {
+    const time_t now = time(NULL);
+    Round round;
+    round.logs = &logs_;
+    for (std::map<string, Chain*>::const_iterator it = chains_.begin();
+         it != chains_.end(); ++it) {
+      if (it->second->due != static_cast<time_t>(-1) &&
+          it->second->due <= now)
+        round.chains.push_back(it->second);
+    }
+    if (round.chains.empty())
+      return false;
+    LOG(INFO) << "Submitting " << round.chains.size() << " chains";
+    round.scts.resize(logs_.size(),
+                      std::vector<string>(round.chains.size()));
+    pool_.ParallelFor(logs_.size(), logs_.size(), SubmitToLogs, &round);
+
+    bool changed = false;
+    for (size_t c = 0; c < round.chains.size(); ++c) {
+      Chain *chain = const_cast<Chain*>(round.chains[c]);
+      std::map<string, string> scts;
+      bool failed = false;
+      for (size_t l = 0; l < logs_.size(); ++l) {
+        const string &server = logs_[l].server;
+        if (!round.scts[l][c].empty()) {
+          scts[server] = round.scts[l][c];
+          continue;
+        }
+        failed = true;
+        // An SCT stays good, so keep the old one.
+        std::map<string, string>::const_iterator old =
+            chain->scts.find(server);
+        if (old != chain->scts.end())
+          scts[server] = old->second;
+      }
+      changed = changed || scts != chain->scts;
+      chain->scts.swap(scts);
+      chain->due = now + (failed ? FLAGS_retry_secs : FLAGS_refresh_secs);
+    }
+    return changed;
+  }
+
+  void Publish() {
+    SctStapleWriter writer(staple_file_);
+    for (std::map<string, Chain*>::const_iterator it = chains_.begin();
+         it != chains_.end(); ++it) {
+      const Chain &chain = *it->second;
+      if (chain.scts.empty())
+        continue;
+      SignedCertificateTimestampList list;
+      for (std::map<string, string>::const_iterator sct = chain.scts.begin();
+           sct != chain.scts.end(); ++sct)
+        list.add_sct_list(sct->second);
+      if (!writer.Set(chain.cert_hash, list))
+        LOG(WARNING) << "Could not serialize the SCTs of " << it->first;
+    }
+    writer.Publish();
+    published_ = true;
+    LOG(INFO) << "Published SCTs for " << writer.Size() << " certificates "
+              << "to " << staple_file_;
+  }
+
+  const std::vector<Log> logs_;
+  const string chains_dir_;
+  const string staple_file_;
+  util::ThreadPool pool_;
+  // By path.
+  std::map<string, Chain*> chains_;
+  bool published_;
+};
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  SSL_library_init();
+  ct::LoadCtExtensions();
+  CHECK_EQ(CURLE_OK, curl_global_init(CURL_GLOBAL_ALL));
+
+  const std::vector<string> servers = Split(FLAGS_ct_servers);
+  const std::vector<string> keys = Split(FLAGS_ct_server_public_keys);
+  if (FLAGS_chains_dir.empty() || servers.empty()) {
+    std::cerr << "--chains_dir and --ct_servers must be set" << std::endl;
+    exit(1);
+  }
+  if (!keys.empty() && keys.size() != servers.size()) {
+    std::cerr << "--ct_server_public_keys must have a key for each of "
+              << "--ct_servers" << std::endl;
+    exit(1);
+  }
+  if (FLAGS_poll_secs <= 0 || FLAGS_refresh_secs <= 0 ||
+      FLAGS_retry_secs <= 0) {
+    std::cerr << "--poll_secs, --refresh_secs and --retry_secs must be "
+              << "greater than 0" << std::endl;
+    exit(1);
+  }
+
+  std::vector<Log> logs(servers.size());
+  for (size_t i = 0; i < servers.size(); ++i) {
+    logs[i].server = servers[i];
+    logs[i].verifier = keys.empty() ? NULL : GetLogVerifier(keys[i]);
+  }
+
+  Stapler stapler(logs, FLAGS_chains_dir, FLAGS_staple_file);
+  for (;;) {
+    stapler.Poll();
+    sleep(FLAGS_poll_secs);
+  }
+}
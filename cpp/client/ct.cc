@@ -1,4 +1,6 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <deque>
+#include <dirent.h>
 #include <fcntl.h>
 #include <fstream>
 #include <gflags/gflags.h>
@@ -13,10 +15,16 @@
 #include <openssl/ssl.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
+#include <pthread.h>
 #include <sstream>
 #include <stdio.h>
 #include <string>
+#include <sys/stat.h>
+#include <vector>
 
+#include "client/bulk_uploader.h"
+#include "client/entry_fetcher.h"
+#include "client/entry_processor.h"
 #include "client/http_log_client.h"
 #include "client/log_client.h"
 #include "client/ssl_client.h"
@@ -31,8 +39,10 @@
 #include "monitor/database.h"
 #include "monitor/monitor.h"
 #include "monitor/sqlite_db.h"
+#include "monitor/supervisor.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 DEFINE_string(ssl_client_trusted_cert_dir, "",
@@ -44,6 +54,22 @@ DEFINE_int32(ssl_server_port, 0, "SSL server port");
 DEFINE_string(ct_server_submission, "",
               "Certificate chain to submit to a CT log server. "
               "The file must consist of concatenated PEM certificates.");
+DEFINE_string(bulk_input, "",
+              "Chains for bulk_upload: a directory of files that each hold "
+              "a chain as concatenated PEM certificates, or a file with a "
+              "chain per line, as comma-separated base64 DER certificates, "
+              "leaf first.");
+DEFINE_string(bulk_sct_out, "", "File that bulk_upload appends a line to "
+              "per chain: its name, then its base64 SCT and whether it "
+              "verified, or the error.");
+DEFINE_int32(bulk_parallel, 8, "Number of connections that bulk_upload "
+             "keeps a request in flight on, with --http_log");
+DEFINE_int32(bulk_pipeline, 16, "Number of requests that bulk_upload keeps "
+             "in flight on its one connection, without --http_log");
+DEFINE_int32(bulk_retries, 3, "Number of times bulk_upload retries a chain "
+             "that failed to upload for reasons other than the chain");
+DEFINE_int32(bulk_verify_threads, 4, "Number of threads that bulk_upload "
+             "verifies SCTs with, if --ct_server_public_key is set");
 DEFINE_string(ct_server, "", "CT log server to connect to");
 DEFINE_int32(ct_server_port, 0, "CT log server port (not used for HTTP)");
 DEFINE_string(ct_server_response_out, "",
@@ -78,8 +104,17 @@ DEFINE_bool(http_log, false, "Use an I-D compliant HTTP log server rather than "
             "the old protocol buffer format");
 DEFINE_int32(get_first, 0, "First entry to retrieve with the 'get' command");
 DEFINE_int32(get_last, 0, "Last entry to retrieve with the 'get' command");
+DEFINE_int32(get_entries_parallel, 4, "Number of get-entries requests to "
+             "keep in flight");
+DEFINE_int32(get_entries_batch_size, 1000, "Number of entries to ask for in "
+             "each get-entries request, until the log replies with fewer");
+DEFINE_int32(get_entries_retries, 3, "Number of times to retry a failed "
+             "get-entries request");
 DEFINE_string(certificate_base, "", "Base name for retrieved certificates - "
               "files will be <base><entry>.<cert>.der");
+DEFINE_bool(get_check_scts, false, "Have the 'get' command check the SCTs "
+            "embedded in retrieved certificates against "
+            "--ct_server_public_key");
 DEFINE_string(monitor_action, "loop", "Step the monitor shall do (or loop). "
     "Available actions are:\n"
     "get_sth - put current STH from log into monitor database\n"
@@ -87,7 +122,11 @@ DEFINE_string(monitor_action, "loop", "Step the monitor shall do (or loop). "
     "get_entries - put entries from log into monitor database\n"
     "confirm_tree - build merkletree (latest STH in db OR a given timestamp)\n"
     "init - initiate monitor (i.e. database) prior to its first run\n"
-    "loop - start the monitor in a loop (default)");
+    "loop - start the monitor in a loop (default)\n"
+    "supervise - monitor all the logs of --monitor_logs, whose databases "
+    "have been initiated, in one process\n"
+    "lookup_domain - print the indices of the entries in the monitor "
+    "database whose certificates name --domain");
 DEFINE_string(sqlite_db, "", "Database for certificate and tree storage");
 DEFINE_uint64(timestamp, 0, "The timestamp to be used in the monitor actions "
               "verify_sth and confirm_tree.");
@@ -95,6 +134,30 @@ DEFINE_string(sth1, "", "File containing first STH");
 DEFINE_string(sth2, "", "File containing second STH");
 DEFINE_uint64(monitor_sleep_time_secs, 60, "Amount of time the monitor shall "
               "sleep between probing for a new STH.");
+DEFINE_bool(monitor_wal, false, "Switch the monitor database to "
+            "write-ahead logging");
+DEFINE_string(monitor_logs, "", "File listing the logs to supervise, one "
+              "per line: <log server> <public key file> <sqlite database>. "
+              "Lines starting with # are ignored.");
+DEFINE_int32(monitor_threads, 4, "Number of logs to supervise at once");
+DEFINE_uint64(monitor_min_sleep_time_secs, 10, "Least amount of time the "
+              "supervisor waits before checking a log again.");
+DEFINE_uint64(monitor_step_entries, 100000, "Number of entries the "
+              "supervisor fetches from a log before it turns to the "
+              "others; 0 fetches all.");
+DEFINE_int32(monitor_prepare_threads, 2, "Number of chunks of fetched "
+             "entries that are prepared for the monitor database at once, "
+             "on the shared thread pool");
+DEFINE_bool(monitor_index_domains, false, "Index the entries that the "
+            "monitor fetches by the domain names of their certificates, "
+            "for lookup_domain");
+DEFINE_bool(monitor_chain_consistency, false, "When the monitor catches up "
+            "on several STHs at once, confirm the older ones through "
+            "consistency proofs between each and the next, rather than "
+            "leaving them unconfirmed");
+DEFINE_string(domain, "", "Domain name to look up with lookup_domain");
+DEFINE_bool(include_subdomains, false, "Have lookup_domain also find the "
+            "names under --domain");
 
 
 static const char kUsage[] =
@@ -102,6 +165,7 @@ static const char kUsage[] =
     "Known commands:\n"
     "connect - connect to an SSL server\n"
     "upload - upload a submission to a CT log server\n"
+    "bulk_upload - upload many submissions to a CT log server\n"
     "certificate - make a superfluous proof certificate\n"
     "extension_data - convert an audit proof to TLS extension format\n"
     "configure_proof - write the proof in an X509v3 configuration file\n"
@@ -116,10 +180,12 @@ static const char kUsage[] =
     "monitor - use the monitor (see monitor_action flag)\n"
     "Use --help to display command-line flag options\n";
 
+using ct::ClientMessage;
 using ct::LogEntry;
 using ct::MerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedCertificateTimestampList;
+using ct::ServerMessage;
 using ct::SSLClientCTData;
 using std::string;
 
@@ -136,9 +202,7 @@ static string SCTToList(const string &serialized_sct) {
   return result;
 }
 
-static LogVerifier *GetLogVerifierFromFlags() {
-  CHECK_NE(FLAGS_ct_server_public_key, "");
-  string log_server_key = FLAGS_ct_server_public_key;
+static LogVerifier *GetLogVerifier(const string &log_server_key) {
   EVP_PKEY *pkey = NULL;
   FILE *fp = fopen(log_server_key.c_str(), "r");
 
@@ -154,6 +218,11 @@ static LogVerifier *GetLogVerifierFromFlags() {
                          new MerkleVerifier(new Sha256Hasher()));
 }
 
+static LogVerifier *GetLogVerifierFromFlags() {
+  CHECK_NE(FLAGS_ct_server_public_key, "");
+  return GetLogVerifier(FLAGS_ct_server_public_key);
+}
+
 // Adds the data to the cert as an extension, formatted as a single
 // ASN.1 octet string.
 static void AddOctetExtension(X509 *cert, int nid, const unsigned char *data,
@@ -290,6 +359,373 @@ static int Upload() {
   return 0;
 }
 
+namespace {
+
+// The chains of a directory of PEM files, one chain per file.
+class DirectorySource : public BulkUploader::Source {
+ public:
+  explicit DirectorySource(const string &dir)
+      : dir_(dir), handle_(opendir(dir.c_str())), skipped_(0) {
+    PCHECK(handle_ != NULL) << "Could not open " << dir;
+  }
+
+  ~DirectorySource() { closedir(handle_); }
+
+  bool Next(BulkUploader::Submission *submission) {
+    struct dirent *entry;
+    while ((entry = readdir(handle_)) != NULL) {
+      if (entry->d_name[0] == '.')
+        continue;
+      string contents;
+      if (!util::ReadBinaryFile(dir_ + "/" + entry->d_name, &contents)) {
+        LOG(ERROR) << "Could not read " << entry->d_name;
+        ++skipped_;
+        continue;
+      }
+      CertChain chain(contents);
+      if (!chain.IsLoaded()) {
+        LOG(ERROR) << entry->d_name << " is not a PEM certificate chain";
+        ++skipped_;
+        continue;
+      }
+      submission->name = entry->d_name;
+      submission->chain.resize(chain.Length());
+      for (size_t n = 0; n < chain.Length(); ++n)
+        CHECK_EQ(Cert::TRUE,
+                 chain.CertAt(n)->DerEncoding(&submission->chain[n]));
+      submission->pre = FLAGS_precert;
+      return true;
+    }
+    return false;
+  }
+
+  size_t Skipped() const { return skipped_; }
+
+ private:
+  const string dir_;
+  DIR *const handle_;
+  size_t skipped_;
+};
+
+// The chains of a file with one chain per line, as the base64-encoded DER
+// of its certificates, leaf first, separated by commas.
+class LineSource : public BulkUploader::Source {
+ public:
+  explicit LineSource(const string &file)
+      : in_(file.c_str()), line_number_(0), skipped_(0) {
+    PCHECK(in_.good()) << "Could not open " << file;
+  }
+
+  bool Next(BulkUploader::Submission *submission) {
+    string line;
+    while (std::getline(in_, line)) {
+      ++line_number_;
+      if (line.empty())
+        continue;
+      std::ostringstream name;
+      name << "line" << line_number_;
+      submission->name = name.str();
+      submission->chain.clear();
+      std::istringstream certs(line);
+      string cert;
+      while (std::getline(certs, cert, ','))
+        submission->chain.push_back(util::FromBase64(cert.c_str()));
+      if (submission->chain.empty() || submission->chain[0].empty()) {
+        LOG(ERROR) << "Bad chain on " << submission->name;
+        ++skipped_;
+        continue;
+      }
+      submission->pre = FLAGS_precert;
+      return true;
+    }
+    return false;
+  }
+
+  size_t Skipped() const { return skipped_; }
+
+ private:
+  std::ifstream in_;
+  size_t line_number_;
+  size_t skipped_;
+};
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+// Writes a line per upload to |out|: the name of the submission, then the
+// base64-encoded SCT and whether it verified, or the error. If there is a
+// key to verify with, SCTs are verified by a pool of threads, each with a
+// verifier of its own, while the uploads go on.
+class SCTWriter : public BulkUploader::Callback {
+ public:
+  SCTWriter(std::ostream *out, const string &key_file, size_t threads)
+      : out_(out), key_file_(key_file), threads_(key_file.empty() ? 0 :
+                                                 threads),
+        done_(false), started_(util::TimeInMilliseconds()), uploaded_(0),
+        failed_(0), verified_(0), invalid_(0) {
+    CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+    CHECK_EQ(0, pthread_cond_init(&changed_, NULL));
+    for (size_t i = 0; i < threads_; ++i) {
+      pthread_t thread;
+      CHECK_EQ(0, pthread_create(&thread, NULL, VerifyThread, this));
+      verifiers_.push_back(thread);
+    }
+  }
+
+  ~SCTWriter() {
+    Finish();
+    CHECK_EQ(0, pthread_cond_destroy(&changed_));
+    CHECK_EQ(0, pthread_mutex_destroy(&mutex_));
+  }
+
+  // Wait for the verifiers to get through the SCTs so far.
+  void Finish() {
+    {
+      ScopedLock lock(&mutex_);
+      done_ = true;
+      CHECK_EQ(0, pthread_cond_broadcast(&changed_));
+    }
+    for (size_t i = 0; i < verifiers_.size(); ++i)
+      CHECK_EQ(0, pthread_join(verifiers_[i], NULL));
+    verifiers_.clear();
+  }
+
+  void Uploaded(const BulkUploader::Submission &submission,
+                HTTPLogClient::Status status,
+                const SignedCertificateTimestamp &sct) {
+    if (status != HTTPLogClient::OK) {
+      std::ostringstream line;
+      line << submission.name << " error " << status << "\n";
+      Write(line.str(), false, false);
+      return;
+    }
+    if (threads_ == 0) {
+      Write(Line(submission, sct, "unverified"), true, false);
+      return;
+    }
+
+    ScopedLock lock(&mutex_);
+    // Don't get ahead of the verifiers by more than a few each.
+    while (queue_.size() >= 4 * threads_)
+      CHECK_EQ(0, pthread_cond_wait(&changed_, &mutex_));
+    queue_.push_back(Pending(submission, sct));
+    CHECK_EQ(0, pthread_cond_broadcast(&changed_));
+  }
+
+  void Report() {
+    ScopedLock lock(&mutex_);
+    const uint64_t ms = util::TimeInMilliseconds() - started_;
+    LOG(INFO) << uploaded_ << " uploaded, " << failed_ << " failed, "
+              << verified_ << " verified, " << invalid_ << " invalid, in "
+              << ms / 1000 << "s: "
+              << (ms > 0 ? (uploaded_ + failed_) * 1000 / ms : 0) << "/s";
+  }
+
+  size_t Failed() const { return failed_ + invalid_; }
+
+ private:
+  typedef std::pair<BulkUploader::Submission, SignedCertificateTimestamp>
+      Pending;
+
+  static string Line(const BulkUploader::Submission &submission,
+                     const SignedCertificateTimestamp &sct,
+                     const char *verdict) {
+    string serialized;
+    CHECK_EQ(Serializer::OK, Serializer::SerializeSCT(sct, &serialized));
+    return submission.name + " " + util::ToBase64(serialized) + " " +
+        verdict + "\n";
+  }
+
+  void Write(const string &line, bool ok, bool verified) {
+    ScopedLock lock(&mutex_);
+    out_->write(line.data(), line.size());
+    if (!ok)
+      ++failed_;
+    else
+      ++uploaded_;
+    if (verified)
+      ++verified_;
+    if ((uploaded_ + failed_) % 10000 == 0) {
+      const uint64_t ms = util::TimeInMilliseconds() - started_;
+      LOG(INFO) << uploaded_ + failed_ << " done, "
+                << (ms > 0 ? (uploaded_ + failed_) * 1000 / ms : 0) << "/s";
+    }
+  }
+
+  static void *VerifyThread(void *arg) {
+    static_cast<SCTWriter*>(arg)->Verify();
+    return NULL;
+  }
+
+  void Verify() {
+    // OpenSSL keys shouldn't be shared between threads.
+    LogVerifier *verifier = GetLogVerifier(key_file_);
+    for (;;) {
+      Pending uploaded;
+      {
+        ScopedLock lock(&mutex_);
+        while (queue_.empty() && !done_)
+          CHECK_EQ(0, pthread_cond_wait(&changed_, &mutex_));
+        if (queue_.empty())
+          break;
+        uploaded = queue_.front();
+        queue_.pop_front();
+        CHECK_EQ(0, pthread_cond_broadcast(&changed_));
+      }
+
+      const BulkUploader::Submission &submission = uploaded.first;
+      if (submission.pre) {
+        // Rebuilding a precertificate entry takes the issuer's key, which
+        // only the log's certificate checks find.
+        Write(Line(submission, uploaded.second, "unverified"), true, false);
+        continue;
+      }
+      CertChain chain;
+      for (size_t n = 0; n < submission.chain.size(); ++n) {
+        Cert *cert = new Cert;
+        CHECK_EQ(Cert::TRUE, cert->LoadFromDerString(submission.chain[n]));
+        CHECK_EQ(Cert::TRUE, chain.AddCert(cert));
+      }
+      LogEntry entry;
+      string merkle_leaf;
+      const bool ok = CertSubmissionHandler::X509ChainToEntry(chain, &entry) &&
+          verifier->VerifySignedCertificateTimestamp(
+              entry, uploaded.second, &merkle_leaf) == LogVerifier::VERIFY_OK;
+      if (!ok) {
+        LOG(ERROR) << submission.name << ": the SCT does not verify";
+        ScopedLock lock(&mutex_);
+        ++invalid_;
+      }
+      Write(Line(submission, uploaded.second, ok ? "ok" : "invalid"), true,
+            ok);
+    }
+    delete verifier;
+  }
+
+  std::ostream *const out_;
+  const string key_file_;
+  const size_t threads_;
+  std::vector<pthread_t> verifiers_;
+
+  pthread_mutex_t mutex_;
+  pthread_cond_t changed_;
+  std::deque<Pending> queue_;
+  bool done_;
+  const uint64_t started_;
+  size_t uploaded_;
+  size_t failed_;
+  size_t verified_;
+  size_t invalid_;
+};
+
+// |chain|, the DER-encoded certificates, as concatenated PEM certificates,
+// which is how the protobuf protocol submits them.
+string PEMChain(const std::vector<string> &chain) {
+  string pem;
+  for (size_t i = 0; i < chain.size(); ++i) {
+    const string base64 = util::ToBase64(chain[i]);
+    pem.append("-----BEGIN CERTIFICATE-----\n");
+    for (size_t line = 0; line < base64.size(); line += 64)
+      pem.append(base64, line, 64).append("\n");
+    pem.append("-----END CERTIFICATE-----\n");
+  }
+  return pem;
+}
+
+// Upload everything from |source| to a protobuf log server over one
+// persistent connection, with up to |window| requests in flight, and pass
+// the outcome of each to |callback|, in order.
+void PipelinedUpload(LogClient *client, size_t window,
+                     BulkUploader::Source *source,
+                     BulkUploader::Callback *callback) {
+  client->SetPersistent(true);
+  // Batches of several windows keep the connection busy between them.
+  const size_t batch_size = 16 * window;
+  for ( ; ; ) {
+    std::vector<BulkUploader::Submission> batch;
+    for (BulkUploader::Submission submission;
+         batch.size() < batch_size && source->Next(&submission);
+         submission = BulkUploader::Submission())
+      batch.push_back(submission);
+    if (batch.empty())
+      return;
+
+    std::vector<ClientMessage> messages(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i)
+      LogClient::SubmissionMessage(PEMChain(batch[i].chain), batch[i].pre,
+                                   &messages[i]);
+    std::vector<ServerMessage> replies;
+    client->Pipeline(messages, window, &replies);
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+      SignedCertificateTimestamp sct;
+      HTTPLogClient::Status status = HTTPLogClient::OK;
+      if (i >= replies.size())
+        status = HTTPLogClient::CONNECT_FAILED;
+      else if (!LogClient::SubmissionReply(replies[i], &sct))
+        status = HTTPLogClient::UPLOAD_FAILED;
+      callback->Uploaded(batch[i], status, sct);
+    }
+  }
+}
+
+}  // namespace
+
+// Upload all the chains of --bulk_input, writing the SCTs to
+// --bulk_sct_out: with --http_log, over --bulk_parallel connections, and
+// otherwise pipelined over one.
+// 0 - all uploaded, and verified if there was a key
+// 1 - some failed
+static int BulkUpload() {
+  CHECK_NE(FLAGS_ct_server, "");
+  CHECK_NE(FLAGS_bulk_input, "");
+  CHECK_NE(FLAGS_bulk_sct_out, "");
+
+  std::ofstream out(FLAGS_bulk_sct_out.c_str(),
+                    std::ios::out | std::ios::app);
+  PCHECK(out.good()) << "Could not open " << FLAGS_bulk_sct_out;
+
+  struct stat st;
+  PCHECK(stat(FLAGS_bulk_input.c_str(), &st) == 0)
+      << "Could not stat " << FLAGS_bulk_input;
+  DirectorySource *dir = NULL;
+  LineSource *lines = NULL;
+  BulkUploader::Source *source;
+  if (S_ISDIR(st.st_mode))
+    source = dir = new DirectorySource(FLAGS_bulk_input);
+  else
+    source = lines = new LineSource(FLAGS_bulk_input);
+
+  SCTWriter writer(&out, FLAGS_ct_server_public_key,
+                   FLAGS_bulk_verify_threads);
+  if (FLAGS_http_log) {
+    BulkUploader uploader(HTTPLogClient(FLAGS_ct_server), FLAGS_bulk_parallel,
+                          FLAGS_bulk_retries);
+    uploader.Upload(source, &writer);
+  } else {
+    CHECK_GT(FLAGS_bulk_pipeline, 0);
+    LogClient client(FLAGS_ct_server, FLAGS_ct_server_port);
+    PipelinedUpload(&client, FLAGS_bulk_pipeline, source, &writer);
+  }
+  writer.Finish();
+  writer.Report();
+
+  const size_t skipped = dir != NULL ? dir->Skipped() : lines->Skipped();
+  if (skipped > 0)
+    LOG(ERROR) << skipped << " chains could not be read";
+  delete source;
+  return writer.Failed() + skipped > 0 ? 1 : 0;
+}
+
 // FIXME: fix all the memory leaks in this code.
 static void MakeCert() {
   string sct;
@@ -678,17 +1114,17 @@ static void DiagnoseCertChain() {
   LOG(INFO) << "Embedded SCT extension length is " << serialized_scts.length()
             << " bytes";
 
-  SignedCertificateTimestampList sct_list;
+  std::vector<ByteView> sct_list;
   if (Deserializer::DeserializeSCTList(serialized_scts, &sct_list) !=
       Deserializer::OK) {
     LOG(ERROR) << "Failed to parse SCT list from certificate";
     return;
   }
 
-  LOG(INFO) << "Certificate has " << sct_list.sct_list_size() << " SCTs";
-  for (int i = 0; i < sct_list.sct_list_size(); ++i) {
+  LOG(INFO) << "Certificate has " << sct_list.size() << " SCTs";
+  for (size_t i = 0; i < sct_list.size(); ++i) {
     SignedCertificateTimestamp sct;
-    if (Deserializer::DeserializeSCT(sct_list.sct_list(i), &sct) !=
+    if (Deserializer::DeserializeSCT(sct_list[i], &sct) !=
         Deserializer::OK) {
       LOG(ERROR) << "Failed to parse SCT number " << i + 1;
       continue;
@@ -784,37 +1220,91 @@ static void WriteCertificate(const std::string &cert, int entry,
  out << cert;
 }
 
+namespace {
+
+// Writes the certificates of each entry to files, and reports those that
+// don't parse or whose SCTs don't verify.
+class CertificateWriter : public EntryProcessor::Callback {
+ public:
+  CertificateWriter() : unparsed_(0), sct_verified_(0), sct_invalid_(0) {}
+
+  void Processed(int first, std::vector<HTTPLogClient::LogEntry> *entries,
+                 std::vector<EntryProcessor::ProcessedEntry> *processed) {
+    int e = first;
+    for (std::vector<HTTPLogClient::LogEntry>::const_iterator entry =
+             entries->begin(); entry != entries->end(); ++entry, ++e) {
+      const EntryProcessor::ProcessedEntry &result =
+          (*processed)[e - first];
+      VLOG(1) << "Entry " << e << " has leaf hash "
+              << util::ToBase64(result.leaf_hash);
+      if (result.cert == NULL) {
+        LOG(WARNING) << "The certificate of entry " << e
+                     << " does not parse";
+        ++unparsed_;
+      }
+      if (result.sct_check == EntryProcessor::SCT_VERIFIED) {
+        ++sct_verified_;
+      } else if (result.sct_check == EntryProcessor::SCT_INVALID) {
+        LOG(WARNING) << "The embedded SCTs of entry " << e
+                     << " do not verify";
+        ++sct_invalid_;
+      }
+      if (entry->leaf.timestamped_entry().entry_type() == ct::X509_ENTRY) {
+        WriteCertificate(
+            entry->leaf.timestamped_entry().signed_entry().x509(), e, 0,
+            "x509");
+        const ct::X509ChainEntry &x509chain = entry->entry.x509_entry();
+        for (int n = 0; n < x509chain.certificate_chain_size(); ++n)
+          WriteCertificate(x509chain.certificate_chain(n), e, n + 1, "x509");
+      } else {
+        assert(entry->leaf.timestamped_entry().entry_type()
+               == ct::PRECERT_ENTRY);
+        WriteCertificate(entry->leaf.timestamped_entry().signed_entry()
+                         .precert().tbs_certificate(), e, 0, "pre");
+        const ct::PrecertChainEntry &precertchain =
+            entry->entry.precert_entry();
+        for (int n = 0; n < precertchain.precertificate_chain_size(); ++n)
+          WriteCertificate(precertchain.precertificate_chain(n), e, n + 1,
+                           "x509");
+      }
+    }
+  }
+
+  void LogSummary() const {
+    LOG(INFO) << unparsed_ << " certificates do not parse";
+    if (FLAGS_get_check_scts)
+      LOG(INFO) << sct_verified_ << " certificates have embedded SCTs that "
+                << "verify, and " << sct_invalid_ << " have ones that don't";
+  }
+
+ private:
+  int unparsed_;
+  int sct_verified_;
+  int sct_invalid_;
+};
+
+}  // namespace
+
 void GetEntries() {
   CHECK(FLAGS_http_log);
+  CHECK(!FLAGS_certificate_base.empty());
 
   HTTPLogClient client(FLAGS_ct_server);
-  std::vector<HTTPLogClient::LogEntry> entries;
-  HTTPLogClient::Status error = client.GetEntries(FLAGS_get_first,
-                                                  FLAGS_get_last, &entries);
+  EntryFetcher fetcher(client, FLAGS_get_entries_parallel,
+                       FLAGS_get_entries_batch_size,
+                       FLAGS_get_entries_retries);
+  LogVerifier *verifier =
+      FLAGS_get_check_scts ? GetLogVerifierFromFlags() : NULL;
+  CertificateWriter writer;
+  // Parsing and hashing go over the shared pool, so that they keep up
+  // with the fetches; the files are written in order.
+  EntryProcessor processor(util::ThreadPool::Default(), true, verifier,
+                           &writer);
+  HTTPLogClient::Status error = fetcher.Fetch(FLAGS_get_first,
+                                              FLAGS_get_last, &processor);
   CHECK_EQ(error, HTTPLogClient::OK);
-
-  CHECK(!FLAGS_certificate_base.empty());
-
-  int e = FLAGS_get_first;
-  for (std::vector<HTTPLogClient::LogEntry>::const_iterator entry =
-           entries.begin(); entry != entries.end(); ++entry, ++e) {
-    if (entry->leaf.timestamped_entry().entry_type() == ct::X509_ENTRY) {
-      WriteCertificate(entry->leaf.timestamped_entry().signed_entry().x509(),
-                       e, 0, "x509");
-      const ct::X509ChainEntry &x509chain = entry->entry.x509_entry();
-      for (int n = 0; n < x509chain.certificate_chain_size(); ++n)
-        WriteCertificate(x509chain.certificate_chain(n), e, n + 1, "x509");
-    } else {
-      assert(entry->leaf.timestamped_entry().entry_type()
-             == ct::PRECERT_ENTRY);
-      WriteCertificate(entry->leaf.timestamped_entry().signed_entry()
-                       .precert().tbs_certificate(), e, 0, "pre");
-      const ct::PrecertChainEntry &precertchain = entry->entry.precert_entry();
-      for (int n = 0; n < precertchain.precertificate_chain_size(); ++n)
-        WriteCertificate(precertchain.precertificate_chain(n), e, n + 1,
-                         "x509");
-    }
-  }
+  writer.LogSummary();
+  delete verifier;
 }
 
 int GetSTH() {
@@ -852,24 +1342,85 @@ int GetSTH() {
   return 0;
 }
 
-static monitor::Database *GetMonitorDBFromFlags() {
-  CHECK_NE(FLAGS_sqlite_db, "");
+static monitor::Database *GetMonitorDB(const string &file) {
   monitor::Database *db;
-  db = new monitor::SQLiteDB(FLAGS_sqlite_db);
+  monitor::SQLiteDB *sqlite_db = new monitor::SQLiteDB(file);
+  if (FLAGS_monitor_wal)
+    sqlite_db->EnableWriteAheadLog();
+  db = sqlite_db;
   return db;
 }
 
+static monitor::Database *GetMonitorDBFromFlags() {
+  CHECK_NE(FLAGS_sqlite_db, "");
+  return GetMonitorDB(FLAGS_sqlite_db);
+}
+
+// Monitor the logs listed in --monitor_logs until killed.
+static void Supervise() {
+  CHECK_NE(FLAGS_monitor_logs, "");
+  std::ifstream in(FLAGS_monitor_logs.c_str());
+  PCHECK(in.good()) << "Could not read " << FLAGS_monitor_logs;
+
+  monitor::Supervisor supervisor(FLAGS_monitor_threads,
+                                 FLAGS_monitor_min_sleep_time_secs,
+                                 FLAGS_monitor_sleep_time_secs,
+                                 FLAGS_monitor_step_entries);
+  string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream fields(line);
+    string server, key, db;
+    CHECK(fields >> server >> key >> db) << "Bad line: " << line;
+    supervisor.Add(server, new monitor::Monitor(
+        GetMonitorDB(db), GetLogVerifier(key), HTTPLogClient(server),
+        FLAGS_monitor_sleep_time_secs, FLAGS_get_entries_parallel,
+        FLAGS_get_entries_batch_size, FLAGS_get_entries_retries,
+        FLAGS_monitor_prepare_threads, FLAGS_monitor_index_domains,
+        FLAGS_monitor_chain_consistency));
+  }
+  supervisor.Run();
+}
+
+// Print the log indices of the entries that --domain finds, one per line.
+static int LookupDomain() {
+  CHECK_NE(FLAGS_domain, "");
+  monitor::Database *db = GetMonitorDBFromFlags();
+  std::vector<uint64_t> sequence_numbers;
+  CHECK_EQ(monitor::Database::LOOKUP_OK,
+           db->LookupByDomain(FLAGS_domain, FLAGS_include_subdomains,
+                              &sequence_numbers));
+  // The database numbers entries from 1.
+  for (size_t i = 0; i < sequence_numbers.size(); ++i)
+    std::cout << sequence_numbers[i] - 1 << std::endl;
+  delete db;
+  return sequence_numbers.empty() ? 1 : 0;
+}
+
 // Return code 0 indicates success.
 // See monitor class for the monitor action specific return codes.
 int Monitor() {
   CHECK_NE(FLAGS_monitor_action, "");
+  if (FLAGS_monitor_action == "lookup_domain")
+    return LookupDomain();
   CHECK(FLAGS_http_log);
+  if (FLAGS_monitor_action == "supervise") {
+    Supervise();
+    return 0;
+  }
   CHECK_NE(FLAGS_ct_server, "");
 
   monitor::Monitor monitor(GetMonitorDBFromFlags(),
                            GetLogVerifierFromFlags(),
                            HTTPLogClient(FLAGS_ct_server),
-                           FLAGS_monitor_sleep_time_secs);
+                           FLAGS_monitor_sleep_time_secs,
+                           FLAGS_get_entries_parallel,
+                           FLAGS_get_entries_batch_size,
+                           FLAGS_get_entries_retries,
+                           FLAGS_monitor_prepare_threads,
+                           FLAGS_monitor_index_domains,
+                           FLAGS_monitor_chain_consistency);
 
   int ret = 0;
   if (FLAGS_monitor_action == "get_sth") {
@@ -926,6 +1477,8 @@ int main(int argc, char **argv) {
       ret = 1;
   } else  if (cmd == "upload") {
     ret = Upload();
+  } else if (cmd == "bulk_upload") {
+    ret = BulkUpload();
   } else if (cmd == "audit") {
     ret = Audit();
   } else if (cmd == "consistency") {
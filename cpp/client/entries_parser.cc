@@ -0,0 +1,410 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "client/entries_parser.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+
+using std::string;
+
+namespace {
+
+// Replies don't nest deeper than this unless they are up to no good.
+const size_t kMaxDepth = 64;
+
+// Member names are kept up to this long; those we look for are shorter.
+const size_t kMaxKey = 16;
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Characters of numbers, true, false and null.
+bool IsScalarChar(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '-' ||
+      c == '+' || c == '.' || c == 'E';
+}
+
+int HexValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+int Base64Value(char c) {
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if (c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if (c == '+')
+    return 62;
+  if (c == '/')
+    return 63;
+  return -1;
+}
+
+}  // namespace
+
+void EntriesParser::Base64Decoder::Reset() {
+  bits_ = 0;
+  count_ = 0;
+  padding_ = 0;
+}
+
+bool EntriesParser::Base64Decoder::Put(char c, string *out) {
+  // As util::FromBase64 does.
+  if (IsSpace(c))
+    return true;
+  if (c == '=') {
+    // At most two, at the end of a quantum.
+    if (count_ < 2 || padding_ == 2)
+      return false;
+    ++padding_;
+    bits_ <<= 6;
+  } else {
+    const int value = Base64Value(c);
+    // Nothing can follow the padding.
+    if (value < 0 || padding_ > 0)
+      return false;
+    bits_ = (bits_ << 6) | value;
+  }
+  if (++count_ < 4)
+    return true;
+
+  out->push_back(static_cast<char>(bits_ >> 16));
+  if (padding_ < 2)
+    out->push_back(static_cast<char>(bits_ >> 8));
+  if (padding_ < 1)
+    out->push_back(static_cast<char>(bits_));
+  bits_ = 0;
+  count_ = 0;
+  // |padding_| stays set, so that nothing can follow it.
+  return true;
+}
+
+EntriesParser::EntriesParser() {
+  Reset();
+}
+
+void EntriesParser::Reset() {
+  failed_ = false;
+  expect_ = VALUE;
+  frames_.clear();
+  key_.clear();
+  seen_entries_ = false;
+  in_string_ = false;
+  string_kind_ = OTHER;
+  escape_ = 0;
+  unicode_ = 0;
+  in_scalar_ = false;
+  have_leaf_ = false;
+  have_extra_ = false;
+  entries_.clear();
+}
+
+bool EntriesParser::Parse(const char *data, size_t size) {
+  size_t i = 0;
+  while (i < size && !failed_) {
+    if (in_string_ && escape_ == 0) {
+      // Most of a reply is base64 in strings, so take runs of it at once.
+      size_t end = i;
+      while (end < size && data[end] != '"' && data[end] != '\\' &&
+             static_cast<unsigned char>(data[end]) >= 0x20)
+        ++end;
+      if (!Chars(data + i, end - i)) {
+        failed_ = true;
+        break;
+      }
+      i = end;
+      if (i == size)
+        break;
+    }
+    if (!Next(data[i]))
+      failed_ = true;
+    ++i;
+  }
+  return !failed_;
+}
+
+HTTPLogClient::Status EntriesParser::Finish() const {
+  if (failed_ || expect_ != DONE || !seen_entries_)
+    return HTTPLogClient::BAD_RESPONSE;
+  return HTTPLogClient::OK;
+}
+
+bool EntriesParser::Next(char c) {
+  if (in_string_)
+    return StringChar(c);
+  if (in_scalar_) {
+    if (IsScalarChar(c))
+      return true;
+    in_scalar_ = false;
+    if (!EndValue())
+      return false;
+    // And |c| is what follows it.
+  }
+  if (IsSpace(c))
+    return true;
+
+  switch (expect_) {
+    case FIRST_VALUE:
+      if (c == ']')
+        return Close(c);
+      return BeginValue(c);
+    case VALUE:
+      return BeginValue(c);
+    case FIRST_KEY:
+      if (c == '}')
+        return Close(c);
+      // Fall through.
+    case NEXT_KEY:
+      if (c != '"')
+        return false;
+      BeginString(frames_.back().kind == TOP || frames_.back().kind == ENTRY
+                  ? KEY : OTHER);
+      return true;
+    case COLON:
+      if (c != ':')
+        return false;
+      expect_ = VALUE;
+      return true;
+    case NEXT:
+      if (c == ',') {
+        expect_ = frames_.back().object ? NEXT_KEY : VALUE;
+        return true;
+      }
+      if (c == '}' || c == ']')
+        return Close(c);
+      return false;
+    case DONE:
+      return false;
+  }
+  return false;
+}
+
+EntriesParser::Kind EntriesParser::ValueKind() const {
+  if (frames_.empty())
+    return TOP;
+  switch (frames_.back().kind) {
+    case TOP:
+      return key_ == "entries" ? ENTRIES : OTHER;
+    case ENTRIES:
+      return ENTRY;
+    case ENTRY:
+      if (key_ == "leaf_input")
+        return LEAF_INPUT;
+      if (key_ == "extra_data")
+        return EXTRA_DATA;
+      return OTHER;
+    default:
+      return OTHER;
+  }
+}
+
+bool EntriesParser::BeginValue(char c) {
+  const Kind kind = ValueKind();
+  if (c == '{') {
+    if (kind != TOP && kind != ENTRY && kind != OTHER)
+      return false;
+    if (frames_.size() == kMaxDepth)
+      return false;
+    frames_.push_back(Frame(kind, true));
+    expect_ = FIRST_KEY;
+    if (kind == ENTRY) {
+      have_leaf_ = false;
+      have_extra_ = false;
+    }
+    return true;
+  }
+  if (c == '[') {
+    if (kind != OTHER && (kind != ENTRIES || seen_entries_))
+      return false;
+    if (frames_.size() == kMaxDepth)
+      return false;
+    frames_.push_back(Frame(kind, false));
+    expect_ = FIRST_VALUE;
+    return true;
+  }
+  if (c == '"') {
+    if (kind != LEAF_INPUT && kind != EXTRA_DATA && kind != OTHER)
+      return false;
+    BeginString(kind);
+    return true;
+  }
+  if (kind != OTHER || !IsScalarChar(c))
+    return false;
+  in_scalar_ = true;
+  return true;
+}
+
+bool EntriesParser::EndValue() {
+  expect_ = frames_.empty() ? DONE : NEXT;
+  return true;
+}
+
+bool EntriesParser::Close(char c) {
+  const Frame frame = frames_.back();
+  if (frame.object != (c == '}'))
+    return false;
+  if (frame.kind == ENTRY && !FinishEntry())
+    return false;
+  if (frame.kind == ENTRIES)
+    seen_entries_ = true;
+  frames_.pop_back();
+  return EndValue();
+}
+
+void EntriesParser::BeginString(Kind kind) {
+  in_string_ = true;
+  string_kind_ = kind;
+  escape_ = 0;
+  if (kind == KEY) {
+    key_.clear();
+  } else if (kind == LEAF_INPUT) {
+    leaf_.clear();
+    decoder_.Reset();
+  } else if (kind == EXTRA_DATA) {
+    extra_.clear();
+    decoder_.Reset();
+  }
+}
+
+bool EntriesParser::StringChar(char c) {
+  if (escape_ == 0) {
+    if (c == '"')
+      return EndString();
+    if (c == '\\') {
+      escape_ = 1;
+      return true;
+    }
+    // Control characters must be escaped.
+    if (static_cast<unsigned char>(c) < 0x20)
+      return false;
+    return Chars(&c, 1);
+  }
+
+  if (escape_ == 1) {
+    char unescaped;
+    switch (c) {
+      case '"':
+      case '\\':
+      case '/':
+        unescaped = c;
+        break;
+      case 'b':
+        unescaped = '\b';
+        break;
+      case 'f':
+        unescaped = '\f';
+        break;
+      case 'n':
+        unescaped = '\n';
+        break;
+      case 'r':
+        unescaped = '\r';
+        break;
+      case 't':
+        unescaped = '\t';
+        break;
+      case 'u':
+        escape_ = 2;
+        unicode_ = 0;
+        return true;
+      default:
+        return false;
+    }
+    escape_ = 0;
+    return Chars(&unescaped, 1);
+  }
+
+  const int value = HexValue(c);
+  if (value < 0)
+    return false;
+  unicode_ = unicode_ * 16 + value;
+  if (++escape_ < 6)
+    return true;
+  escape_ = 0;
+  // Only ASCII is of any use in the strings we read; anything else is
+  // neither base64 nor a member name we look for.
+  const char ascii = unicode_ < 0x80 ? static_cast<char>(unicode_) : '?';
+  return Chars(&ascii, 1);
+}
+
+bool EntriesParser::Chars(const char *data, size_t size) {
+  string *out;
+  switch (string_kind_) {
+    case KEY:
+      if (key_.size() < kMaxKey)
+        key_.append(data, std::min(size, kMaxKey - key_.size()));
+      return true;
+    case LEAF_INPUT:
+      out = &leaf_;
+      break;
+    case EXTRA_DATA:
+      out = &extra_;
+      break;
+    default:
+      return true;
+  }
+  for (size_t i = 0; i < size; ++i)
+    if (!decoder_.Put(data[i], out))
+      return false;
+  return true;
+}
+
+bool EntriesParser::EndString() {
+  in_string_ = false;
+  // Member names, of skipped objects too, are followed by their values.
+  if (expect_ == FIRST_KEY || expect_ == NEXT_KEY) {
+    expect_ = COLON;
+    return true;
+  }
+  switch (string_kind_) {
+    case LEAF_INPUT:
+      if (!decoder_.End())
+        return false;
+      have_leaf_ = true;
+      break;
+    case EXTRA_DATA:
+      if (!decoder_.End())
+        return false;
+      have_extra_ = true;
+      break;
+    default:
+      break;
+  }
+  return EndValue();
+}
+
+bool EntriesParser::FinishEntry() {
+  if (!have_leaf_ || !have_extra_)
+    return false;
+
+  entries_.push_back(HTTPLogClient::LogEntry());
+  HTTPLogClient::LogEntry &log_entry = entries_.back();
+  if (Deserializer::DeserializeMerkleTreeLeaf(leaf_, &log_entry.leaf)
+      != Deserializer::OK) {
+    entries_.pop_back();
+    return false;
+  }
+
+  if (log_entry.leaf.timestamped_entry().entry_type() == ct::X509_ENTRY)
+    Deserializer::DeserializeX509Chain(extra_,
+                                       log_entry.entry.mutable_x509_entry());
+  else if (log_entry.leaf.timestamped_entry().entry_type()
+           == ct::PRECERT_ENTRY)
+    Deserializer::DeserializePrecertChainEntry(extra_,
+        log_entry.entry.mutable_precert_entry());
+  else
+    LOG(FATAL) << "Don't understand entry type: "
+               << log_entry.leaf.timestamped_entry().entry_type();
+  return true;
+}
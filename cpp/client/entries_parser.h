@@ -0,0 +1,150 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef ENTRIES_PARSER_H
+#define ENTRIES_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "client/http_log_client.h"
+
+// Parses a get-entries reply as it arrives, in pieces of any size, without
+// holding on to the reply or building a JSON tree of it: the base64 of
+// each entry is decoded as it is read, and the entry deserialized as soon
+// as its object is closed. Members other than "entries", and the entry
+// fields other than "leaf_input" and "extra_data", are skipped.
+class EntriesParser {
+ public:
+  EntriesParser();
+
+  // Start over on a new reply, dropping the entries.
+  void Reset();
+
+  // Parse the next |size| bytes of the reply. Returns false, and ignores
+  // any more, once the reply is known to be bad.
+  bool Parse(const char *data, size_t size);
+
+  // OK if the reply was complete and well-formed, or else BAD_RESPONSE.
+  HTTPLogClient::Status Finish() const;
+
+  // The entries parsed so far. They may be taken by swapping them out.
+  std::vector<HTTPLogClient::LogEntry> *entries() { return &entries_; }
+
+ private:
+  // What a value, or the string being read, is.
+  enum Kind {
+    // The reply object.
+    TOP,
+    // Its "entries" array.
+    ENTRIES,
+    // An object in it.
+    ENTRY,
+    // Its fields.
+    LEAF_INPUT,
+    EXTRA_DATA,
+    // A member name in TOP or ENTRY.
+    KEY,
+    // Anything else.
+    OTHER,
+  };
+
+  // What comes next, past whitespace.
+  enum Expect {
+    VALUE,
+    // After '[': a value or ']'.
+    FIRST_VALUE,
+    // After '{': a member name or '}'.
+    FIRST_KEY,
+    // After ',' in an object.
+    NEXT_KEY,
+    COLON,
+    // A ',' or the end of the enclosing object or array.
+    NEXT,
+    // Trailing whitespace.
+    DONE,
+  };
+
+  // An open object or array.
+  struct Frame {
+    Frame(Kind frame_kind, bool frame_object)
+        : kind(frame_kind), object(frame_object) {}
+
+    Kind kind;
+    bool object;
+  };
+
+  // Decodes base64 a character at a time.
+  class Base64Decoder {
+   public:
+    Base64Decoder() { Reset(); }
+
+    void Reset();
+
+    // Append what |c| completes to |out|. False if |c| can't come next.
+    bool Put(char c, std::string *out);
+
+    // Whether the input ended on a boundary.
+    bool End() const { return count_ == 0; }
+
+   private:
+    uint32_t bits_;
+    // Characters of the current quantum seen, and how many were '='.
+    int count_;
+    int padding_;
+  };
+
+  // Parse |c|, outside the run of plain string characters.
+  bool Next(char c);
+
+  // The kind of a value starting here.
+  Kind ValueKind() const;
+
+  bool BeginValue(char c);
+
+  // A value has ended.
+  bool EndValue();
+
+  // Close the innermost object or array with |c|.
+  bool Close(char c);
+
+  void BeginString(Kind kind);
+
+  // Parse |c| in a string.
+  bool StringChar(char c);
+
+  // Take |size| plain characters of a string.
+  bool Chars(const char *data, size_t size);
+
+  bool EndString();
+
+  // Deserialize the entry whose object just closed.
+  bool FinishEntry();
+
+  bool failed_;
+  Expect expect_;
+  std::vector<Frame> frames_;
+  // The last member name in TOP or ENTRY.
+  std::string key_;
+  bool seen_entries_;
+
+  // The string being read, if any.
+  bool in_string_;
+  Kind string_kind_;
+  // 0, or 1 after a backslash, or 2 to 5 in the digits of a \u escape.
+  int escape_;
+  int unicode_;
+  // Whether in a number or a literal.
+  bool in_scalar_;
+
+  // The decoded fields of the current entry.
+  Base64Decoder decoder_;
+  std::string leaf_;
+  bool have_leaf_;
+  std::string extra_;
+  bool have_extra_;
+
+  std::vector<HTTPLogClient::LogEntry> entries_;
+};
+
+#endif
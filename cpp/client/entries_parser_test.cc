@@ -0,0 +1,270 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "client/entries_parser.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace {
+
+using std::string;
+
+typedef HTTPLogClient::LogEntry LogEntry;
+
+class EntriesParserTest : public ::testing::Test {
+ protected:
+  EntriesParserTest() {
+    for (int i = 0; i < 3; ++i) {
+      string leaf_input;
+      CHECK_EQ(Serializer::OK, Serializer::SerializeV1CertSCTMerkleTreeLeaf(
+          1000 + i, util::RandomString(100, 200), "", &leaf_input));
+      ct::X509ChainEntry chain;
+      chain.add_certificate_chain(util::RandomString(100, 200));
+      chain.add_certificate_chain(util::RandomString(100, 200));
+      string extra_data;
+      CHECK_EQ(Serializer::OK,
+               Serializer::SerializeX509Chain(chain, &extra_data));
+      leaf_inputs_.push_back(leaf_input);
+      extra_datas_.push_back(extra_data);
+    }
+  }
+
+  // A reply with all the entries, made by |Field| from their fields.
+  string Reply(string (*Field)(const string &) = util::ToBase64) const {
+    string reply = "{\"entries\":[";
+    for (size_t i = 0; i < leaf_inputs_.size(); ++i) {
+      if (i > 0)
+        reply += ",";
+      reply += "{\"leaf_input\":\"" + Field(leaf_inputs_[i]) +
+          "\",\"extra_data\":\"" + Field(extra_datas_[i]) + "\"}";
+    }
+    return reply + "]}";
+  }
+
+  // Parse |reply| in one go.
+  static HTTPLogClient::Status Parse(const string &reply,
+                                     EntriesParser *parser) {
+    parser->Reset();
+    parser->Parse(reply.data(), reply.size());
+    return parser->Finish();
+  }
+
+  static bool Parses(const string &reply) {
+    EntriesParser parser;
+    return Parse(reply, &parser) == HTTPLogClient::OK;
+  }
+
+  // Whether |parser| has all the entries.
+  ::testing::AssertionResult HasEntries(EntriesParser *parser) const {
+    const std::vector<LogEntry> &entries = *parser->entries();
+    if (entries.size() != leaf_inputs_.size())
+      return ::testing::AssertionFailure() << entries.size() << " entries";
+    for (size_t i = 0; i < entries.size(); ++i) {
+      string leaf_input, extra_data;
+      CHECK_EQ(Serializer::OK, Serializer::SerializeV1CertSCTMerkleTreeLeaf(
+          entries[i].leaf.timestamped_entry().timestamp(),
+          entries[i].leaf.timestamped_entry().signed_entry().x509(),
+          entries[i].leaf.timestamped_entry().extensions(), &leaf_input));
+      CHECK_EQ(Serializer::OK, Serializer::SerializeX509Chain(
+          entries[i].entry.x509_entry(), &extra_data));
+      if (leaf_input != leaf_inputs_[i] || extra_data != extra_datas_[i])
+        return ::testing::AssertionFailure() << "entry " << i << " differs";
+    }
+    return ::testing::AssertionSuccess();
+  }
+
+  std::vector<string> leaf_inputs_;
+  std::vector<string> extra_datas_;
+};
+
+// |from| in base64, written with escapes: '/' as "\/", and every other
+// character as "\u00XX".
+string EscapedBase64(const string &from) {
+  const string base64 = util::ToBase64(from);
+  string escaped;
+  for (size_t i = 0; i < base64.size(); ++i) {
+    if (base64[i] == '/') {
+      escaped += "\\/";
+    } else if (i % 2 == 0) {
+      char unicode[7];
+      snprintf(unicode, sizeof unicode, "\\u%04X", base64[i]);
+      escaped += unicode;
+    } else {
+      escaped += base64[i];
+    }
+  }
+  return escaped;
+}
+
+TEST_F(EntriesParserTest, Parse) {
+  EntriesParser parser;
+  EXPECT_EQ(HTTPLogClient::OK, Parse(Reply(), &parser));
+  EXPECT_TRUE(HasEntries(&parser));
+
+  EXPECT_EQ(HTTPLogClient::OK, Parse("{\"entries\":[]}", &parser));
+  EXPECT_TRUE(parser.entries()->empty());
+}
+
+TEST_F(EntriesParserTest, SplitAnywhere) {
+  const string reply(Reply());
+  EntriesParser parser;
+  for (size_t split = 0; split <= reply.size(); ++split) {
+    parser.Reset();
+    EXPECT_TRUE(parser.Parse(reply.data(), split));
+    EXPECT_TRUE(parser.Parse(reply.data() + split, reply.size() - split));
+    ASSERT_EQ(HTTPLogClient::OK, parser.Finish()) << "split at " << split;
+    ASSERT_TRUE(HasEntries(&parser)) << "split at " << split;
+  }
+
+  // And a byte at a time.
+  parser.Reset();
+  for (size_t i = 0; i < reply.size(); ++i)
+    EXPECT_TRUE(parser.Parse(reply.data() + i, 1));
+  EXPECT_EQ(HTTPLogClient::OK, parser.Finish());
+  EXPECT_TRUE(HasEntries(&parser));
+}
+
+TEST_F(EntriesParserTest, Escapes) {
+  const string reply(Reply(EscapedBase64));
+  EntriesParser parser;
+  EXPECT_EQ(HTTPLogClient::OK, Parse(reply, &parser));
+  EXPECT_TRUE(HasEntries(&parser));
+
+  // Escapes split between pieces.
+  for (size_t split = 0; split <= reply.size(); ++split) {
+    parser.Reset();
+    parser.Parse(reply.data(), split);
+    parser.Parse(reply.data() + split, reply.size() - split);
+    ASSERT_EQ(HTTPLogClient::OK, parser.Finish()) << "split at " << split;
+    ASSERT_TRUE(HasEntries(&parser)) << "split at " << split;
+  }
+
+  // In member names, and in skipped strings.
+  string escaped_names(Reply());
+  escaped_names.replace(escaped_names.find("entries"), 7,
+                        "\\u0065ntries");
+  escaped_names.replace(escaped_names.find("leaf_input"), 10,
+                        "leaf\\u005finput");
+  escaped_names.insert(1, "\"a\\\"b\\\\\":\"\\\"\\\\\\/\\u00e9\\n\",");
+  EXPECT_EQ(HTTPLogClient::OK, Parse(escaped_names, &parser));
+  EXPECT_TRUE(HasEntries(&parser));
+
+  EXPECT_FALSE(Parses("{\"a\":\"\\x\",\"entries\":[]}"));
+  EXPECT_FALSE(Parses("{\"a\":\"\\u00g0\",\"entries\":[]}"));
+  // Unescaped control characters.
+  EXPECT_FALSE(Parses("{\"a\":\"\n\",\"entries\":[]}"));
+}
+
+TEST_F(EntriesParserTest, SkipsOtherMembers) {
+  string reply(Reply());
+  reply.insert(1, "\"a\":{\"b\":[1,-2.5e3,true,null,{\"entries\":[]}]},");
+  reply.insert(reply.find("\"extra_data\""), "\"index\":7,");
+  EntriesParser parser;
+  EXPECT_EQ(HTTPLogClient::OK, Parse(reply, &parser));
+  EXPECT_TRUE(HasEntries(&parser));
+}
+
+TEST_F(EntriesParserTest, InvalidBase64) {
+  string reply(Reply());
+  reply[reply.find("\"leaf_input\":\"") + 15] = '*';
+  EXPECT_FALSE(Parses(reply));
+
+  // Padding only at the end of a quantum, and nothing after it.
+  EXPECT_FALSE(Parses("{\"entries\":[{\"leaf_input\":\"A===\","
+                      "\"extra_data\":\"\"}]}"));
+  EXPECT_FALSE(Parses("{\"entries\":[{\"leaf_input\":\"AA==AA==\","
+                      "\"extra_data\":\"\"}]}"));
+  // Not a whole quantum.
+  EXPECT_FALSE(Parses("{\"entries\":[{\"leaf_input\":\"AAA\","
+                      "\"extra_data\":\"\"}]}"));
+}
+
+TEST_F(EntriesParserTest, UnexpectedTypes) {
+  EXPECT_FALSE(Parses("[]"));
+  EXPECT_FALSE(Parses("\"entries\""));
+  EXPECT_FALSE(Parses("{\"entries\":{}}"));
+  EXPECT_FALSE(Parses("{\"entries\":\"\"}"));
+  EXPECT_FALSE(Parses("{\"entries\":7}"));
+  EXPECT_FALSE(Parses("{\"entries\":[[]]}"));
+  EXPECT_FALSE(Parses("{\"entries\":[7]}"));
+  EXPECT_FALSE(Parses("{\"entries\":[{\"leaf_input\":7}]}"));
+  EXPECT_FALSE(Parses("{\"entries\":[{\"leaf_input\":[]}]}"));
+  EXPECT_FALSE(Parses("{\"entries\":[{\"extra_data\":{}}]}"));
+  // Only one "entries".
+  EXPECT_FALSE(Parses("{\"entries\":[],\"entries\":[]}"));
+
+  // Entries need both fields.
+  EXPECT_FALSE(Parses("{\"entries\":[{}]}"));
+  string reply(Reply());
+  const size_t extra = reply.find(",\"extra_data\"");
+  EXPECT_FALSE(Parses(reply.erase(extra, reply.find('}') - extra)));
+  // And must be leaves.
+  EXPECT_FALSE(Parses("{\"entries\":[{\"leaf_input\":\"AAAA\","
+                      "\"extra_data\":\"\"}]}"));
+
+  // Mismatched brackets, and a missing colon.
+  EXPECT_FALSE(Parses("{\"entries\":[}"));
+  EXPECT_FALSE(Parses("{\"entries\":[]]"));
+  EXPECT_FALSE(Parses("{\"entries\" []}"));
+  // Something after the reply.
+  EXPECT_FALSE(Parses("{\"entries\":[]} {}"));
+  EXPECT_TRUE(Parses("{\"entries\":[]} \n"));
+}
+
+TEST_F(EntriesParserTest, Nesting) {
+  string deep;
+  for (int depth = 1; depth < 64; ++depth)
+    deep = "[" + deep + "]";
+  EXPECT_TRUE(Parses("{\"a\":" + deep + ",\"entries\":[]}"));
+  EXPECT_FALSE(Parses("{\"a\":[" + deep + "],\"entries\":[]}"));
+}
+
+TEST_F(EntriesParserTest, Truncated) {
+  const string reply(Reply());
+  EntriesParser parser;
+  for (size_t size = 0; size < reply.size(); ++size)
+    EXPECT_EQ(HTTPLogClient::BAD_RESPONSE,
+              Parse(reply.substr(0, size), &parser)) << size << " bytes";
+  EXPECT_FALSE(Parses("{}"));
+}
+
+TEST_F(EntriesParserTest, LongFields) {
+  // Member names are only matched as long as those looked for.
+  EXPECT_FALSE(Parses("{\"entries_and_then_some\":[]}"));
+  string reply(Reply());
+  reply.replace(reply.find("leaf_input"), 10,
+                "leaf_input_and_then_some");
+  EXPECT_FALSE(Parses(reply));
+
+  // Long names and values are skipped.
+  reply = Reply();
+  const string long_name(1 << 16, 'a');
+  reply.insert(1, "\"" + long_name + "\":\"" + long_name + "\",");
+  EntriesParser parser;
+  EXPECT_EQ(HTTPLogClient::OK, Parse(reply, &parser));
+  EXPECT_TRUE(HasEntries(&parser));
+}
+
+TEST_F(EntriesParserTest, Failed) {
+  EntriesParser parser;
+  EXPECT_FALSE(parser.Parse("]", 1));
+  // Stays failed until reset.
+  const string reply(Reply());
+  EXPECT_FALSE(parser.Parse(reply.data(), reply.size()));
+  EXPECT_EQ(HTTPLogClient::BAD_RESPONSE, parser.Finish());
+  EXPECT_EQ(HTTPLogClient::OK, Parse(reply, &parser));
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
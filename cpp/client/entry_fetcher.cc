@@ -0,0 +1,246 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "client/entry_fetcher.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+#include <sstream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+using std::string;
+
+EntryFetcher::EntryFetcher(const HTTPLogClient &client, int parallel,
+                           int batch_size, int max_retries)
+    : server_(client.Server()),
+      max_retries_(max_retries),
+      batch_size_(batch_size),
+      max_batch_size_(batch_size),
+      multi_(CHECK_NOTNULL(curl_multi_init())),
+      requests_(parallel),
+      next_(0),
+      last_(0) {
+  CHECK_GT(parallel, 0);
+  CHECK_GT(batch_size, 0);
+  CHECK_GE(max_retries, 0);
+#ifdef CURLPIPE_MULTIPLEX
+  // Requests share an HTTP/2 connection where there is one.
+  curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+  for (size_t i = 0; i < requests_.size(); ++i)
+    requests_[i].handle = CHECK_NOTNULL(curl_easy_init());
+}
+
+EntryFetcher::~EntryFetcher() {
+  for (size_t i = 0; i < requests_.size(); ++i) {
+    if (requests_[i].busy)
+      curl_multi_remove_handle(multi_, requests_[i].handle);
+    curl_easy_cleanup(requests_[i].handle);
+  }
+  curl_multi_cleanup(multi_);
+}
+
+HTTPLogClient::Status EntryFetcher::Fetch(int first, int last,
+                                          Callback *callback) {
+  CHECK_GE(first, 0);
+  CHECK_GE(last, first);
+  todo_.clear();
+  done_.clear();
+  next_ = first;
+  last_ = last;
+  int delivered = first;
+  size_t running = 0;
+
+  while (delivered <= last) {
+    // Keep every request busy, but don't run too far ahead of the entries
+    // we still wait for.
+    while (running < requests_.size() &&
+           done_.size() + running < 2 * requests_.size()) {
+      Range range;
+      if (!todo_.empty()) {
+        range = todo_.begin()->second;
+        todo_.erase(todo_.begin());
+      } else if (next_ <= last_) {
+        range.first = next_;
+        range.last = std::min(last_, next_ + batch_size_ - 1);
+        next_ = range.last + 1;
+      } else {
+        break;
+      }
+      // Ranges from before the server told us its limit.
+      if (range.last - range.first + 1 > batch_size_) {
+        Range rest(range);
+        rest.first = range.first + batch_size_;
+        todo_[rest.first] = rest;
+        range.last = rest.first - 1;
+      }
+      Start(range);
+      ++running;
+    }
+    CHECK_GT(running, 0U);
+
+    int still_running;
+    curl_multi_perform(multi_, &still_running);
+    CURLMsg *message;
+    int queued;
+    while ((message = curl_multi_info_read(multi_, &queued)) != NULL) {
+      if (message->msg != CURLMSG_DONE)
+        continue;
+      const CURLcode code = message->data.result;
+      Request *request = NULL;
+      for (size_t i = 0; i < requests_.size(); ++i)
+        if (requests_[i].handle == message->easy_handle)
+          request = &requests_[i];
+      CHECK_NOTNULL(request);
+      curl_multi_remove_handle(multi_, request->handle);
+      request->busy = false;
+      --running;
+      const HTTPLogClient::Status status = Finish(request, code);
+      if (status != HTTPLogClient::OK)
+        return status;
+    }
+
+    while (!done_.empty() && done_.begin()->first == delivered) {
+      const int count = done_.begin()->second.size();
+      callback->Entries(delivered, &done_.begin()->second);
+      delivered += count;
+      done_.erase(done_.begin());
+    }
+
+    if (delivered <= last && running > 0)
+      curl_multi_wait(multi_, NULL, 0, 1000, NULL);
+  }
+  return HTTPLogClient::OK;
+}
+
+void EntryFetcher::Start(const Range &range) {
+  Request *request = NULL;
+  for (size_t i = 0; i < requests_.size() && request == NULL; ++i)
+    if (!requests_[i].busy)
+      request = &requests_[i];
+  CHECK_NOTNULL(request);
+
+  std::ostringstream url;
+  url << "http://" << server_ << "/ct/v1/get-entries?start=" << range.first
+      << "&end=" << range.last;
+  VLOG(1) << "request = " << url.str();
+
+  request->busy = true;
+  request->range = range;
+  request->parser.Reset();
+  request->bytes = 0;
+  request->max_bytes = 0;
+  CURL *handle = request->handle;
+  // Forgets the last request's options, but not its connection.
+  curl_easy_reset(handle);
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(handle, CURLOPT_URL, url.str().c_str()));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION,
+                                      &EntryFetcher::WriteCallback));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(handle, CURLOPT_WRITEDATA, request));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION,
+                                      &EntryFetcher::HeaderCallback));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(handle, CURLOPT_HEADERDATA, request));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L));
+  CHECK_EQ(CURLE_OK, curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, ""));
+#ifdef CURL_HTTP_VERSION_2TLS
+  curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#endif
+  CHECK_EQ(CURLM_OK, curl_multi_add_handle(multi_, handle));
+}
+
+HTTPLogClient::Status EntryFetcher::Finish(Request *request, CURLcode code) {
+  const Range &range = request->range;
+  HTTPLogClient::Status status = HTTPLogClient::OK;
+  std::vector<HTTPLogClient::LogEntry> entries;
+  entries.swap(*request->parser.entries());
+  if (code != CURLE_OK) {
+    LOG(WARNING) << "get-entries " << range.first << " to " << range.last
+                 << " failed: " << curl_easy_strerror(code);
+    status = code == CURLE_COULDNT_CONNECT ? HTTPLogClient::CONNECT_FAILED
+        : HTTPLogClient::UNKNOWN_ERROR;
+  } else {
+    long http_code = 0;
+    curl_easy_getinfo(request->handle, CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code != 200) {
+      LOG(WARNING) << "get-entries " << range.first << " to " << range.last
+                   << " failed with HTTP status " << http_code;
+      status = HTTPLogClient::BAD_RESPONSE;
+    } else {
+      status = request->parser.Finish();
+      // The log has the entries, as its tree head says so, but may not
+      // serve them yet.
+      if (status == HTTPLogClient::OK && entries.empty())
+        status = HTTPLogClient::BAD_RESPONSE;
+      if (status != HTTPLogClient::OK)
+        LOG(WARNING) << "get-entries " << range.first << " to " << range.last
+                     << " returned a bad response";
+    }
+  }
+
+  if (status != HTTPLogClient::OK) {
+    Range retry(range);
+    if (++retry.attempts > max_retries_)
+      return status;
+    todo_[retry.first] = retry;
+    return HTTPLogClient::OK;
+  }
+
+  const int requested = range.last - range.first + 1;
+  if (static_cast<int>(entries.size()) > requested)
+    entries.resize(requested);
+  const int count = entries.size();
+  AdjustBatchSize(*request, count, count < requested);
+  if (count < requested) {
+    // Ask for the rest of this range again.
+    Range rest;
+    rest.first = range.first + count;
+    rest.last = range.last;
+    todo_[rest.first] = rest;
+  }
+  done_[range.first].swap(entries);
+  return HTTPLogClient::OK;
+}
+
+void EntryFetcher::AdjustBatchSize(const Request &request, int count,
+                                   bool truncated) {
+  const int old_batch_size = batch_size_;
+  if (request.max_bytes > 0 && request.bytes > 0) {
+    // A reply cut short under the byte budget shows a cap on entries.
+    if (truncated && request.bytes < request.max_bytes)
+      max_batch_size_ = std::min(max_batch_size_, count);
+    // As many entries as fit, if they are like these.
+    const uint64_t fit =
+        static_cast<uint64_t>(count) * request.max_bytes / request.bytes;
+    batch_size_ = static_cast<int>(std::max<uint64_t>(
+        1, std::min<uint64_t>(max_batch_size_, fit)));
+  } else if (truncated) {
+    // The server caps its replies: ask for no more than that from now on.
+    max_batch_size_ = std::min(max_batch_size_, count);
+    batch_size_ = std::min(batch_size_, count);
+  }
+  if (batch_size_ != old_batch_size)
+    VLOG(1) << "Fetching " << batch_size_ << " entries per request";
+}
+
+// static
+size_t EntryFetcher::WriteCallback(char *buffer, size_t size, size_t nmemb,
+                                   Request *request) {
+  // Takes the rest of a bad reply too, so that its HTTP status is seen.
+  request->parser.Parse(buffer, size * nmemb);
+  request->bytes += size * nmemb;
+  return size * nmemb;
+}
+
+// static
+size_t EntryFetcher::HeaderCallback(char *buffer, size_t size, size_t nmemb,
+                                    Request *request) {
+  // Headers come one at a time, unterminated.
+  const string header(buffer, size * nmemb);
+  const size_t name_size = strlen(HTTPLogClient::kMaxBytesHeader);
+  if (header.size() > name_size && header[name_size] == ':' &&
+      strncasecmp(header.c_str(), HTTPLogClient::kMaxBytesHeader,
+                  name_size) == 0)
+    request->max_bytes = strtoul(header.c_str() + name_size + 1, NULL, 10);
+  return size * nmemb;
+}
@@ -0,0 +1,108 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef ENTRY_FETCHER_H
+#define ENTRY_FETCHER_H
+
+#include <curl/curl.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "client/entries_parser.h"
+#include "client/http_log_client.h"
+
+// Fetches a range of entries from an HTTP log with several get-entries
+// requests in flight at once, so that catching up on a large log isn't
+// bound by the round trip time. Requests start out asking for
+// |batch_size| entries; once the server replies with fewer, which it may
+// to cap its replies, later requests ask for as many as it replied with.
+// Servers that tell their byte budget for replies are asked for as many
+// entries as the replies so far suggest will fit, up to |batch_size| or
+// the cap, so that large or small entries don't make for huge replies or
+// needless round trips. Failed requests are retried. Entries are
+// delivered in order however the replies arrive.
+//
+// Not thread-safe.
+class EntryFetcher {
+ public:
+  class Callback {
+   public:
+    virtual ~Callback() {}
+
+    // |entries| are the entries from index |first| on. The callback may
+    // take them, by swapping them out.
+    virtual void Entries(int first,
+                         std::vector<HTTPLogClient::LogEntry> *entries) = 0;
+  };
+
+  // Fetches from the server of |client|, keeping up to |parallel|
+  // requests in flight, and retrying each up to |max_retries| times.
+  EntryFetcher(const HTTPLogClient &client, int parallel, int batch_size,
+               int max_retries);
+  ~EntryFetcher();
+
+  // Fetch the entries |first| to |last|, both included, and pass them to
+  // |callback| in order. Stops at the first request that fails for good;
+  // the entries before it have been passed on.
+  HTTPLogClient::Status Fetch(int first, int last, Callback *callback);
+
+ private:
+  // Entries |first| to |last|, both included.
+  struct Range {
+    Range() : first(0), last(0), attempts(0) {}
+
+    int first;
+    int last;
+    int attempts;
+  };
+
+  // An easy handle, and the range it is fetching, if any.
+  struct Request {
+    Request() : handle(NULL), busy(false), bytes(0), max_bytes(0) {}
+
+    CURL *handle;
+    bool busy;
+    Range range;
+    // Parses the reply as it arrives.
+    EntriesParser parser;
+    // The size of the reply, uncompressed.
+    size_t bytes;
+    // The server's byte budget, if it told it; else 0.
+    size_t max_bytes;
+  };
+
+  // Start fetching |range| on an idle request.
+  void Start(const Range &range);
+
+  // Deal with the reply of |request|. Returns OK, or the error that the
+  // fetch failed with.
+  HTTPLogClient::Status Finish(Request *request, CURLcode code);
+
+  // Size later requests after |request|'s reply, of |count| entries.
+  // |truncated| is whether the server served fewer than asked for.
+  void AdjustBatchSize(const Request &request, int count, bool truncated);
+
+  static size_t WriteCallback(char *buffer, size_t size, size_t nmemb,
+                              Request *request);
+  static size_t HeaderCallback(char *buffer, size_t size, size_t nmemb,
+                               Request *request);
+
+  const std::string server_;
+  const int max_retries_;
+  // What requests ask for, and the most they may: |batch_size|, or the
+  // server's cap on entries once it turns out to be lower.
+  int batch_size_;
+  int max_batch_size_;
+  CURLM *const multi_;
+  std::vector<Request> requests_;
+  // Ranges to fetch, or fetch again, keyed by their first entry.
+  std::map<int, Range> todo_;
+  // The first entry not yet in a range.
+  int next_;
+  // The last entry to fetch.
+  int last_;
+  // Fetched entries that wait for those before them, keyed by the index of
+  // the first.
+  std::map<int, std::vector<HTTPLogClient::LogEntry> > done_;
+};
+
+#endif
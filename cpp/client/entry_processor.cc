@@ -0,0 +1,157 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "client/entry_processor.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "log/cert.h"
+#include "log/cert_submission_handler.h"
+#include "log/ct_extensions.h"
+#include "log/log_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/thread_pool.h"
+
+using ct::Cert;
+using ct::CertChain;
+using std::string;
+
+namespace {
+
+// Entries that a thread processes at least, so that small chunks are not
+// split up more than they are worth.
+const size_t kMinEntriesPerThread = 16;
+
+struct ChunkWork {
+  const EntryProcessor *processor;
+  const std::vector<HTTPLogClient::LogEntry> *entries;
+  std::vector<EntryProcessor::ProcessedEntry> *processed;
+};
+
+}  // namespace
+
+EntryProcessor::EntryProcessor(util::ThreadPool *pool, bool parse,
+                               const LogVerifier *verifier,
+                               Callback *callback)
+    : pool_(pool),
+      parse_(parse),
+      verifier_(verifier),
+      callback_(callback) {}
+
+void EntryProcessor::Entries(int first,
+                             std::vector<HTTPLogClient::LogEntry> *entries) {
+  std::vector<ProcessedEntry> processed(entries->size());
+  ChunkWork work = { this, entries, &processed };
+  const size_t chunks = std::max<size_t>(
+      1, std::min(pool_->Parallelism(),
+                  entries->size() / kMinEntriesPerThread));
+  pool_->ParallelFor(entries->size(), chunks, ProcessChunk, &work);
+
+  callback_->Processed(first, entries, &processed);
+  for (size_t i = 0; i < processed.size(); ++i)
+    delete processed[i].cert;
+}
+
+// static
+void EntryProcessor::ProcessChunk(void *arg, size_t /* chunk */,
+                                  size_t begin, size_t end) {
+  const ChunkWork *work = static_cast<const ChunkWork*>(arg);
+  work->processor->ProcessRange(*work->entries, begin, end, work->processed);
+}
+
+void EntryProcessor::ProcessRange(
+    const std::vector<HTTPLogClient::LogEntry> &entries, size_t begin,
+    size_t end, std::vector<ProcessedEntry> *processed) const {
+  TreeHasherT<Sha256Hasher> hasher;
+  for (size_t i = begin; i < end; ++i) {
+    const HTTPLogClient::LogEntry &entry = entries[i];
+    const ct::TimestampedEntry &timestamped =
+        entry.leaf.timestamped_entry();
+    const bool precert = timestamped.entry_type() == ct::PRECERT_ENTRY;
+    ProcessedEntry *result = &(*processed)[i];
+    result->cert = NULL;
+    result->sct_check = SCT_NOT_CHECKED;
+
+    string leaf;
+    const Serializer::SerializeResult serialized = precert ?
+        Serializer::SerializeV1PrecertSCTMerkleTreeLeaf(
+            timestamped.timestamp(),
+            timestamped.signed_entry().precert().issuer_key_hash(),
+            timestamped.signed_entry().precert().tbs_certificate(),
+            timestamped.extensions(), &leaf) :
+        Serializer::SerializeV1CertSCTMerkleTreeLeaf(
+            timestamped.timestamp(), timestamped.signed_entry().x509(),
+            timestamped.extensions(), &leaf);
+    if (serialized == Serializer::OK)
+      result->leaf_hash = hasher.HashLeaf(leaf);
+
+    if (!parse_ && verifier_ == NULL)
+      continue;
+    Cert *cert = new Cert;
+    if (cert->LoadFromDerString(precert ?
+            entry.entry.precert_entry().pre_certificate() :
+            timestamped.signed_entry().x509()) != Cert::TRUE) {
+      delete cert;
+      continue;
+    }
+    if (verifier_ != NULL && !precert)
+      result->sct_check = CheckSCTs(entry, *cert);
+    if (parse_)
+      result->cert = cert;
+    else
+      delete cert;
+  }
+}
+
+EntryProcessor::SCTCheck EntryProcessor::CheckSCTs(
+    const HTTPLogClient::LogEntry &entry, const Cert &cert) const {
+  if (cert.HasExtension(ct::NID_ctEmbeddedSignedCertificateTimestampList) !=
+      Cert::TRUE)
+    return NO_SCT;
+  string serialized_scts;
+  std::vector<ByteView> scts;
+  if (cert.OctetStringExtensionData(
+          ct::NID_ctEmbeddedSignedCertificateTimestampList,
+          &serialized_scts) != Cert::TRUE ||
+      Deserializer::DeserializeSCTList(serialized_scts, &scts) !=
+      Deserializer::OK)
+    return SCT_INVALID;
+
+  // What the log signed: the precertificate entry made of the certificate
+  // and its issuer, the first of the chain.
+  const ct::X509ChainEntry &x509 = entry.entry.x509_entry();
+  ct::LogEntry signed_entry;
+  bool have_entry = false;
+  SCTCheck check = NO_SCT;
+  for (size_t i = 0; i < scts.size(); ++i) {
+    ct::SignedCertificateTimestamp sct;
+    if (Deserializer::DeserializeSCT(scts[i], &sct) != Deserializer::OK)
+      return SCT_INVALID;
+    if (sct.id().key_id() != verifier_->KeyID())
+      continue;
+    if (!have_entry) {
+      if (x509.certificate_chain_size() == 0)
+        return SCT_INVALID;
+      // The chain takes the certificates, and only those that loaded.
+      CertChain chain;
+      if (chain.AddCert(cert.Clone()) != Cert::TRUE)
+        return SCT_INVALID;
+      Cert *issuer = new Cert;
+      issuer->LoadFromDerString(x509.certificate_chain(0));
+      if (chain.AddCert(issuer) != Cert::TRUE ||
+          !CertSubmissionHandler::X509ChainToEntry(chain, &signed_entry))
+        return SCT_INVALID;
+      have_entry = true;
+    }
+    if (verifier_->VerifySignedCertificateTimestamp(signed_entry, sct) !=
+        LogVerifier::VERIFY_OK)
+      return SCT_INVALID;
+    check = SCT_VERIFIED;
+  }
+  return check;
+}
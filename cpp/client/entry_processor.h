@@ -0,0 +1,95 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef ENTRY_PROCESSOR_H
+#define ENTRY_PROCESSOR_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "client/entry_fetcher.h"
+#include "client/http_log_client.h"
+
+class LogVerifier;
+
+namespace ct {
+class Cert;
+}  // namespace ct
+
+namespace util {
+class ThreadPool;
+}  // namespace util
+
+// Sits between an EntryFetcher and what consumes the entries: parses the
+// certificate of each entry from DER, hashes its Merkle tree leaf and,
+// optionally, checks the SCTs embedded in its certificate, spread over a
+// thread pool, a part of each chunk to each thread. Chunks are processed
+// in the fetcher's thread, one at a time, which keeps them in order for the
+// consumer; the fetcher's other requests stay in flight meanwhile.
+class EntryProcessor : public EntryFetcher::Callback {
+ public:
+  enum SCTCheck {
+    // No verifier, or a precertificate entry, whose logged certificate
+    // has no SCTs yet.
+    SCT_NOT_CHECKED,
+    // The certificate has no SCTs from the verifier's log.
+    NO_SCT,
+    // All of those verify.
+    SCT_VERIFIED,
+    // One of those does not verify, or the SCTs do not parse.
+    SCT_INVALID,
+  };
+
+  // What was made of an entry.
+  struct ProcessedEntry {
+    // The hash of the entry's serialized MerkleTreeLeaf; empty if the leaf
+    // does not serialize, e.g. because a field is too long.
+    std::string leaf_hash;
+    // The leaf certificate, or the precertificate, parsed; NULL if it does
+    // not parse, or certificates were not asked for.
+    ct::Cert *cert;
+    SCTCheck sct_check;
+  };
+
+  class Callback {
+   public:
+    virtual ~Callback() {}
+
+    // |entries| are the entries from index |first| on, and |processed|
+    // what was made of each. The callback may take the entries, by
+    // swapping them out, and the certificates, by setting their pointers
+    // to NULL; the others are deleted once it returns.
+    virtual void Processed(int first,
+                           std::vector<HTTPLogClient::LogEntry> *entries,
+                           std::vector<ProcessedEntry> *processed) = 0;
+  };
+
+  // Processes on |pool|, and passes the results to |callback|. With
+  // |parse|, certificates are handed to the callback. With |verifier|,
+  // which may be NULL, embedded SCTs are checked against it, which takes
+  // parsing, too.
+  EntryProcessor(util::ThreadPool *pool, bool parse,
+                 const LogVerifier *verifier, Callback *callback);
+
+  void Entries(int first, std::vector<HTTPLogClient::LogEntry> *entries);
+
+ private:
+  // Process |entries| [|begin|, |end|) into |processed|.
+  void ProcessRange(const std::vector<HTTPLogClient::LogEntry> &entries,
+                    size_t begin, size_t end,
+                    std::vector<ProcessedEntry> *processed) const;
+
+  // Check the embedded SCTs of the X.509 entry |entry|, whose leaf
+  // certificate is |cert|.
+  SCTCheck CheckSCTs(const HTTPLogClient::LogEntry &entry,
+                     const ct::Cert &cert) const;
+
+  static void ProcessChunk(void *arg, size_t chunk, size_t begin,
+                           size_t end);
+
+  util::ThreadPool *const pool_;
+  const bool parse_;
+  const LogVerifier *const verifier_;
+  Callback *const callback_;
+};
+
+#endif  // ENTRY_PROCESSOR_H
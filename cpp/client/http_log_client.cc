@@ -5,6 +5,7 @@
 #include <glog/logging.h>
 #include <sstream>
 
+#include "client/entries_parser.h"
 #include "log/cert.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
@@ -19,13 +20,23 @@ using std::string;
 namespace {
 
 
+// A request on |handle|, which keeps the connection of the last request,
+// if any, for this one to reuse.
 class CurlRequest {
  public:
-  CurlRequest()
-      : handle_(CHECK_NOTNULL(curl_easy_init())) {
-  }
-  ~CurlRequest() {
-    curl_easy_cleanup(handle_);
+  explicit CurlRequest(CURL *handle)
+      : handle_(handle) {
+    // Forgets the last request's options, but not its connection.
+    curl_easy_reset(handle_);
+    CHECK_EQ(curl_easy_setopt(handle_, CURLOPT_TCP_KEEPALIVE, 1L), CURLE_OK);
+    // Replies come compressed if the server can.
+    CHECK_EQ(curl_easy_setopt(handle_, CURLOPT_ACCEPT_ENCODING, ""),
+             CURLE_OK);
+#ifdef CURL_HTTP_VERSION_2TLS
+    // HTTP/2 where TLS can negotiate it; curl versions that can't do it
+    // refuse the option, which is fine.
+    curl_easy_setopt(handle_, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#endif
   }
 
   void SetUrl(const std::string& url) {
@@ -58,6 +69,22 @@ class CurlRequest {
     return curl_easy_perform(handle_);
   }
 
+  // The HTTP status of the last reply.
+  long ResponseCode() {
+    long code = 0;
+    CHECK_EQ(curl_easy_getinfo(handle_, CURLINFO_RESPONSE_CODE, &code),
+             CURLE_OK);
+    return code;
+  }
+
+  CURLcode Perform(EntriesParser* parser) {
+    curl_easy_setopt(handle_, CURLOPT_WRITEFUNCTION,
+                     &CurlRequest::parse_callback);
+    curl_easy_setopt(handle_, CURLOPT_WRITEDATA, parser);
+
+    return curl_easy_perform(handle_);
+  }
+
  private:
   CURL* const handle_;
 
@@ -75,16 +102,48 @@ class CurlRequest {
 
     return sumsize;
   }
+
+  // Takes the whole reply even once it is known to be bad, so that it
+  // fails as a bad response rather than as a curl error.
+  static size_t parse_callback(char* buffer, size_t size, size_t nmemb,
+                               EntriesParser* parser) {
+    const size_t sumsize(size * nmemb);
+
+    parser->Parse(buffer, sumsize);
+    return sumsize;
+  }
 };
 
 
 }  // namespace
 
+const char HTTPLogClient::kEntriesEndHeader[] = "X-CT-Entries-End";
+const char HTTPLogClient::kMaxBytesHeader[] = "X-CT-Max-Bytes";
+
+HTTPLogClient::HTTPLogClient(const string &server)
+    : server_(server),
+      curl_(CHECK_NOTNULL(curl_easy_init())) {}
+
+HTTPLogClient::HTTPLogClient(const HTTPLogClient &other)
+    : server_(other.server_),
+      curl_(CHECK_NOTNULL(curl_easy_init())) {}
+
+HTTPLogClient::~HTTPLogClient() {
+  curl_easy_cleanup(curl_);
+}
+
+// Connections are kept per server, so ours can stay.
+HTTPLogClient &HTTPLogClient::operator=(const HTTPLogClient &other) {
+  server_ = other.server_;
+  return *this;
+}
+
 void HTTPLogClient::BaseUrl(ostringstream *url) const {
   *url << "http://" << server_ << "/ct/v1/";
 }
 
-static HTTPLogClient::Status SendRequest(ostringstream *response,
+template <class Output>
+static HTTPLogClient::Status SendRequest(Output *response,
                                          CurlRequest *request,
                                          const ostringstream &url) {
   request->SetUrl(url.str());
@@ -112,16 +171,16 @@ HTTPLogClient::UploadSubmission(const std::string &submission, bool pre,
   if (!chain.IsLoaded())
     return INVALID_INPUT;
 
-  JsonArray jchain;
-  for (size_t n = 0; n < chain.Length(); ++n) {
-    string cert;
-    CHECK_EQ(Cert::TRUE, chain.CertAt(n)->DerEncoding(&cert));
-    jchain.Add(json_object_new_string(util::ToBase64(cert).c_str()));
-  }
-  json_object *jsend = json_object_new_object();
-  json_object_object_add(jsend, "chain", jchain.Extract());
+  std::vector<string> certs(chain.Length());
+  for (size_t n = 0; n < chain.Length(); ++n)
+    CHECK_EQ(Cert::TRUE, chain.CertAt(n)->DerEncoding(&certs[n]));
+  return UploadChain(certs, pre, sct);
+}
 
-  const char *jsoned = json_object_to_json_string(jsend);
+HTTPLogClient::Status
+HTTPLogClient::UploadChain(const std::vector<string> &chain, bool pre,
+                           ct::SignedCertificateTimestamp *sct) const {
+  const string jsoned = ChainRequest(chain);
 
   ostringstream url;
   BaseUrl(&url);
@@ -130,7 +189,7 @@ HTTPLogClient::UploadSubmission(const std::string &submission, bool pre,
     url << "pre-";
   url << "chain";
 
-  CurlRequest request;
+  CurlRequest request(curl_);
   request.SetPostFields(jsoned);
 
   std::ostringstream response;
@@ -138,14 +197,32 @@ HTTPLogClient::UploadSubmission(const std::string &submission, bool pre,
   LOG(INFO) << "request = " << url.str();
   LOG(INFO) << "body = " << jsoned;
   LOG(INFO) << "response = " << response.str();
-  json_object_put(jsend);
   if (ret != OK)
     return ret;
 
-  JsonObject jresponse(json_tokener_parse(response.str().c_str()));
+  return ParseSCT(response.str(), sct);
+}
+
+// static
+string HTTPLogClient::ChainRequest(const std::vector<string> &chain) {
+  JsonArray jchain;
+  for (size_t n = 0; n < chain.size(); ++n)
+    jchain.Add(json_object_new_string(util::ToBase64(chain[n]).c_str()));
+  json_object *jsend = json_object_new_object();
+  json_object_object_add(jsend, "chain", jchain.Extract());
+
+  const string jsoned = json_object_to_json_string(jsend);
+  json_object_put(jsend);
+  return jsoned;
+}
+
+// static
+HTTPLogClient::Status HTTPLogClient::ParseSCT(
+    const string &response, ct::SignedCertificateTimestamp *sct) {
+  JsonObject jresponse(json_tokener_parse(response.c_str()));
 
   if (!jresponse.IsType(json_type_object)) {
-    LOG(ERROR) << "Expected a JSON object, got: " << response.str();
+    LOG(ERROR) << "Expected a JSON object, got: " << response;
     return BAD_RESPONSE;
   }
 
@@ -182,7 +259,7 @@ HTTPLogClient::Status HTTPLogClient::GetSTH(ct::SignedTreeHead *sth) const {
   BaseUrl(&url);
   url << "get-sth";
 
-  CurlRequest request;
+  CurlRequest request(curl_);
 
   std::ostringstream response;
   Status ret = SendRequest(&response, &request, url);
@@ -228,7 +305,7 @@ HTTPLogClient::QueryAuditProof(const string &merkle_leaf_hash,
   BaseUrl(&url);
   url << "get-sth";
 
-  CurlRequest request;
+  CurlRequest request(curl_);
 
   std::ostringstream response;
   Status ret = SendRequest(&response, &request, url);
@@ -257,7 +334,7 @@ HTTPLogClient::QueryAuditProof(const string &merkle_leaf_hash,
     return BAD_RESPONSE;
 
   ostringstream url2;
-  CurlRequest request2;
+  CurlRequest request2(curl_);
   BaseUrl(&url2);
   url2 << "get-proof-by-hash?hash="
        << request2.UrlEscape(util::ToBase64(merkle_leaf_hash))
@@ -300,56 +377,23 @@ HTTPLogClient::Status HTTPLogClient::GetEntries(int first, int last,
   BaseUrl(&url);
   url << "get-entries?start=" << first << "&end=" << last;
 
-  CurlRequest request;
+  CurlRequest request(curl_);
 
-  std::ostringstream response;
-  Status ret = SendRequest(&response, &request, url);
+  EntriesParser parser;
+  Status ret = SendRequest(&parser, &request, url);
   LOG(INFO) << "request = " << url.str();
-  LOG(INFO) << "response = " << response.str();
   if (ret != OK)
     return ret;
 
-  JsonObject jresponse(response);
-  if (!jresponse.Ok())
-    return BAD_RESPONSE;
-
-  JsonArray jentries(jresponse, "entries");
-  if (!jentries.Ok())
-    return BAD_RESPONSE;
-
-  for (int n = 0; n < jentries.Length(); ++n) {
-    JsonObject entry(jentries, n);
-    if (!entry.Ok())
-      return BAD_RESPONSE;
-
-    JsonString leaf_input(entry, "leaf_input");
-    if (!leaf_input.Ok())
-      return BAD_RESPONSE;
-
-    LogEntry log_entry;
-    if (Deserializer::DeserializeMerkleTreeLeaf(leaf_input.FromBase64(),
-                                                &log_entry.leaf)
-        != Deserializer::OK)
-      return BAD_RESPONSE;
-
-    JsonString extra_data(entry, "extra_data");
-    if (!extra_data.Ok())
-      return BAD_RESPONSE;
-
-    if (log_entry.leaf.timestamped_entry().entry_type() == ct::X509_ENTRY)
-      Deserializer::DeserializeX509Chain(extra_data.FromBase64(),
-                                         log_entry.entry.mutable_x509_entry());
-    else if (log_entry.leaf.timestamped_entry().entry_type()
-            == ct::PRECERT_ENTRY)
-      Deserializer::DeserializePrecertChainEntry(extra_data.FromBase64(),
-          log_entry.entry.mutable_precert_entry());
-    else
-      LOG(FATAL) << "Don't understand entry type: "
-                 << log_entry.leaf.timestamped_entry().entry_type();
-
-    entries->push_back(log_entry);
-  }
-
+  ret = parser.Finish();
+  if (ret != OK)
+    return ret;
+  std::vector<LogEntry> *parsed = parser.entries();
+  LOG(INFO) << "response has " << parsed->size() << " entries";
+  if (entries->empty())
+    entries->swap(*parsed);
+  else
+    entries->insert(entries->end(), parsed->begin(), parsed->end());
   return OK;
 }
 
@@ -360,7 +404,7 @@ HTTPLogClient::GetSTHConsistency(uint64_t size1, uint64_t size2,
   BaseUrl(&url);
   url << "get-sth-consistency?first=" << size1 << "&second=" << size2;
 
-  CurlRequest request;
+  CurlRequest request(curl_);
 
   std::ostringstream response;
   Status ret = SendRequest(&response, &request, url);
@@ -387,3 +431,29 @@ HTTPLogClient::GetSTHConsistency(uint64_t size1, uint64_t size2,
 
   return OK;
 }
+
+HTTPLogClient::Status
+HTTPLogClient::GetReplicationUpdate(uint64_t start, uint64_t timestamp,
+                                    ct::ReplicationUpdate *update) const {
+  ostringstream url;
+  BaseUrl(&url);
+  url << "get-replication-update?start=" << start << "&timestamp="
+      << timestamp;
+
+  CurlRequest request(curl_);
+
+  std::ostringstream response;
+  Status ret = SendRequest(&response, &request, url);
+  VLOG(1) << "request = " << url.str();
+  if (ret != OK)
+    return ret;
+  if (request.ResponseCode() != 200) {
+    LOG(ERROR) << "replication update failed: " << response.str();
+    return BAD_RESPONSE;
+  }
+
+  if (!update->ParseFromString(response.str()))
+    return BAD_RESPONSE;
+  VLOG(1) << "response has " << update->entry_size() << " entries";
+  return OK;
+}
@@ -4,6 +4,7 @@
 
 #include "proto/ct.pb.h"
 
+#include <curl/curl.h>
 #include <stdint.h>
 
 #include <string>
@@ -13,9 +14,16 @@ class MerkleAuditProof;
 class SignedCertificateTimestamp;
 };
 
+// Requests go over one connection, kept alive between them, so that they
+// don't each pay for connection and TLS setup. Not thread-safe; copies
+// have connections of their own.
 class HTTPLogClient {
  public:
-  HTTPLogClient(const std::string &server) : server_(server) {}
+  HTTPLogClient(const std::string &server);
+  HTTPLogClient(const HTTPLogClient &other);
+  ~HTTPLogClient();
+
+  HTTPLogClient &operator=(const HTTPLogClient &other);
 
   enum Status {
     OK,
@@ -30,6 +38,18 @@ class HTTPLogClient {
   Status UploadSubmission(const std::string &submission, bool pre,
                           ct::SignedCertificateTimestamp *sct) const;
 
+  // As above, for |chain|, the DER-encoded certificates, leaf first.
+  Status UploadChain(const std::vector<std::string> &chain, bool pre,
+                     ct::SignedCertificateTimestamp *sct) const;
+
+  // The add-chain or add-pre-chain request body for |chain|, the
+  // DER-encoded certificates, leaf first.
+  static std::string ChainRequest(const std::vector<std::string> &chain);
+
+  // Parse the add-chain or add-pre-chain reply |response| into |sct|.
+  static Status ParseSCT(const std::string &response,
+                         ct::SignedCertificateTimestamp *sct);
+
   Status GetSTH(ct::SignedTreeHead *sth) const;
 
   Status QueryAuditProof(const std::string &merkle_leaf_hash,
@@ -43,14 +63,32 @@ class HTTPLogClient {
     ct::LogEntry entry;
   };
 
+  // Headers of get-entries replies: the index of the last entry in the
+  // reply, which may end before |last|, and roughly the most bytes of
+  // entries that the log puts in one reply (see EntryFetcher).
+  static const char kEntriesEndHeader[];
+  static const char kMaxBytesHeader[];
+
   // This does not clear |entries| before appending the retrieved
-  // entries.
+  // entries. The reply is parsed as it arrives.
   Status GetEntries(int first, int last, std::vector<LogEntry> *entries) const;
 
+  // The entries from |start| on and the tree head that covers them, from
+  // a log that replicas replicate from; |timestamp| is that of the
+  // replica's latest tree head. The log holds on to the request for a
+  // while if it has nothing newer. See log/replication.h.
+  Status GetReplicationUpdate(uint64_t start, uint64_t timestamp,
+                              ct::ReplicationUpdate *update) const;
+
+  const std::string &Server() const { return server_; }
+
 private:
   void BaseUrl(std::ostringstream *url) const;
 
   std::string server_;
+  // Keeps the connection, and the TLS session, across requests. Requests
+  // are const, but use it.
+  CURL *const curl_;
 };
 
 #endif
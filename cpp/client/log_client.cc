@@ -2,6 +2,8 @@
 
 #include <glog/logging.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "client/client.h"
 #include "include/ct.h"
@@ -24,7 +26,8 @@ const ct::protocol::Format LogClient::kPacketFormat = ct::protocol::PROTOBUF;
 const ct::Version LogClient::kCtVersion = ct::V1;
 
 LogClient::LogClient(const string &server, uint16_t port)
-    : client_(server, port) {
+    : client_(server, port),
+      persistent_(false) {
 }
 
 LogClient::~LogClient() {}
@@ -33,23 +36,70 @@ bool LogClient::Connect() { return client_.Connect(); }
 
 void LogClient::Disconnect() { client_.Disconnect(); }
 
+size_t LogClient::Pipeline(const std::vector<ClientMessage> &messages,
+                           size_t window,
+                           std::vector<ServerMessage> *replies) {
+  CHECK_GT(window, 0U);
+  replies->clear();
+  bool reused;
+  if (messages.empty() || !Ready(&reused))
+    return 0;
+  PipelineOnce(messages, window, replies);
+  // The server may have closed the connection while it was idle.
+  if (persistent_ && reused && replies->empty() && Ready(&reused))
+    PipelineOnce(messages, window, replies);
+  return replies->size();
+}
+
 bool LogClient::UploadSubmission(const string &submission, bool pre,
                                  SignedCertificateTimestamp *sct) {
   ClientMessage message;
-  if (pre)
-    message.set_command(ClientMessage::SUBMIT_CA_BUNDLE);
-  else
-    message.set_command(ClientMessage::SUBMIT_BUNDLE);
-
-  message.set_submission_data(submission);
-
-  if (!SendMessage(message))
-    return false;
+  SubmissionMessage(submission, pre, &message);
 
   ServerMessage reply;
-  if (!ReadReply(&reply))
+  if (!Exchange(message, &reply))
     return false;
 
+  return SubmissionReply(reply, sct);
+}
+
+size_t LogClient::UploadSubmissions(
+    const std::vector<string> &submissions, bool pre, size_t window,
+    std::vector<SignedCertificateTimestamp> *scts,
+    std::vector<bool> *results) {
+  std::vector<ClientMessage> messages(submissions.size());
+  for (size_t i = 0; i < submissions.size(); ++i)
+    SubmissionMessage(submissions[i], pre, &messages[i]);
+
+  std::vector<ServerMessage> replies;
+  Pipeline(messages, window, &replies);
+
+  scts->assign(submissions.size(), SignedCertificateTimestamp());
+  results->assign(submissions.size(), false);
+  size_t succeeded = 0;
+  for (size_t i = 0; i < replies.size(); ++i) {
+    if (SubmissionReply(replies[i], &(*scts)[i])) {
+      (*results)[i] = true;
+      ++succeeded;
+    }
+  }
+  return succeeded;
+}
+
+// static
+void LogClient::SubmissionMessage(const string &submission, bool pre,
+                                  ClientMessage *message) {
+  if (pre)
+    message->set_command(ClientMessage::SUBMIT_CA_BUNDLE);
+  else
+    message->set_command(ClientMessage::SUBMIT_BUNDLE);
+
+  message->set_submission_data(submission);
+}
+
+// static
+bool LogClient::SubmissionReply(const ServerMessage &reply,
+                                SignedCertificateTimestamp *sct) {
   bool ret = false;
   switch (reply.response()) {
     case ServerMessage::ERROR:
@@ -83,10 +133,8 @@ bool LogClient::QueryAuditProof(const string &merkle_leaf_hash,
   message.mutable_lookup()->set_type(
       ClientLookup::MERKLE_AUDIT_PROOF_BY_LEAF_HASH);
   message.mutable_lookup()->set_merkle_leaf_hash(merkle_leaf_hash);
-  if (!SendMessage(message))
-    return false;
   ServerMessage reply;
-  if (!ReadReply(&reply))
+  if (!Exchange(message, &reply))
     return false;
 
   bool ret = false;
@@ -135,6 +183,48 @@ string LogClient::ErrorString(ServerError::ErrorCode error) {
   }
 }
 
+bool LogClient::Exchange(const ClientMessage &message, ServerMessage *reply) {
+  const std::vector<ClientMessage> messages(1, message);
+  std::vector<ServerMessage> replies;
+  if (Pipeline(messages, 1, &replies) == 0)
+    return false;
+  reply->Swap(&replies[0]);
+  return true;
+}
+
+void LogClient::PipelineOnce(const std::vector<ClientMessage> &messages,
+                             size_t window,
+                             std::vector<ServerMessage> *replies) {
+  size_t sent = 0;
+  while (replies->size() < messages.size()) {
+    for ( ; sent < messages.size() && sent < replies->size() + window;
+         ++sent) {
+      if (!SendMessage(messages[sent])) {
+        client_.Disconnect();
+        return;
+      }
+    }
+    replies->push_back(ServerMessage());
+    if (!ReadReply(&replies->back())) {
+      replies->pop_back();
+      // The rest of the stream can't be matched to the messages any more.
+      client_.Disconnect();
+      return;
+    }
+  }
+}
+
+bool LogClient::Ready(bool *reused) {
+  *reused = client_.Connected();
+  if (*reused)
+    return true;
+  if (!persistent_) {
+    LOG(ERROR) << "Not connected";
+    return false;
+  }
+  return client_.Connect();
+}
+
 bool LogClient::SendMessage(const ClientMessage &message) {
   string serialized_message;
   CHECK(message.SerializeToString(&serialized_message));
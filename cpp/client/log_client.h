@@ -2,12 +2,19 @@
 #define LOG_CLIENT_H
 
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "include/ct.h"
 #include "client/client.h"
 #include "proto/ct.pb.h"
 
 // V1 client that speaks the protobuf format.
+//
+// In persistent mode, requests connect when there is no connection and
+// reuse it otherwise, so that one client can make any number of them
+// over one connection; if the server has closed it since the last reply,
+// e.g. for being idle, they reconnect and try again once.
 class LogClient {
  public:
   LogClient(const std::string &server, uint16_t port);
@@ -22,17 +29,55 @@ class LogClient {
 
   void Disconnect();
 
+  void SetPersistent(bool persistent) { persistent_ = persistent; }
+
+  // Send |messages| with up to |window| of them ahead of their replies,
+  // so that a server that serves requests concurrently (see ct-server's
+  // --request_threads) needn't wait on each round trip. The server
+  // replies in order, so the replies in |replies| match the messages.
+  // Returns the number of replies; if the connection fails, the rest of
+  // the messages get none.
+  size_t Pipeline(const std::vector<ct::ClientMessage> &messages,
+                  size_t window, std::vector<ct::ServerMessage> *replies);
+
   bool UploadSubmission(const std::string &submission, bool pre,
                         ct::SignedCertificateTimestamp *sct);
 
+  // Upload |submissions|, pipelined as by Pipeline(). Sets an SCT in
+  // |scts| and a result in |results| for each submission, in order, and
+  // returns the number that succeeded.
+  size_t UploadSubmissions(const std::vector<std::string> &submissions,
+                           bool pre, size_t window,
+                           std::vector<ct::SignedCertificateTimestamp> *scts,
+                           std::vector<bool> *results);
+
   bool QueryAuditProof(const std::string &merkle_leaf_hash,
                        ct::MerkleAuditProof *proof);
 
   static std::string ErrorString(ct::ServerError::ErrorCode error);
 
+  // The message that submits |submission|, for Pipeline().
+  static void SubmissionMessage(const std::string &submission, bool pre,
+                                ct::ClientMessage *message);
+
+  // Whether |reply| to a submission is an SCT, which goes in |sct|.
+  static bool SubmissionReply(const ct::ServerMessage &reply,
+                              ct::SignedCertificateTimestamp *sct);
+
  private:
+  // Send |message| and read the reply to it, reconnecting if need be in
+  // persistent mode.
+  bool Exchange(const ct::ClientMessage &message, ct::ServerMessage *reply);
+  // Send |messages|, and read their replies into |replies|, over the
+  // connection as it is. Disconnects if it fails.
+  void PipelineOnce(const std::vector<ct::ClientMessage> &messages,
+                    size_t window, std::vector<ct::ServerMessage> *replies);
+  // In persistent mode, connect if there is no connection. Returns
+  // whether there is one, and in |reused| whether it was there already.
+  bool Ready(bool *reused);
   bool SendMessage(const ct::ClientMessage &message);
   bool ReadReply(ct::ServerMessage *reply);
   Client client_;
+  bool persistent_;
 };
 #endif
@@ -0,0 +1,279 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "client/scanner.h"
+
+#include <glog/logging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "log/cert.h"
+#include "util/util.h"
+
+using ct::Cert;
+using std::string;
+
+namespace {
+
+// Entries scanned between checkpoints.
+const size_t kCheckpointEntries = 100000;
+
+void CompileRegex(const string &regex, regex_t *compiled) {
+  const int ret = regcomp(compiled, regex.c_str(), REG_EXTENDED | REG_NOSUB);
+  if (ret != 0) {
+    char error[256];
+    regerror(ret, compiled, error, sizeof error);
+    LOG(FATAL) << "Bad regular expression " << regex << ": " << error;
+  }
+}
+
+bool RegexMatches(const regex_t &regex, const string &text) {
+  return regexec(&regex, text.c_str(), 0, NULL, 0) == 0;
+}
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+}  // namespace
+
+SubjectRegexMatcher::SubjectRegexMatcher(const string &regex) {
+  CompileRegex(regex, &regex_);
+}
+
+SubjectRegexMatcher::~SubjectRegexMatcher() {
+  regfree(&regex_);
+}
+
+bool SubjectRegexMatcher::Matches(const Cert &cert, bool precert) const {
+  if (RegexMatches(regex_, cert.PrintSubjectName()))
+    return true;
+  std::vector<string> dns_names;
+  if (cert.SubjectAltDnsNames(&dns_names) != Cert::TRUE)
+    return false;
+  for (size_t i = 0; i < dns_names.size(); ++i)
+    if (RegexMatches(regex_, dns_names[i]))
+      return true;
+  return false;
+}
+
+IssuerRegexMatcher::IssuerRegexMatcher(const string &regex) {
+  CompileRegex(regex, &regex_);
+}
+
+IssuerRegexMatcher::~IssuerRegexMatcher() {
+  regfree(&regex_);
+}
+
+bool IssuerRegexMatcher::Matches(const Cert &cert, bool precert) const {
+  return RegexMatches(regex_, cert.PrintIssuerName());
+}
+
+SerialNumberMatcher::SerialNumberMatcher(const string &serial)
+    : serial_(serial) {}
+
+bool SerialNumberMatcher::Matches(const Cert &cert, bool precert) const {
+  string serial;
+  return cert.SerialNumber(&serial) == Cert::TRUE && serial == serial_;
+}
+
+AllOfMatcher::~AllOfMatcher() {
+  for (size_t i = 0; i < matchers_.size(); ++i)
+    delete matchers_[i];
+}
+
+bool AllOfMatcher::Matches(const Cert &cert, bool precert) const {
+  for (size_t i = 0; i < matchers_.size(); ++i)
+    if (!matchers_[i]->Matches(cert, precert))
+      return false;
+  return true;
+}
+
+Scanner::Scanner(EntryFetcher *fetcher, const CertMatcher *matcher,
+                 size_t match_threads, size_t max_chunks)
+    : fetcher_(fetcher),
+      matcher_(matcher),
+      match_threads_(match_threads),
+      max_chunks_(max_chunks),
+      first_(0),
+      last_(0),
+      scanned_(0),
+      unparsed_(0),
+      chunks_(0),
+      matching_(0),
+      fetched_all_(false),
+      status_(HTTPLogClient::OK) {
+  CHECK_GT(match_threads_, 0U);
+  CHECK_GT(max_chunks_, 0U);
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+  CHECK_EQ(0, pthread_cond_init(&changed_, NULL));
+}
+
+Scanner::~Scanner() {
+  CHECK_EQ(0, pthread_cond_destroy(&changed_));
+  CHECK_EQ(0, pthread_mutex_destroy(&mutex_));
+}
+
+HTTPLogClient::Status Scanner::Scan(int first, int last,
+                                    const string &checkpoint_file,
+                                    Callback *callback) {
+  first_ = first;
+  last_ = last;
+  checkpoint_file_ = checkpoint_file;
+  scanned_ = 0;
+  unparsed_ = 0;
+  fetched_all_ = false;
+  status_ = HTTPLogClient::OK;
+
+  string checkpoint;
+  if (!checkpoint_file_.empty() &&
+      util::ReadBinaryFile(checkpoint_file_, &checkpoint)) {
+    const int next = atoi(checkpoint.c_str());
+    if (next > first_ && next <= last_ + 1) {
+      LOG(INFO) << "Resuming the scan at entry " << next;
+      first_ = next;
+    }
+  }
+  if (first_ > last_)
+    return HTTPLogClient::OK;
+
+  std::vector<pthread_t> threads(match_threads_ + 1);
+  CHECK_EQ(0, pthread_create(&threads[0], NULL, FetchThread, this));
+  for (size_t i = 1; i < threads.size(); ++i)
+    CHECK_EQ(0, pthread_create(&threads[i], NULL, MatchThread, this));
+
+  Report(callback);
+
+  for (size_t i = 0; i < threads.size(); ++i)
+    CHECK_EQ(0, pthread_join(threads[i], NULL));
+  return status_;
+}
+
+// static
+void *Scanner::FetchThread(void *arg) {
+  Scanner *scanner = static_cast<Scanner*>(arg);
+  const HTTPLogClient::Status status =
+      scanner->fetcher_->Fetch(scanner->first_, scanner->last_, scanner);
+  ScopedLock lock(&scanner->mutex_);
+  scanner->status_ = status;
+  scanner->fetched_all_ = true;
+  CHECK_EQ(0, pthread_cond_broadcast(&scanner->changed_));
+  return NULL;
+}
+
+// static
+void *Scanner::MatchThread(void *arg) {
+  static_cast<Scanner*>(arg)->Match();
+  return NULL;
+}
+
+void Scanner::Entries(int first,
+                      std::vector<HTTPLogClient::LogEntry> *entries) {
+  ScopedLock lock(&mutex_);
+  while (chunks_ >= max_chunks_)
+    CHECK_EQ(0, pthread_cond_wait(&changed_, &mutex_));
+  fetched_.push_back(Chunk());
+  fetched_.back().first = first;
+  fetched_.back().entries.swap(*entries);
+  ++chunks_;
+  CHECK_EQ(0, pthread_cond_broadcast(&changed_));
+}
+
+void Scanner::Match() {
+  for (;;) {
+    Chunk chunk;
+    {
+      ScopedLock lock(&mutex_);
+      while (fetched_.empty() && !fetched_all_)
+        CHECK_EQ(0, pthread_cond_wait(&changed_, &mutex_));
+      if (fetched_.empty())
+        return;
+      chunk.first = fetched_.front().first;
+      chunk.entries.swap(fetched_.front().entries);
+      fetched_.pop_front();
+      ++matching_;
+    }
+
+    MatchedChunk matched;
+    matched.size = chunk.entries.size();
+    for (size_t i = 0; i < chunk.entries.size(); ++i) {
+      const ct::TimestampedEntry &timestamped =
+          chunk.entries[i].leaf.timestamped_entry();
+      const bool precert = timestamped.entry_type() == ct::PRECERT_ENTRY;
+      Cert cert;
+      if (cert.LoadFromDerString(precert ?
+              chunk.entries[i].entry.precert_entry().pre_certificate() :
+              timestamped.signed_entry().x509()) != Cert::TRUE) {
+        ++matched.unparsed;
+        continue;
+      }
+      if (matcher_->Matches(cert, precert)) {
+        matched.indices.push_back(chunk.first + i);
+        matched.entries.push_back(HTTPLogClient::LogEntry());
+        matched.entries.back().leaf.Swap(&chunk.entries[i].leaf);
+        matched.entries.back().entry.Swap(&chunk.entries[i].entry);
+      }
+    }
+
+    ScopedLock lock(&mutex_);
+    std::swap(matched_[chunk.first], matched);
+    --matching_;
+    CHECK_EQ(0, pthread_cond_broadcast(&changed_));
+  }
+}
+
+void Scanner::Report(Callback *callback) {
+  int next = first_;
+  size_t unchecked = 0;
+  for (;;) {
+    MatchedChunk matched;
+    {
+      ScopedLock lock(&mutex_);
+      while ((matched_.empty() || matched_.begin()->first != next) &&
+             !(fetched_all_ && fetched_.empty() && matching_ == 0))
+        CHECK_EQ(0, pthread_cond_wait(&changed_, &mutex_));
+      if (matched_.empty() || matched_.begin()->first != next)
+        break;
+      std::swap(matched, matched_.begin()->second);
+      matched_.erase(matched_.begin());
+      --chunks_;
+      CHECK_EQ(0, pthread_cond_broadcast(&changed_));
+    }
+
+    for (size_t i = 0; i < matched.entries.size(); ++i)
+      callback->Matched(matched.indices[i], matched.entries[i]);
+    next += matched.size;
+    scanned_ += matched.size;
+    unparsed_ += matched.unparsed;
+    unchecked += matched.size;
+    if (unchecked >= kCheckpointEntries) {
+      WriteCheckpoint(next);
+      LOG(INFO) << "Scanned entries up to " << next - 1;
+      unchecked = 0;
+    }
+  }
+  if (unchecked > 0)
+    WriteCheckpoint(next);
+}
+
+void Scanner::WriteCheckpoint(int next) const {
+  if (checkpoint_file_.empty())
+    return;
+  char checkpoint[32];
+  snprintf(checkpoint, sizeof checkpoint, "%d\n", next);
+  // Write a new file and rename it over the old one, so that a crash never
+  // leaves a partial checkpoint behind.
+  const string tmp_file = util::WriteTemporaryBinaryFile(
+      checkpoint_file_ + ".XXXXXX", checkpoint);
+  CHECK(!tmp_file.empty()) << "Failed to write scan checkpoint";
+  PCHECK(rename(tmp_file.c_str(), checkpoint_file_.c_str()) == 0)
+      << "Failed to rename " << tmp_file << " to " << checkpoint_file_;
+}
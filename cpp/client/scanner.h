@@ -0,0 +1,187 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <deque>
+#include <map>
+#include <pthread.h>
+#include <regex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "client/entry_fetcher.h"
+#include "client/http_log_client.h"
+
+namespace ct {
+class Cert;
+}  // namespace ct
+
+// Decides which entries a Scanner reports, from their certificate: the
+// leaf certificate of an X.509 entry, or the precertificate, as the CA
+// submitted it, of a precert entry. The issuer of a precertificate is
+// that of the precertificate signing certificate, if the CA used one.
+// Matchers are called from several threads at once.
+class CertMatcher {
+ public:
+  virtual ~CertMatcher() {}
+
+  virtual bool Matches(const ct::Cert &cert, bool precert) const = 0;
+};
+
+// Matches a POSIX extended regular expression against the subject name,
+// as Cert::PrintSubjectName() prints it, and the DNS names of the
+// subjectAltName extension.
+class SubjectRegexMatcher : public CertMatcher {
+ public:
+  // Aborts if |regex| doesn't compile.
+  explicit SubjectRegexMatcher(const std::string &regex);
+  virtual ~SubjectRegexMatcher();
+
+  virtual bool Matches(const ct::Cert &cert, bool precert) const;
+
+ private:
+  regex_t regex_;
+};
+
+// Matches a POSIX extended regular expression against the issuer name,
+// as Cert::PrintIssuerName() prints it.
+class IssuerRegexMatcher : public CertMatcher {
+ public:
+  // Aborts if |regex| doesn't compile.
+  explicit IssuerRegexMatcher(const std::string &regex);
+  virtual ~IssuerRegexMatcher();
+
+  virtual bool Matches(const ct::Cert &cert, bool precert) const;
+
+ private:
+  regex_t regex_;
+};
+
+// Matches a serial number, as unsigned big-endian bytes.
+class SerialNumberMatcher : public CertMatcher {
+ public:
+  explicit SerialNumberMatcher(const std::string &serial);
+
+  virtual bool Matches(const ct::Cert &cert, bool precert) const;
+
+ private:
+  const std::string serial_;
+};
+
+// Matches precertificates only.
+class PrecertMatcher : public CertMatcher {
+ public:
+  virtual bool Matches(const ct::Cert &cert, bool precert) const {
+    return precert;
+  }
+};
+
+// Matches what all of its matchers match, or everything if it has none.
+class AllOfMatcher : public CertMatcher {
+ public:
+  AllOfMatcher() {}
+  virtual ~AllOfMatcher();
+
+  // Takes ownership of |matcher|.
+  void Add(CertMatcher *matcher) { matchers_.push_back(matcher); }
+
+  virtual bool Matches(const ct::Cert &cert, bool precert) const;
+
+ private:
+  std::vector<CertMatcher*> matchers_;
+};
+
+// Scans a range of a log's entries for those that a matcher matches:
+// fetches them in one thread, with an EntryFetcher, matches them in a
+// pool of threads, and reports the matches in the calling thread, in
+// order. Up to |max_chunks| chunks of entries can be between the fetcher
+// and the reporting.
+//
+// Progress can be checkpointed to a file, which a later scan resumes from.
+// A match is reported before the checkpoint that passes it is written, so
+// a scan that is interrupted may report a few matches again when resumed,
+// but never misses one.
+//
+// Not thread-safe.
+class Scanner : private EntryFetcher::Callback {
+ public:
+  class Callback {
+   public:
+    virtual ~Callback() {}
+
+    // |entry|, at |index|, is a match.
+    virtual void Matched(int index, const HTTPLogClient::LogEntry &entry) = 0;
+  };
+
+  // Fetches with |fetcher|, and matches with |matcher| in |match_threads|
+  // threads. Does not take ownership of either.
+  Scanner(EntryFetcher *fetcher, const CertMatcher *matcher,
+          size_t match_threads, size_t max_chunks);
+  ~Scanner();
+
+  // Scan the entries |first| to |last|, both included, or if
+  // |checkpoint_file| (unless it is empty) has a checkpoint in that range,
+  // from the checkpoint on. Returns the status of the fetch; if it failed,
+  // the entries before the failure have been scanned, and checkpointed.
+  HTTPLogClient::Status Scan(int first, int last,
+                             const std::string &checkpoint_file,
+                             Callback *callback);
+
+  // The number of entries scanned, and of those that didn't parse, in the
+  // last scan.
+  uint64_t Scanned() const { return scanned_; }
+  uint64_t Unparsed() const { return unparsed_; }
+
+ private:
+  struct Chunk {
+    int first;
+    std::vector<HTTPLogClient::LogEntry> entries;
+  };
+
+  // A chunk that has been matched: the matching entries, and their
+  // indices.
+  struct MatchedChunk {
+    MatchedChunk() : size(0), unparsed(0) {}
+
+    size_t size;
+    size_t unparsed;
+    std::vector<int> indices;
+    std::vector<HTTPLogClient::LogEntry> entries;
+  };
+
+  static void *FetchThread(void *arg);
+  static void *MatchThread(void *arg);
+
+  // Called from the fetch thread; waits while the pipeline is full.
+  virtual void Entries(int first,
+                       std::vector<HTTPLogClient::LogEntry> *entries);
+  void Match();
+  // Report the matched chunks in order, until the next one won't come.
+  void Report(Callback *callback);
+  void WriteCheckpoint(int next) const;
+
+  EntryFetcher *const fetcher_;
+  const CertMatcher *const matcher_;
+  const size_t match_threads_;
+  const size_t max_chunks_;
+  int first_;
+  int last_;
+  std::string checkpoint_file_;
+  uint64_t scanned_;
+  uint64_t unparsed_;
+
+  pthread_mutex_t mutex_;
+  pthread_cond_t changed_;
+  // Chunks fetched but not reported yet.
+  size_t chunks_;
+  std::deque<Chunk> fetched_;
+  size_t matching_;
+  // Matched chunks, keyed by the index of their first entry.
+  std::map<int, MatchedChunk> matched_;
+  bool fetched_all_;
+  HTTPLogClient::Status status_;
+};
+
+#endif  // SCANNER_H
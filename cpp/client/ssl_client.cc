@@ -4,6 +4,7 @@
 #include <openssl/bio.h>
 #include <openssl/ssl.h>
 #include <openssl/x509.h>
+#include <vector>
 
 #include "client/client.h"
 #include "log/cert.h"
@@ -18,11 +19,13 @@ using ct::CertChain;
 using ct::LogEntry;
 using ct::SSLClientCTData;
 using ct::SignedCertificateTimestamp;
-using ct::SignedCertificateTimestampList;
 using std::string;
 
 const uint16_t CT_EXTENSION_TYPE = 18;
 
+// Enough for the SCTs of a fleet of servers.
+static const size_t kVerifiedSCTCacheSize = 10000;
+
 //static
 int SSLClient::ExtensionCallback(SSL *s, unsigned short ext_type,
 				 const unsigned char *in, unsigned short inlen, 
@@ -63,8 +66,10 @@ SSLClient::SSLClient(const string &server, uint16_t port,
     : client_(server, port),
       ctx_(NULL),
       ssl_(NULL),
-      verify_args_(verifier),
-      connected_(false) {
+      verify_args_(verifier, kVerifiedSCTCacheSize),
+      connected_(false),
+      session_(NULL),
+      session_sct_verified_(false) {
   ctx_ = SSL_CTX_new(TLSv1_client_method());
   CHECK_NOTNULL(ctx_);
 
@@ -92,6 +97,7 @@ SSLClient::SSLClient(const string &server, uint16_t port,
 
 SSLClient::~SSLClient() {
   Disconnect();
+  ForgetSession();
   if (ctx_ != NULL)
     SSL_CTX_free(ctx_);
   delete verify_args_.verifier;
@@ -125,21 +131,33 @@ void SSLClient::GetSSLClientCTData(SSLClientCTData *data) const {
 // that proof too, but let's not complicate things for now.
 // static
 LogVerifier::VerifyResult
-SSLClient::VerifySCT(const string &token, LogVerifier *verifier,
-                     SSLClientCTData *data) {
+SSLClient::VerifySCT(const ByteView &token, LogVerifier *verifier,
+                     SCTCache *cache, SSLClientCTData *data) {
   CHECK(data->has_reconstructed_entry());
+  const LogEntry &entry = data->reconstructed_entry();
   SignedCertificateTimestamp local_sct;
   // Skip over bad SCTs. These could be either badly encoded ones, or SCTs whose
   // version we don't understand.
   if (Deserializer::DeserializeSCT(token, &local_sct) != Deserializer::OK)
     return LogVerifier::INVALID_FORMAT;
 
+  // The log signs the issuer key of a precertificate too.
+  string key = data->certificate_sha256_hash();
+  if (entry.type() == ct::PRECERT_ENTRY)
+    key += entry.precert_entry().pre_cert().issuer_key_hash();
+  key += token.ToString();
+
   string merkle_leaf;
-  LogVerifier::VerifyResult result =
-      verifier->VerifySignedCertificateTimestamp(data->reconstructed_entry(),
-                                                 local_sct, &merkle_leaf);
-  if (result != LogVerifier::VERIFY_OK)
-    return result;
+  if (cache == NULL || !cache->Get(key, &merkle_leaf)) {
+    LogVerifier::VerifyResult result =
+        verifier->VerifySignedCertificateTimestamp(entry, local_sct,
+                                                   &merkle_leaf);
+    if (result != LogVerifier::VERIFY_OK)
+      return result;
+    // Only successes, so that a bad SCT is looked at afresh each time.
+    if (cache != NULL)
+      cache->Put(key, merkle_leaf);
+  }
   SSLClientCTData::SCTInfo *sct_info = data->add_attached_sct_info();
   sct_info->set_merkle_leaf_hash(merkle_leaf);
   sct_info->mutable_sct()->CopyFrom(local_sct);
@@ -220,17 +238,17 @@ int SSLClient::VerifyCallback(X509_STORE_CTX *ctx, void *arg) {
       args->ct_data.set_certificate_sha256_hash(
           Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry)));
       // Only writes the checkpoint if verification succeeds.
-      // Note: an optimized client could only verify the signature if it's
-      // a certificate it hasn't seen before.
-      SignedCertificateTimestampList sct_list;
+      // The SCTs are parsed in place, without copying them out.
+      std::vector<ByteView> sct_list;
       if (Deserializer::DeserializeSCTList(serialized_scts, &sct_list) !=
           Deserializer::OK) {
         LOG(ERROR) << "Failed to parse SCT list.";
       } else {
-        LOG(INFO) << "Received " << sct_list.sct_list_size() << " SCTs";
-        for (int i = 0; i < sct_list.sct_list_size(); ++i) {
+        LOG(INFO) << "Received " << sct_list.size() << " SCTs";
+        for (size_t i = 0; i < sct_list.size(); ++i) {
           LogVerifier::VerifyResult result =
-              VerifySCT(sct_list.sct_list(i), verifier, &args->ct_data);
+              VerifySCT(sct_list[i], verifier, &args->verified_scts,
+                        &args->ct_data);
 
           if (result == LogVerifier::VERIFY_OK) {
             LOG(INFO) << "SCT number " << i + 1 << " verified";
@@ -255,6 +273,7 @@ int SSLClient::VerifyCallback(X509_STORE_CTX *ctx, void *arg) {
 void SSLClient::ResetVerifyCallbackArgs(bool strict) {
   verify_args_.sct_verified = false;
   verify_args_.require_sct = strict;
+  verify_args_.ct_extension.clear();
   verify_args_.ct_data.CopyFrom(SSLClientCTData::default_instance());
 }
 
@@ -268,21 +287,52 @@ SSLClient::HandshakeResult SSLClient::SSLConnect(bool strict) {
   CHECK_NOTNULL(bio);
   // Takes ownership of bio.
   SSL_set_bio(ssl_, bio, bio);
+  // Offer the last session; the server may take it, or do a full handshake.
+  if (session_ != NULL)
+    CHECK_EQ(1, SSL_set_session(ssl_, session_));
 
   ResetVerifyCallbackArgs(strict);
   int ret = SSL_connect(ssl_);
-  HandshakeResult result;
-  if (ret == 1) {
-    LOG(INFO) << "Handshake successful. SSL session started";
-    connected_ = true;
-    DCHECK(!verify_args_.require_sct || verify_args_.sct_verified);
-    result = OK;
-  } else {
+  if (ret != 1) {
     // TODO(ekasper): look into OpenSSL error stack to determine
     // the error reason. Could be unrelated to SCT verification.
     LOG(ERROR) << "SSL handshake failed";
-    result = HANDSHAKE_FAILED;
     Disconnect();
+    ForgetSession();
+    return HANDSHAKE_FAILED;
+  }
+
+  if (SSL_session_reused(ssl_)) {
+    // The verify callback didn't run, so what it found in the handshake
+    // that made the session still holds.
+    LOG(INFO) << "SSL session resumed";
+    verify_args_.sct_verified = session_sct_verified_;
+    verify_args_.ct_data.CopyFrom(session_ct_data_);
+    // The session may have been made without requiring an SCT.
+    if (verify_args_.require_sct && !verify_args_.sct_verified) {
+      LOG(ERROR) << "No valid SCT found";
+      Disconnect();
+      ForgetSession();
+      return HANDSHAKE_FAILED;
+    }
+  } else {
+    ForgetSession();
+    session_ = CHECK_NOTNULL(SSL_get1_session(ssl_));
+    session_sct_verified_ = verify_args_.sct_verified;
+    session_ct_data_.CopyFrom(verify_args_.ct_data);
+  }
+
+  LOG(INFO) << "Handshake successful. SSL session started";
+  connected_ = true;
+  DCHECK(!verify_args_.require_sct || verify_args_.sct_verified);
+  return OK;
+}
+
+void SSLClient::ForgetSession() {
+  if (session_ != NULL) {
+    SSL_SESSION_free(session_);
+    session_ = NULL;
   }
-  return result;
+  session_sct_verified_ = false;
+  session_ct_data_.Clear();
 }
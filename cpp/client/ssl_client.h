@@ -9,6 +9,8 @@
 #include "client/ssl_client.h"
 #include "log/log_verifier.h"
 #include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/lru_cache.h"
 
 class LogVerifier;
 
@@ -43,9 +45,13 @@ class SSLClient {
 
   void GetSSLClientCTData(ct::SSLClientCTData *data) const;
 
-  // Need a static wrapper for the callback.
+  // The Merkle leaf hashes of SCTs verified already, by entry and SCT.
+  typedef util::LRUCache<std::string, std::string> SCTCache;
+
+  // Need a static wrapper for the callback. Looks the SCT up in |cache|
+  // first, unless NULL, and remembers it there if it verifies.
   static LogVerifier::VerifyResult
-  VerifySCT(const std::string &token, LogVerifier *verifier,
+  VerifySCT(const ByteView &token, LogVerifier *verifier, SCTCache *cache,
             ct::SSLClientCTData *data);
 
   // Custom verification callback for verifying the SCT token
@@ -73,11 +79,12 @@ class SSLClient {
   SSL_CTX *ctx_;
   SSL *ssl_;
   struct VerifyCallbackArgs {
-    VerifyCallbackArgs(LogVerifier *log_verifier)
+    VerifyCallbackArgs(LogVerifier *log_verifier, size_t cache_size)
         : verifier(log_verifier),
           sct_verified(false),
           require_sct(false),
-          ct_data() {}
+          ct_data(),
+          verified_scts(cache_size) {}
 
     // The verifier for checking log proofs.
     LogVerifier *verifier;
@@ -89,14 +96,26 @@ class SSLClient {
     // the signed part of the entry (i.e., type and leaf certificate)
     // and all valid SCTs.
     ct::SSLClientCTData ct_data;
+    // So that reconnecting to a server with the same certificate and
+    // SCTs doesn't verify the same signatures again.
+    SCTCache verified_scts;
   };
 
   VerifyCallbackArgs verify_args_;
   bool connected_;
+  // The session of the last full handshake, to resume on the next one,
+  // and what we verified in it, since the server doesn't send its
+  // certificate again when resuming.
+  SSL_SESSION *session_;
+  bool session_sct_verified_;
+  ct::SSLClientCTData session_ct_data_;
 
   // Call before each handshake.
   void ResetVerifyCallbackArgs(bool strict);
 
+  // Do a full handshake next time.
+  void ForgetSession();
+
   HandshakeResult SSLConnect(bool strict);
 };
 #endif
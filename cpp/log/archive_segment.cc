@@ -0,0 +1,235 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/archive_segment.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace {
+
+const char kMagic[] = "CTARCHV1";
+const size_t kTrailerSize = 32;
+
+void AppendUint64(uint64_t value, string *out) {
+  for (int shift = 56; shift >= 0; shift -= 8)
+    out->push_back(static_cast<char>((value >> shift) & 0xff));
+}
+
+uint64_t ReadUint64(const char *in) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(in);
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i)
+    value = (value << 8) | bytes[i];
+  return value;
+}
+
+uint32_t ReadUint32(const char *in) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(in);
+  return (static_cast<uint32_t>(bytes[0]) << 24) |
+      (static_cast<uint32_t>(bytes[1]) << 16) |
+      (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+}
+
+// Orders the positions of entries by their hashes, which are |hash_size|
+// bytes each in |hashes|.
+class HashOrder {
+ public:
+  HashOrder(const string &hashes, size_t hash_size)
+      : hashes_(hashes.data()), hash_size_(hash_size) {}
+
+  bool operator()(uint32_t a, uint32_t b) const {
+    return memcmp(hashes_ + a * hash_size_, hashes_ + b * hash_size_,
+                  hash_size_) < 0;
+  }
+
+ private:
+  const char *hashes_;
+  size_t hash_size_;
+};
+
+}  // namespace
+
+ArchiveSegment::Writer::Writer(const string &path, uint64_t first,
+                               size_t hash_size)
+    : path_(path),
+      first_(first),
+      hash_size_(hash_size),
+      tmp_path_(path + ".XXXXXX"),
+      size_(0) {
+  CHECK_GT(hash_size_, 0U);
+  fd_ = mkstemp(&tmp_path_[0]);
+  PCHECK(fd_ >= 0) << "Could not create " << tmp_path_;
+}
+
+ArchiveSegment::Writer::~Writer() {
+  if (fd_ < 0)
+    return;
+  close(fd_);
+  unlink(tmp_path_.c_str());
+}
+
+void ArchiveSegment::Writer::Add(const string &hash, const string &leaf_hash,
+                                 const string &data) {
+  CHECK_GE(fd_, 0) << "Segment already finished";
+  CHECK_EQ(hash_size_, hash.size());
+  CHECK_EQ(hash_size_, leaf_hash.size());
+  // Positions are 4 bytes in the hash index.
+  CHECK_LT(offsets_.size(), 0xffffffffU);
+  offsets_.push_back(size_);
+  Write(data);
+  hashes_.append(hash);
+  leaf_hashes_.append(leaf_hash);
+}
+
+void ArchiveSegment::Writer::Finish() {
+  CHECK_GE(fd_, 0) << "Segment already finished";
+  const uint64_t data_end = size_;
+  Write(leaf_hashes_);
+
+  const size_t count = offsets_.size();
+  std::vector<uint32_t> positions(count);
+  for (size_t i = 0; i < count; ++i)
+    positions[i] = i;
+  std::sort(positions.begin(), positions.end(),
+            HashOrder(hashes_, hash_size_));
+  string table;
+  table.reserve(count * (hash_size_ + 4));
+  for (size_t i = 0; i < count; ++i) {
+    table.append(hashes_, positions[i] * hash_size_, hash_size_);
+    for (int shift = 24; shift >= 0; shift -= 8)
+      table.push_back(static_cast<char>((positions[i] >> shift) & 0xff));
+  }
+  Write(table);
+
+  table.clear();
+  for (size_t i = 0; i < count; ++i)
+    AppendUint64(offsets_[i], &table);
+  AppendUint64(data_end, &table);
+  AppendUint64(first_, &table);
+  AppendUint64(count, &table);
+  AppendUint64(hash_size_, &table);
+  table.append(kMagic, 8);
+  Write(table);
+
+  // The segment replaces entries elsewhere, so it must be on disk first.
+  PCHECK(fsync(fd_) == 0) << "Could not sync " << tmp_path_;
+  PCHECK(close(fd_) == 0) << "Could not close " << tmp_path_;
+  fd_ = -1;
+  PCHECK(rename(tmp_path_.c_str(), path_.c_str()) == 0)
+      << "Could not rename " << tmp_path_ << " to " << path_;
+}
+
+void ArchiveSegment::Writer::Write(const string &data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t ret = write(fd_, data.data() + done, data.size() - done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    PCHECK(ret > 0) << "Could not write to " << tmp_path_;
+    done += ret;
+  }
+  size_ += data.size();
+}
+
+ArchiveSegment::ArchiveSegment(const string &path)
+    : path_(path), data_(NULL), size_(0) {
+  const int fd = open(path_.c_str(), O_RDONLY);
+  PCHECK(fd >= 0) << "Could not open " << path_;
+  struct stat st;
+  PCHECK(fstat(fd, &st) == 0) << "Could not stat " << path_;
+  size_ = st.st_size;
+  CHECK_GE(size_, kTrailerSize) << "Corrupt archive segment " << path_;
+  void *mapped = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+  PCHECK(mapped != MAP_FAILED) << "Could not map " << path_;
+  close(fd);
+  data_ = static_cast<const char*>(mapped);
+  // Lookups jump around, so reading ahead would only waste the cache.
+  madvise(mapped, size_, MADV_RANDOM);
+
+  const char *trailer = data_ + size_ - kTrailerSize;
+  CHECK_EQ(0, memcmp(trailer + 24, kMagic, 8))
+      << "Not an archive segment: " << path_;
+  first_ = ReadUint64(trailer);
+  count_ = ReadUint64(trailer + 8);
+  hash_size_ = ReadUint64(trailer + 16);
+  CHECK_GT(hash_size_, 0U) << "Corrupt archive segment " << path_;
+  CHECK_LE(count_, size_ / (2 * hash_size_ + 12))
+      << "Corrupt archive segment " << path_;
+  const uint64_t tables = count_ * (2 * hash_size_ + 4) +
+      (count_ + 1) * 8 + kTrailerSize;
+  CHECK_LE(tables, size_) << "Corrupt archive segment " << path_;
+  leaf_hashes_ = size_ - tables;
+  hash_index_ = leaf_hashes_ + count_ * hash_size_;
+  offsets_ = hash_index_ + count_ * (hash_size_ + 4);
+  CHECK_EQ(leaf_hashes_, DataOffset(count_))
+      << "Corrupt archive segment " << path_;
+}
+
+ArchiveSegment::~ArchiveSegment() {
+  munmap(const_cast<char*>(data_), size_);
+}
+
+bool ArchiveSegment::Find(const string &hash,
+                          uint64_t *sequence_number) const {
+  if (hash.size() != hash_size_)
+    return false;
+  const size_t stride = hash_size_ + 4;
+  uint64_t low = 0, high = count_;
+  while (low < high) {
+    const uint64_t middle = low + (high - low) / 2;
+    const char *entry = data_ + hash_index_ + middle * stride;
+    const int order = memcmp(hash.data(), entry, hash_size_);
+    if (order == 0) {
+      if (sequence_number != NULL)
+        *sequence_number = first_ + ReadUint32(entry + hash_size_);
+      return true;
+    }
+    if (order < 0)
+      high = middle;
+    else
+      low = middle + 1;
+  }
+  return false;
+}
+
+string ArchiveSegment::LeafHash(uint64_t sequence_number) const {
+  CHECK_GE(sequence_number, first_);
+  CHECK_LT(sequence_number, end());
+  return string(data_ + leaf_hashes_ + (sequence_number - first_) *
+                hash_size_, hash_size_);
+}
+
+void ArchiveSegment::Hashes(std::vector<string> *hashes) const {
+  hashes->assign(count_, string());
+  const size_t stride = hash_size_ + 4;
+  for (uint64_t i = 0; i < count_; ++i) {
+    const char *entry = data_ + hash_index_ + i * stride;
+    const uint32_t position = ReadUint32(entry + hash_size_);
+    CHECK_LT(position, count_) << "Corrupt archive segment " << path_;
+    (*hashes)[position].assign(entry, hash_size_);
+  }
+}
+
+void ArchiveSegment::Data(uint64_t sequence_number, string *data) const {
+  CHECK_GE(sequence_number, first_);
+  CHECK_LT(sequence_number, end());
+  const uint64_t position = sequence_number - first_;
+  const uint64_t start = DataOffset(position);
+  const uint64_t end = DataOffset(position + 1);
+  CHECK_LE(start, end) << "Corrupt archive segment " << path_;
+  CHECK_LE(end, leaf_hashes_) << "Corrupt archive segment " << path_;
+  data->assign(data_ + start, end - start);
+}
+
+uint64_t ArchiveSegment::DataOffset(uint64_t position) const {
+  return ReadUint64(data_ + offsets_ + position * 8);
+}
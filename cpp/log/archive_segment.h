@@ -0,0 +1,106 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef ARCHIVE_SEGMENT_H
+#define ARCHIVE_SEGMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// An immutable file of consecutive logged entries, for entries that are
+// rarely read any more (see ArchivingDatabase). The file is mapped into
+// memory rather than read, so that only the pages that lookups touch take
+// up memory, and only in the page cache. It holds, in order:
+//
+//   the entries' data: opaque, e.g. compressed, one after the other;
+//   their leaf hashes, in sequence number order;
+//   the hash index: each entry's hash followed by its position in the
+//     segment (4 bytes), in hash order;
+//   where each entry's data starts (8 bytes each), and where the last one
+//     ends (8 bytes);
+//   a trailer: the first sequence number (8 bytes), the number of entries
+//     (8 bytes), the size of each hash (8 bytes) and a magic number (8
+//     bytes).
+//
+// Integers are big-endian. Segments abort on any filesystem error, and on
+// corrupt files.
+class ArchiveSegment {
+ public:
+  // Writes a new segment, to a temporary file until it is done.
+  class Writer {
+   public:
+    // The entries will be those from |first| on. Their entry and leaf
+    // hashes are |hash_size| bytes each.
+    Writer(const std::string &path, uint64_t first, size_t hash_size);
+    // Deletes the temporary file, unless Finish() was called.
+    ~Writer();
+
+    // Add the entry with the next sequence number.
+    void Add(const std::string &hash, const std::string &leaf_hash,
+             const std::string &data);
+
+    // One more than the sequence number of the last entry added.
+    uint64_t end() const { return first_ + offsets_.size(); }
+
+    // Write the indexes, sync the file and move it into place.
+    void Finish();
+
+   private:
+    void Write(const std::string &data);
+
+    const std::string path_;
+    const uint64_t first_;
+    const size_t hash_size_;
+    std::string tmp_path_;
+    int fd_;
+    // Bytes written so far.
+    uint64_t size_;
+    // The hashes of the entries added, in order, back to back.
+    std::string hashes_;
+    std::string leaf_hashes_;
+    std::vector<uint64_t> offsets_;
+  };
+
+  // Maps the segment in |path|.
+  explicit ArchiveSegment(const std::string &path);
+  ~ArchiveSegment();
+
+  const std::string &path() const { return path_; }
+
+  // The first sequence number in the segment, and one more than the last.
+  uint64_t first() const { return first_; }
+  uint64_t end() const { return first_ + count_; }
+
+  size_t hash_size() const { return hash_size_; }
+
+  // The bytes mapped, i.e. the size of the file.
+  size_t MappedBytes() const { return size_; }
+
+  // If the entry with |hash| is in the segment, set |*sequence_number|
+  // (unless NULL) to its sequence number, and return true.
+  bool Find(const std::string &hash, uint64_t *sequence_number) const;
+
+  // The following take a sequence number from first() to end() - 1.
+  std::string LeafHash(uint64_t sequence_number) const;
+
+  // Replace |hashes| with the entries' hashes, in sequence number order.
+  void Hashes(std::vector<std::string> *hashes) const;
+
+  void Data(uint64_t sequence_number, std::string *data) const;
+
+ private:
+  uint64_t DataOffset(uint64_t position) const;
+
+  const std::string path_;
+  const char *data_;
+  size_t size_;
+  uint64_t first_;
+  uint64_t count_;
+  size_t hash_size_;
+  // Where the tables start.
+  uint64_t leaf_hashes_;
+  uint64_t hash_index_;
+  uint64_t offsets_;
+};
+
+#endif  // ARCHIVE_SEGMENT_H
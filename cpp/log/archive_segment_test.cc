@@ -0,0 +1,123 @@
+#include <dirent.h>
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "log/archive_segment.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace {
+
+using std::string;
+
+const size_t kHashSize = 32;
+
+// The number of files in |dir|.
+size_t FileCount(const string &dir) {
+  DIR *d = opendir(dir.c_str());
+  CHECK(d != NULL);
+  size_t count = 0;
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL)
+    if (entry->d_name[0] != '.')
+      ++count;
+  closedir(d);
+  return count;
+}
+
+class ArchiveSegmentTest : public ::testing::Test {
+ protected:
+  ArchiveSegmentTest() : path_(tmp_.TmpStorageDir() + "/archive") {}
+
+  // Write |count| entries from |first| on, keeping them in the vectors.
+  void Write(uint64_t first, size_t count) {
+    ArchiveSegment::Writer writer(path_, first, kHashSize);
+    for (size_t i = 0; i < count; ++i) {
+      hashes_.push_back(util::RandomString(kHashSize, kHashSize));
+      leaf_hashes_.push_back(util::RandomString(kHashSize, kHashSize));
+      // Some entries are empty.
+      data_.push_back(i % 5 == 0 ? string() : util::RandomString(1, 512));
+      writer.Add(hashes_.back(), leaf_hashes_.back(), data_.back());
+      EXPECT_EQ(first + i + 1, writer.end());
+    }
+    writer.Finish();
+  }
+
+  TmpStorage tmp_;
+  const string path_;
+  std::vector<string> hashes_;
+  std::vector<string> leaf_hashes_;
+  std::vector<string> data_;
+};
+
+TEST_F(ArchiveSegmentTest, WriteAndRead) {
+  const uint64_t first = 1000;
+  Write(first, 100);
+
+  ArchiveSegment segment(path_);
+  EXPECT_EQ(path_, segment.path());
+  EXPECT_EQ(first, segment.first());
+  EXPECT_EQ(first + hashes_.size(), segment.end());
+  EXPECT_EQ(kHashSize, segment.hash_size());
+  struct stat st;
+  ASSERT_EQ(0, stat(path_.c_str(), &st));
+  EXPECT_EQ(static_cast<size_t>(st.st_size), segment.MappedBytes());
+
+  for (size_t i = 0; i < hashes_.size(); ++i) {
+    uint64_t sequence_number = 0;
+    EXPECT_TRUE(segment.Find(hashes_[i], &sequence_number));
+    EXPECT_EQ(first + i, sequence_number);
+    EXPECT_EQ(leaf_hashes_[i], segment.LeafHash(first + i));
+    string data;
+    segment.Data(first + i, &data);
+    EXPECT_EQ(data_[i], data);
+  }
+
+  std::vector<string> hashes(1, "replaced");
+  segment.Hashes(&hashes);
+  EXPECT_EQ(hashes_, hashes);
+
+  string missing = hashes_[0];
+  missing[kHashSize - 1] ^= 1;
+  EXPECT_FALSE(segment.Find(missing, NULL));
+  EXPECT_FALSE(segment.Find(hashes_[0].substr(1), NULL));
+}
+
+TEST_F(ArchiveSegmentTest, Empty) {
+  Write(7, 0);
+  ArchiveSegment segment(path_);
+  EXPECT_EQ(7U, segment.first());
+  EXPECT_EQ(7U, segment.end());
+  EXPECT_FALSE(segment.Find(string(kHashSize, 'x'), NULL));
+}
+
+// A segment that wasn't finished leaves nothing behind.
+TEST_F(ArchiveSegmentTest, Unfinished) {
+  {
+    ArchiveSegment::Writer writer(path_, 0, kHashSize);
+    writer.Add(string(kHashSize, 'h'), string(kHashSize, 'l'), "data");
+  }
+  struct stat st;
+  EXPECT_NE(0, stat(path_.c_str(), &st));
+  EXPECT_EQ(0U, FileCount(tmp_.TmpStorageDir()));
+}
+
+typedef ArchiveSegmentTest ArchiveSegmentDeathTest;
+
+TEST_F(ArchiveSegmentDeathTest, Truncated) {
+  Write(0, 10);
+  ASSERT_EQ(0, truncate(path_.c_str(), 100));
+  EXPECT_DEATH(ArchiveSegment segment(path_), "archive segment");
+}
+
+}  // namespace
+
+int main(int argc, char**argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,455 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/archiving_db.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <glog/logging.h>
+#include <set>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "log/archive_segment.h"
+#include "log/entry_compressor.h"
+#include "merkletree/serial_hasher.h"
+#include "util/memory_usage.h"
+
+using std::string;
+
+namespace {
+
+const char kArchivePrefix[] = "archive-";
+
+// Entries read per range lookup when writing a segment, so that other
+// users of the database get a look in between.
+const uint64_t kReadChunk = 1024;
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+bool StartsAfter(uint64_t sequence_number, const ArchiveSegment *segment) {
+  return sequence_number < segment->first();
+}
+
+}  // namespace
+
+// Adds the entries of a range lookup to a segment.
+template <class Logged> class ArchivingDatabase<Logged>::SegmentWriter
+    : public Database<Logged>::EntryCallback {
+ public:
+  SegmentWriter(const ArchivingDatabase<Logged> *db,
+                ArchiveSegment::Writer *writer)
+      : db_(db), writer_(writer) {}
+
+  virtual bool Entry(const Logged &logged) {
+    CHECK_EQ(writer_->end(), logged.sequence_number());
+    string data;
+    CHECK(logged.SerializeForDatabase(&data));
+    db_->CompressEntry(&data);
+    writer_->Add(logged.Hash(), ArchivingDatabase<Logged>::LeafHash(logged),
+                 data);
+    return true;
+  }
+
+ private:
+  const ArchivingDatabase<Logged> *db_;
+  ArchiveSegment::Writer *writer_;
+};
+
+template <class Logged>
+ArchivingDatabase<Logged>::ArchivingDatabase(Database<Logged> *db,
+                                             const string &dir,
+                                             const EntryCompressor *compressor)
+    : db_(db), dir_(dir), owned_compressor_(NULL), hashes_segment_(NULL) {
+  CHECK_NOTNULL(db);
+  if (compressor == NULL) {
+    owned_compressor_ = new EntryCompressor("");
+    compressor = owned_compressor_;
+  }
+  this->SetCompressor(compressor);
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+  CHECK_EQ(0, pthread_mutex_init(&hashes_mutex_, NULL));
+  if (mkdir(dir_.c_str(), 0700) != 0)
+    PCHECK(errno == EEXIST) << "Could not create " << dir_;
+
+  DIR *d = opendir(dir_.c_str());
+  PCHECK(d != NULL) << "Could not open " << dir_;
+  std::vector<uint64_t> firsts;
+  const size_t prefix_length = strlen(kArchivePrefix);
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    if (strncmp(entry->d_name, kArchivePrefix, prefix_length) != 0)
+      continue;
+    char *end;
+    uint64_t first = strtoull(entry->d_name + prefix_length, &end, 10);
+    if (*end == '.') {
+      // A segment we didn't get to finish.
+      const string path = dir_ + "/" + entry->d_name;
+      PCHECK(unlink(path.c_str()) == 0) << "Could not remove " << path;
+      continue;
+    }
+    CHECK_EQ('\0', *end) << "Unexpected file " << entry->d_name;
+    firsts.push_back(first);
+  }
+  closedir(d);
+  std::sort(firsts.begin(), firsts.end());
+  for (size_t i = 0; i < firsts.size(); ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "%s%020llu", kArchivePrefix,
+             static_cast<unsigned long long>(firsts[i]));
+    ArchiveSegment *segment = new ArchiveSegment(dir_ + "/" + name);
+    CHECK_EQ(ArchivedEnd(), segment->first())
+        << "Archive segments are not contiguous at " << segment->path();
+    segments_.push_back(segment);
+  }
+
+  // In case we died between adding the last segment and dropping its
+  // entries.
+  if (!segments_.empty())
+    CHECK(db_->DropLoggedEntries(ArchivedEnd()))
+        << "The database can't drop archived entries";
+}
+
+template <class Logged> ArchivingDatabase<Logged>::~ArchivingDatabase() {
+  for (size_t i = 0; i < segments_.size(); ++i)
+    delete segments_[i];
+  delete db_;
+  delete owned_compressor_;
+  pthread_mutex_destroy(&hashes_mutex_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+template <class Logged>
+uint64_t ArchivingDatabase<Logged>::ArchivedEnd() const {
+  ScopedLock lock(&mutex_);
+  return segments_.empty() ? 0 : segments_.back()->end();
+}
+
+template <class Logged> void ArchivingDatabase<Logged>::Archive(uint64_t end) {
+  AddSegment(WriteSegment(end, this));
+}
+
+template <class Logged> ArchiveSegment *
+ArchivingDatabase<Logged>::WriteSegment(uint64_t end,
+                                        const Database<Logged> *reader) const {
+  const uint64_t first = ArchivedEnd();
+  CHECK_GT(end, first);
+  char name[32];
+  snprintf(name, sizeof(name), "%s%020llu", kArchivePrefix,
+           static_cast<unsigned long long>(first));
+  const string path = dir_ + "/" + name;
+
+  // Entry and leaf hashes are both SHA-256.
+  ArchiveSegment::Writer writer(path, first, Sha256Hasher().DigestSize());
+  SegmentWriter callback(this, &writer);
+  for (uint64_t next = first; next < end; next += kReadChunk)
+    CHECK_EQ(this->LOOKUP_OK,
+             reader->LookupByIndexRange(next, std::min(end, next + kReadChunk),
+                                        &callback))
+        << "Can only archive logged entries";
+  CHECK_EQ(end, writer.end());
+  writer.Finish();
+  return new ArchiveSegment(path);
+}
+
+template <class Logged>
+void ArchivingDatabase<Logged>::AddSegment(ArchiveSegment *segment) {
+  CHECK_NOTNULL(segment);
+  {
+    ScopedLock lock(&mutex_);
+    CHECK_EQ(segments_.empty() ? 0 : segments_.back()->end(),
+             segment->first());
+    segments_.push_back(segment);
+  }
+  CHECK(db_->DropLoggedEntries(segment->end()))
+      << "The database can't drop archived entries";
+}
+
+template <class Logged> bool ArchivingDatabase<Logged>::Transactional() const {
+  return db_->Transactional();
+}
+
+template <class Logged>
+bool ArchivingDatabase<Logged>::ConcurrentReads() const {
+  return db_->ConcurrentReads();
+}
+
+template <class Logged> void ArchivingDatabase<Logged>::ExportMemoryUsage(
+    util::Metrics *metrics) const {
+  db_->ExportMemoryUsage(metrics);
+  util::MemoryUsage usage;
+  ScopedLock lock(&mutex_);
+  for (size_t i = 0; i < segments_.size(); ++i)
+    usage.Add(util::MemoryUsage(segments_[i]->MappedBytes(),
+                                segments_[i]->end() - segments_[i]->first()));
+  util::ExportMemoryUsage("archive_segments", usage, metrics);
+}
+
+template <class Logged> void ArchivingDatabase<Logged>::BeginTransaction() {
+  db_->BeginTransaction();
+}
+
+template <class Logged> void ArchivingDatabase<Logged>::EndTransaction() {
+  db_->EndTransaction();
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+ArchivingDatabase<Logged>::CreatePendingEntry_(const Logged &logged) {
+  if (FindArchived(logged.Hash(), NULL) != NULL)
+    return this->DUPLICATE_CERTIFICATE_HASH;
+  return db_->CreatePendingEntry(logged);
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+ArchivingDatabase<Logged>::AssignSequenceNumber(const string &pending_hash,
+                                                uint64_t sequence_number) {
+  WriteResult result = CheckAssignment(pending_hash, sequence_number);
+  if (result != this->OK)
+    return result;
+  result = db_->AssignSequenceNumber(pending_hash, sequence_number);
+  if (result == this->ENTRY_NOT_FOUND &&
+      FindArchived(pending_hash, NULL) != NULL)
+    return this->ENTRY_ALREADY_LOGGED;
+  return result;
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+ArchivingDatabase<Logged>::AssignSequenceNumbers(
+    const std::vector<string> &pending_hashes,
+    uint64_t first_sequence_number, size_t *assigned) {
+  CHECK_NOTNULL(assigned);
+  if (!pending_hashes.empty()) {
+    WriteResult result =
+        CheckAssignment(pending_hashes[0], first_sequence_number);
+    if (result != this->OK) {
+      *assigned = 0;
+      return result;
+    }
+  }
+  // The rest come after the first, so past the archive too.
+  WriteResult result = db_->AssignSequenceNumbers(
+      pending_hashes, first_sequence_number, assigned);
+  if (result == this->ENTRY_NOT_FOUND &&
+      FindArchived(pending_hashes[*assigned], NULL) != NULL)
+    return this->ENTRY_ALREADY_LOGGED;
+  return result;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ArchivingDatabase<Logged>::LookupByHash(const string &hash) const {
+  if (db_->LookupByHash(hash) == this->LOOKUP_OK ||
+      FindArchived(hash, NULL) != NULL)
+    return this->LOOKUP_OK;
+  return this->NOT_FOUND;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ArchivingDatabase<Logged>::LookupByHash(const string &hash,
+                                        Logged *result) const {
+  CHECK_NOTNULL(result);
+  // Recent entries are the ones most looked up. Entries are archived
+  // before they are dropped, so one that goes meanwhile is still found.
+  if (db_->LookupByHash(hash, result) == this->LOOKUP_OK)
+    return this->LOOKUP_OK;
+  uint64_t sequence_number;
+  const ArchiveSegment *segment = FindArchived(hash, &sequence_number);
+  if (segment == NULL || !ReadArchived(*segment, sequence_number, result))
+    return this->NOT_FOUND;
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ArchivingDatabase<Logged>::LookupByIndex(uint64_t sequence_number,
+                                         Logged *result) const {
+  CHECK_NOTNULL(result);
+  const ArchiveSegment *segment = SegmentFor(sequence_number);
+  if (segment == NULL) {
+    if (db_->LookupByIndex(sequence_number, result) == this->LOOKUP_OK)
+      return this->LOOKUP_OK;
+    // It may have been archived since.
+    segment = SegmentFor(sequence_number);
+    if (segment == NULL)
+      return this->NOT_FOUND;
+  }
+  CHECK(ReadArchived(*segment, sequence_number, result));
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ArchivingDatabase<Logged>::LookupByIndexRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::EntryCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  const uint64_t archived_end = std::min(end, ArchivedEnd());
+  const ArchiveSegment *segment = NULL;
+  for (uint64_t next = start; next < archived_end; ++next) {
+    if (segment == NULL || next >= segment->end())
+      segment = SegmentFor(next);
+    Logged logged;
+    CHECK(ReadArchived(*segment, next, &logged));
+    if (!callback->Entry(logged))
+      return this->LOOKUP_OK;
+  }
+  if (end <= archived_end)
+    return this->LOOKUP_OK;
+  return db_->LookupByIndexRange(std::max(start, archived_end), end,
+                                 callback);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ArchivingDatabase<Logged>::LookupLeafHashRange(
+    uint64_t start, uint64_t end, std::vector<string> *hashes) const {
+  CHECK_NOTNULL(hashes);
+  const uint64_t archived_end = std::min(end, ArchivedEnd());
+  const size_t size = hashes->size();
+  const ArchiveSegment *segment = NULL;
+  for (uint64_t next = start; next < archived_end; ++next) {
+    if (segment == NULL || next >= segment->end())
+      segment = SegmentFor(next);
+    hashes->push_back(segment->LeafHash(next));
+  }
+  if (end <= archived_end)
+    return this->LOOKUP_OK;
+  LookupResult result = db_->LookupLeafHashRange(std::max(start, archived_end),
+                                                 end, hashes);
+  if (result != this->LOOKUP_OK)
+    hashes->resize(size);
+  return result;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ArchivingDatabase<Logged>::LookupEntryHashRange(
+    uint64_t start, uint64_t end, std::vector<string> *hashes) const {
+  CHECK_NOTNULL(hashes);
+  const uint64_t archived_end = std::min(end, ArchivedEnd());
+  if (start < archived_end) {
+    ScopedLock lock(&hashes_mutex_);
+    for (uint64_t next = start; next < archived_end;) {
+      const ArchiveSegment *segment = SegmentFor(next);
+      // Segments index hashes by hash, so putting them in order takes a
+      // pass over the whole segment; keep them for the next range in it.
+      if (segment != hashes_segment_) {
+        segment->Hashes(&segment_hashes_);
+        hashes_segment_ = segment;
+      }
+      const uint64_t segment_end = std::min(archived_end, segment->end());
+      hashes->insert(
+          hashes->end(), segment_hashes_.begin() + (next - segment->first()),
+          segment_hashes_.begin() + (segment_end - segment->first()));
+      next = segment_end;
+      // Ranges are read in order, so that is the last of them.
+      if (segment_end == segment->end()) {
+        std::vector<string>().swap(segment_hashes_);
+        hashes_segment_ = NULL;
+      }
+    }
+  }
+  if (end <= archived_end)
+    return this->LOOKUP_OK;
+  return db_->LookupEntryHashRange(std::max(start, archived_end), end,
+                                   hashes);
+}
+
+template <class Logged> std::set<string>
+ArchivingDatabase<Logged>::PendingHashes() const {
+  return db_->PendingHashes();
+}
+
+template <class Logged> void ArchivingDatabase<Logged>::LookupPendingEntries(
+    size_t limit, typename Database<Logged>::EntryCallback *callback) const {
+  db_->LookupPendingEntries(limit, callback);
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+ArchivingDatabase<Logged>::WriteTreeHead_(const ct::SignedTreeHead &sth) {
+  return db_->WriteTreeHead(sth);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ArchivingDatabase<Logged>::LatestTreeHead(ct::SignedTreeHead *result) const {
+  return db_->LatestTreeHead(result);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ArchivingDatabase<Logged>::LookupTreeHeadByTimestamp(
+    uint64_t timestamp, ct::SignedTreeHead *result) const {
+  return db_->LookupTreeHeadByTimestamp(timestamp, result);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ArchivingDatabase<Logged>::LookupTreeHeadBySize(
+    uint64_t tree_size, ct::SignedTreeHead *result) const {
+  return db_->LookupTreeHeadBySize(tree_size, result);
+}
+
+template <class Logged> void ArchivingDatabase<Logged>::LookupTreeHeadRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::TreeHeadCallback *callback) const {
+  db_->LookupTreeHeadRange(start, end, callback);
+}
+
+template <class Logged> const ArchiveSegment *
+ArchivingDatabase<Logged>::SegmentFor(uint64_t sequence_number) const {
+  ScopedLock lock(&mutex_);
+  if (segments_.empty() || sequence_number >= segments_.back()->end())
+    return NULL;
+  return *(std::upper_bound(segments_.begin(), segments_.end(),
+                            sequence_number, StartsAfter) - 1);
+}
+
+template <class Logged> const ArchiveSegment *
+ArchivingDatabase<Logged>::FindArchived(const string &hash,
+                                        uint64_t *sequence_number) const {
+  std::vector<ArchiveSegment*> segments;
+  {
+    ScopedLock lock(&mutex_);
+    segments = segments_;
+  }
+  // Newest first: those are the entries looked up most.
+  for (size_t i = segments.size(); i > 0; --i)
+    if (segments[i - 1]->Find(hash, sequence_number))
+      return segments[i - 1];
+  return NULL;
+}
+
+template <class Logged>
+bool ArchivingDatabase<Logged>::ReadArchived(const ArchiveSegment &segment,
+                                             uint64_t sequence_number,
+                                             Logged *result) const {
+  string data;
+  segment.Data(sequence_number, &data);
+  if (!this->DecompressEntry(&data) || !result->ParseFromDatabase(data))
+    return false;
+  result->set_sequence_number(sequence_number);
+  return true;
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+ArchivingDatabase<Logged>::CheckAssignment(const string &hash,
+                                           uint64_t sequence_number) const {
+  if (sequence_number >= ArchivedEnd())
+    return this->OK;
+  // Report it as the wrapped database would have, had it kept the entries.
+  // Archived entries are logged, so none of them is pending.
+  Logged logged;
+  if (db_->LookupByHash(hash, &logged) != this->LOOKUP_OK)
+    return this->ENTRY_NOT_FOUND;
+  if (logged.has_sequence_number())
+    return this->ENTRY_ALREADY_LOGGED;
+  return this->SEQUENCE_NUMBER_ALREADY_IN_USE;
+}
@@ -0,0 +1,161 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+
+#ifndef ARCHIVING_DB_H
+#define ARCHIVING_DB_H
+#include <pthread.h>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/database.h"
+
+class ArchiveSegment;
+class EntryCompressor;
+
+namespace util {
+class Metrics;
+}  // namespace util
+
+// Wraps another Database and moves its oldest logged entries, which few
+// clients ever read again, out of it into ArchiveSegment files: immutable,
+// compressed, memory-mapped, with their own index. The wrapped database
+// stays the size of the recent entries, and so do its in-memory indexes.
+// Lookups of archived entries, by hash or sequence number, go to the
+// segments; the rest go to the wrapped database, which must support
+// DropLoggedEntries() (FileDB and SQLiteDB do).
+//
+// Segments cover sequence numbers 0 to ArchivedEnd() - 1, in files
+// archive-<first sequence number> in their directory. A segment is moved
+// into place before its entries are dropped from the wrapped database,
+// which is redone on opening in case that didn't happen.
+//
+// Like the databases it wraps, ArchivingDatabase is not thread-safe, but
+// lookups may run alongside AddSegment() if the wrapped database has
+// ConcurrentReads().
+template <class Logged> class ArchivingDatabase : public Database<Logged> {
+ public:
+  // Takes ownership of |db|. Segments are compressed with |compressor|,
+  // which must outlive the database, or with a compressor without a
+  // dictionary if it's NULL. Creates |dir| if need be.
+  ArchivingDatabase(Database<Logged> *db, const std::string &dir,
+                    const EntryCompressor *compressor);
+
+  ~ArchivingDatabase();
+
+  typedef typename Database<Logged>::WriteResult WriteResult;
+  typedef typename Database<Logged>::LookupResult LookupResult;
+
+  // One more than the last archived sequence number.
+  uint64_t ArchivedEnd() const;
+
+  // Archive the logged entries from ArchivedEnd() to |end| - 1 into a new
+  // segment. They must all be logged.
+  void Archive(uint64_t end);
+
+  // Archive() in two steps, so that the entries can be read and written
+  // out without holding up other users of the database: write the segment,
+  // reading the entries through |reader|, e.g. a LockingDatabase around
+  // this one, and then add it, which drops the entries from the wrapped
+  // database. Nothing else may archive in between.
+  ArchiveSegment *WriteSegment(uint64_t end,
+                               const Database<Logged> *reader) const;
+
+  // Takes ownership of |segment|.
+  void AddSegment(ArchiveSegment *segment);
+
+  virtual bool Transactional() const;
+
+  virtual bool ConcurrentReads() const;
+
+  // Adds the segments, which are mapped rather than read, as
+  // archive_segments.
+  virtual void ExportMemoryUsage(util::Metrics *metrics) const;
+
+  virtual void BeginTransaction();
+
+  virtual void EndTransaction();
+
+  // Archived entries count as existing ones.
+  virtual WriteResult CreatePendingEntry_(const Logged &logged);
+
+  virtual WriteResult AssignSequenceNumber(const std::string &pending_hash,
+                                           uint64_t sequence_number);
+
+  virtual WriteResult AssignSequenceNumbers(
+      const std::vector<std::string> &pending_hashes,
+      uint64_t first_sequence_number, size_t *assigned);
+
+  virtual LookupResult LookupByHash(const std::string &hash) const;
+
+  virtual LookupResult LookupByHash(const std::string &hash,
+                                    Logged *result) const;
+
+  virtual LookupResult LookupByIndex(uint64_t sequence_number,
+                                     Logged *result) const;
+
+  virtual LookupResult LookupByIndexRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual LookupResult LookupLeafHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual LookupResult LookupEntryHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual std::set<std::string> PendingHashes() const;
+
+  virtual void LookupPendingEntries(
+      size_t limit, typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual WriteResult WriteTreeHead_(const ct::SignedTreeHead &sth);
+
+  virtual LookupResult LatestTreeHead(ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadBySize(
+      uint64_t tree_size, ct::SignedTreeHead *result) const;
+
+  virtual void LookupTreeHeadRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::TreeHeadCallback *callback) const;
+
+ private:
+  class SegmentWriter;
+
+  // The segment holding |sequence_number|, or NULL if it isn't archived.
+  const ArchiveSegment *SegmentFor(uint64_t sequence_number) const;
+
+  // If the entry with |hash| is archived, set |*sequence_number| (unless
+  // NULL) and return its segment; else return NULL.
+  const ArchiveSegment *FindArchived(const std::string &hash,
+                                     uint64_t *sequence_number) const;
+
+  bool ReadArchived(const ArchiveSegment &segment, uint64_t sequence_number,
+                    Logged *result) const;
+
+  // Whether |hash| or |sequence_number| conflicts with an archived entry,
+  // as AssignSequenceNumber() reports it; OK if not.
+  WriteResult CheckAssignment(const std::string &hash,
+                              uint64_t sequence_number) const;
+
+  Database<Logged> *db_;
+  const std::string dir_;
+  EntryCompressor *owned_compressor_;
+  // In order of sequence number, with no gaps. Only ever added to, so a
+  // segment found under |mutex_| can be read without it.
+  std::vector<ArchiveSegment*> segments_;
+  // Guards |segments_|, for lookups running alongside AddSegment().
+  mutable pthread_mutex_t mutex_;
+  // The entry hashes of |hashes_segment_| in order, for
+  // LookupEntryHashRange() calls that read a segment in parts.
+  mutable const ArchiveSegment *hashes_segment_;
+  mutable std::vector<std::string> segment_hashes_;
+  // Guards the two above; taken before |mutex_|.
+  mutable pthread_mutex_t hashes_mutex_;
+};
+
+#endif
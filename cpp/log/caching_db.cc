@@ -0,0 +1,221 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/caching_db.h"
+
+#include <glog/logging.h>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "proto/ct.pb.h"
+#include "util/memory_usage.h"
+#include "util/metrics.h"
+
+using std::string;
+
+// Caches the entries of a range lookup on their way to the real callback.
+template <class Logged> class CachingDatabase<Logged>::CachingCallback
+    : public Database<Logged>::EntryCallback {
+ public:
+  CachingCallback(const CachingDatabase<Logged> *db,
+                  typename Database<Logged>::EntryCallback *callback)
+      : db_(db), callback_(callback) {}
+
+  virtual bool Entry(const Logged &logged) {
+    ++db_->stats_.index_misses;
+    db_->by_index_.Put(logged.sequence_number(), logged);
+    return callback_->Entry(logged);
+  }
+
+ private:
+  const CachingDatabase<Logged> *db_;
+  typename Database<Logged>::EntryCallback *callback_;
+};
+
+template <class Logged>
+CachingDatabase<Logged>::CachingDatabase(Database<Logged> *db,
+                                         size_t max_entries)
+    : db_(db),
+      by_hash_(max_entries),
+      by_index_(max_entries),
+      stats_() {
+  CHECK_NOTNULL(db);
+}
+
+template <class Logged> CachingDatabase<Logged>::~CachingDatabase() {
+  delete db_;
+}
+
+template <class Logged> bool CachingDatabase<Logged>::Transactional() const {
+  return db_->Transactional();
+}
+
+template <class Logged>
+void CachingDatabase<Logged>::ExportMemoryUsage(util::Metrics *metrics) const {
+  db_->ExportMemoryUsage(metrics);
+  util::ExportMemoryUsage("entries_by_hash_cache",
+                          by_hash_.MemoryUsage(LoggedBytes), metrics);
+  util::ExportMemoryUsage("entries_by_index_cache",
+                          by_index_.MemoryUsage(LoggedBytes), metrics);
+}
+
+template <class Logged> void CachingDatabase<Logged>::BeginTransaction() {
+  db_->BeginTransaction();
+}
+
+template <class Logged> void CachingDatabase<Logged>::EndTransaction() {
+  db_->EndTransaction();
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+CachingDatabase<Logged>::CreatePendingEntry_(const Logged &logged) {
+  // Nothing to invalidate: failed lookups are not cached.
+  return db_->CreatePendingEntry(logged);
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+CachingDatabase<Logged>::AssignSequenceNumber(const string &pending_hash,
+                                              uint64_t sequence_number) {
+  by_hash_.Erase(pending_hash);
+  return db_->AssignSequenceNumber(pending_hash, sequence_number);
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+CachingDatabase<Logged>::AssignSequenceNumbers(
+    const std::vector<string> &pending_hashes,
+    uint64_t first_sequence_number, size_t *assigned) {
+  for (size_t i = 0; i < pending_hashes.size(); ++i)
+    by_hash_.Erase(pending_hashes[i]);
+  return db_->AssignSequenceNumbers(pending_hashes, first_sequence_number,
+                                    assigned);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+CachingDatabase<Logged>::LookupByHash(const string &hash) const {
+  if (by_hash_.Get(hash, NULL)) {
+    ++stats_.hash_hits;
+    return this->LOOKUP_OK;
+  }
+  ++stats_.hash_misses;
+  return db_->LookupByHash(hash);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+CachingDatabase<Logged>::LookupByHash(const string &hash,
+                                      Logged *result) const {
+  CHECK_NOTNULL(result);
+  if (by_hash_.Get(hash, result)) {
+    ++stats_.hash_hits;
+    return this->LOOKUP_OK;
+  }
+  ++stats_.hash_misses;
+  LookupResult lookup = db_->LookupByHash(hash, result);
+  if (lookup == this->LOOKUP_OK)
+    by_hash_.Put(hash, *result);
+  return lookup;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+CachingDatabase<Logged>::LookupByIndex(uint64_t sequence_number,
+                                       Logged *result) const {
+  CHECK_NOTNULL(result);
+  if (by_index_.Get(sequence_number, result)) {
+    ++stats_.index_hits;
+    return this->LOOKUP_OK;
+  }
+  ++stats_.index_misses;
+  LookupResult lookup = db_->LookupByIndex(sequence_number, result);
+  if (lookup == this->LOOKUP_OK)
+    by_index_.Put(sequence_number, *result);
+  return lookup;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+CachingDatabase<Logged>::LookupByIndexRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::EntryCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  uint64_t next = start;
+  for (; next < end; ++next) {
+    Logged logged;
+    if (!by_index_.Get(next, &logged))
+      break;
+    ++stats_.index_hits;
+    if (!callback->Entry(logged))
+      return this->LOOKUP_OK;
+  }
+  if (next >= end)
+    return this->LOOKUP_OK;
+
+  CachingCallback caching(this, callback);
+  return db_->LookupByIndexRange(next, end, &caching);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+CachingDatabase<Logged>::LookupLeafHashRange(
+    uint64_t start, uint64_t end, std::vector<string> *hashes) const {
+  return db_->LookupLeafHashRange(start, end, hashes);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+CachingDatabase<Logged>::LookupEntryHashRange(
+    uint64_t start, uint64_t end, std::vector<string> *hashes) const {
+  return db_->LookupEntryHashRange(start, end, hashes);
+}
+
+template <class Logged> std::set<string>
+CachingDatabase<Logged>::PendingHashes() const {
+  return db_->PendingHashes();
+}
+
+template <class Logged> void CachingDatabase<Logged>::LookupPendingEntries(
+    size_t limit, typename Database<Logged>::EntryCallback *callback) const {
+  db_->LookupPendingEntries(limit, callback);
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+CachingDatabase<Logged>::WriteTreeHead_(const ct::SignedTreeHead &sth) {
+  return db_->WriteTreeHead(sth);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+CachingDatabase<Logged>::LatestTreeHead(ct::SignedTreeHead *result) const {
+  return db_->LatestTreeHead(result);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+CachingDatabase<Logged>::LookupTreeHeadByTimestamp(
+    uint64_t timestamp, ct::SignedTreeHead *result) const {
+  return db_->LookupTreeHeadByTimestamp(timestamp, result);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+CachingDatabase<Logged>::LookupTreeHeadBySize(
+    uint64_t tree_size, ct::SignedTreeHead *result) const {
+  return db_->LookupTreeHeadBySize(tree_size, result);
+}
+
+template <class Logged> void CachingDatabase<Logged>::LookupTreeHeadRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::TreeHeadCallback *callback) const {
+  db_->LookupTreeHeadRange(start, end, callback);
+}
+
+template <class Logged>
+void CachingDatabase<Logged>::GetStats(CacheStats *stats) const {
+  *stats = stats_;
+}
+
+template <class Logged>
+void CachingDatabase<Logged>::ExportStats(util::Metrics *metrics) const {
+  const char kLookups[] = "ct_cache_lookups_total";
+  metrics->DefineCounter(kLookups, "Cache lookups, by cache and result.");
+  metrics->Set(kLookups, "cache=\"entries_by_hash\",result=\"hit\"",
+               stats_.hash_hits);
+  metrics->Set(kLookups, "cache=\"entries_by_hash\",result=\"miss\"",
+               stats_.hash_misses);
+  metrics->Set(kLookups, "cache=\"entries_by_index\",result=\"hit\"",
+               stats_.index_hits);
+  metrics->Set(kLookups, "cache=\"entries_by_index\",result=\"miss\"",
+               stats_.index_misses);
+}
@@ -0,0 +1,128 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+
+#ifndef CACHING_DB_H
+#define CACHING_DB_H
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/database.h"
+#include "util/lru_cache.h"
+
+namespace util {
+class Metrics;
+}  // namespace util
+
+// Wraps another Database and keeps the entries it recently looked up by
+// hash and by sequence number in memory, so that repeated lookups of the
+// same (usually recent) entries neither hit the disk nor parse again.
+// Only successful lookups are cached. Logged entries never change, so the
+// only cached entries that can go stale are pending ones, which are dropped
+// when their sequence number is assigned.
+//
+// Like the databases it wraps, CachingDatabase is not thread-safe.
+template <class Logged> class CachingDatabase : public Database<Logged> {
+ public:
+  struct CacheStats {
+    CacheStats()
+        : hash_hits(0),
+          hash_misses(0),
+          index_hits(0),
+          index_misses(0) {}
+
+    uint64_t hash_hits;
+    uint64_t hash_misses;
+    // Entries of range lookups count one each.
+    uint64_t index_hits;
+    uint64_t index_misses;
+  };
+
+  // Takes ownership of |db|. Each of the two caches holds up to
+  // |max_entries| entries.
+  CachingDatabase(Database<Logged> *db, size_t max_entries);
+
+  ~CachingDatabase();
+
+  typedef typename Database<Logged>::WriteResult WriteResult;
+  typedef typename Database<Logged>::LookupResult LookupResult;
+
+  virtual bool Transactional() const;
+
+  // Adds the two caches, counting their entries with SpaceUsed(), which
+  // Logged must have, as protocol buffers do.
+  virtual void ExportMemoryUsage(util::Metrics *metrics) const;
+
+  virtual void BeginTransaction();
+
+  virtual void EndTransaction();
+
+  virtual WriteResult CreatePendingEntry_(const Logged &logged);
+
+  virtual WriteResult AssignSequenceNumber(const std::string &pending_hash,
+                                           uint64_t sequence_number);
+
+  virtual WriteResult AssignSequenceNumbers(
+      const std::vector<std::string> &pending_hashes,
+      uint64_t first_sequence_number, size_t *assigned);
+
+  virtual LookupResult LookupByHash(const std::string &hash) const;
+
+  virtual LookupResult LookupByHash(const std::string &hash,
+                                    Logged *result) const;
+
+  virtual LookupResult LookupByIndex(uint64_t sequence_number,
+                                     Logged *result) const;
+
+  // Serves the cached prefix of the range from memory and reads the rest
+  // from the wrapped database in one go, caching it.
+  virtual LookupResult LookupByIndexRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual LookupResult LookupLeafHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual LookupResult LookupEntryHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual std::set<std::string> PendingHashes() const;
+
+  virtual void LookupPendingEntries(
+      size_t limit, typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual WriteResult WriteTreeHead_(const ct::SignedTreeHead &sth);
+
+  virtual LookupResult LatestTreeHead(ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadBySize(
+      uint64_t tree_size, ct::SignedTreeHead *result) const;
+
+  virtual void LookupTreeHeadRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::TreeHeadCallback *callback) const;
+
+  void GetStats(CacheStats *stats) const;
+
+  // Set the counter ct_cache_lookups_total in |metrics| from the stats,
+  // by cache and result.
+  void ExportStats(util::Metrics *metrics) const;
+
+ private:
+  class CachingCallback;
+
+  static size_t LoggedBytes(const Logged &logged) {
+    return logged.SpaceUsed() - sizeof logged;
+  }
+
+  Database<Logged> *db_;
+  // Lookups are const, but fill the caches.
+  mutable util::LRUCache<std::string, Logged> by_hash_;
+  mutable util::LRUCache<uint64_t, Logged> by_index_;
+  mutable CacheStats stats_;
+};
+
+#endif
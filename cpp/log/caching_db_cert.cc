@@ -0,0 +1,6 @@
+#include "caching_db.cc"
+
+#include "log/logged_certificate.h"
+#include "proto/ct.pb.h"
+
+template class CachingDatabase<ct::LoggedCertificate>;
@@ -4,6 +4,7 @@
 #include <glog/logging.h>
 #include <openssl/asn1.h>
 #include <openssl/bio.h>
+#include <openssl/bn.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
@@ -15,6 +16,7 @@
 
 #include "log/ct_extensions.h"
 #include "merkletree/serial_hasher.h"
+#include "util/memory_usage.h"
 #include "util/openssl_util.h"  // For LOG_OPENSSL_ERRORS
 
 using std::string;
@@ -68,6 +70,13 @@ Cert *Cert::Clone() const {
       LOG_OPENSSL_ERRORS(ERROR);
   }
   Cert *clone = new Cert(x509);
+  if (x509 != NULL) {
+    clone->der_ = der_;
+    clone->sha256_digest_ = sha256_digest_;
+    clone->tbs_der_ = tbs_der_;
+    clone->public_key_sha256_digest_ = public_key_sha256_digest_;
+    clone->spki_sha256_digest_ = spki_sha256_digest_;
+  }
   return clone;
 }
 
@@ -76,6 +85,7 @@ Cert::Status Cert::LoadFromDerString(const std::string &der_string) {
     X509_free(x509_);
     x509_ = NULL;
   }
+  ClearEncodings();
   const unsigned char *start =
       reinterpret_cast<const unsigned char*>(der_string.data());
   x509_ = d2i_X509(NULL, &start, der_string.size());
@@ -246,6 +256,115 @@ Cert::Status Cert::HasBasicConstraintCATrue() const {
   return is_ca ? TRUE : FALSE;
 }
 
+Cert::Status Cert::SubjectKeyIdentifier(string *result) const {
+  if (!IsLoaded()) {
+    LOG(ERROR) << "Cert not loaded";
+    return ERROR;
+  }
+
+  void *ext_struct;
+  Status status = ExtensionStructure(NID_subject_key_identifier, &ext_struct);
+  if (status != TRUE)
+    return status;
+
+  ASN1_OCTET_STRING *key_id = static_cast<ASN1_OCTET_STRING*>(ext_struct);
+  result->assign(reinterpret_cast<const char*>(key_id->data), key_id->length);
+  ASN1_OCTET_STRING_free(key_id);
+  return TRUE;
+}
+
+Cert::Status Cert::AuthorityKeyIdentifier(string *result) const {
+  if (!IsLoaded()) {
+    LOG(ERROR) << "Cert not loaded";
+    return ERROR;
+  }
+
+  void *ext_struct;
+  Status status = ExtensionStructure(NID_authority_key_identifier,
+                                     &ext_struct);
+  if (status != TRUE)
+    return status;
+
+  AUTHORITY_KEYID *authority = static_cast<AUTHORITY_KEYID*>(ext_struct);
+  status = FALSE;
+  if (authority->keyid != NULL) {
+    result->assign(reinterpret_cast<const char*>(authority->keyid->data),
+                   authority->keyid->length);
+    status = TRUE;
+  }
+  AUTHORITY_KEYID_free(authority);
+  return status;
+}
+
+Cert::Status Cert::SubjectAltDnsNames(std::vector<string> *dns_names) const {
+  if (!IsLoaded()) {
+    LOG(ERROR) << "Cert not loaded";
+    return ERROR;
+  }
+
+  void *ext_struct;
+  Status status = ExtensionStructure(NID_subject_alt_name, &ext_struct);
+  if (status != TRUE)
+    return status;
+
+  GENERAL_NAMES *names = static_cast<GENERAL_NAMES*>(ext_struct);
+  for (int i = 0; i < sk_GENERAL_NAME_num(names); ++i) {
+    const GENERAL_NAME *name = sk_GENERAL_NAME_value(names, i);
+    if (name->type == GEN_DNS)
+      dns_names->push_back(string(
+          reinterpret_cast<const char*>(ASN1_STRING_data(name->d.dNSName)),
+          ASN1_STRING_length(name->d.dNSName)));
+  }
+  GENERAL_NAMES_free(names);
+  return TRUE;
+}
+
+Cert::Status Cert::SubjectCommonNames(std::vector<string> *names) const {
+  if (!IsLoaded()) {
+    LOG(ERROR) << "Cert not loaded";
+    return ERROR;
+  }
+
+  X509_NAME *subject = X509_get_subject_name(x509_);
+  if (subject == NULL) {
+    LOG(ERROR) << "Missing subject name";
+    LOG_OPENSSL_ERRORS(ERROR);
+    return ERROR;
+  }
+  Status status = FALSE;
+  for (int i = X509_NAME_get_index_by_NID(subject, NID_commonName, -1);
+       i >= 0; i = X509_NAME_get_index_by_NID(subject, NID_commonName, i)) {
+    ASN1_STRING *data =
+        X509_NAME_ENTRY_get_data(X509_NAME_get_entry(subject, i));
+    if (data == NULL)
+      return ERROR;
+    names->push_back(string(
+        reinterpret_cast<const char*>(ASN1_STRING_data(data)),
+        ASN1_STRING_length(data)));
+    status = TRUE;
+  }
+  return status;
+}
+
+Cert::Status Cert::SerialNumber(string *result) const {
+  if (!IsLoaded()) {
+    LOG(ERROR) << "Cert not loaded";
+    return ERROR;
+  }
+
+  BIGNUM *serial = ASN1_INTEGER_to_BN(X509_get_serialNumber(x509_), NULL);
+  if (serial == NULL) {
+    LOG(WARNING) << "Failed to read the serial number";
+    LOG_OPENSSL_ERRORS(WARNING);
+    return ERROR;
+  }
+  result->resize(BN_num_bytes(serial));
+  if (!result->empty())
+    BN_bn2bin(serial, reinterpret_cast<unsigned char*>(&(*result)[0]));
+  BN_free(serial);
+  return TRUE;
+}
+
 Cert::Status Cert::HasExtendedKeyUsage(int key_usage_nid) const {
   if (!IsLoaded()) {
     LOG(ERROR) << "Cert not loaded";
@@ -335,19 +454,22 @@ Cert::Status Cert::DerEncoding(string *result) const {
     return ERROR;
   }
 
-  unsigned char *der_buf = NULL;
-  int der_length = i2d_X509(x509_, &der_buf);
+  if (der_.empty()) {
+    unsigned char *der_buf = NULL;
+    int der_length = i2d_X509(x509_, &der_buf);
 
-  if (der_length < 0) {
-    // What does this return value mean? Let's assume it means the cert
-    // is bad until proven otherwise.
-    LOG(WARNING) << "Failed to serialize cert";
-    LOG_OPENSSL_ERRORS(WARNING);
-    return FALSE;
-  }
+    if (der_length < 0) {
+      // What does this return value mean? Let's assume it means the cert
+      // is bad until proven otherwise.
+      LOG(WARNING) << "Failed to serialize cert";
+      LOG_OPENSSL_ERRORS(WARNING);
+      return FALSE;
+    }
 
-  result->assign(string(reinterpret_cast<char*>(der_buf), der_length));
-  OPENSSL_free(der_buf);
+    der_.assign(reinterpret_cast<char*>(der_buf), der_length);
+    OPENSSL_free(der_buf);
+  }
+  result->assign(der_);
   return TRUE;
 }
 
@@ -357,17 +479,17 @@ Cert::Status Cert::Sha256Digest(string *result) const {
     return ERROR;
   }
 
-  unsigned char digest[EVP_MAX_MD_SIZE];
-  unsigned int len;
-  if (X509_digest(x509_, EVP_sha256(), digest, &len) != 1) {
-    // What does this return value mean? Let's assume it means the cert
-    // is bad until proven otherwise.
-    LOG(WARNING) << "Failed to compute cert digest";
-    LOG_OPENSSL_ERRORS(WARNING);
-    return FALSE;
+  if (sha256_digest_.empty()) {
+    // The digest of the DER encoding, which we may have already.
+    string der;
+    Status status = DerEncoding(&der);
+    if (status != TRUE) {
+      LOG(WARNING) << "Failed to compute cert digest";
+      return status;
+    }
+    sha256_digest_ = Sha256Hasher::Sha256Digest(der);
   }
-
-  result->assign(string(reinterpret_cast<char*>(digest), len));
+  result->assign(sha256_digest_);
   return TRUE;
 }
 
@@ -377,18 +499,21 @@ Cert::Status Cert::DerEncodedTbsCertificate(string *result) const {
     return ERROR;
   }
 
-  unsigned char *der_buf = NULL;
-  // There appears to be no "clean" way for getting the TBS out.
-  int der_length = i2d_X509_CINF(X509_get_cert_info(x509_), &der_buf);
-  if (der_length < 0) {
-    // What does this return value mean? Let's assume it means the cert
-    // is bad until proven otherwise.
-    LOG(WARNING) << "Failed to serialize the TBS component";
-    LOG_OPENSSL_ERRORS(WARNING);
-    return FALSE;
+  if (tbs_der_.empty()) {
+    unsigned char *der_buf = NULL;
+    // There appears to be no "clean" way for getting the TBS out.
+    int der_length = i2d_X509_CINF(X509_get_cert_info(x509_), &der_buf);
+    if (der_length < 0) {
+      // What does this return value mean? Let's assume it means the cert
+      // is bad until proven otherwise.
+      LOG(WARNING) << "Failed to serialize the TBS component";
+      LOG_OPENSSL_ERRORS(WARNING);
+      return FALSE;
+    }
+    tbs_der_.assign(reinterpret_cast<char*>(der_buf), der_length);
+    OPENSSL_free(der_buf);
   }
-  result->assign(string(reinterpret_cast<char*>(der_buf), der_length));
-  OPENSSL_free(der_buf);
+  result->assign(tbs_der_);
   return TRUE;
 }
 
@@ -430,16 +555,19 @@ Cert::Status Cert::PublicKeySha256Digest(string *result) const {
     return ERROR;
   }
 
-  unsigned char digest[EVP_MAX_MD_SIZE];
-  unsigned int len;
-  if (X509_pubkey_digest(x509_, EVP_sha256(), digest, &len) != 1) {
-    // What does this return value mean? Let's assume it means the cert
-    // is bad until proven otherwise.
-    LOG(WARNING) << "Failed to compute public key digest";
-    LOG_OPENSSL_ERRORS(WARNING);
-    return FALSE;
+  if (public_key_sha256_digest_.empty()) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len;
+    if (X509_pubkey_digest(x509_, EVP_sha256(), digest, &len) != 1) {
+      // What does this return value mean? Let's assume it means the cert
+      // is bad until proven otherwise.
+      LOG(WARNING) << "Failed to compute public key digest";
+      LOG_OPENSSL_ERRORS(WARNING);
+      return FALSE;
+    }
+    public_key_sha256_digest_.assign(reinterpret_cast<char*>(digest), len);
   }
-  result->assign(string(reinterpret_cast<char*>(digest), len));
+  result->assign(public_key_sha256_digest_);
   return TRUE;
 }
 
@@ -449,22 +577,53 @@ Cert::Status Cert::SPKISha256Digest(string *result) const {
     return ERROR;
   }
 
-  unsigned char *der_buf = NULL;
-  int der_length = i2d_X509_PUBKEY(X509_get_X509_PUBKEY(x509_), &der_buf);
-  if (der_length < 0) {
-    // What does this return value mean? Let's assume it means the cert
-    // is bad until proven otherwise.
-    LOG(WARNING) << "Failed to serialize the Subject Public Key Info";
-    LOG_OPENSSL_ERRORS(WARNING);
-    return FALSE;
+  if (spki_sha256_digest_.empty()) {
+    unsigned char *der_buf = NULL;
+    int der_length = i2d_X509_PUBKEY(X509_get_X509_PUBKEY(x509_), &der_buf);
+    if (der_length < 0) {
+      // What does this return value mean? Let's assume it means the cert
+      // is bad until proven otherwise.
+      LOG(WARNING) << "Failed to serialize the Subject Public Key Info";
+      LOG_OPENSSL_ERRORS(WARNING);
+      return FALSE;
+    }
+
+    spki_sha256_digest_ = Sha256Hasher::Sha256Digest(
+        string(reinterpret_cast<char*>(der_buf), der_length));
+    OPENSSL_free(der_buf);
   }
+  result->assign(spki_sha256_digest_);
+  return TRUE;
+}
 
-  string sha256_digest = Sha256Hasher::Sha256Digest(
-      string(reinterpret_cast<char*>(der_buf), der_length));
+size_t Cert::HeapBytes() const {
+  size_t bytes = util::HeapBytes(der_) + util::HeapBytes(sha256_digest_) +
+      util::HeapBytes(tbs_der_) +
+      util::HeapBytes(public_key_sha256_digest_) +
+      util::HeapBytes(spki_sha256_digest_);
+  if (x509_ != NULL) {
+    const int length = i2d_X509(x509_, NULL);
+    if (length > 0)
+      bytes += length;
+  }
+  return bytes;
+}
 
-  result->assign(sha256_digest);
-  OPENSSL_free(der_buf);
-  return TRUE;
+void Cert::ComputeEncodings() const {
+  string ignored;
+  DerEncoding(&ignored);
+  Sha256Digest(&ignored);
+  DerEncodedTbsCertificate(&ignored);
+  PublicKeySha256Digest(&ignored);
+  SPKISha256Digest(&ignored);
+}
+
+void Cert::ClearEncodings() {
+  der_.clear();
+  sha256_digest_.clear();
+  tbs_der_.clear();
+  public_key_sha256_digest_.clear();
+  spki_sha256_digest_.clear();
 }
 
 Cert::Status Cert::OctetStringExtensionData(int extension_nid,
@@ -842,6 +1001,10 @@ Cert::Status CertChain::IsValidCaIssuerChainMaybeLegacyRoot() const {
 }
 
 Cert::Status CertChain::IsValidSignatureChain() const {
+  return IsValidSignatureChain(NULL);
+}
+
+Cert::Status CertChain::IsValidSignatureChain(SignatureCache *cache) const {
   if (!IsLoaded()) {
     LOG(ERROR) << "Chain is not loaded";
     return Cert::ERROR;
@@ -852,7 +1015,8 @@ Cert::Status CertChain::IsValidSignatureChain() const {
        it + 1 < chain_.end(); ++it) {
     Cert *subject = *it;
     Cert *issuer = *(it + 1);
-    status = subject->IsSignedBy(*issuer);
+    status = cache != NULL ? cache->IsSignedBy(*subject, *issuer)
+        : subject->IsSignedBy(*issuer);
     if (status != Cert::TRUE)
       return status;
   }
@@ -866,6 +1030,233 @@ void CertChain::ClearChain() {
   chain_.clear();
 }
 
+namespace {
+
+// The position of a DER element in its encoding.
+struct DerElement {
+  unsigned char tag;
+  size_t begin;
+  // Of the contents.
+  size_t contents;
+  size_t end;
+};
+
+// Reads the element at |pos| of |der|, which must end by |end|. Only
+// accepts DER: single-byte tags and minimal, definite lengths.
+bool ReadDerElement(const string &der, size_t pos, size_t end,
+                    DerElement *element) {
+  if (end > der.size() || pos + 2 > end)
+    return false;
+  const unsigned char tag = der[pos];
+  if ((tag & 0x1f) == 0x1f)
+    return false;
+  size_t length = static_cast<unsigned char>(der[pos + 1]);
+  size_t contents = pos + 2;
+  if (length > 0x80 && length <= 0x84) {
+    const size_t bytes = length & 0x7f;
+    if (contents + bytes > end || der[contents] == 0)
+      return false;
+    length = 0;
+    for (size_t i = 0; i < bytes; ++i)
+      length = (length << 8) | static_cast<unsigned char>(der[contents + i]);
+    contents += bytes;
+    if (length < 0x80)
+      return false;
+  } else if (length >= 0x80) {
+    return false;
+  }
+  if (length > end - contents)
+    return false;
+  element->tag = tag;
+  element->begin = pos;
+  element->contents = contents;
+  element->end = contents + length;
+  return true;
+}
+
+// Reads all the elements inside |parent|, which must fill it exactly.
+bool ReadDerChildren(const string &der, const DerElement &parent,
+                     std::vector<DerElement> *children) {
+  children->clear();
+  for (size_t pos = parent.contents; pos < parent.end;) {
+    DerElement child;
+    if (!ReadDerElement(der, pos, parent.end, &child))
+      return false;
+    children->push_back(child);
+    pos = child.end;
+  }
+  return true;
+}
+
+string DerString(const string &der, const DerElement &element) {
+  return der.substr(element.begin, element.end - element.begin);
+}
+
+string DerContents(const string &der, const DerElement &element) {
+  return der.substr(element.contents, element.end - element.contents);
+}
+
+string EncodeDer(unsigned char tag, const string &contents) {
+  string der(1, static_cast<char>(tag));
+  const size_t length = contents.size();
+  if (length < 0x80) {
+    der.push_back(static_cast<char>(length));
+  } else {
+    string bytes;
+    for (size_t l = length; l > 0; l >>= 8)
+      bytes.insert(bytes.begin(), static_cast<char>(l & 0xff));
+    der.push_back(static_cast<char>(0x80 | bytes.size()));
+    der.append(bytes);
+  }
+  return der + contents;
+}
+
+const unsigned char kDerSequence = 0x30;
+const unsigned char kDerBoolean = 0x01;
+const unsigned char kDerOctetString = 0x04;
+const unsigned char kDerObject = 0x06;
+// [0] and [3], constructed.
+const unsigned char kDerVersion = 0xa0;
+const unsigned char kDerExtensions = 0xa3;
+
+// The parts of a DER-encoded certificate that rewriting its TBS needs.
+struct DerTbs {
+  // The fields of the TBS.
+  std::vector<DerElement> fields;
+  size_t issuer;
+  // The extensions, the last field.
+  std::vector<DerElement> extensions;
+};
+
+bool ReadDerTbs(const string &der, DerTbs *tbs) {
+  DerElement cert, tbs_element;
+  std::vector<DerElement> sequence;
+  if (!ReadDerElement(der, 0, der.size(), &cert) || cert.end != der.size() ||
+      cert.tag != kDerSequence ||
+      !ReadDerElement(der, cert.contents, cert.end, &tbs_element) ||
+      tbs_element.tag != kDerSequence ||
+      !ReadDerChildren(der, tbs_element, &tbs->fields))
+    return false;
+  // [version,] serialNumber, signature, issuer, ..., extensions.
+  tbs->issuer = !tbs->fields.empty() &&
+      tbs->fields[0].tag == kDerVersion ? 3 : 2;
+  if (tbs->fields.size() < tbs->issuer + 5 ||
+      tbs->fields[tbs->issuer].tag != kDerSequence ||
+      tbs->fields.back().tag != kDerExtensions ||
+      !ReadDerChildren(der, tbs->fields.back(), &sequence) ||
+      sequence.size() != 1 || sequence[0].tag != kDerSequence ||
+      !ReadDerChildren(der, sequence[0], &tbs->extensions))
+    return false;
+  for (size_t i = 0; i < tbs->extensions.size(); ++i)
+    if (tbs->extensions[i].tag != kDerSequence)
+      return false;
+  return true;
+}
+
+// The DER encoding of the OID of |nid|.
+string DerObject(int nid) {
+  ASN1_OBJECT *object = OBJ_nid2obj(nid);
+  if (object == NULL)
+    return string();
+  unsigned char *der_buf = NULL;
+  int der_length = i2d_ASN1_OBJECT(object, &der_buf);
+  if (der_length < 0)
+    return string();
+  string der(reinterpret_cast<char*>(der_buf), der_length);
+  OPENSSL_free(der_buf);
+  return der;
+}
+
+// Splits |extension| of |der| into its OID, critical flag (or empty) and
+// value: the contents of its OCTET STRING.
+bool ReadDerExtension(const string &der, const DerElement &extension,
+                      string *object, string *critical, string *value) {
+  std::vector<DerElement> parts;
+  if (!ReadDerChildren(der, extension, &parts) || parts.size() < 2 ||
+      parts.size() > 3 || parts[0].tag != kDerObject ||
+      parts.back().tag != kDerOctetString)
+    return false;
+  critical->clear();
+  if (parts.size() == 3) {
+    // DER leaves out a false flag.
+    *critical = DerString(der, parts[1]);
+    if (parts[1].tag != kDerBoolean ||
+        *critical != string("\x01\x01\xff", 3))
+      return false;
+  }
+  *object = DerString(der, parts[0]);
+  *value = DerContents(der, parts.back());
+  return true;
+}
+
+// PreCertChain::PrecertTbsCertificate() straight from the DER encodings of
+// the precert and its |issuer| (if the issuer is a Precertificate Signing
+// Certificate), without decoding them into OpenSSL structures. Gives up
+// on anything out of the ordinary, leaving it to TbsCertificate.
+bool RewriteDerTbs(const Cert &pre, const Cert *issuer, string *result) {
+  const string poison = DerObject(ct::NID_ctPoison);
+  const string authority_key_id = DerObject(NID_authority_key_identifier);
+  string der, issuer_der;
+  DerTbs tbs, issuer_tbs;
+  if (poison.empty() || authority_key_id.empty() ||
+      pre.DerEncoding(&der) != Cert::TRUE || !ReadDerTbs(der, &tbs))
+    return false;
+
+  // The issuer name and Authority KeyID of the final cert.
+  string issuer_name, issuer_key_id;
+  bool have_issuer_key_id = false;
+  if (issuer != NULL) {
+    if (issuer->DerEncoding(&issuer_der) != Cert::TRUE ||
+        !ReadDerTbs(issuer_der, &issuer_tbs))
+      return false;
+    issuer_name = DerString(issuer_der, issuer_tbs.fields[issuer_tbs.issuer]);
+    for (size_t i = 0; i < issuer_tbs.extensions.size(); ++i) {
+      string object, critical, value;
+      if (!ReadDerExtension(issuer_der, issuer_tbs.extensions[i], &object,
+                            &critical, &value))
+        return false;
+      if (object == authority_key_id) {
+        if (have_issuer_key_id)
+          return false;
+        issuer_key_id = value;
+        have_issuer_key_id = true;
+      }
+    }
+  }
+
+  string extensions;
+  size_t poisons = 0;
+  for (size_t i = 0; i < tbs.extensions.size(); ++i) {
+    string object, critical, value;
+    if (!ReadDerExtension(der, tbs.extensions[i], &object, &critical,
+                          &value))
+      return false;
+    if (object == poison) {
+      ++poisons;
+    } else if (object == authority_key_id && issuer != NULL) {
+      if (!have_issuer_key_id)
+        return false;
+      extensions += EncodeDer(kDerSequence, object + critical +
+                              EncodeDer(kDerOctetString, issuer_key_id));
+    } else {
+      extensions += DerString(der, tbs.extensions[i]);
+    }
+  }
+  // OpenSSL might encode no extensions differently.
+  if (poisons != 1 || extensions.empty())
+    return false;
+
+  string fields;
+  for (size_t i = 0; i + 1 < tbs.fields.size(); ++i)
+    fields += issuer != NULL && i == tbs.issuer ? issuer_name
+        : DerString(der, tbs.fields[i]);
+  fields += EncodeDer(kDerExtensions, EncodeDer(kDerSequence, extensions));
+  result->assign(EncodeDer(kDerSequence, fields));
+  return true;
+}
+
+}  // namespace
+
 Cert::Status PreCertChain::UsesPrecertSigningCertificate() const {
   const Cert *issuer = PrecertIssuingCert();
   if (issuer == NULL) {
@@ -911,4 +1302,178 @@ Cert::Status PreCertChain::IsWellFormed() const {
   return issuer->HasExtension(NID_authority_key_identifier);
 }
 
+Cert::Status PreCertChain::PrecertTbsCertificate(string *result) const {
+  if (!IsLoaded()) {
+    LOG(ERROR) << "Chain is not loaded";
+    return Cert::ERROR;
+  }
+
+  Cert::Status status = UsesPrecertSigningCertificate();
+  if (status != Cert::TRUE && status != Cert::FALSE)
+    return status;
+  const Cert *issuer = status == Cert::TRUE ? PrecertIssuingCert() : NULL;
+
+  if (RewriteDerTbs(*PreCert(), issuer, result))
+    return Cert::TRUE;
+  return ReencodedPrecertTbsCertificate(issuer, result);
+}
+
+Cert::Status PreCertChain::ReencodedPrecertTbsCertificate(
+    const Cert *issuer, string *result) const {
+  TbsCertificate tbs(*PreCert());
+  if (!tbs.IsLoaded())
+    return Cert::ERROR;
+  Cert::Status status = tbs.DeleteExtension(ct::NID_ctPoison);
+  if (status != Cert::TRUE)
+    return status;
+
+  // If the issuing cert is the special Precert Signing Certificate,
+  // replace the issuer with the one that will sign the final cert.
+  if (issuer != NULL) {
+    status = tbs.CopyIssuerFrom(*issuer);
+    if (status != Cert::TRUE)
+      return status;
+  }
+  return tbs.DerEncoding(result);
+}
+
+SignatureCache::SignatureCache(size_t capacity) : verified_(capacity) {
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+}
+
+SignatureCache::~SignatureCache() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+Cert::Status SignatureCache::IsSignedBy(const Cert &subject,
+                                        const Cert &issuer) {
+  string subject_hash, issuer_hash;
+  if (subject.Sha256Digest(&subject_hash) != Cert::TRUE ||
+      issuer.SPKISha256Digest(&issuer_hash) != Cert::TRUE)
+    return subject.IsSignedBy(issuer);
+
+  const string link = subject_hash + issuer_hash;
+  CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+  bool cached = verified_.Get(link, NULL);
+  CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+  if (cached)
+    return Cert::TRUE;
+
+  // Verify without holding the lock.
+  Cert::Status status = subject.IsSignedBy(issuer);
+  if (status == Cert::TRUE) {
+    CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+    verified_.Put(link, true);
+    CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+  }
+  return status;
+}
+
+size_t SignatureCache::size() {
+  CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+  size_t size = verified_.size();
+  CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+  return size;
+}
+
+util::MemoryUsage SignatureCache::MemoryUsage() {
+  CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+  const util::MemoryUsage usage =
+      verified_.MemoryUsage(util::NoHeapBytes<bool>);
+  CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+  return usage;
+}
+
+ParsedCertCache::X509Ref::X509Ref(const X509Ref &other)
+    : x509_(other.Get()) {}
+
+ParsedCertCache::X509Ref::~X509Ref() {
+  if (x509_ != NULL)
+    X509_free(x509_);
+}
+
+ParsedCertCache::X509Ref &ParsedCertCache::X509Ref::operator=(
+    const X509Ref &other) {
+  X509 *x509 = other.Get();
+  if (x509_ != NULL)
+    X509_free(x509_);
+  x509_ = x509;
+  return *this;
+}
+
+X509 *ParsedCertCache::X509Ref::Get() const {
+  if (x509_ == NULL)
+    return NULL;
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+  CRYPTO_add(&x509_->references, 1, CRYPTO_LOCK_X509);
+#else
+  X509_up_ref(x509_);
+#endif
+  return x509_;
+}
+
+size_t ParsedCertCache::X509Ref::DerLength() const {
+  if (x509_ == NULL)
+    return 0;
+  const int length = i2d_X509(x509_, NULL);
+  return length > 0 ? length : 0;
+}
+
+ParsedCertCache::ParsedCertCache(size_t capacity) : parsed_(capacity) {
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+}
+
+ParsedCertCache::~ParsedCertCache() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+Cert *ParsedCertCache::Parse(const string &der) {
+  const string digest(Sha256Hasher::Sha256Digest(der));
+  X509Ref cached;
+  CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+  const bool hit = parsed_.Get(digest, &cached);
+  CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+
+  X509 *x509 = cached.Get();
+  if (!hit) {
+    // Parse without holding the lock.
+    const unsigned char *in = reinterpret_cast<const unsigned char*>(
+        der.data());
+    x509 = d2i_X509(NULL, &in, der.size());
+    if (x509 == NULL) {
+      LOG_OPENSSL_ERRORS(INFO);
+      return NULL;
+    }
+    // With trailing bytes, |der| is not the cert's encoding, and not worth
+    // remembering.
+    if (in != reinterpret_cast<const unsigned char*>(der.data()) +
+        der.size())
+      return new Cert(x509);
+    const X509Ref parsed(x509);
+    x509 = parsed.Get();
+    CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+    parsed_.Put(digest, parsed);
+    CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+  }
+
+  Cert *cert = new Cert(x509);
+  cert->der_ = der;
+  cert->sha256_digest_ = digest;
+  return cert;
+}
+
+size_t ParsedCertCache::size() {
+  CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+  size_t size = parsed_.size();
+  CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+  return size;
+}
+
+util::MemoryUsage ParsedCertCache::MemoryUsage() {
+  CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+  const util::MemoryUsage usage = parsed_.MemoryUsage(RefBytes);
+  CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+  return usage;
+}
+
 }  // namespace ct
@@ -4,11 +4,16 @@
 #include <gtest/gtest_prod.h>
 #include <openssl/asn1.h>
 #include <openssl/x509.h>
+#include <pthread.h>
 #include <string>
 #include <vector>
 
+#include "util/lru_cache.h"
+
 namespace ct {
 
+class SignatureCache;
+
 class Cert {
  public:
   // Takes ownership of the X509 structure. It's advisable to check
@@ -93,6 +98,42 @@ class Cert {
   // with OBJ_create. (See log/ct_extensions.h for sample code.)
   Status HasExtendedKeyUsage(int key_usage_nid) const;
 
+  // Sets the subjectKeyIdentifier extension value in |result|.
+  // Returns TRUE if the extension is present.
+  // Returns FALSE if the extension is not present or could not be decoded.
+  // Returns ERROR if the cert is not loaded or some other unknown error
+  // occurred while parsing the extensions.
+  Status SubjectKeyIdentifier(std::string *result) const;
+
+  // Sets the keyIdentifier of the authorityKeyIdentifier extension in
+  // |result|.
+  // Returns TRUE if the extension is present and has a keyIdentifier.
+  // Returns FALSE if the extension or its keyIdentifier is not present, or
+  // the extension could not be decoded.
+  // Returns ERROR if the cert is not loaded or some other unknown error
+  // occurred while parsing the extensions.
+  Status AuthorityKeyIdentifier(std::string *result) const;
+
+  // Appends the dNSName entries of the subjectAltName extension to
+  // |dns_names|.
+  // Returns TRUE if the extension is present.
+  // Returns FALSE if the extension is not present or could not be decoded.
+  // Returns ERROR if the cert is not loaded or some other unknown error
+  // occurred while parsing the extensions.
+  Status SubjectAltDnsNames(std::vector<std::string> *dns_names) const;
+
+  // Appends the commonName entries of the subject name to |names|.
+  // Returns TRUE if there is at least one.
+  // Returns FALSE if there is none.
+  // Returns ERROR if the cert is not loaded or an entry could not be read.
+  Status SubjectCommonNames(std::vector<std::string> *names) const;
+
+  // Sets the serial number in |result|, as unsigned big-endian bytes.
+  // Returns TRUE if the serial number could be read.
+  // Returns ERROR if the cert is not loaded or the serial number could not
+  // be read.
+  Status SerialNumber(std::string *result) const;
+
   // Returns TRUE if the Cert's issuer matches |issuer|.
   // Returns FALSE if there is no match.
   // Returns ERROR if either cert is not loaded.
@@ -107,6 +148,8 @@ class Cert {
 
   Status IsSelfSigned() const { return IsIssuedBy(*this); }
 
+  // The encodings and digests below are computed once per Cert.
+
   // Sets the DER encoding of the cert in |result|.
   // Returns TRUE if the encoding succeeded.
   // Returns FALSE if the encoding failed.
@@ -149,6 +192,11 @@ class Cert {
   // Returns ERROR if the cert is not loaded.
   Status SPKISha256Digest(std::string *result) const;
 
+  // Memory accounting: the heap bytes of the cached encodings and digests,
+  // and of OpenSSL's parse of the cert, counted as the length of its DER
+  // encoding, which it takes at least.
+  size_t HeapBytes() const;
+
   // Fetch data from an extension if encoded as an ASN1_OCTET_STRING.
   // Useful for handling custom extensions registered with X509V3_EXT_add.
   // Returns true if the extension is present and the data could be decoded.
@@ -170,6 +218,7 @@ class Cert {
 
   // CertChecker needs access to the x509_ structure directly.
   friend class CertChecker;
+  friend class ParsedCertCache;
   friend class TbsCertificate;
   // Allow CtExtensions tests to poke around the private members
   // for convenience.
@@ -184,7 +233,21 @@ class Cert {
   static std::string PrintName(X509_NAME* name);
   static std::string PrintTime(ASN1_TIME* when);
   static Status DerEncodedName(X509_NAME *name, std::string *result);
+
+  // Compute all of the cached encodings below, so that from now on the
+  // cert is only read from, even by const methods. A Cert is not
+  // thread-safe otherwise.
+  void ComputeEncodings() const;
+  void ClearEncodings();
+
   X509 *x509_;
+  // The DER encoding and digests of |x509_|, computed when first asked for
+  // (and empty until then). The cert doesn't change once it is loaded.
+  mutable std::string der_;
+  mutable std::string sha256_digest_;
+  mutable std::string tbs_der_;
+  mutable std::string public_key_sha256_digest_;
+  mutable std::string spki_sha256_digest_;
 };
 
 // A wrapper around X509_CINF for chopping at the TBS to CT-sign it or verify
@@ -293,6 +356,8 @@ class CertChain {
   // Returns ERROR if the chain is not loaded or some error occurred.
   // Does not check whether issuers have CA capabilities.
   Cert::Status IsValidSignatureChain() const;
+  // As above, but skips the links that |cache| has seen verified before.
+  Cert::Status IsValidSignatureChain(SignatureCache *cache) const;
 
  private:
   void ClearChain();
@@ -342,6 +407,95 @@ class PreCertChain : public CertChain {
   // This method does not verify any signatures, or otherwise check
   // that the chain is valid.
   Cert::Status IsWellFormed() const;
+
+  // Sets the DER-encoded TBS of the final certificate in |result|, as the
+  // log signs it: the TBS of the precert without its poison extension and,
+  // if a Precertificate Signing Certificate issued it, with the issuer and
+  // Authority KeyID of that certificate instead.
+  // Returns TRUE if the TBS could be built.
+  // Returns FALSE if it could not, e.g. because the chain is not
+  // well-formed or the poison extension occurs more than once.
+  // Returns ERROR if the chain is not loaded or some other error occurred.
+  Cert::Status PrecertTbsCertificate(std::string *result) const;
+
+ private:
+  // PrecertTbsCertificate() through TbsCertificate, which handles any
+  // encoding OpenSSL will parse but is much slower.
+  Cert::Status ReencodedPrecertTbsCertificate(const Cert *issuer,
+                                              std::string *result) const;
+};
+
+// Remembers which certificates have been verified as signed by which
+// keys, so that the links that almost every chain shares (intermediate to
+// root) are only verified once. A link is keyed by the SHA-256 hash of the
+// whole subject certificate, signature included, and of the issuer's
+// subjectPublicKeyInfo. Holds at most |capacity| links, dropping the least
+// recently used. Thread-safe.
+class SignatureCache {
+ public:
+  explicit SignatureCache(size_t capacity);
+  ~SignatureCache();
+
+  // Like subject.IsSignedBy(issuer). Only verified links are cached.
+  Cert::Status IsSignedBy(const Cert &subject, const Cert &issuer);
+
+  size_t size();
+
+  util::MemoryUsage MemoryUsage();
+
+ private:
+  pthread_mutex_t mutex_;
+  util::LRUCache<std::string, bool> verified_;
+};
+
+// Parsed certificates, keyed by the SHA-256 hash of their DER encoding, so
+// that the intermediates that most submissions share, and the leaves of
+// resubmitted chains, are parsed once rather than on every submission. The
+// certs it makes share the parsed X509 structure with the cache, by
+// OpenSSL's reference count, which is safe as a loaded Cert never changes
+// it; a cert outlives its eviction from the cache. Holds at most
+// |capacity| certificates, dropping the least recently used. Thread-safe.
+class ParsedCertCache {
+ public:
+  explicit ParsedCertCache(size_t capacity);
+  ~ParsedCertCache();
+
+  // A new Cert of |der|, which the caller owns, or NULL if it doesn't
+  // parse. Its DER encoding and digest come with it, rather than being
+  // computed again.
+  Cert *Parse(const std::string &der);
+
+  size_t size();
+
+  // Counts the parsed structures as Cert::HeapBytes() does.
+  util::MemoryUsage MemoryUsage();
+
+ private:
+  // A reference to an X509 structure, which copies share.
+  class X509Ref {
+   public:
+    X509Ref() : x509_(NULL) {}
+    // Takes ownership of one reference to |x509|.
+    explicit X509Ref(X509 *x509) : x509_(x509) {}
+    X509Ref(const X509Ref &other);
+    ~X509Ref();
+    X509Ref &operator=(const X509Ref &other);
+
+    // A new reference, which the caller owns.
+    X509 *Get() const;
+
+    // The length of the DER encoding of the structure, or 0 if there is
+    // none.
+    size_t DerLength() const;
+
+   private:
+    X509 *x509_;
+  };
+
+  static size_t RefBytes(const X509Ref &ref) { return ref.DerLength(); }
+
+  pthread_mutex_t mutex_;
+  util::LRUCache<std::string, X509Ref> parsed_;
 };
 
 }  // namespace ct
@@ -0,0 +1,269 @@
+// Benchmark for certificate parsing and checking, and log signatures.
+//
+// Parses the certificates in --test_certs_dir, checks their chains with
+// the CertChecker, with and without its signature cache, and signs and
+// verifies SCTs and tree heads with the test log key. Prints one JSON
+// object per line with the operations per second and the heap allocations
+// per operation of each, counting OpenSSL's allocations as well as those
+// of operator new.
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <time.h>
+
+#include "log/cert.h"
+#include "log/cert_checker.h"
+#include "log/log_signer.h"
+#include "util/allocation_counter.h"
+#include "util/util.h"
+
+DEFINE_string(test_certs_dir, "../test/testdata",
+              "Directory with the test certificates and keys.");
+DEFINE_uint64(iterations, 1000, "Times to run each operation.");
+
+namespace {
+
+using ct::Cert;
+using ct::CertChain;
+using ct::CertChecker;
+using ct::ParsedCertCache;
+using ct::PreCertChain;
+using ct::SignatureCache;
+using std::string;
+
+// Issued by intermediate-cert.pem, which is issued by ca-cert.pem.
+const char kChainLeafCert[] = "test-intermediate-cert.pem";
+const char kIntermediateCert[] = "intermediate-cert.pem";
+const char kCaCert[] = "ca-cert.pem";
+// Issued by ca-cert.pem.
+const char kPreCert[] = "test-embedded-pre-cert.pem";
+const char kLogKey[] = "ct-server-key.pem";
+const char kLogPublicKey[] = "ct-server-key-public.pem";
+
+const uint64_t kTimestamp = 1348589665525LL;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+void *OpenSSLMalloc(size_t size) {
+  return util::CountingMalloc(size);
+}
+
+void *OpenSSLRealloc(void *ptr, size_t size) {
+  return util::CountingRealloc(ptr, size);
+}
+
+void OpenSSLFree(void *ptr) {
+  util::CountingFree(ptr);
+}
+#else
+void *OpenSSLMalloc(size_t size, const char *file, int line) {
+  return util::CountingMalloc(size);
+}
+
+void *OpenSSLRealloc(void *ptr, size_t size, const char *file, int line) {
+  return util::CountingRealloc(ptr, size);
+}
+
+void OpenSSLFree(void *ptr, const char *file, int line) {
+  util::CountingFree(ptr);
+}
+#endif
+
+double NowInMicroseconds() {
+  struct timespec ts;
+  PCHECK(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+string TestFile(const char *name) {
+  return FLAGS_test_certs_dir + "/" + name;
+}
+
+string ReadPem(const char *name) {
+  string pem;
+  CHECK(util::ReadTextFile(TestFile(name), &pem))
+      << "Could not read " << TestFile(name) << ". Wrong --test_certs_dir?";
+  return pem;
+}
+
+EVP_PKEY *ReadKey(const char *name, bool is_private) {
+  const string file = TestFile(name);
+  FILE *fp = fopen(file.c_str(), "r");
+  PCHECK(fp != NULL) << "Could not read " << file;
+  EVP_PKEY *pkey = is_private ? PEM_read_PrivateKey(fp, NULL, NULL, NULL) :
+      PEM_read_PUBKEY(fp, NULL, NULL, NULL);
+  CHECK(pkey != NULL) << file << " is not a valid PEM-encoded key.";
+  fclose(fp);
+  return pkey;
+}
+
+// The inputs of the operations. Each operation returns something of its
+// result, so that it isn't optimized away.
+class Fixture {
+ public:
+  Fixture()
+      : chain_pem_(ReadPem(kChainLeafCert) + ReadPem(kIntermediateCert)),
+        precert_chain_pem_(ReadPem(kPreCert) + ReadPem(kCaCert)),
+        parsed_cache_(100),
+        uncached_signatures_(0),
+        uncached_checker_(&uncached_signatures_),
+        signer_(ReadKey(kLogKey, true)),
+        verifier_(ReadKey(kLogPublicKey, false)),
+        root_hash_(util::RandomString(32, 32)) {
+    Cert leaf(ReadPem(kChainLeafCert));
+    CHECK(leaf.IsLoaded());
+    CHECK_EQ(Cert::TRUE, leaf.DerEncoding(&leaf_der_));
+    CHECK(checker_.LoadTrustedCertificates(TestFile(kCaCert)));
+    CHECK(uncached_checker_.LoadTrustedCertificates(TestFile(kCaCert)));
+    CHECK_EQ(LogSigner::OK,
+             signer_.SignV1CertificateTimestamp(kTimestamp, leaf_der_, "",
+                                                &sct_signature_));
+    CHECK_EQ(LogSigner::OK,
+             signer_.SignV1TreeHead(kTimestamp, 42, root_hash_,
+                                    &sth_signature_));
+  }
+
+  size_t LoadDerCert() {
+    Cert cert;
+    CHECK_EQ(Cert::TRUE, cert.LoadFromDerString(leaf_der_));
+    return 1;
+  }
+
+  size_t ParseCachedDerCert() {
+    Cert *cert = CHECK_NOTNULL(parsed_cache_.Parse(leaf_der_));
+    delete cert;
+    return 1;
+  }
+
+  size_t LoadPemChain() {
+    CertChain chain(chain_pem_);
+    CHECK(chain.IsLoaded());
+    return chain.Length();
+  }
+
+  size_t CheckCertChain() {
+    CertChain chain(chain_pem_);
+    CHECK_EQ(CertChecker::OK, checker_.CheckCertChain(&chain));
+    return chain.Length();
+  }
+
+  size_t CheckCertChainUncached() {
+    CertChain chain(chain_pem_);
+    CHECK_EQ(CertChecker::OK, uncached_checker_.CheckCertChain(&chain));
+    return chain.Length();
+  }
+
+  size_t CheckPreCertChain() {
+    PreCertChain chain(precert_chain_pem_);
+    string issuer_key_hash, tbs_certificate;
+    CHECK_EQ(CertChecker::OK,
+             checker_.CheckPreCertChain(&chain, &issuer_key_hash,
+                                        &tbs_certificate));
+    return tbs_certificate.size();
+  }
+
+  size_t SignSCT() {
+    string signature;
+    CHECK_EQ(LogSigner::OK,
+             signer_.SignV1CertificateTimestamp(kTimestamp, leaf_der_, "",
+                                                &signature));
+    return signature.size();
+  }
+
+  size_t VerifySCT() {
+    CHECK_EQ(LogSigVerifier::OK,
+             verifier_.VerifyV1CertSCTSignature(kTimestamp, leaf_der_, "",
+                                                sct_signature_));
+    return 1;
+  }
+
+  size_t SignTreeHead() {
+    string signature;
+    CHECK_EQ(LogSigner::OK,
+             signer_.SignV1TreeHead(kTimestamp, 42, root_hash_, &signature));
+    return signature.size();
+  }
+
+  size_t VerifyTreeHead() {
+    CHECK_EQ(LogSigVerifier::OK,
+             verifier_.VerifyV1STHSignature(kTimestamp, 42, root_hash_,
+                                            sth_signature_));
+    return 1;
+  }
+
+ private:
+  const string chain_pem_;
+  const string precert_chain_pem_;
+  string leaf_der_;
+  ParsedCertCache parsed_cache_;
+  CertChecker checker_;
+  SignatureCache uncached_signatures_;
+  CertChecker uncached_checker_;
+  LogSigner signer_;
+  LogSigVerifier verifier_;
+  const string root_hash_;
+  string sct_signature_;
+  string sth_signature_;
+};
+
+struct Operation {
+  const char *name;
+  size_t (Fixture::*run)();
+};
+
+const Operation kOperations[] = {
+  { "load_der_cert", &Fixture::LoadDerCert },
+  { "parse_cached_der_cert", &Fixture::ParseCachedDerCert },
+  { "load_pem_chain", &Fixture::LoadPemChain },
+  { "check_cert_chain", &Fixture::CheckCertChain },
+  { "check_cert_chain_uncached", &Fixture::CheckCertChainUncached },
+  { "check_precert_chain", &Fixture::CheckPreCertChain },
+  { "sign_sct", &Fixture::SignSCT },
+  { "verify_sct", &Fixture::VerifySCT },
+  { "sign_tree_head", &Fixture::SignTreeHead },
+  { "verify_tree_head", &Fixture::VerifyTreeHead },
+};
+
+void Benchmark(const Operation &operation, Fixture *fixture) {
+  // Once untimed, to fill the caches.
+  size_t sink = (fixture->*operation.run)();
+  const uint64_t allocations = util::AllocationCount();
+  const double start = NowInMicroseconds();
+  for (uint64_t i = 0; i < FLAGS_iterations; ++i)
+    sink += (fixture->*operation.run)();
+  const double elapsed = NowInMicroseconds() - start;
+  const uint64_t allocated = util::AllocationCount() - allocations;
+  CHECK_GT(sink, 0U);
+  printf("{\"operation\": \"%s\", \"ops_per_sec\": %.3f, "
+         "\"allocations_per_op\": %.3f}\n", operation.name,
+         FLAGS_iterations / (elapsed / 1e6),
+         static_cast<double>(allocated) / FLAGS_iterations);
+  fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  // Before anything allocates through OpenSSL, or it refuses.
+  const bool count_openssl = CRYPTO_set_mem_functions(
+      OpenSSLMalloc, OpenSSLRealloc, OpenSSLFree) == 1;
+  google::SetUsageMessage("Benchmark certificate checks and log signatures.");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_GT(FLAGS_iterations, 0U);
+  if (!count_openssl)
+    LOG(WARNING) << "Not counting the allocations of OpenSSL";
+  OpenSSL_add_all_algorithms();
+  ERR_load_crypto_strings();
+  srand(1);
+
+  Fixture fixture;
+  for (size_t i = 0; i < sizeof kOperations / sizeof kOperations[0]; ++i)
+    Benchmark(kOperations[i], &fixture);
+  return 0;
+}
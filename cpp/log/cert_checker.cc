@@ -14,6 +14,7 @@
 
 #include "log/cert.h"
 #include "log/ct_extensions.h"
+#include "util/memory_usage.h"
 #include "util/openssl_util.h"  // for LOG_OPENSSL_ERRORS
 #include "util/util.h"
 
@@ -22,11 +23,43 @@ using util::ClearOpenSSLErrors;
 
 namespace  ct {
 
-CertChecker::CertChecker() : trusted_() {
+namespace {
+
+const size_t kDefaultSignatureCacheSize = 10000;
+
+// The heap bytes of the nodes and keys of an index of the trusted certs.
+template <class Index> size_t IndexBytes(const Index &index) {
+  size_t bytes = 0;
+  for (typename Index::const_iterator it = index.begin(); it != index.end();
+       ++it)
+    bytes += util::kTreeNodeBytes + sizeof(*it) + util::HeapBytes(it->first);
+  return bytes;
+}
+
+}  // namespace
+
+CertChecker::CertChecker()
+    : trusted_(),
+      signature_cache_(new SignatureCache(kDefaultSignatureCacheSize)),
+      owns_signature_cache_(true) {
+}
+
+CertChecker::CertChecker(size_t signature_cache_size)
+    : trusted_(),
+      signature_cache_(new SignatureCache(signature_cache_size)),
+      owns_signature_cache_(true) {
+}
+
+CertChecker::CertChecker(SignatureCache *signature_cache)
+    : trusted_(),
+      signature_cache_(CHECK_NOTNULL(signature_cache)),
+      owns_signature_cache_(false) {
 }
 
 CertChecker::~CertChecker() {
   ClearAllTrustedCertificates();
+  if (owns_signature_cache_)
+    delete signature_cache_;
 }
 
 bool CertChecker::LoadTrustedCertificates(const std::string &cert_file) {
@@ -99,18 +132,45 @@ bool CertChecker::LoadTrustedCertificates(const std::string &cert_file) {
 
   size_t new_certs = certs_to_add.size();
   while (!certs_to_add.empty()) {
-    trusted_.insert(certs_to_add.back());
+    AddTrustedCertificate(certs_to_add.back().first,
+                          certs_to_add.back().second);
     certs_to_add.pop_back();
   }
   LOG(INFO) << "Added " << new_certs << " new certificate(s) to trusted store";
   return true;
 }
 
+void CertChecker::AddTrustedCertificate(const string &subject_name,
+                                        Cert *cert) {
+  // Trusted certs are shared between threads, so must be read-only.
+  cert->ComputeEncodings();
+  trusted_.insert(make_pair(subject_name, cert));
+
+  string digest;
+  if (cert->Sha256Digest(&digest) == Cert::TRUE)
+    trusted_by_digest_.insert(make_pair(digest, cert));
+  string key_id;
+  if (cert->SubjectKeyIdentifier(&key_id) == Cert::TRUE)
+    trusted_by_key_id_.insert(make_pair(subject_name + key_id, cert));
+}
+
+util::MemoryUsage CertChecker::MemoryUsage() const {
+  util::MemoryUsage usage(IndexBytes(trusted_) +
+                          IndexBytes(trusted_by_digest_) +
+                          IndexBytes(trusted_by_key_id_), trusted_.size());
+  for (std::multimap<string, const Cert *>::const_iterator it =
+           trusted_.begin(); it != trusted_.end(); ++it)
+    usage.bytes += sizeof(Cert) + it->second->HeapBytes();
+  return usage;
+}
+
 void CertChecker::ClearAllTrustedCertificates() {
   std::multimap<string, const Cert *>::iterator it = trusted_.begin();
   for (; it != trusted_.end(); ++it)
     delete it->second;
   trusted_.clear();
+  trusted_by_digest_.clear();
+  trusted_by_key_id_.clear();
 }
 
 CertChecker::CertVerifyResult
@@ -147,7 +207,7 @@ CertChecker::CheckIssuerChain(CertChain *chain) const {
     return INTERNAL_ERROR;
   }
 
-  status = chain->IsValidSignatureChain();
+  status = chain->IsValidSignatureChain(signature_cache_);
   if (status == Cert::UNSUPPORTED_ALGORITHM) {
     // UNSUPPORTED_ALGORITHM can happen when a weak algorithm (such as MD2)
     // is intentionally not accepted in which case it's correct to say that
@@ -207,22 +267,10 @@ CertChecker::CertVerifyResult CertChecker::CheckPreCertChain(
              chain->CertAt(1)->SPKISha256Digest(&key_hash) != Cert::TRUE) {
     return INTERNAL_ERROR;
   }
-  // A well-formed chain always has a precert.
-  TbsCertificate tbs(*chain->PreCert());
-  if (!tbs.IsLoaded() || tbs.DeleteExtension(ct::NID_ctPoison) != Cert::TRUE)
-    return INTERNAL_ERROR;
-
-  // If the issuing cert is the special Precert Signing Certificate,
-  // replace the issuer with the one that will sign the final cert.
   // Should always succeed as we've already verified that the chain
   // is well-formed.
-  if (uses_pre_issuer == Cert::TRUE &&
-      tbs.CopyIssuerFrom(*chain->PrecertIssuingCert()) != Cert::TRUE)
-    return INTERNAL_ERROR;
-
-
   string der_tbs;
-  if (tbs.DerEncoding(&der_tbs) != Cert::TRUE)
+  if (chain->PrecertTbsCertificate(&der_tbs) != Cert::TRUE)
     return INTERNAL_ERROR;
 
   issuer_key_hash->assign(key_hash);
@@ -263,16 +311,25 @@ CertChecker::GetTrustedCa(CertChain *chain) const {
     return ROOT_NOT_IN_LOCAL_STORE;
   }
 
+  // Most certs name the key of their issuer, which narrows the candidates
+  // down to one.
   std::pair<std::multimap<string, const Cert *>::const_iterator,
-            std::multimap<string, const Cert *>::const_iterator> issuer_range =
-    trusted_.equal_range(issuer_name);
+            std::multimap<string, const Cert *>::const_iterator> issuer_range;
+  string key_id;
+  status = subject->AuthorityKeyIdentifier(&key_id);
+  if (status == Cert::ERROR)
+    return INTERNAL_ERROR;
+  if (status == Cert::TRUE)
+    issuer_range = trusted_by_key_id_.equal_range(issuer_name + key_id);
+  if (status != Cert::TRUE || issuer_range.first == issuer_range.second)
+    issuer_range = trusted_.equal_range(issuer_name);
 
   const Cert *issuer = NULL;
   for (std::multimap<string, const Cert *>::const_iterator it
            = issuer_range.first; it != issuer_range.second; ++it) {
     const Cert *issuer_cand = it->second;
 
-    Cert::Status ok = subject->IsSignedBy(*issuer_cand);
+    Cert::Status ok = signature_cache_->IsSignedBy(*subject, *issuer_cand);
     if (ok == Cert::UNSUPPORTED_ALGORITHM) {
       // If the cert's algorithm is unsupported, then there's no point
       // continuing: it's unconditionally invalid.
@@ -313,22 +370,15 @@ CertChecker::CertVerifyResult CertChecker::IsTrusted(
 
   *subject_name = cert_name;
 
-  std::pair<std::multimap<string, const Cert *>::const_iterator,
-            std::multimap<string, const Cert *>::const_iterator> cand_range =
-    trusted_.equal_range(cert_name);
-  for (std::multimap<string, const Cert *>::const_iterator it = cand_range.first;
-       it != cand_range.second; ++it) {
-    const Cert *cand = it->second;
-    Cert::Status matches = cert.IsIdenticalTo(*cand);
-    if (matches != Cert::TRUE && matches != Cert::FALSE) {
-      LOG(ERROR) << "Cert comparison failed";
-      return INTERNAL_ERROR;
-    }
-    if (matches == Cert::TRUE) {
-      return OK;
-    }
-  }
-  return ROOT_NOT_IN_LOCAL_STORE;
+  string digest;
+  status = cert.Sha256Digest(&digest);
+  if (status == Cert::ERROR)
+    return INTERNAL_ERROR;
+  else if (status != Cert::TRUE)
+    return INVALID_CERTIFICATE_CHAIN;
+
+  return trusted_by_digest_.find(digest) != trusted_by_digest_.end() ?
+      OK : ROOT_NOT_IN_LOCAL_STORE;
 }
 
 }  // namespace ct
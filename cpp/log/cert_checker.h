@@ -25,7 +25,14 @@ class PreCertChain;
 // (2) we get some spam protection.
 class CertChecker {
  public:
+  // Remembers up to 10000 verified signatures.
   CertChecker();
+  // Remembers up to |signature_cache_size| verified signatures, so that the
+  // links between intermediates and roots are not verified over and over.
+  explicit CertChecker(size_t signature_cache_size);
+  // Shares |signature_cache| with other checkers, e.g. those of logs with
+  // different roots but the same intermediates. Does not take ownership.
+  explicit CertChecker(SignatureCache *signature_cache);
 
   virtual ~CertChecker();
 
@@ -56,6 +63,9 @@ class CertChecker {
 
   virtual size_t NumTrustedCertificates() const { return trusted_.size(); }
 
+  // Memory accounting: the trusted certificates and their indexes.
+  util::MemoryUsage MemoryUsage() const;
+
   // Check that:
   // (1) Each certificate is correctly signed by the next one in the chain; and
   // (2) The last certificate is issued by a certificate in our trusted store.
@@ -92,10 +102,21 @@ class CertChecker {
   // INTERNAL_ERROR if something terrible happened.
   CertVerifyResult IsTrusted(const Cert &cert, std::string *subject_name) const;
 
+  // Add a cert to the store. Takes ownership.
+  void AddTrustedCertificate(const std::string &subject_name, Cert *cert);
+
   // A map by the DER encoding of the subject name.
   // All code manipulating this container must ensure contained elements are
   // deallocated appropriately.
   std::multimap<std::string, const Cert *> trusted_;
+  // The same certs by their SHA-256 digest, to recognise them.
+  std::map<std::string, const Cert *> trusted_by_digest_;
+  // And by subject name followed by subjectKeyIdentifier, to find the one
+  // cert that issued another amongst those with the same name.
+  std::multimap<std::string, const Cert *> trusted_by_key_id_;
+  // Checks are const, but fill the cache.
+  SignatureCache *signature_cache_;
+  const bool owns_signature_cache_;
 };
 
 }  // namespace ct
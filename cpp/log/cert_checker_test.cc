@@ -193,6 +193,32 @@ TEST_F(CertCheckerTest, Intermediates) {
             checker_.CheckCertChain(&invalid));
 }
 
+TEST_F(CertCheckerTest, SharedSignatureCache) {
+  SignatureCache cache(100);
+  CertChecker checker(&cache), checker2(&cache);
+  EXPECT_TRUE(checker.LoadTrustedCertificates(cert_dir_ + "/" + kCaCert));
+  EXPECT_TRUE(checker2.LoadTrustedCertificates(cert_dir_ + "/" + kCaCert));
+
+  CertChain chain(chain_leaf_pem_ + intermediate_pem_);
+  ASSERT_TRUE(chain.IsLoaded());
+  EXPECT_EQ(CertChecker::OK, checker.CheckCertChain(&chain));
+  const size_t verified = cache.size();
+  EXPECT_LT(0U, verified);
+
+  // The other checker finds the links verified already.
+  CertChain chain2(chain_leaf_pem_ + intermediate_pem_);
+  ASSERT_TRUE(chain2.IsLoaded());
+  EXPECT_EQ(CertChecker::OK, checker2.CheckCertChain(&chain2));
+  EXPECT_EQ(verified, cache.size());
+
+  // A checker with roots of its own doesn't trust the others'.
+  CertChecker untrusting(&cache);
+  CertChain chain3(chain_leaf_pem_ + intermediate_pem_);
+  ASSERT_TRUE(chain3.IsLoaded());
+  EXPECT_EQ(CertChecker::ROOT_NOT_IN_LOCAL_STORE,
+            untrusting.CheckCertChain(&chain3));
+}
+
 TEST_F(CertCheckerTest, PreCert) {
   const string chain_pem = precert_pem_ + ca_pem_;
   PreCertChain chain(chain_pem);
@@ -8,6 +8,7 @@
 #include "log/ct_extensions.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/trace.h"
 
 using ct::Cert;
 using ct::CertChain;
@@ -18,6 +19,7 @@ using ct::PrecertChainEntry;
 using ct::TbsCertificate;
 using ct::X509ChainEntry;
 using std::string;
+using util::Tracer;
 
 // TODO(ekasper): handle Cert errors consistently and log some errors here
 // if they fail.
@@ -108,7 +110,12 @@ CertSubmissionHandler::X509ChainToEntry(const CertChain &chain,
 CertSubmissionHandler::SubmitResult
 CertSubmissionHandler::ProcessX509Submission(CertChain *chain,
                                              LogEntry *entry) {
-  CertChecker::CertVerifyResult result = cert_checker_->CheckCertChain(chain);
+  Tracer::Span span("submission_handler.process_x509");
+  CertChecker::CertVerifyResult result;
+  {
+    Tracer::Span check("cert_checker.check_chain");
+    result = cert_checker_->CheckCertChain(chain);
+  }
   if (result != CertChecker::OK)
     return GetVerifyError(result);
 
@@ -129,11 +136,27 @@ CertSubmissionHandler::ProcessX509Submission(CertChain *chain,
   return OK;
 }
 
+// static
+bool CertSubmissionHandler::X509LeafEntry(const CertChain &chain,
+                                          LogEntry *entry) {
+  if (!chain.IsLoaded())
+    return false;
+
+  string der_cert;
+  if (chain.LeafCert()->DerEncoding(&der_cert) != Cert::TRUE)
+    return false;
+  entry->set_type(ct::X509_ENTRY);
+  entry->mutable_x509_entry()->set_leaf_certificate(der_cert);
+  return true;
+}
+
 // Inputs must be concatenated PEM entries.
 // Format checking is done in the parent class.
 CertSubmissionHandler::SubmitResult
 CertSubmissionHandler::ProcessX509Submission(const string &submission,
                                              LogEntry *entry) {
+  // Parsing the PEM is what the span takes beyond processing the chain.
+  Tracer::Span span("submission_handler.x509_pem");
   string pem_string(reinterpret_cast<const char*>(submission.data()),
                     submission.size());
   CertChain chain(pem_string);
@@ -147,6 +170,7 @@ CertSubmissionHandler::ProcessX509Submission(const string &submission,
 CertSubmissionHandler::SubmitResult
 CertSubmissionHandler::ProcessPreCertSubmission(const string &submission,
                                                 LogEntry *entry) {
+  Tracer::Span span("submission_handler.precert_pem");
   string pem_string(reinterpret_cast<const char*>(submission.data()),
                     submission.size());
   PreCertChain chain(pem_string);
@@ -159,10 +183,15 @@ CertSubmissionHandler::ProcessPreCertSubmission(const string &submission,
 CertSubmissionHandler::SubmitResult
 CertSubmissionHandler::ProcessPreCertSubmission(PreCertChain *chain,
                                                 LogEntry *entry) {
+  Tracer::Span span("submission_handler.process_precert");
   PrecertChainEntry *precert_entry = entry->mutable_precert_entry();
-  CertChecker::CertVerifyResult result = cert_checker_->CheckPreCertChain(
-      chain, precert_entry->mutable_pre_cert()->mutable_issuer_key_hash(),
-      precert_entry->mutable_pre_cert()->mutable_tbs_certificate());
+  CertChecker::CertVerifyResult result;
+  {
+    Tracer::Span check("cert_checker.check_precert_chain");
+    result = cert_checker_->CheckPreCertChain(
+        chain, precert_entry->mutable_pre_cert()->mutable_issuer_key_hash(),
+        precert_entry->mutable_pre_cert()->mutable_tbs_certificate());
+  }
 
   if (result != CertChecker::OK)
     return GetVerifyError(result);
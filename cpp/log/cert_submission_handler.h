@@ -45,10 +45,19 @@ class CertSubmissionHandler {
   static bool X509ChainToEntry(const ct::CertChain &chain,
                                ct::LogEntry *entry);
 
+  // The leaf of the entry that ProcessX509Submission() would make of
+  // |chain|, without verifying anything: enough to look up whether the
+  // submission is already logged.
+  static bool X509LeafEntry(const ct::CertChain &chain, ct::LogEntry *entry);
+
   const std::multimap<std::string, const ct::Cert *> &GetRoots() const {
     return cert_checker_->GetTrustedCertificates();
   }
 
+  util::MemoryUsage RootsMemoryUsage() const {
+    return cert_checker_->MemoryUsage();
+  }
+
  private:
   SubmitResult ProcessX509Submission(const std::string &submission,
                                      ct::LogEntry *entry);
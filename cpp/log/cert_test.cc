@@ -7,6 +7,7 @@
 
 #include "log/cert.h"
 #include "log/ct_extensions.h"
+#include "merkletree/serial_hasher.h"
 #include "util/testing.h"
 #include "util/util.h"
 
@@ -27,6 +28,8 @@ static const char kLeafWithIntermediateCert[] = "test-intermediate-cert.pem";
 static const char kCaPreCert[] = "ca-pre-cert.pem";
 // Issued by ca-cert.pem
 static const char kPreCert[] = "test-embedded-pre-cert.pem";
+// Issued by ca-pre-cert.pem
+static const char kPreWithPreCaCert[] = "test-embedded-with-preca-pre-cert.pem";
 // CA with no basic constraints and an MD2 signature.
 static const char kLegacyCaCert[] = "test-no-bc-ca-cert.pem";
 
@@ -41,6 +44,7 @@ class CertTest : public ::testing::Test {
   string ca_pem_;
   string ca_precert_pem_;
   string precert_pem_;
+  string precert_with_preca_pem_;
   string leaf_with_intermediate_pem_;
   string legacy_ca_pem_;
 
@@ -52,6 +56,8 @@ class CertTest : public ::testing::Test {
     CHECK(util::ReadTextFile(cert_dir + "/" + kCaCert, &ca_pem_));
     CHECK(util::ReadTextFile(cert_dir + "/" + kCaPreCert, &ca_precert_pem_));
     CHECK(util::ReadTextFile(cert_dir + "/" + kPreCert, &precert_pem_));
+    CHECK(util::ReadTextFile(cert_dir + "/" + kPreWithPreCaCert,
+                             &precert_with_preca_pem_));
     CHECK(util::ReadTextFile(cert_dir + "/" + kLeafWithIntermediateCert,
                              &leaf_with_intermediate_pem_));
     CHECK(util::ReadTextFile(cert_dir + "/" + kLegacyCaCert,
@@ -104,6 +110,36 @@ TEST_F(CertTest, LoadInvalidFromDer) {
   EXPECT_FALSE(second.IsLoaded());
 }
 
+TEST_F(CertTest, ReloadFromDer) {
+  Cert leaf(leaf_pem_);
+  Cert ca(ca_pem_);
+  string leaf_der, ca_der, leaf_digest, ca_digest, digest;
+  ASSERT_EQ(Cert::TRUE, leaf.DerEncoding(&leaf_der));
+  ASSERT_EQ(Cert::TRUE, ca.DerEncoding(&ca_der));
+  ASSERT_EQ(Cert::TRUE, leaf.Sha256Digest(&leaf_digest));
+  ASSERT_EQ(Cert::TRUE, ca.Sha256Digest(&ca_digest));
+  EXPECT_EQ(util::HexString(Sha256Hasher::Sha256Digest(leaf_der)),
+            util::HexString(leaf_digest));
+
+  // The encodings of the old cert are forgotten.
+  Cert cert;
+  ASSERT_EQ(Cert::TRUE, cert.LoadFromDerString(leaf_der));
+  ASSERT_EQ(Cert::TRUE, cert.Sha256Digest(&digest));
+  EXPECT_EQ(util::HexString(leaf_digest), util::HexString(digest));
+  ASSERT_EQ(Cert::TRUE, cert.LoadFromDerString(ca_der));
+  ASSERT_EQ(Cert::TRUE, cert.Sha256Digest(&digest));
+  EXPECT_EQ(util::HexString(ca_digest), util::HexString(digest));
+
+  // A clone has the same ones.
+  Cert *clone = cert.Clone();
+  string der;
+  ASSERT_EQ(Cert::TRUE, clone->DerEncoding(&der));
+  EXPECT_EQ(util::HexString(ca_der), util::HexString(der));
+  ASSERT_EQ(Cert::TRUE, clone->Sha256Digest(&digest));
+  EXPECT_EQ(util::HexString(ca_digest), util::HexString(digest));
+  delete clone;
+}
+
 TEST_F(CertTest, PrintSubjectName) {
   Cert leaf(leaf_pem_);
   EXPECT_EQ("C=GB, O=Certificate Transparency, ST=Wales, L=Erw Wen",
@@ -190,6 +226,122 @@ TEST_F(CertTest, Issuers) {
   EXPECT_EQ(Cert::TRUE, ca.IsSelfSigned());
 }
 
+TEST_F(CertTest, KeyIdentifiers) {
+  Cert leaf(leaf_pem_);
+  Cert ca(ca_pem_);
+  string ca_key_id, key_id;
+  ASSERT_EQ(Cert::TRUE, ca.SubjectKeyIdentifier(&ca_key_id));
+  EXPECT_EQ("5f9d880dc873e654d4f80dd8e6b0c124b447c355",
+            util::HexString(ca_key_id));
+  ASSERT_EQ(Cert::TRUE, leaf.AuthorityKeyIdentifier(&key_id));
+  EXPECT_EQ(util::HexString(ca_key_id), util::HexString(key_id));
+  ASSERT_EQ(Cert::TRUE, leaf.SubjectKeyIdentifier(&key_id));
+  EXPECT_NE(util::HexString(ca_key_id), util::HexString(key_id));
+
+  Cert unloaded;
+  EXPECT_EQ(Cert::ERROR, unloaded.SubjectKeyIdentifier(&key_id));
+  EXPECT_EQ(Cert::ERROR, unloaded.AuthorityKeyIdentifier(&key_id));
+}
+
+TEST_F(CertTest, SerialNumber) {
+  Cert leaf(leaf_pem_);
+  Cert ca(ca_pem_);
+  string serial;
+  ASSERT_EQ(Cert::TRUE, leaf.SerialNumber(&serial));
+  EXPECT_EQ("06", util::HexString(serial));
+  ASSERT_EQ(Cert::TRUE, ca.SerialNumber(&serial));
+  EXPECT_EQ("", serial);
+
+  Cert unloaded;
+  EXPECT_EQ(Cert::ERROR, unloaded.SerialNumber(&serial));
+}
+
+TEST_F(CertTest, SubjectAltDnsNames) {
+  Cert leaf(leaf_pem_);
+  std::vector<string> dns_names;
+  // None of the test certs have one.
+  EXPECT_EQ(Cert::FALSE, leaf.SubjectAltDnsNames(&dns_names));
+  EXPECT_TRUE(dns_names.empty());
+
+  Cert unloaded;
+  EXPECT_EQ(Cert::ERROR, unloaded.SubjectAltDnsNames(&dns_names));
+}
+
+TEST_F(CertTest, SubjectCommonNames) {
+  Cert leaf(leaf_pem_);
+  std::vector<string> names;
+  // The test certs name an organization, not a host.
+  EXPECT_EQ(Cert::FALSE, leaf.SubjectCommonNames(&names));
+  EXPECT_TRUE(names.empty());
+
+  Cert unloaded;
+  EXPECT_EQ(Cert::ERROR, unloaded.SubjectCommonNames(&names));
+}
+
+TEST_F(CertTest, SignatureCache) {
+  Cert leaf(leaf_pem_);
+  Cert ca(ca_pem_);
+  Cert ca_pre(ca_precert_pem_);
+  SignatureCache cache(2);
+
+  EXPECT_EQ(Cert::TRUE, cache.IsSignedBy(leaf, ca));
+  EXPECT_EQ(1U, cache.size());
+  EXPECT_EQ(Cert::TRUE, cache.IsSignedBy(leaf, ca));
+  EXPECT_EQ(1U, cache.size());
+
+  // Failures are not remembered.
+  EXPECT_EQ(Cert::FALSE, cache.IsSignedBy(ca, leaf));
+  EXPECT_EQ(Cert::FALSE, cache.IsSignedBy(ca, leaf));
+  EXPECT_EQ(1U, cache.size());
+
+  EXPECT_EQ(Cert::TRUE, cache.IsSignedBy(ca_pre, ca));
+  EXPECT_EQ(Cert::TRUE, cache.IsSignedBy(ca, ca));
+  EXPECT_EQ(2U, cache.size());
+
+  // Doesn't break chain checks either.
+  CertChain chain(leaf_pem_ + ca_pem_);
+  EXPECT_EQ(Cert::TRUE, chain.IsValidSignatureChain(&cache));
+  CertChain reversed(ca_pem_ + leaf_pem_);
+  EXPECT_EQ(Cert::FALSE, reversed.IsValidSignatureChain(&cache));
+}
+
+TEST_F(CertTest, ParsedCertCache) {
+  Cert leaf(leaf_pem_);
+  Cert ca(ca_pem_);
+  string leaf_der, ca_der;
+  ASSERT_EQ(Cert::TRUE, leaf.DerEncoding(&leaf_der));
+  ASSERT_EQ(Cert::TRUE, ca.DerEncoding(&ca_der));
+  ParsedCertCache cache(1);
+
+  Cert *first = cache.Parse(leaf_der);
+  ASSERT_TRUE(first != NULL);
+  Cert *second = cache.Parse(leaf_der);
+  ASSERT_TRUE(second != NULL);
+  EXPECT_EQ(1U, cache.size());
+  EXPECT_EQ(Cert::TRUE, first->IsIdenticalTo(leaf));
+  EXPECT_EQ(Cert::TRUE, second->IsIdenticalTo(leaf));
+  string digest;
+  EXPECT_EQ(Cert::TRUE, second->Sha256Digest(&digest));
+  EXPECT_EQ(Sha256Hasher::Sha256Digest(leaf_der), digest);
+
+  // The certs share the parsed cert, and outlive each other and the
+  // cache entry.
+  delete first;
+  Cert *other = cache.Parse(ca_der);
+  ASSERT_TRUE(other != NULL);
+  EXPECT_EQ(1U, cache.size());
+  EXPECT_EQ(Cert::TRUE, second->IsIdenticalTo(leaf));
+  EXPECT_EQ(Cert::TRUE, other->IsSignedBy(ca));
+  EXPECT_EQ(Cert::TRUE, second->IsSignedBy(*other));
+  delete second;
+  delete other;
+
+  // Only what parses is cached.
+  EXPECT_TRUE(cache.Parse("not a cert") == NULL);
+  EXPECT_TRUE(cache.Parse(string()) == NULL);
+  EXPECT_EQ(1U, cache.size());
+}
+
 TEST_F(CertTest, DerEncodedNames) {
   Cert leaf(leaf_pem_);
   Cert ca(ca_pem_);
@@ -355,6 +507,35 @@ TEST_F(CertChainTest, PreCertChain) {
   EXPECT_EQ(Cert::FALSE, pre_chain2.IsWellFormed());
 }
 
+TEST_F(CertChainTest, PrecertTbsCertificate) {
+  // Issued by the CA: only the poison goes.
+  PreCertChain chain(precert_pem_ + ca_pem_);
+  ASSERT_TRUE(chain.IsLoaded());
+  string tbs, expected;
+  ASSERT_EQ(Cert::TRUE, chain.PrecertTbsCertificate(&tbs));
+  TbsCertificate reencoded(*chain.PreCert());
+  ASSERT_EQ(Cert::TRUE, reencoded.DeleteExtension(ct::NID_ctPoison));
+  ASSERT_EQ(Cert::TRUE, reencoded.DerEncoding(&expected));
+  EXPECT_EQ(util::HexString(expected), util::HexString(tbs));
+
+  // Issued by a Precertificate Signing Certificate: the issuer changes too.
+  PreCertChain pre_ca_chain(precert_with_preca_pem_ + ca_precert_pem_ +
+                            ca_pem_);
+  ASSERT_TRUE(pre_ca_chain.IsLoaded());
+  ASSERT_EQ(Cert::TRUE, pre_ca_chain.UsesPrecertSigningCertificate());
+  ASSERT_EQ(Cert::TRUE, pre_ca_chain.PrecertTbsCertificate(&tbs));
+  TbsCertificate pre_ca_reencoded(*pre_ca_chain.PreCert());
+  ASSERT_EQ(Cert::TRUE, pre_ca_reencoded.DeleteExtension(ct::NID_ctPoison));
+  ASSERT_EQ(Cert::TRUE, pre_ca_reencoded.CopyIssuerFrom(
+      *pre_ca_chain.PrecertIssuingCert()));
+  ASSERT_EQ(Cert::TRUE, pre_ca_reencoded.DerEncoding(&expected));
+  EXPECT_EQ(util::HexString(expected), util::HexString(tbs));
+
+  // Not a precert.
+  PreCertChain not_pre(leaf_pem_ + ca_pem_);
+  EXPECT_EQ(Cert::FALSE, not_pre.PrecertTbsCertificate(&tbs));
+}
+
 }  // namespace
 
 }  // namespace ct
@@ -3,11 +3,22 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include <algorithm>
 #include <glog/logging.h>
 #include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
 
+#include "log/entry_compressor.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
 #include "proto/ct.pb.h"
 
+namespace util {
+class Metrics;
+}  // namespace util
+
 // The |Logged| class needs to provide this interface:
 // class Logged {
 //  public:
@@ -76,10 +87,76 @@ template <class Logged> class Database {
     NOT_FOUND,
   };
 
+  // Receives the entries of a range lookup, in order.
+  class EntryCallback {
+   public:
+    virtual ~EntryCallback() {}
+
+    // Return false to stop the lookup early.
+    virtual bool Entry(const Logged &logged) = 0;
+  };
+
+  // Receives the tree heads of a range lookup, oldest first.
+  class TreeHeadCallback {
+   public:
+    virtual ~TreeHeadCallback() {}
+
+    // Return false to stop the lookup early.
+    virtual bool TreeHead(const ct::SignedTreeHead &sth) = 0;
+  };
+
+  // Told about the tree heads written through a database.
+  class TreeHeadObserver {
+   public:
+    virtual ~TreeHeadObserver() {}
+
+    // Called by the writer once |sth| is written, possibly before the
+    // writer's transaction commits, so don't read the database from here.
+    virtual void NewTreeHead(const ct::SignedTreeHead &sth) = 0;
+  };
+
+  Database() : compressor_(NULL) {}
+
   virtual ~Database() {}
 
+  // Compress the entries written from now on with |compressor|, which
+  // must outlive the database. Entries compressed with a dictionary can
+  // only be read with a compressor that has the same dictionary; entries
+  // written without one stay readable either way. Logged's serialization
+  // for the database must not start with a zero byte (see
+  // EntryCompressor). Wrapping databases don't pass this on, so set it on
+  // the one that stores the entries.
+  void SetCompressor(const EntryCompressor *compressor) {
+    compressor_ = compressor;
+  }
+
+  // Tell |observer| about each tree head written through this database
+  // until it is removed, so that it needn't poll LatestTreeHead().
+  // Observers of a wrapping database hear about the writes through it;
+  // writes by other processes go unnoticed. Not thread-safe: add observers
+  // before writing. They don't change the database, hence const.
+  void AddTreeHeadObserver(TreeHeadObserver *observer) const {
+    observers_.push_back(observer);
+  }
+
+  void RemoveTreeHeadObserver(TreeHeadObserver *observer) const {
+    observers_.erase(std::remove(observers_.begin(), observers_.end(),
+                                 observer),
+                     observers_.end());
+  }
+
   virtual bool Transactional() const { return false; }
 
+  // Whether LookupByHash(), LookupByIndex() and LatestTreeHead() may be
+  // called from several threads at once, and while another thread makes
+  // any other call, so that a lock around the database can let them by.
+  virtual bool ConcurrentReads() const { return false; }
+
+  // Set the memory accounting gauges (see util/memory_usage.h) of what the
+  // database keeps in memory, e.g. its indexes, in |metrics|. Wrapping
+  // databases pass this on and add their own, e.g. their caches.
+  virtual void ExportMemoryUsage(util::Metrics *metrics) const {}
+
   virtual void BeginTransaction() {
     DLOG(FATAL) << "Transactions not supported";
   }
@@ -107,6 +184,33 @@ template <class Logged> class Database {
   virtual WriteResult AssignSequenceNumber(const std::string &pending_hash,
                                            uint64_t sequence_number) = 0;
 
+  // Assign sequence numbers |first_sequence_number|,
+  // |first_sequence_number| + 1, ... to the pending entries |pending_hashes|,
+  // in order, as AssignSequenceNumber() does. Stops at the first entry that
+  // fails and returns its result; |*assigned| is set to the number of
+  // entries that did get their sequence number (i.e., all of them on OK).
+  // The default implementation assigns them one at a time.
+  virtual WriteResult AssignSequenceNumbers(
+      const std::vector<std::string> &pending_hashes,
+      uint64_t first_sequence_number, size_t *assigned) {
+    CHECK_NOTNULL(assigned);
+    for (*assigned = 0; *assigned < pending_hashes.size(); ++*assigned) {
+      WriteResult result =
+          AssignSequenceNumber(pending_hashes[*assigned],
+                               first_sequence_number + *assigned);
+      if (result != OK)
+        return result;
+    }
+    return OK;
+  }
+
+  // Remove the logged entries with sequence numbers below |end| for good,
+  // once they are kept elsewhere (see ArchivingDatabase), so that lookups
+  // of them find nothing. Pending entries stay. Returns false, without
+  // removing anything, if the database can't. Wrapping databases don't
+  // pass this on, so call it on the one that stores the entries.
+  virtual bool DropLoggedEntries(uint64_t end) { return false; }
+
   // Look up by hash.
   virtual LookupResult LookupByHash(const std::string &hash) const = 0;
 
@@ -119,22 +223,106 @@ template <class Logged> class Database {
   virtual LookupResult LookupByIndex(uint64_t sequence_number,
                                      Logged *result) const = 0;
 
+  // Look up the entries with sequence numbers |start| to |end| - 1 and pass
+  // them to |callback| in order, reading the range in one go rather than
+  // one entry at a time. If an entry is missing, return NOT_FOUND after
+  // passing the ones before it. Returns LOOKUP_OK if the callback stops
+  // the lookup.
+  virtual LookupResult LookupByIndexRange(uint64_t start, uint64_t end,
+                                          EntryCallback *callback) const = 0;
+
+  // Look up the Merkle tree leaf hashes of the entries with sequence numbers
+  // |start| to |end| - 1, and append them to |hashes| in order. Leaf hashes
+  // are stored with the entries, so neither is the entry read nor its leaf
+  // reserialized. If any entry in the range is missing, return NOT_FOUND and
+  // leave |hashes| as it was.
+  virtual LookupResult LookupLeafHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const = 0;
+
+  // Look up the hashes of the entries with sequence numbers |start| to
+  // |end| - 1, and append them to |hashes| in order, without reading the
+  // entries. If an entry is missing, return NOT_FOUND after appending the
+  // hashes of the ones before it, as LookupByIndexRange() does.
+  virtual LookupResult LookupEntryHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const = 0;
+
   // List the hashes of all pending entries, i.e. all entries without a
   // sequence number.
   virtual std::set<std::string> PendingHashes() const = 0;
 
+  // Pass the pending entries to |callback|, oldest first, reading each one
+  // once. Stops after |limit| entries, unless |limit| is 0.
+  virtual void LookupPendingEntries(size_t limit,
+                                    EntryCallback *callback) const = 0;
+
   // Attempt to write a tree head. Fails only if a tree head with this timestamp
   // already exists (i.e., |timestamp| is primary key). Does not check that
-  // the timestamp is newer than previous entries.
+  // the timestamp is newer than previous entries. Tells the observers
+  // about the tree head if it was written.
   WriteResult WriteTreeHead(const ct::SignedTreeHead &sth) {
     if (!sth.has_timestamp())
       return MISSING_TREE_HEAD_TIMESTAMP;
-    return WriteTreeHead_(sth);
+    WriteResult result = WriteTreeHead_(sth);
+    if (result == OK)
+      for (size_t i = 0; i < observers_.size(); ++i)
+        observers_[i]->NewTreeHead(sth);
+    return result;
   }
   virtual WriteResult WriteTreeHead_(const ct::SignedTreeHead &sth) = 0;
 
   // Return the tree head with the freshest timestamp.
   virtual LookupResult LatestTreeHead(ct::SignedTreeHead *result) const = 0;
+
+  // Older tree heads are indexed, so that these take O(log n) time in the
+  // number of tree heads rather than a scan. As the signer writes them,
+  // tree sizes never shrink as timestamps grow; databases may rely on it.
+
+  // Look up the tree head with |timestamp|.
+  virtual LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead *result) const = 0;
+
+  // Look up the freshest of the tree heads with |tree_size| entries.
+  virtual LookupResult LookupTreeHeadBySize(
+      uint64_t tree_size, ct::SignedTreeHead *result) const = 0;
+
+  // Pass the tree heads with timestamps |start| to |end| - 1 to |callback|,
+  // oldest first.
+  virtual void LookupTreeHeadRange(uint64_t start, uint64_t end,
+                                   TreeHeadCallback *callback) const = 0;
+
+ protected:
+  // Compress serialized entry |data| in place for storage, if we have a
+  // compressor.
+  void CompressEntry(std::string *data) const {
+    if (compressor_ == NULL)
+      return;
+    std::string compressed;
+    compressor_->Compress(*data, &compressed);
+    data->swap(compressed);
+  }
+
+  // Reverse CompressEntry() in place. Without a compressor, |data| is
+  // taken to be uncompressed: entries needn't be protocol buffers then.
+  bool DecompressEntry(std::string *data) const {
+    if (compressor_ == NULL || !EntryCompressor::IsCompressed(*data))
+      return true;
+    std::string decompressed;
+    if (!compressor_->Decompress(*data, &decompressed))
+      return false;
+    data->swap(decompressed);
+    return true;
+  }
+
+  // The Merkle tree leaf hash of |logged|, as the tree signer computes it.
+  static std::string LeafHash(const Logged &logged) {
+    std::string serialized_leaf;
+    CHECK(logged.SerializeForLeaf(&serialized_leaf));
+    return TreeHasherT<Sha256Hasher>().HashLeaf(serialized_leaf);
+  }
+
+ private:
+  const EntryCompressor *compressor_;
+  mutable std::vector<TreeHeadObserver*> observers_;
 };
 
 #endif  // ndef DATABASE_H
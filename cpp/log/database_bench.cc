@@ -0,0 +1,381 @@
+// Load benchmark for the certificate Database implementations.
+//
+// For each database in --databases, fills a fresh database with --entries
+// logged entries, then runs --operations operations on each of --threads
+// threads, picking CreatePendingEntry, AssignSequenceNumber, LookupByHash,
+// LookupByIndex and WriteTreeHead at random with the given weights. Prints
+// one JSON object per line with the throughput, the latency percentiles
+// of each kind of operation and the bytes on disk per entry. Times are in
+// microseconds.
+//
+// The databases aren't thread-safe, so the threads take turns; latencies
+// are those of the database call, excluding the wait for the turn.
+#include <algorithm>
+#include <ftw.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <time.h>
+#include <vector>
+
+#include "log/database.h"
+#include "log/file_db.h"
+#include "log/file_storage.h"
+#include "log/leveldb_db.h"
+#include "log/logged_certificate.h"
+#include "log/sharded_db.h"
+#include "log/sqlite_db.h"
+#include "util/util.h"
+
+DEFINE_string(databases, "sqlite,file,leveldb,sharded",
+              "Comma-separated databases to benchmark: sqlite, file, "
+              "leveldb and sharded.");
+DEFINE_string(dir, "/tmp", "Directory to create the databases in. They are "
+              "removed afterwards.");
+DEFINE_int32(entries, 10000, "Number of logged entries to start with.");
+DEFINE_int32(operations, 10000, "Number of timed operations per thread.");
+DEFINE_int32(threads, 4, "Number of threads running operations.");
+DEFINE_int32(create_weight, 10, "Relative frequency of CreatePendingEntry.");
+DEFINE_int32(assign_weight, 10, "Relative frequency of AssignSequenceNumber. "
+             "Creates an entry instead if none is pending.");
+DEFINE_int32(lookup_hash_weight, 40, "Relative frequency of LookupByHash.");
+DEFINE_int32(lookup_index_weight, 40, "Relative frequency of LookupByIndex.");
+DEFINE_int32(write_tree_head_weight, 1,
+             "Relative frequency of WriteTreeHead.");
+DEFINE_int32(shard_size, 4096, "Entries per shard of the sharded database.");
+
+namespace {
+
+using ct::LoggedCertificate;
+using std::string;
+
+typedef Database<LoggedCertificate> DB;
+
+enum Operation {
+  CREATE,
+  ASSIGN,
+  LOOKUP_HASH,
+  LOOKUP_INDEX,
+  WRITE_TREE_HEAD,
+  NUM_OPERATIONS,
+};
+
+const char *kOperationNames[NUM_OPERATIONS] = {
+  "create_pending_entry_us",
+  "assign_sequence_number_us",
+  "lookup_by_hash_us",
+  "lookup_by_index_us",
+  "write_tree_head_us",
+};
+
+double NowInMicroseconds() {
+  struct timespec ts;
+  PCHECK(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Sum of the sizes of the files under a directory, for nftw().
+uint64_t disk_bytes;
+
+int AddFileSize(const char *path, const struct stat *st, int type,
+                struct FTW *ftw) {
+  if (type == FTW_F)
+    disk_bytes += st->st_size;
+  return 0;
+}
+
+uint64_t DiskBytes(const string &dir) {
+  disk_bytes = 0;
+  PCHECK(nftw(dir.c_str(), AddFileSize, 16, FTW_PHYS) == 0);
+  return disk_bytes;
+}
+
+DB *CreateDatabase(const string &type, const string &dir) {
+  if (type == "sqlite")
+    return new SQLiteDB<LoggedCertificate>(dir + "/sqlite");
+  if (type == "leveldb")
+    return new LevelDB<LoggedCertificate>(dir + "/leveldb");
+  if (type == "sharded") {
+    PCHECK(mkdir((dir + "/shards").c_str(), 0700) == 0);
+    return new ShardedDB<LoggedCertificate>(dir + "/shards",
+                                            FLAGS_shard_size);
+  }
+  CHECK_EQ("file", type) << "Unknown database";
+  PCHECK(mkdir((dir + "/certs").c_str(), 0700) == 0);
+  PCHECK(mkdir((dir + "/tree").c_str(), 0700) == 0);
+  return new FileDB<LoggedCertificate>(new FileStorage(dir + "/certs", 3),
+                                       new FileStorage(dir + "/tree", 8));
+}
+
+// What the threads share, under |lock|.
+struct Load {
+  explicit Load(DB *db) : db(db), last_timestamp(0) {
+    pthread_mutex_init(&lock, NULL);
+  }
+
+  ~Load() { pthread_mutex_destroy(&lock); }
+
+  // Run one operation. Returns false if there was nothing to do it on.
+  // Call with |lock| held.
+  bool Run(Operation op, const LoggedCertificate &new_entry,
+           double *elapsed);
+
+  DB *const db;
+  pthread_mutex_t lock;
+  std::vector<string> pending;
+  // By sequence number.
+  std::vector<string> logged;
+  uint64_t last_timestamp;
+};
+
+bool Load::Run(Operation op, const LoggedCertificate &new_entry,
+               double *elapsed) {
+  LoggedCertificate result;
+  double start;
+  switch (op) {
+    case CREATE:
+      start = NowInMicroseconds();
+      CHECK_EQ(DB::OK, db->CreatePendingEntry(new_entry));
+      *elapsed = NowInMicroseconds() - start;
+      pending.push_back(new_entry.Hash());
+      return true;
+    case ASSIGN:
+      if (pending.empty())
+        return false;
+      start = NowInMicroseconds();
+      CHECK_EQ(DB::OK, db->AssignSequenceNumber(pending.back(),
+                                                logged.size()));
+      *elapsed = NowInMicroseconds() - start;
+      logged.push_back(pending.back());
+      pending.pop_back();
+      return true;
+    case LOOKUP_HASH:
+      if (logged.empty())
+        return false;
+      start = NowInMicroseconds();
+      CHECK_EQ(DB::LOOKUP_OK,
+               db->LookupByHash(logged[random() % logged.size()], &result));
+      *elapsed = NowInMicroseconds() - start;
+      return true;
+    case LOOKUP_INDEX:
+      if (logged.empty())
+        return false;
+      start = NowInMicroseconds();
+      CHECK_EQ(DB::LOOKUP_OK,
+               db->LookupByIndex(random() % logged.size(), &result));
+      *elapsed = NowInMicroseconds() - start;
+      return true;
+    case WRITE_TREE_HEAD: {
+      // Timestamps must be unique.
+      ct::SignedTreeHead sth;
+      last_timestamp = std::max(util::TimeInMilliseconds(),
+                                last_timestamp + 1);
+      sth.set_timestamp(last_timestamp);
+      sth.set_tree_size(logged.size());
+      sth.set_sha256_root_hash(string(32, 'x'));
+      start = NowInMicroseconds();
+      CHECK_EQ(DB::OK, db->WriteTreeHead(sth));
+      *elapsed = NowInMicroseconds() - start;
+      return true;
+    }
+    default:
+      LOG(FATAL) << "Unknown operation " << op;
+  }
+  return false;
+}
+
+// Runs --operations operations on a Load, and keeps their latencies.
+struct Worker {
+  explicit Worker(Load *load) : load(load) {}
+
+  static void *Run(void *arg) {
+    static_cast<Worker*>(arg)->RunOperations();
+    return NULL;
+  }
+
+  void RunOperations();
+
+  Load *const load;
+  std::vector<double> latencies[NUM_OPERATIONS];
+};
+
+Operation RandomOperation() {
+  const int weights[NUM_OPERATIONS] = {
+    FLAGS_create_weight, FLAGS_assign_weight, FLAGS_lookup_hash_weight,
+    FLAGS_lookup_index_weight, FLAGS_write_tree_head_weight,
+  };
+  int total = 0;
+  for (int i = 0; i < NUM_OPERATIONS; ++i)
+    total += weights[i];
+  int pick = random() % total;
+  int op = 0;
+  while (pick >= weights[op])
+    pick -= weights[op++];
+  return static_cast<Operation>(op);
+}
+
+void Worker::RunOperations() {
+  for (int i = 0; i < FLAGS_operations; ++i) {
+    Operation op = RandomOperation();
+    // Make the entry before taking our turn; most operations don't need it,
+    // but then they all pay the same.
+    LoggedCertificate entry;
+    entry.RandomForTest();
+    double elapsed;
+    pthread_mutex_lock(&load->lock);
+    if (!load->Run(op, entry, &elapsed)) {
+      op = CREATE;
+      CHECK(load->Run(op, entry, &elapsed));
+    }
+    pthread_mutex_unlock(&load->lock);
+    latencies[op].push_back(elapsed);
+  }
+}
+
+// Append |"name": {"p50": ..., "p99": ..., "p999": ..., "max": ...}| for
+// |samples| to |out|, if there are any.
+void AppendPercentiles(const char *name, std::vector<double> *samples,
+                       string *out) {
+  if (samples->empty())
+    return;
+  std::sort(samples->begin(), samples->end());
+  const double percentiles[] = { 0.5, 0.99, 0.999 };
+  const char *names[] = { "p50", "p99", "p999" };
+  char buf[256];
+  snprintf(buf, sizeof(buf), ", \"%s\": {\"count\": %llu, ", name,
+           static_cast<unsigned long long>(samples->size()));
+  out->append(buf);
+  for (size_t i = 0; i < 3; ++i) {
+    size_t index = static_cast<size_t>(percentiles[i] * samples->size());
+    snprintf(buf, sizeof(buf), "\"%s\": %.3f, ", names[i],
+             (*samples)[std::min(index, samples->size() - 1)]);
+    out->append(buf);
+  }
+  snprintf(buf, sizeof(buf), "\"max\": %.3f}", samples->back());
+  out->append(buf);
+}
+
+void AppendCount(const char *name, uint64_t value, string *out) {
+  char buf[256];
+  snprintf(buf, sizeof(buf), ", \"%s\": %llu", name,
+           static_cast<unsigned long long>(value));
+  out->append(buf);
+}
+
+void AppendNumber(const char *name, double value, string *out) {
+  char buf[256];
+  snprintf(buf, sizeof(buf), ", \"%s\": %.3f", name, value);
+  out->append(buf);
+}
+
+// Create and log |count| entries, in transactions of up to 1000 if the
+// database has them.
+void Fill(Load *load, int count) {
+  const int kBatchSize = 1000;
+  for (int done = 0; done < count; ) {
+    const int batch = std::min(kBatchSize, count - done);
+    if (load->db->Transactional())
+      load->db->BeginTransaction();
+    std::vector<string> hashes;
+    for (int i = 0; i < batch; ++i) {
+      LoggedCertificate entry;
+      entry.RandomForTest();
+      CHECK_EQ(DB::OK, load->db->CreatePendingEntry(entry));
+      hashes.push_back(entry.Hash());
+    }
+    size_t assigned;
+    CHECK_EQ(DB::OK, load->db->AssignSequenceNumbers(
+        hashes, load->logged.size(), &assigned));
+    CHECK_EQ(hashes.size(), assigned);
+    load->logged.insert(load->logged.end(), hashes.begin(), hashes.end());
+    if (load->db->Transactional())
+      load->db->EndTransaction();
+    done += batch;
+  }
+}
+
+void Benchmark(const string &type) {
+  const string dir = util::CreateTemporaryDirectory(FLAGS_dir +
+                                                    "/dbbenchXXXXXX");
+  CHECK(!dir.empty()) << "Failed to create a directory in " << FLAGS_dir;
+  DB *db = CreateDatabase(type, dir);
+  Load load(db);
+  Fill(&load, FLAGS_entries);
+
+  std::vector<Worker*> workers;
+  std::vector<pthread_t> threads(FLAGS_threads);
+  double start = NowInMicroseconds();
+  for (int i = 0; i < FLAGS_threads; ++i) {
+    workers.push_back(new Worker(&load));
+    CHECK_EQ(0, pthread_create(&threads[i], NULL, Worker::Run, workers[i]));
+  }
+  for (int i = 0; i < FLAGS_threads; ++i)
+    CHECK_EQ(0, pthread_join(threads[i], NULL));
+  double elapsed = NowInMicroseconds() - start;
+
+  const size_t entries = load.logged.size() + load.pending.size();
+  delete db;
+  const uint64_t bytes = DiskBytes(dir);
+
+  string out = "{\"database\": \"" + type + "\"";
+  AppendCount("entries", entries, &out);
+  AppendCount("threads", FLAGS_threads, &out);
+  AppendNumber("ops_per_sec",
+               FLAGS_threads * FLAGS_operations / (elapsed / 1e6), &out);
+  AppendNumber("disk_bytes_per_entry", static_cast<double>(bytes) / entries,
+               &out);
+  for (int op = 0; op < NUM_OPERATIONS; ++op) {
+    std::vector<double> samples;
+    for (size_t i = 0; i < workers.size(); ++i)
+      samples.insert(samples.end(), workers[i]->latencies[op].begin(),
+                     workers[i]->latencies[op].end());
+    AppendPercentiles(kOperationNames[op], &samples, &out);
+  }
+  out.append("}");
+  printf("%s\n", out.c_str());
+  fflush(stdout);
+
+  for (size_t i = 0; i < workers.size(); ++i)
+    delete workers[i];
+  const string command = "rm -r " + dir;
+  CHECK_EQ(0, system(command.c_str())) << "Failed to remove " << dir;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  google::SetUsageMessage("Benchmark the certificate databases.");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_GE(FLAGS_entries, 0);
+  CHECK_GT(FLAGS_operations, 0);
+  CHECK_GT(FLAGS_threads, 0);
+  CHECK_GT(FLAGS_shard_size, 0);
+  CHECK_GE(FLAGS_create_weight, 0);
+  CHECK_GE(FLAGS_assign_weight, 0);
+  CHECK_GE(FLAGS_lookup_hash_weight, 0);
+  CHECK_GE(FLAGS_lookup_index_weight, 0);
+  CHECK_GE(FLAGS_write_tree_head_weight, 0);
+  CHECK_GT(FLAGS_create_weight + FLAGS_assign_weight +
+           FLAGS_lookup_hash_weight + FLAGS_lookup_index_weight +
+           FLAGS_write_tree_head_weight, 0);
+  srandom(1);
+
+  std::vector<string> types;
+  size_t start = 0;
+  for (;;) {
+    const size_t comma = FLAGS_databases.find(',', start);
+    types.push_back(FLAGS_databases.substr(start, comma - start));
+    if (comma == string::npos)
+      break;
+    start = comma + 1;
+  }
+  for (size_t i = 0; i < types.size(); ++i)
+    Benchmark(types[i]);
+  return 0;
+}
@@ -10,7 +10,9 @@
 #include "log/database.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
+#include "log/leveldb_db.h"
 #include "log/logged_certificate.h"
+#include "log/sharded_db.h"
 #include "log/sqlite_db.h"
 #include "log/test_db.h"
 #include "log/test_signer.h"
@@ -64,7 +66,9 @@ template <class T> class LargeDBTest : public ::testing::Test {
 };
 
 typedef testing::Types<FileDB<LoggedCertificate>,
-                       SQLiteDB<LoggedCertificate> > Databases;
+                       SQLiteDB<LoggedCertificate>,
+                       LevelDB<LoggedCertificate>,
+                       ShardedDB<LoggedCertificate> > Databases;
 
 TYPED_TEST_CASE(LargeDBTest, Databases);
 
@@ -1,15 +1,34 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <algorithm>
 #include <gtest/gtest.h>
+#include <limits>
+#include <pthread.h>
 #include <set>
+#include <stdint.h>
 #include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
 
+#include "log/archive_segment.h"
+#include "log/archiving_db.h"
+#include "log/caching_db.h"
 #include "log/database.h"
+#include "log/entry_compressor.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
+#include "log/instrumented_db.h"
+#include "log/interning_db.h"
+#include "log/leveldb_db.h"
+#include "log/locking_db.h"
 #include "log/logged_certificate.h"
+#include "log/sharded_db.h"
 #include "log/sqlite_db.h"
 #include "log/test_db.h"
 #include "log/test_signer.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
+#include "util/metrics.h"
 #include "util/testing.h"
 #include "util/util.h"
 
@@ -36,10 +55,67 @@ template <class T> class DBTest : public ::testing::Test {
 };
 
 typedef testing::Types<FileDB<ct::LoggedCertificate>,
-                       SQLiteDB<ct::LoggedCertificate> > Databases;
+                       SQLiteDB<ct::LoggedCertificate>,
+                       LevelDB<ct::LoggedCertificate>,
+                       CachingDatabase<ct::LoggedCertificate>,
+                       ShardedDB<ct::LoggedCertificate>,
+                       InterningDatabase,
+                       InstrumentedDatabase<ct::LoggedCertificate>,
+                       LockingDatabase<ct::LoggedCertificate>,
+                       ArchivingDatabase<ct::LoggedCertificate> > Databases;
 
 typedef Database<ct::LoggedCertificate> DB;
 
+// Collects the entries of a range lookup, up to |limit| of them.
+class EntryCollector : public DB::EntryCallback {
+ public:
+  explicit EntryCollector(size_t limit) : limit_(limit) {}
+
+  virtual bool Entry(const LoggedCertificate &logged) {
+    entries_.push_back(logged);
+    return entries_.size() < limit_;
+  }
+
+  const std::vector<LoggedCertificate> &entries() const { return entries_; }
+
+ private:
+  const size_t limit_;
+  std::vector<LoggedCertificate> entries_;
+};
+
+// Collects the tree heads of a range lookup, up to |limit| of them.
+class TreeHeadCollector : public DB::TreeHeadCallback {
+ public:
+  explicit TreeHeadCollector(size_t limit) : limit_(limit) {}
+
+  virtual bool TreeHead(const SignedTreeHead &sth) {
+    tree_heads_.push_back(sth);
+    return tree_heads_.size() < limit_;
+  }
+
+  const std::vector<SignedTreeHead> &tree_heads() const { return tree_heads_; }
+
+ private:
+  const size_t limit_;
+  std::vector<SignedTreeHead> tree_heads_;
+};
+
+// Write tree heads of sizes 0, 10, 10, 20, 30, ... at timestamps
+// |base|, |base| + 100, ... to |db|, and return them in |tree_heads|.
+void WriteTreeHeads(TestSigner *signer, DB *db, uint64_t base, size_t count,
+                    std::vector<SignedTreeHead> *tree_heads) {
+  for (size_t i = 0; i < count; ++i) {
+    SignedTreeHead sth;
+    signer->CreateUnique(&sth);
+    sth.set_timestamp(base + 100 * i);
+    sth.set_tree_size(i < 2 ? 10 * i : 10 * (i - 1));
+    tree_heads->push_back(sth);
+  }
+  // Out of order, to check that lookups don't depend on the write order.
+  for (size_t i = count; i > 0; --i)
+    EXPECT_EQ(DB::OK, db->WriteTreeHead((*tree_heads)[i - 1]));
+}
+
 TYPED_TEST_CASE(DBTest, Databases);
 
 TYPED_TEST(DBTest, CreatePending) {
@@ -62,6 +138,42 @@ TYPED_TEST(DBTest, CreatePending) {
                                      &lookup_cert));
 }
 
+// Entries written before and after turning on compression both read back.
+TYPED_TEST(DBTest, Compression) {
+  std::vector<LoggedCertificate> logged(4);
+  std::vector<string> samples;
+  for (size_t i = 0; i < logged.size(); ++i) {
+    this->test_signer_.CreateUnique(&logged[i]);
+    samples.push_back(string());
+    CHECK(logged[i].SerializeForDatabase(&samples.back()));
+  }
+  EntryCompressor compressor(
+      EntryCompressor::TrainDictionary(samples, 1024));
+
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged[0]));
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged[1]));
+  this->db()->SetCompressor(&compressor);
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged[2]));
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged[3]));
+  EXPECT_EQ(DB::OK, this->db()->AssignSequenceNumber(logged[1].Hash(), 0));
+  EXPECT_EQ(DB::OK, this->db()->AssignSequenceNumber(logged[2].Hash(), 1));
+  logged[1].set_sequence_number(0);
+  logged[2].set_sequence_number(1);
+
+  LoggedCertificate lookup_cert;
+  for (size_t i = 0; i < logged.size(); ++i) {
+    EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupByHash(logged[i].Hash(),
+                                                      &lookup_cert));
+    TestSigner::TestEqualLoggedCerts(logged[i], lookup_cert);
+  }
+  EntryCollector entries(2);
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupByIndexRange(0, 2, &entries));
+  ASSERT_EQ(2U, entries.entries().size());
+  TestSigner::TestEqualLoggedCerts(logged[1], entries.entries()[0]);
+  TestSigner::TestEqualLoggedCerts(logged[2], entries.entries()[1]);
+  EXPECT_EQ(2U, this->db()->PendingHashes().size());
+}
+
 TYPED_TEST(DBTest, GetPendingHashes) {
   LoggedCertificate logged_cert, logged_cert2;
   this->test_signer_.CreateUnique(&logged_cert);
@@ -98,6 +210,41 @@ TYPED_TEST(DBTest, CreatePendingDuplicate) {
   TestSigner::TestEqualLoggedCerts(logged_cert, lookup_cert);
 }
 
+TYPED_TEST(DBTest, LookupPendingEntries) {
+  std::vector<LoggedCertificate> logged_certs(4);
+  for (size_t i = 0; i < logged_certs.size(); ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    logged_certs[i].mutable_sct()->set_timestamp(1000 + i);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_certs[i]));
+  }
+
+  EntryCollector all(100);
+  this->db()->LookupPendingEntries(0, &all);
+  ASSERT_EQ(4U, all.entries().size());
+  for (size_t i = 0; i < logged_certs.size(); ++i)
+    TestSigner::TestEqualLoggedCerts(logged_certs[i], all.entries()[i]);
+
+  EntryCollector capped(100);
+  this->db()->LookupPendingEntries(2, &capped);
+  ASSERT_EQ(2U, capped.entries().size());
+  TestSigner::TestEqualLoggedCerts(logged_certs[1], capped.entries()[1]);
+
+  EntryCollector stopped(1);
+  this->db()->LookupPendingEntries(0, &stopped);
+  ASSERT_EQ(1U, stopped.entries().size());
+
+  // Logged entries are no longer pending, also after a restart.
+  EXPECT_EQ(DB::OK, this->db()->AssignSequenceNumber(logged_certs[0].Hash(),
+                                                     0));
+  Database<ct::LoggedCertificate> *db2 = this->test_db_.SecondDB();
+  EntryCollector rest(100);
+  db2->LookupPendingEntries(0, &rest);
+  ASSERT_EQ(3U, rest.entries().size());
+  for (size_t i = 0; i < 3; ++i)
+    TestSigner::TestEqualLoggedCerts(logged_certs[i + 1], rest.entries()[i]);
+  delete db2;
+}
+
 TYPED_TEST(DBTest, AssignSequenceNumber) {
   LoggedCertificate logged_cert, lookup_cert;
   this->test_signer_.CreateUnique(&logged_cert);
@@ -138,6 +285,78 @@ TYPED_TEST(DBTest, AssignSequenceNumberTwice) {
             this->db()->AssignSequenceNumber(logged_cert2.Hash(), 42));
 }
 
+TYPED_TEST(DBTest, AssignSequenceNumbers) {
+  std::vector<LoggedCertificate> logged_certs(3);
+  std::vector<string> hashes;
+  for (size_t i = 0; i < logged_certs.size(); ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_certs[i]));
+    hashes.push_back(logged_certs[i].Hash());
+  }
+
+  size_t assigned = 42;
+  EXPECT_EQ(DB::OK, this->db()->AssignSequenceNumbers(hashes, 5, &assigned));
+  EXPECT_EQ(3U, assigned);
+  EXPECT_TRUE(this->db()->PendingHashes().empty());
+
+  for (size_t i = 0; i < logged_certs.size(); ++i) {
+    LoggedCertificate lookup_cert;
+    EXPECT_EQ(DB::LOOKUP_OK,
+              this->db()->LookupByIndex(5 + i, &lookup_cert));
+    EXPECT_EQ(5 + i, lookup_cert.sequence_number());
+    lookup_cert.clear_sequence_number();
+    TestSigner::TestEqualLoggedCerts(logged_certs[i], lookup_cert);
+  }
+
+  std::vector<string> leaf_hashes;
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupLeafHashRange(5, 8, &leaf_hashes));
+  EXPECT_EQ(3U, leaf_hashes.size());
+
+  assigned = 42;
+  EXPECT_EQ(DB::OK, this->db()->AssignSequenceNumbers(std::vector<string>(),
+                                                      8, &assigned));
+  EXPECT_EQ(0U, assigned);
+}
+
+TYPED_TEST(DBTest, AssignSequenceNumbersStopsAtFailure) {
+  LoggedCertificate logged_cert, logged_cert2, logged_cert3, lookup_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  this->test_signer_.CreateUnique(&logged_cert2);
+  this->test_signer_.CreateUnique(&logged_cert3);
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert2));
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert3));
+  EXPECT_EQ(DB::OK, this->db()->AssignSequenceNumber(logged_cert3.Hash(), 1));
+
+  // The second entry would get a sequence number that is in use.
+  std::vector<string> hashes;
+  hashes.push_back(logged_cert.Hash());
+  hashes.push_back(logged_cert2.Hash());
+  size_t assigned = 42;
+  EXPECT_EQ(DB::SEQUENCE_NUMBER_ALREADY_IN_USE,
+            this->db()->AssignSequenceNumbers(hashes, 0, &assigned));
+  EXPECT_EQ(1U, assigned);
+
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupByIndex(0, &lookup_cert));
+  EXPECT_EQ(logged_cert.Hash(), lookup_cert.Hash());
+  std::set<string> pending = this->db()->PendingHashes();
+  EXPECT_EQ(1U, pending.size());
+  EXPECT_EQ(1U, pending.count(logged_cert2.Hash()));
+
+  // A hash that is repeated in the batch, or is already logged.
+  hashes.clear();
+  hashes.push_back(logged_cert2.Hash());
+  hashes.push_back(logged_cert2.Hash());
+  EXPECT_EQ(DB::ENTRY_ALREADY_LOGGED,
+            this->db()->AssignSequenceNumbers(hashes, 2, &assigned));
+  EXPECT_EQ(1U, assigned);
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupByIndex(2, &lookup_cert));
+  EXPECT_EQ(logged_cert2.Hash(), lookup_cert.Hash());
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupByIndex(3, &lookup_cert));
+  EXPECT_TRUE(this->db()->PendingHashes().empty());
+}
+
 TYPED_TEST(DBTest, LookupBySequenceNumber) {
   LoggedCertificate logged_cert, logged_cert2, lookup_cert, lookup_cert2;
   this->test_signer_.CreateUnique(&logged_cert);
@@ -163,6 +382,118 @@ TYPED_TEST(DBTest, LookupBySequenceNumber) {
   TestSigner::TestEqualLoggedCerts(logged_cert2, lookup_cert2);
 }
 
+TYPED_TEST(DBTest, LookupByIndexRange) {
+  std::vector<LoggedCertificate> logged_certs(4);
+  for (uint64_t i = 0; i < logged_certs.size(); ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_certs[i]));
+    EXPECT_EQ(DB::OK, this->db()->AssignSequenceNumber(logged_certs[i].Hash(),
+                                                       10 + i));
+    logged_certs[i].set_sequence_number(10 + i);
+  }
+
+  EntryCollector all(100);
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupByIndexRange(11, 14, &all));
+  ASSERT_EQ(3U, all.entries().size());
+  for (size_t i = 0; i < 3; ++i)
+    TestSigner::TestEqualLoggedCerts(logged_certs[i + 1], all.entries()[i]);
+
+  EntryCollector empty(100);
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupByIndexRange(12, 12, &empty));
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupByIndexRange(9, 12, &empty));
+  EXPECT_TRUE(empty.entries().empty());
+
+  // Entries up to the end of the log are passed on.
+  EntryCollector tail(100);
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupByIndexRange(12, 20, &tail));
+  ASSERT_EQ(2U, tail.entries().size());
+  TestSigner::TestEqualLoggedCerts(logged_certs[3], tail.entries()[1]);
+
+  EntryCollector stopped(2);
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupByIndexRange(10, 20, &stopped));
+  ASSERT_EQ(2U, stopped.entries().size());
+  TestSigner::TestEqualLoggedCerts(logged_certs[1], stopped.entries()[1]);
+}
+
+TYPED_TEST(DBTest, LookupLeafHashRange) {
+  TreeHasher hasher(new Sha256Hasher);
+  std::vector<string> expected;
+  for (uint64_t i = 0; i < 4; ++i) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+    EXPECT_EQ(DB::OK, this->db()->AssignSequenceNumber(logged_cert.Hash(),
+                                                       10 + i));
+    string leaf;
+    ASSERT_TRUE(logged_cert.SerializeForLeaf(&leaf));
+    expected.push_back(hasher.HashLeaf(leaf));
+  }
+  // A pending entry's hash is never returned.
+  LoggedCertificate pending_cert;
+  this->test_signer_.CreateUnique(&pending_cert);
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(pending_cert));
+
+  std::vector<string> hashes(1, "unrelated");
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupLeafHashRange(11, 13, &hashes));
+  ASSERT_EQ(3U, hashes.size());
+  EXPECT_EQ("unrelated", hashes[0]);
+  EXPECT_EQ(expected[1], hashes[1]);
+  EXPECT_EQ(expected[2], hashes[2]);
+
+  hashes.clear();
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupLeafHashRange(12, 12, &hashes));
+  EXPECT_TRUE(hashes.empty());
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupLeafHashRange(9, 12, &hashes));
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupLeafHashRange(12, 15, &hashes));
+  EXPECT_TRUE(hashes.empty());
+
+  // The hashes survive a restart.
+  Database<ct::LoggedCertificate> *db2 = this->test_db_.SecondDB();
+  EXPECT_EQ(DB::LOOKUP_OK, db2->LookupLeafHashRange(10, 14, &hashes));
+  EXPECT_EQ(expected, hashes);
+  delete db2;
+}
+
+TYPED_TEST(DBTest, LookupEntryHashRange) {
+  std::vector<string> expected;
+  for (uint64_t i = 0; i < 4; ++i) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+    EXPECT_EQ(DB::OK, this->db()->AssignSequenceNumber(logged_cert.Hash(),
+                                                       10 + i));
+    expected.push_back(logged_cert.Hash());
+  }
+  LoggedCertificate pending_cert;
+  this->test_signer_.CreateUnique(&pending_cert);
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(pending_cert));
+
+  std::vector<string> hashes(1, "unrelated");
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupEntryHashRange(11, 13, &hashes));
+  ASSERT_EQ(3U, hashes.size());
+  EXPECT_EQ("unrelated", hashes[0]);
+  EXPECT_EQ(expected[1], hashes[1]);
+  EXPECT_EQ(expected[2], hashes[2]);
+
+  hashes.clear();
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupEntryHashRange(12, 12, &hashes));
+  EXPECT_TRUE(hashes.empty());
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupEntryHashRange(9, 12, &hashes));
+  EXPECT_TRUE(hashes.empty());
+  // Up to the end of the log.
+  EXPECT_EQ(DB::NOT_FOUND,
+            this->db()->LookupEntryHashRange(
+                12, std::numeric_limits<uint64_t>::max(), &hashes));
+  ASSERT_EQ(2U, hashes.size());
+  EXPECT_EQ(expected[3], hashes[1]);
+
+  Database<ct::LoggedCertificate> *db2 = this->test_db_.SecondDB();
+  hashes.clear();
+  EXPECT_EQ(DB::LOOKUP_OK, db2->LookupEntryHashRange(10, 14, &hashes));
+  EXPECT_EQ(expected, hashes);
+  delete db2;
+}
+
 TYPED_TEST(DBTest, WriteTreeHead) {
   SignedTreeHead sth, lookup_sth;
   this->test_signer_.CreateUnique(&sth);
@@ -215,6 +546,92 @@ TYPED_TEST(DBTest, WriteTreeHeadOlderTimestamp) {
   TestSigner::TestEqualTreeHeads(sth, lookup_sth);
 }
 
+TYPED_TEST(DBTest, LookupTreeHeadByTimestamp) {
+  std::vector<SignedTreeHead> sths;
+  WriteTreeHeads(&this->test_signer_, this->db(), 1000, 5, &sths);
+
+  SignedTreeHead lookup_sth;
+  for (size_t i = 0; i < sths.size(); ++i) {
+    EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupTreeHeadByTimestamp(
+        sths[i].timestamp(), &lookup_sth));
+    TestSigner::TestEqualTreeHeads(sths[i], lookup_sth);
+  }
+  EXPECT_EQ(DB::NOT_FOUND,
+            this->db()->LookupTreeHeadByTimestamp(1050, &lookup_sth));
+  EXPECT_EQ(DB::NOT_FOUND,
+            this->db()->LookupTreeHeadByTimestamp(999, &lookup_sth));
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupTreeHeadByTimestamp(
+      std::numeric_limits<uint64_t>::max(), &lookup_sth));
+}
+
+TYPED_TEST(DBTest, LookupTreeHeadBySize) {
+  SignedTreeHead lookup_sth;
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupTreeHeadBySize(0, &lookup_sth));
+
+  std::vector<SignedTreeHead> sths;
+  WriteTreeHeads(&this->test_signer_, this->db(), 1000, 5, &sths);
+
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupTreeHeadBySize(0, &lookup_sth));
+  TestSigner::TestEqualTreeHeads(sths[0], lookup_sth);
+  // The freshest of the two.
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupTreeHeadBySize(10, &lookup_sth));
+  TestSigner::TestEqualTreeHeads(sths[2], lookup_sth);
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupTreeHeadBySize(30, &lookup_sth));
+  TestSigner::TestEqualTreeHeads(sths[4], lookup_sth);
+
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupTreeHeadBySize(15, &lookup_sth));
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupTreeHeadBySize(40, &lookup_sth));
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupTreeHeadBySize(
+      std::numeric_limits<uint64_t>::max(), &lookup_sth));
+}
+
+TYPED_TEST(DBTest, LookupTreeHeadRange) {
+  std::vector<SignedTreeHead> sths;
+  WriteTreeHeads(&this->test_signer_, this->db(), 1000, 5, &sths);
+
+  TreeHeadCollector all(100);
+  this->db()->LookupTreeHeadRange(0, std::numeric_limits<uint64_t>::max(),
+                                  &all);
+  ASSERT_EQ(sths.size(), all.tree_heads().size());
+  for (size_t i = 0; i < sths.size(); ++i)
+    TestSigner::TestEqualTreeHeads(sths[i], all.tree_heads()[i]);
+
+  // The end is exclusive.
+  TreeHeadCollector some(100);
+  this->db()->LookupTreeHeadRange(1050, 1300, &some);
+  ASSERT_EQ(2U, some.tree_heads().size());
+  TestSigner::TestEqualTreeHeads(sths[1], some.tree_heads()[0]);
+  TestSigner::TestEqualTreeHeads(sths[2], some.tree_heads()[1]);
+
+  TreeHeadCollector first(1);
+  this->db()->LookupTreeHeadRange(1100, 2000, &first);
+  ASSERT_EQ(1U, first.tree_heads().size());
+  TestSigner::TestEqualTreeHeads(sths[1], first.tree_heads()[0]);
+
+  TreeHeadCollector none(100);
+  this->db()->LookupTreeHeadRange(1300, 1300, &none);
+  this->db()->LookupTreeHeadRange(1401, 2000, &none);
+  EXPECT_TRUE(none.tree_heads().empty());
+}
+
+TYPED_TEST(DBTest, ResumeTreeHeadLookups) {
+  std::vector<SignedTreeHead> sths;
+  WriteTreeHeads(&this->test_signer_, this->db(), 1000, 5, &sths);
+
+  DB *db2 = this->test_db_.SecondDB();
+  SignedTreeHead lookup_sth;
+  EXPECT_EQ(DB::LOOKUP_OK, db2->LookupTreeHeadByTimestamp(1300, &lookup_sth));
+  TestSigner::TestEqualTreeHeads(sths[3], lookup_sth);
+  EXPECT_EQ(DB::LOOKUP_OK, db2->LookupTreeHeadBySize(10, &lookup_sth));
+  TestSigner::TestEqualTreeHeads(sths[2], lookup_sth);
+
+  TreeHeadCollector all(100);
+  db2->LookupTreeHeadRange(0, std::numeric_limits<uint64_t>::max(), &all);
+  EXPECT_EQ(sths.size(), all.tree_heads().size());
+
+  delete db2;
+}
+
 TYPED_TEST(DBTest, Resume) {
   LoggedCertificate logged_cert, logged_cert2, lookup_cert, lookup_cert2;
   this->test_signer_.CreateUnique(&logged_cert);
@@ -268,6 +685,965 @@ TYPED_TEST(DBTest, ResumeEmpty) {
   delete db2;
 }
 
+// FileDB with an index file, on its own disk state.
+class FileDBIndexTest : public ::testing::Test {
+ protected:
+  FileDBIndexTest()
+      : tmp_(),
+        index_file_(tmp_.TmpStorageDir() + "/index"),
+        next_sequence_number_(0) {
+    CHECK_ERR(mkdir(CertsDir().c_str(), 0700));
+    CHECK_ERR(mkdir(TreeDir().c_str(), 0700));
+  }
+
+  string CertsDir() const { return tmp_.TmpStorageDir() + "/certs"; }
+
+  string TreeDir() const { return tmp_.TmpStorageDir() + "/tree"; }
+
+  // Caller owns the result. An empty |index_file| means none.
+  FileDB<LoggedCertificate> *OpenDB(const string &index_file) const {
+    return new FileDB<LoggedCertificate>(
+        new FileStorage(CertsDir(), kCertStorageDepth),
+        new FileStorage(TreeDir(), kTreeStorageDepth), index_file);
+  }
+
+  void CreatePending(DB *db, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      LoggedCertificate logged_cert;
+      test_signer_.CreateUnique(&logged_cert);
+      ASSERT_EQ(DB::OK, db->CreatePendingEntry(logged_cert));
+    }
+  }
+
+  // Log |count| of the pending entries.
+  void LogPending(DB *db, size_t count) {
+    std::set<string> pending = db->PendingHashes();
+    ASSERT_LE(count, pending.size());
+    std::vector<string> hashes(pending.begin(), pending.end());
+    hashes.resize(count);
+    size_t assigned;
+    ASSERT_EQ(DB::OK, db->AssignSequenceNumbers(hashes, next_sequence_number_,
+                                                &assigned));
+    next_sequence_number_ += assigned;
+  }
+
+  // Check that |db| sees the same entries as a FileDB that reads them all.
+  void ExpectSameEntries(const DB *db) const {
+    FileDB<LoggedCertificate> *reference = OpenDB("");
+    EXPECT_EQ(reference->PendingHashes(), db->PendingHashes());
+    std::vector<string> hashes, reference_hashes;
+    EXPECT_EQ(DB::LOOKUP_OK, reference->LookupLeafHashRange(
+        0, next_sequence_number_, &reference_hashes));
+    EXPECT_EQ(DB::LOOKUP_OK,
+              db->LookupLeafHashRange(0, next_sequence_number_, &hashes));
+    EXPECT_EQ(reference_hashes, hashes);
+    LoggedCertificate lookup_cert;
+    EXPECT_EQ(DB::NOT_FOUND,
+              db->LookupByIndex(next_sequence_number_, &lookup_cert));
+    delete reference;
+  }
+
+  TmpStorage tmp_;
+  const string index_file_;
+  TestSigner test_signer_;
+  uint64_t next_sequence_number_;
+};
+
+TEST_F(FileDBIndexTest, Resume) {
+  FileDB<LoggedCertificate> *db = OpenDB(index_file_);
+  CreatePending(db, 10);
+  LogPending(db, 4);
+  CreatePending(db, 5);
+  LogPending(db, 5);
+  delete db;
+
+  db = OpenDB(index_file_);
+  EXPECT_EQ(6U, db->PendingHashes().size());
+  ExpectSameEntries(db);
+  CreatePending(db, 3);
+  LogPending(db, 1);
+  ExpectSameEntries(db);
+  delete db;
+}
+
+TEST_F(FileDBIndexTest, Rebuild) {
+  FileDB<LoggedCertificate> *db = OpenDB("");
+  CreatePending(db, 20);
+  LogPending(db, 7);
+  delete db;
+
+  // The index is written from the entries on first use.
+  db = OpenDB(index_file_);
+  ExpectSameEntries(db);
+  delete db;
+  string index;
+  EXPECT_TRUE(util::ReadBinaryFile(index_file_, &index));
+  EXPECT_FALSE(index.empty());
+
+  db = OpenDB(index_file_);
+  ExpectSameEntries(db);
+  delete db;
+}
+
+TEST_F(FileDBIndexTest, CatchUp) {
+  FileDB<LoggedCertificate> *db = OpenDB(index_file_);
+  CreatePending(db, 6);
+  LogPending(db, 2);
+  delete db;
+
+  // Entries logged without updating the index are found.
+  db = OpenDB("");
+  LogPending(db, 3);
+  delete db;
+
+  // So is a partially written record.
+  string index;
+  EXPECT_TRUE(util::ReadBinaryFile(index_file_, &index));
+  FILE *file = fopen(index_file_.c_str(), "a");
+  ASSERT_TRUE(file != NULL);
+  fwrite(index.data(), 1, 10, file);
+  fclose(file);
+
+  db = OpenDB(index_file_);
+  EXPECT_EQ(1U, db->PendingHashes().size());
+  ExpectSameEntries(db);
+  delete db;
+  string index2;
+  EXPECT_TRUE(util::ReadBinaryFile(index_file_, &index2));
+  EXPECT_GT(index2.size(), index.size());
+}
+
+// Entries written while the database was opened without the index file
+// are added to it.
+TEST_F(FileDBIndexTest, Unindexed) {
+  FileDB<LoggedCertificate> *db = OpenDB(index_file_);
+  CreatePending(db, 3);
+  LogPending(db, 1);
+  delete db;
+
+  db = OpenDB("");
+  CreatePending(db, 4);
+  LogPending(db, 3);
+  CreatePending(db, 1);
+  delete db;
+
+  db = OpenDB(index_file_);
+  EXPECT_EQ(4U, db->PendingHashes().size());
+  ExpectSameEntries(db);
+  delete db;
+
+  // From the index this time.
+  db = OpenDB(index_file_);
+  ExpectSameEntries(db);
+  delete db;
+}
+
+// So are entries dropped without it, by reading them all.
+TEST_F(FileDBIndexTest, DroppedWithoutIndex) {
+  FileDB<LoggedCertificate> *db = OpenDB(index_file_);
+  CreatePending(db, 5);
+  LogPending(db, 4);
+  delete db;
+
+  db = OpenDB("");
+  EXPECT_TRUE(db->DropLoggedEntries(2));
+  delete db;
+
+  db = OpenDB(index_file_);
+  EXPECT_EQ(1U, db->PendingHashes().size());
+  LoggedCertificate lookup_cert;
+  EXPECT_EQ(DB::NOT_FOUND, db->LookupByIndex(1, &lookup_cert));
+  EXPECT_EQ(DB::LOOKUP_OK, db->LookupByIndex(2, &lookup_cert));
+  std::vector<string> hashes;
+  EXPECT_EQ(DB::LOOKUP_OK, db->LookupLeafHashRange(2, 4, &hashes));
+  EXPECT_EQ(2U, hashes.size());
+  delete db;
+}
+
+// A corrupt index is rewritten from the entries.
+TEST_F(FileDBIndexTest, Corrupt) {
+  FileDB<LoggedCertificate> *db = OpenDB(index_file_);
+  CreatePending(db, 6);
+  LogPending(db, 2);
+  delete db;
+
+  FILE *file = fopen(index_file_.c_str(), "r+");
+  ASSERT_TRUE(file != NULL);
+  fputc('?', file);
+  fclose(file);
+
+  db = OpenDB(index_file_);
+  EXPECT_EQ(4U, db->PendingHashes().size());
+  ExpectSameEntries(db);
+  delete db;
+  string index;
+  EXPECT_TRUE(util::ReadBinaryFile(index_file_, &index));
+  ASSERT_FALSE(index.empty());
+  EXPECT_NE('?', index[0]);
+}
+
+class CachingDBTest : public ::testing::Test {
+ protected:
+  typedef CachingDatabase<LoggedCertificate> CachingDB;
+
+  CachingDBTest() : test_db_(), test_signer_() {}
+
+  CachingDB *db() const { return test_db_.db(); }
+
+  CachingDB::CacheStats Stats() const {
+    CachingDB::CacheStats stats;
+    db()->GetStats(&stats);
+    return stats;
+  }
+
+  // Create and log |count| entries, with sequence numbers from 0.
+  void LogEntries(size_t count, std::vector<LoggedCertificate> *logged) {
+    for (size_t i = 0; i < count; ++i) {
+      LoggedCertificate logged_cert;
+      test_signer_.CreateUnique(&logged_cert);
+      ASSERT_EQ(DB::OK, db()->CreatePendingEntry(logged_cert));
+      ASSERT_EQ(DB::OK, db()->AssignSequenceNumber(logged_cert.Hash(), i));
+      logged_cert.set_sequence_number(i);
+      logged->push_back(logged_cert);
+    }
+  }
+
+  TestDB<CachingDB> test_db_;
+  TestSigner test_signer_;
+};
+
+TEST_F(CachingDBTest, LookupByHash) {
+  LoggedCertificate logged_cert, lookup_cert;
+  test_signer_.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::NOT_FOUND, db()->LookupByHash(logged_cert.Hash(),
+                                              &lookup_cert));
+  EXPECT_EQ(DB::OK, db()->CreatePendingEntry(logged_cert));
+
+  // Failed lookups are not cached.
+  EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByHash(logged_cert.Hash(),
+                                              &lookup_cert));
+  EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByHash(logged_cert.Hash(),
+                                              &lookup_cert));
+  TestSigner::TestEqualLoggedCerts(logged_cert, lookup_cert);
+  EXPECT_EQ(1U, Stats().hash_hits);
+  EXPECT_EQ(2U, Stats().hash_misses);
+
+  // The pending entry is dropped once it is logged.
+  EXPECT_EQ(DB::OK, db()->AssignSequenceNumber(logged_cert.Hash(), 42));
+  EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByHash(logged_cert.Hash(),
+                                              &lookup_cert));
+  EXPECT_EQ(3U, Stats().hash_misses);
+  EXPECT_EQ(42U, lookup_cert.sequence_number());
+  EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByHash(logged_cert.Hash()));
+  EXPECT_EQ(2U, Stats().hash_hits);
+}
+
+TEST_F(CachingDBTest, ExportStats) {
+  LoggedCertificate logged_cert;
+  test_signer_.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::OK, db()->CreatePendingEntry(logged_cert));
+  EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByHash(logged_cert.Hash()));
+
+  util::Metrics metrics;
+  db()->ExportStats(&metrics);
+  EXPECT_EQ(0, metrics.Value("ct_cache_lookups_total",
+                             "cache=\"entries_by_hash\",result=\"hit\""));
+  EXPECT_EQ(1, metrics.Value("ct_cache_lookups_total",
+                             "cache=\"entries_by_hash\",result=\"miss\""));
+}
+
+TEST_F(CachingDBTest, LookupByIndex) {
+  std::vector<LoggedCertificate> logged;
+  LogEntries(kCacheEntries + 1, &logged);
+  LoggedCertificate lookup_cert;
+  for (size_t i = 0; i <= kCacheEntries; ++i)
+    EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByIndex(i, &lookup_cert));
+  EXPECT_EQ(kCacheEntries + 1, Stats().index_misses);
+
+  // Entry 0 was evicted.
+  for (size_t i = 0; i <= kCacheEntries; ++i) {
+    EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByIndex(kCacheEntries - i,
+                                                 &lookup_cert));
+    TestSigner::TestEqualLoggedCerts(logged[kCacheEntries - i], lookup_cert);
+  }
+  EXPECT_EQ(kCacheEntries, Stats().index_hits);
+  EXPECT_EQ(kCacheEntries + 2, Stats().index_misses);
+  EXPECT_EQ(DB::NOT_FOUND, db()->LookupByIndex(kCacheEntries + 1,
+                                               &lookup_cert));
+}
+
+TEST_F(CachingDBTest, LookupByIndexRange) {
+  std::vector<LoggedCertificate> logged;
+  LogEntries(kCacheEntries, &logged);
+  LoggedCertificate lookup_cert;
+  EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByIndex(0, &lookup_cert));
+
+  // The cached entry 0 is served from memory, the rest is read and cached.
+  EntryCollector entries(100);
+  EXPECT_EQ(DB::LOOKUP_OK,
+            db()->LookupByIndexRange(0, kCacheEntries, &entries));
+  ASSERT_EQ(kCacheEntries, entries.entries().size());
+  for (size_t i = 0; i < kCacheEntries; ++i)
+    TestSigner::TestEqualLoggedCerts(logged[i], entries.entries()[i]);
+  EXPECT_EQ(1U, Stats().index_hits);
+  EXPECT_EQ(kCacheEntries, Stats().index_misses);
+
+  EntryCollector cached(100);
+  EXPECT_EQ(DB::NOT_FOUND,
+            db()->LookupByIndexRange(0, kCacheEntries + 1, &cached));
+  EXPECT_EQ(kCacheEntries, cached.entries().size());
+  EXPECT_EQ(kCacheEntries + 1, Stats().index_hits);
+}
+
+class ShardedDBTest : public ::testing::Test {
+ protected:
+  typedef ShardedDB<LoggedCertificate> ShardedDatabase;
+
+  ShardedDBTest() : test_db_(), test_signer_() {}
+
+  ShardedDatabase *db() const { return test_db_.db(); }
+
+  // Create |count| entries and log them in one batch, with sequence numbers
+  // from |logged|'s size.
+  void LogEntries(size_t count, std::vector<LoggedCertificate> *logged) {
+    std::vector<string> hashes;
+    for (size_t i = 0; i < count; ++i) {
+      LoggedCertificate logged_cert;
+      test_signer_.CreateUnique(&logged_cert);
+      ASSERT_EQ(DB::OK, db()->CreatePendingEntry(logged_cert));
+      logged_cert.set_sequence_number(logged->size());
+      logged->push_back(logged_cert);
+      hashes.push_back(logged_cert.Hash());
+    }
+    size_t assigned;
+    ASSERT_EQ(DB::OK, db()->AssignSequenceNumbers(
+        hashes, logged->size() - count, &assigned));
+    ASSERT_EQ(count, assigned);
+  }
+
+  TestDB<ShardedDatabase> test_db_;
+  TestSigner test_signer_;
+};
+
+TEST_F(ShardedDBTest, Shards) {
+  std::vector<LoggedCertificate> logged;
+  LogEntries(kShardSize + 1, &logged);
+  struct stat st;
+  EXPECT_EQ(0, stat(db()->ShardFile(0).c_str(), &st));
+  EXPECT_EQ(0, stat(db()->ShardFile(1).c_str(), &st));
+  EXPECT_NE(0, stat(db()->ShardFile(2).c_str(), &st));
+
+  // Lookups of missing entries don't create shards.
+  LoggedCertificate lookup_cert;
+  EXPECT_EQ(DB::NOT_FOUND, db()->LookupByIndex(3 * kShardSize, &lookup_cert));
+  EXPECT_NE(0, stat(db()->ShardFile(3).c_str(), &st));
+}
+
+// Use more shards than the database keeps attached.
+TEST_F(ShardedDBTest, ManyShards) {
+  std::vector<LoggedCertificate> logged;
+  for (size_t i = 0; i < 12; ++i)
+    LogEntries(kShardSize, &logged);
+
+  LoggedCertificate lookup_cert;
+  for (size_t i = 0; i < logged.size(); ++i) {
+    EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByHash(logged[i].Hash(),
+                                                &lookup_cert));
+    TestSigner::TestEqualLoggedCerts(logged[i], lookup_cert);
+  }
+
+  EntryCollector entries(logged.size());
+  EXPECT_EQ(DB::LOOKUP_OK,
+            db()->LookupByIndexRange(0, logged.size(), &entries));
+  ASSERT_EQ(logged.size(), entries.entries().size());
+  for (size_t i = 0; i < logged.size(); ++i)
+    TestSigner::TestEqualLoggedCerts(logged[i], entries.entries()[i]);
+
+  std::vector<string> leaf_hashes;
+  EXPECT_EQ(DB::LOOKUP_OK,
+            db()->LookupLeafHashRange(0, logged.size(), &leaf_hashes));
+  EXPECT_EQ(logged.size(), leaf_hashes.size());
+}
+
+// A transaction that moves entries into shards commits them along with the
+// tree head.
+TEST_F(ShardedDBTest, Transaction) {
+  std::vector<LoggedCertificate> logged;
+  for (size_t i = 0; i < 10; ++i)
+    LogEntries(kShardSize, &logged);
+
+  db()->BeginTransaction();
+  LogEntries(2 * kShardSize, &logged);
+  SignedTreeHead sth;
+  sth.set_timestamp(util::TimeInMilliseconds());
+  sth.set_tree_size(logged.size());
+  EXPECT_EQ(DB::OK, db()->WriteTreeHead(sth));
+  db()->EndTransaction();
+
+  ShardedDatabase *db2 = test_db_.SecondDB();
+  LoggedCertificate lookup_cert;
+  EXPECT_EQ(DB::LOOKUP_OK, db2->LookupByIndex(logged.size() - 1,
+                                              &lookup_cert));
+  TestSigner::TestEqualLoggedCerts(logged.back(), lookup_cert);
+  SignedTreeHead lookup_sth;
+  EXPECT_EQ(DB::LOOKUP_OK, db2->LatestTreeHead(&lookup_sth));
+  EXPECT_EQ(logged.size(), lookup_sth.tree_size());
+  EXPECT_TRUE(db2->PendingHashes().empty());
+  delete db2;
+}
+
+// Lookups during a transaction read more old shards than it could attach,
+// and leave it the room to attach the shards it writes to.
+TEST_F(ShardedDBTest, LookupsInTransaction) {
+  std::vector<LoggedCertificate> logged;
+  for (size_t i = 0; i < 12; ++i)
+    LogEntries(kShardSize, &logged);
+  // Start with one of them attached.
+  LoggedCertificate lookup_cert;
+  EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByIndex(0, &lookup_cert));
+
+  db()->BeginTransaction();
+  for (size_t i = 0; i < logged.size(); i += kShardSize - 1) {
+    EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByHash(logged[i].Hash(),
+                                                &lookup_cert));
+    TestSigner::TestEqualLoggedCerts(logged[i], lookup_cert);
+    EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByHash(logged[i].Hash()));
+  }
+  EntryCollector entries(logged.size());
+  EXPECT_EQ(DB::LOOKUP_OK,
+            db()->LookupByIndexRange(0, logged.size(), &entries));
+  ASSERT_EQ(logged.size(), entries.entries().size());
+  for (size_t i = 0; i < logged.size(); ++i)
+    TestSigner::TestEqualLoggedCerts(logged[i], entries.entries()[i]);
+  std::vector<string> leaf_hashes;
+  EXPECT_EQ(DB::LOOKUP_OK,
+            db()->LookupLeafHashRange(0, logged.size(), &leaf_hashes));
+  EXPECT_EQ(logged.size(), leaf_hashes.size());
+
+  // What the transaction writes is looked up in its shards.
+  LogEntries(2 * kShardSize, &logged);
+  EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByHash(logged.back().Hash(),
+                                              &lookup_cert));
+  TestSigner::TestEqualLoggedCerts(logged.back(), lookup_cert);
+  db()->EndTransaction();
+
+  for (size_t i = 0; i < logged.size(); i += kShardSize - 1) {
+    EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByIndex(i, &lookup_cert));
+    TestSigner::TestEqualLoggedCerts(logged[i], lookup_cert);
+  }
+}
+
+class InterningDBTest : public ::testing::Test {
+ protected:
+  InterningDBTest()
+      : tmp_(),
+        sqlite_db_(new SQLiteDB<LoggedCertificate>(tmp_.TmpStorageDir() +
+                                                   "/sqlite")),
+        certs_(NULL),
+        db_(NULL),
+        test_signer_() {
+    const string certs_dir = tmp_.TmpStorageDir() + "/intermediates";
+    CHECK_ERR(mkdir(certs_dir.c_str(), 0700));
+    certs_ = new FileStorage(certs_dir, kCertStorageDepth);
+    db_ = new InterningDatabase(sqlite_db_, certs_, kInternedCerts);
+  }
+
+  ~InterningDBTest() { delete db_; }
+
+  // Create a unique entry with |chain|.
+  void CreateWithChain(const std::vector<string> &chain,
+                       LoggedCertificate *logged) {
+    test_signer_.CreateUnique(logged);
+    google::protobuf::RepeatedPtrField<string> *entry_chain =
+        logged->entry().type() == ct::X509_ENTRY ?
+        logged->mutable_entry()->mutable_x509_entry()
+            ->mutable_certificate_chain() :
+        logged->mutable_entry()->mutable_precert_entry()
+            ->mutable_precertificate_chain();
+    entry_chain->Clear();
+    for (size_t i = 0; i < chain.size(); ++i)
+      entry_chain->Add()->assign(chain[i]);
+  }
+
+  TmpStorage tmp_;
+  // Owned by |db_|.
+  SQLiteDB<LoggedCertificate> *sqlite_db_;
+  FileStorage *certs_;
+  InterningDatabase *db_;
+  TestSigner test_signer_;
+};
+
+TEST_F(InterningDBTest, SharedChain) {
+  std::vector<string> chain;
+  for (size_t i = 0; i < 2 * kInternedCerts; ++i)
+    chain.push_back(util::RandomString(512, 1024));
+  std::vector<LoggedCertificate> logged(3);
+  for (size_t i = 0; i < logged.size(); ++i) {
+    CreateWithChain(chain, &logged[i]);
+    EXPECT_EQ(DB::OK, db_->CreatePendingEntry(logged[i]));
+    EXPECT_EQ(DB::OK, db_->AssignSequenceNumber(logged[i].Hash(), i));
+    logged[i].set_sequence_number(i);
+  }
+
+  // The chain is stored once, and only referred to by the entries.
+  EXPECT_EQ(chain.size(), certs_->Scan().size());
+  LoggedCertificate lookup_cert;
+  EXPECT_EQ(DB::LOOKUP_OK, sqlite_db_->LookupByIndex(0, &lookup_cert));
+  EXPECT_EQ(static_cast<int>(chain.size()),
+            lookup_cert.contents().chain_hash_size());
+  string extra_data;
+  EXPECT_TRUE(lookup_cert.SerializeExtraData(&extra_data));
+  for (size_t i = 0; i < chain.size(); ++i)
+    EXPECT_EQ(string::npos, extra_data.find(chain[i]));
+
+  // Lookups put it back, also when the cache can't hold all of it.
+  for (size_t i = 0; i < logged.size(); ++i) {
+    EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(i, &lookup_cert));
+    TestSigner::TestEqualLoggedCerts(logged[i], lookup_cert);
+    EXPECT_EQ(0, lookup_cert.contents().chain_hash_size());
+  }
+  EntryCollector entries(logged.size());
+  EXPECT_EQ(DB::LOOKUP_OK,
+            db_->LookupByIndexRange(0, logged.size(), &entries));
+  ASSERT_EQ(logged.size(), entries.entries().size());
+  for (size_t i = 0; i < logged.size(); ++i)
+    TestSigner::TestEqualLoggedCerts(logged[i], entries.entries()[i]);
+}
+
+// Entries with their chain in place are read as they are.
+TEST_F(InterningDBTest, InlineChain) {
+  std::vector<string> chain(1, util::RandomString(512, 1024));
+  LoggedCertificate logged_cert, lookup_cert;
+  CreateWithChain(chain, &logged_cert);
+  EXPECT_EQ(DB::OK, sqlite_db_->CreatePendingEntry(logged_cert));
+  EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByHash(logged_cert.Hash(),
+                                             &lookup_cert));
+  TestSigner::TestEqualLoggedCerts(logged_cert, lookup_cert);
+  EXPECT_TRUE(certs_->Scan().empty());
+}
+
+typedef InstrumentedDatabase<LoggedCertificate> InstrumentedDB;
+
+class InstrumentedDBTest : public ::testing::Test {
+ protected:
+  InstrumentedDBTest()
+      : db_(new SQLiteDB<LoggedCertificate>(tmp_.TmpStorageDir() + "/sqlite"),
+            &metrics_) {}
+
+  const InstrumentedDB::OperationStats &Stats(
+      InstrumentedDB::Operation operation) {
+    db_.GetStats(&stats_);
+    return stats_.operations[operation];
+  }
+
+  TmpStorage tmp_;
+  util::Metrics metrics_;
+  InstrumentedDB db_;
+  InstrumentedDB::StorageStats stats_;
+  TestSigner test_signer_;
+};
+
+TEST_F(InstrumentedDBTest, CountsRowsAndBytes) {
+  LoggedCertificate logged_cert, lookup_cert;
+  test_signer_.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::OK, db_.CreatePendingEntry(logged_cert));
+  // Failed writes are calls without rows.
+  EXPECT_EQ(DB::DUPLICATE_CERTIFICATE_HASH,
+            db_.CreatePendingEntry(logged_cert));
+  EXPECT_EQ(2U, Stats(InstrumentedDB::CREATE_PENDING_ENTRY).calls);
+  EXPECT_EQ(1U, Stats(InstrumentedDB::CREATE_PENDING_ENTRY).rows);
+  EXPECT_EQ(static_cast<uint64_t>(logged_cert.ByteSize()),
+            Stats(InstrumentedDB::CREATE_PENDING_ENTRY).bytes);
+
+  EXPECT_EQ(1U, db_.PendingHashes().size());
+  EXPECT_EQ(1U, Stats(InstrumentedDB::PENDING_HASHES).rows);
+  EXPECT_EQ(DB::OK, db_.AssignSequenceNumber(logged_cert.Hash(), 0));
+
+  EXPECT_EQ(DB::LOOKUP_OK, db_.LookupByHash(logged_cert.Hash(), &lookup_cert));
+  EXPECT_EQ(DB::NOT_FOUND, db_.LookupByIndex(1, &lookup_cert));
+  EXPECT_EQ(DB::LOOKUP_OK, db_.LookupByIndex(0, &lookup_cert));
+  EXPECT_EQ(1U, Stats(InstrumentedDB::LOOKUP_BY_HASH).rows);
+  EXPECT_EQ(2U, Stats(InstrumentedDB::LOOKUP_BY_INDEX).calls);
+  EXPECT_EQ(1U, Stats(InstrumentedDB::LOOKUP_BY_INDEX).rows);
+  EXPECT_EQ(static_cast<uint64_t>(lookup_cert.ByteSize()),
+            Stats(InstrumentedDB::LOOKUP_BY_INDEX).bytes);
+
+  EntryCollector collector(10);
+  EXPECT_EQ(DB::LOOKUP_OK, db_.LookupByIndexRange(0, 1, &collector));
+  EXPECT_EQ(1U, collector.entries().size());
+  EXPECT_EQ(1U, Stats(InstrumentedDB::LOOKUP_BY_INDEX_RANGE).rows);
+
+  SignedTreeHead sth;
+  test_signer_.CreateUnique(&sth);
+  EXPECT_EQ(DB::OK, db_.WriteTreeHead(sth));
+  EXPECT_EQ(DB::LOOKUP_OK, db_.LatestTreeHead(&sth));
+  EXPECT_EQ(static_cast<uint64_t>(sth.ByteSize()),
+            Stats(InstrumentedDB::LATEST_TREE_HEAD).bytes);
+  EXPECT_EQ(0U, Stats(InstrumentedDB::BEGIN_TRANSACTION).calls);
+}
+
+TEST_F(InstrumentedDBTest, ExportStats) {
+  LoggedCertificate logged_cert;
+  test_signer_.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::OK, db_.CreatePendingEntry(logged_cert));
+  EXPECT_EQ(DB::LOOKUP_OK, db_.LookupByHash(logged_cert.Hash()));
+  EXPECT_EQ(DB::LOOKUP_OK, db_.LookupByHash(logged_cert.Hash()));
+
+  db_.ExportStats(&metrics_);
+  EXPECT_EQ(2, metrics_.Value("ct_storage_operations_total",
+                              "op=\"lookup_by_hash\""));
+  EXPECT_EQ(2, metrics_.Value("ct_storage_rows_total",
+                              "op=\"lookup_by_hash\""));
+  EXPECT_EQ(logged_cert.ByteSize(),
+            metrics_.Value("ct_storage_bytes_total",
+                           "op=\"create_pending_entry\""));
+  EXPECT_EQ(0, metrics_.Value("ct_storage_operations_total",
+                              "op=\"write_tree_head\""));
+  EXPECT_NE(string::npos, metrics_.Export().find(
+      "ct_storage_operation_seconds_count{op=\"lookup_by_hash\"} 2\n"));
+
+  const string summary = db_.StatsSummary();
+  EXPECT_NE(string::npos, summary.find(" create_pending_entry 1 calls, "));
+  EXPECT_NE(string::npos, summary.find(" lookup_by_hash 2 calls, "));
+  EXPECT_EQ(string::npos, summary.find("write_tree_head"));
+}
+
+typedef LockingDatabase<LoggedCertificate> LockingDB;
+
+class LockingDBTest : public ::testing::Test {
+ protected:
+  LockingDBTest() : test_db_() {}
+
+  LockingDB *db() const { return test_db_.db(); }
+
+  TestDB<LockingDB> test_db_;
+  TestSigner test_signer_;
+};
+
+// One writer's share of the entries.
+struct WriterJob {
+  LockingDB *db;
+  std::vector<LoggedCertificate> entries;
+  bool ok;
+};
+
+void *WriteAndLookup(void *arg) {
+  WriterJob *job = static_cast<WriterJob*>(arg);
+  job->ok = true;
+  LoggedCertificate lookup_cert;
+  for (size_t i = 0; i < job->entries.size(); ++i) {
+    const string hash = job->entries[i].Hash();
+    job->ok &= job->db->CreatePendingEntry(job->entries[i]) == DB::OK;
+    job->ok &= job->db->LookupByHash(hash, &lookup_cert) == DB::LOOKUP_OK;
+    job->ok &= lookup_cert.Hash() == hash;
+  }
+  return NULL;
+}
+
+TEST_F(LockingDBTest, ConcurrentWriters) {
+  std::vector<WriterJob> jobs(4);
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    jobs[i].db = db();
+    jobs[i].entries.resize(20);
+    for (size_t j = 0; j < jobs[i].entries.size(); ++j)
+      test_signer_.CreateUnique(&jobs[i].entries[j]);
+  }
+  std::vector<pthread_t> threads(jobs.size());
+  for (size_t i = 0; i < jobs.size(); ++i)
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, WriteAndLookup, &jobs[i]));
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    ASSERT_EQ(0, pthread_join(threads[i], NULL));
+    EXPECT_TRUE(jobs[i].ok);
+  }
+  EXPECT_EQ(80U, db()->PendingHashes().size());
+}
+
+// A transaction keeps other threads' writes out until it ends.
+TEST_F(LockingDBTest, TransactionHoldsLock) {
+  WriterJob job;
+  job.db = db();
+  job.entries.resize(1);
+  test_signer_.CreateUnique(&job.entries[0]);
+
+  db()->BeginTransaction();
+  pthread_t thread;
+  ASSERT_EQ(0, pthread_create(&thread, NULL, WriteAndLookup, &job));
+  usleep(100000);
+  EXPECT_TRUE(db()->PendingHashes().empty());
+  db()->EndTransaction();
+  ASSERT_EQ(0, pthread_join(thread, NULL));
+  EXPECT_TRUE(job.ok);
+  EXPECT_EQ(1U, db()->PendingHashes().size());
+}
+
+// Looks up |committed| and |uncommitted| by hash.
+struct ReaderJob {
+  LockingDB *db;
+  string committed;
+  string uncommitted;
+  volatile bool done;
+  bool ok;
+};
+
+void *LookUp(void *arg) {
+  ReaderJob *job = static_cast<ReaderJob*>(arg);
+  LoggedCertificate lookup_cert;
+  job->ok = job->db->LookupByHash(job->committed, &lookup_cert) ==
+      DB::LOOKUP_OK;
+  job->ok &= job->db->LookupByHash(job->uncommitted) == DB::NOT_FOUND;
+  job->done = true;
+  return NULL;
+}
+
+// SQLite lookups go by the lock: other threads see what was committed
+// without waiting for the transaction, which sees its own writes.
+TEST_F(LockingDBTest, ReadsDontWaitForTransaction) {
+  LoggedCertificate committed, uncommitted, lookup_cert;
+  test_signer_.CreateUnique(&committed);
+  test_signer_.CreateUnique(&uncommitted);
+  EXPECT_EQ(DB::OK, db()->CreatePendingEntry(committed));
+
+  db()->BeginTransaction();
+  EXPECT_EQ(DB::OK, db()->CreatePendingEntry(uncommitted));
+  EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByHash(uncommitted.Hash(),
+                                              &lookup_cert));
+  ReaderJob job = { db(), committed.Hash(), uncommitted.Hash(), false, false };
+  pthread_t thread;
+  ASSERT_EQ(0, pthread_create(&thread, NULL, LookUp, &job));
+  for (int i = 0; i < 500 && !job.done; ++i)
+    usleep(10000);
+  EXPECT_TRUE(job.done);
+  db()->EndTransaction();
+  ASSERT_EQ(0, pthread_join(thread, NULL));
+  EXPECT_TRUE(job.ok);
+  EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByHash(uncommitted.Hash()));
+}
+
+TEST_F(LockingDBTest, Metrics) {
+  TmpStorage tmp;
+  util::Metrics metrics;
+  LockingDB db(new SQLiteDB<LoggedCertificate>(tmp.TmpStorageDir() + "/sqlite"),
+               &metrics);
+  LoggedCertificate logged_cert, lookup_cert;
+  test_signer_.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::OK, db.CreatePendingEntry(logged_cert));
+  EXPECT_EQ(DB::LOOKUP_OK, db.LookupByHash(logged_cert.Hash(), &lookup_cert));
+  EXPECT_EQ(DB::LOOKUP_OK, db.LookupByHash(logged_cert.Hash(), &lookup_cert));
+
+  const string exported = metrics.Export();
+  EXPECT_NE(string::npos, exported.find(
+      "ct_database_operation_seconds_count{op=\"create_pending_entry\"} 1\n"));
+  EXPECT_NE(string::npos, exported.find(
+      "ct_database_operation_seconds_count{op=\"lookup_by_hash\"} 2\n"));
+}
+
+// Looks up each entry of a range lookup again, by hash.
+class LookupAgainCallback : public DB::EntryCallback {
+ public:
+  explicit LookupAgainCallback(const DB *db) : db_(db), found_(0) {}
+
+  virtual bool Entry(const LoggedCertificate &logged) {
+    if (db_->LookupByHash(logged.Hash()) == DB::LOOKUP_OK)
+      ++found_;
+    return true;
+  }
+
+  size_t found() const { return found_; }
+
+ private:
+  const DB *db_;
+  size_t found_;
+};
+
+// Callbacks may use the database while it is locked.
+TEST_F(LockingDBTest, NestedLookup) {
+  LoggedCertificate logged_cert;
+  for (uint64_t i = 0; i < 3; ++i) {
+    test_signer_.CreateUnique(&logged_cert);
+    EXPECT_EQ(DB::OK, db()->CreatePendingEntry(logged_cert));
+    EXPECT_EQ(DB::OK, db()->AssignSequenceNumber(logged_cert.Hash(), i));
+  }
+  LookupAgainCallback callback(db());
+  EXPECT_EQ(DB::LOOKUP_OK, db()->LookupByIndexRange(0, 3, &callback));
+  EXPECT_EQ(3U, callback.found());
+}
+
+typedef ArchivingDatabase<LoggedCertificate> ArchivingDB;
+
+// Runs over each of the databases that can drop entries.
+template <class T> class ArchivingDBTest : public ::testing::Test {
+ protected:
+  ArchivingDBTest()
+      : tmp_(),
+        test_db_(),
+        test_signer_(),
+        archive_dir_(tmp_.TmpStorageDir() + "/archive"),
+        storage_(NULL),
+        db_(NULL) {
+    Open();
+  }
+
+  ~ArchivingDBTest() { delete db_; }
+
+  // (Re)open the archiving database, over a new instance of the wrapped
+  // one that the fixture's TestDB leaves alone.
+  void Open() {
+    delete db_;
+    storage_ = test_db_.SecondDB();
+    db_ = new ArchivingDB(storage_, archive_dir_, NULL);
+  }
+
+  // Log |count| entries in one batch, after those in |logged|.
+  void LogEntries(size_t count, std::vector<LoggedCertificate> *logged) {
+    std::vector<string> hashes;
+    for (size_t i = 0; i < count; ++i) {
+      LoggedCertificate logged_cert;
+      this->test_signer_.CreateUnique(&logged_cert);
+      ASSERT_EQ(DB::OK, db_->CreatePendingEntry(logged_cert));
+      logged_cert.set_sequence_number(logged->size());
+      logged->push_back(logged_cert);
+      hashes.push_back(logged_cert.Hash());
+    }
+    size_t assigned;
+    ASSERT_EQ(DB::OK, db_->AssignSequenceNumbers(
+        hashes, logged->size() - count, &assigned));
+  }
+
+  // Expect every one of |logged| through each kind of lookup.
+  void ExpectEntries(const std::vector<LoggedCertificate> &logged,
+                     const std::vector<string> &leaf_hashes) {
+    LoggedCertificate lookup_cert;
+    for (size_t i = 0; i < logged.size(); ++i) {
+      EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(i, &lookup_cert));
+      TestSigner::TestEqualLoggedCerts(logged[i], lookup_cert);
+      EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByHash(logged[i].Hash()));
+      EXPECT_EQ(DB::LOOKUP_OK,
+                db_->LookupByHash(logged[i].Hash(), &lookup_cert));
+      TestSigner::TestEqualLoggedCerts(logged[i], lookup_cert);
+    }
+    EXPECT_EQ(DB::NOT_FOUND, db_->LookupByIndex(logged.size(), &lookup_cert));
+
+    // Ranges across the end of the archive.
+    EntryCollector entries(logged.size());
+    EXPECT_EQ(DB::LOOKUP_OK,
+              db_->LookupByIndexRange(1, logged.size(), &entries));
+    ASSERT_EQ(logged.size() - 1, entries.entries().size());
+    for (size_t i = 1; i < logged.size(); ++i)
+      TestSigner::TestEqualLoggedCerts(logged[i], entries.entries()[i - 1]);
+    std::vector<string> hashes;
+    EXPECT_EQ(DB::LOOKUP_OK,
+              db_->LookupLeafHashRange(0, logged.size(), &hashes));
+    EXPECT_EQ(leaf_hashes, hashes);
+    EXPECT_EQ(DB::NOT_FOUND,
+              db_->LookupLeafHashRange(0, logged.size() + 1, &hashes));
+    EXPECT_EQ(leaf_hashes, hashes);
+
+    // In parts, as when reading all of them.
+    std::vector<string> entry_hashes;
+    for (size_t i = 0; i < logged.size(); i += 2)
+      EXPECT_EQ(DB::LOOKUP_OK,
+                db_->LookupEntryHashRange(i, std::min(i + 2, logged.size()),
+                                          &entry_hashes));
+    ASSERT_EQ(logged.size(), entry_hashes.size());
+    for (size_t i = 0; i < logged.size(); ++i)
+      EXPECT_EQ(logged[i].Hash(), entry_hashes[i]);
+    entry_hashes.clear();
+    EXPECT_EQ(DB::NOT_FOUND,
+              db_->LookupEntryHashRange(1, logged.size() + 1, &entry_hashes));
+    EXPECT_EQ(logged.size() - 1, entry_hashes.size());
+  }
+
+  TmpStorage tmp_;
+  TestDB<T> test_db_;
+  TestSigner test_signer_;
+  const string archive_dir_;
+  // Owned by |db_|.
+  T *storage_;
+  ArchivingDB *db_;
+};
+
+typedef testing::Types<FileDB<ct::LoggedCertificate>,
+                       SQLiteDB<ct::LoggedCertificate> > DroppingDatabases;
+
+TYPED_TEST_CASE(ArchivingDBTest, DroppingDatabases);
+
+TYPED_TEST(ArchivingDBTest, ArchiveAndReopen) {
+  std::vector<LoggedCertificate> logged;
+  this->LogEntries(10, &logged);
+  std::vector<string> leaf_hashes;
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db_->LookupLeafHashRange(0, logged.size(), &leaf_hashes));
+
+  EXPECT_EQ(0U, this->db_->ArchivedEnd());
+  this->db_->Archive(4);
+  this->db_->Archive(7);
+  EXPECT_EQ(7U, this->db_->ArchivedEnd());
+
+  // The wrapped database no longer has them.
+  LoggedCertificate lookup_cert;
+  EXPECT_EQ(DB::NOT_FOUND, this->storage_->LookupByIndex(6, &lookup_cert));
+  EXPECT_EQ(DB::NOT_FOUND, this->storage_->LookupByHash(logged[0].Hash(),
+                                                        &lookup_cert));
+  EXPECT_EQ(DB::LOOKUP_OK, this->storage_->LookupByIndex(7, &lookup_cert));
+  this->ExpectEntries(logged, leaf_hashes);
+
+  this->Open();
+  EXPECT_EQ(7U, this->db_->ArchivedEnd());
+  this->ExpectEntries(logged, leaf_hashes);
+
+  // And logging carries on after them.
+  this->LogEntries(3, &logged);
+  leaf_hashes.clear();
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db_->LookupLeafHashRange(0, logged.size(), &leaf_hashes));
+  this->db_->Archive(12);
+  this->ExpectEntries(logged, leaf_hashes);
+}
+
+TYPED_TEST(ArchivingDBTest, ArchivedEntriesConflict) {
+  std::vector<LoggedCertificate> logged;
+  this->LogEntries(5, &logged);
+  this->db_->Archive(3);
+
+  LoggedCertificate duplicate_cert(logged[0]);
+  duplicate_cert.clear_sequence_number();
+  EXPECT_EQ(DB::DUPLICATE_CERTIFICATE_HASH,
+            this->db_->CreatePendingEntry(duplicate_cert));
+  EXPECT_EQ(DB::ENTRY_ALREADY_LOGGED,
+            this->db_->AssignSequenceNumber(logged[1].Hash(), 5));
+
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::ENTRY_NOT_FOUND,
+            this->db_->AssignSequenceNumber(logged_cert.Hash(), 2));
+  EXPECT_EQ(DB::OK, this->db_->CreatePendingEntry(logged_cert));
+  EXPECT_EQ(DB::SEQUENCE_NUMBER_ALREADY_IN_USE,
+            this->db_->AssignSequenceNumber(logged_cert.Hash(), 2));
+  std::vector<string> hashes(1, logged_cert.Hash());
+  size_t assigned = 1;
+  EXPECT_EQ(DB::SEQUENCE_NUMBER_ALREADY_IN_USE,
+            this->db_->AssignSequenceNumbers(hashes, 0, &assigned));
+  EXPECT_EQ(0U, assigned);
+  EXPECT_EQ(DB::OK, this->db_->AssignSequenceNumber(logged_cert.Hash(), 5));
+}
+
+// Entries are dropped from the wrapped database after their segment is in
+// place; if that didn't happen, opening does it.
+TYPED_TEST(ArchivingDBTest, DropOnOpen) {
+  std::vector<LoggedCertificate> logged;
+  this->LogEntries(6, &logged);
+  std::vector<string> leaf_hashes;
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db_->LookupLeafHashRange(0, logged.size(), &leaf_hashes));
+  delete this->db_->WriteSegment(4, this->db_);
+
+  this->Open();
+  EXPECT_EQ(4U, this->db_->ArchivedEnd());
+  LoggedCertificate lookup_cert;
+  EXPECT_EQ(DB::NOT_FOUND, this->storage_->LookupByIndex(0, &lookup_cert));
+  this->ExpectEntries(logged, leaf_hashes);
+}
+
 }  // namespace
 
 int main(int argc, char **argv) {
@@ -0,0 +1,195 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/entry_compressor.h"
+
+#include <algorithm>
+#include <functional>
+#include <glog/logging.h>
+#include <map>
+#include <set>
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+
+using std::string;
+
+namespace {
+
+// Compressed entries are
+//   a zero byte, which no serialized protocol buffer starts with,
+//   the format version (1 byte),
+//   the Adler-32 of the dictionary (4 bytes, big-endian),
+//   the entry, raw deflated with the dictionary preset.
+const char kFormatVersion = 1;
+const size_t kHeaderSize = 6;
+
+// Training looks for recurring strings of at least this many bytes.
+const size_t kGramSize = 8;
+// And reads no more than this much of the samples.
+const size_t kMaxTrainingBytes = 1 << 22;
+
+Bytef *Bytes(const string &data) {
+  return reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+}
+
+uint64_t Gram(const string &sample, size_t position) {
+  uint64_t gram;
+  memcpy(&gram, sample.data() + position, sizeof(gram));
+  return gram;
+}
+
+}  // namespace
+
+EntryCompressor::EntryCompressor(const string &dictionary)
+    : dictionary_(dictionary.substr(0, kMaxDictionarySize)),
+      dictionary_id_(adler32(adler32(0, Z_NULL, 0), Bytes(dictionary_),
+                             dictionary_.size())) {}
+
+void EntryCompressor::Compress(const string &data, string *result) const {
+  CHECK(!IsCompressed(data)) << "Entries must not start with a zero byte";
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // Raw deflate: we keep our own header.
+  CHECK_EQ(Z_OK, deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15,
+                              8, Z_DEFAULT_STRATEGY));
+  if (!dictionary_.empty())
+    CHECK_EQ(Z_OK, deflateSetDictionary(&stream, Bytes(dictionary_),
+                                        dictionary_.size()));
+
+  string compressed(kHeaderSize + deflateBound(&stream, data.size()), '\0');
+  compressed[1] = kFormatVersion;
+  for (size_t i = 0; i < 4; ++i)
+    compressed[2 + i] = dictionary_id_ >> (24 - 8 * i);
+  stream.next_in = Bytes(data);
+  stream.avail_in = data.size();
+  stream.next_out = Bytes(compressed) + kHeaderSize;
+  stream.avail_out = compressed.size() - kHeaderSize;
+  CHECK_EQ(Z_STREAM_END, deflate(&stream, Z_FINISH));
+  compressed.resize(kHeaderSize + stream.total_out);
+  CHECK_EQ(Z_OK, deflateEnd(&stream));
+
+  if (compressed.size() < data.size())
+    result->swap(compressed);
+  else
+    result->assign(data);
+}
+
+bool EntryCompressor::Decompress(const string &data, string *result) const {
+  if (!IsCompressed(data)) {
+    result->assign(data);
+    return true;
+  }
+  if (data.size() < kHeaderSize || data[1] != kFormatVersion) {
+    LOG(ERROR) << "Unknown entry compression format";
+    return false;
+  }
+  uint32_t dictionary_id = 0;
+  for (size_t i = 0; i < 4; ++i)
+    dictionary_id =
+        dictionary_id << 8 | static_cast<unsigned char>(data[2 + i]);
+  if (dictionary_id != dictionary_id_) {
+    LOG(ERROR) << "Entry was compressed with a different dictionary";
+    return false;
+  }
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  CHECK_EQ(Z_OK, inflateInit2(&stream, -15));
+  if (!dictionary_.empty())
+    CHECK_EQ(Z_OK, inflateSetDictionary(&stream, Bytes(dictionary_),
+                                        dictionary_.size()));
+  stream.next_in = Bytes(data) + kHeaderSize;
+  stream.avail_in = data.size() - kHeaderSize;
+
+  result->clear();
+  char buffer[16384];
+  int ret;
+  do {
+    stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    stream.avail_out = sizeof(buffer);
+    ret = inflate(&stream, Z_NO_FLUSH);
+    result->append(buffer, sizeof(buffer) - stream.avail_out);
+  } while (ret == Z_OK);
+  const bool complete = ret == Z_STREAM_END && stream.avail_in == 0;
+  inflateEnd(&stream);
+  return complete;
+}
+
+// static
+bool EntryCompressor::IsCompressed(const string &data) {
+  return !data.empty() && data[0] == '\0';
+}
+
+// Strings that recur in different samples make the dictionary, the ones
+// that recur the most (weighted by length) first. Those go last, where
+// deflate finds them at the shortest distance.
+// static
+string EntryCompressor::TrainDictionary(const std::vector<string> &samples,
+                                        size_t max_size) {
+  // In how many samples does each gram occur?
+  std::map<uint64_t, size_t> counts;
+  size_t used, bytes = 0;
+  for (used = 0; used < samples.size() && bytes < kMaxTrainingBytes; ++used) {
+    const string &sample = samples[used];
+    bytes += sample.size();
+    std::set<uint64_t> grams;
+    for (size_t i = 0; i + kGramSize <= sample.size(); ++i)
+      grams.insert(Gram(sample, i));
+    for (std::set<uint64_t>::const_iterator it = grams.begin();
+         it != grams.end(); ++it)
+      ++counts[*it];
+  }
+
+  // Cut the samples into runs of recurring grams, and score each run by
+  // its length and the number of samples that share all of it (at most).
+  std::map<string, uint64_t> runs;
+  for (size_t s = 0; s < used; ++s) {
+    const string &sample = samples[s];
+    size_t i = 0;
+    while (i + kGramSize <= sample.size()) {
+      size_t count = counts[Gram(sample, i)];
+      if (count < 2) {
+        ++i;
+        continue;
+      }
+      const size_t start = i;
+      size_t shared = count;
+      while (i + kGramSize <= sample.size() &&
+             (count = counts[Gram(sample, i)]) >= 2) {
+        shared = std::min(shared, count);
+        ++i;
+      }
+      const string run = sample.substr(start, i - start + kGramSize - 1);
+      uint64_t &score = runs[run];
+      score = std::max<uint64_t>(score, shared * run.size());
+    }
+  }
+
+  std::vector<std::pair<uint64_t, string> > ranked;
+  for (std::map<string, uint64_t>::const_iterator it = runs.begin();
+       it != runs.end(); ++it)
+    ranked.push_back(std::make_pair(it->second, it->first));
+  std::sort(ranked.begin(), ranked.end(),
+            std::greater<std::pair<uint64_t, string> >());
+
+  // Best first, skipping runs that we already have.
+  string chosen;
+  std::vector<const string*> order;
+  for (size_t i = 0; i < ranked.size() && chosen.size() + kGramSize <= max_size;
+       ++i) {
+    const string &run = ranked[i].second;
+    if (chosen.size() + run.size() > max_size ||
+        chosen.find(run) != string::npos)
+      continue;
+    chosen.append(run);
+    order.push_back(&run);
+  }
+
+  string dictionary;
+  dictionary.reserve(chosen.size());
+  for (size_t i = order.size(); i > 0; --i)
+    dictionary.append(*order[i - 1]);
+  return dictionary;
+}
@@ -0,0 +1,52 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef ENTRY_COMPRESSOR_H
+#define ENTRY_COMPRESSOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Compresses log entries for storage, with deflate and a preset dictionary
+// of the strings that entries tend to share (issuer names, OIDs, CPS
+// URLs...). Entries are small, so without a dictionary there is hardly
+// anything to compress them against.
+//
+// Compressed entries start with a zero byte, followed by a format version
+// and the dictionary's checksum. Uncompressed entries are stored as they
+// are, so compressed and uncompressed entries can be mixed as long as
+// the latter never start with a zero byte. Serialized protocol buffers
+// never do.
+class EntryCompressor {
+ public:
+  // The largest useful dictionary: deflate can't look further back.
+  static const size_t kMaxDictionarySize = 32768;
+
+  // |dictionary| may be empty, and is cut to kMaxDictionarySize.
+  explicit EntryCompressor(const std::string &dictionary);
+
+  const std::string &dictionary() const { return dictionary_; }
+
+  // Compress |data| into |result|. Stores |data| as it is if compressing
+  // it doesn't make it smaller.
+  void Compress(const std::string &data, std::string *result) const;
+
+  // Reverse Compress(). Returns false if |data| is corrupt or compressed
+  // with a different dictionary.
+  bool Decompress(const std::string &data, std::string *result) const;
+
+  // Whether |data| is the result of compressing something.
+  static bool IsCompressed(const std::string &data);
+
+  // Build a dictionary of at most |max_size| bytes out of the strings that
+  // recur across |samples|, which should be typical entries.
+  static std::string TrainDictionary(const std::vector<std::string> &samples,
+                                     size_t max_size);
+
+ private:
+  const std::string dictionary_;
+  // Adler-32 of |dictionary_|, stored with each entry.
+  uint32_t dictionary_id_;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "log/entry_compressor.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace {
+
+using std::string;
+
+// Entries that share some strings, like certificates from the same issuer.
+string Entry() {
+  return "\x0a" + util::RandomString(20, 40) +
+      "CN=Example Intermediate CA, O=Example Trust Services, C=US" +
+      util::RandomString(60, 80) + "http://cps.example.com/repository" +
+      util::RandomString(20, 100);
+}
+
+std::vector<string> Entries(size_t count) {
+  std::vector<string> entries;
+  for (size_t i = 0; i < count; ++i)
+    entries.push_back(Entry());
+  return entries;
+}
+
+TEST(EntryCompressorTest, RoundTrip) {
+  EntryCompressor compressor(EntryCompressor::TrainDictionary(Entries(50),
+                                                              4096));
+  const string entry = Entry();
+  string compressed, decompressed;
+  compressor.Compress(entry, &compressed);
+  EXPECT_TRUE(EntryCompressor::IsCompressed(compressed));
+  EXPECT_TRUE(compressor.Decompress(compressed, &decompressed));
+  EXPECT_EQ(entry, decompressed);
+
+  // Uncompressed data passes through.
+  EXPECT_FALSE(EntryCompressor::IsCompressed(entry));
+  EXPECT_TRUE(compressor.Decompress(entry, &decompressed));
+  EXPECT_EQ(entry, decompressed);
+}
+
+TEST(EntryCompressorTest, Dictionary) {
+  const std::vector<string> samples = Entries(50);
+  const string dictionary = EntryCompressor::TrainDictionary(samples, 4096);
+  EXPECT_LE(dictionary.size(), 4096U);
+  EXPECT_NE(string::npos, dictionary.find("http://cps.example.com/"));
+
+  // The dictionary is what makes small entries compress.
+  EntryCompressor plain((string()));
+  EntryCompressor trained(dictionary);
+  const string entry = Entry();
+  string plain_compressed, trained_compressed;
+  plain.Compress(entry, &plain_compressed);
+  trained.Compress(entry, &trained_compressed);
+  EXPECT_LT(trained_compressed.size() + 50, plain_compressed.size());
+}
+
+TEST(EntryCompressorTest, StoreIncompressible) {
+  EntryCompressor compressor((string()));
+  const string entry = "\x0a" + util::RandomString(10, 10);
+  string compressed;
+  compressor.Compress(entry, &compressed);
+  EXPECT_EQ(entry, compressed);
+}
+
+TEST(EntryCompressorTest, WrongDictionary) {
+  EntryCompressor compressor(EntryCompressor::TrainDictionary(Entries(50),
+                                                              4096));
+  EntryCompressor other(EntryCompressor::TrainDictionary(Entries(50), 1024));
+  string compressed, decompressed;
+  compressor.Compress(Entry(), &compressed);
+  EXPECT_FALSE(other.Decompress(compressed, &decompressed));
+
+  // Neither does a truncated entry decompress.
+  compressed.resize(compressed.size() - 5);
+  EXPECT_FALSE(compressor.Decompress(compressed, &decompressed));
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,315 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/entry_dump.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+#include "proto/serializer.h"
+
+using ct::SignedTreeHead;
+using std::string;
+
+namespace {
+
+const char kMagic[] = "CTDUMP";
+const size_t kMagicSize = 6;
+const uint64_t kFormatVersion = 1;
+const size_t kHeaderSize = kMagicSize + 2;
+const char kTrailerMagic[] = "CTDX";
+const size_t kTrailerSize = 8 + 4 + 4;
+const size_t kIndexEntrySize = 8 + 4 + 8 + 4 + 4;
+const size_t kLeafHashSize = 32;
+
+uint64_t ReadUint(const char *data, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; ++i)
+    value = value << 8 | static_cast<unsigned char>(data[i]);
+  return value;
+}
+
+// Reads the fields of a chunk, or of the index, with bounds checks.
+class FieldReader {
+ public:
+  FieldReader(const char *data, size_t size)
+      : data_(data), remaining_(size) {}
+
+  bool Uint(size_t bytes, uint64_t *value) {
+    if (remaining_ < bytes)
+      return false;
+    *value = ReadUint(data_, bytes);
+    Skip(bytes);
+    return true;
+  }
+
+  bool Fixed(size_t bytes, string *value) {
+    if (remaining_ < bytes)
+      return false;
+    value->assign(data_, bytes);
+    Skip(bytes);
+    return true;
+  }
+
+  bool Var(string *value) {
+    uint64_t length;
+    return Uint(4, &length) && Fixed(length, value);
+  }
+
+  bool Done() const { return remaining_ == 0; }
+
+ private:
+  void Skip(size_t bytes) {
+    data_ += bytes;
+    remaining_ -= bytes;
+  }
+
+  const char *data_;
+  size_t remaining_;
+};
+
+void AppendVar(const string &value, string *out) {
+  out->append(Serializer::SerializeUint(value.size(), 4));
+  out->append(value);
+}
+
+}  // namespace
+
+EntryDumpWriter::EntryDumpWriter(const string &path, size_t chunk_entries)
+    : path_(path),
+      tmp_path_(path + ".tmp"),
+      chunk_entries_(chunk_entries),
+      fd_(-1),
+      offset_(0),
+      have_last_(false),
+      last_(0) {
+  CHECK_GT(chunk_entries_, 0U);
+  fd_ = open(tmp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  PCHECK(fd_ >= 0) << "Failed to create " << tmp_path_;
+  memset(&current_, 0, sizeof current_);
+  string header(kMagic, kMagicSize);
+  header.append(Serializer::SerializeUint(kFormatVersion, 2));
+  Write(header);
+}
+
+EntryDumpWriter::~EntryDumpWriter() {
+  if (fd_ < 0)
+    return;
+  close(fd_);
+  unlink(tmp_path_.c_str());
+}
+
+void EntryDumpWriter::Add(const DumpEntry &entry) {
+  CHECK(!have_last_ || entry.sequence_number > last_)
+      << "Entry " << entry.sequence_number << " is out of order";
+  CHECK_EQ(kLeafHashSize, entry.leaf_hash.size());
+  have_last_ = true;
+  last_ = entry.sequence_number;
+  if (current_.count == 0)
+    current_.first = entry.sequence_number;
+  ++current_.count;
+  chunk_.append(Serializer::SerializeUint(entry.sequence_number, 8));
+  chunk_.append(entry.leaf_hash);
+  AppendVar(entry.leaf, &chunk_);
+  AppendVar(entry.extra_data, &chunk_);
+  if (current_.count == chunk_entries_)
+    FlushChunk();
+}
+
+void EntryDumpWriter::Finish(const SignedTreeHead &sth) {
+  CHECK_GE(fd_, 0);
+  FlushChunk();
+  const uint64_t index_offset = offset_;
+  string index;
+  for (size_t i = 0; i < index_.size(); ++i) {
+    index.append(Serializer::SerializeUint(index_[i].first, 8));
+    index.append(Serializer::SerializeUint(index_[i].count, 4));
+    index.append(Serializer::SerializeUint(index_[i].offset, 8));
+    index.append(Serializer::SerializeUint(index_[i].size, 4));
+    index.append(Serializer::SerializeUint(index_[i].uncompressed_size, 4));
+  }
+  string serialized_sth;
+  CHECK(sth.SerializeToString(&serialized_sth));
+  AppendVar(serialized_sth, &index);
+  index.append(Serializer::SerializeUint(index_offset, 8));
+  index.append(Serializer::SerializeUint(index_.size(), 4));
+  index.append(kTrailerMagic, 4);
+  Write(index);
+
+  PCHECK(fsync(fd_) == 0) << "Failed to sync " << tmp_path_;
+  PCHECK(close(fd_) == 0) << "Failed to close " << tmp_path_;
+  fd_ = -1;
+  PCHECK(rename(tmp_path_.c_str(), path_.c_str()) == 0)
+      << "Failed to rename " << tmp_path_ << " to " << path_;
+}
+
+void EntryDumpWriter::Write(const string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t ret = write(fd_, data.data() + written, data.size() - written);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    PCHECK(ret > 0) << "Failed to write to " << tmp_path_;
+    written += ret;
+  }
+  offset_ += data.size();
+}
+
+void EntryDumpWriter::FlushChunk() {
+  if (current_.count == 0)
+    return;
+  uLongf size = compressBound(chunk_.size());
+  string compressed(size, '\0');
+  CHECK_EQ(Z_OK, compress2(reinterpret_cast<Bytef*>(&compressed[0]), &size,
+                           reinterpret_cast<const Bytef*>(chunk_.data()),
+                           chunk_.size(), Z_DEFAULT_COMPRESSION));
+  compressed.resize(size);
+  current_.offset = offset_;
+  current_.size = compressed.size();
+  current_.uncompressed_size = chunk_.size();
+  Write(compressed);
+  index_.push_back(current_);
+  memset(&current_, 0, sizeof current_);
+  chunk_.clear();
+}
+
+EntryDumpReader::EntryDumpReader(const char *data, size_t size)
+    : data_(data), size_(size) {}
+
+EntryDumpReader::~EntryDumpReader() {
+  PCHECK(munmap(const_cast<char*>(data_), size_) == 0);
+}
+
+// static
+EntryDumpReader *EntryDumpReader::Open(const string &path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    PLOG(ERROR) << "Failed to open " << path;
+    return NULL;
+  }
+  struct stat st;
+  PCHECK(fstat(fd, &st) == 0) << "Failed to stat " << path;
+  if (static_cast<size_t>(st.st_size) < kHeaderSize + kTrailerSize) {
+    LOG(ERROR) << path << " is too short for a dump";
+    close(fd);
+    return NULL;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  PCHECK(map != MAP_FAILED) << "Failed to map " << path;
+  close(fd);
+
+  EntryDumpReader *reader =
+      new EntryDumpReader(static_cast<const char*>(map), st.st_size);
+  if (!reader->Init()) {
+    LOG(ERROR) << path << " is not a whole dump";
+    delete reader;
+    return NULL;
+  }
+  return reader;
+}
+
+bool EntryDumpReader::Init() {
+  if (memcmp(data_, kMagic, kMagicSize) != 0 ||
+      ReadUint(data_ + kMagicSize, 2) != kFormatVersion)
+    return false;
+  const char *trailer = data_ + size_ - kTrailerSize;
+  if (memcmp(trailer + 12, kTrailerMagic, 4) != 0)
+    return false;
+  const uint64_t index_offset = ReadUint(trailer, 8);
+  const uint64_t chunks = ReadUint(trailer + 8, 4);
+  if (index_offset < kHeaderSize || index_offset > size_ - kTrailerSize)
+    return false;
+
+  FieldReader reader(data_ + index_offset,
+                     size_ - kTrailerSize - index_offset);
+  for (uint64_t i = 0; i < chunks; ++i) {
+    uint64_t first, count, offset, size, uncompressed_size;
+    if (!reader.Uint(8, &first) || !reader.Uint(4, &count) ||
+        !reader.Uint(8, &offset) || !reader.Uint(4, &size) ||
+        !reader.Uint(4, &uncompressed_size))
+      return false;
+    if (offset < kHeaderSize || offset + size > index_offset)
+      return false;
+    DumpChunk chunk = { first, static_cast<uint32_t>(count), offset,
+                        static_cast<uint32_t>(size),
+                        static_cast<uint32_t>(uncompressed_size) };
+    index_.push_back(chunk);
+  }
+  string serialized_sth;
+  return reader.Var(&serialized_sth) && reader.Done() &&
+      sth_.ParseFromString(serialized_sth);
+}
+
+uint64_t EntryDumpReader::ChunkFirstSequenceNumber(size_t chunk) const {
+  CHECK_LT(chunk, index_.size());
+  return index_[chunk].first;
+}
+
+size_t EntryDumpReader::ChunkEntryCount(size_t chunk) const {
+  CHECK_LT(chunk, index_.size());
+  return index_[chunk].count;
+}
+
+bool EntryDumpReader::ReadChunk(size_t chunk,
+                                std::vector<DumpEntry> *entries) const {
+  CHECK_LT(chunk, index_.size());
+  const DumpChunk &info = index_[chunk];
+  string uncompressed(info.uncompressed_size, '\0');
+  uLongf size = uncompressed.size();
+  if (uncompress(reinterpret_cast<Bytef*>(&uncompressed[0]), &size,
+                 reinterpret_cast<const Bytef*>(data_ + info.offset),
+                 info.size) != Z_OK ||
+      size != uncompressed.size())
+    return false;
+
+  FieldReader reader(uncompressed.data(), uncompressed.size());
+  const size_t old_size = entries->size();
+  entries->resize(old_size + info.count);
+  for (size_t i = 0; i < info.count; ++i) {
+    DumpEntry *entry = &(*entries)[old_size + i];
+    if (!reader.Uint(8, &entry->sequence_number) ||
+        !reader.Fixed(kLeafHashSize, &entry->leaf_hash) ||
+        !reader.Var(&entry->leaf) || !reader.Var(&entry->extra_data)) {
+      entries->resize(old_size);
+      return false;
+    }
+  }
+  if (!reader.Done()) {
+    entries->resize(old_size);
+    return false;
+  }
+  return true;
+}
+
+bool EntryDumpReader::Lookup(uint64_t sequence_number,
+                             DumpEntry *entry) const {
+  // The last chunk that starts at or before |sequence_number|.
+  size_t begin = 0, end = index_.size();
+  while (begin < end) {
+    const size_t middle = begin + (end - begin) / 2;
+    if (index_[middle].first <= sequence_number)
+      begin = middle + 1;
+    else
+      end = middle;
+  }
+  if (begin == 0)
+    return false;
+  std::vector<DumpEntry> entries;
+  if (!ReadChunk(begin - 1, &entries))
+    return false;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i].sequence_number == sequence_number) {
+      *entry = entries[i];
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,115 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef ENTRY_DUMP_H
+#define ENTRY_DUMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "proto/ct.pb.h"
+
+// A file of a log's sequenced entries for offline analysis, read at disk
+// speed rather than crawled over get-entries. All integers are big-endian:
+//
+//   header   "CTDUMP", and the format version (2 bytes).
+//   chunks   each the zlib-compressed entries of a run of sequence numbers,
+//            each entry as its sequence number (8 bytes), leaf hash (32
+//            bytes), and MerkleTreeLeaf and extra_data, both preceded by
+//            their length in 4 bytes.
+//   index    for each chunk, its first sequence number (8 bytes), entry
+//            count (4), offset in the file (8), and compressed and
+//            uncompressed size (4 each); then the tree head that the
+//            entries add up to, serialized, preceded by its length in 4
+//            bytes.
+//   trailer  the offset of the index (8 bytes), the chunk count (4), and
+//            "CTDX".
+//
+// A dump is only ever written whole; one that is cut short has no trailer.
+
+struct DumpEntry {
+  uint64_t sequence_number;
+  std::string leaf_hash;
+  std::string leaf;
+  std::string extra_data;
+};
+
+// What the index has of a chunk.
+struct DumpChunk {
+  uint64_t first;
+  uint32_t count;
+  uint64_t offset;
+  uint32_t size;
+  uint32_t uncompressed_size;
+};
+
+// Writes a dump to a temporary file, which it renames to the final one
+// once finished. Aborts on any IO error.
+class EntryDumpWriter {
+ public:
+  // Dump to |path|, |chunk_entries| entries per chunk.
+  EntryDumpWriter(const std::string &path, size_t chunk_entries);
+  // Removes the temporary file of a dump that wasn't finished.
+  ~EntryDumpWriter();
+
+  // Entries must be added in order of their sequence numbers.
+  void Add(const DumpEntry &entry);
+
+  // Write the rest, with |sth| as the tree head, and rename the dump into
+  // place.
+  void Finish(const ct::SignedTreeHead &sth);
+
+ private:
+  void Write(const std::string &data);
+  void FlushChunk();
+
+  const std::string path_;
+  const std::string tmp_path_;
+  const size_t chunk_entries_;
+  int fd_;
+  uint64_t offset_;
+  // The entries of the chunk being filled, serialized.
+  std::string chunk_;
+  DumpChunk current_;
+  std::vector<DumpChunk> index_;
+  bool have_last_;
+  uint64_t last_;
+};
+
+// Reads a dump mapped into memory. Thread-safe.
+class EntryDumpReader {
+ public:
+  ~EntryDumpReader();
+
+  // Returns NULL if |path| is not a whole dump.
+  static EntryDumpReader *Open(const std::string &path);
+
+  const ct::SignedTreeHead &TreeHead() const { return sth_; }
+
+  size_t ChunkCount() const { return index_.size(); }
+
+  // The sequence number of the first entry of |chunk|, and the number of
+  // entries in it.
+  uint64_t ChunkFirstSequenceNumber(size_t chunk) const;
+  size_t ChunkEntryCount(size_t chunk) const;
+
+  // Append the entries of |chunk| to |entries|. Chunks are independent, so
+  // several threads can read several of them at once. Returns false if
+  // the chunk is corrupt.
+  bool ReadChunk(size_t chunk, std::vector<DumpEntry> *entries) const;
+
+  // Find the entry with |sequence_number|, reading only its chunk.
+  bool Lookup(uint64_t sequence_number, DumpEntry *entry) const;
+
+ private:
+  EntryDumpReader(const char *data, size_t size);
+  // Parse the header, index and trailer.
+  bool Init();
+
+  const char *const data_;
+  const size_t size_;
+  std::vector<DumpChunk> index_;
+  ct::SignedTreeHead sth_;
+};
+
+#endif  // ENTRY_DUMP_H
@@ -0,0 +1,151 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "log/entry_dump.h"
+#include "proto/ct.pb.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace {
+
+using ct::SignedTreeHead;
+using std::string;
+using std::vector;
+
+class EntryDumpTest : public ::testing::Test {
+ protected:
+  EntryDumpTest() : tmp_(), path_(tmp_.TmpStorageDir() + "/dump") {
+    sth_.set_version(ct::V1);
+    sth_.set_tree_size(10);
+    sth_.set_timestamp(1234);
+    sth_.set_sha256_root_hash(string(32, 'r'));
+  }
+
+  DumpEntry Entry(uint64_t sequence_number) const {
+    DumpEntry entry;
+    entry.sequence_number = sequence_number;
+    entry.leaf_hash = string(32, static_cast<char>(sequence_number));
+    entry.leaf = util::RandomString(100, 200);
+    entry.extra_data = sequence_number % 3 == 0 ? string() :
+        util::RandomString(500, 1000);
+    return entry;
+  }
+
+  // Dump |count| entries, |chunk_entries| per chunk.
+  vector<DumpEntry> Dump(size_t count, size_t chunk_entries) {
+    vector<DumpEntry> entries;
+    EntryDumpWriter writer(path_, chunk_entries);
+    for (size_t i = 0; i < count; ++i) {
+      entries.push_back(Entry(i));
+      writer.Add(entries.back());
+    }
+    writer.Finish(sth_);
+    return entries;
+  }
+
+  void Overwrite(const string &data) const {
+    FILE *file = fopen(path_.c_str(), "wb");
+    ASSERT_TRUE(file != NULL);
+    EXPECT_EQ(data.size(), fwrite(data.data(), 1, data.size(), file));
+    fclose(file);
+  }
+
+  static void ExpectEntry(const DumpEntry &expected, const DumpEntry &entry) {
+    EXPECT_EQ(expected.sequence_number, entry.sequence_number);
+    EXPECT_EQ(expected.leaf_hash, entry.leaf_hash);
+    EXPECT_EQ(expected.leaf, entry.leaf);
+    EXPECT_EQ(expected.extra_data, entry.extra_data);
+  }
+
+  TmpStorage tmp_;
+  const string path_;
+  SignedTreeHead sth_;
+};
+
+TEST_F(EntryDumpTest, ReadChunks) {
+  const vector<DumpEntry> entries = Dump(10, 4);
+  EntryDumpReader *reader = EntryDumpReader::Open(path_);
+  ASSERT_TRUE(reader != NULL);
+  EXPECT_EQ(sth_.SerializeAsString(), reader->TreeHead().SerializeAsString());
+  ASSERT_EQ(3U, reader->ChunkCount());
+  EXPECT_EQ(8U, reader->ChunkFirstSequenceNumber(2));
+  EXPECT_EQ(2U, reader->ChunkEntryCount(2));
+
+  vector<DumpEntry> read;
+  for (size_t i = 0; i < reader->ChunkCount(); ++i)
+    ASSERT_TRUE(reader->ReadChunk(i, &read));
+  ASSERT_EQ(entries.size(), read.size());
+  for (size_t i = 0; i < entries.size(); ++i)
+    ExpectEntry(entries[i], read[i]);
+  delete reader;
+}
+
+TEST_F(EntryDumpTest, Lookup) {
+  const vector<DumpEntry> entries = Dump(10, 3);
+  EntryDumpReader *reader = EntryDumpReader::Open(path_);
+  ASSERT_TRUE(reader != NULL);
+  DumpEntry entry;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    ASSERT_TRUE(reader->Lookup(i, &entry));
+    ExpectEntry(entries[i], entry);
+  }
+  EXPECT_FALSE(reader->Lookup(10, &entry));
+  delete reader;
+}
+
+TEST_F(EntryDumpTest, Empty) {
+  Dump(0, 3);
+  EntryDumpReader *reader = EntryDumpReader::Open(path_);
+  ASSERT_TRUE(reader != NULL);
+  EXPECT_EQ(0U, reader->ChunkCount());
+  DumpEntry entry;
+  EXPECT_FALSE(reader->Lookup(0, &entry));
+  delete reader;
+}
+
+TEST_F(EntryDumpTest, Unfinished) {
+  {
+    EntryDumpWriter writer(path_, 2);
+    writer.Add(Entry(0));
+    writer.Add(Entry(1));
+    writer.Add(Entry(2));
+  }
+  EXPECT_TRUE(EntryDumpReader::Open(path_) == NULL);
+  EXPECT_TRUE(EntryDumpReader::Open(path_ + ".tmp") == NULL);
+}
+
+TEST_F(EntryDumpTest, Corrupt) {
+  Dump(6, 3);
+  string dump;
+  ASSERT_TRUE(util::ReadBinaryFile(path_, &dump));
+
+  // Cut short.
+  Overwrite(dump.substr(0, dump.size() - 1));
+  EXPECT_TRUE(EntryDumpReader::Open(path_) == NULL);
+
+  // A damaged chunk.
+  string damaged(dump);
+  damaged[10] ^= 0xff;
+  Overwrite(damaged);
+  EntryDumpReader *reader = EntryDumpReader::Open(path_);
+  ASSERT_TRUE(reader != NULL);
+  vector<DumpEntry> read;
+  EXPECT_FALSE(reader->ReadChunk(0, &read));
+  EXPECT_TRUE(read.empty());
+  EXPECT_TRUE(reader->ReadChunk(1, &read));
+  EXPECT_EQ(3U, read.size());
+  delete reader;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
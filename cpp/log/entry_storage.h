@@ -0,0 +1,61 @@
+#ifndef ENTRY_STORAGE_H
+#define ENTRY_STORAGE_H
+
+#include <set>
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "util/memory_usage.h"
+
+// Interface for the (key, data) stores that back a FileDB: FileStorage
+// keeps one file per entry, SegmentStorage appends entries to a few large
+// files. Implementations abort upon any filesystem error.
+class EntryStorage {
+ public:
+  virtual ~EntryStorage() {}
+
+  enum FileStorageResult {
+    OK,
+    // Create failed.
+    ENTRY_ALREADY_EXISTS,
+    // Lookup or update failed.
+    NOT_FOUND,
+  };
+
+  // Scan the entire database and return the list of keys.
+  virtual std::set<std::string> Scan() const = 0;
+
+  // As above, but may use up to |num_threads| threads.
+  virtual std::set<std::string> Scan(size_t num_threads) const = 0;
+
+  // Write (key, data) unless an entry matching |key| already exists.
+  virtual FileStorageResult CreateEntry(const std::string &key,
+                                        const std::string &data) = 0;
+
+  // Update an existing entry; fail if it doesn't already exist.
+  virtual FileStorageResult UpdateEntry(const std::string &key,
+                                        const std::string &data) = 0;
+
+  // Update several existing (key, data) entries; fail without writing
+  // anything if any of them doesn't already exist. A crash leaves a prefix
+  // of the updates done.
+  virtual FileStorageResult UpdateEntries(
+      const std::vector<std::pair<std::string, std::string> > &entries) = 0;
+
+  // Delete the entries with |keys|; fail without deleting anything if any
+  // of them doesn't exist. A crash leaves a prefix of them deleted.
+  virtual FileStorageResult DeleteEntries(
+      const std::vector<std::string> &keys) = 0;
+
+  // Lookup entry based on key.
+  virtual FileStorageResult LookupEntry(const std::string &key,
+                                        std::string *result) const = 0;
+
+  // Memory accounting: the index the storage keeps in memory, if any.
+  virtual util::MemoryUsage MemoryUsage() const {
+    return util::MemoryUsage();
+  }
+};
+#endif
@@ -1,32 +1,211 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/file_db.h"
 
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
 #include <glog/logging.h>
-#include <map>
+#include <iterator>
 #include <set>
 #include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
 #include <utility>  // for std::pair
 #include <vector>
 
-#include "log/file_storage.h"
+#include "log/entry_storage.h"
+#include "merkletree/serial_hasher.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/memory_usage.h"
+#include "util/startup_profiler.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
 
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
 using std::string;
+using util::StartupProfiler;
+
+namespace {
+
+// The index file is a sequence of records, each of
+//   type (1 byte): kPendingRecord or kLoggedRecord,
+//   hash length (1 byte), hash,
+// followed, for a pending entry, by
+//   timestamp (8 bytes),
+// and for a logged entry, by
+//   sequence number (8 bytes), leaf hash length (1 byte), leaf hash,
+// or of
+//   type (1 byte): kDroppedRecord, sequence number (8 bytes),
+// once the logged entries below that sequence number are dropped.
+// Integers are big-endian. A later record for a hash supersedes earlier ones.
+const char kPendingRecord = 'P';
+const char kLoggedRecord = 'L';
+const char kDroppedRecord = 'D';
+
+// What the index knows about an entry, or about dropped ones.
+struct IndexEntry {
+  IndexEntry()
+      : dropped(false), logged(false), sequence_number(0), timestamp(0) {}
+
+  // If so, the entries below |sequence_number| are gone, and there is no
+  // hash.
+  bool dropped;
+  string hash;
+  bool logged;
+  // If logged.
+  uint64_t sequence_number;
+  string leaf_hash;
+  // If pending.
+  uint64_t timestamp;
+};
+
+void AppendShortString(const string &value, string *records) {
+  CHECK_LE(value.size(), 255U);
+  records->push_back(static_cast<char>(value.size()));
+  records->append(value);
+}
+
+void AppendPendingRecord(const string &hash, uint64_t timestamp,
+                         string *records) {
+  records->push_back(kPendingRecord);
+  AppendShortString(hash, records);
+  records->append(Serializer::SerializeUint(timestamp, 8));
+}
+
+void AppendLoggedRecord(const string &hash, uint64_t sequence_number,
+                        const string &leaf_hash, string *records) {
+  records->push_back(kLoggedRecord);
+  AppendShortString(hash, records);
+  records->append(Serializer::SerializeUint(sequence_number, 8));
+  AppendShortString(leaf_hash, records);
+}
+
+void AppendDroppedRecord(uint64_t end, string *records) {
+  records->push_back(kDroppedRecord);
+  records->append(Serializer::SerializeUint(end, 8));
+}
+
+bool ReadShortString(const string &data, size_t *pos, string *value) {
+  if (*pos >= data.size())
+    return false;
+  size_t length = static_cast<unsigned char>(data[*pos]);
+  if (data.size() - *pos - 1 < length)
+    return false;
+  value->assign(data, *pos + 1, length);
+  *pos += 1 + length;
+  return true;
+}
+
+bool ReadUint64(const string &data, size_t *pos, uint64_t *value) {
+  if (data.size() - *pos < 8)
+    return false;
+  CHECK_EQ(Deserializer::OK,
+           Deserializer::DeserializeUint(data.substr(*pos, 8), 8, value));
+  *pos += 8;
+  return true;
+}
+
+// Entry and leaf hashes are SHA-256.
+const size_t kHashSize = Sha256Hasher::kDigestLength;
+
+enum IndexRecordResult {
+  RECORD_OK,
+  // The data ends before the record does, as when we died writing it.
+  RECORD_TRUNCATED,
+  // Not a record that we write.
+  RECORD_CORRUPT,
+};
+
+// Read the record at |*pos| and, if it is whole, advance |*pos| past it.
+IndexRecordResult ReadIndexRecord(const string &data, size_t *pos,
+                                  IndexEntry *entry) {
+  size_t next = *pos;
+  if (next >= data.size())
+    return RECORD_TRUNCATED;
+  const char type = data[next++];
+  if (type != kPendingRecord && type != kLoggedRecord &&
+      type != kDroppedRecord)
+    return RECORD_CORRUPT;
+  entry->dropped = type == kDroppedRecord;
+  entry->logged = type == kLoggedRecord;
+  if (entry->dropped) {
+    entry->hash.clear();
+    if (!ReadUint64(data, &next, &entry->sequence_number))
+      return RECORD_TRUNCATED;
+    *pos = next;
+    return RECORD_OK;
+  }
+  if (!ReadShortString(data, &next, &entry->hash))
+    return RECORD_TRUNCATED;
+  if (entry->logged) {
+    if (!ReadUint64(data, &next, &entry->sequence_number) ||
+        !ReadShortString(data, &next, &entry->leaf_hash))
+      return RECORD_TRUNCATED;
+  } else if (!ReadUint64(data, &next, &entry->timestamp)) {
+    return RECORD_TRUNCATED;
+  }
+  if (entry->hash.size() != kHashSize ||
+      (entry->logged && entry->leaf_hash.size() != kHashSize))
+    return RECORD_CORRUPT;
+  *pos = next;
+  return RECORD_OK;
+}
+
+size_t ReadThreads() {
+  return util::ThreadPool::Default()->Parallelism();
+}
+
+}  // namespace
 
 template <class Logged> const size_t FileDB<Logged>::kTimestampBytesIndexed = 6;
 
-template <class Logged> FileDB<Logged>::FileDB(FileStorage *cert_storage,
-                                               FileStorage *tree_storage)
-    : cert_storage_(cert_storage),
+template <class Logged>
+FileDB<Logged>::FileDB(EntryStorage *cert_storage, EntryStorage *tree_storage)
+    : pending_hashes_(kHashSize),
+      sequence_map_(kHashSize),
+      leaf_hash_map_(kHashSize),
+      cert_storage_(cert_storage),
+      tree_storage_(tree_storage),
+      latest_tree_timestamp_(0),
+      index_fd_(-1) {
+  BuildIndex();
+}
+
+template <class Logged>
+FileDB<Logged>::FileDB(EntryStorage *cert_storage, EntryStorage *tree_storage,
+                       const string &index_file)
+    : pending_hashes_(kHashSize),
+      sequence_map_(kHashSize),
+      leaf_hash_map_(kHashSize),
+      cert_storage_(cert_storage),
+      tree_storage_(tree_storage),
+      latest_tree_timestamp_(0),
+      index_file_(index_file),
+      index_fd_(-1) {
+  BuildIndex();
+}
+
+template <class Logged>
+FileDB<Logged>::FileDB(EntryStorage *cert_storage, EntryStorage *tree_storage,
+                       const string &index_file,
+                       const EntryCompressor *compressor)
+    : pending_hashes_(kHashSize),
+      sequence_map_(kHashSize),
+      leaf_hash_map_(kHashSize),
+      cert_storage_(cert_storage),
       tree_storage_(tree_storage),
-      latest_tree_timestamp_(0) {
+      latest_tree_timestamp_(0),
+      index_file_(index_file),
+      index_fd_(-1) {
+  this->SetCompressor(compressor);
   BuildIndex();
 }
 
 template <class Logged> FileDB<Logged>::~FileDB() {
+  if (index_fd_ >= 0)
+    PCHECK(close(index_fd_) == 0) << "Failed to close " << index_file_;
   delete cert_storage_;
   delete tree_storage_;
 }
@@ -34,65 +213,206 @@ template <class Logged> FileDB<Logged>::~FileDB() {
 template <class Logged> typename Database<Logged>::WriteResult
 FileDB<Logged>::CreatePendingEntry_(const Logged &logged) {
   const std::string hash = logged.Hash();
-  if (pending_hashes_.find(hash) != pending_hashes_.end())
+  if (pending_hashes_.Find(hash, NULL))
     return this->DUPLICATE_CERTIFICATE_HASH;
 
-  // ??? We've already asserted that there is no sequence number!
-  Logged local;
-  local.CopyFrom(logged);
-  local.clear_sequence_number();
-
+  // Database::CreatePendingEntry() has checked that there is no sequence
+  // number, so there's nothing to clear.
   string data;
-  CHECK(local.SerializeToString(&data));
+  CHECK(logged.SerializeToString(&data));
+  this->CompressEntry(&data);
+  if (index_fd_ >= 0) {
+    if (cert_storage_->LookupEntry(hash, NULL) == EntryStorage::OK)
+      return this->DUPLICATE_CERTIFICATE_HASH;
+    // Record the entry before writing it, so that the index never misses
+    // one. Should we die in between, the record is dropped on boot.
+    string record;
+    AppendPendingRecord(hash, logged.timestamp(), &record);
+    WriteIndexRecords(record);
+  }
   // Try to create.
-  FileStorage::FileStorageResult result =
+  EntryStorage::FileStorageResult result =
       cert_storage_->CreateEntry(hash, data);
-  if (result == FileStorage::ENTRY_ALREADY_EXISTS)
+  if (result == EntryStorage::ENTRY_ALREADY_EXISTS)
     return this->DUPLICATE_CERTIFICATE_HASH;
-  assert(result == FileStorage::OK);
-  pending_hashes_.insert(hash);
+  assert(result == EntryStorage::OK);
+  IndexPendingEntry(hash, logged.timestamp());
   return this->OK;
 }
 
 template <class Logged> std::set<string> FileDB<Logged>::PendingHashes() const {
-  return pending_hashes_;
+  std::vector<string> pending;
+  pending_hashes_.Digests(&pending);
+  return std::set<string>(pending.begin(), pending.end());
+}
+
+template <class Logged> void FileDB<Logged>::LookupPendingEntries(
+    size_t limit, typename Database<Logged>::EntryCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  std::set<std::pair<uint64_t, string> >::const_iterator it;
+  size_t count = 0;
+  for (it = pending_by_timestamp_.begin();
+       it != pending_by_timestamp_.end() && (limit == 0 || count < limit);
+       ++it, ++count) {
+    string cert_data;
+    EntryStorage::FileStorageResult result =
+        cert_storage_->LookupEntry(it->second, &cert_data);
+    assert(result == EntryStorage::OK);
+
+    CHECK(this->DecompressEntry(&cert_data));
+    Logged logged;
+    bool ret = logged.ParseFromString(cert_data);
+    assert(ret);
+    if (!callback->Entry(logged))
+      return;
+  }
 }
 
 template <class Logged> typename Database<Logged>::WriteResult
 FileDB<Logged>::AssignSequenceNumber(const string &hash,
                                      uint64_t sequence_number) {
-  std::set<string>::iterator pending_it =
-      pending_hashes_.find(hash);
-  if (pending_it == pending_hashes_.end()) {
+  string cert_data, leaf_hash;
+  typename Database<Logged>::WriteResult result =
+      PrepareSequenceNumber(hash, sequence_number, &cert_data, &leaf_hash);
+  if (result != this->OK)
+    return result;
+
+  EntryStorage::FileStorageResult storage_result =
+      cert_storage_->UpdateEntry(hash, cert_data);
+  assert(storage_result == EntryStorage::OK);
+
+  IndexSequenceNumber(hash, sequence_number, leaf_hash);
+  string record;
+  AppendLoggedRecord(hash, sequence_number, leaf_hash, &record);
+  WriteIndexRecords(record);
+  return this->OK;
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+FileDB<Logged>::AssignSequenceNumbers(const std::vector<string> &hashes,
+                                      uint64_t first_sequence_number,
+                                      size_t *assigned) {
+  CHECK_NOTNULL(assigned);
+  // Check and prepare each entry first, so that the file writes can be
+  // grouped.
+  std::vector<std::pair<string, string> > updates;
+  std::vector<string> leaf_hashes;
+  std::set<string> batch;
+  typename Database<Logged>::WriteResult result = this->OK;
+  for (size_t i = 0; i < hashes.size(); ++i) {
+    // A hash repeated in the batch is already logged by the time we get
+    // to it.
+    if (batch.find(hashes[i]) != batch.end()) {
+      result = this->ENTRY_ALREADY_LOGGED;
+      break;
+    }
+    string cert_data, leaf_hash;
+    result = PrepareSequenceNumber(hashes[i], first_sequence_number + i,
+                                   &cert_data, &leaf_hash);
+    if (result != this->OK)
+      break;
+    batch.insert(hashes[i]);
+    updates.push_back(std::make_pair(hashes[i], string()));
+    updates.back().second.swap(cert_data);
+    leaf_hashes.push_back(leaf_hash);
+  }
+
+  EntryStorage::FileStorageResult storage_result =
+      cert_storage_->UpdateEntries(updates);
+  assert(storage_result == EntryStorage::OK);
+
+  string records;
+  for (size_t i = 0; i < updates.size(); ++i) {
+    IndexSequenceNumber(updates[i].first, first_sequence_number + i,
+                        leaf_hashes[i]);
+    AppendLoggedRecord(updates[i].first, first_sequence_number + i,
+                       leaf_hashes[i], &records);
+  }
+  WriteIndexRecords(records);
+  *assigned = updates.size();
+  return result;
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+FileDB<Logged>::PrepareSequenceNumber(const string &hash,
+                                      uint64_t sequence_number,
+                                      string *cert_data,
+                                      string *leaf_hash) const {
+  if (!pending_hashes_.Find(hash, NULL)) {
     // Caller should have ensured we don't get here...
     if (cert_storage_->LookupEntry(hash, NULL) ==
-        FileStorage::OK)
+        EntryStorage::OK)
       return this->ENTRY_ALREADY_LOGGED;
     return this->ENTRY_NOT_FOUND;
   }
 
-  if (sequence_map_.find(sequence_number) != sequence_map_.end())
+  // Dropped sequence numbers were used.
+  if (sequence_number < sequence_map_.first() ||
+      sequence_map_.Has(sequence_number))
     return this->SEQUENCE_NUMBER_ALREADY_IN_USE;
 
-  string cert_data;
-  FileStorage::FileStorageResult result =
-      cert_storage_->LookupEntry(hash, &cert_data);
-  assert(result == FileStorage::OK);
+  EntryStorage::FileStorageResult result =
+      cert_storage_->LookupEntry(hash, cert_data);
+  assert(result == EntryStorage::OK);
 
+  CHECK(this->DecompressEntry(cert_data));
   Logged logged;
-  bool ret = logged.ParseFromString(cert_data);
+  bool ret = logged.ParseFromString(*cert_data);
   assert(ret);
   assert(!logged.has_sequence_number());
   logged.set_sequence_number(sequence_number);
-  logged.SerializeToString(&cert_data);
-  result = cert_storage_->UpdateEntry(hash, cert_data);
-  assert(result == FileStorage::OK);
-
-  pending_hashes_.erase(pending_it);
-  sequence_map_.insert(std::pair<uint64_t, string>(sequence_number, hash));
+  logged.SerializeToString(cert_data);
+  this->CompressEntry(cert_data);
+  *leaf_hash = this->LeafHash(logged);
   return this->OK;
 }
 
+template <class Logged>
+void FileDB<Logged>::IndexPendingEntry(const string &hash, uint64_t timestamp) {
+  pending_hashes_.Insert(hash, timestamp);
+  pending_by_timestamp_.insert(std::make_pair(timestamp, hash));
+}
+
+template <class Logged>
+void FileDB<Logged>::UnindexPendingEntry(const string &hash) {
+  uint64_t timestamp;
+  if (!pending_hashes_.Find(hash, &timestamp))
+    return;
+  pending_by_timestamp_.erase(std::make_pair(timestamp, hash));
+  pending_hashes_.Erase(hash);
+}
+
+template <class Logged>
+void FileDB<Logged>::IndexSequenceNumber(const string &hash,
+                                         uint64_t sequence_number,
+                                         const string &leaf_hash) {
+  UnindexPendingEntry(hash);
+  sequence_map_.Set(sequence_number, hash);
+  leaf_hash_map_.Set(sequence_number, leaf_hash);
+}
+
+template <class Logged> bool FileDB<Logged>::DropLoggedEntries(uint64_t end) {
+  if (end <= sequence_map_.first())
+    return true;
+  // Deleted before the index says so, so that if we die in between, this
+  // can be done again: the entries already gone are skipped.
+  std::vector<string> hashes;
+  const uint64_t last = std::min<uint64_t>(end, sequence_map_.size());
+  string hash;
+  for (uint64_t i = sequence_map_.first(); i < last; ++i)
+    if (sequence_map_.Get(i, &hash) &&
+        cert_storage_->LookupEntry(hash, NULL) == EntryStorage::OK)
+      hashes.push_back(hash);
+  CHECK_EQ(EntryStorage::OK, cert_storage_->DeleteEntries(hashes));
+
+  string record;
+  AppendDroppedRecord(end, &record);
+  WriteIndexRecords(record);
+  sequence_map_.EraseBelow(end);
+  leaf_hash_map_.EraseBelow(end);
+  return true;
+}
+
 template <class Logged> typename Database<Logged>::LookupResult
 FileDB<Logged>::LookupByHash(const string &hash) const {
  return LookupByHash(hash, NULL);
@@ -102,43 +422,103 @@ template <class Logged> typename Database<Logged>::LookupResult
 FileDB<Logged>::LookupByHash(const string &hash,
                              Logged *result) const {
   string cert_data;
-  FileStorage::FileStorageResult db_result =
+  EntryStorage::FileStorageResult db_result =
       cert_storage_->LookupEntry(hash, &cert_data);
-  if (db_result == FileStorage::NOT_FOUND)
+  if (db_result == EntryStorage::NOT_FOUND)
     return this->NOT_FOUND;
-  assert(db_result == FileStorage::OK);
+  assert(db_result == EntryStorage::OK);
 
+  CHECK(this->DecompressEntry(&cert_data));
   Logged logged;
   bool ret = logged.ParseFromString(cert_data);
   assert(ret);
 
   if (result != NULL)
-    result->CopyFrom(logged);
+    result->Swap(&logged);
 
   return this->LOOKUP_OK;
 }
 
 template <class Logged> typename Database<Logged>::LookupResult
 FileDB<Logged>::LookupByIndex(uint64_t sequence_number, Logged *result) const {
-  std::map<uint64_t, string>::const_iterator it =
-      sequence_map_.find(sequence_number);
-  if (it == sequence_map_.end())
+  string hash;
+  if (!sequence_map_.Get(sequence_number, &hash))
     return this->NOT_FOUND;
 
   if (result != NULL) {
     string cert_data;
-    FileStorage::FileStorageResult db_result =
-        cert_storage_->LookupEntry(it->second, &cert_data);
-    assert(db_result == FileStorage::OK);
+    EntryStorage::FileStorageResult db_result =
+        cert_storage_->LookupEntry(hash, &cert_data);
+    assert(db_result == EntryStorage::OK);
 
+    CHECK(this->DecompressEntry(&cert_data));
     Logged logged;
     bool ret = logged.ParseFromString(cert_data);
     assert(ret);
     assert(logged.sequence_number() == sequence_number);
 
-    result->CopyFrom(logged);
+    result->Swap(&logged);
+  }
+
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+FileDB<Logged>::LookupByIndexRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::EntryCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  string hash;
+  for (uint64_t next = start; next < end; ++next) {
+    if (!sequence_map_.Get(next, &hash))
+      return this->NOT_FOUND;
+
+    string cert_data;
+    EntryStorage::FileStorageResult db_result =
+        cert_storage_->LookupEntry(hash, &cert_data);
+    assert(db_result == EntryStorage::OK);
+
+    CHECK(this->DecompressEntry(&cert_data));
+    Logged logged;
+    bool ret = logged.ParseFromString(cert_data);
+    assert(ret);
+    assert(logged.sequence_number() == next);
+    if (!callback->Entry(logged))
+      break;
+  }
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+FileDB<Logged>::LookupLeafHashRange(uint64_t start, uint64_t end,
+                                    std::vector<string> *hashes) const {
+  CHECK_NOTNULL(hashes);
+  if (start >= end)
+    return this->LOOKUP_OK;
+
+  for (uint64_t next = start; next < end; ++next)
+    if (!leaf_hash_map_.Has(next))
+      return this->NOT_FOUND;
+
+  hashes->reserve(hashes->size() + (end - start));
+  for (uint64_t next = start; next < end; ++next) {
+    hashes->push_back(string());
+    leaf_hash_map_.Get(next, &hashes->back());
   }
+  return this->LOOKUP_OK;
+}
 
+template <class Logged> typename Database<Logged>::LookupResult
+FileDB<Logged>::LookupEntryHashRange(uint64_t start, uint64_t end,
+                                     std::vector<string> *hashes) const {
+  CHECK_NOTNULL(hashes);
+  for (uint64_t next = start; next < end; ++next) {
+    hashes->push_back(string());
+    if (!sequence_map_.Get(next, &hashes->back())) {
+      hashes->pop_back();
+      return this->NOT_FOUND;
+    }
+  }
   return this->LOOKUP_OK;
 }
 
@@ -152,16 +532,20 @@ FileDB<Logged>::WriteTreeHead_(const SignedTreeHead &sth) {
   bool ret = sth.SerializeToString(&data);
   assert(ret);
 
-  FileStorage::FileStorageResult result =
+  EntryStorage::FileStorageResult result =
       tree_storage_->CreateEntry(timestamp_key, data);
-  if (result == FileStorage::ENTRY_ALREADY_EXISTS)
+  if (result == EntryStorage::ENTRY_ALREADY_EXISTS)
     return this->DUPLICATE_TREE_HEAD_TIMESTAMP;
-  assert(result == FileStorage::OK);
+  assert(result == EntryStorage::OK);
 
   if (sth.timestamp() > latest_tree_timestamp_) {
     latest_tree_timestamp_ = sth.timestamp();
     latest_timestamp_key_ = timestamp_key;
   }
+  tree_timestamps_.insert(std::upper_bound(tree_timestamps_.begin(),
+                                           tree_timestamps_.end(),
+                                           sth.timestamp()),
+                          sth.timestamp());
 
   return this->OK;
 }
@@ -172,9 +556,9 @@ FileDB<Logged>::LatestTreeHead(SignedTreeHead *result) const {
     return this->NOT_FOUND;
 
   string tree_data;
-  FileStorage::FileStorageResult db_result =
+  EntryStorage::FileStorageResult db_result =
       tree_storage_->LookupEntry(latest_timestamp_key_, &tree_data);
-  assert(db_result == FileStorage::OK);
+  assert(db_result == EntryStorage::OK);
 
   SignedTreeHead local_sth;
 
@@ -182,46 +566,379 @@ FileDB<Logged>::LatestTreeHead(SignedTreeHead *result) const {
   assert(ret);
   assert(local_sth.timestamp() == latest_tree_timestamp_);
 
-  result->CopyFrom(local_sth);
+  result->Swap(&local_sth);
   return this->LOOKUP_OK;
 }
 
-template <class Logged> void FileDB<Logged>::BuildIndex() {
-  pending_hashes_ = cert_storage_->Scan();
-  if (pending_hashes_.empty())
-    return;
-  // Now read the entries: remove those that have a sequence number
-  // from the set of pending entries and add them to the index.
-  std::set<string>::iterator it = pending_hashes_.begin();
-  do {
-    // Increment before any erase operations.
-    std::set<string>::iterator it2 = it++;
+template <class Logged> typename Database<Logged>::LookupResult
+FileDB<Logged>::LookupTreeHeadByTimestamp(uint64_t timestamp,
+                                          SignedTreeHead *result) const {
+  if (!std::binary_search(tree_timestamps_.begin(), tree_timestamps_.end(),
+                          timestamp))
+    return this->NOT_FOUND;
+  ReadTreeHead(timestamp, result);
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+FileDB<Logged>::LookupTreeHeadBySize(uint64_t tree_size,
+                                     SignedTreeHead *result) const {
+  // Find the last tree head of at most |tree_size|.
+  size_t low = 0, high = tree_timestamps_.size();
+  SignedTreeHead sth;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    ReadTreeHead(tree_timestamps_[middle], &sth);
+    if (sth.tree_size() <= tree_size)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if (low == 0)
+    return this->NOT_FOUND;
+  ReadTreeHead(tree_timestamps_[low - 1], &sth);
+  if (sth.tree_size() != tree_size)
+    return this->NOT_FOUND;
+  result->Swap(&sth);
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> void FileDB<Logged>::LookupTreeHeadRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::TreeHeadCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  for (std::vector<uint64_t>::const_iterator it =
+           std::lower_bound(tree_timestamps_.begin(), tree_timestamps_.end(),
+                            start);
+       it != tree_timestamps_.end() && *it < end; ++it) {
+    SignedTreeHead sth;
+    ReadTreeHead(*it, &sth);
+    if (!callback->TreeHead(sth))
+      return;
+  }
+}
+
+template <class Logged>
+void FileDB<Logged>::ExportMemoryUsage(util::Metrics *metrics) const {
+  util::MemoryUsage pending = pending_hashes_.MemoryUsage();
+  for (std::set<std::pair<uint64_t, string> >::const_iterator it =
+           pending_by_timestamp_.begin();
+       it != pending_by_timestamp_.end(); ++it)
+    pending.bytes += util::kTreeNodeBytes + sizeof(*it) +
+        util::HeapBytes(it->second);
+  util::MemoryUsage sequenced = sequence_map_.MemoryUsage();
+  sequenced.bytes += leaf_hash_map_.MemoryUsage().bytes;
+  util::MemoryUsage storage = cert_storage_->MemoryUsage();
+  storage.Add(tree_storage_->MemoryUsage());
+  util::ExportMemoryUsage("file_db_pending_index", pending, metrics);
+  util::ExportMemoryUsage("file_db_sequence_index", sequenced, metrics);
+  util::ExportMemoryUsage(
+      "file_db_tree_heads",
+      util::MemoryUsage(util::HeapBytes(tree_timestamps_),
+                        tree_timestamps_.size()), metrics);
+  util::ExportMemoryUsage("entry_storage_index", storage, metrics);
+}
+
+template <class Logged>
+void FileDB<Logged>::ReadTreeHead(uint64_t timestamp,
+                                  SignedTreeHead *result) const {
+  string tree_data;
+  EntryStorage::FileStorageResult db_result =
+      tree_storage_->LookupEntry(
+          Serializer::SerializeUint(timestamp, FileDB::kTimestampBytesIndexed),
+          &tree_data);
+  CHECK_EQ(EntryStorage::OK, db_result);
+  CHECK(result->ParseFromString(tree_data));
+  CHECK_EQ(timestamp, result->timestamp());
+}
+
+// The entries that one thread reads, and what it found out about them.
+template <class Logged> struct FileDB<Logged>::ReadJob {
+  const FileDB<Logged> *db;
+  const EntryStorage *storage;
+  const std::vector<string> *hashes;
+  std::vector<IndexEntry> *entries;
+  StartupProfiler::Phase *phase;
+};
+
+// static
+template <class Logged>
+void FileDB<Logged>::ReadEntries(void *arg, size_t chunk, size_t begin,
+                                 size_t end) {
+  ReadJob *job = static_cast<ReadJob*>(arg);
+  std::vector<IndexEntry>::iterator out = job->entries->begin() + begin;
+  for (std::vector<string>::const_iterator it = job->hashes->begin() + begin;
+       it != job->hashes->begin() + end; ++it, ++out) {
     string cert_data;
     // Read the data; tolerate no errors.
-    FileStorage::FileStorageResult result =
-        cert_storage_->LookupEntry(*it2, &cert_data);
-    if (result != FileStorage::OK)
+    EntryStorage::FileStorageResult result =
+        job->storage->LookupEntry(*it, &cert_data);
+    if (result != EntryStorage::OK)
       abort();
     Logged logged;
-    if (!logged.ParseFromString(cert_data))
+    if (!job->db->DecompressEntry(&cert_data) ||
+        !logged.ParseFromString(cert_data))
+      abort();
+    out->hash = *it;
+    out->logged = logged.has_sequence_number();
+    if (out->logged) {
+      out->sequence_number = logged.sequence_number();
+      out->leaf_hash = Database<Logged>::LeafHash(logged);
+    } else {
+      out->timestamp = logged.timestamp();
+    }
+    job->phase->Add(1);
+  }
+}
+
+template <class Logged> void FileDB<Logged>::ScanEntries(size_t num_threads) {
+  std::vector<string> hashes;
+  {
+    StartupProfiler::Phase phase("listing entries", "entries");
+    std::set<string> hash_set = cert_storage_->Scan(num_threads);
+    hashes.assign(hash_set.begin(), hash_set.end());
+    phase.Add(hashes.size());
+  }
+  std::vector<IndexEntry> entries(hashes.size());
+  StartupProfiler::Phase phase("reading entries", "entries");
+  phase.SetTotal(hashes.size());
+
+  // Reading and parsing the entries is what takes time, so split it up.
+  if (num_threads > hashes.size())
+    num_threads = hashes.size();
+  if (num_threads > 0) {
+    ReadJob job = { this, cert_storage_, &hashes, &entries, &phase };
+    util::ThreadPool::Default()->ParallelFor(hashes.size(), num_threads,
+                                             ReadEntries, &job);
+  }
+
+  // Entries below the first one logged may have been dropped, so the index
+  // starts there.
+  uint64_t first_logged = 0;
+  bool any_logged = false;
+  for (size_t i = 0; i < entries.size(); ++i)
+    if (entries[i].logged &&
+        (!any_logged || entries[i].sequence_number < first_logged)) {
+      first_logged = entries[i].sequence_number;
+      any_logged = true;
+    }
+  string records;
+  if (first_logged > 0) {
+    sequence_map_.EraseBelow(first_logged);
+    leaf_hash_map_.EraseBelow(first_logged);
+    AppendDroppedRecord(first_logged, &records);
+  }
+
+  // Add those that have a sequence number to the index, and the rest to the
+  // pending entries.
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const IndexEntry &entry = entries[i];
+    if (entry.logged) {
+      IndexSequenceNumber(entry.hash, entry.sequence_number, entry.leaf_hash);
+      AppendLoggedRecord(entry.hash, entry.sequence_number, entry.leaf_hash,
+                         &records);
+    } else {
+      IndexPendingEntry(entry.hash, entry.timestamp);
+      AppendPendingRecord(entry.hash, entry.timestamp, &records);
+    }
+  }
+
+  if (index_file_.empty())
+    return;
+  // Write a new file and rename it into place, so that a crash never leaves
+  // a partial index behind.
+  string tmp_file =
+      util::WriteTemporaryBinaryFile(index_file_ + ".XXXXXX", records);
+  CHECK(!tmp_file.empty()) << "Failed to write index file";
+  PCHECK(rename(tmp_file.c_str(), index_file_.c_str()) == 0)
+      << "Failed to rename " << tmp_file << " to " << index_file_;
+  index_fd_ = open(index_file_.c_str(), O_WRONLY | O_APPEND);
+  PCHECK(index_fd_ >= 0) << "Failed to open " << index_file_;
+}
+
+template <class Logged> bool FileDB<Logged>::LoadIndexFile() {
+  index_fd_ = open(index_file_.c_str(), O_WRONLY | O_APPEND);
+  if (index_fd_ < 0 && errno == ENOENT) {
+    LOG(INFO) << "No index file " << index_file_ << ", reading all entries";
+    return false;
+  }
+  PCHECK(index_fd_ >= 0) << "Failed to open " << index_file_;
+
+  StartupProfiler::Phase phase("loading index", "records");
+  string data;
+  CHECK(util::ReadBinaryFile(index_file_, &data))
+      << "Failed to read " << index_file_;
+  size_t pos = 0;
+  IndexEntry entry;
+  IndexRecordResult read;
+  while ((read = ReadIndexRecord(data, &pos, &entry)) == RECORD_OK) {
+    phase.Add(1);
+    if (entry.dropped) {
+      sequence_map_.EraseBelow(entry.sequence_number);
+      leaf_hash_map_.EraseBelow(entry.sequence_number);
+    } else if (entry.logged) {
+      if (entry.sequence_number < sequence_map_.first()) {
+        read = RECORD_CORRUPT;
+        break;
+      }
+      IndexSequenceNumber(entry.hash, entry.sequence_number, entry.leaf_hash);
+    } else {
+      UnindexPendingEntry(entry.hash);
+      IndexPendingEntry(entry.hash, entry.timestamp);
+    }
+  }
+  if (read == RECORD_CORRUPT) {
+    LOG(WARNING) << "Corrupt record at offset " << pos << " of "
+                 << index_file_ << ", reading all entries";
+    ClearIndex();
+    return false;
+  }
+  if (pos < data.size()) {
+    LOG(WARNING) << "Discarding a partially written record at the end of "
+                 << index_file_;
+    PCHECK(ftruncate(index_fd_, pos) == 0)
+        << "Failed to truncate " << index_file_;
+  }
+
+  // The index may be behind the entries it has as pending, if we died
+  // between writing one and the other: the entry has a sequence number, or
+  // it was never written.
+  std::vector<string> pending;
+  pending_hashes_.Digests(&pending);
+  string records;
+  for (size_t i = 0; i < pending.size(); ++i) {
+    string cert_data;
+    if (cert_storage_->LookupEntry(pending[i], &cert_data) !=
+        EntryStorage::OK) {
+      UnindexPendingEntry(pending[i]);
+      continue;
+    }
+    Logged logged;
+    if (!this->DecompressEntry(&cert_data) ||
+        !logged.ParseFromString(cert_data))
       abort();
     if (logged.has_sequence_number()) {
-      sequence_map_.insert(
-          std::pair<uint64_t, string>(logged.sequence_number(), *it2));
-      pending_hashes_.erase(it2);
+      string leaf_hash = this->LeafHash(logged);
+      IndexSequenceNumber(pending[i], logged.sequence_number(), leaf_hash);
+      AppendLoggedRecord(pending[i], logged.sequence_number(), leaf_hash,
+                         &records);
     }
-  } while (it != pending_hashes_.end());
+  }
+
+  if (!IndexUnindexedEntries(&records)) {
+    LOG(WARNING) << "Index file " << index_file_ << " has entries that are "
+                 << "no longer stored, reading all entries";
+    ClearIndex();
+    return false;
+  }
+  WriteIndexRecords(records);
+  return true;
+}
+
+template <class Logged>
+bool FileDB<Logged>::IndexUnindexedEntries(string *records) {
+  // Listing the entries is cheap next to reading them.
+  std::set<string> stored;
+  {
+    StartupProfiler::Phase phase("listing entries", "entries");
+    stored = cert_storage_->Scan(ReadThreads());
+    phase.Add(stored.size());
+  }
+  std::vector<string> indexed;
+  pending_hashes_.Digests(&indexed);
+  string hash;
+  for (uint64_t i = sequence_map_.first(); i < sequence_map_.size(); ++i)
+    if (sequence_map_.Get(i, &hash))
+      indexed.push_back(hash);
+  std::sort(indexed.begin(), indexed.end());
+
+  std::vector<string> unindexed;
+  std::set_difference(stored.begin(), stored.end(), indexed.begin(),
+                      indexed.end(), std::back_inserter(unindexed));
+  // Entries deleted without the index knowing, as by dropping them.
+  if (stored.size() - unindexed.size() != indexed.size())
+    return false;
+  if (unindexed.empty())
+    return true;
+
+  // Written while the database was opened without the index file.
+  LOG(WARNING) << "Index file " << index_file_ << " is missing "
+               << unindexed.size() << " entries, reading them";
+  StartupProfiler::Phase phase("reading unindexed entries", "entries");
+  phase.SetTotal(unindexed.size());
+  std::vector<IndexEntry> entries(unindexed.size());
+  ReadJob job = { this, cert_storage_, &unindexed, &entries, &phase };
+  util::ThreadPool::Default()->ParallelFor(
+      unindexed.size(), std::min(ReadThreads(), unindexed.size()),
+      ReadEntries, &job);
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const IndexEntry &entry = entries[i];
+    if (entry.logged) {
+      if (entry.sequence_number < sequence_map_.first() ||
+          sequence_map_.Has(entry.sequence_number))
+        return false;
+      IndexSequenceNumber(entry.hash, entry.sequence_number, entry.leaf_hash);
+      AppendLoggedRecord(entry.hash, entry.sequence_number, entry.leaf_hash,
+                         records);
+    } else {
+      IndexPendingEntry(entry.hash, entry.timestamp);
+      AppendPendingRecord(entry.hash, entry.timestamp, records);
+    }
+  }
+  return true;
+}
+
+template <class Logged> void FileDB<Logged>::ClearIndex() {
+  if (index_fd_ >= 0)
+    PCHECK(close(index_fd_) == 0) << "Failed to close " << index_file_;
+  index_fd_ = -1;
+  pending_hashes_.Clear();
+  pending_by_timestamp_.clear();
+  sequence_map_.Clear();
+  leaf_hash_map_.Clear();
+}
+
+template <class Logged>
+void FileDB<Logged>::WriteIndexRecords(const string &records) {
+  if (index_fd_ < 0)
+    return;
+  // Like the entries themselves, the index is not synced to disk.
+  size_t written = 0;
+  while (written < records.size()) {
+    ssize_t ret = write(index_fd_, records.data() + written,
+                        records.size() - written);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    PCHECK(ret > 0) << "Failed to write to " << index_file_;
+    written += ret;
+  }
+}
+
+template <class Logged> void FileDB<Logged>::BuildIndex() {
+  StartupProfiler::Phase phase("building index");
+  if (index_file_.empty() || !LoadIndexFile())
+    ScanEntries(ReadThreads());
 
   // Now read the STH entries.
   std::set<string> sth_timestamps = tree_storage_->Scan();
 
-  if (!sth_timestamps.empty()) {
-    latest_timestamp_key_ = *sth_timestamps.rbegin();
+  // The keys are big-endian, so they come in timestamp order.
+  tree_timestamps_.reserve(sth_timestamps.size());
+  for (std::set<string>::const_iterator it = sth_timestamps.begin();
+       it != sth_timestamps.end(); ++it) {
+    uint64_t timestamp;
     Deserializer::DeserializeResult result =
-        Deserializer::DeserializeUint<uint64_t>(latest_timestamp_key_,
+        Deserializer::DeserializeUint<uint64_t>(*it,
                                                 FileDB::kTimestampBytesIndexed,
-                                                &latest_tree_timestamp_);
+                                                &timestamp);
     if (result != Deserializer::OK)
       abort();
+    tree_timestamps_.push_back(timestamp);
+  }
+
+  if (!sth_timestamps.empty()) {
+    latest_timestamp_key_ = *sth_timestamps.rbegin();
+    latest_tree_timestamp_ = tree_timestamps_.back();
   }
 }
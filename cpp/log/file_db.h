@@ -2,15 +2,16 @@
 
 #ifndef CERTIFICATE_DB_H
 #define CERTIFICATE_DB_H
-#include <map>
 #include <set>
 #include <stdint.h>
+#include <string>
 #include <vector>
 
 #include "log/database.h"
 #include "proto/ct.pb.h"
+#include "util/digest_index.h"
 
-class FileStorage;
+class EntryStorage;
 
 // Database interface that stores certificates and tree head
 // signatures in the filesystem.
@@ -20,14 +21,32 @@ template <class Logged> class FileDB : public Database<Logged> {
   // and builds an in-memory index.
   // Writes to the underlying FileStorage are atomic (assuming underlying
   // file system operations such as 'rename' are atomic) which should
-  // guarantee full recoverability from crashes/power failures.
+  // guarantee full recoverability from crashes/power failures. A
+  // SegmentStorage recovers from crashes by dropping a torn last record.
   // The tree head database uses 6-byte primary keys corresponding to the
   // 6 lower bytes of the (unique) timestamp, so the storage depth of
   // the FileDB should be set up accordingly. For example, a storage depth
   // of 8 buckets tree head updates within about 1 minute
   // (timestamps xxxxxxxx0000 - xxxxxxxxFFFF) to the same directory.
   // Takes ownership of |cert_storage| and |tree_storage|.
-  FileDB(FileStorage *cert_storage, FileStorage *tree_storage);
+  FileDB(EntryStorage *cert_storage, EntryStorage *tree_storage);
+
+  // As above, but also keeps the index in |index_file|, a log of the
+  // entries' hashes and sequence numbers that is appended to as entries are
+  // created and logged. On boot, the entries are only listed, and those
+  // that the index has as logged are not read at all; entries written while
+  // the database was opened without the index file are read and added to
+  // it. If the file does not exist yet, or does not match the entries, it
+  // is written from a full read of the database. An empty path disables
+  // the index file.
+  FileDB(EntryStorage *cert_storage, EntryStorage *tree_storage,
+         const std::string &index_file);
+
+  // As above, but also compresses entries with |compressor| (see
+  // Database::SetCompressor()), which has to be there before the entries
+  // are read on boot. |compressor| may be NULL.
+  FileDB(EntryStorage *cert_storage, EntryStorage *tree_storage,
+         const std::string &index_file, const EntryCompressor *compressor);
   ~FileDB();
 
   static const size_t kTimestampBytesIndexed;
@@ -40,6 +59,15 @@ template <class Logged> class FileDB : public Database<Logged> {
   AssignSequenceNumber(const std::string &hash,
                        uint64_t sequence_number);
 
+  // Writes the updated entries out together.
+  virtual typename Database<Logged>::WriteResult
+  AssignSequenceNumbers(const std::vector<std::string> &hashes,
+                        uint64_t first_sequence_number, size_t *assigned);
+
+  // Deletes the entries from the storage, and frees their part of the
+  // index.
+  virtual bool DropLoggedEntries(uint64_t end);
+
   virtual typename Database<Logged>::LookupResult
   LookupByHash(const std::string &hash) const;
 
@@ -49,24 +77,104 @@ template <class Logged> class FileDB : public Database<Logged> {
   virtual typename Database<Logged>::LookupResult
   LookupByIndex(uint64_t sequence_number, Logged *result) const;
 
+  virtual typename Database<Logged>::LookupResult
+  LookupByIndexRange(uint64_t start, uint64_t end,
+                     typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual typename Database<Logged>::LookupResult
+  LookupLeafHashRange(uint64_t start, uint64_t end,
+                      std::vector<std::string> *hashes) const;
+
+  virtual typename Database<Logged>::LookupResult
+  LookupEntryHashRange(uint64_t start, uint64_t end,
+                       std::vector<std::string> *hashes) const;
+
   virtual std::set<std::string> PendingHashes() const;
 
+  virtual void LookupPendingEntries(
+      size_t limit, typename Database<Logged>::EntryCallback *callback) const;
+
   virtual typename Database<Logged>::WriteResult
   WriteTreeHead_(const ct::SignedTreeHead &sth);
 
   virtual typename Database<Logged>::LookupResult
   LatestTreeHead(ct::SignedTreeHead *result) const;
 
+  virtual typename Database<Logged>::LookupResult
+  LookupTreeHeadByTimestamp(uint64_t timestamp,
+                            ct::SignedTreeHead *result) const;
+
+  // Tree heads are only indexed by timestamp, so this relies on sizes
+  // growing with timestamps to search them.
+  virtual typename Database<Logged>::LookupResult
+  LookupTreeHeadBySize(uint64_t tree_size, ct::SignedTreeHead *result) const;
+
+  virtual void LookupTreeHeadRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::TreeHeadCallback *callback) const;
+
+  // The in-memory indexes of the entries and tree heads, and those of the
+  // storage.
+  virtual void ExportMemoryUsage(util::Metrics *metrics) const;
+
  private:
+  struct ReadJob;
+  static void ReadEntries(void *job, size_t chunk, size_t begin,
+                          size_t end);
+
   void BuildIndex();
-  std::set<std::string> pending_hashes_;
-  std::map<uint64_t, std::string> sequence_map_;
-  FileStorage *cert_storage_;
-  // Store all tree heads, but currently only support looking up the latest one.
-  // Other necessary lookup indices (by tree size, by timestamp range?) TBD.
-  FileStorage *tree_storage_;
+  // Read the index from |index_file_|, and check the entries it has as
+  // pending. Returns false, with nothing indexed, if there is no index file
+  // or it can't be brought up to date with the entries.
+  bool LoadIndexFile();
+  // Index the stored entries that the index does not have, and append their
+  // records to |records|. Returns false if the index has entries that are
+  // not stored.
+  bool IndexUnindexedEntries(std::string *records);
+  // Forget all about the entries, and close |index_file_|.
+  void ClearIndex();
+  // Read all entries, in up to |num_threads| ranges at once on
+  // util::ThreadPool::Default(), and index them.
+  // Rewrites |index_file_|, if we have one.
+  void ScanEntries(size_t num_threads);
+  // Append the serialized |records| to |index_file_|, if we have one.
+  void WriteIndexRecords(const std::string &records);
+  // Check that |hash| can get |sequence_number|, and if so, read the entry
+  // and write its updated contents to |cert_data| and its leaf hash to
+  // |leaf_hash|. Does not modify the database.
+  typename Database<Logged>::WriteResult
+  PrepareSequenceNumber(const std::string &hash, uint64_t sequence_number,
+                        std::string *cert_data, std::string *leaf_hash) const;
+  // Record an assigned sequence number in the in-memory index.
+  void IndexSequenceNumber(const std::string &hash, uint64_t sequence_number,
+                           const std::string &leaf_hash);
+  // Add a pending entry to the in-memory index.
+  void IndexPendingEntry(const std::string &hash, uint64_t timestamp);
+  // Remove a pending entry from the in-memory index, if it is there.
+  void UnindexPendingEntry(const std::string &hash);
+  // Pending entries' hashes, with their timestamps.
+  util::DigestMap pending_hashes_;
+  // The same, in timestamp order.
+  std::set<std::pair<uint64_t, std::string> > pending_by_timestamp_;
+  // Hashes of the logged entries, by sequence number. Sequence numbers are
+  // dense from 0 in practice, so these are flat arrays.
+  util::DigestVector sequence_map_;
+  // Leaf hashes of the logged entries, by sequence number. Computed when
+  // the index is built or the sequence number is assigned, both of which
+  // read the entry anyway.
+  util::DigestVector leaf_hash_map_;
+  // Read the tree head with |timestamp|, which must be in
+  // |tree_timestamps_|, into |result|.
+  void ReadTreeHead(uint64_t timestamp, ct::SignedTreeHead *result) const;
+  EntryStorage *cert_storage_;
+  EntryStorage *tree_storage_;
+  // The timestamps of all tree heads, in order.
+  std::vector<uint64_t> tree_timestamps_;
   uint64_t latest_tree_timestamp_;
   // The same as a string;
   std::string latest_timestamp_key_;
+  const std::string index_file_;
+  // Open for appending, or -1 if there is no index file.
+  int index_fd_;
 };
 #endif
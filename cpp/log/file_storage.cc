@@ -5,10 +5,13 @@
 #include <cstdlib>
 #include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
 #include <set>
 #include <string>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <utility>
+#include <vector>
 
 #include "log/filesystem_op.h"
 #include "util/util.h"
@@ -48,6 +51,63 @@ std::set<string> FileStorage::Scan() const {
   return storage_keys;
 }
 
+// The top-level directories that one thread scans, and the keys it found.
+struct FileStorage::ScanJob {
+  const FileStorage *storage;
+  std::vector<string> dirs;
+  std::set<string> keys;
+};
+
+// static
+void *FileStorage::ScanThread(void *arg) {
+  ScanJob *job = static_cast<ScanJob*>(arg);
+  for (size_t i = 0; i < job->dirs.size(); ++i)
+    job->storage->ScanDir(job->dirs[i], job->storage->storage_depth_ - 1,
+                          &job->keys);
+  return NULL;
+}
+
+std::set<string> FileStorage::Scan(size_t num_threads) const {
+  if (storage_depth_ == 0 || num_threads <= 1)
+    return Scan();
+
+  DIR *dir = opendir(storage_dir_.c_str());
+  if (dir == NULL)
+    abort();
+  std::vector<string> dirs;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.')
+      continue;
+    dirs.push_back(storage_dir_ + "/" + entry->d_name);
+  }
+  closedir(dir);
+
+  if (num_threads > dirs.size())
+    num_threads = dirs.size();
+  std::vector<ScanJob> jobs(num_threads);
+  for (size_t i = 0; i < dirs.size(); ++i)
+    jobs[i % num_threads].dirs.push_back(dirs[i]);
+  std::vector<pthread_t> threads(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    jobs[i].storage = this;
+    // The calling thread takes the first share itself.
+    if (i > 0 && pthread_create(&threads[i], NULL, ScanThread, &jobs[i]) != 0)
+      abort();
+  }
+  std::set<string> storage_keys;
+  if (num_threads > 0) {
+    ScanThread(&jobs[0]);
+    storage_keys.swap(jobs[0].keys);
+  }
+  for (size_t i = 1; i < num_threads; ++i) {
+    if (pthread_join(threads[i], NULL) != 0)
+      abort();
+    storage_keys.insert(jobs[i].keys.begin(), jobs[i].keys.end());
+  }
+  return storage_keys;
+}
+
 FileStorage::FileStorageResult
 FileStorage::CreateEntry(const string &key, const string &data) {
   if (LookupEntry(key, NULL) == OK)
@@ -60,7 +120,43 @@ FileStorage::FileStorageResult
 FileStorage::UpdateEntry(const string &key, const string &data) {
   if (LookupEntry(key, NULL) != OK)
     return NOT_FOUND;
-  WriteStorageEntry(key, data);
+  // The entry exists, so its directories do too.
+  AtomicWriteBinaryFile(StoragePath(key), data);
+  return OK;
+}
+
+FileStorage::FileStorageResult FileStorage::UpdateEntries(
+    const std::vector<std::pair<string, string> > &entries) {
+  for (size_t i = 0; i < entries.size(); ++i)
+    if (LookupEntry(entries[i].first, NULL) != OK)
+      return NOT_FOUND;
+
+  // The entries exist, so their directories do too.
+  std::vector<string> tmp_files;
+  tmp_files.reserve(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    string tmp_file =
+        util::WriteTemporaryBinaryFile(tmp_file_template_, entries[i].second);
+    if (tmp_file.empty())
+      abort();
+    tmp_files.push_back(tmp_file);
+  }
+  for (size_t i = 0; i < entries.size(); ++i)
+    if (file_op_->rename(tmp_files[i].c_str(),
+                         StoragePath(entries[i].first).c_str()) != 0)
+      abort();
+  return OK;
+}
+
+FileStorage::FileStorageResult FileStorage::DeleteEntries(
+    const std::vector<string> &keys) {
+  for (size_t i = 0; i < keys.size(); ++i)
+    if (LookupEntry(keys[i], NULL) != OK)
+      return NOT_FOUND;
+
+  for (size_t i = 0; i < keys.size(); ++i)
+    if (file_op_->remove(StoragePath(keys[i]).c_str()) != 0)
+      abort();
   return OK;
 }
 
@@ -115,12 +211,18 @@ string FileStorage::StorageKey(const string &storage_path) const {
 void FileStorage::WriteStorageEntry(const string &key, const string &data) {
   string hex = util::HexString(key);
 
-  // Make the intermediate directories, if needed.
-  // TODO(ekasper): we can skip this if we know we're updating.
   string dir = storage_dir_;
-  for (unsigned n = 0; n < storage_depth_; ++n) {
+  for (unsigned n = 0; n < storage_depth_; ++n)
     dir += "/" + StoragePathComponent(hex, n);
-    CreateMissingDirectory(dir);
+
+  // Make the intermediate directories, unless we already have.
+  if (storage_depth_ > 0 && known_dirs_.find(dir) == known_dirs_.end()) {
+    string parent = storage_dir_;
+    for (unsigned n = 0; n < storage_depth_; ++n) {
+      parent += "/" + StoragePathComponent(hex, n);
+      CreateMissingDirectory(parent);
+    }
+    known_dirs_.insert(dir);
   }
 
   // == StoragePath(key)
@@ -2,8 +2,13 @@
 #define FILE_DB_H
 
 #include <set>
+#include <stddef.h>
 #include <stdint.h>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "log/entry_storage.h"
 
 class FilesystemOp;
 
@@ -32,44 +37,54 @@ class FilesystemOp;
 //                  same filesystem as <root>/storage.
 
 // FileStorage aborts Upon any FilesystemOp error.
-class FileStorage {
+class FileStorage : public EntryStorage {
  public:
   // Default constructor, uses BasicFilesystemOp.
   FileStorage(const std::string &file_base, unsigned storage_depth);
   // Takes ownership of the FilesystemOp.
   FileStorage(const std::string &file_base, unsigned storage_depth,
          FilesystemOp *file_op);
-  ~FileStorage();
-
-  enum FileStorageResult {
-    OK,
-    // Create failed.
-    ENTRY_ALREADY_EXISTS,
-    // Lookup or update failed.
-    NOT_FOUND,
-  };
+  virtual ~FileStorage();
 
   // Scan the entire database and return the list of keys.
-  std::set<std::string> Scan() const;
+  virtual std::set<std::string> Scan() const;
+
+  // As above, but split the top-level directories between up to
+  // |num_threads| threads.
+  virtual std::set<std::string> Scan(size_t num_threads) const;
 
   // Write (key, data) unless an entry matching |key| already exists.
-  FileStorageResult CreateEntry(const std::string &key,
-                                const std::string &data);
+  virtual FileStorageResult CreateEntry(const std::string &key,
+                                        const std::string &data);
 
   // Update an existing entry; fail if it doesn't already exist.
-  FileStorageResult UpdateEntry(const std::string &key,
-                                const std::string &data);
+  virtual FileStorageResult UpdateEntry(const std::string &key,
+                                        const std::string &data);
+
+  // Update several existing (key, data) entries; fail without writing
+  // anything if any of them doesn't already exist. All new contents are
+  // written out before the first is moved into place, and they are moved
+  // in order, so a crash leaves a prefix of the updates done.
+  virtual FileStorageResult UpdateEntries(
+      const std::vector<std::pair<std::string, std::string> > &entries);
+
+  // Removes the files in order. Directories are left behind.
+  virtual FileStorageResult DeleteEntries(
+      const std::vector<std::string> &keys);
 
   // Lookup entry based on key.
-  FileStorageResult LookupEntry(const std::string &key,
-                                std::string *result) const;
+  virtual FileStorageResult LookupEntry(const std::string &key,
+                                        std::string *result) const;
 
  private:
+  struct ScanJob;
+  static void *ScanThread(void *job);
+
   std::string StoragePathBasename(const std::string &hex) const;
   std::string StoragePathComponent(const std::string &hex, unsigned n) const;
   std::string StoragePath(const std::string &key) const;
   std::string StorageKey(const std::string &storage_path) const;
-  // Write or overwrite.
+  // Write or overwrite, creating the directories if needed.
   void WriteStorageEntry(const std::string &key, const std::string &data);
   void ScanFiles(const std::string &dir_path,
                  std::set<std::string> *keys) const;
@@ -88,5 +103,8 @@ class FileStorage {
   const std::string tmp_file_template_;
   unsigned int storage_depth_;
   FilesystemOp *file_op_;
+  // Leaf directories that this instance has made sure exist, so that
+  // writes to them need not try to create them again.
+  std::set<std::string> known_dirs_;
 };
 #endif
@@ -6,6 +6,8 @@
 #include <string>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <utility>
+#include <vector>
 
 #include "log/file_storage.h"
 #include "log/filesystem_op.h"
@@ -67,6 +69,20 @@ TEST_F(BasicFileStorageTest, Scan) {
   EXPECT_EQ(keys, scan_keys);
 }
 
+TEST_F(BasicFileStorageTest, ParallelScan) {
+  std::set<string> keys;
+  for (int i = 0; i < 40; ++i) {
+    string key(8, static_cast<char>(i * 7));
+    key[7] = static_cast<char>(i);
+    keys.insert(key);
+    EXPECT_EQ(FileStorage::OK, fs()->CreateEntry(key, "data"));
+  }
+
+  EXPECT_EQ(keys, fs()->Scan(1));
+  EXPECT_EQ(keys, fs()->Scan(4));
+  EXPECT_EQ(keys, fs()->Scan(100));
+}
+
 TEST_F(BasicFileStorageTest, CreateDuplicate) {
   string key("1234xyzw", 8);
   string value("unicorn", 7);
@@ -107,6 +123,53 @@ TEST_F(BasicFileStorageTest, Update) {
   EXPECT_EQ(new_value, lookup_result);
 }
 
+TEST_F(BasicFileStorageTest, UpdateEntries) {
+  string key0("1234xyzw", 8), key1("1245xyzw", 8), key2("1256xyzw", 8);
+  EXPECT_EQ(FileStorage::OK, fs()->CreateEntry(key0, "unicorn"));
+  EXPECT_EQ(FileStorage::OK, fs()->CreateEntry(key1, "Alice"));
+
+  std::vector<std::pair<string, string> > updates;
+  updates.push_back(std::make_pair(key0, "Bob"));
+  updates.push_back(std::make_pair(key2, "Charlie"));
+  // Nothing is written if any entry is missing.
+  EXPECT_EQ(FileStorage::NOT_FOUND, fs()->UpdateEntries(updates));
+  string lookup_result;
+  EXPECT_EQ(FileStorage::OK, fs()->LookupEntry(key0, &lookup_result));
+  EXPECT_EQ("unicorn", lookup_result);
+
+  updates[1].first = key1;
+  EXPECT_EQ(FileStorage::OK, fs()->UpdateEntries(updates));
+  EXPECT_EQ(FileStorage::OK, fs()->LookupEntry(key0, &lookup_result));
+  EXPECT_EQ("Bob", lookup_result);
+  EXPECT_EQ(FileStorage::OK, fs()->LookupEntry(key1, &lookup_result));
+  EXPECT_EQ("Charlie", lookup_result);
+}
+
+TEST_F(BasicFileStorageTest, DeleteEntries) {
+  string key0("1234xyzw", 8), key1("1245xyzw", 8), key2("1256xyzw", 8);
+  EXPECT_EQ(FileStorage::OK, fs()->CreateEntry(key0, "unicorn"));
+  EXPECT_EQ(FileStorage::OK, fs()->CreateEntry(key1, "Alice"));
+
+  std::vector<string> keys;
+  keys.push_back(key0);
+  keys.push_back(key2);
+  // Nothing is deleted if any entry is missing.
+  EXPECT_EQ(FileStorage::NOT_FOUND, fs()->DeleteEntries(keys));
+  EXPECT_EQ(FileStorage::OK, fs()->LookupEntry(key0, NULL));
+
+  keys[1] = key1;
+  EXPECT_EQ(FileStorage::OK, fs()->DeleteEntries(keys));
+  EXPECT_EQ(FileStorage::NOT_FOUND, fs()->LookupEntry(key0, NULL));
+  EXPECT_EQ(FileStorage::NOT_FOUND, fs()->LookupEntry(key1, NULL));
+  EXPECT_TRUE(fs()->Scan().empty());
+
+  // And can be created again.
+  EXPECT_EQ(FileStorage::OK, fs()->CreateEntry(key0, "Bob"));
+  string lookup_result;
+  EXPECT_EQ(FileStorage::OK, fs()->LookupEntry(key0, &lookup_result));
+  EXPECT_EQ("Bob", lookup_result);
+}
+
 // Test for non-existing keys that are similar to  existing ones.
 TEST_F(BasicFileStorageTest, LookupInvalidKey) {
   string key("1234xyzw", 8);
@@ -260,6 +323,29 @@ TEST_F(FailingFileStorageDeathTest, DieOnFailedUpdate) {
   }
 };
 
+TEST_F(FailingFileStorageDeathTest, SkipKnownDirectories) {
+  FailingFilesystemOp *failing_file_op = new FailingFilesystemOp(-1);
+  FileStorage db(GetTemporaryDirectory(), kStorageDepth, failing_file_op);
+
+  // Both keys go in the same directory.
+  string key0("1234xyzw", 8);
+  string key1("1235abcd", 8);
+
+  int op_count = failing_file_op->OpCount();
+  EXPECT_EQ(FileStorage::OK, db.CreateEntry(key0, "unicorn"));
+  // The lookup, a mkdir per level and the rename.
+  EXPECT_EQ(op_count + 2 + static_cast<int>(kStorageDepth),
+            failing_file_op->OpCount());
+
+  op_count = failing_file_op->OpCount();
+  EXPECT_EQ(FileStorage::OK, db.CreateEntry(key1, "Alice"));
+  EXPECT_EQ(op_count + 2, failing_file_op->OpCount());
+
+  op_count = failing_file_op->OpCount();
+  EXPECT_EQ(FileStorage::OK, db.UpdateEntry(key0, "alice"));
+  EXPECT_EQ(op_count + 2, failing_file_op->OpCount());
+}
+
 TEST_F(FailingFileStorageDeathTest, ResumeOnFailedCreate) {
   // Profiling run: count file operations.
   FailingFilesystemOp *failing_file_op = new FailingFilesystemOp(-1);
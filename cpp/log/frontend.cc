@@ -2,32 +2,121 @@
 #include "log/frontend.h"
 
 #include <glog/logging.h>
+#include <pthread.h>
 
 #include "log/cert.h"
 #include "log/cert_submission_handler.h"
 #include "log/frontend_signer.h"
 #include "proto/ct.pb.h"
+#include "util/memory_usage.h"
+#include "util/metrics.h"
+#include "util/trace.h"
 
 using ct::CertChain;
 using ct::LogEntry;
 using ct::PreCertChain;
 using ct::SignedCertificateTimestamp;
 using std::string;
+using util::Tracer;
+
+namespace {
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+}  // namespace
 
 Frontend::Frontend(CertSubmissionHandler *handler, FrontendSigner *signer)
     : handler_(handler),
       signer_(signer),
-      stats_() {}
+      stats_() {
+  CHECK_EQ(0, pthread_mutex_init(&signer_mutex_, NULL));
+  CHECK_EQ(0, pthread_mutex_init(&stats_mutex_, NULL));
+}
 
 Frontend::~Frontend() {
   delete signer_;
   delete handler_;
+  pthread_mutex_destroy(&stats_mutex_);
+  pthread_mutex_destroy(&signer_mutex_);
 }
 
 void Frontend::GetStats(Frontend::FrontendStats *stats) const {
+  ScopedLock lock(&stats_mutex_);
   *stats = stats_;
 }
 
+void Frontend::ExportStats(util::Metrics *metrics) const {
+  FrontendStats stats;
+  GetStats(&stats);
+  const char kSubmissions[] = "ct_submissions_total";
+  metrics->DefineCounter(kSubmissions,
+                         "Submissions, by entry type and result.");
+  const struct {
+    const char *labels;
+    int value;
+  } counts[] = {
+    { "type=\"x509\",result=\"accepted\"", stats.x509_accepted },
+    { "type=\"x509\",result=\"duplicate\"", stats.x509_duplicates },
+    { "type=\"x509\",result=\"bad_pem\"", stats.x509_bad_pem_certs },
+    { "type=\"x509\",result=\"too_long\"", stats.x509_too_long_certs },
+    { "type=\"x509\",result=\"verify_error\"", stats.x509_verify_errors },
+    { "type=\"precert\",result=\"accepted\"", stats.precert_accepted },
+    { "type=\"precert\",result=\"duplicate\"", stats.precert_duplicates },
+    { "type=\"precert\",result=\"bad_pem\"", stats.precert_bad_pem_certs },
+    { "type=\"precert\",result=\"too_long\"",
+      stats.precert_too_long_certs },
+    { "type=\"precert\",result=\"verify_error\"",
+      stats.precert_verify_errors },
+    { "type=\"precert\",result=\"format_error\"",
+      stats.precert_format_errors },
+    { "result=\"internal_error\"", stats.internal_errors },
+  };
+  for (size_t i = 0; i < sizeof counts / sizeof counts[0]; ++i)
+    metrics->Set(kSubmissions, counts[i].labels, counts[i].value);
+  util::ExportMemoryUsage("trusted_roots", handler_->RootsMemoryUsage(),
+                          metrics);
+}
+
+bool Frontend::IsLogged(const CertChain &chain,
+                        SignedCertificateTimestamp *sct) {
+  LogEntry entry;
+  if (!CertSubmissionHandler::X509LeafEntry(chain, &entry))
+    return false;
+  Tracer::Span span("frontend.duplicate_lookup");
+  ScopedLock lock(&signer_mutex_);
+  return signer_->IsLogged(entry, sct);
+}
+
+SubmitResult Frontend::SignEntry(const LogEntry &entry,
+                                 SignedCertificateTimestamp *sct) {
+  FrontendSigner::SubmitResult signer_result;
+  {
+    // Includes the wait for the signer.
+    Tracer::Span span("frontend.sign_entry");
+    ScopedLock lock(&signer_mutex_);
+    signer_result = signer_->QueueEntry(entry, sct);
+  }
+
+  switch (signer_result) {
+    case FrontendSigner::NEW:
+      return ADDED;
+    case FrontendSigner::DUPLICATE:
+      return DUPLICATE;
+    default:
+      LOG(FATAL) << "Unknown FrontendSigner return code " << signer_result;
+  }
+  return INTERNAL_ERROR;
+}
+
 SubmitResult
 Frontend::QueueProcessedEntry(CertSubmissionHandler::SubmitResult pre_result,
                               const LogEntry &entry,
@@ -39,26 +128,20 @@ Frontend::QueueProcessedEntry(CertSubmissionHandler::SubmitResult pre_result,
   }
 
   // Step 2. Submit to database.
-  FrontendSigner::SubmitResult signer_result = signer_->QueueEntry(entry, sct);
-
-  SubmitResult result;
-  switch (signer_result) {
-    case FrontendSigner::NEW:
-      result = ADDED;
-      break;
-    case FrontendSigner::DUPLICATE:
-      result = DUPLICATE;
-      break;
-    default:
-      LOG(FATAL) << "Unknown FrontendSigner return code " << signer_result;
-  }
-
+  SubmitResult result = SignEntry(entry, sct);
   UpdateStats(entry.type(), result);
   return result;
 }
 
 SubmitResult
 Frontend::QueueX509Entry(CertChain *chain, SignedCertificateTimestamp *sct) {
+  Tracer::Span span("frontend.queue_x509");
+  // Resubmissions are common, and need no verification.
+  if (IsLogged(*chain, sct)) {
+    UpdateStats(ct::X509_ENTRY, DUPLICATE);
+    return DUPLICATE;
+  }
+
   LogEntry entry;
   return QueueProcessedEntry(handler_->ProcessX509Submission(chain, &entry),
                              entry, sct);
@@ -67,6 +150,7 @@ Frontend::QueueX509Entry(CertChain *chain, SignedCertificateTimestamp *sct) {
 SubmitResult
 Frontend::QueuePreCertEntry(PreCertChain *chain,
                             SignedCertificateTimestamp *sct) {
+  Tracer::Span span("frontend.queue_precert");
   LogEntry entry;
   return QueueProcessedEntry(handler_->ProcessPreCertSubmission(chain, &entry),
                              entry, sct);
@@ -76,6 +160,16 @@ Frontend::QueuePreCertEntry(PreCertChain *chain,
 SubmitResult
 Frontend::QueueEntry(ct::LogEntryType type, const string &data,
                      SignedCertificateTimestamp *sct) {
+  Tracer::Span span("frontend.queue_entry");
+  // Step 0. Resubmissions are common, and need no verification.
+  if (type == ct::X509_ENTRY) {
+    CertChain chain(data);
+    if (IsLogged(chain, sct)) {
+      UpdateStats(type, DUPLICATE);
+      return DUPLICATE;
+    }
+  }
+
   // Step 1. Preprocessing: convert the submission into a CertificateEntry
   // and verify the chain.
   LogEntry entry;
@@ -89,20 +183,7 @@ Frontend::QueueEntry(ct::LogEntryType type, const string &data,
   }
 
   // Step 2. Submit to database.
-  FrontendSigner::SubmitResult signer_result = signer_->QueueEntry(entry, sct);
-
-  SubmitResult result;
-  switch (signer_result) {
-    case FrontendSigner::NEW:
-      result = ADDED;
-      break;
-    case FrontendSigner::DUPLICATE:
-      result = DUPLICATE;
-      break;
-    default:
-      LOG(FATAL) << "Unknown FrontendSigner return code " << signer_result;
-  }
-
+  SubmitResult result = SignEntry(entry, sct);
   UpdateStats(type, result);
   return result;
 }
@@ -169,6 +250,7 @@ Frontend::GetSubmitError(CertSubmissionHandler::SubmitResult result) {
 }
 
 void Frontend::UpdateStats(ct::LogEntryType type, SubmitResult result) {
+  ScopedLock lock(&stats_mutex_);
   if (type == ct::X509_ENTRY)
     UpdateX509Stats (result);
   else
@@ -2,13 +2,23 @@
 #ifndef FRONTEND_H
 #define FRONTEND_H
 
+#include <pthread.h>
+
 #include "log/cert_submission_handler.h"
 #include "log/submit_result.h"
 #include "proto/ct.pb.h"
 
 class FrontendSigner;
 
+namespace util {
+class Metrics;
+}  // namespace util
+
 // Frontend for accepting new submissions.
+//
+// Submissions may be queued from several threads at once: parsing and
+// chain verification, usually the bulk of the work, run concurrently,
+// while the signer handles one entry at a time.
 class Frontend {
  public:
   // Takes ownership of the handler and signer.
@@ -69,8 +79,13 @@ class Frontend {
     int internal_errors;
   };
 
+  // A consistent snapshot of the counters.
   void GetStats(FrontendStats *stats) const;
 
+  // Set the counter ct_submissions_total in |metrics| from the stats, by
+  // entry type and result, and the memory accounting gauges of the roots.
+  void ExportStats(util::Metrics *metrics) const;
+
   SubmitResult QueueEntry(ct::LogEntryType type,
                           const std::string &data,
                           ct::SignedCertificateTimestamp *sct);
@@ -90,8 +105,18 @@ class Frontend {
  private:
   CertSubmissionHandler *handler_;
   FrontendSigner *signer_;
+  // Guards |signer_|, which is not thread-safe.
+  pthread_mutex_t signer_mutex_;
+  // Guards |stats_|.
+  mutable pthread_mutex_t stats_mutex_;
   FrontendStats stats_;
 
+  // Whether the leaf of |chain| is already logged, and if so its SCT.
+  bool IsLogged(const ct::CertChain &chain,
+                ct::SignedCertificateTimestamp *sct);
+  // Sign and store a verified entry.
+  SubmitResult SignEntry(const ct::LogEntry &entry,
+                         ct::SignedCertificateTimestamp *sct);
   SubmitResult
   QueueProcessedEntry(CertSubmissionHandler::SubmitResult pre_result,
 		      const ct::LogEntry &entry,
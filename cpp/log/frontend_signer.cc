@@ -1,74 +1,385 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/frontend_signer.h"
 
+#include <algorithm>
 #include <glog/logging.h>
+#include <map>
+#include <pthread.h>
+#include <set>
+#include <vector>
 
 #include "log/database.h"
 #include "log/log_signer.h"
+#include "log/sequencing_queue.h"
 #include "merkletree/serial_hasher.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/thread_pool.h"
+#include "util/trace.h"
 #include "util/util.h"
 
 using ct::LogEntry;
 using ct::SignedCertificateTimestamp;
 using std::string;
+using util::Tracer;
+
+namespace {
+
+// Logged entry hashes read into the filter at a time.
+const uint64_t kReadHashesBatch = 1 << 16;
+
+// Roughly the number of entries in |db|, to size the filter of hashes.
+size_t ExpectedEntries(const Database<ct::LoggedCertificate> *db) {
+  ct::SignedTreeHead sth;
+  if (db->LatestTreeHead(&sth) != Database<ct::LoggedCertificate>::LOOKUP_OK)
+    return 0;
+  // Leave room to grow before the filter needs to.
+  return 2 * sth.tree_size();
+}
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+}  // namespace
+
+// An entry of QueueEntryAsync(), waiting for its signature.
+class FrontendSigner::PendingEntry : public ct::SignatureCallback {
+ public:
+  PendingEntry(FrontendSigner *signer, const string &hash,
+               SubmitCallback *callback)
+      : signer_(signer),
+        hash_(hash),
+        callback_(callback) {}
+
+  virtual void Signed(const ct::DigitallySigned &signature) {
+    logged_.mutable_sct()->mutable_signature()->CopyFrom(signature);
+    signer_->EntrySigned(this);
+  }
+
+  ct::LoggedCertificate *logged() { return &logged_; }
+  const string &hash() const { return hash_; }
+  SubmitCallback *callback() const { return callback_; }
+
+ private:
+  FrontendSigner *const signer_;
+  const string hash_;
+  SubmitCallback *const callback_;
+  ct::LoggedCertificate logged_;
+};
+
+// Signs a batch, each range with its own signer.
+struct FrontendSigner::SignJob {
+  const std::vector<LogSigner*> *signers;
+  const std::vector<LogEntry> *entries;
+  std::vector<SignedCertificateTimestamp> *scts;
+  // Indices into |entries| and |scts| of the entries to sign.
+  const std::vector<size_t> *indices;
+};
 
 FrontendSigner::FrontendSigner(Database<ct::LoggedCertificate> *db,
                                LogSigner *signer)
     : db_(db),
-      signer_(signer) {}
+      signers_(1, signer),
+      known_hashes_(ExpectedEntries(db)),
+      queue_(NULL) {
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+  ReadKnownHashes();
+}
+
+FrontendSigner::FrontendSigner(Database<ct::LoggedCertificate> *db,
+                               const std::vector<LogSigner*> &signers)
+    : db_(db),
+      signers_(signers),
+      known_hashes_(ExpectedEntries(db)),
+      queue_(NULL) {
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+  CHECK(!signers_.empty());
+  ReadKnownHashes();
+}
 
 FrontendSigner::~FrontendSigner() {
-  delete signer_;
+  CHECK(in_flight_.empty());
+  pthread_mutex_destroy(&mutex_);
+  for (size_t i = 0; i < signers_.size(); ++i)
+    delete signers_[i];
+}
+
+void FrontendSigner::SetSequencingQueue(SequencingQueue *queue) {
+  queue_ = queue;
+}
+
+void FrontendSigner::ReadKnownHashes() {
+  std::set<string> pending = db_->PendingHashes();
+  for (std::set<string>::const_iterator it = pending.begin();
+       it != pending.end(); ++it)
+    known_hashes_.Add(*it);
+  // Only the hashes are read, not the entries. Stops at the first unused
+  // sequence number.
+  std::vector<string> hashes;
+  for (uint64_t start = 0;; start += kReadHashesBatch) {
+    hashes.clear();
+    const Database<ct::LoggedCertificate>::LookupResult result =
+        db_->LookupEntryHashRange(start, start + kReadHashesBatch, &hashes);
+    for (size_t i = 0; i < hashes.size(); ++i)
+      known_hashes_.Add(hashes[i]);
+    if (result != Database<ct::LoggedCertificate>::LOOKUP_OK)
+      break;
+  }
+  LOG(INFO) << "Read " << known_hashes_.size() << " entry hashes";
 }
 
 FrontendSigner::SubmitResult
 FrontendSigner::QueueEntry(const LogEntry &entry,
                            SignedCertificateTimestamp *sct) {
-  // Check if the entry already exists.
-  // TODO(ekasper): switch to using SignedEntryWithType as the DB key.
-  string sha256_hash =
-      Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry));
-  assert(!sha256_hash.empty());
+  std::vector<SubmitResult> results;
+  std::vector<SignedCertificateTimestamp> scts;
+  std::vector<LogEntry> entries(1);
+  entries[0].CopyFrom(entry);
+  QueueOwnedEntries(&entries, &results, &scts);
+  if (sct != NULL)
+    sct->Swap(&scts[0]);
+  return results[0];
+}
 
-  ct::LoggedCertificate logged;
-  Database<ct::LoggedCertificate>::LookupResult db_result =
-      db_->LookupByHash(sha256_hash, &logged);
+void FrontendSigner::QueueEntryAsync(const LogEntry &entry,
+                                     SubmitCallback *callback) {
+  const string hash = EntryHash(entry);
+  {
+    ScopedLock lock(&mutex_);
+    std::map<string, std::vector<SubmitCallback*> >::iterator it =
+        in_flight_.find(hash);
+    if (it != in_flight_.end()) {
+      it->second.push_back(callback);
+      return;
+    }
+    in_flight_[hash];
+  }
+
+  SignedCertificateTimestamp sct;
+  if (LookupHash(hash, &sct)) {
+    Finish(hash, DUPLICATE, sct, callback);
+    return;
+  }
+
+  PendingEntry *pending = new PendingEntry(this, hash, callback);
+  pending->logged()->mutable_entry()->CopyFrom(entry);
+  SignedCertificateTimestamp *new_sct = pending->logged()->mutable_sct();
+  Timestamp(new_sct);
+  new_sct->mutable_id()->set_key_id(signers_[0]->KeyID());
+  // The submission handler has already verified the format of this
+  // entry, so this should never fail.
+  CHECK_EQ(LogSigner::OK, signers_[0]->SignCertificateTimestampAsync(
+      entry, *new_sct, pending));
+}
 
-  if (db_result == Database<ct::LoggedCertificate>::LOOKUP_OK) {
-    if (sct != NULL)
-      sct->CopyFrom(logged.sct());
+void FrontendSigner::EntrySigned(PendingEntry *pending) {
+  CHECK_EQ(pending->logged()->Hash(), pending->hash());
+  SubmitResult result = NEW;
+  SignedCertificateTimestamp sct;
+  Database<ct::LoggedCertificate>::WriteResult write_result =
+      db_->CreatePendingEntry(*pending->logged());
+  if (write_result ==
+      Database<ct::LoggedCertificate>::DUPLICATE_CERTIFICATE_HASH) {
+    // A synchronous submission got there first.
+    LookupLogged(pending->hash(), &sct);
+    result = DUPLICATE;
+  } else {
+    CHECK_EQ(Database<ct::LoggedCertificate>::OK, write_result);
+    AddKnownHash(pending->hash());
+    Sequence(*pending->logged(), pending->hash());
+    sct.Swap(pending->logged()->mutable_sct());
+  }
+  Finish(pending->hash(), result, sct, pending->callback());
+  delete pending;
+}
 
-    return DUPLICATE;
+void FrontendSigner::Finish(const string &hash, SubmitResult result,
+                            const SignedCertificateTimestamp &sct,
+                            SubmitCallback *callback) {
+  std::vector<SubmitCallback*> duplicates;
+  {
+    ScopedLock lock(&mutex_);
+    std::map<string, std::vector<SubmitCallback*> >::iterator it =
+        in_flight_.find(hash);
+    CHECK(it != in_flight_.end());
+    duplicates.swap(it->second);
+    in_flight_.erase(it);
   }
+  callback->Done(result, sct);
+  for (size_t i = 0; i < duplicates.size(); ++i)
+    duplicates[i]->Done(DUPLICATE, sct);
+}
 
-  CHECK_EQ(Database<ct::LoggedCertificate>::NOT_FOUND, db_result);
+void FrontendSigner::AddKnownHash(const string &hash) {
+  ScopedLock lock(&mutex_);
+  known_hashes_.Add(hash);
+}
 
-  SignedCertificateTimestamp local_sct;
-  TimestampAndSign(entry, &local_sct);
+void FrontendSigner::Sequence(const ct::LoggedCertificate &logged,
+                              const string &hash) {
+  if (queue_ == NULL)
+    return;
+  string leaf;
+  CHECK(logged.SerializeForLeaf(&leaf));
+  queue_->Push(hash, &leaf, logged.timestamp());
+}
+
+void FrontendSigner::QueueEntries(
+    const std::vector<LogEntry> &entries, std::vector<SubmitResult> *results,
+    std::vector<SignedCertificateTimestamp> *scts) {
+  std::vector<LogEntry> owned(entries);
+  QueueOwnedEntries(&owned, results, scts);
+}
 
-  ct::LoggedCertificate new_logged;
-  new_logged.mutable_sct()->CopyFrom(local_sct);
-  new_logged.mutable_entry()->CopyFrom(entry);
-  CHECK_EQ(new_logged.Hash(), sha256_hash);
+void FrontendSigner::QueueOwnedEntries(
+    std::vector<LogEntry> *owned, std::vector<SubmitResult> *results,
+    std::vector<SignedCertificateTimestamp> *scts) {
+  Tracer::Span span("frontend_signer.queue_entries");
+  const std::vector<LogEntry> &entries = *owned;
+  results->assign(entries.size(), NEW);
+  scts->assign(entries.size(), SignedCertificateTimestamp());
+  std::vector<string> hashes(entries.size());
+  // The new entries, and the first of each hash in the batch.
+  std::vector<size_t> new_entries;
+  std::map<string, size_t> first;
+  // Earlier entries of the batch with the same hash as this one.
+  std::vector<size_t> duplicate_of(entries.size(), entries.size());
+  {
+    // Sorting out the duplicates, mostly by the filter.
+    Tracer::Span lookup("frontend_signer.lookup");
+    for (size_t i = 0; i < entries.size(); ++i) {
+      hashes[i] = EntryHash(entries[i]);
 
-  Database<ct::LoggedCertificate>::WriteResult write_result =
-      db_->CreatePendingEntry(new_logged);
+      std::map<string, size_t>::const_iterator it = first.find(hashes[i]);
+      if (it != first.end()) {
+        (*results)[i] = DUPLICATE;
+        duplicate_of[i] = it->second;
+        continue;
+      }
+      first[hashes[i]] = i;
 
-  // Assume for now that nobody interfered while we were busy signing.
-  CHECK_EQ(Database<ct::LoggedCertificate>::OK, write_result);
+      if (LookupHash(hashes[i], &(*scts)[i])) {
+        (*results)[i] = DUPLICATE;
+        continue;
+      }
+      // Timestamp in order, before the signers get to finish out of order.
+      Timestamp(&(*scts)[i]);
+      new_entries.push_back(i);
+    }
+  }
+
+  {
+    // Split the new entries between the signers. We take the first share.
+    Tracer::Span signing("frontend_signer.sign_scts");
+    const size_t jobs = std::min(signers_.size(), new_entries.size());
+    SignJob job = { &signers_, &entries, scts, &new_entries };
+    if (jobs > 0)
+      util::ThreadPool::Default()->ParallelFor(new_entries.size(), jobs,
+                                               SignRange, &job);
+  }
+
+  {
+    Tracer::Span create("frontend_signer.create_pending");
+    for (size_t n = 0; n < new_entries.size(); ++n) {
+      const size_t i = new_entries[n];
+      // Lend the SCT to the entry for the write, and give it back after.
+      ct::LoggedCertificate new_logged;
+      new_logged.mutable_sct()->Swap(&(*scts)[i]);
+      new_logged.mutable_entry()->Swap(&(*owned)[i]);
+      CHECK_EQ(new_logged.Hash(), hashes[i]);
+
+      Database<ct::LoggedCertificate>::WriteResult write_result =
+          db_->CreatePendingEntry(new_logged);
+      if (write_result == Database<ct::LoggedCertificate>::OK)
+        Sequence(new_logged, hashes[i]);
+      (*scts)[i].Swap(new_logged.mutable_sct());
+
+      if (write_result ==
+          Database<ct::LoggedCertificate>::DUPLICATE_CERTIFICATE_HASH) {
+        // An asynchronous submission got there first.
+        LookupLogged(hashes[i], &(*scts)[i]);
+        (*results)[i] = DUPLICATE;
+        continue;
+      }
+      CHECK_EQ(Database<ct::LoggedCertificate>::OK, write_result);
+      AddKnownHash(hashes[i]);
+    }
+  }
+
+  for (size_t i = 0; i < entries.size(); ++i)
+    if (duplicate_of[i] < entries.size())
+      (*scts)[i].CopyFrom((*scts)[duplicate_of[i]]);
+}
+
+bool FrontendSigner::IsLogged(const LogEntry &entry,
+                              SignedCertificateTimestamp *sct) const {
+  return LookupHash(EntryHash(entry), sct);
+}
+
+// static
+string FrontendSigner::EntryHash(const LogEntry &entry) {
+  // TODO(ekasper): switch to using SignedEntryWithType as the DB key.
+  string hash = Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry));
+  assert(!hash.empty());
+  return hash;
+}
+
+bool FrontendSigner::LookupHash(const string &hash,
+                                SignedCertificateTimestamp *sct) const {
+  {
+    // Most entries are new, and the filter knows them to be.
+    ScopedLock lock(&mutex_);
+    if (!known_hashes_.MayContain(hash))
+      return false;
+  }
+
+  ct::LoggedCertificate logged;
+  Database<ct::LoggedCertificate>::LookupResult db_result =
+      db_->LookupByHash(hash, &logged);
+  if (db_result == Database<ct::LoggedCertificate>::NOT_FOUND)
+    return false;
+
+  CHECK_EQ(Database<ct::LoggedCertificate>::LOOKUP_OK, db_result);
   if (sct != NULL)
-    sct->CopyFrom(new_logged.sct());
-  return NEW;
+    sct->Swap(logged.mutable_sct());
+  return true;
+}
+
+void FrontendSigner::LookupLogged(const string &hash,
+                                  SignedCertificateTimestamp *sct) const {
+  // Not through the filter, which may not know the hash yet.
+  ct::LoggedCertificate logged;
+  CHECK_EQ(Database<ct::LoggedCertificate>::LOOKUP_OK,
+           db_->LookupByHash(hash, &logged));
+  sct->Swap(logged.mutable_sct());
 }
 
-void FrontendSigner::TimestampAndSign(const LogEntry &entry,
-                                      SignedCertificateTimestamp *sct) const {
+// static
+void FrontendSigner::Timestamp(SignedCertificateTimestamp *sct) {
   sct->set_version(ct::V1);
   sct->set_timestamp(util::TimeInMilliseconds());
   sct->clear_extensions();
-  // The submission handler has already verified the format of this entry,
-  // so this should never fail.
-  CHECK_EQ(LogSigner::OK, signer_->SignCertificateTimestamp(entry, sct));
+}
+
+// static
+void FrontendSigner::SignRange(void *arg, size_t chunk, size_t begin,
+                               size_t end) {
+  const SignJob *job = static_cast<const SignJob*>(arg);
+  const LogSigner *signer = (*job->signers)[chunk];
+  for (size_t n = begin; n < end; ++n) {
+    const size_t i = (*job->indices)[n];
+    // The submission handler has already verified the format of this
+    // entry, so this should never fail.
+    CHECK_EQ(LogSigner::OK, signer->SignCertificateTimestamp(
+        (*job->entries)[i], &(*job->scts)[i]));
+  }
 }
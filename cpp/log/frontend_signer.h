@@ -1,13 +1,18 @@
 #ifndef FRONTEND_SIGNER_H
 #define FRONTEND_SIGNER_H
 
+#include <map>
+#include <pthread.h>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "logged_certificate.h"
+#include "util/bloom_filter.h"
 
 template <class Logged> class Database;
 class LogSigner;
+class SequencingQueue;
 
 class FrontendSigner {
  public:
@@ -16,11 +21,34 @@ class FrontendSigner {
     DUPLICATE,
   };
 
-  // Takes ownership of |signer|.
+  // Receives the result of QueueEntryAsync().
+  class SubmitCallback {
+   public:
+    virtual ~SubmitCallback() {}
+
+    virtual void Done(SubmitResult result,
+                      const ct::SignedCertificateTimestamp &sct) = 0;
+  };
+
+  // Takes ownership of |signer|. Reads the hashes of all entries in |db|,
+  // which should only be written to through this FrontendSigner from now.
   FrontendSigner(Database<ct::LoggedCertificate> *db, LogSigner *signer);
 
+  // As above, but takes ownership of several |signers| for the same key,
+  // which QueueEntries() signs with in parallel, one at a time each, on
+  // util::ThreadPool::Default(). As
+  // OpenSSL keys shouldn't be shared between threads, each signer needs
+  // its own copy of the key.
+  FrontendSigner(Database<ct::LoggedCertificate> *db,
+                 const std::vector<LogSigner*> &signers);
+
   ~FrontendSigner();
 
+  // Also push each new entry onto |queue| once it is written, for the
+  // TreeSigner that sequences it (see TreeSigner::SetSequencingQueue()).
+  // Call before any submissions; |queue| must outlive the signer.
+  void SetSequencingQueue(SequencingQueue *queue);
+
   // Log the entry if it's not already in the database,
   // and return either a new timestamp-signature pair,
   // or a previously existing one. (Currently also copies the
@@ -28,11 +56,74 @@ class FrontendSigner {
   SubmitResult QueueEntry(const ct::LogEntry &entry,
                           ct::SignedCertificateTimestamp *sct);
 
+  // As QueueEntry(), but passes the result to |callback| rather than
+  // waiting for the signature. A new entry is signed through SignAsync(),
+  // and written to the database and called back on the thread that the
+  // signature comes in on, so the database must take writes from several
+  // threads. Submissions of an entry that is still being signed are called
+  // back with it; those of logged entries, before this returns.
+  void QueueEntryAsync(const ct::LogEntry &entry, SubmitCallback *callback);
+
+  // QueueEntry() each of |entries| in turn, but sign the new ones with all
+  // signers at once. Timestamps still follow the order of |entries|.
+  // Writes a result and an SCT for each entry to |results| and |scts|.
+  void QueueEntries(const std::vector<ct::LogEntry> &entries,
+                    std::vector<SubmitResult> *results,
+                    std::vector<ct::SignedCertificateTimestamp> *scts);
+
+  // If |entry| is already logged, copy its SCT to |sct| and return true.
+  // Only looks at the leaf certificate (for precerts, the TBS certificate)
+  // of |entry|, so a submission can be checked before it is verified.
+  bool IsLogged(const ct::LogEntry &entry,
+                ct::SignedCertificateTimestamp *sct) const;
+
  private:
+  struct SignJob;
+  class PendingEntry;
+
   Database<ct::LoggedCertificate> *db_;
-  LogSigner *signer_;
+  std::vector<LogSigner*> signers_;
+  // Guards |known_hashes_| and |in_flight_|, which asynchronous signatures
+  // come back to from other threads.
+  mutable pthread_mutex_t mutex_;
+  // Hashes of all entries, so that new ones need no database lookup.
+  util::BloomFilter known_hashes_;
+  // The hashes of the entries that QueueEntryAsync() is signing, with the
+  // callbacks of later submissions of them.
+  std::map<std::string, std::vector<SubmitCallback*> > in_flight_;
+  // NULL unless set.
+  SequencingQueue *queue_;
+
+  // Read the hashes of the entries in the database.
+  void ReadKnownHashes();
+
+  // As QueueEntries(), but moves the new entries out of |entries| and
+  // into the database rather than copying them.
+  void QueueOwnedEntries(std::vector<ct::LogEntry> *entries,
+                         std::vector<SubmitResult> *results,
+                         std::vector<ct::SignedCertificateTimestamp> *scts);
+
+  // Write the asynchronously signed |entry| to the database and call back.
+  void EntrySigned(PendingEntry *entry);
+  // Pass |result| and |sct| to |callback|, and the submissions of |hash|
+  // that came in meanwhile, and forget about them.
+  void Finish(const std::string &hash, SubmitResult result,
+              const ct::SignedCertificateTimestamp &sct,
+              SubmitCallback *callback);
+  void AddKnownHash(const std::string &hash);
+  // Tell the signer, if there is a queue, of the entry just written.
+  void Sequence(const ct::LoggedCertificate &logged, const std::string &hash);
+
+  static std::string EntryHash(const ct::LogEntry &entry);
+  // Whether an entry with hash |hash| is logged, and if so its SCT.
+  bool LookupHash(const std::string &hash,
+                  ct::SignedCertificateTimestamp *sct) const;
+  // The SCT of the entry with |hash|, which must be in the database.
+  void LookupLogged(const std::string &hash,
+                    ct::SignedCertificateTimestamp *sct) const;
 
-  void TimestampAndSign(const ct::LogEntry &entry,
-                        ct::SignedCertificateTimestamp *sct) const;
+  static void Timestamp(ct::SignedCertificateTimestamp *sct);
+  static void SignRange(void *arg, size_t chunk, size_t begin,
+                        size_t end);
 };
 #endif
@@ -1,12 +1,16 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <deque>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <string>
+#include <vector>
 
 #include "log/file_db.h"
 #include "log/frontend_signer.h"
+#include "log/log_signer.h"
 #include "log/log_verifier.h"
 #include "log/logged_certificate.h"
+#include "log/sequencing_queue.h"
 #include "log/sqlite_db.h"
 #include "log/test_db.h"
 #include "log/test_signer.h"
@@ -126,6 +130,46 @@ TYPED_TEST(FrontendSignerTest, LogDuplicates) {
   EXPECT_EQ(sct0.timestamp(), sct1.timestamp());
 }
 
+TYPED_TEST(FrontendSignerTest, IsLogged) {
+  LogEntry entry;
+  do
+    this->test_signer_.CreateUnique(&entry);
+  while (entry.type() != ct::X509_ENTRY);
+
+  SignedCertificateTimestamp sct0, sct1;
+  EXPECT_FALSE(this->frontend_->IsLogged(entry, &sct1));
+  EXPECT_EQ(FS::NEW, this->frontend_->QueueEntry(entry, &sct0));
+  EXPECT_TRUE(this->frontend_->IsLogged(entry, NULL));
+
+  // Only the leaf matters.
+  LogEntry leaf;
+  leaf.set_type(entry.type());
+  leaf.mutable_x509_entry()->set_leaf_certificate(
+      entry.x509_entry().leaf_certificate());
+  EXPECT_TRUE(this->frontend_->IsLogged(leaf, &sct1));
+  EXPECT_EQ(sct0.timestamp(), sct1.timestamp());
+}
+
+TYPED_TEST(FrontendSignerTest, LogDuplicatesAfterRestart) {
+  LogEntry entry0, entry1;
+  this->test_signer_.CreateUnique(&entry0);
+  this->test_signer_.CreateUnique(&entry1);
+
+  SignedCertificateTimestamp sct0, sct1;
+  EXPECT_EQ(FS::NEW, this->frontend_->QueueEntry(entry0, &sct0));
+  EXPECT_EQ(FS::NEW, this->frontend_->QueueEntry(entry1, NULL));
+  string hash1 =
+      Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry1));
+  EXPECT_EQ(DB::OK, this->db()->AssignSequenceNumber(hash1, 0));
+
+  // A new frontend knows both the pending and the logged entry.
+  delete this->frontend_;
+  this->frontend_ = new FS(this->db(), TestSigner::DefaultLogSigner());
+  EXPECT_EQ(FS::DUPLICATE, this->frontend_->QueueEntry(entry0, &sct1));
+  EXPECT_EQ(sct0.timestamp(), sct1.timestamp());
+  EXPECT_EQ(FS::DUPLICATE, this->frontend_->QueueEntry(entry1, NULL));
+}
+
 TYPED_TEST(FrontendSignerTest, LogDuplicatesDifferentChain) {
   LogEntry entry0, entry1;
   this->test_signer_.CreateUnique(&entry0);
@@ -210,6 +254,129 @@ TYPED_TEST(FrontendSignerTest, TimedVerify) {
             LogVerifier::INVALID_SIGNATURE);
 }
 
+TYPED_TEST(FrontendSignerTest, QueueEntries) {
+  LogEntry logged_entry;
+  this->test_signer_.CreateUnique(&logged_entry);
+  SignedCertificateTimestamp logged_sct;
+  EXPECT_EQ(FS::NEW, this->frontend_->QueueEntry(logged_entry, &logged_sct));
+
+  std::vector<LogSigner*> signers;
+  for (int i = 0; i < 3; ++i)
+    signers.push_back(TestSigner::DefaultLogSigner());
+  FS frontend(this->db(), signers);
+
+  // New entries, one of them twice, and one logged before.
+  std::vector<LogEntry> entries(7);
+  for (size_t i = 0; i < 5; ++i)
+    this->test_signer_.CreateUnique(&entries[i]);
+  entries[5].CopyFrom(entries[1]);
+  entries[6].CopyFrom(logged_entry);
+
+  std::vector<FS::SubmitResult> results;
+  std::vector<SignedCertificateTimestamp> scts;
+  frontend.QueueEntries(entries, &results, &scts);
+  ASSERT_EQ(entries.size(), results.size());
+  ASSERT_EQ(entries.size(), scts.size());
+  for (size_t i = 0; i < 5; ++i) {
+    EXPECT_EQ(FS::NEW, results[i]);
+    EXPECT_EQ(LogVerifier::VERIFY_OK,
+              this->verifier_->VerifySignedCertificateTimestamp(entries[i],
+                                                                scts[i]));
+    if (i > 0) {
+      EXPECT_LE(scts[i - 1].timestamp(), scts[i].timestamp());
+    }
+    LoggedCertificate logged_cert;
+    EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupByHash(
+        Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entries[i])),
+        &logged_cert));
+    EXPECT_EQ(scts[i].timestamp(), logged_cert.sct().timestamp());
+  }
+  EXPECT_EQ(FS::DUPLICATE, results[5]);
+  EXPECT_EQ(scts[1].timestamp(), scts[5].timestamp());
+  EXPECT_EQ(FS::DUPLICATE, results[6]);
+  EXPECT_EQ(logged_sct.timestamp(), scts[6].timestamp());
+}
+
+TYPED_TEST(FrontendSignerTest, SequencingQueue) {
+  SequencingQueue queue;
+  this->frontend_->SetSequencingQueue(&queue);
+  LogEntry entry0, entry1;
+  this->test_signer_.CreateUnique(&entry0);
+  this->test_signer_.CreateUnique(&entry1);
+  std::vector<LogEntry> entries;
+  entries.push_back(entry1);
+  entries.push_back(entry0);
+
+  // Only new entries are queued, once each.
+  EXPECT_EQ(FS::NEW, this->frontend_->QueueEntry(entry0, NULL));
+  std::vector<FS::SubmitResult> results;
+  std::vector<SignedCertificateTimestamp> scts;
+  this->frontend_->QueueEntries(entries, &results, &scts);
+  EXPECT_EQ(FS::NEW, results[0]);
+  EXPECT_EQ(FS::DUPLICATE, results[1]);
+
+  std::deque<SequencingQueue::Entry> queued;
+  EXPECT_EQ(2U, queue.Drain(&queued));
+  for (size_t i = 0; i < queued.size(); ++i) {
+    LoggedCertificate logged_cert;
+    EXPECT_EQ(DB::LOOKUP_OK,
+              this->db()->LookupByHash(queued[i].hash, &logged_cert));
+    TestSigner::TestEqualEntries(i == 0 ? entry0 : entry1,
+                                 logged_cert.entry());
+    string leaf;
+    EXPECT_TRUE(logged_cert.SerializeForLeaf(&leaf));
+    EXPECT_EQ(leaf, queued[i].leaf);
+    EXPECT_EQ(logged_cert.timestamp(), queued[i].timestamp);
+  }
+}
+
+// Records the result of a QueueEntryAsync().
+class SCTCollector : public FS::SubmitCallback {
+ public:
+  SCTCollector() : done_(false) {}
+
+  virtual void Done(FS::SubmitResult result,
+                    const SignedCertificateTimestamp &sct) {
+    done_ = true;
+    result_ = result;
+    sct_.CopyFrom(sct);
+  }
+
+  bool done_;
+  FS::SubmitResult result_;
+  SignedCertificateTimestamp sct_;
+};
+
+TYPED_TEST(FrontendSignerTest, QueueEntryAsync) {
+  LogEntry entry;
+  this->test_signer_.CreateUnique(&entry);
+
+  // The LogSigner signs in-process, so the callback runs at once.
+  SCTCollector first;
+  this->frontend_->QueueEntryAsync(entry, &first);
+  ASSERT_TRUE(first.done_);
+  EXPECT_EQ(FS::NEW, first.result_);
+  EXPECT_EQ(LogVerifier::VERIFY_OK,
+            this->verifier_->VerifySignedCertificateTimestamp(entry,
+                                                              first.sct_));
+  LoggedCertificate logged_cert;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupByHash(
+      Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry)),
+      &logged_cert));
+  EXPECT_EQ(first.sct_.timestamp(), logged_cert.sct().timestamp());
+
+  SCTCollector second;
+  this->frontend_->QueueEntryAsync(entry, &second);
+  ASSERT_TRUE(second.done_);
+  EXPECT_EQ(FS::DUPLICATE, second.result_);
+  EXPECT_EQ(first.sct_.timestamp(), second.sct_.timestamp());
+
+  // The synchronous path sees the entry too.
+  SignedCertificateTimestamp sct;
+  EXPECT_EQ(FS::DUPLICATE, this->frontend_->QueueEntry(entry, &sct));
+  EXPECT_EQ(first.sct_.timestamp(), sct.timestamp());
+}
+
 }  // namespace
 
 int main(int argc, char**argv) {
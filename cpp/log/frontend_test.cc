@@ -3,7 +3,9 @@
 #include <gtest/gtest.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
+#include <pthread.h>
 #include <string>
+#include <vector>
 
 #include "log/cert_submission_handler.h"
 #include "log/ct_extensions.h"
@@ -239,6 +241,78 @@ TYPED_TEST(FrontendTest, TestSubmitDuplicate) {
   this->CompareStats(stats);
 }
 
+TYPED_TEST(FrontendTest, TestSubmitDuplicateSkipsVerification) {
+  SignedCertificateTimestamp sct, duplicate_sct;
+  EXPECT_EQ(ADDED,
+            this->frontend_->QueueEntry(ct::X509_ENTRY, this->leaf_pem_, &sct));
+
+  // With no trusted roots left, only a logged certificate gets through.
+  this->checker_.ClearAllTrustedCertificates();
+  EXPECT_EQ(DUPLICATE, this->frontend_->QueueEntry(
+      ct::X509_ENTRY, this->leaf_pem_, &duplicate_sct));
+  EXPECT_EQ(sct.timestamp(), duplicate_sct.timestamp());
+  EXPECT_EQ(sct.signature().signature(),
+            duplicate_sct.signature().signature());
+
+  CertChain chain(this->leaf_pem_);
+  duplicate_sct.Clear();
+  EXPECT_EQ(DUPLICATE, this->frontend_->QueueX509Entry(&chain,
+                                                       &duplicate_sct));
+  EXPECT_EQ(sct.timestamp(), duplicate_sct.timestamp());
+
+  EXPECT_EQ(CERTIFICATE_VERIFY_ERROR, this->frontend_->QueueEntry(
+      ct::X509_ENTRY, this->chain_leaf_pem_, NULL));
+  FE::FrontendStats stats(1, 2, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0);
+  this->CompareStats(stats);
+}
+
+struct Submitter {
+  FE *frontend;
+  string submission;
+  SubmitResult result;
+  SignedCertificateTimestamp sct;
+};
+
+void *Submit(void *arg) {
+  Submitter *submitter = static_cast<Submitter*>(arg);
+  submitter->result = submitter->frontend->QueueEntry(
+      ct::X509_ENTRY, submitter->submission, &submitter->sct);
+  return NULL;
+}
+
+TYPED_TEST(FrontendTest, TestSubmitConcurrently) {
+  const size_t kThreads = 8;
+  std::vector<Submitter> submitters(kThreads);
+  std::vector<pthread_t> threads(kThreads);
+  for (size_t i = 0; i < kThreads; ++i) {
+    submitters[i].frontend = this->frontend_;
+    // Half of them submit an unknown chain.
+    submitters[i].submission = i % 2 == 0 ? this->leaf_pem_
+        : this->chain_leaf_pem_;
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, &Submit, &submitters[i]));
+  }
+  for (size_t i = 0; i < kThreads; ++i)
+    ASSERT_EQ(0, pthread_join(threads[i], NULL));
+
+  // One submission of the leaf got in first; the rest are duplicates with
+  // the same SCT.
+  size_t added = 0;
+  for (size_t i = 0; i < kThreads; i += 2) {
+    if (submitters[i].result == ADDED)
+      ++added;
+    else
+      EXPECT_EQ(DUPLICATE, submitters[i].result);
+    EXPECT_EQ(submitters[0].sct.timestamp(), submitters[i].sct.timestamp());
+  }
+  EXPECT_EQ(1U, added);
+  for (size_t i = 1; i < kThreads; i += 2)
+    EXPECT_EQ(CERTIFICATE_VERIFY_ERROR, submitters[i].result);
+
+  FE::FrontendStats stats(1, kThreads / 2 - 1, 0, 0, kThreads / 2,
+                          0, 0, 0, 0, 0, 0, 0);
+  this->CompareStats(stats);
+}
+
 TYPED_TEST(FrontendTest, TestSubmitInvalidChain) {
   SignedCertificateTimestamp sct;
   // Missing intermediate.
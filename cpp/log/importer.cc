@@ -0,0 +1,151 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/importer.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/leaf_hash_file.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/ct.pb.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+using ct::SignedTreeHead;
+using std::string;
+
+// Leaf hashes read back from the database at a time, on startup.
+static const size_t kReadChunk = 1 << 16;
+
+// Batches are large, so their leaves hash across the cores, as the tree
+// signer's do.
+static size_t HashingThreads() {
+  return util::ThreadPool::Default()->Parallelism();
+}
+
+template <class Logged>
+Importer<Logged>::Importer(Database<Logged> *db, const string &leaf_hash_file,
+                           const string &checkpoint_file)
+    : db_(db),
+      leaf_hashes_(NULL),
+      checkpoint_file_(checkpoint_file),
+      tree_(new Sha256Hasher()),
+      next_sequence_number_(0) {
+  SignedTreeHead sth;
+  if (db_->LatestTreeHead(&sth) == Database<Logged>::LOOKUP_OK)
+    next_sequence_number_ = sth.tree_size();
+  // Entries of a run that stopped short of its tree head are kept.
+  Logged logged;
+  while (db_->LookupByIndex(next_sequence_number_, &logged) ==
+         Database<Logged>::LOOKUP_OK)
+    ++next_sequence_number_;
+
+  if (!leaf_hash_file.empty()) {
+    leaf_hashes_ = new LeafHashFile(leaf_hash_file, tree_.NodeSize());
+    if (leaf_hashes_->LeafCount() > next_sequence_number_)
+      leaf_hashes_->Truncate(next_sequence_number_);
+  }
+  // Those in the file already aren't appended again.
+  for (uint64_t start = 0; start < next_sequence_number_;
+       start += kReadChunk) {
+    const uint64_t end =
+        std::min<uint64_t>(start + kReadChunk, next_sequence_number_);
+    std::vector<string> leaf_hashes;
+    CHECK_EQ(Database<Logged>::LOOKUP_OK,
+             db_->LookupLeafHashRange(start, end, &leaf_hashes));
+    CHECK_EQ(end - start, leaf_hashes.size());
+    AddLeafHashes(leaf_hashes);
+  }
+  if (next_sequence_number_ > 0)
+    LOG(INFO) << "Resuming import at entry " << next_sequence_number_;
+}
+
+template <class Logged> Importer<Logged>::~Importer() {
+  delete leaf_hashes_;
+}
+
+template <class Logged> typename Importer<Logged>::ImportResult
+Importer<Logged>::Import(uint64_t first, const std::vector<Logged> &entries) {
+  if (first > next_sequence_number_)
+    return OUT_OF_ORDER;
+  const uint64_t end = first + entries.size();
+  const size_t skip = std::min(next_sequence_number_, end) - first;
+
+  const bool transactional = db_->Transactional();
+  if (transactional)
+    db_->BeginTransaction();
+  ImportResult result = IMPORT_OK;
+  std::vector<string> hashes;
+  std::vector<string> leaves;
+  for (size_t i = skip; i < entries.size(); ++i) {
+    // Left pending by a run that didn't finish.
+    typename Database<Logged>::WriteResult write_result =
+        db_->CreatePendingEntry(entries[i]);
+    if (write_result != Database<Logged>::OK &&
+        write_result != Database<Logged>::DUPLICATE_CERTIFICATE_HASH) {
+      result = BAD_ENTRY;
+      break;
+    }
+    hashes.push_back(entries[i].Hash());
+    leaves.push_back(string());
+    CHECK(entries[i].SerializeForLeaf(&leaves.back()));
+  }
+  std::vector<string> leaf_hashes;
+  tree_.LeafHashes(leaves, &leaf_hashes, HashingThreads());
+  size_t assigned = 0;
+  if (result == IMPORT_OK &&
+      db_->AssignSequenceNumbers(hashes, next_sequence_number_, &assigned) !=
+      Database<Logged>::OK)
+    result = BAD_ENTRY;
+  if (transactional)
+    db_->EndTransaction();
+
+  next_sequence_number_ += assigned;
+  leaf_hashes.resize(assigned);
+  AddLeafHashes(leaf_hashes);
+  return result;
+}
+
+template <class Logged> typename Importer<Logged>::ImportResult
+Importer<Logged>::Finish(const SignedTreeHead &sth) {
+  if (sth.tree_size() != next_sequence_number_)
+    return BAD_TREE_HEAD;
+  if (tree_.CurrentRoot() != sth.sha256_root_hash())
+    return ROOT_MISMATCH;
+  typename Database<Logged>::WriteResult write_result =
+      db_->WriteTreeHead(sth);
+  // Imported before.
+  if (write_result != Database<Logged>::OK &&
+      write_result != Database<Logged>::DUPLICATE_TREE_HEAD_TIMESTAMP)
+    return BAD_TREE_HEAD;
+  WriteCheckpoint();
+  return IMPORT_OK;
+}
+
+template <class Logged>
+void Importer<Logged>::AddLeafHashes(const std::vector<string> &leaf_hashes) {
+  const uint64_t old_size = tree_.LeafCount();
+  tree_.AddLeafHashes(leaf_hashes.begin(), leaf_hashes.end(),
+                      HashingThreads());
+  if (leaf_hashes_ != NULL && leaf_hashes_->LeafCount() < tree_.LeafCount())
+    leaf_hashes_->Append(
+        leaf_hashes.begin() +
+        std::max<uint64_t>(leaf_hashes_->LeafCount(), old_size) - old_size,
+        leaf_hashes.end());
+}
+
+template <class Logged> void Importer<Logged>::WriteCheckpoint() {
+  if (checkpoint_file_.empty())
+    return;
+  string checkpoint;
+  tree_.Checkpoint(&checkpoint);
+  // As the tree signer does, so that a crash never leaves a partial
+  // checkpoint behind.
+  string tmp_file =
+      util::WriteTemporaryBinaryFile(checkpoint_file_ + ".XXXXXX", checkpoint);
+  CHECK(!tmp_file.empty()) << "Failed to write tree checkpoint";
+  PCHECK(rename(tmp_file.c_str(), checkpoint_file_.c_str()) == 0)
+      << "Failed to rename " << tmp_file << " to " << checkpoint_file_;
+}
@@ -0,0 +1,75 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef IMPORTER_H
+#define IMPORTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/database.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "proto/ct.pb.h"
+
+class LeafHashFile;
+
+// Loads the entries of another log into a database in bulk, with the
+// sequence numbers and timestamps they have there, rather than through a
+// Frontend that would verify and sign each one anew: a batch of entries is
+// written in one transaction, and sequenced at once. Builds the Merkle tree
+// of the entries as they go in, and writes the source's tree head only if
+// the tree adds up to it.
+//
+// The database keys entries by certificate hash, so a source that has
+// logged a certificate twice can't be imported.
+//
+// Not thread-safe.
+template <class Logged> class Importer {
+ public:
+  // Writes to |db|, which must outlive the importer, picking up where it
+  // left off. Unless they are empty, also keeps the leaf hashes in the
+  // LeafHashFile |leaf_hash_file|, and checkpoints the tree to
+  // |checkpoint_file| with each tree head, as a LogLookup and a TreeSigner
+  // of the database would.
+  Importer(Database<Logged> *db, const std::string &leaf_hash_file,
+           const std::string &checkpoint_file);
+  ~Importer();
+
+  enum ImportResult {
+    IMPORT_OK,
+    // The entries start past our next one.
+    OUT_OF_ORDER,
+    // An entry doesn't fit the database.
+    BAD_ENTRY,
+    // The tree head doesn't cover exactly the entries.
+    BAD_TREE_HEAD,
+    // Or it does, but has a different root.
+    ROOT_MISMATCH,
+  };
+
+  // Write |entries|, which have the sequence numbers from |first| on, as
+  // one batch. Entries that we have already are skipped.
+  ImportResult Import(uint64_t first, const std::vector<Logged> &entries);
+
+  // Write the source's tree head |sth|, once the entries add up to it.
+  ImportResult Finish(const ct::SignedTreeHead &sth);
+
+  // The sequence number of the first entry that we don't have.
+  uint64_t NextSequenceNumber() const { return next_sequence_number_; }
+
+  // The root of the entries imported so far.
+  std::string CurrentRoot() { return tree_.CurrentRoot(); }
+
+ private:
+  // Add the leaf hashes of new entries to the tree and the file.
+  void AddLeafHashes(const std::vector<std::string> &leaf_hashes);
+  void WriteCheckpoint();
+
+  Database<Logged> *const db_;
+  LeafHashFile *leaf_hashes_;
+  const std::string checkpoint_file_;
+  CompactMerkleTree tree_;
+  uint64_t next_sequence_number_;
+};
+
+#endif  // IMPORTER_H
@@ -0,0 +1,5 @@
+#include "importer.cc"
+
+#include "log/logged_certificate.h"
+
+template class Importer<ct::LoggedCertificate>;
@@ -0,0 +1,252 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/file_db.h"
+#include "log/importer.h"
+#include "log/log_lookup.h"
+#include "log/logged_certificate.h"
+#include "log/sqlite_db.h"
+#include "log/test_db.h"
+#include "log/test_signer.h"
+#include "log/tree_signer.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/leaf_hash_file.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace {
+
+using ct::LoggedCertificate;
+using ct::MerkleTreeLeaf;
+using ct::SignedTreeHead;
+using std::string;
+using std::vector;
+
+typedef Database<LoggedCertificate> DB;
+typedef Importer<LoggedCertificate> I;
+typedef LogLookup<LoggedCertificate> LL;
+typedef TreeSigner<LoggedCertificate> TS;
+
+// |logged| as a get-entries client gets it.
+LoggedCertificate Mirror(const LoggedCertificate &logged) {
+  string leaf_input, extra_data;
+  CHECK(logged.SerializeForLeaf(&leaf_input));
+  CHECK(logged.SerializeExtraData(&extra_data));
+  MerkleTreeLeaf leaf;
+  CHECK_EQ(Deserializer::OK,
+           Deserializer::DeserializeMerkleTreeLeaf(leaf_input, &leaf));
+  ct::LogEntry extra;
+  if (logged.entry().type() == ct::X509_ENTRY)
+    CHECK_EQ(Deserializer::OK, Deserializer::DeserializeX509Chain(
+        extra_data, extra.mutable_x509_entry()));
+  else
+    CHECK_EQ(Deserializer::OK, Deserializer::DeserializePrecertChainEntry(
+        extra_data, extra.mutable_precert_entry()));
+  LoggedCertificate mirrored;
+  CHECK(mirrored.CopyFromLeaf(leaf, extra));
+  return mirrored;
+}
+
+TEST(CopyFromLeafTest, RoundTrip) {
+  for (int i = 0; i < 16; ++i) {
+    LoggedCertificate logged;
+    logged.RandomForTest();
+    LoggedCertificate mirrored = Mirror(logged);
+
+    string leaf1, leaf2, extra1, extra2;
+    ASSERT_TRUE(logged.SerializeForLeaf(&leaf1));
+    ASSERT_TRUE(mirrored.SerializeForLeaf(&leaf2));
+    EXPECT_EQ(leaf1, leaf2);
+    ASSERT_TRUE(logged.SerializeExtraData(&extra1));
+    ASSERT_TRUE(mirrored.SerializeExtraData(&extra2));
+    EXPECT_EQ(extra1, extra2);
+    EXPECT_EQ(logged.Hash(), mirrored.Hash());
+    EXPECT_EQ(logged.timestamp(), mirrored.timestamp());
+    EXPECT_FALSE(mirrored.has_sequence_number());
+  }
+}
+
+TEST(CopyFromLeafTest, UnknownLeaf) {
+  LoggedCertificate logged;
+  MerkleTreeLeaf leaf;
+  EXPECT_FALSE(logged.CopyFromLeaf(leaf, ct::LogEntry()));
+  leaf.set_type(ct::TIMESTAMPED_ENTRY);
+  leaf.mutable_timestamped_entry()->set_entry_type(ct::UNKNOWN_ENTRY_TYPE);
+  EXPECT_FALSE(logged.CopyFromLeaf(leaf, ct::LogEntry()));
+}
+
+template <class T> class ImporterTest : public ::testing::Test {
+ protected:
+  ImporterTest()
+      : tree_signer_(NULL),
+        leaf_hash_file_(tmp_.TmpStorageDir() + "/leaf_hashes"),
+        checkpoint_file_(tmp_.TmpStorageDir() + "/checkpoint") {}
+
+  void SetUp() {
+    tree_signer_ = new TS(source(), TestSigner::DefaultLogSigner());
+  }
+
+  ~ImporterTest() { delete tree_signer_; }
+
+  T *source() const { return source_db_.db(); }
+  T *mirror() const { return mirror_db_.db(); }
+
+  // Log |count| more entries on the source and sign them.
+  void AddEntries(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      LoggedCertificate logged;
+      test_signer_.CreateUnique(&logged);
+      EXPECT_EQ(DB::OK, source()->CreatePendingEntry(logged));
+    }
+    EXPECT_EQ(TS::OK, tree_signer_->UpdateTree());
+  }
+
+  // The source's entries |start| to |end| - 1, as fetched from it.
+  vector<LoggedCertificate> Fetch(uint64_t start, uint64_t end) const {
+    vector<LoggedCertificate> entries;
+    for (uint64_t i = start; i < end; ++i) {
+      LoggedCertificate logged;
+      CHECK_EQ(DB::LOOKUP_OK, source()->LookupByIndex(i, &logged));
+      entries.push_back(Mirror(logged));
+    }
+    return entries;
+  }
+
+  // Import entries, |batch_size| at a time, up to the source's latest tree
+  // head, and write it.
+  I::ImportResult ImportAll(I *importer, size_t batch_size) const {
+    const SignedTreeHead sth = tree_signer_->LatestSTH();
+    while (importer->NextSequenceNumber() < sth.tree_size()) {
+      const uint64_t start = importer->NextSequenceNumber();
+      const uint64_t end = std::min<uint64_t>(start + batch_size,
+                                              sth.tree_size());
+      I::ImportResult result = importer->Import(start, Fetch(start, end));
+      if (result != I::IMPORT_OK)
+        return result;
+    }
+    return importer->Finish(sth);
+  }
+
+  void ExpectImported() const {
+    SignedTreeHead source_sth, mirror_sth;
+    ASSERT_EQ(DB::LOOKUP_OK, source()->LatestTreeHead(&source_sth));
+    ASSERT_EQ(DB::LOOKUP_OK, mirror()->LatestTreeHead(&mirror_sth));
+    EXPECT_EQ(source_sth.SerializeAsString(), mirror_sth.SerializeAsString());
+    vector<string> source_hashes, mirror_hashes;
+    ASSERT_EQ(DB::LOOKUP_OK,
+              source()->LookupLeafHashRange(0, source_sth.tree_size(),
+                                            &source_hashes));
+    ASSERT_EQ(DB::LOOKUP_OK,
+              mirror()->LookupLeafHashRange(0, source_sth.tree_size(),
+                                            &mirror_hashes));
+    EXPECT_EQ(source_hashes, mirror_hashes);
+    for (uint64_t i = 0; i < source_sth.tree_size(); ++i) {
+      LoggedCertificate logged;
+      ASSERT_EQ(DB::LOOKUP_OK, mirror()->LookupByIndex(i, &logged));
+      EXPECT_EQ(i, logged.sequence_number());
+    }
+  }
+
+  TestDB<T> source_db_;
+  TestDB<T> mirror_db_;
+  TestSigner test_signer_;
+  TS *tree_signer_;
+  TmpStorage tmp_;
+  const string leaf_hash_file_;
+  const string checkpoint_file_;
+};
+
+typedef testing::Types<FileDB<LoggedCertificate>,
+                       SQLiteDB<LoggedCertificate> > Databases;
+
+TYPED_TEST_CASE(ImporterTest, Databases);
+
+TYPED_TEST(ImporterTest, Import) {
+  this->AddEntries(11);
+  I importer(this->mirror(), this->leaf_hash_file_, this->checkpoint_file_);
+  EXPECT_EQ(0U, importer.NextSequenceNumber());
+  EXPECT_EQ(I::IMPORT_OK, this->ImportAll(&importer, 4));
+  EXPECT_EQ(11U, importer.NextSequenceNumber());
+  this->ExpectImported();
+
+  // The lookup serves it, and the signer carries on from it.
+  LL lookup(this->mirror(), this->leaf_hash_file_);
+  EXPECT_EQ(11U, lookup.GetSTH().tree_size());
+  {
+    LoggedCertificate logged;
+    ASSERT_EQ(DB::LOOKUP_OK, this->mirror()->LookupByIndex(6, &logged));
+    uint64_t index;
+    EXPECT_EQ(LL::OK, lookup.GetIndex(lookup.LeafHash(logged), &index));
+    EXPECT_EQ(6U, index);
+  }
+  TS signer(this->mirror(), TestSigner::DefaultLogSigner(),
+            this->checkpoint_file_);
+  EXPECT_EQ(TS::OK, signer.UpdateTree());
+  EXPECT_EQ(11U, signer.LatestSTH().tree_size());
+
+  LeafHashFile leaf_hashes(this->leaf_hash_file_, 32);
+  EXPECT_EQ(11U, leaf_hashes.LeafCount());
+  string checkpoint;
+  ASSERT_TRUE(util::ReadBinaryFile(this->checkpoint_file_, &checkpoint));
+  CompactMerkleTree tree(new Sha256Hasher());
+  ASSERT_TRUE(tree.Restore(checkpoint));
+  EXPECT_EQ(11U, tree.LeafCount());
+  EXPECT_EQ(importer.CurrentRoot(), tree.CurrentRoot());
+}
+
+TYPED_TEST(ImporterTest, Resume) {
+  this->AddEntries(5);
+  I *importer = new I(this->mirror(), this->leaf_hash_file_, "");
+  EXPECT_EQ(I::IMPORT_OK, this->ImportAll(importer, 2));
+  // Stop short of the next tree head.
+  this->AddEntries(6);
+  EXPECT_EQ(I::IMPORT_OK, importer->Import(5, this->Fetch(5, 8)));
+  const string root = importer->CurrentRoot();
+  delete importer;
+
+  importer = new I(this->mirror(), this->leaf_hash_file_, "");
+  EXPECT_EQ(8U, importer->NextSequenceNumber());
+  EXPECT_EQ(root, importer->CurrentRoot());
+  // Overlapping entries are skipped.
+  EXPECT_EQ(I::IMPORT_OK, importer->Import(6, this->Fetch(6, 11)));
+  EXPECT_EQ(I::IMPORT_OK, importer->Finish(this->tree_signer_->LatestSTH()));
+  delete importer;
+  this->ExpectImported();
+
+  LeafHashFile leaf_hashes(this->leaf_hash_file_, 32);
+  EXPECT_EQ(11U, leaf_hashes.LeafCount());
+}
+
+TYPED_TEST(ImporterTest, BadImports) {
+  this->AddEntries(6);
+  I importer(this->mirror(), "", "");
+  EXPECT_EQ(I::OUT_OF_ORDER, importer.Import(2, this->Fetch(2, 6)));
+  EXPECT_EQ(I::IMPORT_OK, importer.Import(0, this->Fetch(0, 5)));
+
+  SignedTreeHead sth = this->tree_signer_->LatestSTH();
+  EXPECT_EQ(I::BAD_TREE_HEAD, importer.Finish(sth));
+  EXPECT_EQ(I::IMPORT_OK, importer.Import(5, this->Fetch(5, 6)));
+  SignedTreeHead bad_sth(sth);
+  bad_sth.set_sha256_root_hash(string(32, 'x'));
+  EXPECT_EQ(I::ROOT_MISMATCH, importer.Finish(bad_sth));
+  SignedTreeHead written;
+  EXPECT_EQ(DB::NOT_FOUND, this->mirror()->LatestTreeHead(&written));
+
+  EXPECT_EQ(I::IMPORT_OK, importer.Finish(sth));
+  this->ExpectImported();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
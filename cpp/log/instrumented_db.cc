@@ -0,0 +1,366 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/instrumented_db.h"
+
+#include <glog/logging.h>
+#include <set>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "proto/ct.pb.h"
+#include "util/metrics.h"
+#include "util/util.h"
+
+using std::string;
+
+namespace {
+
+const char kOperationSeconds[] = "ct_storage_operation_seconds";
+
+const char *const kOperationNames[] = {
+  "begin_transaction",
+  "end_transaction",
+  "create_pending_entry",
+  "assign_sequence_number",
+  "assign_sequence_numbers",
+  "lookup_by_hash",
+  "lookup_by_index",
+  "lookup_by_index_range",
+  "lookup_leaf_hash_range",
+  "lookup_entry_hash_range",
+  "pending_hashes",
+  "lookup_pending_entries",
+  "write_tree_head",
+  "latest_tree_head",
+  "lookup_tree_head_by_timestamp",
+  "lookup_tree_head_by_size",
+  "lookup_tree_head_range",
+};
+
+string OperationLabel(const char *operation) {
+  return string("op=\"") + operation + "\"";
+}
+
+}  // namespace
+
+// Counts a call, and the rows it reads or writes, into the statistics.
+template <class Logged> class InstrumentedDatabase<Logged>::Call {
+ public:
+  Call(const InstrumentedDatabase<Logged> *db, Operation operation)
+      : db_(db),
+        stats_(&db->stats_.operations[operation]),
+        operation_(operation),
+        start_(util::TimeInMicroseconds()) {}
+
+  ~Call() {
+    const uint64_t elapsed = util::TimeInMicroseconds() - start_;
+    ++stats_->calls;
+    stats_->microseconds += elapsed;
+    if (db_->metrics_ != NULL)
+      db_->metrics_->Observe(kOperationSeconds,
+                             OperationLabel(OperationName(operation_)),
+                             elapsed / 1e6);
+  }
+
+  void AddRow(uint64_t bytes) {
+    ++stats_->rows;
+    stats_->bytes += bytes;
+  }
+
+ private:
+  const InstrumentedDatabase<Logged> *db_;
+  OperationStats *stats_;
+  const Operation operation_;
+  const uint64_t start_;
+};
+
+// Counts the entries passed to another callback.
+template <class Logged> class InstrumentedDatabase<Logged>::CountingCallback
+    : public Database<Logged>::EntryCallback {
+ public:
+  CountingCallback(typename Database<Logged>::EntryCallback *callback,
+                   Call *call)
+      : callback_(callback), call_(call) {}
+
+  virtual bool Entry(const Logged &logged) {
+    call_->AddRow(logged.ByteSize());
+    return callback_->Entry(logged);
+  }
+
+ private:
+  typename Database<Logged>::EntryCallback *callback_;
+  Call *call_;
+};
+
+// Counts the tree heads passed to another callback.
+template <class Logged>
+class InstrumentedDatabase<Logged>::CountingTreeHeadCallback
+    : public Database<Logged>::TreeHeadCallback {
+ public:
+  CountingTreeHeadCallback(
+      typename Database<Logged>::TreeHeadCallback *callback, Call *call)
+      : callback_(callback), call_(call) {}
+
+  virtual bool TreeHead(const ct::SignedTreeHead &sth) {
+    call_->AddRow(sth.ByteSize());
+    return callback_->TreeHead(sth);
+  }
+
+ private:
+  typename Database<Logged>::TreeHeadCallback *callback_;
+  Call *call_;
+};
+
+template <class Logged>
+InstrumentedDatabase<Logged>::InstrumentedDatabase(Database<Logged> *db)
+    : db_(db),
+      metrics_(NULL) {
+  CHECK_NOTNULL(db_);
+}
+
+template <class Logged>
+InstrumentedDatabase<Logged>::InstrumentedDatabase(Database<Logged> *db,
+                                                   util::Metrics *metrics)
+    : db_(db),
+      metrics_(metrics) {
+  CHECK_NOTNULL(db_);
+  CHECK_NOTNULL(metrics);
+  metrics_->DefineHistogram(kOperationSeconds,
+                            "Latency of storage operations, in seconds.",
+                            util::Metrics::LatencyBuckets());
+}
+
+template <class Logged> InstrumentedDatabase<Logged>::~InstrumentedDatabase() {
+  delete db_;
+}
+
+// static
+template <class Logged>
+const char *InstrumentedDatabase<Logged>::OperationName(Operation operation) {
+  CHECK_GE(operation, 0);
+  CHECK_LT(operation, NUM_OPERATIONS);
+  return kOperationNames[operation];
+}
+
+template <class Logged>
+bool InstrumentedDatabase<Logged>::Transactional() const {
+  return db_->Transactional();
+}
+
+template <class Logged>
+void InstrumentedDatabase<Logged>::ExportMemoryUsage(
+    util::Metrics *metrics) const {
+  db_->ExportMemoryUsage(metrics);
+}
+
+template <class Logged> void InstrumentedDatabase<Logged>::BeginTransaction() {
+  Call call(this, BEGIN_TRANSACTION);
+  db_->BeginTransaction();
+}
+
+template <class Logged> void InstrumentedDatabase<Logged>::EndTransaction() {
+  Call call(this, END_TRANSACTION);
+  db_->EndTransaction();
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+InstrumentedDatabase<Logged>::CreatePendingEntry_(const Logged &logged) {
+  Call call(this, CREATE_PENDING_ENTRY);
+  WriteResult result = db_->CreatePendingEntry(logged);
+  if (result == Database<Logged>::OK)
+    call.AddRow(logged.ByteSize());
+  return result;
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+InstrumentedDatabase<Logged>::AssignSequenceNumber(const string &pending_hash,
+                                                   uint64_t sequence_number) {
+  Call call(this, ASSIGN_SEQUENCE_NUMBER);
+  WriteResult result = db_->AssignSequenceNumber(pending_hash,
+                                                 sequence_number);
+  if (result == Database<Logged>::OK)
+    call.AddRow(sizeof(sequence_number));
+  return result;
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+InstrumentedDatabase<Logged>::AssignSequenceNumbers(
+    const std::vector<string> &pending_hashes,
+    uint64_t first_sequence_number, size_t *assigned) {
+  Call call(this, ASSIGN_SEQUENCE_NUMBERS);
+  WriteResult result = db_->AssignSequenceNumbers(
+      pending_hashes, first_sequence_number, assigned);
+  for (size_t i = 0; i < *assigned; ++i)
+    call.AddRow(sizeof(first_sequence_number));
+  return result;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+InstrumentedDatabase<Logged>::LookupByHash(const string &hash) const {
+  Call call(this, LOOKUP_BY_HASH);
+  LookupResult result = db_->LookupByHash(hash);
+  if (result == Database<Logged>::LOOKUP_OK)
+    call.AddRow(0);
+  return result;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+InstrumentedDatabase<Logged>::LookupByHash(const string &hash,
+                                           Logged *result) const {
+  Call call(this, LOOKUP_BY_HASH);
+  LookupResult lookup = db_->LookupByHash(hash, result);
+  if (lookup == Database<Logged>::LOOKUP_OK)
+    call.AddRow(result->ByteSize());
+  return lookup;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+InstrumentedDatabase<Logged>::LookupByIndex(uint64_t sequence_number,
+                                            Logged *result) const {
+  Call call(this, LOOKUP_BY_INDEX);
+  LookupResult lookup = db_->LookupByIndex(sequence_number, result);
+  if (lookup == Database<Logged>::LOOKUP_OK)
+    call.AddRow(result->ByteSize());
+  return lookup;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+InstrumentedDatabase<Logged>::LookupByIndexRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::EntryCallback *callback) const {
+  Call call(this, LOOKUP_BY_INDEX_RANGE);
+  CountingCallback counting(callback, &call);
+  return db_->LookupByIndexRange(start, end, &counting);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+InstrumentedDatabase<Logged>::LookupLeafHashRange(
+    uint64_t start, uint64_t end, std::vector<string> *hashes) const {
+  Call call(this, LOOKUP_LEAF_HASH_RANGE);
+  const size_t size = hashes->size();
+  LookupResult result = db_->LookupLeafHashRange(start, end, hashes);
+  for (size_t i = size; i < hashes->size(); ++i)
+    call.AddRow((*hashes)[i].size());
+  return result;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+InstrumentedDatabase<Logged>::LookupEntryHashRange(
+    uint64_t start, uint64_t end, std::vector<string> *hashes) const {
+  Call call(this, LOOKUP_ENTRY_HASH_RANGE);
+  const size_t size = hashes->size();
+  LookupResult result = db_->LookupEntryHashRange(start, end, hashes);
+  for (size_t i = size; i < hashes->size(); ++i)
+    call.AddRow((*hashes)[i].size());
+  return result;
+}
+
+template <class Logged>
+std::set<string> InstrumentedDatabase<Logged>::PendingHashes() const {
+  Call call(this, PENDING_HASHES);
+  std::set<string> hashes = db_->PendingHashes();
+  for (std::set<string>::const_iterator it = hashes.begin();
+       it != hashes.end(); ++it)
+    call.AddRow(it->size());
+  return hashes;
+}
+
+template <class Logged> void InstrumentedDatabase<Logged>::LookupPendingEntries(
+    size_t limit, typename Database<Logged>::EntryCallback *callback) const {
+  Call call(this, LOOKUP_PENDING_ENTRIES);
+  CountingCallback counting(callback, &call);
+  db_->LookupPendingEntries(limit, &counting);
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+InstrumentedDatabase<Logged>::WriteTreeHead_(const ct::SignedTreeHead &sth) {
+  Call call(this, WRITE_TREE_HEAD);
+  WriteResult result = db_->WriteTreeHead(sth);
+  if (result == Database<Logged>::OK)
+    call.AddRow(sth.ByteSize());
+  return result;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+InstrumentedDatabase<Logged>::LatestTreeHead(ct::SignedTreeHead *result)
+    const {
+  Call call(this, LATEST_TREE_HEAD);
+  LookupResult lookup = db_->LatestTreeHead(result);
+  if (lookup == Database<Logged>::LOOKUP_OK)
+    call.AddRow(result->ByteSize());
+  return lookup;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+InstrumentedDatabase<Logged>::LookupTreeHeadByTimestamp(
+    uint64_t timestamp, ct::SignedTreeHead *result) const {
+  Call call(this, LOOKUP_TREE_HEAD_BY_TIMESTAMP);
+  LookupResult lookup = db_->LookupTreeHeadByTimestamp(timestamp, result);
+  if (lookup == Database<Logged>::LOOKUP_OK)
+    call.AddRow(result->ByteSize());
+  return lookup;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+InstrumentedDatabase<Logged>::LookupTreeHeadBySize(
+    uint64_t tree_size, ct::SignedTreeHead *result) const {
+  Call call(this, LOOKUP_TREE_HEAD_BY_SIZE);
+  LookupResult lookup = db_->LookupTreeHeadBySize(tree_size, result);
+  if (lookup == Database<Logged>::LOOKUP_OK)
+    call.AddRow(result->ByteSize());
+  return lookup;
+}
+
+template <class Logged> void InstrumentedDatabase<Logged>::LookupTreeHeadRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::TreeHeadCallback *callback) const {
+  Call call(this, LOOKUP_TREE_HEAD_RANGE);
+  CountingTreeHeadCallback counting(callback, &call);
+  db_->LookupTreeHeadRange(start, end, &counting);
+}
+
+template <class Logged>
+void InstrumentedDatabase<Logged>::GetStats(StorageStats *stats) const {
+  *stats = stats_;
+}
+
+template <class Logged>
+void InstrumentedDatabase<Logged>::ExportStats(util::Metrics *metrics) const {
+  const char kOperations[] = "ct_storage_operations_total";
+  const char kMicroseconds[] = "ct_storage_operation_microseconds_total";
+  const char kRows[] = "ct_storage_rows_total";
+  const char kBytes[] = "ct_storage_bytes_total";
+  metrics->DefineCounter(kOperations, "Storage operations, by operation.");
+  metrics->DefineCounter(kMicroseconds,
+                         "Time spent in storage operations, by operation.");
+  metrics->DefineCounter(kRows,
+                         "Rows read or written in storage, by operation.");
+  metrics->DefineCounter(kBytes,
+                         "Bytes read or written in storage, by operation.");
+  for (int i = 0; i < NUM_OPERATIONS; ++i) {
+    const OperationStats &stats = stats_.operations[i];
+    const string label =
+        OperationLabel(OperationName(static_cast<Operation>(i)));
+    metrics->Set(kOperations, label, stats.calls);
+    metrics->Set(kMicroseconds, label, stats.microseconds);
+    metrics->Set(kRows, label, stats.rows);
+    metrics->Set(kBytes, label, stats.bytes);
+  }
+}
+
+template <class Logged>
+string InstrumentedDatabase<Logged>::StatsSummary() const {
+  std::ostringstream out;
+  out << "Storage operations:";
+  for (int i = 0; i < NUM_OPERATIONS; ++i) {
+    const OperationStats &stats = stats_.operations[i];
+    if (stats.calls == 0)
+      continue;
+    out << " " << OperationName(static_cast<Operation>(i)) << " "
+        << stats.calls << " calls, " << stats.microseconds / stats.calls
+        << "us mean, " << stats.rows << " rows, " << stats.bytes
+        << " bytes;";
+  }
+  return out.str();
+}
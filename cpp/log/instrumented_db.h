@@ -0,0 +1,151 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+
+#ifndef INSTRUMENTED_DB_H
+#define INSTRUMENTED_DB_H
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/database.h"
+
+namespace util {
+class Metrics;
+}  // namespace util
+
+// Wraps another Database and counts, for each operation, the calls, the
+// time they take and the entries and bytes they read or write, so that a
+// slow storage layer shows in production. Wrap the storage itself, below
+// any cache or lock, so that neither cache hits nor lock waits count.
+//
+// Bytes are those of the entries and tree heads as protocol buffers, so
+// |Logged| must also have ByteSize(), as LoggedCertificate does.
+//
+// Like the databases it wraps, InstrumentedDatabase is not thread-safe.
+template <class Logged> class InstrumentedDatabase : public Database<Logged> {
+ public:
+  enum Operation {
+    BEGIN_TRANSACTION,
+    END_TRANSACTION,
+    CREATE_PENDING_ENTRY,
+    ASSIGN_SEQUENCE_NUMBER,
+    ASSIGN_SEQUENCE_NUMBERS,
+    LOOKUP_BY_HASH,
+    LOOKUP_BY_INDEX,
+    LOOKUP_BY_INDEX_RANGE,
+    LOOKUP_LEAF_HASH_RANGE,
+    LOOKUP_ENTRY_HASH_RANGE,
+    PENDING_HASHES,
+    LOOKUP_PENDING_ENTRIES,
+    WRITE_TREE_HEAD,
+    LATEST_TREE_HEAD,
+    LOOKUP_TREE_HEAD_BY_TIMESTAMP,
+    LOOKUP_TREE_HEAD_BY_SIZE,
+    LOOKUP_TREE_HEAD_RANGE,
+    NUM_OPERATIONS
+  };
+
+  struct OperationStats {
+    OperationStats() : calls(0), microseconds(0), rows(0), bytes(0) {}
+
+    uint64_t calls;
+    uint64_t microseconds;
+    // Entries, tree heads, hashes or sequence numbers read or written.
+    uint64_t rows;
+    uint64_t bytes;
+  };
+
+  struct StorageStats {
+    OperationStats operations[NUM_OPERATIONS];
+  };
+
+  // Takes ownership of |db|.
+  explicit InstrumentedDatabase(Database<Logged> *db);
+  // Also records call latencies in |metrics|, which must outlive the
+  // database, as the histogram ct_storage_operation_seconds.
+  InstrumentedDatabase(Database<Logged> *db, util::Metrics *metrics);
+
+  ~InstrumentedDatabase();
+
+  typedef typename Database<Logged>::WriteResult WriteResult;
+  typedef typename Database<Logged>::LookupResult LookupResult;
+
+  // The name of |operation| in metrics and logs, e.g. "lookup_by_hash".
+  static const char *OperationName(Operation operation);
+
+  virtual bool Transactional() const;
+
+  virtual void ExportMemoryUsage(util::Metrics *metrics) const;
+
+  virtual void BeginTransaction();
+
+  virtual void EndTransaction();
+
+  virtual WriteResult CreatePendingEntry_(const Logged &logged);
+
+  virtual WriteResult AssignSequenceNumber(const std::string &pending_hash,
+                                           uint64_t sequence_number);
+
+  virtual WriteResult AssignSequenceNumbers(
+      const std::vector<std::string> &pending_hashes,
+      uint64_t first_sequence_number, size_t *assigned);
+
+  virtual LookupResult LookupByHash(const std::string &hash) const;
+
+  virtual LookupResult LookupByHash(const std::string &hash,
+                                    Logged *result) const;
+
+  virtual LookupResult LookupByIndex(uint64_t sequence_number,
+                                     Logged *result) const;
+
+  virtual LookupResult LookupByIndexRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual LookupResult LookupLeafHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual LookupResult LookupEntryHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual std::set<std::string> PendingHashes() const;
+
+  virtual void LookupPendingEntries(
+      size_t limit, typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual WriteResult WriteTreeHead_(const ct::SignedTreeHead &sth);
+
+  virtual LookupResult LatestTreeHead(ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadBySize(
+      uint64_t tree_size, ct::SignedTreeHead *result) const;
+
+  virtual void LookupTreeHeadRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::TreeHeadCallback *callback) const;
+
+  void GetStats(StorageStats *stats) const;
+
+  // Set the totals of the counters ct_storage_operations_total,
+  // ct_storage_operation_microseconds_total, ct_storage_rows_total and
+  // ct_storage_bytes_total, by operation, in |metrics|.
+  void ExportStats(util::Metrics *metrics) const;
+
+  // One line of the calls, mean latency, rows and bytes of the operations
+  // called so far, for the log.
+  std::string StatsSummary() const;
+
+ private:
+  class Call;
+  class CountingCallback;
+  class CountingTreeHeadCallback;
+
+  Database<Logged> *db_;
+  util::Metrics *const metrics_;
+  mutable StorageStats stats_;
+};
+
+#endif
@@ -0,0 +1,225 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/interning_db.h"
+
+#include <glog/logging.h>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/entry_storage.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/ct.pb.h"
+#include "util/memory_usage.h"
+#include "util/util.h"
+
+using ct::LoggedCertificate;
+using google::protobuf::RepeatedPtrField;
+using std::string;
+
+namespace {
+
+// The chain of |logged|, whichever type of entry it is.
+RepeatedPtrField<string> *MutableChain(LoggedCertificate *logged) {
+  if (logged->entry().type() == ct::X509_ENTRY)
+    return logged->mutable_entry()->mutable_x509_entry()
+        ->mutable_certificate_chain();
+  return logged->mutable_entry()->mutable_precert_entry()
+      ->mutable_precertificate_chain();
+}
+
+size_t CertBytes(const string &cert) {
+  return util::HeapBytes(cert);
+}
+
+}  // namespace
+
+// Puts the chains of looked up entries back on their way to the real
+// callback.
+class InterningDatabase::RestoringCallback : public EntryCallback {
+ public:
+  RestoringCallback(const InterningDatabase *db, EntryCallback *callback)
+      : db_(db), callback_(callback) {}
+
+  virtual bool Entry(const LoggedCertificate &logged) {
+    if (logged.contents().chain_hash_size() == 0)
+      return callback_->Entry(logged);
+    LoggedCertificate restored(logged);
+    db_->Restore(&restored);
+    return callback_->Entry(restored);
+  }
+
+ private:
+  const InterningDatabase *db_;
+  EntryCallback *callback_;
+};
+
+InterningDatabase::InterningDatabase(Database<LoggedCertificate> *db,
+                                     EntryStorage *certs, size_t max_cached)
+    : db_(db),
+      certs_(certs),
+      cache_(max_cached) {
+  CHECK_NOTNULL(db);
+  CHECK_NOTNULL(certs);
+}
+
+InterningDatabase::~InterningDatabase() {
+  delete db_;
+  delete certs_;
+}
+
+bool InterningDatabase::Transactional() const {
+  return db_->Transactional();
+}
+
+void InterningDatabase::ExportMemoryUsage(util::Metrics *metrics) const {
+  db_->ExportMemoryUsage(metrics);
+  util::ExportMemoryUsage("intermediate_cache",
+                          cache_.MemoryUsage(CertBytes), metrics);
+}
+
+void InterningDatabase::BeginTransaction() {
+  db_->BeginTransaction();
+}
+
+void InterningDatabase::EndTransaction() {
+  db_->EndTransaction();
+}
+
+InterningDatabase::WriteResult
+InterningDatabase::CreatePendingEntry_(const LoggedCertificate &logged) {
+  LoggedCertificate interned(logged);
+  Intern(&interned);
+  return db_->CreatePendingEntry(interned);
+}
+
+InterningDatabase::WriteResult
+InterningDatabase::AssignSequenceNumber(const string &pending_hash,
+                                        uint64_t sequence_number) {
+  return db_->AssignSequenceNumber(pending_hash, sequence_number);
+}
+
+InterningDatabase::WriteResult
+InterningDatabase::AssignSequenceNumbers(
+    const std::vector<string> &pending_hashes,
+    uint64_t first_sequence_number, size_t *assigned) {
+  return db_->AssignSequenceNumbers(pending_hashes, first_sequence_number,
+                                    assigned);
+}
+
+InterningDatabase::LookupResult
+InterningDatabase::LookupByHash(const string &hash) const {
+  return db_->LookupByHash(hash);
+}
+
+InterningDatabase::LookupResult
+InterningDatabase::LookupByHash(const string &hash,
+                                LoggedCertificate *result) const {
+  LookupResult lookup = db_->LookupByHash(hash, result);
+  if (lookup == LOOKUP_OK)
+    Restore(result);
+  return lookup;
+}
+
+InterningDatabase::LookupResult
+InterningDatabase::LookupByIndex(uint64_t sequence_number,
+                                 LoggedCertificate *result) const {
+  LookupResult lookup = db_->LookupByIndex(sequence_number, result);
+  if (lookup == LOOKUP_OK)
+    Restore(result);
+  return lookup;
+}
+
+InterningDatabase::LookupResult
+InterningDatabase::LookupByIndexRange(uint64_t start, uint64_t end,
+                                      EntryCallback *callback) const {
+  RestoringCallback restoring(this, callback);
+  return db_->LookupByIndexRange(start, end, &restoring);
+}
+
+InterningDatabase::LookupResult
+InterningDatabase::LookupLeafHashRange(uint64_t start, uint64_t end,
+                                       std::vector<string> *hashes) const {
+  return db_->LookupLeafHashRange(start, end, hashes);
+}
+
+// Only the chains are interned, so the hashes are those of the entries.
+InterningDatabase::LookupResult
+InterningDatabase::LookupEntryHashRange(uint64_t start, uint64_t end,
+                                        std::vector<string> *hashes) const {
+  return db_->LookupEntryHashRange(start, end, hashes);
+}
+
+std::set<string> InterningDatabase::PendingHashes() const {
+  return db_->PendingHashes();
+}
+
+void InterningDatabase::LookupPendingEntries(size_t limit,
+                                             EntryCallback *callback) const {
+  RestoringCallback restoring(this, callback);
+  db_->LookupPendingEntries(limit, &restoring);
+}
+
+InterningDatabase::WriteResult
+InterningDatabase::WriteTreeHead_(const ct::SignedTreeHead &sth) {
+  return db_->WriteTreeHead(sth);
+}
+
+InterningDatabase::LookupResult
+InterningDatabase::LatestTreeHead(ct::SignedTreeHead *result) const {
+  return db_->LatestTreeHead(result);
+}
+
+InterningDatabase::LookupResult
+InterningDatabase::LookupTreeHeadByTimestamp(uint64_t timestamp,
+                                             ct::SignedTreeHead *result) const {
+  return db_->LookupTreeHeadByTimestamp(timestamp, result);
+}
+
+InterningDatabase::LookupResult
+InterningDatabase::LookupTreeHeadBySize(uint64_t tree_size,
+                                        ct::SignedTreeHead *result) const {
+  return db_->LookupTreeHeadBySize(tree_size, result);
+}
+
+void InterningDatabase::LookupTreeHeadRange(uint64_t start, uint64_t end,
+                                            TreeHeadCallback *callback) const {
+  db_->LookupTreeHeadRange(start, end, callback);
+}
+
+void InterningDatabase::Intern(LoggedCertificate *logged) {
+  CHECK_EQ(0, logged->contents().chain_hash_size());
+  RepeatedPtrField<string> *chain = MutableChain(logged);
+  for (int i = 0; i < chain->size(); ++i) {
+    const string &cert = chain->Get(i);
+    const string hash = Sha256Hasher::Sha256Digest(cert);
+    if (!cache_.Get(hash, NULL)) {
+      // Fails if we have it already, which is fine.
+      certs_->CreateEntry(hash, cert);
+      cache_.Put(hash, cert);
+    }
+    logged->mutable_contents()->add_chain_hash(hash);
+  }
+  chain->Clear();
+}
+
+void InterningDatabase::Restore(LoggedCertificate *logged) const {
+  const int size = logged->contents().chain_hash_size();
+  if (size == 0)
+    return;
+  RepeatedPtrField<string> *chain = MutableChain(logged);
+  CHECK_EQ(0, chain->size());
+  for (int i = 0; i < size; ++i)
+    chain->Add()->assign(Certificate(logged->contents().chain_hash(i)));
+  logged->mutable_contents()->clear_chain_hash();
+}
+
+string InterningDatabase::Certificate(const string &hash) const {
+  string cert;
+  if (cache_.Get(hash, &cert))
+    return cert;
+  CHECK_EQ(EntryStorage::OK, certs_->LookupEntry(hash, &cert))
+      << "Missing chain certificate " << util::HexString(hash);
+  cache_.Put(hash, cert);
+  return cert;
+}
@@ -0,0 +1,109 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+
+#ifndef INTERNING_DB_H
+#define INTERNING_DB_H
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/database.h"
+#include "log/logged_certificate.h"
+#include "util/lru_cache.h"
+
+class EntryStorage;
+
+// Wraps another certificate Database and stores each chain certificate
+// once, rather than with every entry whose chain contains it: almost all
+// chains are built from the same few thousand intermediates and roots.
+// The certificates go into a separate store, keyed by their SHA-256 hash,
+// and the wrapped database stores the hashes in their place. Lookups put
+// the chains back together, reading the certificates through an in-memory
+// cache.
+//
+// Entries that the wrapped database holds with their chain in place (e.g.
+// from before it was wrapped) are read as they are.
+//
+// Like the databases it wraps, InterningDatabase is not thread-safe.
+class InterningDatabase : public Database<ct::LoggedCertificate> {
+ public:
+  // Takes ownership of |db| and |certs|, which stores the certificates.
+  // Keeps up to |max_cached| certificates in memory.
+  InterningDatabase(Database<ct::LoggedCertificate> *db, EntryStorage *certs,
+                    size_t max_cached);
+
+  ~InterningDatabase();
+
+  virtual bool Transactional() const;
+
+  // Adds the certificate cache.
+  virtual void ExportMemoryUsage(util::Metrics *metrics) const;
+
+  virtual void BeginTransaction();
+
+  virtual void EndTransaction();
+
+  // Stores any new chain certificates before the entry that refers to
+  // them.
+  virtual WriteResult CreatePendingEntry_(const ct::LoggedCertificate &logged);
+
+  virtual WriteResult AssignSequenceNumber(const std::string &pending_hash,
+                                           uint64_t sequence_number);
+
+  virtual WriteResult AssignSequenceNumbers(
+      const std::vector<std::string> &pending_hashes,
+      uint64_t first_sequence_number, size_t *assigned);
+
+  virtual LookupResult LookupByHash(const std::string &hash) const;
+
+  virtual LookupResult LookupByHash(const std::string &hash,
+                                    ct::LoggedCertificate *result) const;
+
+  virtual LookupResult LookupByIndex(uint64_t sequence_number,
+                                     ct::LoggedCertificate *result) const;
+
+  virtual LookupResult LookupByIndexRange(uint64_t start, uint64_t end,
+                                          EntryCallback *callback) const;
+
+  virtual LookupResult LookupLeafHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual LookupResult LookupEntryHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual std::set<std::string> PendingHashes() const;
+
+  virtual void LookupPendingEntries(size_t limit,
+                                    EntryCallback *callback) const;
+
+  virtual WriteResult WriteTreeHead_(const ct::SignedTreeHead &sth);
+
+  virtual LookupResult LatestTreeHead(ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadBySize(
+      uint64_t tree_size, ct::SignedTreeHead *result) const;
+
+  virtual void LookupTreeHeadRange(uint64_t start, uint64_t end,
+                                   TreeHeadCallback *callback) const;
+
+ private:
+  class RestoringCallback;
+
+  // Replace the chain of |logged| with the hashes of its certificates,
+  // storing those that are new.
+  void Intern(ct::LoggedCertificate *logged);
+  // Reverse Intern().
+  void Restore(ct::LoggedCertificate *logged) const;
+  // The certificate with hash |hash|, which must exist.
+  std::string Certificate(const std::string &hash) const;
+
+  Database<ct::LoggedCertificate> *db_;
+  EntryStorage *certs_;
+  // Lookups are const, but fill the cache.
+  mutable util::LRUCache<std::string, std::string> cache_;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "log/leaf_index.h"
+
+#include <glog/logging.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/merkle_tree.h"
+
+namespace {
+
+const size_t kMinSlots = 1024;
+const int kTagShift = 48;
+const uint64_t kIndexMask = (static_cast<uint64_t>(1) << kTagShift) - 1;
+
+// The first 8 bytes of |leaf_hash| pick the slot, the next 2 are the tag.
+uint64_t Bucket(const std::string &leaf_hash) {
+  uint64_t bucket = 0;
+  for (size_t i = 0; i < 8; ++i)
+    bucket = (bucket << 8) | static_cast<unsigned char>(leaf_hash[i]);
+  return bucket;
+}
+
+uint64_t Tag(const std::string &leaf_hash) {
+  return static_cast<uint64_t>(static_cast<unsigned char>(leaf_hash[8])) << 8 |
+      static_cast<unsigned char>(leaf_hash[9]);
+}
+
+}  // namespace
+
+LeafIndex::LeafIndex(const MerkleTree *tree)
+    : tree_(tree),
+      slots_(kMinSlots, 0),
+      indexed_(0) {
+  // Bucket() and Tag() need 10 bytes.
+  CHECK_GE(tree_->NodeSize(), 10U);
+}
+
+void LeafIndex::Update() {
+  const size_t leaf_count = tree_->LeafCount();
+  CHECK_GE(leaf_count, indexed_);
+  Reserve(leaf_count);
+  for (; indexed_ < leaf_count; ++indexed_)
+    Insert(tree_->LeafHash(indexed_ + 1), indexed_);
+}
+
+void LeafIndex::Clear() {
+  slots_.assign(kMinSlots, 0);
+  indexed_ = 0;
+}
+
+bool LeafIndex::Find(const std::string &leaf_hash, uint64_t *index) const {
+  if (leaf_hash.size() != tree_->NodeSize())
+    return false;
+  const size_t mask = slots_.size() - 1;
+  const uint64_t tag = Tag(leaf_hash);
+  // Probe consecutive slots, so that most lookups stay in one cache line.
+  for (size_t slot = Bucket(leaf_hash) & mask; slots_[slot] != 0;
+       slot = (slot + 1) & mask) {
+    if (slots_[slot] >> kTagShift != tag)
+      continue;
+    const uint64_t position = slots_[slot] & kIndexMask;
+    if (tree_->LeafHash(position) == leaf_hash) {
+      *index = position - 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+void LeafIndex::Reserve(size_t count) {
+  // Keep the table at most 3/4 full.
+  size_t num_slots = slots_.size();
+  while (4 * count > 3 * num_slots)
+    num_slots *= 2;
+  if (num_slots == slots_.size())
+    return;
+
+  // Rehash what we have. The slots don't hold the hashes, so read them
+  // from the tree again.
+  slots_.assign(num_slots, 0);
+  const size_t indexed = indexed_;
+  for (indexed_ = 0; indexed_ < indexed; ++indexed_)
+    Insert(tree_->LeafHash(indexed_ + 1), indexed_);
+}
+
+void LeafIndex::Insert(const std::string &leaf_hash, uint64_t index) {
+  CHECK_LT(index, kIndexMask);
+  const size_t mask = slots_.size() - 1;
+  const uint64_t tag = Tag(leaf_hash);
+  size_t slot = Bucket(leaf_hash) & mask;
+  for (; slots_[slot] != 0; slot = (slot + 1) & mask) {
+    // Duplicate leaves shouldn't really happen but are not a problem
+    // either: keep the first occurrence.
+    if (slots_[slot] >> kTagShift == tag &&
+        tree_->LeafHash(slots_[slot] & kIndexMask) == leaf_hash)
+      return;
+  }
+  slots_[slot] = tag << kTagShift | (index + 1);
+}
@@ -0,0 +1,57 @@
+#ifndef LEAF_INDEX_H
+#define LEAF_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "util/memory_usage.h"
+
+class MerkleTree;
+
+// Maps the leaf hashes of a MerkleTree back to their (0-based) index.
+// The hashes themselves are not stored here: the tree has them already.
+// Instead, this is an open addressing hash table of 8-byte slots, each
+// holding a leaf index and a 16-bit tag taken from the leaf hash. A lookup
+// probes consecutive slots and only reads the leaf hash from the tree when
+// the tag matches. Leaf hashes are cryptographic hashes, so their leading
+// bytes serve as the hash function.
+//
+// The table is at most 3/4 full, i.e., it takes 11 to 21 bytes per leaf.
+class LeafIndex {
+ public:
+  // |tree| must outlive the index, and only ever grow, unless cleared
+  // along with the index.
+  explicit LeafIndex(const MerkleTree *tree);
+
+  // Index the tree's leaves that aren't yet. If a leaf hash occurs more than
+  // once, the first occurrence wins.
+  void Update();
+
+  // Forget all leaves, for when the tree has been cleared.
+  void Clear();
+
+  // Returns false if no leaf has hash |leaf_hash|.
+  bool Find(const std::string &leaf_hash, uint64_t *index) const;
+
+  // Number of leaves indexed.
+  size_t size() const { return indexed_; }
+
+  util::MemoryUsage MemoryUsage() const {
+    return util::MemoryUsage(util::HeapBytes(slots_), indexed_);
+  }
+
+ private:
+  // Make room for |count| leaves without resizing.
+  void Reserve(size_t count);
+  void Insert(const std::string &leaf_hash, uint64_t index);
+
+  const MerkleTree *tree_;
+  // Each slot is tag << 48 | (index + 1), or 0 if unused. The lower bits
+  // are thus the leaf's position in MerkleTree::LeafHash() terms.
+  std::vector<uint64_t> slots_;
+  size_t indexed_;
+};
+
+#endif
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/leaf_index.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace {
+
+using std::string;
+
+class LeafIndexTest : public ::testing::Test {
+ protected:
+  LeafIndexTest() : tree_(new Sha256Hasher()), index_(&tree_) {}
+
+  // Add |count| leaves to the tree, and return their hashes.
+  std::vector<string> AddLeaves(size_t count) {
+    std::vector<string> hashes;
+    for (size_t i = 0; i < count; ++i) {
+      tree_.AddLeaf(util::RandomString(10, 20));
+      hashes.push_back(tree_.LeafHash(tree_.LeafCount()));
+    }
+    return hashes;
+  }
+
+  void ExpectIndexed(const std::vector<string> &hashes, uint64_t first) {
+    for (size_t i = 0; i < hashes.size(); ++i) {
+      uint64_t index;
+      ASSERT_TRUE(index_.Find(hashes[i], &index));
+      EXPECT_EQ(first + i, index);
+    }
+  }
+
+  MerkleTree tree_;
+  LeafIndex index_;
+};
+
+TEST_F(LeafIndexTest, Empty) {
+  uint64_t index;
+  EXPECT_EQ(0U, index_.size());
+  EXPECT_FALSE(index_.Find(tree_.LeafHash("leaf"), &index));
+  EXPECT_FALSE(index_.Find("short", &index));
+}
+
+TEST_F(LeafIndexTest, Find) {
+  std::vector<string> hashes = AddLeaves(10);
+  // Nothing is indexed until Update().
+  uint64_t index;
+  EXPECT_FALSE(index_.Find(hashes[0], &index));
+
+  index_.Update();
+  EXPECT_EQ(10U, index_.size());
+  ExpectIndexed(hashes, 0);
+  EXPECT_FALSE(index_.Find(tree_.LeafHash("not a leaf"), &index));
+}
+
+TEST_F(LeafIndexTest, Grow) {
+  std::vector<string> first = AddLeaves(1000);
+  index_.Update();
+  // Enough to resize the table a few times.
+  std::vector<string> second = AddLeaves(5000);
+  index_.Update();
+  EXPECT_EQ(6000U, index_.size());
+  ExpectIndexed(first, 0);
+  ExpectIndexed(second, 1000);
+}
+
+TEST_F(LeafIndexTest, Duplicates) {
+  std::vector<string> hashes = AddLeaves(3);
+  tree_.AddLeafHash(hashes[1]);
+  index_.Update();
+  EXPECT_EQ(4U, index_.size());
+
+  // The first occurrence wins.
+  uint64_t index;
+  ASSERT_TRUE(index_.Find(hashes[1], &index));
+  EXPECT_EQ(1U, index);
+}
+
+TEST_F(LeafIndexTest, Clear) {
+  std::vector<string> old_hashes = AddLeaves(1000);
+  index_.Update();
+  tree_.Clear();
+  index_.Clear();
+  EXPECT_EQ(0U, index_.size());
+
+  std::vector<string> hashes = AddLeaves(10);
+  index_.Update();
+  EXPECT_EQ(10U, index_.size());
+  ExpectIndexed(hashes, 0);
+  uint64_t index;
+  EXPECT_FALSE(index_.Find(old_hashes[0], &index));
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
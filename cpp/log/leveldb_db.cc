@@ -0,0 +1,527 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/leveldb_db.h"
+
+#include <glog/logging.h>
+#include <leveldb/db.h>
+#include <leveldb/filter_policy.h>
+#include <leveldb/iterator.h>
+#include <leveldb/options.h>
+#include <leveldb/write_batch.h>
+#include <limits>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+
+using std::string;
+
+namespace {
+
+const char kEntryPrefix = 'e';
+const char kPendingPrefix = 'p';
+const char kSequencePrefix = 's';
+const char kTreeHeadPrefix = 't';
+const char kTreeSizePrefix = 'z';
+const size_t kNumberKeyLength = 9;
+
+// Entry values are
+//   state (1 byte): kPendingState or kLoggedState,
+//   queue position or sequence number (8 bytes),
+//   leaf hash length (1 byte), leaf hash,
+//   the entry as serialized for the database.
+const char kPendingState = 'P';
+const char kLoggedState = 'L';
+
+struct EntryValue {
+  bool logged;
+  uint64_t number;
+  string leaf_hash;
+  string data;
+};
+
+string EntryKey(const string &hash) {
+  return string(1, kEntryPrefix) + hash;
+}
+
+string NumberKey(char prefix, uint64_t number) {
+  return string(1, prefix) + Serializer::SerializeUint(number, 8);
+}
+
+string PendingKey(uint64_t position, const string &hash) {
+  return NumberKey(kPendingPrefix, position) + hash;
+}
+
+uint64_t KeyNumber(const leveldb::Slice &key) {
+  CHECK_GE(key.size(), kNumberKeyLength);
+  uint64_t number = 0;
+  CHECK_EQ(Deserializer::OK,
+           Deserializer::DeserializeUint(string(key.data() + 1, 8), 8,
+                                         &number));
+  return number;
+}
+
+string EncodeEntry(bool logged, uint64_t number, const string &leaf_hash,
+                   const string &data) {
+  CHECK_LT(leaf_hash.size(), 256U);
+  string value(1, logged ? kLoggedState : kPendingState);
+  value.append(Serializer::SerializeUint(number, 8));
+  value.push_back(static_cast<char>(leaf_hash.size()));
+  value.append(leaf_hash);
+  value.append(data);
+  return value;
+}
+
+void DecodeEntry(const string &value, EntryValue *entry) {
+  CHECK_GE(value.size(), 10U);
+  CHECK(value[0] == kPendingState || value[0] == kLoggedState);
+  entry->logged = value[0] == kLoggedState;
+  CHECK_EQ(Deserializer::OK,
+           Deserializer::DeserializeUint(value.substr(1, 8), 8,
+                                         &entry->number));
+  size_t leaf_hash_length = static_cast<unsigned char>(value[9]);
+  CHECK_GE(value.size(), 10 + leaf_hash_length);
+  entry->leaf_hash = value.substr(10, leaf_hash_length);
+  entry->data = value.substr(10 + leaf_hash_length);
+}
+
+// Sequence values are the hash length (1 byte), the hash and the leaf hash.
+string EncodeSequence(const string &hash, const string &leaf_hash) {
+  CHECK_LT(hash.size(), 256U);
+  string value(1, static_cast<char>(hash.size()));
+  value.append(hash);
+  value.append(leaf_hash);
+  return value;
+}
+
+void DecodeSequence(const leveldb::Slice &value, string *hash,
+                    string *leaf_hash) {
+  CHECK_GE(value.size(), 1U);
+  size_t hash_length = static_cast<unsigned char>(value[0]);
+  CHECK_GE(value.size(), 1 + hash_length);
+  hash->assign(value.data() + 1, hash_length);
+  if (leaf_hash != NULL)
+    leaf_hash->assign(value.data() + 1 + hash_length,
+                      value.size() - 1 - hash_length);
+}
+
+string TreeSizeKey(uint64_t tree_size, uint64_t timestamp) {
+  return NumberKey(kTreeSizePrefix, tree_size) +
+      Serializer::SerializeUint(timestamp, 8);
+}
+
+// Position |it| on the last key before |limit|, and return whether it
+// starts with |prefix|.
+bool SeekToLastBefore(leveldb::Iterator *it, const string &limit,
+                      char prefix) {
+  it->Seek(limit);
+  if (it->Valid())
+    it->Prev();
+  else
+    it->SeekToLast();
+  return it->Valid() && it->key().size() > 0 && it->key()[0] == prefix;
+}
+
+// Position |it| on the last key that starts with |prefix|, if any.
+bool SeekToLastWithPrefix(leveldb::Iterator *it, char prefix) {
+  return SeekToLastBefore(it, string(1, prefix + 1), prefix);
+}
+
+leveldb::WriteOptions SyncWrite() {
+  leveldb::WriteOptions options;
+  options.sync = true;
+  return options;
+}
+
+void Write(leveldb::DB *db, leveldb::WriteBatch *batch) {
+  leveldb::Status status = db->Write(SyncWrite(), batch);
+  CHECK(status.ok()) << status.ToString();
+}
+
+}  // namespace
+
+template <class Logged> LevelDB<Logged>::LevelDB(const string &dbdir)
+    : db_(NULL),
+      // Most reads are point lookups by random hash.
+      filter_policy_(leveldb::NewBloomFilterPolicy(10)),
+      next_pending_(0) {
+  leveldb::Options options;
+  options.create_if_missing = true;
+  options.filter_policy = filter_policy_;
+  leveldb::Status status = leveldb::DB::Open(options, dbdir, &db_);
+  CHECK(status.ok()) << "Could not open " << dbdir << ": "
+                     << status.ToString();
+
+  // Queue new entries behind the pending ones.
+  leveldb::Iterator *it = db_->NewIterator(leveldb::ReadOptions());
+  if (SeekToLastWithPrefix(it, kPendingPrefix))
+    next_pending_ = KeyNumber(it->key()) + 1;
+  CHECK(it->status().ok()) << it->status().ToString();
+  delete it;
+  IndexTreeSizes();
+}
+
+template <class Logged> void LevelDB<Logged>::IndexTreeSizes() {
+  leveldb::Iterator *it = db_->NewIterator(leveldb::ReadOptions());
+  const bool indexed = SeekToLastWithPrefix(it, kTreeSizePrefix);
+  leveldb::WriteBatch batch;
+  size_t count = 0;
+  if (!indexed) {
+    for (it->Seek(string(1, kTreeHeadPrefix));
+         it->Valid() && it->key()[0] == kTreeHeadPrefix; it->Next()) {
+      ct::SignedTreeHead sth;
+      CHECK(sth.ParseFromString(it->value().ToString()));
+      batch.Put(TreeSizeKey(sth.tree_size(), sth.timestamp()),
+                leveldb::Slice());
+      ++count;
+    }
+  }
+  CHECK(it->status().ok()) << it->status().ToString();
+  delete it;
+  if (count == 0)
+    return;
+  Write(db_, &batch);
+  LOG(INFO) << "Indexed " << count << " tree heads by size";
+}
+
+template <class Logged> LevelDB<Logged>::~LevelDB() {
+  delete db_;
+  delete filter_policy_;
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+LevelDB<Logged>::CreatePendingEntry_(const Logged &logged) {
+  const string hash = logged.Hash();
+  if (Read(EntryKey(hash), NULL) == this->LOOKUP_OK)
+    return this->DUPLICATE_CERTIFICATE_HASH;
+
+  string data;
+  CHECK(logged.SerializeForDatabase(&data));
+  this->CompressEntry(&data);
+  // As in SQLiteDB, hash the leaf now while we have the entry at hand.
+  leveldb::WriteBatch batch;
+  batch.Put(EntryKey(hash),
+            EncodeEntry(false, next_pending_, this->LeafHash(logged), data));
+  batch.Put(PendingKey(next_pending_, hash), leveldb::Slice());
+  Write(db_, &batch);
+  ++next_pending_;
+  return this->OK;
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+LevelDB<Logged>::AssignSequenceNumber(const string &hash,
+                                      uint64_t sequence_number) {
+  size_t assigned;
+  return AssignSequenceNumbers(std::vector<string>(1, hash),
+                               sequence_number, &assigned);
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+LevelDB<Logged>::AssignSequenceNumbers(const std::vector<string> &hashes,
+                                       uint64_t first_sequence_number,
+                                       size_t *assigned) {
+  CHECK_NOTNULL(assigned);
+  leveldb::WriteBatch batch;
+  // Entries already in |batch|, which the database doesn't see yet. Their
+  // sequence numbers are distinct from the rest of the batch's.
+  std::set<string> batched;
+  WriteResult result = this->OK;
+  for (*assigned = 0; *assigned < hashes.size(); ++*assigned) {
+    const string &hash = hashes[*assigned];
+    const uint64_t sequence_number = first_sequence_number + *assigned;
+    string value;
+    if (Read(EntryKey(hash), &value) == this->NOT_FOUND) {
+      result = this->ENTRY_NOT_FOUND;
+      break;
+    }
+    EntryValue entry;
+    DecodeEntry(value, &entry);
+    if (entry.logged || batched.count(hash) > 0) {
+      result = this->ENTRY_ALREADY_LOGGED;
+      break;
+    }
+    if (Read(NumberKey(kSequencePrefix, sequence_number), NULL) ==
+        this->LOOKUP_OK) {
+      result = this->SEQUENCE_NUMBER_ALREADY_IN_USE;
+      break;
+    }
+
+    batch.Delete(PendingKey(entry.number, hash));
+    batch.Put(EntryKey(hash), EncodeEntry(true, sequence_number,
+                                          entry.leaf_hash, entry.data));
+    batch.Put(NumberKey(kSequencePrefix, sequence_number),
+              EncodeSequence(hash, entry.leaf_hash));
+    batched.insert(hash);
+  }
+  // Entries assigned before a failure are kept, as with one call per entry.
+  if (*assigned > 0)
+    Write(db_, &batch);
+  return result;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LevelDB<Logged>::LookupByHash(const string &hash) const {
+  return Read(EntryKey(hash), NULL);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LevelDB<Logged>::LookupByHash(const string &hash, Logged *result) const {
+  CHECK_NOTNULL(result);
+  string value;
+  if (Read(EntryKey(hash), &value) == this->NOT_FOUND)
+    return this->NOT_FOUND;
+
+  EntryValue entry;
+  DecodeEntry(value, &entry);
+  CHECK(this->DecompressEntry(&entry.data));
+  CHECK(result->ParseFromDatabase(entry.data));
+  if (entry.logged)
+    result->set_sequence_number(entry.number);
+  else
+    result->clear_sequence_number();
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LevelDB<Logged>::LookupByIndex(uint64_t sequence_number,
+                               Logged *result) const {
+  CHECK_NOTNULL(result);
+  string value;
+  if (Read(NumberKey(kSequencePrefix, sequence_number), &value) ==
+      this->NOT_FOUND)
+    return this->NOT_FOUND;
+
+  string hash;
+  DecodeSequence(value, &hash, NULL);
+  ReadEntry(hash, result);
+  CHECK_EQ(sequence_number, result->sequence_number());
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LevelDB<Logged>::LookupByIndexRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::EntryCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  if (start >= end)
+    return this->LOOKUP_OK;
+
+  const string end_key = NumberKey(kSequencePrefix, end);
+  leveldb::Iterator *it = db_->NewIterator(leveldb::ReadOptions());
+  uint64_t next = start;
+  bool stopped = false;
+  for (it->Seek(NumberKey(kSequencePrefix, start));
+       it->Valid() && it->key().compare(end_key) < 0; it->Next()) {
+    // Sequence numbers are unique, so a gap shows up as a skipped one.
+    if (KeyNumber(it->key()) != next)
+      break;
+    string hash;
+    DecodeSequence(it->value(), &hash, NULL);
+    Logged logged;
+    ReadEntry(hash, &logged);
+    ++next;
+    if (!callback->Entry(logged)) {
+      stopped = true;
+      break;
+    }
+  }
+  CHECK(it->status().ok()) << it->status().ToString();
+  delete it;
+  return stopped || next == end ? this->LOOKUP_OK : this->NOT_FOUND;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LevelDB<Logged>::LookupLeafHashRange(uint64_t start, uint64_t end,
+                                     std::vector<string> *hashes) const {
+  CHECK_NOTNULL(hashes);
+  if (start >= end)
+    return this->LOOKUP_OK;
+
+  // The leaf hashes are in the sequence index, so no entry is read.
+  const string end_key = NumberKey(kSequencePrefix, end);
+  leveldb::Iterator *it = db_->NewIterator(leveldb::ReadOptions());
+  std::vector<string> range;
+  for (it->Seek(NumberKey(kSequencePrefix, start));
+       it->Valid() && it->key().compare(end_key) < 0; it->Next()) {
+    if (KeyNumber(it->key()) != start + range.size())
+      break;
+    string hash;
+    range.push_back(string());
+    DecodeSequence(it->value(), &hash, &range.back());
+  }
+  CHECK(it->status().ok()) << it->status().ToString();
+  delete it;
+  if (range.size() != end - start)
+    return this->NOT_FOUND;
+
+  hashes->insert(hashes->end(), range.begin(), range.end());
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LevelDB<Logged>::LookupEntryHashRange(uint64_t start, uint64_t end,
+                                      std::vector<string> *hashes) const {
+  CHECK_NOTNULL(hashes);
+  if (start >= end)
+    return this->LOOKUP_OK;
+
+  // So are the entry hashes.
+  leveldb::Iterator *it = db_->NewIterator(leveldb::ReadOptions());
+  uint64_t next = start;
+  for (it->Seek(NumberKey(kSequencePrefix, start));
+       next < end && it->Valid() && it->key()[0] == kSequencePrefix &&
+           KeyNumber(it->key()) == next;
+       it->Next(), ++next) {
+    string leaf_hash;
+    hashes->push_back(string());
+    DecodeSequence(it->value(), &hashes->back(), &leaf_hash);
+  }
+  CHECK(it->status().ok()) << it->status().ToString();
+  delete it;
+  return next == end ? this->LOOKUP_OK : this->NOT_FOUND;
+}
+
+template <class Logged> std::set<string>
+LevelDB<Logged>::PendingHashes() const {
+  std::set<string> hashes;
+  leveldb::Iterator *it = db_->NewIterator(leveldb::ReadOptions());
+  for (it->Seek(string(1, kPendingPrefix));
+       it->Valid() && it->key()[0] == kPendingPrefix; it->Next())
+    hashes.insert(string(it->key().data() + kNumberKeyLength,
+                         it->key().size() - kNumberKeyLength));
+  CHECK(it->status().ok()) << it->status().ToString();
+  delete it;
+  return hashes;
+}
+
+template <class Logged> void
+LevelDB<Logged>::LookupPendingEntries(
+    size_t limit, typename Database<Logged>::EntryCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  leveldb::Iterator *it = db_->NewIterator(leveldb::ReadOptions());
+  size_t count = 0;
+  for (it->Seek(string(1, kPendingPrefix));
+       it->Valid() && it->key()[0] == kPendingPrefix &&
+           (limit == 0 || count < limit);
+       it->Next(), ++count) {
+    Logged logged;
+    ReadEntry(string(it->key().data() + kNumberKeyLength,
+                     it->key().size() - kNumberKeyLength), &logged);
+    CHECK(!logged.has_sequence_number());
+    if (!callback->Entry(logged))
+      break;
+  }
+  CHECK(it->status().ok()) << it->status().ToString();
+  delete it;
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+LevelDB<Logged>::WriteTreeHead_(const ct::SignedTreeHead &sth) {
+  const string key = NumberKey(kTreeHeadPrefix, sth.timestamp());
+  if (Read(key, NULL) == this->LOOKUP_OK)
+    return this->DUPLICATE_TREE_HEAD_TIMESTAMP;
+
+  string sth_data;
+  CHECK(sth.SerializeToString(&sth_data));
+  leveldb::WriteBatch batch;
+  batch.Put(key, sth_data);
+  batch.Put(TreeSizeKey(sth.tree_size(), sth.timestamp()), leveldb::Slice());
+  Write(db_, &batch);
+  return this->OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LevelDB<Logged>::LatestTreeHead(ct::SignedTreeHead *result) const {
+  leveldb::Iterator *it = db_->NewIterator(leveldb::ReadOptions());
+  LookupResult lookup = this->NOT_FOUND;
+  if (SeekToLastWithPrefix(it, kTreeHeadPrefix)) {
+    CHECK(result->ParseFromString(it->value().ToString()));
+    lookup = this->LOOKUP_OK;
+  }
+  CHECK(it->status().ok()) << it->status().ToString();
+  delete it;
+  return lookup;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LevelDB<Logged>::LookupTreeHeadByTimestamp(
+    uint64_t timestamp, ct::SignedTreeHead *result) const {
+  string sth_data;
+  if (Read(NumberKey(kTreeHeadPrefix, timestamp), &sth_data) ==
+      this->NOT_FOUND)
+    return this->NOT_FOUND;
+  CHECK(result->ParseFromString(sth_data));
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LevelDB<Logged>::LookupTreeHeadBySize(
+    uint64_t tree_size, ct::SignedTreeHead *result) const {
+  // The freshest one sorts last among those of the size.
+  const string limit = tree_size < std::numeric_limits<uint64_t>::max()
+      ? NumberKey(kTreeSizePrefix, tree_size + 1)
+      : string(1, kTreeSizePrefix + 1);
+  leveldb::Iterator *it = db_->NewIterator(leveldb::ReadOptions());
+  uint64_t timestamp = 0;
+  bool found = SeekToLastBefore(it, limit, kTreeSizePrefix) &&
+      KeyNumber(it->key()) == tree_size;
+  if (found) {
+    CHECK_EQ(2 * kNumberKeyLength - 1, it->key().size());
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeUint(
+                 string(it->key().data() + kNumberKeyLength, 8), 8,
+                 &timestamp));
+  }
+  CHECK(it->status().ok()) << it->status().ToString();
+  delete it;
+  if (!found)
+    return this->NOT_FOUND;
+  CHECK_EQ(this->LOOKUP_OK, LookupTreeHeadByTimestamp(timestamp, result));
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> void LevelDB<Logged>::LookupTreeHeadRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::TreeHeadCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  leveldb::Iterator *it = db_->NewIterator(leveldb::ReadOptions());
+  for (it->Seek(NumberKey(kTreeHeadPrefix, start));
+       it->Valid() && it->key()[0] == kTreeHeadPrefix &&
+           KeyNumber(it->key()) < end; it->Next()) {
+    ct::SignedTreeHead sth;
+    CHECK(sth.ParseFromString(it->value().ToString()));
+    if (!callback->TreeHead(sth))
+      break;
+  }
+  CHECK(it->status().ok()) << it->status().ToString();
+  delete it;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LevelDB<Logged>::Read(const string &key, string *value) const {
+  string local_value;
+  leveldb::Status status =
+      db_->Get(leveldb::ReadOptions(), key,
+               value != NULL ? value : &local_value);
+  if (status.IsNotFound())
+    return this->NOT_FOUND;
+  CHECK(status.ok()) << status.ToString();
+  return this->LOOKUP_OK;
+}
+
+template <class Logged>
+void LevelDB<Logged>::ReadEntry(const string &hash, Logged *result) const {
+  string value;
+  CHECK_EQ(this->LOOKUP_OK, Read(EntryKey(hash), &value));
+  EntryValue entry;
+  DecodeEntry(value, &entry);
+  CHECK(this->DecompressEntry(&entry.data));
+  CHECK(result->ParseFromDatabase(entry.data));
+  CHECK_EQ(result->Hash(), hash);
+  if (entry.logged)
+    result->set_sequence_number(entry.number);
+  else
+    result->clear_sequence_number();
+}
@@ -0,0 +1,106 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+
+#ifndef LEVELDB_DB_H
+#define LEVELDB_DB_H
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/database.h"
+
+namespace leveldb {
+class DB;
+class FilterPolicy;
+}  // namespace leveldb
+
+// Database on a LevelDB store, for logs that outgrow SQLite's single writer
+// and FileDB's file per entry. LevelDB has no column families, so each kind
+// of record gets a key prefix instead:
+//
+//   e<hash>              - the entry, its leaf hash and its sequence number
+//                          (or, while pending, its position in the queue);
+//   p<position><hash>    - pending entries, in creation order;
+//   s<sequence number>   - the hash and leaf hash of the logged entry;
+//   t<timestamp>         - tree heads;
+//   z<tree size><timestamp> - an index of the tree heads by size.
+//
+// Numbers in keys are 8-byte big-endian, so that they sort numerically.
+// Every write is a single synced write batch.
+template <class Logged> class LevelDB : public Database<Logged> {
+ public:
+  // Opens the database in the directory |dbdir|, creating it if needed.
+  // A LevelDB database can only be open once at a time.
+  explicit LevelDB(const std::string &dbdir);
+
+  ~LevelDB();
+
+  typedef typename Database<Logged>::WriteResult WriteResult;
+  typedef typename Database<Logged>::LookupResult LookupResult;
+
+  virtual WriteResult CreatePendingEntry_(const Logged &logged);
+
+  virtual WriteResult AssignSequenceNumber(const std::string &pending_hash,
+                                           uint64_t sequence_number);
+
+  // Writes the entries that get their sequence number in one batch.
+  virtual WriteResult AssignSequenceNumbers(
+      const std::vector<std::string> &pending_hashes,
+      uint64_t first_sequence_number, size_t *assigned);
+
+  virtual LookupResult LookupByHash(const std::string &hash) const;
+
+  virtual LookupResult LookupByHash(const std::string &hash,
+                                    Logged *result) const;
+
+  virtual LookupResult LookupByIndex(uint64_t sequence_number,
+                                     Logged *result) const;
+
+  virtual LookupResult LookupByIndexRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual LookupResult LookupLeafHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual LookupResult LookupEntryHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual std::set<std::string> PendingHashes() const;
+
+  // Returns entries in creation order.
+  virtual void LookupPendingEntries(
+      size_t limit, typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual WriteResult WriteTreeHead_(const ct::SignedTreeHead &sth);
+
+  virtual LookupResult LatestTreeHead(ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadBySize(
+      uint64_t tree_size, ct::SignedTreeHead *result) const;
+
+  virtual void LookupTreeHeadRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::TreeHeadCallback *callback) const;
+
+ private:
+  // Read the value of |key| into |value|, which may be NULL.
+  LookupResult Read(const std::string &key, std::string *value) const;
+
+  // Read the entry with |hash|, which must exist, into |result|.
+  void ReadEntry(const std::string &hash, Logged *result) const;
+
+  // Databases from before tree heads were indexed by size lack the index;
+  // build it.
+  void IndexTreeSizes();
+
+  leveldb::DB *db_;
+  const leveldb::FilterPolicy *filter_policy_;
+  // Queue position for the next pending entry.
+  uint64_t next_pending_;
+};
+
+#endif
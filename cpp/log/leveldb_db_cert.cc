@@ -0,0 +1,6 @@
+#include "leveldb_db.cc"
+
+#include "log/logged_certificate.h"
+#include "proto/ct.pb.h"
+
+template class LevelDB<ct::LoggedCertificate>;
@@ -0,0 +1,220 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/locking_db.h"
+
+#include <glog/logging.h>
+#include <pthread.h>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "proto/ct.pb.h"
+#include "util/metrics.h"
+
+using std::string;
+
+namespace {
+
+const char kOperationSeconds[] = "ct_database_operation_seconds";
+
+}  // namespace
+
+// Times the call too, lock included. Lookups that the wrapped database
+// can run concurrently only get timed.
+template <class Logged> class LockingDatabase<Logged>::Lock {
+ public:
+  Lock(const LockingDatabase<Logged> *db, const char *operation,
+       bool read = false)
+      : timer_(db->metrics_, kOperationSeconds,
+               db->metrics_ == NULL ? string()
+               : string("op=\"") + operation + "\""),
+        mutex_(read && db->concurrent_reads_ ? NULL : &db->mutex_) {
+    if (mutex_ != NULL)
+      CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~Lock() {
+    if (mutex_ != NULL)
+      CHECK_EQ(0, pthread_mutex_unlock(mutex_));
+  }
+
+ private:
+  util::Metrics::Timer timer_;
+  pthread_mutex_t *mutex_;
+};
+
+template <class Logged>
+LockingDatabase<Logged>::LockingDatabase(Database<Logged> *db)
+    : db_(db),
+      metrics_(NULL) {
+  Init();
+}
+
+template <class Logged>
+LockingDatabase<Logged>::LockingDatabase(Database<Logged> *db,
+                                         util::Metrics *metrics)
+    : db_(db),
+      metrics_(metrics) {
+  CHECK_NOTNULL(metrics);
+  metrics_->DefineHistogram(kOperationSeconds,
+                            "Latency of database operations, in seconds.",
+                            util::Metrics::LatencyBuckets());
+  Init();
+}
+
+template <class Logged> void LockingDatabase<Logged>::Init() {
+  CHECK_NOTNULL(db_);
+  concurrent_reads_ = db_->ConcurrentReads();
+  pthread_mutexattr_t attr;
+  CHECK_EQ(0, pthread_mutexattr_init(&attr));
+  CHECK_EQ(0, pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE));
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, &attr));
+  pthread_mutexattr_destroy(&attr);
+}
+
+template <class Logged> LockingDatabase<Logged>::~LockingDatabase() {
+  pthread_mutex_destroy(&mutex_);
+  delete db_;
+}
+
+template <class Logged> bool LockingDatabase<Logged>::Transactional() const {
+  return db_->Transactional();
+}
+
+template <class Logged>
+void LockingDatabase<Logged>::ExportMemoryUsage(util::Metrics *metrics) const {
+  Hold hold(this);
+  db_->ExportMemoryUsage(metrics);
+}
+
+template <class Logged> void LockingDatabase<Logged>::BeginTransaction() {
+  CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+  db_->BeginTransaction();
+}
+
+template <class Logged> void LockingDatabase<Logged>::EndTransaction() {
+  util::Metrics::Timer timer(
+      metrics_, kOperationSeconds,
+      metrics_ == NULL ? "" : "op=\"end_transaction\"");
+  db_->EndTransaction();
+  CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+LockingDatabase<Logged>::CreatePendingEntry_(const Logged &logged) {
+  Lock lock(this, "create_pending_entry");
+  return db_->CreatePendingEntry(logged);
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+LockingDatabase<Logged>::AssignSequenceNumber(const string &pending_hash,
+                                              uint64_t sequence_number) {
+  Lock lock(this, "assign_sequence_number");
+  return db_->AssignSequenceNumber(pending_hash, sequence_number);
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+LockingDatabase<Logged>::AssignSequenceNumbers(
+    const std::vector<string> &pending_hashes,
+    uint64_t first_sequence_number, size_t *assigned) {
+  Lock lock(this, "assign_sequence_numbers");
+  return db_->AssignSequenceNumbers(pending_hashes, first_sequence_number,
+                                    assigned);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LockingDatabase<Logged>::LookupByHash(const string &hash) const {
+  Lock lock(this, "lookup_by_hash", true);
+  return db_->LookupByHash(hash);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LockingDatabase<Logged>::LookupByHash(const string &hash,
+                                      Logged *result) const {
+  Lock lock(this, "lookup_by_hash", true);
+  return db_->LookupByHash(hash, result);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LockingDatabase<Logged>::LookupByIndex(uint64_t sequence_number,
+                                       Logged *result) const {
+  Lock lock(this, "lookup_by_index", true);
+  return db_->LookupByIndex(sequence_number, result);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LockingDatabase<Logged>::LookupByIndexRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::EntryCallback *callback) const {
+  Lock lock(this, "lookup_by_index_range");
+  return db_->LookupByIndexRange(start, end, callback);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LockingDatabase<Logged>::LookupLeafHashRange(
+    uint64_t start, uint64_t end, std::vector<string> *hashes) const {
+  Lock lock(this, "lookup_leaf_hash_range");
+  return db_->LookupLeafHashRange(start, end, hashes);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LockingDatabase<Logged>::LookupEntryHashRange(
+    uint64_t start, uint64_t end, std::vector<string> *hashes) const {
+  Lock lock(this, "lookup_entry_hash_range");
+  return db_->LookupEntryHashRange(start, end, hashes);
+}
+
+template <class Logged>
+std::set<string> LockingDatabase<Logged>::PendingHashes() const {
+  Lock lock(this, "pending_hashes");
+  return db_->PendingHashes();
+}
+
+template <class Logged> void LockingDatabase<Logged>::LookupPendingEntries(
+    size_t limit, typename Database<Logged>::EntryCallback *callback) const {
+  Lock lock(this, "lookup_pending_entries");
+  db_->LookupPendingEntries(limit, callback);
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+LockingDatabase<Logged>::WriteTreeHead_(const ct::SignedTreeHead &sth) {
+  Lock lock(this, "write_tree_head");
+  return db_->WriteTreeHead(sth);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LockingDatabase<Logged>::LatestTreeHead(ct::SignedTreeHead *result) const {
+  Lock lock(this, "latest_tree_head", true);
+  return db_->LatestTreeHead(result);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LockingDatabase<Logged>::LookupTreeHeadByTimestamp(
+    uint64_t timestamp, ct::SignedTreeHead *result) const {
+  Lock lock(this, "lookup_tree_head_by_timestamp");
+  return db_->LookupTreeHeadByTimestamp(timestamp, result);
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+LockingDatabase<Logged>::LookupTreeHeadBySize(
+    uint64_t tree_size, ct::SignedTreeHead *result) const {
+  Lock lock(this, "lookup_tree_head_by_size");
+  return db_->LookupTreeHeadBySize(tree_size, result);
+}
+
+template <class Logged> void LockingDatabase<Logged>::LookupTreeHeadRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::TreeHeadCallback *callback) const {
+  Lock lock(this, "lookup_tree_head_range");
+  db_->LookupTreeHeadRange(start, end, callback);
+}
+
+template <class Logged>
+LockingDatabase<Logged>::Hold::Hold(const LockingDatabase<Logged> *db)
+    : mutex_(&db->mutex_) {
+  CHECK_EQ(0, pthread_mutex_lock(mutex_));
+}
+
+template <class Logged> LockingDatabase<Logged>::Hold::~Hold() {
+  CHECK_EQ(0, pthread_mutex_unlock(mutex_));
+}
@@ -0,0 +1,125 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+
+#ifndef LOCKING_DB_H
+#define LOCKING_DB_H
+#include <pthread.h>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/database.h"
+
+namespace util {
+class Metrics;
+}  // namespace util
+
+// Wraps another Database, none of which are thread-safe, so that several
+// threads can use it at once: each call holds a lock on the wrapped
+// database for its duration. Calls from the callback of a range lookup
+// may use the database again.
+//
+// A transaction holds the lock from BeginTransaction() to
+// EndTransaction(), which the same thread must call, so that it takes in
+// no other thread's writes and transactions don't nest.
+//
+// If the wrapped database has ConcurrentReads(), those lookups don't take
+// the lock, and so don't wait for writes or transactions.
+//
+// Can also record how long each call takes, waiting for the lock
+// included: as the histogram ct_database_operation_seconds, by operation.
+template <class Logged> class LockingDatabase : public Database<Logged> {
+ public:
+  // Takes ownership of |db|.
+  explicit LockingDatabase(Database<Logged> *db);
+  // Also records call latencies in |metrics|, which must outlive the
+  // database.
+  LockingDatabase(Database<Logged> *db, util::Metrics *metrics);
+
+  ~LockingDatabase();
+
+  typedef typename Database<Logged>::WriteResult WriteResult;
+  typedef typename Database<Logged>::LookupResult LookupResult;
+
+  virtual bool Transactional() const;
+
+  // Holds the lock meanwhile.
+  virtual void ExportMemoryUsage(util::Metrics *metrics) const;
+
+  // Takes the lock until EndTransaction().
+  virtual void BeginTransaction();
+
+  virtual void EndTransaction();
+
+  virtual WriteResult CreatePendingEntry_(const Logged &logged);
+
+  virtual WriteResult AssignSequenceNumber(const std::string &pending_hash,
+                                           uint64_t sequence_number);
+
+  virtual WriteResult AssignSequenceNumbers(
+      const std::vector<std::string> &pending_hashes,
+      uint64_t first_sequence_number, size_t *assigned);
+
+  virtual LookupResult LookupByHash(const std::string &hash) const;
+
+  virtual LookupResult LookupByHash(const std::string &hash,
+                                    Logged *result) const;
+
+  virtual LookupResult LookupByIndex(uint64_t sequence_number,
+                                     Logged *result) const;
+
+  // Holds the lock while passing the entries to |callback|.
+  virtual LookupResult LookupByIndexRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual LookupResult LookupLeafHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual LookupResult LookupEntryHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual std::set<std::string> PendingHashes() const;
+
+  virtual void LookupPendingEntries(
+      size_t limit, typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual WriteResult WriteTreeHead_(const ct::SignedTreeHead &sth);
+
+  virtual LookupResult LatestTreeHead(ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadBySize(
+      uint64_t tree_size, ct::SignedTreeHead *result) const;
+
+  virtual void LookupTreeHeadRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::TreeHeadCallback *callback) const;
+
+  // Holds the lock while it exists, e.g. to read statistics of the
+  // wrapped database.
+  class Hold {
+   public:
+    explicit Hold(const LockingDatabase<Logged> *db);
+    ~Hold();
+
+   private:
+    pthread_mutex_t *mutex_;
+  };
+
+ private:
+  class Lock;
+
+  void Init();
+
+  Database<Logged> *db_;
+  util::Metrics *const metrics_;
+  // Whether |db_| has ConcurrentReads().
+  bool concurrent_reads_;
+  // Recursive, for callbacks that use the database.
+  mutable pthread_mutex_t mutex_;
+};
+
+#endif
@@ -0,0 +1,6 @@
+#include "locking_db.cc"
+
+#include "log/logged_certificate.h"
+#include "proto/ct.pb.h"
+
+template class LockingDatabase<ct::LoggedCertificate>;
@@ -1,153 +1,830 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/log_lookup.h"
 
+#include <algorithm>
 #include <glog/logging.h>
 #include <map>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
 
 #include "log/database.h"
+#include "log/shared_lookup.h"
+#include "merkletree/leaf_hash_file.h"
 #include "merkletree/merkle_tree.h"
 #include "merkletree/serial_hasher.h"
+#include "merkletree/subtree_root_file.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/memory_usage.h"
+#include "util/startup_profiler.h"
+#include "util/trace.h"
 
 using ct::MerkleAuditProof;
 using ct::ShortMerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
 using std::string;
+using util::StartupProfiler;
+using util::Tracer;
+
+namespace {
+
+// Number of previous STHs that we precompute consistency proofs from.
+const size_t kRecentTreeSizes = 8;
+// Maximum number of cached consistency proofs.
+const size_t kMaxConsistencyProofs = 256;
+// Maximum number of new leaves per update that we precompute audit paths
+// for; the latest of them are the most likely to be asked about.
+const size_t kMaxNewLeafPaths = 16384;
+// Leaf hashes per append when a subtree root file catches up with the tree.
+const size_t kSubtreeRootBatch = 1 << 16;
+
+// Tree hashing is split across all cores; small updates stay on the
+// calling thread anyway.
+size_t HashingThreads() {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? cpus : 1;
+}
+
+// The heap bytes of a path or a proof.
+size_t NodeListBytes(const std::vector<string> &nodes) {
+  size_t bytes = util::HeapBytes(nodes);
+  for (size_t i = 0; i < nodes.size(); ++i)
+    bytes += util::HeapBytes(nodes[i]);
+  return bytes;
+}
+
+}  // namespace
+
+// Readers announce themselves in readers_[view] before they look at
+// views_[view], and then check that it is still current. Update() switches
+// current_ before it waits for the readers of the old view to leave, so
+// a reader either sees the switch and moves to the new view, or is seen
+// by Update(). The __sync builtins are full memory barriers.
+template <class Logged> class LogLookup<Logged>::Reader {
+ public:
+  explicit Reader(const LogLookup<Logged> *lookup) : lookup_(lookup) {
+    for (;;) {
+      view_ = lookup_->current_;
+      __sync_fetch_and_add(&lookup_->readers_[view_], 1);
+      if (view_ == lookup_->current_)
+        break;
+      __sync_fetch_and_sub(&lookup_->readers_[view_], 1);
+    }
+  }
+
+  ~Reader() { __sync_fetch_and_sub(&lookup_->readers_[view_], 1); }
+
+  View *view() const { return &lookup_->views_[view_]; }
+
+ private:
+  const LogLookup<Logged> *lookup_;
+  int view_;
+};
+
+// The database calls NewTreeHead() from the writing thread, so the latest
+// tree head is kept under a lock until Update() takes it.
+template <class Logged> class LogLookup<Logged>::TreeHeadListener
+    : public Database<Logged>::TreeHeadObserver {
+ public:
+  TreeHeadListener() : has_sth_(false) {
+    pthread_mutex_init(&lock_, NULL);
+  }
+
+  ~TreeHeadListener() { pthread_mutex_destroy(&lock_); }
+
+  virtual void NewTreeHead(const SignedTreeHead &sth) {
+    pthread_mutex_lock(&lock_);
+    if (!has_sth_ || sth.timestamp() > sth_.timestamp())
+      sth_.CopyFrom(sth);
+    has_sth_ = true;
+    pthread_mutex_unlock(&lock_);
+  }
+
+  // The latest tree head we heard of since the last call, if any.
+  bool Take(SignedTreeHead *sth) {
+    pthread_mutex_lock(&lock_);
+    const bool had_sth = has_sth_;
+    if (had_sth)
+      sth->Swap(&sth_);
+    has_sth_ = false;
+    pthread_mutex_unlock(&lock_);
+    return had_sth;
+  }
+
+ private:
+  pthread_mutex_t lock_;
+  bool has_sth_;
+  SignedTreeHead sth_;
+};
+
+// The signer hands leaf hashes over from its own thread, so they are kept
+// under a lock until Update() takes them. They are only ever a round or two
+// ahead of the tree.
+template <class Logged> class LogLookup<Logged>::LeafHashListener
+    : public LeafHashObserver {
+ public:
+  LeafHashListener() : first_(0) {
+    pthread_mutex_init(&lock_, NULL);
+  }
+
+  ~LeafHashListener() { pthread_mutex_destroy(&lock_); }
+
+  virtual void NewLeafHashes(uint64_t first,
+                             const std::vector<string> &leaf_hashes) {
+    pthread_mutex_lock(&lock_);
+    // Keep one run of them; a new one that doesn't follow on replaces it.
+    if (first != first_ + hashes_.size()) {
+      hashes_.clear();
+      first_ = first;
+    }
+    hashes_.insert(hashes_.end(), leaf_hashes.begin(), leaf_hashes.end());
+    pthread_mutex_unlock(&lock_);
+  }
+
+  // Append to |leaf_hashes| those we have of leaves |first| to |end| - 1,
+  // from |first| on, and forget them and any before.
+  void Take(uint64_t first, uint64_t end, std::vector<string> *leaf_hashes) {
+    pthread_mutex_lock(&lock_);
+    if (first >= first_) {
+      const size_t skip =
+          std::min<uint64_t>(first - first_, hashes_.size());
+      const size_t count = std::min<uint64_t>(
+          hashes_.size() - skip, end > first ? end - first : 0);
+      leaf_hashes->insert(leaf_hashes->end(), hashes_.begin() + skip,
+                          hashes_.begin() + skip + count);
+      hashes_.erase(hashes_.begin(), hashes_.begin() + skip + count);
+      first_ += skip + count;
+    }
+    pthread_mutex_unlock(&lock_);
+  }
+
+ private:
+  pthread_mutex_t lock_;
+  // The leaf index of the first of |hashes_|.
+  uint64_t first_;
+  std::vector<string> hashes_;
+};
 
 template <class Logged> LogLookup<Logged>::LogLookup(const Database<Logged> *db)
     : db_(db),
-      cert_tree_(new Sha256Hasher()),
-      latest_tree_head_() {
+      current_(0),
+      leaf_hashes_(NULL),
+      publisher_(NULL),
+      listener_(new TreeHeadListener()),
+      leaf_listener_(new LeafHashListener()),
+      max_subtree_leaves_(0),
+      subtrees_(NULL),
+      subtree_roots_(NULL) {
+  readers_[0] = readers_[1] = 0;
+  db_->AddTreeHeadObserver(listener_);
+  StartupProfiler::Phase phase("building lookup tree", "leaves");
+  Update();
+  phase.Add(views_[current_].tree.LeafCount());
+}
+
+template <class Logged>
+LogLookup<Logged>::LogLookup(const Database<Logged> *db,
+                             const string &leaf_hash_file)
+    : db_(db),
+      current_(0),
+      leaf_hashes_(NULL),
+      publisher_(NULL),
+      listener_(new TreeHeadListener()),
+      leaf_listener_(new LeafHashListener()),
+      max_subtree_leaves_(0),
+      subtrees_(NULL),
+      subtree_roots_(NULL) {
+  readers_[0] = readers_[1] = 0;
+  db_->AddTreeHeadObserver(listener_);
+  if (!leaf_hash_file.empty())
+    leaf_hashes_ = new LeafHashFile(leaf_hash_file,
+                                    views_[0].tree.NodeSize());
+  StartupProfiler::Phase phase("building lookup tree", "leaves");
+  Update();
+  phase.Add(views_[current_].tree.LeafCount());
+}
+
+template <class Logged>
+LogLookup<Logged>::LogLookup(const Database<Logged> *db,
+                             const string &leaf_hash_file, Sharing sharing,
+                             const string &shared_file,
+                             size_t max_shared_leaves)
+    : db_(db),
+      current_(0),
+      leaf_hashes_(NULL),
+      publisher_(NULL),
+      shared_file_(sharing == ATTACH ? shared_file : string()),
+      listener_(new TreeHeadListener()),
+      leaf_listener_(new LeafHashListener()),
+      subtree_file_(sharing == SUBTREES ? shared_file : string()),
+      max_subtree_leaves_(max_shared_leaves),
+      subtrees_(NULL),
+      subtree_roots_(NULL) {
+  readers_[0] = readers_[1] = 0;
+  CHECK(!shared_file.empty());
+  db_->AddTreeHeadObserver(listener_);
+  if (sharing == ATTACH) {
+    StartupProfiler::Phase phase("attaching to the shared lookup tree",
+                                 "leaves");
+    Update();
+    phase.Add(views_[current_].sth.tree_size());
+    return;
+  }
+  if (sharing == SUBTREES) {
+    StartupProfiler::Phase phase("opening the subtree root file", "leaves");
+    Update();
+    phase.Add(views_[current_].sth.tree_size());
+    return;
+  }
+  if (!leaf_hash_file.empty())
+    leaf_hashes_ = new LeafHashFile(leaf_hash_file,
+                                    views_[0].tree.NodeSize());
+  publisher_ = new SharedLookupWriter(shared_file, max_shared_leaves);
+  StartupProfiler::Phase phase("building lookup tree", "leaves");
   Update();
+  phase.Add(views_[current_].tree.LeafCount());
 }
 
-template <class Logged> LogLookup<Logged>::~LogLookup() {}
+template <class Logged> LogLookup<Logged>::~LogLookup() {
+  db_->RemoveTreeHeadObserver(listener_);
+  delete listener_;
+  delete leaf_listener_;
+  delete leaf_hashes_;
+  delete publisher_;
+  delete subtree_roots_;
+  delete subtrees_;
+  // Both views have the same one.
+  delete views_[0].shared;
+}
+
+template <class Logged>
+void LogLookup<Logged>::WriteSubtreeRoots(const string &path) {
+  CHECK(shared_file_.empty() && subtree_file_.empty())
+      << "Only a lookup with a tree of its own can write subtree roots";
+  CHECK(subtree_roots_ == NULL);
+  subtree_roots_ = new SubtreeRootFile(path);
+
+  // Update() is the only writer of the current view, and we run on its
+  // thread.
+  View *view = &views_[current_];
+  const uint64_t size = view->tree.LeafCount();
+  // Keep what the tree vouches for, as with the leaf hash file.
+  if (subtree_roots_->LeafCount() > size)
+    subtree_roots_->Truncate(size);
+  const uint64_t kept = subtree_roots_->LeafCount();
+  if (view->tree.RootAtSnapshot(kept) != subtree_roots_->CurrentRoot()) {
+    LOG(WARNING) << path << " does not match the tree; rewriting it";
+    subtree_roots_->Truncate(0);
+  }
+
+  StartupProfiler::Phase phase("writing subtree roots", "leaves");
+  phase.SetTotal(size - subtree_roots_->LeafCount());
+  std::vector<string> leaf_hashes;
+  while (subtree_roots_->LeafCount() < size) {
+    const uint64_t begin = subtree_roots_->LeafCount();
+    const uint64_t end = std::min<uint64_t>(size, begin + kSubtreeRootBatch);
+    leaf_hashes.clear();
+    for (uint64_t leaf = begin; leaf < end; ++leaf)
+      leaf_hashes.push_back(view->tree.LeafHash(leaf + 1));
+    subtree_roots_->Append(leaf_hashes.begin(), leaf_hashes.end());
+    phase.Add(end - begin);
+  }
+  CHECK_EQ(view->tree.CurrentRoot(), subtree_roots_->CurrentRoot());
+}
+
+template <class Logged>
+LeafHashObserver *LogLookup<Logged>::leaf_hash_observer() const {
+  return leaf_listener_;
+}
 
 template <class Logged> typename LogLookup<Logged>::UpdateResult
 LogLookup<Logged>::Update() {
+  Tracer::Span span("log_lookup.update");
+  if (!shared_file_.empty())
+    return UpdateAttached();
   SignedTreeHead sth;
-
-  typename Database<Logged>::LookupResult db_result = db_->LatestTreeHead(&sth);
-  if (db_result == Database<Logged>::NOT_FOUND)
-    return NO_UPDATES_FOUND;
-
-  CHECK(db_result == Database<Logged>::LOOKUP_OK);
+  const bool notified = listener_->Take(&sth);
+  if (!notified) {
+    typename Database<Logged>::LookupResult db_result =
+        db_->LatestTreeHead(&sth);
+    if (db_result == Database<Logged>::NOT_FOUND)
+      return NO_UPDATES_FOUND;
+    CHECK(db_result == Database<Logged>::LOOKUP_OK);
+  }
   CHECK_EQ(ct::V1, sth.version())
       << "Tree head signed with an unknown version";
 
-  if (sth.timestamp() == latest_tree_head_.timestamp())
+  // Nobody reads the spare view, and the current one only changes here.
+  const int current = current_;
+  View *spare = &views_[1 - current];
+  const SignedTreeHead &latest_tree_head = views_[current].sth;
+  // We may have asked the database for a newer one in the meantime.
+  if (sth.timestamp() == latest_tree_head.timestamp() ||
+      (notified && sth.timestamp() < latest_tree_head.timestamp()))
     return NO_UPDATES_FOUND;
 
-  CHECK(sth.timestamp() > latest_tree_head_.timestamp() &&
-        sth.tree_size() >= cert_tree_.LeafCount())
+  CHECK(sth.timestamp() > latest_tree_head.timestamp() &&
+        sth.tree_size() >= views_[current].tree.LeafCount())
       << "Database replied with an STH that is older than ours: "
-      << "Our STH:\n" << latest_tree_head_.DebugString()
+      << "Our STH:\n" << latest_tree_head.DebugString()
       << "Database STH:\n" << sth.DebugString();
+  if (!subtree_file_.empty())
+    return UpdateFromSubtrees(sth);
+
+  const uint64_t old_size = views_[current].tree.LeafCount();
+  CHECK_EQ(old_size, spare->tree.LeafCount());
+  std::vector<string> leaf_hashes;
+  // On startup, take as many leaf hashes as we can from the leaf hash file.
+  // Anything it holds is checked against the STH root along with the rest.
+  size_t cached = 0;
+  if (leaf_hashes_ != NULL && old_size == 0) {
+    cached = std::min<uint64_t>(leaf_hashes_->LeafCount(), sth.tree_size());
+    leaf_hashes_->ReadLeafHashes(cached, &leaf_hashes);
+    LOG(INFO) << "Loaded " << cached << " leaf hashes from cache";
+  }
+
+  // Then those that a signer handed over, which the root check vouches for
+  // just the same.
+  leaf_listener_->Take(old_size + leaf_hashes.size(), sth.tree_size(),
+                       &leaf_hashes);
 
   // Record the new hashes: append all of them, die on any error.
-  // TODO(ekasper): make tree signer write leaves out to the database,
-  // so that we don't have to read the entries in.
-  string leaf_hash;
-  for (uint64_t sequence_number = cert_tree_.LeafCount();
-       sequence_number < sth.tree_size(); ++sequence_number) {
-    Logged logged;
-    // TODO(ekasper): perhaps some of these errors can/should be
-    // handled more gracefully. E.g. we could retry a failed update
-    // a number of times -- but until we know under which conditions
-    // the database might fail (database busy?), just die.
+  // TODO(ekasper): perhaps some of these errors can/should be
+  // handled more gracefully. E.g. we could retry a failed update
+  // a number of times -- but until we know under which conditions
+  // the database might fail (database busy?), just die.
+  const uint64_t first_from_db = old_size + leaf_hashes.size();
+  if (first_from_db < sth.tree_size())
     CHECK_EQ(Database<Logged>::LOOKUP_OK,
-             db_->LookupByIndex(sequence_number, &logged))
-        << "Latest STH has " << sth.tree_size() << "entries but we failed to "
-        << "retrieve entry number " << sequence_number;
-    CHECK(logged.has_sequence_number())
-        << "Logged entry has no sequence number";
-    CHECK_EQ(sequence_number, logged.sequence_number());
-
-    leaf_hash = LeafHash(logged);
-    // TODO(ekasper): plug in the log public key so that we can verify the STH.
-    CHECK_EQ(sequence_number + 1, cert_tree_.AddLeafHash(leaf_hash));
-    // Duplicate leaves shouldn't really happen but are not a problem either:
-    // we just return the Merkle proof of the first occurrence.
-    leaf_index_.insert(std::pair<string, uint64_t>(leaf_hash,
-                                                   sequence_number));
-  }
-  CHECK_EQ(cert_tree_.CurrentRoot(), sth.sha256_root_hash())
+             db_->LookupLeafHashRange(first_from_db, sth.tree_size(),
+                                      &leaf_hashes))
+        << "Latest STH has " << sth.tree_size() << " entries but we failed "
+        << "to retrieve the leaf hashes of entries " << first_from_db
+        << " to " << sth.tree_size() - 1;
+
+  // Monitors mostly ask for consistency with the STHs just before this one.
+  if (recent_tree_sizes_.empty() ||
+      recent_tree_sizes_.back() != sth.tree_size())
+    recent_tree_sizes_.push_back(sth.tree_size());
+  if (recent_tree_sizes_.size() > kRecentTreeSizes + 1)
+    recent_tree_sizes_.erase(recent_tree_sizes_.begin());
+
+  UpdateView(leaf_hashes, sth, spare);
+  // The leaf hash file is only a cache: if it is stale or corrupt, start
+  // over from the database.
+  if (cached > 0 && spare->tree.CurrentRoot() != sth.sha256_root_hash()) {
+    LOG(WARNING) << "The leaf hash file doesn't match the tree head; "
+                 << "rebuilding the tree from the database";
+    spare->tree.Clear();
+    spare->leaf_index.Clear();
+    spare->consistency_proofs.clear();
+    leaf_hashes_->Truncate(0);
+    leaf_hashes.clear();
+    CHECK_EQ(Database<Logged>::LOOKUP_OK,
+             db_->LookupLeafHashRange(0, sth.tree_size(), &leaf_hashes))
+        << "Latest STH has " << sth.tree_size() << " entries but we failed "
+        << "to retrieve their leaf hashes";
+    UpdateView(leaf_hashes, sth, spare);
+  }
+  CHECK_EQ(spare->tree.CurrentRoot(), sth.sha256_root_hash())
       << "Computed root hash and stored STH root hash do not match";
-  LOG(INFO) << "Found " << sth.tree_size() - latest_tree_head_.tree_size()
-            << " new log entries";
-  latest_tree_head_.CopyFrom(sth);
+
+  // Publish the spare view, and catch up the old one once its readers are
+  // gone.
+  __sync_synchronize();
+  current_ = 1 - current;
+  __sync_synchronize();
+  while (__sync_fetch_and_add(&readers_[current], 0) != 0)
+    usleep(100);
+  UpdateView(leaf_hashes, sth, &views_[current]);
+
+  if (leaf_hashes_ != NULL) {
+    // The file may be ahead of the database, e.g., if the database was
+    // restored from a backup. Only keep what the STH vouches for.
+    if (leaf_hashes_->LeafCount() > sth.tree_size())
+      leaf_hashes_->Truncate(sth.tree_size());
+    CHECK_GE(leaf_hashes_->LeafCount(), old_size);
+    leaf_hashes_->Append(
+        leaf_hashes.begin() + (leaf_hashes_->LeafCount() - old_size),
+        leaf_hashes.end());
+  }
+  if (subtree_roots_ != NULL) {
+    if (subtree_roots_->LeafCount() > sth.tree_size())
+      subtree_roots_->Truncate(sth.tree_size());
+    CHECK_GE(subtree_roots_->LeafCount(), old_size);
+    subtree_roots_->Append(
+        leaf_hashes.begin() + (subtree_roots_->LeafCount() - old_size),
+        leaf_hashes.end());
+    CHECK_EQ(subtree_roots_->CurrentRoot(), sth.sha256_root_hash());
+  }
+  // Nobody reads the old view any more, and reading it changes nothing.
+  if (publisher_ != NULL)
+    publisher_->Publish(views_[current].tree, sth);
+  LOG(INFO) << "Found " << sth.tree_size() - old_size << " new log entries";
   return UPDATE_OK;
 }
 
+template <class Logged> typename LogLookup<Logged>::UpdateResult
+LogLookup<Logged>::UpdateAttached() {
+  // Tree heads come from the publisher, which checked them against its
+  // tree; those written through the database are of no use.
+  SignedTreeHead written;
+  listener_->Take(&written);
+
+  const int current = current_;
+  const SignedTreeHead &latest_tree_head = views_[current].sth;
+  SharedLookupReader *old_shared = views_[current].shared;
+  SharedLookupReader *shared = old_shared;
+  SignedTreeHead sth;
+  if (shared != NULL)
+    sth = shared->LatestTreeHead();
+  // A new publisher starts from scratch; stay with the old tree until the
+  // new one has caught up with it.
+  if (shared == NULL || shared->Replaced()) {
+    SharedLookupReader *fresh = SharedLookupReader::Open(shared_file_);
+    SignedTreeHead fresh_sth;
+    if (fresh != NULL)
+      fresh_sth = fresh->LatestTreeHead();
+    if (fresh != NULL &&
+        fresh_sth.tree_size() >= latest_tree_head.tree_size() &&
+        fresh_sth.timestamp() >= latest_tree_head.timestamp()) {
+      shared = fresh;
+      sth.Swap(&fresh_sth);
+    } else {
+      delete fresh;
+    }
+  }
+  if (shared == NULL ||
+      (shared == old_shared &&
+       sth.timestamp() <= latest_tree_head.timestamp()))
+    return NO_UPDATES_FOUND;
+
+  CHECK_EQ(ct::V1, sth.version())
+      << "Tree head signed with an unknown version";
+  CHECK_EQ(shared->RootAtSnapshot(sth.tree_size()), sth.sha256_root_hash())
+      << "Shared tree and its tree head do not match";
+
+  const uint64_t old_size = latest_tree_head.tree_size();
+  View *spare = &views_[1 - current];
+  spare->shared = shared;
+  spare->sth.CopyFrom(sth);
+  __sync_synchronize();
+  current_ = 1 - current;
+  __sync_synchronize();
+  while (__sync_fetch_and_add(&readers_[current], 0) != 0)
+    usleep(100);
+  views_[current].shared = shared;
+  views_[current].sth.CopyFrom(sth);
+  // Neither view has it now.
+  if (old_shared != shared) {
+    LOG(INFO) << "Attached to a new shared lookup tree at " << shared_file_;
+    delete old_shared;
+  }
+  LOG(INFO) << "Found " << sth.tree_size() - old_size << " new log entries";
+  return UPDATE_OK;
+}
+
+template <class Logged> typename LogLookup<Logged>::UpdateResult
+LogLookup<Logged>::UpdateFromSubtrees(const SignedTreeHead &sth) {
+  if (subtrees_ == NULL) {
+    subtrees_ = SubtreeRootReader::Open(subtree_file_, max_subtree_leaves_);
+    if (subtrees_ == NULL) {
+      LOG(WARNING) << "No subtree root file at " << subtree_file_ << " yet";
+      return NO_UPDATES_FOUND;
+    }
+  }
+  // The writer appends once the tree head is out, so it may be behind.
+  if (sth.tree_size() > max_subtree_leaves_) {
+    LOG(ERROR) << "The tree has outgrown the mapping of " << subtree_file_;
+    return NO_UPDATES_FOUND;
+  }
+  if (sth.tree_size() > subtrees_->LeafCount())
+    return NO_UPDATES_FOUND;
+  CHECK_EQ(subtrees_->RootAtSnapshot(sth.tree_size()), sth.sha256_root_hash())
+      << "Subtree root file and tree head do not match";
+
+  const int current = current_;
+  const uint64_t old_size = views_[current].sth.tree_size();
+  View *spare = &views_[1 - current];
+  spare->subtrees = subtrees_;
+  spare->sth.CopyFrom(sth);
+  __sync_synchronize();
+  current_ = 1 - current;
+  __sync_synchronize();
+  while (__sync_fetch_and_add(&readers_[current], 0) != 0)
+    usleep(100);
+  views_[current].subtrees = subtrees_;
+  views_[current].sth.CopyFrom(sth);
+  LOG(INFO) << "Found " << sth.tree_size() - old_size << " new log entries";
+  return UPDATE_OK;
+}
+
+template <class Logged>
+void LogLookup<Logged>::UpdateView(const std::vector<string> &leaf_hashes,
+                                   const SignedTreeHead &sth,
+                                   View *view) const {
+  const uint64_t old_size = view->tree.LeafCount();
+  // TODO(ekasper): plug in the log public key so that we can verify the STH.
+  CHECK_EQ(sth.tree_size(), view->tree.AddLeafHashes(leaf_hashes.begin(),
+                                                     leaf_hashes.end(),
+                                                     HashingThreads()));
+  // Most proof requests are against the latest few STHs.
+  view->tree.CacheSnapshot(sth.tree_size());
+
+  // Submitters ask for the proofs of the new entries as soon as the tree
+  // head is out; compute them all at once. A new tree head of the same
+  // size keeps them.
+  if (sth.tree_size() != old_size) {
+    uint64_t first = old_size;
+    if (sth.tree_size() - first > kMaxNewLeafPaths)
+      first = sth.tree_size() - kMaxNewLeafPaths;
+    std::vector<size_t> leaves;
+    for (uint64_t leaf = first; leaf < sth.tree_size(); ++leaf)
+      leaves.push_back(leaf + 1);
+    view->first_new_leaf = first;
+    view->new_leaf_paths =
+        view->tree.PathsToRootAtSnapshot(leaves, sth.tree_size());
+  }
+
+  // Duplicate leaves shouldn't really happen but are not a problem either:
+  // we just return the Merkle proof of the first occurrence.
+  view->leaf_index.Update();
+  view->sth.CopyFrom(sth);
+
+  // The last of the recent tree sizes is this one.
+  for (size_t i = 0; i + 1 < recent_tree_sizes_.size(); ++i) {
+    std::pair<size_t, size_t> key(sth.tree_size(), recent_tree_sizes_[i]);
+    if (view->consistency_proofs.count(key) > 0)
+      continue;
+    std::vector<string> proof =
+        view->tree.SnapshotConsistency(recent_tree_sizes_[i],
+                                       sth.tree_size());
+    if (proof.empty())
+      continue;
+    view->consistency_proofs[key] = proof;
+    if (view->consistency_proofs.size() > kMaxConsistencyProofs)
+      view->consistency_proofs.erase(view->consistency_proofs.begin());
+  }
+}
+
+// static
+template <class Logged> const std::vector<string> *
+LogLookup<Logged>::NewLeafPath(const View *view, uint64_t leaf_index,
+                               size_t tree_size) {
+  if (tree_size != view->sth.tree_size() ||
+      leaf_index < view->first_new_leaf ||
+      leaf_index - view->first_new_leaf >= view->new_leaf_paths.size())
+    return NULL;
+  return &view->new_leaf_paths[leaf_index - view->first_new_leaf];
+}
+
+// static
+template <class Logged>
+bool LogLookup<Logged>::FindLeaf(const View *view,
+                                 const string &merkle_leaf_hash,
+                                 uint64_t *leaf_index) {
+  if (view->shared != NULL)
+    return view->shared->Find(merkle_leaf_hash, view->sth.tree_size(),
+                              leaf_index);
+  if (view->subtrees != NULL)
+    return false;
+  return view->leaf_index.Find(merkle_leaf_hash, leaf_index);
+}
+
+// static
+template <class Logged> std::vector<string>
+LogLookup<Logged>::AuditPath(View *view, uint64_t leaf_index,
+                             size_t tree_size) {
+  const std::vector<string> *new_leaf_path =
+      NewLeafPath(view, leaf_index, tree_size);
+  if (new_leaf_path != NULL)
+    return *new_leaf_path;
+  if (view->shared == NULL && view->subtrees == NULL)
+    return view->tree.PathToRootAtSnapshot(leaf_index + 1, tree_size);
+  // The shared tree or the file may be ahead of the view.
+  if (tree_size > view->sth.tree_size())
+    return std::vector<string>();
+  if (view->subtrees != NULL)
+    return view->subtrees->PathToRootAtSnapshot(leaf_index + 1, tree_size);
+  return view->shared->PathToRootAtSnapshot(leaf_index + 1, tree_size);
+}
+
+// static
+template <class Logged> std::vector<std::vector<string> >
+LogLookup<Logged>::AuditPaths(View *view, const std::vector<size_t> &leaves,
+                              size_t tree_size) {
+  if (view->shared == NULL && view->subtrees == NULL)
+    return view->tree.PathsToRootAtSnapshot(leaves, tree_size);
+  std::vector<std::vector<string> > paths(leaves.size());
+  if (tree_size <= view->sth.tree_size())
+    for (size_t i = 0; i < leaves.size(); ++i)
+      paths[i] = view->subtrees != NULL ?
+          view->subtrees->PathToRootAtSnapshot(leaves[i], tree_size) :
+          view->shared->PathToRootAtSnapshot(leaves[i], tree_size);
+  return paths;
+}
+
+template <class Logged> std::vector<string>
+LogLookup<Logged>::ConsistencyProof(size_t first, size_t second) const {
+  Reader reader(this);
+  View *view = reader.view();
+  typename std::map<std::pair<size_t, size_t>,
+                    std::vector<string> >::const_iterator it =
+      view->consistency_proofs.find(std::make_pair(second, first));
+  if (it != view->consistency_proofs.end())
+    return it->second;
+  if (view->shared == NULL && view->subtrees == NULL)
+    return view->tree.SnapshotConsistency(first, second);
+  if (second > view->sth.tree_size())
+    return std::vector<string>();
+  if (view->subtrees != NULL)
+    return view->subtrees->SnapshotConsistency(first, second);
+  return view->shared->SnapshotConsistency(first, second);
+}
+
 template <class Logged> typename LogLookup<Logged>::LookupResult
-LogLookup<Logged>::GetIndex(const string &merkle_leaf_hash, uint64_t *index) {
-  std::map<string, uint64_t>::const_iterator it =
-      leaf_index_.find(merkle_leaf_hash);
-  if (it == leaf_index_.end())
+LogLookup<Logged>::GetIndex(const string &merkle_leaf_hash,
+                            uint64_t *index) const {
+  Reader reader(this);
+  if (!FindLeaf(reader.view(), merkle_leaf_hash, index))
     return NOT_FOUND;
-
-  *index = it->second;
   return OK;
 }
-  
 
 // Look up by SHA256-hash of the certificate.
 template <class Logged> typename LogLookup<Logged>::LookupResult
 LogLookup<Logged>::AuditProof(const string &merkle_leaf_hash,
-                              MerkleAuditProof *proof) {
+                              MerkleAuditProof *proof) const {
+  Reader reader(this);
+  View *view = reader.view();
   uint64_t leaf_index;
-  if (GetIndex(merkle_leaf_hash, &leaf_index) != OK)
+  if (!FindLeaf(view, merkle_leaf_hash, &leaf_index))
     return NOT_FOUND;
 
   proof->set_version(ct::V1);
-  proof->set_tree_size(cert_tree_.LeafCount());
-  proof->set_timestamp(latest_tree_head_.timestamp());
+  proof->set_tree_size(view->sth.tree_size());
+  proof->set_timestamp(view->sth.timestamp());
   proof->set_leaf_index(leaf_index);
 
   proof->clear_path_node();
-  std::vector<string> audit_path =
-      cert_tree_.PathToCurrentRoot(leaf_index + 1);
+  const std::vector<string> audit_path =
+      AuditPath(view, leaf_index, view->sth.tree_size());
   for (size_t i = 0; i < audit_path.size(); ++i)
     proof->add_path_node(audit_path[i]);
 
-  proof->mutable_id()->CopyFrom(latest_tree_head_.id());
-  proof->mutable_tree_head_signature()->CopyFrom(latest_tree_head_.signature());
+  proof->mutable_id()->CopyFrom(view->sth.id());
+  proof->mutable_tree_head_signature()->CopyFrom(view->sth.signature());
   return OK;
 }
 
 template <class Logged> typename LogLookup<Logged>::LookupResult
 LogLookup<Logged>::AuditProof(uint64_t leaf_index, size_t tree_size,
-                              ShortMerkleAuditProof *proof) {
+                              ShortMerkleAuditProof *proof) const {
+  Reader reader(this);
+  View *view = reader.view();
+  if (leaf_index >= tree_size || tree_size > view->sth.tree_size())
+    return NOT_FOUND;
   proof->set_leaf_index(leaf_index);
 
   proof->clear_path_node();
-  std::vector<string> audit_path =
-      cert_tree_.PathToRootAtSnapshot(leaf_index + 1, tree_size);
+  const std::vector<string> audit_path =
+      AuditPath(view, leaf_index, tree_size);
   for (size_t i = 0; i < audit_path.size(); ++i)
     proof->add_path_node(audit_path[i]);
 
   return OK;
 }
-  
+
+template <class Logged> typename LogLookup<Logged>::LookupResult
+LogLookup<Logged>::AuditProof(
+    const std::vector<uint64_t> &leaf_indices, size_t tree_size,
+    std::vector<ShortMerkleAuditProof> *proofs) const {
+  proofs->clear();
+  Reader reader(this);
+  View *view = reader.view();
+  if (tree_size > view->sth.tree_size())
+    return NOT_FOUND;
+  std::vector<size_t> leaves;
+  for (size_t i = 0; i < leaf_indices.size(); ++i) {
+    if (leaf_indices[i] >= tree_size)
+      return NOT_FOUND;
+    leaves.push_back(leaf_indices[i] + 1);
+  }
+  std::vector<std::vector<string> > audit_paths =
+      AuditPaths(view, leaves, tree_size);
+
+  proofs->resize(leaf_indices.size());
+  for (size_t i = 0; i < leaf_indices.size(); ++i) {
+    ShortMerkleAuditProof &proof = (*proofs)[i];
+    proof.set_leaf_index(leaf_indices[i]);
+    for (size_t j = 0; j < audit_paths[i].size(); ++j)
+      proof.add_path_node(audit_paths[i][j]);
+  }
+
+  return OK;
+}
 
 // Look up by SHA256-hash of the certificate and tree size.
 template <class Logged> typename LogLookup<Logged>::LookupResult
 LogLookup<Logged>::AuditProof(const string &merkle_leaf_hash, size_t tree_size,
-                              ShortMerkleAuditProof *proof) {
+                              ShortMerkleAuditProof *proof) const {
+  // Both from the same view, so that the index is in the tree.
+  Reader reader(this);
+  View *view = reader.view();
   uint64_t leaf_index;
-  if (GetIndex(merkle_leaf_hash, &leaf_index) != OK)
+  if (!FindLeaf(view, merkle_leaf_hash, &leaf_index))
     return NOT_FOUND;
 
-  return AuditProof(leaf_index, tree_size, proof);
+  proof->set_leaf_index(leaf_index);
+  proof->clear_path_node();
+  const std::vector<string> audit_path =
+      AuditPath(view, leaf_index, tree_size);
+  for (size_t i = 0; i < audit_path.size(); ++i)
+    proof->add_path_node(audit_path[i]);
+
+  return OK;
+}
+
+template <class Logged> typename LogLookup<Logged>::LookupResult
+LogLookup<Logged>::AuditProof(const std::vector<string> &merkle_leaf_hashes,
+                              size_t tree_size,
+                              std::vector<ShortMerkleAuditProof> *proofs,
+                              std::vector<bool> *found) const {
+  proofs->clear();
+  proofs->resize(merkle_leaf_hashes.size());
+  found->assign(merkle_leaf_hashes.size(), false);
+
+  // All from the same view, as for a single hash.
+  Reader reader(this);
+  View *view = reader.view();
+  std::vector<size_t> leaves;
+  std::vector<size_t> positions;
+  for (size_t i = 0; i < merkle_leaf_hashes.size(); ++i) {
+    uint64_t leaf_index;
+    if (!FindLeaf(view, merkle_leaf_hashes[i], &leaf_index))
+      continue;
+    (*found)[i] = true;
+    (*proofs)[i].set_leaf_index(leaf_index);
+    leaves.push_back(leaf_index + 1);
+    positions.push_back(i);
+  }
+
+  std::vector<std::vector<string> > audit_paths =
+      AuditPaths(view, leaves, tree_size);
+  for (size_t i = 0; i < positions.size(); ++i) {
+    ShortMerkleAuditProof &proof = (*proofs)[positions[i]];
+    for (size_t j = 0; j < audit_paths[i].size(); ++j)
+      proof.add_path_node(audit_paths[i][j]);
+  }
+
+  return positions.size() == merkle_leaf_hashes.size() ? OK : NOT_FOUND;
+}
+
+template <class Logged> SignedTreeHead LogLookup<Logged>::GetSTH() const {
+  Reader reader(this);
+  return reader.view()->sth;
 }
 
 template <class Logged> string
 LogLookup<Logged>::LeafHash(const Logged &logged) const {
   string serialized_leaf;
   CHECK(logged.SerializeForLeaf(&serialized_leaf));
-  return cert_tree_.LeafHash(serialized_leaf);
+  // Hashing a leaf doesn't look at the tree, so any view does.
+  return views_[0].tree.LeafHash(serialized_leaf);
+}
+
+template <class Logged>
+void LogLookup<Logged>::ExportMemoryUsage(util::Metrics *metrics) const {
+  util::MemoryUsage leaves, nodes, index, proofs;
+  {
+    // Update() never changes the current view, and leaves the other one
+    // the same, so the current one is counted twice.
+    Reader reader(this);
+    const View *view = reader.view();
+    view->tree.MemoryUsage(&leaves, &nodes);
+    index = view->leaf_index.MemoryUsage();
+    for (std::map<std::pair<size_t, size_t>,
+                  std::vector<string> >::const_iterator it =
+             view->consistency_proofs.begin();
+         it != view->consistency_proofs.end(); ++it)
+      proofs.Add(util::MemoryUsage(util::kTreeNodeBytes + sizeof(*it) +
+                                   NodeListBytes(it->second), 1));
+    proofs.bytes += util::HeapBytes(view->new_leaf_paths);
+    for (size_t i = 0; i < view->new_leaf_paths.size(); ++i)
+      proofs.Add(util::MemoryUsage(NodeListBytes(view->new_leaf_paths[i]),
+                                   1));
+  }
+  leaves.bytes *= 2;
+  nodes.bytes *= 2;
+  index.bytes *= 2;
+  proofs.bytes *= 2;
+  util::ExportMemoryUsage("merkle_tree_leaves", leaves, metrics);
+  util::ExportMemoryUsage("merkle_tree_nodes", nodes, metrics);
+  util::ExportMemoryUsage("leaf_index", index, metrics);
+  util::ExportMemoryUsage("proof_cache", proofs, metrics);
 }
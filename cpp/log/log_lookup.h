@@ -5,17 +5,70 @@
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "log/leaf_index.h"
+#include "log/tree_signer.h"
 #include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
 #include "proto/ct.pb.h"
 
+class LeafHashFile;
+class SharedLookupReader;
+class SharedLookupWriter;
+class SubtreeRootFile;
+class SubtreeRootReader;
 template <class Logged> class Database;
+namespace util {
+class Metrics;
+}  // namespace util
 
 // Lookups into the database. Read-only, so could also be a mirror.
 // Keeps the entire Merkle Tree in memory to serve audit proofs.
+//
+// Proofs are served from one of two copies ("views") of the tree, so that
+// any number of threads can serve them while one thread runs Update():
+// Update() brings the view that nobody reads up to date, publishes it,
+// waits for the readers of the other one to finish, and then brings that
+// one up to date too. Readers take no locks and never wait for Update().
+//
+// Processes on the same host can share one tree (see shared_lookup.h): one
+// of them publishes its tree, and the others attach to it rather than
+// build their own. Their views then hold the published tree head, and
+// proofs are served from the shared tree.
+//
+// Lookups can also serve from a subtree root file that another lookup of
+// the log keeps up to date (see WriteSubtreeRoots()). They then hold no
+// tree at all, only the tree head, and read the few nodes that each proof
+// needs from the mapped file.
 template <class Logged> class LogLookup {
  public:
   explicit LogLookup(const Database<Logged> *db);
+  // Also keeps a copy of the tree's leaf hashes in the file |leaf_hash_file|,
+  // and restores the tree from it on startup rather than rehashing every
+  // entry. An empty |leaf_hash_file| disables the cache.
+  LogLookup(const Database<Logged> *db, const std::string &leaf_hash_file);
+
+  enum Sharing {
+    // Build the tree as above, and publish it to the shared file, sized
+    // for up to |max_shared_leaves| leaves.
+    PUBLISH,
+    // Attach to the tree that another process publishes to the shared
+    // file, rather than build one: |leaf_hash_file| and
+    // |max_shared_leaves| are unused, and leaf hash observers are ignored.
+    ATTACH,
+    // Serve proofs from the subtree root file |shared_file|, mapped for
+    // trees of up to |max_shared_leaves| leaves, rather than build a tree.
+    // Tree heads come from the database; each is only taken up once the
+    // file has its tree. |leaf_hash_file| is unused, leaf hash observers
+    // are ignored, and as there is no leaf index either, lookups by leaf
+    // hash find nothing.
+    SUBTREES,
+  };
+  LogLookup(const Database<Logged> *db, const std::string &leaf_hash_file,
+            Sharing sharing, const std::string &shared_file,
+            size_t max_shared_leaves);
   ~LogLookup();
 
   enum UpdateResult {
@@ -24,32 +77,64 @@ template <class Logged> class LogLookup {
     NO_UPDATES_FOUND,
   };
 
-  // Pick up latest tree changes from the database.
+  // Pick up latest tree changes from the database. Uses the latest tree
+  // head written through the database since the last update, if any, and
+  // otherwise asks the database for it, as other processes may have
+  // written one. Only one thread may call this at a time, and not while
+  // the tree head is being written.
   UpdateResult Update();
 
+  // Also keep the roots of the complete subtrees of the tree in the file
+  // |path|, for SUBTREES lookups elsewhere to serve from: brings it up to
+  // date with the tree now, and then appends to it with each Update(). Not
+  // for ATTACH or SUBTREES lookups. Call from the thread that calls
+  // Update().
+  void WriteSubtreeRoots(const std::string &path);
+
   enum LookupResult {
     OK,
     NOT_FOUND,
   };
 
-  LookupResult GetIndex(const std::string &merkle_leaf_hash, uint64_t *index);
+  LookupResult GetIndex(const std::string &merkle_leaf_hash,
+                        uint64_t *index) const;
 
   // Look up by hash of the logged item.
   LookupResult AuditProof(const std::string &merkle_leaf_hash,
-                          ct::MerkleAuditProof *proof);
+                          ct::MerkleAuditProof *proof) const;
 
-  // Look up by index of the logged item and tree_size.
+  // Look up by index of the logged item and tree_size. Returns NOT_FOUND
+  // unless index < tree_size, and tree_size is at most that of the latest
+  // tree head.
   LookupResult AuditProof(uint64_t index, size_t tree_size,
-                          ct::ShortMerkleAuditProof *proof);
+                          ct::ShortMerkleAuditProof *proof) const;
+
+  // Look up several logged items by index, against the same tree_size.
+  // Fills in one proof per index, in order. Cheaper than separate lookups:
+  // nodes that the paths share are only computed once. Returns NOT_FOUND,
+  // and no proofs, on the indices and tree_size that the lookup of one
+  // index would.
+  LookupResult AuditProof(const std::vector<uint64_t> &leaf_indices,
+                          size_t tree_size,
+                          std::vector<ct::ShortMerkleAuditProof> *proofs) const;
 
   // Look up by hash of the logged item and tree_size.
   LookupResult AuditProof(const std::string &merkle_leaf_hash,
-                          size_t tree_size, ct::ShortMerkleAuditProof *proof);
+                          size_t tree_size,
+                          ct::ShortMerkleAuditProof *proof) const;
 
-  // Get a consitency proof between two tree heads
-  std::vector<std::string> ConsistencyProof(size_t first, size_t second) {
-    return cert_tree_.SnapshotConsistency(first, second);
-  }
+  // Look up several logged items by hash, against the same tree_size, as
+  // the batch lookup by index does. |found| says which hashes are in the
+  // log; the proofs of the others are left empty. Returns NOT_FOUND if
+  // any hash is missing.
+  LookupResult AuditProof(const std::vector<std::string> &merkle_leaf_hashes,
+                          size_t tree_size,
+                          std::vector<ct::ShortMerkleAuditProof> *proofs,
+                          std::vector<bool> *found) const;
+
+  // Get a consitency proof between two tree heads.
+  // Proofs between the latest few STHs are computed when they come in.
+  std::vector<std::string> ConsistencyProof(size_t first, size_t second) const;
 
   // Get the |index|th log entry.
   LookupResult GetEntry(size_t index, Logged *result) const {
@@ -58,21 +143,114 @@ template <class Logged> class LogLookup {
     return OK;
   }
 
-  const ct::SignedTreeHead &GetSTH() const {
-    return latest_tree_head_;
+  // Pass the entries |start| to |end| - 1 to |callback|, in order. Returns
+  // NOT_FOUND if the log ends before |end|, after passing what it has.
+  LookupResult GetEntries(
+      size_t start, size_t end,
+      typename Database<Logged>::EntryCallback *callback) const {
+    if (db_->LookupByIndexRange(start, end, callback) !=
+        Database<Logged>::LOOKUP_OK)
+      return NOT_FOUND;
+    return OK;
   }
 
+  ct::SignedTreeHead GetSTH() const;
+
+  // Leaf hashes handed to this observer, e.g. by adding it to the
+  // TreeSigner of the same database, are used by Update() rather than read
+  // back from the database. Owned by the lookup.
+  LeafHashObserver *leaf_hash_observer() const;
+
   std::string LeafHash(const Logged &logged) const;
 
+  // Set the memory accounting gauges of the tree, the leaf index and the
+  // cached proofs in |metrics|. Their bytes are those of both views, their
+  // elements those of one. Attached lookups hold none of them.
+  void ExportMemoryUsage(util::Metrics *metrics) const;
+
  private:
-  // We keep a hash -> index mapping in memory so that we can quickly serve
-  // Merkle proofs without having to query the database at all.
-  // Note that 32 bytes is an overkill and we can optimize this to use
-  // a shorter prefix (possibly with a multimap).
-  std::map<std::string, uint64_t> leaf_index_;
+  // Everything that readers look at. Only changed while nobody reads it.
+  struct View {
+    View()
+        : tree(new Sha256Hasher()),
+          leaf_index(&tree),
+          first_new_leaf(0),
+          shared(NULL),
+          subtrees(NULL) {}
+
+    // Fully evaluated after each Update(), so that reading it hashes at
+    // most past snapshots, and doesn't modify it.
+    MerkleTree tree;
+    // We keep a hash -> index mapping in memory so that we can quickly serve
+    // Merkle proofs without having to query the database at all.
+    LeafIndex leaf_index;
+    ct::SignedTreeHead sth;
+    // Consistency proofs keyed by (second, first), so that proofs to the
+    // oldest trees come first and are the first to go.
+    std::map<std::pair<size_t, size_t>, std::vector<std::string> >
+        consistency_proofs;
+    // Audit paths to the root of |sth| of the leaves that it added, from
+    // leaf |first_new_leaf| on, as those get asked for right after it is
+    // published. Replaced once the tree grows.
+    uint64_t first_new_leaf;
+    std::vector<std::vector<std::string> > new_leaf_paths;
+    // When attached, the tree that |sth| is served from; |tree| and
+    // |leaf_index| stay empty.
+    SharedLookupReader *shared;
+    // Likewise when serving from a subtree root file.
+    const SubtreeRootReader *subtrees;
+  };
+
+  // Marks the current view as in use until destroyed.
+  class Reader;
+  // Keeps the tree heads that the database tells us about.
+  class TreeHeadListener;
+  // Keeps the leaf hashes that a signer hands over.
+  class LeafHashListener;
+
+  // Update() when attached.
+  UpdateResult UpdateAttached();
+  // Update() when serving from a subtree root file, to |sth|.
+  UpdateResult UpdateFromSubtrees(const ct::SignedTreeHead &sth);
+  // Bring |view| up to date with |leaf_hashes| and |sth|.
+  void UpdateView(const std::vector<std::string> &leaf_hashes,
+                  const ct::SignedTreeHead &sth, View *view) const;
+  // The precomputed audit path of leaf |leaf_index| to the root of tree
+  // size |tree_size| in |view|, or NULL if there is none.
+  static const std::vector<std::string> *NewLeafPath(const View *view,
+                                                     uint64_t leaf_index,
+                                                     size_t tree_size);
+  // From the tree or the shared tree of |view|, whichever it has.
+  static bool FindLeaf(const View *view, const std::string &merkle_leaf_hash,
+                       uint64_t *leaf_index);
+  static std::vector<std::string> AuditPath(View *view, uint64_t leaf_index,
+                                            size_t tree_size);
+  static std::vector<std::vector<std::string> > AuditPaths(
+      View *view, const std::vector<size_t> &leaves, size_t tree_size);
 
   const Database<Logged> *db_;
-  MerkleTree cert_tree_;
-  ct::SignedTreeHead latest_tree_head_;
+  // Mutable as MerkleTree's read methods aren't const, even though they
+  // don't change a fully evaluated tree.
+  mutable View views_[2];
+  // The view that new readers use.
+  volatile int current_;
+  // Readers in each view.
+  mutable volatile long readers_[2];
+  // Tree sizes of the latest STHs picked up by Update(), oldest first.
+  std::vector<size_t> recent_tree_sizes_;
+  // May be NULL.
+  LeafHashFile *leaf_hashes_;
+  // Only when publishing.
+  SharedLookupWriter *publisher_;
+  // Only when attached.
+  const std::string shared_file_;
+  TreeHeadListener *listener_;
+  LeafHashListener *leaf_listener_;
+  // Only when serving from a subtree root file; opened once it exists.
+  const std::string subtree_file_;
+  const uint64_t max_subtree_leaves_;
+  SubtreeRootReader *subtrees_;
+  // May be NULL; see WriteSubtreeRoots().
+  SubtreeRootFile *subtree_roots_;
 };
 #endif
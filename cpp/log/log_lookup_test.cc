@@ -1,9 +1,13 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include <gtest/gtest.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <string>
+#include <vector>
 
 #include "log/file_db.h"
 #include "log/file_storage.h"
+#include "log/instrumented_db.h"
 #include "log/log_lookup.h"
 #include "log/log_signer.h"
 #include "log/log_verifier.h"
@@ -12,6 +16,7 @@
 #include "log/test_db.h"
 #include "log/test_signer.h"
 #include "log/tree_signer.h"
+#include "merkletree/leaf_hash_file.h"
 #include "merkletree/merkle_verifier.h"
 #include "merkletree/serial_hasher.h"
 #include "util/testing.h"
@@ -58,6 +63,32 @@ template <class T> class LogLookupTest : public ::testing::Test {
 typedef testing::Types<FileDB<LoggedCertificate>,
                        SQLiteDB<LoggedCertificate> > Databases;
 
+// Asks for the audit proof of |hash| until |stop|, and keeps one proof per
+// tree size it sees.
+struct ProofReader {
+  ProofReader(const LL *lookup, const string &hash)
+      : lookup(lookup), hash(hash), stop(false), lookups(0) {}
+
+  static void *Run(void *arg) {
+    ProofReader *reader = static_cast<ProofReader*>(arg);
+    while (!reader->stop) {
+      MerkleAuditProof proof;
+      CHECK_EQ(LL::OK, reader->lookup->AuditProof(reader->hash, &proof));
+      if (reader->proofs.empty() ||
+          reader->proofs.back().tree_size() != proof.tree_size())
+        reader->proofs.push_back(proof);
+      ++reader->lookups;
+    }
+    return NULL;
+  }
+
+  const LL *lookup;
+  const string hash;
+  volatile bool stop;
+  size_t lookups;
+  std::vector<MerkleAuditProof> proofs;
+};
+
 TYPED_TEST_CASE(LogLookupTest, Databases);
 
 TYPED_TEST(LogLookupTest, Lookup) {
@@ -150,6 +181,538 @@ TYPED_TEST(LogLookupTest, VerifyWithPath) {
   }
 }
 
+TYPED_TEST(LogLookupTest, BatchAuditProof) {
+  LoggedCertificate logged_certs[13];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_certs[i]));
+  }
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+
+  LL lookup(this->db());
+  std::vector<uint64_t> indices;
+  indices.push_back(6);
+  indices.push_back(0);
+  indices.push_back(5);
+  indices.push_back(3);
+
+  // Check against single lookups, both for the current and a past tree size.
+  for (size_t tree_size = 7; tree_size <= 13; tree_size += 6) {
+    std::vector<ct::ShortMerkleAuditProof> proofs;
+    EXPECT_EQ(LL::OK, lookup.AuditProof(indices, tree_size, &proofs));
+    ASSERT_EQ(indices.size(), proofs.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+      ct::ShortMerkleAuditProof proof;
+      EXPECT_EQ(LL::OK, lookup.AuditProof(indices[i], tree_size, &proof));
+      EXPECT_EQ(proof.SerializeAsString(), proofs[i].SerializeAsString());
+    }
+  }
+
+  // Neither an index past the tree size, nor a tree past the latest.
+  std::vector<ct::ShortMerkleAuditProof> proofs;
+  ct::ShortMerkleAuditProof proof;
+  indices.push_back(12);
+  EXPECT_EQ(LL::NOT_FOUND, lookup.AuditProof(12, 12, &proof));
+  EXPECT_EQ(LL::NOT_FOUND, lookup.AuditProof(indices, 12, &proofs));
+  EXPECT_TRUE(proofs.empty());
+  EXPECT_EQ(LL::OK, lookup.AuditProof(indices, 13, &proofs));
+  EXPECT_EQ(LL::NOT_FOUND, lookup.AuditProof(0, 14, &proof));
+  EXPECT_EQ(LL::NOT_FOUND, lookup.AuditProof(indices, 14, &proofs));
+  EXPECT_TRUE(proofs.empty());
+}
+
+TYPED_TEST(LogLookupTest, BatchAuditProofByHash) {
+  LoggedCertificate logged_certs[13];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_certs[i]));
+  }
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+
+  LL lookup(this->db());
+  std::vector<string> hashes;
+  hashes.push_back(logged_certs[12].merkle_leaf_hash());
+  hashes.push_back(logged_certs[0].merkle_leaf_hash());
+  hashes.push_back(logged_certs[6].merkle_leaf_hash());
+
+  for (size_t tree_size = 7; tree_size <= 13; tree_size += 6) {
+    std::vector<ct::ShortMerkleAuditProof> proofs;
+    std::vector<bool> found;
+    EXPECT_EQ(LL::OK, lookup.AuditProof(hashes, tree_size, &proofs, &found));
+    ASSERT_EQ(hashes.size(), proofs.size());
+    ASSERT_EQ(hashes.size(), found.size());
+    for (size_t i = 0; i < hashes.size(); ++i) {
+      EXPECT_TRUE(found[i]);
+      ct::ShortMerkleAuditProof proof;
+      EXPECT_EQ(LL::OK, lookup.AuditProof(hashes[i], tree_size, &proof));
+      EXPECT_EQ(proof.SerializeAsString(), proofs[i].SerializeAsString());
+    }
+  }
+
+  // An unknown hash is reported, and does not spoil the others.
+  LoggedCertificate unknown;
+  this->test_signer_.CreateUnique(&unknown);
+  hashes.insert(hashes.begin() + 1, unknown.merkle_leaf_hash());
+  std::vector<ct::ShortMerkleAuditProof> proofs;
+  std::vector<bool> found;
+  EXPECT_EQ(LL::NOT_FOUND, lookup.AuditProof(hashes, 13, &proofs, &found));
+  ASSERT_EQ(hashes.size(), proofs.size());
+  EXPECT_FALSE(found[1]);
+  EXPECT_EQ(0, proofs[1].path_node_size());
+  for (size_t i = 0; i < hashes.size(); ++i) {
+    if (i == 1)
+      continue;
+    EXPECT_TRUE(found[i]);
+    ct::ShortMerkleAuditProof proof;
+    EXPECT_EQ(LL::OK, lookup.AuditProof(hashes[i], 13, &proof));
+    EXPECT_EQ(proof.SerializeAsString(), proofs[i].SerializeAsString());
+  }
+}
+
+TYPED_TEST(LogLookupTest, VerifyBatch) {
+  LoggedCertificate logged_certs[13];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_certs[i]));
+  }
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+
+  LL lookup(this->db());
+  std::vector<string> hashes;
+  std::vector<ct::LogEntry> entries;
+  std::vector<ct::SignedCertificateTimestamp> scts;
+  for (int i = 12; i >= 0; i -= 3) {
+    hashes.push_back(logged_certs[i].merkle_leaf_hash());
+    entries.push_back(logged_certs[i].entry());
+    scts.push_back(logged_certs[i].sct());
+  }
+  const ct::SignedTreeHead sth = lookup.GetSTH();
+  std::vector<ct::ShortMerkleAuditProof> proofs;
+  std::vector<bool> found;
+  EXPECT_EQ(LL::OK, lookup.AuditProof(hashes, sth.tree_size(), &proofs,
+                                      &found));
+
+  std::vector<LogVerifier::VerifyResult> results;
+  this->verifier_->VerifyMerkleAuditProofs(sth, entries, scts, proofs,
+                                           &results);
+  ASSERT_EQ(entries.size(), results.size());
+  for (size_t i = 0; i < results.size(); ++i)
+    EXPECT_EQ(LogVerifier::VERIFY_OK, results[i]) << i;
+
+  // Bad items do not spoil the others.
+  proofs[1].set_path_node(0, proofs[2].path_node(0));
+  scts[2].set_timestamp(sth.timestamp() + 1);
+  proofs[3].set_leaf_index(sth.tree_size());
+  this->verifier_->VerifyMerkleAuditProofs(sth, entries, scts, proofs,
+                                           &results);
+  EXPECT_EQ(LogVerifier::VERIFY_OK, results[0]);
+  EXPECT_EQ(LogVerifier::INVALID_MERKLE_PATH, results[1]);
+  EXPECT_EQ(LogVerifier::INCONSISTENT_TIMESTAMPS, results[2]);
+  EXPECT_EQ(LogVerifier::INVALID_MERKLE_PATH, results[3]);
+  EXPECT_EQ(LogVerifier::VERIFY_OK, results[4]);
+
+  // A tree head that does not verify fails them all.
+  ct::SignedTreeHead bad_sth(sth);
+  bad_sth.set_tree_size(sth.tree_size() - 1);
+  this->verifier_->VerifyMerkleAuditProofs(bad_sth, entries, scts, proofs,
+                                           &results);
+  for (size_t i = 0; i < results.size(); ++i)
+    EXPECT_EQ(LogVerifier::INVALID_SIGNATURE, results[i]) << i;
+}
+
+TYPED_TEST(LogLookupTest, NewLeafProofs) {
+  LoggedCertificate logged_certs[12];
+  LL lookup(this->db());
+  // Two rounds, so that the first round's proofs are no longer the
+  // precomputed ones.
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < 6; ++i) {
+      this->test_signer_.CreateUnique(&logged_certs[6 * round + i]);
+      EXPECT_EQ(DB::OK,
+                this->db()->CreatePendingEntry(logged_certs[6 * round + i]));
+    }
+    EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+    EXPECT_EQ(LL::UPDATE_OK, lookup.Update());
+  }
+
+  // The batch lookup computes every path; single lookups of the new
+  // entries take the precomputed ones.
+  std::vector<string> hashes;
+  for (int i = 0; i < 12; ++i)
+    hashes.push_back(logged_certs[i].merkle_leaf_hash());
+  for (size_t tree_size = 6; tree_size <= 12; tree_size += 6) {
+    std::vector<ct::ShortMerkleAuditProof> proofs;
+    std::vector<bool> found;
+    EXPECT_EQ(LL::OK,
+              lookup.AuditProof(std::vector<string>(hashes.begin(),
+                                                    hashes.begin() +
+                                                    tree_size),
+                                tree_size, &proofs, &found));
+    for (size_t i = 0; i < tree_size; ++i) {
+      ct::ShortMerkleAuditProof proof;
+      EXPECT_EQ(LL::OK, lookup.AuditProof(hashes[i], tree_size, &proof));
+      EXPECT_EQ(proofs[i].SerializeAsString(), proof.SerializeAsString());
+      EXPECT_EQ(LL::OK,
+                lookup.AuditProof(proofs[i].leaf_index(), tree_size, &proof));
+      EXPECT_EQ(proofs[i].SerializeAsString(), proof.SerializeAsString());
+    }
+  }
+
+  for (int i = 0; i < 12; ++i) {
+    MerkleAuditProof proof;
+    EXPECT_EQ(LL::OK, lookup.AuditProof(hashes[i], &proof));
+    EXPECT_EQ(LogVerifier::VERIFY_OK,
+              this->verifier_->VerifyMerkleAuditProof(
+                  logged_certs[i].entry(), logged_certs[i].sct(), proof));
+  }
+}
+
+TYPED_TEST(LogLookupTest, ConsistencyProof) {
+  LL lookup(this->db());
+  std::vector<ct::SignedTreeHead> sths;
+  LoggedCertificate logged_cert;
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j <= i; ++j) {
+      this->test_signer_.CreateUnique(&logged_cert);
+      EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+    }
+    EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+    EXPECT_EQ(LL::UPDATE_OK, lookup.Update());
+    sths.push_back(lookup.GetSTH());
+  }
+
+  // Ask twice: answering must not disturb the precomputed proofs.
+  for (int round = 0; round < 2; ++round) {
+    for (size_t i = 0; i < sths.size(); ++i) {
+      for (size_t j = i + 1; j < sths.size(); ++j) {
+        std::vector<string> proof =
+            lookup.ConsistencyProof(sths[i].tree_size(), sths[j].tree_size());
+        EXPECT_TRUE(this->verifier_->VerifyConsistency(sths[i], sths[j],
+                                                       proof));
+      }
+    }
+  }
+  EXPECT_TRUE(lookup.ConsistencyProof(0, sths.back().tree_size()).empty());
+}
+
+TYPED_TEST(LogLookupTest, ReadDuringUpdate) {
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  LL lookup(this->db());
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupByHash(logged_cert.Hash(), &logged_cert));
+
+  ProofReader readers[2] = {
+    ProofReader(&lookup, logged_cert.merkle_leaf_hash()),
+    ProofReader(&lookup, logged_cert.merkle_leaf_hash())
+  };
+  pthread_t threads[2];
+  for (int i = 0; i < 2; ++i)
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, &ProofReader::Run,
+                                &readers[i]));
+  for (int round = 0; round < 10; ++round) {
+    for (int i = 0; i < 20; ++i) {
+      LoggedCertificate new_cert;
+      this->test_signer_.CreateUnique(&new_cert);
+      EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(new_cert));
+    }
+    EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+    EXPECT_EQ(LL::UPDATE_OK, lookup.Update());
+  }
+  for (int i = 0; i < 2; ++i) {
+    readers[i].stop = true;
+    ASSERT_EQ(0, pthread_join(threads[i], NULL));
+  }
+
+  // Every proof that the readers got matches its tree head.
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_LT(0U, readers[i].lookups);
+    for (size_t j = 0; j < readers[i].proofs.size(); ++j)
+      EXPECT_EQ(LogVerifier::VERIFY_OK,
+                this->verifier_->VerifyMerkleAuditProof(
+                    logged_cert.entry(), logged_cert.sct(),
+                    readers[i].proofs[j]));
+  }
+}
+
+TYPED_TEST(LogLookupTest, ResumeFromLeafHashFile) {
+  TmpStorage tmp;
+  string leaf_hash_file = tmp.TmpStorageDir() + "/leaves";
+  LoggedCertificate logged_certs[13];
+
+  for (int i = 0; i < 7; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_certs[i]));
+  }
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+
+  {
+    LL lookup(this->db(), leaf_hash_file);
+    EXPECT_EQ(7U, LeafHashFile(leaf_hash_file, 32).LeafCount());
+  }
+
+  // Sequence some more entries while nobody is looking, so that the cache
+  // falls behind the database.
+  for (int i = 7; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_certs[i]));
+  }
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+
+  LL lookup(this->db(), leaf_hash_file);
+  EXPECT_EQ(13U, LeafHashFile(leaf_hash_file, 32).LeafCount());
+  MerkleAuditProof proof;
+  for (int i = 0; i < 13; ++i) {
+    EXPECT_EQ(LL::OK, lookup.AuditProof(logged_certs[i].merkle_leaf_hash(),
+                                        &proof));
+    EXPECT_EQ(LogVerifier::VERIFY_OK,
+              this->verifier_->VerifyMerkleAuditProof(
+                  logged_certs[i].entry(),
+                  logged_certs[i].sct(), proof));
+  }
+}
+
+TYPED_TEST(LogLookupTest, CorruptLeafHashFile) {
+  TmpStorage tmp;
+  string leaf_hash_file = tmp.TmpStorageDir() + "/leaves";
+  LoggedCertificate logged_certs[7];
+  for (int i = 0; i < 7; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_certs[i]));
+  }
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  {
+    LL lookup(this->db(), leaf_hash_file);
+  }
+
+  // Flip a byte of the fourth leaf hash.
+  FILE *file = fopen(leaf_hash_file.c_str(), "r+");
+  ASSERT_TRUE(file != NULL);
+  ASSERT_EQ(0, fseek(file, 3 * 32 + 5, SEEK_SET));
+  const int byte = fgetc(file);
+  ASSERT_EQ(0, fseek(file, 3 * 32 + 5, SEEK_SET));
+  fputc(byte ^ 0xff, file);
+  fclose(file);
+
+  // The tree is rebuilt from the database, and the file rewritten.
+  LL lookup(this->db(), leaf_hash_file);
+  MerkleAuditProof proof;
+  for (int i = 0; i < 7; ++i) {
+    EXPECT_EQ(LL::OK, lookup.AuditProof(logged_certs[i].merkle_leaf_hash(),
+                                        &proof));
+    EXPECT_EQ(LogVerifier::VERIFY_OK,
+              this->verifier_->VerifyMerkleAuditProof(
+                  logged_certs[i].entry(),
+                  logged_certs[i].sct(), proof));
+  }
+  std::vector<string> hashes, expected;
+  LeafHashFile(leaf_hash_file, 32).ReadLeafHashes(7, &hashes);
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupLeafHashRange(0, 7, &expected));
+  EXPECT_EQ(expected, hashes);
+}
+
+TYPED_TEST(LogLookupTest, SharedTree) {
+  TmpStorage tmp;
+  const string shared_file = tmp.TmpStorageDir() + "/shared";
+  LoggedCertificate logged_certs[12];
+  for (int i = 0; i < 5; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_certs[i]));
+  }
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+
+  LL *publisher = new LL(this->db(), "", LL::PUBLISH, shared_file, 1024);
+  LL attached(this->db(), "", LL::ATTACH, shared_file, 0);
+  EXPECT_EQ(publisher->GetSTH().SerializeAsString(),
+            attached.GetSTH().SerializeAsString());
+
+  for (int i = 5; i < 12; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_certs[i]));
+  }
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  // Not until the publisher has it.
+  EXPECT_EQ(LL::NO_UPDATES_FOUND, attached.Update());
+  EXPECT_EQ(LL::UPDATE_OK, publisher->Update());
+  EXPECT_EQ(LL::UPDATE_OK, attached.Update());
+  EXPECT_EQ(12U, attached.GetSTH().tree_size());
+
+  for (int i = 0; i < 12; ++i) {
+    const string hash = logged_certs[i].merkle_leaf_hash();
+    MerkleAuditProof proof, shared_proof;
+    EXPECT_EQ(LL::OK, publisher->AuditProof(hash, &proof));
+    EXPECT_EQ(LL::OK, attached.AuditProof(hash, &shared_proof));
+    EXPECT_EQ(proof.SerializeAsString(), shared_proof.SerializeAsString());
+    EXPECT_EQ(LogVerifier::VERIFY_OK,
+              this->verifier_->VerifyMerkleAuditProof(
+                  logged_certs[i].entry(), logged_certs[i].sct(),
+                  shared_proof));
+    ct::ShortMerkleAuditProof short_proof, shared_short_proof;
+    EXPECT_EQ(LL::OK, publisher->AuditProof(hash, 12, &short_proof));
+    EXPECT_EQ(LL::OK, attached.AuditProof(hash, 12, &shared_short_proof));
+    EXPECT_EQ(short_proof.SerializeAsString(),
+              shared_short_proof.SerializeAsString());
+  }
+  EXPECT_EQ(publisher->ConsistencyProof(5, 12),
+            attached.ConsistencyProof(5, 12));
+
+  // A new publisher replaces the file; the attached lookup moves over.
+  delete publisher;
+  publisher = new LL(this->db(), "", LL::PUBLISH, shared_file, 1024);
+  EXPECT_EQ(LL::UPDATE_OK, attached.Update());
+  EXPECT_EQ(12U, attached.GetSTH().tree_size());
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  EXPECT_EQ(LL::UPDATE_OK, publisher->Update());
+  EXPECT_EQ(LL::UPDATE_OK, attached.Update());
+  uint64_t index;
+  EXPECT_EQ(LL::OK, attached.GetIndex(logged_cert.merkle_leaf_hash(), &index));
+  EXPECT_EQ(12U, index);
+  delete publisher;
+}
+
+TYPED_TEST(LogLookupTest, SubtreeRootFile) {
+  TmpStorage tmp;
+  const string subtree_file = tmp.TmpStorageDir() + "/subtrees";
+  LoggedCertificate logged_certs[12];
+  for (int i = 0; i < 5; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_certs[i]));
+  }
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+
+  LL writer(this->db());
+  // Nothing to serve until the file is there.
+  LL served(this->db(), "", LL::SUBTREES, subtree_file, 1024);
+  EXPECT_EQ(0U, served.GetSTH().tree_size());
+  writer.WriteSubtreeRoots(subtree_file);
+  EXPECT_EQ(LL::UPDATE_OK, served.Update());
+  EXPECT_EQ(5U, served.GetSTH().tree_size());
+
+  for (int i = 5; i < 12; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_certs[i]));
+  }
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  // Not until the writer has it.
+  EXPECT_EQ(LL::NO_UPDATES_FOUND, served.Update());
+  EXPECT_EQ(LL::UPDATE_OK, writer.Update());
+  EXPECT_EQ(LL::UPDATE_OK, served.Update());
+  EXPECT_EQ(writer.GetSTH().SerializeAsString(),
+            served.GetSTH().SerializeAsString());
+
+  for (int i = 0; i < 12; ++i) {
+    ct::ShortMerkleAuditProof proof, served_proof;
+    EXPECT_EQ(LL::OK, writer.AuditProof(i, 12, &proof));
+    EXPECT_EQ(LL::OK, served.AuditProof(i, 12, &served_proof));
+    EXPECT_EQ(proof.SerializeAsString(), served_proof.SerializeAsString());
+    EXPECT_GT(served_proof.path_node_size(), 0);
+    if (i < 5) {
+      EXPECT_EQ(LL::OK, writer.AuditProof(i, 5, &proof));
+      EXPECT_EQ(LL::OK, served.AuditProof(i, 5, &served_proof));
+      EXPECT_EQ(proof.SerializeAsString(), served_proof.SerializeAsString());
+    }
+  }
+  EXPECT_EQ(writer.ConsistencyProof(5, 12), served.ConsistencyProof(5, 12));
+  EXPECT_EQ(writer.ConsistencyProof(3, 7), served.ConsistencyProof(3, 7));
+
+  // There is no leaf index to look hashes up in.
+  uint64_t index;
+  EXPECT_EQ(LL::NOT_FOUND,
+            served.GetIndex(logged_certs[0].merkle_leaf_hash(), &index));
+
+  // A new writer picks up where the file left off.
+  LL writer2(this->db());
+  writer2.WriteSubtreeRoots(subtree_file);
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  EXPECT_EQ(LL::UPDATE_OK, writer2.Update());
+  EXPECT_EQ(LL::UPDATE_OK, served.Update());
+  EXPECT_EQ(13U, served.GetSTH().tree_size());
+}
+
+// The lookup uses the tree heads written through its database, and only
+// asks the database when it hasn't heard of one.
+TEST(LogLookupNotifyTest, NotifiedTreeHead) {
+  TestDB<SQLiteDB<LoggedCertificate> > test_db;
+  TestSigner test_signer;
+  TS tree_signer(test_db.db(), TestSigner::DefaultLogSigner());
+  LL lookup(test_db.db());
+  LoggedCertificate logged_cert;
+  test_signer.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::OK, test_db.db()->CreatePendingEntry(logged_cert));
+  EXPECT_EQ(TS::OK, tree_signer.UpdateTree());
+
+  // A newer tree head from another writer.
+  ct::SignedTreeHead sth = tree_signer.LatestSTH();
+  sth.set_timestamp(sth.timestamp() + 1);
+  DB *db2 = test_db.SecondDB();
+  EXPECT_EQ(DB::OK, db2->WriteTreeHead(sth));
+  delete db2;
+
+  EXPECT_EQ(LL::UPDATE_OK, lookup.Update());
+  EXPECT_EQ(tree_signer.LatestSTH().timestamp(), lookup.GetSTH().timestamp());
+  EXPECT_EQ(LL::UPDATE_OK, lookup.Update());
+  EXPECT_EQ(sth.timestamp(), lookup.GetSTH().timestamp());
+  EXPECT_EQ(LL::NO_UPDATES_FOUND, lookup.Update());
+}
+
+// With the lookup observing the signer, updates take the leaf hashes from
+// the signer rather than from the database.
+TEST(LogLookupNotifyTest, SignerLeafHashes) {
+  typedef InstrumentedDatabase<LoggedCertificate> InstrumentedDB;
+  TestDB<InstrumentedDB> test_db;
+  TestSigner test_signer;
+  TS tree_signer(test_db.db(), TestSigner::DefaultLogSigner());
+  LL lookup(test_db.db());
+  tree_signer.AddLeafHashObserver(lookup.leaf_hash_observer());
+  LogVerifier verifier(TestSigner::DefaultLogSigVerifier(),
+                       new MerkleVerifier(new Sha256Hasher()));
+
+  InstrumentedDB::StorageStats before, after;
+  test_db.db()->GetStats(&before);
+  LoggedCertificate logged_certs[7];
+  for (int i = 0; i < 7; ++i) {
+    test_signer.CreateUnique(&logged_certs[i]);
+    EXPECT_EQ(DB::OK, test_db.db()->CreatePendingEntry(logged_certs[i]));
+    // A round of one and then rounds of two.
+    if (i % 2 == 0) {
+      EXPECT_EQ(TS::OK, tree_signer.UpdateTree());
+      EXPECT_EQ(LL::UPDATE_OK, lookup.Update());
+    }
+  }
+  test_db.db()->GetStats(&after);
+  EXPECT_EQ(before.operations[InstrumentedDB::LOOKUP_LEAF_HASH_RANGE].calls,
+            after.operations[InstrumentedDB::LOOKUP_LEAF_HASH_RANGE].calls);
+
+  EXPECT_EQ(7U, lookup.GetSTH().tree_size());
+  for (int i = 0; i < 7; ++i) {
+    MerkleAuditProof proof;
+    EXPECT_EQ(LL::OK, lookup.AuditProof(logged_certs[i].merkle_leaf_hash(),
+                                        &proof));
+    EXPECT_EQ(LogVerifier::VERIFY_OK,
+              verifier.VerifyMerkleAuditProof(logged_certs[i].entry(),
+                                              logged_certs[i].sct(), proof));
+  }
+
+  // Once it stops observing, the database fills in.
+  tree_signer.RemoveLeafHashObserver(lookup.leaf_hash_observer());
+  LoggedCertificate logged_cert;
+  test_signer.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::OK, test_db.db()->CreatePendingEntry(logged_cert));
+  EXPECT_EQ(TS::OK, tree_signer.UpdateTree());
+  EXPECT_EQ(LL::UPDATE_OK, lookup.Update());
+  MerkleAuditProof proof;
+  EXPECT_EQ(LL::OK, lookup.AuditProof(logged_cert.merkle_leaf_hash(), &proof));
+}
+
 }  // namespace
 
 int main(int argc, char**argv) {
@@ -1,10 +1,13 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/log_signer.h"
 
+#include <algorithm>
 #include <glog/logging.h>
 #include <openssl/evp.h>
 #include <openssl/opensslv.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <vector>
 
 #include "merkletree/serial_hasher.h"
 #include "proto/ct.pb.h"
@@ -41,9 +44,36 @@ LogSigVerifier::VerifyResult ConvertStatus(const ct::Verifier::Status status) {
 }  // namespace
 
 LogSigner::LogSigner(EVP_PKEY *pkey)
-    : ct::Signer(pkey) {}
+    : ct::Signer(pkey),
+      signer_(NULL) {}
 
-LogSigner::~LogSigner() {}
+LogSigner::LogSigner(ct::Signer *signer)
+    : signer_(CHECK_NOTNULL(signer)) {}
+
+LogSigner::~LogSigner() {
+  delete signer_;
+}
+
+string LogSigner::KeyID() const {
+  if (signer_ != NULL)
+    return signer_->KeyID();
+  return ct::Signer::KeyID();
+}
+
+void LogSigner::Sign(const string &data, DigitallySigned *signature) const {
+  if (signer_ != NULL)
+    signer_->Sign(data, signature);
+  else
+    ct::Signer::Sign(data, signature);
+}
+
+void LogSigner::SignAsync(const string &data,
+                          ct::SignatureCallback *callback) const {
+  if (signer_ != NULL)
+    signer_->SignAsync(data, callback);
+  else
+    ct::Signer::SignAsync(data, callback);
+}
 
 LogSigner::SignResult LogSigner::SignV1CertificateTimestamp(
     uint64_t timestamp, const string &leaf_certificate,
@@ -101,6 +131,22 @@ LogSigner::SignCertificateTimestamp(const LogEntry &entry,
   return OK;
 }
 
+LogSigner::SignResult LogSigner::SignCertificateTimestampAsync(
+    const LogEntry &entry, const SignedCertificateTimestamp &sct,
+    ct::SignatureCallback *callback) const {
+  CHECK(sct.has_timestamp())
+      << "Attempt to sign an SCT with a missing timestamp";
+
+  string serialized_input;
+  Serializer::SerializeResult res = Serializer::SerializeSCTSignatureInput(
+      sct, entry, &serialized_input);
+
+  if (res != Serializer::OK)
+    return GetSerializeError(res);
+  SignAsync(serialized_input, callback);
+  return OK;
+}
+
 LogSigner::SignResult
 LogSigner::SignV1TreeHead(uint64_t timestamp, uint64_t tree_size,
                           const string &root_hash, string *result) const {
@@ -207,6 +253,14 @@ LogSigVerifier::VerifyResult
 LogSigVerifier::VerifySCTSignature(const LogEntry &entry,
                                    const SignedCertificateTimestamp &sct)
     const {
+  string serialized_input;
+  return VerifySCTSignature(entry, sct, &serialized_input);
+}
+
+LogSigVerifier::VerifyResult
+LogSigVerifier::VerifySCTSignature(const LogEntry &entry,
+                                   const SignedCertificateTimestamp &sct,
+                                   string *buffer) const {
   // Try to catch key mismatches early.
   if (sct.id().has_key_id() && sct.id().key_id() != KeyID()) {
     LOG(WARNING) << "Key ID mismatch, got: "
@@ -215,13 +269,11 @@ LogSigVerifier::VerifySCTSignature(const LogEntry &entry,
     return KEY_ID_MISMATCH;
   }
 
-  string serialized_input;
   Serializer::SerializeResult serialize_result =
-      Serializer::SerializeSCTSignatureInput(sct, entry,
-                                             &serialized_input);
+      Serializer::SerializeSCTSignatureInput(sct, entry, buffer);
   if (serialize_result != Serializer::OK)
     return GetSerializeError(serialize_result);
-  return ConvertStatus(Verify(serialized_input, sct.signature()));
+  return ConvertStatus(Verify(*buffer, sct.signature()));
 }
 
 LogSigVerifier::VerifyResult LogSigVerifier::VerifyV1STHSignature(
@@ -244,14 +296,83 @@ LogSigVerifier::VerifyResult LogSigVerifier::VerifyV1STHSignature(
 
 LogSigVerifier::VerifyResult
 LogSigVerifier::VerifySTHSignature(const SignedTreeHead &sth) const {
+  string serialized_sth;
+  return VerifySTHSignature(sth, &serialized_sth);
+}
+
+LogSigVerifier::VerifyResult
+LogSigVerifier::VerifySTHSignature(const SignedTreeHead &sth,
+                                   string *buffer) const {
   if (sth.id().has_key_id() && sth.id().key_id() != KeyID())
     return KEY_ID_MISMATCH;
-  string serialized_sth;
   Serializer::SerializeResult serialize_result =
-      Serializer::SerializeSTHSignatureInput(sth, &serialized_sth);
+      Serializer::SerializeSTHSignatureInput(sth, buffer);
   if (serialize_result != Serializer::OK)
     return GetSerializeError(serialize_result);
-  return ConvertStatus(Verify(serialized_sth, sth.signature()));
+  return ConvertStatus(Verify(*buffer, sth.signature()));
+}
+
+// Verifies items |begin| to |end| - 1 of a batch: SCTs if |scts| is set,
+// tree heads otherwise.
+struct LogSigVerifier::VerifyJob {
+  const LogSigVerifier *verifier;
+  const std::vector<LogEntry> *entries;
+  const std::vector<SignedCertificateTimestamp> *scts;
+  const std::vector<SignedTreeHead> *sths;
+  std::vector<VerifyResult> *results;
+  size_t begin;
+  size_t end;
+};
+
+void LogSigVerifier::VerifySCTSignatures(
+    const std::vector<LogEntry> &entries,
+    const std::vector<SignedCertificateTimestamp> &scts, size_t threads,
+    std::vector<VerifyResult> *results) const {
+  CHECK_EQ(entries.size(), scts.size());
+  results->resize(scts.size());
+  VerifyJob job = { this, &entries, &scts, NULL, results, 0, 0 };
+  RunVerifyJobs(job, scts.size(), threads);
+}
+
+void LogSigVerifier::VerifySTHSignatures(
+    const std::vector<SignedTreeHead> &sths, size_t threads,
+    std::vector<VerifyResult> *results) const {
+  results->resize(sths.size());
+  VerifyJob job = { this, NULL, NULL, &sths, results, 0, 0 };
+  RunVerifyJobs(job, sths.size(), threads);
+}
+
+void LogSigVerifier::RunVerifyJobs(const VerifyJob &job, size_t size,
+                                   size_t threads) const {
+  const size_t jobs = std::min(std::max<size_t>(threads, 1), size);
+  std::vector<VerifyJob> part(jobs, job);
+  std::vector<pthread_t> thread(jobs);
+  for (size_t j = 0; j < jobs; ++j) {
+    part[j].begin = size * j / jobs;
+    part[j].end = size * (j + 1) / jobs;
+    if (j > 0)
+      CHECK_EQ(0, pthread_create(&thread[j], NULL, VerifyThread, &part[j]));
+  }
+  if (jobs > 0)
+    VerifyThread(&part[0]);
+  for (size_t j = 1; j < jobs; ++j)
+    CHECK_EQ(0, pthread_join(thread[j], NULL));
+}
+
+// static
+void *LogSigVerifier::VerifyThread(void *arg) {
+  const VerifyJob *job = static_cast<const VerifyJob*>(arg);
+  // One buffer for all the signature inputs of this job.
+  string buffer;
+  for (size_t i = job->begin; i < job->end; ++i) {
+    if (job->scts != NULL)
+      (*job->results)[i] = job->verifier->VerifySCTSignature(
+          (*job->entries)[i], (*job->scts)[i], &buffer);
+    else
+      (*job->results)[i] = job->verifier->VerifySTHSignature(
+          (*job->sths)[i], &buffer);
+  }
+  return NULL;
 }
 
 // static
@@ -4,6 +4,8 @@
 #include <openssl/evp.h>
 #include <openssl/x509.h>  // for i2d_PUBKEY
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "log/signer.h"
 #include "log/verifier.h"
@@ -13,8 +15,18 @@
 class LogSigner : public ct::Signer {
  public:
   explicit LogSigner(EVP_PKEY *pkey);
+  // Signs with |signer|, e.g. one whose key is in an HSM. Takes ownership.
+  explicit LogSigner(ct::Signer *signer);
   virtual ~LogSigner();
 
+  virtual std::string KeyID() const;
+
+  virtual void Sign(const std::string &data,
+                    ct::DigitallySigned *signature) const;
+
+  virtual void SignAsync(const std::string &data,
+                         ct::SignatureCallback *callback) const;
+
   enum SignResult {
     OK,
     INVALID_ENTRY_TYPE,
@@ -44,6 +56,12 @@ class LogSigner : public ct::Signer {
   SignResult SignCertificateTimestamp(
       const ct::LogEntry &entry, ct::SignedCertificateTimestamp *sct) const;
 
+  // As above, but passes the signature of |sct| to |callback| through
+  // SignAsync(). The key ID is KeyID().
+  SignResult SignCertificateTimestampAsync(
+      const ct::LogEntry &entry, const ct::SignedCertificateTimestamp &sct,
+      ct::SignatureCallback *callback) const;
+
   SignResult SignV1TreeHead(uint64_t timestamp, uint64_t tree_size,
                             const std::string &root_hash,
                             std::string *result) const;
@@ -52,6 +70,9 @@ class LogSigner : public ct::Signer {
 
  private:
   static SignResult GetSerializeError(Serializer::SerializeResult result);
+
+  // NULL if we sign with a key of our own.
+  ct::Signer *const signer_;
 };
 
 class LogSigVerifier : public ct::Verifier {
@@ -98,7 +119,35 @@ class LogSigVerifier : public ct::Verifier {
 
   VerifyResult VerifySTHSignature(const ct::SignedTreeHead &sth) const;
 
+  // Verify the signature of each SCT in |scts| over the entry at the same
+  // position in |entries|, splitting the work between up to |threads|
+  // threads, and write the result for each into |results|.
+  void VerifySCTSignatures(
+      const std::vector<ct::LogEntry> &entries,
+      const std::vector<ct::SignedCertificateTimestamp> &scts,
+      size_t threads, std::vector<VerifyResult> *results) const;
+
+  // Likewise for tree heads.
+  void VerifySTHSignatures(const std::vector<ct::SignedTreeHead> &sths,
+                           size_t threads,
+                           std::vector<VerifyResult> *results) const;
+
  private:
+  struct VerifyJob;
+
+  // As the public versions, serializing the signature input into
+  // |buffer|, which can be reused from one call to the next.
+  VerifyResult VerifySCTSignature(const ct::LogEntry &entry,
+                                  const ct::SignedCertificateTimestamp &sct,
+                                  std::string *buffer) const;
+  VerifyResult VerifySTHSignature(const ct::SignedTreeHead &sth,
+                                  std::string *buffer) const;
+
+  // Split |job| into up to |threads| ranges and run them, the first on
+  // the calling thread.
+  void RunVerifyJobs(const VerifyJob &job, size_t size, size_t threads) const;
+  static void *VerifyThread(void *arg);
+
   static VerifyResult
   GetSerializeError(Serializer::SerializeResult result);
 
@@ -3,6 +3,7 @@
 #include <gtest/gtest.h>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "log/log_signer.h"
 #include "log/test_signer.h"
@@ -985,6 +986,52 @@ TEST_F(LogSignerTest, VerifyBadSerializedSTHSignature) {
   }
 }
 
+TEST_F(LogSignerTest, VerifySCTSignatures) {
+  std::vector<LogEntry> entries(10);
+  std::vector<SignedCertificateTimestamp> scts(10);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    TestSigner::SetDefaults(&entries[i]);
+    TestSigner::SetDefaults(&scts[i]);
+  }
+  // Break every third one.
+  for (size_t i = 0; i < scts.size(); i += 3)
+    scts[i].set_timestamp(scts[i].timestamp() + 1000);
+  entries[4].clear_type();
+
+  // However many threads, the results are those of one by one.
+  for (size_t threads = 1; threads <= 16; threads *= 4) {
+    std::vector<LogSigVerifier::VerifyResult> results;
+    verifier_->VerifySCTSignatures(entries, scts, threads, &results);
+    ASSERT_EQ(scts.size(), results.size());
+    for (size_t i = 0; i < scts.size(); ++i)
+      EXPECT_EQ(verifier_->VerifySCTSignature(entries[i], scts[i]),
+                results[i]) << i;
+    EXPECT_EQ(LogSigVerifier::OK, results[1]);
+    EXPECT_EQ(LogSigVerifier::INVALID_SIGNATURE, results[3]);
+    EXPECT_EQ(LogSigVerifier::INVALID_ENTRY_TYPE, results[4]);
+  }
+
+  std::vector<LogSigVerifier::VerifyResult> results(3);
+  verifier_->VerifySCTSignatures(std::vector<LogEntry>(),
+                                 std::vector<SignedCertificateTimestamp>(), 4,
+                                 &results);
+  EXPECT_TRUE(results.empty());
+}
+
+TEST_F(LogSignerTest, VerifySTHSignatures) {
+  std::vector<SignedTreeHead> sths(5);
+  for (size_t i = 0; i < sths.size(); ++i)
+    TestSigner::SetDefaults(&sths[i]);
+  sths[2].set_tree_size(sths[2].tree_size() + 1);
+
+  std::vector<LogSigVerifier::VerifyResult> results;
+  verifier_->VerifySTHSignatures(sths, 3, &results);
+  ASSERT_EQ(sths.size(), results.size());
+  for (size_t i = 0; i < sths.size(); ++i)
+    EXPECT_EQ(i == 2 ? LogSigVerifier::INVALID_SIGNATURE : LogSigVerifier::OK,
+              results[i]) << i;
+}
+
 }  // namespace
 
 int main(int argc, char **argv) {
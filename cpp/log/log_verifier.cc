@@ -12,18 +12,61 @@
 
 using ct::LogEntry;
 using ct::MerkleAuditProof;
+using ct::ShortMerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
 using std::string;
 
+namespace {
+
+// Enough for the tree heads of the few logs a client follows.
+const size_t kDefaultSTHCacheSize = 64;
+const uint64_t kDefaultSTHCacheLifetimeMs = 10 * 60 * 1000;
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() {
+    CHECK_EQ(0, pthread_mutex_unlock(mutex_));
+  }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+}  // namespace
+
 LogVerifier::LogVerifier(LogSigVerifier *sig_verifier,
                          MerkleVerifier *merkle_verifier)
     : sig_verifier_(sig_verifier),
-      merkle_verifier_(merkle_verifier) {}
+      merkle_verifier_(merkle_verifier),
+      sth_cache_lifetime_ms_(kDefaultSTHCacheLifetimeMs),
+      sth_cache_(kDefaultSTHCacheSize),
+      sth_cache_hits_(0),
+      sth_cache_misses_(0) {
+  CHECK_EQ(0, pthread_mutex_init(&sth_cache_mutex_, NULL));
+}
+
+LogVerifier::LogVerifier(LogSigVerifier *sig_verifier,
+                         MerkleVerifier *merkle_verifier,
+                         size_t sth_cache_size,
+                         uint64_t sth_cache_lifetime_ms)
+    : sig_verifier_(sig_verifier),
+      merkle_verifier_(merkle_verifier),
+      sth_cache_lifetime_ms_(sth_cache_lifetime_ms),
+      sth_cache_(sth_cache_size),
+      sth_cache_hits_(0),
+      sth_cache_misses_(0) {
+  CHECK_EQ(0, pthread_mutex_init(&sth_cache_mutex_, NULL));
+}
 
 LogVerifier::~LogVerifier() {
   delete sig_verifier_;
   delete merkle_verifier_;
+  pthread_mutex_destroy(&sth_cache_mutex_);
 }
 
 LogVerifier::VerifyResult LogVerifier::VerifySignedCertificateTimestamp(
@@ -61,7 +104,7 @@ LogVerifier::VerifySignedTreeHead(const SignedTreeHead &sth,
   if (!IsBetween(sth.timestamp(), begin_range, end_range))
     return INVALID_TIMESTAMP;
 
-  if (sig_verifier_->VerifySTHSignature(sth) != LogSigVerifier::OK)
+  if (!VerifyTreeHeadSignature(sth))
     return INVALID_SIGNATURE;
   return VERIFY_OK;
 }
@@ -109,11 +152,104 @@ LogVerifier::VerifyMerkleAuditProof(const LogEntry &entry,
   sth.set_sha256_root_hash(root_hash);
   sth.mutable_signature()->CopyFrom(merkle_proof.tree_head_signature());
 
-  if (sig_verifier_->VerifySTHSignature(sth) != LogSigVerifier::OK)
+  if (!VerifyTreeHeadSignature(sth))
     return INVALID_SIGNATURE;
   return VERIFY_OK;
 }
 
+void LogVerifier::VerifyMerkleAuditProofs(
+    const SignedTreeHead &sth, const std::vector<LogEntry> &entries,
+    const std::vector<SignedCertificateTimestamp> &scts,
+    const std::vector<ShortMerkleAuditProof> &proofs,
+    std::vector<VerifyResult> *results) const {
+  CHECK_EQ(entries.size(), scts.size());
+  CHECK_EQ(entries.size(), proofs.size());
+  const size_t count = entries.size();
+  if (!VerifyTreeHeadSignature(sth)) {
+    results->assign(count, INVALID_SIGNATURE);
+    return;
+  }
+  results->assign(count, VERIFY_OK);
+
+  const uint64_t latest = util::TimeInMilliseconds() + 1000;
+  // Items that fail before their paths are checked get leaf 0, which
+  // VerifyPaths() turns down right away.
+  std::vector<size_t> leaves(count, 0);
+  std::vector<std::vector<string> > paths(count);
+  std::vector<string> serialized_leaves(count);
+  for (size_t i = 0; i < count; ++i) {
+    if (!IsBetween(sth.timestamp(), scts[i].timestamp(), latest)) {
+      (*results)[i] = INCONSISTENT_TIMESTAMPS;
+      continue;
+    }
+    if (Serializer::SerializeSCTMerkleTreeLeaf(scts[i], entries[i],
+                                               &serialized_leaves[i]) !=
+        Serializer::OK) {
+      (*results)[i] = INVALID_FORMAT;
+      continue;
+    }
+    // Leaf indexing in the MerkleTree starts from 1.
+    leaves[i] = proofs[i].leaf_index() + 1;
+    paths[i].assign(proofs[i].path_node().begin(),
+                    proofs[i].path_node().end());
+  }
+
+  std::vector<bool> verified;
+  merkle_verifier_->VerifyPaths(sth.tree_size(), sth.sha256_root_hash(),
+                                leaves, paths, serialized_leaves, &verified);
+  for (size_t i = 0; i < count; ++i)
+    if ((*results)[i] == VERIFY_OK && !verified[i])
+      (*results)[i] = INVALID_MERKLE_PATH;
+}
+
+uint64_t LogVerifier::STHCacheHits() const {
+  ScopedLock lock(&sth_cache_mutex_);
+  return sth_cache_hits_;
+}
+
+uint64_t LogVerifier::STHCacheMisses() const {
+  ScopedLock lock(&sth_cache_mutex_);
+  return sth_cache_misses_;
+}
+
+double LogVerifier::STHCacheHitRate() const {
+  ScopedLock lock(&sth_cache_mutex_);
+  const uint64_t lookups = sth_cache_hits_ + sth_cache_misses_;
+  return lookups == 0 ? 0 : static_cast<double>(sth_cache_hits_) / lookups;
+}
+
+bool LogVerifier::VerifyTreeHeadSignature(const SignedTreeHead &sth) const {
+  // The key covers everything the verification looks at, so a hit can
+  // only be for a tree head that verified.
+  string input, signature;
+  if (Serializer::SerializeSTHSignatureInput(sth, &input) != Serializer::OK ||
+      Serializer::SerializeDigitallySigned(sth.signature(), &signature) !=
+      Serializer::OK)
+    return sig_verifier_->VerifySTHSignature(sth) == LogSigVerifier::OK;
+  const string key = input + signature + sth.id().key_id();
+
+  const uint64_t now = util::TimeInMilliseconds();
+  {
+    ScopedLock lock(&sth_cache_mutex_);
+    uint64_t expiry;
+    if (sth_cache_.Get(key, &expiry)) {
+      if (now < expiry) {
+        ++sth_cache_hits_;
+        return true;
+      }
+      sth_cache_.Erase(key);
+    }
+    ++sth_cache_misses_;
+  }
+
+  // Verify without holding the lock.
+  if (sig_verifier_->VerifySTHSignature(sth) != LogSigVerifier::OK)
+    return false;
+  ScopedLock lock(&sth_cache_mutex_);
+  sth_cache_.Put(key, now + sth_cache_lifetime_ms_);
+  return true;
+}
+
 /* static */
 bool LogVerifier::IsBetween(uint64_t timestamp, uint64_t earliest,
                             uint64_t latest) {
@@ -2,10 +2,14 @@
 #ifndef LOG_VERIFIER_H
 #define LOG_VERIFIER_H
 
+#include <pthread.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "log/log_signer.h"
 #include "proto/ct.pb.h"
+#include "util/lru_cache.h"
 
 class MerkleVerifier;
 
@@ -15,6 +19,11 @@ class LogVerifier {
  public:
   LogVerifier(LogSigVerifier *sig_verifier,
               MerkleVerifier *tree_verifier);
+  // Also remembers the signatures of up to |sth_cache_size| tree heads
+  // that verified, for |sth_cache_lifetime_ms| each, so that seeing the
+  // same tree head again does not need another signature verification.
+  LogVerifier(LogSigVerifier *sig_verifier, MerkleVerifier *tree_verifier,
+              size_t sth_cache_size, uint64_t sth_cache_lifetime_ms);
   ~LogVerifier();
 
   enum VerifyResult {
@@ -99,13 +108,44 @@ class LogVerifier {
                          const ct::SignedCertificateTimestamp &sct,
                          const ct::MerkleAuditProof &merkle_proof) const;
 
+  // VerifyMerkleAuditProof() for a batch of entries in the tree of |sth|,
+  // e.g. with the proofs that LogLookup gives for a list of hashes:
+  // |proofs[i]| is the path of |entries[i]|, whose SCT is |scts[i]|.
+  // Verifies the tree head once, and all the paths together (see
+  // MerkleVerifier::VerifyPaths()). Writes a result for each entry to
+  // |results|; if the tree head's signature is bad, that is every result.
+  void VerifyMerkleAuditProofs(
+      const ct::SignedTreeHead &sth, const std::vector<ct::LogEntry> &entries,
+      const std::vector<ct::SignedCertificateTimestamp> &scts,
+      const std::vector<ct::ShortMerkleAuditProof> &proofs,
+      std::vector<VerifyResult> *results) const;
+
   bool VerifyConsistency(const ct::SignedTreeHead &sth1,
 			 const ct::SignedTreeHead &sth2,
                          const std::vector<std::string> &proof) const;
 
+  // Tree head signature verifications answered from the cache, and
+  // those that were not.
+  uint64_t STHCacheHits() const;
+  uint64_t STHCacheMisses() const;
+  // The fraction of tree head signature verifications answered from the
+  // cache, or 0 if there were none.
+  double STHCacheHitRate() const;
+
  private:
+  // Verify the signature of |sth|, through the cache.
+  bool VerifyTreeHeadSignature(const ct::SignedTreeHead &sth) const;
+
   LogSigVerifier *sig_verifier_;
   MerkleVerifier *merkle_verifier_;
+  const uint64_t sth_cache_lifetime_ms_;
+  // Verification is const, but fills the cache.
+  mutable pthread_mutex_t sth_cache_mutex_;
+  // The expiry time of each verified tree head, keyed by its signature
+  // input and signature.
+  mutable util::LRUCache<std::string, uint64_t> sth_cache_;
+  mutable uint64_t sth_cache_hits_;
+  mutable uint64_t sth_cache_misses_;
 
   static bool IsBetween(uint64_t timestamp, uint64_t earliest, uint64_t latest);
 };
@@ -0,0 +1,88 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string>
+
+#include "log/log_signer.h"
+#include "log/log_verifier.h"
+#include "log/test_signer.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/ct.pb.h"
+#include "util/testing.h"
+
+namespace {
+
+using ct::SignedTreeHead;
+
+LogVerifier *NewVerifier(size_t sth_cache_size,
+                         uint64_t sth_cache_lifetime_ms) {
+  return new LogVerifier(TestSigner::DefaultLogSigVerifier(),
+                         new MerkleVerifier(new Sha256Hasher()),
+                         sth_cache_size, sth_cache_lifetime_ms);
+}
+
+TEST(LogVerifierTest, CachesVerifiedTreeHeads) {
+  LogVerifier *verifier = NewVerifier(10, 60 * 1000);
+  SignedTreeHead sth;
+  TestSigner::SetDefaults(&sth);
+
+  EXPECT_EQ(0, verifier->STHCacheHitRate());
+  EXPECT_EQ(LogVerifier::VERIFY_OK, verifier->VerifySignedTreeHead(sth));
+  EXPECT_EQ(0U, verifier->STHCacheHits());
+  EXPECT_EQ(1U, verifier->STHCacheMisses());
+  EXPECT_EQ(LogVerifier::VERIFY_OK, verifier->VerifySignedTreeHead(sth));
+  EXPECT_EQ(LogVerifier::VERIFY_OK, verifier->VerifySignedTreeHead(sth));
+  EXPECT_EQ(2U, verifier->STHCacheHits());
+  EXPECT_EQ(1U, verifier->STHCacheMisses());
+  EXPECT_DOUBLE_EQ(2.0 / 3, verifier->STHCacheHitRate());
+
+  // The timestamp range is still checked on a hit.
+  EXPECT_EQ(LogVerifier::INVALID_TIMESTAMP,
+            verifier->VerifySignedTreeHead(sth, 0, sth.timestamp() - 1));
+
+  // A different tree head with the same signature is not a hit.
+  SignedTreeHead changed(sth);
+  changed.set_tree_size(sth.tree_size() + 1);
+  EXPECT_EQ(LogVerifier::INVALID_SIGNATURE,
+            verifier->VerifySignedTreeHead(changed));
+  EXPECT_EQ(LogVerifier::INVALID_SIGNATURE,
+            verifier->VerifySignedTreeHead(changed));
+  EXPECT_EQ(2U, verifier->STHCacheHits());
+  EXPECT_EQ(3U, verifier->STHCacheMisses());
+
+  // Nor is the same tree head with a different key ID.
+  changed.CopyFrom(sth);
+  changed.mutable_id()->set_key_id("bogus");
+  EXPECT_EQ(LogVerifier::INVALID_SIGNATURE,
+            verifier->VerifySignedTreeHead(changed));
+  delete verifier;
+}
+
+TEST(LogVerifierTest, TreeHeadsExpire) {
+  LogVerifier *verifier = NewVerifier(10, 0);
+  SignedTreeHead sth;
+  TestSigner::SetDefaults(&sth);
+  EXPECT_EQ(LogVerifier::VERIFY_OK, verifier->VerifySignedTreeHead(sth));
+  EXPECT_EQ(LogVerifier::VERIFY_OK, verifier->VerifySignedTreeHead(sth));
+  EXPECT_EQ(0U, verifier->STHCacheHits());
+  EXPECT_EQ(2U, verifier->STHCacheMisses());
+  delete verifier;
+}
+
+TEST(LogVerifierTest, NoCache) {
+  LogVerifier *verifier = NewVerifier(0, 60 * 1000);
+  SignedTreeHead sth;
+  TestSigner::SetDefaults(&sth);
+  EXPECT_EQ(LogVerifier::VERIFY_OK, verifier->VerifySignedTreeHead(sth));
+  EXPECT_EQ(LogVerifier::VERIFY_OK, verifier->VerifySignedTreeHead(sth));
+  EXPECT_EQ(0U, verifier->STHCacheHits());
+  delete verifier;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
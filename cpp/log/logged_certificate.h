@@ -59,6 +59,35 @@ class LoggedCertificate : public LoggedCertificatePB {
           == Serializer::OK;
   }
 
+  // The inverse of SerializeForLeaf() and SerializeExtraData(), from a
+  // deserialized |leaf|, and the entry of its extra_data, as a get-entries
+  // client has them. A leaf doesn't have the log ID and signature of its
+  // SCT, so those are left out. Returns false for an unknown entry type.
+  bool CopyFromLeaf(const MerkleTreeLeaf &leaf, const LogEntry &extra) {
+    const TimestampedEntry &timestamped = leaf.timestamped_entry();
+    if (leaf.type() != TIMESTAMPED_ENTRY)
+      return false;
+    Clear();
+    mutable_sct()->set_version(leaf.version());
+    mutable_sct()->set_timestamp(timestamped.timestamp());
+    mutable_sct()->set_extensions(timestamped.extensions());
+
+    LogEntry *log_entry = mutable_entry();
+    log_entry->set_type(timestamped.entry_type());
+    if (timestamped.entry_type() == X509_ENTRY) {
+      log_entry->mutable_x509_entry()->CopyFrom(extra.x509_entry());
+      log_entry->mutable_x509_entry()->set_leaf_certificate(
+          timestamped.signed_entry().x509());
+    } else if (timestamped.entry_type() == PRECERT_ENTRY) {
+      log_entry->mutable_precert_entry()->CopyFrom(extra.precert_entry());
+      log_entry->mutable_precert_entry()->mutable_pre_cert()->CopyFrom(
+          timestamped.signed_entry().precert());
+    } else {
+      return false;
+    }
+    return true;
+  }
+
   // FIXME(benl): unify with TestSigner?
   void RandomForTest() {
     const char kKeyID[] =
@@ -0,0 +1,232 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/replication.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <glog/logging.h>
+#include <pthread.h>
+#include <string>
+#include <sys/time.h>
+#include <vector>
+
+#include "proto/ct.pb.h"
+
+using ct::ReplicationUpdate;
+using ct::SignedTreeHead;
+using std::string;
+
+// Adds the entries of a range lookup to an update.
+template <class Logged> class ReplicationSource<Logged>::EntryCollector
+    : public Database<Logged>::EntryCallback {
+ public:
+  explicit EntryCollector(ReplicationUpdate *update) : update_(update) {}
+
+  virtual bool Entry(const Logged &logged) {
+    CHECK(logged.SerializeForDatabase(
+        update_->add_entry()->mutable_contents()));
+    return true;
+  }
+
+ private:
+  ReplicationUpdate *update_;
+};
+
+// The database calls NewTreeHead() from the writing thread, possibly
+// before the tree head is committed, so the waiting updates read it back
+// from the database rather than take it from here.
+template <class Logged> class ReplicationSource<Logged>::TreeHeadListener
+    : public Database<Logged>::TreeHeadObserver {
+ public:
+  TreeHeadListener() : timestamp_(0) {
+    CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+    CHECK_EQ(0, pthread_cond_init(&written_, NULL));
+  }
+
+  ~TreeHeadListener() {
+    pthread_cond_destroy(&written_);
+    pthread_mutex_destroy(&mutex_);
+  }
+
+  virtual void NewTreeHead(const SignedTreeHead &sth) {
+    CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+    timestamp_ = std::max<uint64_t>(timestamp_, sth.timestamp());
+    CHECK_EQ(0, pthread_cond_broadcast(&written_));
+    CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+  }
+
+  // Wait up to |seconds| for a tree head newer than |timestamp|.
+  void Wait(uint64_t timestamp, int seconds) {
+    struct timeval now;
+    CHECK_EQ(0, gettimeofday(&now, NULL));
+    struct timespec due;
+    due.tv_sec = now.tv_sec + seconds;
+    due.tv_nsec = now.tv_usec * 1000;
+    CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+    while (timestamp_ <= timestamp) {
+      const int ret = pthread_cond_timedwait(&written_, &mutex_, &due);
+      CHECK(ret == 0 || ret == ETIMEDOUT) << ret;
+      if (ret == ETIMEDOUT)
+        break;
+    }
+    CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+  }
+
+ private:
+  pthread_mutex_t mutex_;
+  pthread_cond_t written_;
+  // Of the latest tree head written, while we listened.
+  uint64_t timestamp_;
+};
+
+template <class Logged>
+ReplicationSource<Logged>::ReplicationSource(const Database<Logged> *db)
+    : db_(db),
+      listener_(new TreeHeadListener()) {
+  db_->AddTreeHeadObserver(listener_);
+}
+
+template <class Logged> ReplicationSource<Logged>::~ReplicationSource() {
+  db_->RemoveTreeHeadObserver(listener_);
+  delete listener_;
+}
+
+template <class Logged>
+bool ReplicationSource<Logged>::GetUpdate(uint64_t start, uint64_t timestamp,
+                                          size_t max_entries,
+                                          int wait_seconds,
+                                          ReplicationUpdate *update) const {
+  update->Clear();
+  SignedTreeHead sth;
+  if (db_->LatestTreeHead(&sth) != Database<Logged>::LOOKUP_OK)
+    sth.Clear();
+  // The replica is up to date; hold on to the request until it isn't.
+  if (start == sth.tree_size() && sth.timestamp() <= timestamp &&
+      wait_seconds > 0) {
+    listener_->Wait(timestamp, wait_seconds);
+    if (db_->LatestTreeHead(&sth) != Database<Logged>::LOOKUP_OK)
+      sth.Clear();
+  }
+  if (start > sth.tree_size())
+    return false;
+
+  update->set_first_sequence_number(start);
+  update->set_latest_tree_size(sth.tree_size());
+  update->set_latest_timestamp(sth.timestamp());
+  const uint64_t end = std::min<uint64_t>(sth.tree_size(),
+                                          start + max_entries);
+  if (start < end) {
+    std::vector<string> leaf_hashes;
+    EntryCollector collector(update);
+    // Entries of a tree head that isn't committed yet may be missing; the
+    // replica asks again.
+    if (db_->LookupLeafHashRange(start, end, &leaf_hashes) !=
+        Database<Logged>::LOOKUP_OK ||
+        db_->LookupByIndexRange(start, end, &collector) !=
+        Database<Logged>::LOOKUP_OK ||
+        update->entry_size() != static_cast<int>(end - start)) {
+      update->clear_entry();
+      return true;
+    }
+    for (size_t i = 0; i < leaf_hashes.size(); ++i)
+      update->mutable_entry(i)->mutable_merkle_leaf_hash()->swap(
+          leaf_hashes[i]);
+  }
+  if (end == sth.tree_size() && sth.timestamp() > timestamp)
+    update->mutable_sth()->Swap(&sth);
+  return true;
+}
+
+template <class Logged>
+Replica<Logged>::Replica(Database<Logged> *db,
+                         LeafHashObserver *leaf_hash_observer)
+    : db_(db),
+      leaf_hash_observer_(leaf_hash_observer),
+      next_sequence_number_(0),
+      latest_tree_size_(0),
+      latest_timestamp_(0) {
+  if (db_->LatestTreeHead(&sth_) != Database<Logged>::LOOKUP_OK)
+    sth_.Clear();
+  // Entries of an update that stopped short of its tree head are kept.
+  next_sequence_number_ = sth_.tree_size();
+  Logged logged;
+  while (db_->LookupByIndex(next_sequence_number_, &logged) ==
+         Database<Logged>::LOOKUP_OK)
+    ++next_sequence_number_;
+  latest_tree_size_ = sth_.tree_size();
+  latest_timestamp_ = sth_.timestamp();
+}
+
+template <class Logged> typename Replica<Logged>::ApplyResult
+Replica<Logged>::Apply(const ReplicationUpdate &update) {
+  const uint64_t first = update.first_sequence_number();
+  if (first > next_sequence_number_)
+    return OUT_OF_ORDER;
+  const uint64_t end = first + update.entry_size();
+  if (update.has_sth() && update.sth().tree_size() != end)
+    return BAD_TREE_HEAD;
+
+  const size_t skip = std::min(next_sequence_number_, end) - first;
+  std::vector<Logged> entries(update.entry_size() - skip);
+  for (size_t i = 0; i < entries.size(); ++i)
+    if (!entries[i].ParseFromDatabase(update.entry(skip + i).contents()))
+      return BAD_ENTRY;
+
+  const bool transactional = db_->Transactional();
+  if (transactional)
+    db_->BeginTransaction();
+  ApplyResult result = APPLY_OK;
+  std::vector<string> hashes;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    // Left pending by an update that didn't finish.
+    typename Database<Logged>::WriteResult write_result =
+        db_->CreatePendingEntry(entries[i]);
+    if (write_result != Database<Logged>::OK &&
+        write_result != Database<Logged>::DUPLICATE_CERTIFICATE_HASH) {
+      result = BAD_ENTRY;
+      break;
+    }
+    hashes.push_back(entries[i].Hash());
+  }
+  size_t assigned = 0;
+  if (result == APPLY_OK &&
+      db_->AssignSequenceNumbers(hashes, next_sequence_number_, &assigned) !=
+      Database<Logged>::OK)
+    result = BAD_ENTRY;
+  next_sequence_number_ += assigned;
+
+  // Runs of them that follow on from each other add up.
+  if (leaf_hash_observer_ != NULL && assigned > 0) {
+    std::vector<string> leaf_hashes;
+    for (size_t i = 0; i < assigned; ++i)
+      leaf_hashes.push_back(update.entry(skip + i).merkle_leaf_hash());
+    leaf_hash_observer_->NewLeafHashes(first + skip, leaf_hashes);
+  }
+  if (result == APPLY_OK && update.has_sth() &&
+      update.sth().timestamp() > sth_.timestamp()) {
+    typename Database<Logged>::WriteResult write_result =
+        db_->WriteTreeHead(update.sth());
+    if (write_result == Database<Logged>::OK ||
+        write_result == Database<Logged>::DUPLICATE_TREE_HEAD_TIMESTAMP)
+      sth_.CopyFrom(update.sth());
+    else
+      result = BAD_TREE_HEAD;
+  }
+  if (transactional)
+    db_->EndTransaction();
+
+  if (update.has_latest_tree_size()) {
+    latest_tree_size_ = update.latest_tree_size();
+    latest_timestamp_ = update.latest_timestamp();
+  }
+  return result;
+}
+
+template <class Logged> uint64_t Replica<Logged>::LagEntries() const {
+  return latest_tree_size_ > sth_.tree_size() ?
+      latest_tree_size_ - sth_.tree_size() : 0;
+}
+
+template <class Logged> uint64_t Replica<Logged>::LagMilliseconds() const {
+  return latest_timestamp_ > sth_.timestamp() ?
+      latest_timestamp_ - sth_.timestamp() : 0;
+}
@@ -0,0 +1,90 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "log/database.h"
+#include "log/tree_signer.h"
+#include "proto/ct.pb.h"
+
+// Replicates a log from its primary, which sequences and signs, to
+// read-only replicas with databases of their own. A replica asks for the
+// entries from its next sequence number on, and applies the
+// ReplicationUpdate it gets: the entries, with their leaf hashes, and the
+// primary's latest tree head once they add up to it. Its LogLookup then
+// picks the tree head up as it would a local one.
+//
+// Only sequenced entries covered by a tree head are replicated; pending
+// entries stay on the primary.
+
+// Serves updates from the primary's database. Thread-safe if the database
+// is.
+template <class Logged> class ReplicationSource {
+ public:
+  // Listens for the tree heads written through |db|, which must outlive
+  // the source.
+  explicit ReplicationSource(const Database<Logged> *db);
+  ~ReplicationSource();
+
+  // Fill |update| with up to |max_entries| entries from |start| on, and
+  // with the latest tree head if they reach its size and it is newer than
+  // |timestamp|, that of the replica's latest. If there is nothing new,
+  // waits up to |wait_seconds| for a new tree head first. Returns false
+  // if |start| is past the latest tree head.
+  bool GetUpdate(uint64_t start, uint64_t timestamp, size_t max_entries,
+                 int wait_seconds, ct::ReplicationUpdate *update) const;
+
+ private:
+  class EntryCollector;
+  // Wakes waiting updates when a tree head is written.
+  class TreeHeadListener;
+
+  const Database<Logged> *const db_;
+  TreeHeadListener *const listener_;
+};
+
+// Applies updates to a replica's database. Not thread-safe.
+template <class Logged> class Replica {
+ public:
+  // Writes to |db|, and hands the leaf hashes of new entries to
+  // |leaf_hash_observer|, e.g. the LogLookup's, if it is not NULL. Does
+  // not take ownership of either. Picks up where |db| left off.
+  Replica(Database<Logged> *db, LeafHashObserver *leaf_hash_observer);
+
+  enum ApplyResult {
+    APPLY_OK,
+    // The update starts past our next entry.
+    OUT_OF_ORDER,
+    // An entry doesn't parse, or doesn't fit the database.
+    BAD_ENTRY,
+    // The tree head doesn't cover exactly the entries.
+    BAD_TREE_HEAD,
+  };
+
+  // Write the new entries and tree head of |update|. Entries that we
+  // have already are skipped.
+  ApplyResult Apply(const ct::ReplicationUpdate &update);
+
+  // The sequence number of the first entry that we don't have.
+  uint64_t NextSequenceNumber() const { return next_sequence_number_; }
+
+  // The latest tree head written, or an empty one.
+  const ct::SignedTreeHead &LatestTreeHead() const { return sth_; }
+
+  // How far the latest tree head written is behind the primary's, as of
+  // the last update, in entries and in milliseconds.
+  uint64_t LagEntries() const;
+  uint64_t LagMilliseconds() const;
+
+ private:
+  Database<Logged> *const db_;
+  LeafHashObserver *const leaf_hash_observer_;
+  uint64_t next_sequence_number_;
+  ct::SignedTreeHead sth_;
+  uint64_t latest_tree_size_;
+  uint64_t latest_timestamp_;
+};
+
+#endif  // REPLICATION_H
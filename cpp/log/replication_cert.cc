@@ -0,0 +1,6 @@
+#include "replication.cc"
+
+#include "log/logged_certificate.h"
+
+template class ReplicationSource<ct::LoggedCertificate>;
+template class Replica<ct::LoggedCertificate>;
@@ -0,0 +1,215 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/file_db.h"
+#include "log/log_lookup.h"
+#include "log/logged_certificate.h"
+#include "log/replication.h"
+#include "log/sqlite_db.h"
+#include "log/test_db.h"
+#include "log/test_signer.h"
+#include "log/tree_signer.h"
+#include "proto/ct.pb.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace {
+
+using ct::LoggedCertificate;
+using ct::ReplicationUpdate;
+using ct::SignedTreeHead;
+using std::string;
+
+typedef Database<LoggedCertificate> DB;
+typedef LogLookup<LoggedCertificate> LL;
+typedef Replica<LoggedCertificate> R;
+typedef ReplicationSource<LoggedCertificate> RS;
+typedef TreeSigner<LoggedCertificate> TS;
+
+template <class T> class ReplicationTest : public ::testing::Test {
+ protected:
+  ReplicationTest() : tree_signer_(NULL), source_(NULL) {}
+
+  void SetUp() {
+    tree_signer_ = new TS(primary(), TestSigner::DefaultLogSigner());
+    source_ = new RS(primary());
+  }
+
+  ~ReplicationTest() {
+    delete source_;
+    delete tree_signer_;
+  }
+
+  T *primary() const { return primary_db_.db(); }
+  T *replica() const { return replica_db_.db(); }
+
+  // Log |count| more entries on the primary and sign them.
+  void AddEntries(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      LoggedCertificate logged;
+      test_signer_.CreateUnique(&logged);
+      EXPECT_EQ(DB::OK, primary()->CreatePendingEntry(logged));
+    }
+    EXPECT_EQ(TS::OK, tree_signer_->UpdateTree());
+  }
+
+  // Apply updates of up to |max_entries| to |replica| until it has the
+  // primary's latest tree head.
+  void CatchUp(R *replica, size_t max_entries) {
+    for (int i = 0; i < 100; ++i) {
+      ReplicationUpdate update;
+      ASSERT_TRUE(source_->GetUpdate(replica->NextSequenceNumber(),
+                                     replica->LatestTreeHead().timestamp(),
+                                     max_entries, 0, &update));
+      ASSERT_EQ(R::APPLY_OK, replica->Apply(update));
+      if (replica->LagEntries() == 0 && replica->LagMilliseconds() == 0)
+        return;
+    }
+    ADD_FAILURE() << "Replica did not catch up";
+  }
+
+  void ExpectReplicated() const {
+    SignedTreeHead primary_sth, replica_sth;
+    ASSERT_EQ(DB::LOOKUP_OK, primary()->LatestTreeHead(&primary_sth));
+    ASSERT_EQ(DB::LOOKUP_OK, replica()->LatestTreeHead(&replica_sth));
+    EXPECT_EQ(primary_sth.SerializeAsString(),
+              replica_sth.SerializeAsString());
+    for (uint64_t i = 0; i < primary_sth.tree_size(); ++i) {
+      LoggedCertificate primary_cert, replica_cert;
+      ASSERT_EQ(DB::LOOKUP_OK, primary()->LookupByIndex(i, &primary_cert));
+      ASSERT_EQ(DB::LOOKUP_OK, replica()->LookupByIndex(i, &replica_cert));
+      EXPECT_EQ(i, replica_cert.sequence_number());
+      EXPECT_EQ(primary_cert.contents().SerializeAsString(),
+                replica_cert.contents().SerializeAsString());
+    }
+  }
+
+  TestDB<T> primary_db_;
+  TestDB<T> replica_db_;
+  TestSigner test_signer_;
+  TS *tree_signer_;
+  RS *source_;
+};
+
+typedef testing::Types<FileDB<LoggedCertificate>,
+                       SQLiteDB<LoggedCertificate> > Databases;
+
+TYPED_TEST_CASE(ReplicationTest, Databases);
+
+TYPED_TEST(ReplicationTest, Replicate) {
+  R replica(this->replica(), NULL);
+  EXPECT_EQ(0U, replica.NextSequenceNumber());
+
+  this->AddEntries(5);
+  this->CatchUp(&replica, 100);
+  EXPECT_EQ(5U, replica.NextSequenceNumber());
+  this->ExpectReplicated();
+
+  this->AddEntries(3);
+  this->CatchUp(&replica, 100);
+  EXPECT_EQ(8U, replica.NextSequenceNumber());
+  this->ExpectReplicated();
+}
+
+TYPED_TEST(ReplicationTest, PartialUpdates) {
+  this->AddEntries(7);
+  R replica(this->replica(), NULL);
+
+  // The tree head comes with the last of the entries.
+  ReplicationUpdate update;
+  ASSERT_TRUE(this->source_->GetUpdate(0, 0, 3, 0, &update));
+  EXPECT_EQ(3, update.entry_size());
+  EXPECT_FALSE(update.has_sth());
+  EXPECT_EQ(7U, update.latest_tree_size());
+  ASSERT_EQ(R::APPLY_OK, replica.Apply(update));
+  EXPECT_EQ(3U, replica.NextSequenceNumber());
+  EXPECT_EQ(7U, replica.LagEntries());
+
+  // A replica that restarts picks up the entries applied so far.
+  R restarted(this->replica(), NULL);
+  EXPECT_EQ(3U, restarted.NextSequenceNumber());
+  this->CatchUp(&restarted, 3);
+  EXPECT_EQ(0U, restarted.LagEntries());
+  this->ExpectReplicated();
+}
+
+TYPED_TEST(ReplicationTest, OverlappingUpdate) {
+  this->AddEntries(4);
+  R replica(this->replica(), NULL);
+  ReplicationUpdate update;
+  ASSERT_TRUE(this->source_->GetUpdate(0, 0, 2, 0, &update));
+  ASSERT_EQ(R::APPLY_OK, replica.Apply(update));
+
+  // Entries we have are skipped.
+  ASSERT_TRUE(this->source_->GetUpdate(1, 0, 100, 0, &update));
+  EXPECT_EQ(3, update.entry_size());
+  ASSERT_EQ(R::APPLY_OK, replica.Apply(update));
+  EXPECT_EQ(4U, replica.NextSequenceNumber());
+  this->ExpectReplicated();
+}
+
+TYPED_TEST(ReplicationTest, BadUpdates) {
+  this->AddEntries(4);
+  R replica(this->replica(), NULL);
+  ReplicationUpdate update;
+  ASSERT_TRUE(this->source_->GetUpdate(2, 0, 100, 0, &update));
+  EXPECT_EQ(R::OUT_OF_ORDER, replica.Apply(update));
+
+  ASSERT_TRUE(this->source_->GetUpdate(0, 0, 100, 0, &update));
+  ReplicationUpdate short_update(update);
+  short_update.mutable_entry()->RemoveLast();
+  EXPECT_EQ(R::BAD_TREE_HEAD, replica.Apply(short_update));
+  EXPECT_EQ(0U, replica.NextSequenceNumber());
+
+  // Nothing past the latest tree head.
+  EXPECT_FALSE(this->source_->GetUpdate(5, 0, 100, 0, &update));
+}
+
+TYPED_TEST(ReplicationTest, NothingNew) {
+  this->AddEntries(2);
+  R replica(this->replica(), NULL);
+  this->CatchUp(&replica, 100);
+
+  // Waits for a tree head, and gives up without one.
+  ReplicationUpdate update;
+  const uint64_t start = util::TimeInMilliseconds();
+  ASSERT_TRUE(this->source_->GetUpdate(
+      2, replica.LatestTreeHead().timestamp(), 100, 1, &update));
+  EXPECT_LE(start + 900, util::TimeInMilliseconds());
+  EXPECT_EQ(0, update.entry_size());
+  EXPECT_FALSE(update.has_sth());
+  EXPECT_EQ(R::APPLY_OK, replica.Apply(update));
+  EXPECT_EQ(0U, replica.LagEntries());
+}
+
+TYPED_TEST(ReplicationTest, Lookup) {
+  this->AddEntries(6);
+  LL lookup(this->replica());
+  R replica(this->replica(), lookup.leaf_hash_observer());
+  this->CatchUp(&replica, 4);
+  EXPECT_EQ(LL::UPDATE_OK, lookup.Update());
+  EXPECT_EQ(replica.LatestTreeHead().SerializeAsString(),
+            lookup.GetSTH().SerializeAsString());
+
+  this->AddEntries(3);
+  this->CatchUp(&replica, 100);
+  EXPECT_EQ(LL::UPDATE_OK, lookup.Update());
+  EXPECT_EQ(9U, lookup.GetSTH().tree_size());
+
+  LoggedCertificate logged;
+  ASSERT_EQ(DB::LOOKUP_OK, this->primary()->LookupByIndex(7, &logged));
+  uint64_t index;
+  EXPECT_EQ(LL::OK, lookup.GetIndex(lookup.LeafHash(logged), &index));
+  EXPECT_EQ(7U, index);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
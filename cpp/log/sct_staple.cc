@@ -0,0 +1,238 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/sct_staple.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "merkletree/serial_hasher.h"
+#include "proto/serializer.h"
+
+using ct::SignedCertificateTimestampList;
+using std::string;
+
+namespace {
+
+const uint64_t kMagic = 0x6374737461706c31ULL;  // "ctstapl1"
+const size_t kHashSize = Sha256Hasher::kDigestLength;
+// The type of the signed_certificate_timestamp TLS extension.
+const unsigned char kExtensionType = 18;
+// Of the extension type and length that extensions start with.
+const size_t kExtensionHeaderSize = 4;
+
+struct Header {
+  uint64_t magic;
+  // A power of two.
+  uint64_t num_slots;
+  uint64_t count;
+  // Of the extensions, which follow the slots.
+  uint64_t data_size;
+};
+
+// An empty slot has a zero length.
+struct Slot {
+  char cert_hash[kHashSize];
+  uint64_t offset;
+  uint64_t length;
+};
+
+// The smallest power of two that is at least |n|.
+uint64_t PowerOfTwoAtLeast(uint64_t n) {
+  uint64_t power = 1;
+  while (power < n)
+    power <<= 1;
+  return power;
+}
+
+// The first 8 bytes of |cert_hash| pick the slot, as in LeafIndex.
+uint64_t Bucket(const char *cert_hash) {
+  uint64_t bucket = 0;
+  for (size_t i = 0; i < 8; ++i)
+    bucket = (bucket << 8) | static_cast<unsigned char>(cert_hash[i]);
+  return bucket;
+}
+
+size_t FileSize(uint64_t num_slots, uint64_t data_size) {
+  return sizeof(Header) + num_slots * sizeof(Slot) + data_size;
+}
+
+}  // namespace
+
+SctStapleWriter::SctStapleWriter(const string &path) : path_(path) {}
+
+bool SctStapleWriter::Set(const string &cert_hash,
+                          const SignedCertificateTimestampList &sct_list) {
+  CHECK_EQ(kHashSize, cert_hash.size());
+  string serialized;
+  if (Serializer::SerializeSCTList(sct_list, &serialized) != Serializer::OK)
+    return false;
+  // The list's own length prefix is two bytes, so it fits in the
+  // extension's.
+  CHECK_LE(serialized.size(), 0xffffU);
+  string extension;
+  extension.push_back(0);
+  extension.push_back(kExtensionType);
+  extension.push_back(static_cast<char>(serialized.size() >> 8));
+  extension.push_back(static_cast<char>(serialized.size()));
+  extension.append(serialized);
+  server_info_[cert_hash] = extension;
+  return true;
+}
+
+void SctStapleWriter::Remove(const string &cert_hash) {
+  server_info_.erase(cert_hash);
+}
+
+void SctStapleWriter::Publish() const {
+  Header header;
+  header.magic = kMagic;
+  // At most half full, so that probes stay short.
+  header.num_slots = PowerOfTwoAtLeast(2 * server_info_.size() + 1);
+  header.count = server_info_.size();
+  header.data_size = 0;
+  std::map<string, string>::const_iterator it;
+  for (it = server_info_.begin(); it != server_info_.end(); ++it)
+    header.data_size += it->second.size();
+
+  string contents(FileSize(header.num_slots, header.data_size), '\0');
+  memcpy(&contents[0], &header, sizeof header);
+  Slot *slots = reinterpret_cast<Slot*>(&contents[sizeof header]);
+  const size_t data_offset = sizeof header + header.num_slots * sizeof(Slot);
+  const uint64_t mask = header.num_slots - 1;
+  uint64_t offset = 0;
+  for (it = server_info_.begin(); it != server_info_.end(); ++it) {
+    uint64_t slot = Bucket(it->first.data()) & mask;
+    while (slots[slot].length != 0)
+      slot = (slot + 1) & mask;
+    memcpy(slots[slot].cert_hash, it->first.data(), kHashSize);
+    slots[slot].offset = offset;
+    slots[slot].length = it->second.size();
+    memcpy(&contents[data_offset + offset], it->second.data(),
+           it->second.size());
+    offset += it->second.size();
+  }
+
+  // Readers may have the old file mapped, so it is replaced, not reused.
+  const string tmp_path = path_ + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  PCHECK(fd >= 0) << "Failed to create " << tmp_path;
+  size_t written = 0;
+  while (written < contents.size()) {
+    ssize_t ret = write(fd, contents.data() + written,
+                        contents.size() - written);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    PCHECK(ret > 0) << "Failed to write to " << tmp_path;
+    written += ret;
+  }
+  PCHECK(close(fd) == 0) << "Failed to close " << tmp_path;
+  PCHECK(rename(tmp_path.c_str(), path_.c_str()) == 0)
+      << "Failed to rename " << tmp_path << " to " << path_;
+}
+
+// static
+string SctStapleWriter::CertificateHash(const string &der_cert) {
+  return Sha256Hasher::Sha256Digest(der_cert);
+}
+
+SctStapleReader::SctStapleReader(const string &path, int fd,
+                                 const char *base, size_t size,
+                                 dev_t device, ino_t inode)
+    : path_(path),
+      fd_(fd),
+      base_(base),
+      size_(size),
+      device_(device),
+      inode_(inode) {}
+
+SctStapleReader::~SctStapleReader() {
+  PCHECK(munmap(const_cast<char*>(base_), size_) == 0);
+  PCHECK(close(fd_) == 0);
+}
+
+// static
+SctStapleReader *SctStapleReader::Open(const string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  PCHECK(fstat(fd, &st) == 0) << "Failed to stat " << path;
+  const size_t size = st.st_size;
+  if (size < sizeof(Header)) {
+    close(fd);
+    return NULL;
+  }
+  void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  PCHECK(map != MAP_FAILED) << "Failed to map " << path;
+  const Header *header = static_cast<const Header*>(map);
+  // A file is only ever renamed into place once written, so this only
+  // catches files that are not ours.
+  if (header->magic != kMagic || header->num_slots == 0 ||
+      (header->num_slots & (header->num_slots - 1)) != 0 ||
+      header->num_slots > size / sizeof(Slot) ||
+      FileSize(header->num_slots, header->data_size) != size) {
+    LOG(WARNING) << path << " is not an SCT staple file";
+    PCHECK(munmap(map, size) == 0);
+    close(fd);
+    return NULL;
+  }
+  return new SctStapleReader(path, fd, static_cast<const char*>(map), size,
+                             st.st_dev, st.st_ino);
+}
+
+bool SctStapleReader::FindServerInfo(const string &cert_hash,
+                                     const char **data,
+                                     size_t *length) const {
+  if (cert_hash.size() != kHashSize)
+    return false;
+  const Header *header = reinterpret_cast<const Header*>(base_);
+  const Slot *slots = reinterpret_cast<const Slot*>(base_ + sizeof *header);
+  const char *extensions = base_ + sizeof *header +
+      header->num_slots * sizeof(Slot);
+  const uint64_t mask = header->num_slots - 1;
+  // The table is never full, so there is always an empty slot to stop at.
+  for (uint64_t slot = Bucket(cert_hash.data()) & mask;
+       slots[slot].length != 0; slot = (slot + 1) & mask) {
+    if (memcmp(slots[slot].cert_hash, cert_hash.data(), kHashSize) != 0)
+      continue;
+    CHECK_LE(slots[slot].offset + slots[slot].length, header->data_size)
+        << "Bad slot in " << path_;
+    *data = extensions + slots[slot].offset;
+    *length = slots[slot].length;
+    return true;
+  }
+  return false;
+}
+
+bool SctStapleReader::FindSCTList(const string &cert_hash,
+                                  const char **data, size_t *length) const {
+  if (!FindServerInfo(cert_hash, data, length))
+    return false;
+  CHECK_GE(*length, kExtensionHeaderSize) << "Bad extension in " << path_;
+  *data += kExtensionHeaderSize;
+  *length -= kExtensionHeaderSize;
+  return true;
+}
+
+size_t SctStapleReader::Size() const {
+  return reinterpret_cast<const Header*>(base_)->count;
+}
+
+bool SctStapleReader::Replaced() const {
+  struct stat st;
+  // The publisher replaces the file by renaming over it, so it is always
+  // there once it has been.
+  if (stat(path_.c_str(), &st) != 0)
+    return false;
+  return st.st_dev != device_ || st.st_ino != inode_;
+}
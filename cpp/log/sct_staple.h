@@ -0,0 +1,100 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef SCT_STAPLE_H
+#define SCT_STAPLE_H
+
+#include <map>
+#include <stddef.h>
+#include <string>
+#include <sys/types.h>
+
+#include "proto/ct.pb.h"
+
+// SCT lists for the certificates that TLS servers on a host serve, ready to
+// go out in the signed_certificate_timestamp extension, in a file that the
+// servers map into memory: a stapler (see client/ct-stapler.cc) gets and
+// refreshes the SCTs, and the servers look up the extension for a
+// certificate on each handshake without touching disk or serializing
+// anything. Put the file on tmpfs (e.g. /dev/shm).
+//
+// Each published file is complete and never changes; the stapler
+// publishes a new one in its place, and servers that notice move to it.
+// It has a hash table from the SHA-256 hash of each leaf certificate to
+// its extension, as OpenSSL's serverinfo wants it: the extension type
+// (18) and length, then the serialized SignedCertificateTimestampList.
+
+// The publishing side. Only one process may publish to a file.
+class SctStapleWriter {
+ public:
+  explicit SctStapleWriter(const std::string &path);
+
+  // Staple |sct_list| to the certificate whose DER encoding hashes to
+  // |cert_hash|, from the next Publish() on, in place of what it had.
+  // Returns false, and leaves the certificate as it was, if the list does
+  // not serialize, e.g. because it is empty.
+  bool Set(const std::string &cert_hash,
+           const ct::SignedCertificateTimestampList &sct_list);
+
+  // Staple nothing to the certificate any more.
+  void Remove(const std::string &cert_hash);
+
+  size_t Size() const { return server_info_.size(); }
+
+  // Replace the file with one of all the lists set. Readers of the old
+  // file keep serving from it until they notice. Aborts on any IO error.
+  void Publish() const;
+
+  // The key of a certificate: the SHA-256 hash of |der_cert|.
+  static std::string CertificateHash(const std::string &der_cert);
+
+ private:
+  const std::string path_;
+  // Certificate hash -> extension.
+  std::map<std::string, std::string> server_info_;
+};
+
+// The serving side. Thread-safe.
+class SctStapleReader {
+ public:
+  ~SctStapleReader();
+
+  // Maps |path| read-only. Returns NULL if there is no such file, or it is
+  // not a whole one.
+  static SctStapleReader *Open(const std::string &path);
+
+  // Find the extension for the certificate that hashes to |cert_hash|,
+  // extension type and length included; returns false if it has none. The
+  // data stays valid while the reader is open.
+  bool FindServerInfo(const std::string &cert_hash, const char **data,
+                      size_t *length) const;
+
+  // As above, for the serialized SignedCertificateTimestampList alone, as
+  // an extension callback would add it.
+  bool FindSCTList(const std::string &cert_hash, const char **data,
+                   size_t *length) const;
+
+  // Number of certificates with SCTs.
+  size_t Size() const;
+
+  // Whether a new file has been published since this one was opened, and
+  // should be opened in its place. It costs a stat(), so call it every
+  // now and then rather than on every handshake.
+  bool Replaced() const;
+
+ private:
+  SctStapleReader(const std::string &path, int fd, const char *base,
+                  size_t size, dev_t device, ino_t inode);
+
+  const std::string path_;
+  const int fd_;
+  const char *const base_;
+  const size_t size_;
+  // Of the file when it was opened.
+  const dev_t device_;
+  const ino_t inode_;
+
+  // Private declarations without definitions, to disallow copying.
+  SctStapleReader(const SctStapleReader&);
+  SctStapleReader &operator=(const SctStapleReader&);
+};
+
+#endif  // SCT_STAPLE_H
@@ -0,0 +1,157 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+
+#include "log/sct_staple.h"
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace {
+
+using ct::SignedCertificateTimestampList;
+using std::string;
+
+class SctStapleTest : public ::testing::Test {
+ protected:
+  SctStapleTest()
+      : tmp_(),
+        path_(tmp_.TmpStorageDir() + "/staple") {}
+
+  // A list of |count| made-up SCTs.
+  static SignedCertificateTimestampList List(size_t count, char fill) {
+    SignedCertificateTimestampList list;
+    for (size_t i = 0; i < count; ++i)
+      list.add_sct_list(string(40 + i, fill));
+    return list;
+  }
+
+  static string Serialized(const SignedCertificateTimestampList &list) {
+    string serialized;
+    CHECK_EQ(Serializer::OK, Serializer::SerializeSCTList(list, &serialized));
+    return serialized;
+  }
+
+  static string Hash(const string &cert) {
+    return SctStapleWriter::CertificateHash(cert);
+  }
+
+  // What |reader| has for |cert|, or "" if nothing.
+  static string ServerInfo(const SctStapleReader &reader,
+                           const string &cert) {
+    const char *data;
+    size_t length;
+    if (!reader.FindServerInfo(Hash(cert), &data, &length))
+      return "";
+    return string(data, length);
+  }
+
+  static string SCTList(const SctStapleReader &reader, const string &cert) {
+    const char *data;
+    size_t length;
+    if (!reader.FindSCTList(Hash(cert), &data, &length))
+      return "";
+    return string(data, length);
+  }
+
+  TmpStorage tmp_;
+  string path_;
+};
+
+TEST_F(SctStapleTest, Empty) {
+  EXPECT_TRUE(SctStapleReader::Open(path_) == NULL);
+  SctStapleWriter writer(path_);
+  writer.Publish();
+  SctStapleReader *reader = SctStapleReader::Open(path_);
+  ASSERT_TRUE(reader != NULL);
+  EXPECT_EQ(0U, reader->Size());
+  EXPECT_EQ("", ServerInfo(*reader, "cert"));
+  delete reader;
+}
+
+TEST_F(SctStapleTest, Lookup) {
+  SctStapleWriter writer(path_);
+  // Enough to collide in the table.
+  for (size_t i = 0; i < 100; ++i)
+    EXPECT_TRUE(writer.Set(Hash(string(1, 'a' + i % 26) + string(i, 'x')),
+                           List(1 + i % 3, 'a' + i % 26)));
+  EXPECT_EQ(100U, writer.Size());
+  writer.Publish();
+
+  SctStapleReader *reader = SctStapleReader::Open(path_);
+  ASSERT_TRUE(reader != NULL);
+  EXPECT_EQ(100U, reader->Size());
+  for (size_t i = 0; i < 100; ++i) {
+    const string cert = string(1, 'a' + i % 26) + string(i, 'x');
+    const string list = Serialized(List(1 + i % 3, 'a' + i % 26));
+    EXPECT_EQ(list, SCTList(*reader, cert));
+    // Type 18, then the length.
+    string expected("\x00\x12", 2);
+    expected.push_back(static_cast<char>(list.size() >> 8));
+    expected.push_back(static_cast<char>(list.size()));
+    expected.append(list);
+    EXPECT_EQ(expected, ServerInfo(*reader, cert));
+  }
+  EXPECT_EQ("", ServerInfo(*reader, "unknown"));
+  const char *data;
+  size_t length;
+  EXPECT_FALSE(reader->FindServerInfo("short", &data, &length));
+  delete reader;
+}
+
+TEST_F(SctStapleTest, EmptyListIsRejected) {
+  SctStapleWriter writer(path_);
+  EXPECT_TRUE(writer.Set(Hash("cert"), List(1, 'a')));
+  EXPECT_FALSE(writer.Set(Hash("cert"), List(0, 'a')));
+  writer.Publish();
+  SctStapleReader *reader = SctStapleReader::Open(path_);
+  ASSERT_TRUE(reader != NULL);
+  EXPECT_EQ(Serialized(List(1, 'a')), SCTList(*reader, "cert"));
+  delete reader;
+}
+
+TEST_F(SctStapleTest, Replace) {
+  SctStapleWriter writer(path_);
+  writer.Set(Hash("one"), List(1, 'a'));
+  writer.Set(Hash("two"), List(2, 'b'));
+  writer.Publish();
+  SctStapleReader *old_reader = SctStapleReader::Open(path_);
+  ASSERT_TRUE(old_reader != NULL);
+  EXPECT_FALSE(old_reader->Replaced());
+
+  writer.Remove(Hash("one"));
+  writer.Set(Hash("two"), List(3, 'c'));
+  writer.Publish();
+  EXPECT_TRUE(old_reader->Replaced());
+  // The old file still serves what it had.
+  EXPECT_EQ(Serialized(List(1, 'a')), SCTList(*old_reader, "one"));
+  EXPECT_EQ(Serialized(List(2, 'b')), SCTList(*old_reader, "two"));
+
+  SctStapleReader *reader = SctStapleReader::Open(path_);
+  ASSERT_TRUE(reader != NULL);
+  EXPECT_FALSE(reader->Replaced());
+  EXPECT_EQ(1U, reader->Size());
+  EXPECT_EQ("", SCTList(*reader, "one"));
+  EXPECT_EQ(Serialized(List(3, 'c')), SCTList(*reader, "two"));
+  delete reader;
+  delete old_reader;
+}
+
+TEST_F(SctStapleTest, NotAStapleFile) {
+  FILE *out = fopen(path_.c_str(), "w");
+  ASSERT_TRUE(out != NULL);
+  fputs("not a staple file, but long enough for a header", out);
+  fclose(out);
+  EXPECT_TRUE(SctStapleReader::Open(path_) == NULL);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
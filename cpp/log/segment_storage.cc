@@ -0,0 +1,524 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/segment_storage.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "util/memory_usage.h"
+#include "util/util.h"
+
+using std::string;
+
+namespace {
+
+const char kSegmentPrefix[] = "segment-";
+const size_t kHeaderSize = 8;
+// The data length of a deletion record, which has no data.
+const uint32_t kDeleted = 0xffffffff;
+
+void AppendUint32(uint32_t value, string *out) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out->push_back(static_cast<char>((value >> shift) & 0xff));
+}
+
+uint32_t ReadUint32(const char *in) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(in);
+  return (static_cast<uint32_t>(bytes[0]) << 24) |
+      (static_cast<uint32_t>(bytes[1]) << 16) |
+      (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+}
+
+bool IsDeletion(const string &data, size_t offset) {
+  return ReadUint32(data.data() + offset + 4) == kDeleted;
+}
+
+// The size of the record at |offset| in |data|, or 0 if it is torn.
+size_t RecordSize(const string &data, size_t offset) {
+  if (data.size() - offset < kHeaderSize)
+    return 0;
+  size_t size = kHeaderSize + ReadUint32(data.data() + offset);
+  if (!IsDeletion(data, offset))
+    size += ReadUint32(data.data() + offset + 4);
+  return data.size() - offset < size ? 0 : size;
+}
+
+string RecordKey(const string &data, size_t offset) {
+  return data.substr(offset + kHeaderSize, ReadUint32(data.data() + offset));
+}
+
+string RecordData(const string &data, size_t offset) {
+  size_t key_length = ReadUint32(data.data() + offset);
+  return data.substr(offset + kHeaderSize + key_length,
+                     ReadUint32(data.data() + offset + 4));
+}
+
+// Read |size| bytes at |offset| of |fd|, which must be there.
+void ReadAt(int fd, uint64_t offset, size_t size, string *out) {
+  out->resize(size);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t ret = pread(fd, &(*out)[done], size - done, offset + done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    PCHECK(ret > 0) << "Short read";
+    done += ret;
+  }
+}
+
+void WriteAll(int fd, const string &data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t ret = write(fd, data.data() + done, data.size() - done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    PCHECK(ret > 0) << "Write failed";
+    done += ret;
+  }
+}
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+}  // namespace
+
+SegmentStorage::SegmentStorage(const string &dir, size_t max_segment_size)
+    : dir_(dir),
+      max_segment_size_(max_segment_size),
+      compaction_needed_(false),
+      stop_(false),
+      current_segment_(0) {
+  CHECK_GT(max_segment_size_, 0U);
+  if (mkdir(dir_.c_str(), 0700) != 0)
+    PCHECK(errno == EEXIST) << "Could not create " << dir_;
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+  CHECK_EQ(0, pthread_mutex_init(&compaction_mutex_, NULL));
+  CHECK_EQ(0, pthread_cond_init(&compaction_cond_, NULL));
+
+  DIR *d = opendir(dir_.c_str());
+  PCHECK(d != NULL) << "Could not open " << dir_;
+  std::vector<uint32_t> segments;
+  const size_t prefix_length = strlen(kSegmentPrefix);
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    if (strncmp(entry->d_name, kSegmentPrefix, prefix_length) != 0)
+      continue;
+    char *end;
+    unsigned long segment = strtoul(entry->d_name + prefix_length, &end, 10);
+    CHECK_EQ('\0', *end) << "Unexpected file " << entry->d_name;
+    segments.push_back(segment);
+  }
+  closedir(d);
+  // Later records override earlier ones, so replay in order.
+  std::sort(segments.begin(), segments.end());
+  for (size_t i = 0; i < segments.size(); ++i)
+    LoadSegment(segments[i]);
+
+  if (segments_.empty())
+    StartSegment(0);
+  else if (segments_.rbegin()->second.size >= max_segment_size_)
+    StartSegment(segments_.rbegin()->first + 1);
+  else
+    current_segment_ = segments_.rbegin()->first;
+
+  for (SegmentMap::const_iterator it = segments_.begin();
+       it != segments_.end(); ++it)
+    if (Compactable(it))
+      compaction_needed_ = true;
+  CHECK_EQ(0, pthread_create(&compaction_thread_, NULL, CompactionThread,
+                             this));
+}
+
+SegmentStorage::~SegmentStorage() {
+  {
+    ScopedLock lock(&mutex_);
+    stop_ = true;
+    CHECK_EQ(0, pthread_cond_signal(&compaction_cond_));
+  }
+  CHECK_EQ(0, pthread_join(compaction_thread_, NULL));
+  for (SegmentMap::iterator it = segments_.begin(); it != segments_.end();
+       ++it)
+    close(it->second.fd);
+  pthread_cond_destroy(&compaction_cond_);
+  pthread_mutex_destroy(&compaction_mutex_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+std::set<string> SegmentStorage::Scan() const {
+  ScopedLock lock(&mutex_);
+  std::set<string> keys;
+  for (Index::const_iterator it = index_.begin(); it != index_.end(); ++it)
+    keys.insert(keys.end(), it->first);
+  return keys;
+}
+
+std::set<string> SegmentStorage::Scan(size_t /*num_threads*/) const {
+  return Scan();
+}
+
+SegmentStorage::FileStorageResult
+SegmentStorage::CreateEntry(const string &key, const string &data) {
+  ScopedLock lock(&mutex_);
+  if (index_.find(key) != index_.end())
+    return ENTRY_ALREADY_EXISTS;
+  Put(key, data);
+  return OK;
+}
+
+SegmentStorage::FileStorageResult
+SegmentStorage::UpdateEntry(const string &key, const string &data) {
+  ScopedLock lock(&mutex_);
+  if (index_.find(key) == index_.end())
+    return NOT_FOUND;
+  Put(key, data);
+  return OK;
+}
+
+SegmentStorage::FileStorageResult SegmentStorage::UpdateEntries(
+    const std::vector<std::pair<string, string> > &entries) {
+  ScopedLock lock(&mutex_);
+  for (size_t i = 0; i < entries.size(); ++i)
+    if (index_.find(entries[i].first) == index_.end())
+      return NOT_FOUND;
+  for (size_t i = 0; i < entries.size(); ++i)
+    Put(entries[i].first, entries[i].second);
+  return OK;
+}
+
+SegmentStorage::FileStorageResult SegmentStorage::DeleteEntries(
+    const std::vector<string> &keys) {
+  ScopedLock lock(&mutex_);
+  for (size_t i = 0; i < keys.size(); ++i)
+    if (index_.find(keys[i]) == index_.end())
+      return NOT_FOUND;
+  for (size_t i = 0; i < keys.size(); ++i)
+    // Unless it is repeated.
+    if (index_.find(keys[i]) != index_.end())
+      Delete(keys[i]);
+  return OK;
+}
+
+SegmentStorage::FileStorageResult
+SegmentStorage::LookupEntry(const string &key, string *result) const {
+  ScopedLock lock(&mutex_);
+  Index::const_iterator it = index_.find(key);
+  if (it == index_.end())
+    return NOT_FOUND;
+  if (result != NULL) {
+    string record;
+    ReadAt(segments_.find(it->second.segment)->second.fd, it->second.offset,
+           it->second.size, &record);
+    *result = RecordData(record, 0);
+  }
+  return OK;
+}
+
+void SegmentStorage::Compact() {
+  ScopedLock compaction_lock(&compaction_mutex_);
+  std::vector<uint32_t> segments;
+  {
+    ScopedLock lock(&mutex_);
+    for (SegmentMap::const_iterator it = segments_.begin();
+         it != segments_.end(); ++it)
+      if (Compactable(it))
+        segments.push_back(it->first);
+  }
+  for (size_t i = 0; i < segments.size(); ++i)
+    CompactSegment(segments[i]);
+}
+
+size_t SegmentStorage::SegmentCount() const {
+  ScopedLock lock(&mutex_);
+  return segments_.size();
+}
+
+util::MemoryUsage SegmentStorage::MemoryUsage() const {
+  ScopedLock lock(&mutex_);
+  util::MemoryUsage usage(0, index_.size() + tombstones_.size());
+  for (Index::const_iterator it = index_.begin(); it != index_.end(); ++it)
+    usage.bytes += util::kTreeNodeBytes + sizeof(*it) +
+        util::HeapBytes(it->first);
+  for (TombstoneMap::const_iterator it = tombstones_.begin();
+       it != tombstones_.end(); ++it)
+    usage.bytes += util::kTreeNodeBytes + sizeof(*it) +
+        util::HeapBytes(it->first);
+  return usage;
+}
+
+string SegmentStorage::SegmentPath(uint32_t segment) const {
+  char name[32];
+  snprintf(name, sizeof(name), "%s%08u", kSegmentPrefix, segment);
+  return dir_ + "/" + name;
+}
+
+void SegmentStorage::LoadSegment(uint32_t segment) {
+  const string path = SegmentPath(segment);
+  string data;
+  CHECK(util::ReadBinaryFile(path, &data)) << "Could not read " << path;
+  Segment &loaded = segments_[segment];
+  loaded.fd = open(path.c_str(), O_RDWR | O_APPEND);
+  PCHECK(loaded.fd >= 0) << "Could not open " << path;
+  loaded.live = 0;
+
+  size_t offset = 0;
+  size_t size;
+  while ((size = RecordSize(data, offset)) > 0) {
+    const string key = RecordKey(data, offset);
+    Location location = { segment, segment, offset, size };
+    if (IsDeletion(data, offset)) {
+      // Deleting what no segment has any more is a no-op.
+      Index::iterator it = index_.find(key);
+      if (it != index_.end()) {
+        segments_[it->second.segment].live -= it->second.size;
+        // With no older records, it goes with those in this segment.
+        if (it->second.oldest != segment) {
+          location.oldest = it->second.oldest;
+          tombstones_[key] = location;
+          loaded.live += size;
+        }
+        index_.erase(it);
+      }
+      offset += size;
+      continue;
+    }
+    TombstoneMap::const_iterator tombstone = tombstones_.find(key);
+    if (tombstone != tombstones_.end())
+      location.oldest = tombstone->second.oldest;
+    DropTombstone(key);
+    std::pair<Index::iterator, bool> inserted =
+        index_.insert(Index::value_type(key, location));
+    if (!inserted.second) {
+      segments_[inserted.first->second.segment].live -=
+          inserted.first->second.size;
+      location.oldest = inserted.first->second.oldest;
+      inserted.first->second = location;
+    }
+    loaded.live += size;
+    offset += size;
+  }
+  if (offset < data.size()) {
+    LOG(WARNING) << "Truncating torn record at offset " << offset << " of "
+                 << path;
+    PCHECK(ftruncate(loaded.fd, offset) == 0);
+  }
+  loaded.size = offset;
+}
+
+uint32_t SegmentStorage::OldestSegment(uint32_t oldest) const {
+  SegmentMap::const_iterator it = segments_.lower_bound(oldest);
+  CHECK(it != segments_.end());
+  return it->first;
+}
+
+void SegmentStorage::StartSegment(uint32_t segment) {
+  const string path = SegmentPath(segment);
+  Segment started;
+  started.fd = open(path.c_str(), O_RDWR | O_APPEND | O_CREAT | O_EXCL, 0600);
+  PCHECK(started.fd >= 0) << "Could not create " << path;
+  started.size = 0;
+  started.live = 0;
+  segments_[segment] = started;
+  current_segment_ = segment;
+}
+
+SegmentStorage::Location SegmentStorage::Append(const string &record) {
+  SegmentMap::iterator current = segments_.find(current_segment_);
+  if (current->second.size > 0 &&
+      current->second.size + record.size() > max_segment_size_) {
+    StartSegment(current_segment_ + 1);
+    CheckCompactable(current);
+    current = segments_.find(current_segment_);
+  }
+
+  WriteAll(current->second.fd, record);
+  Location location = { current_segment_, current_segment_,
+                        current->second.size, record.size() };
+  current->second.size += record.size();
+  return location;
+}
+
+void SegmentStorage::Put(const string &key, const string &data) {
+  CHECK_LE(key.size(), 0xffffffffU);
+  CHECK_LT(data.size(), kDeleted);
+  string record;
+  record.reserve(kHeaderSize + key.size() + data.size());
+  AppendUint32(key.size(), &record);
+  AppendUint32(data.size(), &record);
+  record.append(key);
+  record.append(data);
+
+  Location location = Append(record);
+  segments_.find(location.segment)->second.live += location.size;
+  // The records before a deletion are still older records of the key.
+  TombstoneMap::const_iterator tombstone = tombstones_.find(key);
+  if (tombstone != tombstones_.end())
+    location.oldest = tombstone->second.oldest;
+  DropTombstone(key);
+
+  std::pair<Index::iterator, bool> inserted =
+      index_.insert(Index::value_type(key, location));
+  if (inserted.second)
+    return;
+  SegmentMap::iterator old = segments_.find(inserted.first->second.segment);
+  old->second.live -= inserted.first->second.size;
+  location.oldest = inserted.first->second.oldest;
+  inserted.first->second = location;
+  CheckCompactable(old);
+}
+
+void SegmentStorage::Delete(const string &key) {
+  CHECK_LE(key.size(), 0xffffffffU);
+  string record;
+  record.reserve(kHeaderSize + key.size());
+  AppendUint32(key.size(), &record);
+  AppendUint32(kDeleted, &record);
+  record.append(key);
+  Location location = Append(record);
+
+  Index::iterator it = index_.find(key);
+  CHECK(it != index_.end());
+  const Location deleted = it->second;
+  index_.erase(it);
+  SegmentMap::iterator old = segments_.find(deleted.segment);
+  old->second.live -= deleted.size;
+  // If all the records of the key are in its segment, the deletion goes
+  // when they do.
+  location.oldest = OldestSegment(deleted.oldest);
+  if (location.oldest != location.segment) {
+    tombstones_[key] = location;
+    segments_.find(location.segment)->second.live += location.size;
+  }
+  CheckCompactable(old);
+}
+
+void SegmentStorage::DropTombstone(const string &key) {
+  TombstoneMap::iterator it = tombstones_.find(key);
+  if (it == tombstones_.end())
+    return;
+  SegmentMap::iterator segment = segments_.find(it->second.segment);
+  segment->second.live -= it->second.size;
+  tombstones_.erase(it);
+  CheckCompactable(segment);
+}
+
+void SegmentStorage::CheckCompactable(SegmentMap::const_iterator segment) {
+  if (Compactable(segment)) {
+    compaction_needed_ = true;
+    CHECK_EQ(0, pthread_cond_signal(&compaction_cond_));
+  }
+}
+
+bool SegmentStorage::Compactable(SegmentMap::const_iterator segment) const {
+  return segment->first != current_segment_ &&
+      segment->second.live * 2 <= segment->second.size;
+}
+
+void SegmentStorage::CompactSegment(uint32_t segment) {
+  // Sealed segments are never written to, so we can read this one
+  // without holding the lock.
+  int fd;
+  uint64_t size;
+  {
+    ScopedLock lock(&mutex_);
+    SegmentMap::const_iterator it = segments_.find(segment);
+    fd = it->second.fd;
+    size = it->second.size;
+  }
+  string data;
+  ReadAt(fd, 0, size, &data);
+
+  size_t offset = 0;
+  while (offset < data.size()) {
+    size_t record_size = RecordSize(data, offset);
+    CHECK_GT(record_size, 0U);
+    string key = RecordKey(data, offset);
+    ScopedLock lock(&mutex_);
+    if (IsDeletion(data, offset)) {
+      TombstoneMap::iterator it = tombstones_.find(key);
+      if (it != tombstones_.end() && it->second.segment == segment &&
+          it->second.offset == offset) {
+        Location moved = Append(data.substr(offset, record_size));
+        segments_.find(segment)->second.live -= record_size;
+        segments_.find(moved.segment)->second.live += moved.size;
+        moved.oldest = it->second.oldest;
+        it->second = moved;
+      }
+    } else {
+      Index::const_iterator it = index_.find(key);
+      if (it != index_.end() && it->second.segment == segment &&
+          it->second.offset == offset)
+        Put(key, RecordData(data, offset));
+    }
+    offset += record_size;
+  }
+
+  // The copies must be on disk before the originals go.
+  std::vector<int> newer_fds;
+  {
+    ScopedLock lock(&mutex_);
+    for (SegmentMap::const_iterator it = segments_.upper_bound(segment);
+         it != segments_.end(); ++it)
+      newer_fds.push_back(it->second.fd);
+  }
+  for (size_t i = 0; i < newer_fds.size(); ++i)
+    PCHECK(fdatasync(newer_fds[i]) == 0);
+
+  ScopedLock lock(&mutex_);
+  SegmentMap::iterator it = segments_.find(segment);
+  CHECK_EQ(0U, it->second.live);
+  close(it->second.fd);
+  const string path = SegmentPath(segment);
+  PCHECK(unlink(path.c_str()) == 0) << "Could not delete " << path;
+  segments_.erase(it);
+
+  // The deletions left with no older records needn't stay any more.
+  for (TombstoneMap::iterator tombstone = tombstones_.begin();
+       tombstone != tombstones_.end();) {
+    tombstone->second.oldest = OldestSegment(tombstone->second.oldest);
+    if (tombstone->second.oldest != tombstone->second.segment) {
+      ++tombstone;
+      continue;
+    }
+    SegmentMap::iterator holder = segments_.find(tombstone->second.segment);
+    holder->second.live -= tombstone->second.size;
+    tombstones_.erase(tombstone++);
+    CheckCompactable(holder);
+  }
+}
+
+// static
+void *SegmentStorage::CompactionThread(void *arg) {
+  SegmentStorage *storage = static_cast<SegmentStorage*>(arg);
+  CHECK_EQ(0, pthread_mutex_lock(&storage->mutex_));
+  while (true) {
+    while (!storage->stop_ && !storage->compaction_needed_)
+      CHECK_EQ(0, pthread_cond_wait(&storage->compaction_cond_,
+                                    &storage->mutex_));
+    if (storage->stop_)
+      break;
+    storage->compaction_needed_ = false;
+    CHECK_EQ(0, pthread_mutex_unlock(&storage->mutex_));
+    storage->Compact();
+    CHECK_EQ(0, pthread_mutex_lock(&storage->mutex_));
+  }
+  CHECK_EQ(0, pthread_mutex_unlock(&storage->mutex_));
+  return NULL;
+}
@@ -0,0 +1,148 @@
+#ifndef SEGMENT_STORAGE_H
+#define SEGMENT_STORAGE_H
+
+#include <map>
+#include <pthread.h>
+#include <set>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "log/entry_storage.h"
+
+// An append-only database for (key, data) entries, for when there are too
+// many entries for a file each (see FileStorage). Entries are appended to
+// segment files in one directory:
+//
+// <dir>/segment-<n> - Records, each of
+//                       key length (4 bytes, big-endian),
+//                       data length (4 bytes, big-endian),
+//                       key, data.
+//                     Only the segment with the highest <n> is appended to;
+//                     a new one is started once it reaches the maximum
+//                     segment size. When several records have the same key,
+//                     the last one in the last segment wins. A data length
+//                     of 0xffffffff, with no data, marks a deleted key.
+//
+// The key -> (segment, offset) index is kept in memory, and rebuilt by
+// reading all segments when the storage is opened. A torn record at the end
+// of a segment is truncated away.
+//
+// Updates and deletes leave dead records behind. A background thread
+// compacts segments that are at most half live: it copies their live
+// records to the end of the current segment, syncs it and deletes the old
+// segment. The record of a deletion stays live for as long as an older
+// segment may hold a record of the deleted key, even an overwritten one.
+//
+// SegmentStorage is thread-safe, and aborts upon any filesystem error.
+class SegmentStorage : public EntryStorage {
+ public:
+  // Creates |dir| if it doesn't exist yet.
+  SegmentStorage(const std::string &dir, size_t max_segment_size);
+  virtual ~SegmentStorage();
+
+  virtual std::set<std::string> Scan() const;
+
+  // The index is in memory, so this is the same as Scan().
+  virtual std::set<std::string> Scan(size_t num_threads) const;
+
+  virtual FileStorageResult CreateEntry(const std::string &key,
+                                        const std::string &data);
+
+  virtual FileStorageResult UpdateEntry(const std::string &key,
+                                        const std::string &data);
+
+  // The records are appended in order, so a crash leaves a prefix of the
+  // updates done.
+  virtual FileStorageResult UpdateEntries(
+      const std::vector<std::pair<std::string, std::string> > &entries);
+
+  virtual FileStorageResult DeleteEntries(
+      const std::vector<std::string> &keys);
+
+  virtual FileStorageResult LookupEntry(const std::string &key,
+                                        std::string *result) const;
+
+  // Compact all segments that are at most half live now. The background
+  // thread does this as needed; this is for testing.
+  void Compact();
+
+  // Number of segment files.
+  size_t SegmentCount() const;
+
+  // The index of the records' locations, by key, and of the live deletion
+  // records.
+  virtual util::MemoryUsage MemoryUsage() const;
+
+ private:
+  struct Location {
+    uint32_t segment;
+    // No segment before this one has a record of the key. Segments that
+    // have gone since are skipped by OldestSegment().
+    uint32_t oldest;
+    uint64_t offset;
+    // Of the whole record.
+    size_t size;
+  };
+
+  struct Segment {
+    int fd;
+    uint64_t size;
+    // Bytes in records that the index points to.
+    uint64_t live;
+  };
+
+  typedef std::map<std::string, Location> Index;
+  // The records of deletions that have to stay until the older records of
+  // their keys are gone, or the last of those would be back when the
+  // storage is opened again. Each is in a later segment than |oldest|.
+  typedef std::map<std::string, Location> TombstoneMap;
+  typedef std::map<uint32_t, Segment> SegmentMap;
+
+  std::string SegmentPath(uint32_t segment) const;
+  // Read |segment|, add it to segments_ and index its records.
+  void LoadSegment(uint32_t segment);
+  // The following must be called with mutex_ held.
+  // The first segment from |oldest| on that is still there.
+  uint32_t OldestSegment(uint32_t oldest) const;
+  void StartSegment(uint32_t segment);
+  // Append |record| to the current segment, starting a new one if it is
+  // full, and return where it went. Does not count it as live.
+  Location Append(const std::string &record);
+  // Append a record to the current segment and point the index at it.
+  void Put(const std::string &key, const std::string &data);
+  // Append a deletion record for |key|, which must be in the index, and
+  // remove it from the index.
+  void Delete(const std::string &key);
+  // Forget the tombstone of |key|, if there is one, since its deleted
+  // record is gone or superseded.
+  void DropTombstone(const std::string &key);
+  // Ask for compaction if |segment| is compactable.
+  void CheckCompactable(SegmentMap::const_iterator segment);
+  // True if |segment| is sealed and at most half live.
+  bool Compactable(SegmentMap::const_iterator segment) const;
+  // Remove the live records from |segment| and delete it. Call with
+  // compaction_mutex_ held, but not mutex_.
+  void CompactSegment(uint32_t segment);
+
+  static void *CompactionThread(void *storage);
+
+  const std::string dir_;
+  const size_t max_segment_size_;
+  // Guards everything below.
+  mutable pthread_mutex_t mutex_;
+  // Held across Compact(), so that only one thread compacts at a time.
+  pthread_mutex_t compaction_mutex_;
+  // Signalled when a segment becomes compactable, or on shutdown.
+  pthread_cond_t compaction_cond_;
+  pthread_t compaction_thread_;
+  bool compaction_needed_;
+  bool stop_;
+  SegmentMap segments_;
+  uint32_t current_segment_;
+  Index index_;
+  TombstoneMap tombstones_;
+};
+#endif
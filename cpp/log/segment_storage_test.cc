@@ -0,0 +1,245 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <set>
+#include <stdio.h>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "log/segment_storage.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace {
+
+using std::string;
+
+// Small enough that the tests below span several segments.
+const size_t kSegmentSize = 256;
+
+string Key(int i) {
+  char key[16];
+  snprintf(key, sizeof(key), "key%05d", i);
+  return key;
+}
+
+string Value(int i, int version) {
+  char value[32];
+  snprintf(value, sizeof(value), "value %d, version %d", i, version);
+  return value;
+}
+
+class SegmentStorageTest : public ::testing::Test {
+ protected:
+  SegmentStorageTest() : dir_(tmp_.TmpStorageDir() + "/segments") {}
+
+  SegmentStorage *Open() const {
+    return new SegmentStorage(dir_, kSegmentSize);
+  }
+
+  // Expect entries 0 to |count| - 1, at |version|.
+  void ExpectEntries(const SegmentStorage &storage, int count, int version) {
+    std::set<string> keys;
+    for (int i = 0; i < count; ++i) {
+      keys.insert(Key(i));
+      string value;
+      EXPECT_EQ(SegmentStorage::OK, storage.LookupEntry(Key(i), &value));
+      EXPECT_EQ(Value(i, version), value);
+    }
+    EXPECT_EQ(keys, storage.Scan());
+    EXPECT_EQ(keys, storage.Scan(4));
+  }
+
+  TmpStorage tmp_;
+  const string dir_;
+};
+
+TEST_F(SegmentStorageTest, CreateAndLookup) {
+  SegmentStorage storage(dir_, kSegmentSize);
+  EXPECT_EQ(SegmentStorage::NOT_FOUND, storage.LookupEntry(Key(0), NULL));
+  for (int i = 0; i < 50; ++i)
+    EXPECT_EQ(SegmentStorage::OK, storage.CreateEntry(Key(i), Value(i, 0)));
+  EXPECT_LT(1U, storage.SegmentCount());
+  ExpectEntries(storage, 50, 0);
+
+  EXPECT_EQ(SegmentStorage::ENTRY_ALREADY_EXISTS,
+            storage.CreateEntry(Key(3), Value(3, 1)));
+  string value;
+  EXPECT_EQ(SegmentStorage::OK, storage.LookupEntry(Key(3), &value));
+  EXPECT_EQ(Value(3, 0), value);
+}
+
+TEST_F(SegmentStorageTest, Update) {
+  SegmentStorage storage(dir_, kSegmentSize);
+  EXPECT_EQ(SegmentStorage::NOT_FOUND,
+            storage.UpdateEntry(Key(0), Value(0, 1)));
+  EXPECT_EQ(SegmentStorage::NOT_FOUND, storage.LookupEntry(Key(0), NULL));
+
+  EXPECT_EQ(SegmentStorage::OK, storage.CreateEntry(Key(0), Value(0, 0)));
+  EXPECT_EQ(SegmentStorage::OK, storage.UpdateEntry(Key(0), Value(0, 1)));
+  ExpectEntries(storage, 1, 1);
+}
+
+TEST_F(SegmentStorageTest, UpdateEntries) {
+  SegmentStorage storage(dir_, kSegmentSize);
+  for (int i = 0; i < 2; ++i)
+    EXPECT_EQ(SegmentStorage::OK, storage.CreateEntry(Key(i), Value(i, 0)));
+
+  std::vector<std::pair<string, string> > updates;
+  updates.push_back(std::make_pair(Key(0), Value(0, 1)));
+  updates.push_back(std::make_pair(Key(2), Value(2, 1)));
+  // Nothing is written if any entry is missing.
+  EXPECT_EQ(SegmentStorage::NOT_FOUND, storage.UpdateEntries(updates));
+  ExpectEntries(storage, 2, 0);
+
+  updates[1] = std::make_pair(Key(1), Value(1, 1));
+  EXPECT_EQ(SegmentStorage::OK, storage.UpdateEntries(updates));
+  ExpectEntries(storage, 2, 1);
+}
+
+TEST_F(SegmentStorageTest, Resume) {
+  SegmentStorage *storage = Open();
+  for (int i = 0; i < 40; ++i)
+    EXPECT_EQ(SegmentStorage::OK, storage->CreateEntry(Key(i), Value(i, 0)));
+  for (int i = 0; i < 40; ++i)
+    EXPECT_EQ(SegmentStorage::OK, storage->UpdateEntry(Key(i), Value(i, 1)));
+  delete storage;
+
+  storage = Open();
+  ExpectEntries(*storage, 40, 1);
+  EXPECT_EQ(SegmentStorage::OK, storage->CreateEntry(Key(40), Value(40, 1)));
+  delete storage;
+
+  storage = Open();
+  ExpectEntries(*storage, 41, 1);
+  delete storage;
+}
+
+TEST_F(SegmentStorageTest, TruncateTornRecord) {
+  SegmentStorage *storage = Open();
+  EXPECT_EQ(SegmentStorage::OK, storage->CreateEntry(Key(0), Value(0, 0)));
+  delete storage;
+
+  // A record header that promises more than there is.
+  int fd = open((dir_ + "/segment-00000000").c_str(), O_WRONLY | O_APPEND);
+  ASSERT_LE(0, fd);
+  const char torn[] = "\0\0\0\x08\0\0\0\x10key";
+  ASSERT_EQ(11, write(fd, torn, 11));
+  close(fd);
+
+  storage = Open();
+  ExpectEntries(*storage, 1, 0);
+  EXPECT_EQ(SegmentStorage::OK, storage->CreateEntry(Key(1), Value(1, 0)));
+  delete storage;
+
+  storage = Open();
+  ExpectEntries(*storage, 2, 0);
+  delete storage;
+}
+
+TEST_F(SegmentStorageTest, Compact) {
+  SegmentStorage *storage = Open();
+  for (int i = 0; i < 50; ++i)
+    EXPECT_EQ(SegmentStorage::OK, storage->CreateEntry(Key(i), Value(i, 0)));
+  size_t segments = storage->SegmentCount();
+  for (int version = 1; version <= 3; ++version)
+    for (int i = 0; i < 50; ++i)
+      EXPECT_EQ(SegmentStorage::OK,
+                storage->UpdateEntry(Key(i), Value(i, version)));
+
+  // All but the last copy of each entry is dead, so compaction leaves
+  // about as many segments as the entries took up in the first place.
+  storage->Compact();
+  EXPECT_GE(segments + 2, storage->SegmentCount());
+  ExpectEntries(*storage, 50, 3);
+  delete storage;
+
+  storage = Open();
+  ExpectEntries(*storage, 50, 3);
+  delete storage;
+}
+
+TEST_F(SegmentStorageTest, DeleteEntries) {
+  SegmentStorage *storage = Open();
+  for (int i = 0; i < 50; ++i)
+    EXPECT_EQ(SegmentStorage::OK, storage->CreateEntry(Key(i), Value(i, 0)));
+
+  std::vector<string> keys;
+  keys.push_back(Key(0));
+  keys.push_back(Key(50));
+  // Nothing is deleted if any entry is missing.
+  EXPECT_EQ(SegmentStorage::NOT_FOUND, storage->DeleteEntries(keys));
+  ExpectEntries(*storage, 50, 0);
+
+  // Delete the first 30, and bring one of them back.
+  keys.clear();
+  for (int i = 0; i < 30; ++i)
+    keys.push_back(Key(i));
+  EXPECT_EQ(SegmentStorage::OK, storage->DeleteEntries(keys));
+  EXPECT_EQ(SegmentStorage::NOT_FOUND, storage->LookupEntry(Key(0), NULL));
+  EXPECT_EQ(SegmentStorage::NOT_FOUND, storage->LookupEntry(Key(29), NULL));
+  EXPECT_EQ(SegmentStorage::OK, storage->CreateEntry(Key(7), Value(7, 1)));
+  EXPECT_EQ(21U, storage->Scan().size());
+  delete storage;
+
+  // Deleted entries stay deleted, whichever segments compaction drops
+  // first.
+  for (int round = 0; round < 3; ++round) {
+    storage = Open();
+    EXPECT_EQ(21U, storage->Scan().size());
+    EXPECT_EQ(SegmentStorage::NOT_FOUND, storage->LookupEntry(Key(0), NULL));
+    string value;
+    EXPECT_EQ(SegmentStorage::OK, storage->LookupEntry(Key(7), &value));
+    EXPECT_EQ(Value(7, 1), value);
+    EXPECT_EQ(SegmentStorage::OK, storage->LookupEntry(Key(30), &value));
+    EXPECT_EQ(Value(30, 0), value);
+    // Fill up segments, so that the deletions end up in sealed ones too.
+    for (int i = 0; i < 10; ++i)
+      EXPECT_EQ(SegmentStorage::OK,
+                storage->UpdateEntry(Key(40 + i), Value(40 + i, 0)));
+    storage->Compact();
+    delete storage;
+  }
+}
+
+TEST_F(SegmentStorageTest, DeleteOverwritten) {
+  SegmentStorage *storage = Open();
+  // Most of the first segment stays live, so it isn't compacted, and the
+  // first copy of key 0 stays in it.
+  for (int i = 0; i < 7; ++i)
+    EXPECT_EQ(SegmentStorage::OK, storage->CreateEntry(Key(i), Value(i, 0)));
+  EXPECT_EQ(SegmentStorage::OK, storage->UpdateEntry(Key(0), Value(0, 1)));
+  std::vector<string> keys(1, Key(0));
+  EXPECT_EQ(SegmentStorage::OK, storage->DeleteEntries(keys));
+
+  // Make the segments of the second copy and of the deletion compactable.
+  for (int i = 100; i < 120; ++i)
+    EXPECT_EQ(SegmentStorage::OK, storage->CreateEntry(Key(i), Value(i, 0)));
+  for (int i = 100; i < 120; ++i)
+    EXPECT_EQ(SegmentStorage::OK, storage->UpdateEntry(Key(i), Value(i, 1)));
+  storage->Compact();
+  EXPECT_EQ(SegmentStorage::NOT_FOUND, storage->LookupEntry(Key(0), NULL));
+  delete storage;
+
+  for (int round = 0; round < 3; ++round) {
+    storage = Open();
+    EXPECT_EQ(SegmentStorage::NOT_FOUND, storage->LookupEntry(Key(0), NULL));
+    string value;
+    EXPECT_EQ(SegmentStorage::OK, storage->LookupEntry(Key(1), &value));
+    EXPECT_EQ(Value(1, 0), value);
+    EXPECT_EQ(26U, storage->Scan().size());
+    for (int i = 100; i < 120; ++i)
+      EXPECT_EQ(SegmentStorage::OK,
+                storage->UpdateEntry(Key(i), Value(i, round + 2)));
+    storage->Compact();
+    delete storage;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char**argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,106 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef SEQUENCING_QUEUE_H
+#define SEQUENCING_QUEUE_H
+
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Hands the entries that a FrontendSigner has just written as pending to
+// the TreeSigner of the same process, so that the signer need not find
+// them in the database again and read them back. Any number of threads
+// may Push() at once, without locks; one thread at a time may Drain().
+//
+// Pushes go onto a stack: Drain() takes all of it at once and reverses
+// it, so entries come out in the order they went in, and nodes are never
+// popped one by one, which is what makes a lock-free stack hard.
+class SequencingQueue {
+ public:
+  // What TreeSigner needs of a pending entry to sequence it.
+  struct Entry {
+    Entry() : timestamp(0) {}
+
+    std::string hash;
+    // Serialized for inclusion in the tree, but not hashed yet.
+    std::string leaf;
+    uint64_t timestamp;
+  };
+
+  SequencingQueue() : head_(NULL) {}
+
+  ~SequencingQueue() {
+    Node *node = head_;
+    while (node != NULL) {
+      Node *next = node->next;
+      delete node;
+      node = next;
+    }
+  }
+
+  // Takes |leaf| by swapping it with an empty string.
+  void Push(const std::string &hash, std::string *leaf, uint64_t timestamp) {
+    Node *node = new Node;
+    node->entry.hash = hash;
+    node->entry.leaf.swap(*leaf);
+    node->entry.timestamp = timestamp;
+    // The __sync builtins are full memory barriers, so the entry is
+    // written before it can be seen on the stack.
+    Node *head = head_;
+    for (;;) {
+      node->next = head;
+      Node *seen = __sync_val_compare_and_swap(&head_, head, node);
+      if (seen == head)
+        return;
+      head = seen;
+    }
+  }
+
+  // Append the entries pushed since the last call to |entries|, oldest
+  // first. Returns how many there were.
+  size_t Drain(std::deque<Entry> *entries) {
+    Node *head = head_;
+    for (;;) {
+      Node *seen = __sync_val_compare_and_swap(&head_, head, NULL);
+      if (seen == head)
+        break;
+      head = seen;
+    }
+    // Newest first: reverse.
+    Node *oldest = NULL;
+    while (head != NULL) {
+      Node *next = head->next;
+      head->next = oldest;
+      oldest = head;
+      head = next;
+    }
+    size_t count = 0;
+    while (oldest != NULL) {
+      entries->push_back(Entry());
+      Entry &entry = entries->back();
+      entry.hash.swap(oldest->entry.hash);
+      entry.leaf.swap(oldest->entry.leaf);
+      entry.timestamp = oldest->entry.timestamp;
+      Node *next = oldest->next;
+      delete oldest;
+      oldest = next;
+      ++count;
+    }
+    return count;
+  }
+
+ private:
+  struct Node {
+    Entry entry;
+    Node *next;
+  };
+
+  // The newest entry.
+  Node *head_;
+
+  // Private declarations without definitions, to disallow copying.
+  SequencingQueue(const SequencingQueue&);
+  SequencingQueue &operator=(const SequencingQueue&);
+};
+
+#endif  // SEQUENCING_QUEUE_H
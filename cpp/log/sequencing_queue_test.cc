@@ -0,0 +1,109 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include <deque>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/sequencing_queue.h"
+#include "util/testing.h"
+
+namespace {
+
+using std::string;
+
+typedef std::deque<SequencingQueue::Entry> Entries;
+
+void Push(SequencingQueue *queue, const string &hash, uint64_t timestamp) {
+  string leaf = "leaf " + hash;
+  queue->Push(hash, &leaf, timestamp);
+  EXPECT_TRUE(leaf.empty());
+}
+
+TEST(SequencingQueueTest, Order) {
+  SequencingQueue queue;
+  Entries entries;
+  EXPECT_EQ(0U, queue.Drain(&entries));
+  EXPECT_TRUE(entries.empty());
+
+  Push(&queue, "a", 1);
+  Push(&queue, "b", 2);
+  Push(&queue, "c", 3);
+  EXPECT_EQ(3U, queue.Drain(&entries));
+  Push(&queue, "d", 4);
+  // Appends.
+  EXPECT_EQ(1U, queue.Drain(&entries));
+  EXPECT_EQ(0U, queue.Drain(&entries));
+
+  ASSERT_EQ(4U, entries.size());
+  const char *hashes[] = { "a", "b", "c", "d" };
+  for (size_t i = 0; i < entries.size(); ++i) {
+    EXPECT_EQ(hashes[i], entries[i].hash);
+    EXPECT_EQ(string("leaf ") + hashes[i], entries[i].leaf);
+    EXPECT_EQ(i + 1, entries[i].timestamp);
+  }
+}
+
+TEST(SequencingQueueTest, DeletesUndrained) {
+  SequencingQueue *queue = new SequencingQueue;
+  Push(queue, "a", 1);
+  Push(queue, "b", 2);
+  delete queue;
+}
+
+const size_t kPushers = 4;
+const size_t kPushes = 10000;
+
+struct Pusher {
+  SequencingQueue *queue;
+  size_t id;
+};
+
+// Pushes entries numbered in their timestamps.
+void *PushThread(void *arg) {
+  const Pusher *pusher = static_cast<const Pusher*>(arg);
+  const string hash(1, static_cast<char>('0' + pusher->id));
+  for (size_t i = 0; i < kPushes; ++i) {
+    string leaf;
+    pusher->queue->Push(hash, &leaf, i);
+  }
+  return NULL;
+}
+
+// Entries from several threads come out in the order each thread pushed
+// them, while they are being drained.
+TEST(SequencingQueueTest, ConcurrentPushes) {
+  SequencingQueue queue;
+  std::vector<Pusher> pushers(kPushers);
+  std::vector<pthread_t> threads(kPushers);
+  for (size_t i = 0; i < kPushers; ++i) {
+    Pusher pusher = { &queue, i };
+    pushers[i] = pusher;
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, PushThread, &pushers[i]));
+  }
+  Entries entries;
+  while (entries.size() < kPushers * kPushes)
+    queue.Drain(&entries);
+  for (size_t i = 0; i < kPushers; ++i)
+    ASSERT_EQ(0, pthread_join(threads[i], NULL));
+  EXPECT_EQ(0U, queue.Drain(&entries));
+
+  ASSERT_EQ(kPushers * kPushes, entries.size());
+  std::vector<uint64_t> next(kPushers, 0);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    ASSERT_EQ(1U, entries[i].hash.size());
+    const size_t id = entries[i].hash[0] - '0';
+    ASSERT_LT(id, kPushers);
+    EXPECT_EQ(next[id]++, entries[i].timestamp);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char**argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
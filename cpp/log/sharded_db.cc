@@ -0,0 +1,669 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/sharded_db.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+#include <inttypes.h>
+#include <limits>
+#include <map>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "log/sqlite_statement.h"
+#include "log/sqlite_tree_heads.h"
+
+using std::string;
+using sqlite::Statement;
+
+namespace {
+
+// SQLite attaches at most 10 files to a connection by default.
+const size_t kMaxAttachedShards = 8;
+
+// Shards that a transaction can attach. BeginTransaction() detaches shards
+// to make room for them, as they can't be detached during the transaction.
+const size_t kTransactionShards = kMaxAttachedShards / 2;
+
+// Counts the current scope as one use of |*count|.
+class ScopedCount {
+ public:
+  explicit ScopedCount(int *count) : count_(count) { ++*count_; }
+  ~ScopedCount() { --*count_; }
+
+ private:
+  int *count_;
+};
+
+}  // namespace
+
+// Closes a connection once the statements on it are gone.
+class ScopedConnection {
+ public:
+  explicit ScopedConnection(sqlite3 *db) : db_(db) {}
+  ~ScopedConnection() {
+    if (db_ != NULL)
+      CHECK_EQ(SQLITE_OK, sqlite3_close(db_));
+  }
+
+ private:
+  sqlite3 *const db_;
+};
+
+// A shard attached to the hot file's connection as |alias|, or, with
+// |own_db|, opened on a connection of its own as "main"; along with its
+// queries.
+template <class Logged> class ShardedDB<Logged>::Shard {
+ public:
+  Shard(sqlite3 *db, const string &alias_name, bool own_db)
+      : connection(own_db ? db : NULL),
+        alias(alias_name),
+        select_entry("SELECT entry, hash FROM " + alias + ".leaves WHERE "
+                     "sequence = ?"),
+        select_range("SELECT sequence, entry, hash FROM " + alias +
+                     ".leaves WHERE sequence >= ? AND sequence < ? "
+                     "ORDER BY sequence"),
+        select_leaf_hashes("SELECT sequence, leaf_hash FROM " + alias +
+                           ".leaves WHERE sequence >= ? AND sequence < ? "
+                           "ORDER BY sequence"),
+        select_hashes("SELECT sequence, hash FROM " + alias + ".leaves "
+                      "WHERE sequence >= ? AND sequence < ? ORDER BY "
+                      "sequence"),
+        insert("INSERT INTO " + alias + ".leaves(sequence, hash, leaf_hash, "
+               "entry) VALUES(?, ?, ?, ?)"),
+        statements(db),
+        last_use(0),
+        readers(0) {}
+
+  static string AliasFor(uint64_t number) {
+    char alias[32];
+    snprintf(alias, sizeof(alias), "shard%" PRIu64, number);
+    return alias;
+  }
+
+  // Goes after the statements.
+  ScopedConnection connection;
+  const string alias;
+  const string select_entry;
+  const string select_range;
+  const string select_leaf_hashes;
+  const string select_hashes;
+  const string insert;
+  // Has to go before the shard is detached.
+  sqlite::StatementCache statements;
+  uint64_t last_use;
+  // Range lookups in progress, which keep the shard attached, or open.
+  int readers;
+};
+
+template <class Logged>
+ShardedDB<Logged>::ShardedDB(const string &dir, uint64_t shard_size)
+    : dir_(dir),
+      shard_size_(shard_size),
+      db_(NULL),
+      statements_(NULL),
+      shard_uses_(0) {
+  CHECK_GT(shard_size, 0U);
+  const string hot_file = dir + "/hot";
+  int ret = sqlite3_open_v2(hot_file.c_str(), &db_, SQLITE_OPEN_READWRITE,
+                            NULL);
+  if (ret == SQLITE_OK) {
+    Statement statement(db_, "SELECT shard_size FROM config");
+    CHECK_EQ(SQLITE_ROW, statement.Step());
+    CHECK_EQ(shard_size, statement.GetUInt64(0))
+        << "Database in " << dir << " has a different shard size";
+    sqlite::AddTreeSizeColumn(db_);
+    statements_ = new sqlite::StatementCache(db_);
+    return;
+  }
+  CHECK_EQ(SQLITE_CANTOPEN, ret);
+
+  // We have to close and reopen to avoid memory leaks.
+  CHECK_EQ(SQLITE_OK, sqlite3_close(db_));
+  db_ = NULL;
+
+  CHECK_EQ(SQLITE_OK,
+           sqlite3_open_v2(hot_file.c_str(), &db_,
+                           SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL));
+
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "CREATE TABLE pending(hash BLOB "
+                                   "UNIQUE, leaf_hash BLOB, entry BLOB)",
+                                   NULL, NULL, NULL));
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "CREATE TABLE hashes(hash BLOB "
+                                   "PRIMARY KEY, sequence INTEGER UNIQUE)",
+                                   NULL, NULL, NULL));
+  sqlite::CreateTreeHeadTable(db_);
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "CREATE TABLE config(shard_size "
+                                   "INTEGER)", NULL, NULL, NULL));
+  {
+    Statement statement(db_, "INSERT INTO config(shard_size) VALUES(?)");
+    statement.BindUInt64(0, shard_size);
+    CHECK_EQ(SQLITE_DONE, statement.Step());
+  }
+  statements_ = new sqlite::StatementCache(db_);
+  LOG(INFO) << "New sharded database created in " << dir;
+}
+
+template <class Logged> ShardedDB<Logged>::~ShardedDB() {
+  // Cached statements have to be finalized before the connection closes.
+  for (typename std::map<uint64_t, Shard*>::iterator it = shards_.begin();
+       it != shards_.end(); ++it)
+    delete it->second;
+  for (typename std::map<uint64_t, Shard*>::iterator it =
+           read_shards_.begin();
+       it != read_shards_.end(); ++it)
+    delete it->second;
+  delete statements_;
+  CHECK_EQ(SQLITE_OK, sqlite3_close(db_));
+}
+
+template <class Logged>
+string ShardedDB<Logged>::ShardFile(uint64_t shard) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/shard-%08" PRIu64, shard);
+  return dir_ + name;
+}
+
+template <class Logged> typename ShardedDB<Logged>::Shard *
+ShardedDB<Logged>::GetShard(uint64_t number, bool create) const {
+  typename std::map<uint64_t, Shard*>::iterator it = shards_.find(number);
+  if (it != shards_.end()) {
+    it->second->last_use = ++shard_uses_;
+    return it->second;
+  }
+
+  const string file = ShardFile(number);
+  if (!create && access(file.c_str(), F_OK) != 0)
+    return NULL;
+  // Shards can't be detached during a transaction, so it keeps the room
+  // to attach for the shards it writes to. The ones it hasn't attached
+  // don't hold anything it wrote, so they can be read on connections of
+  // their own.
+  if (!create && !sqlite3_get_autocommit(db_))
+    return GetReadShard(number);
+  if (shards_.size() == kMaxAttachedShards)
+    DetachShard();
+
+  const string alias = Shard::AliasFor(number);
+  {
+    Statement statement(db_, ("ATTACH DATABASE ? AS " + alias).c_str());
+    statement.BindText(0, file);
+    CHECK_EQ(SQLITE_DONE, statement.Step());
+  }
+  Shard *shard = new Shard(db_, alias, false);
+  // Sequence numbers are the row ids, so entries are stored in order.
+  const string create_table = "CREATE TABLE IF NOT EXISTS " + shard->alias +
+      ".leaves(sequence INTEGER PRIMARY KEY, hash BLOB, leaf_hash BLOB, "
+      "entry BLOB)";
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, create_table.c_str(), NULL, NULL,
+                                   NULL));
+  shard->last_use = ++shard_uses_;
+  shards_[number] = shard;
+  return shard;
+}
+
+template <class Logged> typename ShardedDB<Logged>::Shard *
+ShardedDB<Logged>::GetReadShard(uint64_t number) const {
+  typename std::map<uint64_t, Shard*>::iterator it =
+      read_shards_.find(number);
+  if (it != read_shards_.end()) {
+    it->second->last_use = ++shard_uses_;
+    return it->second;
+  }
+
+  if (read_shards_.size() == kMaxAttachedShards) {
+    it = LeastRecentlyUsed(&read_shards_);
+    CHECK(it != read_shards_.end()) << "All open shards are being read";
+    delete it->second;
+    read_shards_.erase(it);
+  }
+
+  sqlite3 *db;
+  CHECK_EQ(SQLITE_OK, sqlite3_open_v2(ShardFile(number).c_str(), &db,
+                                      SQLITE_OPEN_READONLY, NULL));
+  Shard *shard = new Shard(db, "main", true);
+  shard->last_use = ++shard_uses_;
+  read_shards_[number] = shard;
+  return shard;
+}
+
+// static
+template <class Logged> typename std::map<uint64_t,
+    typename ShardedDB<Logged>::Shard*>::iterator
+ShardedDB<Logged>::LeastRecentlyUsed(std::map<uint64_t, Shard*> *shards) {
+  typename std::map<uint64_t, Shard*>::iterator victim = shards->end();
+  for (typename std::map<uint64_t, Shard*>::iterator it = shards->begin();
+       it != shards->end(); ++it)
+    if (it->second->readers == 0 &&
+        (victim == shards->end() ||
+         it->second->last_use < victim->second->last_use))
+      victim = it;
+  return victim;
+}
+
+template <class Logged> void ShardedDB<Logged>::DetachShard() const {
+  typename std::map<uint64_t, Shard*>::iterator victim =
+      LeastRecentlyUsed(&shards_);
+  CHECK(victim != shards_.end()) << "All attached shards are being read";
+  CHECK(sqlite3_get_autocommit(db_))
+      << "A transaction can use at most " << kTransactionShards
+      << " new shards";
+
+  const string detach = "DETACH DATABASE " + victim->second->alias;
+  delete victim->second;
+  shards_.erase(victim);
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, detach.c_str(), NULL, NULL, NULL));
+}
+
+template <class Logged> void ShardedDB<Logged>::BeginTransaction() {
+  while (shards_.size() > kMaxAttachedShards - kTransactionShards)
+    DetachShard();
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "BEGIN;", NULL, NULL, NULL));
+}
+
+template <class Logged> void ShardedDB<Logged>::EndTransaction() {
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "COMMIT;", NULL, NULL, NULL));
+  // Shards can be attached again now, which is cheaper to keep.
+  for (typename std::map<uint64_t, Shard*>::iterator it =
+           read_shards_.begin();
+       it != read_shards_.end();) {
+    if (it->second->readers > 0) {
+      ++it;
+      continue;
+    }
+    delete it->second;
+    read_shards_.erase(it++);
+  }
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+ShardedDB<Logged>::CreatePendingEntry_(const Logged &logged) {
+  const string hash = logged.Hash();
+  if (LookupByHash(hash) == this->LOOKUP_OK)
+    return this->DUPLICATE_CERTIFICATE_HASH;
+
+  Statement statement(statements_, "INSERT INTO pending(hash, leaf_hash, "
+                      "entry) VALUES(?, ?, ?)");
+  statement.BindBlob(0, hash);
+
+  // The leaf doesn't depend on the sequence number, so hash it now while we
+  // have the entry at hand, rather than reading it back when it's logged.
+  const string leaf_hash = this->LeafHash(logged);
+  statement.BindBlob(1, leaf_hash);
+
+  string data;
+  CHECK(logged.SerializeForDatabase(&data));
+  this->CompressEntry(&data);
+  statement.BindBlob(2, data);
+
+  CHECK_EQ(SQLITE_DONE, statement.Step());
+  return this->OK;
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+ShardedDB<Logged>::AssignSequenceNumber(const string &hash,
+                                        uint64_t sequence_number) {
+  string leaf_hash, data;
+  {
+    Statement statement(statements_, "SELECT leaf_hash, entry FROM pending "
+                        "WHERE hash = ?");
+    statement.BindBlob(0, hash);
+    int ret = statement.Step();
+    if (ret == SQLITE_DONE) {
+      if (LookupByHash(hash) == this->LOOKUP_OK)
+        return this->ENTRY_ALREADY_LOGGED;
+      return this->ENTRY_NOT_FOUND;
+    }
+    CHECK_EQ(SQLITE_ROW, ret);
+    statement.GetBlob(0, &leaf_hash);
+    statement.GetBlob(1, &data);
+  }
+
+  {
+    Statement statement(statements_,
+                        "SELECT sequence FROM hashes WHERE sequence = ?");
+    statement.BindUInt64(0, sequence_number);
+    int ret = statement.Step();
+    if (ret == SQLITE_ROW)
+      return this->SEQUENCE_NUMBER_ALREADY_IN_USE;
+    CHECK_EQ(SQLITE_DONE, ret);
+  }
+
+  // Move the entry from the hot file into its shard in one go.
+  Shard *shard = GetShard(sequence_number / shard_size_, true);
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "SAVEPOINT assign_sequence_number;",
+                                   NULL, NULL, NULL));
+  {
+    Statement statement(&shard->statements, shard->insert.c_str());
+    statement.BindUInt64(0, sequence_number);
+    statement.BindBlob(1, hash);
+    statement.BindBlob(2, leaf_hash);
+    statement.BindBlob(3, data);
+    CHECK_EQ(SQLITE_DONE, statement.Step());
+  }
+  {
+    Statement statement(statements_, "INSERT INTO hashes(hash, sequence) "
+                        "VALUES(?, ?)");
+    statement.BindBlob(0, hash);
+    statement.BindUInt64(1, sequence_number);
+    CHECK_EQ(SQLITE_DONE, statement.Step());
+  }
+  {
+    Statement statement(statements_, "DELETE FROM pending WHERE hash = ?");
+    statement.BindBlob(0, hash);
+    CHECK_EQ(SQLITE_DONE, statement.Step());
+  }
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "RELEASE assign_sequence_number;",
+                                   NULL, NULL, NULL));
+  return this->OK;
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+ShardedDB<Logged>::AssignSequenceNumbers(const std::vector<string> &hashes,
+                                         uint64_t first_sequence_number,
+                                         size_t *assigned) {
+  // Shards can't be attached and detached in the middle of a transaction,
+  // so attach the ones the batch goes into first, while we still can.
+  if (!hashes.empty()) {
+    const uint64_t last_shard =
+        (first_sequence_number + hashes.size() - 1) / shard_size_;
+    for (uint64_t shard = first_sequence_number / shard_size_;
+         shard <= last_shard; ++shard)
+      GetShard(shard, true);
+  }
+
+  // As in SQLiteDB, a savepoint also works inside BeginTransaction(), and
+  // entries assigned before a failure are kept.
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "SAVEPOINT assign_sequence_numbers;",
+                                   NULL, NULL, NULL));
+  WriteResult result = Database<Logged>::AssignSequenceNumbers(
+      hashes, first_sequence_number, assigned);
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "RELEASE assign_sequence_numbers;",
+                                   NULL, NULL, NULL));
+  return result;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ShardedDB<Logged>::LookupByHash(const string &hash) const {
+  {
+    Statement statement(statements_,
+                        "SELECT sequence FROM hashes WHERE hash = ?");
+    statement.BindBlob(0, hash);
+    int ret = statement.Step();
+    if (ret == SQLITE_ROW)
+      return this->LOOKUP_OK;
+    CHECK_EQ(SQLITE_DONE, ret);
+  }
+
+  Statement statement(statements_, "SELECT hash FROM pending WHERE hash = ?");
+  statement.BindBlob(0, hash);
+  int ret = statement.Step();
+  if (ret == SQLITE_DONE)
+    return this->NOT_FOUND;
+  CHECK_EQ(SQLITE_ROW, ret);
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ShardedDB<Logged>::LookupByHash(const string &hash, Logged *result) const {
+  CHECK_NOTNULL(result);
+  {
+    Statement statement(statements_,
+                        "SELECT sequence FROM hashes WHERE hash = ?");
+    statement.BindBlob(0, hash);
+    int ret = statement.Step();
+    if (ret == SQLITE_ROW) {
+      CHECK_EQ(this->LOOKUP_OK,
+               LookupByIndex(statement.GetUInt64(0), result))
+          << "Indexed entry missing from its shard";
+      return this->LOOKUP_OK;
+    }
+    CHECK_EQ(SQLITE_DONE, ret);
+  }
+
+  Statement statement(statements_, "SELECT entry FROM pending WHERE hash = ?");
+  statement.BindBlob(0, hash);
+  int ret = statement.Step();
+  if (ret == SQLITE_DONE)
+    return this->NOT_FOUND;
+  CHECK_EQ(SQLITE_ROW, ret);
+
+  string data;
+  statement.GetBlob(0, &data);
+  CHECK(this->DecompressEntry(&data));
+  CHECK(result->ParseFromDatabase(data));
+  result->clear_sequence_number();
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ShardedDB<Logged>::LookupByIndex(uint64_t sequence_number,
+                                 Logged *result) const {
+  CHECK_NOTNULL(result);
+  Shard *shard = GetShard(sequence_number / shard_size_, false);
+  if (shard == NULL)
+    return this->NOT_FOUND;
+
+  Statement statement(&shard->statements, shard->select_entry.c_str());
+  statement.BindUInt64(0, sequence_number);
+  int ret = statement.Step();
+  if (ret == SQLITE_DONE)
+    return this->NOT_FOUND;
+  CHECK_EQ(SQLITE_ROW, ret);
+
+  string data;
+  statement.GetBlob(0, &data);
+  CHECK(this->DecompressEntry(&data));
+  CHECK(result->ParseFromDatabase(data));
+
+  string hash;
+  statement.GetBlob(1, &hash);
+  CHECK_EQ(result->Hash(), hash);
+
+  result->set_sequence_number(sequence_number);
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ShardedDB<Logged>::LookupByIndexRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::EntryCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  uint64_t next = start;
+  while (next < end) {
+    const uint64_t number = next / shard_size_;
+    Shard *shard = GetShard(number, false);
+    if (shard == NULL)
+      return this->NOT_FOUND;
+    // The callback may look up other shards; this one has to stay.
+    ScopedCount reading(&shard->readers);
+    const uint64_t shard_end = std::min(end, (number + 1) * shard_size_);
+
+    Statement statement(&shard->statements, shard->select_range.c_str());
+    statement.BindUInt64(0, next);
+    statement.BindUInt64(1, shard_end);
+    int ret;
+    while ((ret = statement.Step()) == SQLITE_ROW) {
+      // Sequence numbers are unique, so a gap shows up as a skipped one.
+      if (statement.GetUInt64(0) != next)
+        return this->NOT_FOUND;
+
+      string data;
+      statement.GetBlob(1, &data);
+      Logged logged;
+      CHECK(this->DecompressEntry(&data));
+      CHECK(logged.ParseFromDatabase(data));
+
+      string hash;
+      statement.GetBlob(2, &hash);
+      CHECK_EQ(logged.Hash(), hash);
+
+      logged.set_sequence_number(next++);
+      if (!callback->Entry(logged))
+        return this->LOOKUP_OK;
+    }
+    CHECK_EQ(SQLITE_DONE, ret);
+    if (next != shard_end)
+      return this->NOT_FOUND;
+  }
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ShardedDB<Logged>::LookupLeafHashRange(uint64_t start, uint64_t end,
+                                       std::vector<string> *hashes) const {
+  CHECK_NOTNULL(hashes);
+  if (start >= end)
+    return this->LOOKUP_OK;
+
+  std::vector<string> range;
+  range.reserve(end - start);
+  while (start + range.size() < end) {
+    const uint64_t next = start + range.size();
+    const uint64_t number = next / shard_size_;
+    Shard *shard = GetShard(number, false);
+    if (shard == NULL)
+      return this->NOT_FOUND;
+    const uint64_t shard_end = std::min(end, (number + 1) * shard_size_);
+
+    Statement statement(&shard->statements,
+                        shard->select_leaf_hashes.c_str());
+    statement.BindUInt64(0, next);
+    statement.BindUInt64(1, shard_end);
+    int ret;
+    while ((ret = statement.Step()) == SQLITE_ROW) {
+      // Sequence numbers are unique, so a gap shows up as a skipped one.
+      if (statement.GetUInt64(0) != start + range.size())
+        return this->NOT_FOUND;
+      range.push_back(string());
+      statement.GetBlob(1, &range.back());
+    }
+    CHECK_EQ(SQLITE_DONE, ret);
+    if (start + range.size() != shard_end)
+      return this->NOT_FOUND;
+  }
+
+  hashes->insert(hashes->end(), range.begin(), range.end());
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ShardedDB<Logged>::LookupEntryHashRange(uint64_t start, uint64_t end,
+                                        std::vector<string> *hashes) const {
+  CHECK_NOTNULL(hashes);
+  uint64_t next = start;
+  while (next < end) {
+    const uint64_t number = next / shard_size_;
+    Shard *shard = GetShard(number, false);
+    if (shard == NULL)
+      return this->NOT_FOUND;
+    const uint64_t shard_end = std::min(end, (number + 1) * shard_size_);
+
+    Statement statement(&shard->statements, shard->select_hashes.c_str());
+    statement.BindUInt64(0, next);
+    statement.BindUInt64(1, shard_end);
+    int ret;
+    while ((ret = statement.Step()) == SQLITE_ROW) {
+      // Sequence numbers are unique, so a gap shows up as a skipped one.
+      if (statement.GetUInt64(0) != next)
+        return this->NOT_FOUND;
+      hashes->push_back(string());
+      statement.GetBlob(1, &hashes->back());
+      ++next;
+    }
+    CHECK_EQ(SQLITE_DONE, ret);
+    if (next != shard_end)
+      return this->NOT_FOUND;
+  }
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> std::set<string>
+ShardedDB<Logged>::PendingHashes() const {
+  std::set<string> hashes;
+  Statement statement(statements_, "SELECT hash FROM pending");
+
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    string hash;
+    statement.GetBlob(0, &hash);
+    hashes.insert(hash);
+  }
+  CHECK_EQ(SQLITE_DONE, ret);
+
+  return hashes;
+}
+
+template <class Logged> void
+ShardedDB<Logged>::LookupPendingEntries(
+    size_t limit, typename Database<Logged>::EntryCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  Statement statement(statements_, "SELECT entry, hash FROM pending "
+                      "ORDER BY rowid LIMIT ?");
+  statement.BindUInt64(0, limit > 0 ? limit
+                          : std::numeric_limits<sqlite3_int64>::max());
+
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    string data;
+    statement.GetBlob(0, &data);
+    Logged logged;
+    CHECK(this->DecompressEntry(&data));
+    CHECK(logged.ParseFromDatabase(data));
+
+    string hash;
+    statement.GetBlob(1, &hash);
+    CHECK_EQ(logged.Hash(), hash);
+
+    if (!callback->Entry(logged))
+      return;
+  }
+  CHECK_EQ(SQLITE_DONE, ret);
+}
+
+template <class Logged> typename Database<Logged>::WriteResult
+ShardedDB<Logged>::WriteTreeHead_(const ct::SignedTreeHead &sth) {
+  if (!sqlite::InsertTreeHead(statements_, sth))
+    return this->DUPLICATE_TREE_HEAD_TIMESTAMP;
+  return this->OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ShardedDB<Logged>::LatestTreeHead(ct::SignedTreeHead *result) const {
+  Statement statement(statements_, "SELECT sth FROM trees WHERE timestamp IN "
+                      "(SELECT MAX(timestamp) FROM trees)");
+
+  int ret = statement.Step();
+  if (ret == SQLITE_DONE)
+    return this->NOT_FOUND;
+  CHECK_EQ(SQLITE_ROW, ret);
+
+  string sth;
+  statement.GetBlob(0, &sth);
+  CHECK(result->ParseFromString(sth));
+
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ShardedDB<Logged>::LookupTreeHeadByTimestamp(
+    uint64_t timestamp, ct::SignedTreeHead *result) const {
+  return sqlite::LookupTreeHeadByTimestamp(statements_, timestamp, result)
+      ? this->LOOKUP_OK : this->NOT_FOUND;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+ShardedDB<Logged>::LookupTreeHeadBySize(
+    uint64_t tree_size, ct::SignedTreeHead *result) const {
+  return sqlite::LookupTreeHeadBySize(statements_, tree_size, result)
+      ? this->LOOKUP_OK : this->NOT_FOUND;
+}
+
+template <class Logged> void ShardedDB<Logged>::LookupTreeHeadRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::TreeHeadCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  sqlite::LookupTreeHeadRange(statements_, start, end, callback);
+}
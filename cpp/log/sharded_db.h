@@ -0,0 +1,131 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+
+#ifndef SHARDED_DB_H
+#define SHARDED_DB_H
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/database.h"
+
+struct sqlite3;
+
+namespace sqlite {
+class StatementCache;
+}  // namespace sqlite
+
+// A database that splits the log into SQLite files, so that no single file
+// grows with the log. Sequenced entries go into shards by sequence number:
+// shard k holds entries k * shard_size to (k + 1) * shard_size - 1. Once
+// the log has moved past it, a shard never changes again, and can be
+// backed up or cached as is. A small hot file holds the pending entries, the
+// tree heads, and an index from entry hash to sequence number, through
+// which lookups by hash find their shard.
+//
+// Shards are attached to the hot file's connection as they are needed, so
+// that logging an entry moves it from the hot file into its shard
+// atomically. SQLite limits how many files a connection can attach, so
+// shards that haven't been used recently are detached again. A single
+// transaction can only write to a few shards; its lookups read the shards
+// it hasn't attached on connections of their own.
+template <class Logged> class ShardedDB : public Database<Logged> {
+ public:
+  // Keeps its files in the existing directory |dir|. |shard_size| must be
+  // the same every time the directory is opened.
+  ShardedDB(const std::string &dir, uint64_t shard_size);
+
+  ~ShardedDB();
+
+  typedef typename Database<Logged>::WriteResult WriteResult;
+  typedef typename Database<Logged>::LookupResult LookupResult;
+
+  virtual bool Transactional() const { return true; }
+
+  void BeginTransaction();
+
+  void EndTransaction();
+
+  virtual WriteResult CreatePendingEntry_(const Logged &logged);
+
+  virtual WriteResult AssignSequenceNumber(const std::string &pending_hash,
+                                           uint64_t sequence_number);
+
+  // Assigns the whole batch in one transaction (nested in the current one,
+  // if any), so that it is synced to disk once.
+  virtual WriteResult AssignSequenceNumbers(
+      const std::vector<std::string> &pending_hashes,
+      uint64_t first_sequence_number, size_t *assigned);
+
+  virtual LookupResult LookupByHash(const std::string &hash) const;
+
+  virtual LookupResult LookupByHash(const std::string &hash,
+                                    Logged *result) const;
+
+  virtual LookupResult LookupByIndex(uint64_t sequence_number,
+                                     Logged *result) const;
+
+  virtual LookupResult LookupByIndexRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual LookupResult LookupLeafHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual LookupResult LookupEntryHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual std::set<std::string> PendingHashes() const;
+
+  // Returns entries in creation order, which is the order the frontend
+  // timestamped them in.
+  virtual void LookupPendingEntries(
+      size_t limit, typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual WriteResult WriteTreeHead_(const ct::SignedTreeHead &sth);
+
+  virtual LookupResult LatestTreeHead(ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadBySize(
+      uint64_t tree_size, ct::SignedTreeHead *result) const;
+
+  virtual void LookupTreeHeadRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::TreeHeadCallback *callback) const;
+
+  // The file that holds shard |shard|.
+  std::string ShardFile(uint64_t shard) const;
+
+ private:
+  class Shard;
+
+  // The attached shard |shard|, or NULL if its file doesn't exist and
+  // |create| is false.
+  Shard *GetShard(uint64_t shard, bool create) const;
+  // Shard |shard|, which exists, opened read-only on its own connection.
+  Shard *GetReadShard(uint64_t shard) const;
+  // The least recently used shard of |shards| that nobody reads, or end().
+  static typename std::map<uint64_t, Shard*>::iterator LeastRecentlyUsed(
+      std::map<uint64_t, Shard*> *shards);
+  // Detach the least recently used shard that nobody reads.
+  void DetachShard() const;
+
+  const std::string dir_;
+  const uint64_t shard_size_;
+  sqlite3 *db_;
+  // Prepared statements on the hot file, reused across calls.
+  sqlite::StatementCache *statements_;
+  // Attached shards, by number. Lookups are const, but attach shards.
+  mutable std::map<uint64_t, Shard*> shards_;
+  // Shards open on their own connections, by number, for lookups during a
+  // transaction; closed when it ends.
+  mutable std::map<uint64_t, Shard*> read_shards_;
+  // Counts shard uses, to find the least recently used one.
+  mutable uint64_t shard_uses_;
+};
+
+#endif
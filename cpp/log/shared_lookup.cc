@@ -0,0 +1,299 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/shared_lookup.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+
+#include "merkletree/merkle_tree.h"
+#include "proto/ct.pb.h"
+
+using ct::SignedTreeHead;
+using std::string;
+
+namespace {
+
+const uint64_t kMagic = 0x6374736c6f6f6b31ULL;  // "ctslook1"
+const size_t kNodeSize = Sha256Hasher::kDigestLength;
+// The header takes the first two pages.
+const size_t kHeaderSize = 8192;
+const size_t kMaxTreeHeadSize = 4096;
+
+struct Header {
+  uint64_t magic;
+  // A power of two.
+  uint64_t max_leaves;
+  // Of the leaf index, twice |max_leaves|.
+  uint64_t num_slots;
+  // The seqlock over the rest; 0 until something is published.
+  volatile uint64_t generation;
+  volatile uint64_t tree_size;
+  volatile uint64_t tree_head_size;
+  volatile char tree_head[kMaxTreeHeadSize];
+};
+
+// The smallest power of two that is at least |n|.
+uint64_t PowerOfTwoAtLeast(uint64_t n) {
+  uint64_t power = 1;
+  while (power < n)
+    power <<= 1;
+  return power;
+}
+
+// The first 8 bytes of |leaf_hash| pick the slot, as in LeafIndex.
+uint64_t Bucket(const char *leaf_hash) {
+  uint64_t bucket = 0;
+  for (size_t i = 0; i < 8; ++i)
+    bucket = (bucket << 8) | static_cast<unsigned char>(leaf_hash[i]);
+  return bucket;
+}
+
+}  // namespace
+
+// The layout of a mapped file: the header, then each level of complete
+// subtree roots with room for all of them, leaves first, then the slots of
+// the leaf index, each holding a leaf index plus one, or 0.
+class SharedLookupMapping {
+ public:
+  // Takes ownership of |fd|.
+  SharedLookupMapping(int fd, size_t size, bool writable)
+      : fd_(fd),
+        size_(size),
+        base_(NULL) {
+    void *map = mmap(NULL, size_, writable ? PROT_READ | PROT_WRITE :
+                     PROT_READ, MAP_SHARED, fd_, 0);
+    PCHECK(map != MAP_FAILED) << "Failed to map the shared lookup";
+    base_ = static_cast<char*>(map);
+  }
+
+  ~SharedLookupMapping() {
+    PCHECK(munmap(base_, size_) == 0);
+    PCHECK(close(fd_) == 0);
+  }
+
+  static size_t FileSize(uint64_t max_leaves) {
+    return kHeaderSize + (2 * max_leaves - 1) * kNodeSize +
+        2 * max_leaves * sizeof(uint64_t);
+  }
+
+  // Only once the header is filled in.
+  void Init() {
+    const uint64_t max_leaves = header()->max_leaves;
+    CHECK_EQ(FileSize(max_leaves), size_);
+    size_t offset = kHeaderSize;
+    for (uint64_t nodes = max_leaves; nodes > 0; nodes >>= 1) {
+      level_offsets_.push_back(offset);
+      offset += nodes * kNodeSize;
+    }
+    slots_offset_ = offset;
+  }
+
+  Header *header() const { return reinterpret_cast<Header*>(base_); }
+
+  char *Node(size_t level, uint64_t index) const {
+    return base_ + level_offsets_[level] + index * kNodeSize;
+  }
+
+  volatile uint64_t *slots() const {
+    return reinterpret_cast<volatile uint64_t*>(base_ + slots_offset_);
+  }
+
+ private:
+  const int fd_;
+  const size_t size_;
+  char *base_;
+  std::vector<size_t> level_offsets_;
+  size_t slots_offset_;
+};
+
+SharedLookupWriter::SharedLookupWriter(const string &path, size_t max_leaves)
+    : path_(path),
+      mapping_(NULL),
+      published_(0) {
+  CHECK_GT(max_leaves, 0U);
+  const uint64_t leaves = PowerOfTwoAtLeast(max_leaves);
+  // Readers may have the old file mapped, so it is replaced, not reused.
+  const string tmp_path = path_ + ".tmp";
+  int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  PCHECK(fd >= 0) << "Failed to create " << tmp_path;
+  const size_t size = SharedLookupMapping::FileSize(leaves);
+  PCHECK(ftruncate(fd, size) == 0) << "Failed to size " << tmp_path;
+  mapping_ = new SharedLookupMapping(fd, size, true);
+  Header *header = mapping_->header();
+  header->max_leaves = leaves;
+  header->num_slots = 2 * leaves;
+  header->generation = 0;
+  mapping_->Init();
+  __sync_synchronize();
+  header->magic = kMagic;
+  PCHECK(rename(tmp_path.c_str(), path_.c_str()) == 0)
+      << "Failed to rename " << tmp_path << " to " << path_;
+}
+
+SharedLookupWriter::~SharedLookupWriter() {
+  delete mapping_;
+}
+
+bool SharedLookupWriter::Publish(const MerkleTree &tree,
+                                 const SignedTreeHead &sth) {
+  const uint64_t size = sth.tree_size();
+  CHECK_EQ(size, tree.LeafCount());
+  CHECK_GE(size, published_);
+  Header *header = mapping_->header();
+  if (size > header->max_leaves) {
+    LOG(WARNING) << "The tree has outgrown " << path_
+                 << "; it is no longer published";
+    return false;
+  }
+  string serialized;
+  CHECK(sth.SerializeToString(&serialized));
+  CHECK_LE(serialized.size(), kMaxTreeHeadSize);
+
+  // The new roots of complete subtrees, at every level.
+  for (size_t level = 0; (size >> level) > 0; ++level) {
+    const uint64_t begin = published_ >> level;
+    tree.CopyNodes(level, begin, size >> level, mapping_->Node(level, begin));
+  }
+
+  volatile uint64_t *slots = mapping_->slots();
+  const uint64_t mask = header->num_slots - 1;
+  for (uint64_t index = published_; index < size; ++index) {
+    const char *leaf_hash = mapping_->Node(0, index);
+    uint64_t slot = Bucket(leaf_hash) & mask;
+    for (; slots[slot] != 0; slot = (slot + 1) & mask) {
+      if (memcmp(mapping_->Node(0, slots[slot] - 1), leaf_hash,
+                 kNodeSize) == 0)
+        break;
+    }
+    // Keep the first occurrence of a duplicate.
+    if (slots[slot] == 0)
+      slots[slot] = index + 1;
+  }
+
+  // The nodes and slots are in place before the size says so.
+  __sync_synchronize();
+  header->generation = header->generation + 1;
+  __sync_synchronize();
+  header->tree_size = size;
+  header->tree_head_size = serialized.size();
+  for (size_t i = 0; i < serialized.size(); ++i)
+    header->tree_head[i] = serialized[i];
+  __sync_synchronize();
+  header->generation = header->generation + 1;
+  published_ = size;
+  return true;
+}
+
+SharedLookupReader::SharedLookupReader(const string &path,
+                                       SharedLookupMapping *mapping,
+                                       dev_t device, ino_t inode)
+    : path_(path),
+      mapping_(mapping),
+      device_(device),
+      inode_(inode),
+      proofs_(mapping) {}
+
+SharedLookupReader::~SharedLookupReader() {
+  delete mapping_;
+}
+
+// static
+SharedLookupReader *SharedLookupReader::Open(const string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  PCHECK(fstat(fd, &st) == 0) << "Failed to stat " << path;
+  if (static_cast<size_t>(st.st_size) < kHeaderSize) {
+    close(fd);
+    return NULL;
+  }
+  SharedLookupMapping *mapping = new SharedLookupMapping(fd, st.st_size,
+                                                         false);
+  const Header *header = mapping->header();
+  if (header->magic != kMagic || header->generation == 0) {
+    delete mapping;
+    return NULL;
+  }
+  __sync_synchronize();
+  mapping->Init();
+  return new SharedLookupReader(path, mapping, st.st_dev, st.st_ino);
+}
+
+SignedTreeHead SharedLookupReader::LatestTreeHead() const {
+  const Header *header = mapping_->header();
+  string serialized;
+  for (;;) {
+    const uint64_t generation = header->generation;
+    if (generation % 2 == 0) {
+      __sync_synchronize();
+      const size_t size = header->tree_head_size;
+      serialized.resize(size <= kMaxTreeHeadSize ? size : 0);
+      for (size_t i = 0; i < serialized.size(); ++i)
+        serialized[i] = header->tree_head[i];
+      __sync_synchronize();
+      if (header->generation == generation)
+        break;
+    }
+    usleep(10);
+  }
+  SignedTreeHead sth;
+  CHECK(sth.ParseFromString(serialized)) << "Bad tree head in " << path_;
+  return sth;
+}
+
+bool SharedLookupReader::Replaced() const {
+  struct stat st;
+  // The publisher replaces the file by renaming over it, so it is always
+  // there once it has been.
+  if (stat(path_.c_str(), &st) != 0)
+    return false;
+  return st.st_dev != device_ || st.st_ino != inode_;
+}
+
+string SharedLookupReader::RootAtSnapshot(uint64_t tree_size) const {
+  CHECK_LE(tree_size, mapping_->header()->tree_size);
+  return proofs_.Root(tree_size);
+}
+
+bool SharedLookupReader::Find(const string &leaf_hash, uint64_t tree_size,
+                              uint64_t *index) const {
+  if (leaf_hash.size() != kNodeSize)
+    return false;
+  const volatile uint64_t *slots = mapping_->slots();
+  const uint64_t mask = mapping_->header()->num_slots - 1;
+  // Slots past |tree_size| may be in use already; they are someone else's.
+  for (uint64_t slot = Bucket(leaf_hash.data()) & mask; slots[slot] != 0;
+       slot = (slot + 1) & mask) {
+    const uint64_t position = slots[slot] - 1;
+    if (position < tree_size &&
+        memcmp(mapping_->Node(0, position), leaf_hash.data(),
+               kNodeSize) == 0) {
+      *index = position;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<string> SharedLookupReader::PathToRootAtSnapshot(
+    uint64_t leaf, uint64_t snapshot) const {
+  if (snapshot > mapping_->header()->tree_size)
+    return std::vector<string>();
+  return proofs_.PathToRootAtSnapshot(leaf, snapshot);
+}
+
+std::vector<string> SharedLookupReader::SnapshotConsistency(
+    uint64_t snapshot1, uint64_t snapshot2) const {
+  if (snapshot2 > mapping_->header()->tree_size)
+    return std::vector<string>();
+  return proofs_.SnapshotConsistency(snapshot1, snapshot2);
+}
@@ -0,0 +1,101 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef SHARED_LOOKUP_H
+#define SHARED_LOOKUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "merkletree/subtree_proofs.h"
+#include "proto/ct.pb.h"
+
+class MerkleTree;
+class SharedLookupMapping;
+
+// What a LogLookup serves proofs from, kept in a file that is mapped into
+// memory, so that the processes on one host that serve the same log can
+// share one copy: one of them builds the tree and publishes it, and the
+// others attach to the file read-only rather than build their own. Put
+// the file on tmpfs (e.g. /dev/shm) to keep it out of the disk's way.
+//
+// The file holds the root of every complete subtree, level by level; the
+// other nodes of a tree head's tree are hashed from those when asked for,
+// which takes at most one hash per level. It also has a hash -> index table
+// of the leaves, and the latest tree head, behind a seqlock: the publisher
+// makes the generation odd while it writes them, and readers retry if it
+// was odd or changed while they read. Nodes and leaves are only ever
+// added, so those below the tree head's size never change.
+//
+// The file is sized up front for a maximum number of leaves. It is sparse,
+// so only the part in use takes memory.
+
+// The publishing side. Only one process may publish to a file.
+class SharedLookupWriter {
+ public:
+  // Replaces |path| with an empty file for trees of up to |max_leaves|
+  // leaves of SHA-256 hashes. Processes attached to the old file keep
+  // serving from it until they notice. Aborts on any IO error.
+  SharedLookupWriter(const std::string &path, size_t max_leaves);
+  ~SharedLookupWriter();
+
+  // Publish |tree| as of |sth|. |tree| must be the tree of |sth|, fully
+  // evaluated, and grow from what was published before. Returns false, and
+  // publishes nothing, if the tree has outgrown the file.
+  bool Publish(const MerkleTree &tree, const ct::SignedTreeHead &sth);
+
+ private:
+  const std::string path_;
+  SharedLookupMapping *mapping_;
+  // The tree size published so far.
+  uint64_t published_;
+};
+
+// The attached side. Thread-safe.
+class SharedLookupReader {
+ public:
+  ~SharedLookupReader();
+
+  // Maps |path| read-only. Returns NULL if there is no such file, or if
+  // nobody has started publishing to it yet.
+  static SharedLookupReader *Open(const std::string &path);
+
+  // The latest tree head published, or an empty one.
+  ct::SignedTreeHead LatestTreeHead() const;
+
+  // Whether the file has been replaced by a new publisher since it was
+  // opened, and the tree should be looked for in a new one.
+  bool Replaced() const;
+
+  // The root of the tree of the first |tree_size| leaves, which must have
+  // been published.
+  std::string RootAtSnapshot(uint64_t tree_size) const;
+
+  // Find a leaf of the tree of the first |tree_size| leaves by its hash;
+  // returns false if there is none. If a leaf hash occurs more than once,
+  // the first occurrence wins.
+  bool Find(const std::string &leaf_hash, uint64_t tree_size,
+            uint64_t *index) const;
+
+  // As the MerkleTree methods of the same name, for trees that have been
+  // published: |leaf| is indexed from 1, and the same queries come back
+  // empty.
+  std::vector<std::string> PathToRootAtSnapshot(uint64_t leaf,
+                                                uint64_t snapshot) const;
+  std::vector<std::string> SnapshotConsistency(uint64_t snapshot1,
+                                               uint64_t snapshot2) const;
+
+ private:
+  SharedLookupReader(const std::string &path, SharedLookupMapping *mapping,
+                     dev_t device, ino_t inode);
+
+  const std::string path_;
+  SharedLookupMapping *const mapping_;
+  // Of the file when it was opened.
+  const dev_t device_;
+  const ino_t inode_;
+  const SubtreeProofs<SharedLookupMapping> proofs_;
+};
+
+#endif  // SHARED_LOOKUP_H
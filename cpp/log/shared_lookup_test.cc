@@ -0,0 +1,157 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/shared_lookup.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/ct.pb.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace {
+
+using ct::SignedTreeHead;
+using std::string;
+
+class SharedLookupTest : public ::testing::Test {
+ protected:
+  SharedLookupTest()
+      : tmp_(),
+        path_(tmp_.TmpStorageDir() + "/lookup"),
+        tree_(new Sha256Hasher()) {}
+
+  // Grow the tree to |size| leaves, and return its tree head.
+  SignedTreeHead Grow(size_t size) {
+    while (tree_.LeafCount() < size) {
+      string leaf(1, static_cast<char>(tree_.LeafCount()));
+      leaf.append(1, static_cast<char>(tree_.LeafCount() >> 8));
+      tree_.AddLeaf(leaf);
+    }
+    SignedTreeHead sth;
+    sth.set_version(ct::V1);
+    sth.set_timestamp(1000 + size);
+    sth.set_tree_size(size);
+    sth.set_sha256_root_hash(tree_.CurrentRoot());
+    return sth;
+  }
+
+  TmpStorage tmp_;
+  string path_;
+  MerkleTree tree_;
+};
+
+TEST_F(SharedLookupTest, NotPublished) {
+  EXPECT_TRUE(SharedLookupReader::Open(path_) == NULL);
+  SharedLookupWriter writer(path_, 16);
+  EXPECT_TRUE(SharedLookupReader::Open(path_) == NULL);
+
+  EXPECT_TRUE(writer.Publish(tree_, Grow(0)));
+  SharedLookupReader *reader = SharedLookupReader::Open(path_);
+  ASSERT_TRUE(reader != NULL);
+  EXPECT_EQ(0U, reader->LatestTreeHead().tree_size());
+  EXPECT_EQ(tree_.CurrentRoot(), reader->RootAtSnapshot(0));
+  delete reader;
+}
+
+TEST_F(SharedLookupTest, Proofs) {
+  SharedLookupWriter writer(path_, 40);
+  // Grow in uneven steps, so that every level's last node changes.
+  const size_t sizes[] = { 1, 2, 5, 11, 16, 17, 30 };
+  SharedLookupReader *reader = NULL;
+  for (size_t s = 0; s < sizeof sizes / sizeof sizes[0]; ++s) {
+    const SignedTreeHead sth = Grow(sizes[s]);
+    ASSERT_TRUE(writer.Publish(tree_, sth));
+    if (reader == NULL)
+      reader = SharedLookupReader::Open(path_);
+    ASSERT_TRUE(reader != NULL);
+    EXPECT_EQ(sth.SerializeAsString(),
+              reader->LatestTreeHead().SerializeAsString());
+
+    // Every tree published so far.
+    for (size_t size = 1; size <= sizes[s]; ++size) {
+      EXPECT_EQ(tree_.RootAtSnapshot(size), reader->RootAtSnapshot(size));
+      for (size_t leaf = 1; leaf <= size; ++leaf)
+        EXPECT_EQ(tree_.PathToRootAtSnapshot(leaf, size),
+                  reader->PathToRootAtSnapshot(leaf, size))
+            << leaf << " " << size;
+      for (size_t first = 1; first < size; ++first)
+        EXPECT_EQ(tree_.SnapshotConsistency(first, size),
+                  reader->SnapshotConsistency(first, size))
+            << first << " " << size;
+    }
+  }
+
+  // The same queries come back empty.
+  EXPECT_TRUE(reader->PathToRootAtSnapshot(0, 30).empty());
+  EXPECT_TRUE(reader->PathToRootAtSnapshot(5, 4).empty());
+  EXPECT_TRUE(reader->PathToRootAtSnapshot(5, 31).empty());
+  EXPECT_TRUE(reader->SnapshotConsistency(0, 30).empty());
+  EXPECT_TRUE(reader->SnapshotConsistency(30, 30).empty());
+  EXPECT_TRUE(reader->SnapshotConsistency(3, 31).empty());
+  delete reader;
+}
+
+TEST_F(SharedLookupTest, Find) {
+  SharedLookupWriter writer(path_, 64);
+  const SignedTreeHead sth = Grow(20);
+  // A duplicate keeps the first index.
+  tree_.AddLeafHash(tree_.LeafHash(3));
+  SignedTreeHead sth21 = sth;
+  sth21.set_tree_size(21);
+  sth21.set_sha256_root_hash(tree_.CurrentRoot());
+  ASSERT_TRUE(writer.Publish(tree_, sth21));
+  SharedLookupReader *reader = SharedLookupReader::Open(path_);
+  ASSERT_TRUE(reader != NULL);
+
+  uint64_t index;
+  for (size_t i = 0; i < 20; ++i) {
+    ASSERT_TRUE(reader->Find(tree_.LeafHash(i + 1), 21, &index));
+    EXPECT_EQ(i, index);
+  }
+  // Not in the smaller tree.
+  EXPECT_FALSE(reader->Find(tree_.LeafHash(11), 10, &index));
+  EXPECT_FALSE(reader->Find(string(32, 'x'), 21, &index));
+  EXPECT_FALSE(reader->Find("short", 21, &index));
+  delete reader;
+}
+
+TEST_F(SharedLookupTest, Outgrown) {
+  SharedLookupWriter writer(path_, 4);
+  ASSERT_TRUE(writer.Publish(tree_, Grow(4)));
+  EXPECT_FALSE(writer.Publish(tree_, Grow(5)));
+  SharedLookupReader *reader = SharedLookupReader::Open(path_);
+  ASSERT_TRUE(reader != NULL);
+  EXPECT_EQ(4U, reader->LatestTreeHead().tree_size());
+  delete reader;
+}
+
+TEST_F(SharedLookupTest, Replaced) {
+  SharedLookupWriter *writer = new SharedLookupWriter(path_, 16);
+  ASSERT_TRUE(writer->Publish(tree_, Grow(7)));
+  SharedLookupReader *reader = SharedLookupReader::Open(path_);
+  ASSERT_TRUE(reader != NULL);
+  EXPECT_FALSE(reader->Replaced());
+  delete writer;
+
+  // The old file stays readable.
+  writer = new SharedLookupWriter(path_, 16);
+  EXPECT_TRUE(reader->Replaced());
+  EXPECT_EQ(7U, reader->LatestTreeHead().tree_size());
+  EXPECT_EQ(tree_.PathToRootAtSnapshot(2, 7),
+            reader->PathToRootAtSnapshot(2, 7));
+  EXPECT_TRUE(SharedLookupReader::Open(path_) == NULL);
+  delete reader;
+  delete writer;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
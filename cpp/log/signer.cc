@@ -2,8 +2,11 @@
 #include "log/signer.h"
 
 #include <glog/logging.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
 #include <openssl/evp.h>
 #include <openssl/opensslv.h>
+#include <openssl/sha.h>
 #include <stdint.h>
 
 #include "log/verifier.h"
@@ -17,11 +20,15 @@
 namespace ct {
 
 Signer::Signer(EVP_PKEY *pkey)
-    : pkey_(CHECK_NOTNULL(pkey)) {
+    : pkey_(CHECK_NOTNULL(pkey)),
+      ec_key_(NULL) {
   switch (pkey_->type) {
     case EVP_PKEY_EC:
       hash_algo_ = DigitallySigned::SHA256;
       sig_algo_ = DigitallySigned::ECDSA;
+      ec_key_ = CHECK_NOTNULL(EVP_PKEY_get1_EC_KEY(pkey_));
+      // Multiples of the generator, which every signature needs.
+      CHECK_EQ(1, EC_KEY_precompute_mult(ec_key_, NULL));
       break;
     default:
       LOG(FATAL) << "Unsupported key type " << pkey_->type;
@@ -30,6 +37,7 @@ Signer::Signer(EVP_PKEY *pkey)
 }
 
 Signer::~Signer() {
+  EC_KEY_free(ec_key_);
   EVP_PKEY_free(pkey_);
 }
 
@@ -44,23 +52,30 @@ void Signer::Sign(const std::string &data,
   signature->set_signature(RawSign(data));
 }
 
+void Signer::SignAsync(const std::string &data,
+                       SignatureCallback *callback) const {
+  DigitallySigned signature;
+  Sign(data, &signature);
+  callback->Signed(signature);
+}
+
 Signer::Signer()
     : pkey_(NULL),
+      ec_key_(NULL),
       hash_algo_(DigitallySigned::NONE),
       sig_algo_(DigitallySigned::ANONYMOUS) {}
 
+// What EVP_SignFinal() does for an EC key, without setting up a digest
+// and key context for every signature.
 std::string Signer::RawSign(const std::string &data) const {
-  EVP_MD_CTX ctx;
-  EVP_MD_CTX_init(&ctx);
-  // NOTE: this syntax for setting the hash function requires OpenSSL >= 1.0.0.
-  CHECK_EQ(1, EVP_SignInit(&ctx, EVP_sha256()));
-  CHECK_EQ(1, EVP_SignUpdate(&ctx, data.data(), data.size()));
-  unsigned int sig_size = EVP_PKEY_size(pkey_);
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const unsigned char*>(data.data()), data.size(),
+         digest);
+  unsigned int sig_size = ECDSA_size(ec_key_);
   unsigned char *sig = new unsigned char[sig_size];
 
-  CHECK_EQ(1, EVP_SignFinal(&ctx, sig, &sig_size, pkey_));
+  CHECK_EQ(1, ECDSA_sign(0, digest, sizeof(digest), sig, &sig_size, ec_key_));
 
-  EVP_MD_CTX_cleanup(&ctx);
   std::string ret(reinterpret_cast<char*>(sig), sig_size);
 
   delete[] sig;
@@ -3,6 +3,7 @@
 #ifndef SRC_LOG_SIGNER_H_
 #define SRC_LOG_SIGNER_H_
 
+#include <openssl/ec.h>
 #include <openssl/evp.h>
 #include <openssl/x509.h>  // for i2d_PUBKEY
 #include <stdint.h>
@@ -11,6 +12,14 @@
 
 namespace ct {
 
+// Receives the signature of SignAsync().
+class SignatureCallback {
+ public:
+  virtual ~SignatureCallback() {}
+
+  virtual void Signed(const DigitallySigned &signature) = 0;
+};
+
 class Signer {
  public:
   explicit Signer(EVP_PKEY *pkey);
@@ -20,6 +29,12 @@ class Signer {
 
   virtual void Sign(const std::string &data, DigitallySigned *signature) const;
 
+  // Sign |data| and pass the signature to |callback|. Signers that wait on
+  // a device call back later, from a thread of their own; this one calls
+  // back before returning.
+  virtual void SignAsync(const std::string &data,
+                         SignatureCallback *callback) const;
+
  protected:
   // A constructor for mocking.
   Signer();
@@ -28,6 +43,8 @@ class Signer {
   std::string RawSign(const std::string &data) const;
 
   EVP_PKEY *pkey_;
+  // The key of |pkey_|, to sign digests with directly.
+  EC_KEY *ec_key_;
   DigitallySigned::HashAlgorithm hash_algo_;
   DigitallySigned::SignatureAlgorithm sig_algo_;
   std::string key_id_;
@@ -0,0 +1,198 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/signing_queue.h"
+
+#include <glog/logging.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "log/signer.h"
+#include "proto/ct.pb.h"
+
+using std::string;
+
+namespace ct {
+
+namespace {
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+// Waits for the signature of one request.
+class SignatureWaiter : public SignatureCallback {
+ public:
+  explicit SignatureWaiter(DigitallySigned *signature)
+      : signature_(signature),
+        done_(false) {
+    CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+    CHECK_EQ(0, pthread_cond_init(&signed_, NULL));
+  }
+
+  ~SignatureWaiter() {
+    pthread_cond_destroy(&signed_);
+    pthread_mutex_destroy(&mutex_);
+  }
+
+  virtual void Signed(const DigitallySigned &signature) {
+    ScopedLock lock(&mutex_);
+    signature_->CopyFrom(signature);
+    done_ = true;
+    CHECK_EQ(0, pthread_cond_signal(&signed_));
+  }
+
+  void Wait() {
+    ScopedLock lock(&mutex_);
+    while (!done_)
+      CHECK_EQ(0, pthread_cond_wait(&signed_, &mutex_));
+  }
+
+ private:
+  DigitallySigned *const signature_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t signed_;
+  bool done_;
+};
+
+}  // namespace
+
+SignerSession::SignerSession(Signer *signer)
+    : signer_(CHECK_NOTNULL(signer)) {}
+
+SignerSession::~SignerSession() {
+  delete signer_;
+}
+
+string SignerSession::KeyID() const {
+  return signer_->KeyID();
+}
+
+void SignerSession::SignBatch(const std::vector<string> &data,
+                              std::vector<DigitallySigned> *signatures) {
+  signatures->resize(data.size());
+  for (size_t i = 0; i < data.size(); ++i)
+    signer_->Sign(data[i], &(*signatures)[i]);
+}
+
+struct SigningQueue::Session {
+  SigningQueue *queue;
+  SigningSession *session;
+  pthread_t thread;
+};
+
+SigningQueue::SigningQueue(const std::vector<SigningSession*> &sessions,
+                           size_t max_batch)
+    : max_batch_(max_batch),
+      stopping_(false) {
+  CHECK(!sessions.empty());
+  CHECK_GT(max_batch_, 0U);
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+  CHECK_EQ(0, pthread_cond_init(&queued_, NULL));
+  for (size_t i = 0; i < sessions.size(); ++i) {
+    CHECK_EQ(sessions[0]->KeyID(), sessions[i]->KeyID());
+    Session *session = new Session;
+    session->queue = this;
+    session->session = sessions[i];
+    sessions_.push_back(session);
+    CHECK_EQ(0, pthread_create(&session->thread, NULL, SessionThread,
+                               session));
+  }
+}
+
+SigningQueue::~SigningQueue() {
+  {
+    ScopedLock lock(&mutex_);
+    stopping_ = true;
+    CHECK_EQ(0, pthread_cond_broadcast(&queued_));
+  }
+  for (size_t i = 0; i < sessions_.size(); ++i) {
+    CHECK_EQ(0, pthread_join(sessions_[i]->thread, NULL));
+    delete sessions_[i]->session;
+    delete sessions_[i];
+  }
+  pthread_cond_destroy(&queued_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+string SigningQueue::KeyID() const {
+  return sessions_[0]->session->KeyID();
+}
+
+void SigningQueue::Sign(const string &data, SignatureCallback *callback) {
+  CHECK_NOTNULL(callback);
+  ScopedLock lock(&mutex_);
+  CHECK(!stopping_);
+  queue_.push_back(Request());
+  queue_.back().data = data;
+  queue_.back().callback = callback;
+  CHECK_EQ(0, pthread_cond_signal(&queued_));
+}
+
+bool SigningQueue::NextBatch(std::vector<Request> *batch) {
+  batch->clear();
+  ScopedLock lock(&mutex_);
+  while (queue_.empty() && !stopping_)
+    CHECK_EQ(0, pthread_cond_wait(&queued_, &mutex_));
+  if (queue_.empty())
+    return false;
+  while (!queue_.empty() && batch->size() < max_batch_) {
+    batch->push_back(Request());
+    batch->back().data.swap(queue_.front().data);
+    batch->back().callback = queue_.front().callback;
+    queue_.pop_front();
+  }
+  // Leave the rest to another session.
+  if (!queue_.empty())
+    CHECK_EQ(0, pthread_cond_signal(&queued_));
+  return true;
+}
+
+// static
+void *SigningQueue::SessionThread(void *arg) {
+  Session *session = static_cast<Session*>(arg);
+  std::vector<Request> batch;
+  std::vector<string> data;
+  std::vector<DigitallySigned> signatures;
+  while (session->queue->NextBatch(&batch)) {
+    data.resize(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i)
+      data[i].swap(batch[i].data);
+    session->session->SignBatch(data, &signatures);
+    CHECK_EQ(batch.size(), signatures.size());
+    for (size_t i = 0; i < batch.size(); ++i)
+      batch[i].callback->Signed(signatures[i]);
+  }
+  return NULL;
+}
+
+QueuedSigner::QueuedSigner(SigningQueue *queue)
+    : queue_(CHECK_NOTNULL(queue)),
+      key_id_(queue->KeyID()) {}
+
+QueuedSigner::~QueuedSigner() {}
+
+string QueuedSigner::KeyID() const {
+  return key_id_;
+}
+
+void QueuedSigner::Sign(const string &data,
+                        DigitallySigned *signature) const {
+  SignatureWaiter waiter(signature);
+  queue_->Sign(data, &waiter);
+  waiter.Wait();
+}
+
+void QueuedSigner::SignAsync(const string &data,
+                             SignatureCallback *callback) const {
+  queue_->Sign(data, callback);
+}
+
+}  // namespace ct
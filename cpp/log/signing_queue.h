@@ -0,0 +1,109 @@
+#ifndef SIGNING_QUEUE_H
+#define SIGNING_QUEUE_H
+
+#include <deque>
+#include <pthread.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "log/signer.h"
+#include "proto/ct.pb.h"
+
+namespace ct {
+
+// One session on a signing device, e.g. a PKCS#11 session on an HSM that
+// holds the log's key. A session is only used by one thread at a time.
+class SigningSession {
+ public:
+  virtual ~SigningSession() {}
+
+  virtual std::string KeyID() const = 0;
+
+  // Sign each of |data|, writing the signatures to |signatures| in the
+  // same order. Devices with a round trip per call should submit the
+  // whole batch at once.
+  virtual void SignBatch(const std::vector<std::string> &data,
+                         std::vector<DigitallySigned> *signatures) = 0;
+};
+
+// A session that signs in-process with a Signer, for keys that are not on
+// a device, and for testing.
+class SignerSession : public SigningSession {
+ public:
+  // Takes ownership of |signer|.
+  explicit SignerSession(Signer *signer);
+  virtual ~SignerSession();
+
+  virtual std::string KeyID() const;
+
+  virtual void SignBatch(const std::vector<std::string> &data,
+                         std::vector<DigitallySigned> *signatures);
+
+ private:
+  Signer *signer_;
+};
+
+// Queues signing requests for several sessions of the same key, each
+// with a thread of its own, so that callers don't wait on the device.
+// Each session takes up to |max_batch| of the queued requests at a time,
+// so that requests that arrive while the device is busy are submitted
+// together. Thread-safe.
+class SigningQueue {
+ public:
+  // Takes ownership of |sessions|, which must not be empty.
+  SigningQueue(const std::vector<SigningSession*> &sessions,
+               size_t max_batch);
+  // Signs what is queued still, then stops the sessions.
+  ~SigningQueue();
+
+  std::string KeyID() const;
+
+  // Queue |data| for signing, and return at once; |callback| gets the
+  // signature, on a session thread.
+  void Sign(const std::string &data, SignatureCallback *callback);
+
+ private:
+  struct Request {
+    std::string data;
+    SignatureCallback *callback;
+  };
+  struct Session;
+
+  static void *SessionThread(void *arg);
+  // Move up to |max_batch_| requests to |batch|, waiting for some if there
+  // are none. Returns false when stopping with nothing queued.
+  bool NextBatch(std::vector<Request> *batch);
+
+  std::vector<Session*> sessions_;
+  const size_t max_batch_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t queued_;
+  // Guarded by |mutex_|.
+  std::deque<Request> queue_;
+  bool stopping_;
+};
+
+// A Signer that signs through a SigningQueue. Sign() waits for the
+// signature, for callers such as TreeSigner that can; SignAsync() does not.
+class QueuedSigner : public Signer {
+ public:
+  // Does not take ownership of |queue|.
+  explicit QueuedSigner(SigningQueue *queue);
+  virtual ~QueuedSigner();
+
+  virtual std::string KeyID() const;
+
+  virtual void Sign(const std::string &data, DigitallySigned *signature) const;
+
+  virtual void SignAsync(const std::string &data,
+                         SignatureCallback *callback) const;
+
+ private:
+  SigningQueue *const queue_;
+  const std::string key_id_;
+};
+
+}  // namespace ct
+
+#endif  // SIGNING_QUEUE_H
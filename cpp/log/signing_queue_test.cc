@@ -0,0 +1,157 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "log/log_signer.h"
+#include "log/signer.h"
+#include "log/signing_queue.h"
+#include "log/test_signer.h"
+#include "log/verifier.h"
+#include "proto/ct.pb.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+using std::string;
+
+namespace ct {
+namespace {
+
+// Collects signatures, in the order they arrive.
+class SignatureCollector : public SignatureCallback {
+ public:
+  SignatureCollector() {
+    CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+  }
+
+  ~SignatureCollector() { pthread_mutex_destroy(&mutex_); }
+
+  virtual void Signed(const DigitallySigned &signature) {
+    CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+    signatures_.push_back(signature);
+    CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+  }
+
+  const std::vector<DigitallySigned> &signatures() const {
+    return signatures_;
+  }
+
+ private:
+  pthread_mutex_t mutex_;
+  std::vector<DigitallySigned> signatures_;
+};
+
+// Records the size of each batch it signs.
+class CountingSession : public SignerSession {
+ public:
+  explicit CountingSession(std::vector<size_t> *batch_sizes)
+      : SignerSession(TestSigner::DefaultSigner()),
+        batch_sizes_(batch_sizes) {}
+
+  virtual void SignBatch(const std::vector<string> &data,
+                         std::vector<DigitallySigned> *signatures) {
+    // Only one session, so no locking.
+    batch_sizes_->push_back(data.size());
+    SignerSession::SignBatch(data, signatures);
+  }
+
+ private:
+  std::vector<size_t> *batch_sizes_;
+};
+
+class SigningQueueTest : public ::testing::Test {
+ protected:
+  SigningQueueTest() : verifier_(TestSigner::DefaultVerifier()) {}
+
+  ~SigningQueueTest() { delete verifier_; }
+
+  static std::vector<SigningSession*> Sessions(size_t count) {
+    std::vector<SigningSession*> sessions;
+    for (size_t i = 0; i < count; ++i)
+      sessions.push_back(new SignerSession(TestSigner::DefaultSigner()));
+    return sessions;
+  }
+
+  Verifier *verifier_;
+};
+
+TEST_F(SigningQueueTest, KeyID) {
+  SigningQueue queue(Sessions(2), 8);
+  EXPECT_EQ(verifier_->KeyID(), queue.KeyID());
+
+  QueuedSigner signer(&queue);
+  EXPECT_EQ(verifier_->KeyID(), signer.KeyID());
+}
+
+TEST_F(SigningQueueTest, SignAsync) {
+  const string data("abc");
+  SignatureCollector collector;
+  {
+    SigningQueue queue(Sessions(3), 8);
+    QueuedSigner signer(&queue);
+    for (size_t i = 0; i < 100; ++i)
+      signer.SignAsync(data, &collector);
+    // Destroying the queue signs what is queued still.
+  }
+
+  ASSERT_EQ(100U, collector.signatures().size());
+  for (size_t i = 0; i < collector.signatures().size(); ++i)
+    EXPECT_EQ(Verifier::OK,
+              verifier_->Verify(data, collector.signatures()[i]));
+}
+
+TEST_F(SigningQueueTest, Batches) {
+  std::vector<size_t> batch_sizes;
+  SignatureCollector collector;
+  {
+    std::vector<SigningSession*> sessions;
+    sessions.push_back(new CountingSession(&batch_sizes));
+    SigningQueue queue(sessions, 4);
+    for (size_t i = 0; i < 50; ++i)
+      queue.Sign("abc", &collector);
+  }
+
+  EXPECT_EQ(50U, collector.signatures().size());
+  size_t total = 0;
+  for (size_t i = 0; i < batch_sizes.size(); ++i) {
+    EXPECT_LT(0U, batch_sizes[i]);
+    EXPECT_GE(4U, batch_sizes[i]);
+    total += batch_sizes[i];
+  }
+  EXPECT_EQ(50U, total);
+}
+
+TEST_F(SigningQueueTest, Sign) {
+  SigningQueue queue(Sessions(2), 8);
+  QueuedSigner signer(&queue);
+  for (size_t i = 0; i < 10; ++i) {
+    const string data(i, 'x');
+    DigitallySigned signature;
+    signer.Sign(data, &signature);
+    EXPECT_EQ(Verifier::OK, verifier_->Verify(data, signature));
+  }
+}
+
+TEST_F(SigningQueueTest, LogSigner) {
+  SigningQueue queue(Sessions(2), 8);
+  LogSigner signer(new QueuedSigner(&queue));
+  LogSigVerifier *verifier = TestSigner::DefaultLogSigVerifier();
+
+  SignedTreeHead sth;
+  TestSigner::SetDefaults(&sth);
+  sth.clear_signature();
+  EXPECT_EQ(LogSigner::OK, signer.SignTreeHead(&sth));
+  EXPECT_EQ(LogSigVerifier::OK, verifier->VerifySTHSignature(sth));
+  delete verifier;
+}
+
+}  // namespace
+}  // namespace ct
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
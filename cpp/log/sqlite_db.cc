@@ -1,20 +1,94 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/sqlite_db.h"
 
+#include <algorithm>
 #include <glog/logging.h>
+#include <limits>
+#include <pthread.h>
 #include <sqlite3.h>
 
 #include "log/sqlite_statement.h"
+#include "log/sqlite_tree_heads.h"
 #include "util/util.h"
 
 using std::string;
 using sqlite::Statement;
 
+namespace {
+
+// How long a read connection waits for the database to be free, which in
+// write-ahead log mode is only while it is being recovered.
+const int kReaderBusyMilliseconds = 5000;
+
+// Readers also switch on memory-mapped I/O, for up to a gigabyte of the
+// database each.
+const char kReaderPragmas[] = "PRAGMA mmap_size = 1073741824;";
+
+}  // namespace
+
+template <class Logged> class SQLiteDB<Logged>::Reader {
+ public:
+  explicit Reader(const SQLiteDB<Logged> *db) : db_(db), pooled_(false) {
+    CHECK_EQ(0, pthread_mutex_lock(&db_->readers_mutex_));
+    // The thread in a transaction has to see its own writes.
+    if (db_->in_transaction_ &&
+        pthread_equal(db_->transaction_thread_, pthread_self())) {
+      CHECK_EQ(0, pthread_mutex_unlock(&db_->readers_mutex_));
+      connection_.db = db_->db_;
+      connection_.statements = db_->statements_;
+      return;
+    }
+    pooled_ = true;
+    if (!db_->idle_readers_.empty()) {
+      connection_ = db_->idle_readers_.back();
+      db_->idle_readers_.pop_back();
+      CHECK_EQ(0, pthread_mutex_unlock(&db_->readers_mutex_));
+      return;
+    }
+    CHECK_EQ(0, pthread_mutex_unlock(&db_->readers_mutex_));
+    CHECK_EQ(SQLITE_OK,
+             sqlite3_open_v2(db_->dbfile_.c_str(), &connection_.db,
+                             SQLITE_OPEN_READONLY, NULL))
+        << "Cannot open " << db_->dbfile_ << " for reading";
+    CHECK_EQ(SQLITE_OK, sqlite3_busy_timeout(connection_.db,
+                                             kReaderBusyMilliseconds));
+    CHECK_EQ(SQLITE_OK, sqlite3_exec(connection_.db, kReaderPragmas, NULL,
+                                     NULL, NULL));
+    connection_.statements = new sqlite::StatementCache(connection_.db);
+  }
+
+  ~Reader() {
+    if (!pooled_)
+      return;
+    CHECK_EQ(0, pthread_mutex_lock(&db_->readers_mutex_));
+    db_->idle_readers_.push_back(connection_);
+    CHECK_EQ(0, pthread_mutex_unlock(&db_->readers_mutex_));
+  }
+
+  sqlite::StatementCache *statements() const {
+    return connection_.statements;
+  }
+
+ private:
+  const SQLiteDB<Logged> *db_;
+  bool pooled_;
+  ReadConnection connection_;
+};
+
 template <class Logged> SQLiteDB<Logged>::SQLiteDB(const string &dbfile)
-    : db_(NULL) {
+    : dbfile_(dbfile),
+      db_(NULL),
+      statements_(NULL),
+      in_transaction_(false) {
+  CHECK_EQ(0, pthread_mutex_init(&readers_mutex_, NULL));
   int ret = sqlite3_open_v2(dbfile.c_str(), &db_, SQLITE_OPEN_READWRITE, NULL);
-  if (ret == SQLITE_OK)
+  if (ret == SQLITE_OK) {
+    AddLeafHashColumn();
+    sqlite::AddTreeSizeColumn(db_);
+    EnableWriteAheadLog();
+    statements_ = new sqlite::StatementCache(db_);
     return;
+  }
   CHECK_EQ(SQLITE_CANTOPEN, ret);
 
   // We have to close and reopen to avoid memory leaks.
@@ -25,42 +99,93 @@ template <class Logged> SQLiteDB<Logged>::SQLiteDB(const string &dbfile)
            sqlite3_open_v2(dbfile.c_str(), &db_,
                            SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL));
 
+  // The leaf hash goes before the entry, so that reading it doesn't have to
+  // step over a large entry.
   CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "CREATE TABLE leaves(hash BLOB UNIQUE, "
-                                   "entry BLOB, sequence INTEGER UNIQUE)",
+                                   "leaf_hash BLOB, entry BLOB, "
+                                   "sequence INTEGER UNIQUE)",
                                    NULL, NULL, NULL));
 
-  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "CREATE TABLE trees(sth BLOB UNIQUE, "
-                                   "timestamp INTEGER UNIQUE)",
-                                   NULL, NULL, NULL));
+  sqlite::CreateTreeHeadTable(db_);
+  EnableWriteAheadLog();
+  statements_ = new sqlite::StatementCache(db_);
   LOG(INFO) << "New SQLite database created in " << dbfile;
 }
 
 template <class Logged> SQLiteDB<Logged>::~SQLiteDB() {
+  // Cached statements have to be finalized before the connection closes.
+  for (size_t i = 0; i < idle_readers_.size(); ++i) {
+    delete idle_readers_[i].statements;
+    CHECK_EQ(SQLITE_OK, sqlite3_close(idle_readers_[i].db));
+  }
+  delete statements_;
   CHECK_EQ(SQLITE_OK, sqlite3_close(db_));
+  pthread_mutex_destroy(&readers_mutex_);
+}
+
+template <class Logged> void SQLiteDB<Logged>::EnableWriteAheadLog() {
+  // The mode sticks to the database file. Where it can't be had, e.g. on a
+  // network file system, readers just wait for writers as before.
+  Statement statement(db_, "PRAGMA journal_mode = WAL");
+  CHECK_EQ(SQLITE_ROW, statement.Step());
+  string mode;
+  statement.GetBlob(0, &mode);
+  if (mode != "wal")
+    LOG(WARNING) << "SQLite database " << dbfile_ << " is in journal mode "
+                 << mode << ", so lookups will wait for writes";
+}
+
+template <class Logged> void SQLiteDB<Logged>::AddLeafHashColumn() {
+  Statement statement(db_, "PRAGMA table_info(leaves)");
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    string column;
+    statement.GetBlob(1, &column);
+    if (column == "leaf_hash")
+      return;
+  }
+  CHECK_EQ(SQLITE_DONE, ret);
+
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "ALTER TABLE leaves ADD COLUMN "
+                                   "leaf_hash BLOB", NULL, NULL, NULL));
+  LOG(INFO) << "Added a leaf hash column to the SQLite database";
 }
 
 template <class Logged> void SQLiteDB<Logged>::BeginTransaction() {
   CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "BEGIN;", NULL, NULL, NULL));
+  CHECK_EQ(0, pthread_mutex_lock(&readers_mutex_));
+  transaction_thread_ = pthread_self();
+  in_transaction_ = true;
+  CHECK_EQ(0, pthread_mutex_unlock(&readers_mutex_));
 }
 
 template <class Logged> void SQLiteDB<Logged>::EndTransaction() {
+  CHECK_EQ(0, pthread_mutex_lock(&readers_mutex_));
+  in_transaction_ = false;
+  CHECK_EQ(0, pthread_mutex_unlock(&readers_mutex_));
   CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "COMMIT;", NULL, NULL, NULL));
 }
 
 template <class Logged> typename Database<Logged>::WriteResult
 SQLiteDB<Logged>::CreatePendingEntry_(const Logged &logged) {
-  Statement statement(db_, "INSERT INTO leaves(hash, entry) "
-                      "VALUES(?, ?)");
+  Statement statement(statements_, "INSERT INTO leaves(hash, entry, leaf_hash) "
+                      "VALUES(?, ?, ?)");
   string hash = logged.Hash();
   statement.BindBlob(0, hash);
 
   string data;
   CHECK(logged.SerializeForDatabase(&data));
+  this->CompressEntry(&data);
   statement.BindBlob(1, data);
 
+  // The leaf doesn't depend on the sequence number, so hash it now while we
+  // have the entry at hand, rather than reading it back when it's logged.
+  string leaf_hash = this->LeafHash(logged);
+  statement.BindBlob(2, leaf_hash);
+
   int ret = statement.Step();
   if (ret == SQLITE_CONSTRAINT) {
-    Statement s2(db_, "SELECT hash FROM leaves WHERE hash = ?");
+    Statement s2(statements_, "SELECT hash FROM leaves WHERE hash = ?");
     hash = logged.Hash();
     s2.BindBlob(0, hash);
     CHECK_EQ(SQLITE_ROW, s2.Step());
@@ -74,14 +199,15 @@ SQLiteDB<Logged>::CreatePendingEntry_(const Logged &logged) {
 template <class Logged> typename Database<Logged>::WriteResult
 SQLiteDB<Logged>::AssignSequenceNumber(const string &hash,
                                        uint64_t sequence_number) {
-  Statement statement(db_, "UPDATE leaves SET sequence = ? WHERE hash = ? "
+  Statement statement(statements_,
+                      "UPDATE leaves SET sequence = ? WHERE hash = ? "
                       "AND sequence IS NULL");
   statement.BindUInt64(0, sequence_number);
   statement.BindBlob(1, hash);
 
   int ret = statement.Step();
   if (ret == SQLITE_CONSTRAINT) {
-    Statement s2(db_, "SELECT sequence FROM leaves WHERE sequence = ?");
+    Statement s2(statements_, "SELECT sequence FROM leaves WHERE sequence = ?");
     s2.BindUInt64(0, sequence_number);
     CHECK_EQ(SQLITE_ROW, s2.Step());
     return this->SEQUENCE_NUMBER_ALREADY_IN_USE;
@@ -90,7 +216,7 @@ SQLiteDB<Logged>::AssignSequenceNumber(const string &hash,
 
   int changes = sqlite3_changes(db_);
   if (changes == 0) {
-    Statement s2(db_, "SELECT hash FROM leaves WHERE hash = ?");
+    Statement s2(statements_, "SELECT hash FROM leaves WHERE hash = ?");
     s2.BindBlob(0, hash);
     int ret = s2.Step();
     if (ret == SQLITE_ROW)
@@ -102,9 +228,37 @@ SQLiteDB<Logged>::AssignSequenceNumber(const string &hash,
   return this->OK;
 }
 
+template <class Logged> typename Database<Logged>::WriteResult
+SQLiteDB<Logged>::AssignSequenceNumbers(const std::vector<string> &hashes,
+                                        uint64_t first_sequence_number,
+                                        size_t *assigned) {
+  // Unlike BEGIN, a savepoint also works inside BeginTransaction(). Entries
+  // assigned before a failure are kept, as with one call per entry; the
+  // statement cache keeps the UPDATE prepared across the batch.
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "SAVEPOINT assign_sequence_numbers;",
+                                   NULL, NULL, NULL));
+  WriteResult result = Database<Logged>::AssignSequenceNumbers(
+      hashes, first_sequence_number, assigned);
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "RELEASE assign_sequence_numbers;",
+                                   NULL, NULL, NULL));
+  return result;
+}
+
+template <class Logged> bool SQLiteDB<Logged>::DropLoggedEntries(uint64_t end) {
+  // Pending entries have no sequence number, which is never less.
+  Statement statement(statements_, "DELETE FROM leaves WHERE sequence < ?");
+  // SQLite integers are signed.
+  statement.BindUInt64(0, std::min<uint64_t>(
+      end, std::numeric_limits<sqlite3_int64>::max()));
+  CHECK_EQ(SQLITE_DONE, statement.Step());
+  return true;
+}
+
 template <class Logged> typename Database<Logged>::LookupResult
 SQLiteDB<Logged>::LookupByHash(const string &hash) const {
-  Statement statement(db_, "SELECT hash FROM leaves WHERE hash = ?");
+  Reader reader(this);
+  Statement statement(reader.statements(),
+                      "SELECT hash FROM leaves WHERE hash = ?");
   statement.BindBlob(0, hash);
 
   int ret = statement.Step();
@@ -119,7 +273,9 @@ template <class Logged> typename Database<Logged>::LookupResult
 SQLiteDB<Logged>::LookupByHash(const string &hash, Logged *result) const {
   CHECK_NOTNULL(result);
 
-  Statement statement(db_, "SELECT entry, sequence FROM leaves WHERE hash = ?");
+  Reader reader(this);
+  Statement statement(reader.statements(),
+                      "SELECT entry, sequence FROM leaves WHERE hash = ?");
 
   statement.BindBlob(0, hash);
 
@@ -130,6 +286,7 @@ SQLiteDB<Logged>::LookupByHash(const string &hash, Logged *result) const {
 
   string data;
   statement.GetBlob(0, &data);
+  CHECK(this->DecompressEntry(&data));
   CHECK(result->ParseFromDatabase(data));
 
   if (statement.GetType(1) == SQLITE_NULL)
@@ -143,7 +300,8 @@ SQLiteDB<Logged>::LookupByHash(const string &hash, Logged *result) const {
 template <class Logged> typename Database<Logged>::LookupResult
 SQLiteDB<Logged>::LookupByIndex(uint64_t sequence_number,
                                 Logged *result) const {
-  Statement statement(db_, "SELECT entry, hash FROM leaves "
+  Reader reader(this);
+  Statement statement(reader.statements(), "SELECT entry, hash FROM leaves "
                       "WHERE sequence = ?");
   statement.BindUInt64(0, sequence_number);
   int ret = statement.Step();
@@ -152,6 +310,7 @@ SQLiteDB<Logged>::LookupByIndex(uint64_t sequence_number,
 
   string data;
   statement.GetBlob(0, &data);
+  CHECK(this->DecompressEntry(&data));
   CHECK(result->ParseFromDatabase(data));
 
   string hash;
@@ -164,10 +323,123 @@ SQLiteDB<Logged>::LookupByIndex(uint64_t sequence_number,
   return this->LOOKUP_OK;
 }
 
+template <class Logged> typename Database<Logged>::LookupResult
+SQLiteDB<Logged>::LookupByIndexRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::EntryCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  if (start >= end)
+    return this->LOOKUP_OK;
+
+  Statement statement(statements_,
+                      "SELECT sequence, entry, hash FROM leaves "
+                      "WHERE sequence >= ? AND sequence < ? ORDER BY sequence");
+  statement.BindUInt64(0, start);
+  // SQLite integers are signed.
+  statement.BindUInt64(1, std::min<uint64_t>(
+      end, std::numeric_limits<sqlite3_int64>::max()));
+
+  uint64_t next = start;
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    // Sequence numbers are unique, so a gap shows up as a skipped one.
+    if (statement.GetUInt64(0) != next)
+      return this->NOT_FOUND;
+
+    string data;
+    statement.GetBlob(1, &data);
+    Logged logged;
+    CHECK(this->DecompressEntry(&data));
+    CHECK(logged.ParseFromDatabase(data));
+
+    string hash;
+    statement.GetBlob(2, &hash);
+    CHECK_EQ(logged.Hash(), hash);
+
+    logged.set_sequence_number(next++);
+    if (!callback->Entry(logged))
+      return this->LOOKUP_OK;
+  }
+  CHECK_EQ(SQLITE_DONE, ret);
+  return next == end ? this->LOOKUP_OK : this->NOT_FOUND;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+SQLiteDB<Logged>::LookupLeafHashRange(uint64_t start, uint64_t end,
+                                      std::vector<string> *hashes) const {
+  CHECK_NOTNULL(hashes);
+  if (start >= end)
+    return this->LOOKUP_OK;
+
+  // The entry is only read for rows from before the leaf_hash column.
+  Statement statement(statements_,
+                      "SELECT sequence, leaf_hash, CASE WHEN leaf_hash "
+                      "IS NULL THEN entry END FROM leaves WHERE sequence >= ? "
+                      "AND sequence < ? ORDER BY sequence");
+  statement.BindUInt64(0, start);
+  statement.BindUInt64(1, end);
+
+  std::vector<string> range;
+  range.reserve(end - start);
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    // Sequence numbers are unique, so a gap shows up as a skipped one.
+    if (statement.GetUInt64(0) != start + range.size())
+      return this->NOT_FOUND;
+    range.push_back(string());
+    if (statement.GetType(1) != SQLITE_NULL) {
+      statement.GetBlob(1, &range.back());
+    } else {
+      string data;
+      statement.GetBlob(2, &data);
+      Logged logged;
+      CHECK(this->DecompressEntry(&data));
+      CHECK(logged.ParseFromDatabase(data));
+      range.back() = this->LeafHash(logged);
+    }
+  }
+  CHECK_EQ(SQLITE_DONE, ret);
+  if (range.size() != end - start)
+    return this->NOT_FOUND;
+
+  hashes->insert(hashes->end(), range.begin(), range.end());
+  return this->LOOKUP_OK;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+SQLiteDB<Logged>::LookupEntryHashRange(uint64_t start, uint64_t end,
+                                       std::vector<string> *hashes) const {
+  CHECK_NOTNULL(hashes);
+  if (start >= end)
+    return this->LOOKUP_OK;
+
+  Statement statement(statements_,
+                      "SELECT sequence, hash FROM leaves WHERE sequence >= ? "
+                      "AND sequence < ? ORDER BY sequence");
+  statement.BindUInt64(0, start);
+  // SQLite integers are signed.
+  statement.BindUInt64(1, std::min<uint64_t>(
+      end, std::numeric_limits<sqlite3_int64>::max()));
+
+  uint64_t next = start;
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    // Sequence numbers are unique, so a gap shows up as a skipped one.
+    if (statement.GetUInt64(0) != next)
+      return this->NOT_FOUND;
+    hashes->push_back(string());
+    statement.GetBlob(1, &hashes->back());
+    ++next;
+  }
+  CHECK_EQ(SQLITE_DONE, ret);
+  return next == end ? this->LOOKUP_OK : this->NOT_FOUND;
+}
+
 template <class Logged> std::set<string>
 SQLiteDB<Logged>::PendingHashes() const {
   std::set<string> hashes;
-  Statement statement(db_, "SELECT hash FROM leaves WHERE sequence IS NULL");
+  Statement statement(statements_,
+                      "SELECT hash FROM leaves WHERE sequence IS NULL");
 
   int ret;
   while ((ret = statement.Step()) == SQLITE_ROW) {
@@ -180,31 +452,49 @@ SQLiteDB<Logged>::PendingHashes() const {
   return hashes;
 }
 
-template <class Logged> typename Database<Logged>::WriteResult
-SQLiteDB<Logged>::WriteTreeHead_(const ct::SignedTreeHead &sth) {
-  Statement statement(db_, "INSERT INTO trees(timestamp, sth) VALUES(?, ?)");
-  statement.BindUInt64(0, sth.timestamp());
+template <class Logged> void
+SQLiteDB<Logged>::LookupPendingEntries(
+    size_t limit, typename Database<Logged>::EntryCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  // Pending entries share the NULL key of the sequence index, within which
+  // they are in rowid order, so this needs no sort.
+  Statement statement(statements_,
+                      "SELECT entry, hash FROM leaves WHERE sequence IS NULL "
+                      "ORDER BY rowid LIMIT ?");
+  statement.BindUInt64(0, limit > 0 ? limit
+                          : std::numeric_limits<sqlite3_int64>::max());
 
-  string sth_data;
-  CHECK(sth.SerializeToString(&sth_data));
-  statement.BindBlob(1, sth_data);
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    string data;
+    statement.GetBlob(0, &data);
+    Logged logged;
+    CHECK(this->DecompressEntry(&data));
+    CHECK(logged.ParseFromDatabase(data));
 
-  int r2 = statement.Step();
-  if (r2 == SQLITE_CONSTRAINT) {
-    Statement s2(db_, "SELECT timestamp FROM trees WHERE timestamp = ?");
-    s2.BindUInt64(0, sth.timestamp());
-    CHECK_EQ(SQLITE_ROW, s2.Step());
-    return this->DUPLICATE_TREE_HEAD_TIMESTAMP;
+    string hash;
+    statement.GetBlob(1, &hash);
+    CHECK_EQ(logged.Hash(), hash);
+
+    if (!callback->Entry(logged))
+      return;
   }
-  CHECK_EQ(SQLITE_DONE, r2);
+  CHECK_EQ(SQLITE_DONE, ret);
+}
 
+template <class Logged> typename Database<Logged>::WriteResult
+SQLiteDB<Logged>::WriteTreeHead_(const ct::SignedTreeHead &sth) {
+  if (!sqlite::InsertTreeHead(statements_, sth))
+    return this->DUPLICATE_TREE_HEAD_TIMESTAMP;
   return this->OK;
 }
 
 template <class Logged> typename Database<Logged>::LookupResult
 SQLiteDB<Logged>::LatestTreeHead(ct::SignedTreeHead *result)
     const {
-  Statement statement(db_, "SELECT sth FROM trees WHERE timestamp IN "
+  Reader reader(this);
+  Statement statement(reader.statements(),
+                      "SELECT sth FROM trees WHERE timestamp IN "
                       "(SELECT MAX(timestamp) FROM trees)");
 
   int ret = statement.Step();
@@ -218,3 +508,24 @@ SQLiteDB<Logged>::LatestTreeHead(ct::SignedTreeHead *result)
 
   return this->LOOKUP_OK;
 }
+
+template <class Logged> typename Database<Logged>::LookupResult
+SQLiteDB<Logged>::LookupTreeHeadByTimestamp(
+    uint64_t timestamp, ct::SignedTreeHead *result) const {
+  return sqlite::LookupTreeHeadByTimestamp(statements_, timestamp, result)
+      ? this->LOOKUP_OK : this->NOT_FOUND;
+}
+
+template <class Logged> typename Database<Logged>::LookupResult
+SQLiteDB<Logged>::LookupTreeHeadBySize(
+    uint64_t tree_size, ct::SignedTreeHead *result) const {
+  return sqlite::LookupTreeHeadBySize(statements_, tree_size, result)
+      ? this->LOOKUP_OK : this->NOT_FOUND;
+}
+
+template <class Logged> void SQLiteDB<Logged>::LookupTreeHeadRange(
+    uint64_t start, uint64_t end,
+    typename Database<Logged>::TreeHeadCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  sqlite::LookupTreeHeadRange(statements_, start, end, callback);
+}
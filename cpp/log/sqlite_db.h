@@ -2,12 +2,25 @@
 
 #ifndef SQLITE_DB_H
 #define SQLITE_DB_H
+#include <pthread.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "log/database.h"
 
 struct sqlite3;
 
+namespace sqlite {
+class StatementCache;
+}  // namespace sqlite
+
+// Writes go through one connection, in write-ahead log mode, so that
+// LookupByHash(), LookupByIndex() and LatestTreeHead() can run on
+// read-only connections of their own: one for each thread that looks up
+// at once, kept for reuse, with memory-mapped I/O. They see what was last
+// committed and never wait for a transaction to end, except on the thread
+// that is in the transaction, which sees its own writes.
 template <class Logged> class SQLiteDB : public Database<Logged> {
  public:
   explicit SQLiteDB(const std::string &dbfile);
@@ -22,6 +35,8 @@ template <class Logged> class SQLiteDB : public Database<Logged> {
   // of a transaction.
   virtual bool Transactional() const { return true; }
 
+  virtual bool ConcurrentReads() const { return true; }
+
   void BeginTransaction();
 
   void EndTransaction();
@@ -31,6 +46,16 @@ template <class Logged> class SQLiteDB : public Database<Logged> {
   virtual WriteResult AssignSequenceNumber(const std::string &pending_hash,
                                            uint64_t sequence_number);
 
+  // Assigns the whole batch in one transaction (nested in the current one,
+  // if any), so that it is synced to disk once.
+  virtual WriteResult AssignSequenceNumbers(
+      const std::vector<std::string> &pending_hashes,
+      uint64_t first_sequence_number, size_t *assigned);
+
+  // The freed pages are reused for new entries rather than given back, as
+  // SQLite does unless the file is vacuumed.
+  virtual bool DropLoggedEntries(uint64_t end);
+
   virtual LookupResult LookupByHash(const std::string &hash) const;
 
   virtual LookupResult LookupByHash(const std::string &hash,
@@ -39,14 +64,65 @@ template <class Logged> class SQLiteDB : public Database<Logged> {
   virtual LookupResult LookupByIndex(uint64_t sequence_number,
                                      Logged *result) const;
 
+  virtual LookupResult LookupByIndexRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::EntryCallback *callback) const;
+
+  virtual LookupResult LookupLeafHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
+  virtual LookupResult LookupEntryHashRange(
+      uint64_t start, uint64_t end, std::vector<std::string> *hashes) const;
+
   virtual std::set<std::string> PendingHashes() const;
 
+  // Returns entries in creation order, which is the order the frontend
+  // timestamped them in.
+  virtual void LookupPendingEntries(
+      size_t limit, typename Database<Logged>::EntryCallback *callback) const;
+
   virtual WriteResult WriteTreeHead_(const ct::SignedTreeHead &sth);
 
   virtual LookupResult LatestTreeHead(ct::SignedTreeHead *result) const;
 
+  virtual LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead *result) const;
+
+  virtual LookupResult LookupTreeHeadBySize(
+      uint64_t tree_size, ct::SignedTreeHead *result) const;
+
+  virtual void LookupTreeHeadRange(
+      uint64_t start, uint64_t end,
+      typename Database<Logged>::TreeHeadCallback *callback) const;
+
  private:
+  // Databases created before leaf hashes were stored lack the leaf_hash
+  // column; add it. Their existing entries' leaf hashes are then computed
+  // on lookup.
+  void AddLeafHashColumn();
+
+  // Switch the database to write-ahead logging, so that readers don't wait
+  // for writers.
+  void EnableWriteAheadLog();
+
+  // The statements of a connection for a lookup of the calling thread.
+  class Reader;
+  struct ReadConnection {
+    sqlite3 *db;
+    sqlite::StatementCache *statements;
+  };
+
+  const std::string dbfile_;
   sqlite3 *db_;
+  // Prepared statements, reused across calls.
+  sqlite::StatementCache *statements_;
+  // The thread in a transaction, if any. Guarded by readers_mutex_, as
+  // readers on other threads check it.
+  bool in_transaction_;
+  pthread_t transaction_thread_;
+  // Read-only connections that no lookup is using.
+  mutable pthread_mutex_t readers_mutex_;
+  mutable std::vector<ReadConnection> idle_readers_;
 };
 
 #endif
@@ -4,27 +4,84 @@
 #define SQLITE_STATEMENT_H
 
 #include <glog/logging.h>
+#include <map>
 #include <sqlite3.h>
 #include <string>
+#include <utility>
 
 namespace sqlite {
 
+inline sqlite3_stmt *Prepare(sqlite3 *db, const char *sql) {
+  sqlite3_stmt *stmt = NULL;
+  int ret = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  if (ret != SQLITE_OK)
+    LOG(ERROR) << "ret = " << ret << ", err = " << sqlite3_errmsg(db)
+               << ", sql = " << sql << std::endl;
+
+  CHECK_EQ(SQLITE_OK, ret);
+  return stmt;
+}
+
+inline void Finalize(sqlite3_stmt *stmt) {
+  int ret = sqlite3_finalize(stmt);
+  // can get SQLITE_CONSTRAINT if an insert failed due to a duplicate key.
+  CHECK(ret == SQLITE_OK || ret == SQLITE_CONSTRAINT);
+}
+
+// Prepared statements for one connection, kept between uses so that each
+// query is only compiled once. Must be destroyed before the connection is
+// closed. Not thread-safe.
+class StatementCache {
+ public:
+  explicit StatementCache(sqlite3 *db) : db_(db) {}
+
+  ~StatementCache() {
+    for (std::map<std::string, sqlite3_stmt*>::iterator it = idle_.begin();
+         it != idle_.end(); ++it)
+      Finalize(it->second);
+  }
+
+  // A statement for |sql|, ready to bind. A statement is only handed out
+  // once at a time, so nested uses of the same query each get their own.
+  sqlite3_stmt *Acquire(const char *sql) {
+    std::map<std::string, sqlite3_stmt*>::iterator it = idle_.find(sql);
+    if (it == idle_.end())
+      return Prepare(db_, sql);
+    sqlite3_stmt *stmt = it->second;
+    idle_.erase(it);
+    return stmt;
+  }
+
+  // Give back a statement from Acquire(sql).
+  void Release(const char *sql, sqlite3_stmt *stmt) {
+    // The result of the last step is reported again; we've already seen it.
+    sqlite3_reset(stmt);
+    // Blob bindings point into the caller's strings.
+    CHECK_EQ(SQLITE_OK, sqlite3_clear_bindings(stmt));
+    if (!idle_.insert(std::make_pair(std::string(sql), stmt)).second)
+      Finalize(stmt);
+  }
+
+ private:
+  sqlite3 *db_;
+  std::map<std::string, sqlite3_stmt*> idle_;
+};
+
 // Reduce the ugliness of the sqlite3 API.
 class Statement {
  public:
-  Statement(sqlite3 *db, const char *sql) : stmt_(NULL) {
-    int ret = sqlite3_prepare_v2(db, sql, -1, &stmt_, NULL);
-    if (ret != SQLITE_OK)
-      LOG(ERROR) << "ret = " << ret << ", err = " << sqlite3_errmsg(db)
-                 << ", sql = " << sql << std::endl;
+  Statement(sqlite3 *db, const char *sql)
+      : cache_(NULL), sql_(sql), stmt_(Prepare(db, sql)) {}
 
-    CHECK_EQ(SQLITE_OK, ret);
-  }
+  // Borrow the statement from |cache|, and give it back when done.
+  Statement(StatementCache *cache, const char *sql)
+      : cache_(cache), sql_(sql), stmt_(cache->Acquire(sql)) {}
 
   ~Statement() {
-    int ret = sqlite3_finalize(stmt_);
-    // can get SQLITE_CONSTRAINT if an insert failed due to a duplicate key.
-    CHECK(ret == SQLITE_OK || ret == SQLITE_CONSTRAINT);
+    if (cache_ != NULL)
+      cache_->Release(sql_, stmt_);
+    else
+      Finalize(stmt_);
   }
 
   // Fields start at 0! |value| must have lifetime that covers its
@@ -35,6 +92,11 @@ class Statement {
                                           value.length(), NULL));
   }
 
+  void BindText(unsigned field, const std::string &value) {
+    CHECK_EQ(SQLITE_OK, sqlite3_bind_text(stmt_, field + 1, value.data(),
+                                          value.length(), NULL));
+  }
+
   void BindUInt64(unsigned field, sqlite3_uint64 value) {
     CHECK_EQ(SQLITE_OK, sqlite3_bind_int64(stmt_, field + 1, value));
   }
@@ -58,7 +120,15 @@ class Statement {
     return sqlite3_step(stmt_);
   }
 
+  // Ready the statement to be bound and stepped through again.
+  void Reset() {
+    sqlite3_reset(stmt_);
+    CHECK_EQ(SQLITE_OK, sqlite3_clear_bindings(stmt_));
+  }
+
  private:
+  StatementCache *cache_;
+  const char *sql_;
   sqlite3_stmt *stmt_;
 };
 
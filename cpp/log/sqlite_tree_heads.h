@@ -0,0 +1,149 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+
+#ifndef SQLITE_TREE_HEADS_H
+#define SQLITE_TREE_HEADS_H
+
+#include <glog/logging.h>
+#include <limits>
+#include <sqlite3.h>
+#include <stdint.h>
+#include <string>
+
+#include "log/sqlite_statement.h"
+#include "proto/ct.pb.h"
+
+// The table that SQLiteDB and ShardedDB keep tree heads in,
+//
+//   trees(sth BLOB UNIQUE, timestamp INTEGER UNIQUE, tree_size INTEGER)
+//
+// indexed by timestamp and by tree size, so that older tree heads are
+// found without a scan.
+namespace sqlite {
+
+// SQLite integers are signed, so timestamps past this don't bind.
+const uint64_t kMaxTreeHeadTimestamp = std::numeric_limits<int64_t>::max();
+
+inline void CreateTreeHeadTable(sqlite3 *db) {
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db, "CREATE TABLE trees(sth BLOB UNIQUE, "
+                                   "timestamp INTEGER UNIQUE, "
+                                   "tree_size INTEGER)",
+                                   NULL, NULL, NULL));
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db, "CREATE INDEX trees_by_size ON "
+                                   "trees(tree_size, timestamp)",
+                                   NULL, NULL, NULL));
+}
+
+// Tables from before tree sizes were indexed lack the tree_size column;
+// add it, fill it in from the tree heads and index it.
+inline void AddTreeSizeColumn(sqlite3 *db) {
+  {
+    Statement statement(db, "PRAGMA table_info(trees)");
+    int ret;
+    while ((ret = statement.Step()) == SQLITE_ROW) {
+      std::string column;
+      statement.GetBlob(1, &column);
+      if (column == "tree_size")
+        return;
+    }
+    CHECK_EQ(SQLITE_DONE, ret);
+  }
+
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL));
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db, "ALTER TABLE trees ADD COLUMN "
+                                   "tree_size INTEGER", NULL, NULL, NULL));
+  {
+    Statement select(db, "SELECT sth FROM trees");
+    Statement update(db, "UPDATE trees SET tree_size = ? WHERE timestamp = ?");
+    int ret;
+    while ((ret = select.Step()) == SQLITE_ROW) {
+      std::string data;
+      select.GetBlob(0, &data);
+      ct::SignedTreeHead sth;
+      CHECK(sth.ParseFromString(data));
+      update.BindUInt64(0, sth.tree_size());
+      update.BindUInt64(1, sth.timestamp());
+      CHECK_EQ(SQLITE_DONE, update.Step());
+      update.Reset();
+    }
+    CHECK_EQ(SQLITE_DONE, ret);
+  }
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db, "CREATE INDEX trees_by_size ON "
+                                   "trees(tree_size, timestamp)",
+                                   NULL, NULL, NULL));
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL));
+  LOG(INFO) << "Indexed the tree heads of the SQLite database by size";
+}
+
+// Returns false if there is a tree head with the same timestamp already.
+inline bool InsertTreeHead(StatementCache *statements,
+                           const ct::SignedTreeHead &sth) {
+  Statement statement(statements, "INSERT INTO trees(timestamp, tree_size, "
+                      "sth) VALUES(?, ?, ?)");
+  statement.BindUInt64(0, sth.timestamp());
+  statement.BindUInt64(1, sth.tree_size());
+  std::string data;
+  CHECK(sth.SerializeToString(&data));
+  statement.BindBlob(2, data);
+
+  int ret = statement.Step();
+  if (ret == SQLITE_CONSTRAINT)
+    return false;
+  CHECK_EQ(SQLITE_DONE, ret);
+  return true;
+}
+
+// Read the tree head in the first column of the next row of |statement|
+// into |result|. Returns false if there are no more rows.
+inline bool NextTreeHead(Statement *statement, ct::SignedTreeHead *result) {
+  int ret = statement->Step();
+  if (ret == SQLITE_DONE)
+    return false;
+  CHECK_EQ(SQLITE_ROW, ret);
+  std::string data;
+  statement->GetBlob(0, &data);
+  CHECK(result->ParseFromString(data));
+  return true;
+}
+
+inline bool LookupTreeHeadByTimestamp(StatementCache *statements,
+                                      uint64_t timestamp,
+                                      ct::SignedTreeHead *result) {
+  if (timestamp > kMaxTreeHeadTimestamp)
+    return false;
+  Statement statement(statements,
+                      "SELECT sth FROM trees WHERE timestamp = ?");
+  statement.BindUInt64(0, timestamp);
+  return NextTreeHead(&statement, result);
+}
+
+inline bool LookupTreeHeadBySize(StatementCache *statements,
+                                 uint64_t tree_size,
+                                 ct::SignedTreeHead *result) {
+  Statement statement(statements, "SELECT sth FROM trees WHERE tree_size = ? "
+                      "ORDER BY timestamp DESC LIMIT 1");
+  statement.BindUInt64(0, tree_size);
+  return NextTreeHead(&statement, result);
+}
+
+// Pass the tree heads with timestamps |start| to |end| - 1 to |callback|,
+// a Database<Logged>::TreeHeadCallback, oldest first.
+template <class Callback>
+void LookupTreeHeadRange(StatementCache *statements, uint64_t start,
+                         uint64_t end, Callback *callback) {
+  if (end > kMaxTreeHeadTimestamp)
+    end = kMaxTreeHeadTimestamp;
+  if (start >= end)
+    return;
+  Statement statement(statements, "SELECT sth FROM trees WHERE timestamp >= ? "
+                      "AND timestamp < ? ORDER BY timestamp");
+  statement.BindUInt64(0, start);
+  statement.BindUInt64(1, end);
+  ct::SignedTreeHead sth;
+  while (NextTreeHead(&statement, &sth))
+    if (!callback->TreeHead(sth))
+      return;
+}
+
+}  // namespace sqlite
+
+#endif  // SQLITE_TREE_HEADS_H
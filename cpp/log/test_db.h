@@ -5,10 +5,17 @@
 #include <sys/stat.h>
 
 #include "util/test_db.h"
+#include "log/archiving_db.h"
+#include "log/caching_db.h"
 #include "log/database.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
+#include "log/instrumented_db.h"
+#include "log/interning_db.h"
+#include "log/leveldb_db.h"
+#include "log/locking_db.h"
 #include "log/logged_certificate.h"
+#include "log/sharded_db.h"
 #include "log/sqlite_db.h"
 
 static const unsigned kCertStorageDepth = 3;
@@ -26,7 +33,7 @@ template <> void TestDB<FileDB<ct::LoggedCertificate> >::Setup() {
 }
 
 template <> FileDB<ct::LoggedCertificate> *
-TestDB<FileDB<ct::LoggedCertificate> >::SecondDB() const {
+TestDB<FileDB<ct::LoggedCertificate> >::SecondDB() {
   std::string certs_dir = this->tmp_.TmpStorageDir() + "/certs";
   std::string tree_dir = this->tmp_.TmpStorageDir() + "/tree";
   return new FileDB<ct::LoggedCertificate>(new FileStorage(certs_dir,
@@ -40,16 +47,115 @@ template <> void TestDB<SQLiteDB<ct::LoggedCertificate> >::Setup() {
 }
 
 template <> SQLiteDB<ct::LoggedCertificate> *
-TestDB<SQLiteDB<ct::LoggedCertificate> >::SecondDB() const {
+TestDB<SQLiteDB<ct::LoggedCertificate> >::SecondDB() {
   return new SQLiteDB<ct::LoggedCertificate>(tmp_.TmpStorageDir() + "/sqlite");
 }
 
+template <> void TestDB<LevelDB<ct::LoggedCertificate> >::Setup() {
+  db_ = new LevelDB<ct::LoggedCertificate>(tmp_.TmpStorageDir() + "/leveldb");
+}
+
+// LevelDB locks its directory, so the first database has to go.
+template <> LevelDB<ct::LoggedCertificate> *
+TestDB<LevelDB<ct::LoggedCertificate> >::SecondDB() {
+  delete db_;
+  db_ = NULL;
+  return new LevelDB<ct::LoggedCertificate>(tmp_.TmpStorageDir() + "/leveldb");
+}
+
+// A cache small enough that the tests evict from it.
+static const size_t kCacheEntries = 4;
+
+template <> void TestDB<CachingDatabase<ct::LoggedCertificate> >::Setup() {
+  db_ = new CachingDatabase<ct::LoggedCertificate>(
+      new SQLiteDB<ct::LoggedCertificate>(tmp_.TmpStorageDir() + "/sqlite"),
+      kCacheEntries);
+}
+
+template <> CachingDatabase<ct::LoggedCertificate> *
+TestDB<CachingDatabase<ct::LoggedCertificate> >::SecondDB() {
+  return new CachingDatabase<ct::LoggedCertificate>(
+      new SQLiteDB<ct::LoggedCertificate>(tmp_.TmpStorageDir() + "/sqlite"),
+      kCacheEntries);
+}
+
+template <> void TestDB<LockingDatabase<ct::LoggedCertificate> >::Setup() {
+  db_ = new LockingDatabase<ct::LoggedCertificate>(
+      new SQLiteDB<ct::LoggedCertificate>(tmp_.TmpStorageDir() + "/sqlite"));
+}
+
+template <> LockingDatabase<ct::LoggedCertificate> *
+TestDB<LockingDatabase<ct::LoggedCertificate> >::SecondDB() {
+  return new LockingDatabase<ct::LoggedCertificate>(
+      new SQLiteDB<ct::LoggedCertificate>(tmp_.TmpStorageDir() + "/sqlite"));
+}
+
+template <>
+void TestDB<InstrumentedDatabase<ct::LoggedCertificate> >::Setup() {
+  db_ = new InstrumentedDatabase<ct::LoggedCertificate>(
+      new SQLiteDB<ct::LoggedCertificate>(tmp_.TmpStorageDir() + "/sqlite"));
+}
+
+template <> InstrumentedDatabase<ct::LoggedCertificate> *
+TestDB<InstrumentedDatabase<ct::LoggedCertificate> >::SecondDB() {
+  return new InstrumentedDatabase<ct::LoggedCertificate>(
+      new SQLiteDB<ct::LoggedCertificate>(tmp_.TmpStorageDir() + "/sqlite"));
+}
+
+// Shards small enough that the tests span several of them.
+static const uint64_t kShardSize = 3;
+
+template <> void TestDB<ShardedDB<ct::LoggedCertificate> >::Setup() {
+  std::string shards_dir = tmp_.TmpStorageDir() + "/shards";
+  CHECK_ERR(mkdir(shards_dir.c_str(), 0700));
+  db_ = new ShardedDB<ct::LoggedCertificate>(shards_dir, kShardSize);
+}
+
+template <> ShardedDB<ct::LoggedCertificate> *
+TestDB<ShardedDB<ct::LoggedCertificate> >::SecondDB() {
+  return new ShardedDB<ct::LoggedCertificate>(
+      tmp_.TmpStorageDir() + "/shards", kShardSize);
+}
+
+// A cache small enough that the tests read certificates from disk.
+static const size_t kInternedCerts = 2;
+
+template <> void TestDB<InterningDatabase>::Setup() {
+  std::string certs_dir = tmp_.TmpStorageDir() + "/intermediates";
+  CHECK_ERR(mkdir(certs_dir.c_str(), 0700));
+  db_ = new InterningDatabase(
+      new SQLiteDB<ct::LoggedCertificate>(tmp_.TmpStorageDir() + "/sqlite"),
+      new FileStorage(certs_dir, kCertStorageDepth), kInternedCerts);
+}
+
+template <> InterningDatabase *TestDB<InterningDatabase>::SecondDB() {
+  return new InterningDatabase(
+      new SQLiteDB<ct::LoggedCertificate>(tmp_.TmpStorageDir() + "/sqlite"),
+      new FileStorage(tmp_.TmpStorageDir() + "/intermediates",
+                      kCertStorageDepth),
+      kInternedCerts);
+}
+
+template <>
+void TestDB<ArchivingDatabase<ct::LoggedCertificate> >::Setup() {
+  db_ = new ArchivingDatabase<ct::LoggedCertificate>(
+      new SQLiteDB<ct::LoggedCertificate>(tmp_.TmpStorageDir() + "/sqlite"),
+      tmp_.TmpStorageDir() + "/archive", NULL);
+}
+
+template <> ArchivingDatabase<ct::LoggedCertificate> *
+TestDB<ArchivingDatabase<ct::LoggedCertificate> >::SecondDB() {
+  return new ArchivingDatabase<ct::LoggedCertificate>(
+      new SQLiteDB<ct::LoggedCertificate>(tmp_.TmpStorageDir() + "/sqlite"),
+      tmp_.TmpStorageDir() + "/archive", NULL);
+}
+
 // Not a Database; we just use the same template for setup.
 template <> void TestDB<FileStorage>::Setup() {
   db_ = new FileStorage(tmp_.TmpStorageDir(), kCertStorageDepth);
 }
 
-template <> FileStorage *TestDB<FileStorage>::SecondDB() const {
+template <> FileStorage *TestDB<FileStorage>::SecondDB() {
   return new FileStorage(tmp_.TmpStorageDir(), kCertStorageDepth);
 }
 #endif // LOG_TEST_DB_H
@@ -0,0 +1,229 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/tile_exporter.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <glog/logging.h>
+#include <sstream>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "merkletree/serial_hasher.h"
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/util.h"
+
+using std::string;
+
+namespace {
+
+// Collects the entries of a bundle.
+template <class Logged>
+class BundleWriter : public Database<Logged>::EntryCallback {
+ public:
+  BundleWriter() : count_(0) {}
+
+  virtual bool Entry(const Logged &logged) {
+    string leaf_input;
+    string extra_data;
+    CHECK(logged.SerializeForLeaf(&leaf_input));
+    CHECK(logged.SerializeExtraData(&extra_data));
+    bundle_.append(Serializer::SerializeUint(leaf_input.size(), 4));
+    bundle_.append(leaf_input);
+    bundle_.append(Serializer::SerializeUint(extra_data.size(), 4));
+    bundle_.append(extra_data);
+    ++count_;
+    return true;
+  }
+
+  const string &Bundle() const { return bundle_; }
+
+  size_t Count() const { return count_; }
+
+ private:
+  string bundle_;
+  size_t count_;
+};
+
+string Decimal(uint64_t n) {
+  std::ostringstream decimal;
+  decimal << n;
+  return decimal.str();
+}
+
+string ThreeDigits(uint64_t n) {
+  char digits[4];
+  snprintf(digits, sizeof digits, "%03u", static_cast<unsigned>(n % 1000));
+  return digits;
+}
+
+}  // namespace
+
+template <class Logged>
+TileExporter<Logged>::TileExporter(const Database<Logged> *db,
+                                   const string &dir, size_t height)
+    : db_(db),
+      dir_(dir),
+      width_(static_cast<size_t>(1) << height),
+      hasher_(new Sha256Hasher),
+      checkpoint_size_(0),
+      checkpoint_timestamp_(0) {
+  CHECK_NOTNULL(db);
+  CHECK_GT(height, 0U);
+  CHECK_LT(height, 16U);
+  PCHECK(mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST)
+      << "Failed to create " << dir;
+}
+
+template <class Logged> bool TileExporter<Logged>::Export(size_t max_entries) {
+  ct::SignedTreeHead sth;
+  if (db_->LatestTreeHead(&sth) != Database<Logged>::LOOKUP_OK)
+    return true;
+  const size_t tree_size = sth.tree_size();
+  size_t size = Size();
+  CHECK_LE(size, tree_size) << "Tree head older than the exported tiles";
+
+  size_t end = tree_size;
+  if (max_entries > 0)
+    end = std::min(end, size + max_entries);
+  while (size < end) {
+    // Up to the end of the current tile.
+    const size_t tile_end = std::min(end, (size / width_ + 1) * width_);
+    std::vector<string> hashes;
+    CHECK_EQ(Database<Logged>::LOOKUP_OK,
+             db_->LookupLeafHashRange(size, tile_end, &hashes))
+        << "Sequenced entries missing from " << size;
+    for (size_t i = 0; i < hashes.size(); ++i)
+      AddHash(0, hashes[i]);
+    size = tile_end;
+  }
+
+  if (size < tree_size)
+    return false;
+  if (sth.timestamp() == checkpoint_timestamp_)
+    return true;
+
+  // The partial tiles at the right edge of the tree.
+  for (size_t level = 0; level < pending_.size(); ++level) {
+    const std::vector<string> &hashes = pending_[level];
+    if (hashes.empty())
+      continue;
+    string tile;
+    for (size_t i = 0; i < hashes.size(); ++i)
+      tile.append(hashes[i]);
+    WriteFile(TilePath(Decimal(level), tiles_[level], hashes.size()),
+              tile, false);
+  }
+  if (!pending_.empty() && !pending_[0].empty())
+    WriteEntries(tiles_[0], pending_[0].size());
+
+  WriteCheckpoint(sth);
+  checkpoint_size_ = tree_size;
+  checkpoint_timestamp_ = sth.timestamp();
+  return true;
+}
+
+template <class Logged> size_t TileExporter<Logged>::Size() const {
+  if (tiles_.empty())
+    return 0;
+  return tiles_[0] * width_ + pending_[0].size();
+}
+
+template <class Logged>
+void TileExporter<Logged>::AddHash(size_t level, const string &hash) {
+  if (pending_.size() <= level) {
+    pending_.resize(level + 1);
+    tiles_.resize(level + 1, 0);
+  }
+  pending_[level].push_back(hash);
+  if (pending_[level].size() < width_)
+    return;
+
+  string tile;
+  for (size_t i = 0; i < width_; ++i)
+    tile.append(pending_[level][i]);
+  WriteFile(TilePath(Decimal(level), tiles_[level], width_), tile, false);
+  if (level == 0)
+    WriteEntries(tiles_[0], width_);
+
+  const string root = TileRoot(pending_[level]);
+  pending_[level].clear();
+  ++tiles_[level];
+  AddHash(level + 1, root);
+}
+
+template <class Logged>
+string TileExporter<Logged>::TileRoot(const std::vector<string> &hashes) {
+  CHECK_EQ(width_, hashes.size());
+  std::vector<string> nodes(hashes);
+  while (nodes.size() > 1) {
+    for (size_t i = 0; i < nodes.size() / 2; ++i)
+      nodes[i] = hasher_.HashChildren(nodes[2 * i], nodes[2 * i + 1]);
+    nodes.resize(nodes.size() / 2);
+  }
+  return nodes[0];
+}
+
+template <class Logged>
+void TileExporter<Logged>::WriteEntries(uint64_t index, size_t count) {
+  const string path = TilePath("entries", index, count);
+  if (access((dir_ + "/" + path).c_str(), F_OK) == 0)
+    return;
+  const size_t start = index * width_;
+  BundleWriter<Logged> writer;
+  db_->LookupByIndexRange(start, start + count, &writer);
+  CHECK_EQ(count, writer.Count())
+      << "Sequenced entries missing from " << start;
+  WriteFile(path, writer.Bundle(), false);
+}
+
+template <class Logged>
+void TileExporter<Logged>::WriteCheckpoint(const ct::SignedTreeHead &sth) {
+  string signature;
+  CHECK_EQ(Serializer::OK,
+           Serializer::SerializeDigitallySigned(sth.signature(), &signature));
+  std::ostringstream checkpoint;
+  checkpoint << "{ \"tree_size\": " << sth.tree_size()
+             << ", \"timestamp\": " << sth.timestamp()
+             << ", \"sha256_root_hash\": \""
+             << util::ToBase64(sth.sha256_root_hash())
+             << "\", \"tree_head_signature\": \""
+             << util::ToBase64(signature) << "\" }";
+  WriteFile("checkpoint", checkpoint.str(), true);
+}
+
+template <class Logged>
+string TileExporter<Logged>::TilePath(const string &name, uint64_t index,
+                                      size_t count) const {
+  string path = ThreeDigits(index);
+  for (uint64_t n = index / 1000; n > 0; n /= 1000)
+    path = "x" + ThreeDigits(n) + "/" + path;
+  path = "tile/" + name + "/" + path;
+  if (count < width_)
+    path += ".p/" + Decimal(count);
+  return path;
+}
+
+template <class Logged>
+void TileExporter<Logged>::WriteFile(const string &path, const string &data,
+                                     bool replace) {
+  const string file = dir_ + "/" + path;
+  if (!replace && access(file.c_str(), F_OK) == 0)
+    return;
+  // Create the directories on the way.
+  for (size_t slash = path.find('/'); slash != string::npos;
+       slash = path.find('/', slash + 1)) {
+    const string dir = dir_ + "/" + path.substr(0, slash);
+    PCHECK(mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST)
+        << "Failed to create " << dir;
+  }
+  const string tmp_file =
+      util::WriteTemporaryBinaryFile(file + ".XXXXXX", data);
+  CHECK(!tmp_file.empty()) << "Failed to write " << file;
+  // Temporary files are only readable by us, but these are for everyone.
+  PCHECK(chmod(tmp_file.c_str(), 0644) == 0) << "Failed to chmod " << tmp_file;
+  PCHECK(rename(tmp_file.c_str(), file.c_str()) == 0)
+      << "Failed to rename " << tmp_file << " to " << file;
+}
@@ -0,0 +1,89 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef TILE_EXPORTER_H
+#define TILE_EXPORTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/database.h"
+#include "merkletree/tree_hasher.h"
+
+// Writes the log out as static files that a plain web server or CDN can
+// serve, so that clients compute proofs and read entries from a few
+// cacheable files instead of asking the log. Under |dir|:
+//
+//   tile/<L>/<N>        tile N of level L: 2^height node hashes, the
+//                       roots of the subtrees of 2^(height * L) leaves
+//                       starting at leaf N * 2^(height * (L + 1)).
+//   tile/<L>/<N>.p/<W>  the first W hashes of tile N, while it has fewer
+//                       than 2^height.
+//   tile/entries/<N>    the 2^height entries of level 0 tile N, each as
+//                       its MerkleTreeLeaf and extra_data, both preceded
+//                       by their length in 4 bytes, big-endian.
+//   tile/entries/<N>.p/<W>
+//   checkpoint          the signed tree head that the tiles add up to, in
+//                       the JSON of a get-sth reply.
+//
+// <N> is written in groups of three digits, with all but the last group
+// prefixed by an "x", e.g. 1234067 as x001/x234/067.
+//
+// Files other than the checkpoint never change once written, and are
+// written before the checkpoint that refers to them. Exporting starts from
+// the first entry on every run, but doesn't write tiles that exist already.
+//
+// Not thread-safe.
+template <class Logged> class TileExporter {
+ public:
+  // Reads the log from |db|, which must outlive the exporter, and writes
+  // tiles of 2^|height| hashes to |dir|.
+  TileExporter(const Database<Logged> *db, const std::string &dir,
+               size_t height = 8);
+
+  // Export the entries up to the latest signed tree head, but no more than
+  // |max_entries| of them if |max_entries| is not 0, so that large logs can
+  // be caught up on in steps. Writes the checkpoint when all the tiles of
+  // the tree head are written, and returns whether they are.
+  bool Export(size_t max_entries);
+
+  // The number of entries exported.
+  size_t Size() const;
+
+  // The tree size of the last checkpoint written.
+  size_t CheckpointSize() const { return checkpoint_size_; }
+
+ private:
+  // Add the next node hash of |level|, and write its tile once full.
+  void AddHash(size_t level, const std::string &hash);
+
+  // The root of the full tile |hashes|.
+  std::string TileRoot(const std::vector<std::string> &hashes);
+
+  // Write the entries of level 0 tile |index|; |count| of them.
+  void WriteEntries(uint64_t index, size_t count);
+
+  void WriteCheckpoint(const ct::SignedTreeHead &sth);
+
+  // The path of |index| below tile/|name|, with |count| hashes.
+  std::string TilePath(const std::string &name, uint64_t index,
+                       size_t count) const;
+
+  // Write |data| to |path| below |dir_|, through a temporary file. Files
+  // that exist already are left alone, unless |replace| is set.
+  void WriteFile(const std::string &path, const std::string &data,
+                 bool replace);
+
+  const Database<Logged> *const db_;
+  const std::string dir_;
+  const size_t width_;
+  TreeHasher hasher_;
+  // The hashes of each level that don't yet fill a tile.
+  std::vector<std::vector<std::string> > pending_;
+  // The number of full tiles of each level.
+  std::vector<uint64_t> tiles_;
+  size_t checkpoint_size_;
+  uint64_t checkpoint_timestamp_;
+};
+
+#endif
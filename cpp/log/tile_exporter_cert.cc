@@ -0,0 +1,5 @@
+#include "log/tile_exporter.cc"
+
+#include "log/logged_certificate.h"
+
+template class TileExporter<ct::LoggedCertificate>;
@@ -0,0 +1,180 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "log/logged_certificate.h"
+#include "log/sqlite_db.h"
+#include "log/test_db.h"
+#include "log/test_signer.h"
+#include "log/tile_exporter.h"
+#include "log/tree_signer.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/serializer.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace {
+
+using ct::LoggedCertificate;
+using std::string;
+
+typedef Database<LoggedCertificate> DB;
+typedef SQLiteDB<LoggedCertificate> SQLite;
+typedef TileExporter<LoggedCertificate> TE;
+typedef TreeSigner<LoggedCertificate> TS;
+
+// Tiles of 4 hashes keep the trees small.
+const size_t kHeight = 2;
+
+class TileExporterTest : public ::testing::Test {
+ protected:
+  TileExporterTest() : tree_signer_(NULL) {}
+
+  void SetUp() {
+    dir_ = util::CreateTemporaryDirectory("/tmp/tilesXXXXXX");
+    ASSERT_FALSE(dir_.empty());
+    tree_signer_ = new TS(db(), TestSigner::DefaultLogSigner());
+  }
+
+  ~TileExporterTest() { delete tree_signer_; }
+
+  SQLite *db() const { return test_db_.db(); }
+
+  // Log |count| more entries and sign them.
+  void AddEntries(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      LoggedCertificate logged;
+      test_signer_.CreateUnique(&logged);
+      EXPECT_EQ(DB::OK, db()->CreatePendingEntry(logged));
+    }
+    EXPECT_EQ(TS::OK, tree_signer_->UpdateTree());
+  }
+
+  bool Exists(const string &path) const {
+    return access((dir_ + "/" + path).c_str(), F_OK) == 0;
+  }
+
+  string Read(const string &path) const {
+    string data;
+    EXPECT_TRUE(util::ReadBinaryFile(dir_ + "/" + path, &data)) << path;
+    return data;
+  }
+
+  // The leaf hashes of the entries |start| to |end| - 1, concatenated.
+  string LeafHashes(size_t start, size_t end) const {
+    std::vector<string> hashes;
+    EXPECT_EQ(DB::LOOKUP_OK, db()->LookupLeafHashRange(start, end, &hashes));
+    string concatenated;
+    for (size_t i = 0; i < hashes.size(); ++i)
+      concatenated.append(hashes[i]);
+    return concatenated;
+  }
+
+  // The root of the subtree of the entries |start| to |end| - 1.
+  string SubtreeRoot(size_t start, size_t end) const {
+    std::vector<string> hashes;
+    EXPECT_EQ(DB::LOOKUP_OK, db()->LookupLeafHashRange(start, end, &hashes));
+    MerkleTree tree(new Sha256Hasher());
+    for (size_t i = 0; i < hashes.size(); ++i)
+      tree.AddLeafHash(hashes[i]);
+    return tree.CurrentRoot();
+  }
+
+  TestDB<SQLite> test_db_;
+  TestSigner test_signer_;
+  TS *tree_signer_;
+  string dir_;
+};
+
+TEST_F(TileExporterTest, ExportsTiles) {
+  AddEntries(11);
+  TE exporter(db(), dir_, kHeight);
+  EXPECT_TRUE(exporter.Export(0));
+  EXPECT_EQ(11U, exporter.Size());
+  EXPECT_EQ(11U, exporter.CheckpointSize());
+
+  EXPECT_EQ(LeafHashes(0, 4), Read("tile/0/000"));
+  EXPECT_EQ(LeafHashes(4, 8), Read("tile/0/001"));
+  EXPECT_FALSE(Exists("tile/0/002"));
+  EXPECT_EQ(LeafHashes(8, 11), Read("tile/0/002.p/3"));
+  EXPECT_EQ(SubtreeRoot(0, 4) + SubtreeRoot(4, 8), Read("tile/1/000.p/2"));
+  EXPECT_FALSE(Exists("tile/2"));
+
+  // The first entry of the first bundle.
+  const string bundle = Read("tile/entries/000");
+  LoggedCertificate logged;
+  ASSERT_EQ(DB::LOOKUP_OK, db()->LookupByIndex(0, &logged));
+  string leaf_input;
+  ASSERT_TRUE(logged.SerializeForLeaf(&leaf_input));
+  ASSERT_GT(bundle.size(), 4U + leaf_input.size());
+  EXPECT_EQ(Serializer::SerializeUint(leaf_input.size(), 4),
+            bundle.substr(0, 4));
+  EXPECT_EQ(leaf_input, bundle.substr(4, leaf_input.size()));
+  EXPECT_TRUE(Exists("tile/entries/001"));
+  EXPECT_TRUE(Exists("tile/entries/002.p/3"));
+
+  const string checkpoint = Read("checkpoint");
+  EXPECT_NE(string::npos, checkpoint.find("\"tree_size\": 11,"));
+  EXPECT_NE(string::npos, checkpoint.find(
+      util::ToBase64(tree_signer_->LatestSTH().sha256_root_hash())));
+}
+
+TEST_F(TileExporterTest, ExportsInSteps) {
+  AddEntries(7);
+  TE exporter(db(), dir_, kHeight);
+  EXPECT_FALSE(exporter.Export(5));
+  EXPECT_EQ(5U, exporter.Size());
+  // No checkpoint until all the tiles are there.
+  EXPECT_FALSE(Exists("checkpoint"));
+  EXPECT_TRUE(Exists("tile/0/000"));
+  EXPECT_FALSE(Exists("tile/0/001.p/1"));
+
+  EXPECT_TRUE(exporter.Export(5));
+  EXPECT_EQ(7U, exporter.CheckpointSize());
+  EXPECT_EQ(LeafHashes(4, 7), Read("tile/0/001.p/3"));
+
+  // Up to a tree of 16 entries, whose root fills level 2 on its own.
+  AddEntries(9);
+  EXPECT_TRUE(exporter.Export(0));
+  EXPECT_EQ(16U, exporter.CheckpointSize());
+  EXPECT_EQ(LeafHashes(12, 16), Read("tile/0/003"));
+  EXPECT_EQ(SubtreeRoot(0, 4) + SubtreeRoot(4, 8) + SubtreeRoot(8, 12) +
+                SubtreeRoot(12, 16),
+            Read("tile/1/000"));
+  EXPECT_EQ(tree_signer_->LatestSTH().sha256_root_hash(),
+            Read("tile/2/000.p/1"));
+  // The old partial tiles stay for those who read the old checkpoint.
+  EXPECT_TRUE(Exists("tile/0/001.p/3"));
+}
+
+TEST_F(TileExporterTest, Restarts) {
+  AddEntries(6);
+  {
+    TE exporter(db(), dir_, kHeight);
+    EXPECT_TRUE(exporter.Export(0));
+  }
+  AddEntries(3);
+  TE exporter(db(), dir_, kHeight);
+  EXPECT_TRUE(exporter.Export(0));
+  EXPECT_EQ(9U, exporter.CheckpointSize());
+  EXPECT_EQ(LeafHashes(4, 8), Read("tile/0/001"));
+  EXPECT_EQ(LeafHashes(8, 9), Read("tile/0/002.p/1"));
+  EXPECT_NE(string::npos, Read("checkpoint").find("\"tree_size\": 9,"));
+}
+
+TEST_F(TileExporterTest, NothingToExport) {
+  TE exporter(db(), dir_, kHeight);
+  EXPECT_TRUE(exporter.Export(0));
+  EXPECT_FALSE(Exists("checkpoint"));
+}
+
+}  // namespace
+
+int main(int argc, char**argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,25 +1,136 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/tree_signer.h"
 
+#include <algorithm>
 #include <glog/logging.h>
-#include <set>
+#include <limits>
 #include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
 
 #include "log/database.h"
 #include "log/log_signer.h"
 #include "merkletree/compact_merkle_tree.h"
 #include "proto/serializer.h"
+#include "util/startup_profiler.h"
+#include "util/thread_pool.h"
+#include "util/trace.h"
 #include "util/util.h"
 
 using ct::SignedTreeHead;
 using std::string;
+using util::StartupProfiler;
+using util::Tracer;
+
+namespace {
+
+// Number of leaf hashes read from the database at a time when building
+// the tree.
+const size_t kBuildBatchSize = 65536;
+
+size_t HashingThreads() {
+  return util::ThreadPool::Default()->Parallelism();
+}
+
+// Appends the entries of a range lookup to a tree, which must have one leaf
+// per entry before them.
+template <class Logged>
+class LeafAppender : public Database<Logged>::EntryCallback {
+ public:
+  explicit LeafAppender(CompactMerkleTree *tree) : tree_(tree) {}
+
+  virtual bool Entry(const Logged &logged) {
+    CHECK_EQ(logged.sequence_number(), tree_->LeafCount());
+    // Serialize for inclusion in the tree.
+    CHECK(logged.SerializeForLeaf(&serialized_leaf_));
+    tree_->AddLeaf(serialized_leaf_);
+    return true;
+  }
+
+ private:
+  CompactMerkleTree *tree_;
+  // Reused from one entry to the next.
+  string serialized_leaf_;
+};
+
+// Collects the pending entries' hashes, serialized leaves and timestamps,
+// up to |limit| of them (or all, if |limit| is 0). Serializing needs the
+// entry, which only lives for the callback, but the leaves are hashed
+// afterwards, all together.
+template <class Logged>
+class PendingCollector : public Database<Logged>::EntryCallback {
+ public:
+  PendingCollector(size_t limit, std::vector<string> *hashes,
+                   std::vector<string> *leaves,
+                   std::vector<uint64_t> *timestamps)
+      : limit_(limit), more_(false), hashes_(hashes), leaves_(leaves),
+        timestamps_(timestamps) {}
+
+  virtual bool Entry(const Logged &logged) {
+    if (limit_ > 0 && hashes_->size() == limit_) {
+      more_ = true;
+      return false;
+    }
+    CHECK(!logged.has_sequence_number())
+        << "Pending entry already has a sequence number; entry is "
+        << logged.DebugString();
+    hashes_->push_back(logged.Hash());
+    // Serialize for inclusion in the tree.
+    leaves_->push_back(string());
+    CHECK(logged.SerializeForLeaf(&leaves_->back()));
+    timestamps_->push_back(logged.timestamp());
+    return true;
+  }
+
+  // Whether there were more entries than the limit.
+  bool More() const { return more_; }
+
+ private:
+  const size_t limit_;
+  bool more_;
+  std::vector<string> *hashes_;
+  std::vector<string> *leaves_;
+  std::vector<uint64_t> *timestamps_;
+};
+
+struct SignJob {
+  const LogSigner *signer;
+  SignedTreeHead *sth;
+};
+
+void Sign(void *arg) {
+  SignJob *job = static_cast<SignJob*>(arg);
+  if (job->signer->SignTreeHead(job->sth) != LogSigner::OK)
+    // Make this one a hard fail. There is really no excuse for it.
+    abort();
+}
+
+}  // namespace
 
 template <class Logged>
 TreeSigner<Logged>::TreeSigner(Database<Logged> *db, LogSigner *signer)
     : db_(db),
       signer_(signer),
       cert_tree_(new Sha256Hasher()),
-      latest_tree_head_() {
+      latest_tree_head_(),
+      pending_backlog_(false),
+      queue_(NULL),
+      recovering_(true) {
+  BuildTree();
+}
+
+template <class Logged>
+TreeSigner<Logged>::TreeSigner(Database<Logged> *db, LogSigner *signer,
+                               const string &checkpoint_file)
+    : db_(db),
+      signer_(signer),
+      checkpoint_file_(checkpoint_file),
+      cert_tree_(new Sha256Hasher()),
+      latest_tree_head_(),
+      pending_backlog_(false),
+      queue_(NULL),
+      recovering_(true) {
   BuildTree();
 }
 
@@ -27,6 +138,24 @@ template <class Logged> TreeSigner<Logged>::~TreeSigner() {
   delete signer_;
 }
 
+template <class Logged>
+void TreeSigner<Logged>::AddLeafHashObserver(LeafHashObserver *observer) {
+  leaf_hash_observers_.push_back(CHECK_NOTNULL(observer));
+}
+
+template <class Logged>
+void TreeSigner<Logged>::RemoveLeafHashObserver(LeafHashObserver *observer) {
+  leaf_hash_observers_.erase(std::remove(leaf_hash_observers_.begin(),
+                                         leaf_hash_observers_.end(),
+                                         observer),
+                             leaf_hash_observers_.end());
+}
+
+template <class Logged>
+void TreeSigner<Logged>::SetSequencingQueue(SequencingQueue *queue) {
+  queue_ = CHECK_NOTNULL(queue);
+}
+
 template <class Logged> uint64_t TreeSigner<Logged>::LastUpdateTime() const {
   // Returns 0 if we have no update yet (i.e., the field is not set).
   return latest_tree_head_.timestamp();
@@ -36,7 +165,17 @@ template <class Logged> uint64_t TreeSigner<Logged>::LastUpdateTime() const {
 // However, if the database itself is giving inconsistent answers, or failing
 // reads/writes, then we die.
 template <class Logged> typename TreeSigner<Logged>::UpdateResult
-TreeSigner<Logged>::UpdateTree() {
+TreeSigner<Logged>::Update(size_t max_entries, bool pipelined) {
+  Tracer::Span span("tree_signer.update");
+  // Only use a staged batch that the same kind of call would have read.
+  // We are the only signer, so it is still at the head of the queue.
+  PendingBatch pending;
+  const bool use_staged = pipelined && !staged_.hashes.empty() &&
+      staged_.max_entries == max_entries;
+  if (use_staged)
+    pending.Swap(&staged_);
+  staged_ = PendingBatch();
+
   // Check that the latest sth is ours.
   SignedTreeHead sth;
   typename Database<Logged>::LookupResult db_result = db_->LatestTreeHead(&sth);
@@ -63,41 +202,161 @@ TreeSigner<Logged>::UpdateTree() {
   // Timestamps have to be unique.
   uint64_t min_timestamp = LastUpdateTime() + 1;
 
-  std::set<string> pending_hashes = db_->PendingHashes();
-  std::set<string>::const_iterator it;
-  for (it = pending_hashes.begin(); it != pending_hashes.end(); ++it) {
-    Logged logged;
-    CHECK_EQ(Database<Logged>::LOOKUP_OK, db_->LookupByHash(*it, &logged))
-        << "Failed to look up pending entry with hash " << util::HexString(*it);
-
-    CHECK(!logged.has_sequence_number())
-        << "Pending entry already has a sequence number; entry is "
-        << logged.DebugString();
-
-    CHECK_EQ(logged.Hash(), *it);
-    if (!Append(logged)) {
-      LOG(ERROR) << "Assigning sequence number failed";
-      return DB_ERROR;
-    }
-
-    if (logged.timestamp() > min_timestamp)
-      min_timestamp = logged.timestamp();
+  if (!use_staged) {
+    Tracer::Span read("tree_signer.read_pending");
+    ReadPending(max_entries, &pending);
   }
+  const std::vector<string> &pending_hashes = pending.hashes;
+  const std::vector<string> &leaf_hashes = pending.leaf_hashes;
+  const std::vector<uint64_t> &timestamps = pending.timestamps;
+
+  // Commit the sequence numbers in one go, and the tree head along with
+  // them if the database can do it atomically.
+  const bool transactional = db_->Transactional();
+  if (transactional)
+    db_->BeginTransaction();
+  const uint64_t first_sequence_number = cert_tree_.LeafCount();
+  size_t assigned = 0;
+  typename Database<Logged>::WriteResult write_result;
+  {
+    Tracer::Span sequence("tree_signer.assign_sequence_numbers");
+    write_result = db_->AssignSequenceNumbers(
+        pending_hashes, first_sequence_number, &assigned);
+  }
+  CHECK_LE(assigned, pending_hashes.size());
+  if (pending.queued)
+    queued_.erase(queued_.begin(), queued_.begin() + assigned);
+
+  // Update in-memory tree with whatever made it in, so that it stays
+  // consistent with the database.
+  {
+    Tracer::Span hash("tree_signer.hash");
+    cert_tree_.AddLeafHashes(leaf_hashes.begin(),
+                             leaf_hashes.begin() + assigned,
+                             HashingThreads());
+  }
+  if (write_result != Database<Logged>::OK) {
+    CHECK_EQ(Database<Logged>::SEQUENCE_NUMBER_ALREADY_IN_USE, write_result);
+    LOG(ERROR) << "Attempt to assign duplicate sequence number "
+               << cert_tree_.LeafCount();
+    if (transactional)
+      db_->EndTransaction();
+    return DB_ERROR;
+  }
+  // Caught up with the database: from now on, the queue has everything.
+  if (queue_ != NULL && !pending.queued && !pending.more)
+    recovering_ = false;
+
+  for (size_t i = 0; i < assigned; ++i)
+    if (timestamps[i] > min_timestamp)
+      min_timestamp = timestamps[i];
 
   // Our tree is consistent with the database, i.e., each leaf in the tree has
   // a matching sequence number in the database (at least assuming overwriting
   // the sequence number is not allowed).
   SignedTreeHead new_sth;
-  TimestampAndSign(min_timestamp, &new_sth);
+  if (pipelined) {
+    // Signing needs nothing but the signer, so stage the next batch in the
+    // meantime. Entries we just sequenced are no longer pending.
+    Tracer::Span sign("tree_signer.sign_and_stage");
+    Timestamp(min_timestamp, &new_sth);
+    SignJob job = { signer_, &new_sth };
+    util::TaskGroup signing(util::ThreadPool::Default());
+    signing.Run(Sign, &job);
+    ReadPending(max_entries, &staged_);
+    signing.Wait();
+  } else {
+    Tracer::Span sign("tree_signer.sign");
+    TimestampAndSign(min_timestamp, &new_sth);
+  }
+
+  // Observers get the leaf hashes before they can hear of the tree head.
+  if (!leaf_hash_observers_.empty() && assigned > 0) {
+    const std::vector<string> assigned_hashes(
+        leaf_hashes.begin(), leaf_hashes.begin() + assigned);
+    for (size_t i = 0; i < leaf_hash_observers_.size(); ++i)
+      leaf_hash_observers_[i]->NewLeafHashes(first_sequence_number,
+                                             assigned_hashes);
+  }
 
   // TODO(ekasper): if we allow multiple processes to modify the database,
   // then we should lock the database file here and check again that we still
   // own the latest STH.
-  CHECK_EQ(Database<Logged>::OK, db_->WriteTreeHead(new_sth));
-  latest_tree_head_.CopyFrom(new_sth);
+  {
+    Tracer::Span write("tree_signer.write_tree_head");
+    CHECK_EQ(Database<Logged>::OK, db_->WriteTreeHead(new_sth));
+    if (transactional)
+      db_->EndTransaction();
+  }
+  latest_tree_head_.Swap(&new_sth);
+  pending_backlog_ = pending.more;
+  // If we die before this, the next signer simply replays a few more
+  // entries from the previous checkpoint.
+  WriteCheckpoint();
   return OK;
 }
 
+template <class Logged>
+void TreeSigner<Logged>::ReadPending(size_t max_entries,
+                                     PendingBatch *batch) {
+  if (queue_ != NULL && !recovering_) {
+    ReadQueued(max_entries, batch);
+    return;
+  }
+  *batch = PendingBatch();
+  batch->max_entries = max_entries;
+  std::vector<string> leaves;
+  PendingCollector<Logged> collector(max_entries, &batch->hashes, &leaves,
+                                     &batch->timestamps);
+  // Ask for one more entry than we take, to find out whether we leave any
+  // behind.
+  db_->LookupPendingEntries(max_entries > 0 ? max_entries + 1 : 0,
+                            &collector);
+  batch->more = collector.More();
+  // Each leaf hashes on its own, so large batches hash across the cores;
+  // only appending them to the tree has to follow the sequence.
+  cert_tree_.LeafHashes(leaves, &batch->leaf_hashes, HashingThreads());
+  if (queue_ != NULL)
+    recovered_.insert(batch->hashes.begin(), batch->hashes.end());
+}
+
+template <class Logged>
+void TreeSigner<Logged>::ReadQueued(size_t max_entries, PendingBatch *batch) {
+  if (recovered_.empty()) {
+    queue_->Drain(&queued_);
+  } else {
+    std::deque<SequencingQueue::Entry> drained;
+    queue_->Drain(&drained);
+    for (size_t i = 0; i < drained.size(); ++i) {
+      if (recovered_.erase(drained[i].hash) > 0)
+        continue;
+      queued_.push_back(SequencingQueue::Entry());
+      SequencingQueue::Entry &entry = queued_.back();
+      entry.hash.swap(drained[i].hash);
+      entry.leaf.swap(drained[i].leaf);
+      entry.timestamp = drained[i].timestamp;
+    }
+  }
+
+  *batch = PendingBatch();
+  batch->max_entries = max_entries;
+  batch->queued = true;
+  size_t count = queued_.size();
+  if (max_entries > 0 && count > max_entries) {
+    count = max_entries;
+    batch->more = true;
+  }
+  // Copied, as the entries stay queued until they are sequenced.
+  std::vector<string> leaves(count);
+  for (size_t i = 0; i < count; ++i) {
+    const SequencingQueue::Entry &entry = queued_[i];
+    batch->hashes.push_back(entry.hash);
+    leaves[i] = entry.leaf;
+    batch->timestamps.push_back(entry.timestamp);
+  }
+  cert_tree_.LeafHashes(leaves, &batch->leaf_hashes, HashingThreads());
+}
+
 template <class Logged> void TreeSigner<Logged>::BuildTree() {
   DCHECK_EQ(0U, cert_tree_.LeafCount())
       << "Attempting to build a tree when one already exists";
@@ -116,73 +375,106 @@ template <class Logged> void TreeSigner<Logged>::BuildTree() {
   CHECK_LE(sth.timestamp(), current_time)
       << "Database has a timestamp from the future.";
 
-  // Read all logged and signed entries.
-  for (size_t i = 0; i < sth.tree_size(); ++i) {
-    Logged logged;
-    CHECK_EQ(Database<Logged>::LOOKUP_OK, db_->LookupByIndex(i, &logged));
-    CHECK_LE(logged.timestamp(), sth.timestamp());
-    CHECK_EQ(logged.sequence_number(), i);
-
-    AppendToTree(logged);
+  // Read the leaf hashes of all logged and signed entries that the
+  // checkpoint doesn't cover. The root check below vouches for them.
+  StartupProfiler::Phase phase("rebuilding tree", "leaves");
+  phase.SetTotal(sth.tree_size());
+  RestoreCheckpoint(sth.tree_size());
+  size_t restored = cert_tree_.LeafCount();
+  phase.Add(restored);
+  for (;;) {
+    for (size_t i = restored; i < sth.tree_size(); i += kBuildBatchSize) {
+      size_t end = std::min<size_t>(i + kBuildBatchSize, sth.tree_size());
+      std::vector<string> leaf_hashes;
+      CHECK_EQ(Database<Logged>::LOOKUP_OK,
+               db_->LookupLeafHashRange(i, end, &leaf_hashes));
+      cert_tree_.AddLeafHashes(leaf_hashes.begin(), leaf_hashes.end(),
+                               HashingThreads());
+      phase.Add(leaf_hashes.size());
+    }
+    if (restored == 0 || cert_tree_.CurrentRoot() == sth.sha256_root_hash())
+      break;
+    // The checkpoint is of another tree, e.g. of a database since restored
+    // from a backup; start over without it.
+    LOG(WARNING) << "Tree checkpoint " << checkpoint_file_ << " for "
+                 << restored << " entries does not match the latest tree "
+                 << "head, rebuilding the tree from the database";
+    // An empty tree.
+    CHECK(cert_tree_.Restore(string(8, '\0')));
+    restored = 0;
+    phase.SetTotal(2 * sth.tree_size());
   }
 
   // Check the root hash.
   CHECK_EQ(cert_tree_.CurrentRoot(), sth.sha256_root_hash());
 
   latest_tree_head_.CopyFrom(sth);
+  if (restored < sth.tree_size())
+    WriteCheckpoint();
 
   // Read the remaining sequenced entries. Note that it is possible to have more
   // entries with sequence numbers than what the latest sth says. This happens
   // when we assign some sequence numbers but die before we manage to sign the
   // sth. It's not an inconsistency and will be corrected with UpdateTree().
-  for (size_t i = sth.tree_size(); ; ++i) {
-    Logged logged;
-    typename Database<Logged>::LookupResult db_result =
-        db_->LookupByIndex(i, &logged);
-    if (db_result == Database<Logged>::NOT_FOUND)
-      break;
-    CHECK_EQ(Database<Logged>::LOOKUP_OK, db_result);
-    CHECK_EQ(logged.sequence_number(), i);
-
-    AppendToTree(logged);
-  }
+  // The range lookup stops at the first missing entry.
+  LeafAppender<Logged> appender(&cert_tree_);
+  db_->LookupByIndexRange(sth.tree_size(),
+                          std::numeric_limits<uint64_t>::max(), &appender);
 }
 
-template <class Logged> bool
-TreeSigner<Logged>::Append(const Logged &logged) {
-  // Serialize for inclusion in the tree.
-  string serialized_leaf;
-  CHECK(logged.SerializeForLeaf(&serialized_leaf));
-
-  // Commit the sequence number of this certificate.
-  typename Database<Logged>::WriteResult db_result =
-      db_->AssignSequenceNumber(logged.Hash(), cert_tree_.LeafCount());
-
-  if (db_result != Database<Logged>::OK) {
-    CHECK_EQ(Database<Logged>::SEQUENCE_NUMBER_ALREADY_IN_USE, db_result);
-    LOG(ERROR) << "Attempt to assign duplicate sequence number "
-               << cert_tree_.LeafCount();
-    return false;
+template <class Logged>
+void TreeSigner<Logged>::RestoreCheckpoint(size_t tree_size) {
+  if (checkpoint_file_.empty())
+    return;
+  string checkpoint;
+  if (!util::ReadBinaryFile(checkpoint_file_, &checkpoint)) {
+    LOG(INFO) << "No tree checkpoint in " << checkpoint_file_
+              << ", rebuilding the tree from the database";
+    return;
   }
-
-  // Update in-memory tree.
-  cert_tree_.AddLeaf(serialized_leaf);
-  return true;
+  CompactMerkleTree tree(new Sha256Hasher());
+  if (!tree.Restore(checkpoint)) {
+    LOG(WARNING) << "Ignoring malformed tree checkpoint " << checkpoint_file_;
+    return;
+  }
+  // We only write checkpoints for signed tree heads, so one that is ahead of
+  // the latest tree head does not belong to this database.
+  if (tree.LeafCount() > tree_size) {
+    LOG(WARNING) << "Ignoring tree checkpoint " << checkpoint_file_
+                 << " for " << tree.LeafCount() << " entries; the latest "
+                 << "tree head has " << tree_size;
+    return;
+  }
+  CHECK(cert_tree_.Restore(checkpoint));
 }
 
-template <class Logged> void
-TreeSigner<Logged>::AppendToTree(const Logged &logged) {
-  // Serialize for inclusion in the tree.
-  string serialized_leaf;
-  CHECK(logged.SerializeForLeaf(&serialized_leaf));
-
-  // Update in-memory tree.
-  cert_tree_.AddLeaf(serialized_leaf);
+template <class Logged> void TreeSigner<Logged>::WriteCheckpoint() {
+  if (checkpoint_file_.empty())
+    return;
+  Tracer::Span span("tree_signer.write_checkpoint");
+  string checkpoint;
+  cert_tree_.Checkpoint(&checkpoint);
+  // Write a new file and rename it over the old one, so that a crash never
+  // leaves a partial checkpoint behind.
+  string tmp_file =
+      util::WriteTemporaryBinaryFile(checkpoint_file_ + ".XXXXXX", checkpoint);
+  CHECK(!tmp_file.empty()) << "Failed to write tree checkpoint";
+  PCHECK(rename(tmp_file.c_str(), checkpoint_file_.c_str()) == 0)
+      << "Failed to rename " << tmp_file << " to " << checkpoint_file_;
 }
 
 template <class Logged> void
 TreeSigner<Logged>::TimestampAndSign(uint64_t min_timestamp,
                                      SignedTreeHead *sth) {
+  Timestamp(min_timestamp, sth);
+  LogSigner::SignResult ret = signer_->SignTreeHead(sth);
+  if (ret != LogSigner::OK)
+    // Make this one a hard fail. There is really no excuse for it.
+    abort();
+}
+
+template <class Logged> void
+TreeSigner<Logged>::Timestamp(uint64_t min_timestamp, SignedTreeHead *sth) {
   sth->set_version(ct::V1);
   sth->set_sha256_root_hash(cert_tree_.CurrentRoot());
   uint64_t timestamp = util::TimeInMilliseconds();
@@ -192,8 +484,4 @@ TreeSigner<Logged>::TimestampAndSign(uint64_t min_timestamp,
     timestamp = min_timestamp;
   sth->set_timestamp(timestamp);
   sth->set_tree_size(cert_tree_.LeafCount());
-  LogSigner::SignResult ret = signer_->SignTreeHead(sth);
-  if (ret != LogSigner::OK)
-    // Make this one a hard fail. There is really no excuse for it.
-    abort();
 }
@@ -1,14 +1,35 @@
 #ifndef TREE_SIGNER_H
 #define TREE_SIGNER_H
 
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <stddef.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
+#include "log/sequencing_queue.h"
 #include "merkletree/compact_merkle_tree.h"
 #include "proto/ct.pb.h"
 
 template <class Logged> class Database;
 class LogSigner;
 
+// Told about the leaf hashes of the entries that a TreeSigner sequences,
+// e.g. by a LogLookup on the same database, so that it need not read them
+// back.
+class LeafHashObserver {
+ public:
+  virtual ~LeafHashObserver() {}
+
+  // |leaf_hashes| are those of the entries sequenced from |first| on, up to
+  // the size of the tree head about to be written. Called on the signing
+  // thread before the tree head is written.
+  virtual void NewLeafHashes(uint64_t first,
+                             const std::vector<std::string> &leaf_hashes) = 0;
+};
+
 // Signer for appending new entries to the log.
 // This is the single authority that assigns sequence numbers to new entries,
 // timestamps and signs tree heads. The signer process assumes there are
@@ -19,6 +40,12 @@ template <class Logged> class TreeSigner {
  public:
   // Takes ownership of |signer|.
   TreeSigner(Database<Logged> *db, LogSigner *signer);
+
+  // As above, but also checkpoints the tree to |checkpoint_file| with each
+  // new tree head, and on startup only replays the entries sequenced after
+  // the checkpoint. An empty path disables checkpointing.
+  TreeSigner(Database<Logged> *db, LogSigner *signer,
+             const std::string &checkpoint_file);
   ~TreeSigner();
 
   enum UpdateResult {
@@ -30,10 +57,48 @@ template <class Logged> class TreeSigner {
   // Latest Tree Head timestamp;
   uint64_t LastUpdateTime() const;
 
+  // Does not take ownership of |observer|, which must outlive the signer or
+  // be removed first.
+  void AddLeafHashObserver(LeafHashObserver *observer);
+
+  void RemoveLeafHashObserver(LeafHashObserver *observer);
+
+  // Sequence the entries pushed onto |queue|, in the order they were
+  // pushed, rather than look for pending entries in the database. Updates
+  // still read the database until one finds no more pending entries than
+  // it takes, so that entries written before the queue was set are not
+  // left behind; those that are also on the queue are sequenced once.
+  // From now on, every entry written to the database as pending must be
+  // pushed onto |queue| after it is written, e.g. by a FrontendSigner.
+  // Does not take ownership of |queue|, which must outlive the signer.
+  // Call before the first update.
+  void SetSequencingQueue(SequencingQueue *queue);
+
   // Simplest update mechanism: take all pending entries and append
-  // (in random order) to the tree. Checks that the update it writes
+  // (oldest first) to the tree. Checks that the update it writes
   // to the database is consistent with the latest STH.
-  UpdateResult UpdateTree();
+  UpdateResult UpdateTree() { return UpdateTree(0); }
+
+  // As above, but append at most |max_entries| entries (or all of them, if
+  // |max_entries| is 0), to bound how long a round holds the database after
+  // a burst of submissions.
+  UpdateResult UpdateTree(size_t max_entries) {
+    return Update(max_entries, false);
+  }
+
+  // As above, but while the new tree head is being signed, also read and
+  // hash the next batch of pending entries, so that the next call can
+  // sequence them right away. That batch is exactly what the next call
+  // appends: entries that arrive in between wait for the call after.
+  // UpdateTree() drops the staged batch and reads the pending entries anew.
+  UpdateResult UpdateTreePipelined(size_t max_entries) {
+    return Update(max_entries, true);
+  }
+
+  // Whether the last successful update left pending entries behind because
+  // of its cap. If so, the caller should update again soon rather than wait
+  // for its usual interval.
+  bool PendingBacklog() const { return pending_backlog_; }
 
   // Latest Tree Head (does not build a new tree, just retrieves the
   // result of the most recent build).
@@ -42,17 +107,64 @@ template <class Logged> class TreeSigner {
   }
 
  private:
+  // Pending entries, oldest first.
+  struct PendingBatch {
+    PendingBatch() : max_entries(0), more(false), queued(false) {}
+
+    void Swap(PendingBatch *other) {
+      std::swap(max_entries, other->max_entries);
+      std::swap(more, other->more);
+      std::swap(queued, other->queued);
+      hashes.swap(other->hashes);
+      leaf_hashes.swap(other->leaf_hashes);
+      timestamps.swap(other->timestamps);
+    }
+    // The cap that the batch was read with.
+    size_t max_entries;
+    // Whether there were more entries than the cap.
+    bool more;
+    // Whether the entries are the first of |queued_|, rather than read
+    // from the database.
+    bool queued;
+    std::vector<std::string> hashes;
+    std::vector<std::string> leaf_hashes;
+    std::vector<uint64_t> timestamps;
+  };
+
+  UpdateResult Update(size_t max_entries, bool pipelined);
+  void ReadPending(size_t max_entries, PendingBatch *batch);
+  // ReadPending() from the queue.
+  void ReadQueued(size_t max_entries, PendingBatch *batch);
   void BuildTree();
-  bool Append(const Logged &logged);
-  void AppendToTree(const Logged &logged_cert);
+  // Restore |cert_tree_| from the checkpoint file, if there is a usable one
+  // for at most |tree_size| leaves.
+  void RestoreCheckpoint(size_t tree_size);
+  void WriteCheckpoint();
   void TimestampAndSign(uint64_t min_timestamp, ct::SignedTreeHead *sth);
+  // The unsigned part of TimestampAndSign().
+  void Timestamp(uint64_t min_timestamp, ct::SignedTreeHead *sth);
   Database<Logged> *db_;
   LogSigner *signer_;
+  const std::string checkpoint_file_;
   // TODO(ekasper): it's a waste for the signer to keep the entire tree in
   // memory. Implement a compact version of the tree that runs in "restricted"
   // mode, i.e., only remembers O(log n) nodes and cannot answer queries
   // about audit paths or previous snapshots.
   CompactMerkleTree cert_tree_;
   ct::SignedTreeHead latest_tree_head_;
+  bool pending_backlog_;
+  // Read by the last UpdateTreePipelined(), to be appended by the next one.
+  PendingBatch staged_;
+  std::vector<LeafHashObserver*> leaf_hash_observers_;
+  // NULL unless set.
+  SequencingQueue *queue_;
+  // Whether updates still read the pending entries from the database.
+  bool recovering_;
+  // The hashes of the entries read from the database while recovering,
+  // to skip on the queue. Each is dropped once it turns up there, so the
+  // set only keeps those pending before the queue was set.
+  std::set<std::string> recovered_;
+  // Drained from the queue but not yet sequenced, oldest first.
+  std::deque<SequencingQueue::Entry> queued_;
 };
 #endif
@@ -2,10 +2,12 @@
 #include <gtest/gtest.h>
 #include <stdint.h>
 #include <string>
+#include <unistd.h>
 
 #include "log/file_db.h"
 #include "log/log_signer.h"
 #include "log/log_verifier.h"
+#include "log/sequencing_queue.h"
 #include "log/sqlite_db.h"
 #include "log/test_db.h"
 #include "log/test_signer.h"
@@ -24,6 +26,33 @@ using std::string;
 typedef Database<LoggedCertificate> DB;
 typedef TreeSigner<LoggedCertificate> TS;
 
+// Tree heads signed in quick succession get timestamps ahead of the clock,
+// and a new signer refuses tree heads from the future. Wait for the clock
+// to catch up with the latest one in |db|.
+void WaitForLatestTreeHead(const DB *db) {
+  SignedTreeHead sth;
+  if (db->LatestTreeHead(&sth) != DB::LOOKUP_OK)
+    return;
+  while (util::TimeInMilliseconds() <= sth.timestamp())
+    usleep(1000);
+}
+
+// Write |logged| as pending to |db|, and push it onto |queue|, as a
+// FrontendSigner would.
+void CreateQueued(DB *db, SequencingQueue *queue,
+                  const LoggedCertificate &logged) {
+  EXPECT_EQ(DB::OK, db->CreatePendingEntry(logged));
+  string leaf;
+  CHECK(logged.SerializeForLeaf(&leaf));
+  queue->Push(logged.Hash(), &leaf, logged.timestamp());
+}
+
+uint64_t SequenceNumber(const DB *db, const LoggedCertificate &logged) {
+  LoggedCertificate result;
+  EXPECT_EQ(DB::LOOKUP_OK, db->LookupByHash(logged.Hash(), &result));
+  return result.sequence_number();
+}
+
 template <class T> class TreeSignerTest : public ::testing::Test {
  protected:
   TreeSignerTest()
@@ -94,6 +123,121 @@ TYPED_TEST(TreeSignerTest, Timestamp) {
   EXPECT_GE(this->tree_signer_->LastUpdateTime(), future);
 }
 
+TYPED_TEST(TreeSignerTest, MaxEntries) {
+  for (size_t i = 0; i < 5; ++i) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+  }
+
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree(2));
+  EXPECT_EQ(2U, this->tree_signer_->LatestSTH().tree_size());
+  EXPECT_EQ(3U, this->db()->PendingHashes().size());
+  EXPECT_TRUE(this->tree_signer_->PendingBacklog());
+
+  // Exactly the rest is no backlog.
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree(3));
+  EXPECT_EQ(5U, this->tree_signer_->LatestSTH().tree_size());
+  EXPECT_TRUE(this->db()->PendingHashes().empty());
+  EXPECT_FALSE(this->tree_signer_->PendingBacklog());
+
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  EXPECT_EQ(6U, this->tree_signer_->LatestSTH().tree_size());
+  EXPECT_FALSE(this->tree_signer_->PendingBacklog());
+}
+
+TYPED_TEST(TreeSignerTest, Pipelined) {
+  for (size_t i = 0; i < 5; ++i) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+  }
+
+  // Sequences two, stages the next two.
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTreePipelined(2));
+  EXPECT_EQ(2U, this->tree_signer_->LatestSTH().tree_size());
+  EXPECT_TRUE(this->tree_signer_->PendingBacklog());
+
+  // Takes the staged entries even though the cap would allow some more.
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTreePipelined(2));
+  EXPECT_EQ(4U, this->tree_signer_->LatestSTH().tree_size());
+
+  // A different cap rereads the queue. So does a plain update.
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTreePipelined(1));
+  EXPECT_EQ(5U, this->tree_signer_->LatestSTH().tree_size());
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  EXPECT_EQ(6U, this->tree_signer_->LatestSTH().tree_size());
+  EXPECT_TRUE(this->db()->PendingHashes().empty());
+  EXPECT_FALSE(this->tree_signer_->PendingBacklog());
+
+  // The tree heads are the same as without pipelining.
+  SignedTreeHead sth;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LatestTreeHead(&sth));
+  EXPECT_EQ(LogVerifier::VERIFY_OK, this->verifier_->VerifySignedTreeHead(sth));
+  WaitForLatestTreeHead(this->db());
+  TS *signer2 = this->GetSimilar();
+  EXPECT_EQ(sth.sha256_root_hash(), signer2->LatestSTH().sha256_root_hash());
+  delete signer2;
+}
+
+TYPED_TEST(TreeSignerTest, SequencingQueue) {
+  // Pending before the queue, and so only in the database.
+  for (size_t i = 0; i < 2; ++i) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+  }
+  SequencingQueue queue;
+  this->tree_signer_->SetSequencingQueue(&queue);
+  LoggedCertificate queued[5];
+  for (size_t i = 0; i < 5; ++i)
+    this->test_signer_.CreateUnique(&queued[i]);
+
+  // Reads the database until it has caught up, and then skips what it
+  // read there on the queue.
+  CreateQueued(this->db(), &queue, queued[0]);
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree(2));
+  EXPECT_EQ(2U, this->tree_signer_->LatestSTH().tree_size());
+  EXPECT_TRUE(this->tree_signer_->PendingBacklog());
+  CreateQueued(this->db(), &queue, queued[1]);
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree(2));
+  EXPECT_EQ(4U, this->tree_signer_->LatestSTH().tree_size());
+  EXPECT_FALSE(this->tree_signer_->PendingBacklog());
+  EXPECT_TRUE(this->db()->PendingHashes().empty());
+
+  // Then only the queue, in its order.
+  CreateQueued(this->db(), &queue, queued[3]);
+  CreateQueued(this->db(), &queue, queued[2]);
+  LoggedCertificate unqueued;
+  this->test_signer_.CreateUnique(&unqueued);
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(unqueued));
+  CreateQueued(this->db(), &queue, queued[4]);
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTreePipelined(2));
+  EXPECT_EQ(6U, this->tree_signer_->LatestSTH().tree_size());
+  EXPECT_TRUE(this->tree_signer_->PendingBacklog());
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTreePipelined(2));
+  EXPECT_EQ(7U, this->tree_signer_->LatestSTH().tree_size());
+  EXPECT_FALSE(this->tree_signer_->PendingBacklog());
+  EXPECT_EQ(4U, SequenceNumber(this->db(), queued[3]));
+  EXPECT_EQ(5U, SequenceNumber(this->db(), queued[2]));
+  EXPECT_EQ(6U, SequenceNumber(this->db(), queued[4]));
+  EXPECT_EQ(1U, this->db()->PendingHashes().size());
+
+  // The tree is the database's.
+  SignedTreeHead sth;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LatestTreeHead(&sth));
+  WaitForLatestTreeHead(this->db());
+  TS *signer2 = this->GetSimilar();
+  EXPECT_EQ(sth.sha256_root_hash(), signer2->LatestSTH().sha256_root_hash());
+  delete signer2;
+}
+
 TYPED_TEST(TreeSignerTest, Verify) {
   LoggedCertificate logged_cert;
   this->test_signer_.CreateUnique(&logged_cert);
@@ -158,6 +302,91 @@ TYPED_TEST(TreeSignerTest, ResumePartialSign) {
   delete signer2;
 }
 
+TYPED_TEST(TreeSignerTest, ResumeFromCheckpoint) {
+  TmpStorage tmp;
+  string checkpoint_file = tmp.TmpStorageDir() + "/checkpoint";
+  TS signer(this->db(), TestSigner::DefaultLogSigner(), checkpoint_file);
+
+  for (size_t i = 0; i < 3; ++i) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+    EXPECT_EQ(TS::OK, signer.UpdateTree());
+  }
+  string checkpoint;
+  EXPECT_TRUE(util::ReadBinaryFile(checkpoint_file, &checkpoint));
+
+  // Another entry gets signed without updating the checkpoint, so the next
+  // signer has to replay it on top of the checkpoint.
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+  WaitForLatestTreeHead(this->db());
+  TS *plain_signer = this->GetSimilar();
+  EXPECT_EQ(TS::OK, plain_signer->UpdateTree());
+  delete plain_signer;
+  SignedTreeHead sth;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LatestTreeHead(&sth));
+  EXPECT_EQ(4U, sth.tree_size());
+
+  WaitForLatestTreeHead(this->db());
+  TS signer2(this->db(), TestSigner::DefaultLogSigner(), checkpoint_file);
+  EXPECT_EQ(sth.timestamp(), signer2.LastUpdateTime());
+  EXPECT_EQ(sth.sha256_root_hash(), signer2.LatestSTH().sha256_root_hash());
+  // The checkpoint has caught up with the tree head.
+  string checkpoint2;
+  EXPECT_TRUE(util::ReadBinaryFile(checkpoint_file, &checkpoint2));
+  EXPECT_NE(checkpoint, checkpoint2);
+
+  EXPECT_EQ(TS::OK, signer2.UpdateTree());
+  SignedTreeHead sth2;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LatestTreeHead(&sth2));
+  EXPECT_EQ(sth.sha256_root_hash(), sth2.sha256_root_hash());
+}
+
+// A checkpoint of another tree, here that of another database, is
+// replaced by one rebuilt from the database.
+TYPED_TEST(TreeSignerTest, StaleCheckpoint) {
+  TmpStorage tmp;
+  string checkpoint_file = tmp.TmpStorageDir() + "/checkpoint";
+  {
+    TestDB<TypeParam> other_db;
+    TS other_signer(other_db.db(), TestSigner::DefaultLogSigner(),
+                    checkpoint_file);
+    for (size_t i = 0; i < 2; ++i) {
+      LoggedCertificate logged_cert;
+      this->test_signer_.CreateUnique(&logged_cert);
+      EXPECT_EQ(DB::OK, other_db.db()->CreatePendingEntry(logged_cert));
+      EXPECT_EQ(TS::OK, other_signer.UpdateTree());
+    }
+  }
+  string checkpoint;
+  EXPECT_TRUE(util::ReadBinaryFile(checkpoint_file, &checkpoint));
+
+  for (size_t i = 0; i < 3; ++i) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    EXPECT_EQ(DB::OK, this->db()->CreatePendingEntry(logged_cert));
+    EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  }
+  SignedTreeHead sth;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LatestTreeHead(&sth));
+  EXPECT_EQ(3U, sth.tree_size());
+
+  WaitForLatestTreeHead(this->db());
+  TS signer(this->db(), TestSigner::DefaultLogSigner(), checkpoint_file);
+  EXPECT_EQ(sth.sha256_root_hash(), signer.LatestSTH().sha256_root_hash());
+  string checkpoint2;
+  EXPECT_TRUE(util::ReadBinaryFile(checkpoint_file, &checkpoint2));
+  EXPECT_NE(checkpoint, checkpoint2);
+
+  // Which works from then on.
+  WaitForLatestTreeHead(this->db());
+  TS signer2(this->db(), TestSigner::DefaultLogSigner(), checkpoint_file);
+  EXPECT_EQ(sth.sha256_root_hash(), signer2.LatestSTH().sha256_root_hash());
+  EXPECT_EQ(TS::OK, signer2.UpdateTree());
+}
+
 TYPED_TEST(TreeSignerTest, SignEmpty) {
   EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
   SignedTreeHead sth;
@@ -2,8 +2,11 @@
 #include "log/verifier.h"
 
 #include <glog/logging.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
 #include <openssl/evp.h>
 #include <openssl/opensslv.h>
+#include <openssl/sha.h>
 #include <stdint.h>
 
 #include "merkletree/serial_hasher.h"
@@ -17,11 +20,15 @@
 namespace ct {
 
 Verifier::Verifier(EVP_PKEY *pkey)
-    : pkey_(CHECK_NOTNULL(pkey)) {
+    : pkey_(CHECK_NOTNULL(pkey)),
+      ec_key_(NULL) {
   switch (pkey_->type) {
     case EVP_PKEY_EC:
       hash_algo_ = DigitallySigned::SHA256;
       sig_algo_ = DigitallySigned::ECDSA;
+      ec_key_ = CHECK_NOTNULL(EVP_PKEY_get1_EC_KEY(pkey_));
+      // Multiples of the generator, which every signature needs.
+      CHECK_EQ(1, EC_KEY_precompute_mult(ec_key_, NULL));
       break;
     default:
       LOG(FATAL) << "Unsupported key type " << pkey_->type;
@@ -30,6 +37,7 @@ Verifier::Verifier(EVP_PKEY *pkey)
 }
 
 Verifier::~Verifier() {
+  EC_KEY_free(ec_key_);
   EVP_PKEY_free(pkey_);
 }
 
@@ -65,22 +73,21 @@ std::string Verifier::ComputeKeyID(EVP_PKEY *pkey) {
 
 Verifier::Verifier()
     : pkey_(NULL),
+      ec_key_(NULL),
       hash_algo_(DigitallySigned::NONE),
       sig_algo_(DigitallySigned::ANONYMOUS) {}
 
+// What EVP_VerifyFinal() does for an EC key, without setting up a digest
+// and key context for every signature.
 bool Verifier::RawVerify(const std::string &data,
                          const std::string &sig_string) const {
-  EVP_MD_CTX ctx;
-  EVP_MD_CTX_init(&ctx);
-  // NOTE: this syntax for setting the hash function requires OpenSSL >= 1.0.0.
-  CHECK_EQ(1, EVP_VerifyInit(&ctx, EVP_sha256()));
-  CHECK_EQ(1, EVP_VerifyUpdate(&ctx, data.data(), data.size()));
-  bool ret =
-      (EVP_VerifyFinal(
-          &ctx, reinterpret_cast<const unsigned char*>(sig_string.data()),
-          sig_string.size(), pkey_) == 1);
-  EVP_MD_CTX_cleanup(&ctx);
-  return ret;
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const unsigned char*>(data.data()), data.size(),
+         digest);
+  return ECDSA_verify(
+      0, digest, sizeof(digest),
+      reinterpret_cast<const unsigned char*>(sig_string.data()),
+      sig_string.size(), ec_key_) == 1;
 }
 
 }  // namespace ct
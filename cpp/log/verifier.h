@@ -4,6 +4,7 @@
 #ifndef SRC_LOG_VERIFIER_H_
 #define SRC_LOG_VERIFIER_H_
 
+#include <openssl/ec.h>
 #include <openssl/evp.h>
 #include <openssl/x509.h>  // for i2d_PUBKEY
 #include <stdint.h>
@@ -39,6 +40,8 @@ class Verifier {
   bool RawVerify(const std::string &data, const std::string &sig_string) const;
 
   EVP_PKEY *pkey_;
+  // The key of |pkey_|, to sign digests with directly.
+  EC_KEY *ec_key_;
   DigitallySigned::HashAlgorithm hash_algo_;
   DigitallySigned::SignatureAlgorithm sig_algo_;
   std::string key_id_;
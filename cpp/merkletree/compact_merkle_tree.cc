@@ -2,6 +2,7 @@
 
 #include <glog/logging.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -15,6 +16,7 @@ CompactMerkleTree::CompactMerkleTree(SerialHasher *hasher)
       leaf_count_(0),
       leaves_processed_(0),
       level_count_(0) {
+  CHECK_LE(treehasher_.DigestSize(), static_cast<size_t>(Digest::kMaxSize));
   root_ = treehasher_.HashEmpty();
 }
 
@@ -26,6 +28,7 @@ CompactMerkleTree::CompactMerkleTree(MerkleTree &model,
       leaf_count_(model.LeafCount()),
       leaves_processed_(0),
       level_count_(model.LevelCount()) {
+  CHECK_LE(treehasher_.DigestSize(), static_cast<size_t>(Digest::kMaxSize));
   if (model.LeafCount() == 0) {
     return;
   }
@@ -85,7 +88,7 @@ CompactMerkleTree::CompactMerkleTree(MerkleTree &model,
   // Now tree_ should contain a representation of the tree state just before
   // the last entry was added, so we PushBack the final right-hand entry
   // here, which will perform any recalculations necessary to reach the final tree.
-  PushBack(0, model.LeafHash(model.LeafCount()));
+  PushBack(0, Digest(model.LeafHash(model.LeafCount())));
   CHECK_EQ(model.CurrentRoot(), CurrentRoot());
   CHECK_EQ(model.LeafCount(), LeafCount());
   CHECK_EQ(model.LevelCount(), LevelCount());
@@ -95,10 +98,17 @@ CompactMerkleTree::~CompactMerkleTree() {}
 
 
 size_t CompactMerkleTree::AddLeaf(const string &data) {
-  return AddLeafHash(treehasher_.HashLeaf(data));
+  Digest hash;
+  treehasher_.HashLeaf(data, &hash);
+  return AddLeafHash(hash);
 }
 
 size_t CompactMerkleTree::AddLeafHash(const string &hash) {
+  CHECK_EQ(hash.size(), treehasher_.DigestSize());
+  return AddLeafHash(Digest(hash));
+}
+
+size_t CompactMerkleTree::AddLeafHash(const Digest &hash) {
   PushBack(0, hash);
   // Update level count: a k-level tree can hold 2^{k-1} leaves,
   // so increment level count every time we overflow a power of two.
@@ -108,22 +118,145 @@ size_t CompactMerkleTree::AddLeafHash(const string &hash) {
   return leaf_count_;
 }
 
+size_t CompactMerkleTree::AddLeafHashes(
+    std::vector<string>::const_iterator begin,
+    std::vector<string>::const_iterator end, size_t num_threads) {
+  const size_t node_size = treehasher_.DigestSize();
+  string level_nodes;
+  string parents;
+  while (begin != end) {
+    const size_t remaining = end - begin;
+    // The largest subtree we can add in one go: a power of two that fits in
+    // the remaining leaves and leaves the tree size a multiple of itself, so
+    // that all levels below the subtree root are currently empty.
+    size_t level = 0;
+    while ((static_cast<size_t>(2) << level) <= remaining &&
+           (leaf_count_ & ((static_cast<size_t>(2) << level) - 1)) == 0)
+      ++level;
+    const size_t subtree_size = static_cast<size_t>(1) << level;
+
+    if (level == 0) {
+      AddLeafHash(*begin++);
+      continue;
+    }
+
+    level_nodes.clear();
+    level_nodes.reserve(subtree_size * node_size);
+    for (size_t i = 0; i < subtree_size; ++i, ++begin) {
+      CHECK_EQ(begin->size(), node_size);
+      level_nodes.append(*begin);
+    }
+    for (size_t nodes = subtree_size; nodes > 1; nodes /= 2) {
+      parents.clear();
+      treehasher_.HashChildrenPairs(level_nodes.data(), nodes / 2, &parents,
+                                    num_threads);
+      level_nodes.swap(parents);
+    }
+
+    AddSubtree(Digest(level_nodes), subtree_size);
+  }
+  return leaf_count_;
+}
+
+size_t CompactMerkleTree::AddSubtree(const string &root, size_t size) {
+  CHECK_EQ(root.size(), treehasher_.DigestSize());
+  return AddSubtree(Digest(root), size);
+}
+
+size_t CompactMerkleTree::AddSubtree(const Digest &root, size_t size) {
+  CHECK_GT(size, 0U);
+  CHECK_EQ(size & (size - 1), 0U) << "Subtree size must be a power of two";
+  CHECK_EQ(leaf_count_ & (size - 1), 0U) << "Subtree is not aligned";
+  size_t level = 0;
+  while ((static_cast<size_t>(1) << level) < size)
+    ++level;
+  // Alignment means all levels below the subtree root are currently empty.
+  if (tree_.size() < level)
+    tree_.resize(level);
+  PushBack(level, root);
+  leaf_count_ += size;
+  // Same invariant as in AddLeafHash(): a k-level tree holds up to
+  // 2^{k-1} leaves.
+  while (level_count_ == 0 ||
+         (static_cast<size_t>(1) << (level_count_ - 1)) < leaf_count_)
+    ++level_count_;
+  return leaf_count_;
+}
+
 string CompactMerkleTree::CurrentRoot() {
   UpdateRoot();
   return root_;
 }
 
-void CompactMerkleTree::PushBack(size_t level, string node) {
+void CompactMerkleTree::Checkpoint(string *checkpoint) const {
+  checkpoint->clear();
+  for (int shift = 56; shift >= 0; shift -= 8)
+    checkpoint->push_back(static_cast<char>((leaf_count_ >> shift) & 0xff));
+  // tree_[level] holds a node exactly when bit |level| of the leaf count is
+  // set.
+  for (size_t level = 0; level < tree_.size(); ++level) {
+    DCHECK_EQ(tree_[level].empty(), ((leaf_count_ >> level) & 1) == 0);
+    checkpoint->append(tree_[level]);
+  }
+}
+
+bool CompactMerkleTree::Restore(const string &checkpoint) {
+  const size_t node_size = treehasher_.DigestSize();
+  if (checkpoint.size() < 8)
+    return false;
+  uint64_t leaf_count = 0;
+  for (size_t i = 0; i < 8; ++i)
+    leaf_count = (leaf_count << 8) | static_cast<unsigned char>(checkpoint[i]);
+  if (leaf_count > static_cast<uint64_t>(static_cast<size_t>(-1)))
+    return false;
+
+  size_t levels = 0;
+  size_t nodes = 0;
+  for (uint64_t bits = leaf_count; bits != 0; bits >>= 1, ++levels)
+    nodes += bits & 1;
+  if (checkpoint.size() != 8 + nodes * node_size)
+    return false;
+
+  tree_.assign(levels, string());
+  size_t offset = 8;
+  for (size_t level = 0; level < levels; ++level) {
+    if ((leaf_count >> level) & 1) {
+      tree_[level].assign(checkpoint, offset, node_size);
+      offset += node_size;
+    }
+  }
+  leaf_count_ = leaf_count;
+  level_count_ = 0;
+  while (leaf_count_ > 0 &&
+         (level_count_ == 0 ||
+          (static_cast<size_t>(1) << (level_count_ - 1)) < leaf_count_))
+    ++level_count_;
+  // Evaluate the root lazily, as usual.
+  leaves_processed_ = 0;
+  root_ = treehasher_.HashEmpty();
+  return true;
+}
+
+void CompactMerkleTree::PushBack(size_t level, const Digest &node) {
   CHECK_EQ(node.size(), treehasher_.DigestSize());
-  if (tree_.size() <= level) {
-    // First node at a new level.
-    tree_.push_back(node);
-  } else if (tree_[level].empty()) {
-    // Lone left sibling.
-    tree_[level] = node;
-  } else {
+  Digest carry(node);
+  Digest left_sibling;
+  for (;; ++level) {
+    if (tree_.size() <= level) {
+      // First node at a new level.
+      tree_.push_back(carry.ToString());
+      return;
+    }
+    if (tree_[level].empty()) {
+      // Lone left sibling. The level's string keeps its capacity across
+      // clear(), so this doesn't allocate.
+      tree_[level].assign(reinterpret_cast<const char*>(carry.data()),
+                          carry.size());
+      return;
+    }
     // Left sibling waiting: hash together and propagate up.
-    PushBack(level + 1, treehasher_.HashChildren(tree_[level], node));
+    left_sibling.Assign(tree_[level].data(), tree_[level].size());
+    treehasher_.HashChildren(left_sibling, carry, &carry);
     tree_[level].clear();
   }
 }
@@ -132,18 +265,21 @@ void CompactMerkleTree::UpdateRoot() {
   if (leaves_processed_ == LeafCount())
     return;
 
-  string right_sibling;
+  Digest right_sibling;
+  Digest left_sibling;
 
   for (size_t level = 0; level < tree_.size(); ++level) {
     if (!tree_[level].empty()) {
       // A lonely left sibling gets pulled up as a right sibling.
-      if (right_sibling.empty())
-        right_sibling = tree_[level];
-      else
-        right_sibling = treehasher_.HashChildren(tree_[level], right_sibling);
+      if (right_sibling.empty()) {
+        right_sibling.Assign(tree_[level].data(), tree_[level].size());
+      } else {
+        left_sibling.Assign(tree_[level].data(), tree_[level].size());
+        treehasher_.HashChildren(left_sibling, right_sibling, &right_sibling);
+      }
     }
   }
 
-  root_ = right_sibling;
+  root_ = right_sibling.ToString();
   leaves_processed_ = LeafCount();
 }
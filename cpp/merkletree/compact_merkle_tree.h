@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 
+#include "merkletree/digest.h"
 #include "merkletree/merkle_tree_interface.h"
 #include "merkletree/merkle_tree.h"
 #include "merkletree/tree_hasher.h"
@@ -41,6 +42,13 @@ class CompactMerkleTree : public ct::MerkleTreeInterface {
     return treehasher_.HashLeaf(data);
   }
 
+  // The leaf hashes of |data|, in order, hashed on up to |num_threads|
+  // threads, without appending them either.
+  void LeafHashes(const std::vector<std::string> &data,
+                  std::vector<std::string> *hashes, size_t num_threads) const {
+    treehasher_.HashLeaves(data, hashes, num_threads);
+  }
+
   // Number of levels. An empty tree has 0 levels, a tree with 1 leaf has
   // 1 level, a tree with 2 leaves has 2 levels, and a tree with n leaves has
   // ceil(log2(n)) + 1 levels.
@@ -69,6 +77,33 @@ class CompactMerkleTree : public ct::MerkleTreeInterface {
   // @param hash leaf hash
   virtual size_t AddLeafHash(const std::string &hash);
 
+  // As above, without going through a string.
+  size_t AddLeafHash(const Digest &hash);
+
+  // Add a sequence of leaf hashes, in order. The leaves are split into
+  // complete power-of-two subtrees aligned with the current tree size; each
+  // subtree root is computed level by level, with each level hashed in
+  // batches split across up to |num_threads| threads, and then pushed in at
+  // its own level. The resulting tree is identical to calling AddLeafHash()
+  // on each hash in turn.
+  //
+  // Returns the position of the last leaf added (i.e., the new leaf count).
+  size_t AddLeafHashes(std::vector<std::string>::const_iterator begin,
+                       std::vector<std::string>::const_iterator end,
+                       size_t num_threads);
+
+  // Append a complete subtree of |size| leaves, given only its root hash
+  // (e.g., as computed by another CompactMerkleTree over those leaves).
+  // |size| must be a power of two, and the current leaf count a multiple of
+  // it, so that the subtree is aligned. The resulting tree is identical to
+  // adding the subtree's leaves one by one.
+  //
+  // Returns the position of the last leaf added (i.e., the new leaf count).
+  size_t AddSubtree(const std::string &root, size_t size);
+
+  // As above, without going through a string.
+  size_t AddSubtree(const Digest &root, size_t size);
+
   // Get the current root of the tree.
   // Update the root to reflect the current shape of the tree,
   // and return the tree digest.
@@ -77,9 +112,22 @@ class CompactMerkleTree : public ct::MerkleTreeInterface {
   // (and hence, no root).
   virtual std::string CurrentRoot();
 
+  // Serialize the state of the tree (its leaf count and the O(log n) nodes
+  // on its left edge) into |checkpoint|, replacing its contents. The format
+  // is an 8-byte big-endian leaf count followed by the nodes, lowest level
+  // first.
+  void Checkpoint(std::string *checkpoint) const;
+
+  // Replace the state of the tree with one written by Checkpoint(), using
+  // the same hash function. Returns false, and leaves the tree unchanged,
+  // if |checkpoint| is malformed. Note that we cannot tell whether the nodes
+  // are correct; that's up to the caller, e.g., by comparing the root
+  // against a signed tree head.
+  bool Restore(const std::string &checkpoint);
+
  private:
   // Append a node to the level.
-  void PushBack(size_t level, std::string node);
+  void PushBack(size_t level, const Digest &node);
 
   void UpdateRoot();
   // Since the tree is append-only to the right, at any given point in time,
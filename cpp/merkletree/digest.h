@@ -0,0 +1,61 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+// A hash value stored inline, so that passing node hashes around does not
+// allocate. Holds digests of up to kMaxSize bytes; hashers with larger
+// digests have to stick to the std::string interfaces.
+class Digest {
+ public:
+  enum { kMaxSize = 64 };
+
+  Digest() : size_(0) {}
+
+  Digest(const void *data, size_t size) : size_(0) { Assign(data, size); }
+
+  explicit Digest(const std::string &data) : size_(0) {
+    Assign(data.data(), data.size());
+  }
+
+  void Assign(const void *data, size_t size) {
+    assert(size <= kMaxSize);
+    memcpy(bytes_, data, size);
+    size_ = size;
+  }
+
+  const unsigned char *data() const { return bytes_; }
+
+  // For writing a digest in place; follow up with set_size().
+  unsigned char *mutable_data() { return bytes_; }
+
+  size_t size() const { return size_; }
+
+  void set_size(size_t size) {
+    assert(size <= kMaxSize);
+    size_ = size;
+  }
+
+  bool empty() const { return size_ == 0; }
+
+  void clear() { size_ = 0; }
+
+  // Adapter for the std::string interfaces.
+  std::string ToString() const {
+    return std::string(reinterpret_cast<const char*>(bytes_), size_);
+  }
+
+  bool operator==(const Digest &other) const {
+    return size_ == other.size_ && memcmp(bytes_, other.bytes_, size_) == 0;
+  }
+
+  bool operator!=(const Digest &other) const { return !(*this == other); }
+
+ private:
+  unsigned char bytes_[kMaxSize];
+  size_t size_;
+};
+#endif
@@ -0,0 +1,110 @@
+#include "merkletree/leaf_hash_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+
+using std::string;
+
+LeafHashFile::LeafHashFile(const string &path, size_t hash_size)
+    : path_(path),
+      hash_size_(hash_size),
+      fd_(-1),
+      leaf_count_(0) {
+  CHECK_GT(hash_size_, 0U);
+  fd_ = open(path_.c_str(), O_RDWR | O_CREAT, 0666);
+  PCHECK(fd_ >= 0) << "Failed to open leaf hash file " << path_;
+
+  struct stat st;
+  PCHECK(fstat(fd_, &st) == 0) << "Failed to stat " << path_;
+  leaf_count_ = st.st_size / hash_size_;
+  if (st.st_size % hash_size_ != 0) {
+    LOG(WARNING) << "Discarding a partially written leaf hash at the end of "
+                 << path_;
+    Truncate(leaf_count_);
+  }
+}
+
+LeafHashFile::~LeafHashFile() {
+  PCHECK(close(fd_) == 0) << "Failed to close " << path_;
+}
+
+void LeafHashFile::ReadLeafHashes(size_t count,
+                                  std::vector<string> *hashes) const {
+  CHECK_LE(count, leaf_count_);
+  if (count == 0)
+    return;
+
+  size_t length = count * hash_size_;
+  void *map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd_, 0);
+  PCHECK(map != MAP_FAILED) << "Failed to map " << path_;
+  // We're going to read the mapping once, front to back.
+  madvise(map, length, MADV_SEQUENTIAL);
+
+  const char *data = static_cast<const char*>(map);
+  hashes->reserve(hashes->size() + count);
+  for (size_t i = 0; i < count; ++i)
+    hashes->push_back(string(data + i * hash_size_, hash_size_));
+
+  PCHECK(munmap(map, length) == 0) << "Failed to unmap " << path_;
+}
+
+void LeafHashFile::ReadLeafHashes(size_t begin, size_t count,
+                                  string *hashes) const {
+  CHECK_LE(begin + count, leaf_count_);
+  size_t length = count * hash_size_;
+  size_t old_size = hashes->size();
+  hashes->resize(old_size + length);
+  off_t offset = begin * hash_size_;
+  size_t bytes_read = 0;
+  while (bytes_read < length) {
+    ssize_t ret = pread(fd_, &(*hashes)[old_size + bytes_read],
+                        length - bytes_read, offset + bytes_read);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    PCHECK(ret > 0) << "Failed to read from " << path_;
+    bytes_read += ret;
+  }
+}
+
+void LeafHashFile::Append(std::vector<string>::const_iterator begin,
+                          std::vector<string>::const_iterator end) {
+  if (begin == end)
+    return;
+
+  string buffer;
+  buffer.reserve((end - begin) * hash_size_);
+  for (std::vector<string>::const_iterator it = begin; it != end; ++it) {
+    CHECK_EQ(hash_size_, it->size());
+    buffer.append(*it);
+  }
+
+  off_t offset = leaf_count_ * hash_size_;
+  size_t written = 0;
+  while (written < buffer.size()) {
+    ssize_t ret = pwrite(fd_, buffer.data() + written,
+                         buffer.size() - written, offset + written);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    PCHECK(ret > 0) << "Failed to write to " << path_;
+    written += ret;
+  }
+  PCHECK(fdatasync(fd_) == 0) << "Failed to sync " << path_;
+  leaf_count_ += end - begin;
+}
+
+void LeafHashFile::Truncate(size_t count) {
+  CHECK_LE(count, leaf_count_);
+  PCHECK(ftruncate(fd_, count * hash_size_) == 0)
+      << "Failed to truncate " << path_;
+  PCHECK(fdatasync(fd_) == 0) << "Failed to sync " << path_;
+  leaf_count_ = count;
+}
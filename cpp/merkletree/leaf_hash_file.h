@@ -0,0 +1,48 @@
+#ifndef LEAF_HASH_FILE_H
+#define LEAF_HASH_FILE_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// An append-only file of fixed-width Merkle leaf hashes, stored back to back
+// in leaf order. Lets a MerkleTree be restored at startup from a single
+// sequential read instead of rehashing every logged entry.
+// Assumes that it is the sole writer of the file.
+// Aborts on any IO error.
+class LeafHashFile {
+ public:
+  // Opens |path|, creating it if it does not exist. A trailing partial hash
+  // (e.g., left behind by a crash during Append) is discarded.
+  LeafHashFile(const std::string &path, size_t hash_size);
+  ~LeafHashFile();
+
+  size_t HashSize() const { return hash_size_; }
+
+  // Number of (complete) leaf hashes in the file.
+  size_t LeafCount() const { return leaf_count_; }
+
+  // Read the first |count| leaf hashes and append them to |hashes|.
+  // Requires count <= LeafCount().
+  void ReadLeafHashes(size_t count, std::vector<std::string> *hashes) const;
+
+  // Append the |count| leaf hashes starting from the |begin|th (indexing
+  // starts at 0), back to back, to |hashes|.
+  // Requires begin + count <= LeafCount().
+  void ReadLeafHashes(size_t begin, size_t count, std::string *hashes) const;
+
+  // Append leaf hashes to the file. Returns once they are on disk.
+  void Append(std::vector<std::string>::const_iterator begin,
+              std::vector<std::string>::const_iterator end);
+
+  // Drop all but the first |count| leaf hashes.
+  // Requires count <= LeafCount().
+  void Truncate(size_t count);
+
+ private:
+  const std::string path_;
+  const size_t hash_size_;
+  int fd_;
+  size_t leaf_count_;
+};
+#endif
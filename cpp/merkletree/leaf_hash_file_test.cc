@@ -0,0 +1,110 @@
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "merkletree/leaf_hash_file.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace {
+
+using std::string;
+
+const size_t kHashSize = 32;
+
+class LeafHashFileTest : public ::testing::Test {
+ protected:
+  LeafHashFileTest()
+      : tmp_(),
+        path_(tmp_.TmpStorageDir() + "/leaves"),
+        tree_(new Sha256Hasher()) {
+    for (size_t i = 0; i < 100; ++i) {
+      string leaf(1, static_cast<char>(i));
+      hashes_.push_back(tree_.LeafHash(leaf));
+    }
+  }
+
+  TmpStorage tmp_;
+  string path_;
+  MerkleTree tree_;
+  std::vector<string> hashes_;
+};
+
+TEST_F(LeafHashFileTest, CreateEmpty) {
+  LeafHashFile file(path_, kHashSize);
+  EXPECT_EQ(0U, file.LeafCount());
+  std::vector<string> read;
+  file.ReadLeafHashes(0, &read);
+  EXPECT_TRUE(read.empty());
+}
+
+TEST_F(LeafHashFileTest, AppendAndReopen) {
+  {
+    LeafHashFile file(path_, kHashSize);
+    file.Append(hashes_.begin(), hashes_.begin() + 10);
+    EXPECT_EQ(10U, file.LeafCount());
+    file.Append(hashes_.begin() + 10, hashes_.end());
+    EXPECT_EQ(hashes_.size(), file.LeafCount());
+  }
+
+  LeafHashFile file(path_, kHashSize);
+  ASSERT_EQ(hashes_.size(), file.LeafCount());
+  std::vector<string> read;
+  file.ReadLeafHashes(file.LeafCount(), &read);
+  EXPECT_EQ(hashes_, read);
+
+  read.clear();
+  file.ReadLeafHashes(7, &read);
+  EXPECT_EQ(std::vector<string>(hashes_.begin(), hashes_.begin() + 7), read);
+}
+
+TEST_F(LeafHashFileTest, Truncate) {
+  {
+    LeafHashFile file(path_, kHashSize);
+    file.Append(hashes_.begin(), hashes_.end());
+    file.Truncate(42);
+    EXPECT_EQ(42U, file.LeafCount());
+    // Appends continue from the truncation point.
+    file.Append(hashes_.begin() + 42, hashes_.begin() + 50);
+  }
+
+  LeafHashFile file(path_, kHashSize);
+  ASSERT_EQ(50U, file.LeafCount());
+  std::vector<string> read;
+  file.ReadLeafHashes(50, &read);
+  EXPECT_EQ(std::vector<string>(hashes_.begin(), hashes_.begin() + 50), read);
+}
+
+TEST_F(LeafHashFileTest, DiscardPartialHash) {
+  {
+    LeafHashFile file(path_, kHashSize);
+    file.Append(hashes_.begin(), hashes_.begin() + 3);
+  }
+
+  // Simulate a crash in the middle of an append.
+  int fd = open(path_.c_str(), O_WRONLY | O_APPEND);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(5, write(fd, "12345", 5));
+  close(fd);
+
+  LeafHashFile file(path_, kHashSize);
+  EXPECT_EQ(3U, file.LeafCount());
+  file.Append(hashes_.begin() + 3, hashes_.begin() + 4);
+
+  std::vector<string> read;
+  file.ReadLeafHashes(4, &read);
+  EXPECT_EQ(std::vector<string>(hashes_.begin(), hashes_.begin() + 4), read);
+}
+
+}  // namespace
+
+int main(int argc, char**argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,7 +1,9 @@
 #include "merkletree/merkle_tree.h"
 
 #include <glog/logging.h>
+#include <map>
 #include <stddef.h>
+#include <string.h>
 #include <string>
 #include <vector>
 
@@ -9,25 +11,39 @@
 
 using std::string;
 
+const size_t MerkleTree::kMaxCachedSnapshots = 16;
+
 MerkleTree::MerkleTree(SerialHasher *hasher)
     : ct::MerkleTreeInterface(),
       treehasher_(hasher),
       leaves_processed_(0),
-      level_count_(0) {}
+      level_count_(0) {
+  CHECK_LE(treehasher_.DigestSize(), static_cast<size_t>(Digest::kMaxSize));
+}
 
 MerkleTree::~MerkleTree() {}
 
 size_t MerkleTree::AddLeaf(const string &data) {
-  return AddLeafHash(treehasher_.HashLeaf(data));
+  Digest hash;
+  treehasher_.HashLeaf(data, &hash);
+  return AddLeafHash(hash);
 }
 
 size_t MerkleTree::AddLeafHash(const string &hash) {
+  return AppendLeafHash(hash.data(), hash.size());
+}
+
+size_t MerkleTree::AddLeafHash(const Digest &hash) {
+  return AppendLeafHash(hash.data(), hash.size());
+}
+
+size_t MerkleTree::AppendLeafHash(const void *hash, size_t size) {
   if (LazyLevelCount() == 0) {
     AddLevel();
     // The first leaf hash is also the first root.
     leaves_processed_ = 1;
   }
-  PushBack(0, hash);
+  PushBack(0, hash, size);
   size_t leaf_count = LeafCount();
   // Update level count: a k-level tree can hold 2^{k-1} leaves,
   // so increment level count every time we overflow a power of two.
@@ -38,6 +54,56 @@ size_t MerkleTree::AddLeafHash(const string &hash) {
   return leaf_count;
 }
 
+size_t MerkleTree::AddLeafHashes(std::vector<string>::const_iterator begin,
+                                 std::vector<string>::const_iterator end,
+                                 size_t num_threads) {
+  if (begin == end)
+    return LeafCount();
+  PrepareLeafBatch(end - begin);
+  for (std::vector<string>::const_iterator it = begin; it != end; ++it) {
+    CHECK_EQ(it->size(), treehasher_.DigestSize());
+    tree_[0].append(*it);
+  }
+  return FinishLeafBatch(num_threads);
+}
+
+size_t MerkleTree::AddLeafHashes(const char *hashes, size_t count,
+                                 size_t num_threads) {
+  if (count == 0)
+    return LeafCount();
+  PrepareLeafBatch(count);
+  tree_[0].append(hashes, count * treehasher_.DigestSize());
+  return FinishLeafBatch(num_threads);
+}
+
+void MerkleTree::Clear() {
+  tree_.clear();
+  leaves_processed_ = 0;
+  level_count_ = 0;
+  snapshot_edges_.clear();
+}
+
+void MerkleTree::PrepareLeafBatch(size_t count) {
+  if (LazyLevelCount() == 0) {
+    AddLevel();
+    // The first leaf hash is also the first root.
+    leaves_processed_ = 1;
+  }
+  tree_[0].reserve(tree_[0].size() + count * treehasher_.DigestSize());
+}
+
+size_t MerkleTree::FinishLeafBatch(size_t num_threads) {
+  const size_t leaf_count = LeafCount();
+  // Same invariant as in AppendLeafHash(): a k-level tree holds up to
+  // 2^{k-1} leaves.
+  while (level_count_ == 0 ||
+         (static_cast<size_t>(1) << (level_count_ - 1)) < leaf_count)
+    ++level_count_;
+  // Then hash each level of new nodes in one pass.
+  UpdateToSnapshot(leaf_count, num_threads);
+  return leaf_count;
+}
+
 string MerkleTree::CurrentRoot() {
   return RootAtSnapshot(LeafCount());
 }
@@ -49,9 +115,23 @@ string MerkleTree::RootAtSnapshot(size_t snapshot) {
   if (snapshot > leaf_count)
     return string();
   if (snapshot >= leaves_processed_)
-    return UpdateToSnapshot(snapshot);
+    return UpdateToSnapshot(snapshot, 1);
   // snapshot < leaves_processed_: recompute the snapshot root.
-  return RecomputePastSnapshot(snapshot, 0, NULL);
+  return RecomputePastSnapshot(snapshot, NULL);
+}
+
+void MerkleTree::CacheSnapshot(size_t snapshot) {
+  if (snapshot == 0 || snapshot > LeafCount() ||
+      snapshot_edges_.count(snapshot) > 0)
+    return;
+  if (snapshot > leaves_processed_)
+    UpdateToSnapshot(snapshot, 1);
+  std::vector<string> edge;
+  RecomputePastSnapshot(snapshot, &edge);
+  snapshot_edges_[snapshot].swap(edge);
+  // Snapshots only ever grow, so the smallest one is the oldest.
+  if (snapshot_edges_.size() > kMaxCachedSnapshots)
+    snapshot_edges_.erase(snapshot_edges_.begin());
 }
 
 std::vector<string> MerkleTree::PathToCurrentRoot(size_t leaf) {
@@ -64,7 +144,24 @@ MerkleTree::PathToRootAtSnapshot(size_t leaf, size_t snapshot) {
   size_t leaf_count = LeafCount();
   if (leaf > snapshot || snapshot > leaf_count || leaf == 0)
     return path;
-  return PathFromNodeToRootAtSnapshot(leaf - 1, 0, snapshot);
+  std::vector<string> edge;
+  return PathFromNodeToRootAtSnapshot(leaf - 1, 0, snapshot, &edge);
+}
+
+std::vector<std::vector<string> >
+MerkleTree::PathsToRootAtSnapshot(const std::vector<size_t> &leaves,
+                                  size_t snapshot) {
+  std::vector<std::vector<string> > paths(leaves.size());
+  size_t leaf_count = LeafCount();
+  // Shared by all paths.
+  std::vector<string> edge;
+  for (size_t i = 0; i < leaves.size(); ++i) {
+    size_t leaf = leaves[i];
+    if (leaf > snapshot || snapshot > leaf_count || leaf == 0)
+      continue;
+    paths[i] = PathFromNodeToRootAtSnapshot(leaf - 1, 0, snapshot, &edge);
+  }
+  return paths;
 }
 
 std::vector<string> MerkleTree::SnapshotConsistency(size_t snapshot1,
@@ -86,7 +183,7 @@ std::vector<string> MerkleTree::SnapshotConsistency(size_t snapshot1,
 
   if (snapshot2 > leaves_processed_) {
     // Bring the tree sufficiently up to date.
-    UpdateToSnapshot(snapshot2);
+    UpdateToSnapshot(snapshot2, 1);
   }
 
   // Record the node, unless we already reached the root of snapshot1.
@@ -94,13 +191,14 @@ std::vector<string> MerkleTree::SnapshotConsistency(size_t snapshot1,
     proof.push_back(Node(level, node));
 
   // Now record the path from this node to the root of snapshot2.
+  std::vector<string> edge;
   std::vector<string> path = PathFromNodeToRootAtSnapshot(node, level,
-                                                           snapshot2);
+                                                           snapshot2, &edge);
   proof.insert(proof.end(), path.begin(), path.end());
   return proof;
 }
 
-string MerkleTree::UpdateToSnapshot(size_t snapshot) {
+string MerkleTree::UpdateToSnapshot(size_t snapshot, size_t num_threads) {
   if (snapshot == 0)
     return treehasher_.HashEmpty();
   if (snapshot == 1)
@@ -130,14 +228,19 @@ string MerkleTree::UpdateToSnapshot(size_t snapshot) {
 
     // Compute the parents of new nodes at the current level.
     // Start with a left sibling and parse an even number of nodes.
-    for (size_t j = first_node & ~1; j < last_node; j += 2) {
-      PushBack(level + 1,
-               treehasher_.HashChildren(Node(level, j), Node(level, j + 1)));
+    // The pairs are adjacent in the level buffer, so hash them in one batch.
+    const size_t first_pair = first_node & ~1;
+    const size_t pair_count = (last_node - first_pair + 1) / 2;
+    if (pair_count > 0) {
+      CHECK_GE(NodeCount(level), first_pair + 2 * pair_count);
+      treehasher_.HashChildrenPairs(
+          tree_[level].data() + first_pair * treehasher_.DigestSize(),
+          pair_count, &tree_[level + 1], num_threads);
     }
     // If the last node at the current level is a left sibling,
     // dummy-propagate it one level up.
     if (!MerkleTreeMath::IsRightChild(last_node))
-      PushBack(level + 1, Node(level, last_node));
+      CopyUp(level, last_node);
 
     first_node = MerkleTreeMath::Parent(first_node);
     last_node = MerkleTreeMath::Parent(last_node);
@@ -149,31 +252,37 @@ string MerkleTree::UpdateToSnapshot(size_t snapshot) {
 }
 
 string MerkleTree::RecomputePastSnapshot(size_t snapshot,
-                                          size_t node_level,
-                                          string *node) {
+                                          std::vector<string> *edge) {
   size_t level = 0;
   // Index of the rightmost node at the current level for this snapshot.
   size_t last_node = snapshot - 1;
 
+  std::map<size_t, std::vector<string> >::const_iterator cached =
+      snapshot_edges_.find(snapshot);
+  if (cached != snapshot_edges_.end()) {
+    if (edge)
+      edge->assign(cached->second.begin(), cached->second.end());
+    return cached->second.back();
+  }
+
   if (snapshot == leaves_processed_) {
     // Nothing to recompute.
-    if (node && LazyLevelCount() > node_level) {
-      if (node_level > 0) {
-        node->assign(LastNode(node_level));
-      } else {
-        // Leaf level: grab the last processed leaf.
-        node->assign(Node(node_level, last_node));
-      }
+    if (edge) {
+      edge->clear();
+      for (; level < LazyLevelCount(); ++level, last_node >>= 1)
+        edge->push_back(Node(level, last_node));
     }
     return Root();
   }
 
   CHECK_LT(snapshot, leaves_processed_);
+  if (edge)
+    edge->clear();
 
   // Recompute nodes on the path of the last leaf.
   while (MerkleTreeMath::IsRightChild(last_node)) {
-    if (node && node_level == level)
-      node->assign(Node(level, last_node));
+    if (edge)
+      edge->push_back(Node(level, last_node));
     // Left sibling and parent exist in the snapshot, and are equal to
     // those in the tree; no need to rehash, move one level up.
     last_node = MerkleTreeMath::Parent(last_node);
@@ -182,31 +291,34 @@ string MerkleTree::RecomputePastSnapshot(size_t snapshot,
 
   // Now last_node is the index of a left sibling with no right sibling.
   // Record the node.
-  string subtree_root = Node(level, last_node);
+  Digest subtree_root;
+  Node(level, last_node, &subtree_root);
 
-  if (node && node_level == level)
-    node->assign(subtree_root);
+  if (edge)
+    edge->push_back(subtree_root.ToString());
 
+  Digest left_sibling;
   while (last_node) {
     if (MerkleTreeMath::IsRightChild(last_node)) {
       // Recompute the parent of tree_[level][last_node].
-      subtree_root = treehasher_.HashChildren(
-          Node(level, last_node - 1), subtree_root);
+      Node(level, last_node - 1, &left_sibling);
+      treehasher_.HashChildren(left_sibling, subtree_root, &subtree_root);
     }
     // Else the parent is a dummy copy of the current node; do nothing.
 
     last_node = MerkleTreeMath::Parent(last_node);
     ++level;
-    if (node && node_level == level)
-      node->assign(subtree_root);
+    if (edge)
+      edge->push_back(subtree_root.ToString());
   }
 
-  return subtree_root;
+  return subtree_root.ToString();
 }
 
 std::vector<string>
 MerkleTree::PathFromNodeToRootAtSnapshot(size_t node, size_t level,
-                                         size_t snapshot) {
+                                         size_t snapshot,
+                                         std::vector<string> *edge) {
   std::vector<string> path;
   if (snapshot == 0)
     return path;
@@ -217,7 +329,7 @@ MerkleTree::PathFromNodeToRootAtSnapshot(size_t node, size_t level,
 
   if (snapshot > leaves_processed_) {
     // Bring the tree sufficiently up to date.
-    UpdateToSnapshot(snapshot);
+    UpdateToSnapshot(snapshot, 1);
   }
 
   // Move up, recording the sibling of the current node at each level.
@@ -229,10 +341,11 @@ MerkleTree::PathFromNodeToRootAtSnapshot(size_t node, size_t level,
       path.push_back(Node(level, sibling));
     } else if (sibling == last_node) {
       // The sibling is the last node of the level in the snapshot tree,
-      // so we get its value for the snapshot. Get the root in the same pass.
-      string recompute_node;
-      RecomputePastSnapshot(snapshot, level, &recompute_node);
-      path.push_back(recompute_node);
+      // so we get its value for the snapshot. The whole right edge is
+      // recomputed in one pass, and only once per |edge|.
+      if (edge->empty())
+        RecomputePastSnapshot(snapshot, edge);
+      path.push_back((*edge)[level]);
     }
     // Else sibling > last_node so the sibling does not exist. Do nothing.
     // Continue moving up in the tree, ignoring dummy copies.
@@ -245,10 +358,27 @@ MerkleTree::PathFromNodeToRootAtSnapshot(size_t node, size_t level,
   return path;
 }
 
+void MerkleTree::CopyNodes(size_t level, size_t begin, size_t end,
+                           char *out) const {
+  CHECK_LE(begin, end);
+  if (begin == end)
+    return;
+  CHECK_GE(NodeCount(level), end);
+  const size_t node_size = treehasher_.DigestSize();
+  memcpy(out, tree_[level].data() + begin * node_size,
+         (end - begin) * node_size);
+}
+
 string MerkleTree::Node(size_t level, size_t index) const {
   CHECK_GT(NodeCount(level), index);
-  return tree_[level].substr(index * treehasher_.DigestSize(),
-                             treehasher_.DigestSize());
+  const size_t node_size = treehasher_.DigestSize();
+  return string(tree_[level], index * node_size, node_size);
+}
+
+void MerkleTree::Node(size_t level, size_t index, Digest *node) const {
+  CHECK_GT(NodeCount(level), index);
+  const size_t node_size = treehasher_.DigestSize();
+  node->Assign(tree_[level].data() + index * node_size, node_size);
 }
 
 string MerkleTree::Root() const {
@@ -256,6 +386,26 @@ string MerkleTree::Root() const {
   return tree_.back();
 }
 
+void MerkleTree::MemoryUsage(util::MemoryUsage *leaves,
+                             util::MemoryUsage *nodes) const {
+  const size_t node_size = treehasher_.DigestSize();
+  *leaves = util::MemoryUsage();
+  *nodes = util::MemoryUsage();
+  for (size_t level = 0; level < tree_.size(); ++level) {
+    util::MemoryUsage *usage = level == 0 ? leaves : nodes;
+    usage->Add(util::MemoryUsage(util::HeapBytes(tree_[level]),
+                                 tree_[level].size() / node_size));
+  }
+  nodes->bytes += util::HeapBytes(tree_);
+  for (std::map<size_t, std::vector<string> >::const_iterator it =
+           snapshot_edges_.begin(); it != snapshot_edges_.end(); ++it) {
+    nodes->bytes += util::kTreeNodeBytes + sizeof(*it) +
+        util::HeapBytes(it->second);
+    for (size_t i = 0; i < it->second.size(); ++i)
+      nodes->Add(util::MemoryUsage(util::HeapBytes(it->second[i]), 1));
+  }
+}
+
 size_t MerkleTree::NodeCount(size_t level) const {
   CHECK_GT(LazyLevelCount(), level);
   return tree_[level].size() / treehasher_.DigestSize();
@@ -263,18 +413,28 @@ size_t MerkleTree::NodeCount(size_t level) const {
 
 string MerkleTree::LastNode(size_t level) const {
   CHECK_GE(NodeCount(level), 1U);
-  return tree_[level].substr(tree_[level].size() - treehasher_.DigestSize());
+  const size_t node_size = treehasher_.DigestSize();
+  return string(tree_[level], tree_[level].size() - node_size, node_size);
 }
 
 void MerkleTree::PopBack(size_t level) {
   CHECK_GE(NodeCount(level), 1U);
-  tree_[level].erase(tree_[level].size() - treehasher_.DigestSize());
+  // Shrinking keeps the capacity, so the next PushBack() to this level
+  // reuses the slot in place.
+  tree_[level].resize(tree_[level].size() - treehasher_.DigestSize());
 }
 
-void MerkleTree::PushBack(size_t level, string node) {
-  CHECK_EQ(node.size(), treehasher_.DigestSize());
+void MerkleTree::PushBack(size_t level, const void *node, size_t size) {
+  CHECK_EQ(size, treehasher_.DigestSize());
   CHECK_GT(LazyLevelCount(), level);
-  tree_[level].append(node);
+  tree_[level].append(static_cast<const char*>(node), size);
+}
+
+void MerkleTree::CopyUp(size_t level, size_t index) {
+  CHECK_GT(NodeCount(level), index);
+  CHECK_GT(LazyLevelCount(), level + 1);
+  const size_t node_size = treehasher_.DigestSize();
+  tree_[level + 1].append(tree_[level], index * node_size, node_size);
 }
 
 void MerkleTree::AddLevel() {
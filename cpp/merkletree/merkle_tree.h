@@ -2,12 +2,15 @@
 #ifndef MERKLETREE_H
 #define MERKLETREE_H
 
+#include <map>
 #include <stddef.h>
 #include <string>
 #include <vector>
 
+#include "merkletree/digest.h"
 #include "merkletree/merkle_tree_interface.h"
 #include "merkletree/tree_hasher.h"
+#include "util/memory_usage.h"
 
 class SerialHasher;
 
@@ -74,6 +77,26 @@ class MerkleTree : public ct::MerkleTreeInterface {
   // @param hash leaf hash
   virtual size_t AddLeafHash(const std::string &hash);
 
+  // As above, without going through a string.
+  size_t AddLeafHash(const Digest &hash);
+
+  // Add a sequence of leaf hashes, in order, and bring the whole tree up to
+  // date. Each level is hashed in batches split across up to |num_threads|
+  // threads. The resulting tree is identical to calling AddLeafHash() on
+  // each hash in turn.
+  //
+  // Returns the position of the last leaf added (i.e., the new leaf count).
+  size_t AddLeafHashes(std::vector<std::string>::const_iterator begin,
+                       std::vector<std::string>::const_iterator end,
+                       size_t num_threads);
+
+  // As above, for |count| leaf hashes stored back to back at |hashes|
+  // (e.g., as read from a LeafHashFile).
+  size_t AddLeafHashes(const char *hashes, size_t count, size_t num_threads);
+
+  // Drop all leaves, as if the tree were new.
+  void Clear();
+
   // Get the current root of the tree.
   // Update the root to reflect the current shape of the tree,
   // and return the tree digest.
@@ -92,6 +115,14 @@ class MerkleTree : public ct::MerkleTreeInterface {
   // @param snapshot point in time (= number of leaves at that point).
   std::string RootAtSnapshot(size_t snapshot);
 
+  // Remember the rightmost node of each level of the tree at |snapshot|,
+  // so that later root, path and consistency queries for that snapshot
+  // need no rehashing. Only the largest kMaxCachedSnapshots snapshots are
+  // kept. Does nothing if the snapshot is 0 or in the future.
+  //
+  // @param snapshot point in time (= number of leaves at that point).
+  void CacheSnapshot(size_t snapshot);
+
   // Get the Merkle path from leaf to root.
   //
   // Returns a vector of node hashes, ordered by levels from leaf to root.
@@ -115,6 +146,19 @@ class MerkleTree : public ct::MerkleTreeInterface {
   // @param snapshot point in time (= number of leaves at that point)
   std::vector<std::string> PathToRootAtSnapshot(size_t leaf, size_t snapshot);
 
+  // Get the Merkle paths from several leaves to the root of a previous
+  // snapshot. Equivalent to calling PathToRootAtSnapshot() for each leaf,
+  // but the right edge of the snapshot tree, which has to be recomputed for
+  // past snapshots, is recomputed at most once for the whole batch.
+  //
+  // Returns one path per leaf, in the same order; the path is empty for
+  // any leaf that PathToRootAtSnapshot() would return no path for.
+  //
+  // @param leaves the indices of the leaves the paths are for.
+  // @param snapshot point in time (= number of leaves at that point)
+  std::vector<std::vector<std::string> >
+  PathsToRootAtSnapshot(const std::vector<size_t> &leaves, size_t snapshot);
+
   // Get the Merkle consistency proof between two snapshots.
   // Returns a vector of node hashes, ordered according to levels.
   // Returns an empty vector if snapshot1 is 0, snapshot 1 >= snapshot2,
@@ -125,22 +169,45 @@ class MerkleTree : public ct::MerkleTreeInterface {
   std::vector<std::string> SnapshotConsistency(size_t snapshot1,
                                                size_t snapshot2);
 
+  // Copy the nodes |begin| to |end| - 1 of level |level| (both indexed
+  // from 0, the leaves being level 0) back to back to |out|. The tree must
+  // be evaluated that far, e.g. by CurrentRoot(). The nodes that are roots
+  // of complete subtrees never change after that.
+  void CopyNodes(size_t level, size_t begin, size_t end, char *out) const;
+
+  // Memory accounting: the heap bytes and nodes of the leaf level, and of
+  // the levels above it together with the cached snapshot edges.
+  void MemoryUsage(util::MemoryUsage *leaves, util::MemoryUsage *nodes) const;
+
  private:
-  // Update to a given snapshot, return the root.
-  std::string UpdateToSnapshot(size_t snapshot);
+  // Update to a given snapshot, return the root. Batches of new nodes are
+  // hashed on up to |num_threads| threads.
+  std::string UpdateToSnapshot(size_t snapshot, size_t num_threads);
   // Return the root of a past snapshot.
-  // If node is not NULL, additionally record the rightmost node
-  // for the given snapshot and node_level.
-  std::string RecomputePastSnapshot(size_t snapshot, size_t node_level,
-                                    std::string *node);
+  // If edge is not NULL, additionally record the rightmost node of each
+  // level of the snapshot tree, from the leaves up: (*edge)[level].
+  std::string RecomputePastSnapshot(size_t snapshot,
+                                    std::vector<std::string> *edge);
   // Path from a node at a given level (both indexed starting with 0)
-  // to the root at a given snapshot.
-  std::vector<std::string> PathFromNodeToRootAtSnapshot(size_t node_index,
-                                                    size_t level,
-                                                    size_t snapshot);
+  // to the root at a given snapshot. |edge| holds the right edge of the
+  // snapshot as recorded by RecomputePastSnapshot(), and is filled in if
+  // it is empty and the path needs it.
+  std::vector<std::string> PathFromNodeToRootAtSnapshot(
+      size_t node_index, size_t level, size_t snapshot,
+      std::vector<std::string> *edge);
   // Get the |index|-th node at level |level|. Indexing starts at 0;
   // caller is responsible for ensuring tree is sufficiently up to date.
   std::string Node(size_t level, size_t index) const;
+  void Node(size_t level, size_t index, Digest *node) const;
+
+  // Implements AddLeafHash() for either representation of the hash.
+  size_t AppendLeafHash(const void *hash, size_t size);
+
+  // The AddLeafHashes() implementations append a batch straight to the
+  // leaf level: make room for |count| more leaves first, then bring the
+  // level count and the upper levels up to date.
+  void PrepareLeafBatch(size_t count);
+  size_t FinishLeafBatch(size_t num_threads);
 
   // Get the current root (of the lazily evaluated tree).
   // Caller is responsible for keeping track of the lazy evaluation status.
@@ -157,7 +224,10 @@ class MerkleTree : public ct::MerkleTreeInterface {
   void PopBack(size_t level);
 
   // Append a node to the level.
-  void PushBack(size_t level, std::string node);
+  void PushBack(size_t level, const void *node, size_t size);
+
+  // Append a dummy copy of the |index|-th node at |level| to the level above.
+  void CopyUp(size_t level, size_t index);
 
   // Start a new level.
   void AddLevel();
@@ -166,6 +236,10 @@ class MerkleTree : public ct::MerkleTreeInterface {
   size_t LazyLevelCount() const;
   // A container for nodes, organized according to levels and sorted
   // left-to-right in each level. tree_[0] is the leaf level, etc.
+  // Each level is a single contiguous buffer of fixed-width
+  // (DigestSize()-byte) nodes, so the |index|th node of a level lives at
+  // offset |index| * DigestSize(), and appending or popping a node never
+  // allocates per node.
   // The hash of nodes tree_[i][j] and tree_[i][j+1] (j even) is stored
   // at tree_[i+1][j/2]. When tree_[i][j] is the last node of the level with
   // no right sibling, we store its dummy copy: tree_[i+1][j/2] = tree_[i][j].
@@ -202,5 +276,9 @@ class MerkleTree : public ct::MerkleTreeInterface {
   size_t leaves_processed_;
   // The "true" level count for a fully evaluated tree.
   size_t level_count_;
+  // Right edges recorded by CacheSnapshot(), keyed by snapshot. Since the
+  // tree is append-only, these never go stale.
+  std::map<size_t, std::vector<std::string> > snapshot_edges_;
+  static const size_t kMaxCachedSnapshots;
 };
 #endif
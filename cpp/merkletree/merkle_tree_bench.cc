@@ -0,0 +1,198 @@
+// Benchmark for MerkleTree and CompactMerkleTree.
+//
+// For each tree size from --min_leaves to --max_leaves (in steps of 10x),
+// builds each kind of tree and prints one JSON object per line with:
+// leaf-append throughput, the latency of the first CurrentRoot() and of
+// CurrentRoot() after a single append, PathToRootAtSnapshot() and
+// SnapshotConsistency() latency percentiles (MerkleTree only) and the
+// approximate resident memory per leaf. Times are in microseconds unless
+// the name says otherwise.
+//
+// Note that a MerkleTree with 1e8 leaves needs several GB of memory.
+#include <algorithm>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+
+DEFINE_uint64(min_leaves, 1000, "Smallest tree size to benchmark.");
+DEFINE_uint64(max_leaves, 1000000, "Largest tree size to benchmark. "
+              "Sizes go up in steps of 10x, up to 1e8.");
+DEFINE_int32(queries, 1000, "Number of timed root, path and consistency "
+             "queries per tree.");
+DEFINE_bool(merkle_tree, true, "Benchmark MerkleTree.");
+DEFINE_bool(compact_merkle_tree, true, "Benchmark CompactMerkleTree.");
+
+namespace {
+
+using std::string;
+
+double NowInMicroseconds() {
+  struct timespec ts;
+  PCHECK(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Current resident set size, in bytes, or 0 if we can't tell.
+size_t ResidentBytes() {
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (statm == NULL)
+    return 0;
+  unsigned long size, resident;
+  int ret = fscanf(statm, "%lu %lu", &size, &resident);
+  fclose(statm);
+  if (ret != 2)
+    return 0;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Distinct leaf data for each index.
+string LeafData(uint64_t index) {
+  string data(8, 0);
+  for (size_t i = 0; i < 8; ++i)
+    data[7 - i] = static_cast<char>((index >> (8 * i)) & 0xff);
+  return data;
+}
+
+string LeafCountString(size_t leaves) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(leaves));
+  return buf;
+}
+
+// A random number in [1, n].
+size_t RandomUpTo(size_t n) {
+  return 1 + static_cast<size_t>(random()) % n;
+}
+
+// Append |"name": {"p50": ..., "p90": ..., "p99": ..., "max": ...}| for
+// |samples| to |out|.
+void AppendPercentiles(const char *name, std::vector<double> *samples,
+                       string *out) {
+  CHECK(!samples->empty());
+  std::sort(samples->begin(), samples->end());
+  const double percentiles[] = { 0.5, 0.9, 0.99 };
+  const char *names[] = { "p50", "p90", "p99" };
+  char buf[256];
+  snprintf(buf, sizeof(buf), ", \"%s\": {", name);
+  out->append(buf);
+  for (size_t i = 0; i < 3; ++i) {
+    size_t index = static_cast<size_t>(percentiles[i] * samples->size());
+    snprintf(buf, sizeof(buf), "\"%s\": %.3f, ", names[i],
+             (*samples)[std::min(index, samples->size() - 1)]);
+    out->append(buf);
+  }
+  snprintf(buf, sizeof(buf), "\"max\": %.3f}", samples->back());
+  out->append(buf);
+}
+
+void AppendNumber(const char *name, double value, string *out) {
+  char buf[256];
+  snprintf(buf, sizeof(buf), ", \"%s\": %.3f", name, value);
+  out->append(buf);
+}
+
+// Time building |tree| with |leaves| leaves, then the root queries.
+// Appends the results to |out|.
+template <class Tree>
+void BenchmarkAppendAndRoot(Tree *tree, size_t leaves, string *out) {
+  size_t rss_before = ResidentBytes();
+  double start = NowInMicroseconds();
+  for (size_t i = 0; i < leaves; ++i)
+    tree->AddLeaf(LeafData(i));
+  double elapsed = NowInMicroseconds() - start;
+  size_t rss_after = ResidentBytes();
+  AppendNumber("append_leaves_per_sec", leaves / (elapsed / 1e6), out);
+
+  start = NowInMicroseconds();
+  CHECK(!tree->CurrentRoot().empty());
+  AppendNumber("first_current_root_ms", (NowInMicroseconds() - start) / 1e3,
+               out);
+  // Measured before the root queries below add more leaves. Memory freed
+  // by a previous tree may be reused, so this is only approximate.
+  if (rss_before > 0) {
+    size_t growth = rss_after > rss_before ? rss_after - rss_before : 0;
+    AppendNumber("bytes_per_leaf", static_cast<double>(growth) / leaves, out);
+  }
+
+  std::vector<double> samples;
+  for (int i = 0; i < FLAGS_queries; ++i) {
+    tree->AddLeaf(LeafData(leaves + i));
+    start = NowInMicroseconds();
+    CHECK(!tree->CurrentRoot().empty());
+    samples.push_back(NowInMicroseconds() - start);
+  }
+  AppendPercentiles("current_root_after_append_us", &samples, out);
+}
+
+void BenchmarkMerkleTree(size_t leaves) {
+  MerkleTree tree(new Sha256Hasher());
+  string out = "{\"tree\": \"MerkleTree\"";
+  out.append(", \"leaves\": " + LeafCountString(leaves));
+  BenchmarkAppendAndRoot(&tree, leaves, &out);
+
+  const size_t tree_size = tree.LeafCount();
+  std::vector<double> samples;
+  for (int i = 0; i < FLAGS_queries; ++i) {
+    size_t snapshot = RandomUpTo(tree_size);
+    size_t leaf = RandomUpTo(snapshot);
+    double start = NowInMicroseconds();
+    tree.PathToRootAtSnapshot(leaf, snapshot);
+    samples.push_back(NowInMicroseconds() - start);
+  }
+  AppendPercentiles("path_to_root_at_snapshot_us", &samples, &out);
+
+  samples.clear();
+  for (int i = 0; i < FLAGS_queries; ++i) {
+    size_t snapshot2 = RandomUpTo(tree_size);
+    size_t snapshot1 = RandomUpTo(snapshot2);
+    double start = NowInMicroseconds();
+    tree.SnapshotConsistency(snapshot1, snapshot2);
+    samples.push_back(NowInMicroseconds() - start);
+  }
+  AppendPercentiles("snapshot_consistency_us", &samples, &out);
+
+  out.append("}");
+  printf("%s\n", out.c_str());
+  fflush(stdout);
+}
+
+void BenchmarkCompactMerkleTree(size_t leaves) {
+  CompactMerkleTree tree(new Sha256Hasher());
+  string out = "{\"tree\": \"CompactMerkleTree\"";
+  out.append(", \"leaves\": " + LeafCountString(leaves));
+  BenchmarkAppendAndRoot(&tree, leaves, &out);
+  out.append("}");
+  printf("%s\n", out.c_str());
+  fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  google::SetUsageMessage("Benchmark the Merkle tree implementations.");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_GT(FLAGS_min_leaves, 0U);
+  CHECK_LE(FLAGS_max_leaves, 100000000U);
+  CHECK_GT(FLAGS_queries, 0);
+  srandom(1);
+
+  for (uint64_t leaves = FLAGS_min_leaves; leaves <= FLAGS_max_leaves;
+       leaves *= 10) {
+    if (FLAGS_compact_merkle_tree)
+      BenchmarkCompactMerkleTree(leaves);
+    if (FLAGS_merkle_tree)
+      BenchmarkMerkleTree(leaves);
+  }
+  return 0;
+}
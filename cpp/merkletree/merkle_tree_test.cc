@@ -217,6 +217,30 @@ TEST_F(MerkleTreeFuzzTest, PathFuzz) {
   }
 }
 
+// Make random batched path queries and check against the reference
+// implementation.
+TEST_F(MerkleTreeFuzzTest, PathsFuzz) {
+  for (size_t tree_size = 1; tree_size <= data_.size(); ++tree_size) {
+    MerkleTree tree(new Sha256Hasher());
+    for (size_t j = 0; j < tree_size; ++j)
+      tree.AddLeaf(data_[j]);
+
+    for (size_t j = 0; j < 8; ++j) {
+      const size_t snapshot = rand() % (tree_size + 1);
+      // Include out-of-range leaves, which get an empty path.
+      std::vector<size_t> leaves;
+      for (size_t k = 0; k < 5; ++k)
+        leaves.push_back(rand() % (snapshot + 2));
+      std::vector<std::vector<string> > paths =
+          tree.PathsToRootAtSnapshot(leaves, snapshot);
+      ASSERT_EQ(leaves.size(), paths.size());
+      for (size_t k = 0; k < leaves.size(); ++k)
+        EXPECT_EQ(ReferenceMerklePath(data_.data(), snapshot, leaves[k],
+                                      &tree_hasher_), paths[k]);
+    }
+  }
+}
+
 // Make random proof queries and check against the reference implementation.
 TEST_F(MerkleTreeFuzzTest, ConsistencyFuzz) {
   for (size_t tree_size = 1; tree_size <= data_.size(); ++tree_size) {
@@ -238,6 +262,31 @@ TEST_F(MerkleTreeFuzzTest, ConsistencyFuzz) {
   }
 }
 
+// Cache snapshots as the tree grows, the way a log publishes tree heads,
+// and check that queries against them are unchanged.
+TEST_F(MerkleTreeFuzzTest, CachedSnapshotFuzz) {
+  MerkleTree tree(new Sha256Hasher());
+  for (size_t tree_size = 1; tree_size <= data_.size(); ++tree_size) {
+    tree.AddLeaf(data_[tree_size - 1]);
+    if (rand() % 3 == 0)
+      tree.CacheSnapshot(tree_size);
+
+    for (size_t j = 0; j < 8; ++j) {
+      const size_t snapshot2 = rand() % (tree_size + 1);
+      const size_t snapshot1 = rand() % (snapshot2 + 1);
+      EXPECT_EQ(tree.RootAtSnapshot(snapshot2),
+                ReferenceMerkleTreeHash(data_.data(), snapshot2,
+                                        &tree_hasher_));
+      EXPECT_EQ(tree.PathToRootAtSnapshot(snapshot1, snapshot2),
+                ReferenceMerklePath(data_.data(), snapshot2, snapshot1,
+                                    &tree_hasher_));
+      EXPECT_EQ(tree.SnapshotConsistency(snapshot1, snapshot2),
+                ReferenceSnapshotConsistency(data_.data(), snapshot2, snapshot1,
+                                             &tree_hasher_, true));
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //                          KNOWN ANSWER TESTS                                //
 ////////////////////////////////////////////////////////////////////////////////
@@ -588,6 +637,160 @@ TEST_F(MerkleTreeTest, AddLeafHash) {
   EXPECT_EQ(kHashValue, tree.LeafHash(index));
 }
 
+// Bulk insertion must give exactly the same tree as one-by-one insertion,
+// starting from any tree size and with any number of threads.
+TEST_F(MerkleTreeTest, AddLeafHashes) {
+  std::vector<string> hashes;
+  for (size_t i = 0; i < 20000; ++i)
+    hashes.push_back(tree_hasher_.HashLeaf(string(1, i) + string(1, i >> 8)));
+
+  const size_t kStartSizes[] = { 0, 1, 5, 1024, 1027 };
+  const size_t kThreads[] = { 1, 4 };
+  for (size_t s = 0; s < sizeof(kStartSizes) / sizeof(kStartSizes[0]); ++s) {
+    for (size_t t = 0; t < sizeof(kThreads) / sizeof(kThreads[0]); ++t) {
+      MerkleTree tree(new Sha256Hasher());
+      MerkleTree bulk_tree(new Sha256Hasher());
+      for (size_t i = 0; i < kStartSizes[s]; ++i) {
+        tree.AddLeafHash(hashes[i]);
+        bulk_tree.AddLeafHash(hashes[i]);
+      }
+      for (size_t i = kStartSizes[s]; i < hashes.size(); ++i)
+        tree.AddLeafHash(hashes[i]);
+      EXPECT_EQ(hashes.size(),
+                bulk_tree.AddLeafHashes(hashes.begin() + kStartSizes[s],
+                                        hashes.end(), kThreads[t]));
+
+      // The same leaves, from one contiguous buffer.
+      MerkleTree buffer_tree(new Sha256Hasher());
+      string buffer;
+      for (size_t i = 0; i < hashes.size(); ++i)
+        buffer.append(hashes[i]);
+      const size_t node_size = tree_hasher_.DigestSize();
+      EXPECT_EQ(kStartSizes[s],
+                buffer_tree.AddLeafHashes(buffer.data(), kStartSizes[s],
+                                          kThreads[t]));
+      EXPECT_EQ(hashes.size(), buffer_tree.AddLeafHashes(
+          buffer.data() + kStartSizes[s] * node_size,
+          hashes.size() - kStartSizes[s], kThreads[t]));
+
+      EXPECT_EQ(tree.LeafCount(), bulk_tree.LeafCount());
+      EXPECT_EQ(tree.LevelCount(), bulk_tree.LevelCount());
+      EXPECT_EQ(tree.LevelCount(), buffer_tree.LevelCount());
+      EXPECT_EQ(H(tree.CurrentRoot()), H(bulk_tree.CurrentRoot()));
+      EXPECT_EQ(H(tree.CurrentRoot()), H(buffer_tree.CurrentRoot()));
+      for (size_t snapshot = 1; snapshot <= hashes.size(); snapshot += 1999) {
+        EXPECT_EQ(H(tree.RootAtSnapshot(snapshot)),
+                  H(bulk_tree.RootAtSnapshot(snapshot)));
+        EXPECT_EQ(H(tree.RootAtSnapshot(snapshot)),
+                  H(buffer_tree.RootAtSnapshot(snapshot)));
+        EXPECT_EQ(tree.PathToRootAtSnapshot(snapshot / 2 + 1, snapshot),
+                  bulk_tree.PathToRootAtSnapshot(snapshot / 2 + 1, snapshot));
+      }
+    }
+  }
+}
+
+TEST_F(CompactMerkleTreeTest, AddLeafHashes) {
+  std::vector<string> hashes;
+  for (size_t i = 0; i < 20000; ++i)
+    hashes.push_back(tree_hasher_.HashLeaf(string(1, i) + string(1, i >> 8)));
+
+  const size_t kStartSizes[] = { 0, 1, 5, 1024, 1027 };
+  const size_t kThreads[] = { 1, 4 };
+  for (size_t s = 0; s < sizeof(kStartSizes) / sizeof(kStartSizes[0]); ++s) {
+    for (size_t t = 0; t < sizeof(kThreads) / sizeof(kThreads[0]); ++t) {
+      CompactMerkleTree tree(new Sha256Hasher());
+      CompactMerkleTree bulk_tree(new Sha256Hasher());
+      for (size_t i = 0; i < kStartSizes[s]; ++i) {
+        tree.AddLeafHash(hashes[i]);
+        bulk_tree.AddLeafHash(hashes[i]);
+      }
+      for (size_t i = kStartSizes[s]; i < hashes.size(); ++i)
+        tree.AddLeafHash(hashes[i]);
+      EXPECT_EQ(hashes.size(),
+                bulk_tree.AddLeafHashes(hashes.begin() + kStartSizes[s],
+                                        hashes.end(), kThreads[t]));
+
+      EXPECT_EQ(tree.LeafCount(), bulk_tree.LeafCount());
+      EXPECT_EQ(tree.LevelCount(), bulk_tree.LevelCount());
+      EXPECT_EQ(H(tree.CurrentRoot()), H(bulk_tree.CurrentRoot()));
+
+      // Both trees must keep evolving identically.
+      tree.AddLeafHash(hashes[0]);
+      bulk_tree.AddLeafHash(hashes[0]);
+      EXPECT_EQ(H(tree.CurrentRoot()), H(bulk_tree.CurrentRoot()));
+    }
+  }
+}
+
+TEST_F(CompactMerkleTreeTest, AddSubtree) {
+  // Split 1000 leaves into aligned power-of-two ranges, as a coordinator
+  // would, hash each range separately and fold in the roots.
+  const size_t kLeaves = 1000;
+  CompactMerkleTree tree(new Sha256Hasher());
+  CompactMerkleTree merged(new Sha256Hasher());
+  for (size_t i = 0; i < kLeaves; ++i)
+    tree.AddLeaf(string(1, i) + string(1, i >> 8));
+
+  const size_t kMaxRange = 128;
+  size_t begin = 0;
+  while (begin < kLeaves) {
+    size_t size = kMaxRange;
+    while (size > kLeaves - begin || begin % size != 0)
+      size /= 2;
+    CompactMerkleTree worker(new Sha256Hasher());
+    for (size_t i = begin; i < begin + size; ++i)
+      worker.AddLeaf(string(1, i) + string(1, i >> 8));
+    EXPECT_EQ(begin + size, merged.AddSubtree(worker.CurrentRoot(), size));
+    begin += size;
+
+    // Each partial result matches a tree built leaf by leaf.
+    CompactMerkleTree reference(new Sha256Hasher());
+    for (size_t i = 0; i < begin; ++i)
+      reference.AddLeaf(string(1, i) + string(1, i >> 8));
+    EXPECT_EQ(reference.LevelCount(), merged.LevelCount());
+    EXPECT_EQ(H(reference.CurrentRoot()), H(merged.CurrentRoot()));
+  }
+
+  EXPECT_EQ(tree.LeafCount(), merged.LeafCount());
+  EXPECT_EQ(tree.LevelCount(), merged.LevelCount());
+  EXPECT_EQ(H(tree.CurrentRoot()), H(merged.CurrentRoot()));
+  tree.AddLeaf("last");
+  merged.AddLeaf("last");
+  EXPECT_EQ(H(tree.CurrentRoot()), H(merged.CurrentRoot()));
+}
+
+TEST_F(CompactMerkleTreeTest, CheckpointAndRestore) {
+  CompactMerkleTree tree(new Sha256Hasher());
+  for (size_t i = 0; i < 300; ++i) {
+    string checkpoint;
+    tree.Checkpoint(&checkpoint);
+    CompactMerkleTree restored(new Sha256Hasher());
+    ASSERT_TRUE(restored.Restore(checkpoint));
+    EXPECT_EQ(tree.LeafCount(), restored.LeafCount());
+    EXPECT_EQ(tree.LevelCount(), restored.LevelCount());
+    EXPECT_EQ(H(tree.CurrentRoot()), H(restored.CurrentRoot()));
+
+    // The restored tree must keep evolving identically.
+    string leaf(1, static_cast<char>(i));
+    tree.AddLeaf(leaf);
+    restored.AddLeaf(leaf);
+    EXPECT_EQ(H(tree.CurrentRoot()), H(restored.CurrentRoot()));
+  }
+
+  string checkpoint;
+  tree.Checkpoint(&checkpoint);
+  CompactMerkleTree other(new Sha256Hasher());
+  other.AddLeaf("data");
+  string root = other.CurrentRoot();
+  // Truncated, too long and empty checkpoints are all rejected.
+  EXPECT_FALSE(other.Restore(checkpoint.substr(0, checkpoint.size() - 1)));
+  EXPECT_FALSE(other.Restore(checkpoint + "x"));
+  EXPECT_FALSE(other.Restore(string()));
+  EXPECT_EQ(1U, other.LeafCount());
+  EXPECT_EQ(H(root), H(other.CurrentRoot()));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //                          VERIFICATION TESTS                                //
 ////////////////////////////////////////////////////////////////////////////////
@@ -787,6 +990,67 @@ TEST_F(MerkleVerifierTest, VerifyPath) {
   }
 }
 
+TEST_F(MerkleVerifierTest, VerifyPaths) {
+  std::vector<bool> results;
+  verifier_.VerifyPaths(0, S(kSHA256EmptyTreeHash), std::vector<size_t>(),
+                        std::vector<std::vector<string> >(),
+                        std::vector<string>(), &results);
+  EXPECT_TRUE(results.empty());
+
+  for (size_t tree_size = 1; tree_size <= data_.size() / 2; ++tree_size) {
+    string root = ReferenceMerkleTreeHash(data_.data(), tree_size,
+                                          &tree_hasher_);
+    std::vector<size_t> leaves;
+    std::vector<std::vector<string> > paths;
+    std::vector<string> data;
+    // Every leaf, including 0 and one past the end, plus a duplicate.
+    for (size_t leaf = 0; leaf <= tree_size + 1; ++leaf) {
+      leaves.push_back(leaf);
+      paths.push_back(
+          ReferenceMerklePath(data_.data(), tree_size, leaf, &tree_hasher_));
+      data.push_back(leaf > 0 && leaf <= tree_size ? data_[leaf - 1]
+                     : string());
+    }
+    leaves.push_back(tree_size);
+    paths.push_back(paths[tree_size]);
+    data.push_back(data[tree_size]);
+    // A few bad items among the good ones.
+    for (size_t leaf = 1; leaf <= tree_size; leaf += 3) {
+      leaves.push_back(leaf);
+      paths.push_back(paths[leaf]);
+      data.push_back(data[leaf]);
+      switch (leaf % 4) {
+        case 0:
+          data.back() = "WrongLeaf";
+          break;
+        case 1:
+          paths.back().push_back(root);
+          break;
+        case 2:
+          paths.back()[0] = S(kSHA256EmptyTreeHash);
+          break;
+        case 3:
+          paths.back().pop_back();
+          break;
+      }
+    }
+
+    verifier_.VerifyPaths(tree_size, root, leaves, paths, data, &results);
+    ASSERT_EQ(leaves.size(), results.size());
+    for (size_t i = 0; i < leaves.size(); ++i)
+      EXPECT_EQ(verifier_.VerifyPath(leaves[i], tree_size, paths[i], root,
+                                     data[i]), results[i]);
+    EXPECT_TRUE(results[1]);
+    EXPECT_TRUE(results[tree_size]);
+
+    // Wrong root.
+    verifier_.VerifyPaths(tree_size, S(kSHA256EmptyTreeHash), leaves, paths,
+                          data, &results);
+    for (size_t i = 0; i < results.size(); ++i)
+      EXPECT_FALSE(results[i]);
+  }
+}
+
 TEST_F(MerkleVerifierTest, VerifyConsistencyProof) {
   std::vector<string> proof;
   string root1, root2;
@@ -1,11 +1,17 @@
 #include "merkletree/merkle_verifier.h"
 
+#include <glog/logging.h>
+#include <map>
 #include <stddef.h>
+#include <string>
 #include <vector>
 
+#include "merkletree/digest.h"
+
 using std::string;
 
 MerkleVerifier::MerkleVerifier(SerialHasher *hasher) : treehasher_(hasher) {
+  CHECK_LE(treehasher_.DigestSize(), static_cast<size_t>(Digest::kMaxSize));
 }
 
 MerkleVerifier::~MerkleVerifier() {}
@@ -27,6 +33,81 @@ bool MerkleVerifier::VerifyPath(size_t leaf, size_t tree_size,
   return path_root == root;
 }
 
+void MerkleVerifier::VerifyPaths(size_t tree_size, const string &root,
+                                 const std::vector<size_t> &leaves,
+                                 const std::vector<std::vector<string> > &paths,
+                                 const std::vector<string> &data,
+                                 std::vector<bool> *results) {
+  CHECK_EQ(leaves.size(), paths.size());
+  CHECK_EQ(leaves.size(), data.size());
+  const size_t count = leaves.size();
+  const size_t node_size = treehasher_.DigestSize();
+  const size_t kNoParent = static_cast<size_t>(-1);
+
+  // |results| doubles as the set of items still being verified.
+  results->assign(count, false);
+  std::vector<size_t> nodes(count);
+  std::vector<size_t> path_position(count, 0);
+  for (size_t i = 0; i < count; ++i) {
+    if (leaves[i] > 0 && leaves[i] <= tree_size) {
+      (*results)[i] = true;
+      nodes[i] = leaves[i] - 1;
+    }
+  }
+  std::vector<string> hashes;
+  treehasher_.HashLeaves(data, &hashes);
+
+  // At each level, the distinct (left, right) pairs, back to back, and the
+  // index of each item's pair among them.
+  string children;
+  std::map<string, size_t> pair_index;
+  std::vector<size_t> item_pair(count);
+  string parents;
+  for (size_t last_node = tree_size - 1; tree_size > 0 && last_node > 0;
+       last_node = Parent(last_node)) {
+    children.clear();
+    pair_index.clear();
+    for (size_t i = 0; i < count; ++i) {
+      item_pair[i] = kNoParent;
+      if (!(*results)[i])
+        continue;
+      size_t node = nodes[i];
+      nodes[i] = Parent(node);
+      if (!IsRightChild(node) && node == last_node)
+        // The sibling does not exist and the parent is a dummy copy.
+        continue;
+      if (path_position[i] == paths[i].size() ||
+          paths[i][path_position[i]].size() != node_size) {
+        (*results)[i] = false;
+        continue;
+      }
+      const string &sibling = paths[i][path_position[i]++];
+      string pair = IsRightChild(node) ? sibling + hashes[i]
+          : hashes[i] + sibling;
+      std::map<string, size_t>::iterator it = pair_index.find(pair);
+      if (it == pair_index.end()) {
+        it = pair_index.insert(
+            std::make_pair(pair, children.size() / (2 * node_size))).first;
+        children.append(pair);
+      }
+      item_pair[i] = it->second;
+    }
+
+    parents.clear();
+    treehasher_.HashChildrenPairs(children.data(),
+                                  children.size() / (2 * node_size), &parents);
+    for (size_t i = 0; i < count; ++i) {
+      if (item_pair[i] != kNoParent)
+        hashes[i].assign(parents, item_pair[i] * node_size, node_size);
+    }
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    if ((*results)[i])
+      (*results)[i] = path_position[i] == paths[i].size() && hashes[i] == root;
+  }
+}
+
 string MerkleVerifier::RootFromPath(size_t leaf, size_t tree_size,
                                      const std::vector<string> &path,
                                      const string &data) {
@@ -37,17 +118,26 @@ string MerkleVerifier::RootFromPath(size_t leaf, size_t tree_size,
   size_t node = leaf - 1;
   size_t last_node = tree_size  - 1;
 
-  string node_hash = LeafHash(data);
+  Digest node_hash;
+  LeafHash(data, &node_hash);
+  Digest sibling;
   std::vector<string>::const_iterator it = path.begin();
 
   while (last_node) {
     if (it == path.end())
       // We've reached the end but we're not done yet.
       return string();
-    if (IsRightChild(node))
-      node_hash = treehasher_.HashChildren(*it++, node_hash);
-    else if (node < last_node)
-      node_hash = treehasher_.HashChildren(node_hash, *it++);
+    if (it->size() != treehasher_.DigestSize())
+      return string();
+    if (IsRightChild(node)) {
+      sibling.Assign(it->data(), it->size());
+      ++it;
+      treehasher_.HashChildren(sibling, node_hash, &node_hash);
+    } else if (node < last_node) {
+      sibling.Assign(it->data(), it->size());
+      ++it;
+      treehasher_.HashChildren(node_hash, sibling, &node_hash);
+    }
     // Else the sibling does not exist and the parent is a dummy copy.
     // Do nothing.
 
@@ -58,7 +148,7 @@ string MerkleVerifier::RootFromPath(size_t leaf, size_t tree_size,
   // Check that we've reached the end.
   if (it != path.end())
     return string();
-  return node_hash;
+  return node_hash.ToString();
 }
 
 bool MerkleVerifier::VerifyConsistency(size_t snapshot1, size_t snapshot2,
@@ -86,26 +176,42 @@ bool MerkleVerifier::VerifyConsistency(size_t snapshot1, size_t snapshot2,
     last_node = Parent(last_node);
   }
 
-  string node1_hash;
-  string node2_hash;
-  if (node)
-    node2_hash = node1_hash = *it++;
-  else
+  // Proof nodes of the wrong size can never match; this also keeps them
+  // within what a Digest holds.
+  for (std::vector<string>::const_iterator i = proof.begin();
+       i != proof.end(); ++i) {
+    if (i->size() != treehasher_.DigestSize())
+      return false;
+  }
+
+  Digest node1_hash;
+  Digest node2_hash;
+  Digest sibling;
+  if (node) {
+    node1_hash.Assign(it->data(), it->size());
+    ++it;
+  } else {
     // The tree at snapshot1 was balanced, nothing to verify for root1.
-    node2_hash = node1_hash = root1;
+    if (root1.size() != treehasher_.DigestSize())
+      return false;
+    node1_hash.Assign(root1.data(), root1.size());
+  }
+  node2_hash = node1_hash;
   while (node) {
     if (it == proof.end())
       return false;
 
+    sibling.Assign(it->data(), it->size());
     if (IsRightChild(node)) {
-      node1_hash = treehasher_.HashChildren(*it, node1_hash);
-      node2_hash = treehasher_.HashChildren(*it, node2_hash);
+      treehasher_.HashChildren(sibling, node1_hash, &node1_hash);
+      treehasher_.HashChildren(sibling, node2_hash, &node2_hash);
       ++it;
-    }
-    else if (node < last_node)
+    } else if (node < last_node) {
       // The sibling only exists in the later tree. The parent in the
       // snapshot1 tree is a dummy copy.
-      node2_hash = treehasher_.HashChildren(node2_hash, *it++);
+      treehasher_.HashChildren(node2_hash, sibling, &node2_hash);
+      ++it;
+    }
     // Else the sibling does not exist in either tree. Do nothing.
 
     node = Parent(node);
@@ -113,7 +219,7 @@ bool MerkleVerifier::VerifyConsistency(size_t snapshot1, size_t snapshot2,
   }
 
   // Verify the first root.
-  if (node1_hash != root1)
+  if (node1_hash.ToString() != root1)
     return false;
 
   // Continue until the second root.
@@ -122,14 +228,20 @@ bool MerkleVerifier::VerifyConsistency(size_t snapshot1, size_t snapshot2,
       // We've reached the end but we're not done yet.
       return false;
 
-    node2_hash = treehasher_.HashChildren(node2_hash, *it++);
+    sibling.Assign(it->data(), it->size());
+    ++it;
+    treehasher_.HashChildren(node2_hash, sibling, &node2_hash);
     last_node = Parent(last_node);
   }
 
   // Verify the second root.
-  return node2_hash == root2 && it == proof.end();
+  return node2_hash.ToString() == root2 && it == proof.end();
 }
 
 string MerkleVerifier::LeafHash(const std::string &data) {
   return treehasher_.HashLeaf(data);
 }
+
+void MerkleVerifier::LeafHash(const std::string &data, Digest *digest) {
+  treehasher_.HashLeaf(data, digest);
+}
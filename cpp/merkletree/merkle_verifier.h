@@ -2,8 +2,10 @@
 #define MERKLEVERIFIER_H
 
 #include <stddef.h>
+#include <string>
 #include <vector>
 
+#include "merkletree/digest.h"
 #include "merkletree/tree_hasher.h"
 
 class SerialHasher;
@@ -31,6 +33,21 @@ class MerkleVerifier {
                   const std::vector<std::string> &path, const std::string &root,
                   const std::string &data);
 
+  // Verify a batch of Merkle paths in a tree of |tree_size| leaves with
+  // root |root|. The ith item is the path |paths[i]| for the |leaves[i]|th
+  // leaf with data |data[i]|. |results| is resized to hold one result per
+  // item, which is the same as VerifyPath() would give; an invalid item
+  // does not affect the others.
+  //
+  // The paths are folded up the tree together, level by level. Parents
+  // computed for several paths (e.g., near the root, or for neighbouring
+  // leaves) are hashed only once, and the rest are hashed in batches.
+  void VerifyPaths(size_t tree_size, const std::string &root,
+                   const std::vector<size_t> &leaves,
+                   const std::vector<std::vector<std::string> > &paths,
+                   const std::vector<std::string> &data,
+                   std::vector<bool> *results);
+
   // Compute the root corresponding to a Merkle audit path.
   // Returns an empty string if the path is not valid.
   //
@@ -49,6 +66,7 @@ class MerkleVerifier {
 
   // Return the leaf hash corresponding to the leaf input.
   std::string LeafHash(const std::string &data);
+  void LeafHash(const std::string &data, Digest *digest);
 
  private:
   TreeHasher treehasher_;
@@ -2,9 +2,243 @@
 
 #include <openssl/sha.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SHA256_MULTIBUFFER_AVX2
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
 
 using std::string;
 
+void SerialHasher::Update(const unsigned char *data, size_t length) {
+  Update(string(reinterpret_cast<const char*>(data), length));
+}
+
+void SerialHasher::Final(Digest *digest) {
+  string result = Final();
+  digest->Assign(result.data(), result.size());
+}
+
+void SerialHasher::DigestBatch(const unsigned char *const *data,
+                               const size_t *length, size_t count,
+                               unsigned char *digests) {
+  // Use a fresh hasher so that we don't clobber an ongoing computation.
+  SerialHasher *hasher = Create();
+  const size_t digest_size = DigestSize();
+  for (size_t i = 0; i < count; ++i) {
+    hasher->Reset();
+    hasher->Update(string(reinterpret_cast<const char*>(data[i]), length[i]));
+    string digest = hasher->Final();
+    memcpy(digests + i * digest_size, digest.data(), digest_size);
+  }
+  delete hasher;
+}
+
+namespace {
+
+#ifdef SHA256_MULTIBUFFER_AVX2
+
+const uint32_t kSha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+const uint32_t kSha256H0[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+const size_t kLanes = 8;
+const size_t kBlockSize = 64;
+
+inline uint32_t LoadBigEndian32(const unsigned char *p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+      (static_cast<uint32_t>(p[1]) << 16) |
+      (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+inline void StoreBigEndian32(uint32_t v, unsigned char *p) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+// One message being fed through a SIMD lane, block by block. The final one
+// or two blocks (the remaining data plus SHA-256 padding) are assembled in
+// |tail|; all preceding blocks are read directly from the message.
+struct Lane {
+  void Init(const unsigned char *message, size_t message_length) {
+    data = message;
+    full_blocks = message_length / kBlockSize;
+    size_t remainder = message_length % kBlockSize;
+    // 0x80 plus the 8-byte length must fit after the remainder.
+    size_t tail_blocks = remainder + 9 > kBlockSize ? 2 : 1;
+    blocks = full_blocks + tail_blocks;
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, message + full_blocks * kBlockSize, remainder);
+    tail[remainder] = 0x80;
+    uint64_t bits = static_cast<uint64_t>(message_length) << 3;
+    unsigned char *end = tail + tail_blocks * kBlockSize;
+    for (int i = 1; i <= 8; ++i, bits >>= 8)
+      end[-i] = bits & 0xff;
+  }
+
+  const unsigned char *Block(size_t i) const {
+    if (i < full_blocks)
+      return data + i * kBlockSize;
+    return tail + (i - full_blocks) * kBlockSize;
+  }
+
+  const unsigned char *data;
+  size_t full_blocks;
+  size_t blocks;
+  unsigned char tail[2 * kBlockSize];
+};
+
+#define ROTR(x, n) \
+  _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+
+// Hash up to kLanes messages in parallel, one message per 32-bit lane.
+__attribute__((target("avx2")))
+void Sha256Avx2Lanes(const unsigned char *const *data, const size_t *length,
+                     size_t count, unsigned char *digests) {
+  static const unsigned char kZeroBlock[kBlockSize] = { 0 };
+  Lane lanes[kLanes];
+  size_t max_blocks = 0;
+  for (size_t l = 0; l < count; ++l) {
+    lanes[l].Init(data[l], length[l]);
+    if (lanes[l].blocks > max_blocks)
+      max_blocks = lanes[l].blocks;
+  }
+
+  __m256i state[8];
+  for (int i = 0; i < 8; ++i)
+    state[i] = _mm256_set1_epi32(kSha256H0[i]);
+
+  for (size_t b = 0; b < max_blocks; ++b) {
+    // Lanes that have run out of blocks (or are unused) hash a dummy block
+    // and keep their previous state.
+    const unsigned char *block[kLanes];
+    int32_t active[kLanes];
+    for (size_t l = 0; l < kLanes; ++l) {
+      bool live = l < count && b < lanes[l].blocks;
+      block[l] = live ? lanes[l].Block(b) : kZeroBlock;
+      active[l] = live ? -1 : 0;
+    }
+    const __m256i mask = _mm256_setr_epi32(active[0], active[1], active[2],
+                                           active[3], active[4], active[5],
+                                           active[6], active[7]);
+
+    __m256i w[16];
+    for (int t = 0; t < 16; ++t) {
+      w[t] = _mm256_setr_epi32(
+          LoadBigEndian32(block[0] + 4 * t), LoadBigEndian32(block[1] + 4 * t),
+          LoadBigEndian32(block[2] + 4 * t), LoadBigEndian32(block[3] + 4 * t),
+          LoadBigEndian32(block[4] + 4 * t), LoadBigEndian32(block[5] + 4 * t),
+          LoadBigEndian32(block[6] + 4 * t), LoadBigEndian32(block[7] + 4 * t));
+    }
+
+    __m256i a = state[0], b_ = state[1], c = state[2], d = state[3];
+    __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int t = 0; t < 64; ++t) {
+      __m256i wt;
+      if (t < 16) {
+        wt = w[t];
+      } else {
+        __m256i w15 = w[(t - 15) & 15];
+        __m256i w2 = w[(t - 2) & 15];
+        __m256i s0 = _mm256_xor_si256(
+            _mm256_xor_si256(ROTR(w15, 7), ROTR(w15, 18)),
+            _mm256_srli_epi32(w15, 3));
+        __m256i s1 = _mm256_xor_si256(
+            _mm256_xor_si256(ROTR(w2, 17), ROTR(w2, 19)),
+            _mm256_srli_epi32(w2, 10));
+        wt = _mm256_add_epi32(
+            _mm256_add_epi32(w[t & 15], s0),
+            _mm256_add_epi32(w[(t - 7) & 15], s1));
+        w[t & 15] = wt;
+      }
+      __m256i sigma1 = _mm256_xor_si256(
+          _mm256_xor_si256(ROTR(e, 6), ROTR(e, 11)), ROTR(e, 25));
+      __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f),
+                                    _mm256_andnot_si256(e, g));
+      __m256i t1 = _mm256_add_epi32(
+          _mm256_add_epi32(_mm256_add_epi32(h, sigma1), ch),
+          _mm256_add_epi32(_mm256_set1_epi32(kSha256K[t]), wt));
+      __m256i sigma0 = _mm256_xor_si256(
+          _mm256_xor_si256(ROTR(a, 2), ROTR(a, 13)), ROTR(a, 22));
+      __m256i maj = _mm256_or_si256(
+          _mm256_and_si256(a, b_),
+          _mm256_and_si256(c, _mm256_or_si256(a, b_)));
+      __m256i t2 = _mm256_add_epi32(sigma0, maj);
+      h = g;
+      g = f;
+      f = e;
+      e = _mm256_add_epi32(d, t1);
+      d = c;
+      c = b_;
+      b_ = a;
+      a = _mm256_add_epi32(t1, t2);
+    }
+
+    __m256i result[8] = { a, b_, c, d, e, f, g, h };
+    for (int i = 0; i < 8; ++i) {
+      state[i] = _mm256_blendv_epi8(
+          state[i], _mm256_add_epi32(state[i], result[i]), mask);
+    }
+  }
+
+  uint32_t words[8][kLanes];
+  for (int i = 0; i < 8; ++i)
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(words[i]), state[i]);
+  for (size_t l = 0; l < count; ++l) {
+    for (int i = 0; i < 8; ++i)
+      StoreBigEndian32(words[i][l], digests + l * SHA256_DIGEST_LENGTH + 4 * i);
+  }
+}
+
+#undef ROTR
+
+bool HaveAvx2() {
+  static const bool have_avx2 = __builtin_cpu_supports("avx2");
+  return have_avx2;
+}
+
+// The SHA extensions: CPUID leaf 7, subleaf 0, EBX bit 29. OpenSSL
+// already uses them for serial hashing when they are there.
+bool CpuHasShaNi() {
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid_max(0, NULL) < 7)
+    return false;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return (ebx & (1U << 29)) != 0;
+}
+
+// Whether the lanes beat hashing the messages one by one. With the SHA
+// extensions a single hardware-hashed message is ~30% faster than its
+// share of an eight-lane AVX2 batch.
+bool UseAvx2Lanes() {
+  static const bool use_lanes = HaveAvx2() && !CpuHasShaNi();
+  return use_lanes;
+}
+
+#endif  // SHA256_MULTIBUFFER_AVX2
+
+}  // namespace
+
 const size_t Sha256Hasher::kDigestSize = SHA256_DIGEST_LENGTH;
 
 Sha256Hasher::Sha256Hasher() : initialized_(false) {}
@@ -21,6 +255,13 @@ void Sha256Hasher::Update(const std::string &data) {
   SHA256_Update(&ctx_, data.data(), data.size());
 }
 
+void Sha256Hasher::Update(const unsigned char *data, size_t length) {
+  if (!initialized_)
+    Reset();
+
+  SHA256_Update(&ctx_, data, length);
+}
+
 string Sha256Hasher::Final() {
   if (!initialized_)
     Reset();
@@ -31,10 +272,81 @@ string Sha256Hasher::Final() {
   initialized_ = false;
 }
 
+void Sha256Hasher::Final(Digest *digest) {
+  if (!initialized_)
+    Reset();
+
+  SHA256_Final(digest->mutable_data(), &ctx_);
+  digest->set_size(SHA256_DIGEST_LENGTH);
+  initialized_ = false;
+}
+
 SerialHasher* Sha256Hasher::Create() const {
   return new Sha256Hasher;
 }
 
+void Sha256Hasher::DigestBatch(const unsigned char *const *data,
+                               const size_t *length, size_t count,
+                               unsigned char *digests) {
+  BatchDigest(data, length, count, digests);
+}
+
+// static
+void Sha256Hasher::OneShotDigest(const unsigned char *data, size_t length,
+                                 unsigned char *digest) {
+  // The low-level interface; with some OpenSSL versions SHA256() itself
+  // goes through a much slower generic digest lookup.
+  SHA256_CTX ctx;
+  SHA256_Init(&ctx);
+  SHA256_Update(&ctx, data, length);
+  SHA256_Final(digest, &ctx);
+}
+
+// static
+void Sha256Hasher::PrefixedDigest(unsigned char prefix,
+                                  const unsigned char *first,
+                                  size_t first_length,
+                                  const unsigned char *second,
+                                  size_t second_length,
+                                  unsigned char *digest) {
+  // Large enough for a node: a prefix and two child digests.
+  unsigned char buffer[1 + 2 * Digest::kMaxSize];
+  if (first_length + second_length < sizeof(buffer)) {
+    buffer[0] = prefix;
+    if (first_length > 0)
+      memcpy(buffer + 1, first, first_length);
+    if (second_length > 0)
+      memcpy(buffer + 1 + first_length, second, second_length);
+    OneShotDigest(buffer, 1 + first_length + second_length, digest);
+    return;
+  }
+  SHA256_CTX ctx;
+  SHA256_Init(&ctx);
+  SHA256_Update(&ctx, &prefix, 1);
+  SHA256_Update(&ctx, first, first_length);
+  SHA256_Update(&ctx, second, second_length);
+  SHA256_Final(digest, &ctx);
+}
+
+// static
+void Sha256Hasher::BatchDigest(const unsigned char *const *data,
+                               const size_t *length, size_t count,
+                               unsigned char *digests) {
+  size_t i = 0;
+#ifdef SHA256_MULTIBUFFER_AVX2
+  // A lone message is cheaper to hash serially.
+  if (count > 1 && UseAvx2Lanes()) {
+    for (; i < count; i += kLanes) {
+      size_t lanes = count - i < kLanes ? count - i : kLanes;
+      Sha256Avx2Lanes(data + i, length + i, lanes,
+                      digests + i * SHA256_DIGEST_LENGTH);
+    }
+  }
+#endif
+  for (; i < count; ++i)
+    OneShotDigest(data[i], length[i], digests + i * SHA256_DIGEST_LENGTH);
+}
+
 // static
 string Sha256Hasher::Sha256Digest(const string &data) {
   Sha256Hasher hasher;
@@ -5,6 +5,8 @@
 #include <stddef.h>
 #include <string>
 
+#include "merkletree/digest.h"
+
 class SerialHasher {
  public:
   SerialHasher() {}
@@ -19,27 +21,72 @@ class SerialHasher {
   // Update the hash context with (binary) data.
   virtual void Update(const std::string &data) = 0;
 
+  // As above, for data that isn't in a string. The default implementation
+  // copies it into one.
+  virtual void Update(const unsigned char *data, size_t length);
+
   // Finalize the hash context and return the binary digest blob.
   virtual std::string Final() = 0;
 
+  // As above, but write the digest to |digest|, which requires
+  // DigestSize() <= Digest::kMaxSize. The default implementation goes
+  // through Final().
+  virtual void Final(Digest *digest);
+
   // A virtual constructor.  The caller gets ownership of the returned object.
   virtual SerialHasher* Create() const = 0;
+
+  // Hash |count| independent messages in one call: message i is the
+  // |length[i]| bytes at |data[i]|, and its digest is written to
+  // |digests| + i * DigestSize(). Does not touch the Reset()/Update()/Final()
+  // context. The default implementation hashes the messages one at a time;
+  // subclasses may override it with a batched kernel.
+  virtual void DigestBatch(const unsigned char *const *data,
+                           const size_t *length, size_t count,
+                           unsigned char *digests);
 };
 
 class Sha256Hasher : public SerialHasher {
  public:
+  enum { kDigestLength = SHA256_DIGEST_LENGTH };
+
   Sha256Hasher();
 
   size_t DigestSize() const { return kDigestSize; }
 
   void Reset();
   void Update(const std::string &data);
+  void Update(const unsigned char *data, size_t length);
   std::string Final();
+  void Final(Digest *digest);
   SerialHasher* Create() const;
 
+  // Uses a multi-buffer SIMD kernel that hashes several messages in
+  // parallel lanes when the CPU supports it (currently AVX2, 8 lanes),
+  // and falls back to hashing one message at a time otherwise. CPUs with
+  // SHA instructions hash one at a time, as that is faster there.
+  void DigestBatch(const unsigned char *const *data, const size_t *length,
+                   size_t count, unsigned char *digests);
+
   // Create a new hasher and call Reset(), Update(), and Final().
   static std::string Sha256Digest(const std::string &data);
 
+  // Non-virtual, context-free hashing, for TreeHasherT<Sha256Hasher>.
+  // Each writes kDigestLength bytes to |digest|.
+  static void OneShotDigest(const unsigned char *data, size_t length,
+                            unsigned char *digest);
+
+  // Hash |prefix|, then |first_length| bytes at |first|, then
+  // |second_length| bytes at |second|. Short inputs are gathered into one
+  // buffer and hashed with a single update.
+  static void PrefixedDigest(unsigned char prefix, const unsigned char *first,
+                             size_t first_length, const unsigned char *second,
+                             size_t second_length, unsigned char *digest);
+
+  // Same as DigestBatch().
+  static void BatchDigest(const unsigned char *const *data,
+                          const size_t *length, size_t count,
+                          unsigned char *digests);
 
  private:
   SHA256_CTX ctx_;
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include <stddef.h>
 #include <string>
+#include <vector>
 
 #include "merkletree/serial_hasher.h"
 #include "util/testing.h"
@@ -108,6 +109,51 @@ TYPED_TEST(SerialHasherTest, Create) {
   }
 }
 
+TYPED_TEST(SerialHasherTest, DigestInterface) {
+  for (size_t i = 0; this->test_vectors_[i].input != NULL; ++i) {
+    const string input = S(this->test_vectors_[i].input,
+                           this->test_vectors_[i].input_length);
+    this->hasher_->Reset();
+    this->hasher_->Update(reinterpret_cast<const unsigned char*>(input.data()),
+                          input.size());
+    Digest digest;
+    this->hasher_->Final(&digest);
+    EXPECT_EQ(this->hasher_->DigestSize(), digest.size());
+    EXPECT_STREQ(H(digest.ToString()).c_str(), this->test_vectors_[i].output);
+  }
+}
+
+// The batch interface must agree with one-at-a-time hashing, for any
+// number of messages and any mix of lengths (including lengths around the
+// block and padding boundaries).
+TYPED_TEST(SerialHasherTest, DigestBatch) {
+  const size_t digest_size = this->hasher_->DigestSize();
+  for (size_t count = 1; count <= 20; ++count) {
+    std::vector<string> messages;
+    for (size_t i = 0; i < count; ++i)
+      messages.push_back(string((count * 37 + i * 13) % 200, 'a' + i));
+
+    std::vector<const unsigned char*> data;
+    std::vector<size_t> length;
+    for (size_t i = 0; i < count; ++i) {
+      data.push_back(
+          reinterpret_cast<const unsigned char*>(messages[i].data()));
+      length.push_back(messages[i].size());
+    }
+    std::vector<unsigned char> digests(count * digest_size);
+    this->hasher_->DigestBatch(&data[0], &length[0], count, &digests[0]);
+
+    for (size_t i = 0; i < count; ++i) {
+      this->hasher_->Reset();
+      this->hasher_->Update(messages[i]);
+      string digest = this->hasher_->Final();
+      EXPECT_EQ(H(digest), H(string(reinterpret_cast<char*>(
+          &digests[i * digest_size]), digest_size)))
+          << "count " << count << ", message " << i;
+    }
+  }
+}
+
 TEST(Sha256Test, StaticDigest) {
   string input, output, digest;
 
@@ -118,6 +164,35 @@ TEST(Sha256Test, StaticDigest) {
   }
 }
 
+// The context-free digests must match the context interface across the
+// block and padding boundaries, with and without the gathering buffer.
+TEST(Sha256Test, OneShotAndPrefixedDigest) {
+  string message;
+  for (size_t i = 0; i < 300; ++i)
+    message.push_back(static_cast<char>(i * 7 + 1));
+  const unsigned char *data =
+      reinterpret_cast<const unsigned char*>(message.data());
+
+  unsigned char digest[Sha256Hasher::kDigestLength];
+  for (size_t length = 0; length <= message.size(); ++length) {
+    Sha256Hasher::OneShotDigest(data, length, digest);
+    EXPECT_EQ(H(Sha256Hasher::Sha256Digest(message.substr(0, length))),
+              H(string(reinterpret_cast<char*>(digest), sizeof(digest))))
+        << "length " << length;
+  }
+
+  for (size_t first = 0; first <= 140; first += 7) {
+    for (size_t second = 0; second <= 140; second += 5) {
+      Sha256Hasher::PrefixedDigest(0x01, data + 1, first, data + 1 + first,
+                                   second, digest);
+      EXPECT_EQ(H(Sha256Hasher::Sha256Digest(
+                    string(1, '\x01') + message.substr(1, first + second))),
+                H(string(reinterpret_cast<char*>(digest), sizeof(digest))))
+          << "lengths " << first << ", " << second;
+    }
+  }
+}
+
 #undef S
 #undef H
 
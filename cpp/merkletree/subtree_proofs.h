@@ -0,0 +1,121 @@
+#ifndef SUBTREE_PROOFS_H
+#define SUBTREE_PROOFS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
+
+// Roots, audit paths and consistency proofs of RFC 6962 section 2.1, for a
+// tree of SHA-256 leaf hashes whose complete, aligned subtrees have their
+// roots stored somewhere, as in a SubtreeRootFile or a SharedLookupReader's
+// file: the recursion only comes to those and to ranges hashed from at
+// most one of them per level. |Nodes| has a method
+//
+//   const char *Node(size_t level, uint64_t index) const;
+//
+// that points at the root of leaves [|index| << |level|, (|index| + 1) <<
+// |level|).
+template <class Nodes> class SubtreeProofs {
+ public:
+  // |nodes| must outlive this.
+  explicit SubtreeProofs(const Nodes *nodes) : nodes_(nodes) {}
+
+  // The root of the tree of the first |tree_size| leaves.
+  std::string Root(uint64_t tree_size) const {
+    if (tree_size == 0)
+      return hasher_.HashEmpty();
+    return SubtreeHash(0, tree_size);
+  }
+
+  // As the MerkleTree methods of the same name: |leaf| is indexed from 1,
+  // and the same queries come back empty. The callers check that the
+  // snapshots are stored.
+  std::vector<std::string> PathToRootAtSnapshot(uint64_t leaf,
+                                                uint64_t snapshot) const {
+    std::vector<std::string> path;
+    if (leaf == 0 || leaf > snapshot)
+      return path;
+    Path(leaf - 1, 0, snapshot, &path);
+    return path;
+  }
+
+  std::vector<std::string> SnapshotConsistency(uint64_t snapshot1,
+                                               uint64_t snapshot2) const {
+    std::vector<std::string> proof;
+    if (snapshot1 == 0 || snapshot1 >= snapshot2)
+      return proof;
+    Subproof(snapshot1, 0, snapshot2, true, &proof);
+    return proof;
+  }
+
+ private:
+  static const size_t kNodeSize = Sha256Hasher::kDigestLength;
+
+  // The largest power of two that is less than |n|, which must be at
+  // least 2.
+  static uint64_t Split(uint64_t n) {
+    uint64_t power = 1;
+    while (power << 1 < n)
+      power <<= 1;
+    return power;
+  }
+
+  // The hash of the leaves |begin| to |end| - 1, a range of the tree that
+  // the recursion comes to.
+  std::string SubtreeHash(uint64_t begin, uint64_t end) const {
+    const uint64_t count = end - begin;
+    if ((count & (count - 1)) == 0) {
+      // The recursion only comes to complete subtrees that are aligned.
+      size_t level = 0;
+      while ((static_cast<uint64_t>(1) << level) < count)
+        ++level;
+      return std::string(nodes_->Node(level, begin >> level), kNodeSize);
+    }
+    const uint64_t split = Split(count);
+    return hasher_.HashChildren(SubtreeHash(begin, begin + split),
+                                SubtreeHash(begin + split, end));
+  }
+
+  // PATH(leaf, D[begin:end]), leaf first.
+  void Path(uint64_t leaf, uint64_t begin, uint64_t end,
+            std::vector<std::string> *path) const {
+    if (end - begin == 1)
+      return;
+    const uint64_t split = Split(end - begin);
+    if (leaf < begin + split) {
+      Path(leaf, begin, begin + split, path);
+      path->push_back(SubtreeHash(begin + split, end));
+    } else {
+      Path(leaf, begin + split, end, path);
+      path->push_back(SubtreeHash(begin, begin + split));
+    }
+  }
+
+  // SUBPROOF(snapshot1, D[begin:end], complete), smallest subtree first.
+  void Subproof(uint64_t snapshot1, uint64_t begin, uint64_t end,
+                bool complete, std::vector<std::string> *proof) const {
+    const uint64_t count = end - begin;
+    if (snapshot1 == count) {
+      if (!complete)
+        proof->push_back(SubtreeHash(begin, end));
+      return;
+    }
+    const uint64_t split = Split(count);
+    if (snapshot1 <= split) {
+      Subproof(snapshot1, begin, begin + split, complete, proof);
+      proof->push_back(SubtreeHash(begin + split, end));
+    } else {
+      Subproof(snapshot1 - split, begin + split, end, false, proof);
+      proof->push_back(SubtreeHash(begin, begin + split));
+    }
+  }
+
+  const Nodes *const nodes_;
+  TreeHasherT<Sha256Hasher> hasher_;
+};
+
+#endif  // SUBTREE_PROOFS_H
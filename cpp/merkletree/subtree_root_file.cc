@@ -0,0 +1,204 @@
+#include "merkletree/subtree_root_file.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stddef.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+
+using std::string;
+
+namespace {
+
+const size_t kNodeSize = Sha256Hasher::kDigestLength;
+
+}  // namespace
+
+SubtreeRootFile::SubtreeRootFile(const string &path)
+    : path_(path),
+      fd_(-1),
+      leaf_count_(0) {
+  fd_ = open(path_.c_str(), O_RDWR | O_CREAT, 0666);
+  PCHECK(fd_ >= 0) << "Failed to open subtree root file " << path_;
+
+  struct stat st;
+  PCHECK(fstat(fd_, &st) == 0) << "Failed to stat " << path_;
+  const uint64_t roots = st.st_size / kNodeSize;
+  leaf_count_ = LeafCountOf(roots);
+  if (st.st_size % kNodeSize != 0 || roots != RootCount(leaf_count_)) {
+    LOG(WARNING) << "Discarding partially written roots at the end of "
+                 << path_;
+    Truncate(leaf_count_);
+    return;
+  }
+  ReadBorder();
+}
+
+SubtreeRootFile::~SubtreeRootFile() {
+  PCHECK(close(fd_) == 0) << "Failed to close " << path_;
+}
+
+string SubtreeRootFile::CurrentRoot() const {
+  if (border_.empty())
+    return hasher_.HashEmpty();
+  string root(border_.back());
+  for (size_t i = border_.size() - 1; i > 0; --i)
+    root = hasher_.HashChildren(border_[i - 1], root);
+  return root;
+}
+
+void SubtreeRootFile::Append(std::vector<string>::const_iterator begin,
+                             std::vector<string>::const_iterator end) {
+  if (begin == end)
+    return;
+
+  // A leaf completes as many subtrees as the number of leaves before it
+  // has trailing ones; those are the smallest of the border.
+  string buffer;
+  uint64_t leaf = leaf_count_;
+  for (std::vector<string>::const_iterator it = begin; it != end;
+       ++it, ++leaf) {
+    CHECK_EQ(kNodeSize, it->size());
+    buffer.append(*it);
+    string root(*it);
+    for (uint64_t bits = leaf; bits & 1; bits >>= 1) {
+      root = hasher_.HashChildren(border_.back(), root);
+      border_.pop_back();
+      buffer.append(root);
+    }
+    border_.push_back(root);
+  }
+
+  const off_t offset = RootCount(leaf_count_) * kNodeSize;
+  size_t written = 0;
+  while (written < buffer.size()) {
+    ssize_t ret = pwrite(fd_, buffer.data() + written,
+                         buffer.size() - written, offset + written);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    PCHECK(ret > 0) << "Failed to write to " << path_;
+    written += ret;
+  }
+  PCHECK(fdatasync(fd_) == 0) << "Failed to sync " << path_;
+  leaf_count_ = leaf;
+}
+
+void SubtreeRootFile::Truncate(uint64_t count) {
+  CHECK_LE(count, leaf_count_);
+  PCHECK(ftruncate(fd_, RootCount(count) * kNodeSize) == 0)
+      << "Failed to truncate " << path_;
+  PCHECK(fdatasync(fd_) == 0) << "Failed to sync " << path_;
+  leaf_count_ = count;
+  ReadBorder();
+}
+
+// static
+uint64_t SubtreeRootFile::RootCount(uint64_t leaves) {
+  return 2 * leaves - __builtin_popcountll(leaves);
+}
+
+// static
+uint64_t SubtreeRootFile::RootPosition(size_t level, uint64_t index) {
+  // Right after the last leaf of the subtree, and the roots of the |level|
+  // subtrees below it that the leaf completes.
+  return RootCount(((index + 1) << level) - 1) + level;
+}
+
+// static
+uint64_t SubtreeRootFile::LeafCountOf(uint64_t roots) {
+  // RootCount(n) is at least 2n - 64, so this starts no lower than the
+  // answer, and RootCount() grows with n.
+  uint64_t leaves = std::min<uint64_t>(roots, roots / 2 + 32);
+  while (leaves > 0 && RootCount(leaves) > roots)
+    --leaves;
+  return leaves;
+}
+
+void SubtreeRootFile::ReadBorder() {
+  border_.clear();
+  uint64_t begin = 0;
+  for (size_t level = 64; level-- > 0;) {
+    if ((leaf_count_ >> level & 1) == 0)
+      continue;
+    string root(kNodeSize, '\0');
+    const off_t offset = RootPosition(level, begin >> level) * kNodeSize;
+    size_t bytes_read = 0;
+    while (bytes_read < kNodeSize) {
+      ssize_t ret = pread(fd_, &root[bytes_read], kNodeSize - bytes_read,
+                          offset + bytes_read);
+      if (ret < 0 && errno == EINTR)
+        continue;
+      PCHECK(ret > 0) << "Failed to read from " << path_;
+      bytes_read += ret;
+    }
+    border_.push_back(root);
+    begin += static_cast<uint64_t>(1) << level;
+  }
+}
+
+SubtreeRootReader::SubtreeRootReader(const string &path, int fd,
+                                     const char *base, size_t size,
+                                     uint64_t max_leaves)
+    : path_(path),
+      fd_(fd),
+      base_(base),
+      size_(size),
+      max_leaves_(max_leaves),
+      proofs_(this) {}
+
+SubtreeRootReader::~SubtreeRootReader() {
+  PCHECK(munmap(const_cast<char*>(base_), size_) == 0);
+  PCHECK(close(fd_) == 0);
+}
+
+// static
+SubtreeRootReader *SubtreeRootReader::Open(const string &path,
+                                           uint64_t max_leaves) {
+  CHECK_GT(max_leaves, 0U);
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  // Mapping past the end of the file is fine, as long as nobody reads
+  // there; the pages become readable as the writer appends.
+  const size_t size = SubtreeRootFile::RootCount(max_leaves) * kNodeSize;
+  void *map = mmap(NULL, size, PROT_READ, MAP_SHARED | MAP_NORESERVE, fd, 0);
+  PCHECK(map != MAP_FAILED) << "Failed to map " << path;
+  return new SubtreeRootReader(path, fd, static_cast<const char*>(map), size,
+                               max_leaves);
+}
+
+uint64_t SubtreeRootReader::LeafCount() const {
+  struct stat st;
+  PCHECK(fstat(fd_, &st) == 0) << "Failed to stat " << path_;
+  return std::min(max_leaves_,
+                  SubtreeRootFile::LeafCountOf(st.st_size / kNodeSize));
+}
+
+string SubtreeRootReader::RootAtSnapshot(uint64_t tree_size) const {
+  CHECK_LE(tree_size, max_leaves_);
+  return proofs_.Root(tree_size);
+}
+
+std::vector<string> SubtreeRootReader::PathToRootAtSnapshot(
+    uint64_t leaf, uint64_t snapshot) const {
+  if (snapshot > max_leaves_)
+    return std::vector<string>();
+  return proofs_.PathToRootAtSnapshot(leaf, snapshot);
+}
+
+std::vector<string> SubtreeRootReader::SnapshotConsistency(
+    uint64_t snapshot1, uint64_t snapshot2) const {
+  if (snapshot2 > max_leaves_)
+    return std::vector<string>();
+  return proofs_.SnapshotConsistency(snapshot1, snapshot2);
+}
+
+const char *SubtreeRootReader::Node(size_t level, uint64_t index) const {
+  return base_ + SubtreeRootFile::RootPosition(level, index) * kNodeSize;
+}
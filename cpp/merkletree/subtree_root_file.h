@@ -0,0 +1,125 @@
+#ifndef SUBTREE_ROOT_FILE_H
+#define SUBTREE_ROOT_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/serial_hasher.h"
+#include "merkletree/subtree_proofs.h"
+#include "merkletree/tree_hasher.h"
+
+// A file of the roots of all complete, aligned subtrees of a Merkle tree of
+// SHA-256 leaf hashes, i.e. of each leaf, each pair of leaves 2i and 2i + 1,
+// and so on up. Any node of the tree or of a past snapshot of it is hashed
+// from at most one of those per level, so any audit path or consistency
+// proof takes O(log^2 n) reads at worst, and a lookup that serves from the
+// file needs no tree in memory: only the pages that the proofs touch.
+//
+// The roots are in post-order: each leaf, followed by the roots of the
+// subtrees that it completes, smallest first. So the file only ever grows
+// at the end, and its first RootCount(n) roots are those of the tree of the
+// first n leaves.
+
+// The writing side. Assumes that it is the sole writer of the file.
+// Aborts on any IO error.
+class SubtreeRootFile {
+ public:
+  // Opens |path|, creating it if it does not exist. Roots past those of the
+  // last complete tree (e.g., left behind by a crash during Append) are
+  // discarded.
+  explicit SubtreeRootFile(const std::string &path);
+  ~SubtreeRootFile();
+
+  // Number of leaves whose tree the file has.
+  uint64_t LeafCount() const { return leaf_count_; }
+
+  // The root of the tree of all those leaves.
+  std::string CurrentRoot() const;
+
+  // Append leaf hashes, and the roots of the subtrees that they complete.
+  // Returns once they are on disk.
+  void Append(std::vector<std::string>::const_iterator begin,
+              std::vector<std::string>::const_iterator end);
+
+  // Drop all but the tree of the first |count| leaves. Readers must not
+  // look past it while this runs. Requires count <= LeafCount().
+  void Truncate(uint64_t count);
+
+  // Number of roots in the tree of |leaves| leaves.
+  static uint64_t RootCount(uint64_t leaves);
+
+  // Position of the root of leaves [|index| << |level|, (|index| + 1) <<
+  // |level|) in the file, in roots.
+  static uint64_t RootPosition(size_t level, uint64_t index);
+
+  // The largest number of leaves whose tree fits in |roots| roots.
+  static uint64_t LeafCountOf(uint64_t roots);
+
+ private:
+  // Read |border_| back for LeafCount() leaves.
+  void ReadBorder();
+
+  const std::string path_;
+  int fd_;
+  uint64_t leaf_count_;
+  // The roots of the largest complete subtrees that the tree is made of,
+  // one for each bit set in |leaf_count_|, largest first.
+  std::vector<std::string> border_;
+  TreeHasherT<Sha256Hasher> hasher_;
+
+  // Private declarations without definitions, to disallow copying.
+  SubtreeRootFile(const SubtreeRootFile&);
+  SubtreeRootFile &operator=(const SubtreeRootFile&);
+};
+
+// The reading side: maps the file read-only, and keeps up with a writer
+// in another process or thread as it appends. Thread-safe.
+class SubtreeRootReader {
+ public:
+  ~SubtreeRootReader();
+
+  // Maps |path| with room for trees of up to |max_leaves| leaves, which
+  // takes address space, but no memory until read. Returns NULL if there is
+  // no such file.
+  static SubtreeRootReader *Open(const std::string &path,
+                                 uint64_t max_leaves);
+
+  // Number of leaves whose tree the file has now, up to the maximum.
+  uint64_t LeafCount() const;
+
+  // The root of the tree of the first |tree_size| leaves, which must be in
+  // the file.
+  std::string RootAtSnapshot(uint64_t tree_size) const;
+
+  // As the MerkleTree methods of the same name, for trees in the file:
+  // |leaf| is indexed from 1, and the same queries come back empty.
+  // Snapshots must be no larger than LeafCount() was.
+  std::vector<std::string> PathToRootAtSnapshot(uint64_t leaf,
+                                                uint64_t snapshot) const;
+  std::vector<std::string> SnapshotConsistency(uint64_t snapshot1,
+                                               uint64_t snapshot2) const;
+
+ private:
+  friend class SubtreeProofs<SubtreeRootReader>;
+
+  SubtreeRootReader(const std::string &path, int fd, const char *base,
+                    size_t size, uint64_t max_leaves);
+
+  // The root of leaves [|index| << |level|, (|index| + 1) << |level|).
+  const char *Node(size_t level, uint64_t index) const;
+
+  const std::string path_;
+  const int fd_;
+  const char *const base_;
+  const size_t size_;
+  const uint64_t max_leaves_;
+  const SubtreeProofs<SubtreeRootReader> proofs_;
+
+  // Private declarations without definitions, to disallow copying.
+  SubtreeRootReader(const SubtreeRootReader&);
+  SubtreeRootReader &operator=(const SubtreeRootReader&);
+};
+
+#endif  // SUBTREE_ROOT_FILE_H
@@ -0,0 +1,167 @@
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/subtree_root_file.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace {
+
+using std::string;
+
+class SubtreeRootFileTest : public ::testing::Test {
+ protected:
+  SubtreeRootFileTest()
+      : tmp_(),
+        path_(tmp_.TmpStorageDir() + "/subtrees"),
+        tree_(new Sha256Hasher()) {
+    for (size_t i = 0; i < 70; ++i) {
+      string leaf(1, static_cast<char>(i));
+      hashes_.push_back(tree_.LeafHash(leaf));
+    }
+  }
+
+  // Append the leaf hashes [|begin|, |end|) to |file| and to the tree.
+  void Append(size_t begin, size_t end, SubtreeRootFile *file) {
+    file->Append(hashes_.begin() + begin, hashes_.begin() + end);
+    for (size_t i = begin; i < end; ++i)
+      tree_.AddLeafHash(hashes_[i]);
+  }
+
+  TmpStorage tmp_;
+  string path_;
+  MerkleTree tree_;
+  std::vector<string> hashes_;
+};
+
+TEST_F(SubtreeRootFileTest, RootPositions) {
+  // Leaves 0 and 1, their parent, leaves 2 and 3, their parent, the root of
+  // all four.
+  EXPECT_EQ(0U, SubtreeRootFile::RootPosition(0, 0));
+  EXPECT_EQ(1U, SubtreeRootFile::RootPosition(0, 1));
+  EXPECT_EQ(2U, SubtreeRootFile::RootPosition(1, 0));
+  EXPECT_EQ(3U, SubtreeRootFile::RootPosition(0, 2));
+  EXPECT_EQ(4U, SubtreeRootFile::RootPosition(0, 3));
+  EXPECT_EQ(5U, SubtreeRootFile::RootPosition(1, 1));
+  EXPECT_EQ(6U, SubtreeRootFile::RootPosition(2, 0));
+  EXPECT_EQ(7U, SubtreeRootFile::RootCount(4));
+  EXPECT_EQ(8U, SubtreeRootFile::RootCount(5));
+
+  for (uint64_t leaves = 0; leaves < 300; ++leaves) {
+    const uint64_t roots = SubtreeRootFile::RootCount(leaves);
+    EXPECT_EQ(leaves, SubtreeRootFile::LeafCountOf(roots));
+    // Roots past a complete tree, but not yet the next, don't count.
+    if (leaves > 0) {
+      EXPECT_EQ(leaves - 1, SubtreeRootFile::LeafCountOf(roots - 1));
+    }
+  }
+}
+
+TEST_F(SubtreeRootFileTest, CreateEmpty) {
+  SubtreeRootFile file(path_);
+  EXPECT_EQ(0U, file.LeafCount());
+  EXPECT_EQ(tree_.CurrentRoot(), file.CurrentRoot());
+}
+
+TEST_F(SubtreeRootFileTest, Proofs) {
+  EXPECT_TRUE(SubtreeRootReader::Open(path_, 64) == NULL);
+  SubtreeRootFile file(path_);
+  SubtreeRootReader *reader = SubtreeRootReader::Open(path_, 64);
+  ASSERT_TRUE(reader != NULL);
+  EXPECT_EQ(0U, reader->LeafCount());
+
+  // Grow in uneven steps, so that every level's last node changes.
+  const size_t sizes[] = { 1, 2, 5, 11, 16, 17, 30, 64 };
+  size_t size = 0;
+  for (size_t s = 0; s < sizeof sizes / sizeof sizes[0]; ++s) {
+    Append(size, sizes[s], &file);
+    size = sizes[s];
+    EXPECT_EQ(size, file.LeafCount());
+    EXPECT_EQ(tree_.CurrentRoot(), file.CurrentRoot());
+    EXPECT_EQ(size, reader->LeafCount());
+
+    // Every tree in the file so far.
+    for (size_t snapshot = 1; snapshot <= size; ++snapshot) {
+      EXPECT_EQ(tree_.RootAtSnapshot(snapshot),
+                reader->RootAtSnapshot(snapshot));
+      for (size_t leaf = 1; leaf <= snapshot; ++leaf)
+        EXPECT_EQ(tree_.PathToRootAtSnapshot(leaf, snapshot),
+                  reader->PathToRootAtSnapshot(leaf, snapshot))
+            << leaf << " " << snapshot;
+      for (size_t first = 1; first < snapshot; ++first)
+        EXPECT_EQ(tree_.SnapshotConsistency(first, snapshot),
+                  reader->SnapshotConsistency(first, snapshot))
+            << first << " " << snapshot;
+    }
+  }
+  EXPECT_TRUE(reader->PathToRootAtSnapshot(0, 5).empty());
+  EXPECT_TRUE(reader->PathToRootAtSnapshot(6, 5).empty());
+  EXPECT_TRUE(reader->SnapshotConsistency(5, 5).empty());
+  // The reader was only mapped for as much.
+  Append(64, 70, &file);
+  EXPECT_EQ(64U, reader->LeafCount());
+  delete reader;
+}
+
+TEST_F(SubtreeRootFileTest, Reopen) {
+  {
+    SubtreeRootFile file(path_);
+    Append(0, 23, &file);
+  }
+  SubtreeRootFile file(path_);
+  EXPECT_EQ(23U, file.LeafCount());
+  EXPECT_EQ(tree_.CurrentRoot(), file.CurrentRoot());
+  // Goes on from the roots it read back.
+  Append(23, 41, &file);
+  EXPECT_EQ(tree_.CurrentRoot(), file.CurrentRoot());
+}
+
+TEST_F(SubtreeRootFileTest, DiscardPartialTree) {
+  {
+    SubtreeRootFile file(path_);
+    Append(0, 8, &file);
+  }
+  // Leave the last leaf without the roots that it completes, and half a
+  // root more.
+  const off_t length = (SubtreeRootFile::RootCount(8) - 2) * 32 + 16;
+  int fd = open(path_.c_str(), O_WRONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(0, ftruncate(fd, length));
+  close(fd);
+
+  SubtreeRootFile file(path_);
+  EXPECT_EQ(7U, file.LeafCount());
+  EXPECT_EQ(tree_.RootAtSnapshot(7), file.CurrentRoot());
+  file.Append(hashes_.begin() + 7, hashes_.begin() + 8);
+  EXPECT_EQ(tree_.CurrentRoot(), file.CurrentRoot());
+}
+
+TEST_F(SubtreeRootFileTest, Truncate) {
+  SubtreeRootFile file(path_);
+  Append(0, 20, &file);
+  file.Truncate(13);
+  EXPECT_EQ(13U, file.LeafCount());
+  EXPECT_EQ(tree_.RootAtSnapshot(13), file.CurrentRoot());
+
+  SubtreeRootReader *reader = SubtreeRootReader::Open(path_, 64);
+  ASSERT_TRUE(reader != NULL);
+  EXPECT_EQ(13U, reader->LeafCount());
+  EXPECT_EQ(tree_.PathToRootAtSnapshot(3, 13),
+            reader->PathToRootAtSnapshot(3, 13));
+  delete reader;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,283 @@
+#include "merkletree/tiered_merkle_tree.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/leaf_hash_file.h"
+
+using std::string;
+
+namespace {
+
+// Largest power of two smaller than n; n must be at least 2.
+size_t SplitPoint(size_t n) {
+  size_t k = 1;
+  while (k << 1 < n)
+    k <<= 1;
+  return k;
+}
+
+// log2(n), if n is a power of two; -1 otherwise.
+int PowerOfTwoExponent(size_t n) {
+  if (n == 0 || (n & (n - 1)) != 0)
+    return -1;
+  int exponent = 0;
+  while (n >>= 1)
+    ++exponent;
+  return exponent;
+}
+
+}  // namespace
+
+TieredMerkleTree::TieredMerkleTree(SerialHasher *hasher,
+                                   size_t resident_level, size_t cache_size)
+    : ct::MerkleTreeInterface(),
+      treehasher_(hasher),
+      resident_level_(resident_level),
+      cache_size_(cache_size),
+      leaf_hashes_(NULL),
+      leaf_count_(0),
+      level_count_(0),
+      leaves_begin_(0) {
+  CHECK_GE(resident_level_, 1U);
+  CHECK_LT(resident_level_, 8 * sizeof(size_t));
+  CHECK_GE(cache_size_, 1U);
+}
+
+TieredMerkleTree::TieredMerkleTree(SerialHasher *hasher,
+                                   size_t resident_level, size_t cache_size,
+                                   const LeafHashFile *leaf_hashes)
+    : ct::MerkleTreeInterface(),
+      treehasher_(hasher),
+      resident_level_(resident_level),
+      cache_size_(cache_size),
+      leaf_hashes_(CHECK_NOTNULL(leaf_hashes)),
+      leaf_count_(0),
+      level_count_(0),
+      leaves_begin_(0) {
+  CHECK_GE(resident_level_, 1U);
+  CHECK_LT(resident_level_, 8 * sizeof(size_t));
+  CHECK_GE(cache_size_, 1U);
+  CHECK_EQ(leaf_hashes_->HashSize(), NodeSize());
+}
+
+TieredMerkleTree::~TieredMerkleTree() {}
+
+string TieredMerkleTree::LeafHash(size_t leaf) const {
+  if (leaf == 0 || leaf > LeafCount())
+    return string();
+  string hash;
+  ReadLeaves(leaf - 1, 1, &hash);
+  return hash;
+}
+
+size_t TieredMerkleTree::AddLeaf(const string &data) {
+  return AddLeafHash(treehasher_.HashLeaf(data));
+}
+
+size_t TieredMerkleTree::AddLeafHash(const string &hash) {
+  CHECK_EQ(NodeSize(), hash.size());
+  leaves_.append(hash);
+  ++leaf_count_;
+  if (leaf_count_ % (static_cast<size_t>(1) << resident_level_) == 0)
+    AddSubtreeRoot();
+  // Same as ceil(log2(leaf_count_)) + 1.
+  while (level_count_ == 0 ||
+         (static_cast<size_t>(1) << (level_count_ - 1)) < leaf_count_)
+    ++level_count_;
+  DropLeavesInFile();
+  return leaf_count_;
+}
+
+size_t TieredMerkleTree::AddLeafHashes(
+    std::vector<string>::const_iterator begin,
+    std::vector<string>::const_iterator end) {
+  leaves_.reserve(leaves_.size() + (end - begin) * NodeSize());
+  for (std::vector<string>::const_iterator it = begin; it != end; ++it)
+    AddLeafHash(*it);
+  return leaf_count_;
+}
+
+string TieredMerkleTree::CurrentRoot() {
+  return RootAtSnapshot(LeafCount());
+}
+
+string TieredMerkleTree::RootAtSnapshot(size_t snapshot) {
+  if (snapshot == 0)
+    return treehasher_.HashEmpty();
+  if (snapshot > LeafCount())
+    return string();
+  return SubtreeHash(0, snapshot);
+}
+
+std::vector<string> TieredMerkleTree::PathToCurrentRoot(size_t leaf) {
+  return PathToRootAtSnapshot(leaf, LeafCount());
+}
+
+std::vector<string>
+TieredMerkleTree::PathToRootAtSnapshot(size_t leaf, size_t snapshot) {
+  std::vector<string> path;
+  if (leaf > snapshot || snapshot > LeafCount() || leaf == 0)
+    return path;
+  PathInSubtree(leaf - 1, 0, snapshot, &path);
+  return path;
+}
+
+std::vector<string> TieredMerkleTree::SnapshotConsistency(size_t snapshot1,
+                                                          size_t snapshot2) {
+  std::vector<string> proof;
+  if (snapshot1 == 0 || snapshot1 >= snapshot2 || snapshot2 > LeafCount())
+    return proof;
+  SubtreeConsistency(snapshot1, 0, snapshot2, true, &proof);
+  return proof;
+}
+
+string TieredMerkleTree::SubtreeHash(size_t begin, size_t end) {
+  DCHECK_LT(begin, end);
+  int height = PowerOfTwoExponent(end - begin);
+  // Every left subtree visited by the splits below is complete and aligned,
+  // so there is a stored (or cached) node for it.
+  if (height >= 0 && begin % (end - begin) == 0)
+    return Node(height, begin >> height);
+  size_t split = begin + SplitPoint(end - begin);
+  return treehasher_.HashChildren(SubtreeHash(begin, split),
+                                  SubtreeHash(split, end));
+}
+
+string TieredMerkleTree::Node(size_t level, size_t index) {
+  const size_t node_size = NodeSize();
+  if (level == 0)
+    return LeafHash(index + 1);
+  if (level >= resident_level_)
+    return string(resident_[level - resident_level_], index * node_size,
+                  node_size);
+
+  size_t subtree = index >> (resident_level_ - level);
+  size_t subtree_size = static_cast<size_t>(1) << resident_level_;
+  if ((subtree + 1) * subtree_size > leaf_count_) {
+    // Part of the incomplete right edge; there are fewer than subtree_size
+    // leaves left of it, so just hash them.
+    return HashLeafRange(index << level, level, NULL);
+  }
+  const CachedSubtree &cached = Subtree(subtree);
+  size_t offset = index - (subtree << (resident_level_ - level));
+  return string(cached.levels[level - 1], offset * node_size, node_size);
+}
+
+void TieredMerkleTree::PathInSubtree(size_t leaf, size_t begin, size_t end,
+                                     std::vector<string> *path) {
+  size_t size = end - begin;
+  if (size == 1)
+    return;
+  size_t split = SplitPoint(size);
+  if (leaf < split) {
+    PathInSubtree(leaf, begin, begin + split, path);
+    path->push_back(SubtreeHash(begin + split, end));
+  } else {
+    PathInSubtree(leaf - split, begin + split, end, path);
+    path->push_back(SubtreeHash(begin, begin + split));
+  }
+}
+
+void TieredMerkleTree::SubtreeConsistency(size_t snapshot, size_t begin,
+                                          size_t end, bool complete,
+                                          std::vector<string> *proof) {
+  size_t size = end - begin;
+  if (snapshot == size) {
+    if (!complete)
+      proof->push_back(SubtreeHash(begin, end));
+    return;
+  }
+  size_t split = SplitPoint(size);
+  if (snapshot <= split) {
+    SubtreeConsistency(snapshot, begin, begin + split, complete, proof);
+    proof->push_back(SubtreeHash(begin + split, end));
+  } else {
+    SubtreeConsistency(snapshot - split, begin + split, end, false, proof);
+    proof->push_back(SubtreeHash(begin, begin + split));
+  }
+}
+
+string TieredMerkleTree::HashLeafRange(size_t begin, size_t height,
+                                       std::vector<string> *levels) {
+  string nodes;
+  ReadLeaves(begin, static_cast<size_t>(1) << height, &nodes);
+  const size_t node_size = NodeSize();
+  for (size_t level = 1; level <= height; ++level) {
+    string parents;
+    parents.reserve(nodes.size() / 2);
+    treehasher_.HashChildrenPairs(nodes.data(), nodes.size() / node_size / 2,
+                                  &parents);
+    nodes.swap(parents);
+    if (levels != NULL && level < height)
+      levels->push_back(nodes);
+  }
+  return nodes;
+}
+
+const TieredMerkleTree::CachedSubtree &
+TieredMerkleTree::Subtree(size_t index) {
+  SubtreeCache::iterator it = cache_.find(index);
+  if (it != cache_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second.lru_position);
+    return it->second;
+  }
+
+  if (cache_.size() >= cache_size_) {
+    cache_.erase(lru_.back());
+    lru_.pop_back();
+  }
+  lru_.push_front(index);
+  CachedSubtree &cached = cache_[index];
+  cached.lru_position = lru_.begin();
+  HashLeafRange(index << resident_level_, resident_level_, &cached.levels);
+  return cached;
+}
+
+void TieredMerkleTree::ReadLeaves(size_t begin, size_t count,
+                                  string *out) const {
+  CHECK_LE(begin + count, leaf_count_);
+  if (begin < leaves_begin_) {
+    size_t from_file = std::min(count, leaves_begin_ - begin);
+    leaf_hashes_->ReadLeafHashes(begin, from_file, out);
+    begin += from_file;
+    count -= from_file;
+  }
+  if (count > 0)
+    out->append(leaves_, (begin - leaves_begin_) * NodeSize(),
+                count * NodeSize());
+}
+
+void TieredMerkleTree::AddSubtreeRoot() {
+  const size_t node_size = NodeSize();
+  size_t subtree_size = static_cast<size_t>(1) << resident_level_;
+  string node = HashLeafRange(leaf_count_ - subtree_size, resident_level_,
+                              NULL);
+  // Append the new root and any parents it completes, the same way
+  // CompactMerkleTree carries them up.
+  for (size_t level = 0; ; ++level) {
+    if (level == resident_.size())
+      resident_.push_back(string());
+    resident_[level].append(node);
+    size_t count = resident_[level].size() / node_size;
+    if (count % 2 != 0)
+      break;
+    node = treehasher_.HashChildren(
+        string(resident_[level], (count - 2) * node_size, node_size), node);
+  }
+}
+
+void TieredMerkleTree::DropLeavesInFile() {
+  if (leaf_hashes_ == NULL)
+    return;
+  size_t in_file = std::min(leaf_hashes_->LeafCount(), leaf_count_);
+  // Drop leaves a subtree at a time rather than shifting the buffer on
+  // every append.
+  if (in_file < leaves_begin_ + (static_cast<size_t>(1) << resident_level_))
+    return;
+  leaves_.erase(0, (in_file - leaves_begin_) * NodeSize());
+  leaves_begin_ = in_file;
+}
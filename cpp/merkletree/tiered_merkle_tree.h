@@ -0,0 +1,164 @@
+#ifndef TIERED_MERKLETREE_H
+#define TIERED_MERKLETREE_H
+
+#include <list>
+#include <map>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/merkle_tree_interface.h"
+#include "merkletree/tree_hasher.h"
+
+class LeafHashFile;
+class SerialHasher;
+
+// A Merkle tree with the same snapshot, path and consistency interface as
+// MerkleTree (see merkletree/merkle_tree.h), for trees too large to keep
+// every level in memory.
+//
+// Only the leaf hashes and the complete nodes from |resident_level| up are
+// stored. A node below |resident_level| is recomputed from the leaves of the
+// level-|resident_level| subtree it belongs to, and the levels of the most
+// recently used such subtrees are kept in a small LRU cache. Leaf hashes
+// that are also in a LeafHashFile are read from the file instead of being
+// kept in memory.
+//
+// This class is thread-compatible, but not thread-safe: lookups update the
+// subtree cache.
+class TieredMerkleTree : public ct::MerkleTreeInterface {
+ public:
+  // Keeps the levels of up to |cache_size| subtrees of height
+  // |resident_level| in cache.
+  // Takes ownership of the hasher.
+  TieredMerkleTree(SerialHasher *hasher, size_t resident_level,
+                   size_t cache_size);
+
+  // As above, but reads leaf hashes from |leaf_hashes| as soon as they show
+  // up in it. The file must hold this tree's leaf hashes in order, though it
+  // may run ahead of or behind the tree; the caller is responsible for
+  // appending to it.
+  // Does not take ownership of |leaf_hashes|.
+  TieredMerkleTree(SerialHasher *hasher, size_t resident_level,
+                   size_t cache_size, const LeafHashFile *leaf_hashes);
+
+  virtual ~TieredMerkleTree();
+
+  // Length of a node (i.e., a hash), in bytes.
+  virtual size_t NodeSize() const { return treehasher_.DigestSize(); };
+
+  // Number of leaves in the tree.
+  virtual size_t LeafCount() const { return leaf_count_; }
+
+  // The |leaf|th leaf hash in the tree. Indexing starts from 1.
+  std::string LeafHash(size_t leaf) const;
+
+  // Return the leaf hash, but do not append the data to the tree.
+  virtual std::string LeafHash(const std::string &data) const {
+    return treehasher_.HashLeaf(data);
+  }
+
+  // Number of levels. An empty tree has 0 levels, a tree with 1 leaf has
+  // 1 level, a tree with 2 leaves has 2 levels, and a tree with n leaves has
+  // ceil(log2(n)) + 1 levels.
+  virtual size_t LevelCount() const { return level_count_; }
+
+  // Add a new leaf to the hash tree. Stores the hash of the leaf data in the
+  // tree structure, does not store the data itself.
+  //
+  // Returns the position of the leaf in the tree. Indexing starts at 1,
+  // so position = number of leaves in the tree after this update.
+  virtual size_t AddLeaf(const std::string &data);
+
+  // Add a new leaf to the hash tree. Stores the provided hash in the
+  // tree structure. It is the caller's responsibility to ensure that
+  // the hash is correct.
+  //
+  // Returns the position of the leaf in the tree.
+  virtual size_t AddLeafHash(const std::string &hash);
+
+  // Add a sequence of leaf hashes, in order.
+  // Returns the position of the last leaf added (i.e., the new leaf count).
+  size_t AddLeafHashes(std::vector<std::string>::const_iterator begin,
+                       std::vector<std::string>::const_iterator end);
+
+  // The following behave exactly as their MerkleTree counterparts.
+  virtual std::string CurrentRoot();
+
+  std::string RootAtSnapshot(size_t snapshot);
+
+  std::vector<std::string> PathToCurrentRoot(size_t leaf);
+
+  std::vector<std::string> PathToRootAtSnapshot(size_t leaf, size_t snapshot);
+
+  std::vector<std::string> SnapshotConsistency(size_t snapshot1,
+                                               size_t snapshot2);
+
+ private:
+  struct CachedSubtree;
+  typedef std::list<size_t> LruList;
+  typedef std::map<size_t, CachedSubtree> SubtreeCache;
+
+  // Levels 1 to resident_level_ - 1 of a subtree, each stored as
+  // contiguous fixed-width nodes.
+  struct CachedSubtree {
+    LruList::iterator lru_position;
+    std::vector<std::string> levels;
+  };
+
+  // Root of the subtree with leaves [begin, end), which must be nonempty
+  // and in the tree.
+  std::string SubtreeHash(size_t begin, size_t end);
+
+  // The |index|th complete node at level |level|.
+  std::string Node(size_t level, size_t index);
+
+  // Append the path for the |leaf|th leaf (indexing starts at 0) of the
+  // subtree with leaves [begin, end) to |path|.
+  void PathInSubtree(size_t leaf, size_t begin, size_t end,
+                     std::vector<std::string> *path);
+
+  // Append the consistency proof between the first |snapshot| leaves and
+  // all leaves of the subtree [begin, end) to |proof|. |complete| is true
+  // when the subtree of the first |snapshot| leaves is the whole old tree.
+  void SubtreeConsistency(size_t snapshot, size_t begin, size_t end,
+                          bool complete, std::vector<std::string> *proof);
+
+  // Hash the 2^|height| leaves from |begin| up to their root. If |levels|
+  // is not NULL, also records the levels in between.
+  std::string HashLeafRange(size_t begin, size_t height,
+                            std::vector<std::string> *levels);
+
+  // The cached levels of the |index|th subtree of height resident_level_,
+  // which must be complete.
+  const CachedSubtree &Subtree(size_t index);
+
+  // Append the |count| leaf hashes from the |begin|th (indexing starts at 0)
+  // back to back to |out|.
+  void ReadLeaves(size_t begin, size_t count, std::string *out) const;
+
+  // Add the root of the last (just completed) resident_level_ subtree to
+  // the resident levels.
+  void AddSubtreeRoot();
+
+  // Stop keeping leaves that the leaf hash file has caught up with.
+  void DropLeavesInFile();
+
+  TreeHasher treehasher_;
+  const size_t resident_level_;
+  const size_t cache_size_;
+  // May be NULL.
+  const LeafHashFile *leaf_hashes_;
+  size_t leaf_count_;
+  size_t level_count_;
+  // Leaf hashes leaves_begin_ to leaf_count_ - 1, back to back.
+  size_t leaves_begin_;
+  std::string leaves_;
+  // Complete nodes of levels resident_level_ and up, back to back:
+  // resident_[i] is level resident_level_ + i.
+  std::vector<std::string> resident_;
+  SubtreeCache cache_;
+  // Cached subtree indices, most recently used first.
+  LruList lru_;
+};
+#endif
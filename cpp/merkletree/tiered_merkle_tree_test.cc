@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/leaf_hash_file.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tiered_merkle_tree.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace {
+
+using std::string;
+
+const size_t kTreeSize = 70;
+
+// Check every snapshot, path and consistency proof of |tree| against the
+// MerkleTree |reference|, which must have the same leaves.
+void ExpectSameTree(MerkleTree *reference, TieredMerkleTree *tree) {
+  ASSERT_EQ(reference->LeafCount(), tree->LeafCount());
+  EXPECT_EQ(reference->LevelCount(), tree->LevelCount());
+  EXPECT_EQ(reference->CurrentRoot(), tree->CurrentRoot());
+  for (size_t snapshot = 0; snapshot <= tree->LeafCount() + 1; ++snapshot) {
+    EXPECT_EQ(reference->RootAtSnapshot(snapshot),
+              tree->RootAtSnapshot(snapshot));
+    for (size_t leaf = 0; leaf <= snapshot + 1; ++leaf)
+      EXPECT_EQ(reference->PathToRootAtSnapshot(leaf, snapshot),
+                tree->PathToRootAtSnapshot(leaf, snapshot));
+    for (size_t old_size = 0; old_size <= snapshot; ++old_size)
+      EXPECT_EQ(reference->SnapshotConsistency(old_size, snapshot),
+                tree->SnapshotConsistency(old_size, snapshot));
+  }
+}
+
+class TieredMerkleTreeTest : public ::testing::Test {
+ protected:
+  TieredMerkleTreeTest() : reference_(new Sha256Hasher()) {
+    for (size_t i = 0; i < kTreeSize; ++i) {
+      string leaf(1, static_cast<char>(i));
+      reference_.AddLeaf(leaf);
+      hashes_.push_back(reference_.LeafHash(i + 1));
+    }
+  }
+
+  MerkleTree reference_;
+  std::vector<string> hashes_;
+};
+
+TEST_F(TieredMerkleTreeTest, EmptyTree) {
+  TieredMerkleTree tree(new Sha256Hasher(), 3, 2);
+  MerkleTree reference(new Sha256Hasher());
+  ExpectSameTree(&reference, &tree);
+}
+
+TEST_F(TieredMerkleTreeTest, MatchesMerkleTree) {
+  const size_t resident_levels[] = { 1, 2, 3, 5, 8 };
+  const size_t cache_sizes[] = { 1, 3 };
+  for (size_t i = 0; i < sizeof(resident_levels) / sizeof(size_t); ++i) {
+    for (size_t j = 0; j < sizeof(cache_sizes) / sizeof(size_t); ++j) {
+      TieredMerkleTree tree(new Sha256Hasher(), resident_levels[i],
+                            cache_sizes[j]);
+      MerkleTree reference(new Sha256Hasher());
+      for (size_t k = 0; k < kTreeSize; ++k) {
+        string leaf(1, static_cast<char>(k));
+        EXPECT_EQ(k + 1, tree.AddLeaf(leaf));
+        reference.AddLeaf(leaf);
+        EXPECT_EQ(reference.CurrentRoot(), tree.CurrentRoot());
+      }
+      ExpectSameTree(&reference, &tree);
+    }
+  }
+}
+
+TEST_F(TieredMerkleTreeTest, AddLeafHashes) {
+  TieredMerkleTree tree(new Sha256Hasher(), 2, 4);
+  EXPECT_EQ(5U, tree.AddLeafHashes(hashes_.begin(), hashes_.begin() + 5));
+  EXPECT_EQ(kTreeSize, tree.AddLeafHashes(hashes_.begin() + 5,
+                                          hashes_.end()));
+  for (size_t i = 0; i < kTreeSize; ++i)
+    EXPECT_EQ(hashes_[i], tree.LeafHash(i + 1));
+  ExpectSameTree(&reference_, &tree);
+}
+
+TEST_F(TieredMerkleTreeTest, ReadLeavesFromFile) {
+  TmpStorage tmp;
+  LeafHashFile file(tmp.TmpStorageDir() + "/leaves", 32);
+  TieredMerkleTree tree(new Sha256Hasher(), 3, 2, &file);
+
+  // Let the file lag behind the tree, as it would behind a LogLookup.
+  const size_t batch = 9;
+  for (size_t i = 0; i < kTreeSize; i += batch) {
+    size_t end = std::min(i + batch, kTreeSize);
+    tree.AddLeafHashes(hashes_.begin() + i, hashes_.begin() + end);
+    if (i > 0)
+      file.Append(hashes_.begin() + i - batch, hashes_.begin() + i);
+  }
+  ExpectSameTree(&reference_, &tree);
+
+  // A file that runs ahead of the tree is fine too.
+  file.Append(hashes_.begin() + file.LeafCount(), hashes_.end());
+  TieredMerkleTree restored(new Sha256Hasher(), 3, 2, &file);
+  restored.AddLeafHashes(hashes_.begin(), hashes_.end());
+  ExpectSameTree(&reference_, &restored);
+}
+
+}  // namespace
+
+int main(int argc, char**argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
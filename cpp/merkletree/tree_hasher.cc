@@ -1,13 +1,138 @@
 #include "merkletree/tree_hasher.h"
 
+#include <glog/logging.h>
+#include <string.h>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
 #include "merkletree/serial_hasher.h"
+#include "util/thread_pool.h"
 
 using std::string;
 
 const string TreeHasher::kLeafPrefix(1, '\x00');
 const string TreeHasher::kNodePrefix(1, '\x01');
+const size_t TreeHasher::kBatchSize = 64;
+const size_t TreeHasher::kMinPairsPerThread = 4096;
+const size_t TreeHasher::kMinLeavesPerThread = 1024;
+
+namespace {
+
+const unsigned char kLeafPrefixByte = 0x00;
+const unsigned char kNodePrefixByte = 0x01;
+// Number of pairs TreeHasherT hands to the batch kernel at a time.
+const size_t kPairBatchSize = 64;
+
+struct PairHashingJob {
+  TreeHasher *hasher;
+  const char *children;
+  size_t digest_size;
+  // The parents of each chunk.
+  std::vector<string> parents;
+};
+
+void HashPairsRange(void *arg, size_t chunk, size_t begin, size_t end) {
+  PairHashingJob *job = static_cast<PairHashingJob*>(arg);
+  job->hasher->HashChildrenPairs(job->children + begin * 2 * job->digest_size,
+                                 end - begin, &job->parents[chunk]);
+}
+
+struct LeafHashingJob {
+  const TreeHasher *hasher;
+  const std::vector<string> *data;
+  std::vector<string> *digests;
+};
+
+void HashLeavesRange(void *arg, size_t chunk, size_t begin, size_t end) {
+  const LeafHashingJob *job = static_cast<const LeafHashingJob*>(arg);
+  job->hasher->HashLeaves(*job->data, begin, end - begin, job->digests);
+}
+
+}  // namespace
+
+template <class Hasher> string TreeHasherT<Hasher>::HashEmpty() const {
+  unsigned char digest[Hasher::kDigestLength];
+  Hasher::OneShotDigest(NULL, 0, digest);
+  return string(reinterpret_cast<char*>(digest), Hasher::kDigestLength);
+}
 
-TreeHasher::TreeHasher(SerialHasher *hasher) : hasher_(hasher) {}
+template <class Hasher>
+string TreeHasherT<Hasher>::HashLeaf(const string &data) const {
+  unsigned char digest[Hasher::kDigestLength];
+  Hasher::PrefixedDigest(kLeafPrefixByte,
+                         reinterpret_cast<const unsigned char*>(data.data()),
+                         data.size(), NULL, 0, digest);
+  return string(reinterpret_cast<char*>(digest), Hasher::kDigestLength);
+}
+
+template <class Hasher>
+string TreeHasherT<Hasher>::HashChildren(const string &left_child,
+                                         const string &right_child) const {
+  unsigned char digest[Hasher::kDigestLength];
+  Hasher::PrefixedDigest(
+      kNodePrefixByte,
+      reinterpret_cast<const unsigned char*>(left_child.data()),
+      left_child.size(),
+      reinterpret_cast<const unsigned char*>(right_child.data()),
+      right_child.size(), digest);
+  return string(reinterpret_cast<char*>(digest), Hasher::kDigestLength);
+}
+
+template <class Hasher>
+void TreeHasherT<Hasher>::HashLeaf(const string &data, Digest *digest) const {
+  Hasher::PrefixedDigest(kLeafPrefixByte,
+                         reinterpret_cast<const unsigned char*>(data.data()),
+                         data.size(), NULL, 0, digest->mutable_data());
+  digest->set_size(Hasher::kDigestLength);
+}
+
+template <class Hasher>
+void TreeHasherT<Hasher>::HashChildren(const Digest &left_child,
+                                       const Digest &right_child,
+                                       Digest *parent) const {
+  // PrefixedDigest() reads its inputs before writing the digest, as
+  // TreeHasher::HashChildren() does, so |parent| may alias a child.
+  Hasher::PrefixedDigest(kNodePrefixByte, left_child.data(),
+                         left_child.size(), right_child.data(),
+                         right_child.size(), parent->mutable_data());
+  parent->set_size(Hasher::kDigestLength);
+}
+
+template <class Hasher>
+void TreeHasherT<Hasher>::HashChildrenPairs(const char *children,
+                                            size_t pair_count,
+                                            string *parents) const {
+  const size_t kMessageSize = 1 + 2 * Hasher::kDigestLength;
+  unsigned char messages[kPairBatchSize][kMessageSize];
+  const unsigned char *message_data[kPairBatchSize];
+  size_t message_length[kPairBatchSize];
+  for (size_t i = 0; i < kPairBatchSize; ++i) {
+    messages[i][0] = kNodePrefixByte;
+    message_data[i] = messages[i];
+    message_length[i] = kMessageSize;
+  }
+  unsigned char output[kPairBatchSize * Hasher::kDigestLength];
+
+  parents->reserve(parents->size() + pair_count * Hasher::kDigestLength);
+  for (size_t first = 0; first < pair_count; first += kPairBatchSize) {
+    size_t count = pair_count - first < kPairBatchSize ?
+        pair_count - first : kPairBatchSize;
+    for (size_t i = 0; i < count; ++i)
+      memcpy(messages[i] + 1,
+             children + (first + i) * 2 * Hasher::kDigestLength,
+             2 * Hasher::kDigestLength);
+    Hasher::BatchDigest(message_data, message_length, count, output);
+    parents->append(reinterpret_cast<const char*>(output),
+                    count * Hasher::kDigestLength);
+  }
+}
+
+template class TreeHasherT<Sha256Hasher>;
+
+TreeHasher::TreeHasher(SerialHasher *hasher)
+    : hasher_(hasher),
+      is_sha256_(typeid(*hasher) == typeid(Sha256Hasher)) {}
 
 TreeHasher::~TreeHasher() {
   delete hasher_;
@@ -24,6 +149,8 @@ string TreeHasher::HashEmpty() {
 }
 
 string TreeHasher::HashLeaf(const string &data) const {
+  if (is_sha256_)
+    return sha256_.HashLeaf(data);
   hasher_->Reset();
   hasher_->Update(kLeafPrefix);
   hasher_->Update(data);
@@ -32,9 +159,165 @@ string TreeHasher::HashLeaf(const string &data) const {
 
 string TreeHasher::HashChildren(const string &left_child,
                                  const string &right_child) {
+  if (is_sha256_)
+    return sha256_.HashChildren(left_child, right_child);
   hasher_->Reset();
   hasher_->Update(kNodePrefix);
   hasher_->Update(left_child);
   hasher_->Update(right_child);
   return hasher_->Final();
 }
+
+void TreeHasher::HashLeaf(const string &data, Digest *digest) const {
+  if (is_sha256_) {
+    sha256_.HashLeaf(data, digest);
+    return;
+  }
+  hasher_->Reset();
+  hasher_->Update(kLeafPrefix);
+  hasher_->Update(data);
+  hasher_->Final(digest);
+}
+
+void TreeHasher::HashChildren(const Digest &left_child,
+                              const Digest &right_child, Digest *parent) {
+  if (is_sha256_) {
+    sha256_.HashChildren(left_child, right_child, parent);
+    return;
+  }
+  hasher_->Reset();
+  hasher_->Update(kNodePrefix);
+  hasher_->Update(left_child.data(), left_child.size());
+  hasher_->Update(right_child.data(), right_child.size());
+  hasher_->Final(parent);
+}
+
+void TreeHasher::HashLeaves(const std::vector<string> &data,
+                            std::vector<string> *digests) const {
+  digests->resize(data.size());
+  HashLeaves(data, 0, data.size(), digests);
+}
+
+void TreeHasher::HashLeaves(const std::vector<string> &data,
+                            std::vector<string> *digests,
+                            size_t num_threads) const {
+  if (num_threads > data.size() / kMinLeavesPerThread)
+    num_threads = data.size() / kMinLeavesPerThread;
+  if (num_threads <= 1) {
+    HashLeaves(data, digests);
+    return;
+  }
+
+  digests->resize(data.size());
+  LeafHashingJob job = { this, &data, digests };
+  util::ThreadPool::Default()->ParallelFor(data.size(), num_threads,
+                                           HashLeavesRange, &job);
+}
+
+void TreeHasher::HashLeaves(const std::vector<string> &data, size_t first,
+                            size_t count,
+                            std::vector<string> *digests) const {
+  CHECK_LE(first + count, data.size());
+  CHECK_EQ(data.size(), digests->size());
+  const size_t digest_size = DigestSize();
+  // The output buffer below holds digests of up to Digest::kMaxSize bytes.
+  if (digest_size > Digest::kMaxSize) {
+    for (size_t i = first; i < first + count; ++i)
+      (*digests)[i] = HashLeaf(data[i]);
+    return;
+  }
+
+  string messages;
+  std::vector<const unsigned char*> message_data;
+  std::vector<size_t> message_length;
+  unsigned char output[kBatchSize * Digest::kMaxSize];
+  const size_t end = first + count;
+  for (size_t batch = first; batch < end; batch += kBatchSize) {
+    size_t batch_count = end - batch < kBatchSize ? end - batch : kBatchSize;
+    // Lay out the prefixed messages back to back, then point into them once
+    // the buffer has stopped growing.
+    messages.clear();
+    message_length.clear();
+    for (size_t i = 0; i < batch_count; ++i) {
+      messages.append(kLeafPrefix);
+      messages.append(data[batch + i]);
+      message_length.push_back(kLeafPrefix.size() + data[batch + i].size());
+    }
+    message_data.clear();
+    const unsigned char *next =
+        reinterpret_cast<const unsigned char*>(messages.data());
+    for (size_t i = 0; i < batch_count; ++i) {
+      message_data.push_back(next);
+      next += message_length[i];
+    }
+
+    hasher_->DigestBatch(&message_data[0], &message_length[0], batch_count,
+                         output);
+    for (size_t i = 0; i < batch_count; ++i)
+      (*digests)[batch + i].assign(
+          reinterpret_cast<const char*>(output + i * digest_size),
+          digest_size);
+  }
+}
+
+void TreeHasher::HashChildrenPairs(const char *children, size_t pair_count,
+                                   string *parents) {
+  if (is_sha256_) {
+    sha256_.HashChildrenPairs(children, pair_count, parents);
+    return;
+  }
+  const size_t digest_size = DigestSize();
+  // As above, fall back to serial hashing for unusually large digests.
+  if (digest_size > Digest::kMaxSize) {
+    for (size_t i = 0; i < pair_count; ++i, children += 2 * digest_size)
+      parents->append(HashChildren(string(children, digest_size),
+                                   string(children + digest_size,
+                                          digest_size)));
+    return;
+  }
+
+  const size_t message_size = kNodePrefix.size() + 2 * digest_size;
+  std::vector<unsigned char> messages(kBatchSize * message_size);
+  std::vector<const unsigned char*> message_data(kBatchSize);
+  std::vector<size_t> message_length(kBatchSize, message_size);
+  for (size_t i = 0; i < kBatchSize; ++i)
+    message_data[i] = &messages[i * message_size];
+  unsigned char output[kBatchSize * Digest::kMaxSize];
+
+  parents->reserve(parents->size() + pair_count * digest_size);
+  for (size_t first = 0; first < pair_count; first += kBatchSize) {
+    size_t count = pair_count - first < kBatchSize ?
+        pair_count - first : kBatchSize;
+    for (size_t i = 0; i < count; ++i) {
+      unsigned char *message = &messages[i * message_size];
+      memcpy(message, kNodePrefix.data(), kNodePrefix.size());
+      memcpy(message + kNodePrefix.size(),
+             children + (first + i) * 2 * digest_size, 2 * digest_size);
+    }
+    hasher_->DigestBatch(&message_data[0], &message_length[0], count, output);
+    parents->append(reinterpret_cast<const char*>(output), count * digest_size);
+  }
+}
+
+void TreeHasher::HashChildrenPairs(const char *children, size_t pair_count,
+                                   string *parents, size_t num_threads) {
+  if (num_threads > pair_count / kMinPairsPerThread)
+    num_threads = pair_count / kMinPairsPerThread;
+  if (num_threads <= 1) {
+    HashChildrenPairs(children, pair_count, parents);
+    return;
+  }
+
+  const size_t digest_size = DigestSize();
+  PairHashingJob job;
+  job.hasher = this;
+  job.children = children;
+  job.digest_size = digest_size;
+  job.parents.resize(num_threads);
+  util::ThreadPool::Default()->ParallelFor(pair_count, num_threads,
+                                           HashPairsRange, &job);
+
+  parents->reserve(parents->size() + pair_count * digest_size);
+  for (size_t i = 0; i < num_threads; ++i)
+    parents->append(job.parents[i]);
+}
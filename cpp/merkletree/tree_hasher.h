@@ -2,9 +2,46 @@
 #define TREEHASHER_H
 
 #include <stddef.h>
+#include <string>
+#include <vector>
 
+#include "merkletree/digest.h"
 #include "merkletree/serial_hasher.h"
 
+// A TreeHasher for a hash function fixed at compile time, so that hashing a
+// node involves no virtual calls and no hashing context. |Hasher| provides
+// the static interface of Sha256Hasher: kDigestLength, OneShotDigest(),
+// PrefixedDigest() and BatchDigest(). The methods behave exactly as their
+// TreeHasher counterparts below, and are all thread-safe.
+//
+// Instantiated for Sha256Hasher in tree_hasher.cc.
+template <class Hasher> class TreeHasherT {
+ public:
+  size_t DigestSize() const { return Hasher::kDigestLength; }
+
+  std::string HashEmpty() const;
+
+  std::string HashLeaf(const std::string &data) const;
+
+  std::string HashChildren(const std::string &left_child,
+                           const std::string &right_child) const;
+
+  void HashLeaf(const std::string &data, Digest *digest) const;
+
+  void HashChildren(const Digest &left_child, const Digest &right_child,
+                    Digest *parent) const;
+
+  void HashChildrenPairs(const char *children, size_t pair_count,
+                         std::string *parents) const;
+};
+
+// HashLeaves() and HashChildrenPairs() only use the SerialHasher's batch
+// interface, which does not touch the shared hashing context, so they may
+// run concurrently on the same TreeHasher.
+//
+// When the SerialHasher is exactly a Sha256Hasher, node and leaf hashing
+// goes through TreeHasherT<Sha256Hasher> instead of the virtual
+// Reset()/Update()/Final() interface.
 class TreeHasher {
  public:
   // Takes ownership of the SerialHasher.
@@ -23,10 +60,55 @@ class TreeHasher {
   std::string HashChildren(const std::string &left_child,
                            const std::string &right_child);
 
+  // Allocation-free versions of the above, for digests of up to
+  // Digest::kMaxSize bytes. |parent| may be one of the children.
+  void HashLeaf(const std::string &data, Digest *digest) const;
+
+  void HashChildren(const Digest &left_child, const Digest &right_child,
+                    Digest *parent);
+
+  // Batch version of HashLeaf(): |digests| is resized to hold the leaf hash
+  // of each element of |data|, in order. Independent inputs are hashed
+  // several at a time by the SerialHasher's batch kernel.
+  void HashLeaves(const std::vector<std::string> &data,
+                  std::vector<std::string> *digests) const;
+
+  // As above, but splits large batches into up to |num_threads| contiguous
+  // ranges that are hashed at once on util::ThreadPool::Default().
+  void HashLeaves(const std::vector<std::string> &data,
+                  std::vector<std::string> *digests, size_t num_threads) const;
+
+  // HashLeaves() of just the |count| elements of |data| from |first| into
+  // the same elements of |digests|, which must have as many as |data|.
+  void HashLeaves(const std::vector<std::string> &data, size_t first,
+                  size_t count, std::vector<std::string> *digests) const;
+
+  // Batch version of HashChildren() for digest-sized nodes: |children|
+  // points to 2 * |pair_count| digests stored back to back, and the parent
+  // of each consecutive (left, right) pair is appended to |parents|.
+  void HashChildrenPairs(const char *children, size_t pair_count,
+                         std::string *parents);
+
+  // As above, but splits large batches into up to |num_threads| contiguous
+  // ranges that are hashed at once on util::ThreadPool::Default(). The
+  // output is identical to the single-threaded version.
+  void HashChildrenPairs(const char *children, size_t pair_count,
+                         std::string *parents, size_t num_threads);
+
  private:
   SerialHasher *hasher_;
+  // Whether |hasher_| is a plain Sha256Hasher, which |sha256_| can stand in
+  // for.
+  const bool is_sha256_;
+  TreeHasherT<Sha256Hasher> sha256_;
   static const std::string kLeafPrefix;
   static const std::string kNodePrefix;
+  // Number of messages handed to the batch kernel at a time.
+  static const size_t kBatchSize;
+  // Below this many pairs or leaves per range, splitting the work isn't
+  // worth it.
+  static const size_t kMinPairsPerThread;
+  static const size_t kMinLeavesPerThread;
   // The dummy hash of an empty tree.
   std::string emptyhash_;
 };
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include <stddef.h>
 #include <string>
+#include <vector>
 
 #include "merkletree/serial_hasher.h"
 #include "merkletree/tree_hasher.h"
@@ -61,12 +62,20 @@ TestVector test_sha256 = { sha256_empty_hash, sha256_leaves, sha256_nodes };
 // The reverse
 #define H(t) util::HexString(t)
 
+// TreeHasher only takes the TreeHasherT<Sha256Hasher> shortcut for an exact
+// Sha256Hasher, so this one goes through the virtual interface.
+class Sha256SubclassHasher : public Sha256Hasher {};
+
 template <class T> TestVector *TestVectors();
 
 template <> TestVector *TestVectors<Sha256Hasher>() {
   return &test_sha256;
 }
 
+template <> TestVector *TestVectors<Sha256SubclassHasher>() {
+  return &test_sha256;
+}
+
 template <class T>
 class TreeHasherTest : public ::testing::Test {
  protected:
@@ -77,7 +86,7 @@ class TreeHasherTest : public ::testing::Test {
         test_vectors_(TestVectors<T>()) {}
 };
 
-typedef ::testing::Types<Sha256Hasher> Hashers;
+typedef ::testing::Types<Sha256Hasher, Sha256SubclassHasher> Hashers;
 
 TYPED_TEST_CASE(TreeHasherTest, Hashers);
 
@@ -151,6 +160,114 @@ TYPED_TEST(TreeHasherTest, TestVectors) {
   }
 }
 
+TYPED_TEST(TreeHasherTest, HashLeaves) {
+  std::vector<string> data;
+  for (size_t i = 0; i < 150; ++i)
+    data.push_back(string(i, static_cast<char>(i)));
+
+  std::vector<string> digests;
+  this->tree_hasher_.HashLeaves(data, &digests);
+  ASSERT_EQ(data.size(), digests.size());
+  for (size_t i = 0; i < data.size(); ++i)
+    EXPECT_EQ(H(this->tree_hasher_.HashLeaf(data[i])), H(digests[i]));
+
+  this->tree_hasher_.HashLeaves(std::vector<string>(), &digests);
+  EXPECT_TRUE(digests.empty());
+}
+
+TYPED_TEST(TreeHasherTest, HashLeavesThreaded) {
+  // Enough for several threads, with a short last range.
+  std::vector<string> data;
+  for (size_t i = 0; i < 5000; ++i)
+    data.push_back(string(i % 300, static_cast<char>(i)));
+
+  std::vector<string> expected, digests;
+  this->tree_hasher_.HashLeaves(data, &expected);
+  this->tree_hasher_.HashLeaves(data, &digests, 3);
+  ASSERT_EQ(expected.size(), digests.size());
+  for (size_t i = 0; i < data.size(); ++i)
+    EXPECT_EQ(H(expected[i]), H(digests[i]));
+
+  this->tree_hasher_.HashLeaves(std::vector<string>(), &digests, 3);
+  EXPECT_TRUE(digests.empty());
+}
+
+TYPED_TEST(TreeHasherTest, HashChildrenPairs) {
+  std::vector<string> nodes;
+  string children;
+  for (size_t i = 0; i < 150; ++i) {
+    nodes.push_back(this->tree_hasher_.HashLeaf(string(1, i)));
+    children.append(nodes.back());
+  }
+
+  // Existing contents of the output are preserved.
+  string parents("prefix");
+  this->tree_hasher_.HashChildrenPairs(children.data(), nodes.size() / 2,
+                                       &parents);
+  const size_t digestsize = this->tree_hasher_.DigestSize();
+  ASSERT_EQ(6 + nodes.size() / 2 * digestsize, parents.size());
+  EXPECT_EQ("prefix", parents.substr(0, 6));
+  for (size_t i = 0; i < nodes.size() / 2; ++i) {
+    EXPECT_EQ(H(this->tree_hasher_.HashChildren(nodes[2 * i],
+                                                nodes[2 * i + 1])),
+              H(parents.substr(6 + i * digestsize, digestsize)));
+  }
+}
+
+TYPED_TEST(TreeHasherTest, DigestInterface) {
+  string leaf1 = this->tree_hasher_.HashLeaf("foo");
+  string leaf2 = this->tree_hasher_.HashLeaf("bar");
+
+  Digest digest1, digest2;
+  this->tree_hasher_.HashLeaf("foo", &digest1);
+  this->tree_hasher_.HashLeaf("bar", &digest2);
+  EXPECT_EQ(H(leaf1), H(digest1.ToString()));
+  EXPECT_EQ(H(leaf2), H(digest2.ToString()));
+
+  // The output may alias an input.
+  this->tree_hasher_.HashChildren(digest1, digest2, &digest2);
+  EXPECT_EQ(H(this->tree_hasher_.HashChildren(leaf1, leaf2)),
+            H(digest2.ToString()));
+}
+
+TEST(TreeHasherTTest, MatchesTreeHasher) {
+  TreeHasherT<Sha256Hasher> static_hasher;
+  TreeHasher tree_hasher(new Sha256SubclassHasher());
+  EXPECT_EQ(tree_hasher.DigestSize(), static_hasher.DigestSize());
+  EXPECT_EQ(H(tree_hasher.HashEmpty()), H(static_hasher.HashEmpty()));
+
+  // Leaves both short enough to be gathered into one buffer, and longer.
+  std::vector<string> nodes;
+  string children;
+  for (size_t i = 0; i < 300; i += 2) {
+    string data(i, static_cast<char>(i));
+    EXPECT_EQ(H(tree_hasher.HashLeaf(data)), H(static_hasher.HashLeaf(data)));
+    Digest digest;
+    static_hasher.HashLeaf(data, &digest);
+    EXPECT_EQ(H(tree_hasher.HashLeaf(data)), H(digest.ToString()));
+    nodes.push_back(digest.ToString());
+    children.append(nodes.back());
+  }
+
+  for (size_t i = 0; i + 1 < nodes.size(); i += 2) {
+    string parent = tree_hasher.HashChildren(nodes[i], nodes[i + 1]);
+    EXPECT_EQ(H(parent), H(static_hasher.HashChildren(nodes[i], nodes[i + 1])));
+    Digest left(nodes[i]);
+    Digest right(nodes[i + 1]);
+    static_hasher.HashChildren(left, right, &left);
+    EXPECT_EQ(H(parent), H(left.ToString()));
+  }
+  // Children of arbitrary length are fine through the string interface.
+  EXPECT_EQ(H(tree_hasher.HashChildren(children, "x")),
+            H(static_hasher.HashChildren(children, "x")));
+
+  string expected, parents;
+  tree_hasher.HashChildrenPairs(children.data(), nodes.size() / 2, &expected);
+  static_hasher.HashChildrenPairs(children.data(), nodes.size() / 2,
+                                  &parents);
+  EXPECT_EQ(H(expected), H(parents));
+}
+
 #undef S
 #undef H
 
@@ -1,5 +1,7 @@
 #include "monitor/database.h"
 
+#include <ctype.h>
+
 #include "merkletree/tree_hasher.h"
 #include "proto/serializer.h"
 
@@ -7,21 +9,75 @@ namespace monitor {
 
 Database::WriteResult Database::CreateEntry(
     const ct::LoggedCertificate &logged) {
+  PreparedEntry entry;
+  WriteResult result = PrepareEntry(logged, &entry);
+  if (result != this->WRITE_OK)
+    return result;
+
+  return WriteEntry(entry);
+}
 
-  std::string leaf;
-  if(!logged.SerializeForLeaf(&leaf))
-    return this->SERIALIZE_FAILED;
+// static
+Database::WriteResult Database::PrepareEntry(
+    const ct::LoggedCertificate &logged, PreparedEntry *entry) {
+
+  if(!logged.SerializeForLeaf(&entry->leaf))
+    return SERIALIZE_FAILED;
 
   TreeHasher hasher(new Sha256Hasher);
-  std::string leaf_hash = hasher.HashLeaf(leaf);
+  entry->leaf_hash = hasher.HashLeaf(entry->leaf);
+
+  entry->cert = Serializer::LeafCertificate(logged.entry());
+
+  if(!logged.SerializeExtraData(&entry->cert_chain))
+    return SERIALIZE_FAILED;
 
-  std::string cert = Serializer::LeafCertificate(logged.entry());
+  return WRITE_OK;
+}
+
+Database::WriteResult Database::WriteEntry(const PreparedEntry &entry) {
+  return CreateEntry_(entry.leaf, entry.leaf_hash, entry.cert,
+                      entry.cert_chain, entry.domains);
+}
 
-  std::string cert_chain;
-  if(!logged.SerializeExtraData(&cert_chain))
-    return this->SERIALIZE_FAILED;
+// static
+std::string Database::ReverseDomain(const std::string &domain) {
+  size_t end = domain.size();
+  if (end > 0 && domain[end - 1] == '.')
+    --end;
+  std::string reversed;
+  reversed.reserve(end);
+  while (end > 0) {
+    const size_t dot = domain.rfind('.', end - 1);
+    const size_t begin = dot == std::string::npos ? 0 : dot + 1;
+    if (!reversed.empty())
+      reversed.push_back('.');
+    for (size_t i = begin; i < end; ++i)
+      reversed.push_back(tolower(static_cast<unsigned char>(domain[i])));
+    end = dot == std::string::npos ? 0 : dot;
+  }
+  return reversed;
+}
+
+Database::WriteResult Database::WriteEntries(
+    const std::vector<PreparedEntry> &entries) {
+  for (size_t i = 0; i < entries.size(); ++i) {
+    WriteResult result = WriteEntry(entries[i]);
+    if (result != this->WRITE_OK)
+      return result;
+  }
+  return this->WRITE_OK;
+}
 
-  return CreateEntry_(leaf, leaf_hash, cert, cert_chain);
+Database::WriteResult Database::CreateEntries(
+    const std::vector<ct::LoggedCertificate> &logged) {
+  std::vector<PreparedEntry> entries(logged.size());
+  for (size_t i = 0; i < logged.size(); ++i) {
+    WriteResult result = PrepareEntry(logged[i], &entries[i]);
+    if (result != this->WRITE_OK)
+      return result;
+  }
+  return WriteEntries(entries);
 }
 
 Database::WriteResult Database::WriteSTH(const ct::SignedTreeHead &sth) {
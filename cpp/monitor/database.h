@@ -3,6 +3,8 @@
 
 #include <glog/logging.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "log/logged_certificate.h"
 
@@ -32,6 +34,15 @@ class Database {
     UNDEFINED, // Let this be last.
   };
 
+  // Receives the leaf hashes of a range scan, in order.
+  class HashCallback {
+   public:
+    virtual ~HashCallback() {}
+
+    // Return false to stop the scan early.
+    virtual bool Hash(const std::string &leaf_hash) = 0;
+  };
+
   virtual ~Database() {}
 
   virtual void BeginTransaction() {
@@ -71,29 +82,100 @@ class Database {
   // response from the log server.
   WriteResult CreateEntry(const ct::LoggedCertificate &logged);
 
+  // An entry serialized and hashed for WriteEntry().
+  struct PreparedEntry {
+    std::string leaf;
+    std::string leaf_hash;
+    std::string cert;
+    std::string cert_chain;
+    // The domain names of the certificate, as ReverseDomain() turns them,
+    // to index the entry by; left empty unless the caller fills it in.
+    std::vector<std::string> domains;
+  };
+
+  // |domain| in lower case, its labels in reverse order, and without a
+  // trailing dot, so that the names under a domain share its prefix:
+  // "*.Example.com." becomes "com.example.*".
+  static std::string ReverseDomain(const std::string &domain);
+
+  // CreateEntry() in two steps, so that several threads can prepare the
+  // entries that one writes. PrepareEntry() is thread-safe.
+  static WriteResult PrepareEntry(const ct::LoggedCertificate &logged,
+                                  PreparedEntry *entry);
+  WriteResult WriteEntry(const PreparedEntry &entry);
+
+  // Write |entries| in order, in a transaction of their own unless one is
+  // open already. Stops at the first that fails.
+  virtual WriteResult WriteEntries(const std::vector<PreparedEntry> &entries);
+
+  // CreateEntry() for each of |logged|, written as by WriteEntries().
+  WriteResult CreateEntries(const std::vector<ct::LoggedCertificate> &logged);
+
   virtual WriteResult WriteSTH(const ct::SignedTreeHead &sth);
 
   // Lookup latest *written* STH (i.e. not necessarily latest timestamp).
   virtual LookupResult LookupLatestWrittenSTH(
       ct::SignedTreeHead *result) const = 0;
 
+  // Number of entries written, i.e. the highest sequence number.
+  virtual uint64_t EntryCount() const = 0;
+
   virtual LookupResult LookupHashByIndex(uint64_t sequence_number,
                                          std::string *result) const = 0;
 
+  // Append the leaf hashes of entries |start| to |end| - 1 to |result|, in
+  // order. Returns NOT_FOUND, leaving |result| alone, if any is missing.
+  virtual LookupResult LookupHashRange(uint64_t start, uint64_t end,
+                                       std::vector<std::string> *result)
+      const = 0;
+
+  // Pass the leaf hashes of entries |start| to |end| - 1 to |callback| in
+  // order, from a single scan, without holding them all in memory. If an
+  // entry is missing, return NOT_FOUND after passing the ones before it.
+  // Returns LOOKUP_OK if the callback stops the scan.
+  virtual LookupResult ScanHashRange(uint64_t start, uint64_t end,
+                                     HashCallback *callback) const = 0;
+
+  // Set |sequence_numbers| to those of the entries indexed by |domain|,
+  // or by a wildcard that covers it, in order and without duplicates. With
+  // |include_subdomains|, any name under |domain| counts too. Only entries
+  // written with their PreparedEntry::domains are indexed.
+  virtual LookupResult LookupByDomain(const std::string &domain,
+                                      bool include_subdomains,
+                                      std::vector<uint64_t> *sequence_numbers)
+      const = 0;
+
   virtual WriteResult SetVerificationLevel(const ct::SignedTreeHead &sth,
                                            VerificationLevel verify_level);
 
   virtual LookupResult LookupSTHByTimestamp(uint64_t timestamp,
       ct::SignedTreeHead *result) const = 0;
 
+  // Set |result| to the STHs with timestamps strictly between |after| and
+  // |before|, oldest first.
+  virtual LookupResult LookupSTHsBetween(
+      uint64_t after, uint64_t before,
+      std::vector<ct::SignedTreeHead> *result) const = 0;
+
   virtual LookupResult LookupVerificationLevel(const ct::SignedTreeHead &sth,
       VerificationLevel *result) const = 0;
 
+  // Remember |sth| as the latest confirmed tree head, with |checkpoint|,
+  // the CompactMerkleTree::Checkpoint() of its tree, replacing the last.
+  virtual WriteResult WriteCheckpoint(const ct::SignedTreeHead &sth,
+                                      const std::string &checkpoint) = 0;
+
+  // Look up the tree head and checkpoint that WriteCheckpoint() wrote last.
+  virtual LookupResult LookupCheckpoint(ct::SignedTreeHead *sth,
+                                        std::string *checkpoint) const = 0;
+
  private:
   virtual WriteResult CreateEntry_(const std::string &leaf,
                                    const std::string &leaf_hash,
                                    const std::string &cert,
-                                   const std::string &cert_chain) = 0;
+                                   const std::string &cert_chain,
+                                   const std::vector<std::string> &domains)
+      = 0;
 
   virtual WriteResult WriteSTH_(uint64_t timestamp, uint64_t tree_size,
                                 const std::string &sth) = 0;
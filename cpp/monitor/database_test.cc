@@ -2,6 +2,8 @@
 
 #include <gtest/gtest.h>
 #include <set>
+#include <string>
+#include <vector>
 
 #include "log/test_signer.h"
 #include "monitor/test_db.h"
@@ -40,6 +42,7 @@ TYPED_TEST(DBTest, LookupsOnEmptyDB) {
 
   string res;
   EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupHashByIndex(1, &res));
+  EXPECT_EQ(0U, this->db()->EntryCount());
 
   DB::VerificationLevel lvl;
   this->test_signer_.CreateUnique(&sth);
@@ -88,6 +91,30 @@ TYPED_TEST(DBTest, LookupLatestWrittenSTH) {
   TestSigner::TestEqualTreeHeads(sth, lookup_sth);
 }
 
+TYPED_TEST(DBTest, LookupSTHsBetween) {
+  std::vector<SignedTreeHead> sths(4);
+  for (size_t i = 0; i < sths.size(); ++i) {
+    this->test_signer_.CreateUnique(&sths[i]);
+    sths[i].set_timestamp(1000 * (i + 1));
+  }
+  // Written out of order, but found by timestamp.
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteSTH(sths[2]));
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteSTH(sths[0]));
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteSTH(sths[3]));
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteSTH(sths[1]));
+
+  std::vector<SignedTreeHead> found;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupSTHsBetween(1000, 4000, &found));
+  ASSERT_EQ(2U, found.size());
+  TestSigner::TestEqualTreeHeads(sths[1], found[0]);
+  TestSigner::TestEqualTreeHeads(sths[2], found[1]);
+
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupSTHsBetween(0, 5000, &found));
+  EXPECT_EQ(4U, found.size());
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupSTHsBetween(1000, 2000, &found));
+  EXPECT_TRUE(found.empty());
+}
+
 TYPED_TEST(DBTest, WriteEntryAndLookupHash) {
   LoggedCertificate logged;
   this->test_signer_.CreateUnique(&logged);
@@ -104,6 +131,169 @@ TYPED_TEST(DBTest, WriteEntryAndLookupHash) {
   EXPECT_EQ(leaf_hash, res);
 }
 
+TYPED_TEST(DBTest, WritePreparedEntry) {
+  LoggedCertificate logged;
+  this->test_signer_.CreateUnique(&logged);
+
+  DB::PreparedEntry entry;
+  EXPECT_EQ(DB::WRITE_OK, DB::PrepareEntry(logged, &entry));
+  string leaf;
+  logged.SerializeForLeaf(&leaf);
+  EXPECT_EQ(leaf, entry.leaf);
+
+  this->db()->BeginTransaction();
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteEntry(entry));
+  this->db()->EndTransaction();
+
+  string res;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupHashByIndex(1, &res));
+  TreeHasher hasher(new Sha256Hasher);
+  EXPECT_EQ(hasher.HashLeaf(leaf), res);
+}
+
+TYPED_TEST(DBTest, CreateEntries) {
+  std::vector<LoggedCertificate> logged(3);
+  for (size_t i = 0; i < logged.size(); ++i)
+    this->test_signer_.CreateUnique(&logged[i]);
+  EXPECT_EQ(DB::WRITE_OK, this->db()->CreateEntries(logged));
+
+  // And within a transaction that is open already.
+  std::vector<LoggedCertificate> more(2);
+  for (size_t i = 0; i < more.size(); ++i)
+    this->test_signer_.CreateUnique(&more[i]);
+  this->db()->BeginTransaction();
+  EXPECT_EQ(DB::WRITE_OK, this->db()->CreateEntries(more));
+  this->db()->EndTransaction();
+  logged.insert(logged.end(), more.begin(), more.end());
+  EXPECT_EQ(5U, this->db()->EntryCount());
+
+  std::vector<string> hashes;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupHashRange(1, 6, &hashes));
+  ASSERT_EQ(5U, hashes.size());
+  TreeHasher hasher(new Sha256Hasher);
+  for (size_t i = 0; i < logged.size(); ++i) {
+    string leaf;
+    logged[i].SerializeForLeaf(&leaf);
+    EXPECT_EQ(hasher.HashLeaf(leaf), hashes[i]);
+  }
+}
+
+TYPED_TEST(DBTest, LookupHashRange) {
+  std::vector<string> expected;
+  for (int i = 0; i < 3; ++i) {
+    LoggedCertificate logged;
+    this->test_signer_.CreateUnique(&logged);
+    EXPECT_EQ(DB::WRITE_OK, this->db()->CreateEntry(logged));
+    string hash;
+    EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupHashByIndex(i + 1, &hash));
+    expected.push_back(hash);
+  }
+
+  std::vector<string> hashes;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupHashRange(1, 4, &hashes));
+  EXPECT_EQ(expected, hashes);
+
+  hashes.clear();
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupHashRange(2, 5, &hashes));
+  EXPECT_TRUE(hashes.empty());
+}
+
+// Collects hashes, up to |limit| of them.
+class HashCollector : public DB::HashCallback {
+ public:
+  explicit HashCollector(size_t limit) : limit_(limit) {}
+
+  bool Hash(const string &leaf_hash) {
+    hashes_.push_back(leaf_hash);
+    return hashes_.size() < limit_;
+  }
+
+  const size_t limit_;
+  std::vector<string> hashes_;
+};
+
+TYPED_TEST(DBTest, ScanHashRange) {
+  std::vector<string> expected;
+  for (int i = 0; i < 4; ++i) {
+    LoggedCertificate logged;
+    this->test_signer_.CreateUnique(&logged);
+    EXPECT_EQ(DB::WRITE_OK, this->db()->CreateEntry(logged));
+  }
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupHashRange(1, 5, &expected));
+
+  HashCollector all(10);
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->ScanHashRange(2, 5, &all));
+  EXPECT_EQ(std::vector<string>(expected.begin() + 1, expected.end()),
+            all.hashes_);
+
+  HashCollector two(2);
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->ScanHashRange(1, 5, &two));
+  EXPECT_EQ(std::vector<string>(expected.begin(), expected.begin() + 2),
+            two.hashes_);
+
+  // Those before the missing one are passed on.
+  HashCollector past_end(10);
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->ScanHashRange(3, 7, &past_end));
+  EXPECT_EQ(std::vector<string>(expected.begin() + 2, expected.end()),
+            past_end.hashes_);
+}
+
+TYPED_TEST(DBTest, ReverseDomain) {
+  EXPECT_EQ("com.example.www", DB::ReverseDomain("www.example.com"));
+  EXPECT_EQ("com.example.*", DB::ReverseDomain("*.Example.COM."));
+  EXPECT_EQ("localhost", DB::ReverseDomain("localhost"));
+  EXPECT_EQ("", DB::ReverseDomain(""));
+}
+
+TYPED_TEST(DBTest, LookupByDomain) {
+  const char *const kDomains[][2] = {
+    { "www.example.com", "example.com" },
+    { "*.example.com", NULL },
+    { "mail.example.org", NULL },
+    { "a.b.example.com", NULL },
+    // Not indexed.
+    { NULL, NULL },
+  };
+  std::vector<DB::PreparedEntry> entries(5);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    LoggedCertificate logged;
+    this->test_signer_.CreateUnique(&logged);
+    EXPECT_EQ(DB::WRITE_OK, DB::PrepareEntry(logged, &entries[i]));
+    for (size_t j = 0; j < 2 && kDomains[i][j] != NULL; ++j)
+      entries[i].domains.push_back(DB::ReverseDomain(kDomains[i][j]));
+  }
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteEntries(entries));
+
+  std::vector<uint64_t> found;
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupByDomain("example.com", false, &found));
+  EXPECT_EQ(std::vector<uint64_t>(1, 1), found);
+
+  // The wildcard covers it.
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupByDomain("WWW.example.com", false, &found));
+  ASSERT_EQ(2U, found.size());
+  EXPECT_EQ(1U, found[0]);
+  EXPECT_EQ(2U, found[1]);
+
+  // But only one label down.
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupByDomain("x.y.example.com", false, &found));
+  EXPECT_TRUE(found.empty());
+
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupByDomain("example.com", true, &found));
+  ASSERT_EQ(3U, found.size());
+  EXPECT_EQ(1U, found[0]);
+  EXPECT_EQ(2U, found[1]);
+  EXPECT_EQ(4U, found[2]);
+
+  // Not a label boundary.
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupByDomain("ample.com", true, &found));
+  EXPECT_TRUE(found.empty());
+}
+
 TYPED_TEST(DBTest, ModifyVerificationLevels) {
   SignedTreeHead sth;
   this->test_signer_.CreateUnique(&sth);
@@ -137,6 +327,25 @@ TYPED_TEST(DBTest, DenyUndefinedVerificationLevel) {
             this->db()->SetVerificationLevel(sth, DB::UNDEFINED));
 }
 
+TYPED_TEST(DBTest, WriteAndLookupCheckpoint) {
+  SignedTreeHead sth, lookup_sth;
+  string checkpoint;
+  EXPECT_EQ(DB::NOT_FOUND,
+            this->db()->LookupCheckpoint(&lookup_sth, &checkpoint));
+
+  this->test_signer_.CreateUnique(&sth);
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteCheckpoint(sth, "tree1"));
+  // The second replaces the first.
+  SignedTreeHead sth2;
+  this->test_signer_.CreateUnique(&sth2);
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteCheckpoint(sth2, "tree2"));
+
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupCheckpoint(&lookup_sth, &checkpoint));
+  TestSigner::TestEqualTreeHeads(sth2, lookup_sth);
+  EXPECT_EQ("tree2", checkpoint);
+}
+
 }  // namespace
 
 int main(int argc, char **argv) {
@@ -1,19 +1,395 @@
 #include "monitor/monitor.h"
 
+#include <algorithm>
+#include <ctype.h>
+#include <map>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "client/entry_fetcher.h"
+#include "log/cert.h"
 #include "log/log_verifier.h"
-#include "merkletree/merkle_tree.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
 #include "monitor/database.h"
+#include "util/thread_pool.h"
 
 using std::string;
 
 namespace monitor {
 
+namespace {
+
+// The database form of an entry from get-entries.
+void ToLoggedCertificate(const HTTPLogClient::LogEntry &entry,
+                         ct::LoggedCertificate *logged) {
+  ct::SignedCertificateTimestamp sct;
+  ct::LogEntry log_entry;
+  ct::LoggedCertificatePB_Contents cont;
+  ct::PreCert precert;
+  ct::X509ChainEntry x509chain_entry;
+  ct::PrecertChainEntry precert_chain_entry;
+
+  sct.set_version(ct::V1);
+  sct.set_timestamp(entry.leaf.timestamped_entry().timestamp());
+  sct.set_extensions(entry.leaf.timestamped_entry().extensions());
+
+  if (entry.leaf.timestamped_entry().entry_type() == ct::X509_ENTRY) {
+    x509chain_entry.CopyFrom(entry.entry.x509_entry());
+
+    x509chain_entry.set_leaf_certificate(
+        entry.leaf.timestamped_entry().signed_entry().x509());
+
+    log_entry.mutable_x509_entry()->CopyFrom(x509chain_entry);
+
+  } else if (entry.leaf.timestamped_entry().entry_type()
+             == ct::PRECERT_ENTRY) {
+    precert_chain_entry.CopyFrom(entry.entry.precert_entry());
+
+    precert.set_issuer_key_hash(entry.leaf.
+        timestamped_entry().signed_entry().precert().issuer_key_hash());
+    precert.set_tbs_certificate(entry.leaf.
+        timestamped_entry().signed_entry().precert().tbs_certificate());
+    precert_chain_entry.mutable_pre_cert()->CopyFrom(precert);
+
+    log_entry.mutable_precert_entry()->CopyFrom(precert_chain_entry);
+  } else {
+    LOG(FATAL) << "Unsupported ENTRY_TYPE: "
+               << entry.leaf.timestamped_entry().entry_type();
+  }
+
+  log_entry.set_type(entry.leaf.timestamped_entry().entry_type());
+
+  cont.mutable_sct()->CopyFrom(sct);
+  cont.mutable_entry()->CopyFrom(log_entry);
+
+  logged->mutable_contents()->CopyFrom(cont);
+}
+
+// Whether |name| looks like a DNS name, possibly a wildcard, rather than
+// the free text that subject common names can also hold.
+bool IsDnsName(const string &name) {
+  if (name.empty() || name.find('.') == string::npos)
+    return false;
+  for (size_t i = 0; i < name.size(); ++i) {
+    const char c = name[i];
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '.' &&
+        c != '_' && c != '*')
+      return false;
+  }
+  return true;
+}
+
+// Set |domains| to the reversed names, for Database::LookupByDomain(), of
+// the subject common names and subjectAltName DNS names of the certificate
+// of |entry|: its leaf certificate, or the precertificate the CA
+// submitted. Leaves |domains| empty if the certificate doesn't parse.
+void ExtractDomains(const HTTPLogClient::LogEntry &entry,
+                    std::vector<string> *domains) {
+  const ct::TimestampedEntry &timestamped = entry.leaf.timestamped_entry();
+  ct::Cert cert;
+  if (cert.LoadFromDerString(timestamped.entry_type() == ct::PRECERT_ENTRY ?
+          entry.entry.precert_entry().pre_certificate() :
+          timestamped.signed_entry().x509()) != ct::Cert::TRUE)
+    return;
+
+  std::vector<string> names;
+  cert.SubjectCommonNames(&names);
+  cert.SubjectAltDnsNames(&names);
+  for (size_t i = 0; i < names.size(); ++i)
+    if (IsDnsName(names[i]))
+      domains->push_back(Database::ReverseDomain(names[i]));
+  // The common name is usually among the subjectAltNames too.
+  std::sort(domains->begin(), domains->end());
+  domains->erase(std::unique(domains->begin(), domains->end()),
+                 domains->end());
+}
+
+// The longest that Loop() waits between polls of a quiet log, in units of
+// its sleep time.
+const uint64_t kMaxBackOff = 8;
+
+// Entries that Loop() fetches before it checks for a newer STH.
+const uint64_t kLoopStepEntries = 1 << 20;
+
+// Adds the leaf hashes of a scan to a tree, in batches, so that they are
+// hashed a level at a time.
+class TreeBuilder : public Database::HashCallback {
+ public:
+  explicit TreeBuilder(CompactMerkleTree *tree) : tree_(tree) {}
+
+  bool Hash(const string &leaf_hash) {
+    hashes_.push_back(leaf_hash);
+    if (hashes_.size() >= kBatch)
+      Flush();
+    return true;
+  }
+
+  void Flush() {
+    tree_->AddLeafHashes(hashes_.begin(), hashes_.end(), 1);
+    hashes_.clear();
+  }
+
+ private:
+  static const size_t kBatch = 1 << 12;
+
+  CompactMerkleTree *const tree_;
+  std::vector<string> hashes_;
+};
+
+// Entries to write in a transaction. Larger transactions write faster,
+// but leave more to fetch again after a crash.
+const size_t kCommitEntries = 10000;
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+// Fetches entries in one thread, prepares them for the database on a
+// thread pool, up to |prepare_chunks| chunks at once, and writes them in
+// the calling thread, so that the network, the CPUs and the disk all keep
+// busy. Up to |max_chunks| chunks of entries can be between the fetcher
+// and the database. With |index_domains|, the entries are written with
+// their domain names.
+class EntryPipeline : public EntryFetcher::Callback {
+ public:
+  EntryPipeline(Database *db, EntryFetcher *fetcher, util::ThreadPool *pool,
+                size_t prepare_chunks, size_t max_chunks, bool index_domains)
+      : db_(db),
+        fetcher_(fetcher),
+        pool_(pool),
+        prepare_chunks_(prepare_chunks),
+        max_chunks_(max_chunks),
+        index_domains_(index_domains),
+        first_(0),
+        last_(0),
+        group_(NULL),
+        chunks_(0),
+        preparing_(0),
+        fetched_all_(false),
+        status_(HTTPLogClient::OK) {
+    CHECK_GT(prepare_chunks_, 0U);
+    CHECK_GT(max_chunks_, 0U);
+    CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+    CHECK_EQ(0, pthread_cond_init(&changed_, NULL));
+  }
+
+  ~EntryPipeline() {
+    CHECK_EQ(0, pthread_cond_destroy(&changed_));
+    CHECK_EQ(0, pthread_mutex_destroy(&mutex_));
+  }
+
+  // Fetch and write the entries |first| to |last|. Returns the status of
+  // the fetch; if it failed, the entries before the failure are written.
+  HTTPLogClient::Status Run(int first, int last) {
+    first_ = first;
+    last_ = last;
+    pthread_t fetch_thread;
+    CHECK_EQ(0, pthread_create(&fetch_thread, NULL, FetchThread, this));
+
+    Write();
+
+    CHECK_EQ(0, pthread_join(fetch_thread, NULL));
+    return status_;
+  }
+
+  // Called from the fetch thread; waits while the pipeline is full.
+  void Entries(int first, std::vector<HTTPLogClient::LogEntry> *entries) {
+    bool full;
+    {
+      ScopedLock lock(&mutex_);
+      full = preparing_ >= prepare_chunks_ || chunks_ >= max_chunks_;
+    }
+    // Waiting for the group runs its chunks in this thread too, so the
+    // pipeline can't stall on a pool that is busy elsewhere, or has no
+    // workers. Once they are prepared, the writer can make room.
+    if (full)
+      group_->Wait();
+    {
+      ScopedLock lock(&mutex_);
+      while (chunks_ >= max_chunks_)
+        CHECK_EQ(0, pthread_cond_wait(&changed_, &mutex_));
+      ++chunks_;
+      ++preparing_;
+    }
+    Chunk *chunk = new Chunk;
+    chunk->pipeline = this;
+    chunk->first = first;
+    chunk->entries.swap(*entries);
+    group_->Run(PrepareTask, chunk);
+  }
+
+ private:
+  struct Chunk {
+    EntryPipeline *pipeline;
+    int first;
+    std::vector<HTTPLogClient::LogEntry> entries;
+  };
+
+  static void *FetchThread(void *arg) {
+    EntryPipeline *pipeline = static_cast<EntryPipeline*>(arg);
+    util::TaskGroup group(pipeline->pool_);
+    pipeline->group_ = &group;
+    const HTTPLogClient::Status status =
+        pipeline->fetcher_->Fetch(pipeline->first_, pipeline->last_,
+                                  pipeline);
+    group.Wait();
+    pipeline->group_ = NULL;
+    ScopedLock lock(&pipeline->mutex_);
+    pipeline->status_ = status;
+    pipeline->fetched_all_ = true;
+    CHECK_EQ(0, pthread_cond_broadcast(&pipeline->changed_));
+    return NULL;
+  }
+
+  static void PrepareTask(void *arg) {
+    Chunk *chunk = static_cast<Chunk*>(arg);
+    chunk->pipeline->Prepare(*chunk);
+    delete chunk;
+  }
+
+  void Prepare(const Chunk &chunk) {
+    std::vector<Database::PreparedEntry> prepared(chunk.entries.size());
+    for (size_t i = 0; i < chunk.entries.size(); ++i) {
+      ct::LoggedCertificate logged;
+      ToLoggedCertificate(chunk.entries[i], &logged);
+      CHECK_EQ(Database::PrepareEntry(logged, &prepared[i]),
+               Database::WRITE_OK);
+      if (index_domains_)
+        ExtractDomains(chunk.entries[i], &prepared[i].domains);
+    }
+
+    ScopedLock lock(&mutex_);
+    prepared_[chunk.first].swap(prepared);
+    --preparing_;
+    CHECK_EQ(0, pthread_cond_broadcast(&changed_));
+  }
+
+  // Write the prepared chunks in order, until the next one won't come.
+  void Write() {
+    int next = first_;
+    size_t uncommitted = 0;
+    for (;;) {
+      std::vector<Database::PreparedEntry> entries;
+      {
+        ScopedLock lock(&mutex_);
+        while ((prepared_.empty() || prepared_.begin()->first != next) &&
+               !fetched_all_)
+          CHECK_EQ(0, pthread_cond_wait(&changed_, &mutex_));
+        if (prepared_.empty() || prepared_.begin()->first != next)
+          break;
+        entries.swap(prepared_.begin()->second);
+        prepared_.erase(prepared_.begin());
+        --chunks_;
+        CHECK_EQ(0, pthread_cond_broadcast(&changed_));
+      }
+
+      if (uncommitted == 0)
+        db_->BeginTransaction();
+      CHECK_EQ(db_->WriteEntries(entries), Database::WRITE_OK);
+      next += entries.size();
+      uncommitted += entries.size();
+      if (uncommitted >= kCommitEntries) {
+        db_->EndTransaction();
+        LOG(INFO) << "Wrote entries up to " << next - 1;
+        uncommitted = 0;
+      }
+    }
+    if (uncommitted > 0) {
+      db_->EndTransaction();
+      LOG(INFO) << "Wrote entries up to " << next - 1;
+    }
+  }
+
+  Database *const db_;
+  EntryFetcher *const fetcher_;
+  util::ThreadPool *const pool_;
+  const size_t prepare_chunks_;
+  const size_t max_chunks_;
+  const bool index_domains_;
+  int first_;
+  int last_;
+  // The tasks of Entries(); only the fetch thread uses it.
+  util::TaskGroup *group_;
+
+  pthread_mutex_t mutex_;
+  pthread_cond_t changed_;
+  // Chunks fetched but not written yet. As chunks arrive in order, and
+  // the fetcher prepares them all itself before it waits for room, the
+  // one to write next can't be held up.
+  size_t chunks_;
+  // Chunks waiting for the pool or being prepared.
+  size_t preparing_;
+  // Prepared chunks, keyed by the index of their first entry.
+  std::map<int, std::vector<Database::PreparedEntry> > prepared_;
+  bool fetched_all_;
+  HTTPLogClient::Status status_;
+};
+
+// A link of Monitor::ConfirmChain(): a consistency proof from one STH to
+// a later one.
+struct ChainLink {
+  const ct::SignedTreeHead *from;
+  const ct::SignedTreeHead *to;
+  bool fetched;
+  std::vector<string> proof;
+  bool consistent;
+};
+
+// Get the proof of |link|, if it needs one. Returns whether it could.
+bool FetchLink(const HTTPLogClient &client, ChainLink *link) {
+  link->proof.clear();
+  link->consistent = false;
+  const uint64_t from = link->from->tree_size();
+  const uint64_t to = link->to->tree_size();
+  // Equal trees, or one empty, need no proof, and a shrinking one has none.
+  link->fetched = from == 0 || from >= to ||
+      client.GetSTHConsistency(from, to, &link->proof) == HTTPLogClient::OK;
+  return link->fetched;
+}
+
+// Verify the fetched links [|begin|, |end|) of the vector |arg|.
+void VerifyLinks(void *arg, size_t chunk, size_t begin, size_t end) {
+  std::vector<ChainLink> *links = static_cast<std::vector<ChainLink>*>(arg);
+  MerkleVerifier verifier(new Sha256Hasher);
+  for (size_t i = begin; i < end; ++i) {
+    ChainLink &link = (*links)[i];
+    link.consistent = link.fetched &&
+        verifier.VerifyConsistency(link.from->tree_size(),
+                                   link.to->tree_size(),
+                                   link.from->sha256_root_hash(),
+                                   link.to->sha256_root_hash(), link.proof);
+  }
+}
+
+}  // namespace
+
 Monitor::Monitor(Database *database,
                  LogVerifier *log_verifier,
                  const HTTPLogClient &client,
-                 uint64_t sleep_time_sec)
+                 uint64_t sleep_time_sec,
+                 int fetch_parallel,
+                 int fetch_batch_size,
+                 int fetch_retries,
+                 int prepare_chunks,
+                 bool index_domains,
+                 bool chain_consistency)
   : db_(database), verifier_(log_verifier), client_(client),
-    sleep_time_(sleep_time_sec)
+    sleep_time_(sleep_time_sec), fetch_parallel_(fetch_parallel),
+    fetch_batch_size_(fetch_batch_size), fetch_retries_(fetch_retries),
+    prepare_chunks_(prepare_chunks), index_domains_(index_domains),
+    chain_consistency_(chain_consistency), entries_(0)
 {
 }
 
@@ -153,78 +529,19 @@ Monitor::GetResult Monitor::GetEntries(int get_first, int get_last) {
   CHECK(get_first >= 0);
   CHECK(get_last >= get_first);
 
-  std::vector<HTTPLogClient::LogEntry> entries;
-  int dload_count = 0;
-  do {
-    // If the server does not impose a limit, all entries from get_first to
-    // get_last will be downloaded at once (could exceed memory).
-    HTTPLogClient::Status error = client_.GetEntries(
-        get_first + dload_count,
-        get_last,
-        &entries);
-
-    if (error != HTTPLogClient::OK) {
-      LOG(ERROR) << "HTTPLogClient returned with error " << error
-                 << ". No entries have been written to the database.";
-      return NETWORK_PROBLEM;
-    }
-
-    LOG(INFO) << "Writing entries from " << get_first + dload_count << " to "
-              << get_first + dload_count + entries.size();
-    dload_count += entries.size();
-
-    db_->BeginTransaction();
-    for (size_t i = 0; i < entries.size(); i++) {
-      ct::SignedCertificateTimestamp sct;
-      ct::LogEntry log_entry;
-      ct::LoggedCertificatePB_Contents cont;
-      ct::PreCert precert;
-      ct::X509ChainEntry x509chain_entry;
-      ct::PrecertChainEntry precert_chain_entry;
-
-      sct.set_version(ct::V1);
-      sct.set_timestamp(entries.at(i).leaf.timestamped_entry().timestamp());
-      sct.set_extensions(entries.at(i).leaf.timestamped_entry().extensions());
-
-      if (entries.at(i).leaf.timestamped_entry().entry_type()
-          == ct::X509_ENTRY) {
-        x509chain_entry.CopyFrom(entries.at(i).entry.x509_entry());
-
-        x509chain_entry.set_leaf_certificate(
-              entries.at(i).leaf.timestamped_entry().signed_entry().x509());
-
-        log_entry.mutable_x509_entry()->CopyFrom(x509chain_entry);
-
-      } else if (entries.at(i).leaf.timestamped_entry().entry_type()
-                 == ct::PRECERT_ENTRY) {
-        precert_chain_entry.CopyFrom(entries.at(i).entry.precert_entry());
-
-        precert.set_issuer_key_hash(entries.at(i).leaf.
-            timestamped_entry().signed_entry().precert().issuer_key_hash());
-        precert.set_tbs_certificate(entries.at(i).leaf.
-            timestamped_entry().signed_entry().precert().tbs_certificate());
-        precert_chain_entry.mutable_pre_cert()->CopyFrom(precert);
-
-        log_entry.mutable_precert_entry()->CopyFrom(precert_chain_entry);
-      } else {
-        LOG(FATAL) << "Unsupported ENTRY_TYPE: "
-                   << entries.at(i).leaf.timestamped_entry().entry_type();
-      }
-
-      log_entry.set_type(entries.at(i).leaf.timestamped_entry().entry_type());
-
-      cont.mutable_sct()->CopyFrom(sct);
-      cont.mutable_entry()->CopyFrom(log_entry);
-
-      ct::LoggedCertificate logged;
-      logged.mutable_contents()->CopyFrom(cont);
-
-      CHECK_EQ(db_->CreateEntry(logged), Database::WRITE_OK);
-    }
-    entries.clear();
-    db_->EndTransaction();
-
-  } while(dload_count + get_first <= get_last);
+  EntryFetcher fetcher(client_, fetch_parallel_, fetch_batch_size_,
+                       fetch_retries_);
+  EntryPipeline pipeline(db_, &fetcher, util::ThreadPool::Default(),
+                         prepare_chunks_,
+                         2 * (fetch_parallel_ + prepare_chunks_),
+                         index_domains_);
+  HTTPLogClient::Status error = pipeline.Run(get_first, get_last);
+  if (error != HTTPLogClient::OK) {
+    LOG(ERROR) << "HTTPLogClient returned with error " << error
+               << ". Only the entries before the failed request have been "
+               << "written to the database.";
+    return NETWORK_PROBLEM;
+  }
   return OK;
 }
 
@@ -245,29 +562,45 @@ Monitor::ConfirmResult Monitor::ConfirmTreeInternal() {
 
 Monitor::ConfirmResult Monitor::ConfirmTreeInternal(
     const ct::SignedTreeHead &sth) {
-  MerkleTree mt(new Sha256Hasher);
-
   Database::VerificationLevel lvl;
   CHECK_EQ(db_->LookupVerificationLevel(sth, &lvl), Database::LOOKUP_OK);
   CHECK_EQ(lvl, Database::SIGNATURE_VERIFIED);
 
-  std::string hash;
+  // Start from the tree of the last confirmed STH, if it is no larger and
+  // its checkpoint still matches it; otherwise from scratch.
+  CompactMerkleTree tree(new Sha256Hasher);
+  ct::SignedTreeHead confirmed;
+  string checkpoint;
+  if (db_->LookupCheckpoint(&confirmed, &checkpoint) == Database::LOOKUP_OK &&
+      confirmed.tree_size() <= sth.tree_size()) {
+    CompactMerkleTree restored(new Sha256Hasher);
+    if (restored.Restore(checkpoint) &&
+        restored.LeafCount() == confirmed.tree_size() &&
+        restored.CurrentRoot() == confirmed.sha256_root_hash())
+      CHECK(tree.Restore(checkpoint));
+    else
+      LOG(WARNING) << "Ignoring bad checkpoint of tree size "
+                   << confirmed.tree_size();
+  }
+  const uint64_t old_size = tree.LeafCount();
+  const string old_root = tree.CurrentRoot();
 
-  LOG(INFO) << "Building tree...";
+  LOG(INFO) << "Building tree from " << old_size << " leaves...";
 
-  for (uint64_t current = 1; current <= sth.tree_size(); current++) {
-    CHECK_EQ(db_->LookupHashByIndex(current, &hash), Database::LOOKUP_OK);
-    mt.AddLeafHash(hash);
-  }
+  // Sequence numbers start at 1.
+  TreeBuilder builder(&tree);
+  CHECK_EQ(db_->ScanHashRange(old_size + 1, sth.tree_size() + 1, &builder),
+           Database::LOOKUP_OK);
+  builder.Flush();
 
   LOG(INFO) << "merkle tree_size and root_hash:";
-  LOG(INFO) << mt.LeafCount();
-  LOG(INFO) << util::ToBase64(mt.CurrentRoot());
+  LOG(INFO) << tree.LeafCount();
+  LOG(INFO) << util::ToBase64(tree.CurrentRoot());
   LOG(INFO) << "STH tree_size and root_hash:";
   LOG(INFO) << sth.tree_size();
   LOG(INFO) << util::ToBase64(sth.sha256_root_hash());
 
-  if (mt.CurrentRoot() != sth.sha256_root_hash()) {
+  if (tree.CurrentRoot() != sth.sha256_root_hash()) {
     LOG(ERROR) << "Tree confirmation failed - hashes mismatch.";
     CHECK_EQ(db_->SetVerificationLevel(sth,
                                        Database::TREE_CONFIRMATION_FAILED),
@@ -276,12 +609,105 @@ Monitor::ConfirmResult Monitor::ConfirmTreeInternal(
     return TREE_CONFIRMATION_FAILED;
   }
 
+  // The log must also prove that the new tree extends the confirmed one.
+  if (old_size > 0 && old_size < sth.tree_size()) {
+    std::vector<string> proof;
+    if (client_.GetSTHConsistency(old_size, sth.tree_size(), &proof) !=
+        HTTPLogClient::OK) {
+      LOG(ERROR) << "Failed to get a consistency proof; not confirming yet.";
+      return TREE_CONFIRMATION_FAILED;
+    }
+    MerkleVerifier verifier(new Sha256Hasher);
+    if (!verifier.VerifyConsistency(old_size, sth.tree_size(), old_root,
+                                    sth.sha256_root_hash(), proof)) {
+      LOG(ERROR) << "Tree confirmation failed - bad consistency proof.";
+      CHECK_EQ(db_->SetVerificationLevel(sth,
+                                         Database::TREE_CONFIRMATION_FAILED),
+               Database::WRITE_OK);
+      return TREE_CONFIRMATION_FAILED;
+    }
+  }
+
   CHECK_EQ(db_->SetVerificationLevel(sth, Database::TREE_CONFIRMED),
            Database::WRITE_OK);
+  if (sth.tree_size() >= confirmed.tree_size()) {
+    tree.Checkpoint(&checkpoint);
+    CHECK_EQ(db_->WriteCheckpoint(sth, checkpoint), Database::WRITE_OK);
+  }
   LOG(INFO) << "Tree confirmed.";
   return TREE_CONFIRMED;
 }
 
+void Monitor::ConfirmChain(const ct::SignedTreeHead &old_sth,
+                           const ct::SignedTreeHead &new_sth) {
+  std::vector<ct::SignedTreeHead> observed;
+  CHECK_EQ(db_->LookupSTHsBetween(old_sth.timestamp(), new_sth.timestamp(),
+                                  &observed),
+           Database::LOOKUP_OK);
+  // Only those signed by the log, and not judged otherwise yet.
+  std::vector<ct::SignedTreeHead> chain;
+  for (size_t i = 0; i < observed.size(); ++i) {
+    Database::VerificationLevel level;
+    CHECK_EQ(db_->LookupVerificationLevel(observed[i], &level),
+             Database::LOOKUP_OK);
+    if (level == Database::SIGNATURE_VERIFIED)
+      chain.push_back(observed[i]);
+  }
+  if (chain.empty())
+    return;
+  chain.push_back(new_sth);
+
+  const size_t count = chain.size() - 1;
+  LOG(INFO) << "Confirming " << count << " intermediate STHs by "
+            << "consistency proofs.";
+  std::vector<ChainLink> links(count);
+  for (size_t i = 0; i < count; ++i) {
+    links[i].from = &chain[i];
+    links[i].to = &chain[i + 1];
+    links[i].fetched = false;
+  }
+  // Newest first, as they are confirmed below: if a fetch fails, the
+  // older links are of no use.
+  for (size_t i = count; i-- > 0;)
+    if (!FetchLink(client_, &links[i]))
+      break;
+  util::ThreadPool *pool = util::ThreadPool::Default();
+  pool->ParallelFor(count, std::min(count, pool->Parallelism()), VerifyLinks,
+                    &links);
+
+  // From the newest down, each STH is consistent with the one after it,
+  // and so with all those after, up to |new_sth|. Past a link that fails,
+  // try the older ones against the last confirmed STH directly.
+  const ct::SignedTreeHead *anchor = &new_sth;
+  for (size_t i = count; i-- > 0;) {
+    ChainLink &link = links[i];
+    if (link.to != anchor) {
+      link.to = anchor;
+      if (FetchLink(client_, &link))
+        VerifyLinks(&links, 0, i, i + 1);
+    }
+    if (!link.fetched) {
+      LOG(ERROR) << "Failed to get a consistency proof; leaving " << i + 1
+                 << " intermediate STHs unconfirmed.";
+      return;
+    }
+    Database::VerificationLevel level = Database::TREE_CONFIRMED;
+    if (link.from->tree_size() > anchor->tree_size()) {
+      LOG(ERROR) << "Intermediate STH at " << link.from->timestamp()
+                 << " is larger than a later one.";
+      level = Database::INCONSISTENT;
+    } else if (!link.consistent) {
+      LOG(ERROR) << "Intermediate STH at " << link.from->timestamp()
+                 << " failed confirmation - bad consistency proof.";
+      level = Database::TREE_CONFIRMATION_FAILED;
+    } else {
+      anchor = link.from;
+    }
+    CHECK_EQ(db_->SetVerificationLevel(*link.from, level),
+             Database::WRITE_OK);
+  }
+}
+
 Monitor::CheckResult Monitor::CheckSTHSanity(
     const ct::SignedTreeHead &old_sth,
     const ct::SignedTreeHead &new_sth) {
@@ -328,36 +754,79 @@ void Monitor::Init() {
 }
 
 void Monitor::Loop() {
-  ct::SignedTreeHead old_sth;
-  ct::SignedTreeHead new_sth;
-
-  if (db_->LookupLatestWrittenSTH(&old_sth), Database::LOOKUP_OK)
-    LOG(FATAL) << "Run init_monitor first.";
-
+  Start();
+
+  // Poll every sleep_time_ seconds from the start of one step to the start
+  // of the next, so the time a step takes counts against its interval.
+  // While the STH stays the same, or can't be had, poll half as often
+  // each time, down to once per kMaxBackOff intervals; as soon as it moves
+  // again, go back to every interval, and catch up on a backlog at once.
+  uint64_t interval = sleep_time_;
+  time_t next = time(NULL);
   while (true) {
-    LOG(INFO) << "Sleeping for " << sleep_time_ << " seconds.";
-    // TODO(weidner): Better only sleep sleep_time - time_used_in_loop.
-    sleep(sleep_time_);
+    const time_t now = time(NULL);
+    if (next > now) {
+      LOG(INFO) << "Sleeping for " << next - now << " seconds.";
+      sleep(next - now);
+    }
 
-    if (VerifySTHInternal() != SIGNATURE_VALID)
-      continue;
+    const time_t started = time(NULL);
+    switch (Step(kLoopStepEntries)) {
+      case UPDATED:
+        interval = sleep_time_;
+        break;
+      case BACKLOG:
+        interval = 0;
+        break;
+      case UNCHANGED:
+      case FAILED:
+        interval = std::min(kMaxBackOff * sleep_time_,
+                            std::max<uint64_t>(sleep_time_, 2 * interval));
+        break;
+    }
+    next = started + interval;
+  }
+}
 
-    CHECK_EQ(db_->LookupLatestWrittenSTH(&new_sth), Database::LOOKUP_OK);
+void Monitor::Start() {
+  if (db_->LookupLatestWrittenSTH(&old_sth_) != Database::LOOKUP_OK)
+    LOG(FATAL) << "Run init_monitor first.";
+  entries_ = db_->EntryCount();
+}
 
-    const CheckResult sanity(CheckSTHSanity(old_sth, new_sth));
-    if (sanity == SANE) {
-      if (GetEntries(old_sth.tree_size(), new_sth.tree_size() - 1) != OK) {
-        continue;
-      }
-    }
-    if (sanity == REFRESHED || sanity == SANE) {
-      // Go on even the confirmation fails to continue to monitor the log.
-      // Nevertheless the failure is logged and written to the database.
-      ConfirmTreeInternal();
+Monitor::StepResult Monitor::Step(uint64_t max_entries) {
+  if (VerifySTHInternal() != SIGNATURE_VALID)
+    return FAILED;
 
-      old_sth = new_sth;
-    }
+  ct::SignedTreeHead new_sth;
+  CHECK_EQ(db_->LookupLatestWrittenSTH(&new_sth), Database::LOOKUP_OK);
+
+  const CheckResult sanity(CheckSTHSanity(old_sth_, new_sth));
+  if (sanity == EQUAL)
+    return UNCHANGED;
+  if (sanity == INSANE)
+    return FAILED;
+
+  if (sanity == SANE && entries_ < new_sth.tree_size()) {
+    uint64_t end = new_sth.tree_size();
+    if (max_entries > 0 && end - entries_ > max_entries)
+      end = entries_ + max_entries;
+    const GetResult result = GetEntries(entries_, end - 1);
+    // Some may have been written even if the fetch failed.
+    entries_ = db_->EntryCount();
+    if (result != OK)
+      return FAILED;
+    if (entries_ < new_sth.tree_size())
+      return BACKLOG;
   }
+
+  // Go on even the confirmation fails to continue to monitor the log.
+  // Nevertheless the failure is logged and written to the database.
+  if (ConfirmTreeInternal(new_sth) == TREE_CONFIRMED && chain_consistency_)
+    ConfirmChain(old_sth_, new_sth);
+
+  old_sth_ = new_sth;
+  return UPDATED;
 }
 
 } // namespace monitor
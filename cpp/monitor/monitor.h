@@ -33,10 +33,31 @@ class Monitor
     TREE_CONFIRMATION_FAILED = 1,
   };
 
+  enum StepResult {
+    // The log's STH is the one we have.
+    UNCHANGED = 0,
+    // A new STH, whose entries have been fetched and tree confirmed.
+    UPDATED = 1,
+    // Entries fetched towards a new STH, but not all yet.
+    BACKLOG = 2,
+    // The STH or entries couldn't be fetched, or the STH is bad.
+    FAILED = 3,
+  };
+
+  // With |index_domains|, GetEntries() indexes the entries it writes by
+  // their domain names, for Database::LookupByDomain(). With
+  // |chain_consistency|, Step() also confirms the STHs it saw on the way to
+  // the one it catches up with; see ConfirmChain().
   Monitor(Database *database,
           LogVerifier *verifier,
           const HTTPLogClient &client,
-          uint64_t sleep_time_sec);
+          uint64_t sleep_time_sec,
+          int fetch_parallel,
+          int fetch_batch_size,
+          int fetch_retries,
+          int prepare_chunks,
+          bool index_domains,
+          bool chain_consistency);
 
   GetResult GetSTH();
 
@@ -50,6 +71,15 @@ class Monitor
 
   void Loop();
 
+  // Load the state that Step() goes on from: the latest STH, and the
+  // number of entries in the database. Requires Init() to have run once.
+  void Start();
+
+  // One round of Loop(): get and verify the latest STH, and if it is new
+  // and sane, fetch its new entries and confirm its tree. Fetches at most
+  // |max_entries| entries, or all if 0, leaving the rest to later steps.
+  StepResult Step(uint64_t max_entries);
+
  private:
   enum CheckResult {
     EQUAL = 0,
@@ -62,6 +92,21 @@ class Monitor
   LogVerifier *verifier_;
   HTTPLogClient client_;
   uint64_t sleep_time_;
+  // Passed on to the EntryFetcher of GetEntries().
+  int fetch_parallel_;
+  int fetch_batch_size_;
+  int fetch_retries_;
+  // Chunks of fetched entries that are serialized and hashed for the
+  // database at once, on the shared thread pool.
+  int prepare_chunks_;
+  // Whether GetEntries() indexes entries by their domain names.
+  bool index_domains_;
+  // Whether Step() confirms the intermediate STHs with ConfirmChain().
+  bool chain_consistency_;
+  // The latest STH that Step() has caught up with.
+  ct::SignedTreeHead old_sth_;
+  // Number of entries in the database.
+  uint64_t entries_;
 
   VerifyResult VerifySTHInternal();
   VerifyResult VerifySTHInternal(const ct::SignedTreeHead &sth);
@@ -69,9 +114,17 @@ class Monitor
   ConfirmResult ConfirmTreeInternal();
   ConfirmResult ConfirmTreeInternal(const ct::SignedTreeHead &sth);
 
+  // Confirm the STHs that were observed between |old_sth| and the
+  // confirmed |new_sth| without entries of their own: each through a
+  // consistency proof to the next, all fetched first and then verified in
+  // parallel, so that k skipped STHs cost k proofs rather than k tree
+  // confirmations.
+  void ConfirmChain(const ct::SignedTreeHead &old_sth,
+                    const ct::SignedTreeHead &new_sth);
+
   // Checks if two (subsequent) STHs are sane regarding timestamp and tree size.
   // Prerequisite: Both STHs should have a valid signature and not be malformed.
-  // Only used internaly in loop().
+  // Only used internaly in Step().
   CheckResult CheckSTHSanity(const ct::SignedTreeHead &old_sth,
                              const ct::SignedTreeHead &new_sth);
 
@@ -10,10 +10,13 @@ using std::string;
 
 namespace monitor {
 
-SQLiteDB::SQLiteDB(const string &dbfile) : db_(NULL) {
+SQLiteDB::SQLiteDB(const string &dbfile) : db_(NULL), statements_(NULL) {
   int ret = sqlite3_open_v2(dbfile.c_str(), &db_, SQLITE_OPEN_READWRITE, NULL);
-  if (ret == SQLITE_OK)
+  if (ret == SQLITE_OK) {
+    CreateMissingTables();
+    statements_ = new sqlite::StatementCache(db_);
     return;
+  }
   CHECK_EQ(SQLITE_CANTOPEN, ret);
 
   // We have to close and reopen to avoid memory leaks.
@@ -46,10 +49,35 @@ SQLiteDB::SQLiteDB(const string &dbfile) : db_(NULL) {
                         "sth BLOB)",
                         NULL, NULL, NULL));
 
+  CreateMissingTables();
+  statements_ = new sqlite::StatementCache(db_);
   LOG(INFO) << "New SQLite database created in " << dbfile;
 }
 
+void SQLiteDB::CreateMissingTables() {
+  // Holds a single row, the latest confirmed tree.
+  CHECK_EQ(SQLITE_OK,
+           sqlite3_exec(db_, "CREATE TABLE IF NOT EXISTS checkpoint("
+                        "id INTEGER PRIMARY KEY CHECK (id = 0), "
+                        "sth BLOB, "
+                        "tree BLOB)",
+                        NULL, NULL, NULL));
+  // The reversed domain names of each entry, for LookupByDomain(). The
+  // index covers the lookups, which don't touch the table itself.
+  CHECK_EQ(SQLITE_OK,
+           sqlite3_exec(db_, "CREATE TABLE IF NOT EXISTS domains("
+                        "name TEXT NOT NULL, "
+                        "sequence INTEGER NOT NULL)",
+                        NULL, NULL, NULL));
+  CHECK_EQ(SQLITE_OK,
+           sqlite3_exec(db_, "CREATE INDEX IF NOT EXISTS domains_by_name "
+                        "ON domains(name, sequence)",
+                        NULL, NULL, NULL));
+}
+
 SQLiteDB::~SQLiteDB() {
+  // Cached statements have to be finalized before the connection closes.
+  delete statements_;
   CHECK_EQ(SQLITE_OK, sqlite3_close(db_));
 }
 
@@ -61,12 +89,35 @@ void SQLiteDB::EndTransaction() {
   CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "COMMIT;", NULL, NULL, NULL));
 }
 
-SQLiteDB::WriteResult SQLiteDB::CreateEntry_(const std::string &leaf,
-                                             const std::string &leaf_hash,
-                                             const std::string &cert,
-                                             const std::string &cert_chain) {
+void SQLiteDB::EnableWriteAheadLog() {
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "PRAGMA journal_mode=WAL;", NULL,
+                                   NULL, NULL));
+  // Still durable across application crashes, if not power loss.
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "PRAGMA synchronous=NORMAL;", NULL,
+                                   NULL, NULL));
+}
 
-  Statement statement(db_,
+SQLiteDB::WriteResult SQLiteDB::WriteEntries(
+    const std::vector<PreparedEntry> &entries) {
+  const bool own_transaction = sqlite3_get_autocommit(db_) != 0;
+  if (own_transaction)
+    BeginTransaction();
+  WriteResult result = Database::WriteEntries(entries);
+  if (own_transaction) {
+    if (result == this->WRITE_OK)
+      EndTransaction();
+    else
+      CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "ROLLBACK;", NULL, NULL, NULL));
+  }
+  return result;
+}
+
+SQLiteDB::WriteResult SQLiteDB::CreateEntry_(
+    const std::string &leaf, const std::string &leaf_hash,
+    const std::string &cert, const std::string &cert_chain,
+    const std::vector<string> &domains) {
+
+  Statement statement(statements_,
                       "INSERT INTO leaves(leaf, leaf_hash, cert, cert_chain) "
                       "VALUES(?, ?, ?, ?)");
 
@@ -78,6 +129,16 @@ SQLiteDB::WriteResult SQLiteDB::CreateEntry_(const std::string &leaf,
   if(statement.Step() != SQLITE_DONE)
     return this->WRITE_FAILED;
 
+  const sqlite3_int64 sequence = sqlite3_last_insert_rowid(db_);
+  for (size_t i = 0; i < domains.size(); ++i) {
+    Statement insert(statements_,
+                     "INSERT INTO domains(name, sequence) VALUES(?, ?)");
+    insert.BindText(0, domains[i]);
+    insert.BindUInt64(1, sequence);
+    if (insert.Step() != SQLITE_DONE)
+      return this->WRITE_FAILED;
+  }
+
   return this->WRITE_OK;
 }
 
@@ -85,7 +146,8 @@ SQLiteDB::WriteResult SQLiteDB::WriteSTH_(uint64_t timestamp,
                                           uint64_t tree_size,
                                           const std::string &sth) {
 
-  Statement statement(db_, "INSERT INTO trees(timestamp, tree_size, sth) "
+  Statement statement(statements_,
+                      "INSERT INTO trees(timestamp, tree_size, sth) "
                       "VALUES(?, ?, ?)");
 
   statement.BindUInt64(0, timestamp);
@@ -94,7 +156,8 @@ SQLiteDB::WriteResult SQLiteDB::WriteSTH_(uint64_t timestamp,
 
   int ret = statement.Step();
   if (ret == SQLITE_CONSTRAINT) {
-    Statement s2(db_, "SELECT timestamp FROM trees WHERE timestamp = ?");
+    Statement s2(statements_,
+                 "SELECT timestamp FROM trees WHERE timestamp = ?");
     s2.BindUInt64(0, timestamp);
     if(s2.Step() != SQLITE_ROW)
       return this->WRITE_FAILED;
@@ -109,7 +172,7 @@ SQLiteDB::WriteResult SQLiteDB::WriteSTH_(uint64_t timestamp,
 SQLiteDB::LookupResult SQLiteDB::LookupLatestWrittenSTH(
     ct::SignedTreeHead *result) const {
 
-  Statement statement(db_, "SELECT sth FROM trees WHERE id IN "
+  Statement statement(statements_, "SELECT sth FROM trees WHERE id IN "
                       "(SELECT MAX(id) FROM trees)");
 
   int ret = statement.Step();
@@ -124,10 +187,18 @@ SQLiteDB::LookupResult SQLiteDB::LookupLatestWrittenSTH(
   return this->LOOKUP_OK;
 }
 
+uint64_t SQLiteDB::EntryCount() const {
+  Statement statement(statements_,
+                      "SELECT IFNULL(MAX(sequence), 0) FROM leaves");
+  CHECK_EQ(SQLITE_ROW, statement.Step());
+  return statement.GetUInt64(0);
+}
+
 SQLiteDB::LookupResult SQLiteDB::LookupHashByIndex(uint64_t sequence_number,
                                                    std::string *result) const {
 
-  Statement statement(db_, "SELECT leaf_hash FROM leaves WHERE sequence = ?");
+  Statement statement(statements_,
+                      "SELECT leaf_hash FROM leaves WHERE sequence = ?");
 
   statement.BindUInt64(0, sequence_number);
   int ret = statement.Step();
@@ -139,11 +210,99 @@ SQLiteDB::LookupResult SQLiteDB::LookupHashByIndex(uint64_t sequence_number,
   return this->LOOKUP_OK;
 }
 
+SQLiteDB::LookupResult SQLiteDB::LookupHashRange(
+    uint64_t start, uint64_t end, std::vector<std::string> *result) const {
+  CHECK_NOTNULL(result);
+  if (start >= end)
+    return this->LOOKUP_OK;
+
+  Statement statement(statements_, "SELECT sequence, leaf_hash FROM leaves "
+                      "WHERE sequence >= ? AND sequence < ? "
+                      "ORDER BY sequence");
+  statement.BindUInt64(0, start);
+  statement.BindUInt64(1, end);
+
+  std::vector<string> range;
+  range.reserve(end - start);
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    if (statement.GetUInt64(0) != start + range.size())
+      return this->NOT_FOUND;
+    range.push_back(string());
+    statement.GetBlob(1, &range.back());
+  }
+  CHECK_EQ(SQLITE_DONE, ret);
+  if (range.size() != end - start)
+    return this->NOT_FOUND;
+
+  result->insert(result->end(), range.begin(), range.end());
+  return this->LOOKUP_OK;
+}
+
+SQLiteDB::LookupResult SQLiteDB::ScanHashRange(
+    uint64_t start, uint64_t end, HashCallback *callback) const {
+  CHECK_NOTNULL(callback);
+  if (start >= end)
+    return this->LOOKUP_OK;
+
+  // sequence is the rowid, so this walks the table's own b-tree in order.
+  Statement statement(statements_, "SELECT sequence, leaf_hash FROM leaves "
+                      "WHERE sequence >= ? AND sequence < ? "
+                      "ORDER BY sequence");
+  statement.BindUInt64(0, start);
+  statement.BindUInt64(1, end);
+
+  uint64_t next = start;
+  string hash;
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    if (statement.GetUInt64(0) != next)
+      return this->NOT_FOUND;
+    statement.GetBlob(1, &hash);
+    if (!callback->Hash(hash))
+      return this->LOOKUP_OK;
+    ++next;
+  }
+  CHECK_EQ(SQLITE_DONE, ret);
+  return next == end ? this->LOOKUP_OK : this->NOT_FOUND;
+}
+
+SQLiteDB::LookupResult SQLiteDB::LookupByDomain(
+    const string &domain, bool include_subdomains,
+    std::vector<uint64_t> *sequence_numbers) const {
+  CHECK_NOTNULL(sequence_numbers);
+  const string name(ReverseDomain(domain));
+  // The wildcard one label up covers |name| too.
+  const size_t dot = name.rfind('.');
+  const string wildcard(dot == string::npos ? name :
+                        name.substr(0, dot) + ".*");
+  // Names under |name| sort between "<name>." and "<name>/"; an empty
+  // range leaves them out.
+  const string lower(include_subdomains ? name + "." : name);
+  const string upper(include_subdomains ? name + "/" : name);
+
+  Statement statement(statements_, "SELECT DISTINCT sequence FROM domains "
+                      "WHERE name = ? OR name = ? OR "
+                      "(name >= ? AND name < ?) ORDER BY sequence");
+  statement.BindText(0, name);
+  statement.BindText(1, wildcard);
+  statement.BindText(2, lower);
+  statement.BindText(3, upper);
+
+  sequence_numbers->clear();
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW)
+    sequence_numbers->push_back(statement.GetUInt64(0));
+  CHECK_EQ(SQLITE_DONE, ret);
+  return this->LOOKUP_OK;
+}
+
 SQLiteDB::WriteResult SQLiteDB::SetVerificationLevel_(
     const ct::SignedTreeHead &sth,
     SQLiteDB::VerificationLevel verify_level) {
 
-  Statement statement(db_, "UPDATE trees SET valid = ? WHERE timestamp = ?");
+  Statement statement(statements_,
+                      "UPDATE trees SET valid = ? WHERE timestamp = ?");
   statement.BindUInt64(0, verify_level);
   statement.BindUInt64(1, sth.timestamp());
 
@@ -158,7 +317,7 @@ SQLiteDB::LookupResult SQLiteDB::LookupSTHByTimestamp(
     uint64_t timestamp,
     ct::SignedTreeHead *result) const {
 
-  Statement statement(db_, "SELECT sth FROM trees WHERE timestamp = ?");
+  Statement statement(statements_, "SELECT sth FROM trees WHERE timestamp = ?");
 
   statement.BindUInt64(0, timestamp);
 
@@ -175,6 +334,27 @@ SQLiteDB::LookupResult SQLiteDB::LookupSTHByTimestamp(
   return this->LOOKUP_OK;
 }
 
+SQLiteDB::LookupResult SQLiteDB::LookupSTHsBetween(
+    uint64_t after, uint64_t before,
+    std::vector<ct::SignedTreeHead> *result) const {
+  CHECK_NOTNULL(result);
+  Statement statement(statements_, "SELECT sth FROM trees WHERE "
+                      "timestamp > ? AND timestamp < ? ORDER BY timestamp");
+  statement.BindUInt64(0, after);
+  statement.BindUInt64(1, before);
+
+  result->clear();
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    string sth;
+    statement.GetBlob(0, &sth);
+    result->push_back(ct::SignedTreeHead());
+    CHECK(result->back().ParseFromString(sth));
+  }
+  CHECK_EQ(SQLITE_DONE, ret);
+  return this->LOOKUP_OK;
+}
+
 SQLiteDB::LookupResult SQLiteDB::LookupVerificationLevel(
     const ct::SignedTreeHead &sth,
     SQLiteDB::VerificationLevel *result) const {
@@ -195,4 +375,38 @@ SQLiteDB::LookupResult SQLiteDB::LookupVerificationLevel(
   return this->LOOKUP_OK;
 }
 
+SQLiteDB::WriteResult SQLiteDB::WriteCheckpoint(const ct::SignedTreeHead &sth,
+                                                const string &checkpoint) {
+  // Blobs are bound without a copy, so this has to outlive the statement.
+  const string serialized(sth.SerializeAsString());
+  Statement statement(statements_,
+                      "INSERT OR REPLACE INTO checkpoint(id, sth, tree) "
+                      "VALUES(0, ?, ?)");
+  statement.BindBlob(0, serialized);
+  statement.BindBlob(1, checkpoint);
+
+  if (statement.Step() != SQLITE_DONE)
+    return this->WRITE_FAILED;
+
+  return this->WRITE_OK;
+}
+
+SQLiteDB::LookupResult SQLiteDB::LookupCheckpoint(
+    ct::SignedTreeHead *sth, string *checkpoint) const {
+  Statement statement(statements_,
+                      "SELECT sth, tree FROM checkpoint WHERE id = 0");
+
+  int ret = statement.Step();
+  if (ret == SQLITE_DONE)
+    return this->NOT_FOUND;
+  CHECK_EQ(SQLITE_ROW, ret);
+
+  string serialized;
+  statement.GetBlob(0, &serialized);
+  CHECK(sth->ParseFromString(serialized));
+  statement.GetBlob(1, checkpoint);
+
+  return this->LOOKUP_OK;
+}
+
 } // namespace monitor
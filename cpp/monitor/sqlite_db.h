@@ -5,9 +5,14 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 struct sqlite3;
 
+namespace sqlite {
+class StatementCache;
+} // namespace sqlite
+
 namespace monitor {
 
 class SQLiteDB : public Database {
@@ -24,22 +29,53 @@ class SQLiteDB : public Database {
 
   void EndTransaction();
 
+  // Switch to write-ahead logging, which syncs once per checkpoint rather
+  // than once per transaction, and lets readers in while entries are
+  // written. The mode sticks to the database file.
+  void EnableWriteAheadLog();
+
+  virtual WriteResult WriteEntries(const std::vector<PreparedEntry> &entries);
+
   virtual LookupResult LookupLatestWrittenSTH(ct::SignedTreeHead *result) const;
 
+  virtual uint64_t EntryCount() const;
+
   virtual LookupResult LookupHashByIndex(uint64_t sequence_number,
                                          std::string *result) const;
 
+  virtual LookupResult LookupHashRange(uint64_t start, uint64_t end,
+                                       std::vector<std::string> *result) const;
+
+  virtual LookupResult ScanHashRange(uint64_t start, uint64_t end,
+                                     HashCallback *callback) const;
+
+  virtual LookupResult LookupByDomain(const std::string &domain,
+                                      bool include_subdomains,
+                                      std::vector<uint64_t> *sequence_numbers)
+      const;
+
   virtual LookupResult LookupSTHByTimestamp(uint64_t timestamp,
                                             ct::SignedTreeHead *result) const;
 
+  virtual LookupResult LookupSTHsBetween(
+      uint64_t after, uint64_t before,
+      std::vector<ct::SignedTreeHead> *result) const;
+
   virtual LookupResult LookupVerificationLevel(const ct::SignedTreeHead &sth,
                                                VerificationLevel *result) const;
 
+  virtual WriteResult WriteCheckpoint(const ct::SignedTreeHead &sth,
+                                      const std::string &checkpoint);
+
+  virtual LookupResult LookupCheckpoint(ct::SignedTreeHead *sth,
+                                        std::string *checkpoint) const;
+
  private:
   virtual WriteResult CreateEntry_(const std::string &leaf,
                                    const std::string &leaf_hash,
                                    const std::string &cert,
-                                   const std::string &cert_chain);
+                                   const std::string &cert_chain,
+                                   const std::vector<std::string> &domains);
 
   virtual WriteResult WriteSTH_(uint64_t timestamp, uint64_t tree_size,
                                 const std::string &sth);
@@ -47,7 +83,12 @@ class SQLiteDB : public Database {
   virtual WriteResult SetVerificationLevel_(const ct::SignedTreeHead &sth,
                                             VerificationLevel verify_level);
 
+  // Create the tables that databases from older versions lack.
+  void CreateMissingTables();
+
   sqlite3 *db_;
+  // Prepared statements, reused across calls.
+  sqlite::StatementCache *statements_;
 };
 
 } // namespace monitor
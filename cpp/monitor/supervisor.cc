@@ -0,0 +1,130 @@
+#include "monitor/supervisor.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <glog/logging.h>
+
+using std::string;
+
+namespace monitor {
+
+Supervisor::Supervisor(size_t threads, uint64_t min_interval_secs,
+                       uint64_t max_interval_secs, uint64_t step_entries)
+    : threads_(threads),
+      min_interval_(min_interval_secs),
+      max_interval_(max_interval_secs),
+      step_entries_(step_entries) {
+  CHECK_GT(threads_, 0U);
+  CHECK_GT(min_interval_, 0U);
+  CHECK_GE(max_interval_, min_interval_);
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+  CHECK_EQ(0, pthread_cond_init(&changed_, NULL));
+}
+
+Supervisor::~Supervisor() {
+  for (size_t i = 0; i < logs_.size(); ++i)
+    delete logs_[i].monitor;
+  CHECK_EQ(0, pthread_cond_destroy(&changed_));
+  CHECK_EQ(0, pthread_mutex_destroy(&mutex_));
+}
+
+void Supervisor::Add(const string &name, Monitor *monitor) {
+  Log log;
+  log.name = name;
+  log.monitor = CHECK_NOTNULL(monitor);
+  log.due = 0;
+  log.interval = min_interval_;
+  log.updated = 0;
+  log.cadence = 0;
+  log.busy = false;
+  logs_.push_back(log);
+}
+
+void Supervisor::Run() {
+  CHECK(!logs_.empty());
+  for (size_t i = 0; i < logs_.size(); ++i)
+    logs_[i].monitor->Start();
+
+  // More threads than logs would only wait.
+  std::vector<pthread_t> threads(std::min(threads_, logs_.size()));
+  for (size_t i = 0; i < threads.size(); ++i)
+    CHECK_EQ(0, pthread_create(&threads[i], NULL, WorkerThread, this));
+  for (size_t i = 0; i < threads.size(); ++i)
+    CHECK_EQ(0, pthread_join(threads[i], NULL));
+}
+
+// static
+void *Supervisor::WorkerThread(void *arg) {
+  static_cast<Supervisor*>(arg)->Work();
+  return NULL;
+}
+
+void Supervisor::Work() {
+  CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+  for (;;) {
+    Log *log = NextDue();
+
+    CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+    VLOG(1) << "Checking " << log->name;
+    const Monitor::StepResult result = log->monitor->Step(step_entries_);
+    CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+
+    Reschedule(log, result, time(NULL));
+    log->busy = false;
+    CHECK_EQ(0, pthread_cond_broadcast(&changed_));
+  }
+}
+
+Supervisor::Log *Supervisor::NextDue() {
+  for (;;) {
+    Log *next = NULL;
+    for (size_t i = 0; i < logs_.size(); ++i)
+      if (!logs_[i].busy && (next == NULL || logs_[i].due < next->due))
+        next = &logs_[i];
+
+    if (next == NULL) {
+      CHECK_EQ(0, pthread_cond_wait(&changed_, &mutex_));
+      continue;
+    }
+    if (next->due <= time(NULL)) {
+      next->busy = true;
+      return next;
+    }
+
+    // Until it is due, or another log is rescheduled.
+    struct timespec due;
+    due.tv_sec = next->due;
+    due.tv_nsec = 0;
+    const int ret = pthread_cond_timedwait(&changed_, &mutex_, &due);
+    CHECK(ret == 0 || ret == ETIMEDOUT) << ret;
+  }
+}
+
+void Supervisor::Reschedule(Log *log, Monitor::StepResult result,
+                            time_t now) {
+  switch (result) {
+    case Monitor::UPDATED:
+      if (log->updated > 0) {
+        const uint64_t seen = now - log->updated;
+        log->cadence = log->cadence == 0 ? seen
+            : (3 * log->cadence + seen) / 4;
+      }
+      log->updated = now;
+      log->interval = std::max(min_interval_,
+                               std::min(max_interval_, log->cadence / 2));
+      break;
+    case Monitor::BACKLOG:
+      // Behind the logs due already, as |now| is later than their time.
+      log->due = now;
+      LOG(INFO) << log->name << " has a backlog, continuing";
+      return;
+    case Monitor::UNCHANGED:
+    case Monitor::FAILED:
+      log->interval = std::min(max_interval_, 2 * log->interval);
+      break;
+  }
+  log->due = now + log->interval;
+  VLOG(1) << log->name << " next checked in " << log->interval << "s";
+}
+
+}  // namespace monitor
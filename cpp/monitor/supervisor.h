@@ -0,0 +1,79 @@
+#ifndef MONITOR_SUPERVISOR_H
+#define MONITOR_SUPERVISOR_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "monitor/monitor.h"
+
+namespace monitor {
+
+// Runs the monitors of many logs in one process. A shared pool of threads
+// takes turns stepping the monitors whose time has come, so the number of
+// logs being fetched, hashed and written at once, and with it the number
+// of connections, hashing threads and database writers, is bounded by the
+// pool rather than by the number of logs.
+//
+// Each log is checked about twice per interval at which it has been seen
+// to publish new STHs, within [min_interval, max_interval]; quiet or
+// failing logs are checked half as often each time, up to max_interval.
+// A log with a backlog of entries comes back as soon as a thread is free,
+// after the logs that were due before it, so that one large log can't
+// starve the others.
+class Supervisor {
+ public:
+  // Fetches at most |step_entries| entries per step, or all if 0.
+  Supervisor(size_t threads, uint64_t min_interval_secs,
+             uint64_t max_interval_secs, uint64_t step_entries);
+  ~Supervisor();
+
+  // Add a log, as monitored by |monitor|, which Init() has run on once.
+  // Takes ownership of |monitor|. Must not be called after Run().
+  void Add(const std::string &name, Monitor *monitor);
+
+  // Run the monitors, forever.
+  void Run();
+
+ private:
+  struct Log {
+    std::string name;
+    Monitor *monitor;
+    // When to step next.
+    time_t due;
+    // Seconds between checks, when the log is quiet.
+    uint64_t interval;
+    // When we saw the last new STH, or 0.
+    time_t updated;
+    // Average seconds between new STHs, or 0 if unknown.
+    uint64_t cadence;
+    // Whether a thread is stepping it.
+    bool busy;
+  };
+
+  static void *WorkerThread(void *arg);
+
+  void Work();
+
+  // Wait for a log to be due, mark it busy and return it. Call with
+  // |mutex_| held.
+  Log *NextDue();
+
+  // Decide when to step |log| next, after a step returned |result|.
+  void Reschedule(Log *log, Monitor::StepResult result, time_t now);
+
+  const size_t threads_;
+  const uint64_t min_interval_;
+  const uint64_t max_interval_;
+  const uint64_t step_entries_;
+
+  pthread_mutex_t mutex_;
+  pthread_cond_t changed_;
+  std::vector<Log> logs_;
+};
+
+}  // namespace monitor
+
+#endif  // MONITOR_SUPERVISOR_H
@@ -8,7 +8,7 @@ template <> void TestDB<monitor::SQLiteDB>::Setup() {
   db_ = new monitor::SQLiteDB(tmp_.TmpStorageDir() + "/sqlite");
 }
 
-template <> monitor::SQLiteDB *TestDB<monitor::SQLiteDB>::SecondDB() const {
+template <> monitor::SQLiteDB *TestDB<monitor::SQLiteDB>::SecondDB() {
   return new monitor::SQLiteDB(tmp_.TmpStorageDir() + "/sqlite");
 }
 
@@ -7,6 +7,7 @@
 
 #include "include/types.h"
 #include "proto/ct.pb.h"
+#include "proto/tls_encoding.h"
 
 using ct::DigitallySigned;
 using ct::DigitallySigned_HashAlgorithm_IsValid;
@@ -20,22 +21,77 @@ using ct::Version_IsValid;
 using ct::X509ChainEntry;
 using std::string;
 
-const size_t Serializer::kMaxCertificateLength = (1 << 24) - 1;
-const size_t Serializer::kMaxCertificateChainLength = (1 << 24) - 1;
-const size_t Serializer::kMaxSignatureLength = (1 << 16) - 1;
-const size_t Serializer::kMaxExtensionsLength = (1 << 16) - 1;
-const size_t Serializer::kMaxSerializedSCTLength = (1 << 16) - 1;
-const size_t Serializer::kMaxSCTListLength = (1 << 16) - 1;
-
-const size_t Serializer::kLogEntryTypeLengthInBytes = 2;
-const size_t Serializer::kSignatureTypeLengthInBytes = 1;
-const size_t Serializer::kHashAlgorithmLengthInBytes = 1;
-const size_t Serializer::kSigAlgorithmLengthInBytes = 1;
-const size_t Serializer::kVersionLengthInBytes = 1;
-const size_t Serializer::kKeyIDLengthInBytes = 32;
-const size_t Serializer::kMerkleLeafTypeLengthInBytes = 1;
-const size_t Serializer::kKeyHashLengthInBytes = 32;
-const size_t Serializer::kTimestampLengthInBytes = 8;
+namespace {
+
+// The fields of the RFC 6962 structures.
+typedef tls::Uint<1> Version;
+typedef tls::Uint<1> SignatureType;
+typedef tls::Uint<1> MerkleLeafType;
+typedef tls::Uint<1> HashAlgorithm;
+typedef tls::Uint<1> SignatureAlgorithm;
+typedef tls::Uint<2> LogEntryType;
+typedef tls::Uint<8> Timestamp;
+typedef tls::Uint<8> TreeSize;
+typedef tls::FixedBytes<32> LogID;
+typedef tls::FixedBytes<32> IssuerKeyHash;
+typedef tls::FixedBytes<32> RootHash;
+typedef tls::VarBytes<(1 << 24) - 1> ASN1Cert;
+typedef tls::VarBytes<(1 << 24) - 1> ASN1CertList;
+typedef tls::VarBytes<(1 << 16) - 1> CtExtensions;
+typedef tls::VarBytes<(1 << 16) - 1> Signature;
+typedef tls::VarBytes<(1 << 16) - 1> SerializedSCT;
+typedef tls::VarBytes<(1 << 16) - 1> SCTList;
+
+// The SCT signature input over an X.509 entry (section 3.2). A
+// MerkleTreeLeaf (section 3.4) is laid out the same, with the leaf type in
+// place of the signature type.
+typedef tls::FixedLength<Version, SignatureType, Timestamp, LogEntryType,
+                         ASN1Cert, CtExtensions> V1CertEntry;
+
+// As above, over a precert entry.
+typedef tls::FixedLength<Version, SignatureType, Timestamp, LogEntryType,
+                         IssuerKeyHash, ASN1Cert, CtExtensions>
+    V1PrecertEntry;
+
+// The STH signature input (section 3.5).
+typedef tls::FixedLength<Version, SignatureType, Timestamp, TreeSize,
+                         RootHash> V1TreeHead;
+
+// DigitallySigned (RFC 5246 section 4.7).
+typedef tls::FixedLength<HashAlgorithm, SignatureAlgorithm, Signature>
+    DigitallySignedStruct;
+
+// SignedCertificateTimestamp (section 3.2).
+typedef tls::FixedLength<Version, LogID, Timestamp, CtExtensions,
+                         HashAlgorithm, SignatureAlgorithm, Signature>
+    V1SCT;
+
+// Sizes |result| to exactly |length| bytes, and returns where they start.
+char *SizeOutput(size_t length, string *result) {
+  result->resize(length);
+  return &(*result)[0];
+}
+
+}  // namespace
+
+const size_t Serializer::kMaxCertificateLength = ASN1Cert::kMax;
+const size_t Serializer::kMaxCertificateChainLength = ASN1CertList::kMax;
+const size_t Serializer::kMaxSignatureLength = Signature::kMax;
+const size_t Serializer::kMaxExtensionsLength = CtExtensions::kMax;
+const size_t Serializer::kMaxSerializedSCTLength = SerializedSCT::kMax;
+const size_t Serializer::kMaxSCTListLength = SCTList::kMax;
+
+const size_t Serializer::kLogEntryTypeLengthInBytes = LogEntryType::kLength;
+const size_t Serializer::kSignatureTypeLengthInBytes = SignatureType::kLength;
+const size_t Serializer::kHashAlgorithmLengthInBytes = HashAlgorithm::kLength;
+const size_t Serializer::kSigAlgorithmLengthInBytes =
+    SignatureAlgorithm::kLength;
+const size_t Serializer::kVersionLengthInBytes = Version::kLength;
+const size_t Serializer::kKeyIDLengthInBytes = LogID::kLength;
+const size_t Serializer::kMerkleLeafTypeLengthInBytes =
+    MerkleLeafType::kLength;
+const size_t Serializer::kKeyHashLengthInBytes = IssuerKeyHash::kLength;
+const size_t Serializer::kTimestampLengthInBytes = Timestamp::kLength;
 
 // static
 // Returns the number of bytes needed to store a value up to max_length.
@@ -84,14 +140,8 @@ Serializer::SerializeV1CertSCTSignatureInput(
   res = CheckExtensionsFormat(extensions);
   if (res != OK)
     return res;
-  Serializer serializer;
-  serializer.WriteUint(ct::V1, kVersionLengthInBytes);
-  serializer.WriteUint(ct::CERTIFICATE_TIMESTAMP, kSignatureTypeLengthInBytes);
-  serializer.WriteUint(timestamp, kTimestampLengthInBytes);
-  serializer.WriteUint(ct::X509_ENTRY, kLogEntryTypeLengthInBytes);
-  serializer.WriteVarBytes(certificate, kMaxCertificateLength);
-  serializer.WriteVarBytes(extensions, kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  WriteV1CertEntry(ct::CERTIFICATE_TIMESTAMP, timestamp, certificate,
+                   extensions, result);
   return OK;
 }
 
@@ -109,15 +159,8 @@ Serializer::SerializeV1PrecertSCTSignatureInput(
   res = CheckExtensionsFormat(extensions);
   if (res != OK)
     return res;
-  Serializer serializer;
-  serializer.WriteUint(ct::V1, kVersionLengthInBytes);
-  serializer.WriteUint(ct::CERTIFICATE_TIMESTAMP, kSignatureTypeLengthInBytes);
-  serializer.WriteUint(timestamp, kTimestampLengthInBytes);
-  serializer.WriteUint(ct::PRECERT_ENTRY, kLogEntryTypeLengthInBytes);
-  serializer.WriteFixedBytes(issuer_key_hash);
-  serializer.WriteVarBytes(tbs_certificate, kMaxCertificateLength);
-  serializer.WriteVarBytes(extensions, kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  WriteV1PrecertEntry(ct::CERTIFICATE_TIMESTAMP, timestamp, issuer_key_hash,
+                      tbs_certificate, extensions, result);
   return OK;
 }
 
@@ -153,14 +196,8 @@ Serializer::SerializeResult Serializer::SerializeV1CertSCTMerkleTreeLeaf(
   res = CheckExtensionsFormat(extensions);
   if (res != OK)
     return res;
-  Serializer serializer;
-  serializer.WriteUint(ct::V1, kVersionLengthInBytes);
-  serializer.WriteUint(ct::TIMESTAMPED_ENTRY, kMerkleLeafTypeLengthInBytes);
-  serializer.WriteUint(timestamp, kTimestampLengthInBytes);
-  serializer.WriteUint(ct::X509_ENTRY, kLogEntryTypeLengthInBytes);
-  serializer.WriteVarBytes(certificate, kMaxCertificateLength);
-  serializer.WriteVarBytes(extensions, kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  WriteV1CertEntry(ct::TIMESTAMPED_ENTRY, timestamp, certificate, extensions,
+                   result);
   return OK;
 }
 
@@ -177,15 +214,8 @@ Serializer::SerializeResult Serializer::SerializeV1PrecertSCTMerkleTreeLeaf(
   res = CheckExtensionsFormat(extensions);
   if (res != OK)
     return res;
-  Serializer serializer;
-  serializer.WriteUint(ct::V1, kVersionLengthInBytes);
-  serializer.WriteUint(ct::TIMESTAMPED_ENTRY, kMerkleLeafTypeLengthInBytes);
-  serializer.WriteUint(timestamp, kTimestampLengthInBytes);
-  serializer.WriteUint(ct::PRECERT_ENTRY, kLogEntryTypeLengthInBytes);
-  serializer.WriteFixedBytes(issuer_key_hash);
-  serializer.WriteVarBytes(tbs_certificate, kMaxCertificateLength);
-  serializer.WriteVarBytes(extensions, kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  WriteV1PrecertEntry(ct::TIMESTAMPED_ENTRY, timestamp, issuer_key_hash,
+                      tbs_certificate, extensions, result);
   return OK;
 }
 
@@ -215,15 +245,15 @@ Serializer::SerializeResult Serializer::SerializeSCTMerkleTreeLeaf(
 Serializer::SerializeResult Serializer::SerializeV1STHSignatureInput(
     uint64_t timestamp, uint64_t tree_size,
     const string &root_hash, string *result) {
-  if (root_hash.size() != 32)
+  if (root_hash.size() != RootHash::kLength)
     return INVALID_HASH_LENGTH;
-  Serializer serializer;
-  serializer.WriteUint(ct::V1, kVersionLengthInBytes);
-  serializer.WriteUint(ct::TREE_HEAD, kSignatureTypeLengthInBytes);
-  serializer.WriteUint(timestamp, kTimestampLengthInBytes);
-  serializer.WriteUint(tree_size, 8);
-  serializer.WriteFixedBytes(root_hash);
-  result->assign(serializer.SerializedString());
+  char *out = SizeOutput(V1TreeHead::value, result);
+  out = Version::Write(ct::V1, out);
+  out = SignatureType::Write(ct::TREE_HEAD, out);
+  out = Timestamp::Write(timestamp, out);
+  out = TreeSize::Write(tree_size, out);
+  out = RootHash::Write(root_hash, out);
+  DCHECK_EQ(result->data() + result->size(), out);
   return OK;
 }
 
@@ -256,11 +286,27 @@ Serializer::WriteSCT(const SignedCertificateTimestamp &sct) {
 // static
 Serializer::SerializeResult Serializer::SerializeSCT(
     const SignedCertificateTimestamp &sct, string *result) {
-  Serializer serializer;
-  SerializeResult res = serializer.WriteSCT(sct);
+  if (sct.version() != ct::V1)
+    return UNSUPPORTED_VERSION;
+  SerializeResult res = CheckExtensionsFormat(sct.extensions());
   if (res != OK)
     return res;
-  result->assign(serializer.SerializedString());
+  if (sct.id().key_id().size() != kKeyIDLengthInBytes)
+    return INVALID_KEYID_LENGTH;
+  const DigitallySigned &sig = sct.signature();
+  res = CheckSignatureFormat(sig);
+  if (res != OK)
+    return res;
+  char *out = SizeOutput(V1SCT::value + sct.extensions().size() +
+                         sig.signature().size(), result);
+  out = Version::Write(ct::V1, out);
+  out = LogID::Write(sct.id().key_id(), out);
+  out = Timestamp::Write(sct.timestamp(), out);
+  out = CtExtensions::Write(sct.extensions(), out);
+  out = HashAlgorithm::Write(sig.hash_algorithm(), out);
+  out = SignatureAlgorithm::Write(sig.sig_algorithm(), out);
+  out = Signature::Write(sig.signature(), out);
+  DCHECK_EQ(result->data() + result->size(), out);
   return OK;
 }
 
@@ -319,11 +365,15 @@ Serializer::SerializeResult Serializer::SerializePrecertChainEntry(
 Serializer::SerializeResult
 Serializer::SerializeDigitallySigned(const DigitallySigned &sig,
                                      string *result) {
-  Serializer serializer;
-  SerializeResult res = serializer.WriteDigitallySigned(sig);
+  SerializeResult res = CheckSignatureFormat(sig);
   if (res != OK)
     return res;
-  result->assign(serializer.SerializedString());
+  char *out = SizeOutput(DigitallySignedStruct::value +
+                         sig.signature().size(), result);
+  out = HashAlgorithm::Write(sig.hash_algorithm(), out);
+  out = SignatureAlgorithm::Write(sig.sig_algorithm(), out);
+  out = Signature::Write(sig.signature(), out);
+  DCHECK_EQ(result->data() + result->size(), out);
   return OK;
 }
 
@@ -350,10 +400,11 @@ Serializer::SerializeResult Serializer::SerializeV1SignedCertEntryWithType(
   SerializeResult res = CheckCertificateFormat(leaf_certificate);
   if (res != OK)
     return res;
-  Serializer serializer;
-  serializer.WriteUint(ct::X509_ENTRY, kLogEntryTypeLengthInBytes);
-  serializer.WriteVarBytes(leaf_certificate, kMaxCertificateLength);
-  result->assign(serializer.SerializedString());
+  char *out = SizeOutput(tls::FixedLength<LogEntryType, ASN1Cert>::value +
+                         leaf_certificate.size(), result);
+  out = LogEntryType::Write(ct::X509_ENTRY, out);
+  out = ASN1Cert::Write(leaf_certificate, out);
+  DCHECK_EQ(result->data() + result->size(), out);
   return OK;
 }
 
@@ -367,16 +418,18 @@ Serializer::SerializeResult Serializer::SerializeV1SignedPrecertEntryWithType(
   res = CheckKeyHashFormat(issuer_key_hash);
   if (res != OK)
     return res;
-  Serializer serializer;
-  serializer.WriteUint(ct::PRECERT_ENTRY, kLogEntryTypeLengthInBytes);
-  serializer.WriteFixedBytes(issuer_key_hash);
-  serializer.WriteVarBytes(tbs_certificate, kMaxCertificateLength);
-  result->assign(serializer.SerializedString());
+  char *out = SizeOutput(tls::FixedLength<LogEntryType, IssuerKeyHash,
+                                          ASN1Cert>::value +
+                         tbs_certificate.size(), result);
+  out = LogEntryType::Write(ct::PRECERT_ENTRY, out);
+  out = IssuerKeyHash::Write(issuer_key_hash, out);
+  out = ASN1Cert::Write(tbs_certificate, out);
+  DCHECK_EQ(result->data() + result->size(), out);
   return OK;
 }
 
 void Serializer::WriteFixedBytes(const string &in) {
-  output_.append(in);
+  output_->append(in);
 }
 
 void Serializer::WriteVarBytes(const string &in, size_t max_length) {
@@ -387,6 +440,40 @@ void Serializer::WriteVarBytes(const string &in, size_t max_length) {
   WriteFixedBytes(in);
 }
 
+// static
+void Serializer::WriteV1CertEntry(int type, uint64_t timestamp,
+                                  const string &certificate,
+                                  const string &extensions, string *result) {
+  char *out = SizeOutput(V1CertEntry::value + certificate.size() +
+                         extensions.size(), result);
+  out = Version::Write(ct::V1, out);
+  // The signature type and the Merkle leaf type have the same length.
+  out = SignatureType::Write(type, out);
+  out = Timestamp::Write(timestamp, out);
+  out = LogEntryType::Write(ct::X509_ENTRY, out);
+  out = ASN1Cert::Write(certificate, out);
+  out = CtExtensions::Write(extensions, out);
+  DCHECK_EQ(result->data() + result->size(), out);
+}
+
+// static
+void Serializer::WriteV1PrecertEntry(int type, uint64_t timestamp,
+                                     const string &issuer_key_hash,
+                                     const string &tbs_certificate,
+                                     const string &extensions,
+                                     string *result) {
+  char *out = SizeOutput(V1PrecertEntry::value + tbs_certificate.size() +
+                         extensions.size(), result);
+  out = Version::Write(ct::V1, out);
+  out = SignatureType::Write(type, out);
+  out = Timestamp::Write(timestamp, out);
+  out = LogEntryType::Write(ct::PRECERT_ENTRY, out);
+  out = IssuerKeyHash::Write(issuer_key_hash, out);
+  out = ASN1Cert::Write(tbs_certificate, out);
+  out = CtExtensions::Write(extensions, out);
+  DCHECK_EQ(result->data() + result->size(), out);
+}
+
 // static
 size_t Serializer::SerializedListLength(const repeated_string &in,
                                         size_t max_elem_length,
@@ -528,24 +615,27 @@ Deserializer::Deserializer(const string &input)
     : current_pos_(input.data()),
     bytes_remaining_(input.size()) {}
 
+Deserializer::Deserializer(const ByteView &input)
+    : current_pos_(input.data),
+    bytes_remaining_(input.size) {}
+
 Deserializer::DeserializeResult Deserializer::ReadSCT(
     SignedCertificateTimestamp *sct) {
   int version;
-  if (!ReadUint(Serializer::kVersionLengthInBytes, &version))
+  if (!Read<Version>(&version))
     return INPUT_TOO_SHORT;
   if (!Version_IsValid(version) || version != ct::V1)
     return UNSUPPORTED_VERSION;
   sct->set_version(ct::V1);
-  if (!ReadFixedBytes(Serializer::kKeyIDLengthInBytes,
-                      sct->mutable_id()->mutable_key_id()))
+  if (!Read<LogID>(sct->mutable_id()->mutable_key_id()))
     return INPUT_TOO_SHORT;
   // V1 encoding.
   uint64_t timestamp = 0;
-  if (!ReadUint(Serializer::kTimestampLengthInBytes, &timestamp))
+  if (!Read<Timestamp>(&timestamp))
     return INPUT_TOO_SHORT;
   sct->set_timestamp(timestamp);
-  string extensions;
-  if (!ReadVarBytes(Serializer::kMaxExtensionsLength, &extensions))
+  ByteView extensions;
+  if (!Read<CtExtensions>(&extensions))
     // In theory, could also be an invalid length prefix, but not if
     // length limits follow byte boundaries.
     return INPUT_TOO_SHORT;
@@ -564,6 +654,18 @@ Deserializer::DeserializeResult Deserializer::DeserializeSCT(
   return OK;
 }
 
+// static
+Deserializer::DeserializeResult Deserializer::DeserializeSCT(
+    const ByteView &in, SignedCertificateTimestamp *sct) {
+  Deserializer deserializer(in);
+  DeserializeResult res = deserializer.ReadSCT(sct);
+  if (res != OK)
+    return res;
+  if (!deserializer.ReachedEnd())
+    return INPUT_TOO_LONG;
+  return OK;
+}
+
 // static
 Deserializer::DeserializeResult Deserializer::DeserializeSCTList(
     const string &in, SignedCertificateTimestampList *sct_list) {
@@ -578,6 +680,20 @@ Deserializer::DeserializeResult Deserializer::DeserializeSCTList(
   return OK;
 }
 
+// static
+Deserializer::DeserializeResult Deserializer::DeserializeSCTList(
+    const string &in, std::vector<ByteView> *scts) {
+  scts->clear();
+  DeserializeResult res = DeserializeList(
+      in, Serializer::kMaxSCTListLength, Serializer::kMaxSerializedSCTLength,
+      scts);
+  if (res != OK)
+    return res;
+  if (scts->empty())
+    return EMPTY_LIST;
+  return OK;
+}
+
 // static
 Deserializer::DeserializeResult
 Deserializer::DeserializeDigitallySigned(const string &in,
@@ -602,6 +718,15 @@ Deserializer::DeserializeX509Chain(const std::string &in,
                          x509_chain_entry->mutable_certificate_chain());
 }
 
+// static
+Deserializer::DeserializeResult
+Deserializer::DeserializeX509Chain(const std::string &in,
+                                   std::vector<ByteView> *chain) {
+  chain->clear();
+  return DeserializeList(in, Serializer::kMaxCertificateChainLength,
+                         Serializer::kMaxCertificateLength, chain);
+}
+
 // static
 Deserializer::DeserializeResult Deserializer::DeserializePrecertChainEntry(
     const std::string &in, ct::PrecertChainEntry *precert_chain_entry) {
@@ -620,15 +745,23 @@ Deserializer::DeserializeResult Deserializer::DeserializePrecertChainEntry(
   return OK;
 }
 
-bool Deserializer::ReadFixedBytes(size_t bytes, string *result) {
+bool Deserializer::ReadFixedBytes(size_t bytes, ByteView *result) {
   if (bytes_remaining_ < bytes)
     return false;
-  result->assign(current_pos_, bytes);
+  *result = ByteView(current_pos_, bytes);
   current_pos_ += bytes;
   bytes_remaining_ -= bytes;
   return true;
 }
 
+bool Deserializer::ReadFixedBytes(size_t bytes, string *result) {
+  ByteView view;
+  if (!ReadFixedBytes(bytes, &view))
+    return false;
+  result->assign(view.data, view.size);
+  return true;
+}
+
 bool Deserializer::ReadLengthPrefix(size_t max_length, size_t *result) {
   size_t prefix_length = Serializer::PrefixLength(max_length);
   size_t length;
@@ -638,8 +771,14 @@ bool Deserializer::ReadLengthPrefix(size_t max_length, size_t *result) {
   return true;
 }
 
-bool Deserializer::ReadVarBytes(size_t max_length, string *result) {
+bool Deserializer::ReadVarBytes(size_t max_length, ByteView *result) {
+  size_t length;
+  if (!ReadLengthPrefix(max_length, &length))
+    return false;
+  return ReadFixedBytes(length, result);
+}
 
+bool Deserializer::ReadVarBytes(size_t max_length, string *result) {
   size_t length;
   if (!ReadLengthPrefix(max_length, &length))
     return false;
@@ -660,10 +799,36 @@ Deserializer::DeserializeResult Deserializer::DeserializeList(
   return OK;
 }
 
+// static
+Deserializer::DeserializeResult Deserializer::DeserializeList(
+    const string &in, size_t max_total_length, size_t max_elem_length,
+    std::vector<ByteView> *out) {
+  Deserializer deserializer(in);
+  DeserializeResult res = deserializer.ReadList(max_total_length,
+                                                max_elem_length, out);
+  if (res != OK)
+    return res;
+  if (!deserializer.ReachedEnd())
+    return INPUT_TOO_LONG;
+  return OK;
+}
+
 Deserializer::DeserializeResult Deserializer::ReadList(
     size_t max_total_length, size_t max_elem_length,
     repeated_string *out) {
-  string serialized_list;
+  std::vector<ByteView> elems;
+  DeserializeResult res = ReadList(max_total_length, max_elem_length, &elems);
+  // Like the views, copy out what there was up to any error.
+  out->Reserve(out->size() + elems.size());
+  for (size_t i = 0; i < elems.size(); ++i)
+    out->Add()->assign(elems[i].data, elems[i].size);
+  return res;
+}
+
+Deserializer::DeserializeResult Deserializer::ReadList(
+    size_t max_total_length, size_t max_elem_length,
+    std::vector<ByteView> *out) {
+  ByteView serialized_list;
   if (!ReadVarBytes(max_total_length, &serialized_list))
     // TODO(ekasper): could also be a length that's too large, if
     // length limits don't follow byte boundaries.
@@ -673,12 +838,12 @@ Deserializer::DeserializeResult Deserializer::ReadList(
 
   Deserializer list_reader(serialized_list);
   while (!list_reader.ReachedEnd()) {
-    string elem;
+    ByteView elem;
     if (!list_reader.ReadVarBytes(max_elem_length, &elem))
       return INVALID_LIST_ENCODING;
-    if (elem.empty())
+    if (elem.size == 0)
       return EMPTY_ELEM_IN_LIST;
-    *(out->Add()) = elem;
+    out->push_back(elem);
   }
   return OK;
 }
@@ -686,37 +851,37 @@ Deserializer::DeserializeResult Deserializer::ReadList(
 Deserializer::DeserializeResult
 Deserializer::ReadDigitallySigned(DigitallySigned *sig) {
   int hash_algo = -1, sig_algo = -1;
-  if (!ReadUint(Serializer::kHashAlgorithmLengthInBytes, &hash_algo))
+  if (!Read<HashAlgorithm>(&hash_algo))
     return INPUT_TOO_SHORT;
   if (!DigitallySigned_HashAlgorithm_IsValid(hash_algo))
     return INVALID_HASH_ALGORITHM;
-  if (!ReadUint(Serializer::kSigAlgorithmLengthInBytes, &sig_algo))
+  if (!Read<SignatureAlgorithm>(&sig_algo))
     return INPUT_TOO_SHORT;
   if (!DigitallySigned_SignatureAlgorithm_IsValid(sig_algo))
     return INVALID_SIGNATURE_ALGORITHM;
 
-  string sig_string;
-  if (!ReadVarBytes(Serializer::kMaxSignatureLength, &sig_string))
+  ByteView sig_string;
+  if (!Read<Signature>(&sig_string))
     return INPUT_TOO_SHORT;
   sig->set_hash_algorithm(
       static_cast<DigitallySigned::HashAlgorithm>(hash_algo));
   sig->set_sig_algorithm(
       static_cast<DigitallySigned::SignatureAlgorithm>(sig_algo));
-  sig->set_signature(sig_string);
+  sig->set_signature(sig_string.data, sig_string.size);
   return OK;
 }
 
 Deserializer::DeserializeResult
 Deserializer::ReadMerkleTreeLeaf(ct::MerkleTreeLeaf *leaf) {
   int version;
-  if (!ReadUint(Serializer::kVersionLengthInBytes, &version))
+  if (!Read<Version>(&version))
     return INPUT_TOO_SHORT;
   if (!Version_IsValid(version) || version != ct::V1)
     return UNSUPPORTED_VERSION;
   leaf->set_version(ct::V1);
 
   int type;
-  if (!ReadUint(Serializer::kMerkleLeafTypeLengthInBytes, &type))
+  if (!Read<MerkleLeafType>(&type))
     return INPUT_TOO_SHORT;
   if (type != ct::TIMESTAMPED_ENTRY)
     return UNKNOWN_LEAF_TYPE;
@@ -725,39 +890,31 @@ Deserializer::ReadMerkleTreeLeaf(ct::MerkleTreeLeaf *leaf) {
   ct::TimestampedEntry *entry = leaf->mutable_timestamped_entry();
 
   uint64_t timestamp;
-  if (!ReadUint(Serializer::kTimestampLengthInBytes, &timestamp))
+  if (!Read<Timestamp>(&timestamp))
     return INPUT_TOO_SHORT;
   entry->set_timestamp(timestamp);
 
   int entry_type;
-  if (!ReadUint(Serializer::kLogEntryTypeLengthInBytes, &entry_type))
+  if (!Read<LogEntryType>(&entry_type))
     return INPUT_TOO_SHORT;
   if (entry_type != ct::X509_ENTRY && entry_type != ct::PRECERT_ENTRY)
     return UNKNOWN_LOGENTRY_TYPE;
   entry->set_entry_type(static_cast<ct::LogEntryType>(entry_type));
 
+  // Read straight into the fields.
   if (entry_type == ct::X509_ENTRY) {
-    string x509;
-    if (!ReadVarBytes(Serializer::kMaxCertificateLength, &x509))
+    if (!Read<ASN1Cert>(entry->mutable_signed_entry()->mutable_x509()))
       return INPUT_TOO_SHORT;
-    entry->mutable_signed_entry()->set_x509(x509);
   } else {
-    string issuer_key_hash;
-    if (!ReadFixedBytes(32, &issuer_key_hash))
+    ct::PreCert *precert = entry->mutable_signed_entry()->mutable_precert();
+    if (!Read<IssuerKeyHash>(precert->mutable_issuer_key_hash()))
       return INPUT_TOO_SHORT;
-    entry->mutable_signed_entry()->mutable_precert()
-        ->set_issuer_key_hash(issuer_key_hash);
-    string tbs_certificate;
-    if (!ReadVarBytes(Serializer::kMaxCertificateLength, &tbs_certificate))
+    if (!Read<ASN1Cert>(precert->mutable_tbs_certificate()))
       return INPUT_TOO_SHORT;
-    entry->mutable_signed_entry()->mutable_precert()
-        ->set_tbs_certificate(tbs_certificate);
   }
 
-  string extensions;
-  if (!ReadVarBytes(Serializer::kMaxExtensionsLength, &extensions))
+  if (!Read<CtExtensions>(entry->mutable_extensions()))
     return INPUT_TOO_SHORT;
-  entry->set_extensions(extensions);
 
   return OK;
 }
@@ -3,8 +3,10 @@
 #define SERIALIZER_H
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "include/types.h"
 #include "proto/ct.pb.h"
@@ -12,7 +14,7 @@
 // A utility class for writing protocol buffer fields in canonical TLS style.
 class Serializer {
  public:
-  Serializer() {}
+  Serializer() : output_(&buffer_) {}
   ~Serializer() {}
 
   // Serialization methods return OK on success,
@@ -59,10 +61,17 @@ class Serializer {
   static size_t PrefixLength(size_t max_length);
 
   // returns binary data
-  std::string SerializedString() const { return output_; }
+  std::string SerializedString() const { return *output_; }
 
   static SerializeResult CheckLogEntryFormat(const ct::LogEntry &entry);
 
+  // The SCT, SCT signature input, Merkle tree leaf, STH signature input,
+  // digitally-signed and signed entry methods below write straight into
+  // |result|, which they size exactly, once, up front: the structures are
+  // laid out in proto/tls_encoding.h terms, so all but their variable-length
+  // contents are compile-time constants. Passing the same string again
+  // reuses its memory.
+
   // Helper method to hide some of the ugly select logic.
   static std::string LeafCertificate(const ct::LogEntry &entry);
 
@@ -149,13 +158,16 @@ class Serializer {
       std::string *result);
 
  private:
+  // Not copyable, as |output_| may point to |buffer_|.
+  Serializer(const Serializer&);
+  void operator=(const Serializer&);
+
   template <class T>
   void WriteUint(T in, size_t bytes) {
     assert(bytes <= sizeof in);
     assert(bytes == sizeof in || in >> (bytes * 8) == 0);
-    std::string result;
     for ( ; bytes > 0; --bytes)
-      output_.push_back(((in & (static_cast<T>(0xff) << ((bytes - 1) * 8)))
+      output_->push_back(((in & (static_cast<T>(0xff) << ((bytes - 1) * 8)))
            >> ((bytes - 1) * 8)));
   }
 
@@ -167,6 +179,19 @@ class Serializer {
   // TODO(ekasper): could return a bool instead.
   void WriteVarBytes(const std::string &in, size_t max_length);
 
+  // Write a V1 SCT signature input or Merkle tree leaf, which have the
+  // same layout, with |type| the signature or leaf type. The fields must
+  // already have been checked.
+  static void WriteV1CertEntry(int type, uint64_t timestamp,
+                               const std::string &certificate,
+                               const std::string &extensions,
+                               std::string *result);
+  static void WriteV1PrecertEntry(int type, uint64_t timestamp,
+                                  const std::string &issuer_key_hash,
+                                  const std::string &tbs_certificate,
+                                  const std::string &extensions,
+                                  std::string *result);
+
   // Length of the serialized list (with length prefix).
   static size_t SerializedListLength(const repeated_string &in,
                                      size_t max_elem_length,
@@ -201,7 +226,22 @@ class Serializer {
   static SerializeResult
   CheckPrecertChainEntryFormat(const ct::PrecertChainEntry &entry);
 
-  std::string output_;
+  // Where the output goes: |buffer_|, or the caller's string.
+  std::string *output_;
+  std::string buffer_;
+};
+
+// A range of bytes in someone else's buffer, which must outlive it.
+struct ByteView {
+  ByteView() : data(NULL), size(0) {}
+  ByteView(const char *view_data, size_t view_size)
+      : data(view_data), size(view_size) {}
+  explicit ByteView(const std::string &in) : data(in.data()), size(in.size()) {}
+
+  std::string ToString() const { return std::string(data, size); }
+
+  const char *data;
+  size_t size;
 };
 
 class Deserializer {
@@ -209,6 +249,7 @@ class Deserializer {
   // We do not make a copy, so input must remain valid.
   // FIXME: and so we should take a string *, not a string &.
   explicit Deserializer(const std::string &input);
+  explicit Deserializer(const ByteView &input);
   ~Deserializer() {}
 
   enum DeserializeResult {
@@ -232,9 +273,17 @@ class Deserializer {
   static DeserializeResult DeserializeSCT(const std::string &in,
                                           ct::SignedCertificateTimestamp *sct);
 
+  static DeserializeResult DeserializeSCT(const ByteView &in,
+                                          ct::SignedCertificateTimestamp *sct);
+
   static DeserializeResult DeserializeSCTList(
       const std::string &in, ct::SignedCertificateTimestampList *sct_list);
 
+  // As above, but return views of the serialized SCTs in |in| rather
+  // than copies.
+  static DeserializeResult DeserializeSCTList(const std::string &in,
+                                              std::vector<ByteView> *scts);
+
   static DeserializeResult
   DeserializeDigitallySigned(const std::string &in, ct::DigitallySigned *sig);
 
@@ -243,6 +292,10 @@ class Deserializer {
   static DeserializeResult DeserializeX509Chain(
       const std::string &in, ct::X509ChainEntry *x509_chain_entry);
 
+  // As above, but return views of the certificates in |in|.
+  static DeserializeResult DeserializeX509Chain(const std::string &in,
+                                                std::vector<ByteView> *chain);
+
   static DeserializeResult DeserializePrecertChainEntry(
       const std::string &in, ct::PrecertChainEntry *precert_chain_entry);
 
@@ -262,6 +315,12 @@ class Deserializer {
   }
 
  private:
+  // Read a field described in proto/tls_encoding.h.
+  template<class Field, class T>
+  bool Read(T *result) {
+    return Field::Read(&current_pos_, &bytes_remaining_, result);
+  }
+
   template<class T>
   bool ReadUint(size_t bytes, T *result) {
     if (bytes_remaining_ < bytes)
@@ -277,10 +336,13 @@ class Deserializer {
     return true;
   }
 
+  // The view versions point into the input, the others copy out of it.
+  bool ReadFixedBytes(size_t bytes, ByteView *result);
   bool ReadFixedBytes(size_t bytes, std::string *result);
 
   bool ReadLengthPrefix(size_t max_length, size_t *result);
 
+  bool ReadVarBytes(size_t max_length, ByteView *result);
   bool ReadVarBytes(size_t max_length, std::string *result);
 
   // FIXME(ekasper): for simplicity these reject if the list has empty
@@ -290,8 +352,14 @@ class Deserializer {
                                            size_t max_total_length,
                                            size_t max_elem_length,
                                            repeated_string *out);
+  static DeserializeResult DeserializeList(const std::string &in,
+                                           size_t max_total_length,
+                                           size_t max_elem_length,
+                                           std::vector<ByteView> *out);
   DeserializeResult ReadList(size_t max_total_length, size_t max_elem_length,
                              repeated_string *out);
+  DeserializeResult ReadList(size_t max_total_length, size_t max_elem_length,
+                             std::vector<ByteView> *out);
 
   DeserializeResult ReadDigitallySigned(ct::DigitallySigned *sig);
 
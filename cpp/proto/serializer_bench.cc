@@ -0,0 +1,290 @@
+// Benchmark for the TLS encoding of the RFC 6962 structures in proto.
+//
+// Serializes and deserializes SCTs, signature inputs, Merkle tree leaves
+// and certificate chains made of the certificates in --test_certs_dir, and
+// prints one JSON object per line with the operations per second and the
+// heap allocations per operation of each. Results are written into the
+// same objects every time, as on the log's hot paths.
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/allocation_counter.h"
+#include "util/util.h"
+
+DEFINE_string(test_certs_dir, "../test/testdata",
+              "Directory with the test certificates.");
+DEFINE_uint64(iterations, 100000, "Times to run each operation.");
+
+namespace {
+
+using ct::DigitallySigned;
+using ct::LogEntry;
+using ct::MerkleTreeLeaf;
+using ct::SignedCertificateTimestamp;
+using ct::SignedCertificateTimestampList;
+using ct::SignedTreeHead;
+using ct::X509ChainEntry;
+using std::string;
+
+// test-intermediate-cert.pem is issued by intermediate-cert.pem, which is
+// issued by ca-cert.pem.
+const char *const kChainFiles[] = {
+  "test-intermediate-cert.pem",
+  "intermediate-cert.pem",
+  "ca-cert.pem",
+};
+const char kPrecertFile[] = "test-embedded-pre-cert.pem";
+
+double NowInMicroseconds() {
+  struct timespec ts;
+  PCHECK(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// The DER of the first certificate in the PEM file |name|.
+string ReadDerCert(const char *name) {
+  const string file = FLAGS_test_certs_dir + "/" + name;
+  string pem;
+  CHECK(util::ReadTextFile(file, &pem))
+      << "Could not read " << file << ". Wrong --test_certs_dir?";
+  static const char kBegin[] = "-----BEGIN CERTIFICATE-----";
+  const size_t begin = pem.find(kBegin);
+  const size_t end = pem.find("-----END CERTIFICATE-----");
+  CHECK(begin != string::npos && end != string::npos && begin < end)
+      << "No certificate in " << file;
+  string b64;
+  for (size_t i = begin + sizeof kBegin - 1; i < end; ++i)
+    if (pem[i] != '\n' && pem[i] != '\r')
+      b64.push_back(pem[i]);
+  const string der = util::FromBase64(b64.c_str());
+  CHECK(!der.empty()) << "Bad certificate in " << file;
+  return der;
+}
+
+// The inputs of the operations, and somewhere for their results. Each
+// operation returns something of its result, so that it isn't optimized
+// away.
+class Fixture {
+ public:
+  Fixture() {
+    for (size_t i = 0; i < sizeof kChainFiles / sizeof kChainFiles[0]; ++i)
+      chain_.add_certificate_chain(ReadDerCert(kChainFiles[i]));
+    chain_.set_leaf_certificate(chain_.certificate_chain(0));
+    precert_ = ReadDerCert(kPrecertFile);
+    issuer_key_hash_ = util::RandomString(32, 32);
+
+    sct_.set_version(ct::V1);
+    sct_.mutable_id()->set_key_id(util::RandomString(32, 32));
+    sct_.set_timestamp(1348589665525LL);
+    DigitallySigned *sig = sct_.mutable_signature();
+    sig->set_hash_algorithm(DigitallySigned::SHA256);
+    sig->set_sig_algorithm(DigitallySigned::ECDSA);
+    // About the size of a P-256 ECDSA signature.
+    sig->set_signature(util::RandomString(71, 71));
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeDigitallySigned(*sig, &digitally_signed_));
+    CHECK_EQ(Serializer::OK, Serializer::SerializeSCT(sct_, &sct_bytes_));
+
+    // As many SCTs as a certificate usually embeds.
+    for (int i = 0; i < 3; ++i)
+      sct_list_.add_sct_list(sct_bytes_);
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSCTList(sct_list_, &sct_list_bytes_));
+
+    entry_.set_type(ct::X509_ENTRY);
+    entry_.mutable_x509_entry()->set_leaf_certificate(leaf());
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSCTMerkleTreeLeaf(sct_, entry_, &leaf_));
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeX509Chain(chain_, &chain_bytes_));
+
+    sth_.set_version(ct::V1);
+    sth_.set_timestamp(1348589667204LL);
+    sth_.set_tree_size(42);
+    sth_.set_sha256_root_hash(util::RandomString(32, 32));
+  }
+
+  size_t SerializeSCT() {
+    CHECK_EQ(Serializer::OK, Serializer::SerializeSCT(sct_, &out_));
+    return out_.size();
+  }
+
+  size_t DeserializeSCT() {
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeSCT(sct_bytes_, &sct_out_));
+    return sct_out_.signature().signature().size();
+  }
+
+  size_t SerializeDigitallySigned() {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeDigitallySigned(sct_.signature(), &out_));
+    return out_.size();
+  }
+
+  size_t DeserializeDigitallySigned() {
+    DigitallySigned *sig = sct_out_.mutable_signature();
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeDigitallySigned(digitally_signed_,
+                                                      sig));
+    return sig->signature().size();
+  }
+
+  size_t SerializeSCTList() {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSCTList(sct_list_, &out_));
+    return out_.size();
+  }
+
+  size_t DeserializeSCTList() {
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeSCTList(sct_list_bytes_,
+                                              &sct_list_out_));
+    return sct_list_out_.sct_list_size();
+  }
+
+  size_t DeserializeSCTListViews() {
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeSCTList(sct_list_bytes_, &views_));
+    return views_.size();
+  }
+
+  size_t SerializeCertSCTSignatureInput() {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeV1CertSCTSignatureInput(
+                 sct_.timestamp(), leaf(), sct_.extensions(), &out_));
+    return out_.size();
+  }
+
+  size_t SerializePrecertSCTSignatureInput() {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeV1PrecertSCTSignatureInput(
+                 sct_.timestamp(), issuer_key_hash_, precert_,
+                 sct_.extensions(), &out_));
+    return out_.size();
+  }
+
+  size_t SerializeMerkleTreeLeaf() {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSCTMerkleTreeLeaf(sct_, entry_, &out_));
+    return out_.size();
+  }
+
+  size_t DeserializeMerkleTreeLeaf() {
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeMerkleTreeLeaf(leaf_, &leaf_out_));
+    return leaf_out_.timestamped_entry().signed_entry().x509().size();
+  }
+
+  size_t SerializeSTHSignatureInput() {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSTHSignatureInput(sth_, &out_));
+    return out_.size();
+  }
+
+  size_t SerializeX509Chain() {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeX509Chain(chain_, &out_));
+    return out_.size();
+  }
+
+  size_t DeserializeX509Chain() {
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeX509Chain(chain_bytes_, &chain_out_));
+    return chain_out_.certificate_chain_size();
+  }
+
+  size_t DeserializeX509ChainViews() {
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeX509Chain(chain_bytes_, &views_));
+    return views_.size();
+  }
+
+ private:
+  const string &leaf() const { return chain_.leaf_certificate(); }
+
+  X509ChainEntry chain_;
+  string precert_;
+  string issuer_key_hash_;
+  SignedCertificateTimestamp sct_;
+  SignedCertificateTimestampList sct_list_;
+  LogEntry entry_;
+  SignedTreeHead sth_;
+
+  // Serialized.
+  string digitally_signed_;
+  string sct_bytes_;
+  string sct_list_bytes_;
+  string leaf_;
+  string chain_bytes_;
+
+  // Results.
+  string out_;
+  SignedCertificateTimestamp sct_out_;
+  SignedCertificateTimestampList sct_list_out_;
+  MerkleTreeLeaf leaf_out_;
+  X509ChainEntry chain_out_;
+  std::vector<ByteView> views_;
+};
+
+struct Operation {
+  const char *name;
+  size_t (Fixture::*run)();
+};
+
+const Operation kOperations[] = {
+  { "serialize_sct", &Fixture::SerializeSCT },
+  { "deserialize_sct", &Fixture::DeserializeSCT },
+  { "serialize_digitally_signed", &Fixture::SerializeDigitallySigned },
+  { "deserialize_digitally_signed", &Fixture::DeserializeDigitallySigned },
+  { "serialize_sct_list", &Fixture::SerializeSCTList },
+  { "deserialize_sct_list", &Fixture::DeserializeSCTList },
+  { "deserialize_sct_list_views", &Fixture::DeserializeSCTListViews },
+  { "serialize_cert_sct_signature_input",
+    &Fixture::SerializeCertSCTSignatureInput },
+  { "serialize_precert_sct_signature_input",
+    &Fixture::SerializePrecertSCTSignatureInput },
+  { "serialize_merkle_tree_leaf", &Fixture::SerializeMerkleTreeLeaf },
+  { "deserialize_merkle_tree_leaf", &Fixture::DeserializeMerkleTreeLeaf },
+  { "serialize_sth_signature_input", &Fixture::SerializeSTHSignatureInput },
+  { "serialize_x509_chain", &Fixture::SerializeX509Chain },
+  { "deserialize_x509_chain", &Fixture::DeserializeX509Chain },
+  { "deserialize_x509_chain_views", &Fixture::DeserializeX509ChainViews },
+};
+
+void Benchmark(const Operation &operation, Fixture *fixture) {
+  // Once untimed, so that the results have grown to size.
+  size_t sink = (fixture->*operation.run)();
+  const uint64_t allocations = util::AllocationCount();
+  const double start = NowInMicroseconds();
+  for (uint64_t i = 0; i < FLAGS_iterations; ++i)
+    sink += (fixture->*operation.run)();
+  const double elapsed = NowInMicroseconds() - start;
+  const uint64_t allocated = util::AllocationCount() - allocations;
+  CHECK_GT(sink, 0U);
+  printf("{\"operation\": \"%s\", \"ops_per_sec\": %.3f, "
+         "\"allocations_per_op\": %.3f}\n", operation.name,
+         FLAGS_iterations / (elapsed / 1e6),
+         static_cast<double>(allocated) / FLAGS_iterations);
+  fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  google::SetUsageMessage("Benchmark the TLS serializer.");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_GT(FLAGS_iterations, 0U);
+  srand(1);
+
+  Fixture fixture;
+  for (size_t i = 0; i < sizeof kOperations / sizeof kOperations[0]; ++i)
+    Benchmark(kOperations[i], &fixture);
+  return 0;
+}
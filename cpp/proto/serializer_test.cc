@@ -3,9 +3,11 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <string>
+#include <vector>
 
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "proto/tls_encoding.h"
 #include "util/testing.h"
 #include "util/util.h"
 
@@ -296,6 +298,31 @@ TEST_F(SerializerTest, DeserializeSCTListKatTest) {
   EXPECT_EQ(string(kDefaultSCTHexString), H(sct_list.sct_list(0)));
 }
 
+TEST_F(SerializerTest, DeserializeSCTListViewsKatTest) {
+  const string serialized(B(kDefaultSCTListHexString));
+  std::vector<ByteView> scts;
+  EXPECT_EQ(Deserializer::OK,
+            Deserializer::DeserializeSCTList(serialized, &scts));
+  ASSERT_EQ(1U, scts.size());
+  // A view into the input...
+  EXPECT_LE(serialized.data(), scts[0].data);
+  EXPECT_LE(scts[0].data + scts[0].size,
+            serialized.data() + serialized.size());
+  EXPECT_EQ(string(kDefaultSCTHexString), H(scts[0].ToString()));
+
+  // ... that parses in place.
+  SignedCertificateTimestamp sct;
+  EXPECT_EQ(Deserializer::OK, Deserializer::DeserializeSCT(scts[0], &sct));
+  EXPECT_EQ(DefaultSCT().timestamp(), sct.timestamp());
+  EXPECT_EQ(DefaultSCT().signature().signature(), sct.signature().signature());
+
+  EXPECT_EQ(Deserializer::INPUT_TOO_SHORT,
+            Deserializer::DeserializeSCTList(
+                serialized.substr(0, serialized.size() - 1), &scts));
+  EXPECT_EQ(Deserializer::INVALID_LIST_ENCODING,
+            Deserializer::DeserializeSCTList(B("00020001"), &scts));
+}
+
 TEST_F(SerializerTest, SerializeSCTSignatureInputKatTest) {
   string cert_result, precert_result;
   EXPECT_EQ(Serializer::OK,
@@ -358,6 +385,25 @@ TEST_F(SerializerTest, SerializeSCTMerkleTreeLeafKatTest) {
   EXPECT_EQ(string(kDefaultPrecertSCTLeafHexString), H(precert_result));
 }
 
+TEST_F(SerializerTest, SerializeSCTMerkleTreeLeafReusesBuffer) {
+  // The result replaces whatever was there, and reuses its memory.
+  string result(4096, 'x');
+  const char *data = result.data();
+  EXPECT_EQ(Serializer::OK,
+            Serializer::SerializeSCTMerkleTreeLeaf(
+                DefaultSCT(), DefaultPrecertEntry(), &result));
+  EXPECT_EQ(string(kDefaultPrecertSCTLeafHexString), H(result));
+  EXPECT_EQ(Serializer::OK,
+            Serializer::SerializeSCTMerkleTreeLeaf(
+                DefaultSCT(), DefaultCertEntry(), &result));
+  EXPECT_EQ(string(kDefaultCertSCTLeafHexString), H(result));
+  EXPECT_EQ(data, result.data());
+
+  EXPECT_EQ(Serializer::OK,
+            Serializer::SerializeSTHSignatureInput(DefaultSTH(), &result));
+  EXPECT_EQ(string(kDefaultSTHSignedHexString), H(result));
+}
+
 TEST_F(SerializerTest, DeserializeMerkleTreeLeafKAT) {
   MerkleTreeLeaf leaf;
   EXPECT_EQ(Deserializer::OK,
@@ -782,6 +828,21 @@ TEST_F(SerializerTest, SerializeDeserializeX509Chain) {
   EXPECT_FALSE(read_entry.has_leaf_certificate());
 }
 
+TEST_F(SerializerTest, DeserializeX509ChainViews) {
+  X509ChainEntry entry;
+  entry.add_certificate_chain("hello");
+  entry.add_certificate_chain("world");
+  string result;
+  EXPECT_EQ(Serializer::OK, Serializer::SerializeX509Chain(entry, &result));
+  std::vector<ByteView> chain(1);
+  EXPECT_EQ(Deserializer::OK,
+            Deserializer::DeserializeX509Chain(result, &chain));
+  ASSERT_EQ(2U, chain.size());
+  EXPECT_EQ("hello", chain[0].ToString());
+  EXPECT_EQ("world", chain[1].ToString());
+  EXPECT_EQ(result.data() + result.size(), chain[1].data + chain[1].size);
+}
+
 TEST_F(SerializerTest, SerializeDeserializeX509Chain_EmptyChain) {
   X509ChainEntry entry, read_entry;
   string result;
@@ -911,6 +972,72 @@ TEST_F(SerializerTest, SerializeSCTSignedEntryWithType_BadIssuerKeyHash) {
             Serializer::SerializeV1SignedEntryWithType(entry, &result));
 }
 
+TEST(TlsEncodingTest, Lengths) {
+  EXPECT_EQ(1, tls::PrefixLength<255>::value);
+  EXPECT_EQ(2, tls::PrefixLength<256>::value);
+  EXPECT_EQ(2, tls::PrefixLength<(1 << 16) - 1>::value);
+  EXPECT_EQ(3, tls::PrefixLength<(1 << 24) - 1>::value);
+  EXPECT_EQ(4, tls::PrefixLength<(1 << 24)>::value);
+  // The same as the run-time computation, for the limits in use.
+  EXPECT_EQ(Serializer::PrefixLength(Serializer::kMaxCertificateLength),
+            static_cast<size_t>(tls::VarBytes<(1 << 24) - 1>::kLength));
+  EXPECT_EQ(Serializer::PrefixLength(Serializer::kMaxExtensionsLength),
+            static_cast<size_t>(tls::VarBytes<(1 << 16) - 1>::kLength));
+
+  EXPECT_EQ(11, (tls::FixedLength<tls::Uint<1>, tls::Uint<8>,
+                 tls::VarBytes<(1 << 16) - 1> >::value));
+}
+
+TEST(TlsEncodingTest, WriteRead) {
+  typedef tls::Uint<3> Uint24;
+  typedef tls::FixedBytes<2> Fixed;
+  typedef tls::VarBytes<300> Var;
+
+  string buffer(Uint24::kLength + Fixed::kLength + Var::Length("hello"),
+                'x');
+  char *out = &buffer[0];
+  out = Uint24::Write(0x010203, out);
+  out = Fixed::Write("ab", out);
+  out = Var::Write("hello", out);
+  EXPECT_EQ(buffer.data() + buffer.size(), out);
+  EXPECT_EQ("010203" "6162" "0005" "68656c6c6f", H(buffer));
+
+  const char *in = buffer.data();
+  size_t remaining = buffer.size();
+  uint32_t value = 0;
+  string fixed;
+  ByteView var;
+  EXPECT_TRUE(Uint24::Read(&in, &remaining, &value));
+  EXPECT_EQ(0x010203U, value);
+  EXPECT_TRUE(Fixed::Read(&in, &remaining, &fixed));
+  EXPECT_EQ("ab", fixed);
+  EXPECT_TRUE(Var::Read(&in, &remaining, &var));
+  EXPECT_EQ("hello", var.ToString());
+  EXPECT_EQ(0U, remaining);
+  EXPECT_EQ(buffer.data() + buffer.size(), in);
+
+  EXPECT_FALSE(Uint24::Read(&in, &remaining, &value));
+}
+
+TEST(TlsEncodingTest, ReadBadLength) {
+  // Longer than what is left.
+  string input(B("000568656c6c"));
+  const char *in = input.data();
+  size_t remaining = input.size();
+  ByteView var;
+  EXPECT_FALSE((tls::VarBytes<300>::Read(&in, &remaining, &var)));
+
+  // Longer than the limit.
+  input = B("03616263");
+  in = input.data();
+  remaining = input.size();
+  EXPECT_FALSE((tls::VarBytes<2>::Read(&in, &remaining, &var)));
+  in = input.data();
+  remaining = input.size();
+  EXPECT_TRUE((tls::VarBytes<3>::Read(&in, &remaining, &var)));
+  EXPECT_EQ("abc", var.ToString());
+}
+
 }  // namespace
 
 int main(int argc, char**argv) {
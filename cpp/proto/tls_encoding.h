@@ -0,0 +1,149 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef PROTO_TLS_ENCODING_H
+#define PROTO_TLS_ENCODING_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include "proto/serializer.h"
+
+// Descriptions of the fields of TLS-encoded structures (RFC 5246 section 4),
+// with their widths and limits as template arguments. A structure is spelled
+// as a list of these, so that its encoder and decoder are straight-line code
+// and its fixed length is a compile-time constant.
+//
+// Each field has an enum |kLength|, the number of bytes it takes up when any
+// vector in it is empty, and static Write() and Read() methods. Write() puts
+// a value at |out|, which must have room for it, and returns the end of what
+// it wrote. Read() takes a value off the front of |*in|, which has |*remaining|
+// bytes, and moves both on past it, or returns false if it isn't there, in
+// which case where they are left is unspecified.
+namespace tls {
+
+// The number of bytes in the length prefix of a vector<0..Max>.
+template <size_t Max>
+struct PrefixLength {
+  enum {
+    value = Max <= 0xff ? 1 : Max <= 0xffff ? 2 : Max <= 0xffffff ? 3 : 4
+  };
+};
+
+// uint8, uint16, uint24, ...: |Bytes| bytes, most significant first.
+template <size_t Bytes>
+struct Uint {
+  enum { kLength = Bytes };
+
+  template <class T>
+  static char *Write(T in, char *out) {
+    uint64_t value = static_cast<uint64_t>(in);
+    assert(Bytes <= sizeof value);
+    // Shifted in two goes, so that eight bytes don't shift by 64.
+    assert((value >> (Bytes * 8 - 1) >> 1) == 0);
+    for (size_t i = Bytes; i > 0; --i) {
+      out[i - 1] = static_cast<char>(value & 0xff);
+      value >>= 8;
+    }
+    return out + Bytes;
+  }
+
+  template <class T>
+  static bool Read(const char **in, size_t *remaining, T *out) {
+    if (*remaining < Bytes)
+      return false;
+    uint64_t value = 0;
+    for (size_t i = 0; i < Bytes; ++i)
+      value = (value << 8) | static_cast<unsigned char>((*in)[i]);
+    *in += Bytes;
+    *remaining -= Bytes;
+    *out = static_cast<T>(value);
+    return true;
+  }
+};
+
+// opaque[Bytes].
+template <size_t Bytes>
+struct FixedBytes {
+  enum { kLength = Bytes };
+
+  static char *Write(const std::string &in, char *out) {
+    assert(in.size() == Bytes);
+    memcpy(out, in.data(), Bytes);
+    return out + Bytes;
+  }
+
+  static bool Read(const char **in, size_t *remaining, ByteView *out) {
+    if (*remaining < Bytes)
+      return false;
+    *out = ByteView(*in, Bytes);
+    *in += Bytes;
+    *remaining -= Bytes;
+    return true;
+  }
+
+  static bool Read(const char **in, size_t *remaining, std::string *out) {
+    ByteView view;
+    if (!Read(in, remaining, &view))
+      return false;
+    out->assign(view.data, view.size);
+    return true;
+  }
+};
+
+// opaque<0..Max>. Callers check the size of what they write against |kMax|.
+template <size_t Max>
+struct VarBytes {
+  typedef Uint<PrefixLength<Max>::value> Prefix;
+  enum { kLength = Prefix::kLength, kMax = Max };
+
+  static size_t Length(const std::string &in) { return kLength + in.size(); }
+
+  static char *Write(const std::string &in, char *out) {
+    assert(in.size() <= Max);
+    out = Prefix::Write(in.size(), out);
+    memcpy(out, in.data(), in.size());
+    return out + in.size();
+  }
+
+  static bool Read(const char **in, size_t *remaining, ByteView *out) {
+    size_t length;
+    if (!Prefix::Read(in, remaining, &length) || length > Max ||
+        *remaining < length)
+      return false;
+    *out = ByteView(*in, length);
+    *in += length;
+    *remaining -= length;
+    return true;
+  }
+
+  static bool Read(const char **in, size_t *remaining, std::string *out) {
+    ByteView view;
+    if (!Read(in, remaining, &view))
+      return false;
+    out->assign(view.data, view.size);
+    return true;
+  }
+};
+
+// Fills the unused places of a FixedLength.
+struct NoField {
+  enum { kLength = 0 };
+};
+
+// The length of a struct of up to eight fields, with any vectors in it
+// empty.
+template <class F1, class F2 = NoField, class F3 = NoField,
+          class F4 = NoField, class F5 = NoField, class F6 = NoField,
+          class F7 = NoField, class F8 = NoField>
+struct FixedLength {
+  enum {
+    value = F1::kLength + F2::kLength + F3::kLength + F4::kLength +
+        F5::kLength + F6::kLength + F7::kLength + F8::kLength
+  };
+};
+
+}  // namespace tls
+
+#endif  // PROTO_TLS_ENCODING_H
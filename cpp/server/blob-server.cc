@@ -7,11 +7,18 @@
 #include "log/log_signer.h"
 #include "log/sqlite_db.h"
 #include "log/tree_signer.h"
+#include "util/util.h"
 
+#include <deque>
+#include <errno.h>
 #include <fstream>
 #include <gflags/gflags.h>
 #include <iostream>
 #include <openssl/ssl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <vector>
 
 // TODO(benl): Make this client/server, make a configurable server
 // (and client?) pipeline which this shares with ct-server.
@@ -23,6 +30,16 @@ DEFINE_string(key, "", "PEM-encoded server private key file");
 DEFINE_string(db, "", "SQLite database for certificate and tree storage");
 DEFINE_string(proof, "", "Destination for audit proof");
 DEFINE_string(sth, "", "Destination for signed tree head");
+DEFINE_bool(daemon, false, "Log blobs read from stdin, one per line in "
+            "base64, until it is closed, writing a line to stdout for each: "
+            "its hash and its audit proof, in hex and base64 respectively, or "
+            "\"error\" in place of the proof. Proofs are written once a tree "
+            "head covers them. The blob file and --proof are not used, and "
+            "--sth is written once stdin is closed.");
+DEFINE_int32(batch_size, 1000, "In daemon mode, the most blobs to "
+             "sequence under one tree head");
+DEFINE_int32(batch_delay_ms, 500, "In daemon mode, how long to wait for more "
+             "blobs to arrive once the first of a batch has");
 
 static bool ValidateRead(const char *flagname, const string &path) {
   if (access(path.c_str(), R_OK) != 0) {
@@ -63,12 +80,191 @@ static TreeSigner<LoggedBlob> *GetTreeSigner(Database<LoggedBlob> *db) {
   return tree_signer;
 }
 
+static void WriteSTH(Database<LoggedBlob> *db) {
+  const ct::SignedTreeHead &sth = GetTreeSigner(db)->LatestSTH();
+
+  std::string sth_str;
+  CHECK(sth.SerializeToString(&sth_str));
+
+  std::ofstream sth_file(FLAGS_sth.c_str(), std::ios::binary);
+  sth_file.write(sth_str.data(), sth_str.length());
+  CHECK(!sth_file.bad());
+}
+
+namespace {
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+// Lines read by their own thread, so that the next batch comes in while
+// the last one is signed.
+class LineQueue {
+ public:
+  LineQueue() : closed_(false) {
+    CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+    CHECK_EQ(0, pthread_cond_init(&changed_, NULL));
+  }
+
+  ~LineQueue() {
+    CHECK_EQ(0, pthread_cond_destroy(&changed_));
+    CHECK_EQ(0, pthread_mutex_destroy(&mutex_));
+  }
+
+  void Push(const string &line) {
+    ScopedLock lock(&mutex_);
+    lines_.push_back(line);
+    CHECK_EQ(0, pthread_cond_signal(&changed_));
+  }
+
+  void Close() {
+    ScopedLock lock(&mutex_);
+    closed_ = true;
+    CHECK_EQ(0, pthread_cond_signal(&changed_));
+  }
+
+  // Wait for a line, then up to |delay_ms| for |max_lines| of them, and
+  // take them. Returns false once the queue is closed and empty.
+  bool TakeBatch(size_t max_lines, int delay_ms, std::vector<string> *batch) {
+    batch->clear();
+    ScopedLock lock(&mutex_);
+    while (lines_.empty() && !closed_)
+      CHECK_EQ(0, pthread_cond_wait(&changed_, &mutex_));
+    if (lines_.empty())
+      return false;
+
+    struct timeval now;
+    CHECK_EQ(0, gettimeofday(&now, NULL));
+    struct timespec due;
+    const uint64_t due_usec = now.tv_usec + delay_ms * 1000ULL;
+    due.tv_sec = now.tv_sec + due_usec / 1000000;
+    due.tv_nsec = (due_usec % 1000000) * 1000;
+    while (lines_.size() < max_lines && !closed_) {
+      const int ret = pthread_cond_timedwait(&changed_, &mutex_, &due);
+      CHECK(ret == 0 || ret == ETIMEDOUT) << ret;
+      if (ret == ETIMEDOUT)
+        break;
+    }
+
+    while (!lines_.empty() && batch->size() < max_lines) {
+      batch->push_back(string());
+      batch->back().swap(lines_.front());
+      lines_.pop_front();
+    }
+    return true;
+  }
+
+ private:
+  pthread_mutex_t mutex_;
+  pthread_cond_t changed_;
+  std::deque<string> lines_;
+  bool closed_;
+};
+
+void *ReadThread(void *arg) {
+  LineQueue *queue = static_cast<LineQueue*>(arg);
+  string line;
+  while (std::getline(std::cin, line))
+    queue->Push(line);
+  queue->Close();
+  return NULL;
+}
+
+// Log the blobs on stdin, a batch to each tree head, keeping the signer
+// and the lookup, and the trees they hold, for the whole run.
+void RunDaemon(Database<LoggedBlob> *db) {
+  CHECK_GT(FLAGS_batch_size, 0);
+  CHECK_GE(FLAGS_batch_delay_ms, 0);
+  TreeSigner<LoggedBlob> *tree_signer = GetTreeSigner(db);
+  // Sequence whatever an earlier run left pending, so that every blob
+  // found in the database below is in the tree.
+  CHECK_EQ(tree_signer->UpdateTree(), TreeSigner<LoggedBlob>::OK);
+  LogLookup<LoggedBlob> lookup(db);
+  TreeHasher tree_hasher(new Sha256Hasher());
+
+  LineQueue queue;
+  pthread_t reader;
+  CHECK_EQ(0, pthread_create(&reader, NULL, &ReadThread, &queue));
+
+  std::vector<string> lines;
+  std::vector<string> blobs;
+  while (queue.TakeBatch(FLAGS_batch_size, FLAGS_batch_delay_ms, &lines)) {
+    blobs.resize(lines.size());
+    size_t added = 0;
+    for (size_t i = 0; i < lines.size(); ++i) {
+      // An empty blob can't be told from a bad line; neither is logged.
+      blobs[i] = util::FromBase64(lines[i].c_str());
+      if (blobs[i].empty())
+        continue;
+      LoggedBlob logged_blob(blobs[i]);
+      if (db->LookupByHash(logged_blob.Hash())
+          != Database<LoggedBlob>::LOOKUP_OK) {
+        db->CreatePendingEntry(logged_blob);
+        ++added;
+      }
+    }
+
+    if (added > 0) {
+      CHECK_EQ(tree_signer->UpdateTree(), TreeSigner<LoggedBlob>::OK);
+      CHECK_EQ(lookup.Update(), LogLookup<LoggedBlob>::UPDATE_OK);
+      VLOG(1) << "Logged " << added << " blobs, tree size "
+              << tree_signer->LatestSTH().tree_size();
+    }
+
+    for (size_t i = 0; i < blobs.size(); ++i) {
+      if (blobs[i].empty()) {
+        LOG(WARNING) << "Bad blob on line: " << lines[i];
+        fputs("- error\n", stdout);
+        continue;
+      }
+      const LoggedBlob logged_blob(blobs[i]);
+      const string hash = util::HexString(logged_blob.Hash());
+      string serialized_leaf;
+      logged_blob.SerializeForLeaf(&serialized_leaf);
+      ct::MerkleAuditProof proof;
+      string proof_str;
+      if (lookup.AuditProof(tree_hasher.HashLeaf(serialized_leaf), &proof)
+          != LogLookup<LoggedBlob>::OK ||
+          !proof.SerializeToString(&proof_str)) {
+        LOG(WARNING) << "No audit proof for blob " << hash;
+        fprintf(stdout, "%s error\n", hash.c_str());
+        continue;
+      }
+      fprintf(stdout, "%s %s\n", hash.c_str(),
+              util::ToBase64(proof_str).c_str());
+    }
+    // The batch is answered as a whole.
+    fflush(stdout);
+  }
+
+  CHECK_EQ(0, pthread_join(reader, NULL));
+}
+
+}  // namespace
+
 // TODO: make this into a fully functional blob server/client pair.
 int main(int argc, char **argv) {
   google::ParseCommandLineFlags(&argc, &argv, true);
   google::InitGoogleLogging(argv[0]);
   SSL_library_init();
 
+  if (FLAGS_daemon) {
+    Database<LoggedBlob> *db = new SQLiteDB<LoggedBlob>(FLAGS_db);
+    RunDaemon(db);
+    // The tree head covering everything logged.
+    if (!FLAGS_sth.empty())
+      WriteSTH(db);
+    return 0;
+  }
+
   const char *blobfile = argv[1];
 
   std::ifstream blobf(blobfile, std::ios::binary);
@@ -121,15 +317,7 @@ int main(int argc, char **argv) {
     CHECK(!proof_file.bad());
   }
 
-  if (!FLAGS_sth.empty()) {
-    const ct::SignedTreeHead &sth = GetTreeSigner(db)->LatestSTH();
-
-    std::string sth_str;
-    CHECK(sth.SerializeToString(&sth_str));
-
-    std::ofstream sth_file(FLAGS_sth.c_str(), std::ios::binary);
-    sth_file.write(sth_str.data(), sth_str.length());
-    CHECK(!sth_file.bad());
-  }
+  if (!FLAGS_sth.empty())
+    WriteSTH(db);
 
 }
@@ -19,6 +19,8 @@ class CTDNSLookup:
         self.resolver = dns.resolver.Resolver(configure=False)
         self.resolver.nameservers = nameservers
         self.resolver.port = port
+        # Room for whole audit paths.
+        self.resolver.use_edns(0, 0, 4096)
 
     def Get(self, name):
         answers = self.resolver.query(name, 'TXT')
@@ -47,6 +49,15 @@ class CTDNSLookup:
         return self.GetOne(str(level) + '.' + str(index) + '.' + str(size)
                            + '.tree.example.com')
 
+    def GetPath(self, index, size, length):
+        path = []
+        while len(path) < length:
+            answers = self.Get(str(len(path)) + '.' + str(index) + '.'
+                               + str(size) + '.path.example.com')
+            assert len(answers) == 1
+            path.extend(answers[0].strings)
+        return path
+
     def GetLeafHash(self, index):
         return self.GetOne(str(index) + '.leafhash.example.com')
 
@@ -80,3 +91,8 @@ print map(base64.b64encode, audit_path)
 
 assert verifier.verify_leaf_hash_inclusion(base64.b64decode(leaf_hash), index,
                                            audit_path, sth)
+
+# The same path, in one query, or a few queries for a large tree.
+path_length = verifier.audit_path_length(index, sth.tree_size)
+assert map(base64.b64decode,
+           lookup.GetPath(index, sth.tree_size, path_length)) == audit_path
@@ -1,14 +1,24 @@
+#include <errno.h>
 #include <gflags/gflags.h>
 #include <iostream>
 #include <ldns/ldns.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sstream>
+#include <stdlib.h>
 #include <string>
+#include <sys/time.h>
+#include <vector>
 
+#include "log/locking_db.h"
 #include "log/log_lookup.h"
 #include "log/logged_certificate.h"
 #include "log/sqlite_db.h"
 #include "proto/ct.pb.h"
 #include "server/event.h"
+#include "util/lru_cache.h"
+#include "util/profiler.h"
+#include "util/startup_profiler.h"
 
 using ct::SignedTreeHead;
 using ct::LoggedCertificate;
@@ -19,6 +29,41 @@ using std::stringstream;
 DEFINE_int32(port, 0, "Server port");
 DEFINE_string(domain, "", "Domain");
 DEFINE_string(db, "", "Database for certificate and tree storage");
+DEFINE_string(leaf_hash_file, "",
+              "File for caching Merkle tree leaf hashes across restarts, "
+              "so that the tree need not be rebuilt from the database. "
+              "Leave empty to disable.");
+DEFINE_string(shared_lookup_file, "",
+              "Attach to the Merkle tree and leaf index that a ct-rfc-server "
+              "on this host publishes to this file, rather than build them; "
+              "leaf_hash_file is then unused. Leave empty to build them.");
+DEFINE_string(subtree_root_file, "",
+              "Serve from the subtree root file that a ct-server keeps with "
+              "--subtree_root_file, rather than build a Merkle tree. Only "
+              "the pages that answers touch take memory; there is no leaf "
+              "index, so hash queries find nothing. leaf_hash_file is then "
+              "unused. Leave empty to build the tree.");
+DEFINE_uint64(subtree_max_leaves, 1ULL << 34,
+              "Largest tree that subtree_root_file is mapped for. It only "
+              "takes address space: some 64 bytes per leaf.");
+DEFINE_int32(event_loops, 1,
+             "Number of event loops to serve queries with, each on a thread "
+             "of its own with its own socket; the kernel spreads queries "
+             "over them (SO_REUSEPORT). 0 means one per CPU core.");
+DEFINE_int32(answer_cache_size, 10000,
+             "Number of wire answers to cache in each event loop. Cached "
+             "answers are dropped whenever the tree changes. 0 disables "
+             "the cache.");
+DEFINE_int32(tree_update_frequency_ms, 1000,
+             "How often to pick up new tree heads from the database, in "
+             "milliseconds. Queries are answered from the tree as of the "
+             "last update. Must be greater than 0.");
+DEFINE_string(profile_dir, "",
+              "Directory to write profiles to on SIGUSR2: a CPU profile of "
+              "the next --profile_seconds, and a heap profile if built with "
+              "TCMALLOC=1, for pprof. Leave empty to disable.");
+DEFINE_int32(profile_seconds, 30,
+             "How long CPU profiles last. Must be greater than 0.");
 
 // Basic sanity checks on flag values.
 static bool ValidatePort(const char *flagname, int32_t port) {
@@ -39,14 +84,137 @@ static bool NonEmptyString(const char *flagname, const string &str) {
 static const bool domain_dummy = RegisterFlagValidator(&FLAGS_domain,
 						       &NonEmptyString);
 
+static bool ValidateIsNonNegative(const char *flagname, int32_t value) {
+  if (value < 0) {
+    std::cerr << flagname << " must not be negative" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool loops_dummy = RegisterFlagValidator(&FLAGS_event_loops,
+                                                      &ValidateIsNonNegative);
+
+static const bool answers_dummy = RegisterFlagValidator(
+    &FLAGS_answer_cache_size, &ValidateIsNonNegative);
+
+static bool ValidateIsPositive(const char *flagname, int32_t value) {
+  if (value <= 0) {
+    std::cerr << flagname << " must be greater than 0" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool update_dummy = RegisterFlagValidator(
+    &FLAGS_tree_update_frequency_ms, &ValidateIsPositive);
+
+static const bool profile_dummy = RegisterFlagValidator(
+    &FLAGS_profile_seconds, &ValidateIsPositive);
+
+// Brings the LogLookup up to date every --tree_update_frequency_ms on a
+// thread of its own, so that queries are answered from memory and never
+// wait for the database or for the tree to be rebuilt. LogLookup lets one
+// thread update while others read.
+class LookupUpdater {
+ public:
+  LookupUpdater(uint64_t frequency_ms, LogLookup<LoggedCertificate> *lookup)
+      : frequency_ms_(frequency_ms),
+        lookup_(lookup),
+        generation_(0),
+        stop_(false) {
+    CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+    CHECK_EQ(0, pthread_cond_init(&wake_, NULL));
+    CHECK_EQ(0, pthread_create(&thread_, NULL, Run, this));
+  }
+
+  ~LookupUpdater() {
+    CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+    stop_ = true;
+    CHECK_EQ(0, pthread_cond_signal(&wake_));
+    CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+    CHECK_EQ(0, pthread_join(thread_, NULL));
+    pthread_cond_destroy(&wake_);
+    pthread_mutex_destroy(&mutex_);
+  }
+
+  // Changes with each update that finds a new tree head.
+  long Generation() const {
+    return __sync_fetch_and_add(&generation_, 0);
+  }
+
+ private:
+  static void *Run(void *arg) {
+    LookupUpdater *updater = static_cast<LookupUpdater*>(arg);
+    while (updater->Sleep()) {
+      if (updater->lookup_->Update() ==
+          LogLookup<LoggedCertificate>::UPDATE_OK)
+        __sync_fetch_and_add(&updater->generation_, 1);
+    }
+    return NULL;
+  }
+
+  // Wait for the next update. Returns false when it's time to stop.
+  bool Sleep() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    const uint64_t until_us = now.tv_sec * 1000000ULL + now.tv_usec +
+        frequency_ms_ * 1000;
+    struct timespec until;
+    until.tv_sec = until_us / 1000000;
+    until.tv_nsec = (until_us % 1000000) * 1000;
+    CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+    while (!stop_ &&
+           pthread_cond_timedwait(&wake_, &mutex_, &until) != ETIMEDOUT) {}
+    const bool stop = stop_;
+    CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+    return !stop;
+  }
+
+  const uint64_t frequency_ms_;
+  LogLookup<LoggedCertificate> *lookup_;
+  mutable volatile long generation_;
+  pthread_t thread_;
+  // Guards |stop_|.
+  pthread_mutex_t mutex_;
+  pthread_cond_t wake_;
+  bool stop_;
+};
+
+// Answers from a LogLookup that is shared by all event loops, and that
+// |updater| keeps up to date.
+//
+// An answer depends on nothing but the query after its ID and on the
+// tree, so answers are cached in wire format, keyed by the rest of the
+// query, until the tree changes.
 class CTUDPDNSServer : public UDPServer {
  public:
-  CTUDPDNSServer(const string &domain, Database<LoggedCertificate> *db,
+  CTUDPDNSServer(const string &domain,
+                 const LogLookup<LoggedCertificate> *lookup,
+                 const LookupUpdater *updater,
 		 EventLoop *loop, int fd)
-    : UDPServer(loop, fd), domain_(domain), lookup_(db) {}
+    : UDPServer(loop, fd), domain_(domain), lookup_(lookup),
+      updater_(updater), answers_(FLAGS_answer_cache_size),
+      answers_generation_(updater->Generation()) {}
 
   virtual void PacketRead(const sockaddr_in &from, const char *buf,
                           size_t len) {
+    const long generation = updater_->Generation();
+    if (generation != answers_generation_) {
+      answers_.Clear();
+      answers_generation_ = generation;
+    }
+
+    // Shorter than a header: ldns will refuse it below.
+    const bool cacheable = len >= kHeaderSize;
+    string answer;
+    if (cacheable && answers_.Get(string(buf + 2, len - 2), &answer)) {
+      answer[0] = buf[0];
+      answer[1] = buf[1];
+      QueuePacket(from, &answer);
+      return;
+    }
+
     ldns_pkt *packet = NULL;
 
     ldns_status ret = ldns_wire2pkt(&packet, (const uint8_t *)buf, len);
@@ -55,7 +223,8 @@ class CTUDPDNSServer : public UDPServer {
       return;
     }
  
-    ldns_pkt_print(stdout, packet);
+    if (VLOG_IS_ON(2))
+      ldns_pkt_print(stdout, packet);
 
     if (ldns_pkt_qr(packet) != 0) {
       LOG(INFO) << "Packet is not a query";
@@ -76,6 +245,23 @@ class CTUDPDNSServer : public UDPServer {
     ldns_pkt_safe_push_rr_list(answers, LDNS_SECTION_QUESTION,
     			       ldns_rr_list_clone(questions));
 
+    // Answers as long as the client can take (EDNS0), or as the plain DNS
+    // limit.
+    size_t max_size = kMaxUDPSize;
+    size_t used = kHeaderSize;
+    if (ldns_pkt_edns(packet)) {
+      const size_t asked = ldns_pkt_edns_udp_size(packet);
+      if (asked > kMaxEDNSSize)
+        max_size = kMaxEDNSSize;
+      else if (asked > kMaxUDPSize)
+        max_size = asked;
+      ldns_pkt_set_edns_udp_size(answers, max_size);
+      used += kOPTSize;
+    }
+    for (size_t n = 0; n < ldns_rr_list_rr_count(questions); ++n)
+      used += ldns_rdf_size(ldns_rr_owner(ldns_rr_list_rr(questions, n))) +
+          kQuestionSize;
+
     for (size_t n = 0; n < ldns_rr_list_rr_count(questions); ++n) {
       ldns_rr *question = ldns_rr_list_rr(questions, n);
 
@@ -104,7 +290,7 @@ class CTUDPDNSServer : public UDPServer {
       ldns_buffer_free(dname);
       dname = NULL;
 
-      LOG(INFO) << "Question is TXT of " << owner_name;
+      VLOG(1) << "Question is TXT of " << owner_name;
 
       if (owner_name.length() <= domain_.length()
 	  || owner_name.compare(owner_name.length() - domain_.length(),
@@ -113,24 +299,33 @@ class CTUDPDNSServer : public UDPServer {
 	continue;
       }
 
-      std::string response =
-	Response(owner_name.substr(0,
-				   owner_name.length() - domain_.length() - 1));
+      // What is left for the strings of the answer.
+      used += ldns_rdf_size(owner) + kAnswerSize;
+      const size_t room = used < max_size ? max_size - used : 0;
+      std::vector<string> response;
+      Response(owner_name.substr(0,
+                                 owner_name.length() - domain_.length() - 1),
+               room, &response);
 
       ldns_rr *answer = ldns_rr_new();
       ldns_rr_set_owner(answer, ldns_rdf_new_frm_str(LDNS_RDF_TYPE_DNAME,
 						     owner_name.c_str()));
       ldns_rr_set_type(answer, LDNS_RR_TYPE_TXT);
       ldns_rr_set_ttl(answer, 123);
-      ldns_rr_push_rdf(answer, ldns_rdf_new_frm_str(LDNS_RDF_TYPE_STR,
-						    response.c_str()));
+      for (size_t i = 0; i < response.size(); ++i) {
+        ldns_rr_push_rdf(answer, ldns_rdf_new_frm_str(LDNS_RDF_TYPE_STR,
+                                                      response[i].c_str()));
+        used += response[i].size() + 1;
+      }
       ldns_pkt_safe_push_rr(answers, LDNS_SECTION_ANSWER, answer);
     }
     ldns_pkt_free(packet);
 
-    char *answer_str = ldns_pkt2str(answers);
-    LOG(INFO) << "Answer is " << answer_str;
-    free(answer_str);
+    if (VLOG_IS_ON(2)) {
+      char *answer_str = ldns_pkt2str(answers);
+      VLOG(2) << "Answer is " << answer_str;
+      free(answer_str);
+    }
 
     uint8_t *wire_answer;
     size_t answer_size;
@@ -138,12 +333,27 @@ class CTUDPDNSServer : public UDPServer {
       LOG(ERROR) << "Can't make wire answer";
       return;
     }
-    QueuePacket(from, wire_answer, answer_size);
+    answer.assign(reinterpret_cast<const char *>(wire_answer), answer_size);
     free(wire_answer);
+    if (cacheable)
+      answers_.Put(string(buf + 2, len - 2), answer);
+    QueuePacket(from, &answer);
     ldns_pkt_free(answers);
   }
 
 private:
+  // The strings of the TXT answer to |question|, in up to |room| bytes on
+  // the wire for those that can be split.
+  void Response(const string &question, size_t room,
+                std::vector<string> *response) {
+    size_t dot = question.find_last_of('.');
+    if (dot != string::npos && question.substr(dot + 1) == "path") {
+      Path(question.substr(0, dot), room, response);
+      return;
+    }
+    response->push_back(Response(question));
+  }
+
   string Response(string question) {
     if (question == "sth")
       return STH();
@@ -154,7 +364,7 @@ private:
 
     string head = question.substr(0, dot);
     string tail = question.substr(dot + 1);
-    LOG(INFO) << "head = " << head << ", tail = " << tail;
+    VLOG(1) << "head = " << head << ", tail = " << tail;
     if (tail == "tree")
       return Tree(head);
     else if (tail == "hash")
@@ -168,17 +378,15 @@ private:
   string LeafHash(const string &index_str) const {
     int index = atoi(index_str.c_str());
     LoggedCertificate cert;
-    if (lookup_.GetEntry(index, &cert) != lookup_.OK)
+    if (lookup_->GetEntry(index, &cert) != lookup_->OK)
       return "No such index";
-    return util::ToBase64(lookup_.LeafHash(cert));
+    return util::ToBase64(lookup_->LeafHash(cert));
   }
 
   string Hash(const string &hash) {
-    lookup_.Update();
-
     // FIXME: decode hash!
     uint64_t index;
-    if (lookup_.GetIndex(hash, &index) != lookup_.OK)
+    if (lookup_->GetIndex(hash, &index) != lookup_->OK)
       return "No such hash";
 
     stringstream ss;
@@ -199,27 +407,66 @@ private:
     string index = question.substr(dot + 1, dot2 - dot - 1);
     string size = question.substr(dot2 + 1);
 
-    LOG(INFO) << "level = " << level << ", index = " << index << ", size = "
+    VLOG(1) << "level = " << level << ", index = " << index << ", size = "
 	      << size;
 
     ct::ShortMerkleAuditProof proof;
-    if (lookup_.AuditProof(atoi(index.c_str()), atoi(size.c_str()), &proof)
-	!= lookup_.OK)
+    if (lookup_->AuditProof(atoi(index.c_str()), atoi(size.c_str()), &proof)
+	!= lookup_->OK)
       return "Lookup of node " + index + "." + size + " failed";
 
     int l = atoi(level.c_str());
     if (l < 0 || l >= proof.path_node_size())
       return "Level " + level + " is out of range";
 
-    string b64 = util::ToBase64(proof.path_node(l));
-    std::cerr << b64 << std::endl;
-    return b64;
+    return util::ToBase64(proof.path_node(l));
   }
 
-  string STH() {
-    lookup_.Update();
+  // The audit path of <index>.<size> from level <first> up, one node per
+  // string, in as many strings as fit in |room|; a client that gets fewer
+  // than the path has left asks again from the level after the last.
+  void Path(const string &question, size_t room,
+            std::vector<string> *response) {
+    size_t dot = question.find_first_of('.');
+    size_t dot2 = dot == string::npos ? dot
+        : question.find_first_of('.', dot + 1);
+    if (dot2 == string::npos) {
+      response->push_back(question + " not understood");
+      return;
+    }
+
+    string first = question.substr(0, dot);
+    string index = question.substr(dot + 1, dot2 - dot - 1);
+    string size = question.substr(dot2 + 1);
+
+    ct::ShortMerkleAuditProof proof;
+    if (lookup_->AuditProof(atoi(index.c_str()), atoi(size.c_str()), &proof)
+        != lookup_->OK) {
+      response->push_back("Lookup of node " + index + "." + size +
+                          " failed");
+      return;
+    }
 
-    const SignedTreeHead &sth = lookup_.GetSTH();
+    int l = atoi(first.c_str());
+    if (l < 0 || l > proof.path_node_size()) {
+      response->push_back("Level " + first + " is out of range");
+      return;
+    }
+
+    size_t used = 0;
+    for ( ; l < proof.path_node_size(); ++l) {
+      const string node = util::ToBase64(proof.path_node(l));
+      // Each string has a length byte. Answer one at least, so that the
+      // client gets on.
+      if (used + node.size() + 1 > room && !response->empty())
+        break;
+      used += node.size() + 1;
+      response->push_back(node);
+    }
+  }
+
+  string STH() {
+    const SignedTreeHead &sth = lookup_->GetSTH();
 
     std::string signature;
     CHECK_EQ(Serializer::SerializeDigitallySigned(sth.signature(), &signature),
@@ -233,18 +480,55 @@ private:
     return ss.str();
   }    
 
+  static const size_t kHeaderSize = 12;
+  // Without EDNS0, answers can be no longer than this; with it, no longer
+  // than the client asks for, up to kMaxEDNSSize.
+  static const size_t kMaxUDPSize = 512;
+  static const size_t kMaxEDNSSize = 4096;
+  // The wire bytes of the OPT record, and of a question and a TXT answer
+  // besides their names.
+  static const size_t kOPTSize = 11;
+  static const size_t kQuestionSize = 4;
+  static const size_t kAnswerSize = 10;
+
   string domain_;
-  LogLookup<LoggedCertificate> lookup_;
+  const LogLookup<LoggedCertificate> *lookup_;
+  const LookupUpdater *updater_;
+  // Wire answers by query without its ID, as of |answers_generation_|.
+  util::LRUCache<string, string> answers_;
+  long answers_generation_;
+};
+
+// Serves the queries that the kernel hands to its socket on a thread and
+// event loop of its own (see --event_loops).
+class ServingThread {
+ public:
+  // Does not take ownership of |lookup| or |updater|.
+  ServingThread(int fd, const LogLookup<LoggedCertificate> *lookup,
+                const LookupUpdater *updater)
+      : dns_(FLAGS_domain, lookup, updater, &loop_, fd) {
+    CHECK_EQ(0, pthread_create(&thread_, NULL, Run, this));
+  }
+
+ private:
+  static void *Run(void *arg) {
+    static_cast<ServingThread*>(arg)->loop_.Forever();
+    return NULL;
+  }
+
+  EventLoop loop_;
+  CTUDPDNSServer dns_;
+  pthread_t thread_;
 };
 
 class Keyboard : public Server {
  public:
   Keyboard(EventLoop *loop) : Server(loop, 0) {}
 
-  void BytesRead(std::string *rbuffer) {
+  void BytesRead(ReadBuffer *rbuffer) {
     while(!rbuffer->empty()) {
-      ProcessKey(rbuffer->at(0));
-      rbuffer->erase(0, 1);
+      ProcessKey(rbuffer->data()[0]);
+      rbuffer->Consume(1);
     }
   }
 
@@ -265,21 +549,55 @@ class Keyboard : public Server {
   }
 };
 
+// How often the phases of startup log their progress.
+static const uint32_t kStartupProgressSeconds = 10;
+
 int main(int argc, char *argv[]) {
   google::ParseCommandLineFlags(&argc, &argv, true);
   google::InitGoogleLogging(argv[0]);
-
-  SQLiteDB<LoggedCertificate> db(FLAGS_db);
+  if (!FLAGS_profile_dir.empty())
+    util::ProfileOnSignal(SIGUSR2, FLAGS_profile_dir, "ct-dns-server",
+                          FLAGS_profile_seconds);
+  util::StartupProfiler startup(kStartupProgressSeconds);
+  util::StartupProfiler::SetGlobal(&startup);
+
+  const int loops = FLAGS_event_loops > 0 ? FLAGS_event_loops
+      : Services::NumCores();
+  std::vector<int> dns_fds(loops);
+  for (int i = 0; i < loops; ++i)
+    CHECK(Services::InitServer(&dns_fds[i], FLAGS_port, NULL, SOCK_DGRAM,
+                               loops > 1));
+
+  // The loops look up entries concurrently.
+  LockingDatabase<LoggedCertificate> db(
+      new SQLiteDB<LoggedCertificate>(FLAGS_db));
+  LogLookup<LoggedCertificate> *lookup;
+  if (!FLAGS_shared_lookup_file.empty())
+    lookup = new LogLookup<LoggedCertificate>(
+        &db, "", LogLookup<LoggedCertificate>::ATTACH,
+        FLAGS_shared_lookup_file, 0);
+  else if (!FLAGS_subtree_root_file.empty())
+    lookup = new LogLookup<LoggedCertificate>(
+        &db, "", LogLookup<LoggedCertificate>::SUBTREES,
+        FLAGS_subtree_root_file, FLAGS_subtree_max_leaves);
+  else
+    lookup = new LogLookup<LoggedCertificate>(&db, FLAGS_leaf_hash_file);
 
   EventLoop loop;
 
   // Mostly so we can have a clean exit for valgrind etc.
   Keyboard keyboard(&loop);
 
-  int dns_fd;
-  CHECK(Services::InitServer(&dns_fd, FLAGS_port, NULL, SOCK_DGRAM));
-  CTUDPDNSServer dns(FLAGS_domain, &db, &loop, dns_fd);
+  LookupUpdater updater(FLAGS_tree_update_frequency_ms, lookup);
+  CTUDPDNSServer dns(FLAGS_domain, lookup, &updater, &loop, dns_fds[0]);
+  for (int i = 1; i < loops; ++i)
+    new ServingThread(dns_fds[i], lookup, &updater);
 
-  LOG(INFO) << "Server listening on port " << FLAGS_port;
+  LOG(INFO) << startup.Report();
+  LOG(INFO) << "Server listening on port " << FLAGS_port << " with "
+            << loops << " event loop(s)";
   loop.Forever();
+  // The other loops still use the lookup, so don't tear it down under them.
+  if (loops > 1)
+    exit(0);
 }
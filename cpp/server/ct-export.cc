@@ -0,0 +1,177 @@
+/* -*- indent-tabs-mode: nil -*- */
+
+// Dumps a log's sequenced entries, up to its latest tree head, straight
+// from its database, for offline analysis; see log/entry_dump.h for the
+// format, and EntryDumpReader for reading it.
+
+#include <algorithm>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "log/entry_compressor.h"
+#include "log/entry_dump.h"
+#include "log/file_storage.h"
+#include "log/interning_db.h"
+#include "log/leveldb_db.h"
+#include "log/logged_certificate.h"
+#include "log/sharded_db.h"
+#include "log/sqlite_db.h"
+#include "util/util.h"
+
+using ct::LoggedCertificate;
+using ct::SignedTreeHead;
+using google::RegisterFlagValidator;
+using std::string;
+
+DEFINE_string(sqlite_db, "", "SQLite database of the log");
+DEFINE_string(leveldb_db, "", "LevelDB database of the log");
+DEFINE_string(sharded_db, "", "Sharded database of the log");
+DEFINE_int32(sharded_db_shard_size, 1 << 20,
+             "Number of sequenced entries per shard of the sharded "
+             "database. Must match that of the log.");
+DEFINE_string(entry_compression_dictionary, "",
+              "Dictionary that the log compresses entries with, if any.");
+DEFINE_string(intermediate_dir, "",
+              "Directory of the log's interned chain certificates, if any.");
+DEFINE_int32(intermediate_storage_depth, 0,
+             "Subdirectory depth of the interned certificates.");
+DEFINE_int32(intermediate_cache_size, 10000,
+             "Number of interned certificates to keep in memory.");
+DEFINE_string(dump_file, "", "File to write the dump to");
+DEFINE_int32(dump_chunk_entries, 4096,
+             "Number of entries per compressed chunk of the dump. Smaller "
+             "chunks make random access cheaper, larger ones compress "
+             "better.");
+
+static bool ValidateIsPositive(const char *flagname, int value) {
+  if (value <= 0) {
+    std::cout << flagname << " must be greater than 0" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool shard_dummy = RegisterFlagValidator(
+    &FLAGS_sharded_db_shard_size, &ValidateIsPositive);
+static const bool chunk_dummy = RegisterFlagValidator(
+    &FLAGS_dump_chunk_entries, &ValidateIsPositive);
+
+static bool NonEmptyString(const char *flagname, const string &str) {
+  if (str.empty()) {
+    std::cout << flagname << " must be set" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool file_dummy = RegisterFlagValidator(&FLAGS_dump_file,
+                                                     &NonEmptyString);
+
+// Entries read from the database at a time.
+static const size_t kReadBatch = 1 << 14;
+// Entries dumped between progress reports.
+static const size_t kStep = 1 << 20;
+
+namespace {
+
+// Adds the entries of a range lookup to the dump, with their leaf hashes.
+class EntryDumper : public Database<LoggedCertificate>::EntryCallback {
+ public:
+  explicit EntryDumper(EntryDumpWriter *writer)
+      : writer_(writer), first_(0), next_(0) {}
+
+  void Start(uint64_t start, std::vector<string> *leaf_hashes) {
+    next_ = start;
+    first_ = start;
+    leaf_hashes_.swap(*leaf_hashes);
+  }
+
+  virtual bool Entry(const LoggedCertificate &logged) {
+    CHECK_EQ(next_, logged.sequence_number());
+    CHECK_LT(next_ - first_, leaf_hashes_.size());
+    DumpEntry entry;
+    entry.sequence_number = next_;
+    entry.leaf_hash.swap(leaf_hashes_[next_ - first_]);
+    CHECK(logged.SerializeForLeaf(&entry.leaf));
+    CHECK(logged.SerializeExtraData(&entry.extra_data));
+    writer_->Add(entry);
+    ++next_;
+    return true;
+  }
+
+  uint64_t Next() const { return next_; }
+
+ private:
+  EntryDumpWriter *const writer_;
+  uint64_t first_;
+  uint64_t next_;
+  std::vector<string> leaf_hashes_;
+};
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  if ((FLAGS_sqlite_db != "" ? 1 : 0) + (FLAGS_leveldb_db != "" ? 1 : 0) +
+      (FLAGS_sharded_db != "" ? 1 : 0) != 1) {
+    std::cerr << "Choose one of sqlite, leveldb or sharded database"
+              << std::endl;
+    exit(1);
+  }
+
+  Database<LoggedCertificate> *db;
+  if (FLAGS_sqlite_db != "")
+    db = new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
+  else if (FLAGS_leveldb_db != "")
+    db = new LevelDB<LoggedCertificate>(FLAGS_leveldb_db);
+  else
+    db = new ShardedDB<LoggedCertificate>(FLAGS_sharded_db,
+                                          FLAGS_sharded_db_shard_size);
+
+  if (FLAGS_entry_compression_dictionary != "") {
+    string dictionary;
+    CHECK(util::ReadBinaryFile(FLAGS_entry_compression_dictionary,
+                               &dictionary))
+        << "Failed to read " << FLAGS_entry_compression_dictionary;
+    db->SetCompressor(new EntryCompressor(dictionary));
+  }
+
+  if (FLAGS_intermediate_dir != "")
+    db = new InterningDatabase(
+        db, new FileStorage(FLAGS_intermediate_dir,
+                            FLAGS_intermediate_storage_depth),
+        FLAGS_intermediate_cache_size);
+
+  SignedTreeHead sth;
+  CHECK_EQ(Database<LoggedCertificate>::LOOKUP_OK, db->LatestTreeHead(&sth))
+      << "The log has no tree head";
+
+  EntryDumpWriter writer(FLAGS_dump_file, FLAGS_dump_chunk_entries);
+  EntryDumper dumper(&writer);
+  for (uint64_t start = 0; start < sth.tree_size(); start += kReadBatch) {
+    const uint64_t end = std::min<uint64_t>(start + kReadBatch,
+                                            sth.tree_size());
+    std::vector<string> leaf_hashes;
+    CHECK_EQ(Database<LoggedCertificate>::LOOKUP_OK,
+             db->LookupLeafHashRange(start, end, &leaf_hashes));
+    CHECK_EQ(end - start, leaf_hashes.size());
+    dumper.Start(start, &leaf_hashes);
+    CHECK_EQ(Database<LoggedCertificate>::LOOKUP_OK,
+             db->LookupByIndexRange(start, end, &dumper));
+    CHECK_EQ(end, dumper.Next()) << "Entries missing from the database";
+    if (end / kStep != start / kStep || end == sth.tree_size())
+      LOG(INFO) << "Dumped " << end << " of " << sth.tree_size()
+                << " entries";
+  }
+  writer.Finish(sth);
+
+  delete db;
+  return 0;
+}
@@ -0,0 +1,296 @@
+/* -*- indent-tabs-mode: nil -*- */
+
+// Writes a synthetic log of any size into a database, for trying out
+// servers on logs far larger than one could fill through a Frontend: the
+// entries are copies of a template chain, each with a unique leaf, and
+// have real SCTs, signed across threads with copies of the log's key, and
+// sequence numbers. Writes a signed tree head every so many entries, and
+// the tree checkpoint and leaf hash file of the last one, through an
+// Importer (see log/importer.h), which writes each batch in one
+// transaction and hashes it across the cores.
+//
+// The entries and timestamps only depend on the flags, so two runs with
+// the same --template_chain, --entries and --first_timestamp hold the same
+// log but for the signatures; an interrupted run picks up where it
+// stopped.
+
+#include <algorithm>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iostream>
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "log/entry_compressor.h"
+#include "log/importer.h"
+#include "log/leveldb_db.h"
+#include "log/log_signer.h"
+#include "log/logged_certificate.h"
+#include "log/sharded_db.h"
+#include "log/sqlite_db.h"
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+using ct::LoggedCertificate;
+using ct::SignedTreeHead;
+using google::RegisterFlagValidator;
+using std::string;
+
+DEFINE_string(sqlite_db, "", "SQLite database to write the log to");
+DEFINE_string(leveldb_db, "", "LevelDB database to write the log to");
+DEFINE_string(sharded_db, "", "Sharded database to write the log to");
+DEFINE_int32(sharded_db_shard_size, 1 << 20,
+             "Number of sequenced entries per shard of the sharded "
+             "database.");
+DEFINE_string(entry_compression_dictionary, "",
+              "Dictionary to compress entries with, if any.");
+DEFINE_string(key, "", "PEM-encoded private key of the log");
+DEFINE_string(template_chain, "",
+              "PEM file of the chain that entries copy, leaf first. Each "
+              "entry's leaf has its sequence number in its last 8 bytes, "
+              "which are part of the signature of a DER certificate, so "
+              "the leaves still parse, but their signatures don't verify.");
+DEFINE_uint64(entries, 1000000, "Number of entries in the log");
+DEFINE_uint64(first_timestamp, 0,
+              "Timestamp of the first entry, in milliseconds; each next "
+              "one is a millisecond later. 0 means as long before now as "
+              "there are entries.");
+DEFINE_int32(sth_every, 1 << 20,
+             "Number of entries between tree heads. The last entry always "
+             "gets one.");
+DEFINE_int32(batch_size, 10000,
+             "Number of entries to write in each transaction");
+DEFINE_int32(signing_threads, 0,
+             "Number of signers, each with its own copy of the key, that "
+             "split each batch between them on the shared thread pool. 0 "
+             "means as many as the pool can run at once.");
+DEFINE_string(leaf_hash_file, "",
+              "The log's --leaf_hash_file, if any, to write the leaf "
+              "hashes to as well.");
+DEFINE_string(tree_checkpoint_file, "",
+              "The log's --tree_checkpoint_file, if any, to checkpoint "
+              "the tree to.");
+
+static bool ValidateIsPositive(const char *flagname, int value) {
+  if (value <= 0) {
+    std::cout << flagname << " must be greater than 0" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static bool ValidateIsNonNegative(const char *flagname, int value) {
+  if (value < 0) {
+    std::cout << flagname << " must not be negative" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool shard_dummy = RegisterFlagValidator(
+    &FLAGS_sharded_db_shard_size, &ValidateIsPositive);
+static const bool sth_dummy = RegisterFlagValidator(
+    &FLAGS_sth_every, &ValidateIsPositive);
+static const bool batch_dummy = RegisterFlagValidator(
+    &FLAGS_batch_size, &ValidateIsPositive);
+static const bool threads_dummy = RegisterFlagValidator(
+    &FLAGS_signing_threads, &ValidateIsNonNegative);
+
+namespace {
+
+// Bytes of the leaf that hold the sequence number.
+const size_t kSerialBytes = 8;
+
+// Read the PEM-encoded private key in |file|. There is no EVP_PKEY_dup,
+// so each signer gets a key read anew.
+EVP_PKEY *ReadKey(const string &file) {
+  FILE *fp = fopen(file.c_str(), "r");
+  PCHECK(fp != NULL) << "Could not read " << file;
+  EVP_PKEY *pkey = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+  CHECK(pkey != NULL) << file << " is not a valid PEM-encoded private key.";
+  fclose(fp);
+  return pkey;
+}
+
+// The DER encodings of the certificates in the PEM file |file|, in order.
+std::vector<string> ReadChain(const string &file) {
+  string pem;
+  CHECK(util::ReadBinaryFile(file, &pem)) << "Could not read " << file;
+  BIO *bio = BIO_new_mem_buf(const_cast<char*>(pem.data()), pem.size());
+  CHECK_NOTNULL(bio);
+  std::vector<string> chain;
+  X509 *x509;
+  while ((x509 = PEM_read_bio_X509(bio, NULL, NULL, NULL)) != NULL) {
+    unsigned char *der = NULL;
+    const int size = i2d_X509(x509, &der);
+    CHECK_GT(size, 0) << "Could not encode certificate " << chain.size()
+                      << " of " << file;
+    chain.push_back(string(reinterpret_cast<char*>(der), size));
+    OPENSSL_free(der);
+    X509_free(x509);
+  }
+  BIO_free(bio);
+  CHECK(!chain.empty()) << file << " has no PEM-encoded certificates.";
+  CHECK_GT(chain[0].size(), kSerialBytes);
+  return chain;
+}
+
+// Generates and signs a batch of entries from |first| on, each range with
+// its own signer.
+struct SignJob {
+  const std::vector<LogSigner*> *signers;
+  const std::vector<string> *chain;
+  std::vector<LoggedCertificate> *batch;
+  uint64_t first;
+};
+
+void SignRange(void *arg, size_t chunk, size_t begin, size_t end) {
+  const SignJob *job = static_cast<const SignJob*>(arg);
+  const LogSigner *signer = (*job->signers)[chunk];
+  const std::vector<string> &chain = *job->chain;
+  string leaf = chain[0];
+  for (size_t i = begin; i < end; ++i) {
+    const uint64_t sequence_number = job->first + i;
+    leaf.replace(leaf.size() - kSerialBytes, kSerialBytes,
+                 Serializer::SerializeUint(sequence_number, kSerialBytes));
+    LoggedCertificate &logged = (*job->batch)[i];
+    logged.Clear();
+    ct::LogEntry *entry = logged.mutable_entry();
+    entry->set_type(ct::X509_ENTRY);
+    entry->mutable_x509_entry()->set_leaf_certificate(leaf);
+    for (size_t c = 1; c < chain.size(); ++c)
+      entry->mutable_x509_entry()->add_certificate_chain(chain[c]);
+    ct::SignedCertificateTimestamp *sct = logged.mutable_sct();
+    sct->set_version(ct::V1);
+    sct->set_timestamp(FLAGS_first_timestamp + sequence_number);
+    CHECK_EQ(LogSigner::OK,
+             signer->SignCertificateTimestamp(logged.entry(), sct));
+  }
+}
+
+// Fill |batch| with the entries from |first| on, split between |signers|.
+void Generate(const std::vector<LogSigner*> &signers,
+              const std::vector<string> &chain, uint64_t first,
+              std::vector<LoggedCertificate> *batch) {
+  const size_t jobs = std::min(signers.size(), batch->size());
+  SignJob job = { &signers, &chain, batch, first };
+  if (jobs > 0)
+    util::ThreadPool::Default()->ParallelFor(batch->size(), jobs, SignRange,
+                                             &job);
+}
+
+// Sign and write the tree head of the first |tree_size| entries.
+void WriteTreeHead(Importer<LoggedCertificate> *importer,
+                   const LogSigner *signer, uint64_t tree_size) {
+  SignedTreeHead sth;
+  sth.set_version(ct::V1);
+  sth.set_tree_size(tree_size);
+  // After the last entry's, and before the next one's, so that tree heads
+  // have timestamps of their own.
+  sth.set_timestamp(FLAGS_first_timestamp + tree_size);
+  sth.set_sha256_root_hash(importer->CurrentRoot());
+  CHECK_EQ(LogSigner::OK, signer->SignTreeHead(&sth));
+  CHECK_EQ(Importer<LoggedCertificate>::IMPORT_OK, importer->Finish(sth))
+      << "Failed to write the tree head of " << tree_size << " entries";
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  if ((FLAGS_sqlite_db != "" ? 1 : 0) + (FLAGS_leveldb_db != "" ? 1 : 0) +
+      (FLAGS_sharded_db != "" ? 1 : 0) != 1) {
+    std::cerr << "Choose one of sqlite, leveldb or sharded database"
+              << std::endl;
+    exit(1);
+  }
+  if (FLAGS_key == "" || FLAGS_template_chain == "") {
+    std::cerr << "Give the log's --key and a --template_chain" << std::endl;
+    exit(1);
+  }
+
+  const uint64_t now = util::TimeInMilliseconds();
+  if (FLAGS_first_timestamp == 0) {
+    FLAGS_first_timestamp = now - FLAGS_entries - 1000;
+    LOG(INFO) << "Entries start at --first_timestamp="
+              << FLAGS_first_timestamp << "; give it again to resume";
+  }
+  // Servers refuse tree heads from the future.
+  CHECK_LE(FLAGS_first_timestamp + FLAGS_entries, now)
+      << "The last tree head would be timestamped in the future";
+
+  const std::vector<string> chain = ReadChain(FLAGS_template_chain);
+  size_t threads = FLAGS_signing_threads;
+  if (threads == 0)
+    threads = util::ThreadPool::Default()->Parallelism();
+  std::vector<LogSigner*> signers;
+  for (size_t i = 0; i < threads; ++i)
+    signers.push_back(new LogSigner(ReadKey(FLAGS_key)));
+
+  Database<LoggedCertificate> *db;
+  if (FLAGS_sqlite_db != "")
+    db = new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
+  else if (FLAGS_leveldb_db != "")
+    db = new LevelDB<LoggedCertificate>(FLAGS_leveldb_db);
+  else
+    db = new ShardedDB<LoggedCertificate>(FLAGS_sharded_db,
+                                          FLAGS_sharded_db_shard_size);
+  if (FLAGS_entry_compression_dictionary != "") {
+    string dictionary;
+    CHECK(util::ReadBinaryFile(FLAGS_entry_compression_dictionary,
+                               &dictionary))
+        << "Failed to read " << FLAGS_entry_compression_dictionary;
+    db->SetCompressor(new EntryCompressor(dictionary));
+  }
+
+  Importer<LoggedCertificate> *importer = new Importer<LoggedCertificate>(
+      db, FLAGS_leaf_hash_file, FLAGS_tree_checkpoint_file);
+  uint64_t next = importer->NextSequenceNumber();
+  CHECK_LE(next, FLAGS_entries)
+      << "The database has more entries than --entries";
+
+  const uint64_t start = next;
+  const uint64_t start_time = util::TimeInMilliseconds();
+  std::vector<LoggedCertificate> batch;
+  while (next < FLAGS_entries) {
+    // Batches end at tree heads.
+    const uint64_t sth_end = (next / FLAGS_sth_every + 1) * FLAGS_sth_every;
+    const uint64_t end = std::min(std::min<uint64_t>(
+        next + FLAGS_batch_size, sth_end), FLAGS_entries);
+    batch.resize(end - next);
+    Generate(signers, chain, next, &batch);
+    CHECK_EQ(Importer<LoggedCertificate>::IMPORT_OK,
+             importer->Import(next, batch))
+        << "Failed to write entries " << next << " to " << end - 1;
+    next = end;
+
+    if (next == sth_end || next == FLAGS_entries) {
+      WriteTreeHead(importer, signers[0], next);
+      const uint64_t seconds =
+          (util::TimeInMilliseconds() - start_time) / 1000;
+      LOG(INFO) << "Wrote " << next << " of " << FLAGS_entries
+                << " entries, " << (next - start) / (seconds + 1)
+                << " per second";
+    }
+  }
+  // Resumed after the last batch, but before its tree head.
+  if (next == start)
+    WriteTreeHead(importer, signers[0], next);
+
+  delete importer;
+  delete db;
+  for (size_t i = 0; i < signers.size(); ++i)
+    delete signers[i];
+  return 0;
+}
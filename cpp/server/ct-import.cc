@@ -0,0 +1,340 @@
+/* -*- indent-tabs-mode: nil -*- */
+
+// Loads the entries of another log into a log's database in bulk, from the
+// log itself or from a dump of its entries, with the sequence numbers and
+// timestamps that they have there, and writes the log's tree head once the
+// tree of the entries adds up to it. See log/importer.h.
+//
+// Neither get-entries nor a dump has the log ID and signature of an SCT, so
+// those are left out of the imported SCTs; the log ID is filled in if the
+// log's public key is given.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iostream>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "client/entry_fetcher.h"
+#include "client/http_log_client.h"
+#include "log/entry_compressor.h"
+#include "log/file_storage.h"
+#include "log/importer.h"
+#include "log/interning_db.h"
+#include "log/leveldb_db.h"
+#include "log/log_signer.h"
+#include "log/log_verifier.h"
+#include "log/logged_certificate.h"
+#include "log/sharded_db.h"
+#include "log/sqlite_db.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/json_wrapper.h"
+#include "util/util.h"
+
+using ct::LoggedCertificate;
+using ct::SignedTreeHead;
+using google::RegisterFlagValidator;
+using std::string;
+
+DEFINE_string(source_log, "", "URL of the log to import");
+DEFINE_string(dump_file, "",
+              "File of the entries to import, instead of --source_log: "
+              "each as its MerkleTreeLeaf and extra_data, both preceded by "
+              "their length in 4 bytes, big-endian, as in the entry tiles "
+              "of ct-tile-exporter");
+DEFINE_string(dump_sth_file, "",
+              "The tree head of --dump_file, in the JSON of a get-sth "
+              "reply, e.g. the checkpoint of ct-tile-exporter");
+DEFINE_string(source_public_key, "",
+              "PEM-encoded public key of the log to import. If set, its "
+              "tree head is verified, and its log ID filled in.");
+DEFINE_int32(get_entries_parallel, 4,
+             "Number of get-entries requests to keep in flight");
+DEFINE_int32(get_entries_batch_size, 1000,
+             "Number of entries to ask for in each get-entries request");
+DEFINE_int32(get_entries_retries, 3,
+             "Number of times to retry a failed get-entries request");
+DEFINE_int32(import_batch_size, 10000,
+             "Number of entries to write in each transaction");
+DEFINE_string(sqlite_db, "", "SQLite database to import into");
+DEFINE_string(leveldb_db, "", "LevelDB database to import into");
+DEFINE_string(sharded_db, "", "Sharded database to import into");
+DEFINE_int32(sharded_db_shard_size, 1 << 20,
+             "Number of sequenced entries per shard of the sharded "
+             "database. Must match that of the log.");
+DEFINE_string(entry_compression_dictionary, "",
+              "Dictionary that the log compresses entries with, if any.");
+DEFINE_string(intermediate_dir, "",
+              "Directory of the log's interned chain certificates, if any.");
+DEFINE_int32(intermediate_storage_depth, 0,
+             "Subdirectory depth of the interned certificates.");
+DEFINE_int32(intermediate_cache_size, 10000,
+             "Number of interned certificates to keep in memory.");
+DEFINE_string(leaf_hash_file, "",
+              "The log's --leaf_hash_file, if any, to write the leaf "
+              "hashes to as well.");
+DEFINE_string(tree_checkpoint_file, "",
+              "The log's --tree_checkpoint_file, if any, to checkpoint "
+              "the tree to.");
+
+static bool ValidateIsPositive(const char *flagname, int value) {
+  if (value <= 0) {
+    std::cout << flagname << " must be greater than 0" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool shard_dummy = RegisterFlagValidator(
+    &FLAGS_sharded_db_shard_size, &ValidateIsPositive);
+static const bool batch_dummy = RegisterFlagValidator(
+    &FLAGS_import_batch_size, &ValidateIsPositive);
+static const bool parallel_dummy = RegisterFlagValidator(
+    &FLAGS_get_entries_parallel, &ValidateIsPositive);
+static const bool fetch_dummy = RegisterFlagValidator(
+    &FLAGS_get_entries_batch_size, &ValidateIsPositive);
+
+namespace {
+
+// Converts entries and writes them in batches.
+class BatchWriter : public EntryFetcher::Callback {
+ public:
+  BatchWriter(Importer<LoggedCertificate> *importer, const string &key_id,
+              uint64_t tree_size)
+      : importer_(importer),
+        key_id_(key_id),
+        tree_size_(tree_size),
+        next_(importer->NextSequenceNumber()) {}
+
+  virtual void Entries(int first,
+                       std::vector<HTTPLogClient::LogEntry> *entries) {
+    CHECK_EQ(next_ + batch_.size(), static_cast<uint64_t>(first));
+    for (size_t i = 0; i < entries->size(); ++i)
+      Add((*entries)[i]);
+  }
+
+  void Add(const HTTPLogClient::LogEntry &entry) {
+    batch_.push_back(LoggedCertificate());
+    CHECK(batch_.back().CopyFromLeaf(entry.leaf, entry.entry))
+        << "Entry " << next_ + batch_.size() - 1 << " has an unknown type";
+    if (!key_id_.empty())
+      batch_.back().mutable_sct()->mutable_id()->set_key_id(key_id_);
+    if (batch_.size() >= static_cast<size_t>(FLAGS_import_batch_size))
+      Flush();
+  }
+
+  void Flush() {
+    if (batch_.empty())
+      return;
+    Importer<LoggedCertificate>::ImportResult result =
+        importer_->Import(next_, batch_);
+    CHECK_EQ(Importer<LoggedCertificate>::IMPORT_OK, result)
+        << "Failed to import entries " << next_ << " to "
+        << next_ + batch_.size() - 1;
+    next_ += batch_.size();
+    batch_.clear();
+    LOG(INFO) << "Imported " << next_ << " of " << tree_size_ << " entries";
+  }
+
+ private:
+  Importer<LoggedCertificate> *const importer_;
+  const string key_id_;
+  const uint64_t tree_size_;
+  // The sequence number of the first entry of |batch_|.
+  uint64_t next_;
+  std::vector<LoggedCertificate> batch_;
+};
+
+LogVerifier *GetLogVerifier(const string &public_key) {
+  EVP_PKEY *pkey = NULL;
+  FILE *fp = fopen(public_key.c_str(), "r");
+  PCHECK(fp != NULL) << "Could not read " << public_key;
+  PEM_read_PUBKEY(fp, &pkey, NULL, NULL);
+  CHECK(pkey != NULL) << public_key
+                      << " is not a valid PEM-encoded public key.";
+  fclose(fp);
+  return new LogVerifier(new LogSigVerifier(pkey),
+                         new MerkleVerifier(new Sha256Hasher()));
+}
+
+// Parse a tree head from the JSON of a get-sth reply.
+bool ReadSTH(const string &file, SignedTreeHead *sth) {
+  string json;
+  if (!util::ReadBinaryFile(file, &json))
+    return false;
+  JsonObject jsth(json);
+  JsonInt tree_size(jsth, "tree_size");
+  JsonInt timestamp(jsth, "timestamp");
+  JsonString root_hash(jsth, "sha256_root_hash");
+  JsonString signature(jsth, "tree_head_signature");
+  if (!tree_size.Ok() || !timestamp.Ok() || !root_hash.Ok() ||
+      !signature.Ok())
+    return false;
+  sth->set_version(ct::V1);
+  sth->set_tree_size(tree_size.Value());
+  sth->set_timestamp(timestamp.Value());
+  sth->set_sha256_root_hash(root_hash.FromBase64());
+  return Deserializer::DeserializeDigitallySigned(
+      signature.FromBase64(), sth->mutable_signature()) == Deserializer::OK;
+}
+
+// Read the next length-prefixed field of a dump into |field|. Returns false
+// at the end of the file, and aborts at a truncated field.
+bool ReadField(FILE *file, string *field) {
+  unsigned char length[4];
+  const size_t read = fread(length, 1, sizeof length, file);
+  if (read == 0 && feof(file))
+    return false;
+  CHECK_EQ(sizeof length, read) << "Truncated dump";
+  const size_t size = (static_cast<size_t>(length[0]) << 24) |
+      (length[1] << 16) | (length[2] << 8) | length[3];
+  field->resize(size);
+  CHECK(size == 0 || fread(&(*field)[0], 1, size, file) == size)
+      << "Truncated dump";
+  return true;
+}
+
+// Read the entries of the dump up to |tree_size|, and pass those from the
+// writer's next one on to it.
+void ImportDump(const string &dump_file, uint64_t start, uint64_t tree_size,
+                BatchWriter *writer) {
+  FILE *file = fopen(dump_file.c_str(), "rb");
+  PCHECK(file != NULL) << "Could not open " << dump_file;
+  string leaf, extra;
+  for (uint64_t index = 0; index < tree_size; ++index) {
+    CHECK(ReadField(file, &leaf) && ReadField(file, &extra))
+        << "The dump ends at entry " << index << " of " << tree_size;
+    if (index < start)
+      continue;
+    HTTPLogClient::LogEntry entry;
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeMerkleTreeLeaf(leaf, &entry.leaf))
+        << "Malformed leaf of entry " << index;
+    const ct::LogEntryType type = entry.leaf.timestamped_entry().entry_type();
+    if (type == ct::X509_ENTRY)
+      CHECK_EQ(Deserializer::OK, Deserializer::DeserializeX509Chain(
+          extra, entry.entry.mutable_x509_entry()))
+          << "Malformed chain of entry " << index;
+    else if (type == ct::PRECERT_ENTRY)
+      CHECK_EQ(Deserializer::OK, Deserializer::DeserializePrecertChainEntry(
+          extra, entry.entry.mutable_precert_entry()))
+          << "Malformed chain of entry " << index;
+    writer->Add(entry);
+  }
+  fclose(file);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  if ((FLAGS_sqlite_db != "" ? 1 : 0) + (FLAGS_leveldb_db != "" ? 1 : 0) +
+      (FLAGS_sharded_db != "" ? 1 : 0) != 1) {
+    std::cerr << "Choose one of sqlite, leveldb or sharded database"
+              << std::endl;
+    exit(1);
+  }
+  if ((FLAGS_source_log != "") == (FLAGS_dump_file != "") ||
+      (FLAGS_dump_file != "") != (FLAGS_dump_sth_file != "")) {
+    std::cerr << "Choose one of --source_log, or --dump_file with "
+              << "--dump_sth_file" << std::endl;
+    exit(1);
+  }
+
+  SignedTreeHead sth;
+  HTTPLogClient *client = NULL;
+  if (FLAGS_source_log != "") {
+    client = new HTTPLogClient(FLAGS_source_log);
+    CHECK_EQ(HTTPLogClient::OK, client->GetSTH(&sth))
+        << "Failed to get the tree head of " << FLAGS_source_log;
+  } else {
+    CHECK(ReadSTH(FLAGS_dump_sth_file, &sth))
+        << "Failed to read a tree head from " << FLAGS_dump_sth_file;
+  }
+  string key_id;
+  if (FLAGS_source_public_key != "") {
+    LogVerifier *verifier = GetLogVerifier(FLAGS_source_public_key);
+    CHECK_EQ(LogVerifier::VERIFY_OK, verifier->VerifySignedTreeHead(sth))
+        << "Invalid tree head";
+    key_id = verifier->KeyID();
+    sth.mutable_id()->set_key_id(key_id);
+    delete verifier;
+  }
+  LOG(INFO) << "Importing " << sth.tree_size() << " entries";
+
+  Database<LoggedCertificate> *db;
+  if (FLAGS_sqlite_db != "")
+    db = new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
+  else if (FLAGS_leveldb_db != "")
+    db = new LevelDB<LoggedCertificate>(FLAGS_leveldb_db);
+  else
+    db = new ShardedDB<LoggedCertificate>(FLAGS_sharded_db,
+                                          FLAGS_sharded_db_shard_size);
+
+  if (FLAGS_entry_compression_dictionary != "") {
+    string dictionary;
+    CHECK(util::ReadBinaryFile(FLAGS_entry_compression_dictionary,
+                               &dictionary))
+        << "Failed to read " << FLAGS_entry_compression_dictionary;
+    db->SetCompressor(new EntryCompressor(dictionary));
+  }
+
+  if (FLAGS_intermediate_dir != "")
+    db = new InterningDatabase(
+        db, new FileStorage(FLAGS_intermediate_dir,
+                            FLAGS_intermediate_storage_depth),
+        FLAGS_intermediate_cache_size);
+
+  Importer<LoggedCertificate> *importer = new Importer<LoggedCertificate>(
+      db, FLAGS_leaf_hash_file, FLAGS_tree_checkpoint_file);
+  const uint64_t start = importer->NextSequenceNumber();
+  // A database that is ahead can't be brought back.
+  CHECK_LE(start, sth.tree_size())
+      << "The database has more entries than the tree head";
+  BatchWriter writer(importer, key_id, sth.tree_size());
+  if (client != NULL) {
+    if (start < sth.tree_size()) {
+      EntryFetcher fetcher(*client, FLAGS_get_entries_parallel,
+                           FLAGS_get_entries_batch_size,
+                           FLAGS_get_entries_retries);
+      CHECK_EQ(HTTPLogClient::OK,
+               fetcher.Fetch(start, sth.tree_size() - 1, &writer))
+          << "Failed to get entries from " << FLAGS_source_log;
+    }
+  } else {
+    ImportDump(FLAGS_dump_file, start, sth.tree_size(), &writer);
+  }
+  writer.Flush();
+
+  int ret = 0;
+  switch (importer->Finish(sth)) {
+    case Importer<LoggedCertificate>::IMPORT_OK:
+      LOG(INFO) << "Imported the tree head of " << sth.tree_size()
+                << " entries";
+      break;
+    case Importer<LoggedCertificate>::ROOT_MISMATCH:
+      LOG(ERROR) << "The entries don't add up to the tree head: the root "
+                 << "is " << util::HexString(importer->CurrentRoot())
+                 << ", not " << util::HexString(sth.sha256_root_hash());
+      ret = 1;
+      break;
+    default:
+      LOG(ERROR) << "Failed to write the tree head";
+      ret = 1;
+  }
+
+  delete importer;
+  delete client;
+  delete db;
+  return ret;
+}
@@ -1,33 +1,78 @@
 /* -*- indent-tabs-mode: nil -*- */
 
+#include <algorithm>
+#include <boost/array.hpp>
 #include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
 // Note that this comes from cpp-netlib, not boost.
 #include <boost/network/protocol/http/server.hpp>
 #include <boost/network/uri.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <iostream>
+#include <map>
+#include <openssl/ec.h>
 #include <openssl/err.h>
 #include <openssl/pem.h>
+#include <openssl/ssl.h>
 #include <openssl/x509.h>
+#include <pthread.h>
+#include <set>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string>
-
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+#include "client/http_log_client.h"
+#include "log/caching_db.h"
 #include "log/cert.h"
 #include "log/cert_checker.h"
 #include "log/ct_extensions.h"
+#include "log/entry_compressor.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
 #include "log/frontend.h"
 #include "log/frontend_signer.h"
+#include "log/instrumented_db.h"
+#include "log/interning_db.h"
+#include "log/leveldb_db.h"
+#include "log/locking_db.h"
 #include "log/log_lookup.h"
 #include "log/log_signer.h"
 #include "log/logged_certificate.h"
+#include "log/replication.h"
+#include "log/segment_storage.h"
+#include "log/sequencing_queue.h"
+#include "log/sharded_db.h"
 #include "log/sqlite_db.h"
+#include "log/tile_exporter.h"
 #include "log/tree_signer.h"
+#include "merkletree/serial_hasher.h"
 #include "proto/ct.pb.h"
+#include "proto/serializer.h"
 #include "server/event.h"
+#include "util/json_reader.h"
 #include "util/json_wrapper.h"
+#include "util/json_writer.h"
+#include "util/lru_cache.h"
+#include "util/memory_usage.h"
+#include "util/metrics.h"
+#include "util/profiler.h"
+#include "util/startup_profiler.h"
+#include "util/thread_pool.h"
+#include "util/trace.h"
 #include "util/openssl_util.h"
+#include "util/util.h"
 
 DEFINE_string(server, "localhost", "Server host");
 DEFINE_string(port, "9999", "Server port");
@@ -36,14 +81,68 @@ DEFINE_string(trusted_cert_file, "",
               "File for trusted CA certificates, in concatenated PEM format");
 DEFINE_string(cert_dir, "", "Storage directory for certificates");
 DEFINE_string(tree_dir, "", "Storage directory for trees");
+DEFINE_string(cert_index_file, "",
+              "File for indexing the certificate directory across restarts, "
+              "so that only pending entries are read at startup. "
+              "Leave empty to scan the whole directory.");
 DEFINE_string(sqlite_db, "", "Database for certificate and tree storage");
+DEFINE_string(leveldb_db, "",
+              "LevelDB directory for certificate and tree storage");
+DEFINE_string(entry_compression_dictionary, "",
+              "File with the dictionary that stored entries are compressed "
+              "with. If the file doesn't exist, a dictionary is trained on "
+              "the latest logged entries and written there. Entries "
+              "compressed with a dictionary can't be read without it.");
+DEFINE_string(sharded_db, "",
+              "Directory for certificate and tree storage in SQLite files, "
+              "one per sharded_db_shard_size sequenced entries");
+DEFINE_int32(sharded_db_shard_size, 1 << 20,
+             "Sequenced entries per --sharded_db shard. Must be the same "
+             "every time the directory is used. Must be greater than 0.");
+DEFINE_string(leaf_hash_file, "",
+              "File for caching Merkle tree leaf hashes across restarts, "
+              "so that the tree need not be rebuilt from the database. "
+              "Leave empty to disable.");
+DEFINE_string(tree_checkpoint_file, "",
+              "File for checkpointing the signer's Merkle tree with each "
+              "tree head, so that a restarting signer need not replay the "
+              "whole log. Leave empty to disable.");
+DEFINE_string(shared_lookup_file, "",
+              "File to publish the lookup's Merkle tree and leaf index to, "
+              "best on tmpfs, so that other processes serving the log on "
+              "this host, e.g. ct-dns-server, can attach to it rather than "
+              "build their own. Each log needs a file of its own. Leave "
+              "empty to disable.");
+DEFINE_int32(shared_lookup_max_entries, 1 << 26,
+             "Number of entries that shared_lookup_file has room for. The "
+             "file is sparse, so room not taken costs no memory. Must be "
+             "greater than 0.");
 // TODO(ekasper): sanity-check these against the directory structure.
 DEFINE_int32(cert_storage_depth, 0,
              "Subdirectory depth for certificates; if the directory is not "
              "empty, must match the existing depth.");
+DEFINE_int32(cert_segment_size_mb, 0,
+             "If positive, append certificates to segment files of up to "
+             "this many megabytes instead of writing a file for each one. "
+             "Cannot be changed for an existing certificate directory.");
 DEFINE_int32(tree_storage_depth, 0,
              "Subdirectory depth for tree signatures; if the directory is not "
              "empty, must match the existing depth");
+DEFINE_string(intermediate_dir, "",
+              "If set, store each chain certificate once in this directory, "
+              "and only its hash with each entry. Entries logged with "
+              "--intermediate_dir can't be read without it.");
+DEFINE_int32(intermediate_storage_depth, 0,
+             "Subdirectory depth for --intermediate_dir; if the directory is "
+             "not empty, must match the existing depth.");
+DEFINE_int32(intermediate_cache_size, 10000,
+             "Number of --intermediate_dir certificates to keep in memory.");
+DEFINE_int32(entry_cache_size, 0,
+             "Number of recently looked up entries to keep in memory, both by "
+             "hash and by sequence number. 0 disables the cache.");
+DEFINE_bool(storage_stats, true,
+            "Count the calls, latency, rows and bytes of each storage "
+            "operation, for the metrics and the statistics log.");
 DEFINE_int32(log_stats_frequency_seconds, 3600,
              "Interval for logging summary statistics. Approximate: the server "
              "will log statistics if in the beginning of its select loop, "
@@ -55,6 +154,129 @@ DEFINE_int32(tree_signing_frequency_seconds, 600,
              "server select loop, at least this period has elapsed since the "
              "last signing. Set this well below the MMD to ensure we sign "
              "in a timely manner. Must be greater than 0.");
+DEFINE_int32(tree_signing_max_entries, 0,
+             "Maximum number of new entries to sequence per signing. When a "
+             "signing leaves entries pending, the next one runs right away "
+             "rather than after tree_signing_frequency_seconds, so that a "
+             "backlog is worked off in bounded steps. 0 means no limit.");
+DEFINE_bool(tree_signing_pipelined, false,
+            "Read and hash the next batch of pending entries while signing "
+            "the current tree head. Entries submitted in the meantime are "
+            "then only sequenced by the signing after next.");
+DEFINE_int32(max_pending_certs, 0,
+             "Refuse add-chain requests with 503 Service Unavailable while "
+             "this many entries are waiting to be sequenced. 0 means no "
+             "limit.");
+DEFINE_int32(max_pending_precerts, 0,
+             "As max_pending_certs, for add-pre-chain requests. Setting it "
+             "higher keeps room for precertificates, which hold up "
+             "issuance, when certificates are refused.");
+DEFINE_int32(server_threads, 4,
+             "Number of threads serving requests. Tree signing runs on a "
+             "thread of its own. Must be greater than 0.");
+DEFINE_int32(compute_threads, 0,
+             "Number of worker threads that parallel leaf hashing, SCT "
+             "signing and startup scans share. 0 means one per CPU core "
+             "but one, since the threads that hand them work help out.");
+DEFINE_bool(pin_compute_threads, false,
+            "Pin each of the compute_threads to a CPU core of its own.");
+DEFINE_int32(max_concurrent_submissions, 0,
+             "Most add-chain and add-pre-chain requests to serve at once, "
+             "across all logs; more are refused with 503 and Retry-After. "
+             "Keep it below server_threads, so that the lookups that cost "
+             "next to nothing aren't stuck behind a burst of submissions. "
+             "0 means no limit.");
+DEFINE_int32(max_concurrent_bulk_reads, 0,
+             "As max_concurrent_submissions, for get-entries and "
+             "get-replication-update requests.");
+DEFINE_int32(get_entries_cache_blocks, 0,
+             "Number of blocks of 256 sequenced entries to keep encoded for "
+             "get-entries replies. 0 disables the cache.");
+DEFINE_int32(get_entries_max_range, 1000,
+             "Maximum number of entries in one JSON get-entries reply. "
+             "Longer ranges are cut short. Must be greater than 0.");
+DEFINE_int32(get_entries_binary_max_range, 65536,
+             "As get_entries_max_range, for binary replies.");
+DEFINE_int32(get_entries_max_bytes, 8 << 20,
+             "Roughly the most bytes of encoded entries in one get-entries "
+             "reply, before compression: replies end at the first block of "
+             "256 entries that reaches it. Told to clients in the "
+             "X-CT-Max-Bytes header, so that they can ask for ranges that "
+             "fit. 0 means no limit but the ranges'.");
+DEFINE_string(tile_dir, "",
+              "Directory to export the log to as static tiles, for a web "
+              "server or CDN to serve. Leave empty to disable.");
+DEFINE_int32(tile_export_frequency_seconds, 60,
+             "How often to export new tree heads to tile_dir. Must be "
+             "greater than 0.");
+DEFINE_int32(max_proof_batch, 1000,
+             "Maximum number of hashes in one get-proofs-by-hash request. "
+             "Must be greater than 0.");
+DEFINE_int32(trace_sample_every, 0,
+             "Trace one in this many submissions and signings, or none if 0. "
+             "The traces are served at /debug/trace.");
+DEFINE_int32(trace_max_spans, 100000,
+             "Number of the latest trace spans to keep.");
+DEFINE_bool(profiling_endpoint, false,
+            "Serve CPU profiles at /debug/pprof/profile?seconds=N, and heap "
+            "profiles at /debug/pprof/heap, to clients on the loopback "
+            "interface. A CPU profile holds a server thread meanwhile.");
+DEFINE_string(log_config, "",
+              "File of the logs to host, one per line: the URL prefix of "
+              "the log, e.g. /2016, followed by name=value settings of any "
+              "of the flags key, trusted_cert_file, cert_dir, tree_dir, "
+              "cert_index_file, sqlite_db, leveldb_db, sharded_db, "
+              "leaf_hash_file, tree_checkpoint_file, intermediate_dir, "
+              "entry_compression_dictionary, tile_dir, replicate_from and "
+              "shared_lookup_file for that log. "
+              "Those not set come from the flags. If empty, one log is "
+              "hosted at the root.");
+DEFINE_int32(signature_cache_size, 10000,
+             "Number of verified certificate signatures to remember, "
+             "shared by all logs.");
+DEFINE_int32(parsed_cert_cache_size, 10000,
+             "Number of parsed submitted certificates to remember, shared "
+             "by all logs.");
+DEFINE_string(replicate_from, "",
+              "Serve a read-only replica of the log at this host:port, "
+              "followed by its prefix if it has one, e.g. "
+              "primary:9999/2016, rather than sequence and sign. The "
+              "replica keeps a database of its own.");
+DEFINE_int32(replication_max_entries, 1000,
+             "Maximum number of entries in one replication update served to "
+             "replicas. Must be greater than 0.");
+DEFINE_int32(replication_wait_seconds, 10,
+             "How long a replica's request for an update waits for a new "
+             "tree head if there is nothing new, holding a server thread; "
+             "0 replies at once.");
+DEFINE_int32(replication_retry_seconds, 5,
+             "How long a replica waits after a failed replication update. "
+             "Must be greater than 0.");
+DEFINE_string(tls_port, "", "Port to also serve HTTPS on, with "
+              "--tls_cert_chain_file and --tls_key_file; empty serves "
+              "plain HTTP only.");
+DEFINE_string(tls_cert_chain_file, "", "PEM-encoded certificate chain of "
+              "the HTTPS server, leaf first");
+DEFINE_string(tls_key_file, "", "PEM-encoded private key of "
+              "--tls_cert_chain_file");
+DEFINE_int32(tls_session_cache_size, 20480, "Number of TLS sessions to "
+             "keep for clients to resume by session ID. 0 disables the "
+             "cache.");
+DEFINE_int32(tls_session_timeout_seconds, 3600, "How long clients can "
+             "resume a TLS session, by session ID or ticket");
+DEFINE_bool(tls_session_tickets, true, "Let clients resume TLS sessions "
+            "with session tickets, which keep no state on the server");
+DEFINE_string(tls_ticket_key_file, "", "File of the key that session "
+              "tickets are encrypted with, for servers behind one name to "
+              "share, so that any of them can resume a session. If empty, "
+              "a key is made up at startup.");
+DEFINE_bool(tls_reuse_ecdh_key, false, "Make one ECDHE key at startup and "
+            "use it in every handshake, rather than a key for each. Saves "
+            "a key generation per full handshake, but gives up forward "
+            "secrecy between the handshakes of the process. Only with "
+            "OpenSSL before 1.1.0, which always makes a new key.");
+DEFINE_int32(tls_idle_timeout_seconds, 60, "How long HTTPS connections are "
+             "kept open, between requests or mid-request, without traffic");
 
 namespace http = boost::network::http;
 namespace uri = boost::network::uri;
@@ -65,9 +287,12 @@ using ct::CertChecker;
 using ct::LoggedCertificate;
 using ct::PreCertChain;
 using ct::ShortMerkleAuditProof;
+using ct::ParsedCertCache;
+using ct::SignatureCache;
 using ct::SignedCertificateTimestamp;
 using google::RegisterFlagValidator;
 using std::string;
+using util::JsonWriter;
 
 // Basic sanity checks on flag values.
 static bool ValidatePort(const char *flagname, const string &port_str) {
@@ -122,6 +347,32 @@ static const bool c_st_dummy = RegisterFlagValidator(&FLAGS_cert_storage_depth,
                                                      &ValidateIsNonNegative);
 static const bool t_st_dummy = RegisterFlagValidator(&FLAGS_tree_storage_depth,
                                                      &ValidateIsNonNegative);
+static const bool seg_dummy = RegisterFlagValidator(
+    &FLAGS_cert_segment_size_mb, &ValidateIsNonNegative);
+static const bool cache_dummy = RegisterFlagValidator(
+    &FLAGS_entry_cache_size, &ValidateIsNonNegative);
+static const bool i_st_dummy = RegisterFlagValidator(
+    &FLAGS_intermediate_storage_depth, &ValidateIsNonNegative);
+static const bool i_cache_dummy = RegisterFlagValidator(
+    &FLAGS_intermediate_cache_size, &ValidateIsNonNegative);
+static const bool max_dummy = RegisterFlagValidator(
+    &FLAGS_tree_signing_max_entries, &ValidateIsNonNegative);
+static const bool p_cert_dummy = RegisterFlagValidator(
+    &FLAGS_max_pending_certs, &ValidateIsNonNegative);
+static const bool p_pre_dummy = RegisterFlagValidator(
+    &FLAGS_max_pending_precerts, &ValidateIsNonNegative);
+static const bool g_cache_dummy = RegisterFlagValidator(
+    &FLAGS_get_entries_cache_blocks, &ValidateIsNonNegative);
+static const bool trace_dummy = RegisterFlagValidator(
+    &FLAGS_trace_sample_every, &ValidateIsNonNegative);
+static const bool r_wait_dummy = RegisterFlagValidator(
+    &FLAGS_replication_wait_seconds, &ValidateIsNonNegative);
+static const bool l_sub_dummy = RegisterFlagValidator(
+    &FLAGS_max_concurrent_submissions, &ValidateIsNonNegative);
+static const bool l_bulk_dummy = RegisterFlagValidator(
+    &FLAGS_max_concurrent_bulk_reads, &ValidateIsNonNegative);
+static const bool compute_dummy = RegisterFlagValidator(
+    &FLAGS_compute_threads, &ValidateIsNonNegative);
 
 static bool ValidateIsPositive(const char *flagname, int value) {
   if (value <= 0) {
@@ -137,6 +388,227 @@ static const bool stats_dummy = RegisterFlagValidator(
 static const bool sign_dummy = RegisterFlagValidator(
     &FLAGS_tree_signing_frequency_seconds, &ValidateIsPositive);
 
+static const bool shard_dummy = RegisterFlagValidator(
+    &FLAGS_sharded_db_shard_size, &ValidateIsPositive);
+
+static const bool threads_dummy = RegisterFlagValidator(
+    &FLAGS_server_threads, &ValidateIsPositive);
+
+static const bool tile_dummy = RegisterFlagValidator(
+    &FLAGS_tile_export_frequency_seconds, &ValidateIsPositive);
+
+static const bool batch_dummy = RegisterFlagValidator(
+    &FLAGS_max_proof_batch, &ValidateIsPositive);
+
+static const bool range_dummy = RegisterFlagValidator(
+    &FLAGS_get_entries_max_range, &ValidateIsPositive);
+
+static const bool b_range_dummy = RegisterFlagValidator(
+    &FLAGS_get_entries_binary_max_range, &ValidateIsPositive);
+
+static const bool ge_bytes_dummy = RegisterFlagValidator(
+    &FLAGS_get_entries_max_bytes, &ValidateIsNonNegative);
+
+static const bool spans_dummy = RegisterFlagValidator(
+    &FLAGS_trace_max_spans, &ValidateIsPositive);
+
+static const bool sig_cache_dummy = RegisterFlagValidator(
+    &FLAGS_signature_cache_size, &ValidateIsPositive);
+
+static const bool parsed_cache_dummy = RegisterFlagValidator(
+    &FLAGS_parsed_cert_cache_size, &ValidateIsPositive);
+
+static const bool r_max_dummy = RegisterFlagValidator(
+    &FLAGS_replication_max_entries, &ValidateIsPositive);
+
+static const bool r_retry_dummy = RegisterFlagValidator(
+    &FLAGS_replication_retry_seconds, &ValidateIsPositive);
+
+static const bool shared_max_dummy = RegisterFlagValidator(
+    &FLAGS_shared_lookup_max_entries, &ValidateIsPositive);
+
+static const bool tls_cache_dummy = RegisterFlagValidator(
+    &FLAGS_tls_session_cache_size, &ValidateIsNonNegative);
+
+static const bool tls_timeout_dummy = RegisterFlagValidator(
+    &FLAGS_tls_session_timeout_seconds, &ValidateIsPositive);
+
+static const bool tls_idle_dummy = RegisterFlagValidator(
+    &FLAGS_tls_idle_timeout_seconds, &ValidateIsPositive);
+
+namespace {
+
+const char kRequests[] = "ct_requests_total";
+const char kRequestSeconds[] = "ct_request_seconds";
+const char kSigningSeconds[] = "ct_signing_round_seconds";
+const char kSigningEntries[] = "ct_signing_round_entries";
+const char kTreeSize[] = "ct_tree_size";
+const char kPending[] = "ct_pending_entries";
+const char kCacheLookups[] = "ct_cache_lookups_total";
+const char kStartupStage[] = "ct_startup_stage";
+const char kStartupSeconds[] = "ct_startup_seconds";
+const char kReplicationLagEntries[] = "ct_replication_lag_entries";
+const char kReplicationLagSeconds[] = "ct_replication_lag_seconds";
+const char kReplicationErrors[] = "ct_replication_errors_total";
+const char kLaneInFlight[] = "ct_lane_requests_in_flight";
+const char kLaneRefused[] = "ct_lane_refused_total";
+const char kTLSHandshakes[] = "ct_tls_handshakes_total";
+
+// Seconds that clients asking for proofs during startup are told to wait.
+const int kStartupRetrySeconds = 10;
+
+// Seconds that clients refused by a full lane are told to wait.
+const int kLaneRetrySeconds = 1;
+
+// Seconds that CPU profiles served by /debug/pprof/profile last, by
+// default and at most.
+const int kDefaultProfileSeconds = 30;
+const int kMaxProfileSeconds = 300;
+
+// Upper bounds for the entries sequenced per signing.
+std::vector<double> EntryBuckets() {
+  std::vector<double> buckets;
+  for (double bound = 1; bound <= 1e7; bound *= 10)
+    buckets.push_back(bound);
+  return buckets;
+}
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+// |data| as a gzip stream.
+string Gzip(const string &data) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // 16 more window bits ask for a gzip header and trailer.
+  CHECK_EQ(Z_OK, deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                              15 + 16, 8, Z_DEFAULT_STRATEGY));
+  string compressed(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+  stream.avail_out = compressed.size();
+  CHECK_EQ(Z_STREAM_END, deflate(&stream, Z_FINISH));
+  compressed.resize(stream.total_out);
+  CHECK_EQ(Z_OK, deflateEnd(&stream));
+  return compressed;
+}
+
+// The settings of one hosted log that differ between logs.
+struct LogConfig {
+  // Those of the flags.
+  LogConfig()
+      : key(FLAGS_key),
+        trusted_cert_file(FLAGS_trusted_cert_file),
+        cert_dir(FLAGS_cert_dir),
+        tree_dir(FLAGS_tree_dir),
+        cert_index_file(FLAGS_cert_index_file),
+        sqlite_db(FLAGS_sqlite_db),
+        leveldb_db(FLAGS_leveldb_db),
+        sharded_db(FLAGS_sharded_db),
+        leaf_hash_file(FLAGS_leaf_hash_file),
+        tree_checkpoint_file(FLAGS_tree_checkpoint_file),
+        intermediate_dir(FLAGS_intermediate_dir),
+        entry_compression_dictionary(FLAGS_entry_compression_dictionary),
+        tile_dir(FLAGS_tile_dir),
+        replicate_from(FLAGS_replicate_from),
+        shared_lookup_file(FLAGS_shared_lookup_file) {}
+
+  // Set the setting |name|; returns false if there is no such setting.
+  bool Set(const string &name, const string &value) {
+    string *const settings[] = {
+      &key, &trusted_cert_file, &cert_dir, &tree_dir, &cert_index_file,
+      &sqlite_db, &leveldb_db, &sharded_db, &leaf_hash_file,
+      &tree_checkpoint_file, &intermediate_dir,
+      &entry_compression_dictionary, &tile_dir, &replicate_from,
+      &shared_lookup_file,
+    };
+    static const char *const kNames[] = {
+      "key", "trusted_cert_file", "cert_dir", "tree_dir", "cert_index_file",
+      "sqlite_db", "leveldb_db", "sharded_db", "leaf_hash_file",
+      "tree_checkpoint_file", "intermediate_dir",
+      "entry_compression_dictionary", "tile_dir", "replicate_from",
+      "shared_lookup_file",
+    };
+    for (size_t i = 0; i < sizeof kNames / sizeof kNames[0]; ++i) {
+      if (name == kNames[i]) {
+        settings[i]->assign(value);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Requests for this log start with it; empty for a log at the root.
+  string prefix;
+  string key;
+  string trusted_cert_file;
+  string cert_dir;
+  string tree_dir;
+  string cert_index_file;
+  string sqlite_db;
+  string leveldb_db;
+  string sharded_db;
+  string leaf_hash_file;
+  string tree_checkpoint_file;
+  string intermediate_dir;
+  string entry_compression_dictionary;
+  string tile_dir;
+  // Where a replica replicates from; empty for a log that signs.
+  string replicate_from;
+  string shared_lookup_file;
+};
+
+// The logs that --log_config lists, or if it is empty, the one the flags
+// describe.
+std::vector<LogConfig> ReadLogConfigs() {
+  std::vector<LogConfig> configs;
+  if (FLAGS_log_config == "") {
+    configs.push_back(LogConfig());
+    return configs;
+  }
+
+  string contents;
+  CHECK(util::ReadTextFile(FLAGS_log_config, &contents))
+      << "Could not read " << FLAGS_log_config;
+  std::istringstream lines(contents);
+  string line;
+  std::set<string> prefixes;
+  while (std::getline(lines, line)) {
+    std::istringstream words(line);
+    LogConfig config;
+    if (!(words >> config.prefix) || config.prefix[0] == '#')
+      continue;
+    CHECK(config.prefix.size() > 1 && config.prefix[0] == '/' &&
+          config.prefix[config.prefix.size() - 1] != '/')
+        << "Bad log prefix " << config.prefix << " in " << FLAGS_log_config;
+    CHECK(prefixes.insert(config.prefix).second)
+        << "Log prefix " << config.prefix << " repeated in "
+        << FLAGS_log_config;
+    string setting;
+    while (words >> setting) {
+      const size_t equals = setting.find('=');
+      CHECK(equals != string::npos &&
+            config.Set(setting.substr(0, equals), setting.substr(equals + 1)))
+          << "Bad setting " << setting << " for log " << config.prefix;
+    }
+    configs.push_back(config);
+  }
+  CHECK(!configs.empty()) << "No logs in " << FLAGS_log_config;
+  return configs;
+}
+
+}  // namespace
+
 // convert a boost single-shot timer (deadline_timer) into a repeat
 // timer.
 class AsioRepeatedEvent {
@@ -150,6 +622,11 @@ class AsioRepeatedEvent {
 protected:
   virtual void Execute() = 0;
 
+  // Events that have work left over from the last execution can return true
+  // to execute again as soon as other pending handlers have run, instead of
+  // waiting for the full period.
+  virtual bool RepeatSoon() { return false; }
+
  private:
   static void Call(const boost::system::error_code& /*e*/,
                    AsioRepeatedEvent *event) {
@@ -163,7 +640,10 @@ protected:
 
   void Go() {
     Execute();
-    timer_.expires_at(timer_.expires_at() + frequency_);
+    if (RepeatSoon())
+      timer_.expires_from_now(boost::posix_time::seconds(0));
+    else
+      timer_.expires_at(timer_.expires_at() + frequency_);
     Wait();
   }
 
@@ -171,21 +651,100 @@ protected:
   boost::asio::deadline_timer timer_;
 };
 
+// Submissions and lookups may come from several threads at once, with
+// the database locked for each of its calls; signing must run on one
+// thread at a time.
+//
+// A replica takes no submissions and doesn't sign; its lookup is brought
+// up to date as the replication thread writes what the primary sends.
+//
+// Building the trees of the signer and the lookup takes a while for a
+// large log, so the manager starts without them: submissions, tree heads
+// and entries are served from the database meanwhile. Proofs and signing
+// wait until SetTrees().
 class CTLogManager {
  public:
-  CTLogManager(Frontend *frontend,
-               TreeSigner<LoggedCertificate> *signer,
-               LogLookup<LoggedCertificate> *lookup)
+  // Startup stages, in order.
+  enum Stage {
+    LOADING_SIGNER,
+    LOADING_LOOKUP,
+    READY,
+  };
+
+  // |pending| is the number of entries waiting to be sequenced at startup.
+  // Records signings in |metrics|, which must outlive the manager.
+  CTLogManager(Frontend *frontend, const Database<LoggedCertificate> *db,
+               uint64_t pending, util::Metrics *metrics, bool replica)
       : frontend_(frontend),
-        signer_(signer),
-        lookup_(lookup) {
+        db_(db),
+        replica_(replica),
+        signer_(NULL),
+        lookup_(NULL),
+        stage_(LOADING_SIGNER),
+        start_time_(util::TimeInMilliseconds()),
+        ready_time_(0),
+        metrics_(metrics),
+        initial_pending_(pending),
+        initial_tree_size_(DatabaseSTH().tree_size()),
+        last_signing_time_(util::TimeInMilliseconds()),
+        last_signing_tree_size_(initial_tree_size_),
+        signing_rate_(0) {
+    CHECK_EQ(0, pthread_mutex_init(&rate_mutex_, NULL));
+    metrics_->DefineHistogram(kSigningSeconds,
+                              "Duration of signing rounds, in seconds.",
+                              util::Metrics::LatencyBuckets());
+    metrics_->DefineHistogram(kSigningEntries,
+                              "Entries sequenced per signing round.",
+                              EntryBuckets());
+    metrics_->DefineGauge(kTreeSize, "Entries in the latest tree head.");
+    metrics_->DefineGauge(kPending, "Entries waiting to be sequenced.");
+    metrics_->DefineGauge(kStartupStage,
+                          "1 for the startup stage the log is in, by stage.");
+    metrics_->DefineGauge(kStartupSeconds,
+                          "Seconds spent loading the trees, so far.");
     LOG(INFO) << "Starting CT log manager";
-    time_t last_update = static_cast<time_t>(signer_->LastUpdateTime() / 1000);
-    if (last_update > 0)
-      LOG(INFO) << "Last tree update was at " << ctime(&last_update);
-}
+  }
+
+  // Moves on to loading the lookup's tree.
+  void SignerLoaded() {
+    __sync_synchronize();
+    stage_ = LOADING_LOOKUP;
+  }
+
+  // Start serving proofs from |lookup| and signing with |signer|, which
+  // the manager takes ownership of. Replicas have no |signer|.
+  void SetTrees(TreeSigner<LoggedCertificate> *signer,
+                LogLookup<LoggedCertificate> *lookup) {
+    CHECK(!Ready());
+    CHECK_EQ(replica_, signer == NULL);
+    signer_ = signer;
+    lookup_ = lookup;
+    ready_time_ = util::TimeInMilliseconds();
+    if (signer_ != NULL) {
+      // The lookup is updated from the signer's rounds.
+      signer_->AddLeafHashObserver(lookup_->leaf_hash_observer());
+      time_t last_update =
+          static_cast<time_t>(signer_->LastUpdateTime() / 1000);
+      if (last_update > 0)
+        LOG(INFO) << "Last tree update was at " << ctime(&last_update);
+    }
+    LOG(INFO) << "Trees loaded in " << (ready_time_ - start_time_) / 1000.0
+              << " seconds";
+    // Publish the trees before saying so.
+    __sync_synchronize();
+    stage_ = READY;
+  }
+
+  // Whether proofs can be served and trees signed.
+  bool Ready() const {
+    if (stage_ != READY)
+      return false;
+    __sync_synchronize();
+    return true;
+  }
 
   ~CTLogManager() {
+    pthread_mutex_destroy(&rate_mutex_);
     delete frontend_;
     delete signer_;
     delete lookup_;
@@ -194,6 +753,8 @@ class CTLogManager {
   enum LogReply {
     SIGNED_CERTIFICATE_TIMESTAMP,
     REJECT,
+    // Too many entries are pending; try again later.
+    BUSY,
   };
 
   enum LookupReply {
@@ -233,11 +794,31 @@ class CTLogManager {
     return ss.str();
   }
 
+  // On BUSY, |retry_after| is the number of seconds to wait before
+  // submitting again.
   LogReply SubmitEntry(CertChain *chain, PreCertChain *prechain,
-                       SignedCertificateTimestamp *sct, string *error) const {
+                       SignedCertificateTimestamp *sct, string *error,
+                       int *retry_after) const {
     CHECK(chain != NULL || prechain != NULL);
     CHECK(!(chain != NULL && prechain != NULL));
 
+    if (replica_) {
+      error->assign("Log is a read-only replica");
+      return REJECT;
+    }
+
+    // Refuse before verifying the chain, which is most of the work.
+    const uint64_t max_pending = chain != NULL ? FLAGS_max_pending_certs
+        : FLAGS_max_pending_precerts;
+    if (max_pending > 0) {
+      const uint64_t pending = Pending();
+      if (pending >= max_pending) {
+        *retry_after = RetryAfter(pending - max_pending + 1);
+        error->assign("Too many pending entries");
+        return BUSY;
+      }
+    }
+
     SignedCertificateTimestamp local_sct;
     SubmitResult submit_result = chain != NULL ?
         frontend_->QueueX509Entry(chain, &local_sct)
@@ -247,7 +828,7 @@ class CTLogManager {
     switch (submit_result) {
       case ADDED:
       case DUPLICATE:
-        sct->CopyFrom(local_sct);
+        sct->Swap(&local_sct);
         reply = SIGNED_CERTIFICATE_TIMESTAMP;
         break;
       default:
@@ -257,28 +838,87 @@ class CTLogManager {
     return reply;
   }
 
-  LookupReply GetEntry(size_t index, LoggedCertificate *result) const {
-    if (lookup_->GetEntry(index, result) == LogLookup<LoggedCertificate>::OK)
+  // Pass the entries |start| to |end| - 1 to |callback|, in order.
+  LookupReply GetEntries(
+      size_t start, size_t end,
+      Database<LoggedCertificate>::EntryCallback *callback) const {
+    if (db_->LookupByIndexRange(start, end, callback) ==
+        Database<LoggedCertificate>::LOOKUP_OK)
       return FOUND;
     return NOT_FOUND;
   }
 
+  // Proofs need Ready().
   LookupReply QueryAuditProof(const std::string &merkle_leaf_hash,
                               size_t tree_size,
                               ct::ShortMerkleAuditProof *proof) const {
+    CHECK(Ready());
     ct::ShortMerkleAuditProof local_proof;
     LogLookup<LoggedCertificate>::LookupResult res =
         lookup_->AuditProof(merkle_leaf_hash, tree_size, &local_proof);
     if (res == LogLookup<LoggedCertificate>::OK) {
-      proof->CopyFrom(local_proof);
+      proof->Swap(&local_proof);
       return MERKLE_AUDIT_PROOF;
     }
     CHECK_EQ(LogLookup<LoggedCertificate>::NOT_FOUND, res);
     return NOT_FOUND;
   }
 
+  // As QueryAuditProof(), for several hashes at once. |found| says which
+  // of them have a proof; returns NOT_FOUND if any of them is missing.
+  LookupReply QueryAuditProofs(const std::vector<string> &merkle_leaf_hashes,
+                               size_t tree_size,
+                               std::vector<ShortMerkleAuditProof> *proofs,
+                               std::vector<bool> *found) const {
+    CHECK(Ready());
+    LogLookup<LoggedCertificate>::LookupResult res =
+        lookup_->AuditProof(merkle_leaf_hashes, tree_size, proofs, found);
+    if (res == LogLookup<LoggedCertificate>::OK)
+      return MERKLE_AUDIT_PROOF;
+    CHECK_EQ(LogLookup<LoggedCertificate>::NOT_FOUND, res);
+    return NOT_FOUND;
+  }
+
+  // The number of entries waiting to be sequenced: those pending at
+  // startup and those added since, less those sequenced since.
+  uint64_t Pending() const {
+    Frontend::FrontendStats stats;
+    frontend_->GetStats(&stats);
+    const uint64_t waiting = initial_pending_ + stats.x509_accepted +
+        stats.precert_accepted;
+    const uint64_t sequenced = GetSTH().tree_size() - initial_tree_size_;
+    return waiting > sequenced ? waiting - sequenced : 0;
+  }
+
+  // Replicas only, once Ready(): the lookup takes the leaf hashes that the
+  // replication hands over, as a signer's would.
+  LeafHashObserver *leaf_hash_observer() const {
+    CHECK(replica_ && Ready());
+    return lookup_->leaf_hash_observer();
+  }
+
+  // Replicas only, once Ready(): pick up what the replication wrote.
+  void Replicated() const {
+    CHECK(replica_ && Ready());
+    const LogLookup<LoggedCertificate>::UpdateResult res = lookup_->Update();
+    CHECK(res == LogLookup<LoggedCertificate>::UPDATE_OK ||
+          res == LogLookup<LoggedCertificate>::NO_UPDATES_FOUND) << res;
+  }
+
+  // Does nothing until Ready(). Not for replicas.
   bool SignMerkleTree() const {
-    TreeSigner<LoggedCertificate>::UpdateResult res = signer_->UpdateTree();
+    CHECK(!replica_);
+    if (!Ready()) {
+      LOG(INFO) << "Not signing while the trees load";
+      return true;
+    }
+    util::Tracer::Span span("manager.sign_merkle_tree");
+    const uint64_t start = util::TimeInMicroseconds();
+    const uint64_t tree_size = signer_->LatestSTH().tree_size();
+    TreeSigner<LoggedCertificate>::UpdateResult res =
+        FLAGS_tree_signing_pipelined ?
+        signer_->UpdateTreePipelined(FLAGS_tree_signing_max_entries) :
+        signer_->UpdateTree(FLAGS_tree_signing_max_entries);
     if (res != TreeSigner<LoggedCertificate>::OK) {
       LOG(ERROR) << "Tree update failed with return code " << res;
       return false;
@@ -286,14 +926,48 @@ class CTLogManager {
     time_t last_update = static_cast<time_t>(signer_->LastUpdateTime() / 1000);
     LOG(INFO) << "Tree successfully updated at " << ctime(&last_update);
     CHECK_EQ(LogLookup<LoggedCertificate>::UPDATE_OK, lookup_->Update());
+    UpdateSigningRate();
+    metrics_->Observe(kSigningSeconds, "",
+                      (util::TimeInMicroseconds() - start) / 1e6);
+    metrics_->Observe(kSigningEntries, "",
+                      signer_->LatestSTH().tree_size() - tree_size);
     return true;
   }
 
+  // Bring the metrics kept elsewhere up to date.
+  void UpdateMetrics() const {
+    metrics_->Set(kTreeSize, "", GetSTH().tree_size());
+    metrics_->Set(kPending, "", Pending());
+    const Stage stage = stage_;
+    metrics_->Set(kStartupStage, "stage=\"loading_signer\"",
+                  stage == LOADING_SIGNER ? 1 : 0);
+    metrics_->Set(kStartupStage, "stage=\"loading_lookup\"",
+                  stage == LOADING_LOOKUP ? 1 : 0);
+    metrics_->Set(kStartupStage, "stage=\"ready\"", stage == READY ? 1 : 0);
+    const uint64_t end = Ready() ? ready_time_ : util::TimeInMilliseconds();
+    metrics_->Set(kStartupSeconds, "", (end - start_time_) / 1000.0);
+    frontend_->ExportStats(metrics_);
+    if (Ready())
+      lookup_->ExportMemoryUsage(metrics_);
+  }
+
+  // Whether the last signing left entries pending because of its cap.
+  bool SigningBacklog() const {
+    return Ready() && signer_->PendingBacklog();
+  }
+
+  // The signer's tree head is only safe to read from the signing thread,
+  // but the lookup's copy of it is brought up to date with each signing.
+  // Until then, the database has it.
   const ct::SignedTreeHead GetSTH() const {
-    return signer_->LatestSTH();
+    if (!Ready())
+      return DatabaseSTH();
+    return lookup_->GetSTH();
   }
 
+  // Needs Ready().
   std::vector<string> GetConsistency(size_t first, size_t second) const {
+    CHECK(Ready());
     return lookup_->ConsistencyProof(first, second);
   }
 
@@ -302,9 +976,59 @@ class CTLogManager {
   }
 
  private:
+  // Fold the entries sequenced since the last signing into the
+  // average rate at which the signer works off pending entries.
+  void UpdateSigningRate() const {
+    const uint64_t now = util::TimeInMilliseconds();
+    const uint64_t tree_size = signer_->LatestSTH().tree_size();
+    ScopedLock lock(&rate_mutex_);
+    if (now <= last_signing_time_)
+      return;
+    const double rate = (tree_size - last_signing_tree_size_) * 1000.0 /
+        (now - last_signing_time_);
+    signing_rate_ = signing_rate_ == 0 ? rate : (signing_rate_ + rate) / 2;
+    last_signing_time_ = now;
+    last_signing_tree_size_ = tree_size;
+  }
+
+  // How long the signer should take to sequence |excess| more entries, in
+  // seconds: at least one, and at most one signing interval if we don't
+  // know any better.
+  int RetryAfter(uint64_t excess) const {
+    const double interval = FLAGS_tree_signing_frequency_seconds;
+    ScopedLock lock(&rate_mutex_);
+    if (signing_rate_ * interval <= excess)
+      return FLAGS_tree_signing_frequency_seconds;
+    return std::max(1, static_cast<int>(excess / signing_rate_ + 0.5));
+  }
+
+  // The latest tree head in the database, or an empty one.
+  ct::SignedTreeHead DatabaseSTH() const {
+    ct::SignedTreeHead sth;
+    if (db_->LatestTreeHead(&sth) != Database<LoggedCertificate>::LOOKUP_OK)
+      sth.Clear();
+    return sth;
+  }
+
   Frontend *frontend_;
+  const Database<LoggedCertificate> *const db_;
+  const bool replica_;
+  // Set once they are loaded.
   TreeSigner<LoggedCertificate> *signer_;
   LogLookup<LoggedCertificate> *lookup_;
+  volatile Stage stage_;
+  const uint64_t start_time_;
+  uint64_t ready_time_;
+  util::Metrics *const metrics_;
+  const uint64_t initial_pending_;
+  const uint64_t initial_tree_size_;
+  // Signing is const, but keeps track of the signing rate, in entries per
+  // second.
+  mutable uint64_t last_signing_time_;
+  mutable uint64_t last_signing_tree_size_;
+  mutable double signing_rate_;
+  // Guards the signing rate, which submissions read.
+  mutable pthread_mutex_t rate_mutex_;
 };
 
 class TreeSigningEvent : public AsioRepeatedEvent {
@@ -319,70 +1043,449 @@ class TreeSigningEvent : public AsioRepeatedEvent {
     CHECK(manager_->SignMerkleTree());
    }
 
+  bool RepeatSoon() {
+    return manager_->SigningBacklog();
+  }
+
   private:
    CTLogManager *manager_;
 };
 
+class FrontendLogEvent : public AsioRepeatedEvent {
+ public:
+  // |cache| and |storage| may be NULL.
+  FrontendLogEvent(boost::shared_ptr<boost::asio::io_service> io,
+                   boost::posix_time::time_duration frequency,
+                   const CTLogManager *manager,
+                   const LockingDatabase<LoggedCertificate> *db,
+                   const CachingDatabase<LoggedCertificate> *cache,
+                   const InstrumentedDatabase<LoggedCertificate> *storage)
+      : AsioRepeatedEvent(io, frequency),
+        manager_(manager),
+        db_(db),
+        cache_(cache),
+        storage_(storage) {}
+
+  void Execute() {
+    LOG(INFO) << manager_->FrontendStats();
+    LockingDatabase<LoggedCertificate>::Hold hold(db_);
+    if (cache_ != NULL) {
+      CachingDatabase<LoggedCertificate>::CacheStats stats;
+      cache_->GetStats(&stats);
+      LOG(INFO) << "Entry cache hits by hash: " << stats.hash_hits << "/"
+                << stats.hash_hits + stats.hash_misses << ", by index: "
+                << stats.index_hits << "/"
+                << stats.index_hits + stats.index_misses;
+    }
+    if (storage_ != NULL)
+      LOG(INFO) << storage_->StatsSummary();
+  }
+
+ private:
+  const CTLogManager *manager_;
+  const LockingDatabase<LoggedCertificate> *db_;
+  const CachingDatabase<LoggedCertificate> *cache_;
+  const InstrumentedDatabase<LoggedCertificate> *storage_;
+};
+
+// Exports new tree heads as tiles. Catching up runs in steps, so that
+// tree signing, which shares the thread, isn't held up for long.
+class TileExportEvent : public AsioRepeatedEvent {
+ public:
+  static const size_t kStep = 1 << 16;
+
+  TileExportEvent(boost::shared_ptr<boost::asio::io_service> io,
+                  boost::posix_time::time_duration frequency,
+                  TileExporter<LoggedCertificate> *exporter)
+      : AsioRepeatedEvent(io, frequency),
+        exporter_(exporter),
+        done_(true) {}
+
+  void Execute() {
+    done_ = exporter_->Export(kStep);
+  }
+
+  bool RepeatSoon() {
+    return !done_;
+  }
+
+ private:
+  TileExporter<LoggedCertificate> *exporter_;
+  bool done_;
+};
+
+// Encodes the entries of a range lookup for the get-entries reply. JSON
+// entries are the comma-separated elements of the "entries" array. Binary
+// entries follow each other directly, each as its serialized MerkleTreeLeaf
+// and extra_data, both preceded by their length in 4 bytes, big-endian.
+class EntryWriter : public Database<LoggedCertificate>::EntryCallback {
+ public:
+  enum Format {
+    JSON,
+    BINARY,
+  };
+
+  explicit EntryWriter(Format format)
+      : separator_(format == JSON ? ", " : ""),
+        format_(format),
+        ok_(true) {}
+
+  virtual bool Entry(const LoggedCertificate &cert) {
+    string leaf_input;
+    string extra_data;
+    if (!cert.SerializeForLeaf(&leaf_input) ||
+        !cert.SerializeExtraData(&extra_data)) {
+      ok_ = false;
+      return false;
+    }
+    if (!offsets_.empty())
+      entries_.append(separator_);
+    offsets_.push_back(entries_.size());
+    if (format_ == BINARY) {
+      entries_.append(Serializer::SerializeUint(leaf_input.size(), 4));
+      entries_.append(leaf_input);
+      entries_.append(Serializer::SerializeUint(extra_data.size(), 4));
+      entries_.append(extra_data);
+    } else {
+      JsonWriter json(&entries_);
+      json.BeginObject();
+      json.Key("leaf_input");
+      json.AddBase64(leaf_input);
+      json.Key("extra_data");
+      json.AddBase64(extra_data);
+      json.EndObject();
+    }
+    return true;
+  }
+
+  bool Ok() const { return ok_; }
+
+  size_t Count() const { return offsets_.size(); }
+
+  // Append the entries |first| to |last| - 1 of those written to |out|,
+  // separated from what |out| holds already.
+  void AppendEntries(size_t first, size_t last, string *out) const {
+    CHECK_LE(last, Count());
+    if (first >= last)
+      return;
+    const size_t begin = offsets_[first];
+    const size_t end = last == Count() ? entries_.size() :
+        offsets_[last] - separator_.size();
+    if (!out->empty())
+      out->append(separator_);
+    out->append(entries_, begin, end - begin);
+  }
+
+  size_t HeapBytes() const {
+    return util::HeapBytes(entries_) + util::HeapBytes(offsets_);
+  }
+
+ private:
+  const string separator_;
+  const Format format_;
+  bool ok_;
+  string entries_;
+  // Where each entry starts in |entries_|.
+  std::vector<size_t> offsets_;
+};
+
+// Keeps the encoded entries of recently requested blocks of the log, so
+// that mirrors and monitors fetching the same ranges don't have them read
+// and encoded again. Only whole blocks of sequenced entries are cached:
+// those never change. Threads that miss the same block at once both read
+// it.
+class EntryBlockCache {
+ public:
+  static const size_t kBlockSize = 256;
+
+  // Keeps up to |max_blocks| blocks in |format|; 0 disables the cache.
+  // Counts hits and misses in |metrics|, as those of the cache |name|.
+  EntryBlockCache(const CTLogManager *manager, EntryWriter::Format format,
+                  size_t max_blocks, const string &name,
+                  util::Metrics *metrics)
+      : manager_(manager),
+        format_(format),
+        max_blocks_(max_blocks),
+        name_(name),
+        hit_("cache=\"" + name + "\",result=\"hit\""),
+        miss_("cache=\"" + name + "\",result=\"miss\""),
+        metrics_(metrics),
+        blocks_(max_blocks) {
+    CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+    metrics_->DefineCounter(kCacheLookups,
+                            "Cache lookups, by cache and result.");
+  }
+
+  ~EntryBlockCache() { pthread_mutex_destroy(&mutex_); }
+
+  // Append the encoded entries |start| to |end| - 1 to |out|, as far as
+  // the log has them, and set |*served_end| to one more than the last.
+  // Stops early at the end of the first block that takes |out| to
+  // |max_bytes| or more, unless that is 0. Returns false if an entry
+  // can't be encoded.
+  bool GetEntries(size_t start, size_t end, size_t max_bytes, string *out,
+                  size_t *served_end) {
+    *served_end = start;
+    const size_t tree_size = manager_->GetSTH().tree_size();
+    while (start < end) {
+      const size_t block_start = start - start % kBlockSize;
+      const size_t block_end = block_start + kBlockSize;
+      const size_t range_end = std::min(end, block_end);
+
+      if (max_blocks_ == 0 || block_end > tree_size) {
+        // Read just what was asked for.
+        EntryWriter writer(format_);
+        manager_->GetEntries(start, range_end, &writer);
+        if (!writer.Ok())
+          return false;
+        writer.AppendEntries(0, writer.Count(), out);
+        if (writer.Count() < range_end - start) {
+          *served_end = start + writer.Count();
+          return true;
+        }
+      } else {
+        boost::shared_ptr<const EntryWriter> block = Get(block_start);
+        metrics_->Increment(kCacheLookups, block != NULL ? hit_ : miss_);
+        if (block == NULL) {
+          boost::shared_ptr<EntryWriter> writer(new EntryWriter(format_));
+          manager_->GetEntries(block_start, block_end, writer.get());
+          if (!writer->Ok())
+            return false;
+          CHECK_EQ(kBlockSize, writer->Count())
+              << "Sequenced entries missing from " << block_start;
+          block = writer;
+          Put(block_start, block);
+        }
+        block->AppendEntries(start - block_start, range_end - block_start,
+                             out);
+      }
+      start = range_end;
+      *served_end = start;
+      if (max_bytes > 0 && out->size() >= max_bytes)
+        break;
+    }
+    return true;
+  }
+
+  // Set the memory accounting gauges of the cache in |metrics|.
+  void ExportMemoryUsage(util::Metrics *metrics) {
+    util::MemoryUsage usage;
+    {
+      ScopedLock lock(&mutex_);
+      usage = blocks_.MemoryUsage(BlockBytes);
+    }
+    util::ExportMemoryUsage(name_ + "_cache", usage, metrics);
+  }
+
+ private:
+  static size_t BlockBytes(const boost::shared_ptr<const EntryWriter> &block) {
+    return sizeof(EntryWriter) + block->HeapBytes();
+  }
+
+  boost::shared_ptr<const EntryWriter> Get(size_t block_start) {
+    ScopedLock lock(&mutex_);
+    boost::shared_ptr<const EntryWriter> block;
+    blocks_.Get(block_start, &block);
+    return block;
+  }
+
+  void Put(size_t block_start,
+           const boost::shared_ptr<const EntryWriter> &block) {
+    ScopedLock lock(&mutex_);
+    blocks_.Put(block_start, block);
+  }
+
+  const CTLogManager *manager_;
+  const EntryWriter::Format format_;
+  const size_t max_blocks_;
+  const string name_;
+  // Labels of the cache lookup counts.
+  const string hit_;
+  const string miss_;
+  util::Metrics *const metrics_;
+  // Guards |blocks_|, but isn't held while reading blocks.
+  pthread_mutex_t mutex_;
+  // Keyed by the index of the first entry of the block.
+  util::LRUCache<size_t, boost::shared_ptr<const EntryWriter> > blocks_;
+};
+
 class ct_server;
 typedef http::server<ct_server> server;
 
-class ct_server {
+// A reply body that is rendered once and served until it changes, with
+// its validators for conditional GETs.
+class CachedReply {
  public:
-  ct_server(CTLogManager *manager) : manager_(manager) {}
+  CachedReply() : modified_(0) {}
+
+  // Serve |content| from now on, last modified at |modified|.
+  void Set(const string &content, time_t modified) {
+    content_ = content;
+    etag_ = "\"" + util::HexString(Sha256Hasher::Sha256Digest(content))
+        .substr(0, 32) + "\"";
+    modified_ = modified;
+    char date[64];
+    struct tm tm;
+    strftime(date, sizeof date, "%a, %d %b %Y %H:%M:%S GMT",
+             gmtime_r(&modified, &tm));
+    last_modified_ = date;
+  }
 
-  void operator() (server::request const &request,
-                   server::response &response) {
-    VLOG(1) << "[" << string(source(request))
-            << "]: source = " << request.source
-            << " destination = " << request.destination
-            << " method = " << request.method
-            << " status = " << response.status << '\n';
+  // Reply with the body, or with 304 Not Modified if the client has it
+  // already.
+  void Serve(const server::request &request,
+             server::response &response) const {
+    if (NotModified(request)) {
+      response.status = server::response::not_modified;
+      response.content.clear();
+    } else {
+      response.status = server::response::ok;
+      response.content = content_;
+    }
+    server::response_header etag = { "ETag", etag_ };
+    server::response_header last_modified = { "Last-Modified",
+                                               last_modified_ };
+    response.headers.push_back(etag);
+    response.headers.push_back(last_modified);
+  }
 
-    // This is kinda incredibly dumb, but cpp-netlib can't do any better.
-    uri::uri uri(string("http://x") + request.destination);
-    string path = uri.path();
+ private:
+  // If-None-Match takes precedence over If-Modified-Since.
+  bool NotModified(const server::request &request) const {
+    const string *if_modified_since = NULL;
+    for (size_t i = 0; i < request.headers.size(); ++i) {
+      const string &name = request.headers[i].name;
+      const string &value = request.headers[i].value;
+      if (strcasecmp(name.c_str(), "If-None-Match") == 0)
+        return value == "*" || value.find(etag_) != string::npos;
+      if (strcasecmp(name.c_str(), "If-Modified-Since") == 0)
+        if_modified_since = &value;
+    }
+    if (if_modified_since == NULL)
+      return false;
+    struct tm tm;
+    memset(&tm, 0, sizeof tm);
+    if (strptime(if_modified_since->c_str(), "%a, %d %b %Y %H:%M:%S GMT",
+                 &tm) == NULL)
+      return false;
+    return timegm(&tm) >= modified_;
+  }
 
-    VLOG(1) << "path = " << path;
+  string content_;
+  string etag_;
+  string last_modified_;
+  time_t modified_;
+};
+
+// Serves the requests for one log, with the paths that follow its prefix.
+class LogHandler {
+ public:
+  // Serves the requests with those of |db|, and |cache| and |storage|,
+  // which may be NULL, at /metrics; records the requests in |metrics|.
+  // Replicas get their updates from |source|. Submitted certificates are
+  // parsed through |cert_cache|.
+  LogHandler(CTLogManager *manager, util::Metrics *metrics,
+             const LockingDatabase<LoggedCertificate> *db,
+             const CachingDatabase<LoggedCertificate> *cache,
+             const InstrumentedDatabase<LoggedCertificate> *storage,
+             const ReplicationSource<LoggedCertificate> *source,
+             ParsedCertCache *cert_cache)
+      : manager_(manager),
+        metrics_(metrics),
+        db_(db),
+        cache_(cache),
+        storage_(storage),
+        source_(source),
+        cert_cache_(cert_cache),
+        entry_cache_(manager, EntryWriter::JSON, FLAGS_get_entries_cache_blocks,
+                     "get_entries", metrics),
+        binary_entry_cache_(manager, EntryWriter::BINARY,
+                            FLAGS_get_entries_cache_blocks,
+                            "get_entries_binary", metrics),
+        roots_ok_(RenderRoots()),
+        sth_rendered_(false),
+        sth_timestamp_(0) {
+    CHECK_EQ(0, pthread_mutex_init(&sth_mutex_, NULL));
+  }
+
+  ~LogHandler() { pthread_mutex_destroy(&sth_mutex_); }
 
+  util::Metrics *metrics() const { return metrics_; }
+
+  // Serve the request for |path|, and return the name of its endpoint, or
+  // NULL if there is no such endpoint.
+  const char *Dispatch(const server::request &request, const uri::uri &uri,
+                       const string &path, server::response &response) {
     if (request.method == "GET") {
-      if (path == "/ct/v1/get-entries")
-        GetEntries(response, uri);
-      else if (path == "/ct/v1/get-roots")
-        GetRoots(response);
-      else if (path == "/ct/v1/get-proof-by-hash")
+      if (path == "/ct/v1/get-entries") {
+        GetEntries(request, response, uri);
+        return "get-entries";
+      } else if (path == "/ct/v1/get-roots") {
+        GetRoots(request, response);
+        return "get-roots";
+      } else if (path == "/ct/v1/get-proof-by-hash") {
         GetProof(response, uri);
-      else if (path == "/ct/v1/get-sth")
-        GetSTH(response);
-      else if (path == "/ct/v1/get-sth-consistency")
+        return "get-proof-by-hash";
+      } else if (path == "/ct/v1/get-sth") {
+        GetSTH(request, response);
+        return "get-sth";
+      } else if (path == "/ct/v1/get-sth-consistency") {
         GetConsistency(response, uri);
-      else
-        response = server::response::stock_reply(server::response::not_found,
-                                                 "Not found");
+        return "get-sth-consistency";
+      } else if (path == "/ct/v1/get-replication-update") {
+        GetReplicationUpdate(request, response, uri);
+        return "get-replication-update";
+      }
     } else if (request.method == "POST") {
-      if (path == "/ct/v1/add-chain")
+      if (path == "/ct/v1/add-chain") {
         AddChain(response, request.body);
-      else if (path == "/ct/v1/add-pre-chain")
+        return "add-chain";
+      } else if (path == "/ct/v1/add-pre-chain") {
         AddPreChain(response, request.body);
-      else
-        response = server::response::stock_reply(server::response::not_found,
-                                                 "Not found");
+        return "add-pre-chain";
+      } else if (path == "/ct/v1/get-proofs-by-hash") {
+        GetProofs(response, request.body);
+        return "get-proofs-by-hash";
+      }
     }
-
-    VLOG(1) << "Response: status = " << response.status << ", content = "
-            << response.content;
+    return NULL;
   }
 
-  void log(const std::string &err) {
-    LOG(ERROR) << err;
+  // Bring the metrics of the log up to date.
+  void UpdateMetrics() {
+    manager_->UpdateMetrics();
+    entry_cache_.ExportMemoryUsage(metrics_);
+    binary_entry_cache_.ExportMemoryUsage(metrics_);
+    LockingDatabase<LoggedCertificate>::Hold hold(db_);
+    if (cache_ != NULL)
+      cache_->ExportStats(metrics_);
+    if (storage_ != NULL)
+      storage_->ExportStats(metrics_);
+    db_->ExportMemoryUsage(metrics_);
   }
 
-private:
+ private:
   static void BadRequest(server::response &response, const char *msg) {
     response.status = server::response::bad_request;
     response.content = msg;
   }
 
-  void GetRoots(server::response &response) const {
+  // Proofs can't be served until the trees are loaded; tell the client to
+  // come back later, and return true, if they aren't yet.
+  bool StartingUp(server::response &response) const {
+    if (manager_->Ready())
+      return false;
+    response.status = server::response::service_unavailable;
+    response.content = "Log is starting up";
+    std::ostringstream seconds;
+    seconds << kStartupRetrySeconds;
+    server::response_header header = { "Retry-After", seconds.str() };
+    response.headers.push_back(header);
+    return true;
+  }
+
+  // The roots are loaded at startup, so their reply is rendered once.
+  bool RenderRoots() {
     std::multimap<string, const Cert *>::const_iterator it
         = manager_->GetRoots().begin();
 
@@ -391,20 +1494,42 @@ private:
       string cert;
       if (it->second->DerEncoding(&cert) != Cert::TRUE) {
         LOG(ERROR) << "Cert encoding failed";
-        BadRequest(response, "Serialisation failed");
-        return;
+        return false;
       }
       roots.AddBase64(cert);
     }
 
     JsonObject jsend;
     jsend.Add("certificates", roots);
-    
-    response.status = server::response::ok;
-    response.content = jsend.ToString();
+    roots_reply_.Set(jsend.ToString(), time(NULL));
+    return true;
+  }
+
+  void GetRoots(const server::request &request,
+                server::response &response) const {
+    if (!roots_ok_) {
+      BadRequest(response, "Serialisation failed");
+      return;
+    }
+    roots_reply_.Serve(request, response);
+  }
+
+  // Whether the |header| of |request| lists |token|, e.g. a content type
+  // in an Accept header. Parameters such as q-values are not looked at.
+  static bool Lists(const server::request &request, const char *header,
+                    const char *token) {
+    for (size_t i = 0; i < request.headers.size(); ++i) {
+      if (strcasecmp(request.headers[i].name.c_str(), header) == 0 &&
+          strcasestr(request.headers[i].value.c_str(), token) != NULL)
+        return true;
+    }
+    return false;
   }
 
-  void GetEntries(server::response &response, const uri::uri &uri) const {
+  // Replies in JSON, or in binary to clients that accept
+  // application/octet-stream; gzipped to clients that accept that.
+  void GetEntries(const server::request &request, server::response &response,
+                  const uri::uri &uri) {
     std::map<string, string> qmap;
     uri::query_map(uri, qmap);
 
@@ -413,40 +1538,99 @@ private:
       return;
     }
 
+    const bool binary = Lists(request, "Accept", "application/octet-stream");
+    const size_t max_range = binary ? FLAGS_get_entries_binary_max_range :
+        FLAGS_get_entries_max_range;
     size_t start = atoi(qmap["start"].c_str());
-    size_t end = atoi(qmap["end"].c_str());
+    size_t end = std::min<size_t>(atoi(qmap["end"].c_str()),
+                                  start + max_range - 1);
 
     VLOG(0) << "start = " << start << " end = " << end;
 
-    JsonArray entries;
-    for (size_t n = start; n <= end; ++n) {
-      LoggedCertificate cert;
-      manager_->GetEntry(n, &cert);
-
-      string leaf_input;
-      if (!cert.SerializeForLeaf(&leaf_input)) {
-        BadRequest(response, "Serialisation failed");
-        return;
-      }
-      JsonObject jentry;
-      jentry.Add("leaf_input", util::ToBase64(leaf_input));
+    // Entries come encoded from the cache, or are read from the database
+    // as one range per block and encoded as they come in.
+    string entries;
+    size_t served_end;
+    EntryBlockCache *cache = binary ? &binary_entry_cache_ : &entry_cache_;
+    if (!cache->GetEntries(start, end + 1, FLAGS_get_entries_max_bytes,
+                           &entries, &served_end)) {
+      BadRequest(response, "Serialisation failed");
+      return;
+    }
 
-      string extra_data;
-      if (!cert.SerializeExtraData(&extra_data)) {
-        BadRequest(response, "Serialisation failed");
-        return;
-      }
+    response.status = server::response::ok;
+    // Clients could count the entries, but this way they needn't parse a
+    // binary reply to find out where the next one starts.
+    if (served_end > start) {
+      std::ostringstream last;
+      last << served_end - 1;
+      server::response_header header = { HTTPLogClient::kEntriesEndHeader,
+                                         last.str() };
+      response.headers.push_back(header);
+    }
+    if (FLAGS_get_entries_max_bytes > 0) {
+      std::ostringstream max_bytes;
+      max_bytes << FLAGS_get_entries_max_bytes;
+      server::response_header header = { HTTPLogClient::kMaxBytesHeader,
+                                         max_bytes.str() };
+      response.headers.push_back(header);
+    }
+    if (binary) {
+      response.content.swap(entries);
+      server::response_header type = { "Content-Type",
+                                       "application/octet-stream" };
+      response.headers.push_back(type);
+    } else {
+      // The entries are encoded already, separated as array elements.
+      static const char kHead[] = "{ \"entries\": [ ";
+      static const char kTail[] = " ] }";
+      string &content = response.content;
+      content.reserve(sizeof(kHead) + entries.size() + sizeof(kTail));
+      content.assign(kHead);
+      content.append(entries);
+      content.append(kTail);
+    }
+    if (Lists(request, "Accept-Encoding", "gzip")) {
+      response.content = Gzip(response.content);
+      server::response_header encoding = { "Content-Encoding", "gzip" };
+      response.headers.push_back(encoding);
+    }
+    server::response_header vary = { "Vary", "Accept, Accept-Encoding" };
+    response.headers.push_back(vary);
+  }
 
-      jentry.Add("extra_data", util::ToBase64(extra_data));
+  // Replies with a serialized ct::ReplicationUpdate, gzipped to clients
+  // that accept that. May wait for a new tree head first.
+  void GetReplicationUpdate(const server::request &request,
+                            server::response &response, const uri::uri &uri) {
+    std::map<string, string> qmap;
+    uri::query_map(uri, qmap);
 
-      entries.Add(&jentry);
+    if (qmap.find("start") == qmap.end() ||
+        qmap.find("timestamp") == qmap.end()) {
+      BadRequest(response, "Bad parameters");
+      return;
     }
 
-    JsonObject jsend;
-    jsend.Add("entries", entries);
+    const uint64_t start = strtoull(qmap["start"].c_str(), NULL, 10);
+    const uint64_t timestamp = strtoull(qmap["timestamp"].c_str(), NULL, 10);
+    ct::ReplicationUpdate update;
+    if (!source_->GetUpdate(start, timestamp, FLAGS_replication_max_entries,
+                            FLAGS_replication_wait_seconds, &update)) {
+      BadRequest(response, "Tree is not that big");
+      return;
+    }
 
     response.status = server::response::ok;
-    response.content = jsend.ToString();
+    CHECK(update.SerializeToString(&response.content));
+    server::response_header type = { "Content-Type",
+                                     "application/octet-stream" };
+    response.headers.push_back(type);
+    if (Lists(request, "Accept-Encoding", "gzip")) {
+      response.content = Gzip(response.content);
+      server::response_header encoding = { "Content-Encoding", "gzip" };
+      response.headers.push_back(encoding);
+    }
   }
 
   void GetConsistency(server::response &response, const uri::uri &uri) {
@@ -461,19 +1645,22 @@ private:
 
     size_t first = atoi(qmap["first"].c_str());
     size_t second = atoi(qmap["second"].c_str());
+    if (StartingUp(response))
+      return;
 
     std::vector<string> consistency = manager_->GetConsistency(first, second);
 
-    JsonArray jcons;
+    response.status = server::response::ok;
+    response.content.clear();
+    JsonWriter json(&response.content);
+    json.BeginObject();
+    json.Key("consistency");
+    json.BeginArray();
     for (std::vector<string>::const_iterator i = consistency.begin();
          i != consistency.end(); ++i)
-      jcons.AddBase64(*i);
-
-    JsonObject jsend;
-    jsend.Add("consistency", jcons);
-
-    response.status = server::response::ok;
-    response.content = jsend.ToString();
+      json.AddBase64(*i);
+    json.EndArray();
+    json.EndObject();
   }
 
   void GetProof(server::response &response, const uri::uri &uri) {
@@ -481,6 +1668,8 @@ private:
     uri::query_map(uri, qmap);
     string b64hash = uri::decoded(qmap["hash"]);
     size_t tree_size = atoi(qmap["tree_size"].c_str());
+    if (StartingUp(response))
+      return;
 
     const ct::SignedTreeHead &sth = manager_->GetSTH();
     if (tree_size > sth.tree_size()) {
@@ -501,31 +1690,114 @@ private:
 
     CHECK_EQ(CTLogManager::MERKLE_AUDIT_PROOF, reply);
 
-    JsonArray audit;
-    for (int n = 0; n < proof.path_node_size(); ++n)
-      audit.AddBase64(proof.path_node(n));
-
-    JsonObject jsend;
-    jsend.Add("leaf_index", proof.leaf_index());
-    jsend.Add("audit_path", audit);
-
     response.status = server::response::ok;
-    response.content = jsend.ToString();
+    response.content.clear();
+    JsonWriter json(&response.content);
+    json.BeginObject();
+    json.Key("leaf_index");
+    json.Add(proof.leaf_index());
+    json.Key("audit_path");
+    json.BeginArray();
+    for (int n = 0; n < proof.path_node_size(); ++n)
+      json.AddBase64(proof.path_node(n));
+    json.EndArray();
+    json.EndObject();
   }
 
-  void GetSTH(server::response &response) {
-    const ct::SignedTreeHead &sth = manager_->GetSTH();
-    response.status = server::response::ok;
+  // Takes { "hashes": [ ... ], "tree_size": N } and replies with one proof
+  // per hash, in order, or null for hashes that are not in the tree. The
+  // paths are computed together, sharing their common nodes, and the reply
+  // is written out directly rather than built up as JSON objects.
+  void GetProofs(server::response &response, const string &body) {
+    JsonObject jbody(body);
+    JsonArray jhashes(jbody, "hashes");
+    JsonInt jtree_size(jbody, "tree_size");
+    if (!jhashes.Ok() || !jtree_size.Ok() || jtree_size.Value() < 0) {
+      BadRequest(response, "Bad parameters");
+      return;
+    }
+    if (jhashes.Length() > FLAGS_max_proof_batch) {
+      BadRequest(response, "Too many hashes");
+      return;
+    }
+    if (StartingUp(response))
+      return;
 
-    VLOG(1) << "STH is " << sth.DebugString();
+    const size_t tree_size = jtree_size.Value();
+    const ct::SignedTreeHead &sth = manager_->GetSTH();
+    if (tree_size > sth.tree_size()) {
+      BadRequest(response, "Tree is not that big");
+      return;
+    }
 
-    JsonObject jsend;
-    jsend.Add("tree_size", sth.tree_size());
-    jsend.Add("timestamp", sth.timestamp());
-    jsend.AddBase64("sha256_root_hash", sth.sha256_root_hash());
-    jsend.Add("tree_head_signature", sth.signature());
+    std::vector<string> hashes;
+    for (int n = 0; n < jhashes.Length(); ++n) {
+      JsonString jhash(jhashes, n);
+      if (!jhash.Ok()) {
+        BadRequest(response, "Bad parameters");
+        return;
+      }
+      hashes.push_back(jhash.FromBase64());
+    }
 
-    response.content = jsend.ToString();
+    std::vector<ShortMerkleAuditProof> proofs;
+    std::vector<bool> found;
+    manager_->QueryAuditProofs(hashes, tree_size, &proofs, &found);
+
+    response.status = server::response::ok;
+    response.content.clear();
+    JsonWriter json(&response.content);
+    json.BeginObject();
+    json.Key("proofs");
+    json.BeginArray();
+    for (size_t i = 0; i < proofs.size(); ++i) {
+      if (!found[i]) {
+        json.AddNull();
+        continue;
+      }
+      json.BeginObject();
+      json.Key("leaf_index");
+      json.Add(proofs[i].leaf_index());
+      json.Key("audit_path");
+      json.BeginArray();
+      for (int n = 0; n < proofs[i].path_node_size(); ++n)
+        json.AddBase64(proofs[i].path_node(n));
+      json.EndArray();
+      json.EndObject();
+    }
+    json.EndArray();
+    json.EndObject();
+  }
+
+  // The reply is rendered again only when a new tree head is signed.
+  void GetSTH(const server::request &request, server::response &response) {
+    const ct::SignedTreeHead &sth = manager_->GetSTH();
+    ScopedLock lock(&sth_mutex_);
+    if (!sth_rendered_ || sth.timestamp() != sth_timestamp_) {
+      VLOG(1) << "STH is " << sth.DebugString();
+
+      string signature;
+      CHECK_EQ(Serializer::OK,
+               Serializer::SerializeDigitallySigned(sth.signature(),
+                                                    &signature));
+      string reply;
+      JsonWriter json(&reply);
+      json.BeginObject();
+      json.Key("tree_size");
+      json.Add(sth.tree_size());
+      json.Key("timestamp");
+      json.Add(sth.timestamp());
+      json.Key("sha256_root_hash");
+      json.AddBase64(sth.sha256_root_hash());
+      json.Key("tree_head_signature");
+      json.AddBase64(signature);
+      json.EndObject();
+
+      sth_reply_.Set(reply, static_cast<time_t>(sth.timestamp() / 1000));
+      sth_rendered_ = true;
+      sth_timestamp_ = sth.timestamp();
+    }
+    sth_reply_.Serve(request, response);
   }
 
   void AddChain(server::response &response, const std::string &body) {
@@ -540,49 +1812,46 @@ private:
 
   void AddChain(server::response &response, const std::string &body,
                 CertChain *chain, PreCertChain *prechain) {
-    if (!ExtractChain(response, chain != NULL ? chain : prechain, body))
-      return;
+    util::Tracer::Span span(chain != NULL ? "server.add_chain"
+                            : "server.add_pre_chain");
+    {
+      // Parsing the JSON, the base64 and the certificates.
+      util::Tracer::Span extract("server.extract_chain");
+      if (!ExtractChain(response, chain != NULL ? chain : prechain, body))
+        return;
+    }
 
     SignedCertificateTimestamp sct;
     string error;
+    int retry_after = 0;
     CTLogManager::LogReply result = manager_->SubmitEntry(chain, prechain, &sct,
-                                                          &error);
+                                                          &error,
+                                                          &retry_after);
 
-    ProcessChainResult(response, result, error, sct);
+    ProcessChainResult(response, result, error, sct, retry_after);
   }
 
-  static bool ExtractChain(server::response &response, CertChain *chain,
-                           const string &body) {
-    JsonObject jbody(body);
-
-    JsonArray jchain(jbody, "chain");
-    if (!jchain.Ok()) {
+  bool ExtractChain(server::response &response, CertChain *chain,
+                    const string &body) {
+    // Decoded in one pass over the body, straight into one buffer, which
+    // the certificates are then parsed from, unless they have been already.
+    string der;
+    std::vector<util::Span> certs;
+    if (!util::DecodeBase64Array(body, "chain", &der, &certs)) {
       response.status = server::response::bad_request;
       response.content = "Couldn't extract chain";
       LOG(INFO) << "Couldn't extract chain from " << body;
       return false;
     }
 
-    for (int n = 0; n < jchain.Length(); ++n) {
-      JsonString jcert(jchain, n);
-      string cert_der = jcert.FromBase64();
-      X509 *x509 = NULL;
-      const unsigned char *in
-          = reinterpret_cast<const unsigned char *>(cert_der.data());
-      x509 = d2i_X509(&x509, &in, cert_der.length());
-      if (x509 == NULL) {
+    for (size_t n = 0; n < certs.size(); ++n) {
+      Cert *cert = cert_cache_->Parse(der.substr(certs[n].first,
+                                                 certs[n].second));
+      if (cert == NULL) {
         response.status = server::response::bad_request;
         response.content = "Couldn't decode certificate";
         return false;
       }
-      Cert *cert = new Cert(x509);
-      if (!cert->IsLoaded()) {
-        delete cert;
-        response.status = server::response::bad_request;
-        response.content = "Couldn't load certificate";
-        LOG(INFO) << "Couldn't load certificate " << jcert.Value();
-        return false;
-      }
       chain->AddCert(cert);
     }
 
@@ -591,11 +1860,20 @@ private:
 
   void ProcessChainResult(server::response &response,
                           CTLogManager::LogReply result, const string &error,
-                          const SignedCertificateTimestamp &sct) {
+                          const SignedCertificateTimestamp &sct,
+                          int retry_after) {
     LOG(INFO) << "Chain added, result = " << result << ", error = " << error;
 
     JsonObject jsend;
-    if (result == CTLogManager::REJECT) {
+    if (result == CTLogManager::BUSY) {
+      jsend.AddBoolean("success", false);
+      jsend.Add("reason", error);
+      response.status = server::response::service_unavailable;
+      std::ostringstream seconds;
+      seconds << retry_after;
+      server::response_header header = { "Retry-After", seconds.str() };
+      response.headers.push_back(header);
+    } else if (result == CTLogManager::REJECT) {
       jsend.AddBoolean("success", false);
       jsend.Add("reason",error);
       response.status = server::response::bad_request;
@@ -611,61 +1889,1138 @@ private:
   }
 
   const CTLogManager *manager_;
+  util::Metrics *const metrics_;
+  const LockingDatabase<LoggedCertificate> *const db_;
+  const CachingDatabase<LoggedCertificate> *const cache_;
+  const InstrumentedDatabase<LoggedCertificate> *const storage_;
+  const ReplicationSource<LoggedCertificate> *const source_;
+  ParsedCertCache *const cert_cache_;
+  EntryBlockCache entry_cache_;
+  EntryBlockCache binary_entry_cache_;
+  CachedReply roots_reply_;
+  const bool roots_ok_;
+  // Guards |sth_reply_| and what it was rendered from.
+  pthread_mutex_t sth_mutex_;
+  CachedReply sth_reply_;
+  bool sth_rendered_;
+  // The timestamp of the tree head in |sth_reply_|.
+  uint64_t sth_timestamp_;
 };
 
-int main(int argc, char * argv[]) {
-  google::ParseCommandLineFlags(&argc, &argv, true);
-  google::InitGoogleLogging(argv[0]);
-  OpenSSL_add_all_algorithms();
-  ERR_load_crypto_strings();
-  ct::LoadCtExtensions();
+// Caps the requests of one kind that are served at once, so that they
+// can't take up all the server threads. Requests over the cap are
+// refused rather than queued: a request waiting for its turn would hold a
+// thread just the same. Keeps its requests in flight, and those it
+// refused, in the metrics, labelled with its name.
+class RequestLane {
+ public:
+  // |limit| 0 means no limit.
+  RequestLane(const string &name, int limit, util::Metrics *metrics)
+      : labels_("lane=\"" + name + "\""),
+        limit_(limit),
+        metrics_(metrics),
+        in_flight_(0) {
+    CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+    metrics_->DefineGauge(kLaneInFlight,
+                          "Requests being served, by lane.");
+    metrics_->DefineCounter(kLaneRefused,
+                            "Requests refused because their lane was full, "
+                            "by lane.");
+    metrics_->Set(kLaneInFlight, labels_, 0);
+    metrics_->Increment(kLaneRefused, labels_, 0);
+  }
 
-  EVP_PKEY *pkey = NULL;
-  CHECK_EQ(Services::ReadPrivateKey(&pkey, FLAGS_key), Services::KEY_OK);
+  ~RequestLane() { pthread_mutex_destroy(&mutex_); }
 
-  CertChecker checker;
-  CHECK(checker.LoadTrustedCertificates(FLAGS_trusted_cert_file))
-      << "Could not load CA certs from " << FLAGS_trusted_cert_file;
+  // Returns false, and counts the request as refused, if it can't be
+  // served now. Otherwise, call Leave() once it is.
+  bool Enter() {
+    int in_flight;
+    {
+      ScopedLock lock(&mutex_);
+      if (limit_ > 0 && in_flight_ >= limit_) {
+        metrics_->Increment(kLaneRefused, labels_);
+        return false;
+      }
+      in_flight = ++in_flight_;
+    }
+    metrics_->Set(kLaneInFlight, labels_, in_flight);
+    return true;
+  }
 
-  if (FLAGS_sqlite_db == "")
-    CHECK_NE(FLAGS_cert_dir, FLAGS_tree_dir)
-        << "Certificate directory and tree directory must differ";
+  void Leave() {
+    int in_flight;
+    {
+      ScopedLock lock(&mutex_);
+      CHECK_GT(in_flight_, 0);
+      in_flight = --in_flight_;
+    }
+    metrics_->Set(kLaneInFlight, labels_, in_flight);
+  }
+
+ private:
+  const string labels_;
+  const int limit_;
+  util::Metrics *const metrics_;
+  pthread_mutex_t mutex_;
+  int in_flight_;
+};
+
+// Routes requests to the logs by their prefixes, and serves the metrics,
+// traces and startup of the whole process.
+class ct_server {
+ public:
+  // Records requests in |metrics|, which those of the logs are views of,
+  // and serves them at /metrics, the traces of |tracer|, which may be NULL,
+  // at /debug/trace, and the phases of |startup| at /debug/startup. With
+  // --profiling_endpoint, serves profiles at /debug/pprof. The metrics
+  // include the memory of |signatures| and |certs|, which the logs share.
+  ct_server(util::Metrics *metrics, const util::Tracer *tracer,
+            const util::StartupProfiler *startup, SignatureCache *signatures,
+            ParsedCertCache *certs)
+      : metrics_(metrics),
+        tracer_(tracer),
+        startup_(startup),
+        signatures_(signatures),
+        certs_(certs),
+        submissions_("submission", FLAGS_max_concurrent_submissions, metrics),
+        bulk_reads_("bulk_read", FLAGS_max_concurrent_bulk_reads, metrics),
+        reads_("read", 0, metrics) {
+    metrics_->DefineCounter(kRequests,
+                            "Requests, by endpoint and status code.");
+    metrics_->DefineHistogram(kRequestSeconds,
+                              "Request latency by endpoint, in seconds.",
+                              util::Metrics::LatencyBuckets());
+  }
+
+  // Serve the requests under |prefix| with |handler|, which must outlive
+  // the server. Call before serving.
+  void AddLog(const string &prefix, LogHandler *handler) {
+    logs_.push_back(std::make_pair(prefix, handler));
+  }
+
+  void operator() (server::request const &request,
+                   server::response &response) {
+    VLOG(1) << "[" << string(source(request))
+            << "]: source = " << request.source
+            << " destination = " << request.destination
+            << " method = " << request.method
+            << " status = " << response.status << '\n';
+
+    // This is kinda incredibly dumb, but cpp-netlib can't do any better.
+    uri::uri uri(string("http://x") + request.destination);
+    string path = uri.path();
+
+    VLOG(1) << "path = " << path;
+
+    const uint64_t start = util::TimeInMicroseconds();
+    util::Metrics *metrics = metrics_;
+    RequestLane *lane = LaneFor(request, path);
+    const char *served;
+    if (lane->Enter()) {
+      served = Dispatch(request, uri, path, response, &metrics);
+      lane->Leave();
+    } else {
+      LaneFull(response);
+      served = "lane-full";
+    }
+    const string endpoint = string("endpoint=\"") + served + "\"";
+    metrics->Observe(kRequestSeconds, endpoint,
+                     (util::TimeInMicroseconds() - start) / 1e6);
+    std::ostringstream labels;
+    labels << endpoint << ",code=\"" << response.status << "\"";
+    metrics->Increment(kRequests, labels.str());
+
+    VLOG(1) << "Response: status = " << response.status << ", content = "
+            << response.content;
+  }
+
+  void log(const std::string &err) {
+    LOG(ERROR) << err;
+  }
+
+ private:
+  // Submissions sign and write an entry, and bulk reads read a lot of
+  // them, or wait for them; the rest take next to no time. Which one a
+  // request is depends only on the end of its path, whatever the log.
+  RequestLane *LaneFor(const server::request &request, const string &path) {
+    if (request.method == "POST" &&
+        (EndsWith(path, "/ct/v1/add-chain") ||
+         EndsWith(path, "/ct/v1/add-pre-chain")))
+      return &submissions_;
+    if (request.method == "GET" &&
+        (EndsWith(path, "/ct/v1/get-entries") ||
+         EndsWith(path, "/ct/v1/get-replication-update")))
+      return &bulk_reads_;
+    return &reads_;
+  }
+
+  static bool EndsWith(const string &s, const char *suffix) {
+    const size_t length = strlen(suffix);
+    return s.size() >= length &&
+        s.compare(s.size() - length, length, suffix) == 0;
+  }
+
+  static void LaneFull(server::response &response) {
+    response.status = server::response::service_unavailable;
+    response.content = "Too many requests of this kind; try again later";
+    std::ostringstream seconds;
+    seconds << kLaneRetrySeconds;
+    server::response_header header = { "Retry-After", seconds.str() };
+    response.headers.push_back(header);
+  }
+
+  // Serve the request, and return the name of its endpoint. Requests for
+  // a log set |metrics| to the log's.
+  const char *Dispatch(const server::request &request, const uri::uri &uri,
+                       const string &path, server::response &response,
+                       util::Metrics **metrics) {
+    if (request.method == "GET") {
+      if (path == "/metrics") {
+        GetMetrics(response);
+        return "metrics";
+      } else if (path == "/debug/trace") {
+        GetTrace(response);
+        return "trace";
+      } else if (path == "/debug/startup") {
+        GetStartup(response);
+        return "startup";
+      } else if (path == "/debug/pprof/profile") {
+        GetProfile(request, uri, response, true);
+        return "pprof_profile";
+      } else if (path == "/debug/pprof/heap") {
+        GetProfile(request, uri, response, false);
+        return "pprof_heap";
+      }
+    }
+    for (size_t i = 0; i < logs_.size(); ++i) {
+      const string &prefix = logs_[i].first;
+      if (path.compare(0, prefix.size(), prefix) != 0)
+        continue;
+      const char *endpoint = logs_[i].second->Dispatch(
+          request, uri, path.substr(prefix.size()), response);
+      if (endpoint != NULL) {
+        *metrics = logs_[i].second->metrics();
+        return endpoint;
+      }
+    }
+    response = server::response::stock_reply(server::response::not_found,
+                                             "Not found");
+    return "unknown";
+  }
+
+  void GetMetrics(server::response &response) const {
+    for (size_t i = 0; i < logs_.size(); ++i)
+      logs_[i].second->UpdateMetrics();
+    util::ExportMemoryUsage("signature_cache", signatures_->MemoryUsage(),
+                            metrics_);
+    util::ExportMemoryUsage("parsed_cert_cache", certs_->MemoryUsage(),
+                            metrics_);
+    response.status = server::response::ok;
+    response.content = metrics_->Export();
+    server::response_header type = { "Content-Type",
+                                     "text/plain; version=0.0.4" };
+    response.headers.push_back(type);
+  }
+
+  void GetTrace(server::response &response) const {
+    if (tracer_ == NULL) {
+      response = server::response::stock_reply(server::response::not_found,
+                                               "Tracing is off");
+      return;
+    }
+    response.status = server::response::ok;
+    response.content = tracer_->ExportChromeTrace();
+    server::response_header type = { "Content-Type", "application/json" };
+    response.headers.push_back(type);
+  }
+
+  // Served while the trees load, too, to show how far they are.
+  void GetStartup(server::response &response) const {
+    response.status = server::response::ok;
+    response.content = startup_->Report() + "\n";
+    server::response_header type = { "Content-Type", "text/plain" };
+    response.headers.push_back(type);
+  }
+
+  // Profiles show much of the workings of the server, so they are only
+  // for its operators, on the same host.
+  static bool IsLoopback(const string &address) {
+    return address.compare(0, 4, "127.") == 0 || address == "::1" ||
+        address.compare(0, 11, "::ffff:127.") == 0;
+  }
+
+  // A CPU profile of the next ?seconds=N, or a heap profile, as a pprof
+  // file to download.
+  void GetProfile(const server::request &request, const uri::uri &uri,
+                  server::response &response, bool cpu) const {
+    if (!FLAGS_profiling_endpoint) {
+      response = server::response::stock_reply(server::response::not_found,
+                                               "Profiling is off");
+      return;
+    }
+    if (!IsLoopback(request.source)) {
+      response = server::response::stock_reply(server::response::forbidden,
+                                               "Forbidden");
+      return;
+    }
+    string profile, error;
+    bool ok;
+    if (cpu) {
+      std::map<string, string> qmap;
+      uri::query_map(uri, qmap);
+      int seconds = kDefaultProfileSeconds;
+      if (qmap.find("seconds") != qmap.end())
+        seconds = atoi(qmap["seconds"].c_str());
+      if (seconds <= 0 || seconds > kMaxProfileSeconds) {
+        response = server::response::stock_reply(
+            server::response::bad_request, "Bad seconds");
+        return;
+      }
+      LOG(INFO) << "Profiling the CPU for " << seconds << " seconds for "
+                << request.source;
+      ok = util::ProfileCPU(seconds, util::kDefaultProfileHz, &profile,
+                            &error);
+    } else {
+      ok = util::ProfileHeap(&profile, &error);
+    }
+    if (!ok) {
+      response = server::response::stock_reply(
+          server::response::service_unavailable, error);
+      return;
+    }
+    response.status = server::response::ok;
+    response.content.swap(profile);
+    server::response_header type = { "Content-Type",
+                                     "application/octet-stream" };
+    response.headers.push_back(type);
+    server::response_header disposition = {
+      "Content-Disposition",
+      cpu ? "attachment; filename=\"ct-rfc-server.cpu.prof\"" :
+          "attachment; filename=\"ct-rfc-server.heap.prof\"" };
+    response.headers.push_back(disposition);
+  }
+
+  util::Metrics *const metrics_;
+  const util::Tracer *const tracer_;
+  const util::StartupProfiler *const startup_;
+  SignatureCache *const signatures_;
+  ParsedCertCache *const certs_;
+  // Shared by the logs, as the threads are. Reads have no limit, so they
+  // get whatever threads the other lanes leave.
+  RequestLane submissions_;
+  RequestLane bulk_reads_;
+  RequestLane reads_;
+  // By prefix.
+  std::vector<std::pair<string, LogHandler*> > logs_;
+};
+
+typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket> TLSStream;
+
+// Of a request's line and headers, and of its body, at most, on HTTPS.
+static const size_t kMaxTLSRequestHead = 64 * 1024;
+static const size_t kMaxTLSRequestBody = 8 << 20;
+
+// An HTTPS connection: the handshake, then HTTP/1.1 requests, one at a
+// time, each served by the handler as if it had come in over plain HTTP.
+// The connection is kept alive between requests unless the client asks
+// otherwise, so that clients polling get-sth pay for one handshake at
+// most, and resumed ones after that.
+//
+// A reply body is swapped out of the handler's response rather than
+// copied, and encrypted straight from there, together with the status line
+// and headers, in one gather write.
+class TLSConnection : public boost::enable_shared_from_this<TLSConnection> {
+ public:
+  TLSConnection(boost::asio::io_service &io,
+                boost::asio::ssl::context &context, ct_server *handler,
+                util::Metrics *metrics)
+      : stream_(io, context),
+        strand_(io),
+        timer_(io),
+        input_(kMaxTLSRequestHead + kMaxTLSRequestBody),
+        handler_(handler),
+        metrics_(metrics),
+        handshaken_(false),
+        keep_alive_(false),
+        body_length_(0) {}
+
+  TLSStream::lowest_layer_type &socket() { return stream_.lowest_layer(); }
+
+  void Start() {
+    boost::system::error_code error;
+    const boost::asio::ip::tcp::endpoint peer =
+        socket().remote_endpoint(error);
+    if (error)
+      return;
+    source_ = peer.address().to_string();
+    ArmTimer();
+    stream_.async_handshake(
+        boost::asio::ssl::stream_base::server,
+        strand_.wrap(boost::bind(&TLSConnection::Handshaken,
+                                 shared_from_this(),
+                                 boost::asio::placeholders::error)));
+  }
+
+ private:
+  void Handshaken(const boost::system::error_code &error) {
+    if (error) {
+      VLOG(1) << "[" << source_ << "]: TLS handshake failed: "
+              << error.message();
+      Close();
+      return;
+    }
+    handshaken_ = true;
+    metrics_->Increment(kTLSHandshakes,
+                        SSL_session_reused(stream_.native_handle()) ?
+                        "resumed=\"true\"" : "resumed=\"false\"");
+    ReadRequest();
+  }
+
+  void ReadRequest() {
+    ArmTimer();
+    boost::asio::async_read_until(
+        stream_, input_, "\r\n\r\n",
+        strand_.wrap(boost::bind(
+            &TLSConnection::HeadRead, shared_from_this(),
+            boost::asio::placeholders::error,
+            boost::asio::placeholders::bytes_transferred)));
+  }
+
+  void HeadRead(const boost::system::error_code &error, size_t bytes) {
+    // Including a client that went away between requests, or whose
+    // request was too large.
+    if (error) {
+      Close();
+      return;
+    }
+    const string head(boost::asio::buffers_begin(input_.data()),
+                      boost::asio::buffers_begin(input_.data()) + bytes);
+    input_.consume(bytes);
+    const char *status = ParseHead(head);
+    if (status != NULL) {
+      Refuse(status);
+      return;
+    }
+    // There may be more of the body to come than has been read with the
+    // head.
+    if (input_.size() < body_length_) {
+      boost::asio::async_read(
+          stream_, input_,
+          boost::asio::transfer_exactly(body_length_ - input_.size()),
+          strand_.wrap(boost::bind(&TLSConnection::BodyRead,
+                                   shared_from_this(),
+                                   boost::asio::placeholders::error)));
+      return;
+    }
+    BodyRead(boost::system::error_code());
+  }
+
+  // Fill in |request_| from the request line and headers. Returns NULL,
+  // or the status line to refuse the request with.
+  const char *ParseHead(const string &head) {
+    request_ = server::request();
+    request_.source = source_;
+    body_length_ = 0;
+    std::istringstream lines(head);
+    string line;
+    std::getline(lines, line);
+    std::istringstream request_line(line);
+    string version;
+    request_line >> request_.method >> request_.destination >> version;
+    if (version == "HTTP/1.1\r" || version == "HTTP/1.1")
+      keep_alive_ = true;
+    else if (version == "HTTP/1.0\r" || version == "HTTP/1.0")
+      keep_alive_ = false;
+    else
+      return "400 Bad Request";
+    if (request_.method.empty() || request_.destination.empty() ||
+        request_.destination[0] != '/')
+      return "400 Bad Request";
+
+    while (std::getline(lines, line)) {
+      if (!line.empty() && line[line.size() - 1] == '\r')
+        line.erase(line.size() - 1);
+      if (line.empty())
+        break;
+      const size_t colon = line.find(':');
+      if (colon == string::npos || colon == 0)
+        return "400 Bad Request";
+      const size_t value = line.find_first_not_of(" \t", colon + 1);
+      request_.headers.resize(request_.headers.size() + 1);
+      request_.headers.back().name = line.substr(0, colon);
+      request_.headers.back().value =
+          value == string::npos ? "" : line.substr(value);
+      const string &name = request_.headers.back().name;
+      const string &text = request_.headers.back().value;
+      if (strcasecmp(name.c_str(), "Content-Length") == 0) {
+        char *end;
+        const unsigned long long length = strtoull(text.c_str(), &end, 10);
+        if (text.empty() || *end != '\0')
+          return "400 Bad Request";
+        if (length > kMaxTLSRequestBody)
+          return "413 Request Entity Too Large";
+        body_length_ = length;
+      } else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0) {
+        return "501 Not Implemented";
+      } else if (strcasecmp(name.c_str(), "Connection") == 0) {
+        if (strcasestr(text.c_str(), "close") != NULL)
+          keep_alive_ = false;
+        else if (strcasestr(text.c_str(), "keep-alive") != NULL)
+          keep_alive_ = true;
+      }
+    }
+    return NULL;
+  }
 
-  if ((FLAGS_cert_dir != "" || FLAGS_tree_dir != "") && FLAGS_sqlite_db != "") {
-    std::cerr << "Choose either file or sqlite database, not both" << std::endl;
+  void BodyRead(const boost::system::error_code &error) {
+    if (error) {
+      Close();
+      return;
+    }
+    request_.body.assign(boost::asio::buffers_begin(input_.data()),
+                         boost::asio::buffers_begin(input_.data()) +
+                         body_length_);
+    input_.consume(body_length_);
+    // Handlers may take a while, e.g. for replication updates.
+    timer_.cancel();
+
+    server::response response;
+    response.status = server::response::ok;
+    (*handler_)(request_, response);
+
+    std::ostringstream head;
+    head << "HTTP/1.1 " << static_cast<int>(response.status) << ' '
+         << Reason(response.status) << "\r\n";
+    for (size_t i = 0; i < response.headers.size(); ++i) {
+      const string &name = response.headers[i].name;
+      if (strcasecmp(name.c_str(), "Content-Length") == 0 ||
+          strcasecmp(name.c_str(), "Connection") == 0)
+        continue;
+      head << name << ": " << response.headers[i].value << "\r\n";
+    }
+    head << "Content-Length: " << response.content.size() << "\r\n";
+    if (!keep_alive_)
+      head << "Connection: close\r\n";
+    head << "\r\n";
+    head_ = head.str();
+    body_.swap(response.content);
+    Write();
+  }
+
+  // Reply with just |status|, and close the connection.
+  void Refuse(const char *status) {
+    keep_alive_ = false;
+    head_ = string("HTTP/1.1 ") + status + "\r\nContent-Length: 0\r\n"
+        "Connection: close\r\n\r\n";
+    body_.clear();
+    Write();
+  }
+
+  void Write() {
+    ArmTimer();
+    boost::array<boost::asio::const_buffer, 2> buffers = { {
+        boost::asio::buffer(head_), boost::asio::buffer(body_) } };
+    boost::asio::async_write(
+        stream_, buffers,
+        strand_.wrap(boost::bind(&TLSConnection::Written, shared_from_this(),
+                                 boost::asio::placeholders::error)));
+  }
+
+  void Written(const boost::system::error_code &error) {
+    head_.clear();
+    string().swap(body_);
+    if (error || !keep_alive_) {
+      Close();
+      return;
+    }
+    ReadRequest();
+  }
+
+  // Close the connection if it stays idle for too long.
+  void ArmTimer() {
+    timer_.expires_from_now(
+        boost::posix_time::seconds(FLAGS_tls_idle_timeout_seconds));
+    timer_.async_wait(
+        strand_.wrap(boost::bind(&TLSConnection::TimedOut, shared_from_this(),
+                                 boost::asio::placeholders::error)));
+  }
+
+  void TimedOut(const boost::system::error_code &error) {
+    // Re-armed or cancelled since.
+    if (error == boost::asio::error::operation_aborted ||
+        timer_.expires_from_now() > boost::posix_time::seconds(0))
+      return;
+    Close();
+  }
+
+  void Close() {
+    // OpenSSL drops the session from its cache unless the connection was
+    // shut down, and waiting for the client's close_notify gains nothing,
+    // so shut down without alerts on either side.
+    if (handshaken_) {
+      SSL_set_quiet_shutdown(stream_.native_handle(), 1);
+      SSL_shutdown(stream_.native_handle());
+      handshaken_ = false;
+    }
+    boost::system::error_code ignored;
+    socket().close(ignored);
+    timer_.cancel(ignored);
+  }
+
+  // The reason phrase of the statuses that replies have.
+  static const char *Reason(server::response::status_type status) {
+    switch (static_cast<int>(status)) {
+      case 200:
+        return "OK";
+      case 304:
+        return "Not Modified";
+      case 400:
+        return "Bad Request";
+      case 403:
+        return "Forbidden";
+      case 404:
+        return "Not Found";
+      case 500:
+        return "Internal Server Error";
+      case 503:
+        return "Service Unavailable";
+    }
+    return "";
+  }
+
+  TLSStream stream_;
+  // Handlers of the connection run one at a time, whichever of the server
+  // threads runs them.
+  boost::asio::io_service::strand strand_;
+  boost::asio::deadline_timer timer_;
+  boost::asio::streambuf input_;
+  ct_server *const handler_;
+  util::Metrics *const metrics_;
+  string source_;
+  bool handshaken_;
+  server::request request_;
+  bool keep_alive_;
+  size_t body_length_;
+  // The reply being written.
+  string head_;
+  string body_;
+};
+
+// Accepts HTTPS connections on |io|, alongside the plain HTTP server, to
+// serve with the same handler and threads.
+class TLSServer {
+ public:
+  // Does not take ownership of |context|.
+  TLSServer(const boost::shared_ptr<boost::asio::io_service> &io,
+            boost::asio::ssl::context *context, ct_server *handler,
+            util::Metrics *metrics, const string &address,
+            const string &port)
+      : io_(io),
+        context_(context),
+        handler_(handler),
+        metrics_(metrics),
+        acceptor_(*io) {
+    metrics_->DefineCounter(kTLSHandshakes,
+                            "Completed TLS handshakes, by whether they "
+                            "resumed a session.");
+    boost::asio::ip::tcp::resolver resolver(*io);
+    boost::asio::ip::tcp::resolver::query query(address, port);
+    const boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    Accept();
+  }
+
+ private:
+  void Accept() {
+    boost::shared_ptr<TLSConnection> connection(
+        new TLSConnection(*io_, *context_, handler_, metrics_));
+    acceptor_.async_accept(connection->socket(),
+                           boost::bind(&TLSServer::Accepted, this, connection,
+                                       boost::asio::placeholders::error));
+  }
+
+  void Accepted(boost::shared_ptr<TLSConnection> connection,
+                const boost::system::error_code &error) {
+    if (!error) {
+      boost::system::error_code ignored;
+      connection->socket().set_option(boost::asio::ip::tcp::no_delay(true),
+                                      ignored);
+      connection->Start();
+    } else {
+      LOG(WARNING) << "Failed to accept an HTTPS connection: "
+                   << error.message();
+    }
+    Accept();
+  }
+
+  const boost::shared_ptr<boost::asio::io_service> io_;
+  boost::asio::ssl::context *const context_;
+  ct_server *const handler_;
+  util::Metrics *const metrics_;
+  boost::asio::ip::tcp::acceptor acceptor_;
+};
+
+// The TLS context of the HTTPS server, from the flags.
+static boost::asio::ssl::context *TLSContext() {
+  CHECK(!FLAGS_tls_cert_chain_file.empty() && !FLAGS_tls_key_file.empty())
+      << "--tls_port needs --tls_cert_chain_file and --tls_key_file";
+  boost::asio::ssl::context *context =
+      new boost::asio::ssl::context(boost::asio::ssl::context::sslv23);
+  context->set_options(boost::asio::ssl::context::default_workarounds |
+                       boost::asio::ssl::context::no_sslv2 |
+                       boost::asio::ssl::context::no_sslv3);
+  context->use_certificate_chain_file(FLAGS_tls_cert_chain_file);
+  context->use_private_key_file(FLAGS_tls_key_file,
+                                boost::asio::ssl::context::pem);
+  SSL_CTX *ctx = context->native_handle();
+
+  // Sessions, for resumption by session ID, are cached for all threads.
+  static const unsigned char kSessionContext[] = "ct-rfc-server";
+  CHECK_EQ(1, SSL_CTX_set_session_id_context(ctx, kSessionContext,
+                                             sizeof kSessionContext - 1));
+  SSL_CTX_set_session_cache_mode(ctx, FLAGS_tls_session_cache_size > 0 ?
+                                 SSL_SESS_CACHE_SERVER : SSL_SESS_CACHE_OFF);
+  SSL_CTX_sess_set_cache_size(ctx, FLAGS_tls_session_cache_size);
+  SSL_CTX_set_timeout(ctx, FLAGS_tls_session_timeout_seconds);
+
+  if (!FLAGS_tls_session_tickets) {
+    SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+  } else if (!FLAGS_tls_ticket_key_file.empty()) {
+    string keys;
+    PCHECK(util::ReadBinaryFile(FLAGS_tls_ticket_key_file, &keys))
+        << "Could not read " << FLAGS_tls_ticket_key_file;
+    // The key name, HMAC and AES keys, whose sizes depend on the version
+    // of OpenSSL.
+    const long length = SSL_CTX_get_tlsext_ticket_keys(ctx, NULL, 0);
+    CHECK_EQ(static_cast<size_t>(length), keys.size())
+        << FLAGS_tls_ticket_key_file << " must hold " << length
+        << " random bytes";
+    CHECK_EQ(1, SSL_CTX_set_tlsext_ticket_keys(ctx, &keys[0], length));
+  }
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+  EC_KEY *ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+  CHECK_NOTNULL(ecdh);
+  CHECK_EQ(1, SSL_CTX_set_tmp_ecdh(ctx, ecdh));
+  EC_KEY_free(ecdh);
+  // Without this, the key made from |ecdh| serves every handshake.
+  if (!FLAGS_tls_reuse_ecdh_key)
+    SSL_CTX_set_options(ctx, SSL_OP_SINGLE_ECDH_USE);
+#else
+  if (FLAGS_tls_reuse_ecdh_key)
+    LOG(WARNING) << "This OpenSSL makes a new ECDHE key for every "
+                 << "handshake; --tls_reuse_ecdh_key has no effect";
+#endif
+  return context;
+}
+
+// Collects serialized entries from a range lookup.
+class SampleCollector : public Database<LoggedCertificate>::EntryCallback {
+ public:
+  explicit SampleCollector(std::vector<string> *samples) : samples_(samples) {}
+
+  virtual bool Entry(const LoggedCertificate &logged) {
+    samples_->push_back(string());
+    CHECK(logged.SerializeForDatabase(&samples_->back()));
+    return true;
+  }
+
+ private:
+  std::vector<string> *samples_;
+};
+
+// Train a compression dictionary on the latest logged entries and save it
+// to |file|. Returns NULL if there are too few entries to train on.
+static EntryCompressor *TrainCompressor(const Database<LoggedCertificate> *db,
+                                        const string &file) {
+  static const uint64_t kMinSamples = 100;
+  static const uint64_t kMaxSamples = 1000;
+  ct::SignedTreeHead sth;
+  if (db->LatestTreeHead(&sth) != Database<LoggedCertificate>::LOOKUP_OK ||
+      sth.tree_size() < kMinSamples) {
+    LOG(WARNING) << "Too few logged entries to train a compression "
+                 << "dictionary on; storing entries uncompressed";
+    return NULL;
+  }
+  std::vector<string> samples;
+  SampleCollector collector(&samples);
+  CHECK_EQ(Database<LoggedCertificate>::LOOKUP_OK,
+           db->LookupByIndexRange(
+               sth.tree_size() - std::min(sth.tree_size(), kMaxSamples),
+               sth.tree_size(), &collector));
+  const string dictionary = EntryCompressor::TrainDictionary(
+      samples, EntryCompressor::kMaxDictionarySize);
+
+  string tmp_file = util::WriteTemporaryBinaryFile(file + ".XXXXXX",
+                                                   dictionary);
+  CHECK(!tmp_file.empty()) << "Failed to write compression dictionary";
+  PCHECK(rename(tmp_file.c_str(), file.c_str()) == 0)
+      << "Failed to rename " << tmp_file << " to " << file;
+  LOG(INFO) << "Trained a " << dictionary.size() << "-byte compression "
+            << "dictionary on " << samples.size() << " entries";
+  return new EntryCompressor(dictionary);
+}
+
+struct TreeLoader {
+  CTLogManager *manager;
+  Database<LoggedCertificate> *db;
+  EVP_PKEY *pkey;
+  const LogConfig *config;
+  const util::StartupProfiler *startup;
+  // What the frontend writes, for the signer.
+  SequencingQueue *queue;
+};
+
+static void *LoadTrees(void *arg) {
+  TreeLoader *loader = static_cast<TreeLoader*>(arg);
+  // Replicas don't sign.
+  TreeSigner<LoggedCertificate> *signer = NULL;
+  if (loader->config->replicate_from.empty()) {
+    signer = new TreeSigner<LoggedCertificate>(
+        loader->db, new LogSigner(loader->pkey),
+        loader->config->tree_checkpoint_file);
+    // Requests are served already, but the first update reads the
+    // database anyway and sorts out what is on the queue too.
+    signer->SetSequencingQueue(loader->queue);
+  }
+  loader->manager->SignerLoaded();
+  const LogConfig *config = loader->config;
+  LogLookup<LoggedCertificate> *lookup = config->shared_lookup_file.empty() ?
+      new LogLookup<LoggedCertificate>(loader->db, config->leaf_hash_file) :
+      new LogLookup<LoggedCertificate>(
+          loader->db, config->leaf_hash_file,
+          LogLookup<LoggedCertificate>::PUBLISH, config->shared_lookup_file,
+          FLAGS_shared_lookup_max_entries);
+  loader->manager->SetTrees(signer, lookup);
+  LOG(INFO) << loader->startup->Report();
+  return NULL;
+}
+
+struct ReplicationRunner {
+  CTLogManager *manager;
+  Database<LoggedCertificate> *db;
+  const LogConfig *config;
+  util::Metrics *metrics;
+};
+
+// Keeps a replica up to date with its primary, once its trees are loaded.
+// Each request waits on the primary for a new tree head if there is
+// nothing new, so the loop only sleeps after errors.
+static void *RunReplication(void *arg) {
+  ReplicationRunner *runner = static_cast<ReplicationRunner*>(arg);
+  while (!runner->manager->Ready())
+    sleep(1);
+
+  util::Metrics *metrics = runner->metrics;
+  metrics->DefineGauge(kReplicationLagEntries,
+                       "Entries the replica's tree head is behind the "
+                       "primary's.");
+  metrics->DefineGauge(kReplicationLagSeconds,
+                       "Seconds the replica's tree head is behind the "
+                       "primary's.");
+  metrics->DefineCounter(kReplicationErrors,
+                         "Replication updates that failed.");
+  HTTPLogClient client(runner->config->replicate_from);
+  Replica<LoggedCertificate> replica(runner->db,
+                                     runner->manager->leaf_hash_observer());
+  LOG(INFO) << "Replicating from " << runner->config->replicate_from
+            << " at entry " << replica.NextSequenceNumber();
+  while (true) {
+    ct::ReplicationUpdate update;
+    HTTPLogClient::Status status = client.GetReplicationUpdate(
+        replica.NextSequenceNumber(), replica.LatestTreeHead().timestamp(),
+        &update);
+    Replica<LoggedCertificate>::ApplyResult result =
+        Replica<LoggedCertificate>::APPLY_OK;
+    if (status == HTTPLogClient::OK) {
+      result = replica.Apply(update);
+      runner->manager->Replicated();
+      metrics->Set(kReplicationLagEntries, "", replica.LagEntries());
+      metrics->Set(kReplicationLagSeconds, "",
+                   replica.LagMilliseconds() / 1000.0);
+    }
+    if (status != HTTPLogClient::OK ||
+        result != Replica<LoggedCertificate>::APPLY_OK) {
+      LOG(WARNING) << "Replication update failed: status " << status
+                   << ", result " << result;
+      metrics->Increment(kReplicationErrors, "");
+      sleep(FLAGS_replication_retry_seconds);
+    }
+  }
+  return NULL;
+}
+
+// Open the storage of the log |config|, without the layers above it.
+static Database<LoggedCertificate> *OpenDatabase(const LogConfig &config) {
+  const bool file_db = config.cert_dir != "" || config.tree_dir != "";
+  if ((file_db ? 1 : 0) + (config.sqlite_db != "" ? 1 : 0) +
+      (config.leveldb_db != "" ? 1 : 0) +
+      (config.sharded_db != "" ? 1 : 0) > 1) {
+    std::cerr << "Choose one of file, sqlite, leveldb or sharded database"
+              << std::endl;
     exit(1);
   }
 
+  if (config.sqlite_db == "" && config.leveldb_db == "" &&
+      config.sharded_db == "")
+    CHECK_NE(config.cert_dir, config.tree_dir)
+        << "Certificate directory and tree directory must differ";
+
+  // FileDB reads entries as it opens, so it needs the dictionary first.
+  EntryCompressor *compressor = NULL;
+  string dictionary;
+  if (config.entry_compression_dictionary != "" &&
+      util::ReadBinaryFile(config.entry_compression_dictionary, &dictionary))
+    compressor = new EntryCompressor(dictionary);
+
   Database<LoggedCertificate> *db;
 
-  if (FLAGS_sqlite_db != "")
-      db = new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
-  else
+  if (config.sqlite_db != "") {
+      db = new SQLiteDB<LoggedCertificate>(config.sqlite_db);
+  } else if (config.leveldb_db != "") {
+      db = new LevelDB<LoggedCertificate>(config.leveldb_db);
+  } else if (config.sharded_db != "") {
+      db = new ShardedDB<LoggedCertificate>(config.sharded_db,
+                                            FLAGS_sharded_db_shard_size);
+  } else {
+      EntryStorage *cert_storage;
+      if (FLAGS_cert_segment_size_mb > 0)
+        cert_storage = new SegmentStorage(
+            config.cert_dir,
+            static_cast<size_t>(FLAGS_cert_segment_size_mb) << 20);
+      else
+        cert_storage = new FileStorage(config.cert_dir,
+                                       FLAGS_cert_storage_depth);
       db = new FileDB<LoggedCertificate>(
-               new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth),
-               new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth));
+               cert_storage,
+               new FileStorage(config.tree_dir, FLAGS_tree_storage_depth),
+               config.cert_index_file, compressor);
+  }
+
+  if (config.entry_compression_dictionary != "") {
+    if (compressor == NULL)
+      compressor = TrainCompressor(db, config.entry_compression_dictionary);
+    db->SetCompressor(compressor);
+  }
+
+  if (config.intermediate_dir != "")
+    db = new InterningDatabase(
+        db, new FileStorage(config.intermediate_dir,
+                            FLAGS_intermediate_storage_depth),
+        FLAGS_intermediate_cache_size);
+  return db;
+}
+
+// One of the logs the process hosts. Each has its own roots, database,
+// trees and key, and its metrics labelled by its prefix; they share the
+// signature cache, the metrics, and the threads that serve requests and
+// sign trees.
+struct HostedLog {
+  HostedLog(const LogConfig &log_config, SignatureCache *signature_cache,
+            util::Metrics *parent_metrics)
+      : config(log_config),
+        metrics(parent_metrics, config.prefix.empty() ? string() :
+                "log=\"" + config.prefix + "\""),
+        checker(signature_cache),
+        storage(NULL),
+        cache(NULL),
+        source(NULL) {}
+
+  const LogConfig config;
+  util::Metrics metrics;
+  CertChecker checker;
+  InstrumentedDatabase<LoggedCertificate> *storage;
+  CachingDatabase<LoggedCertificate> *cache;
+  LockingDatabase<LoggedCertificate> *db;
+  // Serves the log's replicas, if it has any.
+  ReplicationSource<LoggedCertificate> *source;
+  // From the frontend to the tree signer. Only replicas don't have one.
+  SequencingQueue queue;
+  CTLogManager *manager;
+  TreeLoader loader;
+  pthread_t loading_thread;
+  // Replicas only.
+  ReplicationRunner runner;
+  pthread_t replication_thread;
+};
+
+// Open the log |config| and start loading its trees; requests are served
+// meanwhile.
+static HostedLog *OpenLog(const LogConfig &config,
+                          SignatureCache *signature_cache,
+                          util::Metrics *metrics,
+                          const util::StartupProfiler *startup) {
+  HostedLog *log = new HostedLog(config, signature_cache, metrics);
+  EVP_PKEY *pkey = NULL;
+  CHECK_EQ(Services::ReadPrivateKey(&pkey, config.key), Services::KEY_OK);
+
+  {
+    util::StartupProfiler::Phase phase("loading trust store");
+    CHECK(log->checker.LoadTrustedCertificates(config.trusted_cert_file))
+        << "Could not load CA certs from " << config.trusted_cert_file;
+  }
+
+  Database<LoggedCertificate> *db = OpenDatabase(config);
+
+  // Below the cache and the lock, so that it times the storage alone.
+  if (FLAGS_storage_stats) {
+    log->storage = new InstrumentedDatabase<LoggedCertificate>(
+        db, &log->metrics);
+    db = log->storage;
+  }
+
+  if (FLAGS_entry_cache_size > 0) {
+    log->cache = new CachingDatabase<LoggedCertificate>(
+        db, FLAGS_entry_cache_size);
+    db = log->cache;
+  }
+
+  // Requests and signing run on threads of their own.
+  log->db = new LockingDatabase<LoggedCertificate>(db, &log->metrics);
+  db = log->db;
+  log->source = new ReplicationSource<LoggedCertificate>(db);
 
   // Hmm, there is no EVP_PKEY_dup, so let's read the key again...
   EVP_PKEY *pkey2 = NULL;
-  CHECK_EQ(Services::ReadPrivateKey(&pkey2, FLAGS_key), Services::KEY_OK);
+  CHECK_EQ(Services::ReadPrivateKey(&pkey2, config.key), Services::KEY_OK);
+
+  FrontendSigner *frontend_signer = new FrontendSigner(db, new LogSigner(pkey));
+  if (config.replicate_from.empty())
+    frontend_signer->SetSequencingQueue(&log->queue);
+  log->manager = new CTLogManager(
+      new Frontend(new CertSubmissionHandler(&log->checker), frontend_signer),
+      db, db->PendingHashes().size(), &log->metrics,
+      !config.replicate_from.empty());
+  // Requests are served while the trees load.
+  TreeLoader loader = { log->manager, db, pkey2, &log->config, startup,
+                        &log->queue };
+  log->loader = loader;
+  CHECK_EQ(0, pthread_create(&log->loading_thread, NULL, LoadTrees,
+                             &log->loader));
+  if (!config.replicate_from.empty()) {
+    ReplicationRunner runner = { log->manager, db, &log->config,
+                                 &log->metrics };
+    log->runner = runner;
+    CHECK_EQ(0, pthread_create(&log->replication_thread, NULL,
+                               RunReplication, &log->runner));
+  }
+  return log;
+}
 
-  CTLogManager manager(
-      new Frontend(new CertSubmissionHandler(&checker),
-                   new FrontendSigner(db, new LogSigner(pkey))),
-      new TreeSigner<LoggedCertificate>(db, new LogSigner(pkey2)),
-      new LogLookup<LoggedCertificate>(db));
+static void *RunIOService(void *io) {
+  static_cast<boost::asio::io_service*>(io)->run();
+  return NULL;
+}
 
+static void *RunServer(void *server_) {
   try {
-    ct_server handler(&manager);
+    static_cast<server*>(server_)->run();
+  }
+  catch (std::exception &e) {
+    LOG(FATAL) << e.what();
+  }
+  return NULL;
+}
+
+// How often the phases of startup log their progress.
+static const uint32_t kStartupProgressSeconds = 10;
+
+int main(int argc, char * argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  util::ThreadPool::ConfigureDefault(
+      FLAGS_compute_threads > 0 ? FLAGS_compute_threads :
+                               util::ThreadPool::DefaultThreads(),
+      FLAGS_pin_compute_threads);
+  util::StartupProfiler startup(kStartupProgressSeconds);
+  util::StartupProfiler::SetGlobal(&startup);
+  OpenSSL_add_all_algorithms();
+  ERR_load_crypto_strings();
+  ct::LoadCtExtensions();
+
+  if (FLAGS_max_concurrent_submissions + FLAGS_max_concurrent_bulk_reads >=
+      FLAGS_server_threads)
+    LOG(WARNING) << "max_concurrent_submissions and max_concurrent_bulk_reads "
+                 << "leave no server threads for the other requests";
+
+  const std::vector<LogConfig> configs = ReadLogConfigs();
+  SignatureCache signature_cache(FLAGS_signature_cache_size);
+  ParsedCertCache cert_cache(FLAGS_parsed_cert_cache_size);
+  util::Metrics metrics;
+  util::Tracer tracer(FLAGS_trace_sample_every, FLAGS_trace_max_spans);
+  if (FLAGS_trace_sample_every > 0)
+    util::Tracer::SetGlobal(&tracer);
+  std::vector<HostedLog*> logs;
+  for (size_t i = 0; i < configs.size(); ++i)
+    logs.push_back(OpenLog(configs[i], &signature_cache, &metrics, &startup));
+
+  try {
+    ct_server handler(&metrics,
+                      FLAGS_trace_sample_every > 0 ? &tracer : NULL,
+                      &startup, &signature_cache, &cert_cache);
+    // Signing has an event loop of its own, so that it doesn't hold up
+    // requests. The logs take turns on it.
+    boost::shared_ptr<boost::asio::io_service> signing_io
+        = boost::make_shared<boost::asio::io_service>();
+    std::vector<LogHandler*> log_handlers;
+    std::vector<AsioRepeatedEvent*> events;
+    std::vector<TileExporter<LoggedCertificate>*> exporters;
+    for (size_t i = 0; i < logs.size(); ++i) {
+      HostedLog *log = logs[i];
+      log_handlers.push_back(new LogHandler(log->manager, &log->metrics,
+                                            log->db, log->cache,
+                                            log->storage, log->source,
+                                            &cert_cache));
+      handler.AddLog(log->config.prefix, log_handlers.back());
+      if (log->config.replicate_from.empty())
+        events.push_back(new TreeSigningEvent(signing_io,
+            boost::posix_time::seconds(FLAGS_tree_signing_frequency_seconds),
+            log->manager));
+      events.push_back(new FrontendLogEvent(signing_io,
+          boost::posix_time::seconds(FLAGS_log_stats_frequency_seconds),
+          log->manager, log->db, log->cache, log->storage));
+      // Tiles are exported between signings.
+      if (log->config.tile_dir != "") {
+        exporters.push_back(new TileExporter<LoggedCertificate>(
+            log->db, log->config.tile_dir));
+        events.push_back(new TileExportEvent(
+            signing_io,
+            boost::posix_time::seconds(FLAGS_tile_export_frequency_seconds),
+            exporters.back()));
+      }
+    }
+    pthread_t signing_thread;
+    CHECK_EQ(0, pthread_create(&signing_thread, NULL, RunIOService,
+                               signing_io.get()));
+
     boost::shared_ptr<boost::asio::io_service> io
         = boost::make_shared<boost::asio::io_service>();
-    TreeSigningEvent tree_event(io,
-        boost::posix_time::seconds(FLAGS_tree_signing_frequency_seconds),
-        &manager);
     server::options options(handler);
     server server_(options.address(FLAGS_server).port(FLAGS_port)
                    .reuse_address(true).io_service(io));
+    // HTTPS is served by the same threads, from the same event loop.
+    boost::scoped_ptr<boost::asio::ssl::context> tls_context;
+    boost::scoped_ptr<TLSServer> tls_server;
+    if (!FLAGS_tls_port.empty()) {
+      SSL_library_init();
+      tls_context.reset(TLSContext());
+      tls_server.reset(new TLSServer(io, tls_context.get(), &handler,
+                                     &metrics, FLAGS_server,
+                                     FLAGS_tls_port));
+    }
+    // All the threads serve requests from the same event loop.
+    std::vector<pthread_t> threads(FLAGS_server_threads - 1);
+    for (size_t i = 0; i < threads.size(); ++i)
+      CHECK_EQ(0, pthread_create(&threads[i], NULL, RunServer, &server_));
     server_.run();
+    for (size_t i = 0; i < threads.size(); ++i)
+      CHECK_EQ(0, pthread_join(threads[i], NULL));
+    for (size_t i = 0; i < logs.size(); ++i)
+      CHECK_EQ(0, pthread_join(logs[i]->loading_thread, NULL));
   }
   catch (std::exception &e) {
     std::cerr << e.what() << std::endl;
@@ -1,12 +1,16 @@
 /* -*- indent-tabs-mode: nil -*- */
 
+#include <algorithm>
 #include <deque>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <iostream>
+#include <map>
 #include <netinet/in.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,22 +20,39 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <vector>
 
 #include "include/ct.h"
+#include "log/archive_segment.h"
+#include "log/archiving_db.h"
+#include "log/caching_db.h"
 #include "log/cert_checker.h"
 #include "log/cert_submission_handler.h"
 #include "log/ct_extensions.h"
+#include "log/entry_compressor.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
 #include "log/frontend_signer.h"
 #include "log/frontend.h"
+#include "log/instrumented_db.h"
+#include "log/interning_db.h"
+#include "log/leveldb_db.h"
+#include "log/locking_db.h"
 #include "log/log_lookup.h"
 #include "log/log_signer.h"
 #include "log/logged_certificate.h"
+#include "log/segment_storage.h"
+#include "log/sequencing_queue.h"
+#include "log/sharded_db.h"
 #include "log/sqlite_db.h"
 #include "log/tree_signer.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/metrics.h"
+#include "util/profiler.h"
+#include "util/startup_profiler.h"
+#include "util/thread_pool.h"
+#include "util/trace.h"
 // FIXME: debug
 #include "util/util.h"
 
@@ -43,14 +64,99 @@ DEFINE_string(trusted_cert_file, "",
               "File for trusted CA certificates, in concatenated PEM format");
 DEFINE_string(cert_dir, "", "Storage directory for certificates");
 DEFINE_string(tree_dir, "", "Storage directory for trees");
+DEFINE_string(cert_index_file, "",
+              "File for indexing the certificate directory across restarts, "
+              "so that only pending entries are read at startup. "
+              "Leave empty to scan the whole directory.");
 DEFINE_string(sqlite_db, "", "Database for certificate and tree storage");
+DEFINE_string(leveldb_db, "",
+              "LevelDB directory for certificate and tree storage");
+DEFINE_string(entry_compression_dictionary, "",
+              "File with the dictionary that stored entries are compressed "
+              "with. If the file doesn't exist, a dictionary is trained on "
+              "the latest logged entries and written there. Entries "
+              "compressed with a dictionary can't be read without it.");
+DEFINE_string(sharded_db, "",
+              "Directory for certificate and tree storage in SQLite files, "
+              "one per sharded_db_shard_size sequenced entries");
+DEFINE_int32(sharded_db_shard_size, 1 << 20,
+             "Sequenced entries per --sharded_db shard. Must be the same "
+             "every time the directory is used. Must be greater than 0.");
+DEFINE_string(leaf_hash_file, "",
+              "File for caching Merkle tree leaf hashes across restarts, "
+              "so that the tree need not be rebuilt from the database. "
+              "Leave empty to disable.");
+DEFINE_string(subtree_root_file, "",
+              "File to keep the roots of the complete subtrees of the "
+              "Merkle tree in, with each tree head, for ct-dns-server "
+              "--subtree_root_file to serve from. Leave empty to disable.");
+DEFINE_string(tree_checkpoint_file, "",
+              "File for checkpointing the signer's Merkle tree with each "
+              "tree head, so that a restarting signer need not replay the "
+              "whole log. Leave empty to disable.");
 // TODO(ekasper): sanity-check these against the directory structure.
 DEFINE_int32(cert_storage_depth, 0,
              "Subdirectory depth for certificates; if the directory is not "
              "empty, must match the existing depth.");
+DEFINE_int32(cert_segment_size_mb, 0,
+             "If positive, append certificates to segment files of up to "
+             "this many megabytes instead of writing a file for each one. "
+             "Cannot be changed for an existing certificate directory.");
 DEFINE_int32(tree_storage_depth, 0,
              "Subdirectory depth for tree signatures; if the directory is not "
              "empty, must match the existing depth");
+DEFINE_string(intermediate_dir, "",
+              "If set, store each chain certificate once in this directory, "
+              "and only its hash with each entry. Entries logged with "
+              "--intermediate_dir can't be read without it.");
+DEFINE_int32(intermediate_storage_depth, 0,
+             "Subdirectory depth for --intermediate_dir; if the directory is "
+             "not empty, must match the existing depth.");
+DEFINE_int32(intermediate_cache_size, 10000,
+             "Number of --intermediate_dir certificates to keep in memory.");
+DEFINE_int32(entry_cache_size, 0,
+             "Number of recently looked up entries to keep in memory, both by "
+             "hash and by sequence number. 0 disables the cache.");
+DEFINE_string(archive_dir, "",
+              "If set, move logged entries older than archive_age_days out "
+              "of the file or sqlite database into compressed, "
+              "memory-mapped segment files in this directory, checking "
+              "every tree_signing_frequency_seconds. Archived entries can't "
+              "be read without it.");
+DEFINE_int32(archive_age_days, 90,
+             "Age, by SCT timestamp, after which --archive_dir entries are "
+             "archived.");
+DEFINE_int32(archive_segment_entries, 1 << 20,
+             "Number of entries per --archive_dir segment.");
+DEFINE_bool(storage_stats, true,
+            "Count the calls, latency, rows and bytes of each storage "
+            "operation, for the metrics and the statistics log.");
+DEFINE_int32(group_commit_max_entries, 0,
+             "With --sqlite_db, commit the submissions that arrive in the "
+             "same round of the event loop together, in batches of up to "
+             "this many, and reply once their batch is committed. "
+             "0 commits each submission on its own.");
+DEFINE_int32(event_loops, 1,
+             "Number of event loops to serve connections with, each on a "
+             "thread of its own with its own listening socket; the kernel "
+             "spreads connections over them (SO_REUSEPORT). 0 means one "
+             "per CPU core.");
+DEFINE_int32(request_threads, 0,
+             "Number of worker threads to serve requests on, shared by all "
+             "event loops, so that connections can pipeline requests and a "
+             "slow one doesn't hold up the others. 0 serves requests on the "
+             "event loops as they are read. Ignored with "
+             "--group_commit_max_entries.");
+DEFINE_int32(compute_threads, 0,
+             "Number of worker threads that parallel leaf hashing, SCT "
+             "signing and startup scans share. 0 means one per CPU core "
+             "but one, since the threads that hand them work help out.");
+DEFINE_bool(pin_compute_threads, false,
+            "Pin each of the compute_threads to a CPU core of its own.");
+DEFINE_int32(max_inflight_requests, 16,
+             "With --request_threads, the most requests of one connection "
+             "to serve at a time; the connection isn't read from while it "
+             "has this many. Must be greater than 0.");
 DEFINE_int32(log_stats_frequency_seconds, 3600,
              "Interval for logging summary statistics. Approximate: the server "
              "will log statistics if in the beginning of its select loop, "
@@ -62,6 +168,35 @@ DEFINE_int32(tree_signing_frequency_seconds, 600,
              "server select loop, at least this period has elapsed since the "
              "last signing. Set this well below the MMD to ensure we sign "
              "in a timely manner. Must be greater than 0.");
+DEFINE_int32(tree_signing_max_entries, 0,
+             "Maximum number of new entries to sequence per signing. When a "
+             "signing leaves entries pending, the next one runs right away "
+             "rather than after tree_signing_frequency_seconds, so that a "
+             "backlog is worked off in bounded steps. 0 means no limit.");
+DEFINE_bool(tree_signing_pipelined, false,
+            "Read and hash the next batch of pending entries while signing "
+            "the current tree head. Entries submitted in the meantime are "
+            "then only sequenced by the signing after next.");
+DEFINE_string(metrics_file, "",
+              "File to write metrics to, in the Prometheus text format, for "
+              "a node exporter's textfile collector to pick up. Leave empty "
+              "to disable.");
+DEFINE_int32(metrics_frequency_seconds, 60,
+             "Interval for writing --metrics_file. Must be greater than 0.");
+DEFINE_int32(trace_sample_every, 0,
+             "Trace one in this many submissions and signings, or none if 0.");
+DEFINE_int32(trace_max_spans, 100000,
+             "Number of the latest trace spans to keep.");
+DEFINE_string(trace_file, "",
+              "File to write the traces to, in the Chrome trace event "
+              "format, every --metrics_frequency_seconds. Leave empty to "
+              "disable.");
+DEFINE_string(profile_dir, "",
+              "Directory to write profiles to on SIGUSR2: a CPU profile of "
+              "the next --profile_seconds, and a heap profile if built with "
+              "TCMALLOC=1, for pprof. Leave empty to disable.");
+DEFINE_int32(profile_seconds, 30,
+             "How long CPU profiles last. Must be greater than 0.");
 
 using ct::LoggedCertificate;
 using google::RegisterFlagValidator;
@@ -121,6 +256,26 @@ static const bool c_st_dummy = RegisterFlagValidator(&FLAGS_cert_storage_depth,
                                                      &ValidateIsNonNegative);
 static const bool t_st_dummy = RegisterFlagValidator(&FLAGS_tree_storage_depth,
                                                      &ValidateIsNonNegative);
+static const bool seg_dummy = RegisterFlagValidator(
+    &FLAGS_cert_segment_size_mb, &ValidateIsNonNegative);
+static const bool cache_dummy = RegisterFlagValidator(
+    &FLAGS_entry_cache_size, &ValidateIsNonNegative);
+static const bool i_st_dummy = RegisterFlagValidator(
+    &FLAGS_intermediate_storage_depth, &ValidateIsNonNegative);
+static const bool i_cache_dummy = RegisterFlagValidator(
+    &FLAGS_intermediate_cache_size, &ValidateIsNonNegative);
+static const bool max_dummy = RegisterFlagValidator(
+    &FLAGS_tree_signing_max_entries, &ValidateIsNonNegative);
+static const bool group_dummy = RegisterFlagValidator(
+    &FLAGS_group_commit_max_entries, &ValidateIsNonNegative);
+static const bool loops_dummy = RegisterFlagValidator(
+    &FLAGS_event_loops, &ValidateIsNonNegative);
+static const bool threads_dummy = RegisterFlagValidator(
+    &FLAGS_request_threads, &ValidateIsNonNegative);
+static const bool trace_dummy = RegisterFlagValidator(
+    &FLAGS_trace_sample_every, &ValidateIsNonNegative);
+static const bool compute_dummy = RegisterFlagValidator(
+    &FLAGS_compute_threads, &ValidateIsNonNegative);
 
 static bool ValidateIsPositive(const char *flagname, int value) {
   if (value <= 0) {
@@ -136,6 +291,27 @@ static const bool stats_dummy = RegisterFlagValidator(
 static const bool sign_dummy = RegisterFlagValidator(
     &FLAGS_tree_signing_frequency_seconds, &ValidateIsPositive);
 
+static const bool shard_dummy = RegisterFlagValidator(
+    &FLAGS_sharded_db_shard_size, &ValidateIsPositive);
+
+static const bool archive_age_dummy = RegisterFlagValidator(
+    &FLAGS_archive_age_days, &ValidateIsPositive);
+
+static const bool archive_size_dummy = RegisterFlagValidator(
+    &FLAGS_archive_segment_entries, &ValidateIsPositive);
+
+static const bool metrics_dummy = RegisterFlagValidator(
+    &FLAGS_metrics_frequency_seconds, &ValidateIsPositive);
+
+static const bool spans_dummy = RegisterFlagValidator(
+    &FLAGS_trace_max_spans, &ValidateIsPositive);
+
+static const bool inflight_dummy = RegisterFlagValidator(
+    &FLAGS_max_inflight_requests, &ValidateIsPositive);
+
+static const bool profile_dummy = RegisterFlagValidator(
+    &FLAGS_profile_seconds, &ValidateIsPositive);
+
 using ct::MerkleAuditProof;
 using ct::ClientLookup;
 using ct::ClientMessage;
@@ -145,15 +321,98 @@ using ct::SignedCertificateTimestamp;
 using ct::protocol::kPacketPrefixLength;
 using ct::protocol::kMaxPacketLength;
 
+namespace {
+
+const char kRequests[] = "ct_requests_total";
+const char kRequestSeconds[] = "ct_request_seconds";
+const char kSigningSeconds[] = "ct_signing_round_seconds";
+const char kSigningEntries[] = "ct_signing_round_entries";
+const char kTreeSize[] = "ct_tree_size";
+const char kPending[] = "ct_pending_entries";
+
+// Upper bounds for the entries sequenced per signing.
+std::vector<double> EntryBuckets() {
+  std::vector<double> buckets;
+  for (double bound = 1; bound <= 1e7; bound *= 10)
+    buckets.push_back(bound);
+  return buckets;
+}
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+}  // namespace
+
+// Writes the submissions of each round of the event loop in as few
+// transactions as possible. The SCTs for a round are sent in a later round
+// (see EndOfRoundEvent), so none goes out before its entry is committed.
+class GroupCommit : public EndOfRoundEvent {
+ public:
+  GroupCommit(Database<LoggedCertificate> *db, size_t max_entries)
+      : db_(db),
+        max_entries_(max_entries),
+        entries_(0) {
+    CHECK(db_->Transactional());
+    CHECK_GT(max_entries_, 0U);
+  }
+
+  // Call before each submission.
+  void Submitting() {
+    if (entries_ == max_entries_)
+      Execute();
+    if (entries_ == 0)
+      db_->BeginTransaction();
+    ++entries_;
+  }
+
+  void Execute() {
+    if (entries_ == 0)
+      return;
+    db_->EndTransaction();
+    entries_ = 0;
+  }
+
+ private:
+  Database<LoggedCertificate> *db_;
+  const size_t max_entries_;
+  // Submissions in the open transaction, if any.
+  size_t entries_;
+};
+
 class CTLogManager {
  public:
+  // |pending| is the number of entries waiting to be sequenced at startup.
+  // Records signings in |metrics|, which must outlive the manager.
   CTLogManager(Frontend *frontend,
                TreeSigner<LoggedCertificate> *signer,
-               LogLookup<LoggedCertificate> *lookup)
+               LogLookup<LoggedCertificate> *lookup,
+               uint64_t pending, util::Metrics *metrics)
       : frontend_(frontend),
         signer_(signer),
-        lookup_(lookup) {
+        lookup_(lookup),
+        metrics_(metrics),
+        initial_pending_(pending),
+        initial_tree_size_(lookup_->GetSTH().tree_size()) {
+    metrics_->DefineHistogram(kSigningSeconds,
+                              "Duration of signing rounds, in seconds.",
+                              util::Metrics::LatencyBuckets());
+    metrics_->DefineHistogram(kSigningEntries,
+                              "Entries sequenced per signing round.",
+                              EntryBuckets());
+    metrics_->DefineGauge(kTreeSize, "Entries in the latest tree head.");
+    metrics_->DefineGauge(kPending, "Entries waiting to be sequenced.");
     LOG(INFO) << "Starting CT log manager";
+    // The lookup is updated from the signer's rounds.
+    signer_->AddLeafHashObserver(lookup_->leaf_hash_observer());
     time_t last_update = static_cast<time_t>(signer_->LastUpdateTime() / 1000);
     if (last_update > 0)
       LOG(INFO) << "Last tree update was at " << ctime(&last_update);
@@ -207,9 +466,14 @@ class CTLogManager {
   }
 
   // Submit an entry and write a token, if the entry is accepted,
-  // or an error otherwise.
+  // or an error otherwise. |group_commit| is that of the calling loop, if
+  // any, and may be NULL.
   LogReply SubmitEntry(ct::LogEntryType type, const string &data,
-                       SignedCertificateTimestamp *sct, string *error) {
+                       SignedCertificateTimestamp *sct, string *error,
+                       GroupCommit *group_commit) {
+    util::Tracer::Span span("manager.submit_entry");
+    if (group_commit != NULL)
+      group_commit->Submitting();
     SignedCertificateTimestamp local_sct;
     SubmitResult submit_result = frontend_->QueueEntry(type, data, &local_sct);
 
@@ -217,7 +481,7 @@ class CTLogManager {
     switch (submit_result) {
       case ADDED:
       case DUPLICATE:
-        sct->CopyFrom(local_sct);
+        sct->Swap(&local_sct);
         reply = SIGNED_CERTIFICATE_TIMESTAMP;
         break;
       default:
@@ -233,7 +497,7 @@ class CTLogManager {
     LogLookup<LoggedCertificate>::LookupResult res =
         lookup_->AuditProof(merkle_leaf_hash, &local_proof);
     if (res == LogLookup<LoggedCertificate>::OK) {
-      proof->CopyFrom(local_proof);
+      proof->Swap(&local_proof);
       return MERKLE_AUDIT_PROOF;
     }
     CHECK_EQ(LogLookup<LoggedCertificate>::NOT_FOUND, res);
@@ -241,7 +505,13 @@ class CTLogManager {
   }
 
   bool SignMerkleTree() {
-    TreeSigner<LoggedCertificate>::UpdateResult res = signer_->UpdateTree();
+    util::Tracer::Span span("manager.sign_merkle_tree");
+    util::Metrics::Timer timer(metrics_, kSigningSeconds, "");
+    const uint64_t tree_size = signer_->LatestSTH().tree_size();
+    TreeSigner<LoggedCertificate>::UpdateResult res =
+        FLAGS_tree_signing_pipelined ?
+        signer_->UpdateTreePipelined(FLAGS_tree_signing_max_entries) :
+        signer_->UpdateTree(FLAGS_tree_signing_max_entries);
     if (res != TreeSigner<LoggedCertificate>::OK) {
       LOG(ERROR) << "Tree update failed with return code " << res;
       return false;
@@ -249,20 +519,61 @@ class CTLogManager {
     time_t last_update = static_cast<time_t>(signer_->LastUpdateTime() / 1000);
     LOG(INFO) << "Tree successfully updated at " << ctime(&last_update);
     CHECK_EQ(LogLookup<LoggedCertificate>::UPDATE_OK, lookup_->Update());
+    metrics_->Observe(kSigningEntries, "",
+                      signer_->LatestSTH().tree_size() - tree_size);
     return true;
   }
 
+  // Whether the last signing left entries pending because of its cap.
+  bool SigningBacklog() const {
+    return signer_->PendingBacklog();
+  }
+
+  // The number of entries waiting to be sequenced: those pending at
+  // startup and those added since, less those sequenced since.
+  uint64_t Pending() const {
+    Frontend::FrontendStats stats;
+    frontend_->GetStats(&stats);
+    const uint64_t waiting = initial_pending_ + stats.x509_accepted +
+        stats.precert_accepted;
+    const uint64_t sequenced =
+        lookup_->GetSTH().tree_size() - initial_tree_size_;
+    return waiting > sequenced ? waiting - sequenced : 0;
+  }
+
+  // Bring the metrics kept elsewhere up to date.
+  void UpdateMetrics() const {
+    metrics_->Set(kTreeSize, "", lookup_->GetSTH().tree_size());
+    metrics_->Set(kPending, "", Pending());
+    frontend_->ExportStats(metrics_);
+    lookup_->ExportMemoryUsage(metrics_);
+  }
+
+  util::Metrics *metrics() const {
+    return metrics_;
+  }
+
  private:
   Frontend *frontend_;
   TreeSigner<LoggedCertificate> *signer_;
   LogLookup<LoggedCertificate> *lookup_;
+  util::Metrics *const metrics_;
+  const uint64_t initial_pending_;
+  const uint64_t initial_tree_size_;
 };
 
 class FrontendLogEvent : public RepeatedEvent {
  public:
-  FrontendLogEvent(time_t frequency, CTLogManager *manager)
+  // |cache| and |storage| may be NULL.
+  FrontendLogEvent(time_t frequency, CTLogManager *manager,
+                   const LockingDatabase<LoggedCertificate> *db,
+                   const CachingDatabase<LoggedCertificate> *cache,
+                   const InstrumentedDatabase<LoggedCertificate> *storage)
   : RepeatedEvent(frequency),
-    manager_(manager) {}
+    manager_(manager),
+    db_(db),
+    cache_(cache),
+    storage_(storage) {}
 
   string Description() {
     return "frontend statistics logging";
@@ -272,35 +583,299 @@ class FrontendLogEvent : public RepeatedEvent {
     time_t roughly_now = Services::RoughTime();
     LOG(INFO) << "Frontend statistics on " << ctime(&roughly_now);
     LOG(INFO) << manager_->FrontendStats();
+    LockingDatabase<LoggedCertificate>::Hold hold(db_);
+    if (cache_ != NULL) {
+      CachingDatabase<LoggedCertificate>::CacheStats stats;
+      cache_->GetStats(&stats);
+      LOG(INFO) << "Entry cache hits by hash: " << stats.hash_hits << "/"
+                << stats.hash_hits + stats.hash_misses << ", by index: "
+                << stats.index_hits << "/"
+                << stats.index_hits + stats.index_misses;
+    }
+    if (storage_ != NULL)
+      LOG(INFO) << storage_->StatsSummary();
   }
  private:
   CTLogManager *manager_;
+  const LockingDatabase<LoggedCertificate> *db_;
+  const CachingDatabase<LoggedCertificate> *cache_;
+  const InstrumentedDatabase<LoggedCertificate> *storage_;
 };
 
+// Writes all metrics to a file for a node exporter's textfile collector.
+// The file is replaced whole, so the collector never reads half of it.
+class MetricsEvent : public RepeatedEvent {
+ public:
+  // |cache| and |storage| may be NULL.
+  MetricsEvent(time_t frequency, const string &file,
+               const CTLogManager *manager,
+               const LockingDatabase<LoggedCertificate> *db,
+               const CachingDatabase<LoggedCertificate> *cache,
+               const InstrumentedDatabase<LoggedCertificate> *storage)
+  : RepeatedEvent(frequency),
+    file_(file),
+    manager_(manager),
+    db_(db),
+    cache_(cache),
+    storage_(storage) {}
+
+  string Description() {
+    return "metrics export";
+  }
+
+  void Execute() {
+    manager_->UpdateMetrics();
+    {
+      LockingDatabase<LoggedCertificate>::Hold hold(db_);
+      if (cache_ != NULL)
+        cache_->ExportStats(manager_->metrics());
+      if (storage_ != NULL)
+        storage_->ExportStats(manager_->metrics());
+      db_->ExportMemoryUsage(manager_->metrics());
+    }
+    ReplaceFile(file_, manager_->metrics()->Export());
+  }
+
+  // Write |contents| to a new file and rename it over |file|, so that
+  // readers never see a partial one.
+  static void ReplaceFile(const string &file, const string &contents) {
+    const string tmp_file =
+        util::WriteTemporaryBinaryFile(file + ".XXXXXX", contents);
+    if (tmp_file.empty()) {
+      LOG(ERROR) << "Failed to write " << file;
+      return;
+    }
+    if (rename(tmp_file.c_str(), file.c_str()) != 0) {
+      PLOG(ERROR) << "Failed to rename " << tmp_file << " to " << file;
+      unlink(tmp_file.c_str());
+    }
+  }
+
+ private:
+  const string file_;
+  const CTLogManager *manager_;
+  const LockingDatabase<LoggedCertificate> *db_;
+  const CachingDatabase<LoggedCertificate> *cache_;
+  const InstrumentedDatabase<LoggedCertificate> *storage_;
+};
+
+class TraceEvent : public RepeatedEvent {
+ public:
+  TraceEvent(time_t frequency, const string &file, const util::Tracer *tracer)
+  : RepeatedEvent(frequency),
+    file_(file),
+    tracer_(tracer) {}
+
+  string Description() {
+    return "trace export";
+  }
+
+  void Execute() {
+    MetricsEvent::ReplaceFile(file_, tracer_->ExportChromeTrace());
+  }
+
+ private:
+  const string file_;
+  const util::Tracer *tracer_;
+};
 
+// Signs in a thread of its own, so that serving carries on meanwhile.
+// LogLookup publishes the new tree to readers atomically, and the
+// database is locked for each call and each transaction.
 class TreeSigningEvent : public RepeatedEvent {
  public:
   TreeSigningEvent(time_t frequency, CTLogManager *manager)
   : RepeatedEvent(frequency),
-    manager_(manager) {}
+    manager_(manager),
+    running_(false),
+    started_(false),
+    backlog_(false) {
+    CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+  }
+
+  ~TreeSigningEvent() {
+    if (started_)
+      CHECK_EQ(0, pthread_join(thread_, NULL));
+    pthread_mutex_destroy(&mutex_);
+  }
 
   string Description() {
     return "tree signing";
   }
 
+  // Starts a signing, unless the last one is still running.
   void Execute() {
-    CHECK(manager_->SignMerkleTree());
-   }
-  private:
-   CTLogManager *manager_;
+    {
+      ScopedLock lock(&mutex_);
+      if (running_) {
+        LOG(WARNING) << "Last tree signing still running";
+        return;
+      }
+      running_ = true;
+    }
+    if (started_)
+      CHECK_EQ(0, pthread_join(thread_, NULL));
+    CHECK_EQ(0, pthread_create(&thread_, NULL, SignThread, this));
+    started_ = true;
+  }
+
+  bool RepeatSoon() {
+    ScopedLock lock(&mutex_);
+    return backlog_;
+  }
+
+ private:
+  static void *SignThread(void *arg) {
+    TreeSigningEvent *event = static_cast<TreeSigningEvent*>(arg);
+    CHECK(event->manager_->SignMerkleTree());
+    const bool backlog = event->manager_->SigningBacklog();
+    ScopedLock lock(&event->mutex_);
+    event->backlog_ = backlog;
+    event->running_ = false;
+    return NULL;
+  }
+
+  CTLogManager *manager_;
+  pthread_t thread_;
+  // Guards |running_| and |backlog_|.
+  pthread_mutex_t mutex_;
+  bool running_;
+  // Whether |thread_| needs joining. Only used by the loop's thread.
+  bool started_;
+  // Whether the last signing left entries pending because of its cap.
+  bool backlog_;
 };
 
-class CTServer : public Server {
+// Archives old entries in a thread of its own, a segment at a time: the
+// entries are read and written out under the database lock a chunk at a
+// time, and only dropping them from the database holds it throughout.
+class ArchiveEvent : public RepeatedEvent {
  public:
-  // Does not grab ownership of the manager.
-  CTServer(EventLoop *loop, int fd, CTLogManager *manager)
-      : Server(loop, fd),
-        manager_(manager) {}
+  ArchiveEvent(time_t frequency, LockingDatabase<LoggedCertificate> *db,
+               ArchivingDatabase<LoggedCertificate> *archive,
+               uint64_t segment_entries, uint64_t max_age_ms)
+  : RepeatedEvent(frequency),
+    db_(db),
+    archive_(archive),
+    segment_entries_(segment_entries),
+    max_age_ms_(max_age_ms),
+    running_(false),
+    started_(false),
+    backlog_(false) {
+    CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+  }
+
+  ~ArchiveEvent() {
+    if (started_)
+      CHECK_EQ(0, pthread_join(thread_, NULL));
+    pthread_mutex_destroy(&mutex_);
+  }
+
+  string Description() {
+    return "archiving";
+  }
+
+  void Execute() {
+    {
+      ScopedLock lock(&mutex_);
+      if (running_)
+        return;
+      running_ = true;
+    }
+    if (started_)
+      CHECK_EQ(0, pthread_join(thread_, NULL));
+    CHECK_EQ(0, pthread_create(&thread_, NULL, ArchiveThread, this));
+    started_ = true;
+  }
+
+  bool RepeatSoon() {
+    ScopedLock lock(&mutex_);
+    return backlog_;
+  }
+
+ private:
+  // Whether the next segment's worth of entries is in the tree, and old
+  // enough to archive.
+  bool SegmentDue(uint64_t end) const {
+    ct::SignedTreeHead sth;
+    if (db_->LatestTreeHead(&sth) != Database<LoggedCertificate>::LOOKUP_OK ||
+        sth.tree_size() < end)
+      return false;
+    LoggedCertificate last;
+    CHECK_EQ(Database<LoggedCertificate>::LOOKUP_OK,
+             db_->LookupByIndex(end - 1, &last));
+    return last.timestamp() + max_age_ms_ <= util::TimeInMilliseconds();
+  }
+
+  // Archives one segment, if one is due.
+  static void *ArchiveThread(void *arg) {
+    ArchiveEvent *event = static_cast<ArchiveEvent*>(arg);
+    const uint64_t end =
+        event->archive_->ArchivedEnd() + event->segment_entries_;
+    bool archived = false;
+    if (event->SegmentDue(end)) {
+      ArchiveSegment *segment = event->archive_->WriteSegment(end,
+                                                              event->db_);
+      LockingDatabase<LoggedCertificate>::Hold hold(event->db_);
+      event->archive_->AddSegment(segment);
+      LOG(INFO) << "Archived entries up to " << end;
+      archived = true;
+    }
+    ScopedLock lock(&event->mutex_);
+    event->backlog_ = archived;
+    event->running_ = false;
+    return NULL;
+  }
+
+  LockingDatabase<LoggedCertificate> *db_;
+  ArchivingDatabase<LoggedCertificate> *archive_;
+  const uint64_t segment_entries_;
+  const uint64_t max_age_ms_;
+  pthread_t thread_;
+  // Guards |running_| and |backlog_|.
+  pthread_mutex_t mutex_;
+  bool running_;
+  // Whether |thread_| needs joining. Only used by the loop's thread.
+  bool started_;
+  // Whether the last run archived a segment, so there may be more due.
+  bool backlog_;
+};
+
+// A reply to a request: the packet header and the message, which go out
+// together in one writev().
+struct Reply {
+  string header;
+  string message;
+};
+
+// Serves requests, each into a reply. Holds no per-request state, so one
+// handler can serve several threads as long as its group commit, if any,
+// is only used on its own loop.
+class RequestHandler {
+ public:
+  // Does not grab ownership of the manager, or of |group_commit|, which
+  // may be NULL.
+  RequestHandler(CTLogManager *manager, GroupCommit *group_commit)
+      : manager_(manager),
+        group_commit_(group_commit) {}
+
+  // Define the metrics that servers record in |metrics|.
+  static void DefineMetrics(util::Metrics *metrics) {
+    metrics->DefineCounter(kRequests, "Requests, by command.");
+    metrics->DefineHistogram(kRequestSeconds,
+                             "Request latency by command, in seconds.",
+                             util::Metrics::LatencyBuckets());
+  }
+
+  void Handle(int version, int format, const string &data,
+              Reply *reply) const {
+    const uint64_t start = util::TimeInMicroseconds();
+    const string endpoint = string("endpoint=\"") +
+        HandlePacket(version, format, data, reply) + "\"";
+    manager_->metrics()->Observe(kRequestSeconds, endpoint,
+                                 (util::TimeInMicroseconds() - start) / 1e6);
+    manager_->metrics()->Increment(kRequests, endpoint);
+  }
 
   static const ct::protocol::Version kProtocolVersion = ct::protocol::V1;
   static const ct::protocol::Format kPacketFormat = ct::protocol::PROTOBUF;
@@ -308,52 +883,23 @@ class CTServer : public Server {
   static const ct::Version kCtVersion = ct::V1;
 
  private:
-  void BytesRead(string *rbuffer) {
-    for ( ; ; ) {
-      if (rbuffer->size() < 5)
-        return;
-      size_t length = kMaxPacketLength + 1;
-      // Just DCHECK: we explicitly feed it the right-size input,
-      // so nothing should really go wrong here.
-      Deserializer::DeserializeResult res =
-          Deserializer::DeserializeUint(rbuffer->substr(2, 3), 3, &length);
-      DCHECK_EQ(Deserializer::OK, res);
-      if (rbuffer->size() < length + 5)
-        return;
-      // Can only really happen if max packet length is not aligned with
-      // byte boundaries.
-      if (length > kMaxPacketLength) {
-        Close();
-        return;
-      }
-      // We have to initialize to make the compiler happy,
-      // so initialize to an invalid enum.
-      int version = -1;
-      int format = -1;
-      res = Deserializer::DeserializeUint(rbuffer->substr(0, 1), 1, &version);
-      DCHECK_EQ(Deserializer::OK, res);
-      res = Deserializer::DeserializeUint(rbuffer->substr(1, 1), 1, &format);
-      DCHECK_EQ(Deserializer::OK, res);
-      PacketRead(version, format, rbuffer->substr(5, length));
-      rbuffer->erase(0, length + 5);
-    }
-  }
-
-  void PacketRead(int version, int format, const string &data) {
+  // Serve a packet, and return the name of its command.
+  const char *HandlePacket(int version, int format, const string &data,
+                           Reply *out) const {
     if (version != kProtocolVersion) {
-      SendError(ServerError::BAD_VERSION);
-      return;
+      SetError(ServerError::BAD_VERSION, out);
+      return "invalid";
     }
 
     if (format != kPacketFormat) {
-      SendError(ServerError::UNSUPPORTED_FORMAT);
-      return;
+      SetError(ServerError::UNSUPPORTED_FORMAT, out);
+      return "invalid";
     }
 
    ClientMessage message;
    if (!message.ParseFromString(data)) {
-     SendError(ServerError::INVALID_MESSAGE);
-     return;
+     SetError(ServerError::INVALID_MESSAGE, out);
+     return "invalid";
    }
 
    LOG(INFO) << "Command is " << message.command() << ", data length "
@@ -366,8 +912,8 @@ class CTServer : public Server {
        (message.command() != ClientMessage::LOOKUP_AUDIT_PROOF
         || message.lookup().type() !=
         ClientLookup::MERKLE_AUDIT_PROOF_BY_LEAF_HASH)) {
-         SendError(ServerError::UNSUPPORTED_COMMAND);
-         return;
+         SetError(ServerError::UNSUPPORTED_COMMAND, out);
+         return "unsupported";
        }
 
    if (message.command() == ClientMessage::SUBMIT_BUNDLE ||
@@ -377,17 +923,19 @@ class CTServer : public Server {
      CTLogManager::LogReply reply;
      if (message.command() == ClientMessage::SUBMIT_BUNDLE)
        reply = manager_->SubmitEntry(ct::X509_ENTRY,
-                                     message.submission_data(), &sct, &error);
+                                     message.submission_data(), &sct, &error,
+                                     group_commit_);
      else
        reply = manager_->SubmitEntry(ct::PRECERT_ENTRY,
-                                     message.submission_data(), &sct,  &error);
+                                     message.submission_data(), &sct, &error,
+                                     group_commit_);
 
      switch (reply) {
        case CTLogManager::REJECT:
-         SendError(ServerError::REJECTED, error);
+         SetError(ServerError::REJECTED, error, out);
          break;
        case CTLogManager::SIGNED_CERTIFICATE_TIMESTAMP:
-         SendSCTToken(sct);
+         SetSCTToken(sct, out);
          break;
        default:
          DLOG(FATAL) << "Unknown CTLogManager reply: " << reply;
@@ -400,80 +948,483 @@ class CTServer : public Server {
          manager_->QueryAuditProof(message.lookup().merkle_leaf_hash(),
                                    &proof);
      if (reply == CTLogManager::MERKLE_AUDIT_PROOF) {
-       SendMerkleProof(proof);
+       SetMerkleProof(proof, out);
      } else {
        CHECK_EQ(CTLogManager::NOT_FOUND, reply);
-       SendError(ServerError::NOT_FOUND);
+       SetError(ServerError::NOT_FOUND, out);
      }
+     return "lookup_audit_proof";
    }
+   return message.command() == ClientMessage::SUBMIT_BUNDLE ?
+       "submit_bundle" : "submit_ca_bundle";
   }
 
-  void SendError(ServerError::ErrorCode error) {
-    SendError(error, "");
+  static void SetError(ServerError::ErrorCode error, Reply *reply) {
+    SetError(error, "", reply);
   }
 
-  void SendError(ServerError::ErrorCode error, const string &error_string) {
+  static void SetError(ServerError::ErrorCode error,
+                       const string &error_string, Reply *reply) {
     ServerMessage message;
     message.set_response(ServerMessage::ERROR);
     message.mutable_error()->set_code(error);
     message.mutable_error()->set_error_message(error_string);
 
-    SendMessage(message);
+    SetMessage(message, reply);
   }
 
-  void SendSCTToken(const SignedCertificateTimestamp &sct) {
+  static void SetSCTToken(const SignedCertificateTimestamp &sct,
+                          Reply *reply) {
     CHECK_EQ(kCtVersion, sct.version());
     ServerMessage message;
     message.set_response(ServerMessage::SIGNED_CERTIFICATE_TIMESTAMP);
     message.mutable_sct()->CopyFrom(sct);
-    SendMessage(message);
+    SetMessage(message, reply);
   }
 
-  void SendMerkleProof(const MerkleAuditProof &proof) {
+  static void SetMerkleProof(const MerkleAuditProof &proof, Reply *reply) {
     CHECK_EQ(kCtVersion, proof.version());
     ServerMessage message;
     message.set_response(ServerMessage::MERKLE_AUDIT_PROOF);
     message.mutable_merkle_proof()->CopyFrom(proof);
-    SendMessage(message);
+    SetMessage(message, reply);
   }
 
-  void SendMessage(const ServerMessage &message) {
-    string serialized_message;
-    CHECK(message.SerializeToString(&serialized_message));
+  static void SetMessage(const ServerMessage &message, Reply *reply) {
+    CHECK(message.SerializeToString(&reply->message));
     // TODO(ekasper): remove the CHECK; it's temporary until we decide
     // how to split large messages.
-    CHECK_LE(serialized_message.size(), kMaxPacketLength) <<
+    CHECK_LE(reply->message.size(), kMaxPacketLength) <<
         "Attempted to send a message that exceeds maximum packet length.";
 
-    Write(Serializer::SerializeUint(kProtocolVersion, 1));
-    Write(Serializer::SerializeUint(kPacketFormat, 1));
-    Write(Serializer::SerializeUint(serialized_message.length(),
-                                    kPacketPrefixLength));
-    Write(serialized_message);
+    reply->header = Serializer::SerializeUint(kProtocolVersion, 1);
+    reply->header.append(Serializer::SerializeUint(kPacketFormat, 1));
+    reply->header.append(Serializer::SerializeUint(reply->message.length(),
+                                                   kPacketPrefixLength));
   }
 
   CTLogManager *manager_;
+  GroupCommit *group_commit_;
+};
+
+const ct::Version RequestHandler::kCtVersion;
+
+class ReplyQueue;
+
+// A request read on a connection, on its way to a worker and back.
+struct RequestJob {
+  // The connection it was read on, as its ReplyQueue knows it.
+  uint64_t connection;
+  // Its place among the requests read on the connection.
+  uint64_t sequence;
+  int version;
+  int format;
+  string data;
+  Reply reply;
+  ReplyQueue *replies;
+};
+
+class CTServer;
+
+// Hands the requests that workers have served back to their connections on
+// the loop they were read on. Workers wake the loop through a pipe.
+class ReplyQueue : public FD {
+ public:
+  ReplyQueue(EventLoop *loop, int read_fd, int write_fd)
+      : FD(loop, read_fd, NO_DELETE),
+        write_fd_(write_fd),
+        next_connection_(1) {
+    CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+  }
+
+  // Called on the loop's thread, like Unregister().
+  uint64_t Register(CTServer *server) {
+    const uint64_t connection = next_connection_++;
+    connections_[connection] = server;
+    return connection;
+  }
+
+  void Unregister(uint64_t connection) { connections_.erase(connection); }
+
+  // Called by workers; takes ownership of |job|.
+  void Done(RequestJob *job) {
+    ScopedLock lock(&mutex_);
+    const bool was_empty = done_.empty();
+    done_.push_back(job);
+    if (was_empty) {
+      const char wake = 0;
+      CHECK_EQ(1, write(write_fd_, &wake, 1));
+    }
+  }
+
+  bool WantsRead() const { return true; }
+
+  // Delivers the jobs that are done. Those whose connections have gone are
+  // dropped.
+  void ReadIsAllowed();
+
+  bool WantsWrite() const { return false; }
+
+  void WriteIsAllowed() { DLOG(FATAL) << "ReplyQueue doesn't write"; }
+
+ private:
+  const int write_fd_;
+  uint64_t next_connection_;
+  std::map<uint64_t, CTServer*> connections_;
+  pthread_mutex_t mutex_;
+  std::deque<RequestJob*> done_;
+};
+
+// Workers that serve the requests of all the loops' connections (see
+// --request_threads), so that a slow request doesn't hold up the others
+// on its loop. Submissions there are never group committed.
+class RequestPool {
+ public:
+  // Does not take ownership of |manager|. Connections keep up to
+  // |max_inflight| of their requests in the pool at a time.
+  RequestPool(CTLogManager *manager, int threads, size_t max_inflight)
+      : handler_(manager, NULL),
+        max_inflight_(max_inflight) {
+    CHECK_GT(threads, 0);
+    CHECK_GT(max_inflight, 0U);
+    CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+    CHECK_EQ(0, pthread_cond_init(&queued_, NULL));
+    // The workers are never stopped, so the pool is never deleted either.
+    for (int i = 0; i < threads; ++i) {
+      pthread_t thread;
+      CHECK_EQ(0, pthread_create(&thread, NULL, Run, this));
+    }
+  }
+
+  size_t MaxInflight() const { return max_inflight_; }
+
+  // Takes ownership of |job|, and hands it to its ReplyQueue once it is
+  // served.
+  void Dispatch(RequestJob *job) {
+    ScopedLock lock(&mutex_);
+    jobs_.push_back(job);
+    CHECK_EQ(0, pthread_cond_signal(&queued_));
+  }
+
+ private:
+  static void *Run(void *arg) {
+    static_cast<RequestPool*>(arg)->Work();
+    return NULL;
+  }
+
+  void Work() {
+    for ( ; ; ) {
+      RequestJob *job;
+      {
+        ScopedLock lock(&mutex_);
+        while (jobs_.empty())
+          CHECK_EQ(0, pthread_cond_wait(&queued_, &mutex_));
+        job = jobs_.front();
+        jobs_.pop_front();
+      }
+      handler_.Handle(job->version, job->format, job->data, &job->reply);
+      job->data.clear();
+      job->replies->Done(job);
+    }
+  }
+
+  const RequestHandler handler_;
+  const size_t max_inflight_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t queued_;
+  std::deque<RequestJob*> jobs_;
+};
+
+class CTServer : public Server {
+ public:
+  // Does not grab ownership of the manager, or of |group_commit|, |pool|
+  // or |replies|, which may be NULL. With a pool, requests are served
+  // there, up to its MaxInflight() at a time, and their replies come back
+  // through |replies|, which must be on |loop|; they are sent in the order
+  // the requests were read in, so that clients can pipeline. Otherwise
+  // requests are served as they are read.
+  CTServer(EventLoop *loop, int fd, CTLogManager *manager,
+           GroupCommit *group_commit, RequestPool *pool, ReplyQueue *replies)
+      : Server(loop, fd),
+        handler_(manager, group_commit),
+        pool_(pool),
+        replies_(replies),
+        connection_(pool == NULL ? 0 : replies->Register(this)),
+        next_sequence_(0) {
+    CHECK((pool_ == NULL) == (replies_ == NULL));
+  }
+
+  ~CTServer() {
+    if (pool_ == NULL)
+      return;
+    replies_->Unregister(connection_);
+    // Jobs still in the pool are dropped by the ReplyQueue.
+    for (std::deque<RequestJob*>::iterator it = pending_.begin();
+         it != pending_.end(); ++it)
+      delete *it;
+  }
+
+  // Stop reading while the pool has as many requests of ours as it takes.
+  bool WantsRead() const {
+    return pool_ == NULL || pending_.size() < pool_->MaxInflight();
+  }
+
+  // |job| is served; takes ownership of it. Sends the replies that are
+  // ready in order.
+  void Replied(RequestJob *job) {
+    const bool was_full = !WantsRead();
+    DCHECK_GE(job->sequence, next_sequence_ - pending_.size());
+    const size_t index = job->sequence - (next_sequence_ - pending_.size());
+    DCHECK_LT(index, pending_.size());
+    DCHECK(pending_[index] == NULL);
+    pending_[index] = job;
+    while (!pending_.empty() && pending_.front() != NULL) {
+      Send(&pending_.front()->reply);
+      delete pending_.front();
+      pending_.pop_front();
+    }
+    if (was_full && WantsRead()) {
+      loop()->Changed(this);
+      // Requests may be waiting in the buffer already.
+      RereadBuffer();
+    }
+  }
+
+ private:
+  // Frames packets in place in |rbuffer|, copying out only their bodies.
+  void BytesRead(ReadBuffer *rbuffer) {
+    while (WantsRead()) {
+      if (rbuffer->size() < 5)
+        return;
+      const char *header = rbuffer->data();
+      size_t length = kMaxPacketLength + 1;
+      // Just DCHECK: we explicitly feed it the right-size input,
+      // so nothing should really go wrong here.
+      Deserializer::DeserializeResult res =
+          Deserializer::DeserializeUint(string(header + 2, 3), 3, &length);
+      DCHECK_EQ(Deserializer::OK, res);
+      // Can only really happen if max packet length is not aligned with
+      // byte boundaries.
+      if (length > kMaxPacketLength) {
+        Close();
+        return;
+      }
+      if (rbuffer->size() < length + 5)
+        return;
+      const int version = static_cast<unsigned char>(header[0]);
+      const int format = static_cast<unsigned char>(header[1]);
+      PacketRead(version, format, string(header + 5, length));
+      rbuffer->Consume(length + 5);
+    }
+  }
+
+  void PacketRead(int version, int format, const string &data) {
+    if (pool_ == NULL) {
+      Reply reply;
+      handler_.Handle(version, format, data, &reply);
+      Send(&reply);
+      return;
+    }
+    RequestJob *job = new RequestJob;
+    job->connection = connection_;
+    job->sequence = next_sequence_++;
+    job->version = version;
+    job->format = format;
+    job->data = data;
+    job->replies = replies_;
+    pending_.push_back(NULL);
+    pool_->Dispatch(job);
+  }
+
+  void Send(Reply *reply) {
+    // Hand both over; they go out together in one writev().
+    Write(&reply->header);
+    Write(&reply->message);
+  }
+
+  const RequestHandler handler_;
+  RequestPool *const pool_;
+  ReplyQueue *const replies_;
+  const uint64_t connection_;
+  // The sequence number of the next request read.
+  uint64_t next_sequence_;
+  // The requests in the pool and the replies still to send, in the order
+  // the requests were read in; NULL until a request is served.
+  std::deque<RequestJob*> pending_;
 };
 
-const ct::Version CTServer::kCtVersion;
+void ReplyQueue::ReadIsAllowed() {
+  char buf[64];
+  if (read(fd(), buf, sizeof buf) <= 0) {
+    PLOG(ERROR) << "Reading the reply queue's pipe";
+    return;
+  }
+  std::deque<RequestJob*> done;
+  {
+    ScopedLock lock(&mutex_);
+    done.swap(done_);
+  }
+  for (std::deque<RequestJob*>::iterator it = done.begin(); it != done.end();
+       ++it) {
+    std::map<uint64_t, CTServer*>::iterator connection =
+        connections_.find((*it)->connection);
+    if (connection == connections_.end() || connection->second->WantsErase())
+      delete *it;
+    else
+      connection->second->Replied(*it);
+  }
+}
 
 class CTServerListener : public Listener {
  public:
-  CTServerListener(EventLoop *loop, int fd,
-                   CTLogManager *manager) : Listener(loop, fd),
-                                            manager_(manager) {}
+  CTServerListener(EventLoop *loop, int fd, CTLogManager *manager,
+                   GroupCommit *group_commit, RequestPool *pool,
+                   ReplyQueue *replies)
+      : Listener(loop, fd),
+        manager_(manager),
+        group_commit_(group_commit),
+        pool_(pool),
+        replies_(replies) {}
 
   void Accepted(int fd) {
     LOG(INFO) << "Accepted fd " << fd << std::endl;
-    new CTServer(loop(), fd, manager_);
+    new CTServer(loop(), fd, manager_, group_commit_, pool_, replies_);
   }
  private:
   CTLogManager *manager_;
+  GroupCommit *group_commit_;
+  RequestPool *pool_;
+  ReplyQueue *replies_;
 };
 
+// A group commit on |loop|, if --group_commit_max_entries asks for one and
+// |db| can do it; otherwise NULL.
+static GroupCommit *NewGroupCommit(EventLoop *loop,
+                                   Database<LoggedCertificate> *db) {
+  if (FLAGS_group_commit_max_entries == 0 || !db->Transactional())
+    return NULL;
+  GroupCommit *group_commit =
+      new GroupCommit(db, FLAGS_group_commit_max_entries);
+  loop->Add(group_commit);
+  return group_commit;
+}
+
+// A pool of --request_threads workers, if it asks for any; otherwise NULL.
+// Group commits begin and end their transactions on their loop, so they
+// keep requests there.
+static RequestPool *NewRequestPool(CTLogManager *manager,
+                                   const Database<LoggedCertificate> *db) {
+  if (FLAGS_request_threads == 0)
+    return NULL;
+  if (FLAGS_group_commit_max_entries > 0 && db->Transactional()) {
+    LOG(WARNING) << "Ignoring --request_threads: requests are served on the "
+                 << "event loops with --group_commit_max_entries";
+    return NULL;
+  }
+  return new RequestPool(manager, FLAGS_request_threads,
+                         FLAGS_max_inflight_requests);
+}
+
+// The queue for the replies that |pool| serves to connections on |loop|,
+// or NULL if there is no pool.
+static ReplyQueue *NewReplyQueue(EventLoop *loop, const RequestPool *pool) {
+  if (pool == NULL)
+    return NULL;
+  int fds[2];
+  PCHECK(pipe(fds) == 0);
+  return new ReplyQueue(loop, fds[0], fds[1]);
+}
+
+// Serves the connections that the kernel hands to its listening socket on
+// a thread and event loop of its own (see --event_loops). Everything else
+// runs in the main loop.
+class ServingThread {
+ public:
+  // Does not take ownership of |manager|, |db| or |pool|, which may be
+  // NULL.
+  ServingThread(int fd, CTLogManager *manager,
+                Database<LoggedCertificate> *db, RequestPool *pool)
+      : group_commit_(NewGroupCommit(&loop_, db)),
+        replies_(NewReplyQueue(&loop_, pool)),
+        listener_(&loop_, fd, manager, group_commit_, pool, replies_) {
+    CHECK_EQ(0, pthread_create(&thread_, NULL, Run, this));
+  }
+
+ private:
+  static void *Run(void *arg) {
+    static_cast<ServingThread*>(arg)->loop_.Forever();
+    return NULL;
+  }
+
+  EventLoop loop_;
+  GroupCommit *group_commit_;
+  ReplyQueue *replies_;
+  CTServerListener listener_;
+  pthread_t thread_;
+};
+
+// Collects serialized entries from a range lookup.
+class SampleCollector : public Database<LoggedCertificate>::EntryCallback {
+ public:
+  explicit SampleCollector(std::vector<string> *samples) : samples_(samples) {}
+
+  virtual bool Entry(const LoggedCertificate &logged) {
+    samples_->push_back(string());
+    CHECK(logged.SerializeForDatabase(&samples_->back()));
+    return true;
+  }
+
+ private:
+  std::vector<string> *samples_;
+};
+
+// Train a compression dictionary on the latest logged entries and save it
+// to |file|. Returns NULL if there are too few entries to train on.
+static EntryCompressor *TrainCompressor(const Database<LoggedCertificate> *db,
+                                        const string &file) {
+  static const uint64_t kMinSamples = 100;
+  static const uint64_t kMaxSamples = 1000;
+  ct::SignedTreeHead sth;
+  if (db->LatestTreeHead(&sth) != Database<LoggedCertificate>::LOOKUP_OK ||
+      sth.tree_size() < kMinSamples) {
+    LOG(WARNING) << "Too few logged entries to train a compression "
+                 << "dictionary on; storing entries uncompressed";
+    return NULL;
+  }
+  std::vector<string> samples;
+  SampleCollector collector(&samples);
+  CHECK_EQ(Database<LoggedCertificate>::LOOKUP_OK,
+           db->LookupByIndexRange(
+               sth.tree_size() - std::min(sth.tree_size(), kMaxSamples),
+               sth.tree_size(), &collector));
+  const string dictionary = EntryCompressor::TrainDictionary(
+      samples, EntryCompressor::kMaxDictionarySize);
+
+  string tmp_file = util::WriteTemporaryBinaryFile(file + ".XXXXXX",
+                                                   dictionary);
+  CHECK(!tmp_file.empty()) << "Failed to write compression dictionary";
+  PCHECK(rename(tmp_file.c_str(), file.c_str()) == 0)
+      << "Failed to rename " << tmp_file << " to " << file;
+  LOG(INFO) << "Trained a " << dictionary.size() << "-byte compression "
+            << "dictionary on " << samples.size() << " entries";
+  return new EntryCompressor(dictionary);
+}
+
+// How often the phases of startup log their progress.
+static const uint32_t kStartupProgressSeconds = 10;
+
 int main(int argc, char **argv) {
   google::ParseCommandLineFlags(&argc, &argv, true);
   google::InitGoogleLogging(argv[0]);
+  util::ThreadPool::ConfigureDefault(
+      FLAGS_compute_threads > 0 ? FLAGS_compute_threads :
+                               util::ThreadPool::DefaultThreads(),
+      FLAGS_pin_compute_threads);
+  if (!FLAGS_profile_dir.empty())
+    util::ProfileOnSignal(SIGUSR2, FLAGS_profile_dir, "ct-server",
+                          FLAGS_profile_seconds);
+  util::StartupProfiler startup(kStartupProgressSeconds);
+  util::StartupProfiler::SetGlobal(&startup);
   OpenSSL_add_all_algorithms();
   ERR_load_crypto_strings();
   ct::LoadCtExtensions();
@@ -481,49 +1432,172 @@ int main(int argc, char **argv) {
   EVP_PKEY *pkey = NULL;
   CHECK_EQ(Services::ReadPrivateKey(&pkey, FLAGS_key), Services::KEY_OK);
 
-  int fd;
-  CHECK(Services::InitServer(&fd, FLAGS_port, NULL, SOCK_STREAM));
+  const int loops = FLAGS_event_loops > 0 ? FLAGS_event_loops
+      : Services::NumCores();
+  std::vector<int> fds(loops);
+  for (int i = 0; i < loops; ++i)
+    CHECK(Services::InitServer(&fds[i], FLAGS_port, NULL, SOCK_STREAM,
+                               loops > 1));
 
   EventLoop loop;
 
   CertChecker checker;
-  CHECK(checker.LoadTrustedCertificates(FLAGS_trusted_cert_file))
-      << "Could not load CA certs from " << FLAGS_trusted_cert_file;
+  {
+    util::StartupProfiler::Phase phase("loading trust store");
+    CHECK(checker.LoadTrustedCertificates(FLAGS_trusted_cert_file))
+        << "Could not load CA certs from " << FLAGS_trusted_cert_file;
+  }
 
-  if (FLAGS_sqlite_db == "")
-    CHECK_NE(FLAGS_cert_dir, FLAGS_tree_dir)
-        << "Certificate directory and tree directory must differ";
+  const bool file_db = FLAGS_cert_dir != "" || FLAGS_tree_dir != "";
+  if ((file_db ? 1 : 0) + (FLAGS_sqlite_db != "" ? 1 : 0) +
+      (FLAGS_leveldb_db != "" ? 1 : 0) +
+      (FLAGS_sharded_db != "" ? 1 : 0) > 1) {
+    std::cerr << "Choose one of file, sqlite, leveldb or sharded database"
+              << std::endl;
+    exit(1);
+  }
 
-  if ((FLAGS_cert_dir != "" || FLAGS_tree_dir != "") && FLAGS_sqlite_db != "") {
-    std::cerr << "Choose either file or sqlite database, not both" << std::endl;
+  if (FLAGS_archive_dir != "" &&
+      (FLAGS_leveldb_db != "" || FLAGS_sharded_db != "")) {
+    std::cerr << "--archive_dir needs a file or sqlite database" << std::endl;
     exit(1);
   }
 
+  if (FLAGS_sqlite_db == "" && FLAGS_leveldb_db == "" &&
+      FLAGS_sharded_db == "")
+    CHECK_NE(FLAGS_cert_dir, FLAGS_tree_dir)
+        << "Certificate directory and tree directory must differ";
+
+  // FileDB reads entries as it opens, so it needs the dictionary first.
+  EntryCompressor *compressor = NULL;
+  string dictionary;
+  if (FLAGS_entry_compression_dictionary != "" &&
+      util::ReadBinaryFile(FLAGS_entry_compression_dictionary, &dictionary))
+    compressor = new EntryCompressor(dictionary);
+
   Database<LoggedCertificate> *db;
 
-  if (FLAGS_sqlite_db != "")
+  if (FLAGS_sqlite_db != "") {
       db = new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
-  else
+  } else if (FLAGS_leveldb_db != "") {
+      db = new LevelDB<LoggedCertificate>(FLAGS_leveldb_db);
+  } else if (FLAGS_sharded_db != "") {
+      db = new ShardedDB<LoggedCertificate>(FLAGS_sharded_db,
+                                            FLAGS_sharded_db_shard_size);
+  } else {
+      EntryStorage *cert_storage;
+      if (FLAGS_cert_segment_size_mb > 0)
+        cert_storage = new SegmentStorage(
+            FLAGS_cert_dir,
+            static_cast<size_t>(FLAGS_cert_segment_size_mb) << 20);
+      else
+        cert_storage = new FileStorage(FLAGS_cert_dir,
+                                       FLAGS_cert_storage_depth);
       db = new FileDB<LoggedCertificate>(
-               new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth),
-               new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth));
+               cert_storage,
+               new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
+               FLAGS_cert_index_file, compressor);
+  }
+
+  if (FLAGS_entry_compression_dictionary != "") {
+    if (compressor == NULL)
+      compressor = TrainCompressor(db, FLAGS_entry_compression_dictionary);
+    db->SetCompressor(compressor);
+  }
+
+  // Right above the storage, so that everything else reads archived
+  // entries through it like any others.
+  ArchivingDatabase<LoggedCertificate> *archive = NULL;
+  if (FLAGS_archive_dir != "") {
+    util::StartupProfiler::Phase phase("opening archive");
+    archive = new ArchivingDatabase<LoggedCertificate>(db, FLAGS_archive_dir,
+                                                       compressor);
+    db = archive;
+  }
+
+  if (FLAGS_intermediate_dir != "")
+    db = new InterningDatabase(
+        db, new FileStorage(FLAGS_intermediate_dir,
+                            FLAGS_intermediate_storage_depth),
+        FLAGS_intermediate_cache_size);
+
+  // Below the cache and the lock, so that it times the storage alone.
+  util::Metrics metrics;
+  InstrumentedDatabase<LoggedCertificate> *storage = NULL;
+  if (FLAGS_storage_stats) {
+    storage = new InstrumentedDatabase<LoggedCertificate>(db, &metrics);
+    db = storage;
+  }
+
+  CachingDatabase<LoggedCertificate> *cache = NULL;
+  if (FLAGS_entry_cache_size > 0) {
+    cache = new CachingDatabase<LoggedCertificate>(db, FLAGS_entry_cache_size);
+    db = cache;
+  }
+
+  // Signing runs in a thread of its own.
+  util::Tracer tracer(FLAGS_trace_sample_every, FLAGS_trace_max_spans);
+  if (FLAGS_trace_sample_every > 0)
+    util::Tracer::SetGlobal(&tracer);
+  LockingDatabase<LoggedCertificate> *locking_db =
+      new LockingDatabase<LoggedCertificate>(db, &metrics);
+  db = locking_db;
 
   // Hmm, there is no EVP_PKEY_dup, so let's read the key again...
   EVP_PKEY *pkey2 = NULL;
   CHECK_EQ(Services::ReadPrivateKey(&pkey2, FLAGS_key), Services::KEY_OK);
 
+  if (FLAGS_group_commit_max_entries > 0 && !db->Transactional())
+    LOG(WARNING) << "Group commit needs --sqlite_db or --sharded_db; "
+                 << "ignoring --group_commit_max_entries";
+
+  // New entries go straight from the frontend to the tree signer, which
+  // only reads the pending ones from the database on startup.
+  SequencingQueue sequencing_queue;
+  FrontendSigner *frontend_signer = new FrontendSigner(db, new LogSigner(pkey));
+  frontend_signer->SetSequencingQueue(&sequencing_queue);
+  TreeSigner<LoggedCertificate> *tree_signer =
+      new TreeSigner<LoggedCertificate>(db, new LogSigner(pkey2),
+                                        FLAGS_tree_checkpoint_file);
+  tree_signer->SetSequencingQueue(&sequencing_queue);
+  LogLookup<LoggedCertificate> *lookup =
+      new LogLookup<LoggedCertificate>(db, FLAGS_leaf_hash_file);
+  if (!FLAGS_subtree_root_file.empty())
+    lookup->WriteSubtreeRoots(FLAGS_subtree_root_file);
   CTLogManager manager(
-      new Frontend(new CertSubmissionHandler(&checker),
-                   new FrontendSigner(db, new LogSigner(pkey))),
-      new TreeSigner<LoggedCertificate>(db, new LogSigner(pkey2)),
-      new LogLookup<LoggedCertificate>(db));
+      new Frontend(new CertSubmissionHandler(&checker), frontend_signer),
+      tree_signer, lookup, db->PendingHashes().size(), &metrics);
+  RequestHandler::DefineMetrics(&metrics);
 
   Services::SetRoughTime();
   TreeSigningEvent tree_event(FLAGS_tree_signing_frequency_seconds, &manager);
-  FrontendLogEvent frontend_event(FLAGS_log_stats_frequency_seconds, &manager);
+  FrontendLogEvent frontend_event(FLAGS_log_stats_frequency_seconds, &manager,
+                                  locking_db, cache, storage);
   loop.Add(&frontend_event);
   loop.Add(&tree_event);
-  CTServerListener l(&loop, fd, &manager);
-  LOG(INFO) << "Server listening on port " << FLAGS_port;
+  ArchiveEvent archive_event(FLAGS_tree_signing_frequency_seconds, locking_db,
+                             archive, FLAGS_archive_segment_entries,
+                             static_cast<uint64_t>(FLAGS_archive_age_days) *
+                             24 * 60 * 60 * 1000);
+  if (archive != NULL)
+    loop.Add(&archive_event);
+  MetricsEvent metrics_event(FLAGS_metrics_frequency_seconds,
+                             FLAGS_metrics_file, &manager, locking_db, cache,
+                             storage);
+  if (FLAGS_metrics_file != "")
+    loop.Add(&metrics_event);
+  TraceEvent trace_event(FLAGS_metrics_frequency_seconds, FLAGS_trace_file,
+                         &tracer);
+  if (FLAGS_trace_file != "")
+    loop.Add(&trace_event);
+  RequestPool *pool = NewRequestPool(&manager, db);
+  CTServerListener l(&loop, fds[0], &manager, NewGroupCommit(&loop, db),
+                     pool, NewReplyQueue(&loop, pool));
+  // The other loops are never stopped, so they are never deleted either.
+  for (int i = 1; i < loops; ++i)
+    new ServingThread(fds[i], &manager, db, pool);
+  LOG(INFO) << startup.Report();
+  LOG(INFO) << "Server listening on port " << FLAGS_port << " with "
+            << loops << " event loop(s)";
   loop.Forever();
 }
@@ -0,0 +1,129 @@
+/* -*- indent-tabs-mode: nil -*- */
+
+// Exports a log's database as static tiles for a web server or CDN to
+// serve; see log/tile_exporter.h for the layout.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "log/entry_compressor.h"
+#include "log/file_storage.h"
+#include "log/interning_db.h"
+#include "log/leveldb_db.h"
+#include "log/logged_certificate.h"
+#include "log/sharded_db.h"
+#include "log/sqlite_db.h"
+#include "log/tile_exporter.h"
+#include "util/util.h"
+
+using ct::LoggedCertificate;
+using google::RegisterFlagValidator;
+using std::string;
+
+DEFINE_string(sqlite_db, "", "SQLite database of the log");
+DEFINE_string(leveldb_db, "", "LevelDB database of the log");
+DEFINE_string(sharded_db, "", "Sharded database of the log");
+DEFINE_int32(sharded_db_shard_size, 1 << 20,
+             "Number of sequenced entries per shard of the sharded "
+             "database. Must match that of the log.");
+DEFINE_string(entry_compression_dictionary, "",
+              "Dictionary that the log compresses entries with, if any.");
+DEFINE_string(intermediate_dir, "",
+              "Directory of the log's interned chain certificates, if any.");
+DEFINE_int32(intermediate_storage_depth, 0,
+             "Subdirectory depth of the interned certificates.");
+DEFINE_int32(intermediate_cache_size, 10000,
+             "Number of interned certificates to keep in memory.");
+DEFINE_string(tile_dir, "", "Directory to write the tiles to");
+DEFINE_int32(frequency_seconds, 0,
+             "Keep exporting new tree heads, this often. 0 exports the "
+             "latest tree head and exits.");
+
+static bool ValidateIsNonNegative(const char *flagname, int value) {
+  if (value < 0) {
+    std::cout << flagname << " must not be negative" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool freq_dummy = RegisterFlagValidator(
+    &FLAGS_frequency_seconds, &ValidateIsNonNegative);
+
+static bool ValidateIsPositive(const char *flagname, int value) {
+  if (value <= 0) {
+    std::cout << flagname << " must be greater than 0" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool shard_dummy = RegisterFlagValidator(
+    &FLAGS_sharded_db_shard_size, &ValidateIsPositive);
+
+static bool NonEmptyString(const char *flagname, const string &str) {
+  if (str.empty()) {
+    std::cout << flagname << " must be set" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool dir_dummy = RegisterFlagValidator(&FLAGS_tile_dir,
+                                                    &NonEmptyString);
+
+// Entries exported between progress reports.
+static const size_t kStep = 1 << 20;
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  if ((FLAGS_sqlite_db != "" ? 1 : 0) + (FLAGS_leveldb_db != "" ? 1 : 0) +
+      (FLAGS_sharded_db != "" ? 1 : 0) != 1) {
+    std::cerr << "Choose one of sqlite, leveldb or sharded database"
+              << std::endl;
+    exit(1);
+  }
+
+  Database<LoggedCertificate> *db;
+  if (FLAGS_sqlite_db != "")
+    db = new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
+  else if (FLAGS_leveldb_db != "")
+    db = new LevelDB<LoggedCertificate>(FLAGS_leveldb_db);
+  else
+    db = new ShardedDB<LoggedCertificate>(FLAGS_sharded_db,
+                                          FLAGS_sharded_db_shard_size);
+
+  if (FLAGS_entry_compression_dictionary != "") {
+    string dictionary;
+    CHECK(util::ReadBinaryFile(FLAGS_entry_compression_dictionary,
+                               &dictionary))
+        << "Failed to read " << FLAGS_entry_compression_dictionary;
+    db->SetCompressor(new EntryCompressor(dictionary));
+  }
+
+  if (FLAGS_intermediate_dir != "")
+    db = new InterningDatabase(
+        db, new FileStorage(FLAGS_intermediate_dir,
+                            FLAGS_intermediate_storage_depth),
+        FLAGS_intermediate_cache_size);
+
+  TileExporter<LoggedCertificate> exporter(db, FLAGS_tile_dir);
+  for (;;) {
+    while (!exporter.Export(kStep))
+      LOG(INFO) << "Exported " << exporter.Size() << " entries";
+    LOG(INFO) << "Exported tree head of " << exporter.CheckpointSize()
+              << " entries";
+    if (FLAGS_frequency_seconds == 0)
+      break;
+    sleep(FLAGS_frequency_seconds);
+  }
+
+  delete db;
+  return 0;
+}
@@ -1,18 +1,54 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "event.h"
 
+#include <algorithm>
+#include <errno.h>
 #include <limits.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
-
-time_t Services::rough_time_;
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "util/util.h"
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__)
+#include <sys/event.h>
+#include <sys/time.h>
+#define USE_KQUEUE
+#else
+#error "EventLoop needs epoll or kqueue"
+#endif
+
+__thread time_t Services::rough_time_;
+const uint64_t EventLoop::kSoonMs;
+const size_t ReadBuffer::kBlockSize;
+const size_t ReadBuffer::kPoolBlocks;
+__thread char *ReadBuffer::pool_[ReadBuffer::kPoolBlocks];
+__thread size_t ReadBuffer::pooled_;
+const size_t Server::kReadSize;
 
 FD::FD(EventLoop *loop, int fd, CanDelete deletable)
-    : fd_(fd), loop_(loop), wants_erase_(false), deletable_(deletable) {
+    : fd_(fd),
+      loop_(loop),
+      wants_erase_(false),
+      deletable_(deletable),
+      last_activity_(Services::RoughTime()) {
   DCHECK_GE(fd, 0);
-  CHECK_LT((unsigned)fd, FD_SETSIZE);
   loop->Add(this);
-  Activity();
+}
+
+void FD::Activity() {
+  const time_t now = Services::RoughTime();
+  // FDs active within the same second are in order either way.
+  if (now == last_activity_)
+    return;
+  last_activity_ = now;
+  if (CanDrop() && !WantsErase())
+    loop_->Touched(this);
 }
 
 void FD::Close() {
@@ -23,14 +59,28 @@ void FD::Close() {
   }
   LOG(INFO) << "Closing fd " << fd() << std::endl;
   wants_erase_ = true;
+  loop_->Closing(this);
   shutdown(fd(), SHUT_RDWR);
   close(fd());
 }
 
 bool FD::WillAccept(int fd) {
-  if (fd >= kFDLimit - kFDLimitWindow)
+  const int limit = FDLimit() - kFDReserve;
+  if (fd >= limit - kFDLimitWindow)
     loop()->MaybeDropOne();
-  return fd < kFDLimit;
+  return fd < limit;
+}
+
+// static
+int FD::FDLimit() {
+  static int limit = 0;
+  if (limit == 0) {
+    struct rlimit rl;
+    PCHECK(getrlimit(RLIMIT_NOFILE, &rl) == 0);
+    limit = rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > INT_MAX ?
+        INT_MAX : static_cast<int>(rl.rlim_cur);
+  }
+  return limit;
 }
 
 void Listener::ReadIsAllowed() {
@@ -54,95 +104,112 @@ void Listener::WriteIsAllowed() {
   DLOG(FATAL) << "WriteIsAllowed() called on a read-only Listener.";
 }
 
-time_t EventLoop::ProcessRepeatedEvents() {
-  if (events_.empty())
+void EventLoop::Add(FD *fd) {
+  fds_[fd] = NONE;
+  if (fd->CanDrop())
+    fd->activity_position_ = by_activity_.insert(by_activity_.end(), fd);
+  Changed(fd);
+}
+
+void EventLoop::Add(RepeatedEvent *event) {
+  Schedule(util::TimeInMilliseconds() + event->FrequencyMs(), event, NULL);
+}
+
+void EventLoop::Add(OneShotEvent *event, uint64_t delay_ms) {
+  Schedule(util::TimeInMilliseconds() + delay_ms, NULL, event);
+}
+
+void EventLoop::Schedule(uint64_t when_ms, RepeatedEvent *repeated,
+                         OneShotEvent *once) {
+  Timer timer;
+  timer.when_ms = when_ms;
+  timer.sequence = timer_sequence_++;
+  timer.repeated = repeated;
+  timer.once = once;
+  timers_.push(timer);
+}
+
+int EventLoop::ProcessTimers() {
+  if (timers_.empty())
     return INT_MAX;
   Services::SetRoughTime();
-  time_t now = Services::RoughTime();
-  time_t earliest = INT_MAX;
-  for (std::vector<RepeatedEvent *>::iterator it = events_.begin();
-       it != events_.end(); ++it) {
-    RepeatedEvent *event = *it;
-    time_t trigger = event->Trigger();
-    if (trigger <= now) {
-      event->Execute();
-      LOG(INFO) << "Executed " << event->Description() << " with a delay of "
-                << difftime(now, trigger) << " seconds";
-      event->Activity();
-      trigger = event->Trigger();
-      CHECK_GT(trigger, now);
+  const uint64_t now = util::TimeInMilliseconds();
+  // Events are rescheduled from |now|, so each runs at most once here.
+  while (!timers_.empty() && timers_.top().when_ms <= now) {
+    const Timer timer = timers_.top();
+    timers_.pop();
+    if (timer.once != NULL) {
+      timer.once->Execute();
+      continue;
     }
-    earliest = std::min(earliest, trigger);
+    RepeatedEvent *event = timer.repeated;
+    event->Execute();
+    VLOG(1) << "Executed " << event->Description() << " with a delay of "
+            << now - timer.when_ms << " ms";
+    Schedule(now + (event->RepeatSoon() ?
+                    std::min(kSoonMs, event->FrequencyMs()) :
+                    event->FrequencyMs()),
+             event, NULL);
   }
-  CHECK_GT(earliest, 0);
-  return earliest - now;
+  if (timers_.empty())
+    return INT_MAX;
+  CHECK_GT(timers_.top().when_ms, now);
+  return static_cast<int>(std::min<uint64_t>(timers_.top().when_ms - now,
+                                             INT_MAX));
 }
 
-void EventLoop::OneLoop() {
-  time_t select_timeout = ProcessRepeatedEvents();
-  // Do not schedule any repeated events between now and the next
-  // select - they will get ignored until select returns.
-  CHECK_GT(select_timeout, 0);
-
-  fd_set readers, writers;
-  int max = -1;
-
-  memset(&readers, '\0', sizeof readers);
-  memset(&writers, '\0', sizeof writers);
-  for (std::deque<FD *>::const_iterator pfd = fds_.begin(); pfd != fds_.end();
-       ++pfd) {
-    FD *fd = *pfd;
-
-    DCHECK(!fd->WantsErase());
-    if (fd->WantsWrite())
-      Set(fd->fd(), &writers, &max);
-    if (fd->WantsRead())
-      Set(fd->fd(), &readers, &max);
-  }
-
-  CHECK_GE(max, 0);
+EventLoop::EventLoop() : timer_sequence_(0), go_(true) {
+#ifdef USE_KQUEUE
+  poll_fd_ = kqueue();
+#else
+  poll_fd_ = epoll_create(kMaxEvents);
+#endif
+  PCHECK(poll_fd_ >= 0) << "Failed to create poller";
+}
 
-  struct timeval tv;
-  tv.tv_sec = select_timeout;
-  tv.tv_usec = 0;
+EventLoop::~EventLoop() {
+  close(poll_fd_);
+}
 
-  int r = select(max+1, &readers, &writers, NULL, &tv);
-  if (r == 0)
+void EventLoop::OneLoop() {
+  const int wait_timeout = ProcessTimers();
+  // Events added between now and the next wait are only looked at after
+  // it returns.
+  CHECK_GT(wait_timeout, 0);
+
+  UpdateInterest();
+  std::vector<Ready> ready;
+  Wait(wait_timeout, &ready);
+  if (ready.empty())
     return;
 
-  CHECK_GT(r, 0);
-
   Services::SetRoughTime();
-  int n = 0;
-  for (std::deque<FD *>::iterator pfd = fds_.begin(); pfd != fds_.end(); ) {
-    FD *fd = *pfd;
-
-    if (EraseCheck(&pfd))
-      continue;
+  for (std::vector<Ready>::const_iterator it = ready.begin();
+       it != ready.end(); ++it) {
+    FD *fd = it->fd;
 
-    if (FD_ISSET(fd->fd(), &writers)) {
+    if (it->write && !fd->WantsErase()) {
       DCHECK(fd->WantsWrite());
       fd->WriteIsAllowed();
       fd->Activity();
-      ++n;
     }
 
-    if (EraseCheck(&pfd))
-      continue;
-
-    if (FD_ISSET(fd->fd(), &readers)) {
-      DCHECK(fd->WantsRead());
+    // FDs handled before it in this round may have changed whether it
+    // wants to read, e.g. by handing it replies to send first.
+    if (it->read && !fd->WantsErase() && fd->WantsRead()) {
       fd->ReadIsAllowed();
       fd->Activity();
-      ++n;
     }
 
-    if (EraseCheck(&pfd))
-      continue;
-
-    ++pfd;
+    Changed(fd);
   }
-  CHECK_LE(n, r);
+
+  // An FD is only offered writing if it wanted to write before the wait,
+  // so nothing queued above has gone out yet.
+  for (std::vector<EndOfRoundEvent *>::iterator it =
+           end_of_round_events_.begin();
+       it != end_of_round_events_.end(); ++it)
+    (*it)->Execute();
 }
 
 void EventLoop::Stop() {
@@ -155,94 +222,311 @@ void EventLoop::Forever() {
 }
 
 void EventLoop::MaybeDropOne() {
-  std::deque<FD *>::iterator drop = fds_.end();
-  time_t oldest = Services::RoughTime() - kIdleTime;
+  if (by_activity_.empty())
+    return;
+  FD *oldest = by_activity_.front();
+  if (oldest->LastActivity() < Services::RoughTime() - kIdleTime)
+    oldest->Close();
+}
 
-  for (std::deque<FD *>::iterator pfd = fds_.begin(); pfd != fds_.end();
-       ++pfd) {
-    FD *fd = *pfd;
+void EventLoop::Touched(FD *fd) {
+  by_activity_.splice(by_activity_.end(), by_activity_,
+                      fd->activity_position_);
+}
+
+void EventLoop::Closing(FD *fd) {
+  std::map<FD *, int>::iterator it = fds_.find(fd);
+  CHECK(it != fds_.end());
+  if (fd->CanDrop())
+    by_activity_.erase(fd->activity_position_);
+  if (it->second != NONE)
+    Watch(fd, it->second, NONE);
+  it->second = NONE;
+  Changed(fd);
+}
 
-    if (fd->CanDrop() && fd->LastActivity() < oldest) {
-      oldest = fd->LastActivity();
-      drop = pfd;
+void EventLoop::UpdateInterest() {
+  for (std::set<FD *>::const_iterator it = changed_.begin();
+       it != changed_.end(); ++it) {
+    FD *fd = *it;
+    if (fd->WantsErase()) {
+      fds_.erase(fd);
+      always_ready_.erase(fd);
+      delete fd;
+      continue;
+    }
+    const int wanted = (fd->WantsRead() ? READ : NONE) |
+        (fd->WantsWrite() ? WRITE : NONE);
+    int &interest = fds_[fd];
+    if (wanted != interest) {
+      Watch(fd, interest, wanted);
+      interest = wanted;
     }
   }
-  if (drop != fds_.end())
-    (*drop)->Close();
+  changed_.clear();
+}
+
+#ifdef USE_KQUEUE
+
+void EventLoop::Watch(FD *fd, int interest, int wanted) {
+  struct kevent changes[2];
+  int n = 0;
+  if ((interest ^ wanted) & READ)
+    EV_SET(&changes[n++], fd->fd(), EVFILT_READ,
+           wanted & READ ? EV_ADD : EV_DELETE, 0, 0, fd);
+  if ((interest ^ wanted) & WRITE)
+    EV_SET(&changes[n++], fd->fd(), EVFILT_WRITE,
+           wanted & WRITE ? EV_ADD : EV_DELETE, 0, 0, fd);
+  PCHECK(kevent(poll_fd_, changes, n, NULL, 0, NULL) == 0)
+      << "Failed to watch fd " << fd->fd();
+}
+
+void EventLoop::Wait(int timeout_ms, std::vector<Ready> *ready) {
+  struct kevent events[kMaxEvents];
+  struct timespec ts;
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  const int n = kevent(poll_fd_, NULL, 0, events, kMaxEvents, &ts);
+  if (n < 0 && errno == EINTR)
+    return;
+  PCHECK(n >= 0) << "kevent() failed";
+  for (int i = 0; i < n; ++i) {
+    Ready r;
+    r.fd = static_cast<FD *>(events[i].udata);
+    r.read = events[i].filter == EVFILT_READ;
+    r.write = events[i].filter == EVFILT_WRITE;
+    ready->push_back(r);
+  }
+}
+
+#else
+
+void EventLoop::Watch(FD *fd, int interest, int wanted) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof event);
+  event.events = (wanted & READ ? EPOLLIN : 0) |
+      (wanted & WRITE ? EPOLLOUT : 0);
+  event.data.ptr = fd;
+  // An FD that wants nothing is taken out altogether, or errors and
+  // hangups would still wake us up for it.
+  const int op = interest == NONE ? EPOLL_CTL_ADD :
+      wanted == NONE ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+  if (epoll_ctl(poll_fd_, op, fd->fd(), &event) == 0)
+    return;
+  PCHECK(errno == EPERM) << "Failed to watch fd " << fd->fd();
+  if (wanted == NONE)
+    always_ready_.erase(fd);
+  else
+    always_ready_.insert(fd);
+}
+
+void EventLoop::Wait(int timeout_ms, std::vector<Ready> *ready) {
+  struct epoll_event events[kMaxEvents];
+  const int n = epoll_wait(poll_fd_, events, kMaxEvents,
+                           always_ready_.empty() ? timeout_ms : 0);
+  if (n < 0 && errno == EINTR)
+    return;
+  PCHECK(n >= 0) << "epoll_wait() failed";
+  // As with select(), errors and hangups are for the FD's next read or
+  // write to find.
+  const uint32_t broken = EPOLLERR | EPOLLHUP;
+  for (int i = 0; i < n; ++i) {
+    Ready r;
+    r.fd = static_cast<FD *>(events[i].data.ptr);
+    const int interest = fds_[r.fd];
+    r.read = (interest & READ) && (events[i].events & (EPOLLIN | broken));
+    r.write = (interest & WRITE) && (events[i].events & (EPOLLOUT | broken));
+    ready->push_back(r);
+  }
+  for (std::set<FD *>::const_iterator it = always_ready_.begin();
+       it != always_ready_.end(); ++it) {
+    Ready r;
+    r.fd = *it;
+    const int interest = fds_[r.fd];
+    r.read = interest & READ;
+    r.write = interest & WRITE;
+    ready->push_back(r);
+  }
+}
+
+#endif
+
+void ReadBuffer::Consume(size_t n) {
+  DCHECK_LE(n, size());
+  start_ += n;
+  if (start_ == end_)
+    Release();
 }
 
-bool EventLoop::EraseCheck(std::deque<FD *>::iterator *pfd) {
-  if ((**pfd)->WantsErase()) {
-    delete **pfd;
-    *pfd = fds_.erase(*pfd);
-    return true;
+char *ReadBuffer::Reserve(size_t n) {
+  if (capacity_ - end_ >= n)
+    return storage_ + end_;
+  const size_t used = size();
+  if (storage_ == NULL && n <= kBlockSize && pooled_ > 0) {
+    storage_ = pool_[--pooled_];
+    capacity_ = kBlockSize;
+  } else if (start_ >= used && capacity_ - used >= n) {
+    // Fewer bytes to move than were consumed since the last move.
+    memmove(storage_, storage_ + start_, used);
+  } else {
+    size_t capacity = std::max(kBlockSize, 2 * capacity_);
+    while (capacity - used < n)
+      capacity *= 2;
+    char *storage = new char[capacity];
+    if (used > 0)
+      memcpy(storage, storage_ + start_, used);
+    delete[] storage_;
+    storage_ = storage;
+    capacity_ = capacity;
   }
-  return false;
+  start_ = 0;
+  end_ = used;
+  return storage_ + end_;
 }
 
-// static
-void EventLoop::Set(int fd, fd_set *fdset, int *max) {
-  DCHECK_GE(fd, 0);
-  CHECK_LT((unsigned)fd, FD_SETSIZE);
-  FD_SET(fd, fdset);
-  if (fd > *max)
-    *max = fd;
+void ReadBuffer::Release() {
+  if (capacity_ == kBlockSize && pooled_ < kPoolBlocks)
+    pool_[pooled_++] = storage_;
+  else
+    delete[] storage_;
+  storage_ = NULL;
+  capacity_ = start_ = end_ = 0;
 }
 
 void Server::ReadIsAllowed() {
-  char buf[1024];
-
-  ssize_t n = read(fd(), buf, sizeof buf);
+  ssize_t n = read(fd(), rbuffer_.Reserve(kReadSize), kReadSize);
   VLOG(1) << "read " << n << " bytes from " << fd();
   if (n <= 0) {
     Close();
     return;
   }
-  rbuffer_.append(buf, (size_t)n);
+  rbuffer_.Commit(n);
   BytesRead(&rbuffer_);
 }
 
 void Server::WriteIsAllowed() {
-  ssize_t n = write(fd(), wbuffer_.data(), wbuffer_.length());
+  struct iovec iov[kMaxWriteBuffers];
+  int count = 0;
+  for (std::deque<std::string>::iterator it = wbuffers_.begin();
+       it != wbuffers_.end() && count < kMaxWriteBuffers; ++it, ++count) {
+    const size_t skip = count == 0 ? written_ : 0;
+    iov[count].iov_base = const_cast<char *>(it->data()) + skip;
+    iov[count].iov_len = it->size() - skip;
+  }
+  ssize_t n = writev(fd(), iov, count);
   VLOG(1) << "wrote " << n << " bytes to " << fd();
   if (n <= 0) {
     Close();
     return;
   }
-  wbuffer_.erase(0, n);
+  size_t left = n;
+  while (left > 0) {
+    const size_t rest = wbuffers_.front().size() - written_;
+    if (left < rest) {
+      written_ += left;
+      break;
+    }
+    left -= rest;
+    wbuffers_.pop_front();
+    written_ = 0;
+  }
+}
+
+void Server::Write(std::string *str) {
+  if (str->empty())
+    return;
+  wbuffers_.push_back(std::string());
+  wbuffers_.back().swap(*str);
+  loop()->Changed(this);
 }
 
 void UDPServer::ReadIsAllowed() {
-  char buf[2048];
+  if (read_buffer_.empty())
+    read_buffer_.resize(kMaxReadPackets * kMaxPacketSize);
+#ifdef __linux__
+  struct mmsghdr messages[kMaxReadPackets];
+  struct iovec iov[kMaxReadPackets];
+  struct sockaddr_in from[kMaxReadPackets];
+  memset(messages, 0, sizeof messages);
+  for (int i = 0; i < kMaxReadPackets; ++i) {
+    iov[i].iov_base = &read_buffer_[i * kMaxPacketSize];
+    iov[i].iov_len = kMaxPacketSize;
+    messages[i].msg_hdr.msg_name = &from[i];
+    messages[i].msg_hdr.msg_namelen = sizeof from[i];
+    messages[i].msg_hdr.msg_iov = &iov[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+  // Waits for the first packet only.
+  int in = recvmmsg(fd(), messages, kMaxReadPackets, MSG_WAITFORONE, NULL);
+  CHECK_GE(in, 1);
+  for (int i = 0; i < in; ++i) {
+    CHECK_EQ(messages[i].msg_hdr.msg_namelen, sizeof from[i]);
+    PacketRead(from[i], &read_buffer_[i * kMaxPacketSize],
+               messages[i].msg_len);
+  }
+#else
   struct sockaddr_in sa;
   socklen_t sa_len = sizeof sa;
 
-  ssize_t in = recvfrom(fd(), buf, sizeof buf, 0, (sockaddr *)&sa, &sa_len);
+  ssize_t in = recvfrom(fd(), &read_buffer_[0], kMaxPacketSize, 0,
+                        (sockaddr *)&sa, &sa_len);
   CHECK_GE(in, 1);
   CHECK_EQ(sa_len, sizeof sa);
-  //LOG(INFO) << "UDP packet " << util::HexString(std::string(buf, in));
-  PacketRead(sa, buf, in);
+  PacketRead(sa, &read_buffer_[0], in);
+#endif
 }
 
 void UDPServer::WriteIsAllowed() {
   CHECK(!write_queue_.empty());
-  WBuffer wbuf = write_queue_.front();
-  write_queue_.pop_front();
+#ifdef __linux__
+  struct mmsghdr messages[kMaxWritePackets];
+  struct iovec iov[kMaxWritePackets];
+  int count = 0;
+  memset(messages, 0, sizeof messages);
+  for (std::deque<WBuffer>::iterator it = write_queue_.begin();
+       it != write_queue_.end() && count < kMaxWritePackets; ++it, ++count) {
+    iov[count].iov_base = const_cast<char *>(it->packet.data());
+    iov[count].iov_len = it->packet.length();
+    messages[count].msg_hdr.msg_name = &it->sa;
+    messages[count].msg_hdr.msg_namelen = sizeof it->sa;
+    messages[count].msg_hdr.msg_iov = &iov[count];
+    messages[count].msg_hdr.msg_iovlen = 1;
+  }
+  int sent = sendmmsg(fd(), messages, count, 0);
+  CHECK_GT(sent, 0);
+  for (int i = 0; i < sent; ++i) {
+    CHECK_EQ(messages[i].msg_len, write_queue_.front().packet.length());
+    write_queue_.pop_front();
+  }
+#else
+  const WBuffer &wbuf = write_queue_.front();
   ssize_t out = sendto(fd(), wbuf.packet.data(), wbuf.packet.length(), 0,
                        (const sockaddr *)&wbuf.sa, sizeof wbuf.sa);
   CHECK_NE(out, -1);
   CHECK_EQ((size_t)out, wbuf.packet.length());
+  write_queue_.pop_front();
+#endif
 }
 
 void UDPServer::QueuePacket(const sockaddr_in &to, const char *buf,
                             size_t len) {
-  WBuffer wbuf;
-  wbuf.sa = to;
-  wbuf.packet = std::string(buf, len);
-  write_queue_.push_back(wbuf);
+  std::string packet(buf, len);
+  QueuePacket(to, &packet);
+}
+
+void UDPServer::QueuePacket(const sockaddr_in &to, std::string *packet) {
+  write_queue_.push_back(WBuffer());
+  write_queue_.back().sa = to;
+  write_queue_.back().packet.swap(*packet);
+  loop()->Changed(this);
 }
 
 bool Services::InitServer(int *sock, int port, const char *ip, int type) {
+  return InitServer(sock, port, ip, type, false);
+}
+
+bool Services::InitServer(int *sock, int port, const char *ip, int type,
+                          bool reuse_port) {
   bool ret = false;
   struct sockaddr_in server;
   int s = -1;
@@ -265,6 +549,18 @@ bool Services::InitServer(int *sock, int port, const char *ip, int type) {
   {
     int j = 1;
     setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &j, sizeof j);
+#ifdef SO_REUSEPORT
+    if (reuse_port && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &j,
+                                 sizeof j) == -1) {
+      perror("setsockopt");
+      goto err;
+    }
+#else
+    if (reuse_port) {
+      LOG(ERROR) << "SO_REUSEPORT is not supported";
+      goto err;
+    }
+#endif
   }
 
   if (bind(s, (struct sockaddr *)&server, sizeof(server)) == -1) {
@@ -283,6 +579,12 @@ err:
   return ret;
 }
 
+// static
+int Services::NumCores() {
+  const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? static_cast<int>(cores) : 1;
+}
+
 Services::KeyError Services::ReadPrivateKey(EVP_PKEY **pkey,
                                             const std::string &file) {
   FILE *fp = fopen(file.c_str(), "r");
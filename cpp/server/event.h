@@ -1,13 +1,20 @@
 /* -*- mode: c++; indent-tabs-mode: nil -*- */
 
 #include <deque>
+#include <functional>
 #include <glog/logging.h>
+#include <list>
+#include <map>
 #include <openssl/evp.h>
 #include <netinet/in.h>
+#include <queue>
+#include <set>
+#include <stdint.h>
 #include <string>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
+#include <vector>
 
 class Services {
  
@@ -26,6 +33,14 @@ class Services {
 
   static bool InitServer(int *sock, int port, const char *ip, int type);
 
+  // With |reuse_port|, several sockets can listen on the same port, e.g.
+  // one for each event loop, and the kernel spreads the load over them.
+  static bool InitServer(int *sock, int port, const char *ip, int type,
+                         bool reuse_port);
+
+  // The number of CPU cores online.
+  static int NumCores();
+
   enum KeyError {
     KEY_OK,
     NO_SUCH_FILE,
@@ -36,7 +51,8 @@ class Services {
 
  private:
 
-  static time_t rough_time_;
+  // Each thread runs its own loop, and keeps its own time.
+  static __thread time_t rough_time_;
 };
 
 class EventLoop;
@@ -70,7 +86,7 @@ class FD {
   bool CanDrop() const { return deletable_ == DELETE; }
 
   // Don't forget to call me if anything happens!
-  void Activity() { last_activity_ = Services::RoughTime(); }
+  void Activity();
 
   time_t LastActivity() const { return last_activity_; }
 
@@ -81,19 +97,24 @@ class FD {
   bool WillAccept(int fd);
 
  private:
+  friend class EventLoop;
+
+  // The process's limit on open files.
+  static int FDLimit();
 
   int fd_;
   EventLoop *loop_;
   bool wants_erase_;
   CanDelete deletable_;
   time_t last_activity_;
-
-  // Note that while you can set these low for test, they behave a
-  // bit strangely when set low - for example, it is quite easy to
-  // hit the limit even if the window is not 0. I'm guessing 1000
-  // and 100 would be good numbers. Note EventLoop::kIdleTime below,
-  // also.
-  static const int kFDLimit = 1000;
+  // Where the loop keeps it in order of activity, if it can be dropped.
+  std::list<FD *>::iterator activity_position_;
+
+  // Connections are accepted up to the open file limit (see ulimit -n)
+  // less kFDReserve, which is left for the files the process opens
+  // itself; from kFDLimitWindow below that, the oldest idle connection
+  // is dropped for each new one. Note EventLoop::kIdleTime below, also.
+  static const int kFDReserve = 32;
   static const int kFDLimitWindow = 1;
 };
 
@@ -113,90 +134,271 @@ class Listener : public FD {
   virtual void Accepted(int fd) = 0;
 };
 
+// Work to do every so often, starting one period after the event is added
+// to the loop.
 class RepeatedEvent {
  public:
-  RepeatedEvent(time_t repeat_frequency_seconds)
-      : frequency_(repeat_frequency_seconds),
-        last_activity_(Services::RoughTime()) {}
+  enum Unit {
+    SECONDS,
+    MILLISECONDS,
+  };
 
- // The time when we should execute next.
-  time_t Trigger() {
-    return last_activity_ + frequency_;
+  explicit RepeatedEvent(uint64_t repeat_frequency, Unit unit = SECONDS)
+      : frequency_ms_(unit == SECONDS ? repeat_frequency * 1000
+                      : repeat_frequency) {
+    CHECK_GT(frequency_ms_, 0U);
   }
 
+  virtual ~RepeatedEvent() {}
+
+  uint64_t FrequencyMs() const { return frequency_ms_; }
+
   virtual std::string Description() = 0;
 
   virtual void Execute() = 0;
 
-  void Activity() {
-    last_activity_ = Services::RoughTime();
-  }
+  // Events that have work left over from the last execution can return true
+  // to execute again after a second (or their period, if shorter) instead
+  // of waiting for the full period. Asked after each execution.
+  virtual bool RepeatSoon() { return false; }
+
  private:
- time_t frequency_;
- time_t last_activity_;
+  const uint64_t frequency_ms_;
+};
+
+// Work to do once, after a delay (see EventLoop::Add()).
+class OneShotEvent {
+ public:
+  virtual ~OneShotEvent() {}
+
+  virtual void Execute() = 0;
 };
 
+// Work to do at the end of each round of the loop in which FDs got to read
+// or write. Whatever the FDs queued for writing in that round is only
+// written in a later round, so this is the place to, e.g., commit the
+// effects of the requests that were read before replying to any of them.
+class EndOfRoundEvent {
+ public:
+  virtual ~EndOfRoundEvent() {}
+
+  virtual void Execute() = 0;
+};
+
+// Waits with epoll (Linux) or kqueue (BSD, Mac OS X), so that a round
+// of the loop costs in proportion to the FDs that are ready rather than
+// to all of them. The poller is only told what an FD wants when that may
+// have changed: after it got to read or write, or after Changed().
 class EventLoop {
  public:
-  EventLoop() : go_(true) {}
+  EventLoop();
+
+  ~EventLoop();
 
-  void Add(FD *fd) { fds_.push_back(fd); }
+  void Add(FD *fd);
 
-  void Add(RepeatedEvent *event) { events_.push_back(event); }
+  // Call when what |fd| wants may have changed other than by its own
+  // ReadIsAllowed() or WriteIsAllowed(), e.g. when it queued a write.
+  void Changed(FD *fd) { changed_.insert(fd); }
 
-  // Returns remaining time until the next alarm.
-  time_t ProcessRepeatedEvents();
+  // Call before closing the file descriptor of |fd|, which is deleted
+  // before the next wait.
+  void Closing(FD *fd);
+
+  void Add(RepeatedEvent *event);
+
+  // Execute |event| once, |delay_ms| milliseconds from now.
+  void Add(OneShotEvent *event, uint64_t delay_ms);
+
+  void Add(EndOfRoundEvent *event) { end_of_round_events_.push_back(event); }
+
+  // Executes the events that are due, and returns the milliseconds until
+  // the next one.
+  int ProcessTimers();
 
   void OneLoop();
 
   void Forever();
 
+  // Close the connection that has been idle longest, if it has been for
+  // kIdleTime. Takes constant time, however many connections there are.
   void MaybeDropOne();
 
   void Stop();
 
  private:
+  // What an FD wants to do, and what the poller watches it for.
+  enum Interest {
+    NONE = 0,
+    READ = 1,
+    WRITE = 2,
+  };
 
-  bool EraseCheck(std::deque<FD *>::iterator *pfd);
+  // When an event is next due. Exactly one of |repeated| and |once| is set.
+  struct Timer {
+    uint64_t when_ms;
+    // Keeps timers that are due at the same time in the order they were
+    // set.
+    uint64_t sequence;
+    RepeatedEvent *repeated;
+    OneShotEvent *once;
+
+    bool operator>(const Timer &other) const {
+      if (when_ms != other.when_ms)
+        return when_ms > other.when_ms;
+      return sequence > other.sequence;
+    }
+  };
 
-  static void Set(int fd, fd_set *fdset, int *max);
+  struct Ready {
+    FD *fd;
+    bool read;
+    bool write;
+  };
 
-  std::deque<FD *> fds_;
-  std::vector<RepeatedEvent *> events_;
+  // Bring what the poller watches the changed FDs for up to date, and
+  // delete those that were closed.
+  void UpdateInterest();
+
+  friend class FD;
+
+  // Move |fd| to the back of |by_activity_|, as it was just active.
+  void Touched(FD *fd);
+
+  // Have the poller watch |fd| for |wanted| rather than |interest|.
+  void Watch(FD *fd, int interest, int wanted);
+
+  void Schedule(uint64_t when_ms, RepeatedEvent *repeated,
+                OneShotEvent *once);
+
+  // Wait up to |timeout_ms| milliseconds for FDs to get ready.
+  void Wait(int timeout_ms, std::vector<Ready> *ready);
+
+  // The most events to take from the poller in one wait.
+  static const int kMaxEvents = 256;
+
+  // All FDs, with what the poller watches them for.
+  std::map<FD *, int> fds_;
+  // The FDs that can be dropped and aren't closed yet, least recently
+  // active first.
+  std::list<FD *> by_activity_;
+  std::set<FD *> changed_;
+  // FDs the poller can't watch, like regular files, which are always
+  // ready.
+  std::set<FD *> always_ready_;
+  int poll_fd_;
+  // The earliest due first.
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer> >
+      timers_;
+  uint64_t timer_sequence_;
+  std::vector<EndOfRoundEvent *> end_of_round_events_;
   // This should probably be set to 2 for anything but test (or 1 or 0).
   // 2: everything gets a chance to speak.
   // 1: sometimes the clock will tick before some get a chance to speak.
   // 0: maybe no-one ever gets a chance to speak.
   static const time_t kIdleTime = 20;
+  // How soon events that RepeatSoon() repeat.
+  static const uint64_t kSoonMs = 1000;
 
   bool go_;
 };
 
+// The bytes read from a connection and not yet consumed, kept together so
+// that packets can be framed in place. Consuming moves the start along
+// rather than the bytes; those left only move to the front once they are
+// fewer than the consumed ones before them, so each byte moves at most once
+// on average. Storage of the usual size goes back to a pool of the thread
+// when the buffer empties, so idle connections hold none. Not thread-safe.
+class ReadBuffer {
+ public:
+  ReadBuffer() : storage_(NULL), capacity_(0), start_(0), end_(0) {}
+
+  ~ReadBuffer() { Release(); }
+
+  const char *data() const { return storage_ + start_; }
+
+  size_t size() const { return end_ - start_; }
+
+  bool empty() const { return start_ == end_; }
+
+  // Forget the first |n| bytes.
+  void Consume(size_t n);
+
+  // Room for at least |n| more bytes after the data, to read into; then
+  // Commit() the ones that were.
+  char *Reserve(size_t n);
+
+  void Commit(size_t n) {
+    DCHECK_LE(end_ + n, capacity_);
+    end_ += n;
+  }
+
+  // The size of the storage that is pooled, which is also the least a
+  // buffer has.
+  static const size_t kBlockSize = 32 * 1024;
+
+ private:
+  void Release();
+
+  // The most blocks each thread keeps for reuse.
+  static const size_t kPoolBlocks = 64;
+  static __thread char *pool_[kPoolBlocks];
+  static __thread size_t pooled_;
+
+  char *storage_;
+  size_t capacity_;
+  size_t start_;
+  size_t end_;
+
+  // Private declarations without definitions, to disallow copying.
+  ReadBuffer(const ReadBuffer &);
+  ReadBuffer &operator=(const ReadBuffer &);
+};
+
 class Server : public FD {
  public:
 
-  Server(EventLoop *loop, int fd) : FD(loop, fd) {}
+  Server(EventLoop *loop, int fd) : FD(loop, fd), written_(0) {}
 
   bool WantsRead() const { return true; }
 
   void ReadIsAllowed();
 
   // There are fresh bytes available in rbuffer.  It is the callee's
-  // responsibility to remove consumed bytes from rbuffer. This will
+  // responsibility to Consume() the bytes it uses from rbuffer. This will
   // NOT be called again until more data arrives from the network,
   // even if there are unconsumed bytes in rbuffer.
-  virtual void BytesRead(std::string *rbuffer) = 0;
+  virtual void BytesRead(ReadBuffer *rbuffer) = 0;
 
-  bool WantsWrite() const { return !wbuffer_.empty(); }
+  bool WantsWrite() const { return !wbuffers_.empty(); }
 
+  // Writes as many queued buffers as the socket takes in one writev().
   void WriteIsAllowed();
 
-  void Write(std::string str) { wbuffer_.append(str); }
+  void Write(const std::string &str) {
+    std::string copy(str);
+    Write(&copy);
+  }
 
- private:
+  // Queues the contents of |str| without copying them, and leaves it
+  // empty.
+  void Write(std::string *str);
 
-  std::string rbuffer_;
-  std::string wbuffer_;
+ protected:
+  // Present the unconsumed bytes in rbuffer to BytesRead() again, e.g.
+  // once the server is ready to take more of them.
+  void RereadBuffer() { BytesRead(&rbuffer_); }
+
+ private:
+  // The most buffers to hand to one writev().
+  static const int kMaxWriteBuffers = 64;
+  // The most to read at once.
+  static const size_t kReadSize = 16 * 1024;
+
+  ReadBuffer rbuffer_;
+  std::deque<std::string> wbuffers_;
+  // Bytes of the first of |wbuffers_| that are written already.
+  size_t written_;
 };
 
 class UDPServer : public FD {
@@ -206,12 +408,16 @@ class UDPServer : public FD {
 
   bool WantsRead() const { return true; }
 
+  // Reads the first waiting packet and, where there is recvmmsg(), up to
+  // kMaxReadPackets - 1 more that are already waiting.
   void ReadIsAllowed();
 
   bool WantsWrite() const {
     return !write_queue_.empty();
   }
 
+  // Sends as many queued packets as the socket takes in one sendmmsg(),
+  // where there is one.
   void WriteIsAllowed();
 
   // A packet has been read. It will not be re-presented if you do not
@@ -226,7 +432,19 @@ class UDPServer : public FD {
     QueuePacket(to, reinterpret_cast<const char *>(buf), len);
   }
 
+  // Queues the contents of |packet| without copying them, and leaves it
+  // empty.
+  void QueuePacket(const sockaddr_in &to, std::string *packet);
+
 private:
+  // The most packets to hand to one sendmmsg().
+  static const int kMaxWritePackets = 64;
+  static const int kMaxReadPackets = 64;
+  static const size_t kMaxPacketSize = 2048;
+
+  // Room for kMaxReadPackets packets, allocated on first read.
+  std::vector<char> read_buffer_;
+
   struct WBuffer {
     sockaddr_in sa;
     std::string packet;
@@ -0,0 +1,61 @@
+#include "util/allocation_counter.h"
+
+#include <new>
+#include <stdlib.h>
+
+namespace {
+
+uint64_t allocations = 0;
+
+void *Allocate(size_t size) {
+  __sync_fetch_and_add(&allocations, 1);
+  // operator new must return a distinct pointer even for no bytes.
+  void *ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == NULL)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+}  // namespace
+
+void *operator new(size_t size) {
+  return Allocate(size);
+}
+
+void *operator new[](size_t size) {
+  return Allocate(size);
+}
+
+void operator delete(void *ptr) throw() {
+  free(ptr);
+}
+
+void operator delete[](void *ptr) throw() {
+  free(ptr);
+}
+
+namespace util {
+
+uint64_t AllocationCount() {
+  return __sync_fetch_and_add(&allocations, 0);
+}
+
+void CountAllocation() {
+  __sync_fetch_and_add(&allocations, 1);
+}
+
+void *CountingMalloc(size_t size) {
+  CountAllocation();
+  return malloc(size);
+}
+
+void *CountingRealloc(void *ptr, size_t size) {
+  CountAllocation();
+  return realloc(ptr, size);
+}
+
+void CountingFree(void *ptr) {
+  free(ptr);
+}
+
+}  // namespace util
@@ -0,0 +1,29 @@
+#ifndef UTIL_ALLOCATION_COUNTER_H
+#define UTIL_ALLOCATION_COUNTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace util {
+
+// Counts the heap allocations of a process, for benchmarks. Linking in
+// util/allocation_counter.o replaces the global operator new and delete
+// with ones that count, so it is kept out of libutil.a, and only the
+// benchmarks that want it link it.
+
+// The number of allocations made so far, by all threads.
+uint64_t AllocationCount();
+
+// Count one more allocation, made by an allocator that doesn't go through
+// operator new, e.g. OpenSSL's once CRYPTO_set_mem_functions() routes it
+// through CountingMalloc().
+void CountAllocation();
+
+// malloc(), realloc() and free(), counting each malloc() and realloc().
+void *CountingMalloc(size_t size);
+void *CountingRealloc(void *ptr, size_t size);
+void CountingFree(void *ptr);
+
+}  // namespace util
+
+#endif  // UTIL_ALLOCATION_COUNTER_H
@@ -0,0 +1,80 @@
+#include "util/bloom_filter.h"
+
+#include <glog/logging.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace util {
+
+namespace {
+
+// About 1% false positives.
+const size_t kBitsPerKey = 10;
+const size_t kNumProbes = 7;
+const size_t kMinCapacity = 1024;
+
+uint64_t Word(const std::string &key, size_t offset) {
+  uint64_t word = 0;
+  for (size_t i = 0; i < 8; ++i)
+    word = (word << 8) | static_cast<unsigned char>(key[offset + i]);
+  return word;
+}
+
+// The |probe|th bit of |key| in a filter of |num_bits|, by double hashing.
+uint64_t Bit(uint64_t h1, uint64_t h2, size_t probe, size_t num_bits) {
+  return (h1 + probe * h2) % num_bits;
+}
+
+}  // namespace
+
+BloomFilter::BloomFilter(size_t expected_keys) : size_(0) {
+  AddFilter(expected_keys);
+}
+
+void BloomFilter::Add(const std::string &key) {
+  CHECK_GE(key.size(), 16U);
+  if (filters_.back().size >= filters_.back().capacity)
+    AddFilter(2 * filters_.back().capacity);
+
+  Filter &filter = filters_.back();
+  const size_t num_bits = filter.bits.size() * 64;
+  const uint64_t h1 = Word(key, 0), h2 = Word(key, 8);
+  for (size_t i = 0; i < kNumProbes; ++i) {
+    uint64_t bit = Bit(h1, h2, i, num_bits);
+    filter.bits[bit / 64] |= static_cast<uint64_t>(1) << (bit % 64);
+  }
+  ++filter.size;
+  ++size_;
+}
+
+bool BloomFilter::MayContain(const std::string &key) const {
+  CHECK_GE(key.size(), 16U);
+  const uint64_t h1 = Word(key, 0), h2 = Word(key, 8);
+  for (std::vector<Filter>::const_iterator it = filters_.begin();
+       it != filters_.end(); ++it) {
+    const size_t num_bits = it->bits.size() * 64;
+    size_t i = 0;
+    for (; i < kNumProbes; ++i) {
+      uint64_t bit = Bit(h1, h2, i, num_bits);
+      if ((it->bits[bit / 64] & (static_cast<uint64_t>(1) << (bit % 64))) == 0)
+        break;
+    }
+    if (i == kNumProbes)
+      return true;
+  }
+  return false;
+}
+
+void BloomFilter::AddFilter(size_t capacity) {
+  if (capacity < kMinCapacity)
+    capacity = kMinCapacity;
+  filters_.push_back(Filter());
+  Filter &filter = filters_.back();
+  filter.bits.resize((capacity * kBitsPerKey + 63) / 64);
+  filter.capacity = capacity;
+  filter.size = 0;
+}
+
+}  // namespace util
@@ -0,0 +1,47 @@
+#ifndef UTIL_BLOOM_FILTER_H
+#define UTIL_BLOOM_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace util {
+
+// A set of keys that may answer "maybe" for a key that was never added
+// (about 1% of the time), but never "no" for one that was. Keys must look
+// random, e.g. be cryptographic hashes of at least 16 bytes: their bits are
+// used as is.
+//
+// Once more keys have been added than the filter was sized for, a new
+// filter of twice the size is added for the next ones, so that the false
+// positive rate stays bounded (if slowly rising) however many keys there
+// are. Not thread-safe.
+class BloomFilter {
+ public:
+  explicit BloomFilter(size_t expected_keys);
+
+  void Add(const std::string &key);
+
+  // False if |key| was never added.
+  bool MayContain(const std::string &key) const;
+
+  // Number of keys added.
+  size_t size() const { return size_; }
+
+ private:
+  struct Filter {
+    std::vector<uint64_t> bits;
+    size_t capacity;
+    size_t size;
+  };
+
+  void AddFilter(size_t capacity);
+
+  std::vector<Filter> filters_;
+  size_t size_;
+};
+
+}  // namespace util
+
+#endif  // UTIL_BLOOM_FILTER_H
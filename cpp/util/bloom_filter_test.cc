@@ -0,0 +1,72 @@
+#include "util/bloom_filter.h"
+
+#include <gtest/gtest.h>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace {
+
+using std::string;
+using util::BloomFilter;
+
+// Random keys, as long as a SHA-256 hash.
+std::vector<string> RandomKeys(size_t count) {
+  std::set<string> keys;
+  while (keys.size() < count)
+    keys.insert(util::RandomString(32, 32));
+  return std::vector<string>(keys.begin(), keys.end());
+}
+
+// Number of |keys| that |filter| may contain.
+size_t MayContain(const BloomFilter &filter,
+                  const std::vector<string> &keys) {
+  size_t count = 0;
+  for (size_t i = 0; i < keys.size(); ++i)
+    if (filter.MayContain(keys[i]))
+      ++count;
+  return count;
+}
+
+TEST(BloomFilterTest, Empty) {
+  BloomFilter filter(100);
+  EXPECT_EQ(0U, filter.size());
+  EXPECT_EQ(0U, MayContain(filter, RandomKeys(100)));
+}
+
+TEST(BloomFilterTest, NoFalseNegatives) {
+  std::vector<string> keys = RandomKeys(20000);
+  std::vector<string> added(keys.begin(), keys.begin() + 10000);
+  std::vector<string> others(keys.begin() + 10000, keys.end());
+
+  BloomFilter filter(added.size());
+  for (size_t i = 0; i < added.size(); ++i)
+    filter.Add(added[i]);
+  EXPECT_EQ(added.size(), filter.size());
+  EXPECT_EQ(added.size(), MayContain(filter, added));
+  // About 1% false positives.
+  EXPECT_GT(others.size() / 40, MayContain(filter, others));
+}
+
+TEST(BloomFilterTest, Grow) {
+  std::vector<string> keys = RandomKeys(40000);
+  std::vector<string> added(keys.begin(), keys.begin() + 20000);
+  std::vector<string> others(keys.begin() + 20000, keys.end());
+
+  // Sized for far fewer keys than it gets.
+  BloomFilter filter(10);
+  for (size_t i = 0; i < added.size(); ++i)
+    filter.Add(added[i]);
+  EXPECT_EQ(added.size(), MayContain(filter, added));
+  EXPECT_GT(others.size() / 10, MayContain(filter, others));
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
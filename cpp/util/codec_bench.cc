@@ -0,0 +1,190 @@
+// Benchmark for the hex and base64 codecs in util.
+//
+// For each input size from --min_bytes to --max_bytes (in steps of 4x),
+// times the buffer codecs against b64_ntop, b64_pton and a digit at a
+// time hex encoder, and prints one JSON object per line with the
+// throughput of each in MB per second of input.
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <netinet/in.h>  // for resolv.h
+#include <resolv.h>  // for b64_ntop
+#include <stdio.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "util/util.h"
+
+DEFINE_uint64(min_bytes, 32, "Smallest input to benchmark.");
+DEFINE_uint64(max_bytes, 32768, "Largest input to benchmark.");
+DEFINE_uint64(total_bytes, 100000000, "Bytes to convert per codec and "
+              "input size.");
+
+namespace {
+
+using std::string;
+
+double NowInMicroseconds() {
+  struct timespec ts;
+  PCHECK(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void AppendNumber(const char *name, double value, string *out) {
+  char buf[256];
+  snprintf(buf, sizeof(buf), ", \"%s\": %.3f", name, value);
+  out->append(buf);
+}
+
+// The hex encoder as it was, a digit at a time.
+string OldHexString(const string &data) {
+  static const char nibble[] = "0123456789abcdef";
+  string ret;
+  for (unsigned int i = 0; i < data.size(); ++i) {
+    ret.push_back(nibble[(data[i] >> 4) & 0xf]);
+    ret.push_back(nibble[data[i] & 0xf]);
+  }
+  return ret;
+}
+
+// Each codec converts a buffer of input, and returns something of the
+// output, so that it isn't optimized away.
+class Codec {
+ public:
+  virtual ~Codec() {}
+  virtual size_t Convert() = 0;
+};
+
+class ToBase64Codec : public Codec {
+ public:
+  explicit ToBase64Codec(const string &data)
+      : data_(data), out_(util::Base64EncodedLength(data.size()) + 1) {}
+
+  size_t Convert() {
+    return util::ToBase64(data_.data(), data_.size(), &out_[0]);
+  }
+
+ private:
+  const string data_;
+  std::vector<char> out_;
+};
+
+class NtopCodec : public Codec {
+ public:
+  explicit NtopCodec(const string &data)
+      : data_(data), out_(util::Base64EncodedLength(data.size()) + 1) {}
+
+  size_t Convert() {
+    return b64_ntop(reinterpret_cast<const u_char*>(data_.data()),
+                    data_.size(), &out_[0], out_.size());
+  }
+
+ private:
+  const string data_;
+  std::vector<char> out_;
+};
+
+class FromBase64Codec : public Codec {
+ public:
+  explicit FromBase64Codec(const string &data)
+      : b64_(util::ToBase64(data)),
+        out_(util::Base64DecodedMaxLength(b64_.size())) {}
+
+  size_t Convert() {
+    size_t size;
+    CHECK(util::FromBase64(b64_.data(), b64_.size(), &out_[0], &size));
+    return size;
+  }
+
+ private:
+  const string b64_;
+  std::vector<char> out_;
+};
+
+class PtonCodec : public Codec {
+ public:
+  explicit PtonCodec(const string &data)
+      : b64_(util::ToBase64(data)), out_(b64_.size()) {}
+
+  size_t Convert() {
+    const int size = b64_pton(b64_.c_str(), &out_[0], out_.size());
+    CHECK_GE(size, 0);
+    return size;
+  }
+
+ private:
+  const string b64_;
+  std::vector<u_char> out_;
+};
+
+class HexCodec : public Codec {
+ public:
+  explicit HexCodec(const string &data)
+      : data_(data), out_(2 * data.size()) {}
+
+  size_t Convert() {
+    util::HexString(data_.data(), data_.size(), &out_[0]);
+    return out_[0];
+  }
+
+ private:
+  const string data_;
+  std::vector<char> out_;
+};
+
+class OldHexCodec : public Codec {
+ public:
+  explicit OldHexCodec(const string &data) : data_(data) {}
+
+  size_t Convert() {
+    return OldHexString(data_).size();
+  }
+
+ private:
+  const string data_;
+};
+
+// Append the throughput of |codec| on |bytes| of input to |out|.
+void Benchmark(const char *name, size_t bytes, Codec *codec, string *out) {
+  const uint64_t rounds = FLAGS_total_bytes / bytes + 1;
+  size_t sink = 0;
+  const double start = NowInMicroseconds();
+  for (uint64_t i = 0; i < rounds; ++i)
+    sink += codec->Convert();
+  const double elapsed = NowInMicroseconds() - start;
+  CHECK_GT(sink, 0U);
+  AppendNumber(name, rounds * bytes / elapsed, out);
+  delete codec;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  google::SetUsageMessage("Benchmark the hex and base64 codecs.");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_GT(FLAGS_min_bytes, 0U);
+  CHECK_GE(FLAGS_max_bytes, FLAGS_min_bytes);
+  srand(1);
+
+  for (uint64_t bytes = FLAGS_min_bytes; bytes <= FLAGS_max_bytes;
+       bytes *= 4) {
+    const string data = util::RandomString(bytes, bytes);
+    char buf[64];
+    snprintf(buf, sizeof(buf), "{\"bytes\": %llu",
+             static_cast<unsigned long long>(bytes));
+    string out(buf);
+    Benchmark("to_base64_mb_per_sec", bytes, new ToBase64Codec(data), &out);
+    Benchmark("b64_ntop_mb_per_sec", bytes, new NtopCodec(data), &out);
+    Benchmark("from_base64_mb_per_sec", bytes, new FromBase64Codec(data),
+              &out);
+    Benchmark("b64_pton_mb_per_sec", bytes, new PtonCodec(data), &out);
+    Benchmark("hex_string_mb_per_sec", bytes, new HexCodec(data), &out);
+    Benchmark("old_hex_string_mb_per_sec", bytes, new OldHexCodec(data),
+              &out);
+    out.append("}");
+    printf("%s\n", out.c_str());
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,179 @@
+#include "util/digest_index.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using std::string;
+
+namespace util {
+
+namespace {
+
+const size_t kInitialCapacity = 16;
+
+// FNV-1a. Digests are random enough already; this just mixes in all of
+// their bytes, so that other keys spread too.
+size_t HashDigest(const char *digest, size_t size) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(digest[i]);
+    hash *= 1099511628211ULL;
+  }
+  return static_cast<size_t>(hash ^ (hash >> 32));
+}
+
+}  // namespace
+
+DigestMap::DigestMap(size_t digest_size)
+    : digest_size_(digest_size),
+      size_(0),
+      capacity_(kInitialCapacity),
+      keys_(kInitialCapacity * digest_size),
+      values_(kInitialCapacity),
+      used_(kInitialCapacity) {
+  CHECK_GT(digest_size_, 0U);
+}
+
+void DigestMap::Clear() {
+  size_ = 0;
+  capacity_ = kInitialCapacity;
+  std::vector<char>(kInitialCapacity * digest_size_).swap(keys_);
+  std::vector<uint64_t>(kInitialCapacity).swap(values_);
+  std::vector<bool>(kInitialCapacity).swap(used_);
+}
+
+size_t DigestMap::Slot(const char *digest) const {
+  size_t slot = HashDigest(digest, digest_size_) & (capacity_ - 1);
+  while (used_[slot] && memcmp(Key(slot), digest, digest_size_) != 0)
+    slot = (slot + 1) & (capacity_ - 1);
+  return slot;
+}
+
+bool DigestMap::Insert(const string &digest, uint64_t value) {
+  CHECK_EQ(digest_size_, digest.size());
+  if (2 * (size_ + 1) > capacity_)
+    Grow();
+  const size_t slot = Slot(digest.data());
+  if (used_[slot])
+    return false;
+  memcpy(&keys_[slot * digest_size_], digest.data(), digest_size_);
+  values_[slot] = value;
+  used_[slot] = true;
+  ++size_;
+  return true;
+}
+
+bool DigestMap::Find(const string &digest, uint64_t *value) const {
+  if (digest.size() != digest_size_)
+    return false;
+  const size_t slot = Slot(digest.data());
+  if (!used_[slot])
+    return false;
+  if (value != NULL)
+    *value = values_[slot];
+  return true;
+}
+
+bool DigestMap::Erase(const string &digest) {
+  if (digest.size() != digest_size_)
+    return false;
+  size_t slot = Slot(digest.data());
+  if (!used_[slot])
+    return false;
+  used_[slot] = false;
+  --size_;
+  // Move back the entries after it that would no longer be found past the
+  // gap, so that lookups can stop at the first empty slot.
+  const size_t mask = capacity_ - 1;
+  for (size_t next = (slot + 1) & mask; used_[next];
+       next = (next + 1) & mask) {
+    const size_t home = HashDigest(Key(next), digest_size_) & mask;
+    // Whether |home| lies cyclically in (slot, next].
+    const bool stays = slot <= next ? (slot < home && home <= next)
+        : (slot < home || home <= next);
+    if (stays)
+      continue;
+    memcpy(&keys_[slot * digest_size_], Key(next), digest_size_);
+    values_[slot] = values_[next];
+    used_[slot] = true;
+    used_[next] = false;
+    slot = next;
+  }
+  return true;
+}
+
+void DigestMap::Digests(std::vector<string> *digests) const {
+  digests->reserve(digests->size() + size_);
+  for (size_t slot = 0; slot < capacity_; ++slot)
+    if (used_[slot])
+      digests->push_back(string(Key(slot), digest_size_));
+}
+
+void DigestMap::Grow() {
+  std::vector<char> keys(2 * capacity_ * digest_size_);
+  std::vector<uint64_t> values(2 * capacity_);
+  std::vector<bool> used(2 * capacity_);
+  keys.swap(keys_);
+  values.swap(values_);
+  used.swap(used_);
+  const size_t old_capacity = capacity_;
+  capacity_ *= 2;
+  for (size_t slot = 0; slot < old_capacity; ++slot) {
+    if (!used[slot])
+      continue;
+    const char *key = &keys[slot * digest_size_];
+    const size_t to = Slot(key);
+    memcpy(&keys_[to * digest_size_], key, digest_size_);
+    values_[to] = values[slot];
+    used_[to] = true;
+  }
+}
+
+DigestVector::DigestVector(size_t digest_size)
+    : digest_size_(digest_size), first_(0) {
+  CHECK_GT(digest_size_, 0U);
+}
+
+void DigestVector::Set(uint64_t index, const string &digest) {
+  CHECK_EQ(digest_size_, digest.size());
+  CHECK_GE(index, first_);
+  const size_t slot = index - first_;
+  if (slot >= present_.size()) {
+    present_.resize(slot + 1);
+    digests_.resize((slot + 1) * digest_size_);
+  }
+  memcpy(&digests_[slot * digest_size_], digest.data(), digest_size_);
+  present_[slot] = true;
+}
+
+bool DigestVector::Get(uint64_t index, string *digest) const {
+  if (!Has(index))
+    return false;
+  if (digest != NULL)
+    digest->assign(&digests_[(index - first_) * digest_size_], digest_size_);
+  return true;
+}
+
+void DigestVector::EraseBelow(uint64_t index) {
+  if (index <= first_)
+    return;
+  const size_t erased =
+      std::min<uint64_t>(index - first_, present_.size());
+  // Copied rather than erased in place, so that the capacity goes too.
+  std::vector<char>(digests_.begin() + erased * digest_size_,
+                    digests_.end()).swap(digests_);
+  std::vector<bool>(present_.begin() + erased, present_.end()).swap(present_);
+  first_ = index;
+}
+
+void DigestVector::Clear() {
+  first_ = 0;
+  std::vector<char>().swap(digests_);
+  std::vector<bool>().swap(present_);
+}
+
+}  // namespace util
@@ -0,0 +1,118 @@
+#ifndef UTIL_DIGEST_INDEX_H
+#define UTIL_DIGEST_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "util/memory_usage.h"
+
+namespace util {
+
+// Flat containers for fixed-size digests, such as SHA-256 hashes, that keep
+// the digests inline rather than in a string and a tree node each, for
+// indexes of millions of them. Not thread-safe.
+
+// A map from digests of |digest_size| bytes to integers, with open
+// addressing.
+class DigestMap {
+ public:
+  explicit DigestMap(size_t digest_size);
+
+  size_t digest_size() const { return digest_size_; }
+
+  size_t size() const { return size_; }
+
+  // Map |digest| to |value|, unless it is there already. Returns whether
+  // it was added.
+  bool Insert(const std::string &digest, uint64_t value);
+
+  // If |digest| is there, copy its value to |value| (unless NULL) and
+  // return true. Strings of another size are never there.
+  bool Find(const std::string &digest, uint64_t *value) const;
+
+  // Returns whether |digest| was there.
+  bool Erase(const std::string &digest);
+
+  // Append all the digests to |digests|, in no particular order.
+  void Digests(std::vector<std::string> *digests) const;
+
+  // Remove all the digests, and free their memory.
+  void Clear();
+
+  util::MemoryUsage MemoryUsage() const {
+    return util::MemoryUsage(HeapBytes(keys_) + HeapBytes(values_) +
+                             HeapBytes(used_), size_);
+  }
+
+ private:
+  // The slot of |digest|, or of the empty slot where it would go.
+  size_t Slot(const char *digest) const;
+
+  const char *Key(size_t slot) const {
+    return &keys_[slot * digest_size_];
+  }
+
+  void Grow();
+
+  const size_t digest_size_;
+  size_t size_;
+  // A power of 2, kept at least twice |size_|.
+  size_t capacity_;
+  std::vector<char> keys_;
+  std::vector<uint64_t> values_;
+  std::vector<bool> used_;
+};
+
+// Digests of |digest_size| bytes by index, e.g. by sequence number, for
+// indices that are mostly dense from 0, or from where they were last
+// erased below.
+class DigestVector {
+ public:
+  explicit DigestVector(size_t digest_size);
+
+  size_t digest_size() const { return digest_size_; }
+
+  // One more than the highest index set, or 0.
+  size_t size() const { return first_ + present_.size(); }
+
+  // The lowest index that can be set.
+  uint64_t first() const { return first_; }
+
+  // Set the digest at |index|, replacing any there. |index| must be at
+  // least first().
+  void Set(uint64_t index, const std::string &digest);
+
+  bool Has(uint64_t index) const {
+    return index >= first_ && index - first_ < present_.size() &&
+        present_[index - first_];
+  }
+
+  // If there is a digest at |index|, copy it to |digest| (unless NULL) and
+  // return true.
+  bool Get(uint64_t index, std::string *digest) const;
+
+  // Drop the digests below |index| and free their memory, for good: they
+  // can't be set again. Takes time linear in what is left.
+  void EraseBelow(uint64_t index);
+
+  // Drop all the digests, and start again from index 0.
+  void Clear();
+
+  util::MemoryUsage MemoryUsage() const {
+    return util::MemoryUsage(HeapBytes(digests_) + HeapBytes(present_),
+                             present_.size());
+  }
+
+ private:
+  const size_t digest_size_;
+  // The index of the first digest in |digests_|.
+  uint64_t first_;
+  std::vector<char> digests_;
+  std::vector<bool> present_;
+};
+
+}  // namespace util
+
+#endif  // UTIL_DIGEST_INDEX_H
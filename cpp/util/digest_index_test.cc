@@ -0,0 +1,171 @@
+#include "util/digest_index.h"
+
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <map>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "util/testing.h"
+
+namespace {
+
+using std::string;
+using util::DigestMap;
+using util::DigestVector;
+
+const size_t kDigestSize = 32;
+
+string Digest(uint64_t n) {
+  string digest(kDigestSize, 'x');
+  for (int i = 0; i < 8; ++i)
+    digest[i] = static_cast<char>(n >> (8 * i));
+  return digest;
+}
+
+TEST(DigestMapTest, InsertFindErase) {
+  DigestMap map(kDigestSize);
+  EXPECT_TRUE(map.Insert(Digest(1), 10));
+  EXPECT_FALSE(map.Insert(Digest(1), 11));
+  EXPECT_EQ(1U, map.size());
+
+  uint64_t value = 0;
+  EXPECT_TRUE(map.Find(Digest(1), &value));
+  EXPECT_EQ(10U, value);
+  EXPECT_TRUE(map.Find(Digest(1), NULL));
+  EXPECT_FALSE(map.Find(Digest(2), &value));
+  EXPECT_FALSE(map.Find("short", &value));
+
+  EXPECT_FALSE(map.Erase(Digest(2)));
+  EXPECT_TRUE(map.Erase(Digest(1)));
+  EXPECT_FALSE(map.Find(Digest(1), NULL));
+  EXPECT_EQ(0U, map.size());
+}
+
+TEST(DigestMapTest, MatchesStdMap) {
+  DigestMap map(kDigestSize);
+  std::map<string, uint64_t> expected;
+  srand(1);
+  // Enough to grow several times, and to erase across collision runs.
+  for (int i = 0; i < 20000; ++i) {
+    const string digest = Digest(rand() % 5000);
+    if (rand() % 3 == 0) {
+      EXPECT_EQ(expected.erase(digest) == 1, map.Erase(digest));
+    } else {
+      EXPECT_EQ(expected.insert(std::make_pair(digest, i)).second,
+                map.Insert(digest, i));
+    }
+  }
+  ASSERT_EQ(expected.size(), map.size());
+  for (std::map<string, uint64_t>::const_iterator it = expected.begin();
+       it != expected.end(); ++it) {
+    uint64_t value = 0;
+    EXPECT_TRUE(map.Find(it->first, &value));
+    EXPECT_EQ(it->second, value);
+  }
+
+  std::vector<string> digests;
+  map.Digests(&digests);
+  std::sort(digests.begin(), digests.end());
+  ASSERT_EQ(expected.size(), digests.size());
+  size_t i = 0;
+  for (std::map<string, uint64_t>::const_iterator it = expected.begin();
+       it != expected.end(); ++it, ++i)
+    EXPECT_EQ(it->first, digests[i]);
+}
+
+TEST(DigestVectorTest, SetGet) {
+  DigestVector vector(kDigestSize);
+  EXPECT_EQ(0U, vector.size());
+  EXPECT_FALSE(vector.Get(0, NULL));
+
+  for (uint64_t i = 0; i < 1000; ++i)
+    vector.Set(i, Digest(i));
+  // With a gap.
+  vector.Set(1042, Digest(42));
+  EXPECT_EQ(1043U, vector.size());
+
+  string digest;
+  EXPECT_TRUE(vector.Get(999, &digest));
+  EXPECT_EQ(Digest(999), digest);
+  EXPECT_FALSE(vector.Has(1000));
+  EXPECT_FALSE(vector.Get(1041, &digest));
+  EXPECT_TRUE(vector.Get(1042, &digest));
+  EXPECT_EQ(Digest(42), digest);
+  EXPECT_FALSE(vector.Has(1043));
+
+  vector.Set(7, Digest(77));
+  EXPECT_TRUE(vector.Get(7, &digest));
+  EXPECT_EQ(Digest(77), digest);
+}
+
+TEST(DigestVectorTest, EraseBelow) {
+  DigestVector vector(kDigestSize);
+  for (uint64_t i = 0; i < 100; ++i)
+    vector.Set(i, Digest(i));
+
+  vector.EraseBelow(60);
+  EXPECT_EQ(60U, vector.first());
+  EXPECT_EQ(100U, vector.size());
+  EXPECT_EQ(40U, vector.MemoryUsage().elements);
+  EXPECT_FALSE(vector.Has(59));
+  string digest;
+  EXPECT_TRUE(vector.Get(60, &digest));
+  EXPECT_EQ(Digest(60), digest);
+  EXPECT_TRUE(vector.Get(99, &digest));
+  EXPECT_EQ(Digest(99), digest);
+
+  // Erasing less does nothing.
+  vector.EraseBelow(10);
+  EXPECT_EQ(60U, vector.first());
+  vector.Set(150, Digest(150));
+  EXPECT_TRUE(vector.Get(150, &digest));
+  EXPECT_EQ(Digest(150), digest);
+  EXPECT_FALSE(vector.Has(120));
+
+  // Past the end, too.
+  vector.EraseBelow(200);
+  EXPECT_EQ(200U, vector.size());
+  EXPECT_FALSE(vector.Has(150));
+  vector.Set(200, Digest(200));
+  EXPECT_TRUE(vector.Has(200));
+}
+
+TEST(DigestIndexTest, Clear) {
+  DigestMap map(kDigestSize);
+  DigestVector vector(kDigestSize);
+  for (uint64_t i = 0; i < 100; ++i) {
+    map.Insert(Digest(i), i);
+    vector.Set(i, Digest(i));
+  }
+  vector.EraseBelow(50);
+
+  map.Clear();
+  EXPECT_EQ(0U, map.size());
+  EXPECT_FALSE(map.Find(Digest(1), NULL));
+  EXPECT_TRUE(map.Insert(Digest(1), 2));
+  uint64_t value;
+  EXPECT_TRUE(map.Find(Digest(1), &value));
+  EXPECT_EQ(2U, value);
+
+  vector.Clear();
+  EXPECT_EQ(0U, vector.first());
+  EXPECT_EQ(0U, vector.size());
+  vector.Set(1, Digest(1));
+  EXPECT_TRUE(vector.Has(1));
+}
+
+TEST(DigestVectorDeathTest, SetBelowFirst) {
+  DigestVector vector(kDigestSize);
+  vector.EraseBelow(10);
+  EXPECT_DEATH(vector.Set(9, Digest(9)), "first_");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
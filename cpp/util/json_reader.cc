@@ -0,0 +1,228 @@
+#include "util/json_reader.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/util.h"
+
+using std::string;
+
+namespace util {
+
+namespace {
+
+// Nesting deeper than this is refused, rather than recursed into.
+const int kMaxDepth = 64;
+
+// Reads through a JSON text, skipping what it isn't asked for.
+class Reader {
+ public:
+  Reader(const char *begin, const char *end) : pos_(begin), end_(end) {}
+
+  void SkipSpace() {
+    while (pos_ < end_ && (*pos_ == ' ' || *pos_ == '\t' || *pos_ == '\n' ||
+                           *pos_ == '\r'))
+      ++pos_;
+  }
+
+  // Consume |c|, after any whitespace, if it is next.
+  bool Consume(char c) {
+    SkipSpace();
+    if (pos_ == end_ || *pos_ != c)
+      return false;
+    ++pos_;
+    return true;
+  }
+
+  bool AtEnd() {
+    SkipSpace();
+    return pos_ == end_;
+  }
+
+  // Read a string, leaving |begin| and |size| to its raw contents, escapes
+  // and all, and setting |escaped| if it has any.
+  bool String(const char **begin, size_t *size, bool *escaped) {
+    if (!Consume('"'))
+      return false;
+    *begin = pos_;
+    *escaped = false;
+    for (; pos_ < end_; ++pos_) {
+      if (*pos_ == '"') {
+        *size = pos_ - *begin;
+        ++pos_;
+        return true;
+      }
+      if (*pos_ == '\\') {
+        *escaped = true;
+        if (++pos_ == end_)
+          return false;
+      }
+    }
+    return false;
+  }
+
+  bool SkipValue(int depth) {
+    if (depth > kMaxDepth)
+      return false;
+    SkipSpace();
+    if (pos_ == end_)
+      return false;
+    const char *begin;
+    size_t size;
+    bool escaped;
+    switch (*pos_) {
+      case '"':
+        return String(&begin, &size, &escaped);
+      case '{':
+        ++pos_;
+        if (Consume('}'))
+          return true;
+        do {
+          if (!String(&begin, &size, &escaped) || !Consume(':') ||
+              !SkipValue(depth + 1))
+            return false;
+        } while (Consume(','));
+        return Consume('}');
+      case '[':
+        ++pos_;
+        if (Consume(']'))
+          return true;
+        do {
+          if (!SkipValue(depth + 1))
+            return false;
+        } while (Consume(','));
+        return Consume(']');
+      default:
+        // A number, true, false or null.
+        begin = pos_;
+        while (pos_ < end_ && (isalnum(static_cast<unsigned char>(*pos_)) ||
+                               *pos_ == '-' || *pos_ == '+' || *pos_ == '.'))
+          ++pos_;
+        return pos_ > begin;
+    }
+  }
+
+ private:
+  const char *pos_;
+  const char *const end_;
+};
+
+// Undo the escapes of a JSON string. Only those of ASCII characters are
+// understood, which is all that base64 and member names like ours need.
+bool Unescape(const char *begin, size_t size, string *out) {
+  out->clear();
+  out->reserve(size);
+  const char *const end = begin + size;
+  for (const char *p = begin; p < end; ++p) {
+    if (*p != '\\') {
+      out->push_back(*p);
+      continue;
+    }
+    if (++p == end)
+      return false;
+    switch (*p) {
+      case '"': case '\\': case '/':
+        out->push_back(*p);
+        break;
+      case 'b': out->push_back('\b'); break;
+      case 'f': out->push_back('\f'); break;
+      case 'n': out->push_back('\n'); break;
+      case 'r': out->push_back('\r'); break;
+      case 't': out->push_back('\t'); break;
+      case 'u': {
+        if (end - p < 5)
+          return false;
+        char hex[5];
+        memcpy(hex, p + 1, 4);
+        hex[4] = '\0';
+        char *hex_end;
+        const long c = strtol(hex, &hex_end, 16);
+        if (hex_end != hex + 4 || c <= 0 || c >= 0x80)
+          return false;
+        out->push_back(static_cast<char>(c));
+        p += 4;
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool DecodeBase64Array(const string &json, const char *name,
+                       string *decoded, std::vector<Span> *spans) {
+  const size_t name_size = strlen(name);
+  // No more than the whole of |json| could decode to.
+  decoded->assign(Base64DecodedMaxLength(json.size()), '\0');
+  spans->clear();
+
+  Reader reader(json.data(), json.data() + json.size());
+  if (!reader.Consume('{'))
+    return false;
+  bool found = false;
+  size_t used = 0;
+  if (!reader.Consume('}')) {
+    string unescaped;
+    do {
+      const char *key;
+      size_t key_size;
+      bool escaped;
+      if (!reader.String(&key, &key_size, &escaped) || !reader.Consume(':'))
+        return false;
+      if (escaped && Unescape(key, key_size, &unescaped)) {
+        key = unescaped.data();
+        key_size = unescaped.size();
+      }
+      if (key_size != name_size || memcmp(key, name, name_size) != 0) {
+        if (!reader.SkipValue(1))
+          return false;
+        continue;
+      }
+
+      // A later member of the same name replaces this one.
+      found = true;
+      used = 0;
+      spans->clear();
+      if (!reader.Consume('['))
+        return false;
+      if (reader.Consume(']'))
+        continue;
+      do {
+        const char *b64;
+        size_t b64_size;
+        if (!reader.String(&b64, &b64_size, &escaped))
+          return false;
+        if (escaped) {
+          // json-c, for one, escapes the slashes of base64.
+          if (!Unescape(b64, b64_size, &unescaped)) {
+            spans->push_back(Span(used, 0));
+            continue;
+          }
+          b64 = unescaped.data();
+          b64_size = unescaped.size();
+        }
+        size_t size;
+        // Anything shorter than a quantum is no base64.
+        if (b64_size < 4 ||
+            !FromBase64(b64, b64_size, &(*decoded)[used], &size))
+          size = 0;
+        spans->push_back(Span(used, size));
+        used += size;
+      } while (reader.Consume(','));
+      if (!reader.Consume(']'))
+        return false;
+    } while (reader.Consume(','));
+    if (!reader.Consume('}'))
+      return false;
+  }
+  if (!found || !reader.AtEnd())
+    return false;
+  decoded->resize(used);
+  return true;
+}
+
+}  // namespace util
@@ -0,0 +1,28 @@
+#ifndef UTIL_JSON_READER_H
+#define UTIL_JSON_READER_H
+
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+// Where a value starts in a buffer, and its size.
+typedef std::pair<size_t, size_t> Span;
+
+// Decode the array member |name| of the JSON object |json|, whose elements
+// are base64 strings, in one pass over |json| and without building its
+// objects: the strings are decoded one after another into |decoded|,
+// which is sized once up front, and |spans| set to where each one is in
+// it. An element that isn't valid base64 gets an empty span, as
+// FromBase64() would make it an empty string. Returns false, with
+// |decoded| and |spans| unspecified, if |json| isn't a JSON object, or has
+// no such member, or it isn't an array of strings. If |name| appears more
+// than once, the last one counts, as with json-c.
+bool DecodeBase64Array(const std::string &json, const char *name,
+                       std::string *decoded, std::vector<Span> *spans);
+
+}  // namespace util
+
+#endif  // UTIL_JSON_READER_H
@@ -0,0 +1,121 @@
+#include "util/json_reader.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace {
+
+using std::string;
+using std::vector;
+using util::DecodeBase64Array;
+using util::Span;
+
+// The strings that |spans| mark out in |decoded|.
+vector<string> Split(const string &decoded, const vector<Span> &spans) {
+  vector<string> strings;
+  for (size_t i = 0; i < spans.size(); ++i)
+    strings.push_back(decoded.substr(spans[i].first, spans[i].second));
+  return strings;
+}
+
+TEST(JsonReaderTest, DecodeChain) {
+  const string first(util::RandomString(100, 200));
+  const string second(util::RandomString(1000, 2000));
+  const string json("{ \"chain\": [ \"" + util::ToBase64(first) + "\", \"" +
+                    util::ToBase64(second) + "\" ] }");
+  string decoded;
+  vector<Span> spans;
+  ASSERT_TRUE(DecodeBase64Array(json, "chain", &decoded, &spans));
+  const vector<string> certs(Split(decoded, spans));
+  ASSERT_EQ(2U, certs.size());
+  EXPECT_EQ(first, certs[0]);
+  EXPECT_EQ(second, certs[1]);
+  EXPECT_EQ(first + second, decoded);
+}
+
+TEST(JsonReaderTest, SkipsOtherMembers) {
+  const string json(
+      "{\"a\":1,\"b\":[true,false,null,{\"chain\":[\"Zm9v\"]}],"
+      "\"c\":{\"d\":\"e\\\"\"},\"chain\":[\"YmFy\"],\"f\":-1.5e3}");
+  string decoded;
+  vector<Span> spans;
+  ASSERT_TRUE(DecodeBase64Array(json, "chain", &decoded, &spans));
+  EXPECT_EQ(vector<string>(1, "bar"), Split(decoded, spans));
+}
+
+TEST(JsonReaderTest, LastMemberCounts) {
+  const string json("{ \"chain\": [ \"Zm9v\" ], \"chain\": [ \"YmFy\" ] }");
+  string decoded;
+  vector<Span> spans;
+  ASSERT_TRUE(DecodeBase64Array(json, "chain", &decoded, &spans));
+  EXPECT_EQ(vector<string>(1, "bar"), Split(decoded, spans));
+}
+
+TEST(JsonReaderTest, Escapes) {
+  // As json-c writes them, with the slashes escaped.
+  const string data("\xff\xff\xff\xfb\xff");
+  ASSERT_EQ("////+/8=", util::ToBase64(data));
+  const string json("{ \"ch\\u0061in\": [ \"\\/\\/\\/\\/+\\/8=\" ] }");
+  string decoded;
+  vector<Span> spans;
+  ASSERT_TRUE(DecodeBase64Array(json, "chain", &decoded, &spans));
+  EXPECT_EQ(vector<string>(1, data), Split(decoded, spans));
+}
+
+TEST(JsonReaderTest, EmptyChain) {
+  string decoded;
+  vector<Span> spans;
+  ASSERT_TRUE(DecodeBase64Array("{ \"chain\": [ ] }", "chain", &decoded,
+                                &spans));
+  EXPECT_TRUE(spans.empty());
+  EXPECT_TRUE(decoded.empty());
+}
+
+TEST(JsonReaderTest, BadBase64IsEmpty) {
+  string decoded;
+  vector<Span> spans;
+  ASSERT_TRUE(DecodeBase64Array("{ \"chain\": [ \"!!!!\", \"\", \"YmFy\" ] }",
+                                "chain", &decoded, &spans));
+  const vector<string> certs(Split(decoded, spans));
+  ASSERT_EQ(3U, certs.size());
+  EXPECT_EQ("", certs[0]);
+  EXPECT_EQ("", certs[1]);
+  EXPECT_EQ("bar", certs[2]);
+}
+
+TEST(JsonReaderTest, Malformed) {
+  const char *const kBad[] = {
+    "",
+    "[ \"Zm9v\" ]",
+    "{ }",
+    "{ \"other\": [ \"Zm9v\" ] }",
+    "{ \"chain\": \"Zm9v\" }",
+    "{ \"chain\": [ 1 ] }",
+    "{ \"chain\": [ \"Zm9v\" }",
+    "{ \"chain\": [ \"Zm9v\" ] } x",
+    "{ \"chain\": [ \"Zm9v ] }",
+    "{ \"a\": [[[[[[[[",
+  };
+  string decoded;
+  vector<Span> spans;
+  for (size_t i = 0; i < sizeof kBad / sizeof kBad[0]; ++i)
+    EXPECT_FALSE(DecodeBase64Array(kBad[i], "chain", &decoded, &spans))
+        << kBad[i];
+
+  string deep("{ \"a\": ");
+  deep.append(100, '[');
+  deep.append(100, ']');
+  deep.append(", \"chain\": [] }");
+  EXPECT_FALSE(DecodeBase64Array(deep, "chain", &decoded, &spans));
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
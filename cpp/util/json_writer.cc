@@ -0,0 +1,153 @@
+#include "util/json_writer.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util/util.h"
+
+using std::string;
+
+namespace util {
+
+void JsonWriter::BeginObject() {
+  BeginValue();
+  out_->append("{ ");
+  nonempty_.push_back(false);
+}
+
+void JsonWriter::EndObject() {
+  assert(!nonempty_.empty() && !after_key_);
+  if (nonempty_.back())
+    out_->append(" ");
+  out_->append("}");
+  nonempty_.pop_back();
+}
+
+void JsonWriter::BeginArray() {
+  BeginValue();
+  out_->append("[ ");
+  nonempty_.push_back(false);
+}
+
+void JsonWriter::EndArray() {
+  assert(!nonempty_.empty());
+  if (nonempty_.back())
+    out_->append(" ");
+  out_->append("]");
+  nonempty_.pop_back();
+}
+
+void JsonWriter::Key(const char *name) {
+  assert(!nonempty_.empty() && !after_key_);
+  if (nonempty_.back())
+    out_->append(", ");
+  nonempty_.back() = true;
+  AppendString(name, strlen(name));
+  out_->append(": ");
+  after_key_ = true;
+}
+
+void JsonWriter::Add(const string &value) {
+  BeginValue();
+  AppendString(value.data(), value.size());
+}
+
+void JsonWriter::Add(const char *value) {
+  BeginValue();
+  AppendString(value, strlen(value));
+}
+
+void JsonWriter::Add(int64_t value) {
+  BeginValue();
+  char buf[32];
+  const int length = snprintf(buf, sizeof(buf), "%lld",
+                              static_cast<long long>(value));
+  out_->append(buf, length);
+}
+
+void JsonWriter::AddBoolean(bool value) {
+  BeginValue();
+  out_->append(value ? "true" : "false");
+}
+
+void JsonWriter::AddNull() {
+  BeginValue();
+  out_->append("null");
+}
+
+void JsonWriter::AddBase64(const string &data) {
+  BeginValue();
+  // Base64 needs no escaping, so it is encoded in place.
+  out_->push_back('"');
+  const size_t start = out_->size();
+  out_->resize(start + Base64EncodedLength(data.size()));
+  if (!data.empty())
+    ToBase64(data.data(), data.size(), &(*out_)[start]);
+  out_->push_back('"');
+}
+
+void JsonWriter::AddRaw(const string &json) {
+  BeginValue();
+  out_->append(json);
+}
+
+void JsonWriter::BeginValue() {
+  if (after_key_) {
+    after_key_ = false;
+    return;
+  }
+  if (nonempty_.empty())
+    return;
+  if (nonempty_.back())
+    out_->append(", ");
+  nonempty_.back() = true;
+}
+
+void JsonWriter::AppendString(const char *value, size_t size) {
+  out_->push_back('"');
+  const char *const end = value + size;
+  while (value < end) {
+    // Copy runs of characters that don't need escaping at once.
+    const char *run = value;
+    while (run < end && *run != '"' && *run != '\\' &&
+           static_cast<unsigned char>(*run) >= 0x20)
+      ++run;
+    out_->append(value, run - value);
+    if (run == end)
+      break;
+    const char c = *run;
+    switch (c) {
+      case '"':
+        out_->append("\\\"");
+        break;
+      case '\\':
+        out_->append("\\\\");
+        break;
+      case '\b':
+        out_->append("\\b");
+        break;
+      case '\f':
+        out_->append("\\f");
+        break;
+      case '\n':
+        out_->append("\\n");
+        break;
+      case '\r':
+        out_->append("\\r");
+        break;
+      case '\t':
+        out_->append("\\t");
+        break;
+      default: {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(c));
+        out_->append(buf);
+      }
+    }
+    value = run + 1;
+  }
+  out_->push_back('"');
+}
+
+}  // namespace util
@@ -0,0 +1,60 @@
+#ifndef UTIL_JSON_WRITER_H
+#define UTIL_JSON_WRITER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace util {
+
+// Writes JSON straight onto the end of a string, in the layout json-c
+// renders, rather than building objects to render afterwards. Members and
+// elements are separated as they are added; the caller is left to nest
+// them properly, and to name each member with Key() first.
+//
+//   JsonWriter json(&out);
+//   json.BeginObject();
+//   json.Key("tree_size");
+//   json.Add(sth.tree_size());
+//   json.EndObject();
+class JsonWriter {
+ public:
+  // Appends to |out|.
+  explicit JsonWriter(std::string *out) : out_(out), after_key_(false) {}
+
+  void BeginObject();
+  void EndObject();
+  void BeginArray();
+  void EndArray();
+
+  // Name the next member of the object being written.
+  void Key(const char *name);
+
+  void Add(const std::string &value);
+  void Add(const char *value);
+  void Add(int64_t value);
+  void AddBoolean(bool value);
+  void AddNull();
+
+  // Add |data|, in base64, as a string.
+  void AddBase64(const std::string &data);
+
+  // Add |json|, which must be a single value, rendered already.
+  void AddRaw(const std::string &json);
+
+ private:
+  // Separate a new value from the one before, if any.
+  void BeginValue();
+
+  void AppendString(const char *value, size_t size);
+
+  std::string *const out_;
+  // For each object or array being written, whether it has a value yet.
+  std::vector<bool> nonempty_;
+  // Whether a member was named, but not given its value yet.
+  bool after_key_;
+};
+
+}  // namespace util
+
+#endif  // UTIL_JSON_WRITER_H
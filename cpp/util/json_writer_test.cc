@@ -0,0 +1,76 @@
+#include "util/json_writer.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace {
+
+using std::string;
+using util::JsonWriter;
+
+TEST(JsonWriterTest, Layout) {
+  string out;
+  JsonWriter json(&out);
+  json.BeginObject();
+  json.Key("tree_size");
+  json.Add(static_cast<int64_t>(0x123456789aLL));
+  json.Key("empty");
+  json.BeginArray();
+  json.EndArray();
+  json.Key("nested");
+  json.BeginArray();
+  json.Add("a");
+  json.BeginObject();
+  json.EndObject();
+  json.AddBoolean(true);
+  json.AddNull();
+  json.EndArray();
+  json.EndObject();
+
+  // As json_object_to_json_string() has it.
+  EXPECT_EQ("{ \"tree_size\": 78187493530, \"empty\": [ ], "
+            "\"nested\": [ \"a\", { }, true, null ] }", out);
+}
+
+TEST(JsonWriterTest, AppendsToWhatIsThere) {
+  string out("x");
+  JsonWriter json(&out);
+  json.BeginArray();
+  json.Add(-1);
+  json.Add(2);
+  json.EndArray();
+  EXPECT_EQ("x[ -1, 2 ]", out);
+}
+
+TEST(JsonWriterTest, Escapes) {
+  const string value("quote \" backslash \\ slash / \b\f\n\r\t \x01 end");
+  string out;
+  JsonWriter json(&out);
+  json.BeginObject();
+  json.Key("k\"ey");
+  json.Add(value);
+  json.EndObject();
+
+  EXPECT_EQ("{ \"k\\\"ey\": \"quote \\\" backslash \\\\ slash / "
+            "\\b\\f\\n\\r\\t \\u0001 end\" }", out);
+}
+
+TEST(JsonWriterTest, Base64) {
+  for (int i = 0; i < 100; ++i) {
+    const string data = util::RandomString(0, 100);
+    string out;
+    JsonWriter json(&out);
+    json.AddBase64(data);
+    EXPECT_EQ("\"" + util::ToBase64(data) + "\"", out);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,86 @@
+#ifndef UTIL_LRU_CACHE_H
+#define UTIL_LRU_CACHE_H
+
+#include <list>
+#include <map>
+#include <stddef.h>
+#include <utility>
+
+#include "util/memory_usage.h"
+
+namespace util {
+
+// A map of at most |capacity| values that drops the least recently used
+// one to make room for a new one. Not thread-safe.
+template <class Key, class Value> class LRUCache {
+ public:
+  // A cache with |capacity| 0 keeps nothing.
+  explicit LRUCache(size_t capacity) : capacity_(capacity) {}
+
+  // If |key| is cached, copy its value to |value| (unless NULL), mark it
+  // as the most recently used and return true.
+  bool Get(const Key &key, Value *value) {
+    typename Index::iterator it = index_.find(key);
+    if (it == index_.end())
+      return false;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    if (value != NULL)
+      *value = it->second->second;
+    return true;
+  }
+
+  // Cache |value| for |key|, replacing any previous value.
+  void Put(const Key &key, const Value &value) {
+    if (capacity_ == 0)
+      return;
+    Erase(key);
+    entries_.push_front(std::make_pair(key, value));
+    index_[key] = entries_.begin();
+    if (index_.size() > capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+
+  void Erase(const Key &key) {
+    typename Index::iterator it = index_.find(key);
+    if (it == index_.end())
+      return;
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+
+  void Clear() {
+    entries_.clear();
+    index_.clear();
+  }
+
+  size_t size() const { return index_.size(); }
+
+  // The heap bytes held, estimated: the list and index nodes of each
+  // entry, with its key in both, plus |value_bytes(value)| for what each
+  // value holds outside itself.
+  template <class ValueBytes>
+  util::MemoryUsage MemoryUsage(ValueBytes value_bytes) const {
+    util::MemoryUsage usage(0, index_.size());
+    for (typename Entries::const_iterator it = entries_.begin();
+         it != entries_.end(); ++it)
+      usage.bytes += kListNodeBytes + sizeof(*it) + kTreeNodeBytes +
+          sizeof(typename Index::value_type) + 2 * HeapBytes(it->first) +
+          value_bytes(it->second);
+    return usage;
+  }
+
+ private:
+  typedef std::list<std::pair<Key, Value> > Entries;
+  typedef std::map<Key, typename Entries::iterator> Index;
+
+  const size_t capacity_;
+  // Most recently used first.
+  Entries entries_;
+  Index index_;
+};
+
+}  // namespace util
+
+#endif  // UTIL_LRU_CACHE_H
@@ -0,0 +1,170 @@
+#include "util/lru_cache.h"
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string>
+
+#include "util/testing.h"
+
+namespace {
+
+using std::string;
+using util::LRUCache;
+
+typedef LRUCache<uint64_t, string> Cache;
+
+TEST(LRUCacheTest, GetAndPut) {
+  Cache cache(3);
+  string value;
+  EXPECT_FALSE(cache.Get(1, &value));
+
+  cache.Put(1, "one");
+  cache.Put(2, "two");
+  EXPECT_EQ(2U, cache.size());
+  EXPECT_TRUE(cache.Get(1, &value));
+  EXPECT_EQ("one", value);
+  EXPECT_TRUE(cache.Get(2, &value));
+  EXPECT_EQ("two", value);
+  EXPECT_TRUE(cache.Get(2, NULL));
+  EXPECT_FALSE(cache.Get(3, &value));
+  EXPECT_EQ("two", value);
+}
+
+TEST(LRUCacheTest, EvictsLeastRecentlyPut) {
+  Cache cache(3);
+  cache.Put(1, "one");
+  cache.Put(2, "two");
+  cache.Put(3, "three");
+  cache.Put(4, "four");
+  EXPECT_EQ(3U, cache.size());
+  // Misses don't change the order.
+  EXPECT_FALSE(cache.Get(1, NULL));
+
+  cache.Put(5, "five");
+  EXPECT_FALSE(cache.Get(2, NULL));
+  EXPECT_TRUE(cache.Get(3, NULL));
+  EXPECT_TRUE(cache.Get(4, NULL));
+  EXPECT_TRUE(cache.Get(5, NULL));
+}
+
+TEST(LRUCacheTest, GetRefreshes) {
+  Cache cache(3);
+  cache.Put(1, "one");
+  cache.Put(2, "two");
+  cache.Put(3, "three");
+  // 1 is now the most recently used, so 2 goes first, then 3, then 1.
+  EXPECT_TRUE(cache.Get(1, NULL));
+  cache.Put(4, "four");
+  EXPECT_FALSE(cache.Get(2, NULL));
+  cache.Put(5, "five");
+  EXPECT_FALSE(cache.Get(3, NULL));
+  cache.Put(6, "six");
+  EXPECT_FALSE(cache.Get(1, NULL));
+  cache.Put(7, "seven");
+  EXPECT_FALSE(cache.Get(4, NULL));
+  EXPECT_TRUE(cache.Get(5, NULL));
+  EXPECT_TRUE(cache.Get(6, NULL));
+  EXPECT_TRUE(cache.Get(7, NULL));
+}
+
+TEST(LRUCacheTest, PutRefreshes) {
+  Cache cache(3);
+  cache.Put(1, "one");
+  cache.Put(2, "two");
+  cache.Put(3, "three");
+  cache.Put(1, "one");
+  cache.Put(4, "four");
+  EXPECT_FALSE(cache.Get(2, NULL));
+  EXPECT_TRUE(cache.Get(1, NULL));
+  EXPECT_TRUE(cache.Get(3, NULL));
+}
+
+TEST(LRUCacheTest, PutReplaces) {
+  Cache cache(2);
+  cache.Put(1, "one");
+  cache.Put(2, "two");
+  cache.Put(1, "uno");
+  EXPECT_EQ(2U, cache.size());
+  string value;
+  EXPECT_TRUE(cache.Get(1, &value));
+  EXPECT_EQ("uno", value);
+  EXPECT_TRUE(cache.Get(2, &value));
+  EXPECT_EQ("two", value);
+
+  // Replacing an entry of a full cache evicts nothing.
+  cache.Put(2, "dos");
+  EXPECT_EQ(2U, cache.size());
+  EXPECT_TRUE(cache.Get(1, &value));
+  EXPECT_EQ("uno", value);
+  EXPECT_TRUE(cache.Get(2, &value));
+  EXPECT_EQ("dos", value);
+}
+
+TEST(LRUCacheTest, CapacityZero) {
+  Cache cache(0);
+  cache.Put(1, "one");
+  EXPECT_EQ(0U, cache.size());
+  EXPECT_FALSE(cache.Get(1, NULL));
+  cache.Erase(1);
+  EXPECT_EQ(0U, cache.size());
+}
+
+TEST(LRUCacheTest, CapacityOne) {
+  Cache cache(1);
+  string value;
+  cache.Put(1, "one");
+  EXPECT_TRUE(cache.Get(1, &value));
+  EXPECT_EQ("one", value);
+
+  cache.Put(1, "uno");
+  EXPECT_EQ(1U, cache.size());
+  EXPECT_TRUE(cache.Get(1, &value));
+  EXPECT_EQ("uno", value);
+
+  cache.Put(2, "two");
+  EXPECT_EQ(1U, cache.size());
+  EXPECT_FALSE(cache.Get(1, NULL));
+  EXPECT_TRUE(cache.Get(2, &value));
+  EXPECT_EQ("two", value);
+}
+
+TEST(LRUCacheTest, EraseAndClear) {
+  Cache cache(2);
+  cache.Put(1, "one");
+  cache.Put(2, "two");
+  cache.Erase(1);
+  cache.Erase(3);
+  EXPECT_EQ(1U, cache.size());
+  EXPECT_FALSE(cache.Get(1, NULL));
+
+  // The room is taken without evicting 2.
+  cache.Put(3, "three");
+  EXPECT_TRUE(cache.Get(2, NULL));
+  EXPECT_TRUE(cache.Get(3, NULL));
+
+  cache.Clear();
+  EXPECT_EQ(0U, cache.size());
+  EXPECT_FALSE(cache.Get(2, NULL));
+  cache.Put(4, "four");
+  cache.Put(5, "five");
+  EXPECT_EQ(2U, cache.size());
+}
+
+TEST(LRUCacheTest, MemoryUsage) {
+  Cache cache(2);
+  EXPECT_EQ(0U, cache.MemoryUsage(util::NoHeapBytes<string>).bytes);
+  cache.Put(1, "one");
+  const size_t one = cache.MemoryUsage(util::NoHeapBytes<string>).bytes;
+  EXPECT_LT(0U, one);
+  cache.Put(2, "two");
+  const util::MemoryUsage two(cache.MemoryUsage(util::NoHeapBytes<string>));
+  EXPECT_EQ(2U, two.elements);
+  EXPECT_EQ(2 * one, two.bytes);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,22 @@
+#include "util/memory_usage.h"
+
+#include <string>
+
+#include "util/metrics.h"
+
+using std::string;
+
+namespace util {
+
+void ExportMemoryUsage(const string &structure, const MemoryUsage &usage,
+                       Metrics *metrics) {
+  const char kBytes[] = "ct_memory_bytes";
+  const char kElements[] = "ct_memory_elements";
+  metrics->DefineGauge(kBytes, "Estimated heap bytes held, by structure.");
+  metrics->DefineGauge(kElements, "Elements held, by structure.");
+  const string labels = "structure=\"" + structure + "\"";
+  metrics->Set(kBytes, labels, usage.bytes);
+  metrics->Set(kElements, labels, usage.elements);
+}
+
+}  // namespace util
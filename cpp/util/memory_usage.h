@@ -0,0 +1,60 @@
+#ifndef UTIL_MEMORY_USAGE_H
+#define UTIL_MEMORY_USAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace util {
+
+class Metrics;
+
+// Memory accounting: the structures that grow with the log estimate the
+// heap bytes they hold, so that the metrics show how the server's memory
+// divides between them. The estimates count what the containers ask the
+// allocator for, not the allocator's own overhead, so they add up to
+// somewhat less than the resident set.
+
+struct MemoryUsage {
+  MemoryUsage() : bytes(0), elements(0) {}
+  MemoryUsage(size_t b, size_t e) : bytes(b), elements(e) {}
+
+  void Add(const MemoryUsage &other) {
+    bytes += other.bytes;
+    elements += other.elements;
+  }
+
+  size_t bytes;
+  size_t elements;
+};
+
+// The bookkeeping of a node of a std::map or std::set (its colour, parent
+// and children), and of a std::list (its neighbours).
+const size_t kTreeNodeBytes = 4 * sizeof(void*);
+const size_t kListNodeBytes = 2 * sizeof(void*);
+
+// What containers hold on the heap, beyond their own size.
+inline size_t HeapBytes(const std::string &s) { return s.capacity(); }
+
+inline size_t HeapBytes(uint64_t) { return 0; }
+
+template <class T> size_t HeapBytes(const std::vector<T> &v) {
+  return v.capacity() * sizeof(T);
+}
+
+inline size_t HeapBytes(const std::vector<bool> &v) {
+  return v.capacity() / 8;
+}
+
+// For values that hold nothing outside themselves.
+template <class T> size_t NoHeapBytes(const T &) { return 0; }
+
+// Set the gauges ct_memory_bytes and ct_memory_elements of |structure| to
+// |usage|, defining them if need be.
+void ExportMemoryUsage(const std::string &structure, const MemoryUsage &usage,
+                       Metrics *metrics);
+
+}  // namespace util
+
+#endif  // UTIL_MEMORY_USAGE_H
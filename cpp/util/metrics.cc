@@ -0,0 +1,235 @@
+#include "util/metrics.h"
+
+#include <glog/logging.h>
+#include <map>
+#include <pthread.h>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "util/util.h"
+
+using std::string;
+
+namespace util {
+
+namespace {
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+const double kLatencyBuckets[] = {
+  0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5,
+  5, 10, 30, 60,
+};
+
+// Whole numbers below 10^15 come out exactly, without an exponent.
+string Number(double value) {
+  char buffer[32];
+  snprintf(buffer, sizeof buffer, "%.15g", value);
+  return buffer;
+}
+
+// |name|{|labels|}, with |extra| added to the labels if not empty.
+string SeriesName(const string &name, const string &labels,
+                  const string &extra) {
+  if (labels.empty() && extra.empty())
+    return name;
+  string ret = name + "{" + labels;
+  if (!labels.empty() && !extra.empty())
+    ret += ",";
+  return ret + extra + "}";
+}
+
+}  // namespace
+
+Metrics::Metrics() : parent_(NULL) {
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+}
+
+Metrics::Metrics(Metrics *parent, const string &labels)
+    : parent_(CHECK_NOTNULL(parent)),
+      labels_(labels) {
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+}
+
+Metrics::~Metrics() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+// static
+std::vector<double> Metrics::LatencyBuckets() {
+  return std::vector<double>(
+      kLatencyBuckets,
+      kLatencyBuckets + sizeof kLatencyBuckets / sizeof kLatencyBuckets[0]);
+}
+
+void Metrics::DefineCounter(const string &name, const string &help) {
+  Define(name, COUNTER, help, std::vector<double>());
+}
+
+void Metrics::DefineGauge(const string &name, const string &help) {
+  Define(name, GAUGE, help, std::vector<double>());
+}
+
+void Metrics::DefineHistogram(const string &name, const string &help,
+                              const std::vector<double> &buckets) {
+  for (size_t i = 1; i < buckets.size(); ++i)
+    CHECK_LT(buckets[i - 1], buckets[i]);
+  Define(name, HISTOGRAM, help, buckets);
+}
+
+void Metrics::Define(const string &name, Type type, const string &help,
+                     const std::vector<double> &buckets) {
+  if (parent_ != NULL) {
+    parent_->Define(name, type, help, buckets);
+    return;
+  }
+  ScopedLock lock(&mutex_);
+  std::map<string, Family>::iterator it = families_.find(name);
+  if (it != families_.end()) {
+    CHECK_EQ(type, it->second.type) << "Metric " << name << " redefined";
+    CHECK(buckets == it->second.buckets) << "Metric " << name
+                                         << " redefined";
+    return;
+  }
+  Family &family = families_[name];
+  family.type = type;
+  family.help = help;
+  family.buckets = buckets;
+}
+
+Metrics::Series *Metrics::GetSeries(const string &name, const string &labels,
+                                    bool histogram) {
+  std::map<string, Family>::iterator it = families_.find(name);
+  CHECK(it != families_.end()) << "Undefined metric " << name;
+  CHECK_EQ(histogram, it->second.type == HISTOGRAM)
+      << "Wrong type of metric " << name;
+  Series *series = &it->second.series[labels];
+  if (histogram && series->buckets.empty())
+    series->buckets.resize(it->second.buckets.size(), 0);
+  return series;
+}
+
+string Metrics::Labels(const string &labels) const {
+  if (labels_.empty())
+    return labels;
+  if (labels.empty())
+    return labels_;
+  return labels_ + "," + labels;
+}
+
+void Metrics::Increment(const string &name, const string &labels,
+                        double value) {
+  if (parent_ != NULL) {
+    parent_->Increment(name, Labels(labels), value);
+    return;
+  }
+  ScopedLock lock(&mutex_);
+  GetSeries(name, labels, false)->value += value;
+}
+
+void Metrics::Set(const string &name, const string &labels, double value) {
+  if (parent_ != NULL) {
+    parent_->Set(name, Labels(labels), value);
+    return;
+  }
+  ScopedLock lock(&mutex_);
+  GetSeries(name, labels, false)->value = value;
+}
+
+void Metrics::Observe(const string &name, const string &labels,
+                      double value) {
+  if (parent_ != NULL) {
+    parent_->Observe(name, Labels(labels), value);
+    return;
+  }
+  ScopedLock lock(&mutex_);
+  Series *series = GetSeries(name, labels, true);
+  const std::vector<double> &buckets = families_[name].buckets;
+  // Values above the last bound only count towards +Inf.
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    if (value <= buckets[i]) {
+      ++series->buckets[i];
+      break;
+    }
+  }
+  ++series->count;
+  series->value += value;
+}
+
+double Metrics::Value(const string &name, const string &labels) const {
+  if (parent_ != NULL)
+    return parent_->Value(name, Labels(labels));
+  ScopedLock lock(&mutex_);
+  std::map<string, Family>::const_iterator it = families_.find(name);
+  CHECK(it != families_.end()) << "Undefined metric " << name;
+  std::map<string, Series>::const_iterator series =
+      it->second.series.find(labels);
+  return series == it->second.series.end() ? 0 : series->second.value;
+}
+
+string Metrics::Export() const {
+  static const char *const kTypes[] = { "counter", "gauge", "histogram" };
+  if (parent_ != NULL)
+    return parent_->Export();
+  std::ostringstream out;
+  ScopedLock lock(&mutex_);
+  for (std::map<string, Family>::const_iterator it = families_.begin();
+       it != families_.end(); ++it) {
+    const string &name = it->first;
+    const Family &family = it->second;
+    out << "# HELP " << name << " " << family.help << "\n";
+    out << "# TYPE " << name << " " << kTypes[family.type] << "\n";
+    for (std::map<string, Series>::const_iterator s = family.series.begin();
+         s != family.series.end(); ++s) {
+      const string &labels = s->first;
+      const Series &series = s->second;
+      if (family.type != HISTOGRAM) {
+        out << SeriesName(name, labels, "") << " " << Number(series.value)
+            << "\n";
+        continue;
+      }
+      uint64_t cumulative = 0;
+      for (size_t i = 0; i < family.buckets.size(); ++i) {
+        cumulative += series.buckets[i];
+        out << SeriesName(name + "_bucket", labels,
+                          "le=\"" + Number(family.buckets[i]) + "\"")
+            << " " << cumulative << "\n";
+      }
+      out << SeriesName(name + "_bucket", labels, "le=\"+Inf\"") << " "
+          << series.count << "\n";
+      out << SeriesName(name + "_sum", labels, "") << " "
+          << Number(series.value) << "\n";
+      out << SeriesName(name + "_count", labels, "") << " " << series.count
+          << "\n";
+    }
+  }
+  return out.str();
+}
+
+Metrics::Timer::Timer(Metrics *metrics, const string &name,
+                      const string &labels)
+    : metrics_(metrics),
+      name_(name),
+      labels_(labels),
+      start_(TimeInMicroseconds()) {}
+
+Metrics::Timer::~Timer() {
+  if (metrics_ != NULL)
+    metrics_->Observe(name_, labels_,
+                      (TimeInMicroseconds() - start_) / 1e6);
+}
+
+}  // namespace util
@@ -0,0 +1,116 @@
+#ifndef UTIL_METRICS_H
+#define UTIL_METRICS_H
+
+#include <map>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace util {
+
+// Counters, gauges and histograms for monitoring, exported in the
+// Prometheus text format. Each metric is defined once by name, and then
+// holds one series per set of labels, e.g. endpoint="get-sth" (or none).
+// Thread-safe.
+class Metrics {
+ public:
+  Metrics();
+  // A view of |parent| that records into its series, with |labels| added
+  // to those of each, e.g. log="2015" for one of several logs in a process.
+  // Exports all of |parent|.
+  Metrics(Metrics *parent, const std::string &labels);
+  ~Metrics();
+
+  // Upper bounds for latencies, in seconds.
+  static std::vector<double> LatencyBuckets();
+
+  // Define the metric |name|, described by |help|. Redefining a metric
+  // keeps its series.
+  void DefineCounter(const std::string &name, const std::string &help);
+  void DefineGauge(const std::string &name, const std::string &help);
+  // Counts observations into buckets with upper bounds |buckets|, which
+  // must ascend.
+  void DefineHistogram(const std::string &name, const std::string &help,
+                       const std::vector<double> &buckets);
+
+  // Add |value| to the counter or gauge |name|.
+  void Increment(const std::string &name, const std::string &labels,
+                 double value);
+  void Increment(const std::string &name, const std::string &labels) {
+    Increment(name, labels, 1);
+  }
+
+  // Set the counter or gauge |name|, e.g. from statistics kept elsewhere.
+  void Set(const std::string &name, const std::string &labels, double value);
+
+  // Count |value| into the histogram |name|.
+  void Observe(const std::string &name, const std::string &labels,
+               double value);
+
+  // The current value of the counter or gauge |name|, for testing.
+  double Value(const std::string &name, const std::string &labels) const;
+
+  // All metrics, in the Prometheus text exposition format.
+  std::string Export() const;
+
+  // Observes the seconds from its construction to its destruction into a
+  // histogram. |metrics| may be NULL, in which case it does nothing.
+  class Timer {
+   public:
+    Timer(Metrics *metrics, const std::string &name,
+          const std::string &labels);
+    ~Timer();
+
+   private:
+    Metrics *metrics_;
+    const std::string name_;
+    const std::string labels_;
+    const uint64_t start_;
+  };
+
+ private:
+  enum Type {
+    COUNTER,
+    GAUGE,
+    HISTOGRAM,
+  };
+
+  struct Series {
+    Series() : value(0), count(0) {}
+
+    // The value of a counter or gauge, or the sum of a histogram.
+    double value;
+    uint64_t count;
+    // Observations per bucket, not cumulative.
+    std::vector<uint64_t> buckets;
+  };
+
+  struct Family {
+    Type type;
+    std::string help;
+    std::vector<double> buckets;
+    // By labels.
+    std::map<std::string, Series> series;
+  };
+
+  void Define(const std::string &name, Type type, const std::string &help,
+              const std::vector<double> &buckets);
+  // The series |labels| of the metric |name|, which must be a histogram
+  // if |histogram|, and a counter or gauge otherwise. Call with |mutex_|
+  // held.
+  Series *GetSeries(const std::string &name, const std::string &labels,
+                    bool histogram);
+  // |labels| with those of this view added.
+  std::string Labels(const std::string &labels) const;
+
+  // NULL unless this is a view.
+  Metrics *const parent_;
+  const std::string labels_;
+  mutable pthread_mutex_t mutex_;
+  std::map<std::string, Family> families_;
+};
+
+}  // namespace util
+
+#endif  // UTIL_METRICS_H
@@ -0,0 +1,117 @@
+#include "util/metrics.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "util/memory_usage.h"
+#include "util/testing.h"
+
+namespace {
+
+using std::string;
+using util::Metrics;
+
+TEST(MetricsTest, Counter) {
+  Metrics metrics;
+  metrics.DefineCounter("requests_total", "Requests served.");
+  metrics.Increment("requests_total", "endpoint=\"get-sth\"");
+  metrics.Increment("requests_total", "endpoint=\"get-sth\"", 2);
+  metrics.Increment("requests_total", "");
+  EXPECT_EQ(3, metrics.Value("requests_total", "endpoint=\"get-sth\""));
+  EXPECT_EQ(0, metrics.Value("requests_total", "endpoint=\"get-roots\""));
+
+  metrics.Set("requests_total", "", 1234567890123.0);
+  EXPECT_EQ("# HELP requests_total Requests served.\n"
+            "# TYPE requests_total counter\n"
+            "requests_total 1234567890123\n"
+            "requests_total{endpoint=\"get-sth\"} 3\n",
+            metrics.Export());
+}
+
+TEST(MetricsTest, Gauge) {
+  Metrics metrics;
+  metrics.DefineGauge("tree_size", "Entries in the tree.");
+  metrics.Set("tree_size", "", 10);
+  metrics.Increment("tree_size", "", -2.5);
+  EXPECT_EQ(7.5, metrics.Value("tree_size", ""));
+  EXPECT_EQ("# HELP tree_size Entries in the tree.\n"
+            "# TYPE tree_size gauge\n"
+            "tree_size 7.5\n", metrics.Export());
+}
+
+TEST(MetricsTest, Histogram) {
+  Metrics metrics;
+  std::vector<double> buckets;
+  buckets.push_back(0.5);
+  buckets.push_back(1);
+  metrics.DefineHistogram("latency_seconds", "Latency.", buckets);
+  metrics.Observe("latency_seconds", "op=\"read\"", 0.25);
+  metrics.Observe("latency_seconds", "op=\"read\"", 1);
+  metrics.Observe("latency_seconds", "op=\"read\"", 4);
+  EXPECT_EQ("# HELP latency_seconds Latency.\n"
+            "# TYPE latency_seconds histogram\n"
+            "latency_seconds_bucket{op=\"read\",le=\"0.5\"} 1\n"
+            "latency_seconds_bucket{op=\"read\",le=\"1\"} 2\n"
+            "latency_seconds_bucket{op=\"read\",le=\"+Inf\"} 3\n"
+            "latency_seconds_sum{op=\"read\"} 5.25\n"
+            "latency_seconds_count{op=\"read\"} 3\n", metrics.Export());
+}
+
+TEST(MetricsTest, Timer) {
+  Metrics metrics;
+  metrics.DefineHistogram("latency_seconds", "Latency.",
+                          Metrics::LatencyBuckets());
+  {
+    Metrics::Timer timer(&metrics, "latency_seconds", "");
+    Metrics::Timer ignored(NULL, "latency_seconds", "");
+  }
+  EXPECT_NE(string::npos,
+            metrics.Export().find("latency_seconds_count 1\n"));
+}
+
+TEST(MetricsTest, View) {
+  Metrics metrics;
+  Metrics view(&metrics, "log=\"a\"");
+  view.DefineCounter("requests_total", "Requests served.");
+  view.Increment("requests_total", "endpoint=\"get-sth\"");
+  view.Increment("requests_total", "");
+  metrics.Increment("requests_total", "", 2);
+  EXPECT_EQ(1, view.Value("requests_total", ""));
+  EXPECT_EQ(1, metrics.Value("requests_total", "log=\"a\""));
+  EXPECT_EQ("# HELP requests_total Requests served.\n"
+            "# TYPE requests_total counter\n"
+            "requests_total 2\n"
+            "requests_total{log=\"a\"} 1\n"
+            "requests_total{log=\"a\",endpoint=\"get-sth\"} 1\n",
+            view.Export());
+  EXPECT_EQ(metrics.Export(), view.Export());
+}
+
+TEST(MetricsTest, MemoryUsage) {
+  Metrics metrics;
+  util::MemoryUsage usage(100, 2);
+  usage.Add(util::MemoryUsage(20, 1));
+  util::ExportMemoryUsage("leaf_index", usage, &metrics);
+  util::ExportMemoryUsage("proof_cache", util::MemoryUsage(), &metrics);
+  EXPECT_EQ(120, metrics.Value("ct_memory_bytes",
+                               "structure=\"leaf_index\""));
+  EXPECT_EQ(3, metrics.Value("ct_memory_elements",
+                             "structure=\"leaf_index\""));
+  EXPECT_EQ(0, metrics.Value("ct_memory_bytes",
+                             "structure=\"proof_cache\""));
+}
+
+TEST(MetricsDeathTest, Undefined) {
+  Metrics metrics;
+  metrics.DefineGauge("tree_size", "Entries in the tree.");
+  EXPECT_DEATH(metrics.Increment("requests_total", ""), "Undefined");
+  EXPECT_DEATH(metrics.Observe("tree_size", "", 1), "Wrong type");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,268 @@
+#include "util/profiler.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "util/util.h"
+
+#ifdef HAVE_TCMALLOC
+#include <gperftools/malloc_extension.h>
+#endif
+
+using std::string;
+
+namespace util {
+
+namespace {
+
+// Frames kept per CPU sample.
+const int kMaxDepth = 32;
+// CPU samples kept per profile, at most; about 35 MB of them.
+const size_t kMaxSamples = 1 << 17;
+// The frames of the signal handler and the signal trampoline, which sit
+// above the interrupted code.
+const int kSkippedFrames = 2;
+
+struct Sample {
+  uintptr_t depth;
+  void *pcs[kMaxDepth];
+};
+
+// One CPU profile at a time.
+pthread_mutex_t cpu_profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Where the SIGPROF handler records, while |sampling| is set. Samples
+// beyond |max_samples| are dropped.
+Sample *samples = NULL;
+size_t max_samples = 0;
+volatile size_t next_sample = 0;
+volatile int sampling = 0;
+// SIGPROF handlers running, which must finish before |samples| is read.
+volatile int in_handler = 0;
+
+void OnProfileSignal(int) {
+  const int saved_errno = errno;
+  // Counted before |sampling| is looked at, so that StopSampling() can
+  // wait for any handler that saw it set.
+  __sync_fetch_and_add(&in_handler, 1);
+  if (sampling) {
+    const size_t i = __sync_fetch_and_add(&next_sample, 1);
+    if (i < max_samples) {
+      void *pcs[kMaxDepth + kSkippedFrames];
+      const int depth = backtrace(pcs, kMaxDepth + kSkippedFrames);
+      Sample *sample = &samples[i];
+      sample->depth = 0;
+      for (int j = kSkippedFrames; j < depth; ++j)
+        sample->pcs[sample->depth++] = pcs[j];
+    }
+  }
+  __sync_fetch_and_sub(&in_handler, 1);
+  errno = saved_errno;
+}
+
+void SetProfileTimer(int hz) {
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = hz > 0 ? 1000000 / hz : 0;
+  timer.it_value = timer.it_interval;
+  PCHECK(setitimer(ITIMER_PROF, &timer, NULL) == 0);
+}
+
+void StartSampling(int hz) {
+  static bool installed = false;
+  if (!installed) {
+    // backtrace() loads what it needs on its first call, which is not
+    // safe in a signal handler.
+    void *pc;
+    backtrace(&pc, 1);
+    // The handler stays, so that a SIGPROF still pending when a profile
+    // stops is harmless.
+    struct sigaction action;
+    action.sa_handler = OnProfileSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    PCHECK(sigaction(SIGPROF, &action, NULL) == 0);
+    installed = true;
+  }
+  next_sample = 0;
+  __sync_synchronize();
+  sampling = 1;
+  SetProfileTimer(hz);
+}
+
+// Returns the number of samples taken.
+size_t StopSampling() {
+  SetProfileTimer(0);
+  sampling = 0;
+  __sync_synchronize();
+  while (__sync_fetch_and_add(&in_handler, 0) != 0)
+    sched_yield();
+  return next_sample;
+}
+
+void AppendWord(uintptr_t word, string *out) {
+  out->append(reinterpret_cast<const char*>(&word), sizeof word);
+}
+
+// The memory map of the process, which pprof needs to symbolize the
+// samples. It has no size to read up to, so it is read to the end.
+void AppendMaps(string *out) {
+  const int fd = open("/proc/self/maps", O_RDONLY);
+  if (fd < 0) {
+    PLOG(WARNING) << "Failed to read /proc/self/maps";
+    return;
+  }
+  char buf[4096];
+  ssize_t got;
+  while ((got = read(fd, buf, sizeof buf)) > 0)
+    out->append(buf, got);
+  close(fd);
+}
+
+// The legacy binary CPU profile format of gperftools, which pprof reads:
+// a header, the samples, a trailer, and the memory map.
+void EncodeProfile(int hz, size_t count, string *out) {
+  out->clear();
+  AppendWord(0, out);
+  AppendWord(3, out);
+  AppendWord(0, out);
+  AppendWord(1000000 / hz, out);
+  AppendWord(0, out);
+  for (size_t i = 0; i < count; ++i) {
+    AppendWord(1, out);
+    AppendWord(samples[i].depth, out);
+    for (uintptr_t j = 0; j < samples[i].depth; ++j)
+      AppendWord(reinterpret_cast<uintptr_t>(samples[i].pcs[j]), out);
+  }
+  AppendWord(0, out);
+  AppendWord(1, out);
+  AppendWord(0, out);
+  AppendMaps(out);
+}
+
+// Posted by the signal handler of ProfileOnSignal(), which is all it may
+// safely do.
+sem_t profile_requests;
+
+struct SignalProfile {
+  string dir;
+  string name;
+  int seconds;
+};
+
+void OnProfileRequest(int) {
+  sem_post(&profile_requests);
+}
+
+void WriteProfile(const SignalProfile &request, const char *kind,
+                  const string &profile) {
+  const string file = WriteTemporaryBinaryFile(
+      request.dir + "/" + request.name + "." + kind + ".XXXXXX", profile);
+  if (file.empty())
+    LOG(ERROR) << "Failed to write a " << kind << " profile in "
+               << request.dir;
+  else
+    LOG(INFO) << "Wrote a " << kind << " profile to " << file;
+}
+
+void *ProfileRequestThread(void *arg) {
+  const SignalProfile *request = static_cast<SignalProfile*>(arg);
+  for (;;) {
+    if (sem_wait(&profile_requests) != 0) {
+      PCHECK(errno == EINTR);
+      continue;
+    }
+    LOG(INFO) << "Profiling the CPU for " << request->seconds << " seconds";
+    string profile, error;
+    if (ProfileCPU(request->seconds, kDefaultProfileHz, &profile, &error))
+      WriteProfile(*request, "cpu", profile);
+    else
+      LOG(WARNING) << "No CPU profile: " << error;
+    if (ProfileHeap(&profile, &error))
+      WriteProfile(*request, "heap", profile);
+    // Drop the requests made meanwhile.
+    while (sem_trywait(&profile_requests) == 0) {}
+  }
+  return NULL;
+}
+
+}  // namespace
+
+bool ProfileCPU(int seconds, int hz, string *profile, string *error) {
+  CHECK_GT(seconds, 0);
+  CHECK_GT(hz, 0);
+  CHECK_LE(hz, 1000000);
+  if (pthread_mutex_trylock(&cpu_profile_mutex) != 0) {
+    *error = "A CPU profile is already running";
+    return false;
+  }
+  // The timer counts the CPU time of all threads, so room for that of all
+  // cores, and a little more for slack.
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores < 1)
+    cores = 1;
+  std::vector<Sample> buffer(std::min(
+      static_cast<size_t>(seconds) * hz * cores + hz, kMaxSamples));
+  samples = &buffer[0];
+  max_samples = buffer.size();
+
+  StartSampling(hz);
+  // Sleeps again if a signal cuts it short.
+  struct timespec left = { seconds, 0 };
+  while (nanosleep(&left, &left) != 0)
+    PCHECK(errno == EINTR);
+  size_t count = StopSampling();
+  if (count > max_samples) {
+    LOG(WARNING) << "Dropped " << count - max_samples << " CPU samples";
+    count = max_samples;
+  }
+
+  EncodeProfile(hz, count, profile);
+  samples = NULL;
+  max_samples = 0;
+  CHECK_EQ(0, pthread_mutex_unlock(&cpu_profile_mutex));
+  return true;
+}
+
+bool ProfileHeap(string *profile, string *error) {
+#ifdef HAVE_TCMALLOC
+  profile->clear();
+  MallocExtension::instance()->GetHeapSample(profile);
+  return true;
+#else
+  *error = "Heap profiles need a build with TCMALLOC=1";
+  return false;
+#endif
+}
+
+void ProfileOnSignal(int signal, const string &dir, const string &name,
+                     int seconds) {
+  CHECK_GT(seconds, 0);
+  PCHECK(sem_init(&profile_requests, 0, 0) == 0);
+  SignalProfile *request = new SignalProfile;
+  request->dir = dir;
+  request->name = name;
+  request->seconds = seconds;
+  pthread_t thread;
+  CHECK_EQ(0, pthread_create(&thread, NULL, ProfileRequestThread, request));
+  CHECK_EQ(0, pthread_detach(thread));
+
+  struct sigaction action;
+  action.sa_handler = OnProfileRequest;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  PCHECK(sigaction(signal, &action, NULL) == 0);
+}
+
+}  // namespace util
@@ -0,0 +1,40 @@
+#ifndef UTIL_PROFILER_H
+#define UTIL_PROFILER_H
+
+#include <string>
+
+namespace util {
+
+// Profiles the whole process on demand, so that a live server can be
+// profiled without restarting it under perf. The profiles are in the
+// formats pprof reads: run "pprof <binary> <profile>".
+//
+// CPU profiles are sampled by a built-in profiler, with SIGPROF, so they
+// cost nothing unless one is running. Heap profiles are tcmalloc's sample
+// of the live heap; they need the binary built with "make TCMALLOC=1", and
+// run with TCMALLOC_SAMPLE_PARAMETER set, e.g. to 524288 for a sample
+// every 512 KB allocated.
+
+// How often CPU profiles sample, by default.
+const int kDefaultProfileHz = 100;
+
+// Sample the CPU time of all threads for |seconds|, |hz| times a CPU
+// second, and set |profile| to the result. Blocks meanwhile. Returns
+// false, with |error| set, if another CPU profile is running.
+bool ProfileCPU(int seconds, int hz, std::string *profile, std::string *error);
+
+// Set |profile| to a sample of the live heap. Returns false, with |error|
+// set, if there is no heap sampler.
+bool ProfileHeap(std::string *profile, std::string *error);
+
+// From now on, on |signal|, write a CPU profile of the next |seconds|, and
+// a heap profile if it can, to new files in |dir| whose names start with
+// |name|, and log their names. The profiles are taken by a thread of its
+// own, so call this before starting threads that block |signal|, if any.
+// Signals that arrive while profiling are ignored. Call once.
+void ProfileOnSignal(int signal, const std::string &dir,
+                     const std::string &name, int seconds);
+
+}  // namespace util
+
+#endif  // UTIL_PROFILER_H
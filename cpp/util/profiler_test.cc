@@ -0,0 +1,66 @@
+#include "util/profiler.h"
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include "util/testing.h"
+
+namespace {
+
+using std::string;
+
+volatile bool burning = false;
+
+void *BurnCPU(void *) {
+  volatile uint64_t sum = 0;
+  while (burning)
+    sum += 1;
+  return NULL;
+}
+
+uintptr_t Word(const string &profile, size_t i) {
+  uintptr_t word;
+  memcpy(&word, profile.data() + i * sizeof word, sizeof word);
+  return word;
+}
+
+TEST(ProfilerTest, ProfileCPU) {
+  burning = true;
+  pthread_t thread;
+  ASSERT_EQ(0, pthread_create(&thread, NULL, BurnCPU, NULL));
+  string profile, error;
+  EXPECT_TRUE(util::ProfileCPU(1, 100, &profile, &error));
+  burning = false;
+  ASSERT_EQ(0, pthread_join(thread, NULL));
+
+  // The header, with 10000 microseconds between samples.
+  ASSERT_GT(profile.size(), 8 * sizeof(uintptr_t));
+  EXPECT_EQ(0U, Word(profile, 0));
+  EXPECT_EQ(3U, Word(profile, 1));
+  EXPECT_EQ(0U, Word(profile, 2));
+  EXPECT_EQ(10000U, Word(profile, 3));
+  EXPECT_EQ(0U, Word(profile, 4));
+  // A second of burning takes some samples, each of one count and a stack.
+  EXPECT_EQ(1U, Word(profile, 5));
+  EXPECT_GT(Word(profile, 6), 0U);
+  // The memory map, after the trailer.
+  EXPECT_NE(string::npos, profile.find("[stack]"));
+}
+
+#ifndef HAVE_TCMALLOC
+TEST(ProfilerTest, NoHeapProfile) {
+  string profile, error;
+  EXPECT_FALSE(util::ProfileHeap(&profile, &error));
+  EXPECT_FALSE(error.empty());
+}
+#endif
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
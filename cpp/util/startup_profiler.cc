@@ -0,0 +1,193 @@
+#include "util/startup_profiler.h"
+
+#include <glog/logging.h>
+#include <iomanip>
+#include <pthread.h>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+#include "util/util.h"
+
+using std::string;
+
+namespace util {
+
+namespace {
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+long PeakRSSKilobytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  // Linux reports it in kilobytes already.
+  return usage.ru_maxrss;
+}
+
+// |microseconds| in seconds, to the millisecond.
+string Seconds(uint64_t microseconds) {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(3) << microseconds / 1e6 << "s";
+  return out.str();
+}
+
+}  // namespace
+
+StartupProfiler *StartupProfiler::global_ = NULL;
+
+StartupProfiler::StartupProfiler(uint32_t log_seconds)
+    : log_seconds_(log_seconds),
+      created_(TimeInMicroseconds()) {
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+}
+
+StartupProfiler::~StartupProfiler() {
+  CHECK_EQ(0, pthread_mutex_destroy(&mutex_));
+}
+
+// static
+void StartupProfiler::SetGlobal(StartupProfiler *profiler) {
+  global_ = profiler;
+}
+
+// static
+string StartupProfiler::Progress(const char *name, const char *unit,
+                                 uint64_t done, uint64_t total) {
+  std::ostringstream out;
+  out << name << ": " << done;
+  if (total > 0)
+    out << "/" << total;
+  out << " " << unit;
+  return out.str();
+}
+
+string StartupProfiler::Report() const {
+  const uint64_t now = TimeInMicroseconds() - created_;
+  std::ostringstream out;
+  out << "Startup phases:";
+  ScopedLock lock(&mutex_);
+  for (size_t i = 0; i < phases_.size(); ++i) {
+    const Record &record = phases_[i];
+    out << "\n  ";
+    if (record.phase != NULL) {
+      // Phases set their total before they count towards it.
+      const uint64_t done = __sync_fetch_and_add(&record.phase->done_, 0);
+      if (record.unit != NULL)
+        out << Progress(record.name, record.unit, done, record.phase->total_)
+            << ", ";
+      else
+        out << record.name << ": ";
+      out << "in progress since " << Seconds(record.start) << " ("
+          << Seconds(now - record.start) << ")";
+      continue;
+    }
+    out << record.name << ": " << Seconds(record.start) << " to "
+        << Seconds(record.end) << " (" << Seconds(record.end - record.start)
+        << ")";
+    if (record.unit != NULL) {
+      out << ", " << record.done;
+      if (record.total > 0 && record.total != record.done)
+        out << "/" << record.total;
+      out << " " << record.unit;
+    }
+    out << ", peak RSS " << record.peak_rss_kb / 1024 << " MB";
+  }
+  return out.str();
+}
+
+size_t StartupProfiler::PhaseCount() const {
+  ScopedLock lock(&mutex_);
+  return phases_.size();
+}
+
+StartupProfiler::Phase::Phase(const char *name)
+    : profiler_(global_),
+      name_(name),
+      unit_(NULL),
+      index_(0),
+      total_(0),
+      done_(0),
+      next_log_(0) {
+  Start();
+}
+
+StartupProfiler::Phase::Phase(const char *name, const char *unit)
+    : profiler_(global_),
+      name_(name),
+      unit_(unit),
+      index_(0),
+      total_(0),
+      done_(0),
+      next_log_(0) {
+  Start();
+}
+
+void StartupProfiler::Phase::Start() {
+  if (profiler_ == NULL)
+    return;
+  LOG(INFO) << "Startup phase: " << name_;
+  Record record;
+  record.name = name_;
+  record.unit = unit_;
+  record.start = TimeInMicroseconds() - profiler_->created_;
+  record.end = 0;
+  record.total = 0;
+  record.done = 0;
+  record.peak_rss_kb = 0;
+  record.phase = this;
+  if (profiler_->log_seconds_ > 0)
+    next_log_ = TimeInMilliseconds() + profiler_->log_seconds_ * 1000ULL;
+
+  ScopedLock lock(&profiler_->mutex_);
+  index_ = profiler_->phases_.size();
+  profiler_->phases_.push_back(record);
+}
+
+StartupProfiler::Phase::~Phase() {
+  if (profiler_ == NULL)
+    return;
+  const uint64_t end = TimeInMicroseconds() - profiler_->created_;
+  const long peak_rss_kb = PeakRSSKilobytes();
+  ScopedLock lock(&profiler_->mutex_);
+  Record *record = &profiler_->phases_[index_];
+  record->end = end;
+  record->total = total_;
+  record->done = done_;
+  record->peak_rss_kb = peak_rss_kb;
+  record->phase = NULL;
+}
+
+void StartupProfiler::Phase::SetTotal(uint64_t total) {
+  total_ = total;
+}
+
+void StartupProfiler::Phase::Add(uint64_t count) {
+  if (profiler_ == NULL)
+    return;
+  const uint64_t done = __sync_add_and_fetch(&done_, count);
+  if (next_log_ == 0 || unit_ == NULL)
+    return;
+  // Whichever thread moves the time on logs.
+  const uint64_t next_log = next_log_;
+  const uint64_t now = TimeInMilliseconds();
+  if (now < next_log ||
+      !__sync_bool_compare_and_swap(
+          &next_log_, next_log, now + profiler_->log_seconds_ * 1000ULL))
+    return;
+  LOG(INFO) << Progress(name_, unit_, done, total_);
+}
+
+}  // namespace util
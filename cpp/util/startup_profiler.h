@@ -0,0 +1,105 @@
+#ifndef UTIL_STARTUP_PROFILER_H
+#define UTIL_STARTUP_PROFILER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace util {
+
+// Records the phases of a server's startup: when each starts and ends, how
+// many entries it gets through and the peak RSS when it ends. Phases in
+// progress log how far they are every few seconds, e.g.
+// "rebuilding tree: 41000000/90000000 leaves".
+//
+// Phases record to the global profiler, so that the code that loads
+// things needs no profiler handed down to it; without one they do nothing.
+//
+//   StartupProfiler::Phase phase("rebuilding tree", "leaves");
+//   phase.SetTotal(tree_size);
+//   ...
+//   phase.Add(leaves);
+//
+// Thread-safe.
+class StartupProfiler {
+ public:
+  // Phases log their progress every |log_seconds|, or never if it is 0.
+  explicit StartupProfiler(uint32_t log_seconds);
+  ~StartupProfiler();
+
+  // Make |profiler|, which may be NULL, the one phases record to. Set it
+  // before startup begins, and keep it while phases may run.
+  static void SetGlobal(StartupProfiler *profiler);
+
+  // One line for each phase so far, in the order they started, with its
+  // start and end relative to the profiler's creation; phases in progress
+  // show how far they are.
+  std::string Report() const;
+
+  // The number of phases so far, for testing.
+  size_t PhaseCount() const;
+
+  // Times its scope as a phase. |name| and |unit| must outlive the
+  // profiler, e.g. be literals; |unit| is what the phase counts, if
+  // anything.
+  class Phase {
+   public:
+    explicit Phase(const char *name);
+    Phase(const char *name, const char *unit);
+    ~Phase();
+
+    // The number of entries the phase will get through, if known.
+    void SetTotal(uint64_t total);
+
+    // Count |count| more entries done. May be called from several threads.
+    void Add(uint64_t count);
+
+   private:
+    friend class StartupProfiler;
+
+    void Start();
+
+    StartupProfiler *const profiler_;
+    const char *const name_;
+    const char *const unit_;
+    size_t index_;
+    uint64_t total_;
+    uint64_t done_;
+    // When to log progress next, in milliseconds.
+    uint64_t next_log_;
+
+    // Private declarations without definitions, to disallow copying.
+    Phase(const Phase&);
+    Phase &operator=(const Phase&);
+  };
+
+ private:
+  struct Record {
+    const char *name;
+    const char *unit;
+    // In microseconds since the profiler's creation.
+    uint64_t start;
+    uint64_t end;
+    uint64_t total;
+    uint64_t done;
+    long peak_rss_kb;
+    // While the phase is in progress.
+    Phase *phase;
+  };
+
+  // The progress of a phase, e.g. "rebuilding tree: 41/90 leaves".
+  static std::string Progress(const char *name, const char *unit,
+                              uint64_t done, uint64_t total);
+
+  static StartupProfiler *global_;
+
+  const uint32_t log_seconds_;
+  const uint64_t created_;
+  mutable pthread_mutex_t mutex_;
+  std::vector<Record> phases_;
+};
+
+}  // namespace util
+
+#endif  // UTIL_STARTUP_PROFILER_H
@@ -0,0 +1,73 @@
+#include "util/startup_profiler.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+#include "util/testing.h"
+
+namespace {
+
+using std::string;
+using util::StartupProfiler;
+
+class StartupProfilerTest : public ::testing::Test {
+ protected:
+  ~StartupProfilerTest() { StartupProfiler::SetGlobal(NULL); }
+};
+
+TEST_F(StartupProfilerTest, NoProfiler) {
+  // Phases without a profiler do nothing.
+  {
+    StartupProfiler::Phase phase("loading", "entries");
+    phase.Add(3);
+  }
+  StartupProfiler profiler(0);
+  EXPECT_EQ(0U, profiler.PhaseCount());
+}
+
+TEST_F(StartupProfilerTest, RecordsPhases) {
+  StartupProfiler profiler(0);
+  StartupProfiler::SetGlobal(&profiler);
+  {
+    StartupProfiler::Phase phase("loading trust store");
+  }
+  {
+    StartupProfiler::Phase phase("rebuilding tree", "leaves");
+    phase.SetTotal(90);
+    phase.Add(40);
+    phase.Add(50);
+  }
+  {
+    StartupProfiler::Phase phase("reading entries", "entries");
+    phase.SetTotal(10);
+    phase.Add(4);
+  }
+  EXPECT_EQ(3U, profiler.PhaseCount());
+
+  const string report = profiler.Report();
+  EXPECT_EQ(0U, report.find("Startup phases:\n  loading trust store: "));
+  EXPECT_EQ(string::npos, report.find("in progress"));
+  const size_t tree = report.find("\n  rebuilding tree: ");
+  ASSERT_NE(string::npos, tree);
+  EXPECT_NE(string::npos, report.find("s), 90 leaves, peak RSS ", tree));
+  // Phases that end early show how far they got.
+  EXPECT_NE(string::npos, report.find("s), 4/10 entries, peak RSS "));
+}
+
+TEST_F(StartupProfilerTest, ReportsProgress) {
+  StartupProfiler profiler(0);
+  StartupProfiler::SetGlobal(&profiler);
+  StartupProfiler::Phase phase("rebuilding tree", "leaves");
+  phase.SetTotal(90);
+  phase.Add(41);
+  const string report = profiler.Report();
+  EXPECT_NE(string::npos, report.find(
+      "\n  rebuilding tree: 41/90 leaves, in progress since "));
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -58,7 +58,8 @@ class TestDB {
   // Build a second database from the current disk state. Caller owns result.
   // Meant to be used for testing resumes from disk.
   // Concurrent behaviour is undefined (depends on the Database implementation).
-  T *SecondDB() const;
+  // Databases that can only be open once close db() first.
+  T *SecondDB();
 
  private:
   TmpStorage tmp_;
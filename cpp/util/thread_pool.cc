@@ -0,0 +1,279 @@
+#include "util/thread_pool.h"
+
+#include <glog/logging.h>
+#include <sched.h>
+#include <unistd.h>
+
+namespace util {
+
+namespace {
+
+// The pool, and the index of the queue, of the worker running this thread,
+// if any.
+__thread ThreadPool *current_pool = NULL;
+__thread size_t current_queue = 0;
+
+pthread_once_t default_once = PTHREAD_ONCE_INIT;
+ThreadPool *default_pool = NULL;
+bool default_configured = false;
+size_t default_threads = 0;
+bool default_pin = false;
+
+void CreateDefault() {
+  default_pool = new ThreadPool(
+      default_configured ? default_threads : ThreadPool::DefaultThreads(),
+      default_pin);
+}
+
+size_t Cpus() {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? cpus : 1;
+}
+
+void Pin(pthread_t thread, size_t index) {
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(index % Cpus(), &cpus);
+  int ret = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+  LOG_IF(WARNING, ret != 0) << "Could not pin worker " << index
+                            << " to a CPU: error " << ret;
+#else
+  LOG_IF(WARNING, index == 0) << "Workers cannot be pinned to CPUs here";
+#endif
+}
+
+struct RangeTask {
+  ThreadPool::RangeFunction function;
+  void *arg;
+  size_t chunk;
+  size_t begin;
+  size_t end;
+};
+
+void RunRange(void *arg) {
+  const RangeTask *task = static_cast<const RangeTask*>(arg);
+  task->function(task->arg, task->chunk, task->begin, task->end);
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t threads, bool pin)
+    : workers_(threads),
+      next_queue_(0),
+      queued_(0),
+      sleeping_(0),
+      stop_(false) {
+  CHECK_EQ(0, pthread_mutex_init(&idle_mutex_, NULL));
+  CHECK_EQ(0, pthread_cond_init(&idle_, NULL));
+  const size_t queues = threads > 0 ? threads : 1;
+  for (size_t i = 0; i < queues; ++i) {
+    queues_.push_back(new Queue);
+    CHECK_EQ(0, pthread_mutex_init(&queues_.back()->mutex, NULL));
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    workers_[i].pool = this;
+    workers_[i].index = i;
+    CHECK_EQ(0, pthread_create(&workers_[i].thread, NULL, WorkerThread,
+                               &workers_[i]));
+    if (pin)
+      Pin(workers_[i].thread, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  CHECK_EQ(0, pthread_mutex_lock(&idle_mutex_));
+  stop_ = true;
+  CHECK_EQ(0, pthread_cond_broadcast(&idle_));
+  CHECK_EQ(0, pthread_mutex_unlock(&idle_mutex_));
+  for (size_t i = 0; i < workers_.size(); ++i)
+    CHECK_EQ(0, pthread_join(workers_[i].thread, NULL));
+  CHECK_EQ(0U, queued_);
+  for (size_t i = 0; i < queues_.size(); ++i) {
+    CHECK_EQ(0, pthread_mutex_destroy(&queues_[i]->mutex));
+    delete queues_[i];
+  }
+  CHECK_EQ(0, pthread_cond_destroy(&idle_));
+  CHECK_EQ(0, pthread_mutex_destroy(&idle_mutex_));
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t chunks,
+                             RangeFunction function, void *arg) {
+  CHECK_GT(chunks, 0U);
+  std::vector<RangeTask> tasks(chunks);
+  for (size_t i = 0; i < chunks; ++i) {
+    RangeTask task = { function, arg, i, count * i / chunks,
+                       count * (i + 1) / chunks };
+    tasks[i] = task;
+  }
+  TaskGroup group(this);
+  for (size_t i = 1; i < chunks; ++i)
+    group.Run(RunRange, &tasks[i]);
+  RunRange(&tasks[0]);
+  group.Wait();
+}
+
+// static
+ThreadPool *ThreadPool::Default() {
+  CHECK_EQ(0, pthread_once(&default_once, CreateDefault));
+  return default_pool;
+}
+
+// static
+void ThreadPool::ConfigureDefault(size_t threads, bool pin) {
+  CHECK(default_pool == NULL)
+      << "The default thread pool is already running";
+  default_configured = true;
+  default_threads = threads;
+  default_pin = pin;
+}
+
+// static
+size_t ThreadPool::DefaultThreads() {
+  return Cpus() - 1;
+}
+
+// static
+void *ThreadPool::WorkerThread(void *arg) {
+  Worker *worker = static_cast<Worker*>(arg);
+  current_pool = worker->pool;
+  current_queue = worker->index;
+  worker->pool->Work(worker->index);
+  return NULL;
+}
+
+void ThreadPool::Work(size_t index) {
+  for (;;) {
+    Task task;
+    if (Take(index, &task)) {
+      Run(task);
+      continue;
+    }
+    CHECK_EQ(0, pthread_mutex_lock(&idle_mutex_));
+    // A full barrier between announcing that we sleep and looking at the
+    // queues, just as Push() has one between queueing and looking for
+    // sleepers: one of the two sees the other.
+    __sync_add_and_fetch(&sleeping_, 1);
+    while (__sync_fetch_and_add(&queued_, 0) == 0 && !stop_)
+      CHECK_EQ(0, pthread_cond_wait(&idle_, &idle_mutex_));
+    __sync_sub_and_fetch(&sleeping_, 1);
+    const bool stop = stop_ && __sync_fetch_and_add(&queued_, 0) == 0;
+    CHECK_EQ(0, pthread_mutex_unlock(&idle_mutex_));
+    if (stop)
+      return;
+  }
+}
+
+void ThreadPool::Push(const Task &task) {
+  const size_t queue = current_pool == this ?
+      current_queue :
+      __sync_fetch_and_add(&next_queue_, 1) % queues_.size();
+  CHECK_EQ(0, pthread_mutex_lock(&queues_[queue]->mutex));
+  queues_[queue]->tasks.push_back(task);
+  CHECK_EQ(0, pthread_mutex_unlock(&queues_[queue]->mutex));
+  __sync_add_and_fetch(&queued_, 1);
+  if (__sync_fetch_and_add(&sleeping_, 0) > 0) {
+    CHECK_EQ(0, pthread_mutex_lock(&idle_mutex_));
+    CHECK_EQ(0, pthread_cond_signal(&idle_));
+    CHECK_EQ(0, pthread_mutex_unlock(&idle_mutex_));
+  }
+}
+
+bool ThreadPool::Take(size_t own, Task *task) {
+  if (__sync_fetch_and_add(&queued_, 0) == 0)
+    return false;
+  const size_t queues = queues_.size();
+  if (own < queues) {
+    Queue *queue = queues_[own];
+    CHECK_EQ(0, pthread_mutex_lock(&queue->mutex));
+    const bool found = !queue->tasks.empty();
+    if (found) {
+      *task = queue->tasks.back();
+      queue->tasks.pop_back();
+    }
+    CHECK_EQ(0, pthread_mutex_unlock(&queue->mutex));
+    if (found) {
+      __sync_sub_and_fetch(&queued_, 1);
+      return true;
+    }
+  }
+  // Steal, starting from the next queue along, so that thieves spread out.
+  for (size_t i = 1; i <= queues; ++i) {
+    const size_t victim = (own + i) % queues;
+    if (victim == own)
+      continue;
+    Queue *queue = queues_[victim];
+    CHECK_EQ(0, pthread_mutex_lock(&queue->mutex));
+    const bool found = !queue->tasks.empty();
+    if (found) {
+      *task = queue->tasks.front();
+      queue->tasks.pop_front();
+    }
+    CHECK_EQ(0, pthread_mutex_unlock(&queue->mutex));
+    if (found) {
+      __sync_sub_and_fetch(&queued_, 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::RunOne() {
+  Task task;
+  if (!Take(current_pool == this ? current_queue : queues_.size(), &task))
+    return false;
+  Run(task);
+  return true;
+}
+
+// static
+void ThreadPool::Run(const Task &task) {
+  task.function(task.arg);
+  task.group->Done();
+}
+
+TaskGroup::TaskGroup(ThreadPool *pool) : pool_(pool), pending_(0) {
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+  CHECK_EQ(0, pthread_cond_init(&done_, NULL));
+}
+
+TaskGroup::~TaskGroup() {
+  Wait();
+  CHECK_EQ(0, pthread_cond_destroy(&done_));
+  CHECK_EQ(0, pthread_mutex_destroy(&mutex_));
+}
+
+void TaskGroup::Run(ThreadPool::Function function, void *arg) {
+  CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+  ++pending_;
+  CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+  ThreadPool::Task task = { function, arg, this };
+  pool_->Push(task);
+}
+
+void TaskGroup::Wait() {
+  for (;;) {
+    CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+    const bool done = pending_ == 0;
+    CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+    if (done || !pool_->RunOne())
+      break;
+  }
+  // Nothing is queued that we could help with, so whatever is left of ours
+  // is running elsewhere.
+  CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+  while (pending_ > 0)
+    CHECK_EQ(0, pthread_cond_wait(&done_, &mutex_));
+  CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+}
+
+void TaskGroup::Done() {
+  // Signalled under the lock, so that the group cannot be destroyed before
+  // we are done with it.
+  CHECK_EQ(0, pthread_mutex_lock(&mutex_));
+  if (--pending_ == 0)
+    CHECK_EQ(0, pthread_cond_broadcast(&done_));
+  CHECK_EQ(0, pthread_mutex_unlock(&mutex_));
+}
+
+}  // namespace util
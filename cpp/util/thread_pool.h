@@ -0,0 +1,141 @@
+#ifndef UTIL_THREAD_POOL_H
+#define UTIL_THREAD_POOL_H
+
+#include <deque>
+#include <pthread.h>
+#include <stddef.h>
+#include <vector>
+
+namespace util {
+
+class TaskGroup;
+
+// Worker threads for CPU-bound work that splits into independent tasks,
+// such as hashing a batch of leaves or signing a batch of SCTs, to share
+// across the process instead of each starting threads of its own.
+//
+// Each worker has its own deque of tasks: it runs the newest of its own
+// first, and when it has none, steals the oldest of another's. Threads that
+// wait for a TaskGroup run queued tasks too, so waiting from inside a task
+// cannot deadlock, and a pool with no workers still gets everything done.
+class ThreadPool {
+ public:
+  typedef void (*Function)(void *arg);
+  // Runs part |chunk| of a ParallelFor(), the range [|begin|, |end|).
+  typedef void (*RangeFunction)(void *arg, size_t chunk, size_t begin,
+                                size_t end);
+
+  // Starts |threads| workers. With |pin|, worker i only runs on CPU i (mod
+  // the number of CPUs), where the platform allows it.
+  ThreadPool(size_t threads, bool pin);
+  // All task groups must have been waited for.
+  ~ThreadPool();
+
+  size_t Workers() const { return workers_.size(); }
+
+  // How many threads can work on a ParallelFor() at once: the workers and
+  // the caller.
+  size_t Parallelism() const { return workers_.size() + 1; }
+
+  // Split [0, |count|) into |chunks| ranges of nearly equal size (some
+  // empty if |chunks| > |count|) and call |function| on each, returning
+  // once all calls have. The calling thread runs chunk 0 itself.
+  void ParallelFor(size_t count, size_t chunks, RangeFunction function,
+                   void *arg);
+
+  // The process's shared pool, started on first use with
+  // ConfigureDefault()'s settings: by default, a worker for every CPU but
+  // one, since callers work as well, unpinned. It is never deleted.
+  static ThreadPool *Default();
+
+  // Set the workers and pinning of Default(). Call before its first use,
+  // e.g. early in main().
+  static void ConfigureDefault(size_t threads, bool pin);
+
+  // A worker for every CPU but one.
+  static size_t DefaultThreads();
+
+ private:
+  friend class TaskGroup;
+
+  struct Task {
+    Function function;
+    void *arg;
+    TaskGroup *group;
+  };
+
+  struct Queue {
+    pthread_mutex_t mutex;
+    std::deque<Task> tasks;
+  };
+
+  struct Worker {
+    ThreadPool *pool;
+    size_t index;
+    pthread_t thread;
+  };
+
+  static void *WorkerThread(void *arg);
+  void Work(size_t index);
+  // Queue |task| on the calling worker's deque, or, from any other thread,
+  // on the next deque in turn.
+  void Push(const Task &task);
+  // Take a task, the newest of the queue |own| or else the oldest of any
+  // other. |own| is queues_.size() for threads outside the pool.
+  bool Take(size_t own, Task *task);
+  // Run a task of any group, if one is queued. Returns whether it did.
+  bool RunOne();
+  static void Run(const Task &task);
+
+  std::vector<Worker> workers_;
+  // One per worker, or just one if there are none.
+  std::vector<Queue*> queues_;
+  // Where the next task from outside the pool goes, modulo queues_.size().
+  size_t next_queue_;
+  // Tasks in all queues. Updated with __sync builtins.
+  size_t queued_;
+  // Workers about to sleep or asleep on |idle_|.
+  size_t sleeping_;
+  bool stop_;
+  pthread_mutex_t idle_mutex_;
+  pthread_cond_t idle_;
+
+  // Private declarations without definitions, to disallow copying.
+  ThreadPool(const ThreadPool&);
+  ThreadPool &operator=(const ThreadPool&);
+};
+
+// Tasks run on a ThreadPool that can be waited for together. Run() and
+// Wait() are for the thread that created the group; tasks themselves may
+// start groups of their own, and wait for them.
+class TaskGroup {
+ public:
+  explicit TaskGroup(ThreadPool *pool);
+  // Waits for the tasks still running.
+  ~TaskGroup();
+
+  // Queue |function|(|arg|) to run on the pool.
+  void Run(ThreadPool::Function function, void *arg);
+
+  // Return once all tasks run so far have finished, running queued tasks,
+  // this group's or others', in the meantime.
+  void Wait();
+
+ private:
+  friend class ThreadPool;
+
+  void Done();
+
+  ThreadPool *const pool_;
+  size_t pending_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t done_;
+
+  // Private declarations without definitions, to disallow copying.
+  TaskGroup(const TaskGroup&);
+  TaskGroup &operator=(const TaskGroup&);
+};
+
+}  // namespace util
+
+#endif  // UTIL_THREAD_POOL_H
@@ -0,0 +1,134 @@
+#include "util/thread_pool.h"
+
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <vector>
+
+#include "util/testing.h"
+
+namespace {
+
+using util::TaskGroup;
+using util::ThreadPool;
+
+// Counts the calls for each index of a range, and the chunks.
+struct Coverage {
+  std::vector<int> calls;
+  std::vector<size_t> chunk_sizes;
+};
+
+void Cover(void *arg, size_t chunk, size_t begin, size_t end) {
+  Coverage *coverage = static_cast<Coverage*>(arg);
+  coverage->chunk_sizes[chunk] = end - begin;
+  for (size_t i = begin; i < end; ++i)
+    ++coverage->calls[i];
+}
+
+void ExpectCovered(ThreadPool *pool, size_t count, size_t chunks) {
+  Coverage coverage;
+  coverage.calls.resize(count);
+  coverage.chunk_sizes.resize(chunks, count + 1);
+  pool->ParallelFor(count, chunks, Cover, &coverage);
+  for (size_t i = 0; i < count; ++i)
+    EXPECT_EQ(1, coverage.calls[i]) << i;
+  for (size_t i = 0; i < chunks; ++i) {
+    EXPECT_LE(coverage.chunk_sizes[i], count / chunks + 1) << i;
+    EXPECT_GE(coverage.chunk_sizes[i], count / chunks) << i;
+  }
+}
+
+TEST(ThreadPoolTest, ParallelFor) {
+  ThreadPool pool(3, false);
+  EXPECT_EQ(3U, pool.Workers());
+  EXPECT_EQ(4U, pool.Parallelism());
+  ExpectCovered(&pool, 1000, 4);
+  ExpectCovered(&pool, 1001, 7);
+  ExpectCovered(&pool, 5, 1);
+  // More chunks than items: some are empty.
+  ExpectCovered(&pool, 3, 8);
+  ExpectCovered(&pool, 0, 2);
+}
+
+// Without workers, the caller does it all.
+TEST(ThreadPoolTest, NoWorkers) {
+  ThreadPool pool(0, false);
+  EXPECT_EQ(1U, pool.Parallelism());
+  ExpectCovered(&pool, 1000, 4);
+}
+
+TEST(ThreadPoolTest, Pinned) {
+  ThreadPool pool(2, true);
+  ExpectCovered(&pool, 1000, 3);
+}
+
+void Increment(void *arg) {
+  __sync_add_and_fetch(static_cast<int*>(arg), 1);
+}
+
+TEST(ThreadPoolTest, TaskGroup) {
+  ThreadPool pool(2, false);
+  int count = 0;
+  TaskGroup group(&pool);
+  for (int i = 0; i < 1000; ++i)
+    group.Run(Increment, &count);
+  group.Wait();
+  EXPECT_EQ(1000, count);
+  // Groups can be reused after waiting.
+  group.Run(Increment, &count);
+  group.Wait();
+  EXPECT_EQ(1001, count);
+}
+
+struct Nested {
+  ThreadPool *pool;
+  int count;
+};
+
+// Each task waits for tasks of its own, which only works if waiting
+// threads run queued tasks: there are more tasks than workers.
+void RunNested(void *arg) {
+  Nested *nested = static_cast<Nested*>(arg);
+  TaskGroup group(nested->pool);
+  for (int i = 0; i < 10; ++i)
+    group.Run(Increment, &nested->count);
+  group.Wait();
+}
+
+TEST(ThreadPoolTest, NestedGroups) {
+  ThreadPool pool(2, false);
+  std::vector<Nested> nested(20);
+  TaskGroup group(&pool);
+  for (size_t i = 0; i < nested.size(); ++i) {
+    nested[i].pool = &pool;
+    nested[i].count = 0;
+    group.Run(RunNested, &nested[i]);
+  }
+  group.Wait();
+  for (size_t i = 0; i < nested.size(); ++i)
+    EXPECT_EQ(10, nested[i].count) << i;
+}
+
+TEST(ThreadPoolTest, DestroyingGroupWaits) {
+  ThreadPool pool(2, false);
+  int count = 0;
+  {
+    TaskGroup group(&pool);
+    for (int i = 0; i < 100; ++i)
+      group.Run(Increment, &count);
+  }
+  EXPECT_EQ(100, count);
+}
+
+TEST(ThreadPoolTest, Default) {
+  ThreadPool *pool = ThreadPool::Default();
+  EXPECT_EQ(pool, ThreadPool::Default());
+  EXPECT_EQ(ThreadPool::DefaultThreads(), pool->Workers());
+  ExpectCovered(pool, 1000, pool->Parallelism());
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,152 @@
+#include "util/trace.h"
+
+#include <glog/logging.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "util/json_writer.h"
+#include "util/util.h"
+
+using std::string;
+
+namespace util {
+
+namespace {
+
+class ScopedLock {
+ public:
+  explicit ScopedLock(pthread_mutex_t *mutex) : mutex_(mutex) {
+    CHECK_EQ(0, pthread_mutex_lock(mutex_));
+  }
+
+  ~ScopedLock() { CHECK_EQ(0, pthread_mutex_unlock(mutex_)); }
+
+ private:
+  pthread_mutex_t *mutex_;
+};
+
+// The spans open in this thread, and whether their trace is sampled.
+__thread int span_depth = 0;
+__thread bool trace_sampled = false;
+
+// Numbers the threads for the trace, from 1, as they first record a span.
+__thread uint32_t thread_number = 0;
+uint32_t threads = 0;
+
+uint32_t ThreadNumber() {
+  if (thread_number == 0)
+    thread_number = __sync_add_and_fetch(&threads, 1);
+  return thread_number;
+}
+
+}  // namespace
+
+Tracer *Tracer::global_ = NULL;
+
+Tracer::Tracer(uint32_t sample_every, size_t max_spans)
+    : sample_every_(sample_every),
+      max_spans_(max_spans),
+      traces_(0),
+      next_(0) {
+  CHECK_GT(max_spans_, 0U);
+  CHECK_EQ(0, pthread_mutex_init(&mutex_, NULL));
+}
+
+Tracer::~Tracer() {
+  CHECK_EQ(0, pthread_mutex_destroy(&mutex_));
+}
+
+// static
+void Tracer::SetGlobal(Tracer *tracer) {
+  global_ = tracer;
+}
+
+bool Tracer::Sample() {
+  if (sample_every_ == 0)
+    return false;
+  return __sync_fetch_and_add(&traces_, 1) % sample_every_ == 0;
+}
+
+void Tracer::Add(const char *name, uint64_t start, uint64_t duration) {
+  Record record;
+  record.name = name;
+  record.start = start;
+  record.duration = duration;
+  record.thread = ThreadNumber();
+
+  ScopedLock lock(&mutex_);
+  if (spans_.size() < max_spans_) {
+    spans_.push_back(record);
+    return;
+  }
+  spans_[next_] = record;
+  next_ = (next_ + 1) % max_spans_;
+}
+
+size_t Tracer::SpanCount() const {
+  ScopedLock lock(&mutex_);
+  return spans_.size();
+}
+
+string Tracer::ExportChromeTrace() const {
+  std::vector<Record> spans;
+  {
+    ScopedLock lock(&mutex_);
+    spans.reserve(spans_.size());
+    spans.insert(spans.end(), spans_.begin() + next_, spans_.end());
+    spans.insert(spans.end(), spans_.begin(), spans_.begin() + next_);
+  }
+
+  string out;
+  JsonWriter json(&out);
+  json.BeginObject();
+  json.Key("traceEvents");
+  json.BeginArray();
+  const int64_t pid = getpid();
+  for (size_t i = 0; i < spans.size(); ++i) {
+    // Complete events, with their start and duration in microseconds.
+    json.BeginObject();
+    json.Key("name");
+    json.Add(spans[i].name);
+    json.Key("ph");
+    json.Add("X");
+    json.Key("ts");
+    json.Add(static_cast<int64_t>(spans[i].start));
+    json.Key("dur");
+    json.Add(static_cast<int64_t>(spans[i].duration));
+    json.Key("pid");
+    json.Add(pid);
+    json.Key("tid");
+    json.Add(static_cast<int64_t>(spans[i].thread));
+    json.EndObject();
+  }
+  json.EndArray();
+  json.Key("displayTimeUnit");
+  json.Add("ms");
+  json.EndObject();
+  return out;
+}
+
+Tracer::Span::Span(const char *name)
+    : tracer_(global_), recorded_(false), name_(name), start_(0) {
+  if (tracer_ == NULL)
+    return;
+  if (span_depth++ == 0)
+    trace_sampled = tracer_->Sample();
+  recorded_ = trace_sampled;
+  if (recorded_)
+    start_ = TimeInMicroseconds();
+}
+
+Tracer::Span::~Span() {
+  if (tracer_ == NULL)
+    return;
+  --span_depth;
+  if (recorded_)
+    tracer_->Add(name_, start_, TimeInMicroseconds() - start_);
+}
+
+}  // namespace util
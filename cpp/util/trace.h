@@ -0,0 +1,86 @@
+#ifndef UTIL_TRACE_H
+#define UTIL_TRACE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace util {
+
+// Records how long the steps of a piece of work take, as nested spans, and
+// exports them in the Chrome trace event format, which chrome://tracing
+// and Perfetto read. The outermost span open in a thread starts a trace,
+// and the spans inside it, in the same thread, are part of it; one in
+// every few traces is sampled, and only those are recorded.
+//
+// Spans record to the global tracer, so that code needs no tracer handed
+// down to it; without one they cost next to nothing.
+//
+//   Tracer::Span span("tree_signer.update");
+//
+// Thread-safe.
+class Tracer {
+ public:
+  // Records one trace in every |sample_every|, or none if it is 0, and
+  // keeps the last |max_spans| spans.
+  Tracer(uint32_t sample_every, size_t max_spans);
+  ~Tracer();
+
+  // Make |tracer|, which may be NULL, the one spans record to. Set it
+  // before any threads that trace start, and keep it while they run.
+  static void SetGlobal(Tracer *tracer);
+
+  // The recorded spans, in the order they ended, as a JSON trace object.
+  std::string ExportChromeTrace() const;
+
+  // The number of spans kept, for testing.
+  size_t SpanCount() const;
+
+  // Times its scope. |name| must outlive the tracer, e.g. be a literal.
+  class Span {
+   public:
+    explicit Span(const char *name);
+    ~Span();
+
+   private:
+    // The tracer, if the span counts towards the depth of the thread.
+    Tracer *tracer_;
+    // Whether the trace is sampled.
+    bool recorded_;
+    const char *const name_;
+    uint64_t start_;
+
+    // Private declarations without definitions, to disallow copying.
+    Span(const Span&);
+    Span &operator=(const Span&);
+  };
+
+ private:
+  struct Record {
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+    uint32_t thread;
+  };
+
+  // Whether to sample the next trace.
+  bool Sample();
+
+  void Add(const char *name, uint64_t start, uint64_t duration);
+
+  static Tracer *global_;
+
+  const uint32_t sample_every_;
+  const size_t max_spans_;
+  uint64_t traces_;
+  mutable pthread_mutex_t mutex_;
+  // A ring of the last |max_spans_| spans, of which |next_| is the oldest
+  // once it is full.
+  std::vector<Record> spans_;
+  size_t next_;
+};
+
+}  // namespace util
+
+#endif  // UTIL_TRACE_H
@@ -0,0 +1,87 @@
+#include "util/trace.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+#include "util/testing.h"
+
+namespace {
+
+using std::string;
+using util::Tracer;
+
+class TracerTest : public ::testing::Test {
+ protected:
+  ~TracerTest() { Tracer::SetGlobal(NULL); }
+};
+
+// A trace of a root span with two children.
+void Trace() {
+  Tracer::Span root("root");
+  {
+    Tracer::Span child("child");
+  }
+  Tracer::Span other("other");
+}
+
+TEST_F(TracerTest, NoTracer) {
+  // Spans without a tracer do nothing.
+  Trace();
+  Tracer tracer(1, 10);
+  EXPECT_EQ(0U, tracer.SpanCount());
+}
+
+TEST_F(TracerTest, RecordsNestedSpans) {
+  Tracer tracer(1, 10);
+  Tracer::SetGlobal(&tracer);
+  Trace();
+  EXPECT_EQ(3U, tracer.SpanCount());
+
+  const string trace = tracer.ExportChromeTrace();
+  EXPECT_EQ(0U, trace.find("{ \"traceEvents\": [ { \"name\": \"child\", "
+                           "\"ph\": \"X\", \"ts\": "));
+  // Spans are exported as they ended, each in a complete event.
+  const size_t child = trace.find("\"child\"");
+  const size_t other = trace.find("\"other\"");
+  const size_t root = trace.find("\"root\"");
+  EXPECT_LT(child, other);
+  EXPECT_LT(other, root);
+  EXPECT_NE(string::npos, root);
+  EXPECT_NE(string::npos, trace.find("\"tid\": "));
+  EXPECT_NE(string::npos, trace.find("\"displayTimeUnit\": \"ms\" }"));
+}
+
+TEST_F(TracerTest, SamplesWholeTraces) {
+  Tracer tracer(3, 100);
+  Tracer::SetGlobal(&tracer);
+  for (int i = 0; i < 9; ++i)
+    Trace();
+  // Traces 0, 3 and 6, with all their spans.
+  EXPECT_EQ(9U, tracer.SpanCount());
+
+  Tracer off(0, 100);
+  Tracer::SetGlobal(&off);
+  Trace();
+  EXPECT_EQ(0U, off.SpanCount());
+}
+
+TEST_F(TracerTest, KeepsLastSpans) {
+  Tracer tracer(1, 2);
+  Tracer::SetGlobal(&tracer);
+  {
+    Tracer::Span first("first");
+  }
+  Trace();
+  EXPECT_EQ(2U, tracer.SpanCount());
+  const string trace = tracer.ExportChromeTrace();
+  EXPECT_EQ(string::npos, trace.find("\"first\""));
+  EXPECT_EQ(string::npos, trace.find("\"child\""));
+  EXPECT_LT(trace.find("\"other\""), trace.find("\"root\""));
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -12,6 +12,7 @@
 #include <string>
 #include <sys/time.h>
 #include <unistd.h>
+#include <vector>
 
 using std::string;
 
@@ -20,6 +21,103 @@ namespace util {
 namespace {
 const char nibble[] = "0123456789abcdef";
 
+const char kBase64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Set in the tables below for characters that aren't base64 digits.
+const uint32_t kBadBase64 = 0x1000000;
+
+// Lookup tables for the codecs, so that they convert several bits at a
+// time rather than a digit at a time.
+struct Tables {
+  Tables() {
+    for (int i = 0; i < 256; ++i) {
+      hex_pairs[i][0] = nibble[i >> 4];
+      hex_pairs[i][1] = nibble[i & 0xf];
+    }
+    for (int i = 0; i < 4096; ++i) {
+      base64_pairs[i][0] = kBase64[i >> 6];
+      base64_pairs[i][1] = kBase64[i & 0x3f];
+    }
+    for (int place = 0; place < 4; ++place)
+      for (int c = 0; c < 256; ++c)
+        base64_values[place][c] = kBadBase64;
+    for (uint32_t value = 0; value < 64; ++value) {
+      const unsigned char c = kBase64[value];
+      for (int place = 0; place < 4; ++place)
+        base64_values[place][c] = value << (6 * (3 - place));
+    }
+  }
+
+  // The two hex digits of each byte.
+  char hex_pairs[256][2];
+  // The two base64 digits of each 12 bits.
+  char base64_pairs[4096][2];
+  // The value of each base64 digit, shifted to its place in a group of
+  // four: the bits of a group are the OR of its digits' entries.
+  uint32_t base64_values[4][256];
+};
+
+// Built on first use, so that static initializers elsewhere may convert.
+const Tables &GetTables() {
+  static const Tables tables;
+  return tables;
+}
+
+// The bits of the group of four base64 digits at |in|, or a value with
+// kBadBase64 set.
+uint32_t Base64Group(const Tables &tables, const unsigned char *in) {
+  return tables.base64_values[0][in[0]] | tables.base64_values[1][in[1]] |
+      tables.base64_values[2][in[2]] | tables.base64_values[3][in[3]];
+}
+
+// Decode canonical base64, without whitespace, as b64_pton would. Returns
+// false for anything else, which b64_pton has to have a look at.
+bool FastFromBase64(const char *b64, size_t size, char *out,
+                    size_t *out_size) {
+  if (size % 4 != 0)
+    return false;
+  const unsigned char *in = reinterpret_cast<const unsigned char*>(b64);
+  char *const start = out;
+  const Tables &tables = GetTables();
+  // All groups but the last, which may be padded.
+  const unsigned char *const last = in + (size == 0 ? 0 : size - 4);
+  for (; in < last; in += 4) {
+    const uint32_t bits = Base64Group(tables, in);
+    if (bits & kBadBase64)
+      return false;
+    out[0] = bits >> 16;
+    out[1] = bits >> 8;
+    out[2] = bits;
+    out += 3;
+  }
+  if (size > 0) {
+    unsigned char group[4] = { in[0], in[1], in[2], in[3] };
+    size_t bytes = 3;
+    if (group[3] == '=') {
+      group[3] = 'A';
+      bytes = 2;
+      if (group[2] == '=') {
+        group[2] = 'A';
+        bytes = 1;
+      }
+    }
+    const uint32_t bits = Base64Group(tables, group);
+    // b64_pton rejects set bits past the end, too.
+    const uint32_t extra = bytes == 3 ? 0 : bytes == 2 ? 0xff : 0xffff;
+    if ((bits & kBadBase64) || (bits & extra))
+      return false;
+    out[0] = bits >> 16;
+    if (bytes > 1)
+      out[1] = bits >> 8;
+    if (bytes > 2)
+      out[2] = bits;
+    out += bytes;
+  }
+  *out_size = out - start;
+  return true;
+}
+
 char ByteValue(char high, char low) {
   assert(('0' <= high && high <= '9') || ('a' <= high && high <= 'f'));
   assert(('0' <= high && high <= '9') || ('a' <= high && high <= 'f'));
@@ -38,14 +136,19 @@ char ByteValue(char high, char low) {
 }  // namespace
 
 string HexString(const string &data) {
-  string ret;
-  for (unsigned int i = 0; i < data.size(); ++i) {
-    ret.push_back(nibble[(data[i] >> 4) & 0xf]);
-    ret.push_back(nibble[data[i] & 0xf]);
-  }
+  string ret(2 * data.size(), '\0');
+  if (!data.empty())
+    HexString(data.data(), data.size(), &ret[0]);
   return ret;
 }
 
+void HexString(const char *data, size_t size, char *out) {
+  const unsigned char *in = reinterpret_cast<const unsigned char*>(data);
+  const Tables &tables = GetTables();
+  for (size_t i = 0; i < size; ++i, out += 2)
+    memcpy(out, tables.hex_pairs[in[i]], 2);
+}
+
 string HexString(const string &data, char byte_delimiter) {
   string ret;
   if (data.empty())
@@ -156,6 +259,13 @@ uint64_t TimeInMilliseconds() {
       static_cast<uint64_t>(tv.tv_usec) / 1000;
 }
 
+uint64_t TimeInMicroseconds() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return static_cast<uint64_t>(tv.tv_sec) * 1000000 +
+      static_cast<uint64_t>(tv.tv_usec);
+}
+
 string RandomString(size_t min_length, size_t max_length) {
   size_t length = min_length == max_length ? min_length
       : rand() % (max_length - min_length) + min_length;
@@ -168,28 +278,67 @@ string RandomString(size_t min_length, size_t max_length) {
 }
 
 string FromBase64(const char *b64) {
-  size_t length = strlen(b64);
-  // Lazy: base 64 encoding is always >= in length to decoded value
-  // (equality occurs for zero length).
-  u_char *buf = new u_char[length];
-  int rlength = b64_pton(b64, buf, length);
+  const size_t length = strlen(b64);
+  string ret(Base64DecodedMaxLength(length), '\0');
+  size_t size;
   // Treat decode errors as empty strings.
-  if (rlength < 0)
-      rlength = 0;
-  string ret(reinterpret_cast<char*>(buf), rlength);
-  delete[] buf;
+  if (ret.empty() || !FromBase64(b64, length, &ret[0], &size))
+    size = 0;
+  ret.resize(size);
   return ret;
 }
 
 string ToBase64(const string &from) {
-  // base 64 is 4 output bytes for every 3 input bytes (rounded up).
-  size_t length = ((from.size() + 2) / 3) * 4;
-  char *buf = new char[length + 1];
-  length = b64_ntop((const u_char *)from.data(), from.length(), buf,
-                    length + 1);
-  string ret(buf, length);
-  delete[] buf;
+  string ret(Base64EncodedLength(from.size()), '\0');
+  if (!ret.empty())
+    ToBase64(from.data(), from.size(), &ret[0]);
   return ret;
 }
 
+size_t Base64EncodedLength(size_t size) {
+  // base 64 is 4 output bytes for every 3 input bytes (rounded up).
+  return ((size + 2) / 3) * 4;
+}
+
+size_t ToBase64(const char *data, size_t size, char *out) {
+  const unsigned char *in = reinterpret_cast<const unsigned char*>(data);
+  char *const start = out;
+  const Tables &tables = GetTables();
+  for (; size >= 3; size -= 3, in += 3, out += 4) {
+    const uint32_t bits = (in[0] << 16) | (in[1] << 8) | in[2];
+    memcpy(out, tables.base64_pairs[bits >> 12], 2);
+    memcpy(out + 2, tables.base64_pairs[bits & 0xfff], 2);
+  }
+  if (size > 0) {
+    const uint32_t bits = (in[0] << 16) | (size > 1 ? in[1] << 8 : 0);
+    out[0] = kBase64[bits >> 18];
+    out[1] = kBase64[(bits >> 12) & 0x3f];
+    out[2] = size > 1 ? kBase64[(bits >> 6) & 0x3f] : '=';
+    out[3] = '=';
+    out += 4;
+  }
+  return out - start;
+}
+
+size_t Base64DecodedMaxLength(size_t size) {
+  return (size / 4) * 3;
+}
+
+bool FromBase64(const char *b64, size_t size, char *out, size_t *out_size) {
+  if (FastFromBase64(b64, size, out, out_size))
+    return true;
+
+  // Whitespace, or bad base64: let b64_pton sort it out. It wants a
+  // terminated string, and as much room as it had before.
+  const string terminated(b64, size);
+  std::vector<u_char> buf(size + 1);
+  const int length = b64_pton(terminated.c_str(), &buf[0], buf.size());
+  if (length < 0)
+    return false;
+  assert(static_cast<size_t>(length) <= Base64DecodedMaxLength(size));
+  memcpy(out, &buf[0], length);
+  *out_size = length;
+  return true;
+}
+
 }  // namespace util
@@ -3,6 +3,7 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <string>
 
@@ -10,6 +11,10 @@ namespace util {
 
 std::string HexString(const std::string &data);
 
+// Write the |size| bytes of |data| in hex to |out|, which must have room
+// for 2 * |size| characters.
+void HexString(const char *data, size_t size, char *out);
+
 std::string HexString(const std::string &data, char byte_delimiter);
 
 std::string BinaryString(const std::string &hex_string);
@@ -29,6 +34,8 @@ std::string CreateTemporaryDirectory(const std::string &dir_template);
 
 uint64_t TimeInMilliseconds();
 
+uint64_t TimeInMicroseconds();
+
 // Return a non-cryptographic random string. Caller needs to ensure
 // srand() is called if needed.
 std::string RandomString(size_t min_length, size_t max_length);
@@ -37,6 +44,24 @@ std::string FromBase64(const char *b64);
 
 std::string ToBase64(const std::string &from);
 
+// The codecs below write into |out| rather than growing a string, for
+// the paths that convert a lot.
+
+// The length of the base64 of |size| bytes.
+size_t Base64EncodedLength(size_t size);
+
+// Write the base64 of the |size| bytes of |data| to |out|, which must
+// have room for Base64EncodedLength(|size|) characters. Returns that.
+size_t ToBase64(const char *data, size_t size, char *out);
+
+// The most bytes that |size| characters of base64 decode to.
+size_t Base64DecodedMaxLength(size_t size);
+
+// Decode the |size| characters of |b64| to |out|, which must have room
+// for Base64DecodedMaxLength(|size|) bytes, and set |out_size|. Returns
+// false on bad base64, which FromBase64() treats as empty.
+bool FromBase64(const char *b64, size_t size, char *out, size_t *out_size);
+
 }  // namespace util
 
 #endif  // ndef UTIL_H
@@ -0,0 +1,102 @@
+#include "util/util.h"
+
+#include <gtest/gtest.h>
+#include <netinet/in.h>  // for resolv.h
+#include <resolv.h>  // for b64_ntop
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "util/testing.h"
+
+namespace {
+
+using std::string;
+
+// What b64_pton makes of |b64|, or "error".
+string ReferenceFromBase64(const string &b64) {
+  std::vector<u_char> buf(b64.size() + 1);
+  const int length = b64_pton(b64.c_str(), &buf[0], buf.size());
+  if (length < 0)
+    return "error";
+  return string(reinterpret_cast<char*>(&buf[0]), length);
+}
+
+// What FromBase64 makes of the buffer |b64|, or "error".
+string BufferFromBase64(const string &b64) {
+  std::vector<char> buf(util::Base64DecodedMaxLength(b64.size()) + 1);
+  size_t size;
+  if (!util::FromBase64(b64.data(), b64.size(), &buf[0], &size))
+    return "error";
+  EXPECT_LE(size, util::Base64DecodedMaxLength(b64.size()));
+  return string(&buf[0], size);
+}
+
+TEST(UtilTest, HexString) {
+  EXPECT_EQ("", util::HexString(""));
+  EXPECT_EQ("00017f80ff", util::HexString(string("\x00\x01\x7f\x80\xff", 5)));
+  EXPECT_EQ("00:ff", util::HexString(string("\x00\xff", 2), ':'));
+
+  for (int i = 0; i < 100; ++i) {
+    const string data = util::RandomString(0, 100);
+    EXPECT_EQ(data, util::BinaryString(util::HexString(data)));
+  }
+}
+
+TEST(UtilTest, ToBase64) {
+  // From RFC 4648.
+  EXPECT_EQ("", util::ToBase64(""));
+  EXPECT_EQ("Zg==", util::ToBase64("f"));
+  EXPECT_EQ("Zm8=", util::ToBase64("fo"));
+  EXPECT_EQ("Zm9v", util::ToBase64("foo"));
+  EXPECT_EQ("Zm9vYg==", util::ToBase64("foob"));
+  EXPECT_EQ("Zm9vYmE=", util::ToBase64("fooba"));
+  EXPECT_EQ("Zm9vYmFy", util::ToBase64("foobar"));
+
+  for (int i = 0; i < 100; ++i) {
+    const string data = util::RandomString(0, 100);
+    std::vector<char> buf(util::Base64EncodedLength(data.size()) + 1);
+    ASSERT_NE(-1, b64_ntop(reinterpret_cast<const u_char*>(data.data()),
+                           data.size(), &buf[0], buf.size()));
+    EXPECT_EQ(string(&buf[0]), util::ToBase64(data));
+  }
+}
+
+TEST(UtilTest, FromBase64) {
+  EXPECT_EQ("", util::FromBase64(""));
+  EXPECT_EQ("f", util::FromBase64("Zg=="));
+  EXPECT_EQ("fo", util::FromBase64("Zm8="));
+  EXPECT_EQ("foobar", util::FromBase64("Zm9vYmFy"));
+  // Whitespace is skipped.
+  EXPECT_EQ("foobar", util::FromBase64(" Zm9v\nYmFy "));
+  // Errors decode to nothing.
+  EXPECT_EQ("", util::FromBase64("Zm9"));
+  EXPECT_EQ("", util::FromBase64("Zm9v!"));
+  // Set bits past the end.
+  EXPECT_EQ("", util::FromBase64("Zh=="));
+
+  for (int i = 0; i < 100; ++i) {
+    const string data = util::RandomString(0, 100);
+    EXPECT_EQ(data, util::FromBase64(util::ToBase64(data).c_str()));
+  }
+}
+
+// The buffer decoder takes just what b64_pton takes.
+TEST(UtilTest, FromBase64MatchesReference) {
+  const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+      "0123456789+/= \n!";
+  for (int i = 0; i < 10000; ++i) {
+    string b64 = util::ToBase64(util::RandomString(0, 20));
+    // Spoil some.
+    if (!b64.empty() && rand() % 2 == 0)
+      b64[rand() % b64.size()] = digits[rand() % (sizeof(digits) - 1)];
+    EXPECT_EQ(ReferenceFromBase64(b64), BufferFromBase64(b64)) << b64;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ct::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -40,6 +40,15 @@ func (m *CPPMerkleTree) AddLeafHash(hash []byte) uint64 {
 	return uint64(C.AddLeafHash(m.peer, C.BYTE_SLICE(&hash)))
 }
 
+// AddLeafHashes adds the leaf hashes stored back to back in |hashes| to the
+// tree with a single call into C++, and returns the new leaf count.
+func (m *CPPMerkleTree) AddLeafHashes(hashes []byte) (uint64, error) {
+	if len(hashes)%int(m.nodeSize) != 0 {
+		return 0, fmt.Errorf("hashes len %d is not a multiple of node size %d", len(hashes), m.nodeSize)
+	}
+	return uint64(C.AddLeafHashes(m.peer, C.BYTE_SLICE(&hashes))), nil
+}
+
 func (m *CPPMerkleTree) LeafHash(leaf uint64) ([]byte, error) {
 	hash := make([]byte, m.nodeSize)
 	success := C.LeafHash(m.peer, C.BYTE_SLICE(&hash), C.size_t(leaf))
@@ -76,6 +76,15 @@ size_t AddLeafHash(TREE tree, BYTE_SLICE hash) {
       std::string(static_cast<char*>(slice->data), slice->len));
 }
 
+size_t AddLeafHashes(TREE tree, BYTE_SLICE hashes) {
+  GoSlice* slice(BS(hashes));
+  MerkleTree* t(MT(tree));
+  const size_t nodesize(t->NodeSize());
+  CHECK_EQ(0U, slice->len % nodesize);
+  return t->AddLeafHashes(static_cast<char*>(slice->data),
+                          slice->len / nodesize, 1);
+}
+
 bool CurrentRoot(TREE tree, BYTE_SLICE out) {
   GoSlice* slice(BS(out));
   MerkleTree *t(MT(tree));
@@ -46,6 +46,11 @@ bool LeafHash(TREE tree, BYTE_SLICE out, size_t leaf);
 size_t LevelCount(TREE tree);
 size_t AddLeaf(TREE tree, BYTE_SLICE leaf);
 size_t AddLeafHash(TREE tree, BYTE_SLICE hash);
+
+// Adds all of the leaf hashes stored back to back in |hashes|, whose length
+// must be a multiple of NodeSize(), in one call.
+// Returns the new leaf count.
+size_t AddLeafHashes(TREE tree, BYTE_SLICE hashes);
 bool CurrentRoot(TREE tree, BYTE_SLICE out);
 bool RootAtSnapshot(TREE tree, BYTE_SLICE out, size_t snapshot);
 
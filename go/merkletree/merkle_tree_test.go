@@ -166,3 +166,49 @@ func TestAddLeafHash(t *testing.T) {
 		t.Fatalf("Added leafhash:\n%v\nGot:\n%v", hex.Dump([]byte(hashValue)), hex.Dump(gotHash))
 	}
 }
+
+func TestAddLeafHashes(t *testing.T) {
+	hashes := [][]byte{
+		[]byte("0123456789abcdef0123456789abcdef"),
+		[]byte("fedcba9876543210fedcba9876543210"),
+		[]byte("00112233445566778899aabbccddeeff")}
+	m := NewCPPMerkleTree()
+	defer m.DeletePeer()
+	single := NewCPPMerkleTree()
+	defer single.DeletePeer()
+	for _, h := range hashes {
+		single.AddLeafHash(h)
+	}
+
+	count, err := m.AddLeafHashes(bytes.Join(hashes, nil))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if count != uint64(len(hashes)) {
+		t.Fatalf("Expected leaf count of %d, got %d", len(hashes), count)
+	}
+	for i, h := range hashes {
+		gotHash, err := m.LeafHash(uint64(i + 1))
+		if err != nil {
+			t.Fatal(err)
+		}
+		if bytes.Compare(h, gotHash) != 0 {
+			t.Fatalf("Added leafhash:\n%v\nGot:\n%v", hex.Dump(h), hex.Dump(gotHash))
+		}
+	}
+	root, err := m.CurrentRoot()
+	if err != nil {
+		t.Fatal(err)
+	}
+	expectedRoot, err := single.CurrentRoot()
+	if err != nil {
+		t.Fatal(err)
+	}
+	if bytes.Compare(expectedRoot, root) != 0 {
+		t.Fatalf("Expected root:\n%v\nGot:\n%v", hex.Dump(expectedRoot), hex.Dump(root))
+	}
+
+	if _, err := m.AddLeafHashes([]byte("short")); err == nil {
+		t.Fatal("AddLeafHashes accepted a partial hash")
+	}
+}